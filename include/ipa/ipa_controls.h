@@ -11,7 +11,9 @@
 extern "C" {
 #endif
 
-#define IPA_CONTROLS_FORMAT_VERSION	1
+#define IPA_CONTROLS_FORMAT_VERSION	3
+
+#define IPA_CONTROLS_FLAG_DELTA		(1 << 0)
 
 struct ipa_controls_header {
 	uint32_t version;
@@ -19,12 +21,16 @@ struct ipa_controls_header {
 	uint32_t entries;
 	uint32_t size;
 	uint32_t data_offset;
-	uint32_t reserved[3];
+	uint32_t flags;
+	uint32_t sequence;
+	uint32_t reserved[1];
 };
 
 struct ipa_control_value_entry {
 	uint32_t id;
-	uint32_t type;
+	uint8_t type;
+	uint8_t is_array;
+	uint16_t reserved;
 	uint32_t count;
 	uint32_t offset;
 };
@@ -38,8 +44,10 @@ struct ipa_control_range_entry {
 
 union ipa_control_value_data {
 	bool b;
+	uint8_t u8;
 	int32_t i32;
 	int64_t i64;
+	float f;
 };
 
 struct ipa_control_range_data {
@@ -0,0 +1,30 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * simple.h - Image Processing Algorithm interface for the simple pipeline
+ */
+#ifndef __LIBCAMERA_IPA_INTERFACE_SIMPLE_H__
+#define __LIBCAMERA_IPA_INTERFACE_SIMPLE_H__
+
+/*
+ * The statistics event carries the frame number, the mean red, green and blue
+ * raw values on a 16-bit scale, and the luminance grid of SoftwareIspStats,
+ * one zone per element.
+ *
+ * The YUV statistics event is sent for YUV captures, processed without the
+ * software ISP. It carries the frame number, the mean luma, Cb and Cr grids of
+ * YuvStats, in that order with one zone per element, and the 64 bins of the
+ * luma histogram. The values are gamma-encoded as captured.
+ *
+ * The ISP parameters action carries the black level on a 16-bit scale, and
+ * the red, green and blue gains in U8.8 fixed point.
+ */
+enum SimpleOperations {
+	SIMPLE_IPA_ACTION_V4L2_SET = 1,
+	SIMPLE_IPA_ACTION_ISP_PARAMS = 2,
+	SIMPLE_IPA_EVENT_STATS = 3,
+	SIMPLE_IPA_EVENT_YUV_STATS = 4,
+};
+
+#endif /* __LIBCAMERA_IPA_INTERFACE_SIMPLE_H__ */
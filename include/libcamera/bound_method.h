@@ -8,33 +8,90 @@
 #define __LIBCAMERA_BOUND_METHOD_H__
 
 #include <memory>
+#include <stddef.h>
 #include <tuple>
 #include <type_traits>
 #include <utility>
 
 namespace libcamera {
 
+class InvokeMessage;
 class Object;
+template<typename... Args>
+class Signal;
 
 enum ConnectionType {
 	ConnectionTypeAuto,
 	ConnectionTypeDirect,
 	ConnectionTypeQueued,
 	ConnectionTypeBlocking,
+	ConnectionTypeConflated,
+};
+
+enum MessagePriority {
+	MessagePriorityNormal,
+	MessagePriorityRealtime,
+};
+
+class MessagePool
+{
+public:
+	static void *allocate(std::size_t size);
+	static void release(void *ptr);
 };
 
+template<typename T>
+class MessagePoolAllocator
+{
+public:
+	using value_type = T;
+
+	MessagePoolAllocator() = default;
+	template<typename U>
+	MessagePoolAllocator(const MessagePoolAllocator<U> &) {}
+
+	T *allocate(std::size_t n)
+	{
+		return static_cast<T *>(MessagePool::allocate(n * sizeof(T)));
+	}
+
+	void deallocate(T *ptr, std::size_t)
+	{
+		MessagePool::release(ptr);
+	}
+};
+
+template<typename T, typename U>
+bool operator==(const MessagePoolAllocator<T> &, const MessagePoolAllocator<U> &)
+{
+	return true;
+}
+
+template<typename T, typename U>
+bool operator!=(const MessagePoolAllocator<T> &, const MessagePoolAllocator<U> &)
+{
+	return false;
+}
+
 class BoundMethodPackBase
 {
 public:
+	BoundMethodPackBase()
+		: shared_(false)
+	{
+	}
 	virtual ~BoundMethodPackBase() {}
+
+	bool shared_;
 };
 
 template<typename R, typename... Args>
 class BoundMethodPack : public BoundMethodPackBase
 {
 public:
-	BoundMethodPack(const Args &... args)
-		: args_(args...)
+	template<typename... Ts>
+	BoundMethodPack(Ts &&... args)
+		: args_(std::forward<Ts>(args)...)
 	{
 	}
 
@@ -46,8 +103,9 @@ template<typename... Args>
 class BoundMethodPack<void, Args...> : public BoundMethodPackBase
 {
 public:
-	BoundMethodPack(const Args &... args)
-		: args_(args...)
+	template<typename... Ts>
+	BoundMethodPack(Ts &&... args)
+		: args_(std::forward<Ts>(args)...)
 	{
 	}
 
@@ -57,21 +115,32 @@ public:
 class BoundMethodBase
 {
 public:
-	BoundMethodBase(void *obj, Object *object, ConnectionType type)
-		: obj_(obj), object_(object), connectionType_(type)
+	BoundMethodBase(void *obj, Object *object, ConnectionType type,
+			MessagePriority priority = MessagePriorityNormal)
+		: obj_(obj), object_(object), connectionType_(type),
+		  priority_(priority), disconnected_(false)
 	{
 	}
 	virtual ~BoundMethodBase() {}
 
+	static void *operator new(std::size_t size) { return MessagePool::allocate(size); }
+	static void operator delete(void *ptr) { MessagePool::release(ptr); }
+
 	template<typename T, typename std::enable_if<!std::is_same<Object, T>::value>::type * = nullptr>
 	bool match(T *obj) { return obj == obj_; }
 	bool match(Object *object) { return object == object_; }
 
 	Object *object() const { return object_; }
+	bool disconnected() const { return disconnected_; }
 
 	virtual void invokePack(BoundMethodPackBase *pack) = 0;
 
 protected:
+	friend class InvokeMessage;
+	friend class SignalBase;
+	template<typename... Args>
+	friend class Signal;
+
 	bool activatePack(std::shared_ptr<BoundMethodPackBase> pack,
 			  bool deleteMethod);
 
@@ -80,6 +149,9 @@ protected:
 
 private:
 	ConnectionType connectionType_;
+	MessagePriority priority_;
+	std::shared_ptr<BoundMethodPackBase> conflatedPack_;
+	bool disconnected_;
 };
 
 template<typename R, typename... Args>
@@ -93,12 +165,18 @@ private:
 	void invokePack(BoundMethodPackBase *pack, std::index_sequence<I...>)
 	{
 		PackType *args = static_cast<PackType *>(pack);
-		args->ret_ = invoke(std::get<I>(args->args_)...);
+
+		/* Move arguments out of the pack unless it's shared. */
+		if (args->shared_)
+			args->ret_ = invoke(std::get<I>(args->args_)...);
+		else
+			args->ret_ = invoke(std::forward<Args>(std::get<I>(args->args_))...);
 	}
 
 public:
-	BoundMethodArgs(void *obj, Object *object, ConnectionType type)
-		: BoundMethodBase(obj, object, type) {}
+	BoundMethodArgs(void *obj, Object *object, ConnectionType type,
+			MessagePriority priority = MessagePriorityNormal)
+		: BoundMethodBase(obj, object, type, priority) {}
 
 	void invokePack(BoundMethodPackBase *pack) override
 	{
@@ -121,12 +199,18 @@ private:
 	{
 		/* args is effectively unused when the sequence I is empty. */
 		PackType *args [[gnu::unused]] = static_cast<PackType *>(pack);
-		invoke(std::get<I>(args->args_)...);
+
+		/* Move arguments out of the pack unless it's shared. */
+		if (args->shared_)
+			invoke(std::get<I>(args->args_)...);
+		else
+			invoke(std::forward<Args>(std::get<I>(args->args_))...);
 	}
 
 public:
-	BoundMethodArgs(void *obj, Object *object, ConnectionType type)
-		: BoundMethodBase(obj, object, type) {}
+	BoundMethodArgs(void *obj, Object *object, ConnectionType type,
+			MessagePriority priority = MessagePriorityNormal)
+		: BoundMethodBase(obj, object, type, priority) {}
 
 	void invokePack(BoundMethodPackBase *pack) override
 	{
@@ -144,8 +228,10 @@ public:
 	using PackType = typename BoundMethodArgs<R, Args...>::PackType;
 
 	BoundMethodMember(T *obj, Object *object, R (T::*func)(Args...),
-			  ConnectionType type = ConnectionTypeAuto)
-		: BoundMethodArgs<R, Args...>(obj, object, type), func_(func)
+			  ConnectionType type = ConnectionTypeAuto,
+			  MessagePriority priority = MessagePriorityNormal)
+		: BoundMethodArgs<R, Args...>(obj, object, type, priority),
+		  func_(func)
 	{
 	}
 
@@ -154,16 +240,17 @@ public:
 	R activate(Args... args, bool deleteMethod = false) override
 	{
 		if (!this->object_)
-			return (static_cast<T *>(this->obj_)->*func_)(args...);
+			return (static_cast<T *>(this->obj_)->*func_)(std::forward<Args>(args)...);
 
-		auto pack = std::make_shared<PackType>(args...);
+		auto pack = std::allocate_shared<PackType>(MessagePoolAllocator<PackType>(),
+							   std::forward<Args>(args)...);
 		bool sync = BoundMethodBase::activatePack(pack, deleteMethod);
 		return sync ? pack->ret_ : R();
 	}
 
 	R invoke(Args... args) override
 	{
-		return (static_cast<T *>(this->obj_)->*func_)(args...);
+		return (static_cast<T *>(this->obj_)->*func_)(std::forward<Args>(args)...);
 	}
 
 private:
@@ -177,8 +264,10 @@ public:
 	using PackType = typename BoundMethodArgs<void *, Args...>::PackType;
 
 	BoundMethodMember(T *obj, Object *object, void (T::*func)(Args...),
-			  ConnectionType type = ConnectionTypeAuto)
-		: BoundMethodArgs<void, Args...>(obj, object, type), func_(func)
+			  ConnectionType type = ConnectionTypeAuto,
+			  MessagePriority priority = MessagePriorityNormal)
+		: BoundMethodArgs<void, Args...>(obj, object, type, priority),
+		  func_(func)
 	{
 	}
 
@@ -187,15 +276,16 @@ public:
 	void activate(Args... args, bool deleteMethod = false) override
 	{
 		if (!this->object_)
-			return (static_cast<T *>(this->obj_)->*func_)(args...);
+			return (static_cast<T *>(this->obj_)->*func_)(std::forward<Args>(args)...);
 
-		auto pack = std::make_shared<PackType>(args...);
+		auto pack = std::allocate_shared<PackType>(MessagePoolAllocator<PackType>(),
+							   std::forward<Args>(args)...);
 		BoundMethodBase::activatePack(pack, deleteMethod);
 	}
 
 	void invoke(Args... args) override
 	{
-		(static_cast<T *>(this->obj_)->*func_)(args...);
+		(static_cast<T *>(this->obj_)->*func_)(std::forward<Args>(args)...);
 	}
 
 private:
@@ -216,7 +306,7 @@ public:
 
 	R activate(Args... args, bool deleteMethod = false) override
 	{
-		return (*func_)(args...);
+		return (*func_)(std::forward<Args>(args)...);
 	}
 
 	R invoke(Args...) override
@@ -7,20 +7,27 @@
 #ifndef __LIBCAMERA_BUFFER_H__
 #define __LIBCAMERA_BUFFER_H__
 
+#include <array>
 #include <stdint.h>
 #include <vector>
 
 #include <libcamera/file_descriptor.h>
+#include <libcamera/signal.h>
+#include <libcamera/span.h>
 
 namespace libcamera {
 
 class Request;
 
+/* Maximum number of planes in a frame, matching V4L2's VIDEO_MAX_PLANES. */
+static constexpr unsigned int FrameMaxPlanes = 8;
+
 struct FrameMetadata {
 	enum Status {
 		FrameSuccess,
 		FrameError,
 		FrameCancelled,
+		FrameSkipped,
 	};
 
 	struct Plane {
@@ -30,7 +37,16 @@ struct FrameMetadata {
 	Status status;
 	unsigned int sequence;
 	uint64_t timestamp;
-	std::vector<Plane> planes;
+
+	Span<Plane> planes() { return { planes_.data(), numPlanes_ }; }
+	Span<const Plane> planes() const { return { planes_.data(), numPlanes_ }; }
+
+private:
+	friend class BufferMetadata; /* Needed to update numPlanes_. */
+	friend class V4L2VideoDevice; /* Needed to update planes_. */
+
+	unsigned int numPlanes_ = 0;
+	std::array<Plane, FrameMaxPlanes> planes_;
 };
 
 class FrameBuffer final
@@ -39,9 +55,24 @@ public:
 	struct Plane {
 		FileDescriptor fd;
 		unsigned int length;
+		void *address = nullptr;
+	};
+
+	enum Memory {
+		MemoryDmaBuf,
+		MemoryUserPtr,
+		MemoryMmap,
+	};
+
+	enum CpuAccess {
+		CpuAccessNone = 0,
+		CpuAccessRead = (1 << 0),
+		CpuAccessWrite = (1 << 1),
+		CpuAccessReadWrite = CpuAccessRead | CpuAccessWrite,
 	};
 
 	FrameBuffer(const std::vector<Plane> &planes, unsigned int cookie = 0);
+	~FrameBuffer();
 
 	FrameBuffer(const FrameBuffer &) = delete;
 	FrameBuffer(FrameBuffer &&) = delete;
@@ -49,7 +80,8 @@ public:
 	FrameBuffer &operator=(const FrameBuffer &) = delete;
 	FrameBuffer &operator=(FrameBuffer &&) = delete;
 
-	const std::vector<Plane> &planes() const { return planes_; }
+	Span<const Plane> planes() const { return { planes_.data(), numPlanes_ }; }
+	Memory memory() const { return memory_; }
 
 	Request *request() const { return request_; }
 	const FrameMetadata &metadata() const { return metadata_; };
@@ -57,11 +89,17 @@ public:
 	unsigned int cookie() const { return cookie_; }
 	void setCookie(unsigned int cookie) { cookie_ = cookie; }
 
+	/* Mutable to let users of const buffers track their lifetime. */
+	mutable Signal<const FrameBuffer *> destroyed;
+
 private:
+	friend class BufferMetadata; /* Needed to update metadata_. */
 	friend class Request; /* Needed to update request_. */
-	friend class V4L2VideoDevice; /* Needed to update metadata_. */
+	friend class V4L2VideoDevice; /* Needed to update metadata_ and memory_. */
 
-	std::vector<Plane> planes_;
+	unsigned int numPlanes_;
+	std::array<Plane, FrameMaxPlanes> planes_;
+	Memory memory_;
 
 	Request *request_;
 	FrameMetadata metadata_;
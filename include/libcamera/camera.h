@@ -7,18 +7,26 @@
 #ifndef __LIBCAMERA_CAMERA_H__
 #define __LIBCAMERA_CAMERA_H__
 
+#include <array>
+#include <functional>
 #include <memory>
 #include <set>
 #include <stdint.h>
 #include <string>
+#include <type_traits>
+#include <vector>
 
+#include <libcamera/bound_method.h>
 #include <libcamera/controls.h>
+#include <libcamera/object.h>
 #include <libcamera/request.h>
 #include <libcamera/signal.h>
+#include <libcamera/span.h>
 #include <libcamera/stream.h>
 
 namespace libcamera {
 
+class ControlValidator;
 class FrameBuffer;
 class FrameBufferAllocator;
 class PipelineHandler;
@@ -60,15 +68,94 @@ public:
 	bool empty() const;
 	std::size_t size() const;
 
+	uint64_t minFrameDuration;
+	uint64_t maxFrameDuration;
+
 protected:
 	CameraConfiguration();
 
 	std::vector<StreamConfiguration> config_;
 };
 
+class CameraStatistics
+{
+public:
+	static constexpr unsigned int LatencyBuckets = 16;
+
+	enum CpuComponent {
+		CpuEvents,
+		CpuPipeline,
+		CpuIPA,
+		CpuSerialization,
+		CpuLogging,
+		CpuApplication,
+		CpuComponents,
+	};
+
+	CameraStatistics();
+
+	uint64_t cpuTimePerFrame(CpuComponent component) const;
+
+	uint64_t framesCaptured;
+	uint64_t framesDelivered;
+	uint64_t framesDroppedNoRequest;
+	uint64_t framesDroppedKernel;
+	uint64_t requestsCancelled;
+	uint64_t idlePauses;
+	uint64_t resumeLatency;
+	uint64_t resumeLatencyMax;
+	uint64_t statisticsSkipped;
+
+	std::array<uint64_t, LatencyBuckets> latency;
+	std::array<uint64_t, CpuComponents> cpuTime;
+};
+
+class BufferPoolUsage
+{
+public:
+	enum Type {
+		Exported,
+		Imported,
+		Internal,
+	};
+
+	BufferPoolUsage(Type type, const Stream *stream,
+			const std::string &name = {});
+
+	void add(const FrameBuffer *buffer);
+	void add(const std::vector<std::unique_ptr<FrameBuffer>> &buffers);
+
+	Type type;
+	const Stream *stream;
+	std::string name;
+
+	unsigned int buffers;
+	uint64_t bytes;
+};
+
+class CameraStall
+{
+public:
+	struct Device {
+		std::string name;
+		unsigned int queuedBuffers;
+	};
+
+	CameraStall();
+
+	uint64_t elapsed;
+	std::vector<Device> devices;
+	bool recovered;
+};
+
 class Camera final : public std::enable_shared_from_this<Camera>
 {
 public:
+	enum CompletionOrder {
+		QueueOrder,
+		StreamOrder,
+	};
+
 	static std::shared_ptr<Camera> create(PipelineHandler *pipe,
 					      const std::string &name,
 					      const std::set<Stream *> &streams);
@@ -80,7 +167,11 @@ public:
 
 	Signal<Request *, FrameBuffer *> bufferCompleted;
 	Signal<Request *> requestCompleted;
+	Signal<Camera *> requestQueueAvailable;
 	Signal<Camera *> disconnected;
+	Signal<Camera *, const CameraStall &> stalled;
+	Signal<Camera *, int> configureCompleted;
+	Signal<Camera *, int> startCompleted;
 
 	int acquire();
 	int release();
@@ -90,29 +181,79 @@ public:
 	const std::set<Stream *> &streams() const;
 	std::unique_ptr<CameraConfiguration> generateConfiguration(const StreamRoles &roles);
 	int configure(CameraConfiguration *config);
+	int configureAsync(CameraConfiguration *config);
+
+	int setMetadataFilter(const std::vector<const ControlId *> &ids);
+	int clearMetadataFilter();
 
-	Request *createRequest(uint64_t cookie = 0);
+	std::unique_ptr<Request> createRequest(uint64_t cookie = 0);
 	int queueRequest(Request *request);
+	int queueRequests(Span<Request *const> requests);
+	int releaseRequest(Request *request);
+
+#ifndef __DOXYGEN__
+	template<typename T, typename std::enable_if<std::is_base_of<Object, T>::value>::type * = nullptr>
+#else
+	template<typename T>
+#endif
+	int queueRequest(Request *request, T *receiver,
+			 void (T::*func)(Request *))
+	{
+		return queueRequest(request,
+				    new BoundMethodMember<T, void, Request *>(receiver, receiver, func));
+	}
+
+	int setCompletionOrder(CompletionOrder order);
+	CompletionOrder completionOrder() const;
+
+	int setLatestFrames(unsigned int spares);
+	unsigned int latestFrames() const;
 
 	int start();
+	int startAsync();
 	int stop();
 
+	CameraStatistics statistics() const;
+	std::vector<BufferPoolUsage> bufferUsage() const;
+
 private:
 	Camera(PipelineHandler *pipe, const std::string &name,
 	       const std::set<Stream *> &streams);
 	~Camera();
 
+	friend class CameraGroup;
+	int queueRequest(Request *request,
+			 BoundMethodArgs<void, Request *> *completion);
+	int createSpareRequests();
+	int doConfigure(CameraConfiguration *config);
+	int doStart();
+	int runAsync(std::function<int(Camera *)> operation,
+		     Signal<Camera *, int> *completed);
+
 	class Private;
 	std::unique_ptr<Private> p_;
 
 	friend class PipelineHandler;
 	void disconnect();
 	void requestComplete(Request *request);
+	Request *takeSubmittedRequests(bool close);
+	void idlePaused();
+	void idleResumed(uint64_t latency);
+	void statisticsSkipped();
+
+	friend class CpuScope;
+	void accountCpuTime(const std::array<uint64_t, CameraStatistics::CpuComponents> &times);
+
+	friend class Request;
+	ControlValidator *validator() const;
 
 	friend class FrameBufferAllocator;
-	int exportFrameBuffers(Stream *stream,
+	int exportFrameBuffers(Stream *stream, FrameBuffer::CpuAccess cpuAccess,
 			       std::vector<std::unique_ptr<FrameBuffer>> *buffers);
+	int importFrameBuffers(Stream *stream);
 	int freeFrameBuffers(Stream *stream);
+	int addFrameBuffers(Stream *stream, unsigned int count,
+			    std::vector<std::unique_ptr<FrameBuffer>> *buffers);
 	/* \todo Remove allocator_ from the exposed API */
 	FrameBufferAllocator *allocator_;
 };
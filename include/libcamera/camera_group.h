@@ -0,0 +1,62 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * camera_group.h - Synchronised capture from multiple cameras
+ */
+#ifndef __LIBCAMERA_CAMERA_GROUP_H__
+#define __LIBCAMERA_CAMERA_GROUP_H__
+
+#include <chrono>
+#include <deque>
+#include <map>
+#include <memory>
+#include <vector>
+
+#include <libcamera/object.h>
+#include <libcamera/signal.h>
+
+namespace libcamera {
+
+class Camera;
+class Request;
+
+class CameraGroup : public Object
+{
+public:
+	CameraGroup(const std::vector<std::shared_ptr<Camera>> &cameras);
+	~CameraGroup();
+
+	CameraGroup(const CameraGroup &) = delete;
+	CameraGroup &operator=(const CameraGroup &) = delete;
+
+	const std::vector<std::shared_ptr<Camera>> &cameras() const { return cameras_; }
+
+	void setTolerance(std::chrono::nanoseconds tolerance);
+	std::chrono::nanoseconds tolerance() const { return tolerance_; }
+
+	int start();
+	int stop();
+
+	int queueRequests(const std::vector<Request *> &requests);
+
+	Signal<const std::vector<Request *> &> requestsCompleted;
+	Signal<unsigned int, Request *> requestDropped;
+
+private:
+	void requestComplete(Request *request);
+	void pairRequests();
+	void dropRequest(unsigned int index);
+
+	std::vector<std::shared_ptr<Camera>> cameras_;
+	std::chrono::nanoseconds tolerance_;
+	bool running_;
+	bool syncPending_;
+
+	std::map<Request *, unsigned int> queued_;
+	std::vector<std::deque<Request *>> completed_;
+};
+
+} /* namespace libcamera */
+
+#endif /* __LIBCAMERA_CAMERA_GROUP_H__ */
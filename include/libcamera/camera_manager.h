@@ -13,6 +13,7 @@
 #include <vector>
 
 #include <libcamera/object.h>
+#include <libcamera/signal.h>
 
 namespace libcamera {
 
@@ -27,12 +28,15 @@ public:
 	CameraManager &operator=(const CameraManager &) = delete;
 	~CameraManager();
 
+	void setDeferredMatching(bool enable);
+
 	int start();
 	void stop();
 
 	std::vector<std::shared_ptr<Camera>> cameras() const;
 	std::shared_ptr<Camera> get(const std::string &name);
 	std::shared_ptr<Camera> get(dev_t devnum);
+	int matchDevice(dev_t devnum);
 
 	void addCamera(std::shared_ptr<Camera> camera, dev_t devnum);
 	void removeCamera(Camera *camera);
@@ -42,6 +46,9 @@ public:
 	void setEventDispatcher(std::unique_ptr<EventDispatcher> dispatcher);
 	EventDispatcher *eventDispatcher();
 
+	Signal<std::shared_ptr<Camera>> cameraAdded;
+	Signal<std::shared_ptr<Camera>> cameraRemoved;
+
 private:
 	static const std::string version_;
 	static CameraManager *self_;
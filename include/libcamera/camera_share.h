@@ -0,0 +1,118 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * camera_share.h - Share the frames of a camera with other processes
+ */
+#ifndef __LIBCAMERA_CAMERA_SHARE_H__
+#define __LIBCAMERA_CAMERA_SHARE_H__
+
+#include <map>
+#include <memory>
+#include <set>
+#include <string>
+#include <vector>
+
+#include <libcamera/controls.h>
+#include <libcamera/geometry.h>
+#include <libcamera/object.h>
+#include <libcamera/pixelformats.h>
+#include <libcamera/signal.h>
+
+namespace libcamera {
+
+class ControlSerializer;
+class EventNotifier;
+class FrameBuffer;
+class IPCUnixSocket;
+struct StreamConfiguration;
+
+class CameraShareServer : public Object
+{
+public:
+	CameraShareServer();
+	~CameraShareServer();
+
+	CameraShareServer(const CameraShareServer &) = delete;
+	CameraShareServer &operator=(const CameraShareServer &) = delete;
+
+	int listen(const std::string &path);
+	void close();
+
+	unsigned int clients() const { return clients_.size(); }
+
+	void configure(const StreamConfiguration &cfg);
+	bool queueFrame(FrameBuffer *buffer, const ControlList &metadata);
+
+	Signal<FrameBuffer *> frameReleased;
+
+private:
+	struct Client;
+
+	struct Frame {
+		FrameBuffer *buffer;
+		unsigned int refs;
+	};
+
+	void clientConnected(EventNotifier *notifier);
+	void clientReady(IPCUnixSocket *socket);
+	void removeClient(Client *client);
+
+	int sendConfiguration(Client *client);
+	int sendBuffer(Client *client, unsigned int id, FrameBuffer *buffer);
+	void unref(unsigned int id);
+
+	std::string path_;
+	int fd_;
+	EventNotifier *notifier_;
+
+	std::vector<std::unique_ptr<Client>> clients_;
+
+	PixelFormat pixelFormat_;
+	Size size_;
+
+	unsigned int nextId_;
+	std::map<FrameBuffer *, unsigned int> ids_;
+	std::map<unsigned int, Frame> frames_;
+};
+
+class CameraShareClient : public Object
+{
+public:
+	CameraShareClient();
+	~CameraShareClient();
+
+	CameraShareClient(const CameraShareClient &) = delete;
+	CameraShareClient &operator=(const CameraShareClient &) = delete;
+
+	int connect(const std::string &path);
+	void disconnect();
+	bool isConnected() const;
+
+	PixelFormat pixelFormat() const { return pixelFormat_; }
+	const Size &size() const { return size_; }
+
+	int release(FrameBuffer *buffer);
+
+	Signal<> configured;
+	Signal<FrameBuffer *, const ControlList &> frameReceived;
+	Signal<> disconnected;
+
+private:
+	void messageReady(IPCUnixSocket *socket);
+
+	std::unique_ptr<IPCUnixSocket> socket_;
+	std::unique_ptr<ControlSerializer> serializer_;
+
+	PixelFormat pixelFormat_;
+	Size size_;
+
+	std::map<unsigned int, std::unique_ptr<FrameBuffer>> buffers_;
+	std::map<unsigned int, std::unique_ptr<FrameBuffer>> stale_;
+	std::set<unsigned int> held_;
+	ControlList metadata_;
+};
+
+} /* namespace libcamera */
+
+#endif /* __LIBCAMERA_CAMERA_SHARE_H__ */
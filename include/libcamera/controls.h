@@ -8,8 +8,17 @@
 #ifndef __LIBCAMERA_CONTROLS_H__
 #define __LIBCAMERA_CONTROLS_H__
 
+#include <assert.h>
+#include <memory>
+#include <stdint.h>
 #include <string>
+#include <type_traits>
 #include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <libcamera/geometry.h>
+#include <libcamera/span.h>
 
 namespace libcamera {
 
@@ -20,23 +29,122 @@ enum ControlType {
 	ControlTypeBool,
 	ControlTypeInteger32,
 	ControlTypeInteger64,
+	ControlTypeByte,
+	ControlTypeFloat,
+	ControlTypeRectangle,
+};
+
+namespace details {
+
+template<typename T>
+struct control_type {
+};
+
+template<>
+struct control_type<void> {
+	static constexpr ControlType value = ControlTypeNone;
+};
+
+template<>
+struct control_type<bool> {
+	static constexpr ControlType value = ControlTypeBool;
+};
+
+template<>
+struct control_type<uint8_t> {
+	static constexpr ControlType value = ControlTypeByte;
+};
+
+template<>
+struct control_type<int32_t> {
+	static constexpr ControlType value = ControlTypeInteger32;
+};
+
+template<>
+struct control_type<int64_t> {
+	static constexpr ControlType value = ControlTypeInteger64;
 };
 
+template<>
+struct control_type<float> {
+	static constexpr ControlType value = ControlTypeFloat;
+};
+
+template<>
+struct control_type<Rectangle> {
+	static constexpr ControlType value = ControlTypeRectangle;
+};
+
+template<typename T>
+struct control_type<Span<T>> : public control_type<typename std::remove_cv<T>::type> {
+};
+
+} /* namespace details */
+
 class ControlValue
 {
 public:
 	ControlValue();
 	ControlValue(bool value);
+	ControlValue(uint8_t value);
 	ControlValue(int32_t value);
 	ControlValue(int64_t value);
+	ControlValue(float value);
+	ControlValue(const Rectangle &value);
+
+	template<typename T>
+	ControlValue(Span<T> values)
+		: ControlValue()
+	{
+		set(values);
+	}
+
+	ControlValue(const ControlValue &other);
+	ControlValue(ControlValue &&other) noexcept;
+	~ControlValue();
+
+	ControlValue &operator=(const ControlValue &other);
+	ControlValue &operator=(ControlValue &&other) noexcept;
 
 	ControlType type() const { return type_; }
 	bool isNone() const { return type_ == ControlTypeNone; }
+	bool isArray() const { return isArray_; }
+	std::size_t numElements() const { return numElements_; }
+
+	Span<const uint8_t> data() const;
+	Span<uint8_t> data();
+
+	void reserve(ControlType type, bool isArray = false,
+		     std::size_t numElements = 1);
 
 	template<typename T>
-	const T &get() const;
+	typename std::enable_if<!details::is_span<T>::value, const T &>::type
+	get() const;
+
 	template<typename T>
-	void set(const T &value);
+	typename std::enable_if<details::is_span<T>::value, T>::type
+	get() const
+	{
+		using V = typename std::remove_cv<typename T::element_type>::type;
+
+		assert(type_ == details::control_type<V>::value);
+
+		return T{ reinterpret_cast<const V *>(data().data()), numElements_ };
+	}
+
+	template<typename T>
+	typename std::enable_if<!details::is_span<T>::value>::type
+	set(const T &value);
+
+	template<typename T>
+	typename std::enable_if<details::is_span<T>::value>::type
+	set(const T &value)
+	{
+		using V = typename std::remove_cv<typename T::element_type>::type;
+
+		set(details::control_type<V>::value, true, value.data(),
+		    value.size(), sizeof(V));
+	}
 
 	std::string toString() const;
 
@@ -47,12 +155,25 @@ public:
 	}
 
 private:
-	ControlType type_;
+	struct Storage;
+
+	bool isStorageExternal() const;
+	void release();
+	void set(ControlType type, bool isArray, const void *data,
+		 std::size_t numElements, std::size_t elementSize);
+
+	ControlType type_ : 8;
+	bool isArray_;
+	uint32_t numElements_;
 
 	union {
+		uint64_t value_;
 		bool bool_;
-		int32_t integer32_;
-		int64_t integer64_;
+		uint8_t byte_;
+		int32_t int32_;
+		int64_t int64_;
+		float float_;
+		Storage *storage_;
 	};
 };
 
@@ -103,7 +224,10 @@ class Control : public ControlId
 public:
 	using type = T;
 
-	Control(unsigned int id, const char *name);
+	Control(unsigned int id, const char *name)
+		: ControlId(id, name, details::control_type<typename std::remove_cv<T>::type>::value)
+	{
+	}
 
 private:
 	Control(const Control &) = delete;
@@ -138,12 +262,19 @@ private:
 
 using ControlIdMap = std::unordered_map<unsigned int, const ControlId *>;
 
-class ControlInfoMap : private std::unordered_map<const ControlId *, ControlRange>
+class ControlInfoMap
 {
 public:
 	using Map = std::unordered_map<const ControlId *, ControlRange>;
 
-	ControlInfoMap() = default;
+	using key_type = const ControlId *;
+	using mapped_type = ControlRange;
+	using value_type = std::pair<const ControlId *, ControlRange>;
+	using size_type = std::size_t;
+	using const_iterator = std::vector<value_type>::const_iterator;
+	using iterator = const_iterator;
+
+	ControlInfoMap();
 	ControlInfoMap(const ControlInfoMap &other) = default;
 	ControlInfoMap(std::initializer_list<Map::value_type> init);
 	ControlInfoMap(Map &&info);
@@ -152,41 +283,46 @@ public:
 	ControlInfoMap &operator=(std::initializer_list<Map::value_type> init);
 	ControlInfoMap &operator=(Map &&info);
 
-	using Map::key_type;
-	using Map::mapped_type;
-	using Map::value_type;
-	using Map::size_type;
-	using Map::iterator;
-	using Map::const_iterator;
-
-	using Map::begin;
-	using Map::cbegin;
-	using Map::end;
-	using Map::cend;
-	using Map::at;
-	using Map::empty;
-	using Map::size;
-	using Map::count;
-	using Map::find;
-
-	mapped_type &at(unsigned int key);
-	const mapped_type &at(unsigned int key) const;
-	size_type count(unsigned int key) const;
-	iterator find(unsigned int key);
-	const_iterator find(unsigned int key) const;
-
-	const ControlIdMap &idmap() const { return idmap_; }
+	const_iterator begin() const { return data_->entries.begin(); }
+	const_iterator cbegin() const { return data_->entries.cbegin(); }
+	const_iterator end() const { return data_->entries.end(); }
+	const_iterator cend() const { return data_->entries.cend(); }
+	bool empty() const { return data_->entries.empty(); }
+	size_type size() const { return data_->entries.size(); }
+
+	const mapped_type &at(const ControlId *id) const;
+	const mapped_type &at(unsigned int id) const;
+	size_type count(const ControlId *id) const;
+	size_type count(unsigned int id) const;
+	const_iterator find(const ControlId *id) const;
+	const_iterator find(unsigned int id) const;
+
+	const ControlIdMap &idmap() const { return data_->idmap; }
 
 private:
-	void generateIdmap();
+	friend class ControlSerializer;
 
-	ControlIdMap idmap_;
+	struct Serialized;
+
+	struct Data {
+		std::vector<value_type> entries;
+		ControlIdMap idmap;
+		unsigned int indexBase;
+		std::vector<unsigned int> index;
+
+		/* Serialized form, created on demand by the ControlSerializer. */
+		mutable std::shared_ptr<const Serialized> serialized;
+	};
+
+	static std::shared_ptr<const Data> createData(Map &&info);
+
+	std::shared_ptr<const Data> data_;
 };
 
 class ControlList
 {
 private:
-	using ControlListMap = std::unordered_map<unsigned int, ControlValue>;
+	using ControlListMap = std::vector<std::pair<unsigned int, ControlValue>>;
 
 public:
 	ControlList();
@@ -204,18 +340,17 @@ public:
 	bool empty() const { return controls_.empty(); }
 	std::size_t size() const { return controls_.size(); }
 	void clear() { controls_.clear(); }
+	void reserve(std::size_t size) { controls_.reserve(size); }
 
 	bool contains(const ControlId &id) const;
 	bool contains(unsigned int id) const;
 
 	template<typename T>
-	const T &get(const Control<T> &ctrl) const
+	T get(const Control<T> &ctrl) const
 	{
 		const ControlValue *val = find(ctrl.id());
-		if (!val) {
-			static T t(0);
-			return t;
-		}
+		if (!val)
+			return T{};
 
 		return val->get<T>();
 	}
@@ -236,6 +371,9 @@ public:
 	const ControlInfoMap *infoMap() const { return infoMap_; }
 
 private:
+	friend class ControlSerializer;
+
+	const_iterator lowerBound(unsigned int id) const;
 	const ControlValue *find(unsigned int id) const;
 	ControlValue *find(unsigned int id);
 
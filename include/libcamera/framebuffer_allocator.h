@@ -11,15 +11,26 @@
 #include <memory>
 #include <vector>
 
+#include <libcamera/buffer.h>
+#include <libcamera/geometry.h>
+#include <libcamera/pixelformats.h>
+
 namespace libcamera {
 
 class Camera;
-class FrameBuffer;
+class DmaHeap;
 class Stream;
 
 class FrameBufferAllocator
 {
 public:
+	enum Heap {
+		HeapNone,
+		HeapSystem,
+		HeapSystemUncached,
+		HeapCma,
+	};
+
 	static FrameBufferAllocator *create(std::shared_ptr<Camera> camera);
 
 	FrameBufferAllocator(const Camera &) = delete;
@@ -27,17 +38,50 @@ public:
 
 	~FrameBufferAllocator();
 
-	int allocate(Stream *stream);
+	int setHeap(Heap heap);
+	Heap heap() const { return heapType_; }
+
+	int allocate(Stream *stream,
+		     FrameBuffer::CpuAccess cpuAccess = FrameBuffer::CpuAccessReadWrite);
+	int allocate(Stream *stream, unsigned int extra);
 	int free(Stream *stream);
 
+	int reserve(Stream *stream,
+		    FrameBuffer::CpuAccess cpuAccess = FrameBuffer::CpuAccessReadWrite);
+	void releasePool();
+
 	bool allocated() const { return !buffers_.empty(); }
 	const std::vector<std::unique_ptr<FrameBuffer>> &buffers(Stream *stream) const;
+	const std::vector<std::unique_ptr<FrameBuffer>> &spareBuffers(Stream *stream) const;
 
 private:
+	struct PooledBuffers {
+		PixelFormat pixelFormat;
+		Size size;
+		std::vector<std::unique_ptr<FrameBuffer>> buffers;
+	};
+
 	FrameBufferAllocator(std::shared_ptr<Camera> camera);
 
+	int createBuffers(Stream *stream, FrameBuffer::CpuAccess cpuAccess,
+			  std::vector<std::unique_ptr<FrameBuffer>> *buffers);
+	int createHeapBuffers(Stream *stream, unsigned int count,
+			      std::vector<std::unique_ptr<FrameBuffer>> *buffers);
+	int allocateSpares(Stream *stream, unsigned int count);
+
+	std::vector<PooledBuffers>::iterator findPooled(Stream *stream);
+	void addToPool(Stream *stream,
+		       std::vector<std::unique_ptr<FrameBuffer>> buffers);
+
 	std::shared_ptr<Camera> camera_;
 	std::map<Stream *, std::vector<std::unique_ptr<FrameBuffer>>> buffers_;
+	std::map<Stream *, std::vector<std::unique_ptr<FrameBuffer>>> spares_;
+	std::vector<PooledBuffers> pool_;
+
+	Heap heapType_;
+	std::unique_ptr<DmaHeap> heap_;
+
+	friend class Camera;
 };
 
 } /* namespace libcamera */
@@ -20,6 +20,9 @@ int logSetFile(const char *path);
 int logSetStream(std::ostream *stream);
 int logSetTarget(LoggingTarget target);
 void logSetLevel(const char *category, const char *level);
+void logSetAsync(bool async);
+int logSetRecorder(const char *path, unsigned int size);
+void logDumpRecorder(const char *reason);
 
 } /* namespace libcamera */
 
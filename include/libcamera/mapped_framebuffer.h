@@ -0,0 +1,116 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * mapped_framebuffer.h - CPU mappings of FrameBuffer memory
+ */
+#ifndef __LIBCAMERA_MAPPED_FRAMEBUFFER_H__
+#define __LIBCAMERA_MAPPED_FRAMEBUFFER_H__
+
+#include <array>
+#include <map>
+#include <memory>
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+#include <libcamera/buffer.h>
+
+namespace libcamera {
+
+class MappedFrameBuffer
+{
+public:
+	enum MapFlag {
+		MapRead = 1 << 0,
+		MapWrite = 1 << 1,
+		MapReadWrite = MapRead | MapWrite,
+	};
+
+	struct Plane {
+		uint8_t *data;
+		size_t length;
+	};
+
+	MappedFrameBuffer(const FrameBuffer *buffer, unsigned int flags = MapRead);
+	~MappedFrameBuffer();
+
+	MappedFrameBuffer(const MappedFrameBuffer &) = delete;
+	MappedFrameBuffer &operator=(const MappedFrameBuffer &) = delete;
+
+	bool isValid() const { return error_ == 0; }
+	int error() const { return error_; }
+
+	const FrameBuffer *buffer() const { return buffer_; }
+	unsigned int flags() const { return flags_; }
+	const std::vector<Plane> &planes() const { return planes_; }
+
+private:
+	struct Mapping {
+		int fd;
+		void *address;
+		size_t length;
+	};
+
+	const FrameBuffer *buffer_;
+	unsigned int flags_;
+	int error_;
+
+	std::vector<Mapping> maps_;
+	std::vector<Plane> planes_;
+};
+
+class ScopedCpuAccess
+{
+public:
+	static constexpr uint32_t AllPlanes = ~0U;
+
+	ScopedCpuAccess(const MappedFrameBuffer &buffer,
+			uint32_t planes = AllPlanes);
+	ScopedCpuAccess(const FrameBuffer::Plane &plane, unsigned int flags);
+	~ScopedCpuAccess();
+
+	ScopedCpuAccess(const ScopedCpuAccess &) = delete;
+	ScopedCpuAccess &operator=(const ScopedCpuAccess &) = delete;
+
+	int error() const { return error_; }
+
+private:
+	static constexpr unsigned int MaxDmaBufs = 8;
+
+	void begin(int fd);
+	int sync(int fd, uint64_t flags);
+
+	uint64_t flags_;
+	int error_;
+
+	std::array<int, MaxDmaBufs> fds_;
+	unsigned int count_;
+};
+
+class MappedBufferCache
+{
+public:
+	MappedBufferCache(unsigned int flags = MappedFrameBuffer::MapRead);
+	~MappedBufferCache();
+
+	MappedBufferCache(const MappedBufferCache &) = delete;
+	MappedBufferCache &operator=(const MappedBufferCache &) = delete;
+
+	const MappedFrameBuffer *map(const FrameBuffer *buffer);
+	const MappedFrameBuffer *find(const FrameBuffer *buffer) const;
+	void unmap(const FrameBuffer *buffer);
+	void clear();
+
+	unsigned int flags() const { return flags_; }
+
+private:
+	void bufferDestroyed(const FrameBuffer *buffer);
+
+	unsigned int flags_;
+	std::map<const FrameBuffer *, std::unique_ptr<MappedFrameBuffer>> mappings_;
+};
+
+} /* namespace libcamera */
+
+#endif /* __LIBCAMERA_MAPPED_FRAMEBUFFER_H__ */
@@ -7,6 +7,7 @@
 #ifndef __LIBCAMERA_OBJECT_H__
 #define __LIBCAMERA_OBJECT_H__
 
+#include <atomic>
 #include <list>
 #include <memory>
 #include <vector>
@@ -16,6 +17,7 @@
 namespace libcamera {
 
 class Message;
+class MessageQueue;
 template<typename... Args>
 class Signal;
 class SignalBase;
@@ -27,16 +29,29 @@ public:
 	Object(Object *parent = nullptr);
 	virtual ~Object();
 
+	void deleteLater();
+
 	void postMessage(std::unique_ptr<Message> msg);
 
 	template<typename T, typename R, typename... FuncArgs, typename... Args,
 		 typename std::enable_if<std::is_base_of<Object, T>::value>::type * = nullptr>
 	R invokeMethod(R (T::*func)(FuncArgs...), ConnectionType type,
-		       Args... args)
+		       Args &&... args)
 	{
 		T *obj = static_cast<T *>(this);
 		auto *method = new BoundMethodMember<T, R, FuncArgs...>(obj, this, func, type);
-		return method->activate(args..., true);
+		return method->activate(std::forward<Args>(args)..., true);
+	}
+
+	template<typename T, typename R, typename... FuncArgs, typename... Args,
+		 typename std::enable_if<std::is_base_of<Object, T>::value>::type * = nullptr>
+	R invokeMethod(R (T::*func)(FuncArgs...), ConnectionType type,
+		       MessagePriority priority, Args &&... args)
+	{
+		T *obj = static_cast<T *>(this);
+		auto *method = new BoundMethodMember<T, R, FuncArgs...>(obj, this, func,
+									type, priority);
+		return method->activate(std::forward<Args>(args)..., true);
 	}
 
 	Thread *thread() const { return thread_; }
@@ -48,6 +63,7 @@ protected:
 	virtual void message(Message *msg);
 
 private:
+	friend class MessageQueue;
 	friend class SignalBase;
 	friend class Thread;
 
@@ -61,7 +77,9 @@ private:
 
 	Thread *thread_;
 	std::list<SignalBase *> signals_;
-	unsigned int pendingMessages_;
+	std::atomic<unsigned int> pendingMessages_;
+	Message *firstMessage_;
+	Message *lastMessage_;
 };
 
 } /* namespace libcamera */
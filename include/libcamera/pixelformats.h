@@ -7,12 +7,45 @@
 #ifndef __LIBCAMERA_PIXEL_FORMATS_H__
 #define __LIBCAMERA_PIXEL_FORMATS_H__
 
+#include <array>
 #include <stdint.h>
 
+#include <libcamera/geometry.h>
+
 namespace libcamera {
 
 using PixelFormat = uint32_t;
 
+struct PixelFormatPlaneInfo {
+	unsigned int bitsPerPixel;
+	unsigned int horizontalSubSampling;
+	unsigned int verticalSubSampling;
+};
+
+struct PixelFormatInfo {
+	enum ColourEncoding {
+		ColourEncodingRGB,
+		ColourEncodingYUV,
+	};
+
+	bool isValid() const { return format != 0; }
+
+	unsigned int stride(unsigned int width, unsigned int plane) const;
+	unsigned int planeSize(const Size &size, unsigned int plane) const;
+	unsigned int frameSize(const Size &size) const;
+
+	static const PixelFormatInfo &info(PixelFormat format);
+	static const PixelFormatInfo &fromV4L2(uint32_t v4l2Format);
+
+	PixelFormat format;
+	uint32_t v4l2Format;
+	uint32_t v4l2FormatMultiPlane;
+	ColourEncoding colourEncoding;
+	bool compressed;
+	unsigned int numPlanes;
+	std::array<PixelFormatPlaneInfo, 3> planes;
+};
+
 } /* namespace libcamera */
 
 #endif /* __LIBCAMERA_PIXEL_FORMATS_H__ */
@@ -0,0 +1,43 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * raw_unpacker.h - Unpacking of packed raw Bayer formats
+ */
+#ifndef __LIBCAMERA_RAW_UNPACKER_H__
+#define __LIBCAMERA_RAW_UNPACKER_H__
+
+#include <stdint.h>
+
+#include <libcamera/pixelformats.h>
+
+namespace libcamera {
+
+class RawUnpacker
+{
+public:
+	RawUnpacker();
+
+	int configure(PixelFormat format, unsigned int width);
+
+	unsigned int width() const { return width_; }
+	unsigned int bitDepth() const { return bitDepth_; }
+	unsigned int minStride() const { return minStride_; }
+
+	void unpack(const uint8_t *src, unsigned int srcStride, uint16_t *dst,
+		    unsigned int dstStride, unsigned int start,
+		    unsigned int end) const;
+
+private:
+	using LineUnpacker = void (*)(const uint8_t *src, uint16_t *dst,
+				      unsigned int width);
+
+	unsigned int width_;
+	unsigned int bitDepth_;
+	unsigned int minStride_;
+	LineUnpacker unpackLine_;
+};
+
+} /* namespace libcamera */
+
+#endif /* __LIBCAMERA_RAW_UNPACKER_H__ */
@@ -0,0 +1,86 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * raw_video.h - Indexed raw video container
+ */
+#ifndef __LIBCAMERA_RAW_VIDEO_H__
+#define __LIBCAMERA_RAW_VIDEO_H__
+
+#include <memory>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include <libcamera/buffer.h>
+#include <libcamera/controls.h>
+#include <libcamera/geometry.h>
+#include <libcamera/pixelformats.h>
+#include <libcamera/span.h>
+
+namespace libcamera {
+
+struct RawVideoStream {
+	std::string name;
+	PixelFormat pixelFormat;
+	Size size;
+};
+
+struct RawVideoFrame {
+	unsigned int stream;
+	FrameMetadata metadata;
+	std::vector<Span<const uint8_t>> planes;
+};
+
+class RawVideoWriter
+{
+public:
+	RawVideoWriter();
+	~RawVideoWriter();
+
+	RawVideoWriter(const RawVideoWriter &) = delete;
+	RawVideoWriter &operator=(const RawVideoWriter &) = delete;
+
+	int open(const std::string &path,
+		 const std::vector<RawVideoStream> &streams);
+	int close();
+	bool isOpen() const;
+
+	int write(unsigned int stream, const FrameMetadata &metadata,
+		  const std::vector<Span<const uint8_t>> &planes,
+		  const ControlList &controls);
+
+	unsigned int frames() const;
+
+private:
+	class Private;
+	std::unique_ptr<Private> p_;
+};
+
+class RawVideoReader
+{
+public:
+	RawVideoReader();
+	~RawVideoReader();
+
+	RawVideoReader(const RawVideoReader &) = delete;
+	RawVideoReader &operator=(const RawVideoReader &) = delete;
+
+	int open(const std::string &path);
+	void close();
+	bool isOpen() const;
+
+	const std::vector<RawVideoStream> &streams() const;
+	unsigned int frames() const;
+
+	int frame(unsigned int index, RawVideoFrame *frame) const;
+	int controls(unsigned int index, ControlList *controls);
+
+private:
+	class Private;
+	std::unique_ptr<Private> p_;
+};
+
+} /* namespace libcamera */
+
+#endif /* __LIBCAMERA_RAW_VIDEO_H__ */
@@ -7,18 +7,20 @@
 #ifndef __LIBCAMERA_REQUEST_H__
 #define __LIBCAMERA_REQUEST_H__
 
+#include <array>
+#include <chrono>
 #include <map>
 #include <memory>
 #include <stdint.h>
-#include <unordered_set>
+#include <vector>
 
+#include <libcamera/bound_method.h>
 #include <libcamera/controls.h>
 #include <libcamera/signal.h>
 
 namespace libcamera {
 
 class Camera;
-class CameraControlValidator;
 class FrameBuffer;
 class Stream;
 
@@ -36,6 +38,8 @@ public:
 	Request &operator=(const Request &) = delete;
 	~Request();
 
+	void reuse();
+
 	ControlList &controls() { return *controls_; }
 	ControlList &metadata() { return *metadata_; }
 	const std::map<Stream *, FrameBuffer *> &buffers() const { return bufferMap_; }
@@ -45,25 +49,58 @@ public:
 	uint64_t cookie() const { return cookie_; }
 	Status status() const { return status_; }
 
-	bool hasPendingBuffers() const { return !pending_.empty(); }
+	bool hasPendingBuffers() const { return pending_ != 0; }
+
+	void setRepeating(bool repeating) { repeating_ = repeating; }
+	bool repeating() const { return repeating_; }
+
+	void setMetadataFilter(const std::vector<const ControlId *> &ids);
+	void clearMetadataFilter();
+	bool metadataEnabled(const ControlId &id) const;
 
 private:
+	friend class Camera;
 	friend class PipelineHandler;
 
 	void complete();
+	void cancel();
+	void rearm();
+	void decimate(unsigned int frame);
+	void takeBuffers(Request *spare);
 
 	bool completeBuffer(FrameBuffer *buffer);
 
 	Camera *camera_;
-	CameraControlValidator *validator_;
 	ControlList *controls_;
 	ControlList *metadata_;
+	struct BufferSlot {
+		Stream *stream;
+		FrameBuffer *buffer;
+	};
+
+	static constexpr unsigned int MaxBuffers = 8;
+
 	std::map<Stream *, FrameBuffer *> bufferMap_;
-	std::unordered_set<FrameBuffer *> pending_;
+	std::array<BufferSlot, MaxBuffers> slots_;
+	unsigned int numSlots_;
+	uint32_t pending_;
 
 	const uint64_t cookie_;
 	Status status_;
 	bool cancelled_;
+	bool repeating_;
+	bool spare_;
+
+	bool filterMetadata_;
+	std::vector<unsigned int> metadataFilter_;
+
+	std::chrono::steady_clock::time_point queueTime_;
+	std::chrono::steady_clock::time_point deviceTime_;
+	std::chrono::steady_clock::time_point bufferTime_;
+	std::chrono::steady_clock::time_point ipaTime_;
+
+	BoundMethodArgs<void, Request *> *completion_;
+	Request *submitNext_;
 };
 
 } /* namespace libcamera */
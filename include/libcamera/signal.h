@@ -8,7 +8,7 @@
 #define __LIBCAMERA_SIGNAL_H__
 
 #include <functional>
-#include <list>
+#include <memory>
 #include <type_traits>
 #include <vector>
 
@@ -23,15 +23,15 @@ public:
 	void disconnect(Object *object);
 
 protected:
-	using SlotList = std::list<BoundMethodBase *>;
+	using SlotList = std::vector<std::shared_ptr<BoundMethodBase>>;
 
 	void connect(BoundMethodBase *slot);
-	void disconnect(std::function<bool(SlotList::iterator &)> match);
+	void disconnect(std::function<bool(BoundMethodBase *)> match);
 
-	SlotList slots();
+	std::shared_ptr<const SlotList> slots() const { return slots_; }
 
 private:
-	SlotList slots_;
+	std::shared_ptr<const SlotList> slots_;
 };
 
 template<typename... Args>
@@ -47,10 +47,12 @@ public:
 #ifndef __DOXYGEN__
 	template<typename T, typename R, typename std::enable_if<std::is_base_of<Object, T>::value>::type * = nullptr>
 	void connect(T *obj, R (T::*func)(Args...),
-		     ConnectionType type = ConnectionTypeAuto)
+		     ConnectionType type = ConnectionTypeAuto,
+		     MessagePriority priority = MessagePriorityNormal)
 	{
 		Object *object = static_cast<Object *>(obj);
-		SignalBase::connect(new BoundMethodMember<T, void, Args...>(obj, object, func, type));
+		SignalBase::connect(new BoundMethodMember<T, void, Args...>(obj, object, func,
+									   type, priority));
 	}
 
 	template<typename T, typename R, typename std::enable_if<!std::is_base_of<Object, T>::value>::type * = nullptr>
@@ -70,7 +72,7 @@ public:
 
 	void disconnect()
 	{
-		SignalBase::disconnect([](SlotList::iterator &iter) {
+		SignalBase::disconnect([](BoundMethodBase *slot) {
 			return true;
 		});
 	}
@@ -78,17 +80,17 @@ public:
 	template<typename T>
 	void disconnect(T *obj)
 	{
-		SignalBase::disconnect([obj](SlotList::iterator &iter) {
-			return (*iter)->match(obj);
+		SignalBase::disconnect([obj](BoundMethodBase *slot) {
+			return slot->match(obj);
 		});
 	}
 
 	template<typename T, typename R>
 	void disconnect(T *obj, R (T::*func)(Args...))
 	{
-		SignalBase::disconnect([obj, func](SlotList::iterator &iter) {
+		SignalBase::disconnect([obj, func](BoundMethodBase *base) {
 			BoundMethodArgs<R, Args...> *slot =
-				static_cast<BoundMethodArgs<R, Args...> *>(*iter);
+				static_cast<BoundMethodArgs<R, Args...> *>(base);
 
 			if (!slot->match(obj))
 				return false;
@@ -106,9 +108,9 @@ public:
 	template<typename R>
 	void disconnect(R (*func)(Args...))
 	{
-		SignalBase::disconnect([func](SlotList::iterator &iter) {
+		SignalBase::disconnect([func](BoundMethodBase *base) {
 			BoundMethodArgs<R, Args...> *slot =
-				static_cast<BoundMethodArgs<R, Args...> *>(*iter);
+				static_cast<BoundMethodArgs<R, Args...> *>(base);
 
 			if (!slot->match(nullptr))
 				return false;
@@ -120,11 +122,65 @@ public:
 	void emit(Args... args)
 	{
 		/*
-		 * Make a copy of the slots list as the slot could call the
-		 * disconnect operation, invalidating the iterator.
+		 * Hold a reference to the current slots list, as slots could
+		 * connect or disconnect the signal, replacing the list.
 		 */
-		for (BoundMethodBase *slot : slots())
-			static_cast<BoundMethodArgs<void, Args...> *>(slot)->activate(args...);
+		std::shared_ptr<const SlotList> slots = SignalBase::slots();
+		if (!slots)
+			return;
+
+		using SlotType = BoundMethodArgs<void, Args...>;
+
+		if (slots->size() == 1) {
+			/* A single slot can't be disconnected before being called. */
+			static_cast<SlotType *>(slots->front().get())->activate(std::forward<Args>(args)...);
+			return;
+		}
+
+		/*
+		 * Slots bound to an Object receive the arguments through a
+		 * pack. Share a single pack between all of them to copy the
+		 * arguments once, unless slots could modify them.
+		 */
+		std::shared_ptr<typename SlotType::PackType> pack;
+
+		for (const std::shared_ptr<BoundMethodBase> &slot : *slots) {
+			/* Skip slots disconnected by a previous slot. */
+			if (slot->disconnected())
+				continue;
+
+			if (!shareable() || !slot->object()) {
+				static_cast<SlotType *>(slot.get())->activate(args...);
+				continue;
+			}
+
+			if (!pack) {
+				pack = std::allocate_shared<typename SlotType::PackType>(
+					MessagePoolAllocator<typename SlotType::PackType>(),
+					args...);
+				pack->shared_ = true;
+			}
+
+			slot->activatePack(pack, false);
+		}
+	}
+
+private:
+	static constexpr bool shareable()
+	{
+		/* The first element avoids an empty array for signals without arguments. */
+		const bool writable[] = {
+			false,
+			(std::is_lvalue_reference<Args>::value &&
+			 !std::is_const<typename std::remove_reference<Args>::type>::value)...
+		};
+
+		for (bool w : writable) {
+			if (w)
+				return false;
+		}
+
+		return true;
 	}
 };
 
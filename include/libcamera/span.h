@@ -0,0 +1,149 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * span.h - C++20 std::span<> implementation for C++14
+ */
+
+#ifndef __LIBCAMERA_SPAN_H__
+#define __LIBCAMERA_SPAN_H__
+
+#include <iterator>
+#include <limits>
+#include <stddef.h>
+#include <type_traits>
+#include <utility>
+
+namespace libcamera {
+
+template<typename T>
+class Span;
+
+namespace details {
+
+template<typename T>
+struct is_span : public std::false_type {
+};
+
+template<typename T>
+struct is_span<Span<T>> : public std::true_type {
+};
+
+} /* namespace details */
+
+template<typename T>
+class Span
+{
+public:
+	using element_type = T;
+	using value_type = typename std::remove_cv<T>::type;
+	using size_type = std::size_t;
+	using difference_type = std::ptrdiff_t;
+	using pointer = T *;
+	using const_pointer = const T *;
+	using reference = T &;
+	using const_reference = const T &;
+	using iterator = pointer;
+	using const_iterator = const_pointer;
+	using reverse_iterator = std::reverse_iterator<iterator>;
+	using const_reverse_iterator = std::reverse_iterator<const_iterator>;
+
+	static constexpr size_type npos = std::numeric_limits<size_type>::max();
+
+	constexpr Span() noexcept
+		: data_(nullptr), size_(0)
+	{
+	}
+
+	constexpr Span(pointer ptr, size_type count)
+		: data_(ptr), size_(count)
+	{
+	}
+
+	constexpr Span(pointer first, pointer last)
+		: data_(first), size_(last - first)
+	{
+	}
+
+	template<std::size_t N>
+	constexpr Span(element_type (&arr)[N]) noexcept
+		: data_(arr), size_(N)
+	{
+	}
+
+	template<class Container,
+		 typename std::enable_if<!details::is_span<Container>::value &&
+					 std::is_convertible<typename std::remove_pointer<decltype(std::declval<Container &>().data())>::type (*)[],
+							     element_type (*)[]>::value,
+					 std::nullptr_t>::type = nullptr>
+	constexpr Span(Container &cont)
+		: data_(cont.data()), size_(cont.size())
+	{
+	}
+
+	template<class Container,
+		 typename std::enable_if<!details::is_span<Container>::value &&
+					 std::is_convertible<typename std::remove_pointer<decltype(std::declval<const Container &>().data())>::type (*)[],
+							     element_type (*)[]>::value,
+					 std::nullptr_t>::type = nullptr>
+	constexpr Span(const Container &cont)
+		: data_(cont.data()), size_(cont.size())
+	{
+	}
+
+	template<class U,
+		 typename std::enable_if<!std::is_same<U, T>::value &&
+					 std::is_convertible<U (*)[], element_type (*)[]>::value,
+					 std::nullptr_t>::type = nullptr>
+	constexpr Span(const Span<U> &other) noexcept
+		: data_(other.data()), size_(other.size())
+	{
+	}
+
+	constexpr Span(const Span &other) noexcept = default;
+	constexpr Span &operator=(const Span &other) noexcept = default;
+
+	constexpr iterator begin() const { return data_; }
+	constexpr const_iterator cbegin() const { return data_; }
+	constexpr iterator end() const { return data_ + size_; }
+	constexpr const_iterator cend() const { return data_ + size_; }
+	constexpr reverse_iterator rbegin() const { return reverse_iterator(end()); }
+	constexpr const_reverse_iterator crbegin() const { return const_reverse_iterator(cend()); }
+	constexpr reverse_iterator rend() const { return reverse_iterator(begin()); }
+	constexpr const_reverse_iterator crend() const { return const_reverse_iterator(cbegin()); }
+
+	constexpr reference front() const { return *data_; }
+	constexpr reference back() const { return data_[size_ - 1]; }
+	constexpr reference operator[](size_type idx) const { return data_[idx]; }
+	constexpr pointer data() const noexcept { return data_; }
+
+	constexpr size_type size() const noexcept { return size_; }
+	constexpr size_type size_bytes() const noexcept { return size_ * sizeof(element_type); }
+	constexpr bool empty() const noexcept { return size_ == 0; }
+
+	constexpr Span<element_type> first(size_type count) const
+	{
+		return { data_, count };
+	}
+
+	constexpr Span<element_type> last(size_type count) const
+	{
+		return { data_ + size_ - count, count };
+	}
+
+	constexpr Span<element_type> subspan(size_type offset, size_type count = npos) const
+	{
+		return { data_ + offset, count == npos ? size_ - offset : count };
+	}
+
+private:
+	pointer data_;
+	size_type size_;
+};
+
+template<typename T>
+constexpr typename Span<T>::size_type Span<T>::npos;
+
+} /* namespace libcamera */
+
+#endif /* __LIBCAMERA_SPAN_H__ */
@@ -9,6 +9,7 @@
 
 #include <map>
 #include <memory>
+#include <stdint.h>
 #include <string>
 #include <vector>
 
@@ -37,13 +38,23 @@ private:
 };
 
 struct StreamConfiguration {
+	enum Direction {
+		Output,
+		Input,
+	};
+
 	StreamConfiguration();
 	StreamConfiguration(const StreamFormats &formats);
 
+	Direction direction;
 	PixelFormat pixelFormat;
 	Size size;
 
 	unsigned int bufferCount;
+	FrameBuffer::Memory memory;
+	unsigned int decimation;
+	unsigned int zslFrames;
+	uint64_t stallDuration;
 
 	Stream *stream() const { return stream_; }
 	void setStream(Stream *stream) { stream_ = stream; }
@@ -60,6 +71,8 @@ enum StreamRole {
 	StillCapture,
 	VideoRecording,
 	Viewfinder,
+	Raw,
+	Reprocessing,
 };
 
 using StreamRoles = std::vector<StreamRole>;
@@ -70,11 +83,13 @@ public:
 	Stream();
 
 	const StreamConfiguration &configuration() const { return configuration_; }
+	FrameBuffer::CpuAccess cpuAccess() const { return cpuAccess_; }
 
 protected:
 	friend class Camera;
 
 	StreamConfiguration configuration_;
+	FrameBuffer::CpuAccess cpuAccess_;
 };
 
 } /* namespace libcamera */
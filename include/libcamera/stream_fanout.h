@@ -0,0 +1,99 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * stream_fanout.h - Share the buffers of a stream between multiple consumers
+ */
+#ifndef __LIBCAMERA_STREAM_FANOUT_H__
+#define __LIBCAMERA_STREAM_FANOUT_H__
+
+#include <chrono>
+#include <map>
+#include <memory>
+#include <stdint.h>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include <libcamera/object.h>
+#include <libcamera/signal.h>
+
+namespace libcamera {
+
+class Camera;
+class FrameBuffer;
+class Request;
+class Stream;
+
+class StreamFanout : public Object
+{
+public:
+	struct ConsumerStatistics {
+		std::string name;
+		uint64_t buffers;
+		unsigned int held;
+		std::chrono::microseconds totalHoldTime;
+		std::chrono::microseconds maxHoldTime;
+	};
+
+	StreamFanout(std::shared_ptr<Camera> camera, Stream *stream);
+	~StreamFanout();
+
+	StreamFanout(const StreamFanout &) = delete;
+	StreamFanout &operator=(const StreamFanout &) = delete;
+
+	Stream *stream() const { return stream_; }
+
+#ifndef __DOXYGEN__
+	template<typename T, typename std::enable_if<std::is_base_of<Object, T>::value>::type * = nullptr>
+#else
+	template<typename T>
+#endif
+	unsigned int addConsumer(const std::string &name, T *receiver,
+				 void (T::*func)(FrameBuffer *))
+	{
+		Consumer *consumer = createConsumer(name);
+		consumer->bufferReady.connect(receiver, func);
+		return consumer->id;
+	}
+	void removeConsumer(unsigned int consumer);
+
+	int queueRequest(Request *request);
+	void release(unsigned int consumer, FrameBuffer *buffer);
+
+	std::vector<ConsumerStatistics> statistics() const;
+
+	Signal<Request *> requestReleased;
+
+private:
+	using clock = std::chrono::steady_clock;
+
+	struct Consumer {
+		unsigned int id;
+		Signal<FrameBuffer *> bufferReady;
+		std::map<FrameBuffer *, clock::time_point> held;
+		ConsumerStatistics stats;
+	};
+
+	struct Dispatch {
+		Request *request;
+		unsigned int refs;
+	};
+
+	Consumer *createConsumer(const std::string &name);
+
+	void requestComplete(Request *request);
+	void releaseBuffer(unsigned int consumer, FrameBuffer *buffer);
+	void unref(FrameBuffer *buffer);
+
+	std::shared_ptr<Camera> camera_;
+	Stream *stream_;
+
+	unsigned int nextId_;
+	std::map<unsigned int, std::unique_ptr<Consumer>> consumers_;
+	std::map<FrameBuffer *, Dispatch> dispatched_;
+};
+
+} /* namespace libcamera */
+
+#endif /* __LIBCAMERA_STREAM_FANOUT_H__ */
@@ -31,6 +31,9 @@ public:
 
 	std::chrono::steady_clock::time_point deadline() const { return deadline_; }
 
+	void setSlack(std::chrono::microseconds slack);
+	std::chrono::microseconds slack() const { return slack_; }
+
 	Signal<Timer *> timeout;
 
 protected:
@@ -42,6 +45,7 @@ private:
 
 	bool running_;
 	std::chrono::steady_clock::time_point deadline_;
+	std::chrono::microseconds slack_;
 };
 
 } /* namespace libcamera */
@@ -7,15 +7,122 @@
 
 #include "camera_device.h"
 
+#include <algorithm>
+#include <unistd.h>
+
+#include <linux/drm_fourcc.h>
+
+#include <libcamera/control_ids.h>
+#include <libcamera/controls.h>
+#include <libcamera/geometry.h>
+#include <libcamera/pixelformats.h>
+
 #include "log.h"
 #include "utils.h"
 
 #include "camera_metadata.h"
+#include "post_processor_jpeg.h"
+#include "post_processor_scaler.h"
 
 using namespace libcamera;
 
 LOG_DECLARE_CATEGORY(HAL);
 
+namespace {
+
+/*
+ * Translation of the request metadata to the Android result metadata. The
+ * translate function is called with the libcamera metadata value, or with a
+ * null value if the control is not reported for the request, in which case it
+ * adds the default value of the tag, if any.
+ */
+struct ResultMetadataMap {
+	uint32_t tag;
+	const ControlId *id;
+	bool (*translate)(CameraMetadata *result, uint32_t tag,
+			  const ControlValue *value);
+};
+
+template<uint8_t Value>
+bool translateFixed(CameraMetadata *result, uint32_t tag,
+		    const ControlValue *)
+{
+	const uint8_t data = Value;
+	return result->addEntry(tag, &data, 1);
+}
+
+bool translateAeState(CameraMetadata *result, uint32_t tag,
+		      const ControlValue *value)
+{
+	uint8_t data = ANDROID_CONTROL_AE_STATE_CONVERGED;
+	if (value && !value->get<bool>())
+		data = ANDROID_CONTROL_AE_STATE_SEARCHING;
+
+	return result->addEntry(tag, &data, 1);
+}
+
+bool translateCropRegion(CameraMetadata *result, uint32_t tag,
+			 const ControlValue *value)
+{
+	Rectangle crop = { 0, 0, 2560, 1920 };
+	if (value)
+		crop = value->get<Rectangle>();
+
+	const int32_t data[] = {
+		crop.x, crop.y,
+		static_cast<int32_t>(crop.w), static_cast<int32_t>(crop.h),
+	};
+
+	return result->addEntry(tag, data, 4);
+}
+
+bool translateFrameDuration(CameraMetadata *result, uint32_t tag,
+			    const ControlValue *value)
+{
+	if (!value)
+		return true;
+
+	/* libcamera reports the duration in micro-seconds. */
+	const int64_t data = value->get<int64_t>() * 1000;
+
+	return result->addEntry(tag, &data, 1);
+}
+
+/*
+ * The table is sorted by tag, the entries are thus appended to the result
+ * metadata pack in tag order.
+ */
+const ResultMetadataMap resultMetadataMap[] = {
+	{ ANDROID_CONTROL_AE_LOCK, nullptr,
+	  translateFixed<ANDROID_CONTROL_AE_LOCK_OFF> },
+	{ ANDROID_CONTROL_AWB_LOCK, nullptr,
+	  translateFixed<ANDROID_CONTROL_AWB_LOCK_OFF> },
+	{ ANDROID_CONTROL_AE_STATE, &controls::AeLocked, translateAeState },
+	{ ANDROID_CONTROL_AF_STATE, nullptr,
+	  translateFixed<ANDROID_CONTROL_AF_STATE_INACTIVE> },
+	{ ANDROID_CONTROL_AWB_STATE, nullptr,
+	  translateFixed<ANDROID_CONTROL_AWB_STATE_CONVERGED> },
+	{ ANDROID_LENS_STATE, nullptr,
+	  translateFixed<ANDROID_LENS_STATE_STATIONARY> },
+	{ ANDROID_SCALER_CROP_REGION, &controls::ScalerCrop, translateCropRegion },
+	{ ANDROID_SENSOR_FRAME_DURATION, &controls::FrameDuration,
+	  translateFrameDuration },
+	{ ANDROID_STATISTICS_SCENE_FLICKER, nullptr,
+	  translateFixed<ANDROID_STATISTICS_SCENE_FLICKER_NONE> },
+	{ ANDROID_STATISTICS_LENS_SHADING_MAP_MODE, nullptr,
+	  translateFixed<ANDROID_STATISTICS_LENS_SHADING_MAP_MODE_OFF> },
+};
+
+/*
+ * Capacity of the result metadata pack, large enough for all entries of the
+ * table. Only the crop region (16 bytes) and frame duration (8 bytes) don't
+ * fit in the entry itself.
+ */
+constexpr size_t resultMetadataEntries = ARRAY_SIZE(resultMetadataMap);
+constexpr size_t resultMetadataData = 24;
+
+} /* namespace */
+
 /*
  * \struct Camera3RequestDescriptor
  *
@@ -25,13 +132,20 @@ LOG_DECLARE_CATEGORY(HAL);
 
 CameraDevice::Camera3RequestDescriptor::Camera3RequestDescriptor(
 		unsigned int frameNumber, unsigned int numBuffers)
-	: frameNumber(frameNumber), numBuffers(numBuffers)
+	: frameNumber(frameNumber), numBuffers(numBuffers),
+	  frameBuffers(numBuffers, nullptr), scalerSource(nullptr),
+	  states(numBuffers, BufferPending),
+	  shutterNotified(false), completed(false), pendingFences(0)
 {
 	buffers = new camera3_stream_buffer_t[numBuffers];
 }
 
 CameraDevice::Camera3RequestDescriptor::~Camera3RequestDescriptor()
 {
+	/* The HAL owns the acquire fences, close them when done. */
+	for (std::unique_ptr<EventNotifier> &fence : fences)
+		::close(fence->fd());
+
 	delete[] buffers;
 }
 
@@ -49,13 +163,28 @@ CameraDevice::Camera3RequestDescriptor::~Camera3RequestDescriptor()
  */
 
 CameraDevice::CameraDevice(unsigned int id, const std::shared_ptr<Camera> &camera)
-	: running_(false), camera_(camera), staticMetadata_(nullptr)
+	: running_(false), camera_(camera), staticMetadata_(nullptr),
+	  inFlightRequests_(0), jpegStream_(nullptr)
 {
+	camera_->bufferCompleted.connect(this, &CameraDevice::bufferComplete);
 	camera_->requestCompleted.connect(this, &CameraDevice::requestComplete);
+
+	jpeg_ = std::make_unique<PostProcessorJpeg>();
+	jpeg_->processed.connect(this, &CameraDevice::jpegProcessed);
+	jpeg_->moveToThread(&jpegThread_);
+
+	scaler_ = std::make_unique<PostProcessorScaler>();
+	scaler_->processed.connect(this, &CameraDevice::scalerProcessed);
+	scaler_->moveToThread(&scalerThread_);
 }
 
 CameraDevice::~CameraDevice()
 {
+	jpegThread_.exit();
+	jpegThread_.wait();
+	scalerThread_.exit();
+	scalerThread_.wait();
+
 	if (staticMetadata_)
 		delete staticMetadata_;
 
@@ -71,12 +200,48 @@ int CameraDevice::open()
 		return ret;
 	}
 
+	/*
+	 * The post-processing threads are only needed while the camera is
+	 * open, don't keep them around for cameras that the framework only
+	 * queries the static information of.
+	 */
+	jpegThread_.start();
+	scalerThread_.start();
+
+	/* Only compute the metadata translated to the result metadata. */
+	std::vector<const ControlId *> ids;
+	for (const ResultMetadataMap &entry : resultMetadataMap) {
+		if (entry.id)
+			ids.push_back(entry.id);
+	}
+	camera_->setMetadataFilter(ids);
+
 	return 0;
 }
 
 void CameraDevice::close()
 {
+	flushPendingRequests();
+
 	camera_->stop();
+
+	/*
+	 * Wait for the frames being encoded or scaled, and return them to the
+	 * framework before releasing the camera.
+	 */
+	jpeg_->invokeMethod(&PostProcessorJpeg::flush,
+			    ConnectionTypeBlocking);
+	scaler_->invokeMethod(&PostProcessorScaler::flush,
+			      ConnectionTypeBlocking);
+	Thread::current()->dispatchMessages();
+
+	jpegThread_.exit();
+	jpegThread_.wait();
+	scalerThread_.exit();
+	scalerThread_.wait();
+
+	clearStreams();
+
 	camera_->release();
 
 	running_ = false;
@@ -103,9 +268,9 @@ camera_metadata_t *CameraDevice::getStaticMetadata()
 
 	/*
 	 * \todo Keep this in sync with the actual number of entries.
-	 * Currently: 50 entries, 666 bytes
+	 * Currently: 52 entries, 686 bytes
 	 */
-	staticMetadata_ = new CameraMetadata(50, 700);
+	staticMetadata_ = new CameraMetadata(52, 704);
 	if (!staticMetadata_->isValid()) {
 		LOG(HAL, Error) << "Failed to allocate static metadata";
 		delete staticMetadata_;
@@ -230,6 +395,15 @@ camera_metadata_t *CameraDevice::getStaticMetadata()
 				  availableThumbnailSizes.data(),
 				  availableThumbnailSizes.size());
 
+	/*
+	 * Size the BLOB buffers to hold the largest JPEG frame, which, at the
+	 * maximum resolution, can't reasonably exceed the size of the NV12
+	 * frame it is encoded from.
+	 */
+	int32_t jpegMaxSize = PixelFormatInfo::info(DRM_FORMAT_NV12).frameSize({ 2560, 1920 })
+			    + sizeof(camera3_jpeg_blob);
+	staticMetadata_->addEntry(ANDROID_JPEG_MAX_SIZE, &jpegMaxSize, 1);
+
 	/* Sensor static metadata. */
 	int32_t pixelArraySize[] = {
 		2592, 1944,
@@ -363,17 +537,41 @@ camera_metadata_t *CameraDevice::getStaticMetadata()
 				  availableStreamConfigurations.data(),
 				  availableStreamConfigurations.size());
 
+	/*
+	 * Query the timings of the pipeline at the maximum resolution, and
+	 * fall back to 30 frames per second when the pipeline handler can't
+	 * estimate them. JPEG frames are encoded on the CPU once the pipeline
+	 * has processed them, budget one frame duration for the encoder.
+	 */
+	int64_t minFrameDuration = 33333333;
+	int64_t stallDuration = 0;
+
+	std::unique_ptr<CameraConfiguration> timingConfig =
+		camera_->generateConfiguration({ StreamRole::StillCapture });
+	if (timingConfig && !timingConfig->empty()) {
+		StreamConfiguration &cfg = timingConfig->at(0);
+		cfg.pixelFormat = DRM_FORMAT_NV12;
+		cfg.size = { 2560, 1920 };
+
+		if (timingConfig->validate() != CameraConfiguration::Invalid &&
+		    timingConfig->minFrameDuration) {
+			minFrameDuration = timingConfig->minFrameDuration;
+			stallDuration = cfg.stallDuration;
+		}
+	}
+
 	std::vector<int64_t> availableStallDurations = {
-		ANDROID_SCALER_AVAILABLE_FORMATS_BLOB, 2560, 1920, 33333333,
+		ANDROID_SCALER_AVAILABLE_FORMATS_BLOB, 2560, 1920,
+		stallDuration + minFrameDuration,
 	};
 	staticMetadata_->addEntry(ANDROID_SCALER_AVAILABLE_STALL_DURATIONS,
 				  availableStallDurations.data(),
 				  availableStallDurations.size());
 
 	std::vector<int64_t> minFrameDurations = {
-		ANDROID_SCALER_AVAILABLE_FORMATS_BLOB, 2560, 1920, 33333333,
-		ANDROID_SCALER_AVAILABLE_FORMATS_IMPLEMENTATION_DEFINED, 2560, 1920, 33333333,
-		ANDROID_SCALER_AVAILABLE_FORMATS_YCbCr_420_888, 2560, 1920, 33333333,
+		ANDROID_SCALER_AVAILABLE_FORMATS_BLOB, 2560, 1920, minFrameDuration,
+		ANDROID_SCALER_AVAILABLE_FORMATS_IMPLEMENTATION_DEFINED, 2560, 1920, minFrameDuration,
+		ANDROID_SCALER_AVAILABLE_FORMATS_YCbCr_420_888, 2560, 1920, minFrameDuration,
 	};
 	staticMetadata_->addEntry(ANDROID_SCALER_AVAILABLE_MIN_FRAME_DURATIONS,
 				  minFrameDurations.data(),
@@ -387,8 +585,11 @@ camera_metadata_t *CameraDevice::getStaticMetadata()
 	staticMetadata_->addEntry(ANDROID_INFO_SUPPORTED_HARDWARE_LEVEL,
 				  &supportedHWLevel, 1);
 
-	/* Request static metadata. */
-	int32_t partialResultCount = 1;
+	/*
+	 * Request static metadata. The sensor metadata is sent with the first
+	 * buffer of a request, and the rest when the request completes.
+	 */
+	int32_t partialResultCount = 2;
 	staticMetadata_->addEntry(ANDROID_REQUEST_PARTIAL_RESULT_COUNT,
 				  &partialResultCount, 1);
 
@@ -396,6 +597,16 @@ camera_metadata_t *CameraDevice::getStaticMetadata()
 	staticMetadata_->addEntry(ANDROID_REQUEST_PIPELINE_MAX_DEPTH,
 				  &maxPipelineDepth, 1);
 
+	/*
+	 * YUV streams the camera can't produce concurrently are scaled by the
+	 * HAL, any number of them can thus be configured. Report the minimum
+	 * required by the framework.
+	 */
+	std::vector<int32_t> maxNumOutputStreams = { 0, 3, 1 };
+	staticMetadata_->addEntry(ANDROID_REQUEST_MAX_NUM_OUTPUT_STREAMS,
+				  maxNumOutputStreams.data(),
+				  maxNumOutputStreams.size());
+
 	std::vector<uint8_t> availableCapabilities = {
 		ANDROID_REQUEST_AVAILABLE_CAPABILITIES_BACKWARD_COMPATIBLE,
 	};
@@ -421,6 +632,7 @@ camera_metadata_t *CameraDevice::getStaticMetadata()
 		ANDROID_CONTROL_AWB_LOCK_AVAILABLE,
 		ANDROID_CONTROL_AVAILABLE_MODES,
 		ANDROID_JPEG_AVAILABLE_THUMBNAIL_SIZES,
+		ANDROID_JPEG_MAX_SIZE,
 		ANDROID_SENSOR_INFO_PIXEL_ARRAY_SIZE,
 		ANDROID_SENSOR_INFO_ACTIVE_ARRAY_SIZE,
 		ANDROID_SENSOR_INFO_SENSITIVITY_RANGE,
@@ -450,6 +662,7 @@ camera_metadata_t *CameraDevice::getStaticMetadata()
 		ANDROID_INFO_SUPPORTED_HARDWARE_LEVEL,
 		ANDROID_REQUEST_PARTIAL_RESULT_COUNT,
 		ANDROID_REQUEST_PIPELINE_MAX_DEPTH,
+		ANDROID_REQUEST_MAX_NUM_OUTPUT_STREAMS,
 		ANDROID_REQUEST_AVAILABLE_CAPABILITIES,
 	};
 	staticMetadata_->addEntry(ANDROID_REQUEST_AVAILABLE_CHARACTERISTICS_KEYS,
@@ -482,6 +695,7 @@ camera_metadata_t *CameraDevice::getStaticMetadata()
 		ANDROID_CONTROL_AWB_LOCK,
 		ANDROID_LENS_STATE,
 		ANDROID_SCALER_CROP_REGION,
+		ANDROID_SENSOR_FRAME_DURATION,
 		ANDROID_SENSOR_TIMESTAMP,
 		ANDROID_SENSOR_ROLLING_SHUTTER_SKEW,
 		ANDROID_SENSOR_EXPOSURE_TIME,
@@ -611,6 +825,9 @@ const camera_metadata_t *CameraDevice::constructDefaultRequestSettings(int type)
  */
 int CameraDevice::configureStreams(camera3_stream_configuration_t *stream_list)
 {
+	camera3_stream_t *jpegStream = nullptr;
+	std::vector<camera3_stream_t *> yuvStreams;
+
 	for (unsigned int i = 0; i < stream_list->num_streams; ++i) {
 		camera3_stream_t *stream = stream_list->streams[i];
 
@@ -619,70 +836,282 @@ int CameraDevice::configureStreams(camera3_stream_configuration_t *stream_list)
 			       << ", width: " << stream->width
 			       << ", height: " << stream->height
 			       << ", format: " << utils::hex(stream->format);
+
+		if (stream->format != HAL_PIXEL_FORMAT_BLOB) {
+			yuvStreams.push_back(stream);
+			continue;
+		}
+
+		if (jpegStream) {
+			LOG(HAL, Error) << "Only one BLOB stream supported";
+			return -EINVAL;
+		}
+
+		jpegStream = stream;
 	}
 
-	/* Hardcode viewfinder role, collecting sizes from the stream config. */
-	if (stream_list->num_streams != 1) {
-		LOG(HAL, Error) << "Only one stream supported";
-		return -EINVAL;
+	/* The buffers of the previous configuration are not used anymore. */
+	clearStreams();
+
+	/*
+	 * Capture each stream from its own libcamera stream if the camera
+	 * supports it. Otherwise, capture all YUV streams from a single
+	 * libcamera stream, and scale the frames in the HAL.
+	 */
+	bool scale = false;
+	config_ = generateConfiguration(yuvStreams, jpegStream, false);
+	if (!config_ && yuvStreams.size() > 1) {
+		LOG(HAL, Info)
+			<< "Scaling " << yuvStreams.size()
+			<< " streams from one camera stream";
+
+		scale = true;
+		config_ = generateConfiguration(yuvStreams, jpegStream, true);
 	}
 
-	StreamRoles roles = { StreamRole::Viewfinder };
-	config_ = camera_->generateConfiguration(roles);
-	if (!config_ || config_->empty()) {
-		LOG(HAL, Error) << "Failed to generate camera configuration";
+	if (!config_) {
+		LOG(HAL, Error) << "Unsupported stream configuration";
 		return -EINVAL;
 	}
 
-	/* Only one stream is supported. */
-	camera3_stream_t *camera3Stream = stream_list->streams[0];
-	StreamConfiguration *streamConfiguration = &config_->at(0);
-	streamConfiguration->size.width = camera3Stream->width;
-	streamConfiguration->size.height = camera3Stream->height;
-
 	/*
-	 * \todo We'll need to translate from Android defined pixel format codes
-	 * to the libcamera image format codes. For now, do not change the
-	 * format returned from Camera::generateConfiguration().
+	 * Once the CameraConfiguration has been adjusted/validated
+	 * it can be applied to the camera.
 	 */
+	int ret = camera_->configure(config_.get());
+	if (ret) {
+		LOG(HAL, Error) << "Failed to configure camera '"
+				<< camera_->name() << "'";
+		return ret;
+	}
+
+	for (unsigned int i = 0; i < yuvStreams.size(); ++i) {
+		camera3_stream_t *stream = yuvStreams[i];
+
+		if (scale) {
+			streams_[stream] = { CameraStream::Scaled, 0,
+					     static_cast<unsigned int>(scaledStreams_.size()) };
+			scaledStreams_.push_back(stream);
+		} else {
+			streams_[stream] = { CameraStream::Direct, i, 0 };
+		}
+
+		stream->max_buffers = config_->at(scale ? 0 : i).bufferCount;
+	}
 
-	switch (config_->validate()) {
+	unsigned int jpegIndex = scale ? 1 : yuvStreams.size();
+	if (jpegStream) {
+		streams_[jpegStream] = { CameraStream::Jpeg, jpegIndex, 0 };
+		jpegStream->max_buffers = config_->at(jpegIndex).bufferCount;
+	}
+
+	if (scale || jpegStream)
+		allocator_.reset(FrameBufferAllocator::create(camera_));
+
+	if (scale) {
+		ret = configureScaler(&config_->at(0));
+		if (ret) {
+			clearStreams();
+			return ret;
+		}
+	}
+
+	if (jpegStream) {
+		ret = configureJpeg(&config_->at(jpegIndex));
+		if (ret) {
+			clearStreams();
+			return ret;
+		}
+
+		jpegStream_ = jpegStream;
+	}
+
+	return 0;
+}
+
+/*
+ * Generate and validate a camera configuration for the framework streams.
+ * YUV streams are captured with the viewfinder role, each from its own
+ * libcamera stream, or all from one libcamera stream at the largest size of
+ * the streams if \a scale is true. BLOB streams are captured in NV12 with the
+ * still capture role, and encoded to JPEG by the HAL.
+ */
+std::unique_ptr<CameraConfiguration>
+CameraDevice::generateConfiguration(const std::vector<camera3_stream_t *> &yuvStreams,
+				    camera3_stream_t *jpegStream, bool scale)
+{
+	std::vector<Size> sizes;
+
+	if (scale) {
+		Size size;
+		for (const camera3_stream_t *stream : yuvStreams) {
+			size.width = std::max(size.width, stream->width);
+			size.height = std::max(size.height, stream->height);
+		}
+
+		sizes.push_back(size);
+	} else {
+		for (const camera3_stream_t *stream : yuvStreams)
+			sizes.emplace_back(stream->width, stream->height);
+	}
+
+	StreamRoles roles(sizes.size(), StreamRole::Viewfinder);
+	if (jpegStream) {
+		roles.push_back(StreamRole::StillCapture);
+		sizes.emplace_back(jpegStream->width, jpegStream->height);
+	}
+
+	if (roles.empty())
+		return nullptr;
+
+	std::unique_ptr<CameraConfiguration> config =
+		camera_->generateConfiguration(roles);
+	if (!config || config->size() != roles.size()) {
+		LOG(HAL, Debug) << "Failed to generate camera configuration";
+		return nullptr;
+	}
+
+	for (unsigned int i = 0; i < roles.size(); ++i) {
+		StreamConfiguration &cfg = config->at(i);
+		cfg.size = sizes[i];
+
+		/*
+		 * \todo We'll need to translate from Android defined pixel
+		 * format codes to the libcamera image format codes. For now,
+		 * do not change the format returned from
+		 * Camera::generateConfiguration(), except for the frames
+		 * processed by the HAL.
+		 */
+		if (scale || roles[i] == StreamRole::StillCapture)
+			cfg.pixelFormat = DRM_FORMAT_NV12;
+	}
+
+	switch (config->validate()) {
 	case CameraConfiguration::Valid:
 		break;
 	case CameraConfiguration::Adjusted:
 		LOG(HAL, Info) << "Camera configuration adjusted";
-		config_.reset();
-		return -EINVAL;
+		return nullptr;
 	case CameraConfiguration::Invalid:
 		LOG(HAL, Info) << "Camera configuration invalid";
-		config_.reset();
-		return -EINVAL;
+		return nullptr;
 	}
 
-	camera3Stream->max_buffers = streamConfiguration->bufferCount;
+	return config;
+}
 
-	/*
-	 * Once the CameraConfiguration has been adjusted/validated
-	 * it can be applied to the camera.
-	 */
-	int ret = camera_->configure(config_.get());
+/*
+ * Release the buffers and the stream mappings of the current configuration.
+ */
+void CameraDevice::clearStreams()
+{
+	buffers_.clear();
+	jpegBuffers_.clear();
+	scalerBuffers_.clear();
+	allocator_.reset();
+
+	streams_.clear();
+	scaledStreams_.clear();
+	jpegStream_ = nullptr;
+}
+
+/*
+ * Allocate the internal buffers the frames of the BLOB stream are captured
+ * to, and configure the post-processor to encode them.
+ */
+int CameraDevice::configureJpeg(const StreamConfiguration *streamConfiguration)
+{
+	Stream *stream = streamConfiguration->stream();
+
+	int ret = allocator_->allocate(stream);
+	if (ret < 0) {
+		LOG(HAL, Error) << "Failed to allocate JPEG source buffers";
+		return ret;
+	}
+
+	for (const std::unique_ptr<FrameBuffer> &buffer : allocator_->buffers(stream))
+		jpegBuffers_.push_back(buffer.get());
+
+	ret = jpeg_->invokeMethod(&PostProcessorJpeg::configure,
+				  ConnectionTypeBlocking, *streamConfiguration);
 	if (ret) {
-		LOG(HAL, Error) << "Failed to configure camera '"
-				<< camera_->name() << "'";
+		LOG(HAL, Error) << "Failed to configure JPEG encoder";
 		return ret;
 	}
 
 	return 0;
 }
 
-void CameraDevice::processCaptureRequest(camera3_capture_request_t *camera3Request)
+/*
+ * Allocate the internal buffers the frames of the scaled streams are captured
+ * to, and configure the post-processor to scale them.
+ */
+int CameraDevice::configureScaler(const StreamConfiguration *streamConfiguration)
 {
-	StreamConfiguration *streamConfiguration = &config_->at(0);
 	Stream *stream = streamConfiguration->stream();
 
-	if (camera3Request->num_output_buffers != 1) {
-		LOG(HAL, Error) << "Invalid number of output buffers: "
-				<< camera3Request->num_output_buffers;
+	int ret = allocator_->allocate(stream);
+	if (ret < 0) {
+		LOG(HAL, Error) << "Failed to allocate scaler source buffers";
+		return ret;
+	}
+
+	for (const std::unique_ptr<FrameBuffer> &buffer : allocator_->buffers(stream))
+		scalerBuffers_.push_back(buffer.get());
+
+	std::vector<Size> outputs;
+	for (const camera3_stream_t *camera3Stream : scaledStreams_)
+		outputs.emplace_back(camera3Stream->width, camera3Stream->height);
+
+	ret = scaler_->invokeMethod(&PostProcessorScaler::configure,
+				    ConnectionTypeBlocking,
+				    *streamConfiguration, outputs);
+	if (ret) {
+		LOG(HAL, Error) << "Failed to configure scaler";
+		return ret;
+	}
+
+	return 0;
+}
+
+/*
+ * Queue a capture request from the framework. This method may be called from
+ * any thread. The request is copied to a descriptor and handed to the camera
+ * device thread without waiting for it to be processed, errors are reported
+ * asynchronously through notifications. The caller is only blocked when too
+ * many requests are in flight, to bound the work queued to the camera device
+ * thread.
+ */
+void CameraDevice::queueCaptureRequest(camera3_capture_request_t *camera3Request)
+{
+	MutexLocker locker(inFlightMutex_);
+	inFlightCondition_.wait(locker, [&] {
+		return inFlightRequests_ < MaxInFlightRequests;
+	});
+	inFlightRequests_++;
+	locker.unlock();
+
+	/*
+	 * The framework only guarantees the validity of the request during
+	 * this call, save everything needed to process it in the descriptor.
+	 * The gralloc handles themselves stay valid until their buffer is
+	 * returned. The descriptor is freed when the request completes.
+	 */
+	Camera3RequestDescriptor *descriptor =
+		new Camera3RequestDescriptor(camera3Request->frame_number,
+					     camera3Request->num_output_buffers);
+	for (unsigned int i = 0; i < descriptor->numBuffers; ++i)
+		descriptor->buffers[i] = camera3Request->output_buffers[i];
+
+	invokeMethod(&CameraDevice::processCaptureRequest,
+		     ConnectionTypeQueued, descriptor);
+}
+
+void CameraDevice::processCaptureRequest(Camera3RequestDescriptor *descriptor)
+{
+	if (!descriptor->numBuffers) {
+		LOG(HAL, Error) << "Request without output buffers";
+		abortRequest(descriptor);
 		return;
 	}
 
@@ -691,139 +1120,485 @@ void CameraDevice::processCaptureRequest(camera3_capture_request_t *camera3Reque
 		int ret = camera_->start();
 		if (ret) {
 			LOG(HAL, Error) << "Failed to start camera";
+			abortRequest(descriptor);
 			return;
 		}
 
 		running_ = true;
 	}
 
+	descriptor->request =
+		camera_->createRequest(reinterpret_cast<uint64_t>(descriptor));
+
 	/*
-	 * Queue a request for the Camera with the provided dmabuf file
-	 * descriptors.
+	 * Retrieve the libcamera buffer for each request buffer. BLOB streams
+	 * and scaled streams are captured to internal buffers, all scaled
+	 * streams sharing the same buffer.
 	 */
-	const camera3_stream_buffer_t *camera3Buffers =
-					camera3Request->output_buffers;
+	const camera3_stream_buffer_t *camera3Buffers = descriptor->buffers;
+	for (unsigned int i = 0; i < descriptor->numBuffers; ++i) {
+		auto it = streams_.find(camera3Buffers[i].stream);
+		if (it == streams_.end()) {
+			LOG(HAL, Error) << "Buffer for unconfigured stream";
+			abortRequest(descriptor);
+			return;
+		}
+
+		const CameraStream &cameraStream = it->second;
+		Stream *stream = config_->at(cameraStream.index).stream();
+		FrameBuffer *buffer = nullptr;
+
+		switch (cameraStream.type) {
+		case CameraStream::Scaled:
+			if (descriptor->scalerSource)
+				continue;
+
+			if (scalerBuffers_.empty()) {
+				LOG(HAL, Error) << "No scaler source buffer available";
+				abortRequest(descriptor);
+				return;
+			}
+
+			buffer = scalerBuffers_.front();
+			scalerBuffers_.pop_front();
+			descriptor->scalerSource = buffer;
+			break;
+
+		case CameraStream::Jpeg:
+			if (jpegBuffers_.empty()) {
+				LOG(HAL, Error) << "No JPEG source buffer available";
+				abortRequest(descriptor);
+				return;
+			}
+
+			buffer = jpegBuffers_.front();
+			jpegBuffers_.pop_front();
+			descriptor->frameBuffers[i] = buffer;
+			break;
+
+		case CameraStream::Direct:
+			buffer = frameBuffer(*camera3Buffers[i].buffer);
+			if (!buffer) {
+				LOG(HAL, Error) << "Failed to create buffer";
+				abortRequest(descriptor);
+				return;
+			}
+
+			descriptor->frameBuffers[i] = buffer;
+			break;
+		}
+
+		descriptor->request->addBuffer(stream, buffer);
+	}
 
 	/*
-	 * Save the request descriptors for use at completion time.
-	 * The descriptor and the associated memory reserved here are freed
-	 * at request complete time.
+	 * The buffers can't be queued to the camera before their acquire
+	 * fences signal. Wait for the fences asynchronously in the event loop
+	 * of the camera device thread instead of blocking the caller. Sync
+	 * files become readable when signalled.
 	 */
-	Camera3RequestDescriptor *descriptor =
-		new Camera3RequestDescriptor(camera3Request->frame_number,
-					     camera3Request->num_output_buffers);
 	for (unsigned int i = 0; i < descriptor->numBuffers; ++i) {
-		/*
-		 * Keep track of which stream the request belongs to and store
-		 * the native buffer handles.
-		 *
-		 * \todo Currently we only support one capture buffer. Copy
-		 * all of them to be ready once we'll support more.
-		 */
-		descriptor->buffers[i].stream = camera3Buffers[i].stream;
-		descriptor->buffers[i].buffer = camera3Buffers[i].buffer;
+		int fence = camera3Buffers[i].acquire_fence;
+		if (fence < 0)
+			continue;
+
+		EventNotifier *notifier = new EventNotifier(fence, EventNotifier::Read);
+		notifier->activated.connect(this, &CameraDevice::fenceSignalled);
+		descriptor->fences.emplace_back(notifier);
+		descriptor->pendingFences++;
+		fenceWaits_[notifier] = descriptor;
 	}
 
+	pendingRequests_.push_back(descriptor);
+	queuePendingRequests();
+}
+
+void CameraDevice::fenceSignalled(EventNotifier *notifier)
+{
 	/*
-	 * Create a libcamera buffer using the dmabuf descriptors of the first
-	 * and (currently) only supported request buffer.
+	 * The notifier is owned by the request descriptor, only disable it
+	 * here, it is destroyed with the descriptor.
 	 */
-	const buffer_handle_t camera3Handle = *camera3Buffers[0].buffer;
+	notifier->setEnabled(false);
 
-	std::vector<FrameBuffer::Plane> planes;
-	for (int i = 0; i < 3; i++) {
-		FrameBuffer::Plane plane;
-		plane.fd = FileDescriptor(camera3Handle->data[i]);
-		/*
-		 * Setting length to zero here is OK as the length is only used
-		 * to map the memory of the plane. Libcamera do not need to poke
-		 * at the memory content queued by the HAL.
-		 */
-		plane.length = 0;
-		planes.push_back(std::move(plane));
+	auto it = fenceWaits_.find(notifier);
+	if (it == fenceWaits_.end())
+		return;
+
+	Camera3RequestDescriptor *descriptor = it->second;
+	fenceWaits_.erase(it);
+
+	descriptor->pendingFences--;
+	queuePendingRequests();
+}
+
+/*
+ * Queue the requests whose fences have all signalled to the camera, stopping
+ * at the first request still waiting to preserve the order of the requests.
+ */
+void CameraDevice::queuePendingRequests()
+{
+	while (!pendingRequests_.empty()) {
+		Camera3RequestDescriptor *descriptor = pendingRequests_.front();
+		if (descriptor->pendingFences)
+			return;
+
+		pendingRequests_.pop_front();
+
+		int ret = camera_->queueRequest(descriptor->request.get());
+		if (ret) {
+			LOG(HAL, Error) << "Failed to queue request";
+			abortRequest(descriptor);
+		}
+	}
+}
+
+void CameraDevice::flushPendingRequests()
+{
+	for (Camera3RequestDescriptor *descriptor : pendingRequests_)
+		abortRequest(descriptor);
+
+	pendingRequests_.clear();
+	fenceWaits_.clear();
+}
+
+/*
+ * Delete a request descriptor, recycling the internal buffers it used to
+ * capture frames for the BLOB stream and the scaled streams.
+ */
+void CameraDevice::deleteDescriptor(Camera3RequestDescriptor *descriptor)
+{
+	for (unsigned int i = 0; i < descriptor->numBuffers; ++i) {
+		if (descriptor->buffers[i].stream == jpegStream_ &&
+		    descriptor->frameBuffers[i])
+			jpegBuffers_.push_back(descriptor->frameBuffers[i]);
+	}
+
+	if (descriptor->scalerSource)
+		scalerBuffers_.push_back(descriptor->scalerSource);
+
+	delete descriptor;
+
+	MutexLocker locker(inFlightMutex_);
+	inFlightRequests_--;
+	inFlightCondition_.notify_one();
+}
+
+/*
+ * Fail a request that couldn't be queued to the camera, returning all its
+ * buffers to the framework. The acquire fences that haven't been waited for
+ * yet are handed back as release fences.
+ */
+void CameraDevice::abortRequest(Camera3RequestDescriptor *descriptor)
+{
+	notifyError(descriptor->frameNumber, nullptr, CAMERA3_MSG_ERROR_REQUEST);
+
+	for (unsigned int i = 0; i < descriptor->numBuffers; ++i) {
+		camera3_stream_buffer_t &buffer = descriptor->buffers[i];
+		buffer.release_fence = descriptor->fences.empty()
+				     ? buffer.acquire_fence : -1;
+		buffer.acquire_fence = -1;
+		buffer.status = CAMERA3_BUFFER_STATUS_ERROR;
+	}
+
+	if (descriptor->numBuffers) {
+		camera3_capture_result_t captureResult = {};
+		captureResult.frame_number = descriptor->frameNumber;
+		captureResult.num_output_buffers = descriptor->numBuffers;
+		captureResult.output_buffers = descriptor->buffers;
+
+		callbacks_->process_capture_result(callbacks_, &captureResult);
+	}
+
+	deleteDescriptor(descriptor);
+}
+
+/*
+ * Return each buffer to the framework as soon as it completes, without
+ * waiting for the other streams of the request. The shutter and the early
+ * partial result are sent with the first buffer. Failed buffers are returned
+ * with the request, once the error type is known.
+ *
+ * Frames captured for the BLOB stream and the scaled streams are handed to
+ * the post-processors, and their buffers are returned once processed.
+ */
+void CameraDevice::bufferComplete(Request *request, FrameBuffer *buffer)
+{
+	if (buffer->metadata().status != FrameMetadata::FrameSuccess)
+		return;
+
+	Camera3RequestDescriptor *descriptor =
+		reinterpret_cast<Camera3RequestDescriptor *>(request->cookie());
+
+	bool scalerSource = buffer == descriptor->scalerSource;
+	auto it = std::find(descriptor->frameBuffers.begin(),
+			    descriptor->frameBuffers.end(), buffer);
+	if (!scalerSource && it == descriptor->frameBuffers.end())
+		return;
+
+	camera3_capture_result_t captureResult = {};
+	captureResult.frame_number = descriptor->frameNumber;
+
+	if (!descriptor->shutterNotified) {
+		uint64_t timestamp = buffer->metadata().timestamp;
+
+		notifyShutter(descriptor->frameNumber, timestamp);
+		descriptor->shutterNotified = true;
+
+		captureResult.result = getEarlyResultMetadata(timestamp);
+		if (captureResult.result)
+			captureResult.partial_result = 1;
 	}
 
-	FrameBuffer *buffer = new FrameBuffer(std::move(planes));
-	if (!buffer) {
-		LOG(HAL, Error) << "Failed to create buffer";
-		delete descriptor;
+	if (scalerSource) {
+		if (captureResult.result)
+			callbacks_->process_capture_result(callbacks_,
+							   &captureResult);
+
+		scaleBuffers(descriptor);
 		return;
 	}
 
-	Request *request =
-		camera_->createRequest(reinterpret_cast<uint64_t>(descriptor));
-	request->addBuffer(stream, buffer);
+	unsigned int index = it - descriptor->frameBuffers.begin();
+	camera3_stream_buffer_t *camera3Buffer = &descriptor->buffers[index];
+
+	if (camera3Buffer->stream == jpegStream_) {
+		if (captureResult.result)
+			callbacks_->process_capture_result(callbacks_,
+							   &captureResult);
+
+		descriptor->states[index] = BufferProcessing;
+		jpeg_->invokeMethod(&PostProcessorJpeg::process,
+				    ConnectionTypeQueued, buffer,
+				    *camera3Buffer->buffer,
+				    static_cast<void *>(descriptor));
+		return;
+	}
+
+	camera3Buffer->acquire_fence = -1;
+	camera3Buffer->release_fence = -1;
+	camera3Buffer->status = CAMERA3_BUFFER_STATUS_OK;
+	descriptor->states[index] = BufferReturned;
+
+	captureResult.num_output_buffers = 1;
+	captureResult.output_buffers = camera3Buffer;
+
+	callbacks_->process_capture_result(callbacks_, &captureResult);
+}
+
+/*
+ * Return the BLOB buffer of a request once its frame has been encoded. The
+ * buffer is only written by the post-processor, which has completed, there's
+ * thus no release fence.
+ */
+void CameraDevice::jpegProcessed(void *cookie, FrameBuffer *source, int ret)
+{
+	Camera3RequestDescriptor *descriptor =
+		static_cast<Camera3RequestDescriptor *>(cookie);
+
+	auto it = std::find(descriptor->frameBuffers.begin(),
+			    descriptor->frameBuffers.end(), source);
+	if (it == descriptor->frameBuffers.end())
+		return;
+
+	unsigned int index = it - descriptor->frameBuffers.begin();
+	camera3_stream_buffer_t *camera3Buffer = &descriptor->buffers[index];
+
+	camera3Buffer->acquire_fence = -1;
+	camera3Buffer->release_fence = -1;
+	descriptor->states[index] = BufferReturned;
 
-	int ret = camera_->queueRequest(request);
 	if (ret) {
-		LOG(HAL, Error) << "Failed to queue request";
-		goto error;
+		LOG(HAL, Error) << "Failed to encode JPEG frame "
+				<< descriptor->frameNumber;
+		camera3Buffer->status = CAMERA3_BUFFER_STATUS_ERROR;
+		notifyError(descriptor->frameNumber, camera3Buffer->stream,
+			    CAMERA3_MSG_ERROR_BUFFER);
+	} else {
+		camera3Buffer->status = CAMERA3_BUFFER_STATUS_OK;
 	}
 
-	return;
+	camera3_capture_result_t captureResult = {};
+	captureResult.frame_number = descriptor->frameNumber;
+	captureResult.num_output_buffers = 1;
+	captureResult.output_buffers = camera3Buffer;
 
-error:
-	delete request;
-	delete descriptor;
+	callbacks_->process_capture_result(callbacks_, &captureResult);
+
+	if (descriptor->completed &&
+	    std::find(descriptor->states.begin(), descriptor->states.end(),
+		      BufferProcessing) == descriptor->states.end())
+		deleteDescriptor(descriptor);
 }
 
-void CameraDevice::requestComplete(Request *request)
+/*
+ * Hand the frame captured for the scaled streams of a request to the
+ * post-processor, to be scaled to all their buffers at once.
+ */
+void CameraDevice::scaleBuffers(Camera3RequestDescriptor *descriptor)
+{
+	std::vector<buffer_handle_t> destinations(scaledStreams_.size(), nullptr);
+
+	for (unsigned int i = 0; i < descriptor->numBuffers; ++i) {
+		const camera3_stream_buffer_t &camera3Buffer = descriptor->buffers[i];
+		const CameraStream &cameraStream = streams_[camera3Buffer.stream];
+		if (cameraStream.type != CameraStream::Scaled)
+			continue;
+
+		destinations[cameraStream.output] = *camera3Buffer.buffer;
+		descriptor->states[i] = BufferProcessing;
+	}
+
+	scaler_->invokeMethod(&PostProcessorScaler::process,
+			      ConnectionTypeQueued, descriptor->scalerSource,
+			      destinations, static_cast<void *>(descriptor));
+}
+
+/*
+ * Return the buffers of the scaled streams of a request once the frame has
+ * been scaled. As for BLOB buffers, there's no release fence.
+ */
+void CameraDevice::scalerProcessed(void *cookie, FrameBuffer *source, int ret)
 {
-	const std::map<Stream *, FrameBuffer *> &buffers = request->buffers();
-	FrameBuffer *buffer = buffers.begin()->second;
-	camera3_buffer_status status = CAMERA3_BUFFER_STATUS_OK;
-	std::unique_ptr<CameraMetadata> resultMetadata;
+	Camera3RequestDescriptor *descriptor =
+		static_cast<Camera3RequestDescriptor *>(cookie);
+
+	if (ret)
+		LOG(HAL, Error) << "Failed to scale frame "
+				<< descriptor->frameNumber;
+
+	std::vector<camera3_stream_buffer_t> buffers;
+	for (unsigned int i = 0; i < descriptor->numBuffers; ++i) {
+		if (descriptor->states[i] != BufferProcessing ||
+		    streams_[descriptor->buffers[i].stream].type != CameraStream::Scaled)
+			continue;
+
+		camera3_stream_buffer_t &buffer = descriptor->buffers[i];
+		buffer.acquire_fence = -1;
+		buffer.release_fence = -1;
+		buffer.status = ret ? CAMERA3_BUFFER_STATUS_ERROR
+				    : CAMERA3_BUFFER_STATUS_OK;
+		descriptor->states[i] = BufferReturned;
+		buffers.push_back(buffer);
+
+		if (ret)
+			notifyError(descriptor->frameNumber, buffer.stream,
+				    CAMERA3_MSG_ERROR_BUFFER);
+	}
+
+	camera3_capture_result_t captureResult = {};
+	captureResult.frame_number = descriptor->frameNumber;
+	captureResult.num_output_buffers = buffers.size();
+	captureResult.output_buffers = buffers.data();
+
+	callbacks_->process_capture_result(callbacks_, &captureResult);
+
+	if (descriptor->completed &&
+	    std::find(descriptor->states.begin(), descriptor->states.end(),
+		      BufferProcessing) == descriptor->states.end())
+		deleteDescriptor(descriptor);
+}
 
-	if (request->status() != Request::RequestComplete) {
+void CameraDevice::requestComplete(Request *request)
+{
+	if (request->status() != Request::RequestComplete)
 		LOG(HAL, Error) << "Request not succesfully completed: "
 				<< request->status();
-		status = CAMERA3_BUFFER_STATUS_ERROR;
-	}
 
 	/* Prepare to call back the Android camera stack. */
 	Camera3RequestDescriptor *descriptor =
 		reinterpret_cast<Camera3RequestDescriptor *>(request->cookie());
 
-	camera3_capture_result_t captureResult = {};
-	captureResult.frame_number = descriptor->frameNumber;
-	captureResult.num_output_buffers = descriptor->numBuffers;
+	/*
+	 * Without a shutter notification, no buffer has been returned and the
+	 * whole request has failed. Otherwise, report the failed buffers
+	 * individually.
+	 */
+	if (!descriptor->shutterNotified)
+		notifyError(descriptor->frameNumber,
+			    descriptor->buffers[0].stream,
+			    CAMERA3_MSG_ERROR_REQUEST);
+
+	std::vector<camera3_stream_buffer_t> buffers;
 	for (unsigned int i = 0; i < descriptor->numBuffers; ++i) {
-		/*
-		 * \todo Currently we only support one capture buffer. Prepare
-		 * all of them to be ready once we'll support more.
-		 */
-		descriptor->buffers[i].acquire_fence = -1;
-		descriptor->buffers[i].release_fence = -1;
-		descriptor->buffers[i].status = status;
+		if (descriptor->states[i] != BufferPending)
+			continue;
+
+		camera3_stream_buffer_t &buffer = descriptor->buffers[i];
+		buffer.acquire_fence = -1;
+		buffer.release_fence = -1;
+		buffer.status = CAMERA3_BUFFER_STATUS_ERROR;
+		buffers.push_back(buffer);
+
+		if (descriptor->shutterNotified)
+			notifyError(descriptor->frameNumber, buffer.stream,
+				    CAMERA3_MSG_ERROR_BUFFER);
 	}
-	captureResult.output_buffers =
-		const_cast<const camera3_stream_buffer_t *>(descriptor->buffers);
 
-	if (status == CAMERA3_BUFFER_STATUS_OK) {
-		notifyShutter(descriptor->frameNumber,
-			      buffer->metadata().timestamp);
+	camera3_capture_result_t captureResult = {};
+	captureResult.frame_number = descriptor->frameNumber;
+	captureResult.num_output_buffers = buffers.size();
+	captureResult.output_buffers = buffers.data();
+
+	if (descriptor->shutterNotified) {
+		captureResult.result = getResultMetadata(request->metadata());
 
-		captureResult.partial_result = 1;
-		resultMetadata = getResultMetadata(descriptor->frameNumber,
-						   buffer->metadata().timestamp);
-		captureResult.result = resultMetadata->get();
+		if (captureResult.result)
+			captureResult.partial_result = 2;
+		else
+			notifyError(descriptor->frameNumber, nullptr,
+				    CAMERA3_MSG_ERROR_RESULT);
 	}
 
-	if (status == CAMERA3_BUFFER_STATUS_ERROR || !captureResult.result) {
-		/* \todo Improve error handling. In case we notify an error
-		 * because the metadata generation fails, a shutter event has
-		 * already been notified for this frame number before the error
-		 * is here signalled. Make sure the error path plays well with
-		 * the camera stack state machine.
+	if (captureResult.num_output_buffers || captureResult.result)
+		callbacks_->process_capture_result(callbacks_, &captureResult);
+
+	/* Keep the descriptor until its frames have been encoded. */
+	descriptor->completed = true;
+	if (std::find(descriptor->states.begin(), descriptor->states.end(),
+		      BufferProcessing) != descriptor->states.end())
+		return;
+
+	deleteDescriptor(descriptor);
+}
+
+/*
+ * Retrieve the libcamera buffer wrapping a gralloc handle. The framework
+ * cycles through a small set of buffers, reusing the same FrameBuffer for a
+ * handle lets the pipeline handler find it in its V4L2 buffer cache instead
+ * of importing the dmabufs again for every request.
+ *
+ * Handles may be freed and their address reused for a different buffer, the
+ * cached buffer is thus only reused if the file descriptors are unchanged.
+ */
+FrameBuffer *CameraDevice::frameBuffer(buffer_handle_t camera3Handle)
+{
+	std::array<int, 3> fds;
+	for (unsigned int i = 0; i < fds.size(); i++)
+		fds[i] = camera3Handle->data[i];
+
+	auto it = buffers_.find(camera3Handle);
+	if (it != buffers_.end() && it->second.fds == fds)
+		return it->second.buffer.get();
+
+	std::vector<FrameBuffer::Plane> planes;
+	for (int fd : fds) {
+		FrameBuffer::Plane plane;
+		plane.fd = FileDescriptor(fd);
+		/*
+		 * Setting length to zero here is OK as the length is only used
+		 * to map the memory of the plane. Libcamera do not need to poke
+		 * at the memory content queued by the HAL.
 		 */
-		notifyError(descriptor->frameNumber,
-			    descriptor->buffers[0].stream);
+		plane.length = 0;
+		planes.push_back(std::move(plane));
 	}
 
-	callbacks_->process_capture_result(callbacks_, &captureResult);
+	CachedBuffer &cached = buffers_[camera3Handle];
+	cached.buffer = std::make_unique<FrameBuffer>(std::move(planes));
+	cached.fds = fds;
 
-	delete descriptor;
-	delete buffer;
+	return cached.buffer.get();
 }
 
 void CameraDevice::notifyShutter(uint32_t frameNumber, uint64_t timestamp)
@@ -837,58 +1612,45 @@ void CameraDevice::notifyShutter(uint32_t frameNumber, uint64_t timestamp)
 	callbacks_->notify(callbacks_, &notify);
 }
 
-void CameraDevice::notifyError(uint32_t frameNumber, camera3_stream_t *stream)
+void CameraDevice::notifyError(uint32_t frameNumber, camera3_stream_t *stream,
+			       camera3_error_msg_code code)
 {
 	camera3_notify_msg_t notify = {};
 
 	notify.type = CAMERA3_MSG_ERROR;
 	notify.message.error.error_stream = stream;
 	notify.message.error.frame_number = frameNumber;
-	notify.message.error.error_code = CAMERA3_MSG_ERROR_REQUEST;
+	notify.message.error.error_code = code;
 
 	callbacks_->notify(callbacks_, &notify);
 }
 
 /*
- * Produce a set of fixed result metadata.
+ * Produce the sensor result metadata, sent in the first partial result when
+ * the first buffer of a request completes.
+ *
+ * The framework copies the result metadata in process_capture_result(), the
+ * metadata pack is thus allocated once and updated in place for every frame.
  */
-std::unique_ptr<CameraMetadata> CameraDevice::getResultMetadata(int frame_number,
-								int64_t timestamp)
+camera_metadata_t *CameraDevice::getEarlyResultMetadata(int64_t timestamp)
 {
+	if (earlyResultMetadata_) {
+		earlyResultMetadata_->updateEntry(ANDROID_SENSOR_TIMESTAMP,
+						  &timestamp, 1);
+		return earlyResultMetadata_->get();
+	}
+
 	/*
 	 * \todo Keep this in sync with the actual number of entries.
-	 * Currently: 12 entries, 36 bytes
+	 * Currently: 3 entries, 24 bytes
 	 */
 	std::unique_ptr<CameraMetadata> resultMetadata =
-		std::make_unique<CameraMetadata>(15, 50);
+		std::make_unique<CameraMetadata>(3, 24);
 	if (!resultMetadata->isValid()) {
-		LOG(HAL, Error) << "Failed to allocate static metadata";
+		LOG(HAL, Error) << "Failed to allocate early result metadata";
 		return nullptr;
 	}
 
-	const uint8_t ae_state = ANDROID_CONTROL_AE_STATE_CONVERGED;
-	resultMetadata->addEntry(ANDROID_CONTROL_AE_STATE, &ae_state, 1);
-
-	const uint8_t ae_lock = ANDROID_CONTROL_AE_LOCK_OFF;
-	resultMetadata->addEntry(ANDROID_CONTROL_AE_LOCK, &ae_lock, 1);
-
-	uint8_t af_state = ANDROID_CONTROL_AF_STATE_INACTIVE;
-	resultMetadata->addEntry(ANDROID_CONTROL_AF_STATE, &af_state, 1);
-
-	const uint8_t awb_state = ANDROID_CONTROL_AWB_STATE_CONVERGED;
-	resultMetadata->addEntry(ANDROID_CONTROL_AWB_STATE, &awb_state, 1);
-
-	const uint8_t awb_lock = ANDROID_CONTROL_AWB_LOCK_OFF;
-	resultMetadata->addEntry(ANDROID_CONTROL_AWB_LOCK, &awb_lock, 1);
-
-	const uint8_t lens_state = ANDROID_LENS_STATE_STATIONARY;
-	resultMetadata->addEntry(ANDROID_LENS_STATE, &lens_state, 1);
-
-	int32_t sensorSizes[] = {
-		0, 0, 2560, 1920,
-	};
-	resultMetadata->addEntry(ANDROID_SCALER_CROP_REGION, sensorSizes, 4);
-
 	resultMetadata->addEntry(ANDROID_SENSOR_TIMESTAMP, &timestamp, 1);
 
 	/* 33.3 msec */
@@ -901,22 +1663,48 @@ std::unique_ptr<CameraMetadata> CameraDevice::getResultMetadata(int frame_number
 	resultMetadata->addEntry(ANDROID_SENSOR_EXPOSURE_TIME,
 				 &exposure_time, 1);
 
-	const uint8_t lens_shading_map_mode =
-				ANDROID_STATISTICS_LENS_SHADING_MAP_MODE_OFF;
-	resultMetadata->addEntry(ANDROID_STATISTICS_LENS_SHADING_MAP_MODE,
-				 &lens_shading_map_mode, 1);
+	if (!resultMetadata->isValid()) {
+		LOG(HAL, Error) << "Failed to construct early result metadata";
+		return nullptr;
+	}
+
+	earlyResultMetadata_ = std::move(resultMetadata);
 
-	const uint8_t scene_flicker = ANDROID_STATISTICS_SCENE_FLICKER_NONE;
-	resultMetadata->addEntry(ANDROID_STATISTICS_SCENE_FLICKER,
-				 &scene_flicker, 1);
+	return earlyResultMetadata_->get();
+}
 
-	/*
-	 * Return the result metadata pack even is not valid: get() will return
-	 * nullptr.
-	 */
-	if (!resultMetadata->isValid()) {
+/*
+ * Produce the remaining result metadata, sent in the final partial result when
+ * the request completes. The metadata pack is allocated once, and rebuilt in
+ * place for every request from the resultMetadataMap table.
+ */
+camera_metadata_t *CameraDevice::getResultMetadata(const ControlList &metadata)
+{
+	if (!resultMetadata_) {
+		resultMetadata_ = std::make_unique<CameraMetadata>(resultMetadataEntries,
+								   resultMetadataData);
+	} else {
+		resultMetadata_->reset();
+	}
+
+	if (!resultMetadata_->isValid()) {
+		LOG(HAL, Error) << "Failed to allocate result metadata";
+		resultMetadata_.reset();
+		return nullptr;
+	}
+
+	for (const ResultMetadataMap &entry : resultMetadataMap) {
+		const ControlValue *value = nullptr;
+		if (entry.id && metadata.contains(*entry.id))
+			value = &metadata.get(entry.id->id());
+
+		entry.translate(resultMetadata_.get(), entry.tag, value);
+	}
+
+	if (!resultMetadata_->isValid()) {
 		LOG(HAL, Error) << "Failed to construct result metadata";
+		return nullptr;
 	}
 
-	return resultMetadata;
+	return resultMetadata_->get();
 }
@@ -7,19 +7,29 @@
 #ifndef __ANDROID_CAMERA_DEVICE_H__
 #define __ANDROID_CAMERA_DEVICE_H__
 
+#include <array>
+#include <condition_variable>
+#include <deque>
+#include <map>
 #include <memory>
+#include <vector>
 
 #include <hardware/camera3.h>
 
 #include <libcamera/buffer.h>
 #include <libcamera/camera.h>
+#include <libcamera/event_notifier.h>
+#include <libcamera/framebuffer_allocator.h>
 #include <libcamera/object.h>
 #include <libcamera/request.h>
 #include <libcamera/stream.h>
 
 #include "message.h"
+#include "thread.h"
 
 class CameraMetadata;
+class PostProcessorJpeg;
+class PostProcessorScaler;
 
 class CameraDevice : public libcamera::Object
 {
@@ -33,10 +43,18 @@ public:
 	camera_metadata_t *getStaticMetadata();
 	const camera_metadata_t *constructDefaultRequestSettings(int type);
 	int configureStreams(camera3_stream_configuration_t *stream_list);
-	void processCaptureRequest(camera3_capture_request_t *request);
+	void queueCaptureRequest(camera3_capture_request_t *request);
+	void bufferComplete(libcamera::Request *request,
+			    libcamera::FrameBuffer *buffer);
 	void requestComplete(libcamera::Request *request);
 
 private:
+	enum BufferState {
+		BufferPending,
+		BufferProcessing,
+		BufferReturned,
+	};
+
 	struct Camera3RequestDescriptor {
 		Camera3RequestDescriptor(unsigned int frameNumber,
 					 unsigned int numBuffers);
@@ -45,20 +63,122 @@ private:
 		uint32_t frameNumber;
 		uint32_t numBuffers;
 		camera3_stream_buffer_t *buffers;
+		std::unique_ptr<libcamera::Request> request;
+
+		std::vector<libcamera::FrameBuffer *> frameBuffers;
+		libcamera::FrameBuffer *scalerSource;
+		std::vector<BufferState> states;
+		bool shutterNotified;
+		bool completed;
+
+		std::vector<std::unique_ptr<libcamera::EventNotifier>> fences;
+		unsigned int pendingFences;
+	};
+
+	struct CachedBuffer {
+		std::unique_ptr<libcamera::FrameBuffer> buffer;
+		std::array<int, 3> fds;
+	};
+
+	/*
+	 * Mapping of a framework stream to the libcamera stream configuration
+	 * at index in config_. Scaled streams are produced by the scaler
+	 * output at index output from the frames of that stream.
+	 */
+	struct CameraStream {
+		enum Type {
+			Direct,
+			Jpeg,
+			Scaled,
+		};
+
+		Type type;
+		unsigned int index;
+		unsigned int output;
 	};
 
+	std::unique_ptr<libcamera::CameraConfiguration>
+	generateConfiguration(const std::vector<camera3_stream_t *> &yuvStreams,
+			      camera3_stream_t *jpegStream, bool scale);
+	void clearStreams();
+	int configureJpeg(const libcamera::StreamConfiguration *streamConfiguration);
+	int configureScaler(const libcamera::StreamConfiguration *streamConfiguration);
+	libcamera::FrameBuffer *frameBuffer(buffer_handle_t camera3Handle);
+	void fenceSignalled(libcamera::EventNotifier *notifier);
+	void queuePendingRequests();
+	void processCaptureRequest(Camera3RequestDescriptor *descriptor);
+	void flushPendingRequests();
+	void deleteDescriptor(Camera3RequestDescriptor *descriptor);
+	void abortRequest(Camera3RequestDescriptor *descriptor);
+	void jpegProcessed(void *cookie, libcamera::FrameBuffer *source,
+			   int ret);
+	void scaleBuffers(Camera3RequestDescriptor *descriptor);
+	void scalerProcessed(void *cookie, libcamera::FrameBuffer *source,
+			     int ret);
+
 	void notifyShutter(uint32_t frameNumber, uint64_t timestamp);
-	void notifyError(uint32_t frameNumber, camera3_stream_t *stream);
-	std::unique_ptr<CameraMetadata> getResultMetadata(int frame_number,
-							  int64_t timestamp);
+	void notifyError(uint32_t frameNumber, camera3_stream_t *stream,
+			 camera3_error_msg_code code);
+	camera_metadata_t *getEarlyResultMetadata(int64_t timestamp);
+	camera_metadata_t *getResultMetadata(const libcamera::ControlList &metadata);
 
 	bool running_;
 	std::shared_ptr<libcamera::Camera> camera_;
 	std::unique_ptr<libcamera::CameraConfiguration> config_;
+	std::map<const camera3_stream_t *, CameraStream> streams_;
 
 	CameraMetadata *staticMetadata_;
 	std::map<unsigned int, CameraMetadata *> requestTemplates_;
+	std::unique_ptr<CameraMetadata> earlyResultMetadata_;
+	std::unique_ptr<CameraMetadata> resultMetadata_;
 	const camera3_callback_ops_t *callbacks_;
+
+	/*
+	 * Buffers created for the gralloc handles queued by the framework,
+	 * kept for the lifetime of the stream configuration.
+	 */
+	std::map<buffer_handle_t, CachedBuffer> buffers_;
+
+	/*
+	 * Requests waiting for the acquire fences of their buffers, in the
+	 * order they have been received from the framework.
+	 */
+	std::deque<Camera3RequestDescriptor *> pendingRequests_;
+	std::map<libcamera::EventNotifier *, Camera3RequestDescriptor *> fenceWaits_;
+
+	/*
+	 * Requests received from the framework and not completed yet, bounded
+	 * to MaxInFlightRequests. The framework itself doesn't queue more
+	 * buffers than the max_buffers of the streams, the limit only guards
+	 * against a stalled camera device thread.
+	 */
+	static constexpr unsigned int MaxInFlightRequests = 8;
+	libcamera::Mutex inFlightMutex_;
+	std::condition_variable inFlightCondition_;
+	unsigned int inFlightRequests_;
+
+	/* Allocator of the internal buffers of the JPEG and scaler sources. */
+	std::unique_ptr<libcamera::FrameBufferAllocator> allocator_;
+
+	/*
+	 * BLOB stream, captured in NV12 to internal buffers and encoded to
+	 * JPEG in the gralloc buffers by the post-processor, in its own
+	 * thread.
+	 */
+	camera3_stream_t *jpegStream_;
+	std::deque<libcamera::FrameBuffer *> jpegBuffers_;
+	std::unique_ptr<PostProcessorJpeg> jpeg_;
+	libcamera::Thread jpegThread_;
+
+	/*
+	 * YUV streams the camera can't produce concurrently, captured in NV12
+	 * to internal buffers at the largest size of the streams, and scaled
+	 * to the gralloc buffers by the post-processor, in its own thread.
+	 */
+	std::vector<camera3_stream_t *> scaledStreams_;
+	std::deque<libcamera::FrameBuffer *> scalerBuffers_;
+	std::unique_ptr<PostProcessorScaler> scaler_;
+	libcamera::Thread scalerThread_;
 };
 
 #endif /* __ANDROID_CAMERA_DEVICE_H__ */
@@ -46,6 +46,52 @@ bool CameraMetadata::addEntry(uint32_t tag, const void *data, size_t count)
 	return false;
 }
 
+/*
+ * Update the data of an existing entry. The update is performed in place if
+ * the data count is unchanged, without any memory allocation.
+ */
+bool CameraMetadata::updateEntry(uint32_t tag, const void *data, size_t count)
+{
+	if (!valid_)
+		return false;
+
+	camera_metadata_entry_t entry;
+	int ret = find_camera_metadata_entry(metadata_, tag, &entry);
+	if (!ret)
+		ret = update_camera_metadata_entry(metadata_, entry.index,
+						   data, count, nullptr);
+	if (!ret)
+		return true;
+
+	const char *name = get_camera_metadata_tag_name(tag);
+	if (name)
+		LOG(CameraMetadata, Error)
+			<< "Failed to update tag " << name;
+	else
+		LOG(CameraMetadata, Error)
+			<< "Failed to update unknown tag " << tag;
+
+	return false;
+}
+
+/*
+ * Remove all entries. The metadata pack is reinitialised in place with the same
+ * capacity, without any memory allocation.
+ */
+bool CameraMetadata::reset()
+{
+	if (!metadata_)
+		return false;
+
+	camera_metadata_t *metadata =
+		place_camera_metadata(metadata_, get_camera_metadata_size(metadata_),
+				      get_camera_metadata_entry_capacity(metadata_),
+				      get_camera_metadata_data_capacity(metadata_));
+	valid_ = metadata != nullptr;
+
+	return valid_;
+}
+
 camera_metadata_t *CameraMetadata::get()
 {
 	return valid_ ? metadata_ : nullptr;
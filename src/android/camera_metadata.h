@@ -19,6 +19,8 @@ public:
 
 	bool isValid() { return valid_; }
 	bool addEntry(uint32_t tag, const void *data, size_t data_count);
+	bool updateEntry(uint32_t tag, const void *data, size_t data_count);
+	bool reset();
 
 	camera_metadata_t *get();
 
@@ -173,8 +173,7 @@ int CameraProxy::configureStreams(camera3_stream_configuration_t *stream_list)
 
 int CameraProxy::processCaptureRequest(camera3_capture_request_t *request)
 {
-	cameraDevice_->invokeMethod(&CameraDevice::processCaptureRequest,
-				    ConnectionTypeBlocking, request);
+	cameraDevice_->queueCaptureRequest(request);
 
 	return 0;
 }
@@ -0,0 +1,350 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * downscaler.cpp - Multi-output NV12 downscaler
+ */
+
+#include "downscaler.h"
+
+#include <algorithm>
+#include <errno.h>
+#include <string.h>
+#include <thread>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+using namespace libcamera;
+
+namespace {
+
+/* Number of source lines processed for all outputs before moving on. */
+constexpr unsigned int ChunkLines = 16;
+
+/*
+ * Interpolate between lines \a a and \a b, with \a weight / 256 of \a b. The
+ * vector code processes 16 bytes per iteration, and produces exactly the same
+ * results as the scalar code.
+ */
+void blendLines(const uint8_t *a, const uint8_t *b, unsigned int weight,
+		uint8_t *dst, unsigned int width)
+{
+	if (!weight) {
+		memcpy(dst, a, width);
+		return;
+	}
+
+	unsigned int x = 0;
+
+#if defined(__SSE2__)
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i weightA = _mm_set1_epi16(256 - weight);
+	const __m128i weightB = _mm_set1_epi16(weight);
+	const __m128i round = _mm_set1_epi16(128);
+
+	for (; x + 16 <= width; x += 16) {
+		__m128i va = _mm_loadu_si128(reinterpret_cast<const __m128i *>(a + x));
+		__m128i vb = _mm_loadu_si128(reinterpret_cast<const __m128i *>(b + x));
+
+		__m128i lo = _mm_add_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(va, zero), weightA),
+					   _mm_mullo_epi16(_mm_unpacklo_epi8(vb, zero), weightB));
+		__m128i hi = _mm_add_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(va, zero), weightA),
+					   _mm_mullo_epi16(_mm_unpackhi_epi8(vb, zero), weightB));
+		lo = _mm_srli_epi16(_mm_add_epi16(lo, round), 8);
+		hi = _mm_srli_epi16(_mm_add_epi16(hi, round), 8);
+
+		_mm_storeu_si128(reinterpret_cast<__m128i *>(dst + x),
+				 _mm_packus_epi16(lo, hi));
+	}
+#elif defined(__ARM_NEON)
+	const uint8x8_t weightA = vdup_n_u8(256 - weight);
+	const uint8x8_t weightB = vdup_n_u8(weight);
+
+	for (; x + 16 <= width; x += 16) {
+		uint8x16_t va = vld1q_u8(a + x);
+		uint8x16_t vb = vld1q_u8(b + x);
+
+		uint16x8_t lo = vmlal_u8(vmull_u8(vget_low_u8(va), weightA),
+					 vget_low_u8(vb), weightB);
+		uint16x8_t hi = vmlal_u8(vmull_u8(vget_high_u8(va), weightA),
+					 vget_high_u8(vb), weightB);
+
+		vst1q_u8(dst + x, vcombine_u8(vrshrn_n_u16(lo, 8),
+					      vrshrn_n_u16(hi, 8)));
+	}
+#endif
+
+	for (; x < width; ++x)
+		dst[x] = (a[x] * (256 - weight) + b[x] * weight + 128) >> 8;
+}
+
+} /* namespace */
+
+/*
+ * \class Downscaler
+ * \brief Scale an NV12 frame down to multiple sizes in a single pass
+ *
+ * The outputs are produced by bilinear interpolation, horizontally first, and
+ * then vertically between two horizontally resampled lines, with vector
+ * instructions when available. The source frame is processed in chunks of
+ * lines, and the output lines interpolated from a chunk are produced for all
+ * outputs before moving to the next chunk, while its lines are still in the
+ * CPU caches. The frame is split in horizontal stripes processed concurrently
+ * by multiple threads.
+ *
+ * The source luma and chroma lines are \a stride bytes long. The output lines
+ * are packed, without padding.
+ */
+
+Downscaler::Downscaler()
+	: stride_(0), threads_(1)
+{
+}
+
+/*
+ * Configure the downscaler for \a input frames with lines of \a stride bytes,
+ * scaled to the \a outputs sizes. Widths must be even, and outputs can't be
+ * larger than the input.
+ */
+int Downscaler::configure(const Size &input, unsigned int stride,
+			  const std::vector<Size> &outputs)
+{
+	outputs_.clear();
+
+	if (!input.width || !input.height || input.width % 2 ||
+	    stride < input.width)
+		return -EINVAL;
+
+	for (const Size &size : outputs) {
+		if (!size.width || !size.height || size.width % 2 ||
+		    size.width > input.width || size.height > input.height) {
+			outputs_.clear();
+			return -EINVAL;
+		}
+
+		Output output;
+		mapPlane(input.width, input.height, size.width, size.height,
+			 1, &output.luma);
+		mapPlane(input.width / 2, (input.height + 1) / 2,
+			 size.width / 2, (size.height + 1) / 2, 2,
+			 &output.chroma);
+		outputs_.push_back(std::move(output));
+	}
+
+	input_ = input;
+	stride_ = stride;
+
+	return 0;
+}
+
+/*
+ * Set the number of threads used to scale a frame. Each thread processes one
+ * stripe of the source frame for all outputs.
+ */
+void Downscaler::setThreads(unsigned int threads)
+{
+	threads_ = std::max(threads, 1U);
+}
+
+/*
+ * Scale the frame whose luma and chroma planes are stored in \a y and \a uv to
+ * the \a outputs, one per configured size. Outputs with null planes are
+ * skipped.
+ */
+void Downscaler::scale(const uint8_t *y, const uint8_t *uv,
+		       const std::vector<Image> &outputs)
+{
+	if (outputs.size() != outputs_.size())
+		return;
+
+	const unsigned int height = input_.height;
+	unsigned int threads = std::min(threads_, height);
+	std::vector<std::thread> workers;
+
+	for (unsigned int i = 1; i < threads; ++i)
+		workers.emplace_back(&Downscaler::scaleStripe, this, y, uv,
+				     std::cref(outputs), height * i / threads,
+				     height * (i + 1) / threads);
+
+	scaleStripe(y, uv, outputs, 0, height / threads);
+
+	for (std::thread &worker : workers)
+		worker.join();
+}
+
+/*
+ * Compute the interpolation taps to scale an axis from \a input to \a output
+ * samples, sampling the input at the centre of the output samples. The weight
+ * of the second sample is expressed in 1/256.
+ */
+void Downscaler::mapAxis(unsigned int input, unsigned int output,
+			 std::vector<Tap> *taps)
+{
+	const uint64_t step = (static_cast<uint64_t>(input) << 16) / output;
+
+	taps->resize(output);
+
+	for (unsigned int i = 0; i < output; ++i) {
+		int64_t pos = static_cast<int64_t>(i * step + step / 2) - (1 << 15);
+		pos = std::max<int64_t>(pos, 0);
+
+		Tap &tap = (*taps)[i];
+		tap.first = pos >> 16;
+		tap.weight = (pos & 0xffff) >> 8;
+
+		if (tap.first >= input - 1) {
+			tap.first = input - 1;
+			tap.weight = 0;
+		}
+
+		tap.second = std::min(tap.first + 1, input - 1);
+	}
+}
+
+void Downscaler::mapPlane(unsigned int inputWidth, unsigned int inputHeight,
+			  unsigned int outputWidth, unsigned int outputHeight,
+			  unsigned int components, PlaneMap *map)
+{
+	map->width = outputWidth;
+	map->components = components;
+	mapAxis(inputWidth, outputWidth, &map->columns);
+	mapAxis(inputHeight, outputHeight, &map->lines);
+
+	map->direct = inputWidth == outputWidth;
+}
+
+/*
+ * Resample source \a line horizontally, or return it from the \a cache if it
+ * has been resampled already. The cache holds two lines, the oldest one is
+ * replaced, unless it stores the \a keep line still in use by the caller.
+ */
+const uint8_t *Downscaler::resampleLine(const Plane &plane, const PlaneMap &map,
+					LineCache *cache, unsigned int line,
+					const uint8_t *keep)
+{
+	const int tag = line;
+
+	if (cache->line[0] == tag)
+		return cache->data[0].data();
+	if (cache->line[1] == tag)
+		return cache->data[1].data();
+
+	unsigned int victim = cache->line[0] <= cache->line[1] ? 0 : 1;
+	if (cache->data[victim].data() == keep)
+		victim ^= 1;
+
+	uint8_t *dst = cache->data[victim].data();
+	const uint8_t *src = plane.src + line * plane.stride;
+
+	cache->line[victim] = tag;
+
+	if (map.direct) {
+		memcpy(dst, src, map.width * map.components);
+		return dst;
+	}
+
+	if (map.components == 1) {
+		for (unsigned int x = 0; x < map.width; ++x) {
+			const Tap &tap = map.columns[x];
+			dst[x] = (src[tap.first] * (256 - tap.weight) +
+				  src[tap.second] * tap.weight + 128) >> 8;
+		}
+	} else {
+		for (unsigned int x = 0; x < map.width; ++x) {
+			const Tap &tap = map.columns[x];
+			const uint8_t *s0 = src + tap.first * 2;
+			const uint8_t *s1 = src + tap.second * 2;
+
+			dst[x * 2] = (s0[0] * (256 - tap.weight) +
+				      s1[0] * tap.weight + 128) >> 8;
+			dst[x * 2 + 1] = (s0[1] * (256 - tap.weight) +
+					  s1[1] * tap.weight + 128) >> 8;
+		}
+	}
+
+	return dst;
+}
+
+/*
+ * Produce the lines of an output plane, starting at line \a next, that are
+ * interpolated from source lines before \a end, expressed in luma lines.
+ */
+void Downscaler::scalePlane(const Plane &plane, const PlaneMap &map,
+			    uint8_t *dst, LineCache *cache, unsigned int end,
+			    unsigned int *next)
+{
+	const unsigned int lineSize = map.width * map.components;
+	unsigned int i;
+
+	for (i = *next; i < map.lines.size(); ++i) {
+		const Tap &tap = map.lines[i];
+		if (tap.first * plane.scale >= end)
+			break;
+
+		const uint8_t *a = resampleLine(plane, map, cache, tap.first,
+						nullptr);
+		const uint8_t *b = tap.weight
+				 ? resampleLine(plane, map, cache, tap.second, a)
+				 : a;
+
+		blendLines(a, b, tap.weight, dst + i * lineSize, lineSize);
+	}
+
+	*next = i;
+}
+
+/*
+ * Produce the output lines interpolated from the source luma lines in the
+ * [\a begin, \a end[ range, and the corresponding chroma lines.
+ */
+void Downscaler::scaleStripe(const uint8_t *y, const uint8_t *uv,
+			     const std::vector<Image> &outputs,
+			     unsigned int begin, unsigned int end)
+{
+	const Plane luma = { y, stride_, 1 };
+	const Plane chroma = { uv, stride_, 2 };
+
+	std::vector<LineCache> caches(outputs_.size() * 2);
+	std::vector<unsigned int> next(outputs_.size() * 2);
+
+	for (unsigned int i = 0; i < outputs_.size(); ++i) {
+		const PlaneMap *maps[] = { &outputs_[i].luma, &outputs_[i].chroma };
+		const Plane *planes[] = { &luma, &chroma };
+
+		for (unsigned int p = 0; p < 2; ++p) {
+			const PlaneMap &map = *maps[p];
+			const unsigned int scale = planes[p]->scale;
+			LineCache &cache = caches[i * 2 + p];
+
+			for (unsigned int j = 0; j < 2; ++j) {
+				cache.data[j].resize(map.width * map.components);
+				cache.line[j] = -1;
+			}
+
+			auto first = std::lower_bound(map.lines.begin(), map.lines.end(),
+						      begin, [scale](const Tap &tap, unsigned int line) {
+							      return tap.first * scale < line;
+						      });
+			next[i * 2 + p] = first - map.lines.begin();
+		}
+	}
+
+	for (unsigned int line = begin; line < end; line += ChunkLines) {
+		const unsigned int last = std::min(line + ChunkLines, end);
+
+		for (unsigned int i = 0; i < outputs_.size(); ++i) {
+			const Image &image = outputs[i];
+			if (!image.y || !image.uv)
+				continue;
+
+			scalePlane(luma, outputs_[i].luma, image.y,
+				   &caches[i * 2], last, &next[i * 2]);
+			scalePlane(chroma, outputs_[i].chroma, image.uv,
+				   &caches[i * 2 + 1], last, &next[i * 2 + 1]);
+		}
+	}
+}
@@ -0,0 +1,89 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * downscaler.h - Multi-output NV12 downscaler
+ */
+#ifndef __ANDROID_DOWNSCALER_H__
+#define __ANDROID_DOWNSCALER_H__
+
+#include <stdint.h>
+#include <vector>
+
+#include <libcamera/geometry.h>
+
+class Downscaler
+{
+public:
+	struct Image {
+		uint8_t *y;
+		uint8_t *uv;
+	};
+
+	Downscaler();
+
+	int configure(const libcamera::Size &input, unsigned int stride,
+		      const std::vector<libcamera::Size> &outputs);
+	void setThreads(unsigned int threads);
+	unsigned int threads() const { return threads_; }
+
+	void scale(const uint8_t *y, const uint8_t *uv,
+		   const std::vector<Image> &outputs);
+
+private:
+	struct Tap {
+		unsigned int first;
+		unsigned int second;
+		unsigned int weight;
+	};
+
+	struct PlaneMap {
+		unsigned int width;
+		unsigned int components;
+		bool direct;
+		std::vector<Tap> columns;
+		std::vector<Tap> lines;
+	};
+
+	struct Output {
+		PlaneMap luma;
+		PlaneMap chroma;
+	};
+
+	struct LineCache {
+		std::vector<uint8_t> data[2];
+		int line[2];
+	};
+
+	struct Plane {
+		const uint8_t *src;
+		unsigned int stride;
+		unsigned int scale;
+	};
+
+	static void mapAxis(unsigned int input, unsigned int output,
+			    std::vector<Tap> *taps);
+	static void mapPlane(unsigned int inputWidth, unsigned int inputHeight,
+			     unsigned int outputWidth, unsigned int outputHeight,
+			     unsigned int components, PlaneMap *map);
+
+	static const uint8_t *resampleLine(const Plane &plane,
+					   const PlaneMap &map,
+					   LineCache *cache, unsigned int line,
+					   const uint8_t *keep);
+	static void scalePlane(const Plane &plane, const PlaneMap &map,
+			       uint8_t *dst, LineCache *cache,
+			       unsigned int end, unsigned int *next);
+
+	void scaleStripe(const uint8_t *y, const uint8_t *uv,
+			 const std::vector<Image> &outputs,
+			 unsigned int begin, unsigned int end);
+
+	libcamera::Size input_;
+	unsigned int stride_;
+	unsigned int threads_;
+
+	std::vector<Output> outputs_;
+};
+
+#endif /* __ANDROID_DOWNSCALER_H__ */
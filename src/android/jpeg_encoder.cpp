@@ -0,0 +1,372 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * jpeg_encoder.cpp - JPEG encoder based on libjpeg
+ */
+
+#include "jpeg_encoder.h"
+
+#include <algorithm>
+#include <errno.h>
+#include <setjmp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <thread>
+
+#include <jpeglib.h>
+#include <linux/drm_fourcc.h>
+
+#include "log.h"
+#include "utils.h"
+
+using namespace libcamera;
+
+LOG_DECLARE_CATEGORY(HAL);
+
+namespace {
+
+/* Size of an MCU in pixels, for 4:2:0 chroma subsampling. */
+constexpr unsigned int McuSize = 16;
+
+/* Largest restart interval, in MCUs, that can be stored in a DRI marker. */
+constexpr unsigned int MaxRestartInterval = 65535;
+
+constexpr uint8_t MarkerSOF0 = 0xc0;
+constexpr uint8_t MarkerRST0 = 0xd0;
+constexpr uint8_t MarkerEOI = 0xd9;
+constexpr uint8_t MarkerSOS = 0xda;
+
+struct ErrorManager {
+	struct jpeg_error_mgr base;
+	jmp_buf jump;
+};
+
+void errorExit(j_common_ptr cinfo)
+{
+	ErrorManager *error = reinterpret_cast<ErrorManager *>(cinfo->err);
+	longjmp(error->jump, 1);
+}
+
+void outputMessage(j_common_ptr)
+{
+}
+
+/*
+ * Locate the start of the entropy-coded data, right after the SOS marker
+ * segment, and the SOF0 marker segment, in a JPEG stream produced by libjpeg.
+ */
+int parseHeader(const unsigned char *data, unsigned long size,
+		unsigned long *sof, unsigned long *sos)
+{
+	unsigned long pos = 2;
+
+	*sof = 0;
+
+	while (pos + 4 <= size) {
+		if (data[pos] != 0xff)
+			return -EINVAL;
+
+		uint8_t marker = data[pos + 1];
+		unsigned int length = (data[pos + 2] << 8) | data[pos + 3];
+
+		if (marker == MarkerSOF0)
+			*sof = pos;
+
+		pos += 2 + length;
+
+		if (marker == MarkerSOS) {
+			*sos = pos;
+			return *sof && pos + 2 <= size ? 0 : -EINVAL;
+		}
+	}
+
+	return -EINVAL;
+}
+
+} /* namespace */
+
+/*
+ * \class JpegEncoder
+ * \brief Encode NV12 and NV21 frames to JPEG
+ *
+ * The frame is split in horizontal segments, each of an integer number of MCU
+ * rows, encoded concurrently on multiple threads as independent JPEG streams
+ * sharing the same tables. The entropy-coded data of the segments is then
+ * concatenated, separated by restart markers, behind the headers of the first
+ * segment. A restart interval equal to the number of MCUs in a segment makes
+ * the result a valid baseline JPEG stream, as the decoder resets its DC
+ * predictors at every restart marker, exactly as the segment encoders did.
+ */
+
+JpegEncoder::JpegEncoder()
+	: pixelFormat_(0), width_(0), height_(0), quality_(95), threads_(1),
+	  mcusPerRow_(0), mcuRowsPerSegment_(0), segments_(0)
+{
+}
+
+/*
+ * Configure the encoder for frames matching the stream configuration \a cfg.
+ * Only NV12 and NV21 frames of even width are supported.
+ */
+int JpegEncoder::configure(const StreamConfiguration &cfg)
+{
+	if (cfg.pixelFormat != DRM_FORMAT_NV12 &&
+	    cfg.pixelFormat != DRM_FORMAT_NV21) {
+		LOG(HAL, Error) << "Unsupported JPEG encoder input format "
+				<< utils::hex(cfg.pixelFormat);
+		return -EINVAL;
+	}
+
+	if (!cfg.size.width || !cfg.size.height || cfg.size.width % 2) {
+		LOG(HAL, Error) << "Unsupported JPEG encoder input size "
+				<< cfg.size.toString();
+		return -EINVAL;
+	}
+
+	pixelFormat_ = cfg.pixelFormat;
+	width_ = cfg.size.width;
+	height_ = cfg.size.height;
+	mcusPerRow_ = (width_ + McuSize - 1) / McuSize;
+
+	setThreads(threads_);
+
+	return 0;
+}
+
+/*
+ * Set the number of threads used to encode a frame. Each thread encodes one
+ * segment of the frame at a time.
+ */
+void JpegEncoder::setThreads(unsigned int threads)
+{
+	threads_ = std::max(threads, 1U);
+
+	if (!mcusPerRow_)
+		return;
+
+	unsigned int mcuRows = (height_ + McuSize - 1) / McuSize;
+
+	mcuRowsPerSegment_ = (mcuRows + threads_ - 1) / threads_;
+	if (threads_ > 1)
+		mcuRowsPerSegment_ = std::min(mcuRowsPerSegment_,
+					      MaxRestartInterval / mcusPerRow_);
+	mcuRowsPerSegment_ = std::max(mcuRowsPerSegment_, 1U);
+
+	segments_ = (mcuRows + mcuRowsPerSegment_ - 1) / mcuRowsPerSegment_;
+}
+
+/*
+ * Encode the frame mapped in \a source to JPEG in the \a dst buffer of \a size
+ * bytes. Return the size of the JPEG stream, or a negative error code if the
+ * frame can't be encoded or the JPEG stream doesn't fit in \a dst.
+ */
+int JpegEncoder::encode(const MappedFrameBuffer &source, uint8_t *dst,
+			size_t size)
+{
+	const std::vector<MappedFrameBuffer::Plane> &planes = source.planes();
+	const size_t lumaSize = width_ * height_;
+	const size_t chromaSize = width_ * ((height_ + 1) / 2);
+	const uint8_t *y;
+	const uint8_t *uv;
+
+	if (!segments_ || planes.empty())
+		return -EINVAL;
+
+	/* The chroma plane follows the luma plane in single-planar buffers. */
+	if (planes.size() == 1) {
+		if (planes[0].length < lumaSize + chromaSize)
+			return -EINVAL;
+
+		y = planes[0].data;
+		uv = y + lumaSize;
+	} else {
+		if (planes[0].length < lumaSize || planes[1].length < chromaSize)
+			return -EINVAL;
+
+		y = planes[0].data;
+		uv = planes[1].data;
+	}
+
+	std::vector<Segment> segments(segments_, { nullptr, 0, 0 });
+	unsigned int threads = std::min(threads_, segments_);
+	std::vector<std::thread> workers;
+
+	for (unsigned int i = 1; i < threads; ++i)
+		workers.emplace_back(&JpegEncoder::encodeSegments, this, y, uv,
+				     std::ref(segments), i, threads);
+
+	encodeSegments(y, uv, segments, 0, threads);
+
+	for (std::thread &worker : workers)
+		worker.join();
+
+	/* Assemble the segments behind the headers of the first one. */
+	size_t offset = 0;
+	int ret = 0;
+
+	for (unsigned int i = 0; i < segments.size() && !ret; ++i) {
+		const Segment &segment = segments[i];
+		unsigned long sof, sos;
+
+		ret = segment.error;
+		if (ret)
+			break;
+
+		ret = parseHeader(segment.data, segment.size, &sof, &sos);
+		if (ret)
+			break;
+
+		unsigned long start = i == 0 ? 0 : sos;
+		unsigned long length = segment.size - 2 - start;
+
+		/* Leave space for the restart or EOI marker. */
+		if (offset + length + 2 > size) {
+			ret = -ENOSPC;
+			break;
+		}
+
+		memcpy(dst + offset, segment.data + start, length);
+
+		/* Store the height of the whole frame in the SOF0 marker. */
+		if (i == 0) {
+			dst[sof + 5] = height_ >> 8;
+			dst[sof + 6] = height_ & 0xff;
+		}
+
+		offset += length;
+		dst[offset++] = 0xff;
+		dst[offset++] = i == segments.size() - 1
+			      ? MarkerEOI : MarkerRST0 + i % 8;
+	}
+
+	for (Segment &segment : segments)
+		free(segment.data);
+
+	if (ret) {
+		LOG(HAL, Error) << "Failed to encode JPEG frame: "
+				<< strerror(-ret);
+		return ret;
+	}
+
+	return offset;
+}
+
+void JpegEncoder::encodeSegments(const uint8_t *y, const uint8_t *uv,
+				 std::vector<Segment> &segments,
+				 unsigned int first, unsigned int step)
+{
+	for (unsigned int i = first; i < segments.size(); i += step)
+		segments[i].error = encodeSegment(y, uv, i, &segments[i]);
+}
+
+int JpegEncoder::encodeSegment(const uint8_t *y, const uint8_t *uv,
+			       unsigned int index, Segment *segment)
+{
+	const unsigned int firstLine = index * mcuRowsPerSegment_ * McuSize;
+	const unsigned int lumaWidth = mcusPerRow_ * McuSize;
+	const unsigned int chromaWidth = lumaWidth / 2;
+	const unsigned int cbOffset = pixelFormat_ == DRM_FORMAT_NV12 ? 0 : 1;
+
+	/*
+	 * libjpeg consumes raw data in full MCUs. Lines are padded by
+	 * replicating the last pixel, and the last line is replicated at the
+	 * bottom of the frame.
+	 */
+	std::vector<uint8_t> lumaLines(width_ == lumaWidth ? 0 : lumaWidth * McuSize);
+	std::vector<uint8_t> cbLines(chromaWidth * McuSize / 2);
+	std::vector<uint8_t> crLines(chromaWidth * McuSize / 2);
+	JSAMPROW lumaRows[McuSize];
+	JSAMPROW cbRows[McuSize / 2];
+	JSAMPROW crRows[McuSize / 2];
+	JSAMPARRAY components[3] = { lumaRows, cbRows, crRows };
+
+	struct jpeg_compress_struct cinfo;
+	ErrorManager error;
+
+	cinfo.err = jpeg_std_error(&error.base);
+	error.base.error_exit = errorExit;
+	error.base.output_message = outputMessage;
+
+	segment->data = nullptr;
+	segment->size = 0;
+
+	if (setjmp(error.jump)) {
+		jpeg_destroy_compress(&cinfo);
+		return -EINVAL;
+	}
+
+	jpeg_create_compress(&cinfo);
+	jpeg_mem_dest(&cinfo, &segment->data, &segment->size);
+
+	cinfo.image_width = width_;
+	cinfo.image_height = std::min(mcuRowsPerSegment_ * McuSize,
+				      height_ - firstLine);
+	cinfo.input_components = 3;
+	cinfo.in_color_space = JCS_YCbCr;
+
+	jpeg_set_defaults(&cinfo);
+	jpeg_set_quality(&cinfo, quality_, TRUE);
+
+	cinfo.raw_data_in = TRUE;
+	cinfo.dct_method = JDCT_IFAST;
+	cinfo.comp_info[0].h_samp_factor = 2;
+	cinfo.comp_info[0].v_samp_factor = 2;
+	cinfo.comp_info[1].h_samp_factor = 1;
+	cinfo.comp_info[1].v_samp_factor = 1;
+	cinfo.comp_info[2].h_samp_factor = 1;
+	cinfo.comp_info[2].v_samp_factor = 1;
+
+	if (segments_ > 1)
+		cinfo.restart_interval = mcusPerRow_ * mcuRowsPerSegment_;
+
+	jpeg_start_compress(&cinfo, TRUE);
+
+	while (cinfo.next_scanline < cinfo.image_height) {
+		unsigned int line = firstLine + cinfo.next_scanline;
+
+		for (unsigned int i = 0; i < McuSize; ++i) {
+			const uint8_t *src = y + std::min(line + i, height_ - 1) * width_;
+
+			if (lumaLines.empty()) {
+				lumaRows[i] = const_cast<uint8_t *>(src);
+				continue;
+			}
+
+			uint8_t *dst = &lumaLines[i * lumaWidth];
+			memcpy(dst, src, width_);
+			memset(dst + width_, src[width_ - 1], lumaWidth - width_);
+			lumaRows[i] = dst;
+		}
+
+		for (unsigned int i = 0; i < McuSize / 2; ++i) {
+			unsigned int chromaLine = std::min(line / 2 + i,
+							   (height_ + 1) / 2 - 1);
+			const uint8_t *src = uv + chromaLine * width_;
+			uint8_t *cb = &cbLines[i * chromaWidth];
+			uint8_t *cr = &crLines[i * chromaWidth];
+			unsigned int x;
+
+			for (x = 0; x < width_ / 2; ++x) {
+				cb[x] = src[x * 2 + cbOffset];
+				cr[x] = src[x * 2 + 1 - cbOffset];
+			}
+
+			for (; x < chromaWidth; ++x) {
+				cb[x] = cb[x - 1];
+				cr[x] = cr[x - 1];
+			}
+
+			cbRows[i] = cb;
+			crRows[i] = cr;
+		}
+
+		jpeg_write_raw_data(&cinfo, components, McuSize);
+	}
+
+	jpeg_finish_compress(&cinfo);
+	jpeg_destroy_compress(&cinfo);
+
+	return 0;
+}
@@ -0,0 +1,54 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * jpeg_encoder.h - JPEG encoder based on libjpeg
+ */
+#ifndef __ANDROID_JPEG_ENCODER_H__
+#define __ANDROID_JPEG_ENCODER_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+#include <libcamera/mapped_framebuffer.h>
+#include <libcamera/pixelformats.h>
+#include <libcamera/stream.h>
+
+class JpegEncoder
+{
+public:
+	JpegEncoder();
+
+	int configure(const libcamera::StreamConfiguration &cfg);
+	void setThreads(unsigned int threads);
+	void setQuality(int quality) { quality_ = quality; }
+
+	int encode(const libcamera::MappedFrameBuffer &source, uint8_t *dst,
+		   size_t size);
+
+private:
+	struct Segment {
+		unsigned char *data;
+		unsigned long size;
+		int error;
+	};
+
+	void encodeSegments(const uint8_t *y, const uint8_t *uv,
+			    std::vector<Segment> &segments,
+			    unsigned int first, unsigned int step);
+	int encodeSegment(const uint8_t *y, const uint8_t *uv,
+			  unsigned int index, Segment *segment);
+
+	libcamera::PixelFormat pixelFormat_;
+	unsigned int width_;
+	unsigned int height_;
+	int quality_;
+	unsigned int threads_;
+
+	unsigned int mcusPerRow_;
+	unsigned int mcuRowsPerSegment_;
+	unsigned int segments_;
+};
+
+#endif /* __ANDROID_JPEG_ENCODER_H__ */
@@ -0,0 +1,116 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * post_processor_jpeg.cpp - JPEG post-processing of BLOB stream buffers
+ */
+
+#include "post_processor_jpeg.h"
+
+#include <errno.h>
+#include <string.h>
+#include <sys/types.h>
+#include <thread>
+#include <unistd.h>
+
+#include <libcamera/file_descriptor.h>
+
+#include "log.h"
+
+using namespace libcamera;
+
+LOG_DECLARE_CATEGORY(HAL);
+
+/*
+ * \class PostProcessorJpeg
+ * \brief Encode the frames captured for a BLOB stream to JPEG
+ *
+ * Android captures still images through streams of HAL_PIXEL_FORMAT_BLOB
+ * format, which libcamera doesn't produce. The frames are captured in NV12
+ * to internal buffers, and encoded to the gralloc buffers of the BLOB stream
+ * by this class. The post-processor is meant to live in a dedicated thread,
+ * to avoid stalling the camera device thread while encoding, and uses all
+ * CPU cores to encode a frame.
+ */
+
+PostProcessorJpeg::PostProcessorJpeg()
+	: sources_(MappedFrameBuffer::MapRead)
+{
+	encoder_.setThreads(std::thread::hardware_concurrency());
+}
+
+/*
+ * Configure the post-processor for the frames captured with the stream
+ * configuration \a cfg. The mappings of the buffers of the previous
+ * configuration are released.
+ */
+int PostProcessorJpeg::configure(const StreamConfiguration &cfg)
+{
+	sources_.clear();
+
+	return encoder_.configure(cfg);
+}
+
+/*
+ * Encode the \a source frame to the \a destination BLOB buffer, and emit the
+ * processed signal with the \a cookie when done.
+ */
+void PostProcessorJpeg::process(FrameBuffer *source,
+				buffer_handle_t destination, void *cookie)
+{
+	int ret = encode(source, destination);
+	processed.emit(cookie, source, ret);
+}
+
+/*
+ * Do nothing. Invoking this method synchronously from another thread waits
+ * for all the frames queued for processing before it to be processed.
+ */
+void PostProcessorJpeg::flush()
+{
+}
+
+int PostProcessorJpeg::encode(const FrameBuffer *source,
+			      buffer_handle_t destination)
+{
+	const MappedFrameBuffer *input = sources_.map(source);
+	if (!input)
+		return -ENOMEM;
+
+	/*
+	 * The BLOB buffer holds the JPEG stream at its beginning, and the
+	 * camera3_jpeg_blob transport header at its end.
+	 */
+	FrameBuffer::Plane plane;
+	plane.fd = FileDescriptor(destination->data[0]);
+
+	off_t size = lseek(plane.fd.fd(), 0, SEEK_END);
+	if (size < 0 || static_cast<size_t>(size) <= sizeof(camera3_jpeg_blob)) {
+		LOG(HAL, Error) << "Invalid BLOB buffer size";
+		return -EINVAL;
+	}
+
+	plane.length = size;
+
+	FrameBuffer buffer({ plane });
+	MappedFrameBuffer output(&buffer, MappedFrameBuffer::MapWrite);
+	if (!output.isValid())
+		return output.error();
+
+	ScopedCpuAccess inputAccess(*input);
+	ScopedCpuAccess outputAccess(output);
+
+	uint8_t *data = output.planes()[0].data;
+	size_t maxSize = size - sizeof(camera3_jpeg_blob);
+
+	int jpegSize = encoder_.encode(*input, data, maxSize);
+	if (jpegSize < 0)
+		return jpegSize;
+
+	camera3_jpeg_blob blob = {};
+	blob.jpeg_blob_id = CAMERA3_JPEG_BLOB_ID;
+	blob.jpeg_size = jpegSize;
+	memcpy(data + maxSize, &blob, sizeof(blob));
+
+	return 0;
+}
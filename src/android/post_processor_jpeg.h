@@ -0,0 +1,40 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * post_processor_jpeg.h - JPEG post-processing of BLOB stream buffers
+ */
+#ifndef __ANDROID_POST_PROCESSOR_JPEG_H__
+#define __ANDROID_POST_PROCESSOR_JPEG_H__
+
+#include <hardware/camera3.h>
+
+#include <libcamera/buffer.h>
+#include <libcamera/mapped_framebuffer.h>
+#include <libcamera/object.h>
+#include <libcamera/signal.h>
+#include <libcamera/stream.h>
+
+#include "jpeg_encoder.h"
+
+class PostProcessorJpeg : public libcamera::Object
+{
+public:
+	PostProcessorJpeg();
+
+	int configure(const libcamera::StreamConfiguration &cfg);
+	void process(libcamera::FrameBuffer *source, buffer_handle_t destination,
+		     void *cookie);
+	void flush();
+
+	libcamera::Signal<void *, libcamera::FrameBuffer *, int> processed;
+
+private:
+	int encode(const libcamera::FrameBuffer *source,
+		   buffer_handle_t destination);
+
+	JpegEncoder encoder_;
+	libcamera::MappedBufferCache sources_;
+};
+
+#endif /* __ANDROID_POST_PROCESSOR_JPEG_H__ */
@@ -0,0 +1,176 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * post_processor_scaler.cpp - Scaling of YUV streams from a shared frame
+ */
+
+#include "post_processor_scaler.h"
+
+#include <errno.h>
+#include <memory>
+#include <sys/types.h>
+#include <thread>
+#include <unistd.h>
+
+#include <linux/drm_fourcc.h>
+
+#include <libcamera/file_descriptor.h>
+
+#include "log.h"
+#include "utils.h"
+
+using namespace libcamera;
+
+LOG_DECLARE_CATEGORY(HAL);
+
+/*
+ * \class PostProcessorScaler
+ * \brief Produce multiple YUV streams from the frames of one camera stream
+ *
+ * Cameras that can't produce all the YUV streams requested by the framework
+ * concurrently capture NV12 frames to internal buffers, at the largest size
+ * of the streams. This class scales each frame down to the gralloc buffers of
+ * the streams of the request, in a single pass over the frame. The
+ * post-processor is meant to live in a dedicated thread, to avoid stalling the
+ * camera device thread while scaling, and uses all CPU cores to scale a frame.
+ */
+
+PostProcessorScaler::PostProcessorScaler()
+	: sources_(MappedFrameBuffer::MapRead)
+{
+	scaler_.setThreads(std::thread::hardware_concurrency());
+}
+
+/*
+ * Configure the post-processor to scale the frames captured with the stream
+ * configuration \a cfg to the \a outputs sizes. The mappings of the buffers of
+ * the previous configuration are released.
+ */
+int PostProcessorScaler::configure(const StreamConfiguration &cfg,
+				   const std::vector<Size> &outputs)
+{
+	sources_.clear();
+	outputs_.clear();
+
+	if (cfg.pixelFormat != DRM_FORMAT_NV12) {
+		LOG(HAL, Error) << "Unsupported scaler input format "
+				<< utils::hex(cfg.pixelFormat);
+		return -EINVAL;
+	}
+
+	int ret = scaler_.configure(cfg.size, cfg.size.width, outputs);
+	if (ret)
+		return ret;
+
+	input_ = cfg.size;
+	outputs_ = outputs;
+
+	return 0;
+}
+
+/*
+ * Scale the \a source frame to the \a destinations, one per configured output
+ * size, null for the outputs not needed for this frame. Emit the processed
+ * signal with the \a cookie when done.
+ */
+void PostProcessorScaler::process(FrameBuffer *source,
+				  const std::vector<buffer_handle_t> &destinations,
+				  void *cookie)
+{
+	int ret = scale(source, destinations);
+	processed.emit(cookie, source, ret);
+}
+
+/*
+ * Release the mappings of the source buffers. Invoking this method
+ * synchronously from another thread also waits for all the frames queued for
+ * processing before it to be processed.
+ */
+void PostProcessorScaler::flush()
+{
+	sources_.clear();
+}
+
+int PostProcessorScaler::scale(const FrameBuffer *source,
+			       const std::vector<buffer_handle_t> &destinations)
+{
+	if (destinations.size() != outputs_.size())
+		return -EINVAL;
+
+	const MappedFrameBuffer *input = sources_.map(source);
+	if (!input)
+		return -ENOMEM;
+
+	const std::vector<MappedFrameBuffer::Plane> &planes = input->planes();
+	const size_t lumaSize = input_.width * input_.height;
+	const size_t chromaSize = input_.width * ((input_.height + 1) / 2);
+	const uint8_t *y;
+	const uint8_t *uv;
+
+	/* The chroma plane follows the luma plane in single-planar buffers. */
+	if (planes.size() == 1) {
+		if (planes[0].length < lumaSize + chromaSize)
+			return -EINVAL;
+
+		y = planes[0].data;
+		uv = y + lumaSize;
+	} else {
+		if (planes[0].length < lumaSize || planes[1].length < chromaSize)
+			return -EINVAL;
+
+		y = planes[0].data;
+		uv = planes[1].data;
+	}
+
+	/*
+	 * The destination buffers store NV12 frames, with the chroma plane
+	 * following the luma plane.
+	 *
+	 * \todo Retrieve the gralloc buffer layout instead of assuming packed
+	 * planes.
+	 */
+	std::vector<std::unique_ptr<FrameBuffer>> buffers;
+	std::vector<std::unique_ptr<MappedFrameBuffer>> outputs;
+	std::vector<Downscaler::Image> images(outputs_.size(), { nullptr, nullptr });
+
+	for (unsigned int i = 0; i < destinations.size(); ++i) {
+		if (!destinations[i])
+			continue;
+
+		const Size &size = outputs_[i];
+		const size_t frameSize = size.width * size.height +
+					 size.width * ((size.height + 1) / 2);
+
+		FrameBuffer::Plane plane;
+		plane.fd = FileDescriptor(destinations[i]->data[0]);
+
+		off_t length = lseek(plane.fd.fd(), 0, SEEK_END);
+		if (length < 0 || static_cast<size_t>(length) < frameSize) {
+			LOG(HAL, Error) << "Invalid YUV buffer size";
+			return -EINVAL;
+		}
+
+		plane.length = frameSize;
+
+		buffers.push_back(std::make_unique<FrameBuffer>(
+			std::vector<FrameBuffer::Plane>{ plane }));
+		outputs.push_back(std::make_unique<MappedFrameBuffer>(
+			buffers.back().get(), MappedFrameBuffer::MapWrite));
+		if (!outputs.back()->isValid())
+			return outputs.back()->error();
+
+		uint8_t *data = outputs.back()->planes()[0].data;
+		images[i] = { data, data + size.width * size.height };
+	}
+
+	ScopedCpuAccess inputAccess(*input);
+
+	std::vector<std::unique_ptr<ScopedCpuAccess>> outputAccesses;
+	for (const std::unique_ptr<MappedFrameBuffer> &output : outputs)
+		outputAccesses.push_back(std::make_unique<ScopedCpuAccess>(*output));
+
+	scaler_.scale(y, uv, images);
+
+	return 0;
+}
@@ -0,0 +1,47 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * post_processor_scaler.h - Scaling of YUV streams from a shared frame
+ */
+#ifndef __ANDROID_POST_PROCESSOR_SCALER_H__
+#define __ANDROID_POST_PROCESSOR_SCALER_H__
+
+#include <vector>
+
+#include <hardware/camera3.h>
+
+#include <libcamera/buffer.h>
+#include <libcamera/geometry.h>
+#include <libcamera/mapped_framebuffer.h>
+#include <libcamera/object.h>
+#include <libcamera/signal.h>
+#include <libcamera/stream.h>
+
+#include "downscaler.h"
+
+class PostProcessorScaler : public libcamera::Object
+{
+public:
+	PostProcessorScaler();
+
+	int configure(const libcamera::StreamConfiguration &cfg,
+		      const std::vector<libcamera::Size> &outputs);
+	void process(libcamera::FrameBuffer *source,
+		     const std::vector<buffer_handle_t> &destinations,
+		     void *cookie);
+	void flush();
+
+	libcamera::Signal<void *, libcamera::FrameBuffer *, int> processed;
+
+private:
+	int scale(const libcamera::FrameBuffer *source,
+		  const std::vector<buffer_handle_t> &destinations);
+
+	Downscaler scaler_;
+	libcamera::Size input_;
+	std::vector<libcamera::Size> outputs_;
+	libcamera::MappedBufferCache sources_;
+};
+
+#endif /* __ANDROID_POST_PROCESSOR_SCALER_H__ */
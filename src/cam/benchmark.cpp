@@ -0,0 +1,221 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * benchmark.cpp - Capture performance statistics
+ */
+
+#include <algorithm>
+#include <iomanip>
+
+#include <libcamera/buffer.h>
+
+#include "benchmark.h"
+
+using namespace libcamera;
+
+static double toMilliseconds(std::chrono::nanoseconds duration)
+{
+	return duration.count() / 1000000.0;
+}
+
+static double toSeconds(const struct timeval &time)
+{
+	return time.tv_sec + time.tv_usec / 1000000.0;
+}
+
+Benchmark::Benchmark()
+	: frames_(0), failed_(0), dropped_(0), lastTimestamp_(0)
+{
+}
+
+void Benchmark::start()
+{
+	frames_ = 0;
+	failed_ = 0;
+	dropped_ = 0;
+	lastTimestamp_ = 0;
+
+	queued_.clear();
+	sequences_.clear();
+	intervals_.clear();
+	captureLatencies_.clear();
+	queueLatencies_.clear();
+
+	getrusage(RUSAGE_SELF, &startUsage_);
+	start_ = clock::now();
+	last_ = start_;
+}
+
+void Benchmark::stop()
+{
+	getrusage(RUSAGE_SELF, &stopUsage_);
+}
+
+void Benchmark::requestQueued(Request *request)
+{
+	queued_[request] = clock::now();
+}
+
+/*
+ * The buffer timestamps are sampled from CLOCK_MONOTONIC, as is the steady
+ * clock, which allows measuring the latency from capture to completion.
+ */
+void Benchmark::requestCompleted(Request *request)
+{
+	clock::time_point now = clock::now();
+
+	auto queued = queued_.find(request);
+	if (queued != queued_.end()) {
+		queueLatencies_.push_back(toMilliseconds(now - queued->second));
+		queued_.erase(queued);
+	}
+
+	if (request->status() != Request::RequestComplete) {
+		failed_++;
+		return;
+	}
+
+	frames_++;
+	last_ = now;
+
+	const std::map<Stream *, FrameBuffer *> &buffers = request->buffers();
+	if (buffers.empty())
+		return;
+
+	for (const auto &it : buffers) {
+		unsigned int sequence = it.second->metadata().sequence;
+
+		auto last = sequences_.find(it.first);
+		if (last != sequences_.end() && sequence > last->second + 1)
+			dropped_ += sequence - last->second - 1;
+
+		sequences_[it.first] = sequence;
+	}
+
+	uint64_t timestamp = buffers.begin()->second->metadata().timestamp;
+	uint64_t current = std::chrono::duration_cast<std::chrono::nanoseconds>(
+		now.time_since_epoch()).count();
+
+	if (timestamp && timestamp <= current)
+		captureLatencies_.push_back((current - timestamp) / 1000000.0);
+
+	if (lastTimestamp_ && timestamp > lastTimestamp_)
+		intervals_.push_back((timestamp - lastTimestamp_) / 1000000.0);
+
+	lastTimestamp_ = timestamp;
+}
+
+/*
+ * Accumulate the statistics of another benchmark, to report aggregated
+ * statistics for concurrent captures. The other benchmark shall have been
+ * started after and stopped before this one.
+ */
+void Benchmark::merge(const Benchmark &other)
+{
+	frames_ += other.frames_;
+	failed_ += other.failed_;
+	dropped_ += other.dropped_;
+	last_ = std::max(last_, other.last_);
+
+	intervals_.insert(intervals_.end(), other.intervals_.begin(),
+			  other.intervals_.end());
+	captureLatencies_.insert(captureLatencies_.end(),
+				 other.captureLatencies_.begin(),
+				 other.captureLatencies_.end());
+	queueLatencies_.insert(queueLatencies_.end(),
+			       other.queueLatencies_.begin(),
+			       other.queueLatencies_.end());
+}
+
+Benchmark::clock::duration Benchmark::elapsed() const
+{
+	return clock::now() - start_;
+}
+
+Benchmark::Percentiles Benchmark::percentiles(std::vector<double> values)
+{
+	if (values.empty())
+		return { 0.0, 0.0, 0.0, 0.0, 0.0 };
+
+	std::sort(values.begin(), values.end());
+
+	auto rank = [&](double p) {
+		size_t index = static_cast<size_t>(p * (values.size() - 1) + 0.5);
+		return values[index];
+	};
+
+	return { values.front(), rank(0.50), rank(0.90), rank(0.99),
+		 values.back() };
+}
+
+void Benchmark::printText(std::ostream &out, const char *name,
+			  const std::vector<double> &values)
+{
+	Percentiles p = percentiles(values);
+
+	out << std::left << std::setw(24) << name << std::right
+	    << " min " << std::setw(8) << p.min
+	    << " p50 " << std::setw(8) << p.p50
+	    << " p90 " << std::setw(8) << p.p90
+	    << " p99 " << std::setw(8) << p.p99
+	    << " max " << std::setw(8) << p.max
+	    << " (ms)" << std::endl;
+}
+
+void Benchmark::printJson(std::ostream &out, const char *name,
+			  const std::vector<double> &values)
+{
+	Percentiles p = percentiles(values);
+
+	out << "\t\"" << name << "\": { "
+	    << "\"min\": " << p.min << ", "
+	    << "\"p50\": " << p.p50 << ", "
+	    << "\"p90\": " << p.p90 << ", "
+	    << "\"p99\": " << p.p99 << ", "
+	    << "\"max\": " << p.max << " },"
+	    << std::endl;
+}
+
+/*
+ * Report the statistics of the frames completed between start() and stop().
+ * Durations are expressed in milliseconds, and the CPU usage as a percentage
+ * of one CPU.
+ */
+void Benchmark::report(std::ostream &out, bool json) const
+{
+	double duration = toMilliseconds(last_ - start_) / 1000.0;
+	double fps = duration > 0.0 ? frames_ / duration : 0.0;
+
+	double cpuTime = toSeconds(stopUsage_.ru_utime) - toSeconds(startUsage_.ru_utime)
+		       + toSeconds(stopUsage_.ru_stime) - toSeconds(startUsage_.ru_stime);
+	double cpu = duration > 0.0 ? cpuTime / duration * 100.0 : 0.0;
+
+	std::ios_base::fmtflags flags = out.flags();
+	out << std::fixed << std::setprecision(3);
+
+	if (json) {
+		out << "{" << std::endl
+		    << "\t\"frames\": " << frames_ << "," << std::endl
+		    << "\t\"failed\": " << failed_ << "," << std::endl
+		    << "\t\"dropped\": " << dropped_ << "," << std::endl
+		    << "\t\"duration\": " << duration << "," << std::endl
+		    << "\t\"fps\": " << fps << "," << std::endl;
+		printJson(out, "interval", intervals_);
+		printJson(out, "capture_latency", captureLatencies_);
+		printJson(out, "queue_latency", queueLatencies_);
+		out << "\t\"cpu\": " << cpu << std::endl
+		    << "}" << std::endl;
+	} else {
+		out << "Frames:  " << frames_ << " completed, " << failed_
+		    << " failed, " << dropped_ << " dropped" << std::endl
+		    << "Duration: " << duration << " s, " << fps << " fps"
+		    << std::endl;
+		printText(out, "Frame interval", intervals_);
+		printText(out, "Capture to completion", captureLatencies_);
+		printText(out, "Queue to completion", queueLatencies_);
+		out << "CPU usage: " << cpu << " %" << std::endl;
+	}
+
+	out.flags(flags);
+}
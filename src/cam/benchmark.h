@@ -0,0 +1,73 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * benchmark.h - Capture performance statistics
+ */
+#ifndef __CAM_BENCHMARK_H__
+#define __CAM_BENCHMARK_H__
+
+#include <chrono>
+#include <map>
+#include <ostream>
+#include <stdint.h>
+#include <sys/resource.h>
+#include <vector>
+
+#include <libcamera/request.h>
+#include <libcamera/stream.h>
+
+class Benchmark
+{
+public:
+	using clock = std::chrono::steady_clock;
+
+	Benchmark();
+
+	void start();
+	void stop();
+
+	void requestQueued(libcamera::Request *request);
+	void requestCompleted(libcamera::Request *request);
+
+	void merge(const Benchmark &other);
+
+	unsigned int frames() const { return frames_; }
+	clock::duration elapsed() const;
+
+	void report(std::ostream &out, bool json) const;
+
+private:
+	struct Percentiles {
+		double min;
+		double p50;
+		double p90;
+		double p99;
+		double max;
+	};
+
+	static Percentiles percentiles(std::vector<double> values);
+	static void printText(std::ostream &out, const char *name,
+			      const std::vector<double> &values);
+	static void printJson(std::ostream &out, const char *name,
+			      const std::vector<double> &values);
+
+	clock::time_point start_;
+	clock::time_point last_;
+	struct rusage startUsage_;
+	struct rusage stopUsage_;
+
+	unsigned int frames_;
+	unsigned int failed_;
+	unsigned int dropped_;
+
+	std::map<libcamera::Request *, clock::time_point> queued_;
+	std::map<libcamera::Stream *, unsigned int> sequences_;
+	uint64_t lastTimestamp_;
+
+	std::vector<double> intervals_;
+	std::vector<double> captureLatencies_;
+	std::vector<double> queueLatencies_;
+};
+
+#endif /* __CAM_BENCHMARK_H__ */
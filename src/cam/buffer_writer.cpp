@@ -5,84 +5,354 @@
  * buffer_writer.cpp - Buffer writer
  */
 
+#include <algorithm>
 #include <fcntl.h>
 #include <iomanip>
 #include <iostream>
 #include <sstream>
 #include <string.h>
-#include <sys/mman.h>
+#include <sys/eventfd.h>
+#include <sys/stat.h>
 #include <unistd.h>
 
 #include "buffer_writer.h"
 
 using namespace libcamera;
 
-BufferWriter::BufferWriter(const std::string &pattern)
-	: pattern_(pattern)
+/* Number of frames reserved on disk at a time when writing to a single file. */
+static constexpr unsigned int PreallocFrames = 32;
+
+/*
+ * Frames are written by a background thread, to keep file system latencies
+ * out of the event loop. The writer holds the requests until their buffers
+ * have been written, and hands them back through the requestWritten signal,
+ * emitted from the thread that created the writer.
+ *
+ * When the file name pattern contains no '#' character, all frames are
+ * appended to a single file that is kept open, and whose disk space is
+ * reserved ahead of the writes.
+ *
+ * When the file name ends with '.lcv', the frames of all streams are written
+ * to an indexed raw video container along with the request metadata, for
+ * later replay. The container is created when the first request is queued,
+ * once the stream configurations are known.
+ */
+BufferWriter::BufferWriter(const std::string &pattern, unsigned int maxQueued)
+	: pattern_(pattern), maxQueued_(maxQueued), fd_(-1), written_(0),
+	  allocated_(0), notifier_(nullptr), busy_(false), stop_(false)
 {
+	container_ = pattern_.size() > 4 &&
+		     pattern_.compare(pattern_.size() - 4, 4, ".lcv") == 0;
+	singleFile_ = pattern_.find_first_of('#') == std::string::npos;
+	if (singleFile_ && !container_) {
+		fd_ = open(pattern_.c_str(), O_CREAT | O_WRONLY | O_APPEND,
+			   S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH | S_IWOTH);
+		if (fd_ == -1) {
+			std::cerr << "failed to open " << pattern_ << ": "
+				  << strerror(errno) << std::endl;
+		} else {
+			written_ = lseek(fd_, 0, SEEK_END);
+			allocated_ = written_;
+		}
+	}
+
+	eventFd_ = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (eventFd_ != -1) {
+		notifier_ = new EventNotifier(eventFd_, EventNotifier::Read);
+		notifier_->activated.connect(this, &BufferWriter::notifierActivated);
+	} else {
+		std::cerr << "failed to create eventfd: " << strerror(errno)
+			  << std::endl;
+	}
+
+	thread_ = std::thread(&BufferWriter::run, this);
 }
 
 BufferWriter::~BufferWriter()
 {
-	for (auto &iter : mappedBuffers_) {
-		void *memory = iter.second.first;
-		unsigned int length = iter.second.second;
-		munmap(memory, length);
+	{
+		std::lock_guard<std::mutex> locker(mutex_);
+		stop_ = true;
 	}
-	mappedBuffers_.clear();
+
+	cond_.notify_all();
+	thread_.join();
+
+	delete notifier_;
+
+	if (video_.isOpen() && video_.close() < 0)
+		std::cerr << "failed to finalize " << pattern_ << std::endl;
+
+	if (eventFd_ != -1)
+		close(eventFd_);
+	if (fd_ != -1)
+		close(fd_);
 }
 
 void BufferWriter::mapBuffer(FrameBuffer *buffer)
 {
-	for (const FrameBuffer::Plane &plane : buffer->planes()) {
-		void *memory = mmap(NULL, plane.length, PROT_READ, MAP_SHARED,
-				    plane.fd.fd(), 0);
+	mappedBuffers_.map(buffer);
+}
+
+/*
+ * Queue the buffers of a completed request for writing. The request shall not
+ * be reused until it is handed back through the requestWritten signal. Return
+ * -EBUSY if the queue is full, in which case the caller keeps the request.
+ */
+int BufferWriter::queueRequest(Request *request,
+			       const std::map<Stream *, std::string> &streamNames)
+{
+	if (!notifier_)
+		return -ENODEV;
+
+	if (container_ && !video_.isOpen()) {
+		int ret = openContainer(streamNames);
+		if (ret < 0)
+			return ret;
+	}
+
+	Job job;
+	job.request = request;
+
+	for (const auto &it : request->buffers()) {
+		FrameBuffer *buffer = it.second;
+		std::string filename;
+
+		if (buffer->metadata().status == FrameMetadata::FrameSkipped)
+			continue;
+
+		if (!singleFile_) {
+			auto name = streamNames.find(it.first);
+
+			std::stringstream ss;
+			ss << (name != streamNames.end() ? name->second : "")
+			   << "-" << std::setw(6) << std::setfill('0')
+			   << buffer->metadata().sequence;
+
+			filename = pattern_;
+			filename.replace(filename.find_first_of('#'), 1, ss.str());
+		}
 
-		mappedBuffers_[plane.fd.fd()] =
-			std::make_pair(memory, plane.length);
+		auto stream = videoStreams_.find(it.first);
+		job.buffers.push_back({ buffer, std::move(filename),
+					stream != videoStreams_.end() ? stream->second : 0 });
 	}
+
+	{
+		std::lock_guard<std::mutex> locker(mutex_);
+		if (pending_.size() + (busy_ ? 1 : 0) >= maxQueued_)
+			return -EBUSY;
+
+		pending_.push_back(std::move(job));
+	}
+
+	cond_.notify_all();
+
+	return 0;
+}
+
+/*
+ * Wait for all queued buffers to be written. The requests still pending in the
+ * writer are dropped, without emitting the requestWritten signal.
+ */
+void BufferWriter::flush()
+{
+	std::unique_lock<std::mutex> locker(mutex_);
+	cond_.wait(locker, [&] { return pending_.empty() && !busy_; });
+	completed_.clear();
 }
 
-int BufferWriter::write(FrameBuffer *buffer, const std::string &streamName)
+void BufferWriter::run()
 {
-	std::string filename;
-	size_t pos;
-	int fd, ret = 0;
-
-	filename = pattern_;
-	pos = filename.find_first_of('#');
-	if (pos != std::string::npos) {
-		std::stringstream ss;
-		ss << streamName << "-" << std::setw(6)
-		   << std::setfill('0') << buffer->metadata().sequence;
-		filename.replace(pos, 1, ss.str());
+	std::unique_lock<std::mutex> locker(mutex_);
+
+	while (true) {
+		cond_.wait(locker, [&] { return stop_ || !pending_.empty(); });
+		if (pending_.empty())
+			break;
+
+		Job job = std::move(pending_.front());
+		pending_.pop_front();
+		busy_ = true;
+
+		locker.unlock();
+
+		for (const Item &item : job.buffers)
+			write(job, item);
+
+		locker.lock();
+
+		busy_ = false;
+		completed_.push_back(job.request);
+		cond_.notify_all();
+
+		uint64_t value = 1;
+		ssize_t ret = ::write(eventFd_, &value, sizeof(value));
+		if (ret != sizeof(value))
+			std::cerr << "failed to signal written request"
+				  << std::endl;
 	}
+}
+
+void BufferWriter::notifierActivated(EventNotifier *notifier)
+{
+	uint64_t value;
+	ssize_t ret = read(eventFd_, &value, sizeof(value));
+	if (ret != sizeof(value))
+		return;
+
+	std::deque<Request *> completed;
+
+	{
+		std::lock_guard<std::mutex> locker(mutex_);
+		completed.swap(completed_);
+	}
+
+	for (Request *request : completed)
+		requestWritten.emit(request);
+}
 
-	fd = open(filename.c_str(), O_CREAT | O_WRONLY |
-		  (pos == std::string::npos ? O_APPEND : O_TRUNC),
-		  S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH | S_IWOTH);
+int BufferWriter::openContainer(const std::map<Stream *, std::string> &streamNames)
+{
+	std::vector<RawVideoStream> streams;
+
+	videoStreams_.clear();
+	for (const auto &it : streamNames) {
+		const StreamConfiguration &cfg = it.first->configuration();
+
+		videoStreams_[it.first] = streams.size();
+		streams.push_back({ it.second, cfg.pixelFormat, cfg.size });
+	}
+
+	int ret = video_.open(pattern_, streams);
+	if (ret < 0) {
+		std::cerr << "failed to create " << pattern_ << ": "
+			  << strerror(-ret) << std::endl;
+		return ret;
+	}
+
+	return 0;
+}
+
+int BufferWriter::write(const Job &job, const Item &item)
+{
+	if (container_)
+		return writeContainer(job, item);
+
+	const MappedFrameBuffer *mapped = mappedBuffers_.find(item.buffer);
+	if (!mapped)
+		return -EINVAL;
+
+	const std::string &filename = item.filename;
+
+	if (singleFile_) {
+		if (fd_ == -1)
+			return -EBADF;
+
+		size_t size = 0;
+		for (const MappedFrameBuffer::Plane &plane : mapped->planes())
+			size += plane.length;
+
+		preallocate(size);
+
+		int ret = writePlanes(fd_, mapped);
+		if (ret > 0)
+			written_ += ret;
+
+		return ret;
+	}
+
+	int fd = open(filename.c_str(), O_CREAT | O_WRONLY | O_TRUNC,
+		      S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH | S_IWOTH);
 	if (fd == -1)
 		return -errno;
 
-	for (const FrameBuffer::Plane &plane : buffer->planes()) {
-		void *data = mappedBuffers_[plane.fd.fd()].first;
+	int ret = writePlanes(fd, mapped);
+
+	close(fd);
+
+	return ret;
+}
+
+/*
+ * Append a buffer to the container. Only the bytes used in each plane are
+ * stored, the request metadata is stored alongside the frame.
+ */
+int BufferWriter::writeContainer(const Job &job, const Item &item)
+{
+	const MappedFrameBuffer *mapped = mappedBuffers_.find(item.buffer);
+	if (!mapped)
+		return -EINVAL;
+
+	const FrameMetadata &metadata = item.buffer->metadata();
+	std::vector<Span<const uint8_t>> planes;
+
+	for (unsigned int i = 0; i < mapped->planes().size(); ++i) {
+		const MappedFrameBuffer::Plane &plane = mapped->planes()[i];
+		size_t length = plane.length;
+
+		if (i < metadata.planes().size() &&
+		    metadata.planes()[i].bytesused &&
+		    metadata.planes()[i].bytesused < length)
+			length = metadata.planes()[i].bytesused;
+
+		planes.emplace_back(plane.data, length);
+	}
+
+	ScopedCpuAccess access(*mapped);
+
+	int ret = video_.write(item.stream, metadata, planes,
+			       job.request->metadata());
+	if (ret < 0)
+		std::cerr << "write error: " << strerror(-ret) << std::endl;
+
+	return ret;
+}
+
+int BufferWriter::writePlanes(int fd, const MappedFrameBuffer *mapped)
+{
+	ScopedCpuAccess access(*mapped);
+	int total = 0;
+
+	for (const MappedFrameBuffer::Plane &plane : mapped->planes()) {
+		void *data = plane.data;
 		unsigned int length = plane.length;
 
-		ret = ::write(fd, data, length);
+		int ret = ::write(fd, data, length);
 		if (ret < 0) {
 			ret = -errno;
 			std::cerr << "write error: " << strerror(-ret)
 				  << std::endl;
-			break;
+			return ret;
 		} else if (ret != (int)length) {
 			std::cerr << "write error: only " << ret
 				  << " bytes written instead of "
 				  << length << std::endl;
-			break;
+			return total + ret;
 		}
+
+		total += ret;
 	}
 
-	close(fd);
+	return total;
+}
 
-	return ret;
+/*
+ * Reserve disk space for the next frames, to avoid growing the file on every
+ * write. Preallocation is disabled if the file system doesn't support it.
+ */
+void BufferWriter::preallocate(size_t size)
+{
+	if (allocated_ < 0 || written_ + static_cast<off_t>(size) <= allocated_)
+		return;
+
+	off_t offset = std::max(written_, allocated_);
+	off_t length = static_cast<off_t>(size) * PreallocFrames;
+
+	if (fallocate(fd_, FALLOC_FL_KEEP_SIZE, offset, length) < 0) {
+		allocated_ = -1;
+		return;
+	}
+
+	allocated_ = offset + length;
 }
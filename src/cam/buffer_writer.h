@@ -7,25 +7,83 @@
 #ifndef __LIBCAMERA_BUFFER_WRITER_H__
 #define __LIBCAMERA_BUFFER_WRITER_H__
 
+#include <condition_variable>
+#include <deque>
 #include <map>
+#include <mutex>
 #include <string>
+#include <sys/types.h>
+#include <thread>
+#include <utility>
+#include <vector>
 
 #include <libcamera/buffer.h>
+#include <libcamera/event_notifier.h>
+#include <libcamera/mapped_framebuffer.h>
+#include <libcamera/raw_video.h>
+#include <libcamera/request.h>
+#include <libcamera/signal.h>
+#include <libcamera/stream.h>
 
 class BufferWriter
 {
 public:
-	BufferWriter(const std::string &pattern = "frame-#.bin");
+	BufferWriter(const std::string &pattern = "frame-#.bin",
+		     unsigned int maxQueued = 8);
 	~BufferWriter();
 
 	void mapBuffer(libcamera::FrameBuffer *buffer);
 
-	int write(libcamera::FrameBuffer *buffer,
-		  const std::string &streamName);
+	int queueRequest(libcamera::Request *request,
+			 const std::map<libcamera::Stream *, std::string> &streamNames);
+	void flush();
+
+	libcamera::Signal<libcamera::Request *> requestWritten;
 
 private:
+	struct Item {
+		libcamera::FrameBuffer *buffer;
+		std::string filename;
+		unsigned int stream;
+	};
+
+	struct Job {
+		libcamera::Request *request;
+		std::vector<Item> buffers;
+	};
+
+	int openContainer(const std::map<libcamera::Stream *, std::string> &streamNames);
+	int write(const Job &job, const Item &item);
+	int writeContainer(const Job &job, const Item &item);
+	int writePlanes(int fd, const libcamera::MappedFrameBuffer *mapped);
+	void preallocate(size_t size);
+
+	void run();
+	void notifierActivated(libcamera::EventNotifier *notifier);
+
 	std::string pattern_;
-	std::map<int, std::pair<void *, unsigned int>> mappedBuffers_;
+	bool singleFile_;
+	bool container_;
+	unsigned int maxQueued_;
+	libcamera::MappedBufferCache mappedBuffers_;
+
+	int fd_;
+	off_t written_;
+	off_t allocated_;
+
+	libcamera::RawVideoWriter video_;
+	std::map<libcamera::Stream *, unsigned int> videoStreams_;
+
+	int eventFd_;
+	libcamera::EventNotifier *notifier_;
+
+	std::thread thread_;
+	std::mutex mutex_;
+	std::condition_variable cond_;
+	std::deque<Job> pending_;
+	std::deque<libcamera::Request *> completed_;
+	bool busy_;
+	bool stop_;
 };
 
 #endif /* __LIBCAMERA_BUFFER_WRITER_H__ */
@@ -16,12 +16,22 @@
 
 using namespace libcamera;
 
-Capture::Capture(std::shared_ptr<Camera> camera, CameraConfiguration *config)
-	: camera_(camera), config_(config), writer_(nullptr)
+Capture::Capture(std::shared_ptr<Camera> camera, CameraConfiguration *config,
+		 const std::string &prefix)
+	: camera_(camera), config_(config), prefix_(prefix),
+	  allocator_(nullptr), writer_(nullptr), checker_(nullptr), sink_(nullptr),
+	  encoder_(nullptr), net_(nullptr), share_(nullptr), captureLimit_(0),
+	  durationLimit_(0),
+	  captured_(0), running_(false), done_(false)
 {
 }
 
-int Capture::run(EventLoop *loop, const OptionsParser::Options &options)
+Capture::~Capture()
+{
+	stop();
+}
+
+int Capture::start(const OptionsParser::Options &options)
 {
 	int ret;
 
@@ -33,9 +43,17 @@ int Capture::run(EventLoop *loop, const OptionsParser::Options &options)
 	streamName_.clear();
 	for (unsigned int index = 0; index < config_->size(); ++index) {
 		StreamConfiguration &cfg = config_->at(index);
-		streamName_[cfg.stream()] = "stream" + std::to_string(index);
+		streamName_[cfg.stream()] = prefix_ + "stream" + std::to_string(index);
 	}
 
+	if (options.isSet(OptBenchmark))
+		benchmark_ = std::make_unique<Benchmark>();
+
+	if (options.isSet(OptFrames))
+		captureLimit_ = options[OptFrames].toInteger();
+	if (options.isSet(OptDuration))
+		durationLimit_ = std::chrono::seconds(options[OptDuration].toInteger());
+
 	ret = camera_->configure(config_);
 	if (ret < 0) {
 		std::cout << "Failed to configure camera" << std::endl;
@@ -49,37 +67,218 @@ int Capture::run(EventLoop *loop, const OptionsParser::Options &options)
 			writer_ = new BufferWriter(options[OptFile]);
 		else
 			writer_ = new BufferWriter();
+
+		writer_->requestWritten.connect(this, &Capture::requeueRequest);
 	}
 
+	if (options.isSet(OptCheck)) {
+		checker_ = new FrameChecker();
+		checker_->requestChecked.connect(this, &Capture::requeueRequest);
+	}
 
-	FrameBufferAllocator *allocator = FrameBufferAllocator::create(camera_);
+	allocator_ = FrameBufferAllocator::create(camera_);
 
-	ret = capture(loop, allocator);
+	if (options.isSet(OptDisplay)) {
+		sink_ = new KMSSink(options[OptDisplay].toString());
 
-	if (options.isSet(OptFile)) {
-		delete writer_;
-		writer_ = nullptr;
+		ret = sink_->configure(*config_);
+		if (ret < 0) {
+			std::cout << "Failed to configure display" << std::endl;
+			stop();
+			return ret;
+		}
+
+		sink_->requestProcessed.connect(this, &Capture::requeueRequest);
+	}
+
+	if (options.isSet(OptEncode)) {
+		encoder_ = new Encoder(options[OptEncode]);
+
+		ret = encoder_->configure(*config_);
+		if (ret < 0) {
+			std::cout << "Failed to configure encoder" << std::endl;
+			stop();
+			return ret;
+		}
+
+		encoder_->requestProcessed.connect(this, &Capture::requeueRequest);
+	}
+
+	if (options.isSet(OptNet)) {
+		net_ = new NetSink(options[OptNet]);
+
+		ret = net_->configure(*config_);
+		if (ret < 0) {
+			std::cout << "Failed to configure network sink" << std::endl;
+			stop();
+			return ret;
+		}
+
+		net_->requestProcessed.connect(this, &Capture::requeueRequest);
+	}
+
+	if (options.isSet(OptShare)) {
+		share_ = new CameraShareServer();
+
+		ret = share_->listen(options[OptShare]);
+		if (ret < 0) {
+			std::cout << "Failed to listen for clients" << std::endl;
+			stop();
+			return ret;
+		}
+
+		share_->configure(config_->at(0));
+		share_->frameReleased.connect(this, &Capture::frameReleased);
 	}
 
-	delete allocator;
+	ret = allocateRequests();
+	if (ret < 0) {
+		stop();
+		return ret;
+	}
+
+	if (sink_) {
+		ret = sink_->start();
+		if (ret < 0) {
+			std::cout << "Failed to start display" << std::endl;
+			stop();
+			return ret;
+		}
+	}
+
+	if (encoder_) {
+		ret = encoder_->start();
+		if (ret < 0) {
+			std::cout << "Failed to start encoder" << std::endl;
+			stop();
+			return ret;
+		}
+	}
+
+	if (net_) {
+		ret = net_->start();
+		if (ret < 0) {
+			std::cout << "Failed to start network sink" << std::endl;
+			stop();
+			return ret;
+		}
+	}
+
+	ret = camera_->start();
+	if (ret) {
+		std::cout << "Failed to start capture" << std::endl;
+		stop();
+		return ret;
+	}
+
+	running_ = true;
+
+	captured_ = 0;
+	done_ = false;
+	start_ = std::chrono::steady_clock::now();
+	if (benchmark_)
+		benchmark_->start();
+
+	for (std::unique_ptr<Request> &request : requests_) {
+		if (benchmark_)
+			benchmark_->requestQueued(request.get());
+
+		ret = camera_->queueRequest(request.get());
+		if (ret < 0) {
+			std::cerr << "Can't queue request" << std::endl;
+			stop();
+			return ret;
+		}
+	}
+
+	return 0;
+}
+
+int Capture::stop()
+{
+	int ret = 0;
+
+	if (!allocator_)
+		return 0;
+
+	if (running_) {
+		ret = camera_->stop();
+		if (ret)
+			std::cout << "Failed to stop capture" << std::endl;
+
+		running_ = false;
+	}
+
+	if (benchmark_)
+		benchmark_->stop();
+
+	camera_->requestCompleted.disconnect(this, &Capture::requestComplete);
+
+	/*
+	 * Wait for the writer, the checker, the display, the encoder and the
+	 * network sink to release the buffers before freeing them.
+	 */
+	if (writer_)
+		writer_->flush();
+
+	if (checker_) {
+		checker_->flush();
+		checker_->report(std::cout);
+	}
+
+	delete sink_;
+	sink_ = nullptr;
+
+	delete encoder_;
+	encoder_ = nullptr;
+
+	delete net_;
+	net_ = nullptr;
+
+	if (share_) {
+		share_->frameReleased.disconnect(this, &Capture::frameReleased);
+		delete share_;
+		share_ = nullptr;
+		shared_.clear();
+	}
+
+	requests_.clear();
+
+	delete writer_;
+	writer_ = nullptr;
+
+	delete checker_;
+	checker_ = nullptr;
+
+	delete allocator_;
+	allocator_ = nullptr;
 
 	return ret;
 }
 
-int Capture::capture(EventLoop *loop, FrameBufferAllocator *allocator)
+int Capture::allocateRequests()
 {
 	int ret;
 
+	/*
+	 * Only the buffer writer, the frame checker, the share clients and the
+	 * network sink access the frames with the CPU, the display and the
+	 * encoder use DMA.
+	 */
+	FrameBuffer::CpuAccess cpuAccess = writer_ || checker_ || share_ || net_
+					 ? FrameBuffer::CpuAccessRead
+					 : FrameBuffer::CpuAccessNone;
+
 	/* Identify the stream with the least number of buffers. */
 	unsigned int nbuffers = UINT_MAX;
 	for (StreamConfiguration &cfg : *config_) {
-		ret = allocator->allocate(cfg.stream());
+		ret = allocator_->allocate(cfg.stream(), cpuAccess);
 		if (ret < 0) {
 			std::cerr << "Can't allocate buffers" << std::endl;
 			return -ENOMEM;
 		}
 
-		unsigned int allocated = allocator->buffers(cfg.stream()).size();
+		unsigned int allocated = allocator_->buffers(cfg.stream()).size();
 		nbuffers = std::min(nbuffers, allocated);
 	}
 
@@ -88,9 +287,8 @@ int Capture::capture(EventLoop *loop, FrameBufferAllocator *allocator)
 	 * example pushing a button. For now run all streams all the time.
 	 */
 
-	std::vector<Request *> requests;
 	for (unsigned int i = 0; i < nbuffers; i++) {
-		Request *request = camera_->createRequest();
+		std::unique_ptr<Request> request = camera_->createRequest();
 		if (!request) {
 			std::cerr << "Can't create request" << std::endl;
 			return -ENOMEM;
@@ -99,7 +297,7 @@ int Capture::capture(EventLoop *loop, FrameBufferAllocator *allocator)
 		for (StreamConfiguration &cfg : *config_) {
 			Stream *stream = cfg.stream();
 			const std::vector<std::unique_ptr<FrameBuffer>> &buffers =
-				allocator->buffers(stream);
+				allocator_->buffers(stream);
 			const std::unique_ptr<FrameBuffer> &buffer = buffers[i];
 
 			ret = request->addBuffer(stream, buffer.get());
@@ -111,36 +309,39 @@ int Capture::capture(EventLoop *loop, FrameBufferAllocator *allocator)
 
 			if (writer_)
 				writer_->mapBuffer(buffer.get());
-		}
 
-		requests.push_back(request);
-	}
+			if (checker_)
+				checker_->mapBuffer(buffer.get());
 
-	ret = camera_->start();
-	if (ret) {
-		std::cout << "Failed to start capture" << std::endl;
-		return ret;
-	}
+			if (sink_ && stream == config_->at(0).stream()) {
+				ret = sink_->mapBuffer(buffer.get());
+				if (ret < 0)
+					return ret;
+			}
 
-	for (Request *request : requests) {
-		ret = camera_->queueRequest(request);
-		if (ret < 0) {
-			std::cerr << "Can't queue request" << std::endl;
-			camera_->stop();
-			return ret;
+			if (encoder_ && stream == config_->at(0).stream()) {
+				ret = encoder_->mapBuffer(buffer.get());
+				if (ret < 0)
+					return ret;
+			}
+
+			if (net_ && stream == config_->at(0).stream()) {
+				ret = net_->mapBuffer(buffer.get());
+				if (ret < 0)
+					return ret;
+			}
 		}
-	}
 
-	std::cout << "Capture until user interrupts by SIGINT" << std::endl;
-	ret = loop->exec();
-	if (ret)
-		std::cout << "Failed to run capture loop" << std::endl;
+		/*
+		 * All frames are captured with the same buffers and
+		 * controls, re-arm the requests instead of rebuilding them.
+		 */
+		request->setRepeating(true);
 
-	ret = camera_->stop();
-	if (ret)
-		std::cout << "Failed to stop capture" << std::endl;
+		requests_.push_back(std::move(request));
+	}
 
-	return ret;
+	return 0;
 }
 
 void Capture::requestComplete(Request *request)
@@ -148,6 +349,69 @@ void Capture::requestComplete(Request *request)
 	if (request->status() == Request::RequestCancelled)
 		return;
 
+	captured_++;
+
+	if (!done_) {
+		done_ = (captureLimit_ && captured_ >= captureLimit_) ||
+			(durationLimit_.count() &&
+			 std::chrono::steady_clock::now() - start_ >= durationLimit_);
+		if (done_)
+			finished.emit(this);
+	}
+
+	std::stringstream info;
+
+	if (benchmark_)
+		benchmark_->requestCompleted(request);
+	else
+		printInfo(request, info);
+
+	/*
+	 * Hand the request to the display, the encoder, the network sink, the
+	 * share clients, the writer or the checker, which will give it back
+	 * once the buffers have been displayed, encoded, sent, released,
+	 * written or hashed. If the writer or the checker can't keep up, skip
+	 * the frame instead of stalling the capture.
+	 */
+	bool held = false;
+	if (sink_) {
+		held = sink_->processRequest(request);
+		if (!held)
+			info << " (not displayed)";
+	} else if (encoder_) {
+		held = encoder_->processRequest(request);
+		if (!held)
+			info << " (not encoded)";
+	} else if (net_) {
+		held = net_->processRequest(request);
+		if (!held)
+			info << " (not sent)";
+	} else if (share_) {
+		FrameBuffer *buffer = request->findBuffer(config_->at(0).stream());
+		held = buffer && share_->queueFrame(buffer, request->metadata());
+		if (held)
+			shared_[buffer] = request;
+		else
+			info << " (not shared)";
+	} else if (writer_) {
+		held = !writer_->queueRequest(request, streamName_);
+		if (!held)
+			info << " (not written)";
+	} else if (checker_) {
+		held = !checker_->queueRequest(request, streamName_);
+		if (!held)
+			info << " (not hashed)";
+	}
+
+	if (!benchmark_)
+		std::cout << info.str() << std::endl;
+
+	if (!held)
+		requeueRequest(request);
+}
+
+void Capture::printInfo(Request *request, std::ostream &info)
+{
 	const std::map<Stream *, FrameBuffer *> &buffers = request->buffers();
 
 	std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
@@ -156,7 +420,6 @@ void Capture::requestComplete(Request *request)
 	    ? 1000.0 / fps : 0.0;
 	last_ = now;
 
-	std::stringstream info;
 	info << "fps: " << std::fixed << std::setprecision(2) << fps;
 
 	for (auto it = buffers.begin(); it != buffers.end(); ++it) {
@@ -165,40 +428,42 @@ void Capture::requestComplete(Request *request)
 		const std::string &name = streamName_[stream];
 
 		const FrameMetadata &metadata = buffer->metadata();
+		if (metadata.status == FrameMetadata::FrameSkipped)
+			continue;
 
 		info << " " << name
 		     << " seq: " << std::setw(6) << std::setfill('0') << metadata.sequence
 		     << " bytesused: ";
 
 		unsigned int nplane = 0;
-		for (const FrameMetadata::Plane &plane : metadata.planes) {
+		for (const FrameMetadata::Plane &plane : metadata.planes()) {
 			info << plane.bytesused;
-			if (++nplane < metadata.planes.size())
+			if (++nplane < metadata.planes().size())
 				info << "/";
 		}
-
-		if (writer_)
-			writer_->write(buffer, name);
 	}
+}
 
-	std::cout << info.str() << std::endl;
-
-	/*
-	 * Create a new request and populate it with one buffer for each
-	 * stream.
-	 */
-	request = camera_->createRequest();
-	if (!request) {
-		std::cerr << "Can't create request" << std::endl;
+void Capture::requeueRequest(Request *request)
+{
+	/* Stop capturing once the capture limit has been reached. */
+	if (done_)
 		return;
-	}
 
-	for (auto it = buffers.begin(); it != buffers.end(); ++it) {
-		Stream *stream = it->first;
-		FrameBuffer *buffer = it->second;
+	if (benchmark_)
+		benchmark_->requestQueued(request);
 
-		request->addBuffer(stream, buffer);
-	}
+	/* Re-arm the request with the same buffers and queue it again. */
+	camera_->releaseRequest(request);
+}
+
+void Capture::frameReleased(FrameBuffer *buffer)
+{
+	auto iter = shared_.find(buffer);
+	if (iter == shared_.end())
+		return;
 
-	camera_->queueRequest(request);
+	Request *request = iter->second;
+	shared_.erase(iter);
+	requeueRequest(request);
 }
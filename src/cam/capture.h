@@ -9,36 +9,74 @@
 
 #include <chrono>
 #include <memory>
+#include <ostream>
+#include <string>
+#include <vector>
 
 #include <libcamera/buffer.h>
 #include <libcamera/camera.h>
+#include <libcamera/camera_share.h>
 #include <libcamera/framebuffer_allocator.h>
 #include <libcamera/request.h>
+#include <libcamera/signal.h>
 #include <libcamera/stream.h>
 
+#include "benchmark.h"
 #include "buffer_writer.h"
-#include "event_loop.h"
+#include "encoder.h"
+#include "frame_checker.h"
+#include "kms_sink.h"
+#include "net_sink.h"
 #include "options.h"
 
 class Capture
 {
 public:
 	Capture(std::shared_ptr<libcamera::Camera> camera,
-		libcamera::CameraConfiguration *config);
+		libcamera::CameraConfiguration *config,
+		const std::string &prefix = "");
+	~Capture();
+
+	int start(const OptionsParser::Options &options);
+	int stop();
+
+	const libcamera::Camera *camera() const { return camera_.get(); }
+	const Benchmark *benchmark() const { return benchmark_.get(); }
+
+	libcamera::Signal<Capture *> finished;
 
-	int run(EventLoop *loop, const OptionsParser::Options &options);
 private:
-	int capture(EventLoop *loop,
-		    libcamera::FrameBufferAllocator *allocator);
+	int allocateRequests();
 
 	void requestComplete(libcamera::Request *request);
+	void printInfo(libcamera::Request *request, std::ostream &info);
+	void requeueRequest(libcamera::Request *request);
+	void frameReleased(libcamera::FrameBuffer *buffer);
 
 	std::shared_ptr<libcamera::Camera> camera_;
 	libcamera::CameraConfiguration *config_;
+	std::string prefix_;
 
 	std::map<libcamera::Stream *, std::string> streamName_;
+	libcamera::FrameBufferAllocator *allocator_;
 	BufferWriter *writer_;
+	FrameChecker *checker_;
+	KMSSink *sink_;
+	Encoder *encoder_;
+	NetSink *net_;
+	libcamera::CameraShareServer *share_;
+	std::map<libcamera::FrameBuffer *, libcamera::Request *> shared_;
 	std::chrono::steady_clock::time_point last_;
+
+	std::unique_ptr<Benchmark> benchmark_;
+	unsigned int captureLimit_;
+	std::chrono::seconds durationLimit_;
+	std::chrono::steady_clock::time_point start_;
+	unsigned int captured_;
+	bool running_;
+	bool done_;
+
+	std::vector<std::unique_ptr<libcamera::Request>> requests_;
 };
 
 #endif /* __CAM_CAPTURE_H__ */
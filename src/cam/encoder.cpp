@@ -0,0 +1,580 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * encoder.cpp - V4L2 M2M video encoder
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <iostream>
+#include <poll.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <linux/drm_fourcc.h>
+#include <linux/videodev2.h>
+
+#include "encoder.h"
+
+using namespace libcamera;
+
+namespace {
+
+/* Maximum number of video device nodes probed to find an encoder. */
+constexpr unsigned int MaxDevices = 64;
+
+/* Number of buffers for the encoded bitstream. */
+constexpr unsigned int CodedBufferCount = 4;
+
+/* Time to wait for the encoder to drain when stopping, in milliseconds. */
+constexpr int DrainTimeout = 1000;
+
+/* Raw formats accepted by the encoder, as DRM and V4L2 pixel formats. */
+const std::map<PixelFormat, uint32_t> rawFormats = {
+	{ DRM_FORMAT_NV12, V4L2_PIX_FMT_NV12 },
+	{ DRM_FORMAT_NV21, V4L2_PIX_FMT_NV21 },
+	{ DRM_FORMAT_NV16, V4L2_PIX_FMT_NV16 },
+	{ DRM_FORMAT_NV61, V4L2_PIX_FMT_NV61 },
+	{ DRM_FORMAT_YUV420, V4L2_PIX_FMT_YUV420 },
+	{ DRM_FORMAT_YVU420, V4L2_PIX_FMT_YVU420 },
+	{ DRM_FORMAT_YUYV, V4L2_PIX_FMT_YUYV },
+	{ DRM_FORMAT_UYVY, V4L2_PIX_FMT_UYVY },
+};
+
+int xioctl(int fd, unsigned long request, void *arg)
+{
+	int ret;
+
+	do {
+		ret = ioctl(fd, request, arg);
+	} while (ret < 0 && errno == EINTR);
+
+	return ret < 0 ? -errno : 0;
+}
+
+bool hasFormat(int fd, uint32_t type, uint32_t format)
+{
+	struct v4l2_fmtdesc desc = {};
+	desc.type = type;
+
+	while (!xioctl(fd, VIDIOC_ENUM_FMT, &desc)) {
+		if (desc.pixelformat == format)
+			return true;
+		desc.index++;
+	}
+
+	return false;
+}
+
+bool endsWith(const std::string &str, const std::string &suffix)
+{
+	return str.size() >= suffix.size() &&
+	       !str.compare(str.size() - suffix.size(), suffix.size(), suffix);
+}
+
+} /* namespace */
+
+/*
+ * The encoder feeds the buffers of the first stream of the camera to a V4L2
+ * memory-to-memory H.264 or HEVC encoder, and writes the bitstream to a file.
+ * The FrameBuffer dmabufs are queued to the encoder without any copy. A request
+ * is held by the encoder until the encoder releases its buffer, and is then
+ * handed back through the requestProcessed signal.
+ *
+ * The codec is selected from the file name extension: '.h265' and '.hevc'
+ * select HEVC, any other extension selects H.264.
+ */
+Encoder::Encoder(const std::string &filename)
+	: filename_(filename), fd_(-1), file_(-1), mplane_(false),
+	  outputType_(0), captureType_(0), rawPlanes_(0), stream_(nullptr),
+	  codedNotifier_(nullptr), rawNotifier_(nullptr), streaming_(false),
+	  eos_(false)
+{
+	codec_ = endsWith(filename_, ".h265") || endsWith(filename_, ".hevc")
+	       ? V4L2_PIX_FMT_HEVC : V4L2_PIX_FMT_H264;
+}
+
+Encoder::~Encoder()
+{
+	stop();
+
+	if (fd_ != -1)
+		close(fd_);
+	if (file_ != -1)
+		close(file_);
+}
+
+int Encoder::openDevice(uint32_t rawFormat)
+{
+	for (unsigned int i = 0; i < MaxDevices; ++i) {
+		std::string path = "/dev/video" + std::to_string(i);
+
+		int fd = open(path.c_str(), O_RDWR | O_NONBLOCK | O_CLOEXEC);
+		if (fd == -1)
+			continue;
+
+		struct v4l2_capability caps = {};
+		if (xioctl(fd, VIDIOC_QUERYCAP, &caps) < 0) {
+			close(fd);
+			continue;
+		}
+
+		uint32_t deviceCaps = caps.capabilities & V4L2_CAP_DEVICE_CAPS
+				    ? caps.device_caps : caps.capabilities;
+
+		bool mplane;
+		if (deviceCaps & V4L2_CAP_VIDEO_M2M_MPLANE) {
+			mplane = true;
+		} else if (deviceCaps & V4L2_CAP_VIDEO_M2M) {
+			mplane = false;
+		} else {
+			close(fd);
+			continue;
+		}
+
+		uint32_t outputType = mplane ? V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE
+					     : V4L2_BUF_TYPE_VIDEO_OUTPUT;
+		uint32_t captureType = mplane ? V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE
+					      : V4L2_BUF_TYPE_VIDEO_CAPTURE;
+
+		if (!hasFormat(fd, captureType, codec_) ||
+		    !hasFormat(fd, outputType, rawFormat)) {
+			close(fd);
+			continue;
+		}
+
+		std::cout << "Encoding with " << caps.card << " (" << path << ")"
+			  << std::endl;
+
+		fd_ = fd;
+		mplane_ = mplane;
+		outputType_ = outputType;
+		captureType_ = captureType;
+
+		return 0;
+	}
+
+	return -ENODEV;
+}
+
+int Encoder::setFormats(uint32_t rawFormat, const Size &size)
+{
+	struct v4l2_format fmt = {};
+	int ret;
+
+	fmt.type = outputType_;
+	if (mplane_) {
+		fmt.fmt.pix_mp.width = size.width;
+		fmt.fmt.pix_mp.height = size.height;
+		fmt.fmt.pix_mp.pixelformat = rawFormat;
+		fmt.fmt.pix_mp.field = V4L2_FIELD_NONE;
+	} else {
+		fmt.fmt.pix.width = size.width;
+		fmt.fmt.pix.height = size.height;
+		fmt.fmt.pix.pixelformat = rawFormat;
+		fmt.fmt.pix.field = V4L2_FIELD_NONE;
+	}
+
+	ret = xioctl(fd_, VIDIOC_S_FMT, &fmt);
+	if (ret < 0)
+		return ret;
+
+	uint32_t width = mplane_ ? fmt.fmt.pix_mp.width : fmt.fmt.pix.width;
+	uint32_t height = mplane_ ? fmt.fmt.pix_mp.height : fmt.fmt.pix.height;
+	uint32_t format = mplane_ ? fmt.fmt.pix_mp.pixelformat : fmt.fmt.pix.pixelformat;
+
+	if (width != size.width || height != size.height || format != rawFormat) {
+		std::cerr << "Encoder doesn't support " << size.toString()
+			  << std::endl;
+		return -EINVAL;
+	}
+
+	rawPlanes_ = mplane_ ? fmt.fmt.pix_mp.num_planes : 1;
+
+	/* Let the driver size the bitstream buffers. */
+	fmt = {};
+	fmt.type = captureType_;
+	if (mplane_) {
+		fmt.fmt.pix_mp.width = size.width;
+		fmt.fmt.pix_mp.height = size.height;
+		fmt.fmt.pix_mp.pixelformat = codec_;
+		fmt.fmt.pix_mp.num_planes = 1;
+	} else {
+		fmt.fmt.pix.width = size.width;
+		fmt.fmt.pix.height = size.height;
+		fmt.fmt.pix.pixelformat = codec_;
+	}
+
+	return xioctl(fd_, VIDIOC_S_FMT, &fmt);
+}
+
+int Encoder::configure(const CameraConfiguration &config)
+{
+	const StreamConfiguration &cfg = config.at(0);
+
+	auto raw = rawFormats.find(cfg.pixelFormat);
+	if (raw == rawFormats.end()) {
+		std::cerr << "Pixel format 0x" << std::hex << cfg.pixelFormat
+			  << std::dec << " can't be encoded" << std::endl;
+		return -EINVAL;
+	}
+
+	int ret = openDevice(raw->second);
+	if (ret < 0) {
+		std::cerr << "No encoder found for pixel format 0x" << std::hex
+			  << cfg.pixelFormat << std::dec << std::endl;
+		return ret;
+	}
+
+	ret = setFormats(raw->second, cfg.size);
+	if (ret < 0)
+		return ret;
+
+	file_ = open(filename_.c_str(), O_CREAT | O_WRONLY | O_TRUNC | O_CLOEXEC,
+		     S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH | S_IWOTH);
+	if (file_ == -1) {
+		ret = -errno;
+		std::cerr << "failed to open " << filename_ << ": "
+			  << strerror(-ret) << std::endl;
+		return ret;
+	}
+
+	stream_ = cfg.stream();
+
+	return 0;
+}
+
+/*
+ * Associate a buffer of the encoded stream with an encoder input buffer. The
+ * buffer planes must match the planes of the encoder input format.
+ */
+int Encoder::mapBuffer(FrameBuffer *buffer)
+{
+	if (fd_ == -1)
+		return -ENODEV;
+
+	if (buffer->planes().size() != rawPlanes_) {
+		std::cerr << "Encoder requires " << rawPlanes_
+			  << " planes, buffer has " << buffer->planes().size()
+			  << std::endl;
+		return -EINVAL;
+	}
+
+	unsigned int index = rawIndices_.size();
+	rawIndices_[buffer] = index;
+
+	return 0;
+}
+
+int Encoder::start()
+{
+	int ret;
+
+	if (fd_ == -1)
+		return -ENODEV;
+
+	struct v4l2_requestbuffers reqbufs = {};
+	reqbufs.count = rawIndices_.size();
+	reqbufs.type = outputType_;
+	reqbufs.memory = V4L2_MEMORY_DMABUF;
+
+	ret = xioctl(fd_, VIDIOC_REQBUFS, &reqbufs);
+	if (ret < 0)
+		return ret;
+
+	if (reqbufs.count < rawIndices_.size()) {
+		std::cerr << "Encoder supports only " << reqbufs.count
+			  << " input buffers" << std::endl;
+		return -ENOMEM;
+	}
+
+	reqbufs = {};
+	reqbufs.count = CodedBufferCount;
+	reqbufs.type = captureType_;
+	reqbufs.memory = V4L2_MEMORY_MMAP;
+
+	ret = xioctl(fd_, VIDIOC_REQBUFS, &reqbufs);
+	if (ret < 0)
+		return ret;
+
+	for (unsigned int i = 0; i < reqbufs.count; ++i) {
+		struct v4l2_plane plane = {};
+		struct v4l2_buffer buf = {};
+		buf.index = i;
+		buf.type = captureType_;
+		buf.memory = V4L2_MEMORY_MMAP;
+		if (mplane_) {
+			buf.length = 1;
+			buf.m.planes = &plane;
+		}
+
+		ret = xioctl(fd_, VIDIOC_QUERYBUF, &buf);
+		if (ret < 0)
+			return ret;
+
+		size_t length = mplane_ ? plane.length : buf.length;
+		off_t offset = mplane_ ? plane.m.mem_offset : buf.m.offset;
+
+		void *mem = mmap(nullptr, length, PROT_READ, MAP_SHARED, fd_, offset);
+		if (mem == MAP_FAILED)
+			return -errno;
+
+		codedBuffers_.push_back({ mem, length });
+
+		ret = queueCodedBuffer(i);
+		if (ret < 0)
+			return ret;
+	}
+
+	uint32_t type = outputType_;
+	ret = xioctl(fd_, VIDIOC_STREAMON, &type);
+	if (ret < 0)
+		return ret;
+
+	type = captureType_;
+	ret = xioctl(fd_, VIDIOC_STREAMON, &type);
+	if (ret < 0)
+		return ret;
+
+	codedNotifier_ = new EventNotifier(fd_, EventNotifier::Read);
+	codedNotifier_->activated.connect(this, &Encoder::codedAvailable);
+
+	/* Input buffers are only watched for while some are queued. */
+	rawNotifier_ = new EventNotifier(fd_, EventNotifier::Write);
+	rawNotifier_->activated.connect(this, &Encoder::rawReleased);
+	rawNotifier_->setEnabled(false);
+
+	streaming_ = true;
+	eos_ = false;
+
+	return 0;
+}
+
+/*
+ * Drain the encoder, write the remaining bitstream, and stop it. The requests
+ * held by the encoder are dropped, without emitting the requestProcessed
+ * signal.
+ */
+int Encoder::stop()
+{
+	if (fd_ == -1)
+		return 0;
+
+	delete codedNotifier_;
+	codedNotifier_ = nullptr;
+	delete rawNotifier_;
+	rawNotifier_ = nullptr;
+
+	if (streaming_) {
+		struct v4l2_encoder_cmd cmd = {};
+		cmd.cmd = V4L2_ENC_CMD_STOP;
+
+		if (!xioctl(fd_, VIDIOC_ENCODER_CMD, &cmd)) {
+			while (!eos_) {
+				struct pollfd pfd = { fd_, POLLIN, 0 };
+				if (poll(&pfd, 1, DrainTimeout) <= 0 ||
+				    dequeueCoded() < 0)
+					break;
+			}
+		}
+	}
+
+	uint32_t type = outputType_;
+	xioctl(fd_, VIDIOC_STREAMOFF, &type);
+	type = captureType_;
+	xioctl(fd_, VIDIOC_STREAMOFF, &type);
+
+	for (const CodedBuffer &buffer : codedBuffers_)
+		munmap(buffer.mem, buffer.length);
+	codedBuffers_.clear();
+
+	struct v4l2_requestbuffers reqbufs = {};
+	reqbufs.type = outputType_;
+	reqbufs.memory = V4L2_MEMORY_DMABUF;
+	xioctl(fd_, VIDIOC_REQBUFS, &reqbufs);
+
+	reqbufs = {};
+	reqbufs.type = captureType_;
+	reqbufs.memory = V4L2_MEMORY_MMAP;
+	xioctl(fd_, VIDIOC_REQBUFS, &reqbufs);
+
+	queued_.clear();
+	rawIndices_.clear();
+	streaming_ = false;
+
+	return 0;
+}
+
+/*
+ * Queue the buffer of the request to the encoder. Return true if the encoder
+ * holds the request, which will then be handed back through the
+ * requestProcessed signal, or false if the buffer wasn't encoded.
+ */
+bool Encoder::processRequest(Request *request)
+{
+	if (!streaming_)
+		return false;
+
+	FrameBuffer *buffer = request->findBuffer(stream_);
+	auto index = rawIndices_.find(buffer);
+	if (index == rawIndices_.end())
+		return false;
+
+	const FrameMetadata &metadata = buffer->metadata();
+	Span<const FrameBuffer::Plane> planes = buffer->planes();
+
+	struct v4l2_plane v4l2Planes[VIDEO_MAX_PLANES] = {};
+	struct v4l2_buffer buf = {};
+	buf.index = index->second;
+	buf.type = outputType_;
+	buf.memory = V4L2_MEMORY_DMABUF;
+	buf.field = V4L2_FIELD_NONE;
+	buf.timestamp.tv_sec = metadata.timestamp / 1000000000;
+	buf.timestamp.tv_usec = (metadata.timestamp / 1000) % 1000000;
+
+	for (unsigned int i = 0; i < planes.size(); ++i) {
+		unsigned int bytesused = i < metadata.planes().size()
+				       ? metadata.planes()[i].bytesused : 0;
+		if (!bytesused)
+			bytesused = planes[i].length;
+
+		if (mplane_) {
+			v4l2Planes[i].m.fd = planes[i].fd.fd();
+			v4l2Planes[i].length = planes[i].length;
+			v4l2Planes[i].bytesused = bytesused;
+		} else {
+			buf.m.fd = planes[i].fd.fd();
+			buf.length = planes[i].length;
+			buf.bytesused = bytesused;
+		}
+	}
+
+	if (mplane_) {
+		buf.length = planes.size();
+		buf.m.planes = v4l2Planes;
+	}
+
+	if (xioctl(fd_, VIDIOC_QBUF, &buf) < 0)
+		return false;
+
+	queued_[buf.index] = request;
+	rawNotifier_->setEnabled(true);
+
+	return true;
+}
+
+int Encoder::queueCodedBuffer(unsigned int index)
+{
+	struct v4l2_plane plane = {};
+	struct v4l2_buffer buf = {};
+	buf.index = index;
+	buf.type = captureType_;
+	buf.memory = V4L2_MEMORY_MMAP;
+	if (mplane_) {
+		buf.length = 1;
+		buf.m.planes = &plane;
+	}
+
+	return xioctl(fd_, VIDIOC_QBUF, &buf);
+}
+
+/*
+ * Write all the bitstream buffers produced by the encoder to the file, and
+ * give them back to the encoder. Return the number of buffers dequeued, or a
+ * negative error code.
+ */
+int Encoder::dequeueCoded()
+{
+	int count = 0;
+
+	while (!eos_) {
+		struct v4l2_plane plane = {};
+		struct v4l2_buffer buf = {};
+		buf.type = captureType_;
+		buf.memory = V4L2_MEMORY_MMAP;
+		if (mplane_) {
+			buf.length = 1;
+			buf.m.planes = &plane;
+		}
+
+		int ret = xioctl(fd_, VIDIOC_DQBUF, &buf);
+		if (ret == -EAGAIN)
+			break;
+		if (ret < 0)
+			return ret;
+
+		count++;
+
+		const CodedBuffer &coded = codedBuffers_[buf.index];
+		const uint8_t *data = static_cast<const uint8_t *>(coded.mem);
+		size_t size = buf.bytesused;
+		if (mplane_) {
+			data += plane.data_offset;
+			size = plane.bytesused - plane.data_offset;
+		}
+
+		if (size && write(file_, data, size) != static_cast<ssize_t>(size))
+			std::cerr << "write error: " << strerror(errno)
+				  << std::endl;
+
+		if (buf.flags & V4L2_BUF_FLAG_LAST) {
+			eos_ = true;
+			break;
+		}
+
+		ret = queueCodedBuffer(buf.index);
+		if (ret < 0)
+			return ret;
+	}
+
+	return count;
+}
+
+void Encoder::dequeueRaw()
+{
+	while (!queued_.empty()) {
+		struct v4l2_plane planes[VIDEO_MAX_PLANES] = {};
+		struct v4l2_buffer buf = {};
+		buf.type = outputType_;
+		buf.memory = V4L2_MEMORY_DMABUF;
+		if (mplane_) {
+			buf.length = rawPlanes_;
+			buf.m.planes = planes;
+		}
+
+		if (xioctl(fd_, VIDIOC_DQBUF, &buf) < 0)
+			break;
+
+		auto it = queued_.find(buf.index);
+		if (it == queued_.end())
+			continue;
+
+		Request *request = it->second;
+		queued_.erase(it);
+
+		requestProcessed.emit(request);
+	}
+
+	if (queued_.empty() && rawNotifier_)
+		rawNotifier_->setEnabled(false);
+}
+
+void Encoder::codedAvailable(EventNotifier *notifier)
+{
+	int ret = dequeueCoded();
+	if (ret < 0)
+		std::cerr << "Failed to dequeue encoded buffer: "
+			  << strerror(-ret) << std::endl;
+
+	/* The input buffers are usually released along with the bitstream. */
+	dequeueRaw();
+}
+
+void Encoder::rawReleased(EventNotifier *notifier)
+{
+	dequeueRaw();
+}
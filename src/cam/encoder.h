@@ -0,0 +1,75 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * encoder.h - V4L2 M2M video encoder
+ */
+#ifndef __CAM_ENCODER_H__
+#define __CAM_ENCODER_H__
+
+#include <map>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include <libcamera/buffer.h>
+#include <libcamera/camera.h>
+#include <libcamera/event_notifier.h>
+#include <libcamera/request.h>
+#include <libcamera/signal.h>
+#include <libcamera/stream.h>
+
+class Encoder
+{
+public:
+	Encoder(const std::string &filename);
+	~Encoder();
+
+	int configure(const libcamera::CameraConfiguration &config);
+	int mapBuffer(libcamera::FrameBuffer *buffer);
+
+	int start();
+	int stop();
+
+	bool processRequest(libcamera::Request *request);
+
+	libcamera::Signal<libcamera::Request *> requestProcessed;
+
+private:
+	struct CodedBuffer {
+		void *mem;
+		size_t length;
+	};
+
+	int openDevice(uint32_t rawFormat);
+	int setFormats(uint32_t rawFormat, const libcamera::Size &size);
+	int queueCodedBuffer(unsigned int index);
+
+	int dequeueCoded();
+	void dequeueRaw();
+
+	void codedAvailable(libcamera::EventNotifier *notifier);
+	void rawReleased(libcamera::EventNotifier *notifier);
+
+	std::string filename_;
+	uint32_t codec_;
+	int fd_;
+	int file_;
+
+	bool mplane_;
+	uint32_t outputType_;
+	uint32_t captureType_;
+	unsigned int rawPlanes_;
+
+	libcamera::Stream *stream_;
+	libcamera::EventNotifier *codedNotifier_;
+	libcamera::EventNotifier *rawNotifier_;
+	bool streaming_;
+	bool eos_;
+
+	std::vector<CodedBuffer> codedBuffers_;
+	std::map<libcamera::FrameBuffer *, unsigned int> rawIndices_;
+	std::map<unsigned int, libcamera::Request *> queued_;
+};
+
+#endif /* __CAM_ENCODER_H__ */
@@ -0,0 +1,422 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * frame_checker.cpp - Frame integrity checker
+ */
+
+#include <algorithm>
+#include <array>
+#include <iomanip>
+#include <iostream>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#define CRC32C_SSE42 1
+#elif defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+#include <arm_acle.h>
+#define CRC32C_ARM 1
+#endif
+
+#include "frame_checker.h"
+
+using namespace libcamera;
+
+/* Number of past frames per stream compared to each new frame. */
+static constexpr unsigned int HistorySize = 16;
+
+namespace {
+
+/*
+ * CRC32C (Castagnoli) of the frame data. The CRC instructions of x86-64
+ * (SSE4.2) and ARMv8 hash frames at several GB/s, the slicing-by-8 table
+ * implementation is used as a fallback on other CPUs.
+ */
+constexpr uint32_t Crc32cPolynomial = 0x82f63b78;
+
+struct Crc32cTable {
+	Crc32cTable()
+	{
+		for (unsigned int i = 0; i < 256; ++i) {
+			uint32_t crc = i;
+			for (unsigned int j = 0; j < 8; ++j)
+				crc = (crc >> 1) ^ (crc & 1 ? Crc32cPolynomial : 0);
+			table[0][i] = crc;
+		}
+
+		for (unsigned int i = 0; i < 256; ++i) {
+			for (unsigned int j = 1; j < 8; ++j)
+				table[j][i] = (table[j - 1][i] >> 8) ^
+					      table[0][table[j - 1][i] & 0xff];
+		}
+	}
+
+	std::array<std::array<uint32_t, 256>, 8> table;
+};
+
+uint32_t crc32cTable(uint32_t crc, const uint8_t *data, size_t length)
+{
+	static const Crc32cTable crc32c;
+	const auto &t = crc32c.table;
+
+	for (; length >= 8; length -= 8, data += 8) {
+		uint32_t lo;
+		uint32_t hi;
+		memcpy(&lo, data, 4);
+		memcpy(&hi, data + 4, 4);
+		lo ^= crc;
+
+		crc = t[7][lo & 0xff] ^ t[6][(lo >> 8) & 0xff] ^
+		      t[5][(lo >> 16) & 0xff] ^ t[4][lo >> 24] ^
+		      t[3][hi & 0xff] ^ t[2][(hi >> 8) & 0xff] ^
+		      t[1][(hi >> 16) & 0xff] ^ t[0][hi >> 24];
+	}
+
+	while (length--)
+		crc = (crc >> 8) ^ t[0][(crc ^ *data++) & 0xff];
+
+	return crc;
+}
+
+#if defined(CRC32C_SSE42)
+
+/*
+ * SSE4.2 isn't part of the x86-64 baseline, the function is compiled for
+ * SSE4.2 explicitly and selected at runtime when the CPU supports it.
+ */
+__attribute__((target("sse4.2")))
+uint32_t crc32cSse42(uint32_t crc, const uint8_t *data, size_t length)
+{
+	uint64_t crc64 = crc;
+
+	for (; length >= 8; length -= 8, data += 8) {
+		uint64_t value;
+		memcpy(&value, data, 8);
+		crc64 = _mm_crc32_u64(crc64, value);
+	}
+
+	crc = crc64;
+	while (length--)
+		crc = _mm_crc32_u8(crc, *data++);
+
+	return crc;
+}
+
+bool cpuHasSse42()
+{
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("sse4.2") != 0;
+}
+
+#endif /* CRC32C_SSE42 */
+
+#if defined(CRC32C_ARM)
+
+uint32_t crc32cArm(uint32_t crc, const uint8_t *data, size_t length)
+{
+	for (; length >= 8; length -= 8, data += 8) {
+		uint64_t value;
+		memcpy(&value, data, 8);
+		crc = __crc32cd(crc, value);
+	}
+
+	while (length--)
+		crc = __crc32cb(crc, *data++);
+
+	return crc;
+}
+
+#endif /* CRC32C_ARM */
+
+uint32_t crc32c(uint32_t crc, const uint8_t *data, size_t length)
+{
+#if defined(CRC32C_SSE42)
+	static const bool sse42 = cpuHasSse42();
+	if (sse42)
+		return crc32cSse42(crc, data, length);
+#elif defined(CRC32C_ARM)
+	return crc32cArm(crc, data, length);
+#endif
+
+	return crc32cTable(crc, data, length);
+}
+
+} /* namespace */
+
+/*
+ * The checker verifies the integrity of the captured frames without writing
+ * them to disk. Frame status, sequence numbers and timestamps are checked when
+ * the request is queued, and the planes are hashed by a background thread to
+ * detect frames identical to one of the previous frames of the same stream,
+ * which denote a frozen capture or buffers delivered twice. The checker holds
+ * the requests until their buffers have been hashed, and hands them back
+ * through the requestChecked signal, emitted from the thread that created the
+ * checker.
+ */
+FrameChecker::FrameChecker(unsigned int maxQueued)
+	: maxQueued_(maxQueued), notifier_(nullptr), busy_(false), stop_(false)
+{
+	eventFd_ = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (eventFd_ != -1) {
+		notifier_ = new EventNotifier(eventFd_, EventNotifier::Read);
+		notifier_->activated.connect(this, &FrameChecker::notifierActivated);
+	} else {
+		std::cerr << "failed to create eventfd: " << strerror(errno)
+			  << std::endl;
+	}
+
+	thread_ = std::thread(&FrameChecker::run, this);
+}
+
+FrameChecker::~FrameChecker()
+{
+	{
+		std::lock_guard<std::mutex> locker(mutex_);
+		stop_ = true;
+	}
+
+	cond_.notify_all();
+	thread_.join();
+
+	delete notifier_;
+
+	if (eventFd_ != -1)
+		close(eventFd_);
+}
+
+void FrameChecker::mapBuffer(FrameBuffer *buffer)
+{
+	mappedBuffers_.map(buffer);
+}
+
+/*
+ * Check the buffers of a completed request and queue them for hashing. The
+ * request shall not be reused until it is handed back through the
+ * requestChecked signal. Return -EBUSY if the queue is full, in which case the
+ * caller keeps the request and the frames are counted but not hashed.
+ */
+int FrameChecker::queueRequest(Request *request,
+			       const std::map<Stream *, std::string> &streamNames)
+{
+	if (!notifier_)
+		return -ENODEV;
+
+	Job job;
+	job.request = request;
+
+	for (const auto &it : request->buffers()) {
+		Stream *stream = it.first;
+		FrameBuffer *buffer = it.second;
+		const FrameMetadata &metadata = buffer->metadata();
+
+		if (metadata.status == FrameMetadata::FrameSkipped)
+			continue;
+
+		StreamState &state = streams_[stream];
+		if (state.name.empty()) {
+			auto name = streamNames.find(stream);
+			state.name = name != streamNames.end() ? name->second : "";
+		}
+
+		checkSequence(state, metadata);
+
+		if (metadata.status == FrameMetadata::FrameSuccess)
+			job.frames.push_back({ stream, buffer, metadata.sequence, 0 });
+	}
+
+	{
+		std::lock_guard<std::mutex> locker(mutex_);
+		if (pending_.size() + (busy_ ? 1 : 0) >= maxQueued_)
+			return -EBUSY;
+
+		pending_.push_back(std::move(job));
+	}
+
+	cond_.notify_all();
+
+	return 0;
+}
+
+/*
+ * Wait for all queued buffers to be hashed and account for the results. The
+ * requests still pending in the checker are dropped, without emitting the
+ * requestChecked signal.
+ */
+void FrameChecker::flush()
+{
+	std::deque<Job> completed;
+
+	{
+		std::unique_lock<std::mutex> locker(mutex_);
+		cond_.wait(locker, [&] { return pending_.empty() && !busy_; });
+		completed.swap(completed_);
+	}
+
+	for (const Job &job : completed) {
+		for (const Frame &frame : job.frames)
+			checkHash(streams_[frame.stream], frame);
+	}
+}
+
+void FrameChecker::report(std::ostream &out) const
+{
+	for (const auto &it : streams_) {
+		const StreamState &state = it.second;
+
+		out << state.name << ": " << state.frames << " frames, "
+		    << state.hashed << " hashed, "
+		    << state.errors << " errors, "
+		    << state.dropped << " dropped, "
+		    << state.sequenceErrors << " sequence errors, "
+		    << state.timestampErrors << " timestamp errors, "
+		    << state.frozen << " frozen, "
+		    << state.duplicated << " duplicated" << std::endl;
+	}
+}
+
+void FrameChecker::checkSequence(StreamState &state, const FrameMetadata &metadata)
+{
+	state.frames++;
+
+	if (metadata.status == FrameMetadata::FrameError) {
+		state.errors++;
+		std::cout << state.name << " seq: " << std::setw(6)
+			  << std::setfill('0') << metadata.sequence
+			  << " completed with an error" << std::endl;
+	}
+
+	if (!state.started) {
+		state.started = true;
+		state.lastSequence = metadata.sequence;
+		state.lastTimestamp = metadata.timestamp;
+		return;
+	}
+
+	/* Gaps in the sequence are dropped frames, anything else is an error. */
+	if (metadata.sequence > state.lastSequence) {
+		state.dropped += metadata.sequence - state.lastSequence - 1;
+	} else {
+		state.sequenceErrors++;
+		std::cout << state.name << " seq: " << std::setw(6)
+			  << std::setfill('0') << metadata.sequence
+			  << " follows seq " << std::setw(6) << state.lastSequence
+			  << std::endl;
+	}
+
+	if (metadata.timestamp <= state.lastTimestamp) {
+		state.timestampErrors++;
+		std::cout << state.name << " seq: " << std::setw(6)
+			  << std::setfill('0') << metadata.sequence
+			  << " timestamp " << metadata.timestamp
+			  << " not after " << state.lastTimestamp << std::endl;
+	}
+
+	state.lastSequence = metadata.sequence;
+	state.lastTimestamp = metadata.timestamp;
+}
+
+void FrameChecker::checkHash(StreamState &state, const Frame &frame)
+{
+	state.hashed++;
+
+	auto match = std::find_if(state.history.begin(), state.history.end(),
+				  [&](const std::pair<uint32_t, unsigned int> &entry) {
+					  return entry.first == frame.hash;
+				  });
+	if (match != state.history.end()) {
+		if (match == state.history.begin())
+			state.frozen++;
+		else
+			state.duplicated++;
+
+		std::cout << state.name << " seq: " << std::setw(6)
+			  << std::setfill('0') << frame.sequence
+			  << " identical to seq " << std::setw(6) << match->second
+			  << std::endl;
+	}
+
+	state.history.emplace_front(frame.hash, frame.sequence);
+	if (state.history.size() > HistorySize)
+		state.history.pop_back();
+}
+
+uint32_t FrameChecker::hash(FrameBuffer *buffer)
+{
+	const MappedFrameBuffer *mapped = mappedBuffers_.find(buffer);
+	if (!mapped)
+		return 0;
+
+	ScopedCpuAccess access(*mapped);
+	const FrameMetadata &metadata = buffer->metadata();
+	uint32_t crc = ~0U;
+
+	for (unsigned int i = 0; i < mapped->planes().size(); ++i) {
+		const MappedFrameBuffer::Plane &plane = mapped->planes()[i];
+		size_t length = plane.length;
+
+		/* Only hash the valid data of variable-length formats. */
+		if (i < metadata.planes().size() && metadata.planes()[i].bytesused)
+			length = std::min<size_t>(length, metadata.planes()[i].bytesused);
+
+		crc = crc32c(crc, static_cast<const uint8_t *>(plane.data), length);
+	}
+
+	return ~crc;
+}
+
+void FrameChecker::run()
+{
+	std::unique_lock<std::mutex> locker(mutex_);
+
+	while (true) {
+		cond_.wait(locker, [&] { return stop_ || !pending_.empty(); });
+		if (pending_.empty())
+			break;
+
+		Job job = std::move(pending_.front());
+		pending_.pop_front();
+		busy_ = true;
+
+		locker.unlock();
+
+		for (Frame &frame : job.frames)
+			frame.hash = hash(frame.buffer);
+
+		locker.lock();
+
+		busy_ = false;
+		completed_.push_back(std::move(job));
+		cond_.notify_all();
+
+		uint64_t value = 1;
+		ssize_t ret = ::write(eventFd_, &value, sizeof(value));
+		if (ret != sizeof(value))
+			std::cerr << "failed to signal checked request"
+				  << std::endl;
+	}
+}
+
+void FrameChecker::notifierActivated(EventNotifier *notifier)
+{
+	uint64_t value;
+	ssize_t ret = read(eventFd_, &value, sizeof(value));
+	if (ret != sizeof(value))
+		return;
+
+	std::deque<Job> completed;
+
+	{
+		std::lock_guard<std::mutex> locker(mutex_);
+		completed.swap(completed_);
+	}
+
+	for (const Job &job : completed) {
+		for (const Frame &frame : job.frames)
+			checkHash(streams_[frame.stream], frame);
+
+		requestChecked.emit(job.request);
+	}
+}
@@ -0,0 +1,101 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * frame_checker.h - Frame integrity checker
+ */
+#ifndef __CAM_FRAME_CHECKER_H__
+#define __CAM_FRAME_CHECKER_H__
+
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <ostream>
+#include <stdint.h>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <libcamera/buffer.h>
+#include <libcamera/event_notifier.h>
+#include <libcamera/mapped_framebuffer.h>
+#include <libcamera/request.h>
+#include <libcamera/signal.h>
+#include <libcamera/stream.h>
+
+class FrameChecker
+{
+public:
+	FrameChecker(unsigned int maxQueued = 4);
+	~FrameChecker();
+
+	void mapBuffer(libcamera::FrameBuffer *buffer);
+
+	int queueRequest(libcamera::Request *request,
+			 const std::map<libcamera::Stream *, std::string> &streamNames);
+	void flush();
+
+	void report(std::ostream &out) const;
+
+	libcamera::Signal<libcamera::Request *> requestChecked;
+
+private:
+	struct Frame {
+		libcamera::Stream *stream;
+		libcamera::FrameBuffer *buffer;
+		unsigned int sequence;
+		uint32_t hash;
+	};
+
+	struct Job {
+		libcamera::Request *request;
+		std::vector<Frame> frames;
+	};
+
+	struct StreamState {
+		std::string name;
+
+		unsigned int frames = 0;
+		unsigned int hashed = 0;
+		unsigned int errors = 0;
+		unsigned int dropped = 0;
+		unsigned int sequenceErrors = 0;
+		unsigned int timestampErrors = 0;
+		unsigned int frozen = 0;
+		unsigned int duplicated = 0;
+
+		bool started = false;
+		unsigned int lastSequence = 0;
+		uint64_t lastTimestamp = 0;
+
+		/* Hashes of the last frames, most recent first. */
+		std::deque<std::pair<uint32_t, unsigned int>> history;
+	};
+
+	void checkSequence(StreamState &state,
+			   const libcamera::FrameMetadata &metadata);
+	void checkHash(StreamState &state, const Frame &frame);
+	uint32_t hash(libcamera::FrameBuffer *buffer);
+
+	void run();
+	void notifierActivated(libcamera::EventNotifier *notifier);
+
+	unsigned int maxQueued_;
+	libcamera::MappedBufferCache mappedBuffers_;
+	std::map<libcamera::Stream *, StreamState> streams_;
+
+	int eventFd_;
+	libcamera::EventNotifier *notifier_;
+
+	std::thread thread_;
+	std::mutex mutex_;
+	std::condition_variable cond_;
+	std::deque<Job> pending_;
+	std::deque<Job> completed_;
+	bool busy_;
+	bool stop_;
+};
+
+#endif /* __CAM_FRAME_CHECKER_H__ */
@@ -0,0 +1,551 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * kms_sink.cpp - KMS display sink
+ */
+
+#include <algorithm>
+#include <errno.h>
+#include <fcntl.h>
+#include <iostream>
+#include <poll.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <type_traits>
+#include <unistd.h>
+
+#include <linux/drm_fourcc.h>
+#include <linux/drm_mode.h>
+
+#include "kms_sink.h"
+
+using namespace libcamera;
+
+namespace {
+
+/* Value of drm_mode_get_connector::connection for a connected display. */
+constexpr uint32_t ConnectorConnected = 1;
+
+/* Maximum number of DRM cards probed to find a display controller. */
+constexpr unsigned int MaxCards = 8;
+
+/*
+ * Layout of the pixel formats supported by the sink. The chroma planes are
+ * subsampled by hsub and vsub, and cpp is the number of bytes per pixel of
+ * each plane, in the plane's own resolution.
+ */
+struct FormatInfo {
+	PixelFormat format;
+	unsigned int numPlanes;
+	unsigned int cpp[3];
+	unsigned int hsub;
+	unsigned int vsub;
+};
+
+const FormatInfo formatInfo[] = {
+	{ DRM_FORMAT_YUYV, 1, { 2, 0, 0 }, 1, 1 },
+	{ DRM_FORMAT_YVYU, 1, { 2, 0, 0 }, 1, 1 },
+	{ DRM_FORMAT_UYVY, 1, { 2, 0, 0 }, 1, 1 },
+	{ DRM_FORMAT_VYUY, 1, { 2, 0, 0 }, 1, 1 },
+	{ DRM_FORMAT_RGB565, 1, { 2, 0, 0 }, 1, 1 },
+	{ DRM_FORMAT_RGB888, 1, { 3, 0, 0 }, 1, 1 },
+	{ DRM_FORMAT_BGR888, 1, { 3, 0, 0 }, 1, 1 },
+	{ DRM_FORMAT_XRGB8888, 1, { 4, 0, 0 }, 1, 1 },
+	{ DRM_FORMAT_ARGB8888, 1, { 4, 0, 0 }, 1, 1 },
+	{ DRM_FORMAT_XBGR8888, 1, { 4, 0, 0 }, 1, 1 },
+	{ DRM_FORMAT_ABGR8888, 1, { 4, 0, 0 }, 1, 1 },
+	{ DRM_FORMAT_NV12, 2, { 1, 2, 0 }, 2, 2 },
+	{ DRM_FORMAT_NV21, 2, { 1, 2, 0 }, 2, 2 },
+	{ DRM_FORMAT_NV16, 2, { 1, 2, 0 }, 2, 1 },
+	{ DRM_FORMAT_NV61, 2, { 1, 2, 0 }, 2, 1 },
+	{ DRM_FORMAT_YUV420, 3, { 1, 1, 1 }, 2, 2 },
+	{ DRM_FORMAT_YVU420, 3, { 1, 1, 1 }, 2, 2 },
+};
+
+const FormatInfo *findFormat(PixelFormat format)
+{
+	for (const FormatInfo &info : formatInfo) {
+		if (info.format == format)
+			return &info;
+	}
+
+	return nullptr;
+}
+
+/* Connector type names, as used by the kernel, indexed by DRM_MODE_CONNECTOR_*. */
+const char *const connectorTypeNames[] = {
+	"Unknown", "VGA", "DVI-I", "DVI-D", "DVI-A", "Composite", "SVIDEO",
+	"LVDS", "Component", "DIN", "DP", "HDMI-A", "HDMI-B", "TV", "eDP",
+	"Virtual", "DSI", "DPI", "Writeback", "SPI",
+};
+
+uint64_t userPointer(const void *ptr)
+{
+	return reinterpret_cast<uintptr_t>(ptr);
+}
+
+} /* namespace */
+
+/*
+ * The sink displays the frames of the first stream of the camera on a KMS
+ * connector. The FrameBuffer dmabufs are imported as DRM framebuffers, without
+ * any copy, and each completed request triggers a page flip. A request is held
+ * by the sink until the flip that replaces its buffer on screen has completed,
+ * and is then handed back through the requestProcessed signal.
+ *
+ * At most one flip is pending at a time. Requests that complete while a flip
+ * is pending replace each other, so that the most recent frame is displayed
+ * next, and the replaced ones are handed back immediately.
+ */
+KMSSink::KMSSink(const std::string &connectorName)
+	: connectorName_(connectorName), fd_(-1), notifier_(nullptr),
+	  stream_(nullptr), format_(0), connectorId_(0), crtcId_(0),
+	  modeSet_(false), active_(nullptr), queued_(nullptr), pending_(nullptr)
+{
+	memset(&mode_, 0, sizeof(mode_));
+	memset(&savedCrtc_, 0, sizeof(savedCrtc_));
+
+	int ret = openCard();
+	if (ret < 0)
+		std::cerr << "Failed to open a KMS device: " << strerror(-ret)
+			  << std::endl;
+}
+
+KMSSink::~KMSSink()
+{
+	stop();
+
+	if (fd_ != -1)
+		close(fd_);
+}
+
+int KMSSink::openCard()
+{
+	for (unsigned int i = 0; i < MaxCards; ++i) {
+		std::string path = "/dev/dri/card" + std::to_string(i);
+
+		int fd = open(path.c_str(), O_RDWR | O_CLOEXEC);
+		if (fd == -1)
+			continue;
+
+		/* Skip render-only devices and devices that can't import dmabufs. */
+		struct drm_get_cap cap = {};
+		cap.capability = DRM_CAP_PRIME;
+
+		struct drm_mode_card_res res = {};
+
+		if (ioctl(fd, DRM_IOCTL_GET_CAP, &cap) < 0 ||
+		    !(cap.value & DRM_PRIME_CAP_IMPORT) ||
+		    ioctl(fd, DRM_IOCTL_MODE_GETRESOURCES, &res) < 0 ||
+		    !res.count_connectors || !res.count_crtcs) {
+			close(fd);
+			continue;
+		}
+
+		fd_ = fd;
+		return 0;
+	}
+
+	return -ENODEV;
+}
+
+std::string KMSSink::connectorName(const struct drm_mode_get_connector &connector)
+{
+	std::string name = connector.connector_type < std::extent<decltype(connectorTypeNames)>::value
+			 ? connectorTypeNames[connector.connector_type] : "Unknown";
+
+	return name + "-" + std::to_string(connector.connector_type_id);
+}
+
+int KMSSink::configure(const CameraConfiguration &config)
+{
+	if (fd_ == -1)
+		return -ENODEV;
+
+	const StreamConfiguration &cfg = config.at(0);
+
+	if (!findFormat(cfg.pixelFormat)) {
+		std::cerr << "Pixel format 0x" << std::hex << cfg.pixelFormat
+			  << std::dec << " can't be displayed" << std::endl;
+		return -EINVAL;
+	}
+
+	stream_ = cfg.stream();
+	format_ = cfg.pixelFormat;
+	size_ = cfg.size;
+
+	return selectPipeline(size_);
+}
+
+/*
+ * Select a connector, a mode matching the frame size, and a CRTC to drive
+ * them. Frames are displayed without scaling, so the connector must support a
+ * mode of the same size as the stream.
+ */
+int KMSSink::selectPipeline(const Size &size)
+{
+	struct drm_mode_card_res res = {};
+	if (ioctl(fd_, DRM_IOCTL_MODE_GETRESOURCES, &res) < 0)
+		return -errno;
+
+	std::vector<uint32_t> crtcs(res.count_crtcs);
+	std::vector<uint32_t> connectors(res.count_connectors);
+
+	res.count_fbs = 0;
+	res.count_encoders = 0;
+	res.crtc_id_ptr = userPointer(crtcs.data());
+	res.connector_id_ptr = userPointer(connectors.data());
+
+	if (ioctl(fd_, DRM_IOCTL_MODE_GETRESOURCES, &res) < 0)
+		return -errno;
+
+	crtcs.resize(std::min<size_t>(crtcs.size(), res.count_crtcs));
+	connectors.resize(std::min<size_t>(connectors.size(), res.count_connectors));
+
+	for (uint32_t connectorId : connectors) {
+		struct drm_mode_get_connector connector = {};
+		connector.connector_id = connectorId;
+
+		if (ioctl(fd_, DRM_IOCTL_MODE_GETCONNECTOR, &connector) < 0)
+			continue;
+
+		std::vector<struct drm_mode_modeinfo> modes(connector.count_modes);
+		std::vector<uint32_t> encoders(connector.count_encoders);
+
+		connector.count_props = 0;
+		connector.modes_ptr = userPointer(modes.data());
+		connector.encoders_ptr = userPointer(encoders.data());
+
+		if (ioctl(fd_, DRM_IOCTL_MODE_GETCONNECTOR, &connector) < 0)
+			continue;
+
+		modes.resize(std::min<size_t>(modes.size(), connector.count_modes));
+		encoders.resize(std::min<size_t>(encoders.size(), connector.count_encoders));
+
+		std::string name = connectorName(connector);
+		if (!connectorName_.empty()) {
+			if (name != connectorName_)
+				continue;
+		} else if (connector.connection != ConnectorConnected) {
+			continue;
+		}
+
+		/* Modes are sorted by the kernel, the preferred mode first. */
+		const struct drm_mode_modeinfo *mode = nullptr;
+		for (const struct drm_mode_modeinfo &m : modes) {
+			if (m.hdisplay == size.width && m.vdisplay == size.height) {
+				mode = &m;
+				break;
+			}
+		}
+
+		if (!mode) {
+			if (connectorName_.empty())
+				continue;
+
+			std::cerr << "Connector " << name << " has no "
+				  << size.toString() << " mode" << std::endl;
+			return -EINVAL;
+		}
+
+		/*
+		 * Use the CRTC currently driving the connector if any, or the
+		 * first CRTC compatible with one of its encoders.
+		 */
+		uint32_t crtcId = 0;
+		for (uint32_t encoderId : encoders) {
+			struct drm_mode_get_encoder encoder = {};
+			encoder.encoder_id = encoderId;
+
+			if (ioctl(fd_, DRM_IOCTL_MODE_GETENCODER, &encoder) < 0)
+				continue;
+
+			if (encoderId == connector.encoder_id && encoder.crtc_id) {
+				crtcId = encoder.crtc_id;
+				break;
+			}
+
+			for (unsigned int i = 0; i < crtcs.size() && !crtcId; ++i) {
+				if (encoder.possible_crtcs & (1 << i))
+					crtcId = crtcs[i];
+			}
+		}
+
+		if (!crtcId) {
+			std::cerr << "No CRTC for connector " << name << std::endl;
+			return -EINVAL;
+		}
+
+		connectorId_ = connectorId;
+		crtcId_ = crtcId;
+		mode_ = *mode;
+
+		std::cout << "Displaying on connector " << name << " ("
+			  << mode_.name << ")" << std::endl;
+
+		return 0;
+	}
+
+	if (!connectorName_.empty())
+		std::cerr << "Connector " << connectorName_ << " not found"
+			  << std::endl;
+	else
+		std::cerr << "No connected display supports "
+			  << size.toString() << std::endl;
+
+	return -ENODEV;
+}
+
+/*
+ * Import the planes of a buffer of the displayed stream as a DRM framebuffer.
+ * Formats with more planes than the buffer store the extra planes
+ * contiguously after the last buffer plane.
+ */
+int KMSSink::mapBuffer(FrameBuffer *buffer)
+{
+	const FormatInfo *info = findFormat(format_);
+	if (fd_ == -1 || !info)
+		return -ENODEV;
+
+	Span<const FrameBuffer::Plane> planes = buffer->planes();
+
+	struct drm_mode_fb_cmd2 cmd = {};
+	cmd.width = size_.width;
+	cmd.height = size_.height;
+	cmd.pixel_format = format_;
+
+	unsigned int offset = 0;
+	for (unsigned int i = 0; i < info->numPlanes; ++i) {
+		unsigned int width = i ? size_.width / info->hsub : size_.width;
+		unsigned int height = i ? size_.height / info->vsub : size_.height;
+		unsigned int index = std::min<unsigned int>(i, planes.size() - 1);
+		const FrameBuffer::Plane &plane = planes[index];
+
+		if (i == index)
+			offset = 0;
+
+		cmd.pitches[i] = width * info->cpp[i];
+		cmd.offsets[i] = offset;
+		offset += cmd.pitches[i] * height;
+
+		if (offset > plane.length) {
+			std::cerr << "Buffer too small to be displayed" << std::endl;
+			return -EINVAL;
+		}
+
+		struct drm_prime_handle prime = {};
+		prime.fd = plane.fd.fd();
+
+		if (ioctl(fd_, DRM_IOCTL_PRIME_FD_TO_HANDLE, &prime) < 0) {
+			int ret = -errno;
+			std::cerr << "Failed to import dmabuf: " << strerror(-ret)
+				  << std::endl;
+			return ret;
+		}
+
+		handles_.insert(prime.handle);
+		cmd.handles[i] = prime.handle;
+	}
+
+	if (ioctl(fd_, DRM_IOCTL_MODE_ADDFB2, &cmd) < 0) {
+		int ret = -errno;
+		std::cerr << "Failed to create framebuffer: " << strerror(-ret)
+			  << std::endl;
+		return ret;
+	}
+
+	framebuffers_[buffer] = cmd.fb_id;
+
+	return 0;
+}
+
+int KMSSink::start()
+{
+	if (fd_ == -1)
+		return -ENODEV;
+
+	/* Save the CRTC configuration to restore it when stopping. */
+	memset(&savedCrtc_, 0, sizeof(savedCrtc_));
+	savedCrtc_.crtc_id = crtcId_;
+	if (ioctl(fd_, DRM_IOCTL_MODE_GETCRTC, &savedCrtc_) < 0)
+		return -errno;
+
+	notifier_ = new EventNotifier(fd_, EventNotifier::Read);
+	notifier_->activated.connect(this, &KMSSink::eventAvailable);
+
+	modeSet_ = false;
+
+	return 0;
+}
+
+/*
+ * Stop displaying frames and restore the previous CRTC configuration. The
+ * requests held by the sink are dropped, without emitting the
+ * requestProcessed signal.
+ */
+int KMSSink::stop()
+{
+	if (!notifier_)
+		return 0;
+
+	delete notifier_;
+	notifier_ = nullptr;
+
+	/* Wait for the pending flip, if any, before changing the CRTC. */
+	while (queued_) {
+		struct pollfd pfd = { fd_, POLLIN, 0 };
+		if (poll(&pfd, 1, 100) <= 0)
+			break;
+
+		char buffer[1024];
+		ssize_t len = read(fd_, buffer, sizeof(buffer));
+		for (ssize_t pos = 0; pos + static_cast<ssize_t>(sizeof(struct drm_event)) <= len;) {
+			const struct drm_event *event =
+				reinterpret_cast<const struct drm_event *>(&buffer[pos]);
+			if (!event->length)
+				break;
+
+			if (event->type == DRM_EVENT_FLIP_COMPLETE)
+				queued_ = nullptr;
+			pos += event->length;
+		}
+	}
+
+	int ret = 0;
+
+	if (modeSet_) {
+		struct drm_mode_crtc crtc = savedCrtc_;
+		if (crtc.mode_valid && crtc.fb_id) {
+			crtc.set_connectors_ptr = userPointer(&connectorId_);
+			crtc.count_connectors = 1;
+		} else {
+			crtc.fb_id = 0;
+			crtc.mode_valid = 0;
+		}
+
+		if (ioctl(fd_, DRM_IOCTL_MODE_SETCRTC, &crtc) < 0)
+			ret = -errno;
+
+		modeSet_ = false;
+	}
+
+	for (const auto &it : framebuffers_) {
+		unsigned int fbId = it.second;
+		ioctl(fd_, DRM_IOCTL_MODE_RMFB, &fbId);
+	}
+	framebuffers_.clear();
+
+	for (uint32_t handle : handles_) {
+		struct drm_gem_close close = {};
+		close.handle = handle;
+		ioctl(fd_, DRM_IOCTL_GEM_CLOSE, &close);
+	}
+	handles_.clear();
+
+	active_ = nullptr;
+	queued_ = nullptr;
+	pending_ = nullptr;
+
+	return ret;
+}
+
+/*
+ * Display the buffer of the request. Return true if the sink holds the
+ * request, which will then be handed back through the requestProcessed
+ * signal, or false if the request wasn't displayed.
+ */
+bool KMSSink::processRequest(Request *request)
+{
+	if (!notifier_)
+		return false;
+
+	if (queued_) {
+		if (pending_)
+			requestProcessed.emit(pending_);
+
+		pending_ = request;
+		return true;
+	}
+
+	return !flip(request);
+}
+
+int KMSSink::flip(Request *request)
+{
+	auto fb = framebuffers_.find(request->findBuffer(stream_));
+	if (fb == framebuffers_.end())
+		return -EINVAL;
+
+	if (!modeSet_) {
+		struct drm_mode_crtc crtc = {};
+		crtc.crtc_id = crtcId_;
+		crtc.fb_id = fb->second;
+		crtc.set_connectors_ptr = userPointer(&connectorId_);
+		crtc.count_connectors = 1;
+		crtc.mode = mode_;
+		crtc.mode_valid = 1;
+
+		/* The mode set is synchronous, the frame is on screen on return. */
+		if (ioctl(fd_, DRM_IOCTL_MODE_SETCRTC, &crtc) < 0) {
+			int ret = -errno;
+			std::cerr << "Failed to set mode: " << strerror(-ret)
+				  << std::endl;
+			return ret;
+		}
+
+		modeSet_ = true;
+		active_ = request;
+		return 0;
+	}
+
+	struct drm_mode_crtc_page_flip flip = {};
+	flip.crtc_id = crtcId_;
+	flip.fb_id = fb->second;
+	flip.flags = DRM_MODE_PAGE_FLIP_EVENT;
+	flip.user_data = userPointer(request);
+
+	if (ioctl(fd_, DRM_IOCTL_MODE_PAGE_FLIP, &flip) < 0)
+		return -errno;
+
+	queued_ = request;
+
+	return 0;
+}
+
+void KMSSink::eventAvailable(EventNotifier *notifier)
+{
+	char buffer[1024];
+
+	ssize_t len = read(fd_, buffer, sizeof(buffer));
+	if (len < 0)
+		return;
+
+	for (ssize_t pos = 0; pos + static_cast<ssize_t>(sizeof(struct drm_event)) <= len;) {
+		const struct drm_event *event =
+			reinterpret_cast<const struct drm_event *>(&buffer[pos]);
+		if (!event->length)
+			break;
+
+		pos += event->length;
+
+		if (event->type != DRM_EVENT_FLIP_COMPLETE || !queued_)
+			continue;
+
+		/* The previous frame has left the screen, release it. */
+		Request *released = active_;
+		active_ = queued_;
+		queued_ = nullptr;
+
+		if (released)
+			requestProcessed.emit(released);
+
+		if (pending_) {
+			Request *request = pending_;
+			pending_ = nullptr;
+
+			if (flip(request))
+				requestProcessed.emit(request);
+		}
+	}
+}
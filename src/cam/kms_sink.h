@@ -0,0 +1,70 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * kms_sink.h - KMS display sink
+ */
+#ifndef __CAM_KMS_SINK_H__
+#define __CAM_KMS_SINK_H__
+
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+#include <linux/drm.h>
+
+#include <libcamera/buffer.h>
+#include <libcamera/camera.h>
+#include <libcamera/event_notifier.h>
+#include <libcamera/request.h>
+#include <libcamera/signal.h>
+#include <libcamera/stream.h>
+
+class KMSSink
+{
+public:
+	KMSSink(const std::string &connectorName = "");
+	~KMSSink();
+
+	int configure(const libcamera::CameraConfiguration &config);
+	int mapBuffer(libcamera::FrameBuffer *buffer);
+
+	int start();
+	int stop();
+
+	bool processRequest(libcamera::Request *request);
+
+	libcamera::Signal<libcamera::Request *> requestProcessed;
+
+private:
+	int openCard();
+	int selectPipeline(const libcamera::Size &size);
+	std::string connectorName(const struct drm_mode_get_connector &connector);
+
+	int flip(libcamera::Request *request);
+	void eventAvailable(libcamera::EventNotifier *notifier);
+
+	std::string connectorName_;
+	int fd_;
+	libcamera::EventNotifier *notifier_;
+
+	libcamera::Stream *stream_;
+	libcamera::PixelFormat format_;
+	libcamera::Size size_;
+
+	uint32_t connectorId_;
+	uint32_t crtcId_;
+	struct drm_mode_modeinfo mode_;
+	struct drm_mode_crtc savedCrtc_;
+	bool modeSet_;
+
+	std::map<libcamera::FrameBuffer *, uint32_t> framebuffers_;
+	std::set<uint32_t> handles_;
+
+	libcamera::Request *active_;
+	libcamera::Request *queued_;
+	libcamera::Request *pending_;
+};
+
+#endif /* __CAM_KMS_SINK_H__ */
@@ -7,8 +7,10 @@
 
 #include <iomanip>
 #include <iostream>
+#include <memory>
 #include <signal.h>
 #include <string.h>
+#include <vector>
 
 #include <libcamera/libcamera.h>
 
@@ -34,23 +36,31 @@ public:
 	void quit();
 
 private:
+	struct CameraContext {
+		std::shared_ptr<Camera> camera;
+		std::unique_ptr<CameraConfiguration> config;
+	};
+
 	int parseOptions(int argc, char *argv[]);
-	int prepareConfig();
+	int openCamera(const std::string &cameraName);
+	int prepareConfig(CameraContext *context, unsigned int index);
 	int infoConfiguration();
+	int capture();
+	void captureFinished(Capture *capture);
 	int run();
 
 	static CamApp *app_;
 	OptionsParser::Options options_;
 	CameraManager *cm_;
-	std::shared_ptr<Camera> camera_;
-	std::unique_ptr<libcamera::CameraConfiguration> config_;
+	std::vector<CameraContext> cameras_;
 	EventLoop *loop_;
+	unsigned int activeCaptures_;
 };
 
 CamApp *CamApp::app_ = nullptr;
 
 CamApp::CamApp()
-	: cm_(nullptr), camera_(nullptr), config_(nullptr), loop_(nullptr)
+	: cm_(nullptr), loop_(nullptr), activeCaptures_(0)
 {
 	CamApp::app_ = this;
 }
@@ -83,34 +93,21 @@ int CamApp::init(int argc, char **argv)
 	}
 
 	if (options_.isSet(OptCamera)) {
-		const std::string &cameraName = options_[OptCamera];
-		char *endptr;
-		unsigned long index = strtoul(cameraName.c_str(), &endptr, 10);
-		if (*endptr == '\0' && index > 0 && index <= cm_->cameras().size())
-			camera_ = cm_->cameras()[index - 1];
-		else
-			camera_ = cm_->get(cameraName);
-
-		if (!camera_) {
-			std::cout << "Camera "
-				  << std::string(options_[OptCamera])
-				  << " not found" << std::endl;
-			cm_->stop();
-			return -ENODEV;
+		for (const OptionValue &value : options_[OptCamera].toArray()) {
+			ret = openCamera(value.toString());
+			if (ret) {
+				cleanup();
+				return ret;
+			}
 		}
 
-		if (camera_->acquire()) {
-			std::cout << "Failed to acquire camera" << std::endl;
-			camera_.reset();
-			cm_->stop();
-			return -EINVAL;
+		for (unsigned int i = 0; i < cameras_.size(); ++i) {
+			ret = prepareConfig(&cameras_[i], i);
+			if (ret) {
+				cleanup();
+				return ret;
+			}
 		}
-
-		std::cout << "Using camera " << camera_->name() << std::endl;
-
-		ret = prepareConfig();
-		if (ret)
-			return ret;
 	}
 
 	loop_ = new EventLoop(cm_->eventDispatcher());
@@ -123,12 +120,12 @@ void CamApp::cleanup()
 	delete loop_;
 	loop_ = nullptr;
 
-	if (camera_) {
-		camera_->release();
-		camera_.reset();
+	for (CameraContext &context : cameras_) {
+		context.camera->release();
+		context.config.reset();
 	}
 
-	config_.reset();
+	cameras_.clear();
 
 	cm_->stop();
 }
@@ -152,8 +149,11 @@ void CamApp::quit()
 int CamApp::parseOptions(int argc, char *argv[])
 {
 	KeyValueParser streamKeyValue;
+	streamKeyValue.addOption("camera", OptionInteger,
+				 "Index of the --camera option the stream applies to, starting at 0 (default: all cameras)",
+				 ArgumentRequired);
 	streamKeyValue.addOption("role", OptionString,
-				 "Role for the stream (viewfinder, video, still)",
+				 "Role for the stream (viewfinder, video, still, raw)",
 				 ArgumentRequired);
 	streamKeyValue.addOption("width", OptionInteger, "Width in pixels",
 				 ArgumentRequired);
@@ -161,18 +161,56 @@ int CamApp::parseOptions(int argc, char *argv[])
 				 ArgumentRequired);
 	streamKeyValue.addOption("pixelformat", OptionInteger, "Pixel format",
 				 ArgumentRequired);
+	streamKeyValue.addOption("decimation", OptionInteger,
+				 "Capture one frame out of N for the stream",
+				 ArgumentRequired);
 
 	OptionsParser parser;
 	parser.addOption(OptCamera, OptionString,
-			 "Specify which camera to operate on, by name or by index", "camera",
-			 ArgumentRequired, "camera");
+			 "Specify which camera to operate on, by name or by index\n"
+			 "The option can be given multiple times to capture from multiple cameras concurrently.",
+			 "camera", ArgumentRequired, "camera", true);
 	parser.addOption(OptCapture, OptionNone,
 			 "Capture until interrupted by user", "capture");
+	parser.addOption(OptCheck, OptionNone,
+			 "Check the integrity of the captured frames without storing them\n"
+			 "Frames are hashed to detect frozen and duplicated frames, and their sequence numbers and timestamps are checked.\n"
+			 "Anomalies are reported as they are detected, and a summary is printed at the end of the capture.",
+			 "check");
+	parser.addOption(OptBenchmark, OptionString,
+			 "Capture without printing per-frame information, and report performance statistics at the end of the capture\n"
+			 "The format of the report is 'text' (default) or 'json'.",
+			 "benchmark", ArgumentOptional, "format");
+	parser.addOption(OptFrames, OptionInteger,
+			 "Stop the capture after the given number of frames",
+			 "frames", ArgumentRequired, "count");
+	parser.addOption(OptDuration, OptionInteger,
+			 "Stop the capture after the given number of seconds",
+			 "duration", ArgumentRequired, "seconds");
+	parser.addOption(OptDisplay, OptionString,
+			 "Display the frames of the first stream on a KMS connector\n"
+			 "The connector is specified by name (e.g. 'HDMI-A-1'), the first connected one is used by default.\n"
+			 "The connector must support a display mode of the same size as the stream.",
+			 "display", ArgumentOptional, "connector");
+	parser.addOption(OptEncode, OptionString,
+			 "Encode the frames of the first stream with a V4L2 hardware encoder\n"
+			 "The codec is HEVC if the file name ends with '.h265' or '.hevc', and H.264 otherwise.",
+			 "encode", ArgumentRequired, "filename");
 	parser.addOption(OptFile, OptionString,
 			 "Write captured frames to disk\n"
 			 "The first '#' character in the file name is expanded to the stream name and frame sequence number.\n"
+			 "A file name ending with '.lcv' writes all streams to an indexed raw video container.\n"
 			 "The default file name is 'frame-#.bin'.",
 			 "file", ArgumentOptional, "filename");
+	parser.addOption(OptShare, OptionString,
+			 "Share the frames of the first stream with other processes\n"
+			 "Clients connect to the Unix socket at the given path with the CameraShareClient class.",
+			 "share", ArgumentRequired, "path");
+	parser.addOption(OptNet, OptionString,
+			 "Stream the frames of the first stream over the network as RTP (RFC 4175)\n"
+			 "The destination is given as host:port, the session description for the receiver is printed at start.\n"
+			 "Frames are sent without copy when supported, and paced to the frame interval with the fq qdisc.",
+			 "net", ArgumentRequired, "host:port");
 	parser.addOption(OptStream, &streamKeyValue,
 			 "Set configuration of a camera stream", "stream", true);
 	parser.addOption(OptHelp, OptionNone, "Display this help message",
@@ -193,18 +231,66 @@ int CamApp::parseOptions(int argc, char *argv[])
 	return 0;
 }
 
-int CamApp::prepareConfig()
+int CamApp::openCamera(const std::string &cameraName)
+{
+	std::shared_ptr<Camera> camera;
+	char *endptr;
+
+	unsigned long index = strtoul(cameraName.c_str(), &endptr, 10);
+	if (*endptr == '\0' && index > 0 && index <= cm_->cameras().size())
+		camera = cm_->cameras()[index - 1];
+	else
+		camera = cm_->get(cameraName);
+
+	if (!camera) {
+		std::cout << "Camera " << cameraName << " not found" << std::endl;
+		return -ENODEV;
+	}
+
+	for (const CameraContext &context : cameras_) {
+		if (context.camera == camera) {
+			std::cout << "Camera " << camera->name()
+				  << " specified multiple times" << std::endl;
+			return -EINVAL;
+		}
+	}
+
+	if (camera->acquire()) {
+		std::cout << "Failed to acquire camera" << std::endl;
+		return -EINVAL;
+	}
+
+	std::cout << "Using camera " << camera->name() << std::endl;
+
+	cameras_.push_back({ camera, nullptr });
+
+	return 0;
+}
+
+/*
+ * Configure the camera at position index in the --camera options, with the
+ * --stream options that either apply to all cameras or to that camera.
+ */
+int CamApp::prepareConfig(CameraContext *context, unsigned int index)
 {
+	std::vector<KeyValueParser::Options> streamOptions;
 	StreamRoles roles;
 
 	if (options_.isSet(OptStream)) {
-		const std::vector<OptionValue> &streamOptions =
-			options_[OptStream].toArray();
-
-		/* Use roles and get a default configuration. */
-		for (auto const &value : streamOptions) {
+		for (const OptionValue &value : options_[OptStream].toArray()) {
 			KeyValueParser::Options opt = value.toKeyValues();
 
+			if (opt.isSet("camera") &&
+			    static_cast<unsigned int>(opt["camera"].toInteger()) != index)
+				continue;
+
+			streamOptions.push_back(opt);
+		}
+	}
+
+	if (!streamOptions.empty()) {
+		/* Use roles and get a default configuration. */
+		for (KeyValueParser::Options &opt : streamOptions) {
 			if (!opt.isSet("role")) {
 				roles.push_back(StreamRole::VideoRecording);
 			} else if (opt["role"].toString() == "viewfinder") {
@@ -213,6 +299,8 @@ int CamApp::prepareConfig()
 				roles.push_back(StreamRole::VideoRecording);
 			} else if (opt["role"].toString() == "still") {
 				roles.push_back(StreamRole::StillCapture);
+			} else if (opt["role"].toString() == "raw") {
+				roles.push_back(StreamRole::Raw);
 			} else {
 				std::cerr << "Unknown stream role "
 					  << opt["role"].toString() << std::endl;
@@ -224,36 +312,34 @@ int CamApp::prepareConfig()
 		roles.push_back(StreamRole::VideoRecording);
 	}
 
-	config_ = camera_->generateConfiguration(roles);
-	if (!config_ || config_->size() != roles.size()) {
+	std::unique_ptr<CameraConfiguration> config =
+		context->camera->generateConfiguration(roles);
+	if (!config || config->size() != roles.size()) {
 		std::cerr << "Failed to get default stream configuration"
 			  << std::endl;
 		return -EINVAL;
 	}
 
 	/* Apply configuration if explicitly requested. */
-	if (options_.isSet(OptStream)) {
-		const std::vector<OptionValue> &streamOptions =
-			options_[OptStream].toArray();
+	unsigned int i = 0;
+	for (KeyValueParser::Options &opt : streamOptions) {
+		StreamConfiguration &cfg = config->at(i++);
 
-		unsigned int i = 0;
-		for (auto const &value : streamOptions) {
-			KeyValueParser::Options opt = value.toKeyValues();
-			StreamConfiguration &cfg = config_->at(i++);
+		if (opt.isSet("width"))
+			cfg.size.width = opt["width"];
 
-			if (opt.isSet("width"))
-				cfg.size.width = opt["width"];
+		if (opt.isSet("height"))
+			cfg.size.height = opt["height"];
 
-			if (opt.isSet("height"))
-				cfg.size.height = opt["height"];
+		/* TODO: Translate 4CC string to ID. */
+		if (opt.isSet("pixelformat"))
+			cfg.pixelFormat = opt["pixelformat"];
 
-			/* TODO: Translate 4CC string to ID. */
-			if (opt.isSet("pixelformat"))
-				cfg.pixelFormat = opt["pixelformat"];
-		}
+		if (opt.isSet("decimation"))
+			cfg.decimation = opt["decimation"];
 	}
 
-	switch (config_->validate()) {
+	switch (config->validate()) {
 	case CameraConfiguration::Valid:
 		break;
 	case CameraConfiguration::Adjusted:
@@ -261,43 +347,182 @@ int CamApp::prepareConfig()
 		break;
 	case CameraConfiguration::Invalid:
 		std::cout << "Camera configuration invalid" << std::endl;
-		config_.reset();
 		return -EINVAL;
 	}
 
+	context->config = std::move(config);
+
 	return 0;
 }
 
 int CamApp::infoConfiguration()
 {
-	if (!config_) {
+	if (cameras_.empty()) {
 		std::cout << "Cannot print stream information without a camera"
 			  << std::endl;
 		return -EINVAL;
 	}
 
-	unsigned int index = 0;
-	for (const StreamConfiguration &cfg : *config_) {
-		std::cout << index << ": " << cfg.toString() << std::endl;
+	for (const CameraContext &context : cameras_) {
+		if (cameras_.size() > 1)
+			std::cout << context.camera->name() << ":" << std::endl;
 
-		const StreamFormats &formats = cfg.formats();
-		for (unsigned int pixelformat : formats.pixelformats()) {
-			std::cout << " * Pixelformat: 0x" << std::hex
-				  << std::setw(8) << pixelformat << " "
-				  << formats.range(pixelformat).toString()
-				  << std::endl;
+		unsigned int index = 0;
+		for (const StreamConfiguration &cfg : *context.config) {
+			std::cout << index << ": " << cfg.toString() << std::endl;
 
-			for (const Size &size : formats.sizes(pixelformat))
-				std::cout << "  - " << size.toString()
+			const StreamFormats &formats = cfg.formats();
+			for (unsigned int pixelformat : formats.pixelformats()) {
+				std::cout << " * Pixelformat: 0x" << std::hex
+					  << std::setw(8) << pixelformat << " "
+					  << formats.range(pixelformat).toString()
 					  << std::endl;
-		}
 
-		index++;
+				for (const Size &size : formats.sizes(pixelformat))
+					std::cout << "  - " << size.toString()
+						  << std::endl;
+			}
+
+			index++;
+		}
 	}
 
 	return 0;
 }
 
+/*
+ * Capture from all cameras concurrently, with one Capture instance per camera
+ * sharing the event loop, until all captures have finished or the user
+ * interrupts the capture.
+ */
+int CamApp::capture()
+{
+	bool json = false;
+	int ret = 0;
+
+	if (cameras_.empty()) {
+		std::cout << "Can't capture without a camera" << std::endl;
+		return -ENODEV;
+	}
+
+	if (options_.isSet(OptBenchmark)) {
+		std::string format = options_[OptBenchmark].toString();
+		if (!format.empty() && format != "text" && format != "json") {
+			std::cout << "Invalid benchmark format " << format
+				  << std::endl;
+			return -EINVAL;
+		}
+
+		json = format == "json";
+	}
+
+	/* Each request can only be handed to a single consumer. */
+	unsigned int consumers = options_.isSet(OptDisplay) +
+				 options_.isSet(OptEncode) +
+				 options_.isSet(OptFile) +
+				 options_.isSet(OptCheck) +
+				 options_.isSet(OptShare) +
+				 options_.isSet(OptNet);
+	if (consumers > 1) {
+		std::cout << "The --check, --display, --encode, --file, --net and --share options are mutually exclusive"
+			  << std::endl;
+		return -EINVAL;
+	}
+
+	if ((options_.isSet(OptDisplay) || options_.isSet(OptEncode) ||
+	     options_.isSet(OptShare) || options_.isSet(OptNet)) &&
+	    cameras_.size() > 1) {
+		std::cout << "Only one camera can be displayed, encoded, shared or streamed"
+			  << std::endl;
+		return -EINVAL;
+	}
+
+	std::vector<std::unique_ptr<Capture>> captures;
+	for (unsigned int i = 0; i < cameras_.size(); ++i) {
+		const CameraContext &context = cameras_[i];
+		std::string prefix = cameras_.size() > 1
+				   ? "cam" + std::to_string(i) + "-" : "";
+
+		captures.emplace_back(new Capture(context.camera,
+						  context.config.get(), prefix));
+		captures.back()->finished.connect(this, &CamApp::captureFinished);
+	}
+
+	Benchmark total;
+	total.start();
+
+	for (std::unique_ptr<Capture> &capture : captures) {
+		ret = capture->start(options_);
+		if (ret)
+			return ret;
+	}
+
+	activeCaptures_ = captures.size();
+
+	if (!options_.isSet(OptFrames) && !options_.isSet(OptDuration))
+		std::cout << "Capture until user interrupts by SIGINT" << std::endl;
+
+	ret = loop_->exec();
+	if (ret)
+		std::cout << "Failed to run capture loop" << std::endl;
+
+	for (std::unique_ptr<Capture> &capture : captures) {
+		int err = capture->stop();
+		if (err && !ret)
+			ret = err;
+	}
+
+	total.stop();
+
+	if (!options_.isSet(OptBenchmark))
+		return ret;
+
+	if (captures.size() == 1) {
+		captures[0]->benchmark()->report(std::cout, json);
+		return ret;
+	}
+
+	/* Report the statistics per camera, and aggregated over all cameras. */
+	if (json)
+		std::cout << "{ \"cameras\": [" << std::endl;
+
+	for (unsigned int i = 0; i < captures.size(); ++i) {
+		const Capture *capture = captures[i].get();
+
+		if (json)
+			std::cout << (i ? ", " : "") << "{ \"camera\": \""
+				  << capture->camera()->name() << "\", \"stats\": ";
+		else
+			std::cout << capture->camera()->name() << ":" << std::endl;
+
+		capture->benchmark()->report(std::cout, json);
+		total.merge(*capture->benchmark());
+
+		if (json)
+			std::cout << "}" << std::endl;
+		else
+			std::cout << std::endl;
+	}
+
+	if (json)
+		std::cout << "], \"total\": ";
+	else
+		std::cout << "Total:" << std::endl;
+
+	total.report(std::cout, json);
+
+	if (json)
+		std::cout << "}" << std::endl;
+
+	return ret;
+}
+
+void CamApp::captureFinished(Capture *capture)
+{
+	if (activeCaptures_ && !--activeCaptures_)
+		loop_->exit(0);
+}
+
 int CamApp::run()
 {
 	int ret;
@@ -318,10 +543,11 @@ int CamApp::run()
 			return ret;
 	}
 
-	if (options_.isSet(OptCapture)) {
-		Capture capture(camera_, config_.get());
-		return capture.run(loop_, options_);
-	}
+	if (options_.isSet(OptCapture) || options_.isSet(OptBenchmark) ||
+	    options_.isSet(OptCheck) || options_.isSet(OptDisplay) ||
+	    options_.isSet(OptEncode) || options_.isSet(OptShare) ||
+	    options_.isSet(OptNet))
+		return capture();
 
 	return 0;
 }
@@ -8,13 +8,21 @@
 #define __CAM_MAIN_H__
 
 enum {
+	OptBenchmark = 'B',
 	OptCamera = 'c',
 	OptCapture = 'C',
+	OptCheck = 'K',
+	OptDisplay = 'D',
+	OptEncode = 'E',
 	OptFile = 'F',
 	OptHelp = 'h',
 	OptInfo = 'I',
 	OptList = 'l',
+	OptNet = 'N',
+	OptShare = 'S',
 	OptStream = 's',
+	OptDuration = 256,
+	OptFrames = 257,
 };
 
 #endif /* __CAM_MAIN_H__ */
@@ -0,0 +1,639 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * net_sink.cpp - RTP network streaming sink
+ */
+
+#include <algorithm>
+#include <errno.h>
+#include <iostream>
+#include <limits.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/udp.h>
+#include <poll.h>
+#include <random>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <linux/drm_fourcc.h>
+#include <linux/errqueue.h>
+
+#include "net_sink.h"
+
+using namespace libcamera;
+
+namespace {
+
+/* RTP header and RFC 4175 payload header with a single line segment. */
+constexpr unsigned int HeaderSize = 20;
+
+/* Largest payload fitting in a 1500 bytes MTU with IPv6 and UDP headers. */
+constexpr unsigned int MaxPayloadSize = 1500 - 40 - 8 - HeaderSize;
+
+/* Maximum number of segments the kernel accepts in a UDP GSO send. */
+constexpr unsigned int MaxSegments = 64;
+
+/* Maximum size of a UDP GSO send, below the 64kB datagram limit. */
+constexpr unsigned int MaxSendSize = 65000;
+
+/*
+ * Zero-copy sends reference each header and payload as separate page
+ * fragments, limited to 17 per send by the kernel. A packet uses up to three
+ * fragments, when its payload crosses a page boundary.
+ */
+constexpr unsigned int MaxZeroCopySegments = 5;
+
+/* Number of frames held by the sink before new frames are dropped. */
+constexpr unsigned int MaxQueuedFrames = 3;
+
+constexpr uint8_t PayloadType = 96;
+
+/*
+ * Pixel formats with a RFC 4175 mapping. A pixel group is the smallest unit
+ * of pgroupBytes bytes covering pgroupPixels pixels, line segments hold whole
+ * pixel groups.
+ */
+struct FormatInfo {
+	PixelFormat format;
+	const char *sampling;
+	unsigned int pgroupBytes;
+	unsigned int pgroupPixels;
+};
+
+const FormatInfo formatInfo[] = {
+	{ DRM_FORMAT_UYVY, "YCbCr-4:2:2", 4, 2 },
+	{ DRM_FORMAT_BGR888, "RGB", 3, 1 },
+	{ DRM_FORMAT_RGB888, "BGR", 3, 1 },
+	{ DRM_FORMAT_ABGR8888, "RGBA", 4, 1 },
+	{ DRM_FORMAT_XBGR8888, "RGBA", 4, 1 },
+	{ DRM_FORMAT_ARGB8888, "BGRA", 4, 1 },
+	{ DRM_FORMAT_XRGB8888, "BGRA", 4, 1 },
+};
+
+const FormatInfo *findFormat(PixelFormat format)
+{
+	for (const FormatInfo &info : formatInfo) {
+		if (info.format == format)
+			return &info;
+	}
+
+	return nullptr;
+}
+
+void put16(uint8_t *data, uint16_t value)
+{
+	data[0] = value >> 8;
+	data[1] = value;
+}
+
+void put32(uint8_t *data, uint32_t value)
+{
+	put16(data, value >> 16);
+	put16(data + 2, value);
+}
+
+} /* namespace */
+
+/*
+ * The sink streams the frames of the first stream of the camera as RTP over
+ * UDP, with the RFC 4175 payload format for uncompressed video. The session
+ * description needed by the receiver is printed when the sink starts.
+ *
+ * Packets are sent from the mapped FrameBuffer with MSG_ZEROCOPY, the kernel
+ * references the frame pages instead of copying them to the socket buffers.
+ * A request is held until the socket error queue reports the completion of
+ * all the sends that reference its buffer, and is then handed back through
+ * the requestProcessed signal. The packets of a frame are batched with UDP
+ * segmentation offload, to amortize the cost of pinning the pages.
+ *
+ * The send rate is capped to the frame size over the measured frame interval,
+ * with some headroom, to spread the packets of a frame instead of sending
+ * them in bursts that overflow receive buffers. Pacing is implemented by the
+ * fq queueing discipline, the cap has no effect with other qdiscs.
+ *
+ * Zero-copy transmission falls back to regular sends when the frame buffers
+ * can't be pinned, as with some dmabuf exporters, or when the kernel reports
+ * that it had to copy the data anyway, as on the loopback interface.
+ */
+NetSink::NetSink(const std::string &destination)
+	: fd_(-1), ipv6_(false), writeNotifier_(nullptr),
+	  errorNotifier_(nullptr), stream_(nullptr), format_(0),
+	  sampling_(nullptr), lineLength_(0), pgroupBytes_(0),
+	  pgroupPixels_(0), payloadSize_(0), packetsPerLine_(0),
+	  packetsPerFrame_(0), packetsPerSend_(1), gso_(false),
+	  zerocopy_(false), copied_(false), nextSend_(0), sequence_(0),
+	  ssrc_(0), lastTimestamp_(0), frameInterval_(0), pacingRate_(0)
+{
+	int ret = openSocket(destination);
+	if (ret < 0)
+		std::cerr << "Failed to open socket to " << destination << ": "
+			  << strerror(-ret) << std::endl;
+}
+
+NetSink::~NetSink()
+{
+	stop();
+
+	if (fd_ != -1)
+		close(fd_);
+}
+
+/*
+ * The destination is specified as host:port, IPv6 addresses are enclosed in
+ * square brackets.
+ */
+int NetSink::openSocket(const std::string &destination)
+{
+	size_t pos = destination.rfind(':');
+	if (pos == std::string::npos || pos == 0)
+		return -EINVAL;
+
+	host_ = destination.substr(0, pos);
+	port_ = destination.substr(pos + 1);
+	if (host_.front() == '[' && host_.back() == ']')
+		host_ = host_.substr(1, host_.size() - 2);
+
+	struct addrinfo hints = {};
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_DGRAM;
+
+	struct addrinfo *result;
+	int ret = getaddrinfo(host_.c_str(), port_.c_str(), &hints, &result);
+	if (ret) {
+		std::cerr << "Failed to resolve " << host_ << ": "
+			  << gai_strerror(ret) << std::endl;
+		return -EHOSTUNREACH;
+	}
+
+	ret = -EHOSTUNREACH;
+	for (struct addrinfo *ai = result; ai; ai = ai->ai_next) {
+		int fd = socket(ai->ai_family, ai->ai_socktype | SOCK_CLOEXEC | SOCK_NONBLOCK,
+				ai->ai_protocol);
+		if (fd == -1) {
+			ret = -errno;
+			continue;
+		}
+
+		if (connect(fd, ai->ai_addr, ai->ai_addrlen) == -1) {
+			ret = -errno;
+			close(fd);
+			continue;
+		}
+
+		fd_ = fd;
+		ipv6_ = ai->ai_family == AF_INET6;
+		ret = 0;
+		break;
+	}
+
+	freeaddrinfo(result);
+
+	if (ret < 0)
+		return ret;
+
+	int one = 1;
+	zerocopy_ = !setsockopt(fd_, SOL_SOCKET, SO_ZEROCOPY, &one, sizeof(one));
+	if (!zerocopy_)
+		std::cerr << "Zero-copy transmission not supported, copying frames"
+			  << std::endl;
+
+	/* Report error queue events as POLLPRI, for the exception notifier. */
+	setsockopt(fd_, SOL_SOCKET, SO_SELECT_ERR_QUEUE, &one, sizeof(one));
+
+	/* Probe for UDP segmentation offload support, 0 disables it. */
+	int zero = 0;
+	gso_ = !setsockopt(fd_, SOL_UDP, UDP_SEGMENT, &zero, sizeof(zero));
+
+	/* Leave room for a few frames, the kernel caps the value. */
+	int sndbuf = 16 << 20;
+	setsockopt(fd_, SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof(sndbuf));
+
+	return 0;
+}
+
+int NetSink::configure(const CameraConfiguration &config)
+{
+	if (fd_ == -1)
+		return -ENODEV;
+
+	const StreamConfiguration &cfg = config.at(0);
+
+	const FormatInfo *info = findFormat(cfg.pixelFormat);
+	if (!info) {
+		std::cerr << "Pixel format 0x" << std::hex << cfg.pixelFormat
+			  << std::dec << " can't be streamed" << std::endl;
+		return -EINVAL;
+	}
+
+	if (cfg.size.width % info->pgroupPixels || cfg.size.height > 0x8000) {
+		std::cerr << "Frame size " << cfg.size.toString()
+			  << " can't be streamed" << std::endl;
+		return -EINVAL;
+	}
+
+	stream_ = cfg.stream();
+	format_ = cfg.pixelFormat;
+	size_ = cfg.size;
+	sampling_ = info->sampling;
+	pgroupBytes_ = info->pgroupBytes;
+	pgroupPixels_ = info->pgroupPixels;
+	lineLength_ = size_.width / pgroupPixels_ * pgroupBytes_;
+
+	/*
+	 * Split lines in segments of equal size, as required by segmentation
+	 * offload, holding whole pixel groups. Each packet carries a single
+	 * line segment.
+	 */
+	payloadSize_ = std::min(lineLength_, MaxPayloadSize / pgroupBytes_ * pgroupBytes_);
+	while (lineLength_ % payloadSize_)
+		payloadSize_ -= pgroupBytes_;
+
+	packetsPerLine_ = lineLength_ / payloadSize_;
+	packetsPerFrame_ = packetsPerLine_ * size_.height;
+	packetsPerSend_ = gso_ ? std::min(MaxSegments,
+					  MaxSendSize / (HeaderSize + payloadSize_))
+			       : 1;
+
+	return 0;
+}
+
+int NetSink::mapBuffer(FrameBuffer *buffer)
+{
+	const MappedFrameBuffer *mapped = mappedBuffers_.map(buffer);
+	if (!mapped || !mapped->isValid())
+		return -ENOMEM;
+
+	if (mapped->planes()[0].length < lineLength_ * size_.height) {
+		std::cerr << "Buffer too small to be streamed" << std::endl;
+		return -EINVAL;
+	}
+
+	return 0;
+}
+
+int NetSink::start()
+{
+	if (fd_ == -1)
+		return -ENODEV;
+
+	writeNotifier_ = new EventNotifier(fd_, EventNotifier::Write);
+	writeNotifier_->activated.connect(this, &NetSink::writeReady);
+	writeNotifier_->setEnabled(false);
+
+	errorNotifier_ = new EventNotifier(fd_, EventNotifier::Exception);
+	errorNotifier_->activated.connect(this, &NetSink::errorQueueReady);
+
+	std::random_device rd;
+	ssrc_ = rd();
+	sequence_ = rd();
+
+	lastTimestamp_ = 0;
+	frameInterval_ = 0;
+	pacingRate_ = 0;
+
+	printSdp();
+
+	return 0;
+}
+
+/*
+ * Stop streaming. The completion of the frames being transmitted is waited
+ * for, with a timeout, and the requests held by the sink are dropped without
+ * emitting the requestProcessed signal. The kernel keeps references to the
+ * pages of the frames until their transmission completes, the buffers can
+ * thus be freed safely in any case.
+ */
+int NetSink::stop()
+{
+	if (!writeNotifier_)
+		return 0;
+
+	delete writeNotifier_;
+	writeNotifier_ = nullptr;
+	delete errorNotifier_;
+	errorNotifier_ = nullptr;
+
+	auto pending = [this] {
+		return std::any_of(frames_.begin(), frames_.end(),
+				   [](const Frame &frame) { return frame.sendsPending; });
+	};
+
+	while (pending()) {
+		struct pollfd pfd = { fd_, POLLPRI, 0 };
+		if (poll(&pfd, 1, 100) <= 0)
+			break;
+
+		readErrorQueue();
+	}
+
+	frames_.clear();
+
+	return 0;
+}
+
+void NetSink::printSdp() const
+{
+	const char *family = ipv6_ ? "IP6" : "IP4";
+
+	std::cout << "Streaming to " << host_ << ":" << port_
+		  << ", session description:" << std::endl
+		  << "v=0" << std::endl
+		  << "o=- " << ssrc_ << " 0 IN " << family << " " << host_ << std::endl
+		  << "s=libcamera" << std::endl
+		  << "c=IN " << family << " " << host_ << std::endl
+		  << "t=0 0" << std::endl
+		  << "m=video " << port_ << " RTP/AVP "
+		  << static_cast<unsigned int>(PayloadType) << std::endl
+		  << "a=rtpmap:" << static_cast<unsigned int>(PayloadType)
+		  << " raw/90000" << std::endl
+		  << "a=fmtp:" << static_cast<unsigned int>(PayloadType)
+		  << " sampling=" << sampling_ << "; width=" << size_.width
+		  << "; height=" << size_.height << "; depth=8; colorimetry="
+		  << (pgroupPixels_ == 2 ? "BT601-5" : "BT709-2") << std::endl;
+}
+
+bool NetSink::processRequest(Request *request)
+{
+	if (!writeNotifier_)
+		return false;
+
+	FrameBuffer *buffer = request->findBuffer(stream_);
+	if (!buffer || buffer->metadata().status != FrameMetadata::FrameSuccess)
+		return false;
+
+	const MappedFrameBuffer *mapped = mappedBuffers_.find(buffer);
+	if (!mapped)
+		return false;
+
+	/* Drop the frame if the network can't keep up. */
+	if (frames_.size() >= MaxQueuedFrames)
+		return false;
+
+	updatePacing(buffer);
+
+	/* Make the frame data visible to the CPU, for copying sends. */
+	{
+		ScopedCpuAccess access(*mapped);
+	}
+
+	frames_.emplace_back();
+	Frame &frame = frames_.back();
+	frame.request = request;
+	frame.mapped = mapped;
+	frame.timestamp = buffer->metadata().timestamp * 9 / 100000;
+	frame.packetsSent = 0;
+	frame.firstSend = 0;
+	frame.lastSend = 0;
+	frame.sendsPending = 0;
+	fillHeaders(frame);
+
+	sequence_ += packetsPerFrame_;
+
+	/* When the socket is full, sending resumes once it becomes writable. */
+	if (!writeNotifier_->enabled())
+		sendFrames();
+
+	return true;
+}
+
+/*
+ * Cap the send rate to the rate needed to transmit a frame in 80% of the
+ * frame interval, measured as a moving average of the buffer timestamps.
+ */
+void NetSink::updatePacing(const FrameBuffer *buffer)
+{
+	uint64_t timestamp = buffer->metadata().timestamp;
+
+	if (lastTimestamp_ && timestamp > lastTimestamp_) {
+		uint64_t interval = timestamp - lastTimestamp_;
+		frameInterval_ = frameInterval_
+			       ? (frameInterval_ * 7 + interval) / 8 : interval;
+	}
+
+	lastTimestamp_ = timestamp;
+
+	if (!frameInterval_)
+		return;
+
+	uint64_t frameSize = static_cast<uint64_t>(packetsPerFrame_) *
+			     (HeaderSize + payloadSize_ + 48);
+	uint64_t rate = frameSize * 1000000000ULL / frameInterval_ * 5 / 4;
+	rate = std::min<uint64_t>(rate, UINT_MAX - 1);
+
+	/* Avoid updating the socket on every frame. */
+	if (pacingRate_ && rate > pacingRate_ - pacingRate_ / 8 &&
+	    rate < pacingRate_ + pacingRate_ / 8)
+		return;
+
+	unsigned int value = rate;
+	if (setsockopt(fd_, SOL_SOCKET, SO_MAX_PACING_RATE, &value, sizeof(value)) < 0)
+		return;
+
+	pacingRate_ = rate;
+}
+
+void NetSink::fillHeaders(Frame &frame)
+{
+	frame.headers.resize(packetsPerFrame_ * HeaderSize);
+
+	for (unsigned int i = 0; i < packetsPerFrame_; ++i) {
+		uint8_t *header = &frame.headers[i * HeaderSize];
+		uint32_t sequence = sequence_ + i;
+		unsigned int line = i / packetsPerLine_;
+		unsigned int offset = i % packetsPerLine_ * payloadSize_ /
+				      pgroupBytes_ * pgroupPixels_;
+		bool last = i == packetsPerFrame_ - 1;
+
+		/* RTP version 2, the marker bit flags the last packet of the frame. */
+		header[0] = 0x80;
+		header[1] = (last ? 0x80 : 0) | PayloadType;
+		put16(&header[2], sequence);
+		put32(&header[4], frame.timestamp);
+		put32(&header[8], ssrc_);
+
+		/* Extended sequence number, and a single line segment header. */
+		put16(&header[12], sequence >> 16);
+		put16(&header[14], payloadSize_);
+		put16(&header[16], line & 0x7fff);
+		put16(&header[18], offset & 0x7fff);
+	}
+}
+
+/*
+ * Send as many packets of the queued frames as the socket accepts, and resume
+ * when the socket becomes writable again.
+ */
+void NetSink::sendFrames()
+{
+	for (Frame &frame : frames_) {
+		while (frame.packetsSent < packetsPerFrame_) {
+			int ret = sendBatch(frame);
+			if (!ret)
+				continue;
+
+			if (ret == -EAGAIN || ret == -ENOBUFS) {
+				writeNotifier_->setEnabled(true);
+				return;
+			}
+
+			if (ret == -EFAULT && zerocopy_) {
+				std::cerr << "Frame buffers can't be sent without copy, copying frames"
+					  << std::endl;
+				zerocopy_ = false;
+				continue;
+			}
+
+			/* The receiver isn't listening yet, keep sending. */
+			if (ret == -ECONNREFUSED)
+				continue;
+
+			std::cerr << "Failed to send frame: " << strerror(-ret)
+				  << std::endl;
+			frame.packetsSent = packetsPerFrame_;
+		}
+	}
+
+	writeNotifier_->setEnabled(false);
+
+	completeFrames();
+}
+
+int NetSink::sendBatch(Frame &frame)
+{
+	struct iovec iov[MaxSegments * 2];
+	unsigned int count = std::min(zerocopy_ ? std::min(packetsPerSend_, MaxZeroCopySegments)
+						: packetsPerSend_,
+				      packetsPerFrame_ - frame.packetsSent);
+	uint8_t *data = frame.mapped->planes()[0].data;
+
+	/* The lines are contiguous, packets follow each other in memory. */
+	for (unsigned int i = 0; i < count; ++i) {
+		unsigned int packet = frame.packetsSent + i;
+
+		iov[i * 2].iov_base = &frame.headers[packet * HeaderSize];
+		iov[i * 2].iov_len = HeaderSize;
+		iov[i * 2 + 1].iov_base = data + packet * payloadSize_;
+		iov[i * 2 + 1].iov_len = payloadSize_;
+	}
+
+	struct msghdr msg = {};
+	msg.msg_iov = iov;
+	msg.msg_iovlen = count * 2;
+
+	char control[CMSG_SPACE(sizeof(uint16_t))] = {};
+	if (count > 1) {
+		msg.msg_control = control;
+		msg.msg_controllen = sizeof(control);
+
+		struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+		cmsg->cmsg_level = SOL_UDP;
+		cmsg->cmsg_type = UDP_SEGMENT;
+		cmsg->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+		uint16_t segment = HeaderSize + payloadSize_;
+		memcpy(CMSG_DATA(cmsg), &segment, sizeof(segment));
+	}
+
+	int flags = MSG_DONTWAIT | (zerocopy_ ? MSG_ZEROCOPY : 0);
+	if (sendmsg(fd_, &msg, flags) < 0)
+		return -errno;
+
+	/* Each successful zero-copy send is identified by a counter. */
+	if (zerocopy_) {
+		if (!frame.sendsPending)
+			frame.firstSend = nextSend_;
+		frame.lastSend = nextSend_++;
+		frame.sendsPending++;
+	}
+
+	frame.packetsSent += count;
+
+	return 0;
+}
+
+/* Hand back the requests, in order, once their frames have been transmitted. */
+void NetSink::completeFrames()
+{
+	while (!frames_.empty()) {
+		const Frame &frame = frames_.front();
+		if (frame.packetsSent < packetsPerFrame_ || frame.sendsPending)
+			break;
+
+		Request *request = frame.request;
+		frames_.pop_front();
+		requestProcessed.emit(request);
+	}
+}
+
+void NetSink::writeReady(EventNotifier *notifier)
+{
+	sendFrames();
+}
+
+void NetSink::errorQueueReady(EventNotifier *notifier)
+{
+	readErrorQueue();
+
+	if (writeNotifier_->enabled())
+		completeFrames();
+	else
+		sendFrames();
+}
+
+/*
+ * Process the zero-copy completion notifications. Each notification reports a
+ * range of send identifiers whose pages are not referenced by the kernel
+ * anymore.
+ */
+void NetSink::readErrorQueue()
+{
+	while (true) {
+		char control[128];
+		struct msghdr msg = {};
+		msg.msg_control = control;
+		msg.msg_controllen = sizeof(control);
+
+		if (recvmsg(fd_, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0)
+			break;
+
+		for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg;
+		     cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+			if (!(cmsg->cmsg_level == SOL_IP && cmsg->cmsg_type == IP_RECVERR) &&
+			    !(cmsg->cmsg_level == SOL_IPV6 && cmsg->cmsg_type == IPV6_RECVERR))
+				continue;
+
+			struct sock_extended_err serr;
+			memcpy(&serr, CMSG_DATA(cmsg), sizeof(serr));
+			if (serr.ee_origin != SO_EE_ORIGIN_ZEROCOPY || serr.ee_errno)
+				continue;
+
+			if (serr.ee_code & SO_EE_CODE_ZEROCOPY_COPIED)
+				copied_ = true;
+
+			uint32_t first = serr.ee_info;
+			uint32_t last = serr.ee_data;
+
+			for (Frame &frame : frames_) {
+				if (!frame.sendsPending)
+					continue;
+
+				uint32_t start = std::max(first, frame.firstSend);
+				uint32_t end = std::min(last, frame.lastSend);
+				if (start <= end)
+					frame.sendsPending -= end - start + 1;
+			}
+		}
+	}
+
+	/*
+	 * The kernel had to copy the data, zero-copy only adds the cost of
+	 * the notifications.
+	 */
+	if (copied_ && zerocopy_) {
+		std::cerr << "Zero-copy transmission not supported by the network device, copying frames"
+			  << std::endl;
+		zerocopy_ = false;
+	}
+}
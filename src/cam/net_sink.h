@@ -0,0 +1,101 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * net_sink.h - RTP network streaming sink
+ */
+#ifndef __CAM_NET_SINK_H__
+#define __CAM_NET_SINK_H__
+
+#include <deque>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include <libcamera/buffer.h>
+#include <libcamera/camera.h>
+#include <libcamera/event_notifier.h>
+#include <libcamera/mapped_framebuffer.h>
+#include <libcamera/request.h>
+#include <libcamera/signal.h>
+#include <libcamera/stream.h>
+
+class NetSink
+{
+public:
+	NetSink(const std::string &destination);
+	~NetSink();
+
+	int configure(const libcamera::CameraConfiguration &config);
+	int mapBuffer(libcamera::FrameBuffer *buffer);
+
+	int start();
+	int stop();
+
+	bool processRequest(libcamera::Request *request);
+
+	libcamera::Signal<libcamera::Request *> requestProcessed;
+
+private:
+	struct Frame {
+		libcamera::Request *request;
+		const libcamera::MappedFrameBuffer *mapped;
+		uint32_t timestamp;
+		unsigned int packetsSent;
+		std::vector<uint8_t> headers;
+
+		/* Range of zero-copy send identifiers, and completions pending. */
+		uint32_t firstSend;
+		uint32_t lastSend;
+		unsigned int sendsPending;
+	};
+
+	int openSocket(const std::string &destination);
+	void printSdp() const;
+
+	void updatePacing(const libcamera::FrameBuffer *buffer);
+	void fillHeaders(Frame &frame);
+	void sendFrames();
+	int sendBatch(Frame &frame);
+	void completeFrames();
+
+	void writeReady(libcamera::EventNotifier *notifier);
+	void errorQueueReady(libcamera::EventNotifier *notifier);
+	void readErrorQueue();
+
+	std::string host_;
+	std::string port_;
+	int fd_;
+	bool ipv6_;
+	libcamera::EventNotifier *writeNotifier_;
+	libcamera::EventNotifier *errorNotifier_;
+
+	libcamera::Stream *stream_;
+	libcamera::PixelFormat format_;
+	libcamera::Size size_;
+	const char *sampling_;
+	unsigned int lineLength_;
+	unsigned int pgroupBytes_;
+	unsigned int pgroupPixels_;
+	unsigned int payloadSize_;
+	unsigned int packetsPerLine_;
+	unsigned int packetsPerFrame_;
+	unsigned int packetsPerSend_;
+	bool gso_;
+
+	libcamera::MappedBufferCache mappedBuffers_;
+
+	bool zerocopy_;
+	bool copied_;
+	uint32_t nextSend_;
+	uint32_t sequence_;
+	uint32_t ssrc_;
+
+	uint64_t lastTimestamp_;
+	uint64_t frameInterval_;
+	uint64_t pacingRate_;
+
+	std::deque<Frame> frames_;
+};
+
+#endif /* __CAM_NET_SINK_H__ */
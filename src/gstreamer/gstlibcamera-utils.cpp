@@ -0,0 +1,266 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * gstlibcamera-utils.cpp - GStreamer libcamera utility functions
+ */
+
+#include "gstlibcamera-utils.h"
+
+#include <mutex>
+#include <stdlib.h>
+
+#include <linux/drm_fourcc.h>
+
+#include <libcamera/pixelformats.h>
+
+using namespace libcamera;
+
+static const struct {
+	GstVideoFormat gst_format;
+	PixelFormat format;
+} format_map[] = {
+	/* Compressed */
+	{ GST_VIDEO_FORMAT_ENCODED, DRM_FORMAT_MJPEG },
+
+	/* RGB, the DRM formats are named from the MSB, GStreamer from the first byte. */
+	{ GST_VIDEO_FORMAT_RGB, DRM_FORMAT_BGR888 },
+	{ GST_VIDEO_FORMAT_BGR, DRM_FORMAT_RGB888 },
+	{ GST_VIDEO_FORMAT_BGRx, DRM_FORMAT_XRGB8888 },
+	{ GST_VIDEO_FORMAT_RGBx, DRM_FORMAT_XBGR8888 },
+	{ GST_VIDEO_FORMAT_BGRA, DRM_FORMAT_ARGB8888 },
+	{ GST_VIDEO_FORMAT_RGBA, DRM_FORMAT_ABGR8888 },
+
+	/* YUV packed */
+	{ GST_VIDEO_FORMAT_YUY2, DRM_FORMAT_YUYV },
+	{ GST_VIDEO_FORMAT_YVYU, DRM_FORMAT_YVYU },
+	{ GST_VIDEO_FORMAT_UYVY, DRM_FORMAT_UYVY },
+	{ GST_VIDEO_FORMAT_VYUY, DRM_FORMAT_VYUY },
+
+	/* YUV semi-planar */
+	{ GST_VIDEO_FORMAT_NV12, DRM_FORMAT_NV12 },
+	{ GST_VIDEO_FORMAT_NV21, DRM_FORMAT_NV21 },
+	{ GST_VIDEO_FORMAT_NV16, DRM_FORMAT_NV16 },
+	{ GST_VIDEO_FORMAT_NV61, DRM_FORMAT_NV61 },
+	{ GST_VIDEO_FORMAT_NV24, DRM_FORMAT_NV24 },
+
+	/* YUV planar */
+	{ GST_VIDEO_FORMAT_I420, DRM_FORMAT_YUV420 },
+	{ GST_VIDEO_FORMAT_YV12, DRM_FORMAT_YVU420 },
+	{ GST_VIDEO_FORMAT_Y42B, DRM_FORMAT_YUV422 },
+};
+
+static GstVideoFormat
+pixel_format_to_gst_format(PixelFormat format)
+{
+	for (const auto &item : format_map) {
+		if (item.format == format)
+			return item.gst_format;
+	}
+
+	return GST_VIDEO_FORMAT_UNKNOWN;
+}
+
+static PixelFormat
+gst_format_to_pixel_format(GstVideoFormat gst_format)
+{
+	if (gst_format == GST_VIDEO_FORMAT_ENCODED)
+		return 0;
+
+	for (const auto &item : format_map) {
+		if (item.gst_format == gst_format)
+			return item.format;
+	}
+
+	return 0;
+}
+
+static GstStructure *
+bare_structure_from_format(PixelFormat format)
+{
+	GstVideoFormat gst_format = pixel_format_to_gst_format(format);
+
+	if (gst_format == GST_VIDEO_FORMAT_UNKNOWN)
+		return nullptr;
+
+	if (gst_format != GST_VIDEO_FORMAT_ENCODED)
+		return gst_structure_new("video/x-raw", "format", G_TYPE_STRING,
+					 gst_video_format_to_string(gst_format),
+					 nullptr);
+
+	switch (format) {
+	case DRM_FORMAT_MJPEG:
+		return gst_structure_new_empty("image/jpeg");
+	default:
+		return nullptr;
+	}
+}
+
+GstCaps *
+gst_libcamera_stream_formats_to_caps(const StreamFormats &formats)
+{
+	GstCaps *caps = gst_caps_new_empty();
+
+	for (PixelFormat pixelformat : formats.pixelformats()) {
+		g_autoptr(GstStructure) bare_s = bare_structure_from_format(pixelformat);
+
+		if (!bare_s) {
+			GST_WARNING("Unsupported DRM format %" GST_FOURCC_FORMAT,
+				    GST_FOURCC_ARGS(pixelformat));
+			continue;
+		}
+
+		for (const Size &size : formats.sizes(pixelformat)) {
+			GstStructure *s = gst_structure_copy(bare_s);
+			gst_structure_set(s,
+					  "width", G_TYPE_INT, size.width,
+					  "height", G_TYPE_INT, size.height,
+					  nullptr);
+			gst_caps_append_structure(caps, s);
+		}
+
+		/* Express continuous ranges when no discrete size is listed. */
+		const SizeRange range = formats.range(pixelformat);
+		if (range.hStep && range.vStep && formats.sizes(pixelformat).empty()) {
+			GstStructure *s = gst_structure_copy(bare_s);
+			GValue val = G_VALUE_INIT;
+
+			g_value_init(&val, GST_TYPE_INT_RANGE);
+			gst_value_set_int_range_step(&val, range.min.width,
+						     range.max.width, range.hStep);
+			gst_structure_set_value(s, "width", &val);
+			gst_value_set_int_range_step(&val, range.min.height,
+						     range.max.height, range.vStep);
+			gst_structure_set_value(s, "height", &val);
+			g_value_unset(&val);
+
+			gst_caps_append_structure(caps, s);
+		}
+	}
+
+	return caps;
+}
+
+GstCaps *
+gst_libcamera_stream_configuration_to_caps(const StreamConfiguration &stream_cfg)
+{
+	GstCaps *caps = gst_caps_new_empty();
+	GstStructure *s = bare_structure_from_format(stream_cfg.pixelFormat);
+
+	if (!s)
+		return caps;
+
+	gst_structure_set(s,
+			  "width", G_TYPE_INT, stream_cfg.size.width,
+			  "height", G_TYPE_INT, stream_cfg.size.height,
+			  nullptr);
+	gst_caps_append_structure(caps, s);
+
+	return caps;
+}
+
+void
+gst_libcamera_configure_stream_from_caps(StreamConfiguration &stream_cfg,
+					 GstCaps *caps)
+{
+	GstVideoFormat gst_format = pixel_format_to_gst_format(stream_cfg.pixelFormat);
+
+	/* First fixate the caps using default configuration value. */
+	g_assert(gst_caps_is_writable(caps));
+	caps = gst_caps_truncate(caps);
+	GstStructure *s = gst_caps_get_structure(caps, 0);
+
+	gst_structure_fixate_field_nearest_int(s, "width", stream_cfg.size.width);
+	gst_structure_fixate_field_nearest_int(s, "height", stream_cfg.size.height);
+
+	if (gst_structure_has_name(s, "video/x-raw")) {
+		const gchar *format = gst_video_format_to_string(gst_format);
+		gst_structure_fixate_field_string(s, "format", format);
+	}
+
+	/* Then configure the stream with the result. */
+	if (gst_structure_has_name(s, "video/x-raw")) {
+		const gchar *format = gst_structure_get_string(s, "format");
+		gst_format = gst_video_format_from_string(format);
+		stream_cfg.pixelFormat = gst_format_to_pixel_format(gst_format);
+	} else if (gst_structure_has_name(s, "image/jpeg")) {
+		stream_cfg.pixelFormat = DRM_FORMAT_MJPEG;
+	} else {
+		g_critical("Unsupported media type: %s", gst_structure_get_name(s));
+	}
+
+	gint width, height;
+	gst_structure_get_int(s, "width", &width);
+	gst_structure_get_int(s, "height", &height);
+	stream_cfg.size.width = width;
+	stream_cfg.size.height = height;
+}
+
+/*
+ * Fill the video info of a raw stream, with the strides and plane offsets of
+ * the libcamera frame buffers.
+ */
+gboolean
+gst_libcamera_video_info_from_stream(const StreamConfiguration &stream_cfg,
+				     GstVideoInfo *info)
+{
+	GstVideoFormat gst_format = pixel_format_to_gst_format(stream_cfg.pixelFormat);
+	if (gst_format == GST_VIDEO_FORMAT_UNKNOWN ||
+	    gst_format == GST_VIDEO_FORMAT_ENCODED)
+		return FALSE;
+
+	if (!gst_video_info_set_format(info, gst_format, stream_cfg.size.width,
+				       stream_cfg.size.height))
+		return FALSE;
+
+	const PixelFormatInfo &fmt = PixelFormatInfo::info(stream_cfg.pixelFormat);
+	if (!fmt.isValid())
+		return TRUE;
+
+	gsize offset = 0;
+	for (guint i = 0; i < GST_VIDEO_INFO_N_PLANES(info) && i < fmt.numPlanes; ++i) {
+		info->stride[i] = fmt.stride(stream_cfg.size.width, i);
+		info->offset[i] = offset;
+		offset += fmt.planeSize(stream_cfg.size, i);
+	}
+	info->size = offset;
+
+	return TRUE;
+}
+
+std::shared_ptr<CameraManager>
+gst_libcamera_get_camera_manager(int &ret)
+{
+	static std::weak_ptr<CameraManager> cm_singleton_ptr;
+	static std::mutex cm_singleton_lock;
+
+	std::lock_guard<std::mutex> lock(cm_singleton_lock);
+
+	auto cm = cm_singleton_ptr.lock();
+	if (cm) {
+		ret = 0;
+		return cm;
+	}
+
+	/*
+	 * Nothing runs the event loop of the GStreamer threads. Run the
+	 * pipeline handlers in threads of their own, the cameras then process
+	 * events and complete requests from their own event loop, and marshal
+	 * calls from the GStreamer threads to it.
+	 */
+	setenv("LIBCAMERA_PIPELINE_THREADS", "1", 0);
+
+	cm = std::shared_ptr<CameraManager>(new CameraManager(),
+					    [](CameraManager *manager) {
+						    manager->stop();
+						    delete manager;
+					    });
+
+	ret = cm->start();
+	if (ret)
+		return nullptr;
+
+	cm_singleton_ptr = cm;
+
+	return cm;
+}
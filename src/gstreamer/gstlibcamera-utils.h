@@ -0,0 +1,77 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * gstlibcamera-utils.h - GStreamer libcamera utility functions
+ */
+
+#ifndef __GST_LIBCAMERA_UTILS_H__
+#define __GST_LIBCAMERA_UTILS_H__
+
+#include <memory>
+
+#include <gst/gst.h>
+#include <gst/video/video.h>
+
+#include <libcamera/camera_manager.h>
+#include <libcamera/stream.h>
+
+GstCaps *gst_libcamera_stream_formats_to_caps(const libcamera::StreamFormats &formats);
+GstCaps *gst_libcamera_stream_configuration_to_caps(const libcamera::StreamConfiguration &stream_cfg);
+void gst_libcamera_configure_stream_from_caps(libcamera::StreamConfiguration &stream_cfg,
+					      GstCaps *caps);
+gboolean gst_libcamera_video_info_from_stream(const libcamera::StreamConfiguration &stream_cfg,
+					      GstVideoInfo *info);
+
+std::shared_ptr<libcamera::CameraManager> gst_libcamera_get_camera_manager(int &ret);
+
+/*
+ * Lock and unlock the GST_OBJECT_LOCK of an object for the duration of a
+ * scope.
+ */
+class GLibLocker
+{
+public:
+	GLibLocker(GstObject *object)
+		: mutex_(GST_OBJECT_GET_LOCK(object))
+	{
+		g_mutex_lock(mutex_);
+	}
+
+	GLibLocker(GMutex *mutex)
+		: mutex_(mutex)
+	{
+		g_mutex_lock(mutex_);
+	}
+
+	~GLibLocker()
+	{
+		g_mutex_unlock(mutex_);
+	}
+
+private:
+	GMutex *mutex_;
+};
+
+/*
+ * Lock and unlock a GRecMutex for the duration of a scope.
+ */
+class GLibRecLocker
+{
+public:
+	GLibRecLocker(GRecMutex *mutex)
+		: mutex_(mutex)
+	{
+		g_rec_mutex_lock(mutex_);
+	}
+
+	~GLibRecLocker()
+	{
+		g_rec_mutex_unlock(mutex_);
+	}
+
+private:
+	GRecMutex *mutex_;
+};
+
+#endif /* __GST_LIBCAMERA_UTILS_H__ */
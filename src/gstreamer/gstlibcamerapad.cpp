@@ -0,0 +1,165 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * gstlibcamerapad.cpp - GStreamer Capture Pad
+ */
+
+#include "gstlibcamerapad.h"
+
+#include "gstlibcamera-utils.h"
+
+using namespace libcamera;
+
+struct _GstLibcameraPad {
+	GstPad parent;
+	StreamRole role;
+	GstLibcameraPool *pool;
+};
+
+enum {
+	PROP_0,
+	PROP_STREAM_ROLE
+};
+
+G_DEFINE_TYPE(GstLibcameraPad, gst_libcamera_pad, GST_TYPE_PAD);
+
+#define GST_TYPE_LIBCAMERA_STREAM_ROLE gst_libcamera_stream_role_get_type()
+
+static GType
+gst_libcamera_stream_role_get_type()
+{
+	static GType type = 0;
+	static const GEnumValue values[] = {
+		{ StillCapture, "libcamera::StillCapture", "still-capture" },
+		{ VideoRecording, "libcamera::VideoRecording", "video-recording" },
+		{ Viewfinder, "libcamera::Viewfinder", "view-finder" },
+		{ Raw, "libcamera::Raw", "raw" },
+		{ 0, NULL, NULL }
+	};
+
+	if (!type)
+		type = g_enum_register_static("GstLibcameraStreamRole", values);
+
+	return type;
+}
+
+static void
+gst_libcamera_pad_set_property(GObject *object, guint prop_id,
+			       const GValue *value, GParamSpec *pspec)
+{
+	auto *self = GST_LIBCAMERA_PAD(object);
+	GLibLocker lock(GST_OBJECT(self));
+
+	switch (prop_id) {
+	case PROP_STREAM_ROLE:
+		self->role = (StreamRole)g_value_get_enum(value);
+		break;
+	default:
+		G_OBJECT_WARN_INVALID_PROPERTY_ID(object, prop_id, pspec);
+		break;
+	}
+}
+
+static void
+gst_libcamera_pad_get_property(GObject *object, guint prop_id, GValue *value,
+			       GParamSpec *pspec)
+{
+	auto *self = GST_LIBCAMERA_PAD(object);
+	GLibLocker lock(GST_OBJECT(self));
+
+	switch (prop_id) {
+	case PROP_STREAM_ROLE:
+		g_value_set_enum(value, self->role);
+		break;
+	default:
+		G_OBJECT_WARN_INVALID_PROPERTY_ID(object, prop_id, pspec);
+		break;
+	}
+}
+
+/*
+ * The element is a live source, it can't produce buffers before it reaches
+ * the PLAYING state and doesn't buffer frames internally.
+ */
+static gboolean
+gst_libcamera_pad_query(GstPad *pad, GstObject *parent, GstQuery *query)
+{
+	if (query->type != GST_QUERY_LATENCY)
+		return gst_pad_query_default(pad, parent, query);
+
+	gst_query_set_latency(query, TRUE, 0, GST_CLOCK_TIME_NONE);
+
+	return TRUE;
+}
+
+static void
+gst_libcamera_pad_init(GstLibcameraPad *self)
+{
+	GST_PAD_QUERYFUNC(self) = gst_libcamera_pad_query;
+}
+
+static void
+gst_libcamera_pad_finalize(GObject *object)
+{
+	auto *self = GST_LIBCAMERA_PAD(object);
+
+	g_clear_object(&self->pool);
+
+	G_OBJECT_CLASS(gst_libcamera_pad_parent_class)->finalize(object);
+}
+
+static void
+gst_libcamera_pad_class_init(GstLibcameraPadClass *klass)
+{
+	auto *object_class = G_OBJECT_CLASS(klass);
+
+	object_class->set_property = gst_libcamera_pad_set_property;
+	object_class->get_property = gst_libcamera_pad_get_property;
+	object_class->finalize = gst_libcamera_pad_finalize;
+
+	auto *spec = g_param_spec_enum("stream-role", "Stream Role",
+				       "The selected stream role",
+				       GST_TYPE_LIBCAMERA_STREAM_ROLE, VideoRecording,
+				       (GParamFlags)(GST_PARAM_MUTABLE_READY
+						     | G_PARAM_CONSTRUCT
+						     | G_PARAM_READWRITE
+						     | G_PARAM_STATIC_STRINGS));
+	g_object_class_install_property(object_class, PROP_STREAM_ROLE, spec);
+}
+
+StreamRole
+gst_libcamera_pad_get_role(GstPad *pad)
+{
+	auto *self = GST_LIBCAMERA_PAD(pad);
+	GLibLocker lock(GST_OBJECT(self));
+	return self->role;
+}
+
+GstLibcameraPool *
+gst_libcamera_pad_get_pool(GstPad *pad)
+{
+	auto *self = GST_LIBCAMERA_PAD(pad);
+	return self->pool;
+}
+
+void
+gst_libcamera_pad_set_pool(GstPad *pad, GstLibcameraPool *pool)
+{
+	auto *self = GST_LIBCAMERA_PAD(pad);
+
+	if (self->pool)
+		g_object_unref(self->pool);
+	self->pool = pool;
+}
+
+Stream *
+gst_libcamera_pad_get_stream(GstPad *pad)
+{
+	auto *self = GST_LIBCAMERA_PAD(pad);
+
+	if (self->pool)
+		return gst_libcamera_pool_get_stream(self->pool);
+
+	return nullptr;
+}
@@ -0,0 +1,28 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * gstlibcamerapad.h - GStreamer Capture Pad
+ */
+
+#ifndef __GST_LIBCAMERA_PAD_H__
+#define __GST_LIBCAMERA_PAD_H__
+
+#include "gstlibcamerapool.h"
+
+#include <gst/gst.h>
+
+#include <libcamera/stream.h>
+
+#define GST_TYPE_LIBCAMERA_PAD gst_libcamera_pad_get_type()
+G_DECLARE_FINAL_TYPE(GstLibcameraPad, gst_libcamera_pad, GST_LIBCAMERA, PAD, GstPad)
+
+libcamera::StreamRole gst_libcamera_pad_get_role(GstPad *pad);
+
+GstLibcameraPool *gst_libcamera_pad_get_pool(GstPad *pad);
+
+void gst_libcamera_pad_set_pool(GstPad *pad, GstLibcameraPool *pool);
+
+libcamera::Stream *gst_libcamera_pad_get_stream(GstPad *pad);
+
+#endif /* __GST_LIBCAMERA_PAD_H__ */
@@ -0,0 +1,238 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * gstlibcamerapool.cpp - GStreamer buffer pool wrapping libcamera frame buffers
+ */
+
+#include "gstlibcamerapool.h"
+
+#include <errno.h>
+#include <map>
+#include <unistd.h>
+
+#include <gst/allocators/allocators.h>
+#include <gst/video/video.h>
+
+#include "gstlibcamera-utils.h"
+
+using namespace libcamera;
+
+enum {
+	SIGNAL_BUFFER_FREED,
+	N_SIGNALS
+};
+
+static guint signals[N_SIGNALS];
+
+struct _GstLibcameraPool {
+	GstBufferPool parent;
+
+	GstAtomicQueue *queue;
+	Stream *stream;
+	std::map<FrameBuffer *, GstBuffer *> *buffers;
+};
+
+G_DEFINE_TYPE(GstLibcameraPool, gst_libcamera_pool, GST_TYPE_BUFFER_POOL);
+
+static GQuark
+gst_libcamera_frame_buffer_quark()
+{
+	static GQuark quark = g_quark_from_static_string("GstLibcameraFrameBuffer");
+	return quark;
+}
+
+static GstFlowReturn
+gst_libcamera_pool_acquire_buffer(GstBufferPool *pool, GstBuffer **buffer,
+				  GstBufferPoolAcquireParams *)
+{
+	GstLibcameraPool *self = GST_LIBCAMERA_POOL(pool);
+	GstBuffer *buf = GST_BUFFER(gst_atomic_queue_pop(self->queue));
+	if (!buf)
+		return GST_FLOW_ERROR;
+
+	*buffer = buf;
+	return GST_FLOW_OK;
+}
+
+static void
+gst_libcamera_pool_release_buffer(GstBufferPool *pool, GstBuffer *buffer)
+{
+	GstLibcameraPool *self = GST_LIBCAMERA_POOL(pool);
+	bool do_notify = gst_atomic_queue_length(self->queue) == 0;
+
+	gst_atomic_queue_push(self->queue, buffer);
+
+	/* Only notify the empty to non-empty transition, the source then
+	 * recycles as many requests as the free buffers allow. */
+	if (do_notify)
+		g_signal_emit(self, signals[SIGNAL_BUFFER_FREED], 0, nullptr);
+}
+
+static void
+gst_libcamera_pool_init(GstLibcameraPool *self)
+{
+	self->queue = gst_atomic_queue_new(4);
+	self->buffers = new std::map<FrameBuffer *, GstBuffer *>();
+}
+
+static void
+gst_libcamera_pool_finalize(GObject *object)
+{
+	GstLibcameraPool *self = GST_LIBCAMERA_POOL(object);
+	GstBuffer *buf;
+
+	while ((buf = GST_BUFFER(gst_atomic_queue_pop(self->queue))))
+		gst_buffer_unref(buf);
+
+	gst_atomic_queue_unref(self->queue);
+	delete self->buffers;
+
+	G_OBJECT_CLASS(gst_libcamera_pool_parent_class)->finalize(object);
+}
+
+static void
+gst_libcamera_pool_class_init(GstLibcameraPoolClass *klass)
+{
+	auto *object_class = G_OBJECT_CLASS(klass);
+	auto *pool_class = GST_BUFFER_POOL_CLASS(klass);
+
+	object_class->finalize = gst_libcamera_pool_finalize;
+	pool_class->acquire_buffer = gst_libcamera_pool_acquire_buffer;
+	pool_class->release_buffer = gst_libcamera_pool_release_buffer;
+
+	signals[SIGNAL_BUFFER_FREED] = g_signal_new("buffer-freed",
+						    G_OBJECT_CLASS_TYPE(klass),
+						    G_SIGNAL_RUN_LAST, 0,
+						    nullptr, nullptr, nullptr,
+						    G_TYPE_NONE, 0);
+}
+
+/*
+ * Wrap a frame buffer in a GstBuffer. Each plane becomes a dmabuf memory
+ * holding a duplicate of the plane file descriptor, the memories can thus
+ * safely outlive the libcamera buffers when downstream keeps references
+ * after the element has stopped.
+ */
+static GstBuffer *
+gst_libcamera_pool_wrap_buffer(GstAllocator *allocator,
+			       const StreamConfiguration &stream_cfg,
+			       FrameBuffer *fb)
+{
+	GstBuffer *buffer = gst_buffer_new();
+	gsize offsets[GST_VIDEO_MAX_PLANES] = {};
+	gint strides[GST_VIDEO_MAX_PLANES] = {};
+	gsize offset = 0;
+
+	for (const FrameBuffer::Plane &plane : fb->planes()) {
+		int fd = dup(plane.fd.fd());
+		if (fd < 0) {
+			GST_ERROR("Failed to duplicate dmabuf: %s", g_strerror(errno));
+			gst_buffer_unref(buffer);
+			return nullptr;
+		}
+
+		GstMemory *mem = gst_dmabuf_allocator_alloc(allocator, fd, plane.length);
+		gst_buffer_append_memory(buffer, mem);
+	}
+
+	gst_mini_object_set_qdata(GST_MINI_OBJECT(buffer),
+				  gst_libcamera_frame_buffer_quark(), fb, nullptr);
+
+	GstVideoInfo info;
+	if (!gst_libcamera_video_info_from_stream(stream_cfg, &info))
+		return buffer;
+
+	/*
+	 * Plane offsets are expressed relative to the start of the buffer,
+	 * across all memories. When the frame buffer stores one plane per
+	 * dmabuf, each plane starts at the beginning of its memory.
+	 */
+	const std::vector<FrameBuffer::Plane> &planes = fb->planes();
+	guint n_planes = GST_VIDEO_INFO_N_PLANES(&info);
+
+	for (guint i = 0; i < n_planes; ++i) {
+		strides[i] = GST_VIDEO_INFO_PLANE_STRIDE(&info, i);
+		if (planes.size() == n_planes) {
+			offsets[i] = offset;
+			offset += planes[i].length;
+		} else {
+			offsets[i] = GST_VIDEO_INFO_PLANE_OFFSET(&info, i);
+		}
+	}
+
+	GstVideoMeta *meta =
+		gst_buffer_add_video_meta_full(buffer, GST_VIDEO_FRAME_FLAG_NONE,
+					       GST_VIDEO_INFO_FORMAT(&info),
+					       GST_VIDEO_INFO_WIDTH(&info),
+					       GST_VIDEO_INFO_HEIGHT(&info),
+					       n_planes, offsets, strides);
+
+	/* Keep the meta across pool round trips. */
+	GST_META_FLAG_SET(meta, GST_META_FLAG_POOLED);
+
+	return buffer;
+}
+
+GstLibcameraPool *
+gst_libcamera_pool_new(const StreamConfiguration &stream_cfg,
+		       const std::vector<std::unique_ptr<FrameBuffer>> &buffers)
+{
+	auto *pool = GST_LIBCAMERA_POOL(g_object_new(GST_TYPE_LIBCAMERA_POOL, nullptr));
+	GstAllocator *allocator = gst_dmabuf_allocator_new();
+
+	pool->stream = stream_cfg.stream();
+
+	for (const std::unique_ptr<FrameBuffer> &fb : buffers) {
+		GstBuffer *buffer = gst_libcamera_pool_wrap_buffer(allocator,
+								   stream_cfg,
+								   fb.get());
+		if (!buffer) {
+			gst_object_unref(allocator);
+			gst_object_unref(pool);
+			return nullptr;
+		}
+
+		(*pool->buffers)[fb.get()] = buffer;
+		gst_atomic_queue_push(pool->queue, buffer);
+	}
+
+	gst_object_unref(allocator);
+
+	return pool;
+}
+
+Stream *
+gst_libcamera_pool_get_stream(GstLibcameraPool *self)
+{
+	return self->stream;
+}
+
+gboolean
+gst_libcamera_pool_has_free_buffers(GstLibcameraPool *self)
+{
+	return gst_atomic_queue_length(self->queue) != 0;
+}
+
+FrameBuffer *
+gst_libcamera_buffer_get_frame_buffer(GstBuffer *buffer)
+{
+	return static_cast<FrameBuffer *>(
+		gst_mini_object_get_qdata(GST_MINI_OBJECT(buffer),
+					  gst_libcamera_frame_buffer_quark()));
+}
+
+/*
+ * Retrieve the GstBuffer wrapping a frame buffer. The buffer has been
+ * acquired from the pool when the frame buffer was added to a request, the
+ * caller inherits that reference.
+ */
+GstBuffer *
+gst_libcamera_pool_lookup(GstLibcameraPool *self, FrameBuffer *fb)
+{
+	auto it = self->buffers->find(fb);
+	if (it == self->buffers->end())
+		return nullptr;
+
+	return it->second;
+}
@@ -0,0 +1,41 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * gstlibcamerapool.h - GStreamer buffer pool wrapping libcamera frame buffers
+ *
+ * The pool owns one GstBuffer per libcamera FrameBuffer of a stream. Each
+ * FrameBuffer plane is exposed as a GstDmaBufMemory referencing the plane
+ * dmabuf, the frame data is never copied. When downstream releases a buffer it
+ * returns to the pool, which emits the "buffer-freed" signal to let the source
+ * element recycle its requests.
+ */
+
+#ifndef __GST_LIBCAMERA_POOL_H__
+#define __GST_LIBCAMERA_POOL_H__
+
+#include <memory>
+#include <vector>
+
+#include <gst/gst.h>
+
+#include <libcamera/buffer.h>
+#include <libcamera/stream.h>
+
+#define GST_TYPE_LIBCAMERA_POOL gst_libcamera_pool_get_type()
+G_DECLARE_FINAL_TYPE(GstLibcameraPool, gst_libcamera_pool,
+		     GST_LIBCAMERA, POOL, GstBufferPool)
+
+GstLibcameraPool *gst_libcamera_pool_new(const libcamera::StreamConfiguration &stream_cfg,
+					 const std::vector<std::unique_ptr<libcamera::FrameBuffer>> &buffers);
+
+libcamera::Stream *gst_libcamera_pool_get_stream(GstLibcameraPool *self);
+
+gboolean gst_libcamera_pool_has_free_buffers(GstLibcameraPool *self);
+
+libcamera::FrameBuffer *gst_libcamera_buffer_get_frame_buffer(GstBuffer *buffer);
+
+GstBuffer *gst_libcamera_pool_lookup(GstLibcameraPool *self,
+				     libcamera::FrameBuffer *fb);
+
+#endif /* __GST_LIBCAMERA_POOL_H__ */
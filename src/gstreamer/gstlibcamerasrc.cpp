@@ -0,0 +1,828 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * gstlibcamerasrc.cpp - GStreamer Capture Element
+ */
+
+/**
+ * SECTION:element-libcamerasrc
+ *
+ * libcamerasrc captures frames from a libcamera camera. Each source pad
+ * produces one stream of the camera, additional streams are obtained by
+ * requesting "src_%u" pads, and the "stream-role" property of each pad
+ * selects the role used to configure its stream.
+ *
+ * Frames are exported downstream as dmabuf memories wrapping the libcamera
+ * frame buffers, without copies. A request is recycled and queued back to
+ * the camera as soon as downstream has released all the buffers it needs.
+ *
+ * |[
+ * gst-launch-1.0 libcamerasrc ! videoconvert ! autovideosink
+ * ]|
+ */
+
+#include "gstlibcamerasrc.h"
+
+#include <algorithm>
+#include <condition_variable>
+#include <mutex>
+#include <queue>
+#include <vector>
+
+#include <gst/base/base.h>
+
+#include <libcamera/camera.h>
+#include <libcamera/camera_manager.h>
+#include <libcamera/framebuffer_allocator.h>
+#include <libcamera/request.h>
+
+#include "gstlibcamera-utils.h"
+#include "gstlibcamerapad.h"
+#include "gstlibcamerapool.h"
+
+using namespace libcamera;
+
+GST_DEBUG_CATEGORY_STATIC(source_debug);
+#define GST_CAT_DEFAULT source_debug
+
+/* Used for C++ object with destructors and callbacks. */
+struct GstLibcameraSrcState {
+	GstLibcameraSrc *src_;
+
+	std::shared_ptr<CameraManager> cm_;
+	std::shared_ptr<Camera> cam_;
+	std::unique_ptr<CameraConfiguration> config_;
+	std::unique_ptr<FrameBufferAllocator> allocator_;
+	std::vector<GstPad *> srcpads_;
+
+	/*
+	 * Protects the request queues and the running state. The lock is
+	 * taken from the streaming thread, from the camera pipeline thread
+	 * when requests complete and from any downstream thread releasing
+	 * buffers.
+	 */
+	std::mutex lock_;
+	std::condition_variable cond_;
+	std::vector<std::unique_ptr<Request>> requests_;
+	std::queue<Request *> idleRequests_;
+	std::queue<Request *> completedRequests_;
+	bool running_ = false;
+	bool started_ = false;
+
+	void requestCompleted(Request *request);
+	void recycleRequests();
+	void releaseBuffers(Request *request);
+	GstClockTime timestamp(const FrameBuffer *fb);
+};
+
+struct _GstLibcameraSrc {
+	GstElement parent;
+
+	GRecMutex stream_lock;
+	GstTask *task;
+
+	gchar *camera_name;
+
+	GstLibcameraSrcState *state;
+	GstFlowCombiner *flow_combiner;
+};
+
+enum {
+	PROP_0,
+	PROP_CAMERA_NAME
+};
+
+G_DEFINE_TYPE_WITH_CODE(GstLibcameraSrc, gst_libcamera_src, GST_TYPE_ELEMENT,
+			GST_DEBUG_CATEGORY_INIT(source_debug, "libcamerasrc", 0,
+						"libcamera Source"));
+
+#define TEMPLATE_CAPS GST_STATIC_CAPS("video/x-raw; image/jpeg")
+
+/* For the simple case, we have a first pad that is always present. */
+static GstStaticPadTemplate src_template = {
+	"src", GST_PAD_SRC, GST_PAD_ALWAYS, TEMPLATE_CAPS
+};
+
+/* More pads can be requested in state < PAUSED */
+static GstStaticPadTemplate request_src_template = {
+	"src_%u", GST_PAD_SRC, GST_PAD_REQUEST, TEMPLATE_CAPS
+};
+
+/*
+ * Called by the camera from its pipeline thread. Only queue the request
+ * for the streaming thread, which pushes the buffers downstream.
+ */
+void
+GstLibcameraSrcState::requestCompleted(Request *request)
+{
+	GST_DEBUG_OBJECT(src_, "buffers are ready");
+
+	{
+		std::lock_guard<std::mutex> lock(lock_);
+
+		if (running_ && request->status() != Request::RequestCancelled) {
+			completedRequests_.push(request);
+			cond_.notify_one();
+			return;
+		}
+	}
+
+	/* Cancelled requests return their buffers to the pools directly. */
+	releaseBuffers(request);
+
+	std::lock_guard<std::mutex> lock(lock_);
+	idleRequests_.push(request);
+}
+
+void
+GstLibcameraSrcState::releaseBuffers(Request *request)
+{
+	for (GstPad *srcpad : srcpads_) {
+		GstLibcameraPool *pool = gst_libcamera_pad_get_pool(srcpad);
+		Stream *stream = gst_libcamera_pad_get_stream(srcpad);
+		FrameBuffer *fb = request->findBuffer(stream);
+		if (!fb)
+			continue;
+
+		gst_buffer_unref(gst_libcamera_pool_lookup(pool, fb));
+	}
+}
+
+/*
+ * Queue idle requests to the camera, as long as every pool has a free
+ * buffer to capture to. Called from the streaming thread once a request has
+ * been pushed downstream, and from any thread releasing a buffer to a pool.
+ */
+void
+GstLibcameraSrcState::recycleRequests()
+{
+	std::vector<Request *> requests;
+
+	{
+		std::lock_guard<std::mutex> lock(lock_);
+
+		while (running_ && !idleRequests_.empty()) {
+			bool ready = true;
+			for (GstPad *srcpad : srcpads_) {
+				GstLibcameraPool *pool = gst_libcamera_pad_get_pool(srcpad);
+				if (!gst_libcamera_pool_has_free_buffers(pool)) {
+					ready = false;
+					break;
+				}
+			}
+
+			if (!ready)
+				break;
+
+			Request *request = idleRequests_.front();
+			idleRequests_.pop();
+
+			request->reuse();
+
+			for (GstPad *srcpad : srcpads_) {
+				GstLibcameraPool *pool = gst_libcamera_pad_get_pool(srcpad);
+				GstBuffer *buffer;
+
+				gst_buffer_pool_acquire_buffer(GST_BUFFER_POOL(pool),
+							       &buffer, nullptr);
+				request->addBuffer(gst_libcamera_pad_get_stream(srcpad),
+						   gst_libcamera_buffer_get_frame_buffer(buffer));
+			}
+
+			requests.push_back(request);
+		}
+	}
+
+	/*
+	 * Queue the requests without holding the lock, the camera may
+	 * complete requests synchronously from its pipeline thread.
+	 */
+	for (Request *request : requests) {
+		int ret = cam_->queueRequest(request);
+		if (ret < 0) {
+			GST_ELEMENT_ERROR(src_, RESOURCE, FAILED,
+					  ("Failed to queue request: %s", g_strerror(-ret)),
+					  ("Camera::queueRequest() failed with error code %i", ret));
+			releaseBuffers(request);
+
+			std::lock_guard<std::mutex> lock(lock_);
+			idleRequests_.push(request);
+		}
+	}
+}
+
+/*
+ * Convert the frame buffer monotonic timestamp to the running time of the
+ * element, by measuring the offset between the monotonic clock and the
+ * pipeline clock.
+ */
+GstClockTime
+GstLibcameraSrcState::timestamp(const FrameBuffer *fb)
+{
+	GstClock *clock = gst_element_get_clock(GST_ELEMENT(src_));
+	if (!clock)
+		return GST_CLOCK_TIME_NONE;
+
+	GstClockTime gst_now = gst_clock_get_time(clock);
+	GstClockTime base_time = gst_element_get_base_time(GST_ELEMENT(src_));
+	gst_object_unref(clock);
+
+	GstClockTime sys_now = g_get_monotonic_time() * 1000;
+	GstClockTime latency = sys_now - fb->metadata().timestamp;
+
+	if (gst_now < base_time + latency)
+		return 0;
+
+	return gst_now - base_time - latency;
+}
+
+static gboolean
+gst_libcamera_src_open(GstLibcameraSrc *self)
+{
+	std::shared_ptr<CameraManager> cm;
+	std::shared_ptr<Camera> cam;
+	gint ret = 0;
+
+	GST_DEBUG_OBJECT(self, "Opening camera device ...");
+
+	cm = gst_libcamera_get_camera_manager(ret);
+	if (ret) {
+		GST_ELEMENT_ERROR(self, LIBRARY, INIT,
+				  ("Failed listing cameras."),
+				  ("libcamera::CameraMananger::start() failed: %s", g_strerror(-ret)));
+		return false;
+	}
+
+	g_autofree gchar *camera_name = nullptr;
+	{
+		GLibLocker lock(GST_OBJECT(self));
+		if (self->camera_name)
+			camera_name = g_strdup(self->camera_name);
+	}
+
+	if (camera_name) {
+		cam = cm->get(camera_name);
+		if (!cam) {
+			GST_ELEMENT_ERROR(self, RESOURCE, NOT_FOUND,
+					  ("Could not find a camera named '%s'.", camera_name),
+					  ("libcamera::CameraMananger::get() returned nullptr"));
+			return false;
+		}
+	} else {
+		if (cm->cameras().empty()) {
+			GST_ELEMENT_ERROR(self, RESOURCE, NOT_FOUND,
+					  ("Could not find any supported camera on this system."),
+					  ("libcamera::CameraMananger::cameras() is empty"));
+			return false;
+		}
+		cam = cm->cameras()[0];
+	}
+
+	GST_INFO_OBJECT(self, "Using camera named '%s'", cam->name().c_str());
+
+	ret = cam->acquire();
+	if (ret) {
+		GST_ELEMENT_ERROR(self, RESOURCE, BUSY,
+				  ("Camera name '%s' is already in use.", cam->name().c_str()),
+				  ("libcamera::Camera::acquire() failed: %s", g_strerror(ret)));
+		return false;
+	}
+
+	/*
+	 * The camera completes requests from its own event loop, in the
+	 * pipeline handler thread.
+	 */
+	cam->requestCompleted.connect(self->state, &GstLibcameraSrcState::requestCompleted);
+
+	/* No need to lock here, we didn't start our threads yet. */
+	self->state->cm_ = cm;
+	self->state->cam_ = cam;
+
+	return true;
+}
+
+static void
+gst_libcamera_src_close(GstLibcameraSrc *self)
+{
+	GstLibcameraSrcState *state = self->state;
+	gint ret;
+
+	GST_DEBUG_OBJECT(self, "Releasing resources");
+
+	if (!state->cam_) {
+		state->cm_.reset();
+		return;
+	}
+
+	state->cam_->requestCompleted.disconnect(state, &GstLibcameraSrcState::requestCompleted);
+
+	ret = state->cam_->release();
+	if (ret) {
+		GST_ELEMENT_WARNING(self, RESOURCE, BUSY,
+				    ("Camera '%s' is still in use.", state->cam_->name().c_str()),
+				    ("libcamera::Camera::release() failed: %s", g_strerror(-ret)));
+	}
+
+	state->cam_.reset();
+	state->cm_.reset();
+}
+
+static void
+gst_libcamera_src_buffer_freed(GstLibcameraPool *, GstLibcameraSrcState *state)
+{
+	state->recycleRequests();
+}
+
+static void
+gst_libcamera_src_task_run(gpointer user_data)
+{
+	GstLibcameraSrc *self = GST_LIBCAMERA_SRC(user_data);
+	GstLibcameraSrcState *state = self->state;
+	Request *request;
+
+	{
+		std::unique_lock<std::mutex> lock(state->lock_);
+		state->cond_.wait(lock, [state]() {
+			return !state->running_ || !state->completedRequests_.empty();
+		});
+
+		if (!state->running_)
+			return;
+
+		request = state->completedRequests_.front();
+		state->completedRequests_.pop();
+	}
+
+	GstFlowReturn ret = GST_FLOW_OK;
+
+	for (GstPad *srcpad : state->srcpads_) {
+		GstLibcameraPool *pool = gst_libcamera_pad_get_pool(srcpad);
+		Stream *stream = gst_libcamera_pad_get_stream(srcpad);
+		FrameBuffer *fb = request->findBuffer(stream);
+		GstBuffer *buffer = gst_libcamera_pool_lookup(pool, fb);
+
+		if (fb->metadata().status != FrameMetadata::FrameSuccess) {
+			gst_buffer_unref(buffer);
+			continue;
+		}
+
+		GST_BUFFER_PTS(buffer) = state->timestamp(fb);
+		GST_BUFFER_OFFSET(buffer) = fb->metadata().sequence;
+		GST_BUFFER_OFFSET_END(buffer) = fb->metadata().sequence + 1;
+
+		ret = gst_pad_push(srcpad, buffer);
+		ret = gst_flow_combiner_update_pad_flow(self->flow_combiner,
+							srcpad, ret);
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(state->lock_);
+		state->idleRequests_.push(request);
+	}
+
+	/* Downstream may have released buffers synchronously. */
+	state->recycleRequests();
+
+	switch (ret) {
+	case GST_FLOW_OK:
+		break;
+	case GST_FLOW_NOT_NEGOTIATED:
+	case GST_FLOW_EOS:
+	case GST_FLOW_ERROR:
+		GST_ELEMENT_FLOW_ERROR(self, ret);
+		/* fallthrough */
+	default:
+		GST_DEBUG_OBJECT(self, "Pausing task: %s", gst_flow_get_name(ret));
+		gst_task_pause(self->task);
+		break;
+	}
+}
+
+static void
+gst_libcamera_src_task_enter(GstTask *task, GThread *, gpointer user_data)
+{
+	GstLibcameraSrc *self = GST_LIBCAMERA_SRC(user_data);
+	GLibRecLocker lock(&self->stream_lock);
+	GstLibcameraSrcState *state = self->state;
+	GstFlowReturn flow_ret = GST_FLOW_OK;
+	gint ret;
+
+	GST_DEBUG_OBJECT(self, "Streaming thread has started");
+
+	guint group_id = gst_util_group_id_next();
+	StreamRoles roles;
+	for (GstPad *srcpad : state->srcpads_)
+		roles.push_back(gst_libcamera_pad_get_role(srcpad));
+
+	/* Generate the stream configurations, there should be one per pad. */
+	state->config_ = state->cam_->generateConfiguration(roles);
+	if (!state->config_ || state->config_->size() != roles.size()) {
+		GST_ELEMENT_ERROR(self, RESOURCE, SETTINGS,
+				  ("Failed to generate camera configuration from roles"),
+				  ("Camera::generateConfiguration() failed"));
+		gst_task_stop(task);
+		return;
+	}
+
+	for (gsize i = 0; i < state->srcpads_.size(); i++) {
+		GstPad *srcpad = state->srcpads_[i];
+		StreamConfiguration &stream_cfg = state->config_->at(i);
+
+		/* Retrieve the supported caps. */
+		g_autoptr(GstCaps) filter = gst_libcamera_stream_formats_to_caps(stream_cfg.formats());
+		g_autoptr(GstCaps) caps = gst_pad_peer_query_caps(srcpad, filter);
+		if (gst_caps_is_empty(caps)) {
+			flow_ret = GST_FLOW_NOT_NEGOTIATED;
+			break;
+		}
+
+		/* Fixate caps and configure the stream. */
+		caps = gst_caps_make_writable(caps);
+		gst_libcamera_configure_stream_from_caps(stream_cfg, caps);
+	}
+
+	if (flow_ret != GST_FLOW_OK)
+		goto done;
+
+	/* The validated configuration may differ from the negotiated caps. */
+	if (state->config_->validate() == CameraConfiguration::Invalid) {
+		flow_ret = GST_FLOW_NOT_NEGOTIATED;
+		goto done;
+	}
+
+	ret = state->cam_->configure(state->config_.get());
+	if (ret) {
+		GST_ELEMENT_ERROR(self, RESOURCE, SETTINGS,
+				  ("Failed to configure camera: %s", g_strerror(-ret)),
+				  ("Camera::configure() failed with error code %i", ret));
+		gst_task_stop(task);
+		return;
+	}
+
+	state->allocator_.reset(FrameBufferAllocator::create(state->cam_));
+
+	{
+		guint num_requests = G_MAXUINT;
+
+		for (gsize i = 0; i < state->srcpads_.size(); i++) {
+			GstPad *srcpad = state->srcpads_[i];
+			const StreamConfiguration &stream_cfg = state->config_->at(i);
+			Stream *stream = stream_cfg.stream();
+
+			ret = state->allocator_->allocate(stream);
+			if (ret < 0) {
+				GST_ELEMENT_ERROR(self, RESOURCE, NO_SPACE_LEFT,
+						  ("Failed to allocate memory"),
+						  ("FrameBufferAllocator::allocate() failed with error code %i", ret));
+				gst_task_stop(task);
+				return;
+			}
+
+			const auto &buffers = state->allocator_->buffers(stream);
+			GstLibcameraPool *pool = gst_libcamera_pool_new(stream_cfg, buffers);
+			if (!pool) {
+				GST_ELEMENT_ERROR(self, RESOURCE, NO_SPACE_LEFT,
+						  ("Failed to export buffers"),
+						  ("Failed to wrap frame buffers in dmabuf memories"));
+				gst_task_stop(task);
+				return;
+			}
+
+			g_signal_connect(pool, "buffer-freed",
+					 G_CALLBACK(gst_libcamera_src_buffer_freed),
+					 state);
+			gst_buffer_pool_set_active(GST_BUFFER_POOL(pool), true);
+			gst_libcamera_pad_set_pool(srcpad, pool);
+
+			num_requests = std::min<guint>(num_requests, buffers.size());
+
+			/* Announce the stream to downstream. */
+			g_autofree gchar *stream_id =
+				gst_pad_create_stream_id_printf(srcpad, GST_ELEMENT(self),
+								"%" G_GSIZE_FORMAT, i);
+			GstEvent *event = gst_event_new_stream_start(stream_id);
+			gst_event_set_group_id(event, group_id);
+			gst_pad_push_event(srcpad, event);
+
+			g_autoptr(GstCaps) caps = gst_libcamera_stream_configuration_to_caps(stream_cfg);
+			if (!gst_pad_push_event(srcpad, gst_event_new_caps(caps))) {
+				flow_ret = GST_FLOW_NOT_NEGOTIATED;
+				break;
+			}
+
+			GstSegment segment;
+			gst_segment_init(&segment, GST_FORMAT_TIME);
+			gst_pad_push_event(srcpad, gst_event_new_segment(&segment));
+
+			gst_flow_combiner_add_pad(self->flow_combiner, srcpad);
+		}
+
+		if (flow_ret != GST_FLOW_OK)
+			goto done;
+
+		for (guint i = 0; i < num_requests; i++) {
+			std::unique_ptr<Request> request = state->cam_->createRequest(i);
+			if (!request) {
+				GST_ELEMENT_ERROR(self, RESOURCE, NO_SPACE_LEFT,
+						  ("Failed to create requests"),
+						  ("Camera::createRequest() failed"));
+				gst_task_stop(task);
+				return;
+			}
+
+			state->idleRequests_.push(request.get());
+			state->requests_.push_back(std::move(request));
+		}
+	}
+
+	ret = state->cam_->start();
+	if (ret) {
+		GST_ELEMENT_ERROR(self, RESOURCE, SETTINGS,
+				  ("Failed to start the camera: %s", g_strerror(-ret)),
+				  ("Camera.start() failed with error code %i", ret));
+		gst_task_stop(task);
+		return;
+	}
+
+	state->started_ = true;
+
+	{
+		std::lock_guard<std::mutex> locker(state->lock_);
+		state->running_ = true;
+	}
+
+	state->recycleRequests();
+
+done:
+	switch (flow_ret) {
+	case GST_FLOW_NOT_NEGOTIATED:
+		GST_ELEMENT_FLOW_ERROR(self, flow_ret);
+		gst_task_stop(task);
+		break;
+	default:
+		break;
+	}
+}
+
+static void
+gst_libcamera_src_task_leave(GstTask *, GThread *, gpointer user_data)
+{
+	GstLibcameraSrc *self = GST_LIBCAMERA_SRC(user_data);
+	GstLibcameraSrcState *state = self->state;
+
+	GST_DEBUG_OBJECT(self, "Streaming thread is about to stop");
+
+	{
+		std::lock_guard<std::mutex> lock(state->lock_);
+		state->running_ = false;
+	}
+
+	/* Stopping the camera cancels the queued requests synchronously. */
+	if (state->started_) {
+		state->cam_->stop();
+		state->started_ = false;
+	}
+
+	/* Completed requests that haven't been pushed still hold buffers. */
+	while (!state->completedRequests_.empty()) {
+		state->releaseBuffers(state->completedRequests_.front());
+		state->completedRequests_.pop();
+	}
+
+	for (GstPad *srcpad : state->srcpads_) {
+		GstLibcameraPool *pool = gst_libcamera_pad_get_pool(srcpad);
+		if (!pool)
+			continue;
+
+		g_signal_handlers_disconnect_by_data(pool, state);
+		gst_buffer_pool_set_active(GST_BUFFER_POOL(pool), false);
+		gst_libcamera_pad_set_pool(srcpad, nullptr);
+	}
+
+	gst_flow_combiner_reset(self->flow_combiner);
+	for (GstPad *srcpad : state->srcpads_)
+		gst_flow_combiner_remove_pad(self->flow_combiner, srcpad);
+
+	state->idleRequests_ = {};
+	state->requests_.clear();
+
+	/*
+	 * Buffers still held downstream reference duplicated file
+	 * descriptors, the dmabufs stay valid after the allocator frees the
+	 * frame buffers.
+	 */
+	state->allocator_.reset();
+	state->config_.reset();
+}
+
+static void
+gst_libcamera_src_set_property(GObject *object, guint prop_id,
+			       const GValue *value, GParamSpec *pspec)
+{
+	GLibLocker lock(GST_OBJECT(object));
+	GstLibcameraSrc *self = GST_LIBCAMERA_SRC(object);
+
+	switch (prop_id) {
+	case PROP_CAMERA_NAME:
+		g_free(self->camera_name);
+		self->camera_name = g_value_dup_string(value);
+		break;
+	default:
+		G_OBJECT_WARN_INVALID_PROPERTY_ID(object, prop_id, pspec);
+		break;
+	}
+}
+
+static void
+gst_libcamera_src_get_property(GObject *object, guint prop_id, GValue *value,
+			       GParamSpec *pspec)
+{
+	GLibLocker lock(GST_OBJECT(object));
+	GstLibcameraSrc *self = GST_LIBCAMERA_SRC(object);
+
+	switch (prop_id) {
+	case PROP_CAMERA_NAME:
+		g_value_set_string(value, self->camera_name);
+		break;
+	default:
+		G_OBJECT_WARN_INVALID_PROPERTY_ID(object, prop_id, pspec);
+		break;
+	}
+}
+
+static void
+gst_libcamera_src_stop_task(GstLibcameraSrc *self)
+{
+	GstLibcameraSrcState *state = self->state;
+
+	{
+		std::lock_guard<std::mutex> lock(state->lock_);
+		state->running_ = false;
+		state->cond_.notify_all();
+	}
+
+	gst_task_stop(self->task);
+
+	/* Wait for the streaming thread, the task leave function then runs. */
+	gst_task_join(self->task);
+}
+
+static GstStateChangeReturn
+gst_libcamera_src_change_state(GstElement *element, GstStateChange transition)
+{
+	GstLibcameraSrc *self = GST_LIBCAMERA_SRC(element);
+	GstStateChangeReturn ret = GST_STATE_CHANGE_SUCCESS;
+	GstElementClass *klass = GST_ELEMENT_CLASS(gst_libcamera_src_parent_class);
+
+	ret = klass->change_state(element, transition);
+	if (ret == GST_STATE_CHANGE_FAILURE)
+		return ret;
+
+	switch (transition) {
+	case GST_STATE_CHANGE_NULL_TO_READY:
+		if (!gst_libcamera_src_open(self))
+			return GST_STATE_CHANGE_FAILURE;
+		break;
+	case GST_STATE_CHANGE_READY_TO_PAUSED:
+		/* This needs to be called after pads activation. */
+		if (!gst_task_pause(self->task))
+			return GST_STATE_CHANGE_FAILURE;
+		ret = GST_STATE_CHANGE_NO_PREROLL;
+		break;
+	case GST_STATE_CHANGE_PAUSED_TO_PLAYING:
+		gst_task_start(self->task);
+		break;
+	case GST_STATE_CHANGE_PLAYING_TO_PAUSED:
+		ret = GST_STATE_CHANGE_NO_PREROLL;
+		break;
+	case GST_STATE_CHANGE_PAUSED_TO_READY:
+		gst_libcamera_src_stop_task(self);
+		break;
+	case GST_STATE_CHANGE_READY_TO_NULL:
+		gst_libcamera_src_close(self);
+		break;
+	default:
+		break;
+	}
+
+	return ret;
+}
+
+static void
+gst_libcamera_src_finalize(GObject *object)
+{
+	GObjectClass *klass = G_OBJECT_CLASS(gst_libcamera_src_parent_class);
+	GstLibcameraSrc *self = GST_LIBCAMERA_SRC(object);
+
+	g_rec_mutex_clear(&self->stream_lock);
+	g_clear_object(&self->task);
+	g_free(self->camera_name);
+	gst_flow_combiner_free(self->flow_combiner);
+	delete self->state;
+
+	return klass->finalize(object);
+}
+
+static void
+gst_libcamera_src_init(GstLibcameraSrc *self)
+{
+	GstLibcameraSrcState *state = new GstLibcameraSrcState();
+	GstPadTemplate *templ = gst_element_get_pad_template(GST_ELEMENT(self), "src");
+
+	g_rec_mutex_init(&self->stream_lock);
+	self->task = gst_task_new(gst_libcamera_src_task_run, self, nullptr);
+	gst_task_set_enter_callback(self->task, gst_libcamera_src_task_enter, self, nullptr);
+	gst_task_set_leave_callback(self->task, gst_libcamera_src_task_leave, self, nullptr);
+	gst_task_set_lock(self->task, &self->stream_lock);
+
+	self->flow_combiner = gst_flow_combiner_new();
+
+	state->src_ = self;
+	state->srcpads_.push_back(gst_pad_new_from_template(templ, "src"));
+	gst_element_add_pad(GST_ELEMENT(self), state->srcpads_[0]);
+
+	/* C-style friend. */
+	self->state = state;
+}
+
+static GstPad *
+gst_libcamera_src_request_new_pad(GstElement *element, GstPadTemplate *templ,
+				  const gchar *name, const GstCaps *)
+{
+	GstLibcameraSrc *self = GST_LIBCAMERA_SRC(element);
+	g_autoptr(GstPad) pad = NULL;
+
+	GST_DEBUG_OBJECT(self, "new request pad created");
+
+	pad = gst_pad_new_from_template(templ, name);
+	g_object_ref_sink(pad);
+
+	if (gst_element_add_pad(element, pad)) {
+		GLibRecLocker lock(&self->stream_lock);
+		self->state->srcpads_.push_back(reinterpret_cast<GstPad *>(g_object_ref(pad)));
+	} else {
+		GST_ELEMENT_ERROR(element, STREAM, FAILED,
+				  ("Internal data stream error."),
+				  ("Could not add pad to element"));
+		return NULL;
+	}
+
+	return reinterpret_cast<GstPad *>(g_steal_pointer(&pad));
+}
+
+static void
+gst_libcamera_src_release_pad(GstElement *element, GstPad *pad)
+{
+	GstLibcameraSrc *self = GST_LIBCAMERA_SRC(element);
+
+	GST_DEBUG_OBJECT(self, "Pad %" GST_PTR_FORMAT " being released", pad);
+
+	{
+		GLibRecLocker lock(&self->stream_lock);
+		std::vector<GstPad *> &pads = self->state->srcpads_;
+		auto begin_iterator = pads.begin();
+		auto end_iterator = pads.end();
+		auto pad_iterator = std::find(begin_iterator, end_iterator, pad);
+
+		if (pad_iterator != end_iterator) {
+			g_object_unref(*pad_iterator);
+			pads.erase(pad_iterator);
+		}
+	}
+	gst_element_remove_pad(element, pad);
+}
+
+static void
+gst_libcamera_src_class_init(GstLibcameraSrcClass *klass)
+{
+	GstElementClass *element_class = GST_ELEMENT_CLASS(klass);
+	GObjectClass *object_class = G_OBJECT_CLASS(klass);
+
+	object_class->set_property = gst_libcamera_src_set_property;
+	object_class->get_property = gst_libcamera_src_get_property;
+	object_class->finalize = gst_libcamera_src_finalize;
+
+	element_class->request_new_pad = gst_libcamera_src_request_new_pad;
+	element_class->release_pad = gst_libcamera_src_release_pad;
+	element_class->change_state = gst_libcamera_src_change_state;
+
+	gst_element_class_set_metadata(element_class,
+				       "libcamera Source", "Source/Video",
+				       "Linux Camera source using libcamera",
+				       "libcamera developers");
+	gst_element_class_add_static_pad_template_with_gtype(element_class,
+							     &src_template,
+							     GST_TYPE_LIBCAMERA_PAD);
+	gst_element_class_add_static_pad_template_with_gtype(element_class,
+							     &request_src_template,
+							     GST_TYPE_LIBCAMERA_PAD);
+
+	GParamSpec *spec = g_param_spec_string("camera-name", "Camera Name",
+					       "Select by name which camera to use.", nullptr,
+					       (GParamFlags)(GST_PARAM_MUTABLE_READY
+							     | G_PARAM_CONSTRUCT
+							     | G_PARAM_READWRITE
+							     | G_PARAM_STATIC_STRINGS));
+	g_object_class_install_property(object_class, PROP_CAMERA_NAME, spec);
+}
@@ -36,7 +36,7 @@ public:
 		       const std::map<unsigned int, const ControlInfoMap &> &entityControls) override {}
 	void mapBuffers(const std::vector<IPABuffer> &buffers) override {}
 	void unmapBuffers(const std::vector<unsigned int> &ids) override {}
-	void processEvent(const IPAOperationData &event) override {}
+	void processEvent(const IPAOperationData &event) override;
 
 private:
 	void initTrace();
@@ -66,6 +66,12 @@ int IPAVimc::init()
 	return 0;
 }
 
+void IPAVimc::processEvent(const IPAOperationData &event)
+{
+	/* Echo the event back to allow testing the IPA transport round-trip. */
+	queueFrameAction.emit(0, event);
+}
+
 void IPAVimc::initTrace()
 {
 	struct stat fifoStat;
@@ -0,0 +1,438 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * ipu3.cpp - IPU3 Image Processing Algorithms
+ */
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <map>
+#include <math.h>
+#include <memory>
+#include <stdint.h>
+#include <string.h>
+
+#include <linux/v4l2-controls.h>
+
+#include <ipa/ipa_interface.h>
+#include <ipa/ipa_module_info.h>
+#include <ipa/ipu3.h>
+#include <libcamera/buffer.h>
+#include <libcamera/control_ids.h>
+#include <libcamera/mapped_framebuffer.h>
+#include <libcamera/span.h>
+#include <libipa/algorithm.h>
+#include <libipa/ipa_interface_wrapper.h>
+#include <libipa/metering.h>
+
+#include "log.h"
+#include "utils.h"
+
+namespace libcamera {
+
+LOG_DEFINE_CATEGORY(IPAIPU3)
+
+namespace {
+
+/*
+ * Layout of the AWB statistics grid, as configured by default by the ImgU
+ * driver.
+ *
+ * \todo Program the grid through the parameters buffer to cover the whole
+ * frame, once the ImgU parameters layout is available to the IPA.
+ */
+constexpr unsigned int AwbGridWidth = 16;
+constexpr unsigned int AwbGridHeight = 16;
+
+} /* namespace */
+
+/*
+ * AWB statistics cell, laid out as struct ipu3_uapi_awb_set_item of the ImgU
+ * driver. The 3A statistics buffer starts with the AWB grid, one cell per
+ * block in raster order. The averages are on an 8-bit scale.
+ */
+struct IPU3AwbCell {
+	uint8_t grAvg;
+	uint8_t rAvg;
+	uint8_t bAvg;
+	uint8_t gbAvg;
+	uint8_t satRatio;
+	uint8_t padding[3];
+} __attribute__((packed));
+
+/*
+ * The ImgU parameters buffer starts with flags that select the parameters to
+ * update, a zeroed buffer keeps the current ImgU configuration.
+ */
+struct IPU3Params {
+	Span<uint8_t> data;
+};
+
+struct IPU3Stats {
+	Span<const IPU3AwbCell> awb;
+};
+
+/*
+ * Automatic gain control, computing the sensor exposure time and gain from
+ * the green averages of the AWB statistics grid.
+ */
+class IPU3Agc : public Algorithm<IPU3Params, IPU3Stats>
+{
+public:
+	IPU3Agc();
+
+	const char *name() const override { return "Agc"; }
+
+	void configure(uint32_t minExposure, uint32_t maxExposure,
+		       uint32_t minGain, uint32_t maxGain);
+	void setSensorControls(uint32_t exposure, uint32_t gain);
+	void process(unsigned int frame, const IPU3Stats *stats) override;
+
+	uint32_t exposure() const { return exposure_; }
+	uint32_t gain() const { return gain_; }
+	unsigned int state() const { return state_; }
+	bool updated() const { return updated_; }
+
+private:
+	Metering metering_;
+	EvSmoother exposureSmoother_;
+
+	uint32_t exposure_;
+	uint32_t minExposure_;
+	uint32_t maxExposure_;
+	uint32_t gain_;
+	uint32_t minGain_;
+	uint32_t maxGain_;
+
+	unsigned int state_;
+	bool updated_;
+};
+
+IPU3Agc::IPU3Agc()
+	: exposureSmoother_(0.5), exposure_(0), minExposure_(0), maxExposure_(0),
+	  gain_(0), minGain_(0), maxGain_(0), state_(0), updated_(false)
+{
+	metering_.configure(AwbGridWidth, AwbGridHeight,
+			    Metering::MeteringCentreWeighted);
+	metering_.setThreshold(4);
+}
+
+void IPU3Agc::configure(uint32_t minExposure, uint32_t maxExposure,
+			uint32_t minGain, uint32_t maxGain)
+{
+	minExposure_ = minExposure;
+	maxExposure_ = maxExposure;
+	exposure_ = std::max(minExposure_, maxExposure_ / 2);
+
+	minGain_ = minGain;
+	maxGain_ = maxGain;
+	gain_ = minGain_;
+
+	exposureSmoother_.reset(exposure_);
+}
+
+/*
+ * Update the exposure and gain with the values the sensor captured the frame
+ * with, for the next computation to start from the actual sensor state
+ * instead of the last values requested.
+ */
+void IPU3Agc::setSensorControls(uint32_t exposure, uint32_t gain)
+{
+	exposure_ = utils::clamp(exposure, minExposure_, maxExposure_);
+	gain_ = utils::clamp(gain, minGain_, maxGain_);
+}
+
+void IPU3Agc::process(unsigned int frame, const IPU3Stats *stats)
+{
+	/* Target a linear mid-grey, 18% of the full scale. */
+	const unsigned int target = 46;
+
+	state_ = 0;
+	updated_ = false;
+
+	if (stats->awb.size() < AwbGridWidth * AwbGridHeight)
+		return;
+
+	std::array<uint8_t, AwbGridWidth * AwbGridHeight> luminance;
+	for (unsigned int i = 0; i < luminance.size(); ++i) {
+		const IPU3AwbCell &cell = stats->awb[i];
+		luminance[i] = (cell.grAvg + cell.gbAvg) / 2;
+	}
+
+	double value = metering_.mean(luminance);
+	if (!value)
+		return;
+
+	double factor = target / value;
+
+	/*
+	 * The sensor controls take effect with a delay of a few frames, only
+	 * update them every third frame to avoid oscillations.
+	 */
+	if (frame % 3 == 0) {
+		double exposure;
+
+		exposure = exposureSmoother_.update(factor * exposure_ * gain_ / minGain_);
+		exposure_ = utils::clamp<uint64_t>((uint64_t)exposure,
+						   minExposure_, maxExposure_);
+
+		exposure = exposure / exposure_ * minGain_;
+		gain_ = utils::clamp<uint64_t>((uint64_t)exposure,
+					       minGain_, maxGain_);
+
+		/* Track the exposure actually applied. */
+		exposureSmoother_.reset(static_cast<double>(exposure_) * gain_ / minGain_);
+
+		updated_ = true;
+	}
+
+	state_ = fabs(factor - 1.0) < 0.05 ? 2 : 1;
+}
+
+class IPAIPU3 : public IPAInterface
+{
+public:
+	IPAIPU3();
+	~IPAIPU3();
+
+	int init() override { return 0; }
+
+	void configure(const std::map<unsigned int, IPAStream> &streamConfig,
+		       const std::map<unsigned int, const ControlInfoMap &> &entityControls) override;
+	void mapBuffers(const std::vector<IPABuffer> &buffers) override;
+	void unmapBuffers(const std::vector<unsigned int> &ids) override;
+	void processEvent(const IPAOperationData &event) override;
+
+private:
+	void fillParams(unsigned int frame, const MappedFrameBuffer &buffer);
+	void updateStatistics(unsigned int frame, const IPU3Stats *stats,
+			      const ControlList *sensorControls);
+
+	void setControls(unsigned int frame);
+	void metadataReady(unsigned int frame, unsigned int aeState);
+
+	std::map<unsigned int, FrameBuffer> buffers_;
+	std::map<unsigned int, MappedFrameBuffer> buffersMemory_;
+
+	ControlInfoMap ctrls_;
+
+	bool autoExposure_;
+
+	AlgorithmList<IPU3Params, IPU3Stats> algorithms_;
+	IPU3Agc *agc_;
+};
+
+IPAIPU3::IPAIPU3()
+	: autoExposure_(false)
+{
+	/*
+	 * The frame interval isn't known to the IPA, budget the algorithms
+	 * for 30fps.
+	 */
+	algorithms_.setBudget(std::chrono::milliseconds(33));
+
+	agc_ = new IPU3Agc();
+	algorithms_.add(std::unique_ptr<IPU3Agc>(agc_));
+}
+
+IPAIPU3::~IPAIPU3()
+{
+	LOG(IPAIPU3, Debug) << "Algorithms: " << algorithms_.report();
+}
+
+void IPAIPU3::configure(const std::map<unsigned int, IPAStream> &streamConfig,
+			const std::map<unsigned int, const ControlInfoMap &> &entityControls)
+{
+	autoExposure_ = false;
+
+	if (entityControls.empty())
+		return;
+
+	ctrls_ = entityControls.at(0);
+
+	const auto itExp = ctrls_.find(V4L2_CID_EXPOSURE);
+	const auto itGain = ctrls_.find(V4L2_CID_ANALOGUE_GAIN);
+	if (itExp == ctrls_.end() || itGain == ctrls_.end()) {
+		LOG(IPAIPU3, Warning)
+			<< "Sensor lacks exposure or gain control, disabling AE";
+		return;
+	}
+
+	autoExposure_ = true;
+
+	uint32_t minExposure = std::max<uint32_t>(itExp->second.min().get<int32_t>(), 1);
+	uint32_t maxExposure = itExp->second.max().get<int32_t>();
+	uint32_t minGain = std::max<uint32_t>(itGain->second.min().get<int32_t>(), 1);
+	uint32_t maxGain = itGain->second.max().get<int32_t>();
+
+	agc_->configure(minExposure, maxExposure, minGain, maxGain);
+
+	LOG(IPAIPU3, Info)
+		<< "Exposure: " << minExposure << "-" << maxExposure
+		<< " Gain: " << minGain << "-" << maxGain;
+
+	setControls(0);
+}
+
+void IPAIPU3::mapBuffers(const std::vector<IPABuffer> &buffers)
+{
+	for (const IPABuffer &buffer : buffers) {
+		auto elem = buffers_.emplace(std::piecewise_construct,
+					     std::forward_as_tuple(buffer.id),
+					     std::forward_as_tuple(buffer.planes));
+		const FrameBuffer &fb = elem.first->second;
+
+		auto mapped = buffersMemory_.emplace(std::piecewise_construct,
+						     std::forward_as_tuple(buffer.id),
+						     std::forward_as_tuple(&fb,
+									   MappedFrameBuffer::MapReadWrite));
+		const MappedFrameBuffer &memory = mapped.first->second;
+		if (!memory.isValid())
+			LOG(IPAIPU3, Fatal) << "Failed to mmap buffer: "
+					    << strerror(-memory.error());
+	}
+}
+
+void IPAIPU3::unmapBuffers(const std::vector<unsigned int> &ids)
+{
+	for (unsigned int id : ids) {
+		const auto fb = buffers_.find(id);
+		if (fb == buffers_.end())
+			continue;
+
+		buffersMemory_.erase(id);
+		buffers_.erase(id);
+	}
+}
+
+void IPAIPU3::processEvent(const IPAOperationData &event)
+{
+	switch (event.operation) {
+	case IPU3_IPA_EVENT_STAT_READY: {
+		IPU3EventStatReady stat;
+		if (stat.unpack(event)) {
+			LOG(IPAIPU3, Error) << "Invalid statistics event";
+			break;
+		}
+
+		const MappedFrameBuffer &mapped = buffersMemory_.at(stat.bufferId);
+		const MappedFrameBuffer::Plane &plane = mapped.planes()[0];
+
+		/* The statistics are read in place, without copy. */
+		IPU3Stats stats;
+		stats.awb = { reinterpret_cast<const IPU3AwbCell *>(plane.data),
+			      plane.length / sizeof(IPU3AwbCell) };
+
+		ScopedCpuAccess access(mapped.buffer()->planes()[0],
+				       MappedFrameBuffer::MapRead);
+		updateStatistics(stat.frame, &stats, stat.sensorControls);
+		break;
+	}
+	case IPU3_IPA_EVENT_FILL_PARAMS: {
+		IPU3EventFillParams params;
+		if (params.unpack(event)) {
+			LOG(IPAIPU3, Error) << "Invalid fill parameters event";
+			break;
+		}
+
+		fillParams(params.frame, buffersMemory_.at(params.bufferId));
+		break;
+	}
+	default:
+		LOG(IPAIPU3, Error) << "Unknown event " << event.operation;
+		break;
+	}
+}
+
+void IPAIPU3::fillParams(unsigned int frame, const MappedFrameBuffer &buffer)
+{
+	const MappedFrameBuffer::Plane &plane = buffer.planes()[0];
+
+	/*
+	 * Prepare parameters buffer. CPU access must be completed before
+	 * signalling the pipeline handler that the buffer is filled.
+	 */
+	{
+		ScopedCpuAccess access(buffer.buffer()->planes()[0],
+				       MappedFrameBuffer::MapWrite);
+
+		memset(plane.data, 0, plane.length);
+
+		IPU3Params params;
+		params.data = { plane.data, plane.length };
+		algorithms_.prepare(frame, &params);
+	}
+
+	queueFrameAction.emit(frame, IPU3ActionParamFilled().pack());
+}
+
+void IPAIPU3::updateStatistics(unsigned int frame, const IPU3Stats *stats,
+			       const ControlList *sensorControls)
+{
+	/*
+	 * The pipeline handler reports the sensor controls in effect for the
+	 * frame the statistics have been computed on.
+	 */
+	if (autoExposure_ && sensorControls &&
+	    sensorControls->contains(V4L2_CID_EXPOSURE) &&
+	    sensorControls->contains(V4L2_CID_ANALOGUE_GAIN))
+		agc_->setSensorControls(sensorControls->get(V4L2_CID_EXPOSURE).get<int32_t>(),
+					sensorControls->get(V4L2_CID_ANALOGUE_GAIN).get<int32_t>());
+
+	algorithms_.process(frame, stats);
+
+	if (autoExposure_ && agc_->updated())
+		setControls(frame + 1);
+
+	metadataReady(frame, autoExposure_ ? agc_->state() : 0);
+}
+
+void IPAIPU3::setControls(unsigned int frame)
+{
+	ControlList ctrls(ctrls_);
+	ctrls.set(V4L2_CID_EXPOSURE, static_cast<int32_t>(agc_->exposure()));
+	ctrls.set(V4L2_CID_ANALOGUE_GAIN, static_cast<int32_t>(agc_->gain()));
+
+	IPU3ActionV4L2Set action;
+	action.sensorControls = &ctrls;
+	queueFrameAction.emit(frame, action.pack());
+}
+
+/*
+ * Report the metadata of the frame. This also signals the pipeline handler
+ * that the statistics buffer isn't used anymore.
+ */
+void IPAIPU3::metadataReady(unsigned int frame, unsigned int aeState)
+{
+	ControlList ctrls(controls::controls);
+
+	if (aeState)
+		ctrls.set(controls::AeLocked, aeState == 2);
+
+	IPU3ActionMetadata action;
+	action.metadata = &ctrls;
+	queueFrameAction.emit(frame, action.pack());
+}
+
+/*
+ * External IPA module interface
+ */
+
+extern "C" {
+const struct IPAModuleInfo ipaModuleInfo = {
+	IPA_MODULE_API_VERSION,
+	1,
+	"PipelineHandlerIPU3",
+	"IPU3 IPA",
+	"LGPL-2.1-or-later",
+};
+
+struct ipa_context *ipaCreate()
+{
+	return new IPAInterfaceWrapper(std::make_unique<IPAIPU3>());
+}
+}
+
+} /* namespace libcamera */
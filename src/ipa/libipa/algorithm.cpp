@@ -0,0 +1,289 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * algorithm.cpp - IPA algorithms framework
+ */
+
+#include "algorithm.h"
+
+#include <algorithm>
+#include <chrono>
+#include <sstream>
+
+/**
+ * \file algorithm.h
+ * \brief IPA algorithms framework
+ */
+
+namespace libcamera {
+
+/**
+ * \class Algorithm
+ * \brief Base class for the algorithms of an IPA
+ * \tparam Params The type of the ISP parameters filled by the algorithms
+ * \tparam Stats The type of the ISP statistics processed by the algorithms
+ *
+ * IPAs are made of a set of algorithms (AE, AWB, ...) running for every frame.
+ * Each algorithm implements the prepare() hook to fill the ISP parameters for
+ * a frame, and the process() hook to compute its state from the statistics of
+ * a frame. Algorithms are run by an AlgorithmList, which measures their
+ * processing time.
+ */
+
+/**
+ * \fn Algorithm::name()
+ * \brief Retrieve the algorithm name
+ * \return The algorithm name
+ */
+
+/**
+ * \fn Algorithm::critical()
+ * \brief Retrieve whether the algorithm must run for every frame
+ *
+ * Non-critical algorithms are decimated by the AlgorithmList when the IPA
+ * exceeds its per-frame time budget. Algorithms are critical by default.
+ *
+ * \return True if the algorithm must run for every frame, false otherwise
+ */
+
+/**
+ * \fn Algorithm::prepare()
+ * \brief Fill the ISP parameters for a frame
+ * \param[in] frame The frame number
+ * \param[inout] params The ISP parameters
+ */
+
+/**
+ * \fn Algorithm::process()
+ * \brief Process the ISP statistics of a frame
+ * \param[in] frame The frame number
+ * \param[in] stats The ISP statistics
+ */
+
+/**
+ * \class AlgorithmTiming
+ * \brief Processing time statistics of an algorithm
+ *
+ * The AlgorithmTiming records the processing time of the last runs of an
+ * algorithm in a rolling window, to compute percentiles without allocating
+ * memory.
+ */
+
+AlgorithmTiming::AlgorithmTiming()
+	: count_(0), skipped_(0), max_(0)
+{
+}
+
+/**
+ * \brief Record the duration of a run of the algorithm
+ * \param[in] duration The run duration
+ */
+void AlgorithmTiming::record(utils::duration duration)
+{
+	window_[count_ % WindowSize] = duration;
+	max_ = std::max(max_, duration);
+	count_++;
+}
+
+/**
+ * \fn AlgorithmTiming::skip()
+ * \brief Record that a run of the algorithm has been skipped
+ */
+
+/**
+ * \fn AlgorithmTiming::count()
+ * \brief Retrieve the number of runs of the algorithm
+ * \return The number of runs
+ */
+
+/**
+ * \fn AlgorithmTiming::skipped()
+ * \brief Retrieve the number of runs skipped due to overload
+ * \return The number of skipped runs
+ */
+
+/**
+ * \fn AlgorithmTiming::max()
+ * \brief Retrieve the maximum run duration
+ * \return The maximum run duration since the algorithm was created
+ */
+
+/**
+ * \brief Compute a percentile of the recent run durations
+ * \param[in] p The percentile, in the [0, 1] range
+ *
+ * The percentile is computed over the last runs of the algorithm, up to the
+ * size of the rolling window.
+ *
+ * \return The \a p percentile of the recent run durations, or 0 if the
+ * algorithm hasn't run yet
+ */
+utils::duration AlgorithmTiming::percentile(double p) const
+{
+	unsigned int size = count_ < WindowSize ? count_ : WindowSize;
+	if (!size)
+		return utils::duration(0);
+
+	std::array<utils::duration, WindowSize> sorted;
+	std::copy(window_.begin(), window_.begin() + size, sorted.begin());
+
+	unsigned int index = std::min(std::max(p, 0.0), 1.0) * (size - 1) + 0.5;
+	std::nth_element(sorted.begin(), sorted.begin() + index,
+			 sorted.begin() + size);
+
+	return sorted[index];
+}
+
+/**
+ * \class AlgorithmListBase
+ * \brief Type-independent part of the AlgorithmList
+ */
+
+/**
+ * \class AlgorithmList
+ * \brief Run the algorithms of an IPA within a per-frame time budget
+ * \tparam Params The type of the ISP parameters filled by the algorithms
+ * \tparam Stats The type of the ISP statistics processed by the algorithms
+ *
+ * The AlgorithmList runs the prepare() and process() hooks of its algorithms
+ * in the order they have been added, and measures the duration of each run
+ * with a monotonic clock.
+ *
+ * The total time spent in the algorithms for a frame, from the prepare() calls
+ * to the end of the process() calls, is compared to the time budget. When the
+ * budget is exceeded, non-critical algorithms are decimated: they are run
+ * every second frame, and the decimation factor doubles with every further
+ * overrun up to MaxDecimation. The decimation factor is halved after
+ * RecoveryFrames frames within budget.
+ */
+
+/**
+ * \fn AlgorithmList::add()
+ * \brief Add an algorithm to the list
+ * \param[in] algorithm The algorithm
+ */
+
+/**
+ * \fn AlgorithmList::prepare()
+ * \brief Run the prepare() hook of all algorithms for a frame
+ * \param[in] frame The frame number
+ * \param[inout] params The ISP parameters
+ */
+
+/**
+ * \fn AlgorithmList::process()
+ * \brief Run the process() hook of all algorithms for a frame
+ * \param[in] frame The frame number
+ * \param[in] stats The ISP statistics
+ *
+ * This marks the end of the frame for the purpose of the time budget.
+ */
+
+AlgorithmListBase::AlgorithmListBase()
+	: budget_(0), frameTime_(0), frames_(0), overruns_(0), decimation_(1),
+	  inBudget_(0)
+{
+}
+
+/**
+ * \fn AlgorithmListBase::setBudget()
+ * \brief Set the per-frame time budget
+ * \param[in] budget The time budget, 0 to disable overload handling
+ *
+ * The budget should typically be set to a fraction of the frame interval.
+ */
+
+/**
+ * \fn AlgorithmListBase::budget()
+ * \brief Retrieve the per-frame time budget
+ * \return The per-frame time budget
+ */
+
+/**
+ * \fn AlgorithmListBase::frames()
+ * \brief Retrieve the number of frames processed
+ * \return The number of frames processed
+ */
+
+/**
+ * \fn AlgorithmListBase::overruns()
+ * \brief Retrieve the number of frames that exceeded the time budget
+ * \return The number of budget overruns
+ */
+
+/**
+ * \fn AlgorithmListBase::decimation()
+ * \brief Retrieve the current decimation factor of non-critical algorithms
+ * \return The decimation factor, 1 when all algorithms run for every frame
+ */
+
+/**
+ * \fn AlgorithmListBase::timing()
+ * \brief Retrieve the timing statistics of an algorithm
+ * \param[in] index The algorithm index, in the order of addition
+ * \return The timing statistics of the algorithm
+ */
+
+/**
+ * \brief Format the timing statistics of all algorithms as a string
+ * \return A human-readable report of the timing statistics
+ */
+std::string AlgorithmListBase::report() const
+{
+	using std::chrono::duration_cast;
+	using std::chrono::microseconds;
+
+	std::stringstream ss;
+
+	ss << frames_ << " frames, " << overruns_ << " over budget";
+
+	for (unsigned int i = 0; i < timings_.size(); ++i) {
+		const AlgorithmTiming &timing = timings_[i];
+
+		ss << "; " << names_[i] << ": " << timing.count() << " runs, "
+		   << timing.skipped() << " skipped, p50 "
+		   << duration_cast<microseconds>(timing.percentile(0.5)).count()
+		   << "us p99 "
+		   << duration_cast<microseconds>(timing.percentile(0.99)).count()
+		   << "us max "
+		   << duration_cast<microseconds>(timing.max()).count() << "us";
+	}
+
+	return ss.str();
+}
+
+bool AlgorithmListBase::shouldRun(unsigned int index, bool critical,
+				  unsigned int frame)
+{
+	if (critical || frame % decimation_ == 0)
+		return true;
+
+	timings_[index].skip();
+	return false;
+}
+
+void AlgorithmListBase::record(unsigned int index, utils::duration duration)
+{
+	timings_[index].record(duration);
+	frameTime_ += duration;
+}
+
+void AlgorithmListBase::endFrame()
+{
+	frames_++;
+
+	if (budget_.count() && frameTime_ > budget_) {
+		overruns_++;
+		if (decimation_ < MaxDecimation)
+			decimation_ *= 2;
+		inBudget_ = 0;
+	} else if (decimation_ > 1 && ++inBudget_ >= RecoveryFrames) {
+		decimation_ /= 2;
+		inBudget_ = 0;
+	}
+
+	frameTime_ = utils::duration(0);
+}
+
+} /* namespace libcamera */
@@ -0,0 +1,139 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * algorithm.h - IPA algorithms framework
+ */
+#ifndef __LIBCAMERA_IPA_ALGORITHM_H__
+#define __LIBCAMERA_IPA_ALGORITHM_H__
+
+#include <array>
+#include <memory>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "utils.h"
+
+namespace libcamera {
+
+template<typename Params, typename Stats>
+class Algorithm
+{
+public:
+	virtual ~Algorithm() {}
+
+	virtual const char *name() const = 0;
+	virtual bool critical() const { return true; }
+
+	virtual void prepare(unsigned int, Params *) {}
+	virtual void process(unsigned int, const Stats *) {}
+};
+
+class AlgorithmTiming
+{
+public:
+	AlgorithmTiming();
+
+	void record(utils::duration duration);
+	void skip() { skipped_++; }
+
+	uint64_t count() const { return count_; }
+	uint64_t skipped() const { return skipped_; }
+	utils::duration max() const { return max_; }
+	utils::duration percentile(double p) const;
+
+private:
+	static constexpr unsigned int WindowSize = 64;
+
+	std::array<utils::duration, WindowSize> window_;
+	uint64_t count_;
+	uint64_t skipped_;
+	utils::duration max_;
+};
+
+class AlgorithmListBase
+{
+public:
+	AlgorithmListBase();
+
+	void setBudget(utils::duration budget) { budget_ = budget; }
+	utils::duration budget() const { return budget_; }
+
+	uint64_t frames() const { return frames_; }
+	uint64_t overruns() const { return overruns_; }
+	unsigned int decimation() const { return decimation_; }
+	const AlgorithmTiming &timing(unsigned int index) const
+	{
+		return timings_[index];
+	}
+
+	std::string report() const;
+
+protected:
+	static constexpr unsigned int MaxDecimation = 8;
+	static constexpr unsigned int RecoveryFrames = 16;
+
+	bool shouldRun(unsigned int index, bool critical, unsigned int frame);
+	void record(unsigned int index, utils::duration duration);
+	void endFrame();
+
+	std::vector<std::string> names_;
+	std::vector<AlgorithmTiming> timings_;
+
+private:
+	utils::duration budget_;
+	utils::duration frameTime_;
+
+	uint64_t frames_;
+	uint64_t overruns_;
+	unsigned int decimation_;
+	unsigned int inBudget_;
+};
+
+template<typename Params, typename Stats>
+class AlgorithmList : public AlgorithmListBase
+{
+public:
+	void add(std::unique_ptr<Algorithm<Params, Stats>> algorithm)
+	{
+		names_.push_back(algorithm->name());
+		timings_.emplace_back();
+		algorithms_.push_back(std::move(algorithm));
+	}
+
+	void prepare(unsigned int frame, Params *params)
+	{
+		for (unsigned int i = 0; i < algorithms_.size(); ++i) {
+			Algorithm<Params, Stats> *algo = algorithms_[i].get();
+			if (!shouldRun(i, algo->critical(), frame))
+				continue;
+
+			utils::time_point start = utils::clock::now();
+			algo->prepare(frame, params);
+			record(i, utils::clock::now() - start);
+		}
+	}
+
+	void process(unsigned int frame, const Stats *stats)
+	{
+		for (unsigned int i = 0; i < algorithms_.size(); ++i) {
+			Algorithm<Params, Stats> *algo = algorithms_[i].get();
+			if (!shouldRun(i, algo->critical(), frame))
+				continue;
+
+			utils::time_point start = utils::clock::now();
+			algo->process(frame, stats);
+			record(i, utils::clock::now() - start);
+		}
+
+		endFrame();
+	}
+
+private:
+	std::vector<std::unique_ptr<Algorithm<Params, Stats>>> algorithms_;
+};
+
+} /* namespace libcamera */
+
+#endif /* __LIBCAMERA_IPA_ALGORITHM_H__ */
@@ -51,6 +51,10 @@ namespace libcamera {
  *
  * The wrapper takes ownership of the IPAInterface and will automatically
  * delete it when the wrapper is destroyed.
+ *
+ * Events and frame actions are exchanged for every frame. To keep the heap out
+ * of this path, the wrapper reuses the same storage to translate them across
+ * calls. The storage grows to the largest operation seen and is never shrunk.
  */
 
 /**
@@ -58,7 +62,8 @@ namespace libcamera {
  * \param[in] interface The interface to wrap
  */
 IPAInterfaceWrapper::IPAInterfaceWrapper(std::unique_ptr<IPAInterface> interface)
-	: ipa_(std::move(interface)), callbacks_(nullptr), cb_ctx_(nullptr)
+	: ipa_(std::move(interface)), callbacks_(nullptr), cb_ctx_(nullptr),
+	  eventBusy_(false)
 {
 	ops = &operations_;
 
@@ -171,22 +176,28 @@ void IPAInterfaceWrapper::process_event(struct ipa_context *_ctx,
 					const struct ipa_operation_data *data)
 {
 	IPAInterfaceWrapper *ctx = static_cast<IPAInterfaceWrapper *>(_ctx);
-	IPAOperationData opData;
 
-	opData.operation = data->operation;
+	/*
+	 * Reuse the event storage, unless the IPA processes another event
+	 * recursively.
+	 */
+	IPAOperationData nested;
+	IPAOperationData &opData = ctx->eventBusy_ ? nested : ctx->event_;
+	bool busy = ctx->eventBusy_;
 
-	opData.data.resize(data->num_data);
-	memcpy(opData.data.data(), data->data,
-	       data->num_data * sizeof(*data->data));
+	opData.operation = data->operation;
+	opData.data.assign(data->data, data->data + data->num_data);
 
 	opData.controls.resize(data->num_lists);
 	for (unsigned int i = 0; i < data->num_lists; ++i) {
 		const struct ipa_control_list *c_list = &data->lists[i];
 		ByteStreamBuffer byteStream(c_list->data, c_list->size);
-		opData.controls[i] = ctx->serializer_.deserialize<ControlList>(byteStream);
+		ctx->serializer_.deserialize(byteStream, &opData.controls[i]);
 	}
 
+	ctx->eventBusy_ = true;
 	ctx->ipa_->processEvent(opData);
+	ctx->eventBusy_ = busy;
 }
 
 void IPAInterfaceWrapper::queueFrameAction(unsigned int frame,
@@ -200,20 +211,22 @@ void IPAInterfaceWrapper::queueFrameAction(unsigned int frame,
 	c_data.data = data.data.data();
 	c_data.num_data = data.data.size();
 
-	struct ipa_control_list control_lists[data.controls.size()];
-	c_data.lists = control_lists;
-	c_data.num_lists = data.controls.size();
-
 	std::size_t listsSize = 0;
 	for (const auto &list : data.controls)
 		listsSize += serializer_.binarySize(list);
 
-	std::vector<uint8_t> binaryData(listsSize);
-	ByteStreamBuffer byteStreamBuffer(binaryData.data(), listsSize);
+	if (actionData_.size() < listsSize)
+		actionData_.resize(listsSize);
+	actionLists_.resize(data.controls.size());
+
+	c_data.lists = actionLists_.data();
+	c_data.num_lists = actionLists_.size();
+
+	ByteStreamBuffer byteStreamBuffer(actionData_.data(), listsSize);
 
 	unsigned int i = 0;
 	for (const auto &list : data.controls) {
-		struct ipa_control_list &c_list = control_lists[i];
+		struct ipa_control_list &c_list = actionLists_[i++];
 		c_list.size = serializer_.binarySize(list);
 
 		ByteStreamBuffer b = byteStreamBuffer.carveOut(c_list.size);
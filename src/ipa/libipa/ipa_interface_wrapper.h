@@ -8,6 +8,7 @@
 #define __LIBCAMERA_IPA_INTERFACE_WRAPPER_H__
 
 #include <memory>
+#include <vector>
 
 #include <ipa/ipa_interface.h>
 
@@ -50,6 +51,11 @@ private:
 	void *cb_ctx_;
 
 	ControlSerializer serializer_;
+
+	IPAOperationData event_;
+	bool eventBusy_;
+	std::vector<uint8_t> actionData_;
+	std::vector<struct ipa_control_list> actionLists_;
 };
 
 } /* namespace libcamera */
@@ -0,0 +1,301 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * metering.cpp - Exposure metering helpers for IPAs
+ */
+
+#include "metering.h"
+
+#include <algorithm>
+#include <errno.h>
+#include <math.h>
+#include <stdlib.h>
+
+/**
+ * \file metering.h
+ * \brief Exposure metering helpers for IPAs
+ */
+
+namespace libcamera {
+
+/**
+ * \class Metering
+ * \brief Compute the scene luminance from an ISP exposure statistics grid
+ *
+ * ISPs commonly report exposure statistics as a grid of mean luminance values,
+ * one per block of the image. The Metering class reduces the grid to a single
+ * luminance value, weighting the blocks according to a metering mode. Blocks
+ * whose mean luminance is lower than or equal to a threshold are considered as
+ * too dark to carry information and are ignored.
+ *
+ * The block weights are computed once by configure(). The reduction performed
+ * by mean() for every frame is branch-free integer arithmetic, which compilers
+ * vectorize on all supported architectures.
+ */
+
+/**
+ * \enum Metering::Mode
+ * \brief The metering mode, defining the weight of each block
+ * \var Metering::MeteringAverage
+ * \brief All blocks have the same weight
+ * \var Metering::MeteringCentreWeighted
+ * \brief The weight decreases from the centre of the grid to its edges
+ * \var Metering::MeteringSpot
+ * \brief Only the central block(s) of the grid are taken into account
+ */
+
+/**
+ * \brief Construct an unconfigured Metering instance
+ */
+Metering::Metering()
+	: width_(0), height_(0), mode_(MeteringAverage), threshold_(0)
+{
+}
+
+/**
+ * \brief Configure the statistics grid size and the metering mode
+ * \param[in] width The number of blocks in a grid line
+ * \param[in] height The number of blocks in a grid column
+ * \param[in] mode The metering mode
+ *
+ * \return 0 on success or a negative error code otherwise
+ * \retval -EINVAL The grid size is invalid
+ */
+int Metering::configure(unsigned int width, unsigned int height, Mode mode)
+{
+	if (!width || !height)
+		return -EINVAL;
+
+	width_ = width;
+	height_ = height;
+	mode_ = mode;
+
+	weights_.resize(width * height);
+
+	/*
+	 * Block distances to the centre are computed in half block units to
+	 * stay integer for both odd and even grid sizes.
+	 */
+	for (unsigned int y = 0; y < height; ++y) {
+		for (unsigned int x = 0; x < width; ++x) {
+			unsigned int dx = abs(static_cast<int>(2 * x + 1 - width));
+			unsigned int dy = abs(static_cast<int>(2 * y + 1 - height));
+			uint16_t &weight = weights_[y * width + x];
+
+			switch (mode) {
+			case MeteringAverage:
+				weight = 1;
+				break;
+
+			case MeteringCentreWeighted: {
+				/*
+				 * Weight the blocks from 16 at the centre down
+				 * to 4 at the grid boundary, linearly with
+				 * their normalized distance to the centre.
+				 */
+				double d = std::max(static_cast<double>(dx) / width,
+						    static_cast<double>(dy) / height);
+				weight = lround(16 - 12 * d);
+				break;
+			}
+
+			case MeteringSpot:
+				weight = dx <= 1 && dy <= 1 ? 1 : 0;
+				break;
+			}
+		}
+	}
+
+	return 0;
+}
+
+/**
+ * \fn Metering::setThreshold()
+ * \brief Set the luminance threshold below which blocks are ignored
+ * \param[in] threshold The luminance threshold
+ *
+ * Blocks with a mean luminance lower than or equal to \a threshold are ignored
+ * by mean(). The threshold defaults to 0.
+ */
+
+/**
+ * \fn Metering::width()
+ * \brief Retrieve the number of blocks in a grid line
+ * \return The grid width in blocks
+ */
+
+/**
+ * \fn Metering::height()
+ * \brief Retrieve the number of blocks in a grid column
+ * \return The grid height in blocks
+ */
+
+/**
+ * \fn Metering::mode()
+ * \brief Retrieve the metering mode
+ * \return The metering mode
+ */
+
+/**
+ * \fn Metering::threshold()
+ * \brief Retrieve the luminance threshold
+ * \return The luminance threshold
+ */
+
+/**
+ * \brief Compute the weighted mean luminance of a statistics grid
+ * \param[in] grid The mean luminance of each block, in raster order
+ *
+ * The \a grid shall contain width() x height() blocks. Additional blocks are
+ * ignored.
+ *
+ * \return The weighted mean luminance, or 0 if no block is above the threshold
+ */
+double Metering::mean(Span<const uint8_t> grid) const
+{
+	std::size_t count = std::min(grid.size(), weights_.size());
+	const uint8_t *values = grid.data();
+	const uint16_t *weights = weights_.data();
+	const uint32_t threshold = threshold_;
+
+	uint32_t sum = 0;
+	uint32_t total = 0;
+
+	for (std::size_t i = 0; i < count; ++i) {
+		uint32_t value = values[i];
+		uint32_t weight = value > threshold ? weights[i] : 0;
+
+		sum += weight * value;
+		total += weight;
+	}
+
+	if (!total)
+		return 0.0;
+
+	return static_cast<double>(sum) / total;
+}
+
+/**
+ * \brief Compute the mean of a histogram
+ * \param[in] bins The histogram bin counters
+ *
+ * \return The mean value, expressed in bins in the [0, bins.size()] range, or 0
+ * if the histogram is empty
+ */
+double Metering::histogramMean(Span<const uint16_t> bins)
+{
+	uint64_t sum = 0;
+	uint64_t total = 0;
+
+	/* Accumulate twice the bin centre to stay integer. */
+	for (std::size_t i = 0; i < bins.size(); ++i) {
+		sum += static_cast<uint64_t>(2 * i + 1) * bins[i];
+		total += bins[i];
+	}
+
+	if (!total)
+		return 0.0;
+
+	return static_cast<double>(sum) / (2 * total);
+}
+
+/**
+ * \brief Compute a quantile of a histogram
+ * \param[in] bins The histogram bin counters
+ * \param[in] q The quantile, in the [0, 1] range
+ *
+ * The samples are assumed to be uniformly distributed within each bin.
+ *
+ * \return The value below which the \a q fraction of the samples lie, expressed
+ * in bins in the [0, bins.size()] range, or 0 if the histogram is empty
+ */
+double Metering::histogramQuantile(Span<const uint16_t> bins, double q)
+{
+	uint64_t total = 0;
+	for (uint16_t bin : bins)
+		total += bin;
+
+	if (!total)
+		return 0.0;
+
+	double target = std::min(std::max(q, 0.0), 1.0) * total;
+	uint64_t cumulative = 0;
+
+	for (std::size_t i = 0; i < bins.size(); ++i) {
+		if (!bins[i] || cumulative + bins[i] < target) {
+			cumulative += bins[i];
+			continue;
+		}
+
+		return i + (target - cumulative) / bins[i];
+	}
+
+	return bins.size();
+}
+
+/**
+ * \class EvSmoother
+ * \brief Temporal smoothing of exposure values in the EV space
+ *
+ * Applying the exposure computed from each frame statistics directly leads to
+ * oscillations and visible steps. The EvSmoother low-pass filters the
+ * exposure in the logarithmic (EV) space, where a given change is perceived
+ * identically for dark and bright scenes: each update moves the exposure by a
+ * fixed fraction of the remaining distance to the target, measured in stops.
+ */
+
+/**
+ * \brief Construct an EvSmoother
+ * \param[in] speed The fraction of the distance to the target covered by each
+ * update, in the ]0, 1] range
+ */
+EvSmoother::EvSmoother(double speed)
+	: speed_(std::min(std::max(speed, 0.0), 1.0)), ev_(0.0), valid_(false)
+{
+}
+
+/**
+ * \brief Reset the smoother to \a value
+ * \param[in] value The exposure value, shall be strictly positive
+ */
+void EvSmoother::reset(double value)
+{
+	valid_ = value > 0.0;
+	ev_ = valid_ ? log2(value) : 0.0;
+}
+
+/**
+ * \brief Move the smoothed exposure towards \a target
+ * \param[in] target The target exposure value, shall be strictly positive
+ *
+ * The first update after construction jumps to the \a target directly.
+ * Non-positive targets are ignored.
+ *
+ * \return The smoothed exposure value
+ */
+double EvSmoother::update(double target)
+{
+	if (target <= 0.0)
+		return value();
+
+	if (!valid_) {
+		reset(target);
+		return target;
+	}
+
+	ev_ += speed_ * (log2(target) - ev_);
+	return value();
+}
+
+/**
+ * \brief Retrieve the smoothed exposure value
+ * \return The smoothed exposure value, or 0 if the smoother has not been
+ * initialized
+ */
+double EvSmoother::value() const
+{
+	return valid_ ? exp2(ev_) : 0.0;
+}
+
+} /* namespace libcamera */
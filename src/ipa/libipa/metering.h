@@ -0,0 +1,67 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * metering.h - Exposure metering helpers for IPAs
+ */
+#ifndef __LIBCAMERA_IPA_METERING_H__
+#define __LIBCAMERA_IPA_METERING_H__
+
+#include <stdint.h>
+#include <vector>
+
+#include <libcamera/span.h>
+
+namespace libcamera {
+
+class Metering
+{
+public:
+	enum Mode {
+		MeteringAverage,
+		MeteringCentreWeighted,
+		MeteringSpot,
+	};
+
+	Metering();
+
+	int configure(unsigned int width, unsigned int height, Mode mode);
+	void setThreshold(uint8_t threshold) { threshold_ = threshold; }
+
+	unsigned int width() const { return width_; }
+	unsigned int height() const { return height_; }
+	Mode mode() const { return mode_; }
+	uint8_t threshold() const { return threshold_; }
+
+	double mean(Span<const uint8_t> grid) const;
+
+	static double histogramMean(Span<const uint16_t> bins);
+	static double histogramQuantile(Span<const uint16_t> bins, double q);
+
+private:
+	unsigned int width_;
+	unsigned int height_;
+	Mode mode_;
+	uint8_t threshold_;
+
+	std::vector<uint16_t> weights_;
+};
+
+class EvSmoother
+{
+public:
+	EvSmoother(double speed);
+
+	void reset(double value);
+	double update(double target);
+	double value() const;
+
+private:
+	double speed_;
+	double ev_;
+	bool valid_;
+};
+
+} /* namespace libcamera */
+
+#endif /* __LIBCAMERA_IPA_METERING_H__ */
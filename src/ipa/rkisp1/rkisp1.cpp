@@ -6,11 +6,13 @@
  */
 
 #include <algorithm>
+#include <chrono>
 #include <math.h>
+#include <memory>
 #include <queue>
+#include <stddef.h>
 #include <stdint.h>
 #include <string.h>
-#include <sys/mman.h>
 
 #include <linux/rkisp1-config.h>
 
@@ -19,8 +21,11 @@
 #include <ipa/rkisp1.h>
 #include <libcamera/buffer.h>
 #include <libcamera/control_ids.h>
+#include <libcamera/mapped_framebuffer.h>
 #include <libcamera/request.h>
+#include <libipa/algorithm.h>
 #include <libipa/ipa_interface_wrapper.h>
+#include <libipa/metering.h>
 
 #include "log.h"
 #include "utils.h"
@@ -29,9 +34,272 @@ namespace libcamera {
 
 LOG_DEFINE_CATEGORY(IPARkISP1)
 
+/*
+ * Build ISP parameters buffers incrementally.
+ *
+ * The ISP parameters buffer contains the configuration of all ISP modules,
+ * but the driver only reprograms the modules flagged in module_en_update and
+ * module_cfg_update. The builder keeps a shadow copy of the configuration
+ * requested by the algorithms, and tracks the module enable states and
+ * configurations that have changed since the last buffer was filled. Only
+ * the header and the sections of the modules that changed are written to the
+ * buffer, the rest of the buffer is left untouched.
+ *
+ * This assumes that parameters buffers are applied by the driver in the order
+ * they are filled.
+ */
+class RkISP1Params
+{
+public:
+	RkISP1Params();
+
+	void reset();
+
+	void setEnabled(uint32_t module, bool enable);
+
+	template<typename T>
+	void setConfig(uint32_t module, const T &config)
+	{
+		setConfig(module, &config, sizeof(config));
+	}
+
+	void fill(rkisp1_isp_params_cfg *params);
+
+private:
+	struct Section {
+		uint32_t module;
+		size_t offset;
+		size_t size;
+	};
+
+	static const Section sections_[];
+
+	static const Section *section(uint32_t module);
+	void setConfig(uint32_t module, const void *config, size_t size);
+
+	rkisp1_isp_params_cfg shadow_;
+
+	uint32_t enabled_;
+	uint32_t enableManaged_;
+	uint32_t enableDirty_;
+
+	uint32_t configured_;
+	uint32_t configDirty_;
+};
+
+const RkISP1Params::Section RkISP1Params::sections_[] = {
+	{ CIFISP_MODULE_DPCC, offsetof(rkisp1_isp_params_cfg, others.dpcc_config), sizeof(cifisp_dpcc_config) },
+	{ CIFISP_MODULE_BLS, offsetof(rkisp1_isp_params_cfg, others.bls_config), sizeof(cifisp_bls_config) },
+	{ CIFISP_MODULE_SDG, offsetof(rkisp1_isp_params_cfg, others.sdg_config), sizeof(cifisp_sdg_config) },
+	{ CIFISP_MODULE_HST, offsetof(rkisp1_isp_params_cfg, meas.hst_config), sizeof(cifisp_hst_config) },
+	{ CIFISP_MODULE_LSC, offsetof(rkisp1_isp_params_cfg, others.lsc_config), sizeof(cifisp_lsc_config) },
+	{ CIFISP_MODULE_AWB_GAIN, offsetof(rkisp1_isp_params_cfg, others.awb_gain_config), sizeof(cifisp_awb_gain_config) },
+	{ CIFISP_MODULE_FLT, offsetof(rkisp1_isp_params_cfg, others.flt_config), sizeof(cifisp_flt_config) },
+	{ CIFISP_MODULE_BDM, offsetof(rkisp1_isp_params_cfg, others.bdm_config), sizeof(cifisp_bdm_config) },
+	{ CIFISP_MODULE_CTK, offsetof(rkisp1_isp_params_cfg, others.ctk_config), sizeof(cifisp_ctk_config) },
+	{ CIFISP_MODULE_GOC, offsetof(rkisp1_isp_params_cfg, others.goc_config), sizeof(cifisp_goc_config) },
+	{ CIFISP_MODULE_CPROC, offsetof(rkisp1_isp_params_cfg, others.cproc_config), sizeof(cifisp_cproc_config) },
+	{ CIFISP_MODULE_AFC, offsetof(rkisp1_isp_params_cfg, meas.afc_config), sizeof(cifisp_afc_config) },
+	{ CIFISP_MODULE_AWB, offsetof(rkisp1_isp_params_cfg, meas.awb_meas_config), sizeof(cifisp_awb_meas_config) },
+	{ CIFISP_MODULE_IE, offsetof(rkisp1_isp_params_cfg, others.ie_config), sizeof(cifisp_ie_config) },
+	{ CIFISP_MODULE_AEC, offsetof(rkisp1_isp_params_cfg, meas.aec_config), sizeof(cifisp_aec_config) },
+	{ CIFISP_MODULE_DPF, offsetof(rkisp1_isp_params_cfg, others.dpf_config), sizeof(cifisp_dpf_config) },
+	{ CIFISP_MODULE_DPF_STRENGTH, offsetof(rkisp1_isp_params_cfg, others.dpf_strength_config), sizeof(cifisp_dpf_strength_config) },
+};
+
+RkISP1Params::RkISP1Params()
+	: enabled_(0), enableManaged_(0), enableDirty_(0), configured_(0),
+	  configDirty_(0)
+{
+	memset(&shadow_, 0, sizeof(shadow_));
+}
+
+/*
+ * Resend all the module enable states and configurations with the next
+ * buffer, when the state of the ISP isn't known anymore.
+ */
+void RkISP1Params::reset()
+{
+	enableDirty_ = enableManaged_;
+	configDirty_ = configured_;
+}
+
+void RkISP1Params::setEnabled(uint32_t module, bool enable)
+{
+	uint32_t enabled = enable ? enabled_ | module : enabled_ & ~module;
+
+	if (!(enableManaged_ & module) || enabled != enabled_)
+		enableDirty_ |= module;
+
+	enableManaged_ |= module;
+	enabled_ = enabled;
+}
+
+void RkISP1Params::fill(rkisp1_isp_params_cfg *params)
+{
+	params->module_en_update = enableDirty_;
+	params->module_ens = enabled_;
+	params->module_cfg_update = configDirty_;
+
+	for (const Section &section : sections_) {
+		if (!(configDirty_ & section.module))
+			continue;
+
+		memcpy(reinterpret_cast<uint8_t *>(params) + section.offset,
+		       reinterpret_cast<const uint8_t *>(&shadow_) + section.offset,
+		       section.size);
+	}
+
+	enableDirty_ = 0;
+	configDirty_ = 0;
+}
+
+const RkISP1Params::Section *RkISP1Params::section(uint32_t module)
+{
+	for (const Section &section : sections_) {
+		if (section.module == module)
+			return &section;
+	}
+
+	return nullptr;
+}
+
+void RkISP1Params::setConfig(uint32_t module, const void *config, size_t size)
+{
+	const Section *section = RkISP1Params::section(module);
+	if (!section || section->size != size) {
+		LOG(IPARkISP1, Error)
+			<< "Invalid configuration for module " << module;
+		return;
+	}
+
+	uint8_t *data = reinterpret_cast<uint8_t *>(&shadow_) + section->offset;
+	if (!(configured_ & module) || memcmp(data, config, size)) {
+		memcpy(data, config, size);
+		configDirty_ |= module;
+	}
+
+	configured_ |= module;
+}
+
+/*
+ * Automatic gain control, computing the sensor exposure time and gain from
+ * the AE statistics.
+ */
+class RkISP1Agc : public Algorithm<RkISP1Params, rkisp1_stat_buffer>
+{
+public:
+	RkISP1Agc();
+
+	const char *name() const override { return "Agc"; }
+
+	void configure(uint32_t minExposure, uint32_t maxExposure,
+		       uint32_t minGain, uint32_t maxGain);
+	void setSensorControls(uint32_t exposure, uint32_t gain);
+	void process(unsigned int frame, const rkisp1_stat_buffer *stats) override;
+
+	uint32_t exposure() const { return exposure_; }
+	uint32_t gain() const { return gain_; }
+	unsigned int state() const { return state_; }
+	bool updated() const { return updated_; }
+
+private:
+	Metering metering_;
+	EvSmoother exposureSmoother_;
+
+	uint32_t exposure_;
+	uint32_t minExposure_;
+	uint32_t maxExposure_;
+	uint32_t gain_;
+	uint32_t minGain_;
+	uint32_t maxGain_;
+
+	unsigned int state_;
+	bool updated_;
+};
+
+RkISP1Agc::RkISP1Agc()
+	: exposureSmoother_(0.5), exposure_(0), minExposure_(0), maxExposure_(0),
+	  gain_(0), minGain_(0), maxGain_(0), state_(0), updated_(false)
+{
+	/* The AE statistics are a 5x5 grid, ignore the darkest blocks. */
+	metering_.configure(5, 5, Metering::MeteringAverage);
+	metering_.setThreshold(15);
+}
+
+void RkISP1Agc::configure(uint32_t minExposure, uint32_t maxExposure,
+			  uint32_t minGain, uint32_t maxGain)
+{
+	minExposure_ = minExposure;
+	maxExposure_ = maxExposure;
+	exposure_ = minExposure_;
+
+	minGain_ = minGain;
+	maxGain_ = maxGain;
+	gain_ = minGain_;
+
+	exposureSmoother_.reset(exposure_);
+}
+
+/*
+ * Update the exposure and gain with the values the sensor captured the frame
+ * with, for the next computation to start from the actual sensor state
+ * instead of the last values requested.
+ */
+void RkISP1Agc::setSensorControls(uint32_t exposure, uint32_t gain)
+{
+	exposure_ = utils::clamp(exposure, minExposure_, maxExposure_);
+	gain_ = utils::clamp(gain, minGain_, maxGain_);
+}
+
+void RkISP1Agc::process(unsigned int frame, const rkisp1_stat_buffer *stats)
+{
+	state_ = 0;
+	updated_ = false;
+
+	if (!(stats->meas_type & CIFISP_STAT_AUTOEXP))
+		return;
+
+	const cifisp_ae_stat *ae = &stats->params.ae;
+
+	const unsigned int target = 60;
+
+	double value = metering_.mean({ ae->exp_mean, CIFISP_AE_MEAN_MAX });
+	if (!value)
+		return;
+
+	double factor = target / value;
+
+	if (frame % 3 == 0) {
+		double exposure;
+
+		/*
+		 * Move the total exposure towards the target in the EV space
+		 * to avoid oscillations.
+		 */
+		exposure = exposureSmoother_.update(factor * exposure_ * gain_ / minGain_);
+		exposure_ = utils::clamp<uint64_t>((uint64_t)exposure,
+						   minExposure_, maxExposure_);
+
+		exposure = exposure / exposure_ * minGain_;
+		gain_ = utils::clamp<uint64_t>((uint64_t)exposure,
+					       minGain_, maxGain_);
+
+		/* Track the exposure actually applied. */
+		exposureSmoother_.reset(static_cast<double>(exposure_) * gain_ / minGain_);
+
+		updated_ = true;
+	}
+
+	state_ = fabs(factor - 1.0f) < 0.05f ? 2 : 1;
+}
+
 class IPARkISP1 : public IPAInterface
 {
 public:
+	IPARkISP1();
+	~IPARkISP1();
+
 	int init() override { return 0; }
 
 	void configure(const std::map<unsigned int, IPAStream> &streamConfig,
@@ -41,29 +309,48 @@ public:
 	void processEvent(const IPAOperationData &event) override;
 
 private:
-	void queueRequest(unsigned int frame, rkisp1_isp_params_cfg *params,
+	void queueRequest(unsigned int frame, const MappedFrameBuffer &buffer,
 			  const ControlList &controls);
 	void updateStatistics(unsigned int frame,
-			      const rkisp1_stat_buffer *stats);
+			      const rkisp1_stat_buffer *stats,
+			      const ControlList *sensorControls);
 
 	void setControls(unsigned int frame);
 	void metadataReady(unsigned int frame, unsigned int aeState);
 
 	std::map<unsigned int, FrameBuffer> buffers_;
-	std::map<unsigned int, void *> buffersMemory_;
+	std::map<unsigned int, MappedFrameBuffer> buffersMemory_;
 
 	ControlInfoMap ctrls_;
 
-	/* Camera sensor controls. */
 	bool autoExposure_;
-	uint32_t exposure_;
-	uint32_t minExposure_;
-	uint32_t maxExposure_;
-	uint32_t gain_;
-	uint32_t minGain_;
-	uint32_t maxGain_;
+	/* Whether the application wants the AE state of the current frame. */
+	bool reportAeState_;
+
+	RkISP1Params params_;
+
+	AlgorithmList<RkISP1Params, rkisp1_stat_buffer> algorithms_;
+	RkISP1Agc *agc_;
 };
 
+IPARkISP1::IPARkISP1()
+	: autoExposure_(false), reportAeState_(true)
+{
+	/*
+	 * The frame interval isn't known to the IPA, budget the algorithms
+	 * for 30fps.
+	 */
+	algorithms_.setBudget(std::chrono::milliseconds(33));
+
+	agc_ = new RkISP1Agc();
+	algorithms_.add(std::unique_ptr<RkISP1Agc>(agc_));
+}
+
+IPARkISP1::~IPARkISP1()
+{
+	LOG(IPARkISP1, Debug) << "Algorithms: " << algorithms_.report();
+}
+
 void IPARkISP1::configure(const std::map<unsigned int, IPAStream> &streamConfig,
 			  const std::map<unsigned int, const ControlInfoMap &> &entityControls)
 {
@@ -86,17 +373,18 @@ void IPARkISP1::configure(const std::map<unsigned int, IPAStream> &streamConfig,
 
 	autoExposure_ = true;
 
-	minExposure_ = std::max<uint32_t>(itExp->second.min().get<int32_t>(), 1);
-	maxExposure_ = itExp->second.max().get<int32_t>();
-	exposure_ = minExposure_;
+	uint32_t minExposure = std::max<uint32_t>(itExp->second.min().get<int32_t>(), 1);
+	uint32_t maxExposure = itExp->second.max().get<int32_t>();
+	uint32_t minGain = std::max<uint32_t>(itGain->second.min().get<int32_t>(), 1);
+	uint32_t maxGain = itGain->second.max().get<int32_t>();
 
-	minGain_ = std::max<uint32_t>(itGain->second.min().get<int32_t>(), 1);
-	maxGain_ = itGain->second.max().get<int32_t>();
-	gain_ = minGain_;
+	agc_->configure(minExposure, maxExposure, minGain, maxGain);
+
+	params_.reset();
 
 	LOG(IPARkISP1, Info)
-		<< "Exposure: " << minExposure_ << "-" << maxExposure_
-		<< " Gain: " << minGain_ << "-" << maxGain_;
+		<< "Exposure: " << minExposure << "-" << maxExposure
+		<< " Gain: " << minGain << "-" << maxGain;
 
 	setControls(0);
 }
@@ -109,22 +397,14 @@ void IPARkISP1::mapBuffers(const std::vector<IPABuffer> &buffers)
 					     std::forward_as_tuple(buffer.planes));
 		const FrameBuffer &fb = elem.first->second;
 
-		/*
-		 * \todo Provide a helper to mmap() buffers (possibly exposed
-		 * to applications).
-		 */
-		buffersMemory_[buffer.id] = mmap(NULL,
-						 fb.planes()[0].length,
-						 PROT_READ | PROT_WRITE,
-						 MAP_SHARED,
-						 fb.planes()[0].fd.fd(),
-						 0);
-
-		if (buffersMemory_[buffer.id] == MAP_FAILED) {
-			int ret = -errno;
+		auto mapped = buffersMemory_.emplace(std::piecewise_construct,
+						     std::forward_as_tuple(buffer.id),
+						     std::forward_as_tuple(&fb,
+									   MappedFrameBuffer::MapReadWrite));
+		const MappedFrameBuffer &memory = mapped.first->second;
+		if (!memory.isValid())
 			LOG(IPARkISP1, Fatal) << "Failed to mmap buffer: "
-					      << strerror(-ret);
-		}
+					      << strerror(-memory.error());
 	}
 }
 
@@ -135,7 +415,6 @@ void IPARkISP1::unmapBuffers(const std::vector<unsigned int> &ids)
 		if (fb == buffers_.end())
 			continue;
 
-		munmap(buffersMemory_[id], fb->second.planes()[0].length);
 		buffersMemory_.erase(id);
 		buffers_.erase(id);
 	}
@@ -145,23 +424,32 @@ void IPARkISP1::processEvent(const IPAOperationData &event)
 {
 	switch (event.operation) {
 	case RKISP1_IPA_EVENT_SIGNAL_STAT_BUFFER: {
-		unsigned int frame = event.data[0];
-		unsigned int bufferId = event.data[1];
+		RkISP1EventSignalStatBuffer stat;
+		if (stat.unpack(event)) {
+			LOG(IPARkISP1, Error) << "Invalid statistics event";
+			break;
+		}
+
+		reportAeState_ = stat.reportAeState;
 
+		const MappedFrameBuffer &mapped = buffersMemory_.at(stat.bufferId);
 		const rkisp1_stat_buffer *stats =
-			static_cast<rkisp1_stat_buffer *>(buffersMemory_[bufferId]);
+			reinterpret_cast<rkisp1_stat_buffer *>(mapped.planes()[0].data);
 
-		updateStatistics(frame, stats);
+		ScopedCpuAccess access(mapped.buffer()->planes()[0],
+				       MappedFrameBuffer::MapRead);
+		updateStatistics(stat.frame, stats, stat.sensorControls);
 		break;
 	}
 	case RKISP1_IPA_EVENT_QUEUE_REQUEST: {
-		unsigned int frame = event.data[0];
-		unsigned int bufferId = event.data[1];
-
-		rkisp1_isp_params_cfg *params =
-			static_cast<rkisp1_isp_params_cfg *>(buffersMemory_[bufferId]);
+		RkISP1EventQueueRequest request;
+		if (request.unpack(event)) {
+			LOG(IPARkISP1, Error) << "Invalid request event";
+			break;
+		}
 
-		queueRequest(frame, params, event.controls[0]);
+		queueRequest(request.frame, buffersMemory_.at(request.bufferId),
+			     *request.controls);
 		break;
 	}
 	default:
@@ -170,97 +458,77 @@ void IPARkISP1::processEvent(const IPAOperationData &event)
 	}
 }
 
-void IPARkISP1::queueRequest(unsigned int frame, rkisp1_isp_params_cfg *params,
+void IPARkISP1::queueRequest(unsigned int frame,
+			     const MappedFrameBuffer &buffer,
 			     const ControlList &controls)
 {
-	/* Prepare parameters buffer. */
-	memset(params, 0, sizeof(*params));
-
-	/* Auto Exposure on/off. */
-	if (controls.contains(controls::AeEnable)) {
-		autoExposure_ = controls.get(controls::AeEnable);
-		if (autoExposure_)
-			params->module_ens = CIFISP_MODULE_AEC;
+	rkisp1_isp_params_cfg *params =
+		reinterpret_cast<rkisp1_isp_params_cfg *>(buffer.planes()[0].data);
+
+	/*
+	 * Prepare parameters buffer. CPU access must be completed before
+	 * signalling the pipeline handler that the buffer is filled.
+	 */
+	{
+		ScopedCpuAccess access(buffer.buffer()->planes()[0],
+				       MappedFrameBuffer::MapWrite);
+
+		/* Auto Exposure on/off. */
+		if (controls.contains(controls::AeEnable)) {
+			autoExposure_ = controls.get(controls::AeEnable);
+			params_.setEnabled(CIFISP_MODULE_AEC, autoExposure_);
+		}
 
-		params->module_en_update = CIFISP_MODULE_AEC;
+		algorithms_.prepare(frame, &params_);
+		params_.fill(params);
 	}
 
-	IPAOperationData op;
-	op.operation = RKISP1_IPA_ACTION_PARAM_FILLED;
-
-	queueFrameAction.emit(frame, op);
+	queueFrameAction.emit(frame, RkISP1ActionParamFilled().pack());
 }
 
 void IPARkISP1::updateStatistics(unsigned int frame,
-				 const rkisp1_stat_buffer *stats)
+				 const rkisp1_stat_buffer *stats,
+				 const ControlList *sensorControls)
 {
-	const cifisp_stat *params = &stats->params;
-	unsigned int aeState = 0;
-
-	if (stats->meas_type & CIFISP_STAT_AUTOEXP) {
-		const cifisp_ae_stat *ae = &params->ae;
-
-		const unsigned int target = 60;
-
-		unsigned int value = 0;
-		unsigned int num = 0;
-		for (int i = 0; i < CIFISP_AE_MEAN_MAX; i++) {
-			if (ae->exp_mean[i] <= 15)
-				continue;
-
-			value += ae->exp_mean[i];
-			num++;
-		}
-		value /= num;
-
-		double factor = (double)target / value;
-
-		if (frame % 3 == 0) {
-			double exposure;
-
-			exposure = factor * exposure_ * gain_ / minGain_;
-			exposure_ = utils::clamp<uint64_t>((uint64_t)exposure,
-							   minExposure_,
-							   maxExposure_);
-
-			exposure = exposure / exposure_ * minGain_;
-			gain_ = utils::clamp<uint64_t>((uint64_t)exposure,
-						       minGain_, maxGain_);
-
-			setControls(frame + 1);
-		}
-
-		aeState = fabs(factor - 1.0f) < 0.05f ? 2 : 1;
-	}
-
-	metadataReady(frame, aeState);
+	/*
+	 * The pipeline handler reports the sensor controls in effect for the
+	 * frame the statistics have been computed on.
+	 */
+	if (autoExposure_ && sensorControls &&
+	    sensorControls->contains(V4L2_CID_EXPOSURE) &&
+	    sensorControls->contains(V4L2_CID_ANALOGUE_GAIN))
+		agc_->setSensorControls(sensorControls->get(V4L2_CID_EXPOSURE).get<int32_t>(),
+					sensorControls->get(V4L2_CID_ANALOGUE_GAIN).get<int32_t>());
+
+	algorithms_.process(frame, stats);
+
+	if (agc_->updated())
+		setControls(frame + 1);
+
+	metadataReady(frame, agc_->state());
 }
 
 void IPARkISP1::setControls(unsigned int frame)
 {
-	IPAOperationData op;
-	op.operation = RKISP1_IPA_ACTION_V4L2_SET;
-
 	ControlList ctrls(ctrls_);
-	ctrls.set(V4L2_CID_EXPOSURE, static_cast<int32_t>(exposure_));
-	ctrls.set(V4L2_CID_ANALOGUE_GAIN, static_cast<int32_t>(gain_));
-	op.controls.push_back(ctrls);
+	ctrls.set(V4L2_CID_EXPOSURE, static_cast<int32_t>(agc_->exposure()));
+	ctrls.set(V4L2_CID_ANALOGUE_GAIN, static_cast<int32_t>(agc_->gain()));
 
-	queueFrameAction.emit(frame, op);
+	RkISP1ActionV4L2Set action;
+	action.sensorControls = &ctrls;
+	queueFrameAction.emit(frame, action.pack());
 }
 
 void IPARkISP1::metadataReady(unsigned int frame, unsigned int aeState)
 {
 	ControlList ctrls(controls::controls);
 
-	if (aeState)
+	if (aeState && reportAeState_)
 		ctrls.set(controls::AeLocked, aeState == 2);
 
-	IPAOperationData op;
-	op.operation = RKISP1_IPA_ACTION_METADATA;
-	op.controls.push_back(ctrls);
-
-	queueFrameAction.emit(frame, op);
+	RkISP1ActionMetadata action;
+	action.metadata = &ctrls;
+	queueFrameAction.emit(frame, action.pack());
 }
 
 /*
@@ -0,0 +1,513 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * simple.cpp - Image Processing Algorithms for the simple pipeline
+ */
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <math.h>
+#include <memory>
+#include <stdint.h>
+
+#include <linux/v4l2-controls.h>
+
+#include <ipa/ipa_interface.h>
+#include <ipa/ipa_module_info.h>
+#include <ipa/simple.h>
+#include <libcamera/span.h>
+#include <libipa/algorithm.h>
+#include <libipa/ipa_interface_wrapper.h>
+#include <libipa/metering.h>
+
+#include "log.h"
+#include "utils.h"
+
+namespace libcamera {
+
+LOG_DEFINE_CATEGORY(IPASimple)
+
+namespace {
+
+/* Layout of the software ISP and YUV statistics grids. */
+constexpr unsigned int GridWidth = 16;
+constexpr unsigned int GridHeight = 12;
+constexpr unsigned int GridSize = GridWidth * GridHeight;
+constexpr unsigned int HistogramBins = 64;
+
+/*
+ * Black level of the sensor on a 16-bit scale. Sensor-specific values aren't
+ * known to the IPA, use the level implemented by most CSI-2 sensors.
+ */
+constexpr uint32_t BlackLevel = 4096;
+
+} /* namespace */
+
+struct SimpleParams {
+	uint32_t blackLevel;
+	std::array<double, 3> gains;
+};
+
+struct SimpleStats {
+	/*
+	 * Mean linear values of the red, green and blue pixels on a 16-bit
+	 * scale, without black level and white balance gains.
+	 */
+	std::array<double, 3> means;
+	Span<const uint8_t> luminance;
+	/* Histogram of the gamma-encoded luma, only available for YUV. */
+	Span<const uint32_t> histogram;
+};
+
+/*
+ * Automatic gain control, computing the sensor exposure time and gain from
+ * the linear luminance grid.
+ */
+class SimpleAgc : public Algorithm<SimpleParams, SimpleStats>
+{
+public:
+	SimpleAgc();
+
+	const char *name() const override { return "Agc"; }
+
+	void configure(uint32_t minExposure, uint32_t maxExposure,
+		       uint32_t minGain, uint32_t maxGain);
+	void process(unsigned int frame, const SimpleStats *stats) override;
+
+	uint32_t exposure() const { return exposure_; }
+	uint32_t gain() const { return gain_; }
+	bool updated() const { return updated_; }
+
+private:
+	Metering metering_;
+	EvSmoother exposureSmoother_;
+
+	uint32_t exposure_;
+	uint32_t minExposure_;
+	uint32_t maxExposure_;
+	uint32_t gain_;
+	uint32_t minGain_;
+	uint32_t maxGain_;
+
+	bool updated_;
+};
+
+SimpleAgc::SimpleAgc()
+	: exposureSmoother_(0.5), exposure_(0), minExposure_(0), maxExposure_(0),
+	  gain_(0), minGain_(0), maxGain_(0), updated_(false)
+{
+	metering_.configure(GridWidth, GridHeight, Metering::MeteringCentreWeighted);
+	metering_.setThreshold(4);
+}
+
+void SimpleAgc::configure(uint32_t minExposure, uint32_t maxExposure,
+			  uint32_t minGain, uint32_t maxGain)
+{
+	minExposure_ = minExposure;
+	maxExposure_ = maxExposure;
+	exposure_ = std::max(minExposure_, maxExposure_ / 2);
+
+	minGain_ = minGain;
+	maxGain_ = maxGain;
+	gain_ = minGain_;
+
+	exposureSmoother_.reset(exposure_);
+}
+
+void SimpleAgc::process(unsigned int frame, const SimpleStats *stats)
+{
+	/* Target a linear mid-grey, 18% of the full scale. */
+	const unsigned int target = 46;
+
+	updated_ = false;
+
+	double value = metering_.mean(stats->luminance);
+	if (!value)
+		return;
+
+	/*
+	 * The sensor controls take effect with a delay of a few frames, only
+	 * update them every third frame to avoid oscillations.
+	 */
+	if (frame % 3)
+		return;
+
+	double factor = target / value;
+
+	/*
+	 * Don't let the mean drive bright highlights into saturation, reduce
+	 * the exposure when more than 2% of the pixels are clipped.
+	 */
+	if (!stats->histogram.empty()) {
+		uint64_t total = 0;
+		for (uint32_t count : stats->histogram)
+			total += count;
+
+		uint64_t clipped = stats->histogram[HistogramBins - 1] +
+				   stats->histogram[HistogramBins - 2];
+		if (total && clipped * 50 > total)
+			factor = std::min(factor, 0.8);
+	}
+
+	if (fabs(factor - 1.0) < 0.05)
+		return;
+
+	double exposure = exposureSmoother_.update(factor * exposure_ * gain_ / minGain_);
+	exposure_ = utils::clamp<uint64_t>((uint64_t)exposure,
+					   minExposure_, maxExposure_);
+
+	exposure = exposure / exposure_ * minGain_;
+	gain_ = utils::clamp<uint64_t>((uint64_t)exposure, minGain_, maxGain_);
+
+	/* Track the exposure actually applied. */
+	exposureSmoother_.reset(static_cast<double>(exposure_) * gain_ / minGain_);
+
+	updated_ = true;
+}
+
+/*
+ * Grey world automatic white balance, computing the gains that equalize the
+ * means of the three colour channels.
+ */
+class SimpleAwb : public Algorithm<SimpleParams, SimpleStats>
+{
+public:
+	SimpleAwb();
+
+	const char *name() const override { return "Awb"; }
+	bool critical() const override { return false; }
+
+	void prepare(unsigned int frame, SimpleParams *params) override;
+	void process(unsigned int frame, const SimpleStats *stats) override;
+
+private:
+	std::array<double, 3> gains_;
+};
+
+SimpleAwb::SimpleAwb()
+	: gains_({ 1.0, 1.0, 1.0 })
+{
+}
+
+void SimpleAwb::prepare(unsigned int frame, SimpleParams *params)
+{
+	params->gains = gains_;
+}
+
+void SimpleAwb::process(unsigned int frame, const SimpleStats *stats)
+{
+	const std::array<double, 3> &means = stats->means;
+
+	/* Skip dark frames, the gains would be dominated by noise. */
+	if (means[0] < 256 || means[1] < 256 || means[2] < 256)
+		return;
+
+	/* Converge smoothly towards the gains of the current frame. */
+	for (unsigned int i : { 0U, 2U }) {
+		double gain = utils::clamp(means[1] / means[i], 0.25, 8.0);
+		gains_[i] += (gain - gains_[i]) * 0.2;
+	}
+}
+
+class IPASimple : public IPAInterface
+{
+public:
+	IPASimple();
+	~IPASimple();
+
+	int init() override { return 0; }
+
+	void configure(const std::map<unsigned int, IPAStream> &streamConfig,
+		       const std::map<unsigned int, const ControlInfoMap &> &entityControls) override;
+	void mapBuffers(const std::vector<IPABuffer> &buffers) override {}
+	void unmapBuffers(const std::vector<unsigned int> &ids) override {}
+	void processEvent(const IPAOperationData &event) override;
+
+private:
+	void processYuvStats(const IPAOperationData &event);
+	void updateStatistics(unsigned int frame, const SimpleStats *stats);
+
+	void setControls(unsigned int frame);
+	bool setParams(unsigned int frame);
+
+	ControlInfoMap ctrls_;
+
+	bool autoExposure_;
+	bool yuv_;
+	bool sensorBalance_;
+	std::array<int32_t, 2> balanceMin_;
+	std::array<int32_t, 2> balanceMax_;
+
+	SimpleParams params_;
+	SimpleParams applied_;
+
+	AlgorithmList<SimpleParams, SimpleStats> algorithms_;
+	SimpleAgc *agc_;
+};
+
+IPASimple::IPASimple()
+	: autoExposure_(false), yuv_(false), sensorBalance_(false)
+{
+	params_.blackLevel = BlackLevel;
+	params_.gains = { 1.0, 1.0, 1.0 };
+	applied_ = {};
+
+	algorithms_.setBudget(std::chrono::milliseconds(33));
+
+	agc_ = new SimpleAgc();
+	algorithms_.add(std::unique_ptr<SimpleAgc>(agc_));
+	algorithms_.add(std::make_unique<SimpleAwb>());
+}
+
+IPASimple::~IPASimple()
+{
+	LOG(IPASimple, Debug) << "Algorithms: " << algorithms_.report();
+}
+
+void IPASimple::configure(const std::map<unsigned int, IPAStream> &streamConfig,
+			  const std::map<unsigned int, const ControlInfoMap &> &entityControls)
+{
+	applied_ = {};
+	yuv_ = false;
+	setParams(0);
+
+	if (entityControls.empty())
+		return;
+
+	ctrls_ = entityControls.at(0);
+
+	/*
+	 * Sensors that output YUV apply the white balance themselves. Their
+	 * balance controls have no defined scale, the middle of the range is
+	 * taken as the unity gain, and the controls assumed to be linear.
+	 */
+	const auto itRed = ctrls_.find(V4L2_CID_RED_BALANCE);
+	const auto itBlue = ctrls_.find(V4L2_CID_BLUE_BALANCE);
+	sensorBalance_ = itRed != ctrls_.end() && itBlue != ctrls_.end();
+	if (sensorBalance_) {
+		balanceMin_ = { itRed->second.min().get<int32_t>(),
+				itBlue->second.min().get<int32_t>() };
+		balanceMax_ = { itRed->second.max().get<int32_t>(),
+				itBlue->second.max().get<int32_t>() };
+	}
+
+	const auto itExp = ctrls_.find(V4L2_CID_EXPOSURE);
+	const auto itGain = ctrls_.find(V4L2_CID_ANALOGUE_GAIN);
+	if (itExp == ctrls_.end() || itGain == ctrls_.end()) {
+		LOG(IPASimple, Warning)
+			<< "Sensor lacks exposure or gain control, disabling AE";
+		autoExposure_ = false;
+		return;
+	}
+
+	autoExposure_ = true;
+
+	uint32_t minExposure = std::max<uint32_t>(itExp->second.min().get<int32_t>(), 1);
+	uint32_t maxExposure = itExp->second.max().get<int32_t>();
+	uint32_t minGain = std::max<uint32_t>(itGain->second.min().get<int32_t>(), 1);
+	uint32_t maxGain = itGain->second.max().get<int32_t>();
+
+	agc_->configure(minExposure, maxExposure, minGain, maxGain);
+
+	LOG(IPASimple, Info)
+		<< "Exposure: " << minExposure << "-" << maxExposure
+		<< " Gain: " << minGain << "-" << maxGain;
+
+	setControls(0);
+}
+
+void IPASimple::processEvent(const IPAOperationData &event)
+{
+	switch (event.operation) {
+	case SIMPLE_IPA_EVENT_STATS: {
+		if (event.data.size() != 4 + GridWidth * GridHeight) {
+			LOG(IPASimple, Error) << "Invalid statistics";
+			break;
+		}
+
+		std::array<uint8_t, GridWidth * GridHeight> luminance;
+		std::copy(event.data.begin() + 4, event.data.end(),
+			  luminance.begin());
+
+		SimpleStats stats;
+		for (unsigned int i = 0; i < stats.means.size(); ++i)
+			stats.means[i] = static_cast<double>(event.data[i + 1]) - BlackLevel;
+		stats.luminance = luminance;
+
+		updateStatistics(event.data[0], &stats);
+		break;
+	}
+	case SIMPLE_IPA_EVENT_YUV_STATS:
+		processYuvStats(event);
+		break;
+	default:
+		LOG(IPASimple, Error) << "Unknown event " << event.operation;
+		break;
+	}
+}
+
+void IPASimple::processYuvStats(const IPAOperationData &event)
+{
+	if (event.data.size() != 1 + GridSize * 3 + HistogramBins) {
+		LOG(IPASimple, Error) << "Invalid YUV statistics";
+		return;
+	}
+
+	/* Linearize the gamma-encoded values, approximating sRGB. */
+	static const std::array<uint8_t, 256> linear = []() {
+		std::array<uint8_t, 256> table;
+		for (unsigned int i = 0; i < table.size(); ++i)
+			table[i] = lround(255.0 * pow(i / 255.0, 2.2));
+		return table;
+	}();
+
+	const uint32_t *y = &event.data[1];
+	const uint32_t *cb = y + GridSize;
+	const uint32_t *cr = cb + GridSize;
+
+	/*
+	 * Convert the zones to linear RGB with the BT.601 full range
+	 * encoding. Skip clipped zones whose colour isn't reliable.
+	 */
+	std::array<uint8_t, GridSize> luminance;
+	std::array<double, 3> sums = {};
+	unsigned int count = 0;
+
+	for (unsigned int i = 0; i < GridSize; ++i) {
+		luminance[i] = linear[y[i]];
+
+		if (y[i] >= 235)
+			continue;
+
+		double u = static_cast<double>(cb[i]) - 128;
+		double v = static_cast<double>(cr[i]) - 128;
+		double rgb[3] = {
+			y[i] + 1.402 * v,
+			y[i] - 0.344 * u - 0.714 * v,
+			y[i] + 1.772 * u,
+		};
+
+		for (unsigned int c = 0; c < 3; ++c)
+			sums[c] += linear[utils::clamp(lround(rgb[c]), 0L, 255L)];
+		count++;
+	}
+
+	/*
+	 * The frames have the white balance gains applied by the sensor
+	 * already, remove them to report the means the sensor captured.
+	 */
+	SimpleStats stats;
+	for (unsigned int c = 0; c < 3; ++c) {
+		double gain = sensorBalance_ ? applied_.gains[c] : 1.0;
+		stats.means[c] = count && gain ? sums[c] / count * 257 / gain : 0;
+	}
+	stats.luminance = luminance;
+	stats.histogram = { cr + GridSize, HistogramBins };
+
+	/* Start from the balance the means are corrected for. */
+	if (!yuv_) {
+		yuv_ = true;
+		if (sensorBalance_)
+			setControls(event.data[0] + 1);
+	}
+
+	updateStatistics(event.data[0], &stats);
+}
+
+void IPASimple::updateStatistics(unsigned int frame, const SimpleStats *stats)
+{
+	algorithms_.process(frame, stats);
+
+	/* Without an ISP, the white balance gains are applied by the sensor. */
+	bool balance = setParams(frame + 1) && yuv_;
+
+	if ((autoExposure_ && agc_->updated()) || balance)
+		setControls(frame + 1);
+}
+
+void IPASimple::setControls(unsigned int frame)
+{
+	IPAOperationData op;
+	op.operation = SIMPLE_IPA_ACTION_V4L2_SET;
+
+	ControlList ctrls(ctrls_);
+	if (autoExposure_) {
+		ctrls.set(V4L2_CID_EXPOSURE, static_cast<int32_t>(agc_->exposure()));
+		ctrls.set(V4L2_CID_ANALOGUE_GAIN, static_cast<int32_t>(agc_->gain()));
+	}
+
+	if (yuv_ && sensorBalance_) {
+		const unsigned int ids[] = { V4L2_CID_RED_BALANCE, V4L2_CID_BLUE_BALANCE };
+		const double gains[] = { applied_.gains[0], applied_.gains[2] };
+
+		for (unsigned int i = 0; i < 2; ++i) {
+			double unity = (balanceMin_[i] + balanceMax_[i]) / 2.0;
+			int32_t value = utils::clamp<int32_t>(lround(unity * gains[i]),
+							      balanceMin_[i], balanceMax_[i]);
+			ctrls.set(ids[i], value);
+		}
+	}
+
+	if (ctrls.empty())
+		return;
+
+	op.controls.push_back(ctrls);
+
+	queueFrameAction.emit(frame, op);
+}
+
+bool IPASimple::setParams(unsigned int frame)
+{
+	/* YUV frames can only be white balanced by the sensor. */
+	if (yuv_ && !sensorBalance_)
+		return false;
+
+	algorithms_.prepare(frame, &params_);
+
+	/* Only send the parameters when they change noticeably. */
+	bool changed = params_.blackLevel != applied_.blackLevel;
+	for (unsigned int i = 0; i < params_.gains.size(); ++i)
+		changed |= fabs(params_.gains[i] - applied_.gains[i]) >= 1.0 / 256;
+
+	if (!changed)
+		return false;
+
+	applied_ = params_;
+
+	if (yuv_)
+		return true;
+
+	IPAOperationData op;
+	op.operation = SIMPLE_IPA_ACTION_ISP_PARAMS;
+	op.data = { params_.blackLevel,
+		    static_cast<uint32_t>(params_.gains[0] * 256 + 0.5),
+		    static_cast<uint32_t>(params_.gains[1] * 256 + 0.5),
+		    static_cast<uint32_t>(params_.gains[2] * 256 + 0.5) };
+
+	queueFrameAction.emit(frame, op);
+
+	return true;
+}
+
+/*
+ * External IPA module interface
+ */
+
+extern "C" {
+const struct IPAModuleInfo ipaModuleInfo = {
+	IPA_MODULE_API_VERSION,
+	1,
+	"PipelineHandlerSimple",
+	"Simple pipeline IPA",
+	"LGPL-2.1-or-later",
+};
+
+struct ipa_context *ipaCreate()
+{
+	return new IPAInterfaceWrapper(std::make_unique<IPASimple>());
+}
+}
+
+} /* namespace libcamera */
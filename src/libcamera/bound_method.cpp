@@ -7,6 +7,13 @@
 
 #include <libcamera/bound_method.h>
 
+#include <array>
+#include <atomic>
+#include <new>
+#include <stdint.h>
+#include <stdlib.h>
+#include <vector>
+
 #include "message.h"
 #include "semaphore.h"
 #include "thread.h"
@@ -18,6 +25,259 @@
 
 namespace libcamera {
 
+namespace {
+
+class Pool;
+
+/*
+ * Every block starts with a header that records the pool it belongs to and its
+ * size class. The header size preserves the fundamental alignment of the
+ * payload.
+ */
+struct alignas(alignof(max_align_t)) BlockHeader {
+	Pool *pool;
+	unsigned int sizeClass;
+};
+
+struct FreeBlock {
+	FreeBlock *next;
+};
+
+class Pool
+{
+public:
+	static constexpr unsigned int NumSizeClasses = 4;
+	static constexpr std::size_t MinBlockSize = 64;
+	static constexpr unsigned int Unpooled = NumSizeClasses;
+
+	Pool()
+	{
+		for (unsigned int i = 0; i < NumSizeClasses; ++i) {
+			local_[i] = nullptr;
+			remote_[i] = nullptr;
+		}
+	}
+
+	static unsigned int sizeClass(std::size_t size)
+	{
+		std::size_t blockSize = MinBlockSize;
+
+		for (unsigned int i = 0; i < NumSizeClasses; ++i) {
+			if (size <= blockSize)
+				return i;
+			blockSize <<= 1;
+		}
+
+		return Unpooled;
+	}
+
+	static std::size_t blockSize(unsigned int sizeClass)
+	{
+		return MinBlockSize << sizeClass;
+	}
+
+	void *allocate(unsigned int sizeClass);
+	void release(BlockHeader *header, bool owner);
+
+private:
+	/* Blocks freed by the thread owning the pool. */
+	std::array<FreeBlock *, NumSizeClasses> local_;
+	/* Blocks freed by other threads, pushed locklessly. */
+	std::array<std::atomic<FreeBlock *>, NumSizeClasses> remote_;
+};
+
+void *Pool::allocate(unsigned int sizeClass)
+{
+	FreeBlock *block = local_[sizeClass];
+	if (!block)
+		block = remote_[sizeClass].exchange(nullptr, std::memory_order_acquire);
+
+	if (block) {
+		local_[sizeClass] = block->next;
+		return block;
+	}
+
+	BlockHeader *header = static_cast<BlockHeader *>(
+		malloc(sizeof(BlockHeader) + blockSize(sizeClass)));
+	if (!header)
+		return nullptr;
+
+	header->pool = this;
+	header->sizeClass = sizeClass;
+
+	return header + 1;
+}
+
+void Pool::release(BlockHeader *header, bool owner)
+{
+	FreeBlock *block = reinterpret_cast<FreeBlock *>(header + 1);
+	unsigned int sizeClass = header->sizeClass;
+
+	if (owner) {
+		block->next = local_[sizeClass];
+		local_[sizeClass] = block;
+		return;
+	}
+
+	std::atomic<FreeBlock *> &head = remote_[sizeClass];
+	block->next = head.load(std::memory_order_relaxed);
+	while (!head.compare_exchange_weak(block->next, block,
+					   std::memory_order_release,
+					   std::memory_order_relaxed));
+}
+
+/*
+ * Pools are never freed, as blocks may outlive the thread that allocated them.
+ * When a thread exits its pool is recycled for the next thread that needs one.
+ * The registry is accessed through a leaked pointer to remain usable from
+ * static destructors.
+ */
+class PoolRegistry
+{
+public:
+	static PoolRegistry *instance()
+	{
+		static PoolRegistry *registry = new PoolRegistry();
+		return registry;
+	}
+
+	Pool *acquire()
+	{
+		MutexLocker locker(mutex_);
+
+		if (idle_.empty())
+			return new Pool();
+
+		Pool *pool = idle_.back();
+		idle_.pop_back();
+		return pool;
+	}
+
+	void recycle(Pool *pool)
+	{
+		MutexLocker locker(mutex_);
+		idle_.push_back(pool);
+	}
+
+private:
+	Mutex mutex_;
+	std::vector<Pool *> idle_;
+};
+
+/*
+ * The current thread's pool is stored in a trivially destructible thread-local
+ * variable that remains accessible during thread teardown. The ThreadPool
+ * instance recycles the pool when the thread exits.
+ */
+thread_local Pool *currentPool = nullptr;
+thread_local bool poolReleased = false;
+
+struct ThreadPool {
+	ThreadPool()
+	{
+		currentPool = PoolRegistry::instance()->acquire();
+	}
+
+	~ThreadPool()
+	{
+		PoolRegistry::instance()->recycle(currentPool);
+		currentPool = nullptr;
+		poolReleased = true;
+	}
+};
+
+Pool *threadPool()
+{
+	if (!currentPool && !poolReleased) {
+		thread_local ThreadPool threadPool;
+	}
+
+	return currentPool;
+}
+
+} /* namespace */
+
+/**
+ * \class MessagePool
+ * \brief Per-thread memory pool for method invocations and messages
+ *
+ * Queued method invocations allocate a message, an arguments pack and, for
+ * Object::invokeMethod(), a bound method for every call. To avoid hitting the
+ * system allocator on hot paths, those objects are allocated from a per-thread
+ * pool of fixed-size blocks.
+ *
+ * Blocks are allocated from the pool of the calling thread, and are returned
+ * to the pool they have been allocated from when released, regardless of the
+ * releasing thread. Blocks released by a different thread are returned
+ * without taking any lock and reused by the owning thread when its own free
+ * list runs out. Once a pool has grown to accommodate the number of messages
+ * in flight, invocations don't allocate any memory anymore.
+ *
+ * Requests larger than the largest block size are forwarded to malloc().
+ */
+
+/**
+ * \brief Allocate memory from the current thread's pool
+ * \param[in] size The allocation size in bytes
+ *
+ * \return A pointer to the allocated memory, aligned to the fundamental
+ * alignment
+ * \throw std::bad_alloc if memory can't be allocated
+ */
+void *MessagePool::allocate(std::size_t size)
+{
+	unsigned int sizeClass = Pool::sizeClass(size);
+	Pool *pool = sizeClass != Pool::Unpooled ? threadPool() : nullptr;
+	void *ptr;
+
+	if (pool) {
+		ptr = pool->allocate(sizeClass);
+	} else {
+		BlockHeader *header = static_cast<BlockHeader *>(
+			malloc(sizeof(BlockHeader) + size));
+		if (header) {
+			header->pool = nullptr;
+			header->sizeClass = Pool::Unpooled;
+		}
+		ptr = header ? header + 1 : nullptr;
+	}
+
+	if (!ptr)
+		throw std::bad_alloc();
+
+	return ptr;
+}
+
+/**
+ * \brief Release memory allocated by allocate()
+ * \param[in] ptr The memory to release, may be nullptr
+ *
+ * The memory is returned to the pool it has been allocated from. This function
+ * may be called from any thread.
+ */
+void MessagePool::release(void *ptr)
+{
+	if (!ptr)
+		return;
+
+	BlockHeader *header = static_cast<BlockHeader *>(ptr) - 1;
+	if (!header->pool) {
+		free(header);
+		return;
+	}
+
+	header->pool->release(header, header->pool == currentPool);
+}
+
+/**
+ * \class MessagePoolAllocator
+ * \brief Standard allocator backed by the MessagePool
+ * \tparam T The type of the allocated objects
+ *
+ * This allocator is used with std::allocate_shared() to store the arguments
+ * pack of a method invocation and its reference count in a single pool block.
+ */
+
 /**
  * \enum ConnectionType
  * \brief Connection type for asynchronous communication
@@ -48,6 +308,43 @@ namespace libcamera {
  * ConnectionTypeDirect. Otherwise, the receiver is invoked asynchronously in
  * its thread when control returns to the thread's event loop. The sender
  * blocks until the receiver signals the completion of the invocation.
+ *
+ * \var ConnectionType::ConnectionTypeConflated
+ * \brief The receiver is invoked asynchronously with the latest arguments only
+ *
+ * Invoke the receiver asynchronously in its thread as for
+ * ConnectionTypeQueued, but keep at most one invocation pending per slot. If an
+ * invocation for the same slot hasn't been delivered yet, its arguments are
+ * replaced with the new ones instead of queuing a new invocation. This bounds
+ * the receiver's queue depth for signals emitted at a high rate when only the
+ * most recent value matters.
+ *
+ * Conflation applies to a bound slot, and thus to signal connections.
+ * Object::invokeMethod() binds a new method for every call, its conflated
+ * invocations behave as ConnectionTypeQueued.
+ */
+
+/**
+ * \enum MessagePriority
+ * \brief Dispatch priority of asynchronous invocations
+ *
+ * Messages posted to a thread are dispatched in FIFO order within a priority
+ * level, and messages of a higher priority are dispatched ahead of all
+ * pending messages of lower priorities. The priority applies to invocations
+ * queued by Signal::emit() and Object::invokeMethod(), and is ignored for
+ * direct invocations.
+ *
+ * Raising the priority reorders invocations with respect to other invocations
+ * of lower priority, including those targeting the same receiver. It shall
+ * thus only be used for invocations that don't depend on the completion of
+ * earlier, lower priority ones.
+ *
+ * \var MessagePriority::MessagePriorityNormal
+ * \brief Default priority, for bulk work
+ *
+ * \var MessagePriority::MessagePriorityRealtime
+ * \brief Priority for latency-sensitive work, such as buffer and request
+ * completion
  */
 
 /**
@@ -90,6 +387,22 @@ bool BoundMethodBase::activatePack(std::shared_ptr<BoundMethodPackBase> pack,
 	case ConnectionTypeQueued: {
 		std::unique_ptr<Message> msg =
 			std::make_unique<InvokeMessage>(this, pack, nullptr, deleteMethod);
+		msg->setPriority(priority_);
+		object_->postMessage(std::move(msg));
+		return false;
+	}
+
+	case ConnectionTypeConflated: {
+		/*
+		 * If a message is already pending, it will pick up the new
+		 * arguments when delivered.
+		 */
+		if (std::atomic_exchange(&conflatedPack_, pack))
+			return false;
+
+		std::unique_ptr<Message> msg =
+			std::make_unique<InvokeMessage>(this, nullptr, nullptr, deleteMethod);
+		msg->setPriority(priority_);
 		object_->postMessage(std::move(msg));
 		return false;
 	}
@@ -99,6 +412,7 @@ bool BoundMethodBase::activatePack(std::shared_ptr<BoundMethodPackBase> pack,
 
 		std::unique_ptr<Message> msg =
 			std::make_unique<InvokeMessage>(this, pack, &semaphore, deleteMethod);
+		msg->setPriority(priority_);
 		object_->postMessage(std::move(msg));
 
 		semaphore.acquire();
@@ -44,6 +44,11 @@ LOG_DEFINE_CATEGORY(Buffer)
  * \var FrameMetadata::FrameCancelled
  * Capture stopped before the frame completed. The frame data is not valid. All
  * fields of the FrameMetadata structure but the status field are invalid.
+ * \var FrameMetadata::FrameSkipped
+ * The frame has been skipped as a result of the stream decimation, see
+ * StreamConfiguration::decimation. The frame data is not valid. The sequence
+ * and timestamp fields of the FrameMetadata structure identify the skipped
+ * frame, the other fields are invalid.
  */
 
 /**
@@ -92,8 +97,23 @@ LOG_DEFINE_CATEGORY(Buffer)
  */
 
 /**
- * \var FrameMetadata::planes
- * \brief Array of per-plane metadata
+ * \var FrameMaxPlanes
+ * \brief The maximum number of planes in a frame
+ */
+
+/**
+ * \fn FrameMetadata::planes()
+ * \brief Retrieve the array of per-plane metadata
+ *
+ * The per-plane metadata is stored inline in the FrameMetadata, updating it
+ * doesn't allocate memory.
+ *
+ * \return The array of per-plane metadata
+ */
+
+/**
+ * \fn FrameMetadata::planes() const
+ * \copydoc FrameMetadata::planes()
  */
 
 /**
@@ -107,7 +127,9 @@ LOG_DEFINE_CATEGORY(Buffer)
  *
  * The static information describes the memory planes that make a frame. The
  * planes are specified when creating the FrameBuffer and are expressed as a set
- * of dmabuf file descriptors and length.
+ * of dmabuf file descriptors and length. Alternatively, the planes can wrap
+ * memory allocated by the application in its address space, for consumers
+ * that can't use dmabufs.
  *
  * The dynamic information is grouped in a FrameMetadata instance. It is updated
  * during the processing of a queued capture request, and is valid from the
@@ -136,6 +158,13 @@ LOG_DEFINE_CATEGORY(Buffer)
  * memory to the CPU, but applications and IPAs may use the dmabuf file
  * descriptors to map the plane memory with mmap() and access its contents.
  *
+ * Planes can instead describe memory allocated by the application in its own
+ * address space, by setting the address field and leaving the file descriptor
+ * invalid. Such user pointer planes can only be captured to by pipeline
+ * handlers that support it, for streams configured with
+ * FrameBuffer::MemoryUserPtr. The memory shall be page-aligned, and shall stay
+ * valid for the whole lifetime of the FrameBuffer.
+ *
  * \todo Once we have a Kernel API which can express offsets within a plane
  * this structure shall be extended to contain this information. See commit
  * 83148ce8be55e for initial documentation of this feature.
@@ -151,14 +180,80 @@ LOG_DEFINE_CATEGORY(Buffer)
  * \brief The plane length in bytes
  */
 
+/**
+ * \var FrameBuffer::Plane::address
+ * \brief The address of the plane memory in the application address space
+ *
+ * The address is null for planes backed by a dmabuf.
+ */
+
+/**
+ * \enum FrameBuffer::Memory
+ * \brief The type of memory backing the frame buffer planes
+ * \var FrameBuffer::MemoryDmaBuf
+ * The planes are backed by dmabufs
+ * \var FrameBuffer::MemoryUserPtr
+ * The planes are backed by application memory identified by its address
+ * \var FrameBuffer::MemoryMmap
+ * The planes are backed by memory owned by a video device and mapped in the
+ * process address space, without any dmabuf. Such buffers are only used
+ * internally by pipeline handlers, and can't be shared with other devices
+ */
+
+/**
+ * \enum FrameBuffer::CpuAccess
+ * \brief The CPU access pattern of frame buffers
+ *
+ * Frame buffers are written and read by devices through DMA. When the CPU
+ * accesses the buffer memory as well, the CPU caches need to be cleaned before
+ * the device accesses the memory, and invalidated before the CPU reads data
+ * written by the device. Buffers that are never accessed by the CPU, or only
+ * in one direction, can skip the corresponding cache maintenance operations.
+ *
+ * \var FrameBuffer::CpuAccessNone
+ * The buffer memory is never accessed by the CPU
+ * \var FrameBuffer::CpuAccessRead
+ * The CPU reads the buffer memory, but never writes it
+ * \var FrameBuffer::CpuAccessWrite
+ * The CPU writes the buffer memory, but never reads it
+ * \var FrameBuffer::CpuAccessReadWrite
+ * The CPU reads and writes the buffer memory
+ */
+
 /**
  * \brief Construct a FrameBuffer with an array of planes
  * \param[in] planes The frame memory planes
  * \param[in] cookie Cookie
+ *
+ * The planes are copied to storage internal to the FrameBuffer. At most
+ * FrameMaxPlanes planes are supported, additional planes are ignored.
+ *
+ * All planes shall be backed by the same type of memory, either dmabufs or
+ * user pointers. The memory type of the buffer is set from the first plane.
  */
 FrameBuffer::FrameBuffer(const std::vector<Plane> &planes, unsigned int cookie)
-	: planes_(planes), request_(nullptr), cookie_(cookie)
+	: numPlanes_(0), memory_(MemoryDmaBuf), request_(nullptr),
+	  cookie_(cookie)
+{
+	if (!planes.empty() && planes[0].address)
+		memory_ = MemoryUserPtr;
+
+	if (planes.size() > FrameMaxPlanes)
+		LOG(Buffer, Error)
+			<< "Too many planes (" << planes.size() << "), keeping "
+			<< FrameMaxPlanes;
+
+	for (const Plane &plane : planes) {
+		if (numPlanes_ == FrameMaxPlanes)
+			break;
+
+		planes_[numPlanes_++] = plane;
+	}
+}
+
+FrameBuffer::~FrameBuffer()
 {
+	destroyed.emit(this);
 }
 
 /**
@@ -167,6 +262,12 @@ FrameBuffer::FrameBuffer(const std::vector<Plane> &planes, unsigned int cookie)
  * \return Array of plane descriptors
  */
 
+/**
+ * \fn FrameBuffer::memory()
+ * \brief Retrieve the type of memory backing the buffer planes
+ * \return The buffer memory type
+ */
+
 /**
  * \fn FrameBuffer::request()
  * \brief Retrieve the request this buffer belongs to
@@ -211,4 +312,14 @@ FrameBuffer::FrameBuffer(const std::vector<Plane> &planes, unsigned int cookie)
  * core never modifies the buffer cookie.
  */
 
+/**
+ * \var FrameBuffer::destroyed
+ * \brief Signal emitted when the buffer is being destroyed
+ *
+ * This signal is emitted from the FrameBuffer destructor, to let components
+ * that store data associated with the buffer, such as CPU mappings, release
+ * it. The signal is emitted in the thread that destroys the buffer. Slots
+ * shall not access the buffer beyond using its address as a key.
+ */
+
 } /* namespace libcamera */
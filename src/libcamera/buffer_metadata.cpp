@@ -0,0 +1,52 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * buffer_metadata.cpp - Frame buffer metadata update helpers
+ */
+
+#include "buffer_metadata.h"
+
+#include <algorithm>
+
+/**
+ * \file buffer_metadata.h
+ * \brief Frame buffer metadata update helpers
+ */
+
+namespace libcamera {
+
+/**
+ * \class BufferMetadata
+ * \brief Update the metadata of frame buffers
+ *
+ * The FrameMetadata of a FrameBuffer is read-only for applications. Pipeline
+ * handlers and helpers that complete buffers without a V4L2VideoDevice fill a
+ * FrameMetadata instance and copy it to the buffer with this class, instead of
+ * accessing the FrameBuffer internals directly.
+ */
+
+/**
+ * \brief Copy metadata to a frame buffer
+ * \param[in] buffer The frame buffer
+ * \param[in] metadata The metadata to copy, including the planes
+ */
+void BufferMetadata::copy(FrameBuffer *buffer, const FrameMetadata &metadata)
+{
+	buffer->metadata_ = metadata;
+}
+
+/**
+ * \brief Set the number of planes of frame metadata
+ * \param[in] metadata The frame metadata
+ * \param[in] numPlanes The number of planes
+ *
+ * The number of planes is capped to FrameMaxPlanes. The bytesused value of
+ * the planes can then be set through FrameMetadata::planes().
+ */
+void BufferMetadata::setNumPlanes(FrameMetadata *metadata, unsigned int numPlanes)
+{
+	metadata->numPlanes_ = std::min(numPlanes, FrameMaxPlanes);
+}
+
+} /* namespace libcamera */
@@ -232,6 +232,33 @@ int ByteStreamBuffer::skip(size_t size)
  * \retval -ENOSPC no more space is available in the managed memory buffer
  */
 
+/**
+ * \fn template<typename T> int ByteStreamBuffer::read(const Span<T> &data)
+ * \brief Read data from the managed memory buffer into a Span
+ * \param[out] data Span representing the destination memory
+ * \return 0 on success, a negative error code otherwise
+ * \retval -EACCES attempting to read from a write buffer
+ * \retval -ENOSPC no more space is available in the managed memory buffer
+ */
+
+/**
+ * \fn template<typename T> const T *ByteStreamBuffer::read(size_t count)
+ * \brief Read data in place from the managed memory buffer
+ * \param[in] count Number of data to read
+ *
+ * This method returns a pointer to \a count objects of type \a T stored in
+ * the memory buffer at the current location, and advances the location past
+ * them. Unlike the other read() methods, the data isn't copied, the returned
+ * pointer references the memory buffer directly and is valid as long as the
+ * memory buffer is.
+ *
+ * The data shall be suitably aligned in the memory buffer for type \a T.
+ * Reading misaligned data is treated as an error.
+ *
+ * \return A pointer to the data if they have been read successfully, or a
+ * null pointer otherwise
+ */
+
 /**
  * \fn template<typename T> int ByteStreamBuffer::write(const T *t)
  * \brief Write \a data of \a size to the managed memory buffer
@@ -241,6 +268,34 @@ int ByteStreamBuffer::skip(size_t size)
  * \retval -ENOSPC no more space is available in the managed memory buffer
  */
 
+/**
+ * \fn template<typename T> int ByteStreamBuffer::write(const Span<T> &data)
+ * \brief Write data from a Span to the managed memory buffer
+ * \param[in] data The data to write to memory
+ * \return 0 on success, a negative error code otherwise
+ * \retval -EACCES attempting to write to a read buffer
+ * \retval -ENOSPC no more space is available in the managed memory buffer
+ */
+
+/**
+ * \fn template<typename T> T *ByteStreamBuffer::reserve(size_t count)
+ * \brief Reserve memory to write data in place in the managed memory buffer
+ * \param[in] count Number of data to reserve
+ *
+ * This method returns a pointer to memory for \a count objects of type \a T
+ * in the memory buffer at the current location, and advances the location past
+ * them. The bounds are checked once for all the data, which the caller then
+ * writes directly to the returned memory. This is more efficient than multiple
+ * write() calls when serializing structures made of many fields.
+ *
+ * The current location shall be suitably aligned for type \a T. Reserving
+ * misaligned memory is treated as an error. Reserving memory for uint8_t has
+ * no alignment constraint.
+ *
+ * \return A pointer to the reserved memory, or a null pointer if the memory
+ * can't be reserved
+ */
+
 int ByteStreamBuffer::read(uint8_t *data, size_t size)
 {
 	if (!read_)
@@ -262,6 +317,34 @@ int ByteStreamBuffer::read(uint8_t *data, size_t size)
 	return 0;
 }
 
+const uint8_t *ByteStreamBuffer::read(size_t size, size_t align, size_t count)
+{
+	if (!read_)
+		return nullptr;
+
+	if (overflow_)
+		return nullptr;
+
+	if (reinterpret_cast<uintptr_t>(read_) % align) {
+		LOG(Serialization, Error)
+			<< "Unable to read misaligned data in place";
+		return nullptr;
+	}
+
+	if (count > (base_ + size_ - read_) / size) {
+		LOG(Serialization, Error)
+			<< "Unable to read " << size * count
+			<< " bytes in place: out of bounds";
+		setOverflow();
+		return nullptr;
+	}
+
+	const uint8_t *data = read_;
+	read_ += size * count;
+
+	return data;
+}
+
 int ByteStreamBuffer::write(const uint8_t *data, size_t size)
 {
 	if (!write_)
@@ -283,4 +366,32 @@ int ByteStreamBuffer::write(const uint8_t *data, size_t size)
 	return 0;
 }
 
+uint8_t *ByteStreamBuffer::reserve(size_t size, size_t align, size_t count)
+{
+	if (!write_)
+		return nullptr;
+
+	if (overflow_)
+		return nullptr;
+
+	if (reinterpret_cast<uintptr_t>(write_) % align) {
+		LOG(Serialization, Error)
+			<< "Unable to reserve misaligned data";
+		return nullptr;
+	}
+
+	if (count > (base_ + size_ - write_) / size) {
+		LOG(Serialization, Error)
+			<< "Unable to reserve " << size * count
+			<< " bytes: no space left";
+		setOverflow();
+		return nullptr;
+	}
+
+	uint8_t *data = write_;
+	write_ += size * count;
+
+	return data;
+}
+
 } /* namespace libcamera */
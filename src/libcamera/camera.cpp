@@ -7,14 +7,23 @@
 
 #include <libcamera/camera.h>
 
+#include <algorithm>
+#include <atomic>
 #include <iomanip>
+#include <mutex>
+#include <unordered_map>
 
+#include <libcamera/buffer.h>
 #include <libcamera/framebuffer_allocator.h>
 #include <libcamera/request.h>
 #include <libcamera/stream.h>
 
+#include "camera_controls.h"
+#include "cpu_accounting.h"
 #include "log.h"
 #include "pipeline_handler.h"
+#include "thread.h"
+#include "tracer.h"
 #include "utils.h"
 
 /**
@@ -92,7 +101,7 @@ LOG_DECLARE_CATEGORY(Camera)
  * \brief Create an empty camera configuration
  */
 CameraConfiguration::CameraConfiguration()
-	: config_({})
+	: minFrameDuration(0), maxFrameDuration(0), config_({})
 {
 }
 
@@ -134,6 +143,11 @@ void CameraConfiguration::addConfiguration(const StreamConfiguration &cfg)
  * configuration carefully.
  * \retval CameraConfiguration::Valid The configuration was already valid and
  * hasn't been adjusted.
+ *
+ * Pipeline handlers also report the timings the configuration achieves in
+ * minFrameDuration, maxFrameDuration and StreamConfiguration::stallDuration,
+ * which allows applications to compare configurations without configuring the
+ * camera.
  */
 
 /**
@@ -249,11 +263,301 @@ std::size_t CameraConfiguration::size() const
 	return config_.size();
 }
 
+/**
+ * \var CameraConfiguration::minFrameDuration
+ * \brief The minimum frame duration achievable with the configuration
+ *
+ * The minimum frame duration, in nanoseconds, is set by validate() from the
+ * timings of the sensor mode selected for the configuration and the throughput
+ * limits of the processing hardware. It is 0 if the pipeline handler can't
+ * estimate it.
+ */
+
+/**
+ * \var CameraConfiguration::maxFrameDuration
+ * \brief The maximum frame duration achievable with the configuration
+ *
+ * The maximum frame duration, in nanoseconds, is set by validate() from the
+ * timings of the sensor mode selected for the configuration. It is 0 if the
+ * pipeline handler can't estimate it.
+ */
+
 /**
  * \var CameraConfiguration::config_
  * \brief The vector of stream configurations
  */
 
+/**
+ * \class CameraStatistics
+ * \brief Frame and request statistics of a camera
+ *
+ * The CameraStatistics class is a snapshot of the counters a camera maintains
+ * while running, retrieved with Camera::statistics(). The counters are reset
+ * when the camera is started.
+ *
+ * Frames are accounted for based on the sequence number of the buffers of
+ * completed requests. A gap in the sequence numbers reveals frames captured
+ * by the device but not delivered. They are reported as dropped for lack of
+ * requests if the camera ran out of queued requests before the gap, and as
+ * dropped in the kernel otherwise.
+ */
+
+/**
+ * \var CameraStatistics::LatencyBuckets
+ * \brief The number of buckets of the latency histogram
+ */
+
+/**
+ * \var CameraStatistics::framesCaptured
+ * \brief The number of frames captured by the device, delivered or dropped
+ */
+
+/**
+ * \var CameraStatistics::framesDelivered
+ * \brief The number of frames delivered to the application in completed
+ * requests
+ */
+
+/**
+ * \var CameraStatistics::framesDroppedNoRequest
+ * \brief The number of frames dropped as no request was queued
+ */
+
+/**
+ * \var CameraStatistics::framesDroppedKernel
+ * \brief The number of frames dropped by the device while requests were
+ * queued
+ */
+
+/**
+ * \var CameraStatistics::requestsCancelled
+ * \brief The number of requests cancelled when stopping the camera
+ */
+
+/**
+ * \var CameraStatistics::idlePauses
+ * \brief The number of times the device has been paused as no request was
+ * queued
+ *
+ * \sa Camera::statistics()
+ */
+
+/**
+ * \var CameraStatistics::resumeLatency
+ * \brief The time in microseconds it took the device to deliver its first
+ * frame after the last idle pause
+ */
+
+/**
+ * \var CameraStatistics::resumeLatencyMax
+ * \brief The longest time in microseconds it took the device to deliver its
+ * first frame after an idle pause
+ */
+
+/**
+ * \var CameraStatistics::statisticsSkipped
+ * \brief The number of frames whose statistics have not been processed by the
+ * IPA as it was running late
+ *
+ * When the IPA can't keep up with the frame rate, pipeline handlers may skip
+ * the statistics of some frames to only hand the most recent ones to the IPA.
+ * The frames are still delivered, without the metadata computed by the IPA.
+ */
+
+/**
+ * \enum CameraStatistics::CpuComponent
+ * \brief The components of the camera stack CPU time is accounted to
+ * \var CameraStatistics::CpuEvents
+ * \brief Event notifier and timer callbacks not accounted to another
+ * component, mostly V4L2 buffer and event handling
+ * \var CameraStatistics::CpuPipeline
+ * \brief Pipeline handler buffer completion handlers and request queuing
+ * \var CameraStatistics::CpuIPA
+ * \brief IPA event processing, including its hand-off to the IPA thread or
+ * process when the IPA is isolated
+ * \var CameraStatistics::CpuSerialization
+ * \brief Control list serialization and deserialization
+ * \var CameraStatistics::CpuLogging
+ * \brief Log message output
+ * \var CameraStatistics::CpuApplication
+ * \brief Application slots connected to the Camera completion signals
+ * \var CameraStatistics::CpuComponents
+ * \brief The number of components
+ */
+
+/**
+ * \var CameraStatistics::latency
+ * \brief Histogram of the request completion latency
+ *
+ * The latency is measured from the time a request is queued to the time it
+ * completes. Bucket 0 counts requests that completed in less than 1ms, bucket
+ * \a i counts requests that completed in [2^(i-1), 2^i[ ms, and the last
+ * bucket counts all slower requests.
+ */
+
+/**
+ * \var CameraStatistics::cpuTime
+ * \brief The CPU time in nanoseconds consumed by each component for the
+ * camera, indexed by CpuComponent
+ *
+ * CPU time accounting is disabled by default, as it adds a small overhead to
+ * every frame, and all values are then zero. It is enabled by setting the
+ * LIBCAMERA_CPU_ACCOUNTING environment variable. The CPU time of the threads
+ * running the camera stack is then sampled around the units of work listed in
+ * CpuComponent and accounted to the camera they are performed for. Work that
+ * can't be related to a camera, or that runs in an isolated IPA process, isn't
+ * accounted for.
+ *
+ * \sa cpuTimePerFrame()
+ */
+
+CameraStatistics::CameraStatistics()
+	: framesCaptured(0), framesDelivered(0), framesDroppedNoRequest(0),
+	  framesDroppedKernel(0), requestsCancelled(0), idlePauses(0),
+	  resumeLatency(0), resumeLatencyMax(0), statisticsSkipped(0),
+	  latency{}, cpuTime{}
+{
+}
+
+/**
+ * \brief Retrieve the average CPU time per delivered frame of a component
+ * \param[in] component The component
+ * \return The CPU time in nanoseconds consumed by \a component per delivered
+ * frame, or 0 if no frame has been delivered
+ */
+uint64_t CameraStatistics::cpuTimePerFrame(CpuComponent component) const
+{
+	if (!framesDelivered)
+		return 0;
+
+	return cpuTime[component] / framesDelivered;
+}
+
+/**
+ * \class BufferPoolUsage
+ * \brief Memory usage of a pool of buffers used by a camera
+ *
+ * The BufferPoolUsage class reports the number of buffers and bytes of a
+ * buffer pool, as returned by Camera::bufferUsage(). Pools are identified by
+ * their type, and by the stream they belong to or a name.
+ *
+ * The size of a buffer is the sum of the length of its planes. Planes sharing
+ * the same dmabuf are accounted for separately, and imported buffers whose
+ * planes have no length don't contribute to the byte count.
+ */
+
+/**
+ * \enum BufferPoolUsage::Type
+ * \brief The origin of the buffers of a pool
+ * \var BufferPoolUsage::Exported
+ * Buffers allocated by the camera for a stream and exported to the
+ * application through a FrameBufferAllocator
+ * \var BufferPoolUsage::Imported
+ * Buffers allocated by the application and queued to a stream
+ * \var BufferPoolUsage::Internal
+ * Buffers allocated by the pipeline handler for its internal use, such as
+ * raw frames or ISP parameters and statistics
+ */
+
+/**
+ * \brief Construct an empty buffer pool usage
+ * \param[in] type The pool type
+ * \param[in] stream The stream the pool belongs to, or nullptr for internal
+ * pools
+ * \param[in] name The pool name, for internal pools
+ */
+BufferPoolUsage::BufferPoolUsage(Type type, const Stream *stream,
+				 const std::string &name)
+	: type(type), stream(stream), name(name), buffers(0), bytes(0)
+{
+}
+
+/**
+ * \brief Account for a buffer in the pool
+ * \param[in] buffer The buffer
+ */
+void BufferPoolUsage::add(const FrameBuffer *buffer)
+{
+	buffers++;
+
+	for (const FrameBuffer::Plane &plane : buffer->planes())
+		bytes += plane.length;
+}
+
+/**
+ * \brief Account for a set of buffers in the pool
+ * \param[in] buffers The buffers
+ */
+void BufferPoolUsage::add(const std::vector<std::unique_ptr<FrameBuffer>> &buffers)
+{
+	for (const std::unique_ptr<FrameBuffer> &buffer : buffers)
+		add(buffer.get());
+}
+
+/**
+ * \var BufferPoolUsage::type
+ * \brief The pool type
+ */
+
+/**
+ * \var BufferPoolUsage::stream
+ * \brief The stream the pool belongs to, nullptr for internal pools
+ */
+
+/**
+ * \var BufferPoolUsage::name
+ * \brief The name of the internal pool, empty for stream pools
+ */
+
+/**
+ * \var BufferPoolUsage::buffers
+ * \brief The number of buffers in the pool
+ */
+
+/**
+ * \var BufferPoolUsage::bytes
+ * \brief The total size of the buffers in the pool, in bytes
+ */
+
+/**
+ * \class CameraStall
+ * \brief Diagnostics of a camera that stopped completing buffers
+ *
+ * The CameraStall class describes the state of a camera reported by the
+ * Camera::stalled signal. It lists the devices of the pipeline with the number
+ * of buffers each of them holds, to locate the device that stopped returning
+ * buffers.
+ */
+
+/**
+ * \struct CameraStall::Device
+ * \brief A device of the pipeline
+ * \var CameraStall::Device::name
+ * \brief The device name
+ * \var CameraStall::Device::queuedBuffers
+ * \brief The number of buffers queued to the device
+ */
+
+CameraStall::CameraStall()
+	: elapsed(0), recovered(false)
+{
+}
+
+/**
+ * \var CameraStall::elapsed
+ * \brief The time since the last buffer completed, in microseconds
+ */
+
+/**
+ * \var CameraStall::devices
+ * \brief The devices of the pipeline, as reported by the pipeline handler
+ */
+
+/**
+ * \var CameraStall::recovered
+ * \brief True if the pipeline handler restarted the camera successfully
+ */
+
 class Camera::Private
 {
 public:
@@ -275,20 +579,94 @@ public:
 	void disconnect();
 	void setState(State state);
 
+	void resetStatistics();
+	void requestQueued(Request *request, const FrameBufferAllocator *allocator);
+	void requestRearmed(Request *request);
+	void requestQueueFailed();
+	void requestCompleted(const Request *request);
+	void idlePaused();
+	void idleResumed(uint64_t latency);
+	void statisticsSkipped();
+	void cpuTimeAccounted(const std::array<uint64_t, CameraStatistics::CpuComponents> &times);
+	CameraStatistics statistics() const;
+
+	void resetImportedBuffers();
+	void importedBufferUsage(std::vector<BufferPoolUsage> *pools) const;
+
+	int validateRequest(const Request *request) const;
+
+	void openSubmissions();
+	int submitRequests(Span<Request *const> requests, bool *first);
+	int dispatchRequest(Camera *camera, Request *request);
+	Request *takeSubmittedRequests(bool close);
+
+	template<typename R, typename... FuncArgs, typename... Args>
+	R invokePipeline(R (PipelineHandler::*func)(FuncArgs...), Args &&... args)
+	{
+		if (!pipe_->hasThread())
+			return (pipe_.get()->*func)(std::forward<Args>(args)...);
+
+		return pipe_->invokeMethod(func, ConnectionTypeBlocking,
+					   std::forward<Args>(args)...);
+	}
+
 	std::shared_ptr<PipelineHandler> pipe_;
 	std::string name_;
 	std::set<Stream *> streams_;
 	std::set<Stream *> activeStreams_;
+	std::unique_ptr<CameraControlValidator> validator_;
+	CompletionOrder completionOrder_;
+
+	bool filterMetadata_;
+	std::vector<const ControlId *> metadataFilter_;
+
+	unsigned int latestFrames_;
+	std::vector<std::unique_ptr<Request>> spares_;
+
+	std::atomic<bool> operationPending_;
 
 private:
-	bool disconnected_;
-	State state_;
+	std::atomic<bool> disconnected_;
+	std::atomic<State> state_;
+
+	/*
+	 * Requests submitted from threads other than the pipeline handler
+	 * thread, stored as a lock-free stack linked through
+	 * Request::submitNext_, in reverse submission order. The stack is
+	 * closed when the camera isn't running.
+	 */
+	static Request *const SubmissionsClosed;
+	std::atomic<Request *> submitted_;
+
+	mutable std::mutex statsMutex_;
+	CameraStatistics stats_;
+	unsigned int inFlight_;
+	bool starved_;
+	bool sequenceValid_;
+	bool sequenceRestart_;
+	uint32_t sequence_;
+
+	struct ImportedBuffer {
+		const Stream *stream;
+		uint64_t bytes;
+	};
+
+	/*
+	 * Application buffers queued since the camera has been configured.
+	 * The buffers are only identified by address, they are never
+	 * dereferenced after being queued.
+	 */
+	std::unordered_map<const FrameBuffer *, ImportedBuffer> importedBuffers_;
 };
 
 Camera::Private::Private(PipelineHandler *pipe, const std::string &name,
 			 const std::set<Stream *> &streams)
 	: pipe_(pipe->shared_from_this()), name_(name), streams_(streams),
-	  disconnected_(false), state_(CameraAvailable)
+	  completionOrder_(QueueOrder), filterMetadata_(false),
+	  latestFrames_(0), operationPending_(false), disconnected_(false),
+	  state_(CameraAvailable), submitted_(SubmissionsClosed),
+	  inFlight_(0), starved_(true),
+	  sequenceValid_(false), sequenceRestart_(false), sequence_(0)
 {
 }
 
@@ -298,6 +676,285 @@ Camera::Private::~Private()
 		LOG(Camera, Error) << "Removing camera while still in use";
 }
 
+void Camera::Private::resetStatistics()
+{
+	std::lock_guard<std::mutex> locker(statsMutex_);
+
+	stats_ = CameraStatistics();
+	inFlight_ = 0;
+	starved_ = true;
+	sequenceValid_ = false;
+	sequenceRestart_ = false;
+}
+
+void Camera::Private::requestQueued(Request *request,
+				     const FrameBufferAllocator *allocator)
+{
+	request->queueTime_ = std::chrono::steady_clock::now();
+
+	std::lock_guard<std::mutex> locker(statsMutex_);
+	inFlight_++;
+
+	for (auto const &it : request->buffers()) {
+		const Stream *stream = it.first;
+		const FrameBuffer *buffer = it.second;
+
+		/* Buffers of streams using the allocator are exported. */
+		if (allocator && !allocator->buffers(it.first).empty())
+			continue;
+
+		ImportedBuffer &imported = importedBuffers_[buffer];
+		imported.stream = stream;
+		imported.bytes = 0;
+		for (const FrameBuffer::Plane &plane : buffer->planes())
+			imported.bytes += plane.length;
+	}
+}
+
+/*
+ * The buffers of a repeating request have already been accounted for when it
+ * was first queued.
+ */
+void Camera::Private::requestRearmed(Request *request)
+{
+	request->queueTime_ = std::chrono::steady_clock::now();
+
+	std::lock_guard<std::mutex> locker(statsMutex_);
+	inFlight_++;
+}
+
+void Camera::Private::requestCompleted(const Request *request)
+{
+	using namespace std::chrono;
+
+	auto latency = duration_cast<milliseconds>(steady_clock::now() -
+						   request->queueTime_).count();
+	unsigned int bucket = 0;
+	while (latency > 0 && bucket < CameraStatistics::LatencyBuckets - 1) {
+		latency >>= 1;
+		bucket++;
+	}
+
+	std::lock_guard<std::mutex> locker(statsMutex_);
+
+	stats_.latency[bucket]++;
+	if (inFlight_)
+		inFlight_--;
+
+	if (request->status() == Request::RequestCancelled) {
+		stats_.requestsCancelled++;
+		return;
+	}
+
+	/*
+	 * All buffers of a request capture the same frame, use the sequence
+	 * number of the first one to detect dropped frames. Frames missing
+	 * before the first completed request are accounted for as dropped
+	 * for lack of requests.
+	 */
+	uint32_t sequence = request->buffers().begin()->second->metadata().sequence;
+	uint32_t expected = sequenceValid_ ? sequence_ + 1 : 0;
+
+	/*
+	 * The device restarts its sequence numbers when resumed after an idle
+	 * pause, no frame is lost in between.
+	 */
+	if (sequenceRestart_) {
+		expected = sequence;
+		sequence_ = sequence;
+		sequenceRestart_ = false;
+	}
+
+	if (sequence > expected) {
+		uint32_t dropped = sequence - expected;
+
+		if (starved_)
+			stats_.framesDroppedNoRequest += dropped;
+		else
+			stats_.framesDroppedKernel += dropped;
+
+		stats_.framesCaptured += dropped;
+	}
+
+	if (!sequenceValid_ || sequence > sequence_) {
+		sequence_ = sequence;
+		sequenceValid_ = true;
+	}
+
+	stats_.framesCaptured++;
+	stats_.framesDelivered++;
+
+	starved_ = inFlight_ == 0;
+}
+
+void Camera::Private::idlePaused()
+{
+	std::lock_guard<std::mutex> locker(statsMutex_);
+	stats_.idlePauses++;
+}
+
+void Camera::Private::idleResumed(uint64_t latency)
+{
+	std::lock_guard<std::mutex> locker(statsMutex_);
+
+	stats_.resumeLatency = latency;
+	stats_.resumeLatencyMax = std::max(stats_.resumeLatencyMax, latency);
+	sequenceRestart_ = true;
+}
+
+void Camera::Private::statisticsSkipped()
+{
+	std::lock_guard<std::mutex> locker(statsMutex_);
+	stats_.statisticsSkipped++;
+}
+
+void Camera::Private::cpuTimeAccounted(const std::array<uint64_t, CameraStatistics::CpuComponents> &times)
+{
+	std::lock_guard<std::mutex> locker(statsMutex_);
+
+	for (unsigned int i = 0; i < times.size(); ++i)
+		stats_.cpuTime[i] += times[i];
+}
+
+void Camera::Private::requestQueueFailed()
+{
+	std::lock_guard<std::mutex> locker(statsMutex_);
+	if (inFlight_)
+		inFlight_--;
+}
+
+CameraStatistics Camera::Private::statistics() const
+{
+	std::lock_guard<std::mutex> locker(statsMutex_);
+	return stats_;
+}
+
+void Camera::Private::resetImportedBuffers()
+{
+	std::lock_guard<std::mutex> locker(statsMutex_);
+	importedBuffers_.clear();
+}
+
+void Camera::Private::importedBufferUsage(std::vector<BufferPoolUsage> *pools) const
+{
+	std::lock_guard<std::mutex> locker(statsMutex_);
+
+	for (Stream *stream : activeStreams_) {
+		BufferPoolUsage usage(BufferPoolUsage::Imported, stream);
+
+		for (const auto &it : importedBuffers_) {
+			if (it.second.stream != stream)
+				continue;
+
+			usage.buffers++;
+			usage.bytes += it.second.bytes;
+		}
+
+		if (usage.buffers)
+			pools->push_back(usage);
+	}
+}
+
+/* The address is only used as a marker and is never dereferenced. */
+static char submissionsClosedTag;
+Request *const Camera::Private::SubmissionsClosed =
+	reinterpret_cast<Request *>(&submissionsClosedTag);
+
+void Camera::Private::openSubmissions()
+{
+	submitted_.store(nullptr, std::memory_order_release);
+}
+
+int Camera::Private::validateRequest(const Request *request) const
+{
+	if (request->buffers().empty()) {
+		LOG(Camera, Error) << "Request contains no buffers";
+		return -EINVAL;
+	}
+
+	for (auto const &it : request->buffers()) {
+		Stream *stream = it.first;
+
+		if (activeStreams_.find(stream) == activeStreams_.end()) {
+			LOG(Camera, Error) << "Invalid request";
+			return -EINVAL;
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * Push a batch of requests to the submission stack with a single atomic
+ * operation, to keep the requests of the batch together.
+ */
+int Camera::Private::submitRequests(Span<Request *const> requests, bool *first)
+{
+	for (unsigned int i = 1; i < requests.size(); ++i)
+		requests[i]->submitNext_ = requests[i - 1];
+
+	Request *head = submitted_.load(std::memory_order_relaxed);
+
+	do {
+		if (head == SubmissionsClosed)
+			return -EACCES;
+
+		requests[0]->submitNext_ = head;
+	} while (!submitted_.compare_exchange_weak(head, requests.back(),
+						   std::memory_order_release,
+						   std::memory_order_relaxed));
+
+	*first = !head;
+
+	return 0;
+}
+
+/*
+ * Pass a request to the pipeline handler, synchronously from the pipeline
+ * handler thread, or through the submission stack from other threads.
+ */
+int Camera::Private::dispatchRequest(Camera *camera, Request *request)
+{
+	PipelineHandler *pipe = pipe_.get();
+	if (Thread::current() == pipe->thread()) {
+		/* Preserve ordering with requests submitted from other threads. */
+		pipe->queueSubmittedRequests(camera, false);
+		return pipe->queueRequest(camera, request);
+	}
+
+	bool first;
+	int ret = submitRequests({ &request, 1 }, &first);
+	if (!ret && first)
+		pipe->invokeMethod(&PipelineHandler::queueSubmittedRequests,
+				   ConnectionTypeQueued, camera, false);
+
+	return ret;
+}
+
+Request *Camera::Private::takeSubmittedRequests(bool close)
+{
+	Request *head = submitted_.load(std::memory_order_relaxed);
+	Request *empty = close ? SubmissionsClosed : nullptr;
+
+	do {
+		if (head == SubmissionsClosed || (!head && !close))
+			return nullptr;
+	} while (!submitted_.compare_exchange_weak(head, empty,
+						   std::memory_order_acquire,
+						   std::memory_order_relaxed));
+
+	/* Reverse the stack to restore the submission order. */
+	Request *requests = nullptr;
+	while (head) {
+		Request *next = head->submitNext_;
+		head->submitNext_ = requests;
+		requests = head;
+		head = next;
+	}
+
+	return requests;
+}
+
 static const char *const camera_state_names[] = {
 	"Available",
 	"Acquired",
@@ -344,8 +1001,12 @@ int Camera::Private::isAccessAllowed(State low, State high,
 
 void Camera::Private::disconnect()
 {
-	if (state_ == Private::CameraRunning)
-		state_ = Private::CameraConfigured;
+	/*
+	 * The camera may be disconnected from the pipeline handler thread,
+	 * concurrently with state changes from the application.
+	 */
+	State running = Private::CameraRunning;
+	state_.compare_exchange_strong(running, Private::CameraConfigured);
 
 	disconnected_ = true;
 }
@@ -432,6 +1093,28 @@ void Camera::Private::setState(State state)
  * The camera is running and ready to process requests queued by the
  * application. The camera remains in this state until it is stopped and moved
  * to the Configured state.
+ *
+ * \subsection camera_async Asynchronous Operation
+ *
+ * Configuring and starting a camera involve sequences of device operations
+ * that can take a significant amount of time. The configureAsync() and
+ * startAsync() functions perform the same transitions as configure() and
+ * start() without blocking the caller, and report their result with the
+ * configureCompleted and startCompleted signals. An application can thus
+ * bring up multiple cameras concurrently.
+ *
+ * While an asynchronous operation is pending, configure(), configureAsync(),
+ * start(), startAsync(), stop() and release() return -EBUSY.
+ */
+
+/**
+ * \enum Camera::CompletionOrder
+ * \brief The order in which requests complete
+ * \var Camera::QueueOrder
+ * \brief Requests complete in the order they have been queued
+ * \var Camera::StreamOrder
+ * \brief Requests complete in the order they have been queued for each stream
+ * \sa Camera::setCompletionOrder()
  */
 
 /**
@@ -478,6 +1161,26 @@ const std::string &Camera::name() const
 /**
  * \var Camera::requestCompleted
  * \brief Signal emitted when a request queued to the camera has completed
+ *
+ * The camera signals are emitted from the thread of the pipeline handler. When
+ * the pipeline handler runs in a dedicated thread, slots of receivers that are
+ * not Object instances are called in that thread, and completions may be
+ * delivered to Object receivers after Camera::stop() returns.
+ */
+
+/**
+ * \var Camera::requestQueueAvailable
+ * \brief Signal emitted when the device has room for a new request
+ *
+ * The number of requests processed by the device at a time is bounded by the
+ * number of buffers of the streams, as configured by
+ * StreamConfiguration::bufferCount. Requests queued beyond that limit are held
+ * by libcamera and passed to the device in order as previous requests
+ * complete, which increases their completion latency.
+ *
+ * This signal is emitted when a request completes and no request is waiting
+ * for the device. A request queued at that point is processed by the device
+ * immediately. The camera is passed as a parameter.
  */
 
 /**
@@ -492,8 +1195,41 @@ const std::string &Camera::name() const
  * application API calls by returning errors immediately.
  */
 
-Camera::Camera(PipelineHandler *pipe, const std::string &name,
-	       const std::set<Stream *> &streams)
+/**
+ * \var Camera::stalled
+ * \brief Signal emitted when the camera stops completing buffers
+ *
+ * While requests are being processed, libcamera monitors the time since the
+ * last buffer completed. A camera is considered stalled when no buffer has
+ * completed for 10 frame intervals, with a minimum of one second. This signal
+ * is then emitted with a CameraStall describing the pipeline state.
+ *
+ * Pipeline handlers that support it restart streaming in place, without
+ * completing the requests in flight, in which case CameraStall::recovered is
+ * set. Otherwise the requests remain queued, and the application may stop and
+ * restart the camera to recover. The signal is emitted once per stall, until
+ * a buffer completes again.
+ */
+
+/**
+ * \var Camera::configureCompleted
+ * \brief Signal emitted when an asynchronous configuration completes
+ *
+ * The signal is emitted by configureAsync() operations with the return value
+ * of the configuration, 0 on success or a negative error code as documented
+ * for configure().
+ */
+
+/**
+ * \var Camera::startCompleted
+ * \brief Signal emitted when an asynchronous start completes
+ *
+ * The signal is emitted by startAsync() operations with the return value of
+ * the start, 0 on success or a negative error code as documented for start().
+ */
+
+Camera::Camera(PipelineHandler *pipe, const std::string &name,
+	       const std::set<Stream *> &streams)
 	: p_(new Private(pipe, name, streams)), allocator_(nullptr)
 {
 }
@@ -522,7 +1258,20 @@ void Camera::disconnect()
 	disconnected.emit(this);
 }
 
-int Camera::exportFrameBuffers(Stream *stream,
+/**
+ * \brief Retrieve the control validator for the camera requests
+ *
+ * The validator is shared by all requests created for the camera. It is
+ * created, or updated, when the camera is configured.
+ *
+ * \return The camera control validator
+ */
+ControlValidator *Camera::validator() const
+{
+	return p_->validator_.get();
+}
+
+int Camera::exportFrameBuffers(Stream *stream, FrameBuffer::CpuAccess cpuAccess,
 			       std::vector<std::unique_ptr<FrameBuffer>> *buffers)
 {
 	int ret = p_->isAccessAllowed(Private::CameraConfigured);
@@ -535,7 +1284,22 @@ int Camera::exportFrameBuffers(Stream *stream,
 	if (p_->activeStreams_.find(stream) == p_->activeStreams_.end())
 		return -EINVAL;
 
-	return p_->pipe_->exportFrameBuffers(this, stream, buffers);
+	stream->cpuAccess_ = cpuAccess;
+
+	return p_->invokePipeline(&PipelineHandler::exportFrameBuffers, this,
+				  stream, buffers);
+}
+
+int Camera::importFrameBuffers(Stream *stream)
+{
+	int ret = p_->isAccessAllowed(Private::CameraConfigured);
+	if (ret < 0)
+		return ret;
+
+	if (p_->activeStreams_.find(stream) == p_->activeStreams_.end())
+		return -EINVAL;
+
+	return p_->invokePipeline(&PipelineHandler::importFrameBuffers, this, stream);
 }
 
 int Camera::freeFrameBuffers(Stream *stream)
@@ -544,11 +1308,29 @@ int Camera::freeFrameBuffers(Stream *stream)
 	if (ret < 0)
 		return ret;
 
-	p_->pipe_->freeFrameBuffers(this, stream);
+	/* The spare requests reference the spare buffers of the stream. */
+	p_->spares_.clear();
+
+	p_->invokePipeline(&PipelineHandler::freeFrameBuffers, this, stream);
 
 	return 0;
 }
 
+int Camera::addFrameBuffers(Stream *stream, unsigned int count,
+			    std::vector<std::unique_ptr<FrameBuffer>> *buffers)
+{
+	int ret = p_->isAccessAllowed(Private::CameraConfigured,
+				      Private::CameraRunning);
+	if (ret < 0)
+		return ret;
+
+	if (p_->activeStreams_.find(stream) == p_->activeStreams_.end())
+		return -EINVAL;
+
+	return p_->invokePipeline(&PipelineHandler::addFrameBuffers, this,
+				  stream, count, buffers);
+}
+
 /**
  * \brief Acquire the camera device for exclusive access
  *
@@ -571,19 +1353,28 @@ int Camera::freeFrameBuffers(Stream *stream)
  * \return 0 on success or a negative error code otherwise
  * \retval -ENODEV The camera has been disconnected from the system
  * \retval -EBUSY The camera is not free and can't be acquired by the caller
+ * \retval -ENOENT The resources needed to operate the camera are not available
  */
 int Camera::acquire()
 {
+	LIBCAMERA_TRACEPOINT_SCOPE(CameraAcquire, reinterpret_cast<uintptr_t>(this));
+
 	int ret = p_->isAccessAllowed(Private::CameraAvailable);
 	if (ret < 0)
 		return ret == -EACCES ? -EBUSY : ret;
 
-	if (!p_->pipe_->lock()) {
+	if (!p_->invokePipeline(&PipelineHandler::lock)) {
 		LOG(Camera, Info)
 			<< "Pipeline handler in use by another process";
 		return -EBUSY;
 	}
 
+	ret = p_->invokePipeline(&PipelineHandler::acquire, this);
+	if (ret < 0) {
+		p_->invokePipeline(&PipelineHandler::unlock);
+		return ret;
+	}
+
 	p_->setState(Private::CameraAcquired);
 
 	return 0;
@@ -598,7 +1389,8 @@ int Camera::acquire()
  * This function affects the state of the camera, see \ref camera_operation.
  *
  * \return 0 on success or a negative error code otherwise
- * \retval -EBUSY The camera is running and can't be released
+ * \retval -EBUSY The camera is running or an asynchronous operation is
+ * pending, and can't be released
  */
 int Camera::release()
 {
@@ -607,6 +1399,9 @@ int Camera::release()
 	if (ret < 0)
 		return ret == -EACCES ? -EBUSY : ret;
 
+	if (p_->operationPending_)
+		return -EBUSY;
+
 	if (allocator_) {
 		/*
 		 * \todo Try to find a better API that would make this error
@@ -617,8 +1412,14 @@ int Camera::release()
 		return -EBUSY;
 	}
 
-	p_->pipe_->unlock();
+	p_->invokePipeline(&PipelineHandler::release, this);
+	p_->invokePipeline(&PipelineHandler::unlock);
 
+	p_->completionOrder_ = QueueOrder;
+	p_->latestFrames_ = 0;
+	p_->metadataFilter_.clear();
+	p_->filterMetadata_ = false;
+	p_->resetImportedBuffers();
 	p_->setState(Private::CameraAvailable);
 
 	return 0;
@@ -674,7 +1475,9 @@ std::unique_ptr<CameraConfiguration> Camera::generateConfiguration(const StreamR
 	if (roles.size() > streams().size())
 		return nullptr;
 
-	CameraConfiguration *config = p_->pipe_->generateConfiguration(this, roles);
+	CameraConfiguration *config =
+		p_->invokePipeline(&PipelineHandler::generateConfiguration,
+				   this, roles);
 	if (!config) {
 		LOG(Camera, Debug)
 			<< "Pipeline handler failed to generate configuration";
@@ -719,9 +1522,83 @@ std::unique_ptr<CameraConfiguration> Camera::generateConfiguration(const StreamR
  * \retval -ENODEV The camera has been disconnected from the system
  * \retval -EACCES The camera is not in a state where it can be configured
  * \retval -EINVAL The configuration is not valid
+ * \retval -EBUSY An asynchronous operation is pending
  */
 int Camera::configure(CameraConfiguration *config)
 {
+	if (p_->operationPending_)
+		return -EBUSY;
+
+	return doConfigure(config);
+}
+
+/**
+ * \brief Configure the camera asynchronously
+ * \param[in] config The camera configurations to setup
+ *
+ * This function performs the same operation as configure(), without waiting
+ * for it to complete. The operation runs in the thread of the camera's
+ * pipeline handler, and its result is reported by the configureCompleted
+ * signal, emitted from that thread. The caller shall keep \a config valid
+ * until the signal is emitted.
+ *
+ * Cameras whose pipeline handlers run in dedicated threads are configured in
+ * parallel. Other cameras are configured in the camera manager thread, one
+ * after the other, but still without blocking the caller.
+ *
+ * \return 0 if the operation has been scheduled or a negative error code
+ * otherwise
+ * \retval -ENODEV The camera has been disconnected from the system
+ * \retval -EACCES The camera is not in a state where it can be configured
+ * \retval -EBUSY An asynchronous operation is already pending
+ */
+int Camera::configureAsync(CameraConfiguration *config)
+{
+	int ret = p_->isAccessAllowed(Private::CameraAcquired,
+				      Private::CameraConfigured);
+	if (ret < 0)
+		return ret;
+
+	return runAsync([config](Camera *camera) {
+				return camera->doConfigure(config);
+			}, &configureCompleted);
+}
+
+/*
+ * Schedule an asynchronous camera operation in the pipeline handler thread,
+ * and emit the \a completed signal with its result when it completes. The
+ * operation is skipped if the camera is destroyed before it runs.
+ */
+int Camera::runAsync(std::function<int(Camera *)> operation,
+		     Signal<Camera *, int> *completed)
+{
+	if (p_->operationPending_.exchange(true))
+		return -EBUSY;
+
+	std::weak_ptr<Camera> weak = shared_from_this();
+	auto run = [weak, operation, completed]() {
+		std::shared_ptr<Camera> camera = weak.lock();
+		if (!camera)
+			return;
+
+		int ret = operation(camera.get());
+		camera->p_->operationPending_ = false;
+		completed->emit(camera.get(), ret);
+	};
+
+	p_->pipe_->invokeMethod(&PipelineHandler::runCameraOperation,
+				ConnectionTypeQueued, std::function<void()>(run));
+
+	return 0;
+}
+
+/*
+ * Configure the camera synchronously, for configure() and configureAsync().
+ */
+int Camera::doConfigure(CameraConfiguration *config)
+{
+	LIBCAMERA_TRACEPOINT_SCOPE(CameraConfigure, reinterpret_cast<uintptr_t>(this));
+
 	int ret = p_->isAccessAllowed(Private::CameraAcquired,
 				      Private::CameraConfigured);
 	if (ret < 0)
@@ -749,10 +1626,11 @@ int Camera::configure(CameraConfiguration *config)
 
 	LOG(Camera, Info) << msg.str();
 
-	ret = p_->pipe_->configure(this, config);
+	ret = p_->invokePipeline(&PipelineHandler::configure, this, config);
 	if (ret)
 		return ret;
 
+	p_->resetImportedBuffers();
 	p_->activeStreams_.clear();
 	for (const StreamConfiguration &cfg : *config) {
 		Stream *stream = cfg.stream();
@@ -764,11 +1642,75 @@ int Camera::configure(CameraConfiguration *config)
 		p_->activeStreams_.insert(stream);
 	}
 
+	/*
+	 * The camera controls are final once the camera is configured, build
+	 * the validation table for the requests.
+	 */
+	if (!p_->validator_)
+		p_->validator_ = std::make_unique<CameraControlValidator>(this);
+	else
+		p_->validator_->update();
+
 	p_->setState(Private::CameraConfigured);
 
 	return 0;
 }
 
+/**
+ * \brief Restrict the metadata reported in the camera requests
+ * \param[in] ids The metadata controls the application is interested in
+ *
+ * Set the metadata filter of the requests created by createRequest() from now
+ * on. Requests created before are not affected. The filter can be overridden
+ * for individual requests with Request::setMetadataFilter(), and is removed
+ * when the camera is released.
+ *
+ * This function shall only be called when the camera is in the Acquired,
+ * Configured or Running state, see \ref camera_operation.
+ *
+ * \return 0 on success or a negative error code otherwise
+ * \retval -ENODEV The camera has been disconnected from the system
+ * \retval -EACCES The camera is not acquired
+ */
+int Camera::setMetadataFilter(const std::vector<const ControlId *> &ids)
+{
+	int ret = p_->isAccessAllowed(Private::CameraAcquired,
+				      Private::CameraRunning);
+	if (ret < 0)
+		return ret;
+
+	p_->metadataFilter_ = ids;
+	p_->filterMetadata_ = true;
+
+	return 0;
+}
+
+/**
+ * \brief Report all metadata in the camera requests
+ *
+ * Remove the filter set with setMetadataFilter() for the requests created by
+ * createRequest() from now on.
+ *
+ * This function shall only be called when the camera is in the Acquired,
+ * Configured or Running state, see \ref camera_operation.
+ *
+ * \return 0 on success or a negative error code otherwise
+ * \retval -ENODEV The camera has been disconnected from the system
+ * \retval -EACCES The camera is not acquired
+ */
+int Camera::clearMetadataFilter()
+{
+	int ret = p_->isAccessAllowed(Private::CameraAcquired,
+				      Private::CameraRunning);
+	if (ret < 0)
+		return ret;
+
+	p_->metadataFilter_.clear();
+	p_->filterMetadata_ = false;
+
+	return 0;
+}
+
 /**
  * \brief Create a request object for the camera
  * \param[in] cookie Opaque cookie for application use
@@ -782,21 +1724,27 @@ int Camera::configure(CameraConfiguration *config)
  * handler, and is completely opaque to libcamera.
  *
  * The ownership of the returned request is passed to the caller, which is
- * responsible for either queueing the request or deleting it.
+ * responsible for deleting it. The request may be queued multiple times,
+ * calling Request::reuse() after each completion, and shall only be deleted
+ * once it has completed.
  *
  * This function shall only be called when the camera is in the Configured
  * or Running state, see \ref camera_operation.
  *
- * \return A pointer to the newly created request, or nullptr on error
+ * \return A unique pointer to the newly created request, or nullptr on error
  */
-Request *Camera::createRequest(uint64_t cookie)
+std::unique_ptr<Request> Camera::createRequest(uint64_t cookie)
 {
 	int ret = p_->isAccessAllowed(Private::CameraConfigured,
 				      Private::CameraRunning);
 	if (ret < 0)
 		return nullptr;
 
-	return new Request(this, cookie);
+	std::unique_ptr<Request> request = std::make_unique<Request>(this, cookie);
+	if (p_->filterMetadata_)
+		request->setMetadataFilter(p_->metadataFilter_);
+
+	return request;
 }
 
 /**
@@ -812,8 +1760,24 @@ Request *Camera::createRequest(uint64_t cookie)
  * Once the request has been queued, the camera will notify its completion
  * through the \ref requestCompleted signal.
  *
- * Ownership of the request is transferred to the camera. It will be deleted
- * automatically after it completes.
+ * Requests queued while the device is already processing as many requests as
+ * the streams have buffers are held by the camera until the device has room
+ * for them. Errors preventing such a request from being processed are reported
+ * by completing it in the Request::RequestCancelled state. The
+ * \ref requestQueueAvailable signal notifies when the device has room for a
+ * new request.
+ *
+ * Ownership of the request stays with the application, which shall keep the
+ * request alive until it completes. The request can then be reused with
+ * Request::reuse() and queued again.
+ *
+ * This method is thread-safe, and may be called from any thread while the
+ * camera is running. Requests queued from the pipeline handler thread are
+ * passed to the pipeline handler synchronously. Requests queued from other
+ * threads are handed over to the pipeline handler thread through a lock-free
+ * queue, and errors from the pipeline handler are then reported by completing
+ * the request in the Request::RequestCancelled state instead of through the
+ * return value. Requests keep the order in which they have been queued.
  *
  * \return 0 on success or a negative error code otherwise
  * \retval -ENODEV The camera has been disconnected from the system
@@ -827,21 +1791,293 @@ int Camera::queueRequest(Request *request)
 	if (ret < 0)
 		return ret;
 
-	if (request->buffers().empty()) {
-		LOG(Camera, Error) << "Request contains no buffers";
+	ret = p_->validateRequest(request);
+	if (ret < 0)
+		return ret;
+
+	LIBCAMERA_TRACEPOINT(CameraQueueRequest,
+			     reinterpret_cast<uintptr_t>(request),
+			     request->cookie());
+
+	p_->requestQueued(request, allocator_);
+
+	ret = p_->dispatchRequest(this, request);
+	if (ret < 0)
+		p_->requestQueueFailed();
+
+	return ret;
+}
+
+/**
+ * \brief Return a completed repeating request to the camera
+ * \param[in] request The repeating request to re-arm
+ *
+ * This method hands a completed repeating \a request back to the camera once
+ * the application is done with its buffers. The request is re-armed with the
+ * same buffers and controls, and queued again as with queueRequest(). As the
+ * request has been validated when it was first queued, re-arming it skips the
+ * request validation, and the controls don't need to be set again.
+ *
+ * This is the lightweight alternative to calling Request::reuse() and
+ * queueRequest() from the request completion handler, for applications that
+ * capture continuously with a fixed set of requests. The request metadata is
+ * cleared when the request is re-armed.
+ *
+ * Like queueRequest(), this method is thread-safe.
+ *
+ * \return 0 on success or a negative error code otherwise
+ * \retval -ENODEV The camera has been disconnected from the system
+ * \retval -EACCES The camera is not running
+ * \retval -EINVAL The request is not repeating, or hasn't completed
+ */
+int Camera::releaseRequest(Request *request)
+{
+	int ret = p_->isAccessAllowed(Private::CameraRunning);
+	if (ret < 0)
+		return ret;
+
+	if (!request->repeating() ||
+	    request->status() == Request::RequestPending) {
+		LOG(Camera, Error) << "Request can't be re-armed";
 		return -EINVAL;
 	}
 
-	for (auto const &it : request->buffers()) {
-		Stream *stream = it.first;
+	request->rearm();
 
-		if (p_->activeStreams_.find(stream) == p_->activeStreams_.end()) {
-			LOG(Camera, Error) << "Invalid request";
+	LIBCAMERA_TRACEPOINT(CameraQueueRequest,
+			     reinterpret_cast<uintptr_t>(request),
+			     request->cookie());
+
+	p_->requestRearmed(request);
+
+	ret = p_->dispatchRequest(this, request);
+	if (ret < 0)
+		p_->requestQueueFailed();
+
+	return ret;
+}
+
+/**
+ * \brief Queue a batch of requests to the camera
+ * \param[in] requests The requests to queue to the camera, in order
+ *
+ * This method queues multiple requests to the camera at once, as if they were
+ * queued in order with queueRequest(Request *request). The camera state and
+ * all the requests are validated before queuing any of them, and the batch is
+ * passed to the pipeline handler in a single operation, allowing it to
+ * coalesce device operations.
+ *
+ * Errors from the pipeline handler are reported by completing the failed
+ * requests in the Request::RequestCancelled state, the other requests of the
+ * batch are processed normally. Like queueRequest(Request *request), this
+ * method is thread-safe.
+ *
+ * \return 0 on success or a negative error code otherwise, in which case none
+ * of the requests has been queued
+ * \retval -ENODEV The camera has been disconnected from the system
+ * \retval -EACCES The camera is not running so requests can't be queued
+ * \retval -EINVAL One of the requests is invalid, or the batch contains the
+ * same request multiple times
+ */
+int Camera::queueRequests(Span<Request *const> requests)
+{
+	int ret = p_->isAccessAllowed(Private::CameraRunning);
+	if (ret < 0)
+		return ret;
+
+	for (auto it = requests.begin(); it != requests.end(); ++it) {
+		ret = p_->validateRequest(*it);
+		if (ret < 0)
+			return ret;
+
+		if (std::find(requests.begin(), it, *it) != it) {
+			LOG(Camera, Error) << "Request queued twice in batch";
 			return -EINVAL;
 		}
 	}
 
-	return p_->pipe_->queueRequest(this, request);
+	if (requests.empty())
+		return 0;
+
+	for (Request *request : requests) {
+		LIBCAMERA_TRACEPOINT(CameraQueueRequest,
+				     reinterpret_cast<uintptr_t>(request),
+				     request->cookie());
+
+		p_->requestQueued(request, allocator_);
+	}
+
+	PipelineHandler *pipe = p_->pipe_.get();
+	if (Thread::current() == pipe->thread()) {
+		pipe->queueSubmittedRequests(this, false);
+		pipe->queueRequests(this, requests);
+		return 0;
+	}
+
+	bool first;
+	ret = p_->submitRequests(requests, &first);
+	if (ret < 0) {
+		for (unsigned int i = 0; i < requests.size(); ++i)
+			p_->requestQueueFailed();
+		return ret;
+	}
+
+	if (first)
+		pipe->invokeMethod(&PipelineHandler::queueSubmittedRequests,
+				   ConnectionTypeQueued, this, false);
+
+	return 0;
+}
+
+/**
+ * \fn Camera::queueRequest(Request *request, T *receiver, void (T::*func)(Request *))
+ * \brief Queue a request to the camera with a completion handler
+ * \param[in] request The request to queue to the camera
+ * \param[in] receiver The object to notify of the request completion
+ * \param[in] func The method of \a receiver to call upon completion
+ *
+ * This method queues a \a request to the camera similarly to
+ * queueRequest(Request *request), and additionally calls \a func on \a
+ * receiver when the request completes. The handler runs in the thread of the
+ * \a receiver, after the \ref requestCompleted signal has been emitted. This
+ * allows processing completed requests in a thread chosen by the application
+ * without connecting to the requestCompleted signal and dispatching requests
+ * manually.
+ *
+ * The handler may reuse and queue the request again. The \a receiver shall
+ * outlive all the requests queued with it.
+ *
+ * The handler is allocated from the per-thread message pool, queuing a new
+ * request with a completion handler in steady state doesn't allocate memory
+ * beyond the request itself.
+ *
+ * \return 0 on success or a negative error code otherwise, as for
+ * queueRequest(Request *request). On error, the completion handler is not
+ * called and ownership of the request stays with the caller.
+ */
+
+int Camera::queueRequest(Request *request,
+			 BoundMethodArgs<void, Request *> *completion)
+{
+	delete request->completion_;
+	request->completion_ = completion;
+
+	int ret = queueRequest(request);
+	if (ret < 0) {
+		request->completion_ = nullptr;
+		delete completion;
+	}
+
+	return ret;
+}
+
+/**
+ * \brief Select the order in which requests complete
+ * \param[in] order The request completion order
+ *
+ * By default, requests complete in the order they have been queued
+ * (Camera::QueueOrder). A request that takes longer to process than
+ * the requests queued after it, such as a still capture request, then delays
+ * their completion.
+ *
+ * The Camera::StreamOrder mode relaxes this guarantee, and completes
+ * requests as soon as all their buffers have completed, provided that all the
+ * requests queued before them that share a stream with them have completed.
+ * Requests using the same stream thus still complete in the order they have
+ * been queued, but a request doesn't wait for earlier requests using
+ * different streams only.
+ *
+ * The completion order can only be changed when the camera is not running. It
+ * is reset to Camera::QueueOrder when the camera is released.
+ *
+ * \return 0 on success or a negative error code otherwise
+ * \retval -ENODEV The camera has been disconnected from the system
+ * \retval -EACCES The camera is not acquired or is running
+ */
+int Camera::setCompletionOrder(CompletionOrder order)
+{
+	int ret = p_->isAccessAllowed(Private::CameraAcquired,
+				      Private::CameraConfigured);
+	if (ret < 0)
+		return ret;
+
+	p_->completionOrder_ = order;
+
+	return 0;
+}
+
+/**
+ * \brief Retrieve the order in which requests complete
+ * \return The request completion order
+ */
+Camera::CompletionOrder Camera::completionOrder() const
+{
+	return p_->completionOrder_;
+}
+
+/**
+ * \brief Deliver the latest frame to applications that fall behind
+ * \param[in] spares The number of spare buffers per stream, or 0 to disable
+ *
+ * By default, the camera only captures frames when the application has queued
+ * requests, and frames are dropped by the device when the application doesn't
+ * queue requests fast enough. A request queued late then captures the next
+ * frame, and its completion is delayed by up to a frame interval.
+ *
+ * The latest frames mode keeps the device capturing to \a spares internal
+ * requests while no application request is pending. A request queued in that
+ * state completes immediately with the latest captured frame, or with the next
+ * frame if the device hasn't captured one yet, and older frames are recycled.
+ * The frame isn't copied, the buffers of the request are exchanged with the
+ * buffers that have captured the frame. The buffers of completed requests may
+ * thus differ from the buffers added to the requests, and are either buffers
+ * of the stream or spare buffers retrieved with
+ * FrameBufferAllocator::spareBuffers().
+ *
+ * Requests that carry controls, or whose buffers are skipped by decimation,
+ * always capture a new frame, to guarantee that their controls are applied.
+ * The idle policy of the pipeline handler is disabled in this mode.
+ *
+ * The mode requires the buffers of all active streams to be allocated with a
+ * FrameBufferAllocator, which allocates the spare buffers when the camera is
+ * started. At least two spare buffers are needed for the device to keep
+ * capturing while the latest frame is held. The mode can only be changed when
+ * the camera is not running, and is disabled when the camera is released.
+ *
+ * \return 0 on success or a negative error code otherwise
+ * \retval -ENODEV The camera has been disconnected from the system
+ * \retval -EACCES The camera is not acquired or is running
+ * \retval -EINVAL The number of \a spares is 1
+ */
+int Camera::setLatestFrames(unsigned int spares)
+{
+	int ret = p_->isAccessAllowed(Private::CameraAcquired,
+				      Private::CameraConfigured);
+	if (ret < 0)
+		return ret;
+
+	if (spares == 1) {
+		LOG(Camera, Error)
+			<< "The latest frames mode needs at least two spare buffers";
+		return -EINVAL;
+	}
+
+	if (spares != p_->latestFrames_)
+		p_->spares_.clear();
+
+	p_->latestFrames_ = spares;
+
+	return 0;
+}
+
+/**
+ * \brief Retrieve the number of spare buffers of the latest frames mode
+ * \return The number of spare buffers per stream, or 0 if the latest frames
+ * mode is disabled
+ */
+unsigned int Camera::latestFrames() const
+{
+	return p_->latestFrames_;
 }
 
 /**
@@ -856,9 +2092,55 @@ int Camera::queueRequest(Request *request)
  * \return 0 on success or a negative error code otherwise
  * \retval -ENODEV The camera has been disconnected from the system
  * \retval -EACCES The camera is not in a state where it can be started
+ * \retval -EINVAL The latest frames mode is enabled and the buffers of a stream
+ * haven't been allocated with a FrameBufferAllocator
+ * \retval -EBUSY An asynchronous operation is pending
  */
 int Camera::start()
+{
+	if (p_->operationPending_)
+		return -EBUSY;
+
+	return doStart();
+}
+
+/**
+ * \brief Start capture from camera asynchronously
+ *
+ * This function performs the same operation as start(), without waiting for
+ * it to complete. The operation runs in the thread of the camera's pipeline
+ * handler, and its result is reported by the startCompleted signal, emitted
+ * from that thread. Requests shall not be queued before the signal reports
+ * success.
+ *
+ * Cameras whose pipeline handlers run in dedicated threads are started in
+ * parallel. Other cameras are started in the camera manager thread, one after
+ * the other, but still without blocking the caller.
+ *
+ * \return 0 if the operation has been scheduled or a negative error code
+ * otherwise
+ * \retval -ENODEV The camera has been disconnected from the system
+ * \retval -EACCES The camera is not in a state where it can be started
+ * \retval -EBUSY An asynchronous operation is already pending
+ */
+int Camera::startAsync()
 {
+	int ret = p_->isAccessAllowed(Private::CameraConfigured);
+	if (ret < 0)
+		return ret;
+
+	return runAsync([](Camera *camera) {
+				return camera->doStart();
+			}, &startCompleted);
+}
+
+/*
+ * Start the camera synchronously, for start() and startAsync().
+ */
+int Camera::doStart()
+{
+	LIBCAMERA_TRACEPOINT_SCOPE(CameraStart, reinterpret_cast<uintptr_t>(this));
+
 	int ret = p_->isAccessAllowed(Private::CameraConfigured);
 	if (ret < 0)
 		return ret;
@@ -869,18 +2151,73 @@ int Camera::start()
 		if (allocator_ && !allocator_->buffers(stream).empty())
 			continue;
 
-		p_->pipe_->importFrameBuffers(this, stream);
+		p_->invokePipeline(&PipelineHandler::importFrameBuffers, this, stream);
+	}
+
+	p_->resetStatistics();
+
+	if (p_->latestFrames_ && p_->spares_.empty()) {
+		ret = createSpareRequests();
+		if (ret)
+			return ret;
 	}
 
-	ret = p_->pipe_->start(this);
+	std::vector<Request *> spares;
+	for (std::unique_ptr<Request> &spare : p_->spares_) {
+		if (p_->filterMetadata_)
+			spare->setMetadataFilter(p_->metadataFilter_);
+		else
+			spare->clearMetadataFilter();
+		spares.push_back(spare.get());
+	}
+
+	p_->invokePipeline(&PipelineHandler::setSpareRequests, this,
+			   Span<Request *const>(spares));
+
+	ret = p_->invokePipeline(&PipelineHandler::start, this);
 	if (ret)
 		return ret;
 
+	p_->openSubmissions();
 	p_->setState(Private::CameraRunning);
 
 	return 0;
 }
 
+/*
+ * Create the spare requests of the latest frames mode, with one spare buffer
+ * allocated for each active stream. The requests are kept across capture
+ * sessions until the buffers are freed.
+ */
+int Camera::createSpareRequests()
+{
+	for (Stream *stream : p_->activeStreams_) {
+		if (!allocator_ || allocator_->buffers(stream).empty()) {
+			LOG(Camera, Error)
+				<< "The latest frames mode requires allocated buffers";
+			return -EINVAL;
+		}
+
+		int ret = allocator_->allocateSpares(stream, p_->latestFrames_);
+		if (ret < 0)
+			return ret;
+	}
+
+	for (unsigned int i = 0; i < p_->latestFrames_; ++i) {
+		std::unique_ptr<Request> spare = std::make_unique<Request>(this);
+		spare->spare_ = true;
+
+		for (Stream *stream : p_->activeStreams_) {
+			FrameBuffer *buffer = allocator_->spareBuffers(stream)[i].get();
+			spare->addBuffer(stream, buffer);
+		}
+
+		p_->spares_.push_back(std::move(spare));
+	}
+
+	return 0;
+}
+
 /**
  * \brief Stop capture from camera
  *
@@ -892,6 +2229,7 @@ int Camera::start()
  * \return 0 on success or a negative error code otherwise
  * \retval -ENODEV The camera has been disconnected from the system
  * \retval -EACCES The camera is not running so can't be stopped
+ * \retval -EBUSY An asynchronous operation is pending
  */
 int Camera::stop()
 {
@@ -899,34 +2237,182 @@ int Camera::stop()
 	if (ret < 0)
 		return ret;
 
+	if (p_->operationPending_)
+		return -EBUSY;
+
 	LOG(Camera, Debug) << "Stopping capture";
 
 	p_->setState(Private::CameraConfigured);
 
-	p_->pipe_->stop(this);
+	p_->invokePipeline(&PipelineHandler::stop, this);
 
 	for (Stream *stream : p_->activeStreams_) {
 		if (allocator_ && !allocator_->buffers(stream).empty())
 			continue;
 
-		p_->pipe_->freeFrameBuffers(this, stream);
+		p_->invokePipeline(&PipelineHandler::freeFrameBuffers, this, stream);
 	}
 
 	return 0;
 }
 
+/**
+ * \brief Retrieve a snapshot of the camera statistics
+ *
+ * The statistics are reset when the camera is started, and cover the current
+ * or last capture session. This method may be called from any thread.
+ *
+ * \return The camera statistics
+ */
+CameraStatistics Camera::statistics() const
+{
+	return p_->statistics();
+}
+
+/**
+ * \brief Retrieve the memory usage of the buffers used by the camera
+ *
+ * Report the buffers used by the camera in its current configuration, grouped
+ * in pools:
+ *
+ * - one BufferPoolUsage::Exported pool per stream with buffers allocated by
+ *   a FrameBufferAllocator
+ * - one BufferPoolUsage::Exported pool named "pool" with the buffers kept by
+ *   the FrameBufferAllocator for reuse, not associated with any stream
+ * - one BufferPoolUsage::Imported pool per stream with application buffers,
+ *   counting the distinct buffers queued since the camera has been configured
+ * - the BufferPoolUsage::Internal pools allocated by the pipeline handler,
+ *   which for most pipeline handlers only exist once the camera has been
+ *   started, and may be kept when it is stopped until it is reconfigured or
+ *   released
+ *
+ * Empty pools are not reported. This method shall be called from the thread
+ * that controls the camera.
+ *
+ * \return The usage of each buffer pool
+ */
+std::vector<BufferPoolUsage> Camera::bufferUsage() const
+{
+	std::vector<BufferPoolUsage> pools;
+
+	for (Stream *stream : p_->activeStreams_) {
+		if (!allocator_)
+			break;
+
+		const std::vector<std::unique_ptr<FrameBuffer>> &buffers =
+			allocator_->buffers(stream);
+		if (buffers.empty())
+			continue;
+
+		BufferPoolUsage usage(BufferPoolUsage::Exported, stream);
+		usage.add(buffers);
+		usage.add(allocator_->spareBuffers(stream));
+		pools.push_back(usage);
+	}
+
+	if (allocator_ && !allocator_->pool_.empty()) {
+		BufferPoolUsage usage(BufferPoolUsage::Exported, nullptr, "pool");
+		for (const FrameBufferAllocator::PooledBuffers &pooled : allocator_->pool_)
+			usage.add(pooled.buffers);
+		pools.push_back(usage);
+	}
+
+	p_->importedBufferUsage(&pools);
+	p_->invokePipeline(&PipelineHandler::bufferUsage, this, &pools);
+
+	return pools;
+}
+
+/**
+ * \brief Account for an idle pause of the device in the statistics
+ *
+ * This method is called by the pipeline handler when it stops the device as
+ * no request is queued.
+ */
+void Camera::idlePaused()
+{
+	p_->idlePaused();
+}
+
+/**
+ * \brief Account for the device resuming after an idle pause
+ * \param[in] latency The time in microseconds from the resume to the first
+ * completed frame
+ *
+ * This method is called by the pipeline handler when the first frame captured
+ * after resuming the device completes.
+ */
+void Camera::idleResumed(uint64_t latency)
+{
+	p_->idleResumed(latency);
+}
+
+/**
+ * \brief Account for frame statistics skipped by the pipeline handler
+ *
+ * This method is called by the pipeline handler when it doesn't hand the
+ * statistics of a frame to the IPA, as the IPA is running late.
+ */
+void Camera::statisticsSkipped()
+{
+	p_->statisticsSkipped();
+}
+
+/**
+ * \brief Account for CPU time consumed for the camera
+ * \param[in] times The CPU time in nanoseconds, per component
+ *
+ * This method is called by CpuScope when leaving a scope related to the
+ * camera.
+ */
+void Camera::accountCpuTime(const std::array<uint64_t, CameraStatistics::CpuComponents> &times)
+{
+	p_->cpuTimeAccounted(times);
+}
+
 /**
  * \brief Handle request completion and notify application
  * \param[in] request The request that has completed
  *
  * This function is called by the pipeline handler to notify the camera that
- * the request has completed. It emits the requestCompleted signal and deletes
- * the request.
+ * the request has completed. It emits the requestCompleted signal and hands
+ * the request over to its completion handler if it has been queued with one.
  */
 void Camera::requestComplete(Request *request)
 {
+	p_->requestCompleted(request);
+
+	/*
+	 * Detach the completion handler before emitting the requestCompleted
+	 * signal, as the application may delete the request in its signal
+	 * handler. The completion handler is deleted after the invocation
+	 * completes.
+	 */
+	BoundMethodArgs<void, Request *> *completion = request->completion_;
+	request->completion_ = nullptr;
+
+	CpuScope scope(CameraStatistics::CpuApplication, this);
+
 	requestCompleted.emit(request);
-	delete request;
+
+	if (completion)
+		completion->activate(request, true);
+}
+
+/**
+ * \brief Take the requests submitted from other threads
+ * \param[in] close Reject further submissions
+ *
+ * This method is called by the pipeline handler, in its thread, to take the
+ * requests handed over by queueRequest() from other threads. When \a close is
+ * true, further submissions are rejected until the camera is started again.
+ *
+ * \return The first submitted request, the next ones being linked in
+ * submission order, or nullptr if no request has been submitted
+ */
+Request *Camera::takeSubmittedRequests(bool close)
+{
+	return p_->takeSubmittedRequests(close);
 }
 
 } /* namespace libcamera */
@@ -7,6 +7,8 @@
 
 #include "camera_controls.h"
 
+#include <algorithm>
+
 #include <libcamera/camera.h>
 #include <libcamera/controls.h>
 
@@ -17,12 +19,55 @@
 
 namespace libcamera {
 
+namespace {
+
+/*
+ * Controls with numerical IDs lower than this limit are stored in a table
+ * indexed by ID. This covers all libcamera controls, while preventing large
+ * IDs from causing large allocations.
+ */
+static constexpr unsigned int DenseTableLimit = 1024;
+
+int64_t integerValue(const ControlValue &value)
+{
+	switch (value.type()) {
+	case ControlTypeBool:
+		return value.get<bool>();
+	case ControlTypeByte:
+		return value.get<uint8_t>();
+	case ControlTypeInteger32:
+		return value.get<int32_t>();
+	case ControlTypeInteger64:
+		return value.get<int64_t>();
+	case ControlTypeFloat:
+		return value.get<float>();
+	default:
+		return 0;
+	}
+}
+
+float realValue(const ControlValue &value)
+{
+	if (value.type() == ControlTypeFloat)
+		return value.get<float>();
+
+	return integerValue(value);
+}
+
+} /* namespace */
+
 /**
  * \class CameraControlValidator
  * \brief A control validator for Camera instances
  *
  * This ControlValidator specialisation validates that controls exist in the
- * Camera associated with the validator.
+ * Camera associated with the validator, and that their values match the type
+ * and range of the camera controls.
+ *
+ * To make validation cheap, the validator stores the type and range of all
+ * controls of the camera in a table indexed by control ID. The table is built
+ * at construction time and shall be rebuilt with update() when the camera
+ * controls change.
  */
 
 /**
@@ -32,6 +77,69 @@ namespace libcamera {
 CameraControlValidator::CameraControlValidator(Camera *camera)
 	: camera_(camera)
 {
+	update();
+}
+
+/**
+ * \brief Rebuild the validation table from the camera controls
+ *
+ * The type and limits of all controls supported by the camera are extracted
+ * from the camera ControlInfoMap. This method shall be called when the camera
+ * controls change, typically when the camera is configured.
+ */
+void CameraControlValidator::update()
+{
+	const ControlInfoMap &controls = camera_->controls();
+
+	table_.clear();
+	sparse_.clear();
+
+	for (const auto &ctrl : controls) {
+		const ControlRange &range = ctrl.second;
+		const ControlValue &min = range.min();
+		const ControlValue &max = range.max();
+
+		Entry entry{};
+		entry.valid = true;
+		entry.type = ctrl.first->type();
+		entry.rangeType = ControlTypeNone;
+
+		/* Only scalar ranges of identical types are enforced. */
+		if (!min.isArray() && !max.isArray() && min.type() == max.type()) {
+			switch (min.type()) {
+			case ControlTypeBool:
+			case ControlTypeByte:
+			case ControlTypeInteger32:
+			case ControlTypeInteger64:
+				entry.rangeType = ControlTypeInteger64;
+				entry.min.integer = integerValue(min);
+				entry.max.integer = integerValue(max);
+				break;
+			case ControlTypeFloat:
+				entry.rangeType = ControlTypeFloat;
+				entry.min.real = realValue(min);
+				entry.max.real = realValue(max);
+				break;
+			default:
+				break;
+			}
+		}
+
+		unsigned int id = ctrl.first->id();
+		if (id < DenseTableLimit) {
+			if (id >= table_.size())
+				table_.resize(id + 1, Entry{});
+			table_[id] = entry;
+		} else {
+			sparse_.emplace_back(id, entry);
+		}
+	}
+
+	std::sort(sparse_.begin(), sparse_.end(),
+		  [](const std::pair<unsigned int, Entry> &a,
+		     const std::pair<unsigned int, Entry> &b) {
+			  return a.first < b.first;
+		  });
 }
 
 const std::string &CameraControlValidator::name() const
@@ -46,8 +154,90 @@ const std::string &CameraControlValidator::name() const
  */
 bool CameraControlValidator::validate(unsigned int id) const
 {
-	const ControlInfoMap &controls = camera_->controls();
-	return controls.find(id) != controls.end();
+	return entry(id) != nullptr;
+}
+
+/**
+ * \brief Validate a control and its value
+ * \param[in] id The control ID
+ * \param[in] value The control value
+ *
+ * The control is valid if it is supported by the camera, if the type of
+ * \a value matches the control type, and if the \a value is within the
+ * control range for scalar values.
+ *
+ * \return True if the control and its value are valid, false otherwise
+ */
+bool CameraControlValidator::validate(unsigned int id,
+				      const ControlValue &value) const
+{
+	const Entry *e = entry(id);
+	if (!e)
+		return false;
+
+	return validate(*e, value);
+}
+
+/**
+ * \brief Validate all controls of a list
+ * \param[in] list The control list
+ * \return True if all the controls in the list are valid, false otherwise
+ */
+bool CameraControlValidator::validate(const ControlList &list) const
+{
+	for (const auto &ctrl : list) {
+		const Entry *e = entry(ctrl.first);
+		if (!e || !validate(*e, ctrl.second))
+			return false;
+	}
+
+	return true;
+}
+
+const CameraControlValidator::Entry *CameraControlValidator::entry(unsigned int id) const
+{
+	if (id < DenseTableLimit) {
+		if (id >= table_.size() || !table_[id].valid)
+			return nullptr;
+
+		return &table_[id];
+	}
+
+	auto iter = std::lower_bound(sparse_.begin(), sparse_.end(), id,
+				     [](const std::pair<unsigned int, Entry> &e,
+					unsigned int id) {
+					     return e.first < id;
+				     });
+	if (iter == sparse_.end() || iter->first != id)
+		return nullptr;
+
+	return &iter->second;
+}
+
+bool CameraControlValidator::validate(const Entry &entry,
+				      const ControlValue &value) const
+{
+	if (value.type() != entry.type)
+		return false;
+
+	/* Ranges apply to scalar values only. */
+	if (value.isArray())
+		return true;
+
+	switch (entry.rangeType) {
+	case ControlTypeInteger64: {
+		int64_t v = integerValue(value);
+		return v >= entry.min.integer && v <= entry.max.integer;
+	}
+
+	case ControlTypeFloat: {
+		float v = realValue(value);
+		return v >= entry.min.real && v <= entry.max.real;
+	}
+
+	default:
+		return true;
+	}
 }
 
 } /* namespace libcamera */
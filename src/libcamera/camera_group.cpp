@@ -0,0 +1,335 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * camera_group.cpp - Synchronised capture from multiple cameras
+ */
+
+#include <libcamera/camera_group.h>
+
+#include <algorithm>
+#include <set>
+
+#include <libcamera/buffer.h>
+#include <libcamera/camera.h>
+#include <libcamera/control_ids.h>
+#include <libcamera/request.h>
+
+#include "log.h"
+
+/**
+ * \file camera_group.h
+ * \brief Synchronised capture from multiple cameras
+ */
+
+namespace libcamera {
+
+LOG_DEFINE_CATEGORY(CameraGroup)
+
+/**
+ * \class CameraGroup
+ * \brief Capture frames from multiple cameras in lockstep
+ *
+ * The CameraGroup class groups cameras that capture the same scene, such as
+ * the two cameras of a stereo pair, and delivers their frames in sets
+ * captured at the same time.
+ *
+ * The cameras are acquired and configured individually by the application.
+ * The group then controls streaming on all of them: start() starts all
+ * cameras back to back, and queueRequests() queues one request to each
+ * camera. The group matches completed requests across cameras based on the
+ * timestamp of their first buffer, and emits the requestsCompleted signal for
+ * each set of requests whose timestamps are within the tolerance() of each
+ * other. Requests that can't be matched, because they failed or because a
+ * matching frame has been dropped by another camera, are reported through
+ * the requestDropped signal.
+ *
+ * When the cameras support hardware synchronisation, through the
+ * controls::SyncMode control, the group configures the first camera as the
+ * synchronisation master and the other cameras as slaves. Otherwise the
+ * cameras stream freely and the timestamp tolerance shall account for the
+ * phase difference between their frames.
+ *
+ * Requests queued through the group stay owned by the application, and shall
+ * not be queued to the cameras directly. They can be reused and queued again
+ * from the requestsCompleted and requestDropped signal handlers.
+ */
+
+/**
+ * \brief Create a group of cameras
+ * \param[in] cameras The cameras, the first one acting as the sync master
+ *
+ * The \a cameras shall be distinct. The order of the cameras defines the order
+ * of the requests passed to queueRequests() and reported by the
+ * requestsCompleted signal.
+ */
+CameraGroup::CameraGroup(const std::vector<std::shared_ptr<Camera>> &cameras)
+	: cameras_(cameras), tolerance_(std::chrono::milliseconds(1)),
+	  running_(false), syncPending_(false), completed_(cameras.size())
+{
+}
+
+CameraGroup::~CameraGroup()
+{
+	if (running_)
+		stop();
+}
+
+/**
+ * \fn CameraGroup::cameras()
+ * \brief Retrieve the cameras in the group
+ * \return The cameras in the group, in the order they have been given to the
+ * constructor
+ */
+
+/**
+ * \brief Set the maximum timestamp difference between matched requests
+ * \param[in] tolerance The tolerance
+ *
+ * Completed requests are considered to belong to the same set when the
+ * timestamps of their frames differ by \a tolerance at most. The default
+ * tolerance is 1ms.
+ */
+void CameraGroup::setTolerance(std::chrono::nanoseconds tolerance)
+{
+	tolerance_ = tolerance;
+}
+
+/**
+ * \fn CameraGroup::tolerance()
+ * \brief Retrieve the maximum timestamp difference between matched requests
+ * \return The timestamp tolerance
+ */
+
+/**
+ * \brief Start capture on all cameras of the group
+ *
+ * All cameras shall have been configured. The slave cameras are started first,
+ * and the master camera last, to ensure that the slaves don't miss the first
+ * synchronisation signals. If any camera fails to start, the cameras already
+ * started are stopped.
+ *
+ * \return 0 on success or a negative error code otherwise
+ * \retval -EINVAL The group is empty or contains the same camera twice
+ * \retval -EBUSY The group is already running
+ */
+int CameraGroup::start()
+{
+	if (running_)
+		return -EBUSY;
+
+	std::set<Camera *> cameras;
+	for (const std::shared_ptr<Camera> &camera : cameras_)
+		cameras.insert(camera.get());
+
+	if (cameras.empty() || cameras.size() != cameras_.size()) {
+		LOG(CameraGroup, Error) << "Invalid cameras in group";
+		return -EINVAL;
+	}
+
+	for (auto it = cameras_.rbegin(); it != cameras_.rend(); ++it) {
+		int ret = (*it)->start();
+		if (ret < 0) {
+			LOG(CameraGroup, Error)
+				<< "Failed to start camera " << (*it)->name();
+
+			for (auto started = cameras_.rbegin(); started != it; ++started)
+				(*started)->stop();
+
+			return ret;
+		}
+	}
+
+	running_ = true;
+	syncPending_ = true;
+
+	return 0;
+}
+
+/**
+ * \brief Stop capture on all cameras of the group
+ *
+ * All pending requests are cancelled and reported through the requestDropped
+ * signal, as are the completed requests that haven't been matched yet.
+ *
+ * \return 0 on success or a negative error code otherwise
+ * \retval -EACCES The group is not running
+ */
+int CameraGroup::stop()
+{
+	if (!running_)
+		return -EACCES;
+
+	running_ = false;
+
+	int ret = 0;
+	for (const std::shared_ptr<Camera> &camera : cameras_) {
+		int err = camera->stop();
+		if (err < 0 && !ret)
+			ret = err;
+	}
+
+	for (unsigned int i = 0; i < completed_.size(); ++i) {
+		while (!completed_[i].empty())
+			dropRequest(i);
+	}
+
+	return ret;
+}
+
+/**
+ * \brief Queue one request to each camera of the group
+ * \param[in] requests The requests, one per camera in the group order
+ *
+ * Each request shall have been created by the camera at the same index in the
+ * group. The first requests queued after start() carry the controls::SyncMode
+ * control for the cameras that support it.
+ *
+ * If queuing fails for one of the cameras, the requests already queued to the
+ * previous cameras will be reported through the requestDropped signal.
+ *
+ * \return 0 on success or a negative error code otherwise
+ * \retval -EACCES The group is not running
+ * \retval -EINVAL The number of requests doesn't match the number of cameras
+ */
+int CameraGroup::queueRequests(const std::vector<Request *> &requests)
+{
+	if (!running_)
+		return -EACCES;
+
+	if (requests.size() != cameras_.size()) {
+		LOG(CameraGroup, Error)
+			<< "Expected " << cameras_.size() << " requests, got "
+			<< requests.size();
+		return -EINVAL;
+	}
+
+	if (syncPending_) {
+		for (unsigned int i = 0; i < cameras_.size(); ++i) {
+			if (!cameras_[i]->controls().count(&controls::SyncMode))
+				continue;
+
+			requests[i]->controls().set(controls::SyncMode, i ? 2 : 1);
+		}
+
+		syncPending_ = false;
+	}
+
+	for (unsigned int i = 0; i < cameras_.size(); ++i) {
+		Request *request = requests[i];
+		queued_[request] = i;
+
+		int ret = cameras_[i]->queueRequest(request,
+			new BoundMethodMember<CameraGroup, void, Request *>(
+				this, this, &CameraGroup::requestComplete));
+		if (ret < 0) {
+			LOG(CameraGroup, Error)
+				<< "Failed to queue request to camera "
+				<< cameras_[i]->name();
+			queued_.erase(request);
+			return ret;
+		}
+	}
+
+	return 0;
+}
+
+/**
+ * \var CameraGroup::requestsCompleted
+ * \brief Signal emitted when a set of matching requests has completed
+ *
+ * The requests are passed in the order of the cameras in the group.
+ */
+
+/**
+ * \var CameraGroup::requestDropped
+ * \brief Signal emitted when a request can't be matched
+ *
+ * The signal carries the index of the camera in the group and the request.
+ */
+
+void CameraGroup::requestComplete(Request *request)
+{
+	auto it = queued_.find(request);
+	ASSERT(it != queued_.end());
+
+	unsigned int index = it->second;
+	queued_.erase(it);
+
+	completed_[index].push_back(request);
+
+	if (!running_) {
+		dropRequest(index);
+		return;
+	}
+
+	pairRequests();
+}
+
+/*
+ * Match the oldest completed request of every camera. As requests complete in
+ * order for each camera, the request with the earliest timestamp can't match
+ * any of the requests that will complete later if it doesn't match the other
+ * cameras' oldest requests, and is dropped.
+ */
+void CameraGroup::pairRequests()
+{
+	while (std::all_of(completed_.begin(), completed_.end(),
+			   [](const std::deque<Request *> &queue) {
+				   return !queue.empty();
+			   })) {
+		std::vector<Request *> requests;
+		uint64_t earliest = UINT64_MAX;
+		uint64_t latest = 0;
+		unsigned int oldest = 0;
+		bool failed = false;
+
+		for (unsigned int i = 0; i < completed_.size(); ++i) {
+			Request *request = completed_[i].front();
+			const FrameBuffer *buffer = request->buffers().begin()->second;
+
+			if (request->status() != Request::RequestComplete ||
+			    buffer->metadata().status != FrameMetadata::FrameSuccess) {
+				dropRequest(i);
+				failed = true;
+				break;
+			}
+
+			uint64_t timestamp = buffer->metadata().timestamp;
+			if (timestamp < earliest) {
+				earliest = timestamp;
+				oldest = i;
+			}
+			latest = std::max(latest, timestamp);
+
+			requests.push_back(request);
+		}
+
+		if (failed)
+			continue;
+
+		if (latest - earliest > static_cast<uint64_t>(tolerance_.count())) {
+			LOG(CameraGroup, Debug)
+				<< "Timestamps differ by " << latest - earliest
+				<< "ns, dropping frame from camera "
+				<< cameras_[oldest]->name();
+			dropRequest(oldest);
+			continue;
+		}
+
+		for (std::deque<Request *> &queue : completed_)
+			queue.pop_front();
+
+		requestsCompleted.emit(requests);
+	}
+}
+
+void CameraGroup::dropRequest(unsigned int index)
+{
+	Request *request = completed_[index].front();
+	completed_[index].pop_front();
+
+	requestDropped.emit(index, request);
+}
+
+} /* namespace libcamera */
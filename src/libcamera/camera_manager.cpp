@@ -8,15 +8,19 @@
 #include <libcamera/camera_manager.h>
 
 #include <map>
+#include <mutex>
+#include <stdlib.h>
 
 #include <libcamera/camera.h>
 #include <libcamera/event_dispatcher.h>
 
+#include "device_cache.h"
 #include "device_enumerator.h"
-#include "event_dispatcher_poll.h"
+#include "event_dispatcher_epoll.h"
 #include "log.h"
 #include "pipeline_handler.h"
 #include "thread.h"
+#include "tracer.h"
 #include "utils.h"
 
 /**
@@ -35,31 +39,126 @@ public:
 
 	int start();
 	void stop();
+	int matchDevice(dev_t devnum);
 
 	void addCamera(std::shared_ptr<Camera> &camera, dev_t devnum);
-	void removeCamera(Camera *camera);
+	std::shared_ptr<Camera> removeCamera(Camera *camera);
 
+	/*
+	 * Cameras are added and removed from the pipeline handler threads,
+	 * the mutex protects the camera lists.
+	 */
+	mutable Mutex mutex_;
 	std::vector<std::shared_ptr<Camera>> cameras_;
 	std::map<dev_t, std::weak_ptr<Camera>> camerasByDevnum_;
 
+	bool deferMatching_;
+
 private:
+	void parsePipelineThreads();
+	void createPipelineHandlers();
+
 	CameraManager *cm_;
 
 	std::vector<std::shared_ptr<PipelineHandler>> pipes_;
+	std::unique_ptr<DeviceCache> cache_;
 	std::unique_ptr<DeviceEnumerator> enumerator_;
+
+	bool pipelineThreads_;
+	std::vector<unsigned int> pipelineCpus_;
+	unsigned int nextCpu_;
 };
 
 CameraManager::Private::Private(CameraManager *cm)
-	: cm_(cm)
+	: deferMatching_(false), cm_(cm), pipelineThreads_(false), nextCpu_(0)
 {
 }
 
 int CameraManager::Private::start()
 {
+	/*
+	 * Populate the media devices and match the pipeline handlers from the
+	 * device cache when possible, and update it when done.
+	 */
+	cache_ = std::make_unique<DeviceCache>(DeviceCache::defaultPath());
+	cache_->load();
+
 	enumerator_ = DeviceEnumerator::create();
-	if (!enumerator_ || enumerator_->enumerate())
+	if (!enumerator_)
+		return -ENODEV;
+
+	enumerator_->setCache(cache_.get());
+
+	LIBCAMERA_TRACEPOINT(DeviceEnumerateBegin, 0);
+	int ret = enumerator_->enumerate();
+	LIBCAMERA_TRACEPOINT(DeviceEnumerateEnd, ret);
+	if (ret)
+		return -ENODEV;
+
+	parsePipelineThreads();
+
+	/* With deferred matching, devices are matched by matchDevice(). */
+	if (deferMatching_)
+		return 0;
+
+	createPipelineHandlers();
+
+	enumerator_->devicesAdded.connect(this, &Private::createPipelineHandlers);
+
+	return 0;
+}
+
+int CameraManager::Private::matchDevice(dev_t devnum)
+{
+	if (!enumerator_)
 		return -ENODEV;
 
+	{
+		MutexLocker locker(mutex_);
+		if (camerasByDevnum_.count(devnum))
+			return 0;
+	}
+
+	/*
+	 * Restrict the search to the media device of the node. Media devices
+	 * already acquired are skipped by the search, the pipeline handlers
+	 * thus don't match twice.
+	 */
+	enumerator_->setFilter(devnum);
+	createPipelineHandlers();
+	enumerator_->setFilter(0);
+
+	MutexLocker locker(mutex_);
+	return camerasByDevnum_.count(devnum) ? 0 : -ENODEV;
+}
+
+void CameraManager::Private::parsePipelineThreads()
+{
+	pipelineThreads_ = !!utils::secure_getenv("LIBCAMERA_PIPELINE_THREADS");
+	pipelineCpus_.clear();
+	nextCpu_ = 0;
+
+	const char *cpus = utils::secure_getenv("LIBCAMERA_PIPELINE_CPUS");
+	if (!pipelineThreads_ || !cpus)
+		return;
+
+	while (*cpus) {
+		char *end;
+		unsigned long cpu = strtoul(cpus, &end, 10);
+		if (end == cpus || (*end && *end != ',')) {
+			LOG(Camera, Warning)
+				<< "Invalid LIBCAMERA_PIPELINE_CPUS value, ignoring";
+			pipelineCpus_.clear();
+			return;
+		}
+
+		pipelineCpus_.push_back(cpu);
+		cpus = *end ? end + 1 : end;
+	}
+}
+
+void CameraManager::Private::createPipelineHandlers()
+{
 	/*
 	 * TODO: Try to read handlers and order from configuration
 	 * file and only fallback on all handlers if there is no
@@ -67,14 +166,41 @@ int CameraManager::Private::start()
 	 */
 	std::vector<PipelineHandlerFactory *> &factories = PipelineHandlerFactory::factories();
 
-	for (PipelineHandlerFactory *factory : factories) {
+	for (unsigned int index = 0; index < factories.size(); ++index) {
+		PipelineHandlerFactory *factory = factories[index];
+
 		/*
 		 * Try each pipeline handler until it exhaust
 		 * all pipelines it can provide.
 		 */
 		while (1) {
 			std::shared_ptr<PipelineHandler> pipe = factory->create(cm_);
-			if (!pipe->match(enumerator_.get()))
+
+			if (pipelineThreads_) {
+				std::vector<unsigned int> cpus;
+				if (!pipelineCpus_.empty()) {
+					cpus.push_back(pipelineCpus_[nextCpu_]);
+					nextCpu_ = (nextCpu_ + 1) % pipelineCpus_.size();
+				}
+
+				int ret = pipe->createThread(cpus);
+				if (ret)
+					LOG(Camera, Warning)
+						<< "Failed to create thread for pipeline handler \""
+						<< factory->name() << "\": " << strerror(-ret);
+			}
+
+			/*
+			 * Match in the pipeline handler thread, to bind the
+			 * devices, timers and IPA modules it creates to that
+			 * thread.
+			 */
+			LIBCAMERA_TRACEPOINT(PipelineMatchBegin, index);
+			bool matched = pipe->invokeMethod(&PipelineHandler::match,
+							  ConnectionTypeBlocking,
+							  enumerator_.get());
+			LIBCAMERA_TRACEPOINT(PipelineMatchEnd, index, matched);
+			if (!matched)
 				break;
 
 			LOG(Camera, Debug)
@@ -84,29 +210,32 @@ int CameraManager::Private::start()
 		}
 	}
 
-	/* TODO: register hot-plug callback here */
-
-	return 0;
+	cache_->save();
 }
 
 void CameraManager::Private::stop()
 {
-	/* TODO: unregister hot-plug callback here */
-
 	/*
 	 * Release all references to cameras and pipeline handlers to ensure
 	 * they all get destroyed before the device enumerator deletes the
 	 * media devices.
 	 */
 	pipes_.clear();
+
+	MutexLocker locker(mutex_);
 	cameras_.clear();
+	camerasByDevnum_.clear();
+	locker.unlock();
 
 	enumerator_.reset(nullptr);
+	cache_.reset();
 }
 
 void CameraManager::Private::addCamera(std::shared_ptr<Camera> &camera,
 				       dev_t devnum)
 {
+	MutexLocker locker(mutex_);
+
 	for (std::shared_ptr<Camera> c : cameras_) {
 		if (c->name() == camera->name()) {
 			LOG(Camera, Warning)
@@ -124,14 +253,16 @@ void CameraManager::Private::addCamera(std::shared_ptr<Camera> &camera,
 	}
 }
 
-void CameraManager::Private::removeCamera(Camera *camera)
+std::shared_ptr<Camera> CameraManager::Private::removeCamera(Camera *camera)
 {
+	MutexLocker locker(mutex_);
+
 	auto iter = std::find_if(cameras_.begin(), cameras_.end(),
 				 [camera](std::shared_ptr<Camera> &c) {
 					 return c.get() == camera;
 				 });
 	if (iter == cameras_.end())
-		return;
+		return nullptr;
 
 	LOG(Camera, Debug)
 		<< "Unregistering camera '" << camera->name() << "'";
@@ -143,7 +274,10 @@ void CameraManager::Private::removeCamera(Camera *camera)
 	if (iter_d != camerasByDevnum_.end())
 		camerasByDevnum_.erase(iter_d);
 
+	std::shared_ptr<Camera> removed = std::move(*iter);
 	cameras_.erase(iter);
+
+	return removed;
 }
 
 /**
@@ -174,9 +308,24 @@ void CameraManager::Private::removeCamera(Camera *camera)
  * references it held to cameras, the camera manager can be stopped with
  * stop().
  *
- * \todo Add interface to register a notification callback to the user to be
- * able to inform it new cameras have been hot-plugged or cameras have been
- * removed due to hot-unplug.
+ * Cameras are registered one pipeline handler at a time while the camera
+ * manager starts. Applications that want to use cameras as soon as they are
+ * available, or to be notified of hot-plugged and hot-unplugged cameras, can
+ * connect to the cameraAdded and cameraRemoved signals before calling start().
+ *
+ * All pipeline handlers run by default in the thread of the camera manager,
+ * sharing a single event loop. Setting the LIBCAMERA_PIPELINE_THREADS
+ * environment variable runs each pipeline handler in a thread of its own, to
+ * isolate the cameras of different pipeline handlers from each other. The
+ * threads can additionally be pinned to CPUs with the LIBCAMERA_PIPELINE_CPUS
+ * environment variable, which contains a comma-separated list of CPU numbers
+ * assigned to the pipeline handlers in a round-robin fashion. In that case the
+ * cameraAdded and cameraRemoved signals, as well as the camera signals, are
+ * emitted from the pipeline handler threads.
+ *
+ * The V4L2 compatibility layer only needs the camera of the device node opened
+ * by the application. It defers matching pipeline handlers with
+ * setDeferredMatching() and matches them for that node with matchDevice().
  */
 
 CameraManager *CameraManager::self_ = nullptr;
@@ -198,6 +347,23 @@ CameraManager::~CameraManager()
 	self_ = nullptr;
 }
 
+/**
+ * \brief Defer matching the pipeline handlers until a device is requested
+ * \param[in] enable True to defer matching, false to match at start time
+ *
+ * By default start() matches all pipeline handlers with all media devices in
+ * the system, and matches again when devices are hot-plugged. When matching is
+ * deferred, start() only enumerates the media devices, and no camera is
+ * registered until requested by device number through matchDevice().
+ *
+ * This method is meant solely for the use of the V4L2 compatibility layer, and
+ * shall be called before start().
+ */
+void CameraManager::setDeferredMatching(bool enable)
+{
+	p_->deferMatching_ = enable;
+}
+
 /**
  * \brief Start the camera manager
  *
@@ -212,7 +378,9 @@ int CameraManager::start()
 {
 	LOG(Camera, Info) << "libcamera " << version_;
 
+	LIBCAMERA_TRACEPOINT(CameraManagerStartBegin, 0);
 	int ret = p_->start();
+	LIBCAMERA_TRACEPOINT(CameraManagerStartEnd, cameras().size());
 	if (ret)
 		LOG(Camera, Error) << "Failed to start camera manager: "
 				   << strerror(-ret);
@@ -246,6 +414,8 @@ void CameraManager::stop()
  */
 std::vector<std::shared_ptr<Camera>> CameraManager::cameras() const
 {
+	MutexLocker locker(p_->mutex_);
+
 	return p_->cameras_;
 }
 
@@ -260,6 +430,8 @@ std::vector<std::shared_ptr<Camera>> CameraManager::cameras() const
  */
 std::shared_ptr<Camera> CameraManager::get(const std::string &name)
 {
+	MutexLocker locker(p_->mutex_);
+
 	for (std::shared_ptr<Camera> camera : p_->cameras_) {
 		if (camera->name() == name)
 			return camera;
@@ -284,6 +456,8 @@ std::shared_ptr<Camera> CameraManager::get(const std::string &name)
  */
 std::shared_ptr<Camera> CameraManager::get(dev_t devnum)
 {
+	MutexLocker locker(p_->mutex_);
+
 	auto iter = p_->camerasByDevnum_.find(devnum);
 	if (iter == p_->camerasByDevnum_.end())
 		return nullptr;
@@ -291,6 +465,27 @@ std::shared_ptr<Camera> CameraManager::get(dev_t devnum)
 	return iter->second.lock();
 }
 
+/**
+ * \brief Match pipeline handlers for a device node
+ * \param[in] devnum Device number of the node
+ *
+ * Match the pipeline handlers against the media device that contains the
+ * device node \a devnum only, to register the camera of the node without
+ * bringing up the other cameras in the system. Nothing is matched if a camera
+ * is already registered for \a devnum.
+ *
+ * This method is meant solely for the use of the V4L2 compatibility layer,
+ * with matching deferred by setDeferredMatching(). It shall be called from the
+ * thread of the camera manager.
+ *
+ * \return 0 if a camera is registered for \a devnum, or a negative error code
+ * otherwise
+ */
+int CameraManager::matchDevice(dev_t devnum)
+{
+	return p_->matchDevice(devnum);
+}
+
 /**
  * \brief Add a camera to the camera manager
  * \param[in] camera The camera to be added
@@ -305,8 +500,11 @@ std::shared_ptr<Camera> CameraManager::get(dev_t devnum)
  */
 void CameraManager::addCamera(std::shared_ptr<Camera> camera, dev_t devnum)
 {
+	std::shared_ptr<Camera> added = camera;
 
 	p_->addCamera(camera, devnum);
+
+	cameraAdded.emit(added);
 }
 
 /**
@@ -319,9 +517,29 @@ void CameraManager::addCamera(std::shared_ptr<Camera> camera, dev_t devnum)
  */
 void CameraManager::removeCamera(Camera *camera)
 {
-	p_->removeCamera(camera);
+	std::shared_ptr<Camera> removed = p_->removeCamera(camera);
+	if (removed)
+		cameraRemoved.emit(removed);
 }
 
+/**
+ * \var CameraManager::cameraAdded
+ * \brief Notify of a new camera added to the system
+ *
+ * This signal is emitted when a new camera is registered with the camera
+ * manager, either while the camera manager starts or when a camera is
+ * hot-plugged. The camera is available through cameras() and get() when the
+ * signal is emitted.
+ */
+
+/**
+ * \var CameraManager::cameraRemoved
+ * \brief Notify of a camera removed from the system
+ *
+ * This signal is emitted when a camera is unregistered from the camera
+ * manager, typically when the camera is hot-unplugged.
+ */
+
 /**
  * \fn const std::string &CameraManager::version()
  * \brief Retrieve the libcamera version string
@@ -336,7 +554,7 @@ void CameraManager::removeCamera(Camera *camera)
  * timers with the application event loop. Applications that want to provide
  * their own event dispatcher shall call this function once and only once before
  * the camera manager is started with start(). If no event dispatcher is
- * provided, a default poll-based implementation will be used.
+ * provided, a default epoll-based implementation will be used.
  *
  * The CameraManager takes ownership of the event dispatcher and will delete it
  * when the application terminates.
@@ -350,7 +568,7 @@ void CameraManager::setEventDispatcher(std::unique_ptr<EventDispatcher> dispatch
  * \brief Retrieve the event dispatcher
  *
  * This function retrieves the event dispatcher set with setEventDispatcher().
- * If no dispatcher has been set, a default poll-based implementation is created
+ * If no dispatcher has been set, a default epoll-based implementation is created
  * and returned, and no custom event dispatcher may be installed anymore.
  *
  * The returned event dispatcher is valid until the camera manager is destroyed.
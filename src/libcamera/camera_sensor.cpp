@@ -12,6 +12,11 @@
 #include <iomanip>
 #include <limits.h>
 #include <math.h>
+#include <tuple>
+
+#include <linux/v4l2-controls.h>
+
+#include <libcamera/controls.h>
 
 #include "formats.h"
 #include "utils.h"
@@ -26,6 +31,15 @@ namespace libcamera {
 
 LOG_DEFINE_CATEGORY(CameraSensor);
 
+namespace {
+
+uint64_t area(const Size &size)
+{
+	return static_cast<uint64_t>(size.width) * size.height;
+}
+
+} /* namespace */
+
 /**
  * \class CameraSensor
  * \brief A camera sensor based on V4L2 subdevices
@@ -119,15 +133,91 @@ int CameraSensor::init()
 	std::sort(mbusCodes_.begin(), mbusCodes_.end());
 	std::sort(sizes_.begin(), sizes_.end());
 
+	initModes();
+
 	return 0;
 }
 
+/*
+ * Build the table of sensor modes, sorted by media bus code and area. The
+ * timings are estimated from the pixel rate and the minimum blanking values
+ * reported by the sensor for its current mode, and are left to 0 when the
+ * sensor doesn't report its pixel rate.
+ */
+void CameraSensor::initModes()
+{
+	const ControlInfoMap &infoMap = controls();
+	uint64_t pixelRate = 0;
+	uint64_t hblank = 0;
+	uint64_t vblank = 0;
+	uint64_t vblankMax = 0;
+
+	if (infoMap.find(V4L2_CID_PIXEL_RATE) != infoMap.end()) {
+		ControlList ctrls(infoMap);
+		ctrls.set(V4L2_CID_PIXEL_RATE, static_cast<int64_t>(0));
+
+		if (!getControls(&ctrls)) {
+			int64_t rate = ctrls.get(V4L2_CID_PIXEL_RATE).get<int64_t>();
+			pixelRate = std::max<int64_t>(rate, 0);
+		}
+	}
+
+	auto blanking = infoMap.find(V4L2_CID_HBLANK);
+	if (blanking != infoMap.end())
+		hblank = std::max(blanking->second.min().get<int32_t>(), 0);
+
+	blanking = infoMap.find(V4L2_CID_VBLANK);
+	if (blanking != infoMap.end()) {
+		vblank = std::max(blanking->second.min().get<int32_t>(), 0);
+		vblankMax = std::max<int64_t>(blanking->second.max().get<int32_t>(),
+					      vblank);
+	}
+
+	for (unsigned int code : mbusCodes_) {
+		for (const Size &size : sizes_) {
+			Mode mode{};
+			mode.mbusCode = code;
+			mode.size = size;
+			mode.aspectRatio = static_cast<float>(size.width) / size.height;
+
+			if (pixelRate) {
+				uint64_t lineLength = size.width + hblank;
+
+				mode.readoutTime = lineLength * size.height
+						 * 1000000000ULL / pixelRate;
+				mode.minFrameDuration = lineLength * (size.height + vblank)
+						      * 1000000000ULL / pixelRate;
+				mode.maxFrameDuration = lineLength * (size.height + vblankMax)
+						      * 1000000000ULL / pixelRate;
+			}
+
+			modes_.push_back(mode);
+		}
+	}
+
+	std::sort(modes_.begin(), modes_.end(),
+		  [](const Mode &a, const Mode &b) {
+			  return std::make_tuple(a.mbusCode, area(a.size), a.size.width) <
+				 std::make_tuple(b.mbusCode, area(b.size), b.size.width);
+		  });
+}
+
 /**
  * \fn CameraSensor::entity()
  * \brief Retrieve the sensor media entity
  * \return The sensor media entity
  */
 
+/**
+ * \fn CameraSensor::device()
+ * \brief Retrieve the sensor V4L2 subdevice
+ *
+ * The subdevice is exposed for helpers that operate on a V4L2Device, such as
+ * DelayedControls. Callers shall not reconfigure the subdevice directly.
+ *
+ * \return The sensor V4L2 subdevice
+ */
+
 /**
  * \fn CameraSensor::mbusCodes()
  * \brief Retrieve the media bus codes supported by the camera sensor
@@ -140,6 +230,69 @@ int CameraSensor::init()
  * \return The supported frame sizes sorted in increasing order
  */
 
+/**
+ * \enum CameraSensor::ModePolicy
+ * \brief Criteria to select a sensor mode in getFormat()
+ * \var CameraSensor::ModeBestFit
+ * Select the mode that best matches the desired aspect ratio, and then the
+ * smallest one
+ * \var CameraSensor::ModeMinReadoutTime
+ * Select the mode with the shortest readout time, to minimize the rolling
+ * shutter skew and the latency
+ * \var CameraSensor::ModeMaxFrameRate
+ * Select the mode with the shortest minimum frame duration, to achieve the
+ * highest frame rate
+ */
+
+/**
+ * \struct CameraSensor::Mode
+ * \brief A sensor mode, combination of a media bus code and a frame size
+ *
+ * The timings are estimated from the pixel rate and the minimum horizontal
+ * and vertical blanking reported by the sensor, and are set to 0 when the
+ * sensor doesn't report its pixel rate.
+ *
+ * \var CameraSensor::Mode::mbusCode
+ * \brief The media bus code
+ * \var CameraSensor::Mode::size
+ * \brief The frame size
+ * \var CameraSensor::Mode::aspectRatio
+ * \brief The aspect ratio of the frame size
+ * \var CameraSensor::Mode::readoutTime
+ * \brief The time to read out all lines of a frame in nanoseconds
+ * \var CameraSensor::Mode::minFrameDuration
+ * \brief The minimum frame duration in nanoseconds
+ * \var CameraSensor::Mode::maxFrameDuration
+ * \brief The maximum frame duration in nanoseconds, bounded by the maximum
+ * vertical blanking
+ */
+
+/**
+ * \fn CameraSensor::modes()
+ * \brief Retrieve the modes supported by the camera sensor
+ *
+ * The modes are computed when the sensor is initialized, for all combinations
+ * of the supported media bus codes and frame sizes.
+ *
+ * \return The supported modes sorted by increasing media bus code and area
+ */
+
+/**
+ * \brief Retrieve the sensor mode corresponding to a sensor format
+ * \param[in] format The sensor format
+ * \return The mode matching the media bus code and size of \a format, or
+ * nullptr if the sensor doesn't support the format
+ */
+const CameraSensor::Mode *CameraSensor::mode(const V4L2SubdeviceFormat &format) const
+{
+	for (const Mode &mode : modes_) {
+		if (mode.mbusCode == format.mbus_code && mode.size == format.size)
+			return &mode;
+	}
+
+	return nullptr;
+}
+
 /**
  * \brief Retrieve the camera sensor resolution
  * \return The camera sensor resolution in pixels
@@ -157,6 +310,7 @@ const Size &CameraSensor::resolution() const
  * \brief Retrieve the best sensor format for a desired output
  * \param[in] mbusCodes The list of acceptable media bus codes
  * \param[in] size The desired size
+ * \param[in] policy The mode selection criteria
  *
  * Media bus codes are selected from \a mbusCodes, which lists all acceptable
  * codes in decreasing order of preference. This method selects the first code
@@ -174,6 +328,15 @@ const Size &CameraSensor::resolution() const
  * - The sensor output size shall be as small as possible to lower the required
  *   bandwidth.
  *
+ * The ModeMinReadoutTime and ModeMaxFrameRate policies replace the aspect
+ * ratio criteria by the shortest readout time or minimum frame duration
+ * respectively. The aspect ratio and size criteria then break ties. When the
+ * sensor timings are unknown, the smallest fitting size is selected, as the
+ * timings grow with the frame area.
+ *
+ * Queries are answered from the table of sensor modes computed at
+ * initialization time.
+ *
  * The use of this method is optional, as the above criteria may not match the
  * needs of all pipeline handlers. Pipeline handlers may implement custom
  * sensor format selection when needed.
@@ -185,13 +348,13 @@ const Size &CameraSensor::resolution() const
  * and size on success, or an empty format otherwise.
  */
 V4L2SubdeviceFormat CameraSensor::getFormat(const std::vector<unsigned int> &mbusCodes,
-					    const Size &size) const
+					    const Size &size,
+					    ModePolicy policy) const
 {
 	V4L2SubdeviceFormat format{};
 
 	for (unsigned int code : mbusCodes) {
-		if (std::any_of(mbusCodes_.begin(), mbusCodes_.end(),
-				[code](unsigned int c) { return c == code; })) {
+		if (std::binary_search(mbusCodes_.begin(), mbusCodes_.end(), code)) {
 			format.mbus_code = code;
 			break;
 		}
@@ -202,37 +365,69 @@ V4L2SubdeviceFormat CameraSensor::getFormat(const std::vector<unsigned int> &mbu
 		return format;
 	}
 
-	unsigned int desiredArea = size.width * size.height;
-	unsigned int bestArea = UINT_MAX;
+	/*
+	 * Locate the modes for the media bus code, skipping the ones whose
+	 * area is too small to fit the desired size.
+	 */
+	const uint64_t desiredArea = area(size);
+	const unsigned int code = format.mbus_code;
+
+	auto first = std::lower_bound(modes_.begin(), modes_.end(), code,
+				      [&](const Mode &mode, unsigned int c) {
+					      return mode.mbusCode < c ||
+						     (mode.mbusCode == c &&
+						      area(mode.size) < desiredArea);
+				      });
+	auto last = std::upper_bound(first, modes_.end(), code,
+				     [](unsigned int c, const Mode &mode) {
+					     return c < mode.mbusCode;
+				     });
+
 	float desiredRatio = static_cast<float>(size.width) / size.height;
 	float bestRatio = FLT_MAX;
-	const Size *bestSize = nullptr;
+	uint64_t bestTime = UINT64_MAX;
+	const Mode *best = nullptr;
+
+	/* Modes are visited in increasing area order. */
+	for (auto it = first; it != last; ++it) {
+		const Mode &mode = *it;
 
-	for (const Size &sz : sizes_) {
-		if (sz.width < size.width || sz.height < size.height)
+		if (mode.size.width < size.width || mode.size.height < size.height)
 			continue;
 
-		float ratio = static_cast<float>(sz.width) / sz.height;
-		float ratioDiff = fabsf(ratio - desiredRatio);
-		unsigned int area = sz.width * sz.height;
-		unsigned int areaDiff = area - desiredArea;
+		float ratioDiff = fabsf(mode.aspectRatio - desiredRatio);
+		uint64_t time;
+
+		switch (policy) {
+		case ModeMinReadoutTime:
+			time = mode.readoutTime ? mode.readoutTime : area(mode.size);
+			break;
+		case ModeMaxFrameRate:
+			time = mode.minFrameDuration ? mode.minFrameDuration
+						     : area(mode.size);
+			break;
+		case ModeBestFit:
+		default:
+			time = 0;
+			break;
+		}
 
-		if (ratioDiff > bestRatio)
+		if (time > bestTime)
 			continue;
 
-		if (ratioDiff < bestRatio || areaDiff < bestArea) {
+		if (time < bestTime || ratioDiff < bestRatio) {
+			bestTime = time;
 			bestRatio = ratioDiff;
-			bestArea = areaDiff;
-			bestSize = &sz;
+			best = &mode;
 		}
 	}
 
-	if (!bestSize) {
+	if (!best) {
 		LOG(CameraSensor, Debug) << "No supported size found";
 		return format;
 	}
 
-	format.size = *bestSize;
+	format.size = best->size;
 
 	return format;
 }
@@ -0,0 +1,769 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * camera_share.cpp - Share the frames of a camera with other processes
+ */
+
+#include <libcamera/camera_share.h>
+
+#include <algorithm>
+#include <errno.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <libcamera/buffer.h>
+#include <libcamera/event_notifier.h>
+#include <libcamera/stream.h>
+
+#include "buffer_metadata.h"
+#include "byte_stream_buffer.h"
+#include "control_serializer.h"
+#include "ipc_unixsocket.h"
+#include "log.h"
+
+/**
+ * \file camera_share.h
+ * \brief Share the frames of a camera with other processes
+ *
+ * A camera can only be acquired by a single process. To let multiple
+ * processes, such as a streaming service and an analytics service, process
+ * the frames of the same camera, the process that owns the camera can export
+ * its frames with a CameraShareServer, to which other processes connect with
+ * a CameraShareClient.
+ *
+ * The server and the clients communicate over a Unix socket. The dmabuf file
+ * descriptors of the frame buffers are passed to each client the first time
+ * the buffer is shared with it, and every frame is then announced with a small
+ * message that carries the buffer identifier, the frame metadata and the
+ * request metadata controls, serialized with the ControlSerializer. Frames are
+ * never copied, clients map the buffers and only return the buffer identifiers
+ * to the server when they are done with them.
+ */
+
+namespace libcamera {
+
+LOG_DEFINE_CATEGORY(CameraShare)
+
+namespace {
+
+enum ShareMessageType : uint32_t {
+	ShareConfigure,
+	ShareBuffer,
+	ShareFrame,
+	ShareRelease,
+};
+
+struct ShareConfigureMessage {
+	uint32_t type;
+	uint32_t pixelFormat;
+	uint32_t width;
+	uint32_t height;
+};
+
+/* The plane file descriptors are passed along with the message. */
+struct ShareBufferMessage {
+	uint32_t type;
+	uint32_t id;
+	uint32_t numPlanes;
+	uint32_t length[FrameMaxPlanes];
+};
+
+/* The serialized metadata control list follows the message. */
+struct ShareFrameMessage {
+	uint32_t type;
+	uint32_t id;
+	uint32_t status;
+	uint32_t sequence;
+	uint64_t timestamp;
+	uint32_t numPlanes;
+	uint32_t bytesused[FrameMaxPlanes];
+};
+
+struct ShareReleaseMessage {
+	uint32_t type;
+	uint32_t id;
+};
+
+template<typename T>
+void writeMessage(IPCUnixSocket::Payload *payload, const T &msg)
+{
+	const uint8_t *data = reinterpret_cast<const uint8_t *>(&msg);
+	payload->data.assign(data, data + sizeof(msg));
+}
+
+template<typename T>
+bool readMessage(const IPCUnixSocket::Payload &payload, T *msg)
+{
+	if (payload.data.size() < sizeof(*msg))
+		return false;
+
+	memcpy(msg, payload.data.data(), sizeof(*msg));
+	return true;
+}
+
+} /* namespace */
+
+struct CameraShareServer::Client {
+	IPCUnixSocket socket;
+	ControlSerializer serializer;
+	std::set<unsigned int> buffers;
+	std::set<unsigned int> held;
+};
+
+/**
+ * \class CameraShareServer
+ * \brief Export the frames of a camera to other processes
+ *
+ * The CameraShareServer listens for client connections on a Unix socket, and
+ * shares the frames handed to it with queueFrame() with all connected clients.
+ * A frame is held until all the clients it has been shared with have released
+ * it, or have disconnected, at which point the frameReleased signal is
+ * emitted. The buffer, and the request it belongs to, can then be reused.
+ *
+ * The frame buffers must be backed by dmabuf file descriptors that can be
+ * mapped by the clients, such as the buffers allocated by the
+ * FrameBufferAllocator. The server only supports a single stream, whose
+ * configuration is set with configure() and is sent to clients when they
+ * connect.
+ */
+
+CameraShareServer::CameraShareServer()
+	: fd_(-1), notifier_(nullptr), pixelFormat_(0), nextId_(0)
+{
+}
+
+CameraShareServer::~CameraShareServer()
+{
+	close();
+}
+
+/**
+ * \brief Listen for client connections
+ * \param[in] path The path of the Unix socket
+ *
+ * Any stale socket at \a path is removed before the socket is created.
+ *
+ * \return 0 on success or a negative error code otherwise
+ * \retval -EBUSY The server is already listening
+ * \retval -ENAMETOOLONG The \a path is too long for a Unix socket
+ */
+int CameraShareServer::listen(const std::string &path)
+{
+	if (fd_ != -1)
+		return -EBUSY;
+
+	struct sockaddr_un addr = {};
+	if (path.size() >= sizeof(addr.sun_path))
+		return -ENAMETOOLONG;
+
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, path.c_str());
+
+	fd_ = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (fd_ < 0) {
+		int ret = -errno;
+		LOG(CameraShare, Error)
+			<< "Failed to create socket: " << strerror(-ret);
+		fd_ = -1;
+		return ret;
+	}
+
+	unlink(path.c_str());
+
+	int ret = ::bind(fd_, reinterpret_cast<struct sockaddr *>(&addr),
+			 sizeof(addr));
+	if (!ret)
+		ret = ::listen(fd_, 8);
+	if (ret < 0) {
+		ret = -errno;
+		LOG(CameraShare, Error)
+			<< "Failed to listen on " << path << ": "
+			<< strerror(-ret);
+		::close(fd_);
+		fd_ = -1;
+		return ret;
+	}
+
+	path_ = path;
+	notifier_ = new EventNotifier(fd_, EventNotifier::Read);
+	notifier_->activated.connect(this, &CameraShareServer::clientConnected);
+
+	LOG(CameraShare, Debug) << "Listening on " << path_;
+
+	return 0;
+}
+
+/**
+ * \brief Stop listening and disconnect all clients
+ *
+ * All the frames held by clients are released, and the frameReleased signal
+ * is emitted for each of them.
+ */
+void CameraShareServer::close()
+{
+	while (!clients_.empty())
+		removeClient(clients_.back().get());
+
+	if (fd_ == -1)
+		return;
+
+	delete notifier_;
+	notifier_ = nullptr;
+
+	::close(fd_);
+	fd_ = -1;
+
+	unlink(path_.c_str());
+	path_.clear();
+}
+
+/**
+ * \fn CameraShareServer::clients()
+ * \brief Retrieve the number of connected clients
+ * \return The number of connected clients
+ */
+
+/**
+ * \brief Set the configuration of the shared stream
+ * \param[in] cfg The stream configuration
+ *
+ * The configuration is sent to all connected clients, and to all clients that
+ * connect later. Buffers shared with clients before the configuration change
+ * are forgotten, and will be sent again to the clients the next time they are
+ * queued. This method shall be called every time the camera is configured.
+ */
+void CameraShareServer::configure(const StreamConfiguration &cfg)
+{
+	pixelFormat_ = cfg.pixelFormat;
+	size_ = cfg.size;
+	ids_.clear();
+
+	for (std::unique_ptr<Client> &client : clients_) {
+		client->buffers.clear();
+		sendConfiguration(client.get());
+	}
+}
+
+/**
+ * \brief Share a frame with the connected clients
+ * \param[in] buffer The frame buffer
+ * \param[in] metadata The metadata of the request the frame belongs to
+ *
+ * The \a buffer file descriptors are sent to the clients that haven't received
+ * them yet, and the frame is announced to all clients along with the buffer
+ * metadata and the request \a metadata controls. Clients that can't be reached
+ * are disconnected, which releases the other frames they hold.
+ *
+ * When this method returns true, the buffer is held by the clients and shall
+ * not be reused before the frameReleased signal is emitted for it.
+ *
+ * \return True if the frame has been shared with at least one client, or false
+ * if no client is connected, or if the frame couldn't be sent
+ */
+bool CameraShareServer::queueFrame(FrameBuffer *buffer,
+				   const ControlList &metadata)
+{
+	if (clients_.empty())
+		return false;
+
+	auto iter = ids_.find(buffer);
+	if (iter == ids_.end())
+		iter = ids_.emplace(buffer, nextId_++).first;
+	unsigned int id = iter->second;
+
+	if (frames_.count(id)) {
+		LOG(CameraShare, Error) << "Buffer " << id << " is already queued";
+		return false;
+	}
+
+	const FrameMetadata &frame = buffer->metadata();
+
+	ShareFrameMessage msg = {};
+	msg.type = ShareFrame;
+	msg.id = id;
+	msg.status = frame.status;
+	msg.sequence = frame.sequence;
+	msg.timestamp = frame.timestamp;
+	msg.numPlanes = frame.planes().size();
+	for (unsigned int i = 0; i < msg.numPlanes; ++i)
+		msg.bytesused[i] = frame.planes()[i].bytesused;
+
+	size_t size = ControlSerializer::binarySize(metadata);
+
+	IPCUnixSocket::Payload payload;
+	writeMessage(&payload, msg);
+	payload.data.resize(sizeof(msg) + size);
+
+	std::vector<Client *> failed;
+	unsigned int refs = 0;
+
+	for (std::unique_ptr<Client> &client : clients_) {
+		if (!client->buffers.count(id)) {
+			if (sendBuffer(client.get(), id, buffer) < 0) {
+				failed.push_back(client.get());
+				continue;
+			}
+		}
+
+		/* Each client has its own serializer state. */
+		ByteStreamBuffer data(payload.data.data() + sizeof(msg), size);
+		int ret = client->serializer.serialize(metadata, data);
+		if (ret < 0) {
+			LOG(CameraShare, Error) << "Failed to serialize metadata";
+			continue;
+		}
+
+		ret = client->socket.send(payload);
+		if (ret < 0) {
+			failed.push_back(client.get());
+			continue;
+		}
+
+		client->held.insert(id);
+		refs++;
+	}
+
+	if (refs)
+		frames_[id] = { buffer, refs };
+
+	/*
+	 * Clients we failed to communicate with are disconnected, which may
+	 * release the frame.
+	 */
+	for (Client *client : failed)
+		removeClient(client);
+
+	return refs != 0;
+}
+
+/**
+ * \var CameraShareServer::frameReleased
+ * \brief Signal emitted when all clients have released a frame
+ *
+ * The buffer may be reused from the signal handler.
+ */
+
+void CameraShareServer::clientConnected(EventNotifier *notifier)
+{
+	int fd = accept4(fd_, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+	if (fd < 0) {
+		int ret = -errno;
+		if (ret != -EAGAIN)
+			LOG(CameraShare, Error)
+				<< "Failed to accept connection: " << strerror(-ret);
+		return;
+	}
+
+	std::unique_ptr<Client> client = std::make_unique<Client>();
+	if (client->socket.bind(fd) < 0) {
+		::close(fd);
+		return;
+	}
+
+	client->socket.readyRead.connect(this, &CameraShareServer::clientReady);
+
+	if (pixelFormat_ && sendConfiguration(client.get()) < 0)
+		return;
+
+	clients_.push_back(std::move(client));
+
+	LOG(CameraShare, Debug) << "Client connected, " << clients_.size()
+				<< " clients";
+}
+
+void CameraShareServer::clientReady(IPCUnixSocket *socket)
+{
+	auto iter = std::find_if(clients_.begin(), clients_.end(),
+				 [socket](const std::unique_ptr<Client> &client) {
+					 return &client->socket == socket;
+				 });
+	if (iter == clients_.end())
+		return;
+
+	Client *client = iter->get();
+	IPCUnixSocket::Payload payload;
+
+	while (true) {
+		int ret = socket->receive(&payload);
+		if (ret == -EAGAIN)
+			return;
+
+		if (ret < 0) {
+			removeClient(client);
+			return;
+		}
+
+		for (int32_t fd : payload.fds)
+			::close(fd);
+
+		ShareReleaseMessage msg;
+		if (!readMessage(payload, &msg) || msg.type != ShareRelease) {
+			LOG(CameraShare, Warning) << "Invalid message from client";
+			continue;
+		}
+
+		if (!client->held.erase(msg.id)) {
+			LOG(CameraShare, Warning)
+				<< "Client released buffer " << msg.id
+				<< " it doesn't hold";
+			continue;
+		}
+
+		unref(msg.id);
+	}
+}
+
+void CameraShareServer::removeClient(Client *client)
+{
+	auto iter = std::find_if(clients_.begin(), clients_.end(),
+				 [client](const std::unique_ptr<Client> &c) {
+					 return c.get() == client;
+				 });
+	if (iter == clients_.end())
+		return;
+
+	std::unique_ptr<Client> removed = std::move(*iter);
+	clients_.erase(iter);
+
+	LOG(CameraShare, Debug) << "Client disconnected, " << clients_.size()
+				<< " clients";
+
+	for (unsigned int id : removed->held)
+		unref(id);
+}
+
+int CameraShareServer::sendConfiguration(Client *client)
+{
+	ShareConfigureMessage msg = {};
+	msg.type = ShareConfigure;
+	msg.pixelFormat = pixelFormat_;
+	msg.width = size_.width;
+	msg.height = size_.height;
+
+	IPCUnixSocket::Payload payload;
+	writeMessage(&payload, msg);
+
+	return client->socket.send(payload);
+}
+
+int CameraShareServer::sendBuffer(Client *client, unsigned int id,
+				  FrameBuffer *buffer)
+{
+	ShareBufferMessage msg = {};
+	msg.type = ShareBuffer;
+	msg.id = id;
+	msg.numPlanes = buffer->planes().size();
+
+	IPCUnixSocket::Payload payload;
+
+	for (unsigned int i = 0; i < msg.numPlanes; ++i) {
+		const FrameBuffer::Plane &plane = buffer->planes()[i];
+		msg.length[i] = plane.length;
+		payload.fds.push_back(plane.fd.fd());
+	}
+
+	writeMessage(&payload, msg);
+
+	int ret = client->socket.send(payload);
+	if (ret < 0)
+		return ret;
+
+	client->buffers.insert(id);
+	return 0;
+}
+
+void CameraShareServer::unref(unsigned int id)
+{
+	auto iter = frames_.find(id);
+	if (iter == frames_.end() || --iter->second.refs)
+		return;
+
+	FrameBuffer *buffer = iter->second.buffer;
+	frames_.erase(iter);
+	frameReleased.emit(buffer);
+}
+
+/**
+ * \class CameraShareClient
+ * \brief Receive the frames of a camera exported by another process
+ *
+ * The CameraShareClient connects to a CameraShareServer and receives the frames
+ * it shares. The frame buffers are created from the file descriptors received
+ * from the server, and are owned by the client. Each frame is reported through
+ * the frameReceived signal, along with its metadata controls, and shall be
+ * released with release() when the application is done with it, as the camera
+ * can't reuse the buffer before all clients have released it.
+ */
+
+CameraShareClient::CameraShareClient()
+	: pixelFormat_(0)
+{
+}
+
+CameraShareClient::~CameraShareClient()
+{
+	disconnect();
+}
+
+/**
+ * \brief Connect to a server
+ * \param[in] path The path of the server Unix socket
+ * \return 0 on success or a negative error code otherwise
+ * \retval -EBUSY The client is already connected
+ * \retval -ENAMETOOLONG The \a path is too long for a Unix socket
+ */
+int CameraShareClient::connect(const std::string &path)
+{
+	if (isConnected())
+		return -EBUSY;
+
+	struct sockaddr_un addr = {};
+	if (path.size() >= sizeof(addr.sun_path))
+		return -ENAMETOOLONG;
+
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, path.c_str());
+
+	int fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (fd < 0) {
+		int ret = -errno;
+		LOG(CameraShare, Error)
+			<< "Failed to create socket: " << strerror(-ret);
+		return ret;
+	}
+
+	int ret = ::connect(fd, reinterpret_cast<struct sockaddr *>(&addr),
+			    sizeof(addr));
+	if (ret < 0) {
+		ret = -errno;
+		LOG(CameraShare, Error)
+			<< "Failed to connect to " << path << ": "
+			<< strerror(-ret);
+		::close(fd);
+		return ret;
+	}
+
+	socket_ = std::make_unique<IPCUnixSocket>();
+	ret = socket_->bind(fd);
+	if (ret < 0) {
+		::close(fd);
+		socket_.reset();
+		return ret;
+	}
+
+	serializer_ = std::make_unique<ControlSerializer>();
+	socket_->readyRead.connect(this, &CameraShareClient::messageReady);
+
+	return 0;
+}
+
+/**
+ * \brief Disconnect from the server
+ *
+ * All the buffers received from the server are destroyed, including the ones
+ * that haven't been released yet.
+ */
+void CameraShareClient::disconnect()
+{
+	if (!isConnected())
+		return;
+
+	socket_.reset();
+	serializer_.reset();
+
+	held_.clear();
+	stale_.clear();
+	buffers_.clear();
+
+	pixelFormat_ = 0;
+	size_ = {};
+}
+
+/**
+ * \brief Check if the client is connected to a server
+ * \return True if the client is connected, false otherwise
+ */
+bool CameraShareClient::isConnected() const
+{
+	return socket_ != nullptr;
+}
+
+/**
+ * \fn CameraShareClient::pixelFormat()
+ * \brief Retrieve the pixel format of the shared stream
+ * \return The pixel format, or 0 if the server hasn't sent a configuration yet
+ */
+
+/**
+ * \fn CameraShareClient::size()
+ * \brief Retrieve the size of the shared stream
+ * \return The frame size
+ */
+
+/**
+ * \brief Return a frame to the server
+ * \param[in] buffer The frame buffer received through frameReceived
+ *
+ * The \a buffer shall not be accessed after being released.
+ *
+ * \return 0 on success or a negative error code otherwise
+ * \retval -EINVAL The \a buffer isn't held by the client
+ */
+int CameraShareClient::release(FrameBuffer *buffer)
+{
+	if (!isConnected())
+		return -ENOTCONN;
+
+	unsigned int id = buffer->cookie();
+	if (!held_.erase(id))
+		return -EINVAL;
+
+	/* Buffers from a previous configuration are dropped when released. */
+	stale_.erase(id);
+
+	ShareReleaseMessage msg = {};
+	msg.type = ShareRelease;
+	msg.id = id;
+
+	IPCUnixSocket::Payload payload;
+	writeMessage(&payload, msg);
+
+	return socket_->send(payload);
+}
+
+/**
+ * \var CameraShareClient::configured
+ * \brief Signal emitted when the server sends a new stream configuration
+ *
+ * The new configuration is retrieved with pixelFormat() and size().
+ */
+
+/**
+ * \var CameraShareClient::frameReceived
+ * \brief Signal emitted when a frame is received
+ *
+ * The signal carries the frame buffer and the request metadata controls. The
+ * buffer metadata is updated with the frame status, sequence, timestamp and
+ * planes bytesused. The control list is only valid for the duration of the
+ * signal emission.
+ */
+
+/**
+ * \var CameraShareClient::disconnected
+ * \brief Signal emitted when the server closes the connection
+ */
+
+void CameraShareClient::messageReady(IPCUnixSocket *socket)
+{
+	IPCUnixSocket::Payload payload;
+
+	while (true) {
+		int ret = socket->receive(&payload);
+		if (ret == -EAGAIN)
+			return;
+
+		if (ret < 0) {
+			LOG(CameraShare, Debug) << "Server disconnected";
+			disconnect();
+			disconnected.emit();
+			return;
+		}
+
+		uint32_t type;
+		if (!readMessage(payload, &type)) {
+			LOG(CameraShare, Warning) << "Invalid message from server";
+			continue;
+		}
+
+		switch (type) {
+		case ShareConfigure: {
+			ShareConfigureMessage msg;
+			if (!readMessage(payload, &msg))
+				break;
+
+			pixelFormat_ = msg.pixelFormat;
+			size_ = Size(msg.width, msg.height);
+
+			/* Keep the buffers held by the application alive. */
+			for (auto &buffer : buffers_) {
+				if (held_.count(buffer.first))
+					stale_[buffer.first] = std::move(buffer.second);
+			}
+			buffers_.clear();
+
+			configured.emit();
+			break;
+		}
+
+		case ShareBuffer: {
+			ShareBufferMessage msg;
+			if (!readMessage(payload, &msg) ||
+			    msg.numPlanes > FrameMaxPlanes ||
+			    msg.numPlanes != payload.fds.size())
+				break;
+
+			std::vector<FrameBuffer::Plane> planes(msg.numPlanes);
+			for (unsigned int i = 0; i < msg.numPlanes; ++i) {
+				planes[i].fd = FileDescriptor(payload.fds[i]);
+				planes[i].length = msg.length[i];
+			}
+
+			buffers_[msg.id] = std::make_unique<FrameBuffer>(planes, msg.id);
+			break;
+		}
+
+		case ShareFrame: {
+			ShareFrameMessage msg;
+			if (!readMessage(payload, &msg) ||
+			    msg.numPlanes > FrameMaxPlanes)
+				break;
+
+			auto iter = buffers_.find(msg.id);
+			if (iter == buffers_.end()) {
+				LOG(CameraShare, Error)
+					<< "Received frame for unknown buffer "
+					<< msg.id;
+				break;
+			}
+
+			FrameBuffer *buffer = iter->second.get();
+			FrameMetadata metadata = buffer->metadata();
+			metadata.status = static_cast<FrameMetadata::Status>(msg.status);
+			metadata.sequence = msg.sequence;
+			metadata.timestamp = msg.timestamp;
+			BufferMetadata::setNumPlanes(&metadata, msg.numPlanes);
+			for (unsigned int i = 0; i < metadata.planes().size(); ++i)
+				metadata.planes()[i].bytesused = msg.bytesused[i];
+			BufferMetadata::copy(buffer, metadata);
+
+			const uint8_t *base = payload.data.data() + sizeof(msg);
+			ByteStreamBuffer data(base, payload.data.size() - sizeof(msg));
+			if (serializer_->deserialize(data, &metadata_) < 0)
+				LOG(CameraShare, Warning)
+					<< "Failed to deserialize frame metadata";
+
+			held_.insert(msg.id);
+			frameReceived.emit(buffer, metadata_);
+
+			/* The handler may have disconnected the client. */
+			if (!isConnected())
+				return;
+			break;
+		}
+
+		default:
+			LOG(CameraShare, Warning)
+				<< "Unknown message " << type << " from server";
+			break;
+		}
+
+		/* The buffer planes hold duplicates of the received fds. */
+		for (int32_t fd : payload.fds)
+			::close(fd);
+	}
+}
+
+} /* namespace libcamera */
@@ -0,0 +1,181 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * configuration_cache.cpp - Cache of validated camera configurations
+ */
+
+#include "configuration_cache.h"
+
+/**
+ * \file configuration_cache.h
+ * \brief Cache of validated camera configurations
+ */
+
+namespace libcamera {
+
+/**
+ * \class ConfigurationCache
+ * \brief Memoize the result of CameraConfiguration::validate()
+ *
+ * Applications negotiate a configuration by calling validate() repeatedly,
+ * often with the same stream configurations. Pipeline handlers whose
+ * validation is expensive can store the adjusted configuration in a
+ * per-camera ConfigurationCache, and return it from subsequent validate()
+ * calls without recomputing the sensor format and stream constraints.
+ *
+ * Entries are keyed on the direction, pixel format, size, buffer count, memory
+ * type and number of zero-shutter-lag frames of all the requested stream
+ * configurations, in order. The validation result shall thus depend on those
+ * fields only, and remain constant for the lifetime of the camera. The cache
+ * holds a bounded number of entries and evicts the least recently used one
+ * when full. All methods are thread-safe.
+ */
+
+/**
+ * \struct ConfigurationCache::Result
+ * \brief Pipeline-specific state produced by a validation
+ *
+ * \var ConfigurationCache::Result::status
+ * \brief The status returned by validate()
+ *
+ * \var ConfigurationCache::Result::sensorFormat
+ * \brief The sensor format selected for the configuration
+ *
+ * \var ConfigurationCache::Result::streams
+ * \brief The streams assigned to the configuration entries, in order
+ */
+
+/**
+ * \brief Construct a cache holding up to \a capacity entries
+ * \param[in] capacity The maximum number of entries
+ */
+ConfigurationCache::ConfigurationCache(unsigned int capacity)
+	: capacity_(capacity)
+{
+}
+
+/**
+ * \brief Look up the validation result for a configuration
+ * \param[inout] config The stream configurations to validate
+ * \param[out] result The cached validation result
+ *
+ * If the cache holds an entry for the stream configurations \a config, adjust
+ * the pixel format, size, buffer count, memory type and number of
+ * zero-shutter-lag frames of each of them to the cached validated values, and
+ * store the cached result in \a result.
+ *
+ * \return True if a matching entry was found, false otherwise
+ */
+bool ConfigurationCache::find(std::vector<StreamConfiguration> &config,
+			      Result *result)
+{
+	MutexLocker locker(mutex_);
+
+	for (auto it = entries_.begin(); it != entries_.end(); ++it) {
+		if (!match(it->request, config))
+			continue;
+
+		for (unsigned int i = 0; i < config.size(); ++i) {
+			const Key &key = it->config[i];
+			config[i].pixelFormat = key.pixelFormat;
+			config[i].size = key.size;
+			config[i].bufferCount = key.bufferCount;
+			config[i].memory = key.memory;
+			config[i].zslFrames = key.zslFrames;
+		}
+
+		*result = it->result;
+
+		/* Move the entry to the front to mark it as recently used. */
+		entries_.splice(entries_.begin(), entries_, it);
+
+		return true;
+	}
+
+	return false;
+}
+
+/**
+ * \brief Store the validation result for a configuration
+ * \param[in] request The stream configurations passed to validate()
+ * \param[in] config The stream configurations adjusted by validate()
+ * \param[in] result The validation result
+ *
+ * Validation that adds or removes stream configurations can't be replayed
+ * field by field, and isn't cached.
+ */
+void ConfigurationCache::insert(const std::vector<StreamConfiguration> &request,
+				const std::vector<StreamConfiguration> &config,
+				const Result &result)
+{
+	if (!capacity_ || request.size() != config.size())
+		return;
+
+	MutexLocker locker(mutex_);
+
+	for (auto it = entries_.begin(); it != entries_.end(); ++it) {
+		if (match(it->request, request)) {
+			entries_.erase(it);
+			break;
+		}
+	}
+
+	if (entries_.size() >= capacity_)
+		entries_.pop_back();
+
+	entries_.push_front({ makeKey(request), makeKey(config), result });
+}
+
+/**
+ * \brief Remove all entries from the cache
+ */
+void ConfigurationCache::clear()
+{
+	MutexLocker locker(mutex_);
+	entries_.clear();
+}
+
+/**
+ * \brief Retrieve the number of entries in the cache
+ * \return The number of entries
+ */
+unsigned int ConfigurationCache::size()
+{
+	MutexLocker locker(mutex_);
+	return entries_.size();
+}
+
+std::vector<ConfigurationCache::Key>
+ConfigurationCache::makeKey(const std::vector<StreamConfiguration> &config)
+{
+	std::vector<Key> key;
+	key.reserve(config.size());
+
+	for (const StreamConfiguration &cfg : config)
+		key.push_back({ cfg.direction, cfg.pixelFormat, cfg.size,
+				cfg.bufferCount, cfg.memory, cfg.zslFrames });
+
+	return key;
+}
+
+bool ConfigurationCache::match(const std::vector<Key> &key,
+			       const std::vector<StreamConfiguration> &config)
+{
+	if (key.size() != config.size())
+		return false;
+
+	for (unsigned int i = 0; i < key.size(); ++i) {
+		if (key[i].direction != config[i].direction ||
+		    key[i].pixelFormat != config[i].pixelFormat ||
+		    key[i].size != config[i].size ||
+		    key[i].bufferCount != config[i].bufferCount ||
+		    key[i].memory != config[i].memory ||
+		    key[i].zslFrames != config[i].zslFrames)
+			return false;
+	}
+
+	return true;
+}
+
+} /* namespace libcamera */
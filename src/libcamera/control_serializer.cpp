@@ -8,7 +8,14 @@
 #include "control_serializer.h"
 
 #include <algorithm>
+#include <atomic>
+#include <errno.h>
+#include <fcntl.h>
 #include <memory>
+#include <mutex>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
 #include <vector>
 
 #include <ipa/ipa_controls.h>
@@ -16,7 +23,9 @@
 #include <libcamera/controls.h>
 
 #include "byte_stream_buffer.h"
+#include "cpu_accounting.h"
 #include "log.h"
+#include "utils.h"
 
 /**
  * \file control_serializer.h
@@ -29,15 +38,64 @@ LOG_DEFINE_CATEGORY(Serializer)
 
 namespace {
 
+/*
+ * Control value data is padded to a multiple of 8 bytes in the data section,
+ * as required by the serialization format, to allow accessing it in place.
+ */
+static constexpr size_t ControlValueAlignment = 8;
+
 static constexpr size_t ControlValueSize[] = {
-	[ControlTypeNone]	= 1,
-	[ControlTypeBool]	= sizeof(bool),
-	[ControlTypeInteger32]	= sizeof(int32_t),
-	[ControlTypeInteger64]	= sizeof(int64_t),
+	[ControlTypeNone]		= 0,
+	[ControlTypeBool]		= sizeof(bool),
+	[ControlTypeInteger32]		= sizeof(int32_t),
+	[ControlTypeInteger64]		= sizeof(int64_t),
+	[ControlTypeByte]		= sizeof(uint8_t),
+	[ControlTypeFloat]		= sizeof(float),
+	[ControlTypeRectangle]		= sizeof(Rectangle),
 };
 
+size_t alignedSize(size_t size)
+{
+	return (size + ControlValueAlignment - 1) & ~(ControlValueAlignment - 1);
+}
+
+/*
+ * Validate the type and number of elements of a serialized control value
+ * before allocating memory for it, as they come from an untrusted packet.
+ * The \a available size is the number of bytes left in the data section.
+ */
+bool isValidValue(uint32_t type, bool isArray, uint32_t count, size_t available)
+{
+	if (type >= ARRAY_SIZE(ControlValueSize))
+		return false;
+
+	if (!isArray && count > 1)
+		return false;
+
+	return count <= available / std::max<size_t>(ControlValueSize[type], 1);
+}
+
 } /* namespace */
 
+/*
+ * ControlInfoMap instances are immutable, their serialized form is thus
+ * computed once and shared by all copies of the map and all serializers. The
+ * handle is allocated from a process-wide counter to stay unique across
+ * serializers, and the sealed memfd copy is only created when requested.
+ */
+struct ControlInfoMap::Serialized {
+	Serialized(unsigned int h)
+		: handle(h)
+	{
+	}
+
+	unsigned int handle;
+	std::vector<uint8_t> data;
+
+	mutable std::mutex mutex;
+	mutable FileDescriptor fd;
+};
+
 /**
  * \class ControlSerializer
  * \brief Serializer and deserializer for control-related classes
@@ -76,6 +134,11 @@ static constexpr size_t ControlValueSize[] = {
  * that constraint results in serialization or deserialization failure of the
  * ControlList.
  *
+ * The serialized form of a ControlInfoMap is cached with the map contents and
+ * shared with all its copies, so repeated serialization of the same map, for
+ * instance at every IPA configuration, doesn't need to walk the map again. The
+ * handle associated with the map is stable for the lifetime of its contents.
+ *
  * The serializer can be reset() to clear its internal state. This may be
  * performed when reconfiguring an IPA to avoid constant growth of the internal
  * state, especially if the contents of the ControlInfoMap instances change at
@@ -85,7 +148,7 @@ static constexpr size_t ControlValueSize[] = {
  */
 
 ControlSerializer::ControlSerializer()
-	: serial_(0)
+	: keyframeInterval_(0)
 {
 }
 
@@ -97,16 +160,16 @@ ControlSerializer::ControlSerializer()
  */
 void ControlSerializer::reset()
 {
-	serial_ = 0;
-
 	infoMapHandles_.clear();
 	infoMaps_.clear();
 	controlIds_.clear();
+	txDeltas_.clear();
+	rxDeltas_.clear();
 }
 
 size_t ControlSerializer::binarySize(const ControlValue &value)
 {
-	return ControlValueSize[value.type()];
+	return alignedSize(value.data().size_bytes());
 }
 
 size_t ControlSerializer::binarySize(const ControlRange &range)
@@ -154,38 +217,25 @@ size_t ControlSerializer::binarySize(const ControlList &list)
 	return size;
 }
 
-void ControlSerializer::store(const ControlValue &value,
-			      ByteStreamBuffer &buffer)
+/*
+ * Store \a value at \a data, padded to the value alignment, and return the
+ * location following it. The caller shall have reserved binarySize() bytes.
+ */
+uint8_t *ControlSerializer::store(const ControlValue &value, uint8_t *data)
 {
-	switch (value.type()) {
-	case ControlTypeBool: {
-		bool data = value.get<bool>();
-		buffer.write(&data);
-		break;
-	}
-
-	case ControlTypeInteger32: {
-		int32_t data = value.get<int32_t>();
-		buffer.write(&data);
-		break;
-	}
+	Span<const uint8_t> bytes = value.data();
+	size_t size = alignedSize(bytes.size());
 
-	case ControlTypeInteger64: {
-		uint64_t data = value.get<int64_t>();
-		buffer.write(&data);
-		break;
-	}
+	memcpy(data, bytes.data(), bytes.size());
+	memset(data + bytes.size(), 0, size - bytes.size());
 
-	default:
-		break;
-	}
+	return data + size;
 }
 
-void ControlSerializer::store(const ControlRange &range,
-			      ByteStreamBuffer &buffer)
+uint8_t *ControlSerializer::store(const ControlRange &range, uint8_t *data)
 {
-	store(range.min(), buffer);
-	store(range.max(), buffer);
+	data = store(range.min(), data);
+	return store(range.max(), data);
 }
 
 /**
@@ -204,6 +254,123 @@ void ControlSerializer::store(const ControlRange &range,
  */
 int ControlSerializer::serialize(const ControlInfoMap &info,
 				 ByteStreamBuffer &buffer)
+{
+	std::shared_ptr<const ControlInfoMap::Serialized> blob = serialized(info);
+
+	uint8_t *data = buffer.reserve<uint8_t>(blob->data.size());
+	if (buffer.overflow() || !data)
+		return -ENOSPC;
+
+	memcpy(data, blob->data.data(), blob->data.size());
+
+	/*
+	 * Store the map to handle association, to be used to serialize and
+	 * deserialize control lists.
+	 */
+	infoMapHandles_[&info] = blob->handle;
+
+	return 0;
+}
+
+/**
+ * \brief Serialize a ControlInfoMap
+ * \param[in] info The control info map to serialize
+ *
+ * Serialize the \a info map using the serialization format defined by the IPA
+ * context interface in ipa_controls.h, and return the serialized data. The data
+ * is cached with the contents of \a info and is shared with all its copies, it
+ * stays valid as long as any copy of \a info exists.
+ *
+ * As for serialize(const ControlInfoMap &info, ByteStreamBuffer &buffer), the
+ * serializer stores a reference to the \a info internally.
+ *
+ * \return The serialized ControlInfoMap
+ */
+Span<const uint8_t> ControlSerializer::serialize(const ControlInfoMap &info)
+{
+	std::shared_ptr<const ControlInfoMap::Serialized> blob = serialized(info);
+
+	infoMapHandles_[&info] = blob->handle;
+
+	return { blob->data.data(), blob->data.size() };
+}
+
+/**
+ * \brief Serialize a ControlInfoMap to a sealed memfd
+ * \param[in] info The control info map to serialize
+ *
+ * Serialize the \a info map as serialize(const ControlInfoMap &info), and
+ * return a file descriptor to a sealed memfd that contains the serialized data.
+ * The memfd is created once for the contents of \a info and shared by all
+ * callers, it can be passed to other processes that will map it read-only.
+ *
+ * \return A file descriptor to the serialized ControlInfoMap, or an invalid
+ * file descriptor if the memfd can't be created
+ */
+FileDescriptor ControlSerializer::serializeToFd(const ControlInfoMap &info)
+{
+	std::shared_ptr<const ControlInfoMap::Serialized> blob = serialized(info);
+
+	infoMapHandles_[&info] = blob->handle;
+
+	std::lock_guard<std::mutex> locker(blob->mutex);
+	if (blob->fd.isValid())
+		return blob->fd;
+
+	int fd = memfd_create("libcamera-controls", MFD_ALLOW_SEALING | MFD_CLOEXEC);
+	if (fd < 0) {
+		LOG(Serializer, Error)
+			<< "Failed to create memfd: " << strerror(errno);
+		return FileDescriptor();
+	}
+
+	ssize_t ret = write(fd, blob->data.data(), blob->data.size());
+	if (ret != static_cast<ssize_t>(blob->data.size()) ||
+	    fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW |
+				   F_SEAL_WRITE | F_SEAL_SEAL) < 0) {
+		LOG(Serializer, Error)
+			<< "Failed to populate memfd: " << strerror(errno);
+		::close(fd);
+		return FileDescriptor();
+	}
+
+	blob->fd = FileDescriptor(fd);
+	::close(fd);
+
+	return blob->fd;
+}
+
+/*
+ * Retrieve the serialized form of a ControlInfoMap, creating it if needed. The
+ * cache is lockless, if multiple threads race to create it, the first one wins
+ * and the other copies are discarded.
+ */
+std::shared_ptr<const ControlInfoMap::Serialized>
+ControlSerializer::serialized(const ControlInfoMap &info)
+{
+	static std::atomic<unsigned int> serial{ 0 };
+
+	const ControlInfoMap::Data &infoData = *info.data_;
+	std::shared_ptr<const ControlInfoMap::Serialized> blob =
+		std::atomic_load(&infoData.serialized);
+	if (blob)
+		return blob;
+
+	auto newBlob = std::make_shared<ControlInfoMap::Serialized>(++serial);
+	newBlob->data.resize(binarySize(info));
+	ByteStreamBuffer buffer(newBlob->data.data(), newBlob->data.size());
+	writeInfoMap(info, newBlob->handle, buffer);
+
+	std::shared_ptr<const ControlInfoMap::Serialized> desired = std::move(newBlob);
+	if (!std::atomic_compare_exchange_strong(&infoData.serialized, &blob, desired))
+		return blob;
+
+	return desired;
+}
+
+int ControlSerializer::writeInfoMap(const ControlInfoMap &info,
+				    unsigned int handle,
+				    ByteStreamBuffer &buffer)
 {
 	/* Compute entries and data required sizes. */
 	size_t entriesSize = info.size() * sizeof(struct ipa_control_range_entry);
@@ -211,22 +378,33 @@ int ControlSerializer::serialize(const ControlInfoMap &info,
 	for (const auto &ctrl : info)
 		valuesSize += binarySize(ctrl.second);
 
-	/* Prepare the packet header, assign a handle to the ControlInfoMap. */
+	/* Prepare the packet header. */
 	struct ipa_controls_header hdr;
 	hdr.version = IPA_CONTROLS_FORMAT_VERSION;
-	hdr.handle = ++serial_;
+	hdr.handle = handle;
 	hdr.entries = info.size();
 	hdr.size = sizeof(hdr) + entriesSize + valuesSize;
 	hdr.data_offset = sizeof(hdr) + entriesSize;
+	hdr.flags = 0;
+	hdr.sequence = 0;
+	hdr.reserved[0] = 0;
 
+	/*
+	 * Reserve the entries and values at once, they are then written
+	 * without further bounds checks.
+	 */
 	buffer.write(&hdr);
+	uint8_t *entries = buffer.reserve<uint8_t>(entriesSize);
+	uint8_t *values = buffer.reserve<uint8_t>(valuesSize);
+
+	if (buffer.overflow() || !entries || !values)
+		return -ENOSPC;
 
 	/*
 	 * Serialize all entries.
 	 * \todo Serialize the control name too
 	 */
-	ByteStreamBuffer entries = buffer.carveOut(entriesSize);
-	ByteStreamBuffer values = buffer.carveOut(valuesSize);
+	uint8_t *data = values;
 
 	for (const auto &ctrl : info) {
 		const ControlId *id = ctrl.first;
@@ -235,21 +413,13 @@ int ControlSerializer::serialize(const ControlInfoMap &info,
 		struct ipa_control_range_entry entry;
 		entry.id = id->id();
 		entry.type = id->type();
-		entry.offset = values.offset();
-		entries.write(&entry);
+		entry.offset = data - values;
+		memcpy(entries, &entry, sizeof(entry));
+		entries += sizeof(entry);
 
-		store(range, values);
+		data = store(range, data);
 	}
 
-	if (buffer.overflow())
-		return -ENOSPC;
-
-	/*
-	 * Store the map to handle association, to be used to serialize and
-	 * deserialize control lists.
-	 */
-	infoMapHandles_[&info] = hdr.handle;
-
 	return 0;
 }
 
@@ -261,6 +431,12 @@ int ControlSerializer::serialize(const ControlInfoMap &info,
  * Serialize the \a list into the \a buffer using the serialization format
  * defined by the IPA context interface in ipa_controls.h.
  *
+ * When delta encoding is enabled with setDeltaEncoding(), only the controls
+ * that differ from the previous ControlList serialized with the same
+ * ControlInfoMap handle are stored, except for periodic keyframes. The
+ * binarySize() of the \a list is an upper bound of the serialized size in all
+ * cases.
+ *
  * \return 0 on success, a negative error code otherwise
  * \retval -ENOENT The ControlList is related to an unknown ControlInfoMap
  * \retval -ENOSPC Not enough space is available in the buffer
@@ -268,6 +444,8 @@ int ControlSerializer::serialize(const ControlInfoMap &info,
 int ControlSerializer::serialize(const ControlList &list,
 				 ByteStreamBuffer &buffer)
 {
+	CpuScope scope(CameraStatistics::CpuSerialization);
+
 	/*
 	 * Find the ControlInfoMap handle for the ControlList if it has one, or
 	 * use 0 for ControlList without a ControlInfoMap.
@@ -286,6 +464,72 @@ int ControlSerializer::serialize(const ControlList &list,
 		infoMapHandle = 0;
 	}
 
+	if (!keyframeInterval_)
+		return serializeList(list, infoMapHandle, 0, 0, buffer);
+
+	/*
+	 * Send a keyframe for the first list of a handle, when the keyframe
+	 * interval elapses, when the sequence number wraps around, or when
+	 * the delta can't be encoded or would be larger than the full list.
+	 */
+	DeltaState &state = txDeltas_[infoMapHandle];
+	uint32_t sequence = state.sequence + 1;
+	ControlList delta;
+
+	bool keyframe = !state.sequence || !sequence ||
+			state.deltas + 1 >= keyframeInterval_;
+	if (!keyframe)
+		keyframe = !computeDelta(state.list, list, &delta) ||
+			   binarySize(delta) > binarySize(list);
+
+	if (!sequence)
+		sequence = 1;
+
+	int ret;
+	if (keyframe)
+		ret = serializeList(list, infoMapHandle, 0, sequence, buffer);
+	else
+		ret = serializeList(delta, infoMapHandle, IPA_CONTROLS_FLAG_DELTA,
+				    sequence, buffer);
+	if (ret < 0)
+		return ret;
+
+	state.list = list;
+	state.sequence = sequence;
+	state.deltas = keyframe ? 0 : state.deltas + 1;
+
+	return 0;
+}
+
+/**
+ * \brief Enable or disable delta encoding of ControlList
+ * \param[in] keyframeInterval The number of ControlList packets between two
+ * keyframes for each ControlInfoMap handle, or 0 to disable delta encoding
+ *
+ * Delta encoding reduces the size of ControlList packets when consecutive
+ * lists sent through the same channel differ in a few controls only, as is
+ * typically the case for per-frame controls. When enabled, serialize() only
+ * stores the controls that have been added, changed or removed since the
+ * previous ControlList serialized with the same ControlInfoMap handle. A full
+ * list, called a keyframe, is serialized every \a keyframeInterval packets.
+ *
+ * Delta-encoded packets can only be deserialized with deserialize<ControlList>()
+ * by a ControlSerializer that has deserialized all the preceding packets for
+ * the same handle, in order. The serializer on the other end of the channel
+ * doesn't need to be configured, it handles delta-encoded packets
+ * automatically. Delta encoding shall only be enabled when all packets are
+ * guaranteed to be deserialized, in order, by a single ControlSerializer.
+ */
+void ControlSerializer::setDeltaEncoding(unsigned int keyframeInterval)
+{
+	keyframeInterval_ = keyframeInterval;
+	txDeltas_.clear();
+}
+
+int ControlSerializer::serializeList(const ControlList &list,
+				     unsigned int handle, uint32_t flags,
+				     uint32_t sequence, ByteStreamBuffer &buffer)
+{
 	size_t entriesSize = list.size() * sizeof(struct ipa_control_value_entry);
 	size_t valuesSize = 0;
 	for (const auto &ctrl : list)
@@ -294,71 +538,119 @@ int ControlSerializer::serialize(const ControlList &list,
 	/* Prepare the packet header. */
 	struct ipa_controls_header hdr;
 	hdr.version = IPA_CONTROLS_FORMAT_VERSION;
-	hdr.handle = infoMapHandle;
+	hdr.handle = handle;
 	hdr.entries = list.size();
 	hdr.size = sizeof(hdr) + entriesSize + valuesSize;
 	hdr.data_offset = sizeof(hdr) + entriesSize;
+	hdr.flags = flags;
+	hdr.sequence = sequence;
+	hdr.reserved[0] = 0;
 
+	/*
+	 * Reserve the entries and values at once, they are then written
+	 * without further bounds checks.
+	 */
 	buffer.write(&hdr);
+	uint8_t *entries = buffer.reserve<uint8_t>(entriesSize);
+	uint8_t *values = buffer.reserve<uint8_t>(valuesSize);
 
-	ByteStreamBuffer entries = buffer.carveOut(entriesSize);
-	ByteStreamBuffer values = buffer.carveOut(valuesSize);
+	if (buffer.overflow() || !entries || !values)
+		return -ENOSPC;
 
 	/* Serialize all entries. */
+	uint8_t *data = values;
+
 	for (const auto &ctrl : list) {
 		unsigned int id = ctrl.first;
 		const ControlValue &value = ctrl.second;
 
 		struct ipa_control_value_entry entry;
 		entry.id = id;
-		entry.count = 1;
 		entry.type = value.type();
-		entry.offset = values.offset();
-		entries.write(&entry);
-
-		store(value, values);
+		entry.is_array = value.isArray();
+		entry.reserved = 0;
+		entry.count = value.numElements();
+		entry.offset = data - values;
+		memcpy(entries, &entry, sizeof(entry));
+		entries += sizeof(entry);
+
+		data = store(value, data);
 	}
 
-	if (buffer.overflow())
-		return -ENOSPC;
-
 	return 0;
 }
 
-template<>
-ControlValue ControlSerializer::load<ControlValue>(ControlType type,
-						   ByteStreamBuffer &b)
-{
-	switch (type) {
-	case ControlTypeBool: {
-		bool value;
-		b.read(&value);
-		return ControlValue(value);
-	}
+/*
+ * Empty \a list and bind it to \a idmap, keeping the memory allocated for its
+ * controls.
+ */
+void ControlSerializer::resetList(ControlList *list, const ControlIdMap &idmap)
+{
+	list->clear();
+	list->validator_ = nullptr;
+	list->idmap_ = &idmap;
+	list->infoMap_ = nullptr;
+}
 
-	case ControlTypeInteger32: {
-		int32_t value;
-		b.read(&value);
-		return ControlValue(value);
+/*
+ * Compute the changes from \a from to \a to, with removed controls stored as
+ * empty values. Lists containing empty values can't be delta-encoded.
+ */
+bool ControlSerializer::computeDelta(const ControlList &from,
+				     const ControlList &to, ControlList *delta)
+{
+	auto prev = from.begin();
+	auto next = to.begin();
+
+	while (prev != from.end() || next != to.end()) {
+		if (next != to.end() && next->second.isNone())
+			return false;
+
+		if (next == to.end() ||
+		    (prev != from.end() && prev->first < next->first)) {
+			delta->set(prev->first, ControlValue());
+			++prev;
+		} else if (prev == from.end() || next->first < prev->first) {
+			delta->set(next->first, next->second);
+			++next;
+		} else {
+			if (prev->second != next->second)
+				delta->set(next->first, next->second);
+			++prev;
+			++next;
+		}
 	}
 
-	case ControlTypeInteger64: {
-		int64_t value;
-		b.read(&value);
-		return ControlValue(value);
-	}
+	return true;
+}
 
-	default:
+ControlValue ControlSerializer::loadControlValue(ControlType type,
+						ByteStreamBuffer &buffer,
+						bool isArray,
+						unsigned int count)
+{
+	/*
+	 * Reserve the storage in the ControlValue and read the data directly
+	 * into it, to avoid going through an intermediate copy.
+	 */
+	ControlValue value;
+	value.reserve(type, isArray, count);
+
+	Span<uint8_t> data = value.data();
+	const uint8_t *src = buffer.read<uint8_t>(alignedSize(data.size()));
+	if (!src)
 		return ControlValue();
-	}
+
+	memcpy(data.data(), src, data.size());
+
+	return value;
 }
 
-template<>
-ControlRange ControlSerializer::load<ControlRange>(ControlType type,
-						   ByteStreamBuffer &b)
+ControlRange ControlSerializer::loadControlRange(ControlType type,
+						 ByteStreamBuffer &buffer)
 {
-	ControlValue min = load<ControlValue>(type, b);
-	ControlValue max = load<ControlValue>(type, b);
+	ControlValue min = loadControlValue(type, buffer);
+	ControlValue max = loadControlValue(type, buffer);
 
 	return ControlRange(min, max);
 }
@@ -368,8 +660,8 @@ ControlRange ControlSerializer::load<ControlRange>(ControlType type,
  * \brief Deserialize an object from a binary buffer
  * \param[in] buffer The memory buffer that contains the object
  *
- * This method is only valid when specialized for ControlInfoMap or
- * ControlList. Any other typename \a T is not supported.
+ * This method is only valid when specialized for ControlInfoMap, ControlList
+ * or ControlListView. Any other typename \a T is not supported.
  */
 
 /**
@@ -394,6 +686,12 @@ ControlInfoMap ControlSerializer::deserialize<ControlInfoMap>(ByteStreamBuffer &
 		return {};
 	}
 
+	if (hdr.flags) {
+		LOG(Serializer, Error)
+			<< "Unsupported controls flags " << utils::hex(hdr.flags);
+		return {};
+	}
+
 	ByteStreamBuffer entries = buffer.carveOut(hdr.data_offset - sizeof(hdr));
 	ByteStreamBuffer values = buffer.carveOut(hdr.size - hdr.data_offset);
 
@@ -402,21 +700,47 @@ ControlInfoMap ControlSerializer::deserialize<ControlInfoMap>(ByteStreamBuffer &
 		return {};
 	}
 
+	/*
+	 * Handles identify immutable ControlInfoMap contents, reuse the map if
+	 * it has already been deserialized.
+	 */
+	auto iter = infoMaps_.find(hdr.handle);
+	if (iter != infoMaps_.end())
+		return iter->second;
+
 	ControlInfoMap::Map ctrls;
 
 	for (unsigned int i = 0; i < hdr.entries; ++i) {
-		struct ipa_control_range_entry entry;
-		entries.read(&entry);
+		const struct ipa_control_range_entry *entry =
+			entries.read<ipa_control_range_entry>();
+		if (!entry) {
+			LOG(Serializer, Error) << "Invalid entry " << i;
+			return {};
+		}
+
+		if (!isValidValue(entry->type, false, 1,
+				  values.size() - values.offset())) {
+			LOG(Serializer, Error)
+				<< "Bad data, invalid entry " << i;
+			return {};
+		}
 
-		/* Create and cache the individual ControlId. */
-		ControlType type = static_cast<ControlType>(entry.type);
-		/**
-		 * \todo Find a way to preserve the control name for debugging
-		 * purpose.
+		/*
+		 * Use the libcamera ControlId if the entry matches one, or
+		 * create and cache the individual ControlId otherwise.
 		 */
-		controlIds_.emplace_back(std::make_unique<ControlId>(entry.id, "", type));
+		ControlType type = static_cast<ControlType>(entry->type);
+		const ControlId *id = controls::find(entry->id);
+		if (!id || id->type() != type) {
+			/**
+			 * \todo Find a way to preserve the control name for
+			 * debugging purpose.
+			 */
+			controlIds_.emplace_back(std::make_unique<ControlId>(entry->id, "", type));
+			id = controlIds_.back().get();
+		}
 
-		if (entry.offset != values.offset()) {
+		if (entry->offset != values.offset()) {
 			LOG(Serializer, Error)
 				<< "Bad data, entry offset mismatch (entry "
 				<< i << ")";
@@ -424,8 +748,7 @@ ControlInfoMap ControlSerializer::deserialize<ControlInfoMap>(ByteStreamBuffer &
 		}
 
 		/* Create and store the ControlRange. */
-		ctrls.emplace(controlIds_.back().get(),
-			      load<ControlRange>(type, values));
+		ctrls.emplace(id, loadControlRange(type, values));
 	}
 
 	/*
@@ -438,6 +761,34 @@ ControlInfoMap ControlSerializer::deserialize<ControlInfoMap>(ByteStreamBuffer &
 	return map;
 }
 
+/*
+ * Retrieve the ControlInfoMap associated with a ControlList based on its
+ * handle. The mapping between infoMap and handle is set up when serializing
+ * or deserializing ControlInfoMap. A null handle (which is currently the case
+ * for ControlList related to libcamera controls) maps to no ControlInfoMap.
+ */
+int ControlSerializer::lookupInfoMap(unsigned int handle,
+				     const ControlInfoMap **infoMap) const
+{
+	if (!handle) {
+		*infoMap = nullptr;
+		return 0;
+	}
+
+	auto iter = std::find_if(infoMapHandles_.begin(), infoMapHandles_.end(),
+				 [&](const decltype(infoMapHandles_)::value_type &entry) {
+					 return entry.second == handle;
+				 });
+	if (iter == infoMapHandles_.end()) {
+		LOG(Serializer, Error)
+			<< "Can't deserialize ControlList: unknown ControlInfoMap";
+		return -ENOENT;
+	}
+
+	*infoMap = iter->first;
+	return 0;
+}
+
 /**
  * \brief Deserialize a ControlList from a binary buffer
  * \param[in] buffer The memory buffer that contains the serialized list
@@ -450,6 +801,35 @@ ControlInfoMap ControlSerializer::deserialize<ControlInfoMap>(ByteStreamBuffer &
 template<>
 ControlList ControlSerializer::deserialize<ControlList>(ByteStreamBuffer &buffer)
 {
+	ControlList ctrls;
+	if (deserialize(buffer, &ctrls) < 0)
+		return {};
+
+	return ctrls;
+}
+
+/**
+ * \brief Deserialize a ControlList from a binary buffer in place
+ * \param[in] buffer The memory buffer that contains the serialized list
+ * \param[out] list The control list to fill with the deserialized controls
+ *
+ * Re-construct a ControlList from a binary \a buffer containing data
+ * serialized using the serialize() method, replacing the content of \a list.
+ * The memory allocated for the controls of \a list is reused, this method thus
+ * doesn't allocate memory when \a list is reused to deserialize lists of the
+ * same size, if the lists don't contain array controls. It should be preferred
+ * over deserialize<ControlList>() in hot paths.
+ *
+ * On error \a list is left empty.
+ *
+ * \return 0 on success or a negative error code otherwise
+ */
+int ControlSerializer::deserialize(ByteStreamBuffer &buffer, ControlList *list)
+{
+	CpuScope scope(CameraStatistics::CpuSerialization);
+
+	list->clear();
+
 	struct ipa_controls_header hdr;
 	buffer.read(&hdr);
 
@@ -457,7 +837,13 @@ ControlList ControlSerializer::deserialize<ControlList>(ByteStreamBuffer &buffer
 		LOG(Serializer, Error)
 			<< "Unsupported controls format version "
 			<< hdr.version;
-		return {};
+		return -EINVAL;
+	}
+
+	if (hdr.flags & ~IPA_CONTROLS_FLAG_DELTA) {
+		LOG(Serializer, Error)
+			<< "Unsupported controls flags " << utils::hex(hdr.flags);
+		return -EINVAL;
 	}
 
 	ByteStreamBuffer entries = buffer.carveOut(hdr.data_offset - sizeof(hdr));
@@ -465,51 +851,354 @@ ControlList ControlSerializer::deserialize<ControlList>(ByteStreamBuffer &buffer
 
 	if (buffer.overflow()) {
 		LOG(Serializer, Error) << "Serialized packet too small";
-		return {};
+		return -EINVAL;
 	}
 
-	/*
-	 * Retrieve the ControlInfoMap associated with the ControlList based on
-	 * its ID. The mapping between infoMap and ID is set up when serializing
-	 * or deserializing ControlInfoMap. If no mapping is found (which is
-	 * currently the case for ControlList related to libcamera controls),
-	 * use the global control::control idmap.
-	 */
 	const ControlInfoMap *infoMap;
-	if (hdr.handle) {
-		auto iter = std::find_if(infoMapHandles_.begin(), infoMapHandles_.end(),
-					 [&](decltype(infoMapHandles_)::value_type &entry) {
-						 return entry.second == hdr.handle;
-					 });
-		if (iter == infoMapHandles_.end()) {
+	int ret = lookupInfoMap(hdr.handle, &infoMap);
+	if (ret < 0)
+		return ret;
+
+	const ControlIdMap &idmap = infoMap ? infoMap->idmap() : controls::controls;
+	bool delta = hdr.flags & IPA_CONTROLS_FLAG_DELTA;
+
+	/* Deltas are deserialized to a scratch list and merged in \a list. */
+	ControlList *ctrls = delta ? &rxDelta_ : list;
+	resetList(ctrls, idmap);
+
+	for (unsigned int i = 0; i < hdr.entries; ++i) {
+		const struct ipa_control_value_entry *entry =
+			entries.read<ipa_control_value_entry>();
+		if (!entry) {
+			LOG(Serializer, Error) << "Invalid entry " << i;
+			ctrls->clear();
+			return -EINVAL;
+		}
+
+		if (entry->offset != values.offset()) {
 			LOG(Serializer, Error)
-				<< "Can't deserialize ControlList: unknown ControlInfoMap";
-			return {};
+				<< "Bad data, entry offset mismatch (entry "
+				<< i << ")";
+			ctrls->clear();
+			return -EINVAL;
 		}
 
-		infoMap = iter->first;
-	} else {
-		infoMap = nullptr;
+		if (!isValidValue(entry->type, entry->is_array, entry->count,
+				  values.size() - values.offset())) {
+			LOG(Serializer, Error)
+				<< "Bad data, invalid entry " << i;
+			ctrls->clear();
+			return -EINVAL;
+		}
+
+		ControlType type = static_cast<ControlType>(entry->type);
+		ctrls->set(entry->id,
+			   loadControlValue(type, values, entry->is_array,
+					    entry->count));
+	}
+
+	if (!delta) {
+		/* Keyframes of delta-encoded streams start a new reference. */
+		if (hdr.sequence) {
+			DeltaState &state = rxDeltas_[hdr.handle];
+			state.list = *list;
+			state.sequence = hdr.sequence;
+			state.deltas = 0;
+		}
+
+		return 0;
+	}
+
+	auto iter = rxDeltas_.find(hdr.handle);
+	if (iter == rxDeltas_.end() ||
+	    iter->second.sequence + 1 != hdr.sequence) {
+		LOG(Serializer, Error)
+			<< "Can't deserialize ControlList: out of sequence delta";
+		return -EINVAL;
+	}
+
+	/*
+	 * Merge the delta with the reference list. Both lists are sorted by
+	 * ID, and empty values in the delta mark removed controls.
+	 */
+	DeltaState &state = iter->second;
+	resetList(list, idmap);
+	list->reserve(state.list.size() + rxDelta_.size());
+
+	auto prev = state.list.begin();
+	auto next = rxDelta_.begin();
+
+	while (prev != state.list.end() || next != rxDelta_.end()) {
+		if (next == rxDelta_.end() ||
+		    (prev != state.list.end() && prev->first < next->first)) {
+			list->set(prev->first, prev->second);
+			++prev;
+			continue;
+		}
+
+		if (prev != state.list.end() && prev->first == next->first)
+			++prev;
+
+		if (!next->second.isNone())
+			list->set(next->first, next->second);
+		++next;
+	}
+
+	state.list = *list;
+	state.sequence = hdr.sequence;
+
+	return 0;
+}
+
+/**
+ * \brief Deserialize a ControlListView from a binary buffer
+ * \param[in] buffer The memory buffer that contains the serialized list
+ *
+ * Create a read-only view over a ControlList serialized in a binary \a buffer
+ * using the serialize() method. Unlike deserialize<ControlList>(), the control
+ * values are not reconstructed. The serialized packet is instead copied in a
+ * single memory block owned by the view, and values are looked up directly in
+ * the packet when accessed. This is more efficient than deserializing a
+ * ControlList when only some of the controls are accessed.
+ *
+ * \return The ControlListView, or an empty view if the buffer doesn't contain
+ * a valid serialized ControlList
+ */
+template<>
+ControlListView ControlSerializer::deserialize<ControlListView>(ByteStreamBuffer &buffer)
+{
+	CpuScope scope(CameraStatistics::CpuSerialization);
+
+	struct ipa_controls_header hdr;
+	if (buffer.read(&hdr) < 0)
+		return {};
+
+	if (hdr.version != IPA_CONTROLS_FORMAT_VERSION) {
+		LOG(Serializer, Error)
+			<< "Unsupported controls format version "
+			<< hdr.version;
+		return {};
+	}
+
+	if (hdr.flags & ~IPA_CONTROLS_FLAG_DELTA) {
+		LOG(Serializer, Error)
+			<< "Unsupported controls flags " << utils::hex(hdr.flags);
+		return {};
+	}
+
+	if (hdr.data_offset < sizeof(hdr) || hdr.size < hdr.data_offset ||
+	    (hdr.data_offset - sizeof(hdr)) / sizeof(ipa_control_value_entry) < hdr.entries) {
+		LOG(Serializer, Error) << "Invalid packet header";
+		return {};
+	}
+
+	ByteStreamBuffer entries = buffer.carveOut(hdr.data_offset - sizeof(hdr));
+	ByteStreamBuffer values = buffer.carveOut(hdr.size - hdr.data_offset);
+
+	if (buffer.overflow()) {
+		LOG(Serializer, Error) << "Serialized packet too small";
+		return {};
 	}
 
-	ControlList ctrls(infoMap ? infoMap->idmap() : controls::controls);
+	if (hdr.flags & IPA_CONTROLS_FLAG_DELTA) {
+		LOG(Serializer, Error)
+			<< "Delta-encoded packets can't be viewed";
+		return {};
+	}
+
+	const ControlInfoMap *infoMap;
+	if (lookupInfoMap(hdr.handle, &infoMap) < 0)
+		return {};
+
+	/*
+	 * Copy the entries and data sections, which are contiguous, to memory
+	 * owned by the view. The copy is suitably aligned for all control
+	 * types.
+	 */
+	auto packet = std::make_shared<std::vector<uint8_t>>(
+		entries.base(), values.base() + values.size());
+
+	ControlListView view;
+	view.entries_ = reinterpret_cast<const ipa_control_value_entry *>(packet->data());
+	view.count_ = hdr.entries;
+	view.values_ = packet->data() + entries.size();
+
+	/* Validate all entries to make lookups safe. */
+	view.sorted_ = true;
 
 	for (unsigned int i = 0; i < hdr.entries; ++i) {
-		struct ipa_control_value_entry entry;
-		entries.read(&entry);
+		const ipa_control_value_entry &entry = view.entries_[i];
 
-		if (entry.offset != values.offset()) {
+		if (entry.offset % ControlValueAlignment ||
+		    entry.offset > values.size() ||
+		    !isValidValue(entry.type, entry.is_array, entry.count,
+				  values.size() - entry.offset)) {
 			LOG(Serializer, Error)
-				<< "Bad data, entry offset mismatch (entry "
-				<< i << ")";
+				<< "Bad data, invalid entry " << i;
 			return {};
 		}
 
-		ControlType type = static_cast<ControlType>(entry.type);
-		ctrls.set(entry.id, load<ControlValue>(type, values));
+		if (i && entry.id <= view.entries_[i - 1].id)
+			view.sorted_ = false;
 	}
 
-	return ctrls;
+	view.packet_ = std::move(packet);
+	view.idmap_ = infoMap ? &infoMap->idmap() : &controls::controls;
+	view.infoMap_ = infoMap;
+
+	return view;
+}
+
+/**
+ * \class ControlListView
+ * \brief Read-only view over a serialized ControlList
+ *
+ * The ControlListView class gives access to the controls of a serialized
+ * ControlList without reconstructing it. It is created by
+ * ControlSerializer::deserialize<ControlListView>(), and keeps a copy of the
+ * serialized packet that is shared between copies of the view. Lookups are
+ * performed directly on the packed entries, with a binary search when the
+ * entries are sorted by ID (which is always the case for lists serialized by
+ * the ControlSerializer), or a linear search otherwise.
+ *
+ * Values of array controls are returned as a Span that points to the packet
+ * data, without copying them. The Span is valid as long as the view, or any
+ * of its copies, exists.
+ */
+
+/**
+ * \brief Construct an empty ControlListView
+ */
+ControlListView::ControlListView()
+	: idmap_(nullptr), infoMap_(nullptr), entries_(nullptr), count_(0),
+	  values_(nullptr), sorted_(true)
+{
+}
+
+/**
+ * \fn ControlListView::empty()
+ * \brief Identify if the view is empty
+ * \return True if the view contains no control, false otherwise
+ */
+
+/**
+ * \fn ControlListView::size()
+ * \brief Retrieve the number of controls in the view
+ * \return The number of controls in the view
+ */
+
+/**
+ * \fn ControlListView::infoMap()
+ * \brief Retrieve the ControlInfoMap of the serialized ControlList
+ * \return The ControlInfoMap associated with the serialized ControlList, or
+ * nullptr if the list has no associated ControlInfoMap
+ */
+
+/**
+ * \brief Check if the view contains a control with the specified \a id
+ * \param[in] id The control numerical ID
+ * \return True if the view contains a matching control, false otherwise
+ */
+bool ControlListView::contains(unsigned int id) const
+{
+	return entry(id) != nullptr;
+}
+
+/**
+ * \brief Get the value of control \a id
+ * \param[in] id The control numerical ID
+ *
+ * The value is copied from the serialized packet to the returned ControlValue.
+ *
+ * \return The control value, or an empty ControlValue if the control is not
+ * present in the view
+ */
+ControlValue ControlListView::get(unsigned int id) const
+{
+	const ipa_control_value_entry *e = entry(id);
+	if (!e)
+		return {};
+
+	ControlValue value;
+	value.reserve(static_cast<ControlType>(e->type), e->is_array, e->count);
+
+	Span<uint8_t> data = value.data();
+	memcpy(data.data(), values_ + e->offset, data.size());
+
+	return value;
+}
+
+/**
+ * \fn template<typename T> T ControlListView::get(const Control<T> &ctrl) const
+ * \brief Get the value of control \a ctrl
+ * \param[in] ctrl The control
+ *
+ * Scalar values are copied from the serialized packet. Array values, for
+ * controls whose type \a T is a Span, reference the serialized packet
+ * directly.
+ *
+ * \return The control value, or a default-constructed \a T if the control is
+ * not present in the view or its type doesn't match \a T
+ */
+
+/**
+ * \brief Reconstruct a ControlList from the view
+ * \return A ControlList containing all the controls of the view
+ */
+ControlList ControlListView::toControlList() const
+{
+	if (!idmap_)
+		return {};
+
+	ControlList list(*idmap_);
+	list.reserve(count_);
+
+	for (unsigned int i = 0; i < count_; ++i)
+		list.set(entries_[i].id, get(entries_[i].id));
+
+	return list;
+}
+
+const ipa_control_value_entry *ControlListView::entry(unsigned int id) const
+{
+	const ipa_control_value_entry *end = entries_ + count_;
+	const ipa_control_value_entry *e;
+
+	if (sorted_)
+		e = std::lower_bound(entries_, end, id,
+				     [](const ipa_control_value_entry &entry,
+					unsigned int id) {
+					     return entry.id < id;
+				     });
+	else
+		e = std::find_if(entries_, end,
+				 [id](const ipa_control_value_entry &entry) {
+					 return entry.id == id;
+				 });
+
+	if (e == end || e->id != id)
+		return nullptr;
+
+	return e;
+}
+
+const uint8_t *ControlListView::find(unsigned int id, ControlType type,
+				     bool isArray, std::size_t *count) const
+{
+	const ipa_control_value_entry *e = entry(id);
+	if (!e)
+		return nullptr;
+
+	if (e->type != type || (e->is_array && !isArray)) {
+		LOG(Serializer, Error)
+			<< "Control " << utils::hex(id) << " type mismatch";
+		return nullptr;
+	}
+
+	if (count)
+		*count = e->count;
+
+	return values_ + e->offset;
 }
 
 } /* namespace libcamera */
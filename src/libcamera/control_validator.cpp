@@ -7,6 +7,8 @@
 
 #include "control_validator.h"
 
+#include <libcamera/controls.h>
+
 /**
  * \file control_validator.h
  * \brief Abstract control validator
@@ -42,4 +44,44 @@ namespace libcamera {
  * \return True if the control is valid, false otherwise
  */
 
+/**
+ * \brief Validate a control and its value
+ * \param[in] id The control ID
+ * \param[in] value The control value
+ *
+ * This method validates the control \a id and its \a value against the object
+ * corresponding to the validator. In addition to the checks performed by
+ * validate(unsigned int id), implementations may verify that the value type
+ * and range are supported by the object. The default implementation only
+ * validates the control \a id.
+ *
+ * \return True if the control and its value are valid, false otherwise
+ */
+bool ControlValidator::validate(unsigned int id, const ControlValue &value) const
+{
+	return validate(id);
+}
+
+/**
+ * \brief Validate all controls of a list
+ * \param[in] list The control list
+ *
+ * This method validates all the controls in \a list along with their values,
+ * as validate(unsigned int id, const ControlValue &value) does. It allows
+ * validators to implement bulk validation more efficiently than individual
+ * validation of each control. The default implementation validates the
+ * controls one by one.
+ *
+ * \return True if all the controls in the list are valid, false otherwise
+ */
+bool ControlValidator::validate(const ControlList &list) const
+{
+	for (const auto &ctrl : list) {
+		if (!validate(ctrl.first, ctrl.second))
+			return false;
+	}
+
+	return true;
+}
+
 } /* namespace libcamera */
@@ -7,8 +7,14 @@
 
 #include <libcamera/controls.h>
 
+#include <algorithm>
+#include <atomic>
 #include <iomanip>
+#include <new>
 #include <sstream>
+#include <stdexcept>
+#include <stdlib.h>
+#include <string.h>
 #include <string>
 
 #include "control_validator.h"
@@ -58,18 +64,62 @@ LOG_DEFINE_CATEGORY(Controls)
  * The control stores a 32-bit integer value
  * \var ControlTypeInteger64
  * The control stores a 64-bit integer value
+ * \var ControlTypeByte
+ * The control stores a byte value as an unsigned 8-bit integer
+ * \var ControlTypeFloat
+ * The control stores a 32-bit floating point value
+ * \var ControlTypeRectangle
+ * The control stores a Rectangle value
  */
 
+namespace {
+
+static constexpr size_t ControlValueSize[] = {
+	[ControlTypeNone]		= 0,
+	[ControlTypeBool]		= sizeof(bool),
+	[ControlTypeInteger32]		= sizeof(int32_t),
+	[ControlTypeInteger64]		= sizeof(int64_t),
+	[ControlTypeByte]		= sizeof(uint8_t),
+	[ControlTypeFloat]		= sizeof(float),
+	[ControlTypeRectangle]		= sizeof(Rectangle),
+};
+
+} /* namespace */
+
+/**
+ * \brief Reference-counted storage for large ControlValue data
+ *
+ * Values that don't fit in the ControlValue itself are stored in a separately
+ * allocated memory block, prefixed with a reference count. As the data is
+ * never modified once stored, copies of a ControlValue share the same block.
+ */
+struct ControlValue::Storage {
+	std::atomic<unsigned int> refcount;
+	uint32_t padding;
+
+	uint8_t *data() { return reinterpret_cast<uint8_t *>(this + 1); }
+};
+
 /**
  * \class ControlValue
  * \brief Abstract type representing the value of a control
+ *
+ * A ControlValue stores either a single value, or an array of values, of one
+ * of the types defined by ControlType. Array values are accessed through a
+ * Span<const T> that references the data stored in the ControlValue, without
+ * copying it.
+ *
+ * Small values, up to the size of a 64-bit integer, are stored inline in the
+ * ControlValue. Larger values are stored in a reference-counted memory block
+ * that is shared between copies of the ControlValue, making copies of large
+ * arrays cheap. Setting a new value never modifies shared data in place.
  */
 
 /**
  * \brief Construct an empty ControlValue.
  */
 ControlValue::ControlValue()
-	: type_(ControlTypeNone)
+	: type_(ControlTypeNone), isArray_(false), numElements_(0), value_(0)
 {
 }
 
@@ -78,8 +128,19 @@ ControlValue::ControlValue()
  * \param[in] value Boolean value to store
  */
 ControlValue::ControlValue(bool value)
-	: type_(ControlTypeBool), bool_(value)
+	: ControlValue()
 {
+	set(ControlTypeBool, false, &value, 1, sizeof(bool));
+}
+
+/**
+ * \brief Construct a byte ControlValue
+ * \param[in] value Byte value to store
+ */
+ControlValue::ControlValue(uint8_t value)
+	: ControlValue()
+{
+	set(ControlTypeByte, false, &value, 1, sizeof(uint8_t));
 }
 
 /**
@@ -87,8 +148,9 @@ ControlValue::ControlValue(bool value)
  * \param[in] value Integer value to store
  */
 ControlValue::ControlValue(int32_t value)
-	: type_(ControlTypeInteger32), integer32_(value)
+	: ControlValue()
 {
+	set(ControlTypeInteger32, false, &value, 1, sizeof(int32_t));
 }
 
 /**
@@ -96,8 +158,126 @@ ControlValue::ControlValue(int32_t value)
  * \param[in] value Integer value to store
  */
 ControlValue::ControlValue(int64_t value)
-	: type_(ControlTypeInteger64), integer64_(value)
+	: ControlValue()
+{
+	set(ControlTypeInteger64, false, &value, 1, sizeof(int64_t));
+}
+
+/**
+ * \brief Construct a floating point ControlValue
+ * \param[in] value Floating point value to store
+ */
+ControlValue::ControlValue(float value)
+	: ControlValue()
+{
+	set(ControlTypeFloat, false, &value, 1, sizeof(float));
+}
+
+/**
+ * \brief Construct a Rectangle ControlValue
+ * \param[in] value Rectangle value to store
+ */
+ControlValue::ControlValue(const Rectangle &value)
+	: ControlValue()
+{
+	set(ControlTypeRectangle, false, &value, 1, sizeof(Rectangle));
+}
+
+/**
+ * \fn template<typename T> ControlValue::ControlValue(Span<T> values)
+ * \brief Construct an array ControlValue
+ * \param[in] values The array of values to store
+ *
+ * The values are copied to the ControlValue.
+ */
+
+/**
+ * \brief Construct a ControlValue with the content of \a other
+ * \param[in] other The ControlValue to copy
+ *
+ * Large values are shared with \a other instead of being copied.
+ */
+ControlValue::ControlValue(const ControlValue &other)
+	: ControlValue()
 {
+	*this = other;
+}
+
+/**
+ * \brief Construct a ControlValue by moving the content of \a other
+ * \param[in] other The ControlValue to move
+ *
+ * \a other is reset to an empty value.
+ */
+ControlValue::ControlValue(ControlValue &&other) noexcept
+	: type_(other.type_), isArray_(other.isArray_),
+	  numElements_(other.numElements_), value_(other.value_)
+{
+	other.type_ = ControlTypeNone;
+	other.isArray_ = false;
+	other.numElements_ = 0;
+	other.value_ = 0;
+}
+
+ControlValue::~ControlValue()
+{
+	release();
+}
+
+/**
+ * \brief Replace the content of the ControlValue with the one of \a other
+ * \param[in] other The ControlValue to copy
+ * \return A reference to the ControlValue
+ */
+ControlValue &ControlValue::operator=(const ControlValue &other)
+{
+	if (this == &other)
+		return *this;
+
+	if (other.isStorageExternal())
+		other.storage_->refcount++;
+
+	release();
+
+	type_ = other.type_;
+	isArray_ = other.isArray_;
+	numElements_ = other.numElements_;
+	value_ = 0;
+
+	if (other.isStorageExternal())
+		storage_ = other.storage_;
+	else
+		value_ = other.value_;
+
+	return *this;
+}
+
+/**
+ * \brief Move the content of \a other to the ControlValue
+ * \param[in] other The ControlValue to move
+ *
+ * \a other is reset to an empty value.
+ *
+ * \return A reference to the ControlValue
+ */
+ControlValue &ControlValue::operator=(ControlValue &&other) noexcept
+{
+	if (this == &other)
+		return *this;
+
+	release();
+
+	type_ = other.type_;
+	isArray_ = other.isArray_;
+	numElements_ = other.numElements_;
+	value_ = other.value_;
+
+	other.type_ = ControlTypeNone;
+	other.isArray_ = false;
+	other.numElements_ = 0;
+	other.value_ = 0;
+
+	return *this;
 }
 
 /**
@@ -112,12 +292,139 @@ ControlValue::ControlValue(int64_t value)
  * \return True if the value type is ControlTypeNone, false otherwise
  */
 
+/**
+ * \fn ControlValue::isArray()
+ * \brief Determine if the value stores an array
+ * \return True if the value stores an array, false otherwise
+ */
+
+/**
+ * \fn ControlValue::numElements()
+ * \brief Retrieve the number of elements stored in the ControlValue
+ *
+ * For array values, this method returns the number of elements in the array.
+ * Otherwise, it returns 1 for non-empty values and 0 for empty values.
+ *
+ * \return The number of elements stored in the ControlValue
+ */
+
+/**
+ * \brief Retrieve the raw data of a control value
+ * \return The raw data of the control value as a span of uint8_t
+ */
+Span<const uint8_t> ControlValue::data() const
+{
+	size_t size = numElements_ * ControlValueSize[type_];
+	const uint8_t *data = isStorageExternal()
+			    ? storage_->data()
+			    : reinterpret_cast<const uint8_t *>(&value_);
+
+	return { data, size };
+}
+
+/**
+ * \copydoc ControlValue::data() const
+ *
+ * The data may be shared with copies of the ControlValue, it shall thus only
+ * be written to right after a call to reserve().
+ */
+Span<uint8_t> ControlValue::data()
+{
+	Span<const uint8_t> data = const_cast<const ControlValue *>(this)->data();
+	return { const_cast<uint8_t *>(data.data()), data.size() };
+}
+
+/**
+ * \brief Set the control type and reserve memory
+ * \param[in] type The control type
+ * \param[in] isArray True to make the value an array
+ * \param[in] numElements The number of elements
+ *
+ * This method sets the type of the control value to \a type, and reserves
+ * memory to store the control value data internally for \a numElements
+ * elements. The memory content is left uninitialised, and shall be filled
+ * through data() by the caller. This allows filling the value directly from
+ * its source, such as a serialized buffer, without an intermediate copy.
+ *
+ * If the memory can't be allocated, the control value is left empty.
+ */
+void ControlValue::reserve(ControlType type, bool isArray,
+			   std::size_t numElements)
+{
+	if (!isArray)
+		numElements = 1;
+
+	release();
+
+	type_ = type;
+	isArray_ = isArray;
+	numElements_ = numElements;
+	value_ = 0;
+
+	if (!isStorageExternal())
+		return;
+
+	static_assert(sizeof(Storage) % alignof(int64_t) == 0,
+		      "Misaligned ControlValue storage data");
+
+	size_t size = numElements * ControlValueSize[type];
+	void *mem = malloc(sizeof(Storage) + size);
+	if (!mem) {
+		LOG(Controls, Error)
+			<< "Failed to allocate " << size << " bytes for control value";
+		type_ = ControlTypeNone;
+		isArray_ = false;
+		numElements_ = 0;
+		return;
+	}
+
+	storage_ = new (mem) Storage();
+	storage_->refcount = 1;
+}
+
+bool ControlValue::isStorageExternal() const
+{
+	return numElements_ * ControlValueSize[type_] > sizeof(value_);
+}
+
+void ControlValue::release()
+{
+	if (isStorageExternal() && !--storage_->refcount) {
+		storage_->~Storage();
+		free(storage_);
+	}
+}
+
+void ControlValue::set(ControlType type, bool isArray, const void *data,
+		       std::size_t numElements, std::size_t elementSize)
+{
+	ASSERT(elementSize == ControlValueSize[type]);
+
+	/*
+	 * Keep the current storage alive until the new data has been copied,
+	 * as \a data may point to it.
+	 */
+	ControlValue previous(std::move(*this));
+
+	reserve(type, isArray, numElements);
+
+	Span<uint8_t> storage = ControlValue::data();
+	memcpy(storage.data(), data, storage.size());
+}
+
 /**
  * \fn template<typename T> const T &ControlValue::get() const
  * \brief Get the control value
  *
- * The control value type shall match the type T, otherwise the behaviour is
- * undefined.
+ * This method returns the contained value as an instance of \a T. If the
+ * ControlValue instance stores a single value, the type \a T shall match the
+ * stored value type(). If the instance stores an array of values, the type
+ * \a T should be equal to Span<const R>, and the type R shall match the
+ * stored value type(). The behaviour is undefined otherwise.
+ *
+ * Array values are returned as a Span that references the data stored in the
+ * ControlValue. The Span is valid until the ControlValue is modified or
+ * destroyed.
  *
  * \return The control value
  */
@@ -126,52 +433,98 @@ ControlValue::ControlValue(int64_t value)
  * \fn template<typename T> void ControlValue::set(const T &value)
  * \brief Set the control value to \a value
  * \param[in] value The control value
+ *
+ * This method stores the \a value in the instance. If the type \a T is
+ * equivalent to Span<R>, the instance stores an array of values of type R.
+ * Otherwise the instance stores a single value of type \a T. The numElements()
+ * and type() are updated to reflect the stored value.
  */
 
 #ifndef __DOXYGEN__
 template<>
 const bool &ControlValue::get<bool>() const
 {
-	ASSERT(type_ == ControlTypeBool);
+	ASSERT(type_ == ControlTypeBool && !isArray_);
 
 	return bool_;
 }
 
+template<>
+const uint8_t &ControlValue::get<uint8_t>() const
+{
+	ASSERT(type_ == ControlTypeByte && !isArray_);
+
+	return byte_;
+}
+
 template<>
 const int32_t &ControlValue::get<int32_t>() const
 {
-	ASSERT(type_ == ControlTypeInteger32 || type_ == ControlTypeInteger64);
+	ASSERT((type_ == ControlTypeInteger32 || type_ == ControlTypeInteger64) &&
+	       !isArray_);
 
-	return integer32_;
+	return int32_;
 }
 
 template<>
 const int64_t &ControlValue::get<int64_t>() const
 {
-	ASSERT(type_ == ControlTypeInteger32 || type_ == ControlTypeInteger64);
+	ASSERT((type_ == ControlTypeInteger32 || type_ == ControlTypeInteger64) &&
+	       !isArray_);
+
+	return int64_;
+}
+
+template<>
+const float &ControlValue::get<float>() const
+{
+	ASSERT(type_ == ControlTypeFloat && !isArray_);
+
+	return float_;
+}
+
+template<>
+const Rectangle &ControlValue::get<Rectangle>() const
+{
+	ASSERT(type_ == ControlTypeRectangle && !isArray_);
 
-	return integer64_;
+	return *reinterpret_cast<const Rectangle *>(data().data());
 }
 
 template<>
 void ControlValue::set<bool>(const bool &value)
 {
-	type_ = ControlTypeBool;
-	bool_ = value;
+	set(ControlTypeBool, false, &value, 1, sizeof(bool));
+}
+
+template<>
+void ControlValue::set<uint8_t>(const uint8_t &value)
+{
+	set(ControlTypeByte, false, &value, 1, sizeof(uint8_t));
 }
 
 template<>
 void ControlValue::set<int32_t>(const int32_t &value)
 {
-	type_ = ControlTypeInteger32;
-	integer32_ = value;
+	set(ControlTypeInteger32, false, &value, 1, sizeof(int32_t));
 }
 
 template<>
 void ControlValue::set<int64_t>(const int64_t &value)
 {
-	type_ = ControlTypeInteger64;
-	integer64_ = value;
+	set(ControlTypeInteger64, false, &value, 1, sizeof(int64_t));
+}
+
+template<>
+void ControlValue::set<float>(const float &value)
+{
+	set(ControlTypeFloat, false, &value, 1, sizeof(float));
+}
+
+template<>
+void ControlValue::set<Rectangle>(const Rectangle &value)
+{
+	set(ControlTypeRectangle, false, &value, 1, sizeof(Rectangle));
 }
 #endif /* __DOXYGEN__ */
 
@@ -181,18 +534,56 @@ void ControlValue::set<int64_t>(const int64_t &value)
  */
 std::string ControlValue::toString() const
 {
-	switch (type_) {
-	case ControlTypeNone:
+	if (type_ == ControlTypeNone)
 		return "<None>";
-	case ControlTypeBool:
-		return bool_ ? "True" : "False";
-	case ControlTypeInteger32:
-		return std::to_string(integer32_);
-	case ControlTypeInteger64:
-		return std::to_string(integer64_);
+
+	const uint8_t *data = ControlValue::data().data();
+	std::string str(isArray_ ? "[ " : "");
+
+	for (unsigned int i = 0; i < numElements_; ++i) {
+		switch (type_) {
+		case ControlTypeBool: {
+			const bool *value = reinterpret_cast<const bool *>(data);
+			str += value[i] ? "True" : "False";
+			break;
+		}
+		case ControlTypeByte: {
+			const uint8_t *value = reinterpret_cast<const uint8_t *>(data);
+			str += std::to_string(value[i]);
+			break;
+		}
+		case ControlTypeInteger32: {
+			const int32_t *value = reinterpret_cast<const int32_t *>(data);
+			str += std::to_string(value[i]);
+			break;
+		}
+		case ControlTypeInteger64: {
+			const int64_t *value = reinterpret_cast<const int64_t *>(data);
+			str += std::to_string(value[i]);
+			break;
+		}
+		case ControlTypeFloat: {
+			const float *value = reinterpret_cast<const float *>(data);
+			str += std::to_string(value[i]);
+			break;
+		}
+		case ControlTypeRectangle: {
+			const Rectangle *value = reinterpret_cast<const Rectangle *>(data);
+			str += value[i].toString();
+			break;
+		}
+		case ControlTypeNone:
+			break;
+		}
+
+		if (i + 1 != numElements_)
+			str += ", ";
 	}
 
-	return "<ValueType Error>";
+	if (isArray_)
+		str += " ]";
+
+	return str;
 }
 
 /**
@@ -201,19 +592,13 @@ std::string ControlValue::toString() const
  */
 bool ControlValue::operator==(const ControlValue &other) const
 {
-	if (type_ != other.type_)
+	if (type_ != other.type_ || type_ == ControlTypeNone)
 		return false;
 
-	switch (type_) {
-	case ControlTypeBool:
-		return bool_ == other.bool_;
-	case ControlTypeInteger32:
-		return integer32_ == other.integer32_;
-	case ControlTypeInteger64:
-		return integer64_ == other.integer64_;
-	default:
+	if (numElements_ != other.numElements_ || isArray_ != other.isArray_)
 		return false;
-	}
+
+	return memcmp(data().data(), other.data().data(), data().size()) == 0;
 }
 
 /**
@@ -293,10 +678,10 @@ bool ControlValue::operator==(const ControlValue &other) const
  * instance, the list of controls supported by a camera is exposed as ControlId
  * instead of Control.
  *
- * Controls of any type can be defined through template specialisation, but
- * libcamera only supports the bool, int32_t and int64_t types natively (this
- * includes types that are equivalent to the supported types, such as int and
- * long int).
+ * libcamera supports controls of the bool, uint8_t, int32_t, int64_t and float
+ * types (this includes types that are equivalent to the supported types, such
+ * as int and long int), as well as arrays of those types expressed as
+ * Span<const T>.
  *
  * Controls IDs shall be unique. While nothing prevents multiple instances of
  * the Control class to be created with the same ID for the same object, doing
@@ -317,32 +702,6 @@ bool ControlValue::operator==(const ControlValue &other) const
  * \brief The Control template type T
  */
 
-#ifndef __DOXYGEN__
-template<>
-Control<void>::Control(unsigned int id, const char *name)
-	: ControlId(id, name, ControlTypeNone)
-{
-}
-
-template<>
-Control<bool>::Control(unsigned int id, const char *name)
-	: ControlId(id, name, ControlTypeBool)
-{
-}
-
-template<>
-Control<int32_t>::Control(unsigned int id, const char *name)
-	: ControlId(id, name, ControlTypeInteger32)
-{
-}
-
-template<>
-Control<int64_t>::Control(unsigned int id, const char *name)
-	: ControlId(id, name, ControlTypeInteger64)
-{
-}
-#endif /* __DOXYGEN__ */
-
 /**
  * \class ControlRange
  * \brief Describe the limits of valid values for a Control
@@ -413,27 +772,77 @@ std::string ControlRange::toString() const
  * \class ControlInfoMap
  * \brief A map of ControlId to ControlRange
  *
- * The ControlInfoMap class describes controls supported by an object as an
- * unsorted map of ControlId pointers to ControlRange instances. Unlike the
- * standard std::unsorted_map<> class, it is designed the be immutable once
- * constructed, and thus only exposes the read accessors of the
- * std::unsorted_map<> base class.
+ * The ControlInfoMap class describes controls supported by an object as a map
+ * of ControlId pointers to ControlRange instances. It is designed to be
+ * immutable once constructed, and thus only exposes read accessors.
+ *
+ * Entries are stored in an array sorted by numerical control ID, iteration
+ * thus visits controls in a deterministic order of increasing IDs. When the
+ * IDs are dense, as for libcamera controls, lookups by numerical ID use a
+ * directly indexed table and run in constant time. They fall back to a binary
+ * search on the sorted array otherwise.
  *
- * In addition to the features of the standard unsorted map, this class also
- * provides access to the mapped elements using numerical ID keys. It maintains
- * an internal map of numerical ID to ControlId for this purpose, and exposes it
- * through the idmap() method to help construction of ControlList instances.
+ * The contents of a map are shared between copies, copying or assigning a
+ * ControlInfoMap is thus cheap and doesn't duplicate the entries.
+ *
+ * In addition to the lookups by ControlId, this class also provides access to
+ * the mapped elements using numerical ID keys. It maintains an internal map of
+ * numerical ID to ControlId for this purpose, and exposes it through the
+ * idmap() method to help construction of ControlList instances.
  */
 
 /**
  * \typedef ControlInfoMap::Map
- * \brief The base std::unsorted_map<> container
+ * \brief The plain std::unordered_map<> container used to construct the map
+ */
+
+/**
+ * \typedef ControlInfoMap::key_type
+ * \brief The key type, a pointer to a ControlId
+ */
+
+/**
+ * \typedef ControlInfoMap::mapped_type
+ * \brief The mapped type, a ControlRange
+ */
+
+/**
+ * \typedef ControlInfoMap::value_type
+ * \brief The type of the map entries
+ */
+
+/**
+ * \typedef ControlInfoMap::size_type
+ * \brief The type used to count entries
  */
 
+/**
+ * \typedef ControlInfoMap::const_iterator
+ * \brief Const iterator over the map entries, in increasing ID order
+ */
+
+/**
+ * \typedef ControlInfoMap::iterator
+ * \brief Iterator over the map entries, identical to const_iterator as the
+ * map is immutable
+ */
+
+/**
+ * \brief Construct an empty ControlInfoMap
+ */
+ControlInfoMap::ControlInfoMap()
+{
+	/* All empty maps share the same contents. */
+	static const std::shared_ptr<const Data> empty = createData({});
+	data_ = empty;
+}
+
 /**
  * \fn ControlInfoMap::ControlInfoMap(const ControlInfoMap &other)
  * \brief Copy constructor, construct a ControlInfoMap from a copy of \a other
  * \param[in] other The other ControlInfoMap
+ *
+ * The contents of \a other are shared, not duplicated.
  */
 
 /**
@@ -441,9 +850,8 @@ std::string ControlRange::toString() const
  * \param[in] init The initializer list
  */
 ControlInfoMap::ControlInfoMap(std::initializer_list<Map::value_type> init)
-	: Map(init)
+	: data_(createData(Map(init)))
 {
-	generateIdmap();
 }
 
 /**
@@ -454,15 +862,17 @@ ControlInfoMap::ControlInfoMap(std::initializer_list<Map::value_type> init)
  * \a info using move semantics. Upon return the \a info map will be empty.
  */
 ControlInfoMap::ControlInfoMap(Map &&info)
-	: Map(std::move(info))
+	: data_(createData(std::move(info)))
 {
-	generateIdmap();
 }
 
 /**
  * \fn ControlInfoMap &ControlInfoMap::operator=(const ControlInfoMap &other)
  * \brief Copy assignment operator, replace the contents with a copy of \a other
  * \param[in] other The other ControlInfoMap
+ *
+ * The contents of \a other are shared, not duplicated.
+ *
  * \return A reference to the ControlInfoMap
  */
 
@@ -473,8 +883,7 @@ ControlInfoMap::ControlInfoMap(Map &&info)
  */
 ControlInfoMap &ControlInfoMap::operator=(std::initializer_list<Map::value_type> init)
 {
-	Map::operator=(init);
-	generateIdmap();
+	data_ = createData(Map(init));
 	return *this;
 }
 
@@ -489,29 +898,82 @@ ControlInfoMap &ControlInfoMap::operator=(std::initializer_list<Map::value_type>
  */
 ControlInfoMap &ControlInfoMap::operator=(Map &&info)
 {
-	Map::operator=(std::move(info));
-	generateIdmap();
+	data_ = createData(std::move(info));
 	return *this;
 }
 
 /**
- * \brief Access specified element by numerical ID
- * \param[in] id The numerical ID
- * \return A reference to the element whose ID is equal to \a id
+ * \fn ControlInfoMap::begin()
+ * \brief Retrieve an iterator to the first entry of the map
+ * \return An iterator to the entry with the lowest numerical ID
+ */
+
+/**
+ * \fn ControlInfoMap::cbegin()
+ * \copydoc ControlInfoMap::begin()
+ */
+
+/**
+ * \fn ControlInfoMap::end()
+ * \brief Retrieve an iterator pointing to the past-the-end entry of the map
+ * \return An iterator to the element following the last entry of the map
  */
-ControlInfoMap::mapped_type &ControlInfoMap::at(unsigned int id)
+
+/**
+ * \fn ControlInfoMap::cend()
+ * \copydoc ControlInfoMap::end()
+ */
+
+/**
+ * \fn ControlInfoMap::empty()
+ * \brief Check if the map is empty
+ * \return True if the map is empty, false otherwise
+ */
+
+/**
+ * \fn ControlInfoMap::size()
+ * \brief Retrieve the number of entries in the map
+ * \return The number of entries in the map
+ */
+
+/**
+ * \brief Access specified element by ControlId
+ * \param[in] id The ControlId
+ * \throw std::out_of_range if the map contains no element for \a id
+ * \return A const reference to the element for \a id
+ */
+const ControlInfoMap::mapped_type &ControlInfoMap::at(const ControlId *id) const
 {
-	return at(idmap_.at(id));
+	const_iterator iter = find(id);
+	if (iter == end())
+		throw std::out_of_range("ControlInfoMap::at");
+
+	return iter->second;
 }
 
 /**
  * \brief Access specified element by numerical ID
  * \param[in] id The numerical ID
+ * \throw std::out_of_range if the map contains no element for \a id
  * \return A const reference to the element whose ID is equal to \a id
  */
 const ControlInfoMap::mapped_type &ControlInfoMap::at(unsigned int id) const
 {
-	return at(idmap_.at(id));
+	const_iterator iter = find(id);
+	if (iter == end())
+		throw std::out_of_range("ControlInfoMap::at");
+
+	return iter->second;
+}
+
+/**
+ * \brief Count the number of elements matching a ControlId
+ * \param[in] id The ControlId
+ * \return The number of elements matching \a id
+ */
+ControlInfoMap::size_type ControlInfoMap::count(const ControlId *id) const
+{
+	return find(id) != end();
 }
 
 /**
@@ -521,27 +983,22 @@ const ControlInfoMap::mapped_type &ControlInfoMap::at(unsigned int id) const
  */
 ControlInfoMap::size_type ControlInfoMap::count(unsigned int id) const
 {
-	/*
-	 * The ControlInfoMap and its idmap have a 1:1 mapping between their
-	 * entries, we can thus just count the matching entries in idmap to
-	 * avoid an additional lookup.
-	 */
-	return idmap_.count(id);
+	return find(id) != end();
 }
 
 /**
- * \brief Find the element matching a numerical ID
- * \param[in] id The numerical ID
- * \return An iterator pointing to the element matching the numerical \a id, or
- * end() if no such element exists
+ * \brief Find the element matching a ControlId
+ * \param[in] id The ControlId
+ * \return A const iterator pointing to the element matching \a id, or end()
+ * if no such element exists
  */
-ControlInfoMap::iterator ControlInfoMap::find(unsigned int id)
+ControlInfoMap::const_iterator ControlInfoMap::find(const ControlId *id) const
 {
-	auto iter = idmap_.find(id);
-	if (iter == idmap_.end())
+	const_iterator iter = find(id->id());
+	if (iter == end() || iter->first != id)
 		return end();
 
-	return find(iter->second);
+	return iter;
 }
 
 /**
@@ -552,11 +1009,25 @@ ControlInfoMap::iterator ControlInfoMap::find(unsigned int id)
  */
 ControlInfoMap::const_iterator ControlInfoMap::find(unsigned int id) const
 {
-	auto iter = idmap_.find(id);
-	if (iter == idmap_.end())
+	const Data &data = *data_;
+
+	if (!data.index.empty()) {
+		/* The unsigned subtraction wraps around for IDs below the base. */
+		unsigned int offset = id - data.indexBase;
+		if (offset >= data.index.size() || !data.index[offset])
+			return end();
+
+		return data.entries.begin() + data.index[offset] - 1;
+	}
+
+	auto iter = std::lower_bound(data.entries.begin(), data.entries.end(), id,
+				     [](const value_type &entry, unsigned int value) {
+					     return entry.first->id() < value;
+				     });
+	if (iter == data.entries.end() || iter->first->id() != id)
 		return end();
 
-	return find(iter->second);
+	return iter;
 }
 
 /**
@@ -567,25 +1038,59 @@ ControlInfoMap::const_iterator ControlInfoMap::find(unsigned int id) const
  * for the V4L2 device that the control list targets. This helper method
  * returns a suitable idmap for that purpose.
  *
+ * The idmap is shared by all copies of the ControlInfoMap, and stays valid as
+ * long as one of them isn't destroyed or reassigned.
+ *
  * \return The ControlId map
  */
 
-void ControlInfoMap::generateIdmap()
+std::shared_ptr<const ControlInfoMap::Data> ControlInfoMap::createData(Map &&info)
 {
-	idmap_.clear();
+	auto data = std::make_shared<Data>();
+	data->indexBase = 0;
 
-	for (const auto &ctrl : *this) {
+	for (const auto &ctrl : info) {
 		if (ctrl.first->type() != ctrl.second.min().type()) {
 			LOG(Controls, Error)
 				<< "Control " << utils::hex(ctrl.first->id())
 				<< " type and range type mismatch";
-			idmap_.clear();
-			clear();
-			return;
+			info.clear();
+			data->entries.clear();
+			data->idmap.clear();
+			return data;
 		}
 
-		idmap_[ctrl.first->id()] = ctrl.first;
+		data->idmap[ctrl.first->id()] = ctrl.first;
 	}
+
+	data->entries.reserve(info.size());
+	for (auto &ctrl : info)
+		data->entries.emplace_back(ctrl.first, std::move(ctrl.second));
+	info.clear();
+
+	std::sort(data->entries.begin(), data->entries.end(),
+		  [](const value_type &a, const value_type &b) {
+			  return a.first->id() < b.first->id();
+		  });
+
+	if (data->entries.empty())
+		return data;
+
+	/*
+	 * Index the entries directly by numerical ID when the IDs are dense
+	 * enough for the table not to waste memory.
+	 */
+	unsigned int first = data->entries.front().first->id();
+	unsigned int last = data->entries.back().first->id();
+	if (last - first >= 4 * data->entries.size() + 16)
+		return data;
+
+	data->indexBase = first;
+	data->index.resize(last - first + 1, 0);
+	for (unsigned int i = 0; i < data->entries.size(); ++i)
+		data->index[data->entries[i].first->id() - first] = i + 1;
+
+	return data;
 }
 
 /**
@@ -599,6 +1104,15 @@ void ControlInfoMap::generateIdmap()
  * Control lists are constructed with a map of all the controls supported by
  * their object, and an optional ControlValidator to further validate the
  * controls.
+ *
+ * Controls are stored in a vector sorted by control numerical ID. Lists are
+ * small, lookups are thus a binary search on contiguous memory, and iteration
+ * visits controls in a deterministic order of increasing IDs.
+ *
+ * As a consequence, adding a control to the list with set() invalidates all
+ * iterators and all references returned by get(), as does clear(). Updating
+ * the value of a control already present in the list doesn't invalidate them.
+ * Callers that need a value across calls adding controls shall copy it.
  */
 
 /**
@@ -687,6 +1201,18 @@ ControlList::ControlList(const ControlInfoMap &info, ControlValidator *validator
 /**
  * \fn ControlList::clear()
  * \brief Removes all controls from the list
+ *
+ * The memory allocated to store the controls is retained, refilling a cleared
+ * list with the same number of controls doesn't allocate memory.
+ */
+
+/**
+ * \fn ControlList::reserve()
+ * \brief Allocate memory for a number of controls
+ * \param[in] size The number of controls
+ *
+ * Storage is allocated for at least \a size controls, to avoid reallocations
+ * when subsequently adding controls to the list.
  */
 
 /**
@@ -697,7 +1223,7 @@ ControlList::ControlList(const ControlInfoMap &info, ControlValidator *validator
  */
 bool ControlList::contains(const ControlId &id) const
 {
-	return controls_.find(id.id()) != controls_.end();
+	return contains(id.id());
 }
 
 /**
@@ -708,11 +1234,12 @@ bool ControlList::contains(const ControlId &id) const
  */
 bool ControlList::contains(unsigned int id) const
 {
-	return controls_.find(id) != controls_.end();
+	auto iter = lowerBound(id);
+	return iter != controls_.end() && iter->first == id;
 }
 
 /**
- * \fn template<typename T> const T &ControlList::get(const Control<T> &ctrl) const
+ * \fn template<typename T> T ControlList::get(const Control<T> &ctrl) const
  * \brief Get the value of control \a ctrl
  * \param[in] ctrl The control
  *
@@ -748,6 +1275,8 @@ bool ControlList::contains(unsigned int id) const
  * Use ControlList::contains() to test for the presence of a control in the
  * list before retrieving its value.
  *
+ * The returned reference is invalidated when a control is added to the list.
+ *
  * \return The control value
  */
 const ControlValue &ControlList::get(unsigned int id) const
@@ -772,9 +1301,24 @@ const ControlValue &ControlList::get(unsigned int id) const
  *
  * The behaviour is undefined if the control \a id is not supported by the
  * object that the list refers to.
+ *
+ * The \a value may reference a control stored in the list itself.
  */
 void ControlList::set(unsigned int id, const ControlValue &value)
 {
+	/*
+	 * Adding a control may reallocate the storage, copy the value first if
+	 * it is stored in the list.
+	 */
+	const uint8_t *ptr = reinterpret_cast<const uint8_t *>(&value);
+	const uint8_t *begin = reinterpret_cast<const uint8_t *>(controls_.data());
+	const uint8_t *end = reinterpret_cast<const uint8_t *>(controls_.data() + controls_.size());
+	if (ptr >= begin && ptr < end) {
+		ControlValue copy = value;
+		set(id, copy);
+		return;
+	}
+
 	ControlValue *val = find(id);
 	if (!val)
 		return;
@@ -792,10 +1336,26 @@ void ControlList::set(unsigned int id, const ControlValue &value)
  * associated ControlInfoMap, nullptr is returned in that case.
  */
 
+namespace {
+
+bool controlIdLess(const std::pair<unsigned int, ControlValue> &entry,
+		   unsigned int id)
+{
+	return entry.first < id;
+}
+
+} /* namespace */
+
+ControlList::const_iterator ControlList::lowerBound(unsigned int id) const
+{
+	return std::lower_bound(controls_.begin(), controls_.end(), id,
+				controlIdLess);
+}
+
 const ControlValue *ControlList::find(unsigned int id) const
 {
-	const auto iter = controls_.find(id);
-	if (iter == controls_.end()) {
+	const auto iter = lowerBound(id);
+	if (iter == controls_.end() || iter->first != id) {
 		LOG(Controls, Error)
 			<< "Control " << utils::hex(id) << " not found";
 
@@ -814,7 +1374,12 @@ ControlValue *ControlList::find(unsigned int id)
 		return nullptr;
 	}
 
-	return &controls_[id];
+	auto pos = std::lower_bound(controls_.begin(), controls_.end(), id,
+				   controlIdLess);
+	if (pos == controls_.end() || pos->first != id)
+		pos = controls_.emplace(pos, id, ControlValue());
+
+	return &pos->second;
 }
 
 } /* namespace libcamera */
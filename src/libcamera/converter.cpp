@@ -0,0 +1,517 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * converter.cpp - Format converter for pipeline handlers
+ */
+
+#include "converter.h"
+
+#include <algorithm>
+#include <errno.h>
+#include <limits.h>
+#include <linux/media.h>
+#include <string.h>
+
+#include <libcamera/buffer.h>
+#include <libcamera/stream.h>
+
+#include "log.h"
+#include "media_device.h"
+#include "v4l2_videodevice.h"
+
+/**
+ * \file converter.h
+ * \brief Format converter for pipeline handlers
+ */
+
+namespace libcamera {
+
+LOG_DEFINE_CATEGORY(Converter);
+
+/**
+ * \class Converter
+ * \brief A memory-to-memory format converter and scaler
+ *
+ * Many SoCs include hardware scalers and colour space converters exposed to
+ * userspace as V4L2 memory-to-memory devices. The Converter class wraps such a
+ * device in a component that pipeline handlers can chain after their capture
+ * video node to produce formats and sizes that the capture hardware doesn't
+ * support natively.
+ *
+ * The converter processes input buffers into one or more outputs. Each output
+ * uses a separate context of the memory-to-memory device, with its own format,
+ * size and buffer queues. Input and output buffers are exchanged with the
+ * device as dmabufs, no frame data is copied by the CPU.
+ *
+ * The converter manages the buffer queues of the device for all its outputs.
+ * The input buffers are imported from the capture device, and the output
+ * buffers are either exported by the converter with exportBuffers(), or
+ * imported from the application when queued.
+ */
+
+/**
+ * \brief Construct a Converter for a memory-to-memory media device
+ * \param[in] media The media device of the memory-to-memory converter
+ *
+ * The caller guarantees that the \a media device is a V4L2 memory-to-memory
+ * device. Its video node is located by this constructor, and opened by open().
+ */
+Converter::Converter(MediaDevice *media)
+{
+	const std::vector<MediaEntity *> &entities = media->entities();
+	auto it = std::find_if(entities.begin(), entities.end(),
+			       [](MediaEntity *entity) {
+				       return entity->function() == MEDIA_ENT_F_IO_V4L &&
+					      !entity->deviceNode().empty();
+			       });
+	if (it == entities.end()) {
+		LOG(Converter, Error)
+			<< "No video node found in " << media->deviceNode();
+		return;
+	}
+
+	deviceNode_ = (*it)->deviceNode();
+}
+
+Converter::~Converter()
+{
+	close();
+}
+
+/**
+ * \brief Open the converter device
+ *
+ * Open the first context of the memory-to-memory device, used to query the
+ * formats and sizes supported by the converter. Additional contexts are opened
+ * by configure() as needed.
+ *
+ * \return 0 on success or a negative error code otherwise
+ */
+int Converter::open()
+{
+	if (deviceNode_.empty())
+		return -ENODEV;
+
+	if (!streams_.empty())
+		return 0;
+
+	std::unique_ptr<Stream> stream = std::make_unique<Stream>(this);
+	int ret = stream->open();
+	if (ret)
+		return ret;
+
+	streams_.push_back(std::move(stream));
+
+	return 0;
+}
+
+/**
+ * \brief Close the converter device, releasing all its contexts
+ */
+void Converter::close()
+{
+	streams_.clear();
+	queue_.clear();
+}
+
+/**
+ * \brief Retrieve the output pixel formats supported for an input format
+ * \param[in] input The input pixel format
+ *
+ * \return The list of supported output pixel formats, or an empty list if the
+ * \a input format isn't supported
+ */
+std::vector<PixelFormat> Converter::formats(PixelFormat input)
+{
+	if (streams_.empty())
+		return {};
+
+	V4L2M2MDevice *m2m = streams_[0]->m2m();
+
+	/*
+	 * Set the format on the input side (V4L2 output) of the converter to
+	 * enumerate the conversion capabilities on its output side (V4L2
+	 * capture).
+	 */
+	V4L2DeviceFormat format = {};
+	format.fourcc = m2m->output()->toV4L2Fourcc(input);
+	format.size = { 1, 1 };
+
+	int ret = m2m->output()->setFormat(&format);
+	if (ret < 0) {
+		LOG(Converter, Error)
+			<< "Failed to set format: " << strerror(-ret);
+		return {};
+	}
+
+	if (format.fourcc != m2m->output()->toV4L2Fourcc(input))
+		return {};
+
+	std::vector<PixelFormat> pixelFormats;
+
+	for (unsigned int fourcc : m2m->capture()->formats(true).formats()) {
+		PixelFormat pixelFormat = V4L2VideoDevice::toPixelFormat(fourcc);
+		if (pixelFormat)
+			pixelFormats.push_back(pixelFormat);
+	}
+
+	return pixelFormats;
+}
+
+/**
+ * \brief Retrieve the range of output sizes supported for an input size
+ * \param[in] input The input frame size
+ *
+ * \return The range of supported output sizes, or an empty range if the
+ * \a input size isn't supported
+ */
+SizeRange Converter::sizes(const Size &input)
+{
+	if (streams_.empty())
+		return {};
+
+	V4L2M2MDevice *m2m = streams_[0]->m2m();
+
+	V4L2DeviceFormat format = {};
+	int ret = m2m->output()->getFormat(&format);
+	if (ret < 0)
+		return {};
+
+	format.size = input;
+	ret = m2m->output()->setFormat(&format);
+	if (ret < 0) {
+		LOG(Converter, Error)
+			<< "Failed to set format: " << strerror(-ret);
+		return {};
+	}
+
+	/*
+	 * Probe the output size limits by requesting the smallest and largest
+	 * possible sizes, and reading back the sizes adjusted by the driver.
+	 */
+	SizeRange sizes;
+
+	ret = m2m->capture()->getFormat(&format);
+	if (ret < 0)
+		return {};
+
+	format.size = { 1, 1 };
+	ret = m2m->capture()->setFormat(&format);
+	if (ret < 0)
+		return {};
+
+	sizes.min = format.size;
+
+	format.size = { UINT_MAX, UINT_MAX };
+	ret = m2m->capture()->setFormat(&format);
+	if (ret < 0)
+		return {};
+
+	sizes.max = format.size;
+
+	return sizes;
+}
+
+/**
+ * \brief Configure the converter for a conversion
+ * \param[in] inputCfg The input stream configuration
+ * \param[in] outputCfgs The output streams configurations
+ *
+ * Configure the converter to process frames described by \a inputCfg into one
+ * output per entry of \a outputCfgs. The bufferCount of the configurations sets
+ * the number of buffers that can be queued to the converter at a time on the
+ * input and on each output.
+ *
+ * \return 0 on success or a negative error code otherwise
+ */
+int Converter::configure(const StreamConfiguration &inputCfg,
+			 const std::vector<std::reference_wrapper<StreamConfiguration>> &outputCfgs)
+{
+	if (outputCfgs.empty())
+		return -EINVAL;
+
+	int ret = open();
+	if (ret)
+		return ret;
+
+	while (streams_.size() < outputCfgs.size()) {
+		std::unique_ptr<Stream> stream = std::make_unique<Stream>(this);
+		ret = stream->open();
+		if (ret)
+			return ret;
+
+		streams_.push_back(std::move(stream));
+	}
+
+	streams_.resize(outputCfgs.size());
+
+	for (unsigned int i = 0; i < outputCfgs.size(); ++i) {
+		ret = streams_[i]->configure(inputCfg, outputCfgs[i]);
+		if (ret)
+			return ret;
+	}
+
+	return 0;
+}
+
+/**
+ * \brief Export buffers for a converter output
+ * \param[in] output The output index
+ * \param[in] count The number of buffers to allocate
+ * \param[out] buffers Vector to store allocated buffers
+ *
+ * The exported buffers are owned by the caller, and can then be queued to the
+ * \a output with queueBuffers().
+ *
+ * \return The number of allocated buffers on success or a negative error code
+ * otherwise
+ */
+int Converter::exportBuffers(unsigned int output, unsigned int count,
+			     std::vector<std::unique_ptr<FrameBuffer>> *buffers)
+{
+	if (output >= streams_.size())
+		return -EINVAL;
+
+	return streams_[output]->exportBuffers(count, buffers);
+}
+
+/**
+ * \brief Start the converter
+ * \return 0 on success or a negative error code otherwise
+ */
+int Converter::start()
+{
+	for (const std::unique_ptr<Stream> &stream : streams_) {
+		int ret = stream->start();
+		if (ret) {
+			stop();
+			return ret;
+		}
+	}
+
+	return 0;
+}
+
+/**
+ * \brief Stop the converter
+ *
+ * All buffers queued to the converter are returned through the
+ * inputBufferReady and outputBufferReady signals, with their status set to
+ * FrameMetadata::FrameCancelled for those that haven't been processed.
+ */
+void Converter::stop()
+{
+	for (const std::unique_ptr<Stream> &stream : streams_)
+		stream->stop();
+
+	queue_.clear();
+}
+
+/**
+ * \brief Queue buffers to the converter
+ * \param[in] input The frame buffer to convert
+ * \param[in] outputs The frame buffers to store the converted frame, indexed by
+ * output
+ *
+ * The \a input buffer is processed into all the \a outputs. It is returned
+ * through the inputBufferReady signal once all outputs have been processed.
+ * Outputs not listed in \a outputs don't process the \a input buffer.
+ *
+ * If queuing to one of the outputs fails, the buffers already queued to the
+ * other outputs are still processed and returned through the signals.
+ *
+ * \return 0 on success or a negative error code otherwise
+ */
+int Converter::queueBuffers(FrameBuffer *input,
+			    const std::map<unsigned int, FrameBuffer *> &outputs)
+{
+	if (outputs.empty())
+		return -EINVAL;
+
+	for (auto it : outputs) {
+		if (it.first >= streams_.size() || !it.second)
+			return -EINVAL;
+	}
+
+	for (auto it : outputs) {
+		int ret = streams_[it.first]->queueBuffers(input, it.second);
+		if (ret)
+			return ret;
+
+		queue_[input]++;
+	}
+
+	return 0;
+}
+
+/**
+ * \var Converter::inputBufferReady
+ * \brief A signal emitted when an input buffer has been processed by all
+ * outputs
+ */
+
+/**
+ * \var Converter::outputBufferReady
+ * \brief A signal emitted when an output buffer has been filled
+ */
+
+void Converter::inputBufferDone(FrameBuffer *buffer)
+{
+	auto it = queue_.find(buffer);
+	if (it == queue_.end())
+		return;
+
+	if (--it->second)
+		return;
+
+	queue_.erase(it);
+	inputBufferReady.emit(buffer);
+}
+
+Converter::Stream::Stream(Converter *converter)
+	: converter_(converter), inputBufferCount_(0), outputBufferCount_(0)
+{
+}
+
+Converter::Stream::~Stream()
+{
+	if (m2m_)
+		m2m_->close();
+}
+
+int Converter::Stream::open()
+{
+	m2m_ = std::make_unique<V4L2M2MDevice>(converter_->deviceNode_);
+
+	int ret = m2m_->open();
+	if (ret < 0) {
+		m2m_.reset();
+		return ret;
+	}
+
+	m2m_->output()->bufferReady.connect(this, &Stream::outputBufferReady);
+	m2m_->capture()->bufferReady.connect(this, &Stream::captureBufferReady);
+
+	return 0;
+}
+
+int Converter::Stream::configure(const StreamConfiguration &inputCfg,
+				 const StreamConfiguration &outputCfg)
+{
+	V4L2DeviceFormat format = {};
+	format.fourcc = m2m_->output()->toV4L2Fourcc(inputCfg.pixelFormat);
+	format.size = inputCfg.size;
+
+	int ret = m2m_->output()->setFormat(&format);
+	if (ret < 0) {
+		LOG(Converter, Error)
+			<< "Failed to set input format: " << strerror(-ret);
+		return ret;
+	}
+
+	if (format.fourcc != m2m_->output()->toV4L2Fourcc(inputCfg.pixelFormat) ||
+	    format.size != inputCfg.size) {
+		LOG(Converter, Error) << "Input format not supported";
+		return -EINVAL;
+	}
+
+	format = {};
+	format.fourcc = m2m_->capture()->toV4L2Fourcc(outputCfg.pixelFormat);
+	format.size = outputCfg.size;
+
+	ret = m2m_->capture()->setFormat(&format);
+	if (ret < 0) {
+		LOG(Converter, Error)
+			<< "Failed to set output format: " << strerror(-ret);
+		return ret;
+	}
+
+	if (format.fourcc != m2m_->capture()->toV4L2Fourcc(outputCfg.pixelFormat) ||
+	    format.size != outputCfg.size) {
+		LOG(Converter, Error) << "Output format not supported";
+		return -EINVAL;
+	}
+
+	inputBufferCount_ = inputCfg.bufferCount;
+	outputBufferCount_ = outputCfg.bufferCount;
+
+	return 0;
+}
+
+int Converter::Stream::exportBuffers(unsigned int count,
+				     std::vector<std::unique_ptr<FrameBuffer>> *buffers)
+{
+	int ret = m2m_->capture()->exportBuffers(count, buffers);
+	if (ret < 0)
+		return ret;
+
+	/*
+	 * The exported dmabufs keep the buffer memory alive. Release the
+	 * buffers from the device to import them at start time, as for
+	 * application-provided buffers.
+	 */
+	m2m_->capture()->releaseBuffers();
+
+	return ret;
+}
+
+int Converter::Stream::start()
+{
+	int ret = m2m_->output()->importBuffers(inputBufferCount_);
+	if (ret < 0)
+		return ret;
+
+	ret = m2m_->capture()->importBuffers(outputBufferCount_);
+	if (ret < 0) {
+		stop();
+		return ret;
+	}
+
+	ret = m2m_->output()->streamOn();
+	if (ret < 0) {
+		stop();
+		return ret;
+	}
+
+	ret = m2m_->capture()->streamOn();
+	if (ret < 0) {
+		stop();
+		return ret;
+	}
+
+	return 0;
+}
+
+void Converter::Stream::stop()
+{
+	m2m_->capture()->streamOff();
+	m2m_->output()->streamOff();
+	m2m_->capture()->releaseBuffers();
+	m2m_->output()->releaseBuffers();
+}
+
+int Converter::Stream::queueBuffers(FrameBuffer *input, FrameBuffer *output)
+{
+	int ret = m2m_->output()->queueBuffer(input);
+	if (ret < 0)
+		return ret;
+
+	ret = m2m_->capture()->queueBuffer(output);
+	if (ret < 0)
+		return ret;
+
+	return 0;
+}
+
+void Converter::Stream::captureBufferReady(FrameBuffer *buffer)
+{
+	converter_->outputBufferReady.emit(buffer);
+}
+
+void Converter::Stream::outputBufferReady(FrameBuffer *buffer)
+{
+	converter_->inputBufferDone(buffer);
+}
+
+} /* namespace libcamera */
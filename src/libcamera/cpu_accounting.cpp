@@ -0,0 +1,146 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * cpu_accounting.cpp - Per-camera CPU time accounting
+ */
+
+#include "cpu_accounting.h"
+
+#include <time.h>
+
+#include "utils.h"
+
+/**
+ * \file cpu_accounting.h
+ * \brief Attribute the CPU time of the camera stack to cameras and components
+ *
+ * CPU time accounting measures the CPU time consumed by the calling thread in
+ * the major units of work of the camera stack, and accumulates it per camera
+ * and per component in the CameraStatistics. It is disabled by default, as
+ * sampling the thread CPU time requires a system call, and is enabled at
+ * runtime by setting the LIBCAMERA_CPU_ACCOUNTING environment variable.
+ */
+
+namespace libcamera {
+
+namespace {
+
+thread_local CpuScope *currentScope = nullptr;
+
+uint64_t threadCpuTime()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+} /* namespace */
+
+/**
+ * \class CpuScope
+ * \brief Account for the CPU time spent in a scope
+ *
+ * A CpuScope measures the CPU time consumed by the current thread from its
+ * construction to its destruction, and accounts it to a component of a
+ * camera. Scopes nest: the time spent in a nested scope is accounted to the
+ * nested scope's component only, and is subtracted from the enclosing scope.
+ *
+ * The camera a unit of work belongs to is often not known when the work
+ * starts. An event notifier callback, for instance, only finds out which
+ * camera it relates to when the pipeline handler completes a request. Scopes
+ * created without a camera inherit the camera of the first nested scope that
+ * has one, or can be assigned a camera with setCamera(). The time of scopes
+ * that never get a camera is handed to the enclosing scope, and is dropped
+ * at the outermost scope.
+ *
+ * When accounting is disabled, the cost of a scope is limited to a test of a
+ * global flag.
+ */
+
+const bool CpuScope::enabled_ = !!utils::secure_getenv("LIBCAMERA_CPU_ACCOUNTING");
+
+/**
+ * \fn CpuScope::CpuScope()
+ * \brief Start accounting CPU time to a component
+ * \param[in] component The component the time is accounted to
+ * \param[in] camera The camera the time is accounted to, if known
+ */
+
+/**
+ * \fn CpuScope::~CpuScope()
+ * \brief Stop accounting CPU time and report it to the camera
+ */
+
+/**
+ * \fn CpuScope::enabled()
+ * \brief Check if CPU time accounting is enabled
+ * \return True if CPU time accounting is enabled, false otherwise
+ */
+
+/**
+ * \brief Retrieve the camera of the current thread's scopes
+ *
+ * This function allows handing the camera over to work deferred to another
+ * thread, which can then account its CPU time with a scope of its own.
+ *
+ * \return The camera of the innermost scope that has one, or nullptr if no
+ * scope of the current thread has a camera
+ */
+Camera *CpuScope::camera()
+{
+	for (CpuScope *scope = currentScope; scope; scope = scope->parent_) {
+		if (scope->camera_)
+			return scope->camera_;
+	}
+
+	return nullptr;
+}
+
+/**
+ * \brief Set the camera of the innermost scope of the current thread
+ * \param[in] camera The camera
+ *
+ * The camera is only set if the innermost scope doesn't have one already.
+ */
+void CpuScope::setCamera(Camera *camera)
+{
+	if (currentScope && !currentScope->camera_)
+		currentScope->camera_ = camera;
+}
+
+void CpuScope::enter(CameraStatistics::CpuComponent component, Camera *camera)
+{
+	active_ = true;
+	component_ = component;
+	camera_ = camera;
+	parent_ = currentScope;
+	children_ = 0;
+	times_ = {};
+
+	currentScope = this;
+	start_ = threadCpuTime();
+}
+
+void CpuScope::leave()
+{
+	uint64_t elapsed = threadCpuTime() - start_;
+
+	times_[component_] += elapsed > children_ ? elapsed - children_ : 0;
+	currentScope = parent_;
+
+	if (parent_)
+		parent_->children_ += elapsed;
+
+	if (camera_) {
+		camera_->accountCpuTime(times_);
+
+		if (parent_ && !parent_->camera_)
+			parent_->camera_ = camera_;
+	} else if (parent_) {
+		for (unsigned int i = 0; i < times_.size(); ++i)
+			parent_->times_[i] += times_[i];
+	}
+}
+
+} /* namespace libcamera */
@@ -0,0 +1,278 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * delayed_controls.cpp - Helper to deal with controls that take effect with a delay
+ */
+
+#include "delayed_controls.h"
+
+#include <algorithm>
+#include <errno.h>
+#include <iterator>
+
+#include "log.h"
+#include "utils.h"
+#include "v4l2_device.h"
+
+/**
+ * \file delayed_controls.h
+ * \brief Helper to deal with controls that take effect with a delay
+ */
+
+namespace libcamera {
+
+LOG_DEFINE_CATEGORY(DelayedControls)
+
+/**
+ * \class DelayedControls
+ * \brief Schedule V4L2 controls for a frame, accounting for their delays
+ *
+ * Some sensor controls take effect a number of frames after they have been
+ * written to the device. The exposure time, for instance, is commonly latched
+ * by the sensor at the start of a frame and only applies to the next one or
+ * two frames, while the analogue gain may apply one frame earlier. Writing
+ * controls as soon as they're computed thus makes their effect land on an
+ * unpredictable frame, and controls written together may even take effect
+ * on different frames.
+ *
+ * The DelayedControls class manages a set of controls of a V4L2Device, each
+ * with its own delay expressed in frames. A control written to the device
+ * after the start of frame N takes effect for frame N + delay. Controls are
+ * pushed with the sequence number of the frame they shall apply to, and are
+ * written to the device from applyControls(), which the pipeline handler
+ * shall call at the start of every frame. Each control is written exactly
+ * delay frames ahead of its target frame, so that all controls pushed
+ * together take effect on the same frame.
+ *
+ * The values of the controls actually in effect for a frame are recorded and
+ * can be retrieved with get(), to report them in the frame metadata or to
+ * provide algorithms with the sensor configuration their statistics have been
+ * captured with.
+ */
+
+/**
+ * \var DelayedControls::HistoryDepth
+ * \brief The number of past frames for which the controls in effect are
+ * tracked
+ */
+
+/**
+ * \brief Construct a DelayedControls instance
+ * \param[in] device The V4L2 device the controls are written to
+ * \param[in] delays The delay in frames of each control, by numerical ID
+ *
+ * Only the controls listed in \a delays are managed by the instance. Controls
+ * not supported by the \a device are ignored.
+ */
+DelayedControls::DelayedControls(V4L2Device *device,
+				 const std::map<unsigned int, unsigned int> &delays)
+	: device_(device), maxDelay_(0), running_(false), sequence_(0)
+{
+	const ControlInfoMap &controls = device_->controls();
+
+	for (const auto &delay : delays) {
+		if (controls.find(delay.first) == controls.end()) {
+			LOG(DelayedControls, Debug)
+				<< "Control " << utils::hex(delay.first)
+				<< " not supported by the device, ignoring";
+			continue;
+		}
+
+		controls_[delay.first].delay = delay.second;
+		maxDelay_ = std::max(maxDelay_, delay.second);
+	}
+
+	reset();
+}
+
+/**
+ * \brief Reset the state to the current values of the device controls
+ *
+ * This method discards all pending controls and the recorded history, and
+ * reads the current value of all managed controls from the device. Those
+ * values are considered to be in effect for all frames until new controls
+ * take effect. It shall be called before starting streaming.
+ *
+ * \return 0 on success or a negative error code otherwise
+ */
+int DelayedControls::reset()
+{
+	running_ = false;
+	sequence_ = 0;
+
+	ControlList ctrls(device_->controls());
+	for (auto &ctrl : controls_) {
+		ctrl.second.pending.clear();
+		ctrl.second.history.clear();
+
+		ctrls.set(ctrl.first, ControlValue(0));
+	}
+
+	int ret = device_->getControls(&ctrls);
+	if (ret) {
+		LOG(DelayedControls, Error) << "Failed to read controls";
+		return ret < 0 ? ret : -EIO;
+	}
+
+	for (auto &ctrl : controls_)
+		ctrl.second.initial = ctrls.get(ctrl.first);
+
+	return 0;
+}
+
+/**
+ * \brief Push controls to be applied to a frame
+ * \param[in] frame The sequence number of the frame the controls apply to
+ * \param[in] controls The list of controls
+ *
+ * Queue the \a controls to take effect on \a frame. Pushing a control for a
+ * frame that already has a pending value for the same control replaces the
+ * pending value.
+ *
+ * If the controls are pushed too late to take effect on \a frame, they are
+ * postponed to the earliest frame on which all of them can take effect
+ * together. The frame they apply to is then reported by get().
+ *
+ * \return 0 on success or a negative error code otherwise
+ * \retval -EINVAL One of the controls isn't managed by this instance
+ */
+int DelayedControls::push(uint32_t frame, const ControlList &controls)
+{
+	unsigned int delay = 0;
+
+	for (const auto &ctrl : controls) {
+		auto it = controls_.find(ctrl.first);
+		if (it == controls_.end()) {
+			LOG(DelayedControls, Error)
+				<< "Control " << utils::hex(ctrl.first)
+				<< " has no delay";
+			return -EINVAL;
+		}
+
+		delay = std::max(delay, it->second.delay);
+	}
+
+	/*
+	 * The earliest frame the controls can take effect on is delay frames
+	 * after the next frame start.
+	 */
+	if (running_ && frame < sequence_ + 1 + delay) {
+		LOG(DelayedControls, Debug)
+			<< "Controls for frame " << frame
+			<< " postponed to frame " << sequence_ + 1 + delay;
+		frame = sequence_ + 1 + delay;
+	}
+
+	for (const auto &ctrl : controls)
+		controls_[ctrl.first].pending[frame] = ctrl.second;
+
+	return 0;
+}
+
+/**
+ * \brief Write the controls due at the start of a frame to the device
+ * \param[in] sequence The sequence number of the frame that just started
+ *
+ * This method shall be called at the start of every frame, typically from the
+ * frame start event handler. It writes to the device the controls that need
+ * to be set during frame \a sequence to take effect on their target frame,
+ * and records the values in effect for the future frames.
+ *
+ * Controls whose value doesn't change are not written.
+ */
+void DelayedControls::applyControls(uint32_t sequence)
+{
+	running_ = true;
+	sequence_ = sequence;
+
+	ControlList ctrls(device_->controls());
+
+	for (auto &ctrl : controls_) {
+		ControlState &state = ctrl.second;
+		uint32_t frame = sequence + state.delay;
+
+		/*
+		 * Only the latest pending value due by the frame the control
+		 * can now take effect on matters, values for earlier frames
+		 * have been missed.
+		 */
+		auto end = state.pending.upper_bound(frame);
+		if (end == state.pending.begin())
+			continue;
+
+		const ControlValue &value = std::prev(end)->second;
+		if (value != state.current())
+			ctrls.set(ctrl.first, value);
+
+		state.pending.erase(state.pending.begin(), end);
+	}
+
+	if (!ctrls.empty()) {
+		int ret = device_->setControls(&ctrls);
+		if (ret) {
+			LOG(DelayedControls, Error)
+				<< "Failed to set controls for frame " << sequence;
+			return;
+		}
+	}
+
+	for (const auto &ctrl : ctrls) {
+		ControlState &state = controls_[ctrl.first];
+		state.history.emplace_back(sequence + state.delay, ctrl.second);
+	}
+
+	/*
+	 * Drop the history entries superseded by a value that was already in
+	 * effect HistoryDepth frames ago.
+	 */
+	for (auto &ctrl : controls_) {
+		auto &history = ctrl.second.history;
+		while (history.size() > 1 &&
+		       history[1].first + HistoryDepth <= sequence)
+			history.pop_front();
+	}
+}
+
+/**
+ * \brief Retrieve the controls in effect for a frame
+ * \param[in] frame The sequence number of the frame
+ *
+ * The values returned for frames older than HistoryDepth frames before the
+ * last frame start are not guaranteed to be accurate.
+ *
+ * \return The list of all managed controls with their value in effect for
+ * \a frame
+ */
+ControlList DelayedControls::get(uint32_t frame) const
+{
+	ControlList ctrls(device_->controls());
+
+	for (const auto &ctrl : controls_)
+		ctrls.set(ctrl.first, ctrl.second.at(frame));
+
+	return ctrls;
+}
+
+/**
+ * \fn DelayedControls::maxDelay()
+ * \brief Retrieve the largest delay of the managed controls
+ * \return The largest delay, in frames
+ */
+
+const ControlValue &DelayedControls::ControlState::current() const
+{
+	return history.empty() ? initial : history.back().second;
+}
+
+const ControlValue &DelayedControls::ControlState::at(uint32_t frame) const
+{
+	for (auto it = history.rbegin(); it != history.rend(); ++it) {
+		if (it->first <= frame)
+			return it->second;
+	}
+
+	return initial;
+}
+
+} /* namespace libcamera */
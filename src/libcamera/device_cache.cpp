@@ -0,0 +1,554 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * device_cache.cpp - Persistent cache of media graphs and device formats
+ */
+
+#include "device_cache.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "byte_stream_buffer.h"
+#include "log.h"
+#include "utils.h"
+
+/**
+ * \file device_cache.h
+ * \brief Persistent cache of media graphs and device formats
+ */
+
+namespace libcamera {
+
+LOG_DEFINE_CATEGORY(DeviceCache)
+
+namespace {
+
+constexpr uint32_t CacheMagic = 0x4344434c; /* "LCDC" */
+constexpr uint32_t CacheVersion = 1;
+
+struct CacheHeader {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t entitySize;
+	uint32_t interfaceSize;
+	uint32_t padSize;
+	uint32_t linkSize;
+	uint32_t count;
+	uint32_t reserved;
+};
+
+struct CacheEntryHeader {
+	uint64_t topologyVersion;
+	uint32_t keyLength;
+	uint32_t hasTopology;
+	uint32_t numEntities;
+	uint32_t numInterfaces;
+	uint32_t numPads;
+	uint32_t numLinks;
+	uint32_t numFormats;
+	uint32_t reserved;
+};
+
+struct CacheFormatsHeader {
+	uint32_t keyLength;
+	uint32_t count;
+};
+
+struct CacheFormatHeader {
+	uint32_t format;
+	uint32_t numSizes;
+};
+
+struct CacheSizeRange {
+	uint32_t minWidth;
+	uint32_t minHeight;
+	uint32_t maxWidth;
+	uint32_t maxHeight;
+	uint32_t hStep;
+	uint32_t vStep;
+};
+
+template<typename T>
+bool readArray(ByteStreamBuffer &buffer, std::vector<T> *array, uint32_t count)
+{
+	/* Bound the allocation by the size of the cache file. */
+	if (count > (buffer.size() - buffer.offset()) / sizeof(T))
+		return false;
+
+	array->resize(count);
+	return !buffer.read(Span<T>(array->data(), count));
+}
+
+bool readString(ByteStreamBuffer &buffer, std::string *str, uint32_t length)
+{
+	const char *data = buffer.read<char>(length);
+	if (!data)
+		return false;
+
+	str->assign(data, length);
+	return true;
+}
+
+size_t formatsSize(const std::string &key, const ImageFormats &formats)
+{
+	size_t size = sizeof(CacheFormatsHeader) + key.size();
+
+	for (const auto &format : formats.data())
+		size += sizeof(CacheFormatHeader)
+		      + format.second.size() * sizeof(CacheSizeRange);
+
+	return size;
+}
+
+} /* namespace */
+
+/**
+ * \class DeviceCache
+ * \brief Persistent cache of the media graphs and formats of camera devices
+ *
+ * Enumerating the camera devices at camera manager startup requires a large
+ * number of ioctls: the media graph of every media device is retrieved with
+ * MEDIA_IOC_G_TOPOLOGY, and the pipeline handlers enumerate the formats and
+ * frame sizes of the sensors and video devices they match, with one ioctl
+ * per format and per frame size. The hardware doesn't change between runs,
+ * and short-lived processes spend a noticeable part of their time to first
+ * frame repeating the same enumeration.
+ *
+ * The DeviceCache stores the media graph and the formats of the devices of a
+ * media device in an Entry, identified by a key that combines the media device
+ * driver, model, serial number, bus information, hardware revision and driver
+ * version. Entries are saved to a file at the end of the camera manager
+ * startup, and loaded by the next process.
+ *
+ * The cache is only a hint. The cached media graph is only used if its
+ * topology version and object counts match the ones reported by the device,
+ * and a changed driver version invalidates the whole entry. Formats are
+ * cached with the same semantics as the in-memory caches of V4L2Subdevice and
+ * V4L2VideoDevice: their first enumeration is reused until explicitly
+ * refreshed.
+ *
+ * Entries are looked up concurrently by the threads that populate media
+ * devices, the entry() method is thread-safe. An Entry is only accessed by
+ * the media device it belongs to and doesn't need locking.
+ */
+
+/**
+ * \struct DeviceCache::Topology
+ * \brief A media graph as returned by MEDIA_IOC_G_TOPOLOGY
+ *
+ * \var DeviceCache::Topology::version
+ * \brief The topology version
+ *
+ * \var DeviceCache::Topology::entities
+ * \brief The media graph entities
+ *
+ * \var DeviceCache::Topology::interfaces
+ * \brief The media graph interfaces
+ *
+ * \var DeviceCache::Topology::pads
+ * \brief The media graph pads
+ *
+ * \var DeviceCache::Topology::links
+ * \brief The media graph links
+ */
+
+/**
+ * \class DeviceCache::Entry
+ * \brief The cached data of a media device
+ *
+ * An entry stores the media graph Topology of a media device, and the
+ * ImageFormats of its subdevices and video devices, indexed by a string key
+ * chosen by the devices.
+ */
+
+DeviceCache::Entry::Entry()
+	: hasTopology_(false), topology_{}, dirty_(false)
+{
+}
+
+/**
+ * \brief Retrieve the cached media graph
+ * \return The cached media graph, or nullptr if no graph is cached
+ */
+const DeviceCache::Topology *DeviceCache::Entry::topology() const
+{
+	return hasTopology_ ? &topology_ : nullptr;
+}
+
+/**
+ * \brief Store the media graph in the entry
+ * \param[in] topology The media graph
+ *
+ * The cached formats are dropped, as a changed media graph is a sign that the
+ * devices have changed.
+ */
+void DeviceCache::Entry::setTopology(Topology &&topology)
+{
+	topology_ = std::move(topology);
+	hasTopology_ = true;
+	formats_.clear();
+	dirty_ = true;
+}
+
+/**
+ * \brief Retrieve cached formats
+ * \param[in] key The key identifying the formats
+ * \return The cached formats, or nullptr if no formats are cached for \a key
+ */
+const ImageFormats *DeviceCache::Entry::formats(const std::string &key) const
+{
+	auto it = formats_.find(key);
+	if (it == formats_.end())
+		return nullptr;
+
+	return &it->second;
+}
+
+/**
+ * \brief Store formats in the entry
+ * \param[in] key The key identifying the formats
+ * \param[in] formats The formats
+ */
+void DeviceCache::Entry::setFormats(const std::string &key,
+				    const ImageFormats &formats)
+{
+	formats_[key] = formats;
+	dirty_ = true;
+}
+
+/**
+ * \brief Construct a device cache stored in \a path
+ * \param[in] path The path to the cache file
+ *
+ * The cache is initially empty. An empty \a path disables the persistent
+ * storage, load() and save() then have no effect.
+ */
+DeviceCache::DeviceCache(const std::string &path)
+	: path_(path)
+{
+}
+
+/**
+ * \fn DeviceCache::path()
+ * \brief Retrieve the path to the cache file
+ * \return The path to the cache file
+ */
+
+/**
+ * \brief Load the cache content from the cache file
+ *
+ * A missing, outdated or corrupted cache file is ignored and results in an
+ * empty cache.
+ *
+ * \return 0 on success or a negative error code otherwise
+ */
+int DeviceCache::load()
+{
+	MutexLocker locker(mutex_);
+
+	entries_.clear();
+	used_.clear();
+
+	if (path_.empty())
+		return 0;
+
+	int fd = open(path_.c_str(), O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return -errno;
+
+	std::vector<uint8_t> data;
+	struct stat st;
+	int ret = fstat(fd, &st);
+	if (!ret) {
+		data.resize(st.st_size);
+		ssize_t size = read(fd, data.data(), data.size());
+		if (size != static_cast<ssize_t>(data.size()))
+			ret = -EIO;
+	} else {
+		ret = -errno;
+	}
+
+	close(fd);
+
+	if (ret < 0)
+		return ret;
+
+	ByteStreamBuffer buffer(static_cast<const uint8_t *>(data.data()),
+				data.size());
+
+	CacheHeader header;
+	if (buffer.read(&header) < 0 || header.magic != CacheMagic ||
+	    header.version != CacheVersion ||
+	    header.entitySize != sizeof(struct media_v2_entity) ||
+	    header.interfaceSize != sizeof(struct media_v2_interface) ||
+	    header.padSize != sizeof(struct media_v2_pad) ||
+	    header.linkSize != sizeof(struct media_v2_link)) {
+		LOG(DeviceCache, Debug) << "Ignoring outdated cache " << path_;
+		return -EINVAL;
+	}
+
+	bool valid = true;
+
+	for (unsigned int i = 0; i < header.count && valid; ++i) {
+		CacheEntryHeader entryHeader;
+		std::string key;
+		auto entry = std::make_shared<Entry>();
+		Topology &topology = entry->topology_;
+
+		valid = !buffer.read(&entryHeader) &&
+			readString(buffer, &key, entryHeader.keyLength) &&
+			readArray(buffer, &topology.entities, entryHeader.numEntities) &&
+			readArray(buffer, &topology.interfaces, entryHeader.numInterfaces) &&
+			readArray(buffer, &topology.pads, entryHeader.numPads) &&
+			readArray(buffer, &topology.links, entryHeader.numLinks);
+
+		topology.version = entryHeader.topologyVersion;
+		entry->hasTopology_ = entryHeader.hasTopology;
+
+		for (unsigned int j = 0; j < entryHeader.numFormats && valid; ++j) {
+			CacheFormatsHeader formatsHeader;
+			std::string formatsKey;
+			ImageFormats formats;
+
+			valid = !buffer.read(&formatsHeader) &&
+				readString(buffer, &formatsKey, formatsHeader.keyLength);
+
+			for (unsigned int k = 0; k < formatsHeader.count && valid; ++k) {
+				CacheFormatHeader formatHeader;
+				std::vector<CacheSizeRange> ranges;
+
+				valid = !buffer.read(&formatHeader) &&
+					readArray(buffer, &ranges, formatHeader.numSizes);
+				if (!valid)
+					break;
+
+				std::vector<SizeRange> sizes;
+				sizes.reserve(ranges.size());
+				for (const CacheSizeRange &range : ranges)
+					sizes.emplace_back(range.minWidth, range.minHeight,
+							   range.maxWidth, range.maxHeight,
+							   range.hStep, range.vStep);
+
+				valid = !formats.addFormat(formatHeader.format, sizes);
+			}
+
+			entry->formats_[formatsKey] = std::move(formats);
+		}
+
+		entries_[key] = std::move(entry);
+	}
+
+	if (!valid || buffer.overflow()) {
+		LOG(DeviceCache, Debug) << "Ignoring corrupted cache " << path_;
+		entries_.clear();
+		return -EINVAL;
+	}
+
+	return 0;
+}
+
+/**
+ * \brief Store the cache content to the cache file
+ *
+ * Only the entries that have been looked up with entry() since the cache was
+ * loaded are stored, to drop the media devices that are not present anymore.
+ * The cache file is only written when its content changes, and is replaced
+ * atomically.
+ *
+ * \return 0 on success or a negative error code otherwise
+ */
+int DeviceCache::save()
+{
+	MutexLocker locker(mutex_);
+
+	if (path_.empty())
+		return 0;
+
+	bool dirty = !entries_.empty();
+	size_t size = sizeof(CacheHeader);
+
+	for (const auto &it : used_) {
+		const Entry &entry = *it.second;
+		const Topology &topology = entry.topology_;
+
+		dirty |= entry.dirty_;
+
+		size += sizeof(CacheEntryHeader) + it.first.size()
+		      + topology.entities.size() * sizeof(struct media_v2_entity)
+		      + topology.interfaces.size() * sizeof(struct media_v2_interface)
+		      + topology.pads.size() * sizeof(struct media_v2_pad)
+		      + topology.links.size() * sizeof(struct media_v2_link);
+
+		for (const auto &formats : entry.formats_)
+			size += formatsSize(formats.first, formats.second);
+	}
+
+	if (!dirty)
+		return 0;
+
+	std::vector<uint8_t> data(size);
+	ByteStreamBuffer buffer(data.data(), data.size());
+
+	CacheHeader header = {
+		CacheMagic, CacheVersion,
+		sizeof(struct media_v2_entity), sizeof(struct media_v2_interface),
+		sizeof(struct media_v2_pad), sizeof(struct media_v2_link),
+		static_cast<uint32_t>(used_.size()), 0
+	};
+	buffer.write(&header);
+
+	for (const auto &it : used_) {
+		const Entry &entry = *it.second;
+		const Topology &topology = entry.topology_;
+
+		CacheEntryHeader entryHeader = {
+			topology.version,
+			static_cast<uint32_t>(it.first.size()),
+			entry.hasTopology_,
+			static_cast<uint32_t>(topology.entities.size()),
+			static_cast<uint32_t>(topology.interfaces.size()),
+			static_cast<uint32_t>(topology.pads.size()),
+			static_cast<uint32_t>(topology.links.size()),
+			static_cast<uint32_t>(entry.formats_.size()),
+			0
+		};
+		buffer.write(&entryHeader);
+		buffer.write(Span<const char>(it.first.data(), it.first.size()));
+		buffer.write(Span<const struct media_v2_entity>(topology.entities));
+		buffer.write(Span<const struct media_v2_interface>(topology.interfaces));
+		buffer.write(Span<const struct media_v2_pad>(topology.pads));
+		buffer.write(Span<const struct media_v2_link>(topology.links));
+
+		for (const auto &formats : entry.formats_) {
+			const auto &map = formats.second.data();
+			CacheFormatsHeader formatsHeader = {
+				static_cast<uint32_t>(formats.first.size()),
+				static_cast<uint32_t>(map.size())
+			};
+			buffer.write(&formatsHeader);
+			buffer.write(Span<const char>(formats.first.data(),
+						      formats.first.size()));
+
+			for (const auto &format : map) {
+				CacheFormatHeader formatHeader = {
+					format.first,
+					static_cast<uint32_t>(format.second.size())
+				};
+				buffer.write(&formatHeader);
+
+				for (const SizeRange &range : format.second) {
+					CacheSizeRange cached = {
+						range.min.width, range.min.height,
+						range.max.width, range.max.height,
+						range.hStep, range.vStep
+					};
+					buffer.write(&cached);
+				}
+			}
+		}
+	}
+
+	/* Create the parent directories. */
+	for (size_t pos = path_.find('/', 1); pos != std::string::npos;
+	     pos = path_.find('/', pos + 1)) {
+		std::string dir = path_.substr(0, pos);
+		if (mkdir(dir.c_str(), 0755) < 0 && errno != EEXIST) {
+			int ret = -errno;
+			LOG(DeviceCache, Debug)
+				<< "Failed to create cache directory " << dir
+				<< ": " << strerror(-ret);
+			return ret;
+		}
+	}
+
+	std::string tmpPath = path_ + "." + std::to_string(getpid());
+	int fd = open(tmpPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+		      0644);
+	if (fd < 0) {
+		int ret = -errno;
+		LOG(DeviceCache, Debug)
+			<< "Failed to create cache " << tmpPath << ": "
+			<< strerror(-ret);
+		return ret;
+	}
+
+	ssize_t written = write(fd, data.data(), data.size());
+	close(fd);
+
+	if (written != static_cast<ssize_t>(data.size()) ||
+	    rename(tmpPath.c_str(), path_.c_str()) < 0) {
+		unlink(tmpPath.c_str());
+		LOG(DeviceCache, Debug) << "Failed to write cache " << path_;
+		return -EIO;
+	}
+
+	/* The file now matches the used entries. */
+	for (const auto &it : used_)
+		it.second->dirty_ = false;
+	entries_.clear();
+
+	return 0;
+}
+
+/**
+ * \brief Retrieve the cache entry for a media device
+ * \param[in] key The key identifying the media device
+ *
+ * The entry is created empty if the cache doesn't contain it yet. This method
+ * is thread-safe.
+ *
+ * \return The cache entry for \a key
+ */
+std::shared_ptr<DeviceCache::Entry> DeviceCache::entry(const std::string &key)
+{
+	MutexLocker locker(mutex_);
+
+	auto it = used_.find(key);
+	if (it != used_.end())
+		return it->second;
+
+	std::shared_ptr<Entry> entry;
+
+	auto loaded = entries_.find(key);
+	if (loaded != entries_.end()) {
+		entry = std::move(loaded->second);
+		entries_.erase(loaded);
+	} else {
+		entry = std::make_shared<Entry>();
+	}
+
+	used_[key] = entry;
+	return entry;
+}
+
+/**
+ * \brief Retrieve the default path of the device cache file
+ *
+ * The cache is stored in the libcamera cache directory, see
+ * utils::cacheDirectory(). The LIBCAMERA_DEVICE_CACHE environment variable
+ * overrides the cache file path, an empty value disables the cache.
+ *
+ * \return The default path of the cache file, or an empty string if the cache
+ * is disabled or no cache directory is available
+ */
+std::string DeviceCache::defaultPath()
+{
+	const char *path = utils::secure_getenv("LIBCAMERA_DEVICE_CACHE");
+	if (path)
+		return path;
+
+	std::string dir = utils::cacheDirectory();
+	if (dir.empty())
+		return dir;
+
+	return dir + "/devices.cache";
+}
+
+} /* namespace libcamera */
@@ -6,10 +6,14 @@
  */
 
 #include "device_enumerator.h"
+#include "device_enumerator_mock.h"
 #include "device_enumerator_sysfs.h"
 #include "device_enumerator_udev.h"
 
+#include <algorithm>
 #include <string.h>
+#include <sys/sysmacros.h>
+#include <thread>
 
 #include "log.h"
 #include "media_device.h"
@@ -125,6 +129,10 @@ bool DeviceMatch::match(const MediaDevice *device) const
  * then be searched using DeviceMatch search patterns.
  *
  * The enumerator also associates media device entities with device node paths.
+ *
+ * Enumerators that support hot-plug keep monitoring the system after
+ * enumerate() returns, and emit the devicesAdded signal when new media devices
+ * become available.
  */
 
 /**
@@ -143,6 +151,13 @@ std::unique_ptr<DeviceEnumerator> DeviceEnumerator::create()
 {
 	std::unique_ptr<DeviceEnumerator> enumerator;
 
+#ifdef HAVE_MOCK_DEVICES
+	/* Simulated devices replace the system devices when requested. */
+	enumerator = std::make_unique<DeviceEnumeratorMock>();
+	if (!enumerator->init())
+		return enumerator;
+#endif
+
 #ifdef HAVE_LIBUDEV
 	enumerator = std::make_unique<DeviceEnumeratorUdev>();
 	if (!enumerator->init())
@@ -178,6 +193,33 @@ DeviceEnumerator::~DeviceEnumerator()
  * \retval -ENODEV the enumerator can't enumerate devices
  */
 
+/**
+ * \fn DeviceEnumerator::setCache()
+ * \brief Set the cache used to populate media devices
+ * \param[in] cache The device cache, or nullptr to disable caching
+ *
+ * The \a cache shall outlive the enumerator and the media devices it creates.
+ */
+
+/**
+ * \fn DeviceEnumerator::setFilter()
+ * \brief Restrict the search to the media device of a device node
+ * \param[in] devnum The device number of the node, or 0 to disable filtering
+ *
+ * This is used to match pipeline handlers against a single media device, see
+ * CameraManager::matchDevice().
+ */
+
+/**
+ * \var DeviceEnumerator::devicesAdded
+ * \brief Notify of new media devices being found
+ *
+ * This signal is emitted when hot-plugged media devices have been added to the
+ * enumerator, after the devices found by enumerate(). A group of devices that
+ * appear together, such as the nodes of a USB camera, is signalled once, and
+ * receivers are expected to match pipeline handlers again with search().
+ */
+
 /**
  * \fn DeviceEnumerator::enumerate()
  * \brief Enumerate all media devices in the system
@@ -212,7 +254,7 @@ std::shared_ptr<MediaDevice> DeviceEnumerator::createDevice(const std::string &d
 {
 	std::shared_ptr<MediaDevice> media = std::make_shared<MediaDevice>(deviceNode);
 
-	int ret = media->populate();
+	int ret = media->populate(cache_);
 	if (ret < 0) {
 		LOG(DeviceEnumerator, Info)
 			<< "Unable to populate media device " << deviceNode
@@ -227,6 +269,46 @@ std::shared_ptr<MediaDevice> DeviceEnumerator::createDevice(const std::string &d
 	return media;
 }
 
+/**
+ * \brief Create media device instances concurrently
+ * \param[in] deviceNodes paths to the media devices to create
+ *
+ * Create and populate one media device for each entry in \a deviceNodes, as
+ * createDevice() does. Populating a media device requires several ioctls to
+ * retrieve its graph topology, which are independent between media devices.
+ * When multiple devices are enumerated they are thus populated concurrently
+ * from worker threads to reduce the enumeration time.
+ *
+ * The media devices are not bound to any thread and can be used from the
+ * caller's thread once this method returns.
+ *
+ * \return A vector of media devices in the same order as \a deviceNodes, with
+ * nullptr entries for devices that failed to be created
+ */
+std::vector<std::shared_ptr<MediaDevice>>
+DeviceEnumerator::createDevices(const std::vector<std::string> &deviceNodes)
+{
+	std::vector<std::shared_ptr<MediaDevice>> devices(deviceNodes.size());
+
+	if (deviceNodes.size() == 1) {
+		devices[0] = createDevice(deviceNodes[0]);
+		return devices;
+	}
+
+	std::vector<std::thread> workers;
+	workers.reserve(deviceNodes.size());
+
+	for (unsigned int i = 0; i < deviceNodes.size(); ++i)
+		workers.emplace_back([this, &devices, &deviceNodes, i]() {
+			devices[i] = createDevice(deviceNodes[i]);
+		});
+
+	for (std::thread &worker : workers)
+		worker.join();
+
+	return devices;
+}
+
 /**
  * \brief Add a media device to the enumerator
  * \param[in] media media device instance to add
@@ -286,6 +368,9 @@ void DeviceEnumerator::removeDevice(const std::string &deviceNode)
  * it the caller is responsible for acquiring the MediaDevice object and
  * releasing it when done with it.
  *
+ * When a filter is set with setFilter(), only the media device that contains
+ * the filtered device node is considered.
+ *
  * \return pointer to the matching MediaDevice, or nullptr if no match is found
  */
 std::shared_ptr<MediaDevice> DeviceEnumerator::search(const DeviceMatch &dm)
@@ -294,6 +379,17 @@ std::shared_ptr<MediaDevice> DeviceEnumerator::search(const DeviceMatch &dm)
 		if (media->busy())
 			continue;
 
+		if (filter_) {
+			const std::vector<MediaEntity *> &entities = media->entities();
+			auto it = std::find_if(entities.begin(), entities.end(),
+					       [&](const MediaEntity *entity) {
+						       return makedev(entity->deviceMajor(),
+								      entity->deviceMinor()) == filter_;
+					       });
+			if (it == entities.end())
+				continue;
+		}
+
 		if (dm.match(media.get())) {
 			LOG(DeviceEnumerator, Debug)
 				<< "Successful match for media device \""
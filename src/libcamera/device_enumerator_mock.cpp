@@ -0,0 +1,119 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * device_enumerator_mock.cpp - Enumerator for simulated media devices
+ */
+
+#include "device_enumerator_mock.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+
+#include <linux/media.h>
+
+#include "log.h"
+#include "media_device.h"
+#include "utils.h"
+
+namespace libcamera {
+
+LOG_DECLARE_CATEGORY(DeviceEnumerator)
+
+/**
+ * \class DeviceEnumeratorMock
+ * \brief Enumerate media devices simulated in userspace
+ *
+ * The mock enumerator creates media devices that don't exist in the system,
+ * for the mock pipeline handler to expose them as cameras. It allows
+ * measuring the CPU cost of the libcamera request, signal and pipeline
+ * handler paths in isolation from kernel drivers and hardware, with any
+ * number of cameras.
+ *
+ * The enumerator is only available when libcamera is compiled with the
+ * mock_devices option, and is selected by DeviceEnumerator::create() when the
+ * LIBCAMERA_MOCK_CAMERAS environment variable is set to the number of cameras
+ * to simulate. Each camera is backed by a separate media device named
+ * "/dev/mock-media<N>", whose graph contains a "Mock Sensor" entity linked to
+ * a "Mock Capture" entity.
+ */
+
+DeviceEnumeratorMock::DeviceEnumeratorMock()
+	: cameras_(0)
+{
+}
+
+int DeviceEnumeratorMock::init()
+{
+	const char *cameras = utils::secure_getenv("LIBCAMERA_MOCK_CAMERAS");
+	if (!cameras)
+		return -ENODEV;
+
+	cameras_ = strtoul(cameras, nullptr, 10);
+	return 0;
+}
+
+int DeviceEnumeratorMock::enumerate()
+{
+	struct media_v2_entity entities[2] = {};
+	struct media_v2_pad pads[2] = {};
+	struct media_v2_link link = {};
+
+	entities[0].id = 1;
+	entities[0].function = MEDIA_ENT_F_CAM_SENSOR;
+	strncpy(entities[0].name, "Mock Sensor", sizeof(entities[0].name));
+
+	entities[1].id = 2;
+	entities[1].function = MEDIA_ENT_F_IO_V4L;
+	entities[1].flags = MEDIA_ENT_FL_DEFAULT;
+	strncpy(entities[1].name, "Mock Capture", sizeof(entities[1].name));
+
+	pads[0].id = 3;
+	pads[0].entity_id = 1;
+	pads[0].flags = MEDIA_PAD_FL_SOURCE;
+
+	pads[1].id = 4;
+	pads[1].entity_id = 2;
+	pads[1].flags = MEDIA_PAD_FL_SINK;
+
+	link.id = 5;
+	link.source_id = 3;
+	link.sink_id = 4;
+	link.flags = MEDIA_LNK_FL_DATA_LINK | MEDIA_LNK_FL_ENABLED
+		   | MEDIA_LNK_FL_IMMUTABLE;
+
+	struct media_v2_topology topology = {};
+	topology.num_entities = 2;
+	topology.ptr_entities = reinterpret_cast<__u64>(entities);
+	topology.num_pads = 2;
+	topology.ptr_pads = reinterpret_cast<__u64>(pads);
+	topology.num_links = 1;
+	topology.ptr_links = reinterpret_cast<__u64>(&link);
+
+	for (unsigned int i = 0; i < cameras_; ++i) {
+		std::string model = "Mock Camera " + std::to_string(i);
+
+		struct media_device_info info = {};
+		strncpy(info.driver, "mock", sizeof(info.driver));
+		strncpy(info.model, model.c_str(), sizeof(info.model) - 1);
+		info.media_version = (4 << 16) | (19 << 8);
+
+		std::shared_ptr<MediaDevice> media =
+			std::make_shared<MediaDevice>("/dev/mock-media" + std::to_string(i));
+		int ret = media->populate(info, topology);
+		if (ret < 0) {
+			LOG(DeviceEnumerator, Error)
+				<< "Failed to create " << model << ": "
+				<< strerror(-ret);
+			return ret;
+		}
+
+		addDevice(media);
+	}
+
+	return 0;
+}
+
+} /* namespace libcamera */
@@ -12,10 +12,12 @@
 #include <fstream>
 #include <stdlib.h>
 #include <string.h>
+#include <string>
 #include <sys/ioctl.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <unistd.h>
+#include <vector>
 
 #include "log.h"
 #include "media_device.h"
@@ -31,6 +33,7 @@ int DeviceEnumeratorSysfs::init()
 
 int DeviceEnumeratorSysfs::enumerate()
 {
+	std::vector<std::string> devnodes;
 	struct dirent *ent;
 	DIR *dir;
 	int ret = 0;
@@ -73,7 +76,12 @@ int DeviceEnumeratorSysfs::enumerate()
 			continue;
 		}
 
-		std::shared_ptr<MediaDevice> media = createDevice(devnode);
+		devnodes.push_back(devnode);
+	}
+
+	closedir(dir);
+
+	for (const std::shared_ptr<MediaDevice> &media : createDevices(devnodes)) {
 		if (!media) {
 			ret = -ENODEV;
 			break;
@@ -87,8 +95,6 @@ int DeviceEnumeratorSysfs::enumerate()
 		addDevice(media);
 	}
 
-	closedir(dir);
-
 	return ret;
 }
 
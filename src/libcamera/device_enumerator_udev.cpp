@@ -16,6 +16,7 @@
 #include <sys/ioctl.h>
 #include <sys/sysmacros.h>
 #include <unistd.h>
+#include <vector>
 
 #include <libcamera/event_notifier.h>
 
@@ -26,13 +27,32 @@ namespace libcamera {
 
 LOG_DECLARE_CATEGORY(DeviceEnumerator)
 
+namespace {
+
+/*
+ * Hot-plugging a camera generates a burst of udev events, one for the media
+ * device and one for each of its video and subdev nodes. Events are grouped
+ * until none has been received for the settle time, with an upper bound on the
+ * delay to handle devices that keep generating events.
+ */
+constexpr std::chrono::milliseconds kEventsSettleTime{ 100 };
+constexpr std::chrono::milliseconds kEventsMaxDelay{ 500 };
+constexpr std::chrono::milliseconds kEventsSettleSlack{ 20 };
+
+} /* namespace */
+
 DeviceEnumeratorUdev::DeviceEnumeratorUdev()
-	: udev_(nullptr)
+	: udev_(nullptr), devicesAdded_(false)
 {
+	settleTimer_.timeout.connect(this, &DeviceEnumeratorUdev::processEvents);
+	settleTimer_.setSlack(kEventsSettleSlack);
 }
 
 DeviceEnumeratorUdev::~DeviceEnumeratorUdev()
 {
+	for (struct udev_device *dev : events_)
+		udev_device_unref(dev);
+
 	delete notifier_;
 
 	if (monitor_)
@@ -99,6 +119,7 @@ int DeviceEnumeratorUdev::enumerate()
 {
 	struct udev_enumerate *udev_enum = nullptr;
 	struct udev_list_entry *ents, *ent;
+	std::vector<std::string> devnodes;
 	int ret;
 
 	udev_enum = udev_enumerate_new(udev_);
@@ -145,12 +166,36 @@ int DeviceEnumeratorUdev::enumerate()
 			goto done;
 		}
 
+		/*
+		 * Defer creation of media devices to populate them
+		 * concurrently once all devices have been listed.
+		 */
+		const char *subsystem = udev_device_get_subsystem(dev);
+		if (subsystem && !strcmp(subsystem, "media")) {
+			devnodes.push_back(devnode);
+			udev_device_unref(dev);
+			continue;
+		}
+
 		ret = addUdevDevice(dev);
 		udev_device_unref(dev);
 		if (ret < 0)
 			break;
 	}
 
+	if (ret < 0)
+		goto done;
+
+	for (const std::shared_ptr<MediaDevice> &media : createDevices(devnodes)) {
+		if (!media) {
+			ret = -ENODEV;
+			break;
+		}
+
+		if (populateMediaDevice(media) == 0)
+			addDevice(media);
+	}
+
 done:
 	udev_enumerate_unref(udev_enum);
 	if (ret < 0)
@@ -304,6 +349,7 @@ int DeviceEnumeratorUdev::addV4L2Device(dev_t devnum)
 	if (deps->deps_.empty()) {
 		addDevice(deps->media_);
 		pending_.remove(*deps);
+		devicesAdded_ = true;
 	}
 
 	return 0;
@@ -312,21 +358,85 @@ int DeviceEnumeratorUdev::addV4L2Device(dev_t devnum)
 void DeviceEnumeratorUdev::udevNotify(EventNotifier *notifier)
 {
 	struct udev_device *dev = udev_monitor_receive_device(monitor_);
-	std::string action(udev_device_get_action(dev));
-	std::string deviceNode(udev_device_get_devnode(dev));
+	if (!dev)
+		return;
 
 	LOG(DeviceEnumerator, Debug)
-		<< action << " device " << udev_device_get_devnode(dev);
+		<< udev_device_get_action(dev) << " device "
+		<< udev_device_get_devnode(dev);
+
+	/* Defer processing until the burst of events settles. */
+	std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+	if (events_.empty())
+		eventsDeadline_ = now + kEventsMaxDelay;
+
+	events_.push_back(dev);
 
-	if (action == "add") {
-		addUdevDevice(dev);
-	} else if (action == "remove") {
+	settleTimer_.start(std::min(now + kEventsSettleTime, eventsDeadline_));
+}
+
+void DeviceEnumeratorUdev::processEvents(Timer *timer)
+{
+	std::vector<struct udev_device *> events = std::move(events_);
+	std::vector<std::string> mediaNodes;
+	std::vector<dev_t> v4l2Devices;
+
+	events_.clear();
+
+	/*
+	 * Handle removals in order, and collect additions. A media device
+	 * that appears and disappears within the same batch is dropped.
+	 */
+	for (struct udev_device *dev : events) {
+		const char *action = udev_device_get_action(dev);
 		const char *subsystem = udev_device_get_subsystem(dev);
-		if (subsystem && !strcmp(subsystem, "media"))
-			removeDevice(deviceNode);
+		const char *devnode = udev_device_get_devnode(dev);
+
+		if (!action || !subsystem || !devnode) {
+			udev_device_unref(dev);
+			continue;
+		}
+
+		bool media = !strcmp(subsystem, "media");
+
+		if (!strcmp(action, "add")) {
+			if (media)
+				mediaNodes.push_back(devnode);
+			else if (!strcmp(subsystem, "video4linux"))
+				v4l2Devices.push_back(udev_device_get_devnum(dev));
+		} else if (!strcmp(action, "remove") && media) {
+			auto it = std::find(mediaNodes.begin(), mediaNodes.end(),
+					    devnode);
+			if (it != mediaNodes.end())
+				mediaNodes.erase(it);
+			else
+				removeDevice(devnode);
+		}
+
+		udev_device_unref(dev);
+	}
+
+	devicesAdded_ = false;
+
+	/*
+	 * Register the V4L2 devices first, to resolve the dependencies of the
+	 * new media devices in a single pass when populating them.
+	 */
+	for (dev_t devnum : v4l2Devices)
+		addV4L2Device(devnum);
+
+	for (const std::shared_ptr<MediaDevice> &media : createDevices(mediaNodes)) {
+		if (!media)
+			continue;
+
+		if (populateMediaDevice(media) == 0) {
+			addDevice(media);
+			devicesAdded_ = true;
+		}
 	}
 
-	udev_device_unref(dev);
+	if (devicesAdded_)
+		devicesAdded.emit();
 }
 
 } /* namespace libcamera */
@@ -0,0 +1,119 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * dma_heap.cpp - DMA heap memory allocator
+ */
+
+#include "dma_heap.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+#include <linux/dma-heap.h>
+
+#include "log.h"
+
+/**
+ * \file dma_heap.h
+ * \brief DMA heap memory allocator
+ */
+
+namespace libcamera {
+
+LOG_DEFINE_CATEGORY(DmaHeap)
+
+/**
+ * \class DmaHeap
+ * \brief Allocate dmabufs from a Linux DMA heap
+ *
+ * The Linux DMA heaps, exposed as character devices in /dev/dma_heap/, hand
+ * out dmabufs that are not tied to any device. Unlike buffers exported by a
+ * V4L2 video device, they can be imported by any number of devices, such as
+ * several cameras, a GPU and a video encoder, without copies.
+ *
+ * Heap names are platform-specific, the CMA heap for instance is named
+ * "linux,cma" or "reserved" depending on the device tree. A DmaHeap is thus
+ * constructed from a list of candidate names, and opens the first heap that
+ * exists.
+ */
+
+/**
+ * \brief Open a DMA heap
+ * \param[in] names The candidate heap names, in order of preference
+ *
+ * Use isValid() to check if one of the heaps has been opened.
+ */
+DmaHeap::DmaHeap(const std::vector<std::string> &names)
+{
+	for (const std::string &name : names) {
+		std::string path = "/dev/dma_heap/" + name;
+		int fd = ::open(path.c_str(), O_RDWR | O_CLOEXEC);
+		if (fd < 0) {
+			LOG(DmaHeap, Debug)
+				<< "Failed to open " << path << ": "
+				<< strerror(errno);
+			continue;
+		}
+
+		handle_ = FileDescriptor(fd);
+		::close(fd);
+
+		name_ = name;
+		LOG(DmaHeap, Debug) << "Using DMA heap " << name_;
+		return;
+	}
+
+	LOG(DmaHeap, Error) << "No DMA heap available";
+}
+
+/**
+ * \fn DmaHeap::isValid()
+ * \brief Check if the heap has been opened successfully
+ * \return True if the heap is usable, false otherwise
+ */
+
+/**
+ * \fn DmaHeap::name()
+ * \brief Retrieve the name of the opened heap
+ * \return The heap name, or an empty string if no heap has been opened
+ */
+
+/**
+ * \brief Allocate a dmabuf from the heap
+ * \param[in] size The size of the buffer in bytes
+ *
+ * \return The dmabuf file descriptor, or an invalid file descriptor if the
+ * allocation failed, in which case errno is set
+ */
+FileDescriptor DmaHeap::alloc(size_t size)
+{
+	if (!isValid()) {
+		errno = ENODEV;
+		return FileDescriptor();
+	}
+
+	struct dma_heap_allocation_data alloc = {};
+	alloc.len = size;
+	alloc.fd_flags = O_CLOEXEC | O_RDWR;
+
+	int ret = ::ioctl(handle_.fd(), DMA_HEAP_IOCTL_ALLOC, &alloc);
+	if (ret < 0) {
+		int err = errno;
+		LOG(DmaHeap, Error)
+			<< "Failed to allocate " << size << " bytes from "
+			<< name_ << ": " << strerror(err);
+		errno = err;
+		return FileDescriptor();
+	}
+
+	FileDescriptor buffer(alloc.fd);
+	::close(alloc.fd);
+
+	return buffer;
+}
+
+} /* namespace libcamera */
@@ -100,7 +100,8 @@ EventDispatcher::~EventDispatcher()
  *
  * This function processes all pending events associated with registered event
  * notifiers and timers and signals the corresponding EventNotifier and Timer
- * objects. If no events are pending, it waits for the first event and processes
+ * objects. It also dispatches the messages posted to the current thread. If no
+ * events or messages are pending, it waits for the first event and processes
  * it before returning.
  */
 
@@ -0,0 +1,626 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * event_dispatcher_epoll.cpp - Epoll-based event dispatcher
+ */
+
+#include "event_dispatcher_epoll.h"
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/prctl.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+#include <libcamera/event_notifier.h>
+#include <libcamera/timer.h>
+
+#include "cpu_accounting.h"
+#include "log.h"
+#include "thread.h"
+#include "utils.h"
+
+/**
+ * \file event_dispatcher_epoll.h
+ */
+
+namespace libcamera {
+
+LOG_DECLARE_CATEGORY(Event)
+
+static const char *notifierType(EventNotifier::Type type)
+{
+	if (type == EventNotifier::Read)
+		return "read";
+	if (type == EventNotifier::Write)
+		return "write";
+	if (type == EventNotifier::Exception)
+		return "exception";
+
+	return "";
+}
+
+/**
+ * \class EventDispatcherEpoll
+ * \brief An epoll-based event dispatcher
+ *
+ * The EventDispatcherEpoll keeps file descriptors registered with an epoll
+ * instance for as long as they have an enabled event notifier. Contrary to the
+ * EventDispatcherPoll, it doesn't need to build the list of monitored file
+ * descriptors for every iteration of the event loop, and only processes the
+ * file descriptors that have pending events. This is the default event
+ * dispatcher.
+ *
+ * Timers are implemented with a timerfd armed with the absolute deadline of
+ * the next timer, providing nanosecond precision instead of the millisecond
+ * granularity of the epoll_wait() timeout.
+ *
+ * Waking up a blocked thread when a file descriptor becomes readable adds the
+ * scheduler wake-up latency, typically 50 to 200µs, to the processing of every
+ * event. For low-latency capture, the dispatcher can instead busy poll the
+ * file descriptors around the expected arrival of periodic events, such as
+ * frames completed by a video device. The mode is opt-in, enabled with
+ * setBusyPoll() or the LIBCAMERA_EVENT_BUSY_POLL environment variable set to
+ * the window duration in microseconds.
+ *
+ * The dispatcher measures the period of the read events of each file
+ * descriptor. Once the period is stable, the dispatcher wakes up a window
+ * ahead of the next expected event, polls without blocking until an event
+ * arrives or the window after the expected arrival expires, and then falls
+ * back to blocking. The CPU time spent spinning, the events caught and the
+ * estimated latency saved are accounted in the ThreadStatistics.
+ *
+ * Timers with a slack are coalesced, the dispatcher wakes up at the end of the
+ * earliest slack and expires all timers whose deadline has passed. When all
+ * the timers of the thread have a slack of at least a few milliseconds, the
+ * dispatcher waits with the epoll_wait() timeout instead of the timerfd, and
+ * sets the timer slack of the thread with PR_SET_TIMERSLACK to let the kernel
+ * batch the wake-up with other timers of the system.
+ */
+
+namespace {
+
+/* Number of consistent periods required before busy polling a source. */
+constexpr unsigned int MinStableIntervals = 3;
+
+/* Number of expected events missed before giving up on a source. */
+constexpr unsigned int MaxMissedEvents = 2;
+
+/* Minimum timer slack for coarse waits with the kernel timer slack. */
+constexpr std::chrono::milliseconds MinCoarseSlack{ 4 };
+
+} /* namespace */
+
+/**
+ * \fn EventDispatcherEpoll::timers()
+ * \brief Retrieve the queue of running timers
+ *
+ * The timer queue is exposed to access the timer lateness statistics.
+ *
+ * \return The timer queue
+ */
+
+EventDispatcherEpoll::EventDispatcherEpoll()
+	: processingEvents_(false), busyPollWindow_(0), wakeupLatency_(0),
+	  spinTime_(0), blocking_(false), timerSlack_(0)
+{
+	/*
+	 * Create the epoll and event fds. Failures are fatal as we can't
+	 * implement an interruptible dispatcher without them.
+	 */
+	epollfd_ = epoll_create1(EPOLL_CLOEXEC);
+	if (epollfd_ < 0)
+		LOG(Event, Fatal) << "Unable to create epoll fd";
+
+	eventfd_ = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (eventfd_ < 0)
+		LOG(Event, Fatal) << "Unable to create eventfd";
+
+	if (update(eventfd_, 0, EPOLLIN) < 0)
+		LOG(Event, Fatal) << "Unable to monitor eventfd";
+
+	timerfd_ = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+	if (timerfd_ < 0)
+		LOG(Event, Fatal) << "Unable to create timerfd";
+
+	if (update(timerfd_, 0, EPOLLIN) < 0)
+		LOG(Event, Fatal) << "Unable to monitor timerfd";
+
+	const char *window = utils::secure_getenv("LIBCAMERA_EVENT_BUSY_POLL");
+	if (window)
+		setBusyPoll(std::chrono::microseconds(strtoul(window, nullptr, 10)));
+}
+
+EventDispatcherEpoll::~EventDispatcherEpoll()
+{
+	close(timerfd_);
+	close(eventfd_);
+	close(epollfd_);
+}
+
+void EventDispatcherEpoll::registerEventNotifier(EventNotifier *notifier)
+{
+	EventNotifierSetEpoll &set = notifiers_[notifier->fd()];
+	EventNotifier::Type type = notifier->type();
+
+	if (set.notifiers[type] && set.notifiers[type] != notifier) {
+		LOG(Event, Warning)
+			<< "Ignoring duplicate " << notifierType(type)
+			<< " notifier for fd " << notifier->fd();
+		return;
+	}
+
+	uint32_t oldEvents = set.events();
+	set.notifiers[type] = notifier;
+
+	int ret = update(notifier->fd(), oldEvents, set.events());
+	if (ret < 0) {
+		LOG(Event, Error)
+			<< "Unable to monitor fd " << notifier->fd() << ": "
+			<< strerror(-ret);
+		set.notifiers[type] = nullptr;
+	}
+}
+
+void EventDispatcherEpoll::unregisterEventNotifier(EventNotifier *notifier)
+{
+	auto iter = notifiers_.find(notifier->fd());
+	if (iter == notifiers_.end())
+		return;
+
+	EventNotifierSetEpoll &set = iter->second;
+	EventNotifier::Type type = notifier->type();
+
+	if (!set.notifiers[type])
+		return;
+
+	if (set.notifiers[type] != notifier) {
+		LOG(Event, Warning)
+			<< notifierType(type) << " notifier for fd "
+			<< notifier->fd() << " is not registered";
+		return;
+	}
+
+	uint32_t oldEvents = set.events();
+	set.notifiers[type] = nullptr;
+
+	/*
+	 * The file descriptor may have been closed already, in which case it
+	 * has been removed from the epoll instance automatically. Ignore
+	 * errors.
+	 */
+	update(notifier->fd(), oldEvents, set.events());
+
+	/*
+	 * Don't race with event processing if this method is called from an
+	 * event notifier. The notifiers_ entry will be erased by
+	 * processEvents().
+	 */
+	if (processingEvents_)
+		return;
+
+	if (!set.notifiers[0] && !set.notifiers[1] && !set.notifiers[2])
+		notifiers_.erase(iter);
+}
+
+void EventDispatcherEpoll::registerTimer(Timer *timer)
+{
+	timers_.insert(timer);
+}
+
+void EventDispatcherEpoll::unregisterTimer(Timer *timer)
+{
+	timers_.remove(timer);
+}
+
+/**
+ * \brief Set the busy polling window
+ * \param[in] window The window duration, or 0 to disable busy polling
+ *
+ * When busy polling is enabled, the dispatcher polls without blocking from
+ * \a window before to \a window after the expected arrival of periodic read
+ * events.
+ */
+void EventDispatcherEpoll::setBusyPoll(utils::duration window)
+{
+	busyPollWindow_ = std::max(window, utils::duration(0));
+}
+
+/**
+ * \fn EventDispatcherEpoll::busyPoll()
+ * \brief Retrieve the busy polling window
+ * \return The busy polling window, or 0 if busy polling is disabled
+ */
+
+void EventDispatcherEpoll::processEvents()
+{
+	Thread *thread = Thread::current();
+	int ret;
+
+	/* Don't wait for events if messages have been dispatched. */
+	bool block = !thread->dispatchMessages();
+
+	/* Wait for events and process notifiers and timers. */
+	utils::time_point start = utils::clock::now();
+
+	do {
+		ret = poll(block);
+	} while (ret == -1 && errno == EINTR);
+
+	/* Time spent spinning is accounted separately. */
+	thread->recordSleep(utils::clock::now() - start - spinTime_);
+
+	if (ret < 0) {
+		ret = -errno;
+		LOG(Event, Warning) << "epoll_wait() failed with " << strerror(-ret);
+	} else if (ret > 0) {
+		processNotifiers(ret);
+	}
+
+	processTimers();
+}
+
+void EventDispatcherEpoll::interrupt()
+{
+	uint64_t value = 1;
+	ssize_t ret = write(eventfd_, &value, sizeof(value));
+	if (ret != sizeof(value)) {
+		if (ret < 0)
+			ret = -errno;
+		LOG(Event, Error)
+			<< "Failed to interrupt event dispatcher ("
+			<< ret << ")";
+	}
+}
+
+uint32_t EventDispatcherEpoll::EventNotifierSetEpoll::events() const
+{
+	uint32_t events = 0;
+
+	if (notifiers[EventNotifier::Read])
+		events |= EPOLLIN;
+	if (notifiers[EventNotifier::Write])
+		events |= EPOLLOUT;
+	if (notifiers[EventNotifier::Exception])
+		events |= EPOLLPRI;
+
+	return events;
+}
+
+int EventDispatcherEpoll::update(int fd, uint32_t oldEvents, uint32_t newEvents)
+{
+	struct epoll_event event = {};
+	event.events = newEvents;
+	event.data.fd = fd;
+
+	int ret;
+
+	if (!newEvents) {
+		ret = epoll_ctl(epollfd_, EPOLL_CTL_DEL, fd, nullptr);
+	} else if (!oldEvents) {
+		ret = epoll_ctl(epollfd_, EPOLL_CTL_ADD, fd, &event);
+	} else {
+		ret = epoll_ctl(epollfd_, EPOLL_CTL_MOD, fd, &event);
+		/*
+		 * If the fd has been closed and the number reused without
+		 * unregistering the notifiers, it has been removed from the
+		 * epoll instance. Add it back.
+		 */
+		if (ret < 0 && errno == ENOENT)
+			ret = epoll_ctl(epollfd_, EPOLL_CTL_ADD, fd, &event);
+	}
+
+	return ret < 0 ? -errno : 0;
+}
+
+int EventDispatcherEpoll::poll(bool block)
+{
+	Timer *nextTimer = timers_.next();
+	utils::duration slack(0);
+	utils::time_point deadline = nextTimer ? timers_.wakeup(&slack)
+					       : utils::time_point();
+	utils::time_point now = utils::clock::now();
+	int timeout = -1;
+
+	spinTime_ = utils::duration(0);
+	blocking_ = false;
+
+	/*
+	 * Busy poll around the expected arrival of the next event, or wake up
+	 * early to do so.
+	 */
+	utils::time_point arrival;
+	if (block && busyPollWindow_ != utils::duration(0) &&
+	    predictArrival(now, &arrival)) {
+		utils::time_point spinStart = arrival - busyPollWindow_;
+		utils::time_point spinEnd = arrival + busyPollWindow_;
+
+		if (nextTimer && deadline < spinEnd)
+			spinEnd = deadline;
+
+		if (now < spinStart) {
+			if (!nextTimer || spinStart < deadline) {
+				deadline = spinStart;
+				slack = utils::duration(0);
+			}
+		} else if (now < spinEnd) {
+			int ret = spin(spinEnd);
+			if (ret)
+				return ret;
+
+			now = utils::clock::now();
+		}
+	}
+
+	/*
+	 * Arm the timerfd with the wake-up time of the timers, or return
+	 * immediately if it has already passed. When all timers tolerate a
+	 * large enough slack, wait with the millisecond epoll_wait() timeout
+	 * and let the kernel delay the wake-up by half of the slack. The
+	 * timeout is rounded up, target the wake-up 1ms early to compensate,
+	 * but never wake up before the earliest deadline.
+	 */
+	if (deadline == utils::time_point()) {
+		armTimer(utils::time_point());
+	} else if (deadline <= now) {
+		timeout = 0;
+	} else if (slack >= MinCoarseSlack) {
+		armTimer(utils::time_point());
+		setTimerSlack(slack / 2);
+
+		utils::time_point target = std::max(deadline - slack / 2 - std::chrono::milliseconds(1),
+						    nextTimer->deadline());
+		auto delay = std::chrono::duration_cast<std::chrono::milliseconds>(
+			target - now + std::chrono::milliseconds(1) - std::chrono::nanoseconds(1));
+		timeout = std::max<int64_t>(delay.count(), 0);
+	} else {
+		armTimer(deadline);
+	}
+
+	if (slack < MinCoarseSlack)
+		setTimerSlack(utils::duration(0));
+
+	if (!block)
+		timeout = 0;
+
+	blocking_ = timeout != 0;
+
+	return epoll_wait(epollfd_, events_.data(), events_.size(), timeout);
+}
+
+bool EventDispatcherEpoll::predictArrival(utils::time_point now,
+					  utils::time_point *arrival) const
+{
+	bool found = false;
+
+	for (const auto &iter : notifiers_) {
+		const EventNotifierSetEpoll &set = iter.second;
+
+		/*
+		 * Spinning on sources whose period isn't much longer than the
+		 * window would never block.
+		 */
+		if (set.stableIntervals < MinStableIntervals ||
+		    set.interval <= busyPollWindow_ * 2)
+			continue;
+
+		/*
+		 * Skip the events that have been missed, and give up when the
+		 * source seems to have stopped.
+		 */
+		utils::time_point next = set.lastEvent + set.interval;
+		unsigned int missed = 0;
+
+		while (next + busyPollWindow_ <= now && missed <= MaxMissedEvents) {
+			next += set.interval;
+			missed++;
+		}
+
+		if (missed > MaxMissedEvents)
+			continue;
+
+		if (!found || next < *arrival)
+			*arrival = next;
+		found = true;
+	}
+
+	return found;
+}
+
+int EventDispatcherEpoll::spin(utils::time_point end)
+{
+	utils::time_point start = utils::clock::now();
+	bool hit = false;
+	int ret;
+
+	do {
+		ret = epoll_wait(epollfd_, events_.data(), events_.size(), 0);
+	} while (ret == 0 && utils::clock::now() < end);
+
+	spinTime_ = utils::clock::now() - start;
+
+	/* Interrupts and timers don't benefit from busy polling. */
+	for (int i = 0; i < ret; ++i) {
+		int fd = events_[i].data.fd;
+		if (fd != eventfd_ && fd != timerfd_)
+			hit = true;
+	}
+
+	Thread::current()->recordBusyPoll(spinTime_, hit,
+					  hit ? wakeupLatency_ : utils::duration(0));
+
+	return ret;
+}
+
+void EventDispatcherEpoll::recordArrival(EventNotifierSetEpoll &set,
+					 utils::time_point now)
+{
+	if (set.lastEvent != utils::time_point()) {
+		utils::duration measured = now - set.lastEvent;
+
+		/* Average consistent periods, restart on the others. */
+		if (measured > set.interval * 3 / 4 &&
+		    measured < set.interval * 5 / 4) {
+			set.interval = (set.interval * 3 + measured) / 4;
+			set.stableIntervals = std::min(set.stableIntervals + 1,
+						       MinStableIntervals);
+		} else {
+			set.interval = measured;
+			set.stableIntervals = 0;
+		}
+	}
+
+	set.lastEvent = now;
+}
+
+void EventDispatcherEpoll::setTimerSlack(utils::duration slack)
+{
+	if (slack == timerSlack_)
+		return;
+
+	/* A zero value restores the default slack of the thread. */
+	unsigned long value = std::chrono::duration_cast<std::chrono::nanoseconds>(slack).count();
+	if (prctl(PR_SET_TIMERSLACK, value, 0, 0, 0) < 0) {
+		LOG(Event, Warning)
+			<< "Failed to set timer slack: " << strerror(errno);
+		return;
+	}
+
+	timerSlack_ = slack;
+}
+
+void EventDispatcherEpoll::armTimer(utils::time_point deadline)
+{
+	if (deadline == timerfdDeadline_)
+		return;
+
+	/*
+	 * The steady clock is CLOCK_MONOTONIC-based. A zero deadline disarms
+	 * the timer.
+	 */
+	struct itimerspec spec = {};
+	spec.it_value = utils::duration_to_timespec(deadline.time_since_epoch());
+
+	int ret = timerfd_settime(timerfd_, TFD_TIMER_ABSTIME, &spec, nullptr);
+	if (ret < 0) {
+		LOG(Event, Error)
+			<< "Failed to arm timerfd: " << strerror(errno);
+		return;
+	}
+
+	timerfdDeadline_ = deadline;
+}
+
+void EventDispatcherEpoll::processInterrupt()
+{
+	uint64_t value;
+	ssize_t ret = read(eventfd_, &value, sizeof(value));
+	if (ret != sizeof(value)) {
+		if (ret < 0)
+			ret = -errno;
+		LOG(Event, Error)
+			<< "Failed to process interrupt (" << ret << ")";
+	}
+}
+
+void EventDispatcherEpoll::processNotifiers(unsigned int count)
+{
+	static const struct {
+		EventNotifier::Type type;
+		uint32_t events;
+	} events[] = {
+		{ EventNotifier::Read, EPOLLIN },
+		{ EventNotifier::Write, EPOLLOUT },
+		{ EventNotifier::Exception, EPOLLPRI },
+	};
+
+	processingEvents_ = true;
+
+	for (unsigned int i = 0; i < count; ++i) {
+		const struct epoll_event &event = events_[i];
+		int fd = event.data.fd;
+
+		if (fd == eventfd_) {
+			processInterrupt();
+			continue;
+		}
+
+		/* Expired timers are processed by processTimers(). */
+		if (fd == timerfd_) {
+			/*
+			 * Measure the wake-up latency of the thread, to
+			 * estimate the latency saved by busy polling.
+			 */
+			if (blocking_ && busyPollWindow_ != utils::duration(0) &&
+			    timerfdDeadline_ != utils::time_point()) {
+				utils::duration latency = utils::clock::now() - timerfdDeadline_;
+				wakeupLatency_ = (wakeupLatency_ * 7 + latency) / 8;
+			}
+
+			uint64_t expirations;
+			if (read(timerfd_, &expirations, sizeof(expirations)) < 0 &&
+			    errno != EAGAIN)
+				LOG(Event, Error)
+					<< "Failed to read timerfd: " << strerror(errno);
+			timerfdDeadline_ = utils::time_point();
+			continue;
+		}
+
+		/*
+		 * The notifiers for the fd may have been unregistered by a
+		 * notifier processed earlier in this iteration.
+		 */
+		auto iter = notifiers_.find(fd);
+		if (iter == notifiers_.end())
+			continue;
+
+		EventNotifierSetEpoll &set = iter->second;
+
+		for (const auto &type : events) {
+			EventNotifier *notifier = set.notifiers[type.type];
+
+			if (!notifier || !(event.events & type.events))
+				continue;
+
+			utils::time_point start = utils::clock::now();
+			if (type.type == EventNotifier::Read)
+				recordArrival(set, start);
+
+			{
+				CpuScope scope(CameraStatistics::CpuEvents);
+				notifier->activated.emit(notifier);
+			}
+			Thread::current()->recordHandler(utils::clock::now() - start);
+		}
+
+		/* Erase the notifiers_ entry if it is now empty. */
+		if (!set.notifiers[0] && !set.notifiers[1] && !set.notifiers[2])
+			notifiers_.erase(iter);
+	}
+
+	processingEvents_ = false;
+}
+
+void EventDispatcherEpoll::processTimers()
+{
+	utils::time_point now = utils::clock::now();
+
+	while (Timer *timer = timers_.expire(now)) {
+		utils::time_point start = utils::clock::now();
+
+		timer->stop();
+
+		{
+			CpuScope scope(CameraStatistics::CpuEvents);
+			timer->timeout.emit(timer);
+		}
+
+		Thread::current()->recordHandler(utils::clock::now() - start);
+	}
+}
+
+} /* namespace libcamera */
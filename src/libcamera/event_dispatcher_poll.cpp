@@ -19,6 +19,7 @@
 #include <libcamera/event_notifier.h>
 #include <libcamera/timer.h>
 
+#include "cpu_accounting.h"
 #include "log.h"
 #include "thread.h"
 #include "utils.h"
@@ -48,6 +49,15 @@ static const char *notifierType(EventNotifier::Type type)
  * \brief A poll-based event dispatcher
  */
 
+/**
+ * \fn EventDispatcherPoll::timers()
+ * \brief Retrieve the queue of running timers
+ *
+ * The timer queue is exposed to access the timer lateness statistics.
+ *
+ * \return The timer queue
+ */
+
 EventDispatcherPoll::EventDispatcherPoll()
 	: processingEvents_(false)
 {
@@ -115,38 +125,21 @@ void EventDispatcherPoll::unregisterEventNotifier(EventNotifier *notifier)
 
 void EventDispatcherPoll::registerTimer(Timer *timer)
 {
-	for (auto iter = timers_.begin(); iter != timers_.end(); ++iter) {
-		if ((*iter)->deadline() > timer->deadline()) {
-			timers_.insert(iter, timer);
-			return;
-		}
-	}
-
-	timers_.push_back(timer);
+	timers_.insert(timer);
 }
 
 void EventDispatcherPoll::unregisterTimer(Timer *timer)
 {
-	for (auto iter = timers_.begin(); iter != timers_.end(); ++iter) {
-		if (*iter == timer) {
-			timers_.erase(iter);
-			return;
-		}
-
-		/*
-		 * As the timers list is ordered, we can stop as soon as we go
-		 * past the deadline.
-		 */
-		if ((*iter)->deadline() > timer->deadline())
-			break;
-	}
+	timers_.remove(timer);
 }
 
 void EventDispatcherPoll::processEvents()
 {
+	Thread *thread = Thread::current();
 	int ret;
 
-	Thread::current()->dispatchMessages();
+	/* Don't wait for events if messages have been dispatched. */
+	bool block = !thread->dispatchMessages();
 
 	/* Create the pollfd array. */
 	std::vector<struct pollfd> pollfds;
@@ -158,10 +151,14 @@ void EventDispatcherPoll::processEvents()
 	pollfds.push_back({ eventfd_, POLLIN, 0 });
 
 	/* Wait for events and process notifiers and timers. */
+	utils::time_point start = utils::clock::now();
+
 	do {
-		ret = poll(&pollfds);
+		ret = poll(&pollfds, block);
 	} while (ret == -1 && errno == EINTR);
 
+	thread->recordSleep(utils::clock::now() - start);
+
 	if (ret < 0) {
 		ret = -errno;
 		LOG(Event, Warning) << "poll() failed with " << strerror(-ret);
@@ -201,19 +198,18 @@ short EventDispatcherPoll::EventNotifierSetPoll::events() const
 	return events;
 }
 
-int EventDispatcherPoll::poll(std::vector<struct pollfd> *pollfds)
+int EventDispatcherPoll::poll(std::vector<struct pollfd> *pollfds, bool block)
 {
 	/* Compute the timeout. */
-	Timer *nextTimer = !timers_.empty() ? timers_.front() : nullptr;
-	struct timespec timeout;
+	Timer *nextTimer = block ? timers_.next() : nullptr;
+	struct timespec timeout = { 0, 0 };
 
 	if (nextTimer) {
 		utils::time_point now = utils::clock::now();
+		utils::time_point wakeup = timers_.wakeup();
 
-		if (nextTimer->deadline() > now)
-			timeout = utils::duration_to_timespec(nextTimer->deadline() - now);
-		else
-			timeout = { 0, 0 };
+		if (wakeup > now)
+			timeout = utils::duration_to_timespec(wakeup - now);
 
 		LOG(Event, Debug)
 			<< "timeout " << timeout.tv_sec << "."
@@ -222,7 +218,7 @@ int EventDispatcherPoll::poll(std::vector<struct pollfd> *pollfds)
 	}
 
 	return ppoll(pollfds->data(), pollfds->size(),
-		     nextTimer ? &timeout : nullptr, nullptr);
+		     nextTimer || !block ? &timeout : nullptr, nullptr);
 }
 
 void EventDispatcherPoll::processInterrupt(const struct pollfd &pfd)
@@ -278,8 +274,15 @@ void EventDispatcherPoll::processNotifiers(const std::vector<struct pollfd> &pol
 				continue;
 			}
 
-			if (pfd.revents & event.events)
+			if (!(pfd.revents & event.events))
+				continue;
+
+			utils::time_point start = utils::clock::now();
+			{
+				CpuScope scope(CameraStatistics::CpuEvents);
 				notifier->activated.emit(notifier);
+			}
+			Thread::current()->recordHandler(utils::clock::now() - start);
 		}
 
 		/* Erase the notifiers_ entry if it is now empty. */
@@ -294,14 +297,17 @@ void EventDispatcherPoll::processTimers()
 {
 	utils::time_point now = utils::clock::now();
 
-	while (!timers_.empty()) {
-		Timer *timer = timers_.front();
-		if (timer->deadline() > now)
-			break;
+	while (Timer *timer = timers_.expire(now)) {
+		utils::time_point start = utils::clock::now();
 
-		timers_.pop_front();
 		timer->stop();
-		timer->timeout.emit(timer);
+
+		{
+			CpuScope scope(CameraStatistics::CpuEvents);
+			timer->timeout.emit(timer);
+		}
+
+		Thread::current()->recordHandler(utils::clock::now() - start);
 	}
 }
 
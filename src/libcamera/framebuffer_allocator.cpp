@@ -7,12 +7,17 @@
 
 #include <libcamera/framebuffer_allocator.h>
 
+#include <algorithm>
 #include <errno.h>
+#include <iterator>
+#include <string.h>
+#include <unistd.h>
 
 #include <libcamera/buffer.h>
 #include <libcamera/camera.h>
 #include <libcamera/stream.h>
 
+#include "dma_heap.h"
 #include "log.h"
 #include "pipeline_handler.h"
 
@@ -25,6 +30,17 @@ namespace libcamera {
 
 LOG_DEFINE_CATEGORY(Allocator)
 
+namespace {
+
+/*
+ * Lines of buffers allocated from a DMA heap are padded to this alignment,
+ * which covers the stride constraints of common capture, GPU and video
+ * encoder devices.
+ */
+constexpr unsigned int HeapStrideAlignment = 256;
+
+} /* namespace */
+
 /**
  * \class FrameBufferAllocator
  * \brief FrameBuffer allocator for applications
@@ -43,16 +59,53 @@ LOG_DEFINE_CATEGORY(Allocator)
  * control which streams to allocate buffers for, and can thus use external
  * buffers for a subset of the streams if desired.
  *
- * Buffers are deleted for a stream with free(), and destroying the allocator
+ * More buffers can be allocated for a stream at any time, even while the
+ * camera is running, with allocate(Stream *, unsigned int). This allows
+ * applications to increase the number of buffers in flight, for instance to
+ * absorb processing jitter, without stopping the camera.
+ *
+ * Buffers are released for a stream with free(), and destroying the allocator
  * automatically deletes all allocated buffers. Applications own the buffers
  * allocated by the FrameBufferAllocator and are responsible for ensuring the
  * buffers are not deleted while they are in use (part of a Request that has
  * been queued and hasn't completed yet).
  *
+ * Buffers released with free() are not deleted immediately but kept in a pool,
+ * along with the pixel format and size of the stream they have been allocated
+ * for. A later call to allocate() for a stream configured with the same pixel
+ * format and size reuses pooled buffers instead of allocating new ones, which
+ * makes reconfiguring the camera with a compatible configuration, or switching
+ * back and forth between configurations, cheap. Applications can preallocate
+ * buffers for a configuration they will use later with reserve(), and delete
+ * all pooled buffers with releasePool().
+ *
+ * By default buffers are exported by the device that captures the stream, and
+ * are thus allocated from the memory that device uses. Applications that
+ * share buffers with other devices, such as a GPU or a video encoder, or
+ * between cameras, can instead select a Linux DMA heap with setHeap(). The
+ * buffers are then allocated from the heap, independently of any device, and
+ * imported by the camera.
+ *
  * Usage of the FrameBufferAllocator is optional, if all buffers for a camera
  * are provided externally applications shall not use this class.
  */
 
+/**
+ * \enum FrameBufferAllocator::Heap
+ * \brief The memory the buffers are allocated from
+ * \var FrameBufferAllocator::HeapNone
+ * Buffers are exported by the device capturing the stream
+ * \var FrameBufferAllocator::HeapSystem
+ * Buffers are allocated from the system DMA heap, in cached memory that
+ * isn't physically contiguous
+ * \var FrameBufferAllocator::HeapSystemUncached
+ * Buffers are allocated from the uncached system DMA heap, for buffers that
+ * are not accessed by the CPU
+ * \var FrameBufferAllocator::HeapCma
+ * Buffers are allocated from the contiguous memory allocator DMA heap, for
+ * devices that require physically contiguous memory
+ */
+
 /**
  * \brief Create a FrameBuffer allocator
  * \param[in] camera The camera the allocator serves
@@ -81,7 +134,7 @@ FrameBufferAllocator::create(std::shared_ptr<Camera> camera)
  * \param[in] camera The camera
  */
 FrameBufferAllocator::FrameBufferAllocator(std::shared_ptr<Camera> camera)
-	: camera_(camera)
+	: camera_(camera), heapType_(HeapNone)
 {
 }
 
@@ -97,36 +150,215 @@ FrameBufferAllocator::~FrameBufferAllocator()
 	camera_->allocator_ = nullptr;
 }
 
+/**
+ * \brief Select the memory buffers are allocated from
+ * \param[in] heap The DMA heap, or HeapNone to export buffers from the device
+ *
+ * Buffers allocated from a DMA heap are not bound to the device capturing the
+ * stream. They can be imported by other devices, and queued to other cameras,
+ * without copies. Their lines are padded to an alignment suitable for common
+ * capture, GPU and encoder devices, and each buffer stores all the planes of
+ * the frame contiguously in a single dmabuf. The formats whose frame size
+ * can't be computed, such as compressed formats, can't be allocated from a
+ * heap.
+ *
+ * The heap can only be changed when no buffers are allocated for any stream.
+ * Buffers in the pool are reused regardless of the memory they have been
+ * allocated from.
+ *
+ * \return 0 on success or a negative error code otherwise
+ * \retval -EBUSY Buffers are allocated
+ * \retval -ENODEV The \a heap is not available on the system
+ */
+int FrameBufferAllocator::setHeap(Heap heap)
+{
+	static const std::map<Heap, std::vector<std::string>> heapNames = {
+		{ HeapSystem, { "system" } },
+		{ HeapSystemUncached, { "system-uncached" } },
+		{ HeapCma, { "linux,cma", "reserved" } },
+	};
+
+	if (allocated()) {
+		LOG(Allocator, Error)
+			<< "Can't change the heap while buffers are allocated";
+		return -EBUSY;
+	}
+
+	if (heap == HeapNone) {
+		heap_.reset();
+		heapType_ = heap;
+		return 0;
+	}
+
+	std::unique_ptr<DmaHeap> dmaHeap =
+		std::make_unique<DmaHeap>(heapNames.at(heap));
+	if (!dmaHeap->isValid())
+		return -ENODEV;
+
+	heap_ = std::move(dmaHeap);
+	heapType_ = heap;
+
+	return 0;
+}
+
+/**
+ * \fn FrameBufferAllocator::heap()
+ * \brief Retrieve the memory buffers are allocated from
+ * \return The DMA heap selected with setHeap()
+ */
+
 /**
  * \brief Allocate buffers for a configured stream
  * \param[in] stream The stream to allocate buffers for
+ * \param[in] cpuAccess The CPU access pattern of the buffers
  *
  * Allocate buffers suitable for capturing frames from the \a stream. The Camera
  * shall have been previously configured with Camera::configure() and shall be
  * stopped, and the stream shall be part of the active camera configuration.
  *
+ * Buffers previously released with free() or reserved with reserve() for the
+ * same pixel format and size are reused if enough of them are available in the
+ * pool. Otherwise new buffers are allocated, and if the allocation fails due to
+ * lack of memory, the pool is emptied and the allocation retried.
+ *
+ * The \a cpuAccess hint states how the application accesses the buffers memory
+ * with the CPU. Buffers only accessed by other devices, for instance to be
+ * displayed or encoded, should be allocated with FrameBuffer::CpuAccessNone,
+ * which allows the pipeline handler to skip the CPU cache maintenance
+ * operations every time a buffer is queued and dequeued. The hint only applies
+ * to newly allocated buffers, buffers reused from the pool keep the cache
+ * behaviour they have been allocated with. It doesn't apply to buffers
+ * allocated from a DMA heap, whose cache behaviour is selected by the heap.
+ *
  * Upon successful allocation, the allocated buffers can be retrieved with the
  * buffers() method.
  *
  * \return The number of allocated buffers on success or a negative error code
  * otherwise
  * \retval -EACCES The camera is not in a state where buffers can be allocated
- * \retval -EINVAL The \a stream does not belong to the camera or the stream is
- * not part of the active camera configuration
+ * \retval -EINVAL The \a stream does not belong to the camera, the stream is
+ * not part of the active camera configuration, or the stream is configured for
+ * user pointer buffers
  * \retval -EBUSY Buffers are already allocated for the \a stream
  */
-int FrameBufferAllocator::allocate(Stream *stream)
+int FrameBufferAllocator::allocate(Stream *stream,
+				   FrameBuffer::CpuAccess cpuAccess)
 {
 	if (buffers_.count(stream)) {
 		LOG(Allocator, Error) << "Buffers already allocated for stream";
 		return -EBUSY;
 	}
 
-	int ret = camera_->exportFrameBuffers(stream, &buffers_[stream]);
-	if (ret == -EINVAL)
+	if (stream->configuration().memory != FrameBuffer::MemoryDmaBuf) {
 		LOG(Allocator, Error)
-			<< "Stream is not part of " << camera_->name()
-			<< " active configuration";
+			<< "Can't allocate buffers for a user pointer stream";
+		return -EINVAL;
+	}
+
+	unsigned int count = stream->configuration().bufferCount;
+	auto pooled = findPooled(stream);
+
+	if (pooled != pool_.end() && pooled->buffers.size() >= count) {
+		int ret = camera_->importFrameBuffers(stream);
+		if (ret < 0) {
+			if (ret == -EINVAL)
+				LOG(Allocator, Error)
+					<< "Stream is not part of " << camera_->name()
+					<< " active configuration";
+			return ret;
+		}
+
+		std::vector<std::unique_ptr<FrameBuffer>> &buffers = buffers_[stream];
+		std::vector<std::unique_ptr<FrameBuffer>> &available = pooled->buffers;
+		auto end = available.begin() + count;
+
+		std::move(available.begin(), end, std::back_inserter(buffers));
+		available.erase(available.begin(), end);
+		if (available.empty())
+			pool_.erase(pooled);
+
+		LOG(Allocator, Debug) << "Reusing " << count << " pooled buffers";
+
+		return count;
+	}
+
+	/* Too few buffers to be reused, don't keep them around. */
+	if (pooled != pool_.end())
+		pool_.erase(pooled);
+
+	std::vector<std::unique_ptr<FrameBuffer>> buffers;
+	int ret = createBuffers(stream, cpuAccess, &buffers);
+	if (ret == -ENOMEM && !pool_.empty()) {
+		LOG(Allocator, Debug)
+			<< "Out of memory, releasing pooled buffers";
+
+		pool_.clear();
+		ret = createBuffers(stream, cpuAccess, &buffers);
+	}
+
+	if (ret < 0) {
+		if (ret == -EINVAL)
+			LOG(Allocator, Error)
+				<< "Stream is not part of " << camera_->name()
+				<< " active configuration";
+		return ret;
+	}
+
+	buffers_[stream] = std::move(buffers);
+
+	return ret;
+}
+
+/**
+ * \brief Allocate additional buffers for a stream
+ * \param[in] stream The stream to allocate buffers for
+ * \param[in] extra The number of buffers to add
+ *
+ * Grow the buffers allocated for the \a stream with allocate() by \a extra
+ * buffers. The camera may be running, in which case the buffers already queued
+ * are not affected and frames keep being captured while the buffers are
+ * allocated. The new buffers are appended to the buffers returned by
+ * buffers(), and use the CPU access pattern the stream buffers have been
+ * allocated with.
+ *
+ * Adding buffers invalidates the iterators of the vector returned by
+ * buffers(), but not the buffers themselves.
+ *
+ * \return The number of allocated buffers on success or a negative error code
+ * otherwise
+ * \retval -EACCES The camera is not in a state where buffers can be allocated
+ * \retval -EINVAL No buffers have been allocated for the \a stream, or they
+ * have been reused from the pool and can't be grown, unless allocated from a
+ * DMA heap
+ * \retval -ENOTSUP The camera can't add buffers to the \a stream
+ */
+int FrameBufferAllocator::allocate(Stream *stream, unsigned int extra)
+{
+	auto iter = buffers_.find(stream);
+	if (iter == buffers_.end()) {
+		LOG(Allocator, Error) << "No buffers allocated for stream";
+		return -EINVAL;
+	}
+
+	/*
+	 * Buffers allocated from a heap are imported by the camera, which
+	 * accepts any number of them.
+	 */
+	std::vector<std::unique_ptr<FrameBuffer>> buffers;
+	int ret = heap_ ? createHeapBuffers(stream, extra, &buffers)
+			: camera_->addFrameBuffers(stream, extra, &buffers);
+	if (ret < 0) {
+		LOG(Allocator, Error)
+			<< "Failed to add " << extra << " buffers: "
+			<< strerror(-ret);
+		return ret;
+	}
+
+	std::move(buffers.begin(), buffers.end(),
+		  std::back_inserter(iter->second));
+
+	LOG(Allocator, Debug) << "Added " << ret << " buffers";
+
 	return ret;
 }
 
@@ -134,9 +366,13 @@ int FrameBufferAllocator::allocate(Stream *stream)
  * \brief Free buffers previously allocated for a \a stream
  * \param[in] stream The stream
  *
- * Free buffers allocated with allocate().
+ * Release buffers allocated with allocate(). The buffers are not deleted but
+ * moved to the pool of the allocator, from which they can be reused by a later
+ * call to allocate() with a compatible stream configuration. Use releasePool()
+ * to delete them.
  *
- * This invalidates the buffers returned by buffers().
+ * This invalidates the buffers returned by buffers(), and deletes the spare
+ * buffers of the \a stream returned by spareBuffers().
  *
  * \return 0 on success or a negative error code otherwise
  * \retval -EACCES The camera is not in a state where buffers can be freed
@@ -152,13 +388,73 @@ int FrameBufferAllocator::free(Stream *stream)
 	if (ret < 0)
 		return ret;
 
-	std::vector<std::unique_ptr<FrameBuffer>> &buffers = iter->second;
-	buffers.clear();
+	addToPool(stream, std::move(iter->second));
 	buffers_.erase(iter);
+	spares_.erase(stream);
 
 	return 0;
 }
 
+/**
+ * \brief Preallocate buffers for a configured stream
+ * \param[in] stream The stream to preallocate buffers for
+ * \param[in] cpuAccess The CPU access pattern of the buffers
+ *
+ * Allocate buffers for the current configuration of the \a stream and store
+ * them in the pool of the allocator, without making them available through
+ * buffers(). This allows applications to allocate buffers at startup for all
+ * the configurations they will use, and then switch between configurations
+ * without allocating memory. The buffers are reused by a later call to
+ * allocate() for a stream configured with the same pixel format and size.
+ * The \a cpuAccess hint is handled as in allocate().
+ *
+ * The Camera shall be configured and stopped, the stream shall be part of the
+ * active camera configuration, and no buffers shall be allocated for it.
+ *
+ * \return The number of preallocated buffers on success or a negative error
+ * code otherwise
+ * \retval -EACCES The camera is not in a state where buffers can be allocated
+ * \retval -EINVAL The \a stream does not belong to the camera, the stream is
+ * not part of the active camera configuration, or the stream is configured for
+ * user pointer buffers
+ * \retval -EBUSY Buffers are already allocated for the \a stream
+ */
+int FrameBufferAllocator::reserve(Stream *stream,
+				  FrameBuffer::CpuAccess cpuAccess)
+{
+	if (buffers_.count(stream)) {
+		LOG(Allocator, Error) << "Buffers already allocated for stream";
+		return -EBUSY;
+	}
+
+	if (stream->configuration().memory != FrameBuffer::MemoryDmaBuf) {
+		LOG(Allocator, Error)
+			<< "Can't allocate buffers for a user pointer stream";
+		return -EINVAL;
+	}
+
+	std::vector<std::unique_ptr<FrameBuffer>> buffers;
+	int ret = createBuffers(stream, cpuAccess, &buffers);
+	if (ret < 0)
+		return ret;
+
+	camera_->freeFrameBuffers(stream);
+	addToPool(stream, std::move(buffers));
+
+	return ret;
+}
+
+/**
+ * \brief Delete all buffers stored in the pool
+ *
+ * Delete the buffers released with free() or preallocated with reserve(). The
+ * buffers allocated for streams with allocate() are not affected.
+ */
+void FrameBufferAllocator::releasePool()
+{
+	pool_.clear();
+}
+
 /**
  * \fn FrameBufferAllocator::allocated()
  * \brief Check if the allocator has allocated buffers for any stream
@@ -188,4 +484,152 @@ FrameBufferAllocator::buffers(Stream *stream) const
 	return iter->second;
 }
 
+/**
+ * \brief Retrieve the spare buffers of a \a stream
+ * \param[in] stream The stream to retrieve spare buffers for
+ *
+ * When the camera operates in the latest frames mode selected with
+ * Camera::setLatestFrames(), the spare buffers of the \a stream are allocated
+ * when the camera is started, and are exchanged with the application buffers
+ * of the requests completed with the latest frame. Applications that map
+ * buffers ahead of time shall map the spare buffers as well. The returned
+ * buffers are valid until free() is called for the same stream or the
+ * FrameBufferAllocator instance is destroyed.
+ *
+ * \return The spare buffers of the \a stream, or an empty vector if the
+ * stream has no spare buffers
+ */
+const std::vector<std::unique_ptr<FrameBuffer>> &
+FrameBufferAllocator::spareBuffers(Stream *stream) const
+{
+	static const std::vector<std::unique_ptr<FrameBuffer>> empty;
+
+	auto iter = spares_.find(stream);
+	if (iter == spares_.end())
+		return empty;
+
+	return iter->second;
+}
+
+/*
+ * Allocate spare buffers for the latest frames mode, in the same memory as the
+ * stream buffers. Spare buffers are kept until the stream buffers are freed,
+ * and only the missing ones are allocated when the camera is started again.
+ */
+int FrameBufferAllocator::allocateSpares(Stream *stream, unsigned int count)
+{
+	std::vector<std::unique_ptr<FrameBuffer>> &spares = spares_[stream];
+	if (spares.size() >= count)
+		return count;
+
+	std::vector<std::unique_ptr<FrameBuffer>> buffers;
+	unsigned int missing = count - spares.size();
+	int ret = heap_ ? createHeapBuffers(stream, missing, &buffers)
+			: camera_->addFrameBuffers(stream, missing, &buffers);
+	if (ret < 0) {
+		LOG(Allocator, Error)
+			<< "Failed to allocate " << missing << " spare buffers: "
+			<< strerror(-ret);
+		return ret;
+	}
+
+	std::move(buffers.begin(), buffers.end(), std::back_inserter(spares));
+
+	return count;
+}
+
+/*
+ * Create buffers for the stream, either exported by the camera or allocated
+ * from the DMA heap and imported by the camera.
+ */
+int FrameBufferAllocator::createBuffers(Stream *stream,
+					FrameBuffer::CpuAccess cpuAccess,
+					std::vector<std::unique_ptr<FrameBuffer>> *buffers)
+{
+	if (!heap_)
+		return camera_->exportFrameBuffers(stream, cpuAccess, buffers);
+
+	int ret = camera_->importFrameBuffers(stream);
+	if (ret < 0)
+		return ret;
+
+	ret = createHeapBuffers(stream, stream->configuration().bufferCount,
+				buffers);
+	if (ret < 0)
+		camera_->freeFrameBuffers(stream);
+
+	return ret;
+}
+
+int FrameBufferAllocator::createHeapBuffers(Stream *stream, unsigned int count,
+					    std::vector<std::unique_ptr<FrameBuffer>> *buffers)
+{
+	const StreamConfiguration &cfg = stream->configuration();
+	const PixelFormatInfo &info = PixelFormatInfo::info(cfg.pixelFormat);
+
+	size_t size = 0;
+	for (unsigned int i = 0; i < info.numPlanes; ++i) {
+		unsigned int stride = info.stride(cfg.size.width, i);
+		stride = (stride + HeapStrideAlignment - 1) & ~(HeapStrideAlignment - 1);
+
+		unsigned int subSampling = info.planes[i].verticalSubSampling;
+		size += stride * ((cfg.size.height + subSampling - 1) / subSampling);
+	}
+
+	if (!size) {
+		LOG(Allocator, Error)
+			<< "Can't allocate " << cfg.toString()
+			<< " buffers from a DMA heap";
+		return -EINVAL;
+	}
+
+	size_t pageSize = sysconf(_SC_PAGESIZE);
+	size = (size + pageSize - 1) / pageSize * pageSize;
+
+	for (unsigned int i = 0; i < count; ++i) {
+		FrameBuffer::Plane plane;
+		plane.fd = heap_->alloc(size);
+		if (!plane.fd.isValid())
+			return -errno;
+
+		plane.length = size;
+		buffers->push_back(std::make_unique<FrameBuffer>(std::vector<FrameBuffer::Plane>{ plane }));
+	}
+
+	LOG(Allocator, Debug)
+		<< "Allocated " << count << " buffers of " << size
+		<< " bytes from " << heap_->name();
+
+	return count;
+}
+
+std::vector<FrameBufferAllocator::PooledBuffers>::iterator
+FrameBufferAllocator::findPooled(Stream *stream)
+{
+	const StreamConfiguration &cfg = stream->configuration();
+
+	return std::find_if(pool_.begin(), pool_.end(),
+			    [&](const PooledBuffers &pooled) {
+				    return pooled.pixelFormat == cfg.pixelFormat &&
+					   pooled.size == cfg.size;
+			    });
+}
+
+void FrameBufferAllocator::addToPool(Stream *stream,
+				     std::vector<std::unique_ptr<FrameBuffer>> buffers)
+{
+	if (buffers.empty())
+		return;
+
+	auto pooled = findPooled(stream);
+	if (pooled == pool_.end()) {
+		const StreamConfiguration &cfg = stream->configuration();
+		pool_.push_back({ cfg.pixelFormat, cfg.size, {} });
+		pooled = pool_.end() - 1;
+	}
+
+	std::move(buffers.begin(), buffers.end(),
+		  std::back_inserter(pooled->buffers));
+}
+
 } /* namespace libcamera */
@@ -26,6 +26,8 @@ ${description}
     ctrls_doc = []
     ctrls_def = []
     ctrls_map = []
+    ctrls_table = []
+    names = []
 
     for ctrl in controls:
         name, ctrl = ctrl.popitem()
@@ -45,11 +47,18 @@ ${description}
         ctrls_doc.append(doc_template.substitute(info))
         ctrls_def.append(def_template.substitute(info))
         ctrls_map.append('\t{ ' + id_name + ', &' + name + ' },')
+        ctrls_table.append('\t&' + name + ',')
+        names.append(name)
+
+    # Sort the names using byte-wise comparison, to match strcmp().
+    names.sort(key=lambda name: name.encode('utf-8'))
 
     return {
         'controls_doc': '\n\n'.join(ctrls_doc),
         'controls_def': '\n'.join(ctrls_def),
         'controls_map': '\n'.join(ctrls_map),
+        'controls_table': '\n'.join(ctrls_table),
+        'controls_names': '\n'.join(['\t&' + name + ',' for name in names]),
     }
 
 
@@ -74,7 +83,11 @@ def generate_h(controls):
         ctrls.append(template.substitute(info))
         id_value += 1
 
-    return {'ids': '\n'.join(ids), 'controls': '\n'.join(ctrls)}
+    return {
+        'ids': '\n'.join(ids),
+        'controls': '\n'.join(ctrls),
+        'count': str(id_value - 1),
+    }
 
 
 def fill_template(template, data):
@@ -0,0 +1,23 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * buffer_metadata.h - Frame buffer metadata update helpers
+ */
+#ifndef __LIBCAMERA_BUFFER_METADATA_H__
+#define __LIBCAMERA_BUFFER_METADATA_H__
+
+#include <libcamera/buffer.h>
+
+namespace libcamera {
+
+class BufferMetadata
+{
+public:
+	static void copy(FrameBuffer *buffer, const FrameMetadata &metadata);
+	static void setNumPlanes(FrameMetadata *metadata, unsigned int numPlanes);
+};
+
+} /* namespace libcamera */
+
+#endif /* __LIBCAMERA_BUFFER_METADATA_H__ */
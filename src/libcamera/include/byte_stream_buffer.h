@@ -10,6 +10,8 @@
 #include <stddef.h>
 #include <stdint.h>
 
+#include <libcamera/span.h>
+
 namespace libcamera {
 
 class ByteStreamBuffer
@@ -33,11 +35,36 @@ public:
 	{
 		return read(reinterpret_cast<uint8_t *>(t), sizeof(*t));
 	}
+	template<typename T>
+	int read(const Span<T> &data)
+	{
+		return read(reinterpret_cast<uint8_t *>(data.data()),
+			    data.size_bytes());
+	}
+
+	template<typename T>
+	const T *read(size_t count = 1)
+	{
+		return reinterpret_cast<const T *>(read(sizeof(T), alignof(T), count));
+	}
+
 	template<typename T>
 	int write(const T *t)
 	{
 		return write(reinterpret_cast<const uint8_t *>(t), sizeof(*t));
 	}
+	template<typename T>
+	int write(const Span<T> &data)
+	{
+		return write(reinterpret_cast<const uint8_t *>(data.data()),
+			     data.size_bytes());
+	}
+
+	template<typename T>
+	T *reserve(size_t count = 1)
+	{
+		return reinterpret_cast<T *>(reserve(sizeof(T), alignof(T), count));
+	}
 
 private:
 	ByteStreamBuffer(const ByteStreamBuffer &other) = delete;
@@ -46,7 +73,9 @@ private:
 	void setOverflow();
 
 	int read(uint8_t *data, size_t size);
+	const uint8_t *read(size_t size, size_t align, size_t count);
 	int write(const uint8_t *data, size_t size);
+	uint8_t *reserve(size_t size, size_t align, size_t count);
 
 	ByteStreamBuffer *parent_;
 
@@ -7,6 +7,11 @@
 #ifndef __LIBCAMERA_CAMERA_CONTROLS_H__
 #define __LIBCAMERA_CAMERA_CONTROLS_H__
 
+#include <stdint.h>
+#include <vector>
+
+#include <libcamera/controls.h>
+
 #include "control_validator.h"
 
 namespace libcamera {
@@ -18,11 +23,30 @@ class CameraControlValidator final : public ControlValidator
 public:
 	CameraControlValidator(Camera *camera);
 
+	void update();
+
 	const std::string &name() const override;
 	bool validate(unsigned int id) const override;
+	bool validate(unsigned int id, const ControlValue &value) const override;
+	bool validate(const ControlList &list) const override;
 
 private:
+	struct Entry {
+		bool valid;
+		ControlType type;
+		ControlType rangeType;
+		union {
+			int64_t integer;
+			float real;
+		} min, max;
+	};
+
+	const Entry *entry(unsigned int id) const;
+	bool validate(const Entry &entry, const ControlValue &value) const;
+
 	Camera *camera_;
+	std::vector<Entry> table_;
+	std::vector<std::pair<unsigned int, Entry>> sparse_;
 };
 
 } /* namespace libcamera */
@@ -7,6 +7,7 @@
 #ifndef __LIBCAMERA_CAMERA_SENSOR_H__
 #define __LIBCAMERA_CAMERA_SENSOR_H__
 
+#include <stdint.h>
 #include <string>
 #include <vector>
 
@@ -26,6 +27,21 @@ struct V4L2SubdeviceFormat;
 class CameraSensor : protected Loggable
 {
 public:
+	enum ModePolicy {
+		ModeBestFit,
+		ModeMinReadoutTime,
+		ModeMaxFrameRate,
+	};
+
+	struct Mode {
+		unsigned int mbusCode;
+		Size size;
+		float aspectRatio;
+		uint64_t readoutTime;
+		uint64_t minFrameDuration;
+		uint64_t maxFrameDuration;
+	};
+
 	explicit CameraSensor(const MediaEntity *entity);
 	~CameraSensor();
 
@@ -35,12 +51,16 @@ public:
 	int init();
 
 	const MediaEntity *entity() const { return entity_; }
+	V4L2Subdevice *device() { return subdev_; }
 	const std::vector<unsigned int> &mbusCodes() const { return mbusCodes_; }
 	const std::vector<Size> &sizes() const { return sizes_; }
+	const std::vector<Mode> &modes() const { return modes_; }
+	const Mode *mode(const V4L2SubdeviceFormat &format) const;
 	const Size &resolution() const;
 
 	V4L2SubdeviceFormat getFormat(const std::vector<unsigned int> &mbusCodes,
-				      const Size &size) const;
+				      const Size &size,
+				      ModePolicy policy = ModeBestFit) const;
 	int setFormat(V4L2SubdeviceFormat *format);
 
 	const ControlInfoMap &controls() const;
@@ -51,11 +71,14 @@ protected:
 	std::string logPrefix() const;
 
 private:
+	void initModes();
+
 	const MediaEntity *entity_;
 	V4L2Subdevice *subdev_;
 
 	std::vector<unsigned int> mbusCodes_;
 	std::vector<Size> sizes_;
+	std::vector<Mode> modes_;
 };
 
 } /* namespace libcamera */
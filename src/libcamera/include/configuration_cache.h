@@ -0,0 +1,67 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * configuration_cache.h - Cache of validated camera configurations
+ */
+#ifndef __LIBCAMERA_CONFIGURATION_CACHE_H__
+#define __LIBCAMERA_CONFIGURATION_CACHE_H__
+
+#include <list>
+#include <vector>
+
+#include <libcamera/camera.h>
+#include <libcamera/stream.h>
+
+#include "thread.h"
+#include "v4l2_subdevice.h"
+
+namespace libcamera {
+
+class ConfigurationCache
+{
+public:
+	struct Result {
+		CameraConfiguration::Status status;
+		V4L2SubdeviceFormat sensorFormat;
+		std::vector<const Stream *> streams;
+	};
+
+	ConfigurationCache(unsigned int capacity = 16);
+
+	bool find(std::vector<StreamConfiguration> &config, Result *result);
+	void insert(const std::vector<StreamConfiguration> &request,
+		    const std::vector<StreamConfiguration> &config,
+		    const Result &result);
+	void clear();
+
+	unsigned int size();
+
+private:
+	struct Key {
+		StreamConfiguration::Direction direction;
+		PixelFormat pixelFormat;
+		Size size;
+		unsigned int bufferCount;
+		FrameBuffer::Memory memory;
+		unsigned int zslFrames;
+	};
+
+	struct Entry {
+		std::vector<Key> request;
+		std::vector<Key> config;
+		Result result;
+	};
+
+	static std::vector<Key> makeKey(const std::vector<StreamConfiguration> &config);
+	static bool match(const std::vector<Key> &key,
+			  const std::vector<StreamConfiguration> &config);
+
+	Mutex mutex_;
+	unsigned int capacity_;
+	std::list<Entry> entries_;
+};
+
+} /* namespace libcamera */
+
+#endif /* __LIBCAMERA_CONFIGURATION_CACHE_H__ */
@@ -9,14 +9,80 @@
 
 #include <map>
 #include <memory>
+#include <string.h>
+#include <type_traits>
 #include <vector>
 
 #include <libcamera/controls.h>
+#include <libcamera/file_descriptor.h>
+#include <libcamera/span.h>
+
+struct ipa_control_value_entry;
 
 namespace libcamera {
 
 class ByteStreamBuffer;
 
+class ControlListView
+{
+public:
+	ControlListView();
+
+	bool empty() const { return !count_; }
+	std::size_t size() const { return count_; }
+	const ControlInfoMap *infoMap() const { return infoMap_; }
+
+	bool contains(unsigned int id) const;
+	ControlValue get(unsigned int id) const;
+
+	template<typename T>
+	typename std::enable_if<!details::is_span<T>::value, T>::type
+	get(const Control<T> &ctrl) const
+	{
+		T value{};
+
+		const uint8_t *data = find(ctrl.id(), details::control_type<T>::value,
+					   false, nullptr);
+		if (data)
+			memcpy(&value, data, sizeof(value));
+
+		return value;
+	}
+
+	template<typename T>
+	typename std::enable_if<details::is_span<T>::value, T>::type
+	get(const Control<T> &ctrl) const
+	{
+		using V = typename std::remove_cv<typename T::element_type>::type;
+
+		std::size_t count;
+		const uint8_t *data = find(ctrl.id(), details::control_type<V>::value,
+					   true, &count);
+		if (!data)
+			return T{};
+
+		return T{ reinterpret_cast<const V *>(data), count };
+	}
+
+	ControlList toControlList() const;
+
+private:
+	friend class ControlSerializer;
+
+	const struct ipa_control_value_entry *entry(unsigned int id) const;
+	const uint8_t *find(unsigned int id, ControlType type, bool isArray,
+			    std::size_t *count) const;
+
+	std::shared_ptr<const std::vector<uint8_t>> packet_;
+	const ControlIdMap *idmap_;
+	const ControlInfoMap *infoMap_;
+
+	const struct ipa_control_value_entry *entries_;
+	std::size_t count_;
+	const uint8_t *values_;
+	bool sorted_;
+};
+
 class ControlSerializer
 {
 public:
@@ -28,25 +94,56 @@ public:
 	static size_t binarySize(const ControlList &list);
 
 	int serialize(const ControlInfoMap &info, ByteStreamBuffer &buffer);
+	Span<const uint8_t> serialize(const ControlInfoMap &info);
+	FileDescriptor serializeToFd(const ControlInfoMap &info);
 	int serialize(const ControlList &list, ByteStreamBuffer &buffer);
 
+	void setDeltaEncoding(unsigned int keyframeInterval);
+
 	template<typename T>
 	T deserialize(ByteStreamBuffer &buffer);
+	int deserialize(ByteStreamBuffer &buffer, ControlList *list);
 
 private:
+	struct DeltaState {
+		ControlList list;
+		uint32_t sequence;
+		unsigned int deltas;
+	};
+
+	int serializeList(const ControlList &list, unsigned int handle,
+			  uint32_t flags, uint32_t sequence,
+			  ByteStreamBuffer &buffer);
+	static void resetList(ControlList *list, const ControlIdMap &idmap);
+	static bool computeDelta(const ControlList &from, const ControlList &to,
+				 ControlList *delta);
+
+	static std::shared_ptr<const ControlInfoMap::Serialized>
+	serialized(const ControlInfoMap &info);
+	static int writeInfoMap(const ControlInfoMap &info, unsigned int handle,
+				ByteStreamBuffer &buffer);
+
+	int lookupInfoMap(unsigned int handle,
+			  const ControlInfoMap **infoMap) const;
+
 	static size_t binarySize(const ControlValue &value);
 	static size_t binarySize(const ControlRange &range);
 
-	static void store(const ControlValue &value, ByteStreamBuffer &buffer);
-	static void store(const ControlRange &range, ByteStreamBuffer &buffer);
+	static uint8_t *store(const ControlValue &value, uint8_t *data);
+	static uint8_t *store(const ControlRange &range, uint8_t *data);
 
-	template<typename T>
-	T load(ControlType type, ByteStreamBuffer &b);
+	ControlValue loadControlValue(ControlType type, ByteStreamBuffer &buffer,
+				      bool isArray = false, unsigned int count = 1);
+	ControlRange loadControlRange(ControlType type, ByteStreamBuffer &buffer);
 
-	unsigned int serial_;
 	std::vector<std::unique_ptr<ControlId>> controlIds_;
 	std::map<unsigned int, ControlInfoMap> infoMaps_;
 	std::map<const ControlInfoMap *, unsigned int> infoMapHandles_;
+
+	unsigned int keyframeInterval_;
+	std::map<unsigned int, DeltaState> txDeltas_;
+	std::map<unsigned int, DeltaState> rxDeltas_;
+	ControlList rxDelta_;
 };
 
 } /* namespace libcamera */
@@ -12,6 +12,8 @@
 namespace libcamera {
 
 class ControlId;
+class ControlList;
+class ControlValue;
 
 class ControlValidator
 {
@@ -20,6 +22,8 @@ public:
 
 	virtual const std::string &name() const = 0;
 	virtual bool validate(unsigned int id) const = 0;
+	virtual bool validate(unsigned int id, const ControlValue &value) const;
+	virtual bool validate(const ControlList &list) const;
 };
 
 } /* namespace libcamera */
@@ -0,0 +1,59 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * cpu_accounting.h - Per-camera CPU time accounting
+ */
+#ifndef __LIBCAMERA_CPU_ACCOUNTING_H__
+#define __LIBCAMERA_CPU_ACCOUNTING_H__
+
+#include <array>
+#include <stdint.h>
+
+#include <libcamera/camera.h>
+
+namespace libcamera {
+
+class CpuScope
+{
+public:
+	CpuScope(CameraStatistics::CpuComponent component,
+		 Camera *camera = nullptr)
+		: active_(false)
+	{
+		if (enabled_)
+			enter(component, camera);
+	}
+
+	~CpuScope()
+	{
+		if (active_)
+			leave();
+	}
+
+	CpuScope(const CpuScope &) = delete;
+	CpuScope &operator=(const CpuScope &) = delete;
+
+	static bool enabled() { return enabled_; }
+	static Camera *camera();
+	static void setCamera(Camera *camera);
+
+private:
+	static const bool enabled_;
+
+	void enter(CameraStatistics::CpuComponent component, Camera *camera);
+	void leave();
+
+	bool active_;
+	CameraStatistics::CpuComponent component_;
+	Camera *camera_;
+	CpuScope *parent_;
+
+	uint64_t start_;
+	uint64_t children_;
+	std::array<uint64_t, CameraStatistics::CpuComponents> times_;
+};
+
+} /* namespace libcamera */
+
+#endif /* __LIBCAMERA_CPU_ACCOUNTING_H__ */
@@ -0,0 +1,58 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * delayed_controls.h - Helper to deal with controls that take effect with a delay
+ */
+#ifndef __LIBCAMERA_DELAYED_CONTROLS_H__
+#define __LIBCAMERA_DELAYED_CONTROLS_H__
+
+#include <deque>
+#include <map>
+#include <stdint.h>
+#include <utility>
+
+#include <libcamera/controls.h>
+
+namespace libcamera {
+
+class V4L2Device;
+
+class DelayedControls
+{
+public:
+	static constexpr unsigned int HistoryDepth = 16;
+
+	DelayedControls(V4L2Device *device,
+			const std::map<unsigned int, unsigned int> &delays);
+
+	int reset();
+
+	int push(uint32_t frame, const ControlList &controls);
+	void applyControls(uint32_t sequence);
+	ControlList get(uint32_t frame) const;
+
+	unsigned int maxDelay() const { return maxDelay_; }
+
+private:
+	struct ControlState {
+		unsigned int delay;
+		ControlValue initial;
+		std::map<uint32_t, ControlValue> pending;
+		std::deque<std::pair<uint32_t, ControlValue>> history;
+
+		const ControlValue &current() const;
+		const ControlValue &at(uint32_t frame) const;
+	};
+
+	V4L2Device *device_;
+	std::map<unsigned int, ControlState> controls_;
+	unsigned int maxDelay_;
+
+	bool running_;
+	uint32_t sequence_;
+};
+
+} /* namespace libcamera */
+
+#endif /* __LIBCAMERA_DELAYED_CONTROLS_H__ */
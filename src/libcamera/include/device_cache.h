@@ -0,0 +1,75 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * device_cache.h - Persistent cache of media graphs and device formats
+ */
+#ifndef __LIBCAMERA_DEVICE_CACHE_H__
+#define __LIBCAMERA_DEVICE_CACHE_H__
+
+#include <map>
+#include <memory>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include <linux/media.h>
+
+#include "formats.h"
+#include "thread.h"
+
+namespace libcamera {
+
+class DeviceCache
+{
+public:
+	struct Topology {
+		uint64_t version;
+		std::vector<struct media_v2_entity> entities;
+		std::vector<struct media_v2_interface> interfaces;
+		std::vector<struct media_v2_pad> pads;
+		std::vector<struct media_v2_link> links;
+	};
+
+	class Entry
+	{
+	public:
+		Entry();
+
+		const Topology *topology() const;
+		void setTopology(Topology &&topology);
+
+		const ImageFormats *formats(const std::string &key) const;
+		void setFormats(const std::string &key, const ImageFormats &formats);
+
+	private:
+		friend class DeviceCache;
+
+		bool hasTopology_;
+		Topology topology_;
+		std::map<std::string, ImageFormats> formats_;
+		bool dirty_;
+	};
+
+	DeviceCache(const std::string &path);
+
+	const std::string &path() const { return path_; }
+
+	int load();
+	int save();
+
+	std::shared_ptr<Entry> entry(const std::string &key);
+
+	static std::string defaultPath();
+
+private:
+	std::string path_;
+
+	Mutex mutex_;
+	std::map<std::string, std::shared_ptr<Entry>> entries_;
+	std::map<std::string, std::shared_ptr<Entry>> used_;
+};
+
+} /* namespace libcamera */
+
+#endif /* __LIBCAMERA_DEVICE_CACHE_H__ */
@@ -9,12 +9,16 @@
 
 #include <memory>
 #include <string>
+#include <sys/types.h>
 #include <vector>
 
 #include <linux/media.h>
 
+#include <libcamera/signal.h>
+
 namespace libcamera {
 
+class DeviceCache;
 class MediaDevice;
 
 class DeviceMatch
@@ -41,15 +45,24 @@ public:
 	virtual int init() = 0;
 	virtual int enumerate() = 0;
 
+	void setCache(DeviceCache *cache) { cache_ = cache; }
+	void setFilter(dev_t devnum) { filter_ = devnum; }
+
 	std::shared_ptr<MediaDevice> search(const DeviceMatch &dm);
 
+	Signal<> devicesAdded;
+
 protected:
 	std::shared_ptr<MediaDevice> createDevice(const std::string &deviceNode);
+	std::vector<std::shared_ptr<MediaDevice>>
+	createDevices(const std::vector<std::string> &deviceNodes);
 	void addDevice(const std::shared_ptr<MediaDevice> &media);
 	void removeDevice(const std::string &deviceNode);
 
 private:
 	std::vector<std::shared_ptr<MediaDevice>> devices_;
+	DeviceCache *cache_ = nullptr;
+	dev_t filter_ = 0;
 };
 
 } /* namespace libcamera */
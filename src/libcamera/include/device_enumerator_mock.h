@@ -0,0 +1,28 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * device_enumerator_mock.h - Enumerator for simulated media devices
+ */
+#ifndef __LIBCAMERA_DEVICE_ENUMERATOR_MOCK_H__
+#define __LIBCAMERA_DEVICE_ENUMERATOR_MOCK_H__
+
+#include "device_enumerator.h"
+
+namespace libcamera {
+
+class DeviceEnumeratorMock final : public DeviceEnumerator
+{
+public:
+	DeviceEnumeratorMock();
+
+	int init();
+	int enumerate();
+
+private:
+	unsigned int cameras_;
+};
+
+} /* namespace libcamera */
+
+#endif /* __LIBCAMERA_DEVICE_ENUMERATOR_MOCK_H__ */
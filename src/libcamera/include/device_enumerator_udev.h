@@ -7,12 +7,16 @@
 #ifndef __LIBCAMERA_DEVICE_ENUMERATOR_UDEV_H__
 #define __LIBCAMERA_DEVICE_ENUMERATOR_UDEV_H__
 
+#include <chrono>
 #include <list>
 #include <map>
 #include <memory>
 #include <set>
 #include <string>
 #include <sys/types.h>
+#include <vector>
+
+#include <libcamera/timer.h>
 
 #include "device_enumerator.h"
 
@@ -62,12 +66,18 @@ private:
 	std::list<MediaDeviceDeps> pending_;
 	std::map<dev_t, MediaDeviceDeps *> devMap_;
 
+	std::vector<struct udev_device *> events_;
+	std::chrono::steady_clock::time_point eventsDeadline_;
+	Timer settleTimer_;
+	bool devicesAdded_;
+
 	int addUdevDevice(struct udev_device *dev);
 	int populateMediaDevice(const std::shared_ptr<MediaDevice> &media);
 	std::string lookupDeviceNode(dev_t devnum);
 
 	int addV4L2Device(dev_t devnum);
 	void udevNotify(EventNotifier *notifier);
+	void processEvents(Timer *timer);
 };
 
 } /* namespace libcamera */
@@ -0,0 +1,35 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * dma_heap.h - DMA heap memory allocator
+ */
+#ifndef __LIBCAMERA_DMA_HEAP_H__
+#define __LIBCAMERA_DMA_HEAP_H__
+
+#include <stddef.h>
+#include <string>
+#include <vector>
+
+#include <libcamera/file_descriptor.h>
+
+namespace libcamera {
+
+class DmaHeap
+{
+public:
+	DmaHeap(const std::vector<std::string> &names);
+
+	bool isValid() const { return handle_.isValid(); }
+	const std::string &name() const { return name_; }
+
+	FileDescriptor alloc(size_t size);
+
+private:
+	FileDescriptor handle_;
+	std::string name_;
+};
+
+} /* namespace libcamera */
+
+#endif /* __LIBCAMERA_DMA_HEAP_H__ */
@@ -0,0 +1,89 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * event_dispatcher_epoll.h - Epoll-based event dispatcher
+ */
+#ifndef __LIBCAMERA_EVENT_DISPATCHER_EPOLL_H__
+#define __LIBCAMERA_EVENT_DISPATCHER_EPOLL_H__
+
+#include <array>
+#include <map>
+#include <stdint.h>
+#include <sys/epoll.h>
+
+#include <libcamera/event_dispatcher.h>
+
+#include "timer_queue.h"
+#include "utils.h"
+
+namespace libcamera {
+
+class EventNotifier;
+class Timer;
+
+class EventDispatcherEpoll final : public EventDispatcher
+{
+public:
+	EventDispatcherEpoll();
+	~EventDispatcherEpoll();
+
+	void registerEventNotifier(EventNotifier *notifier);
+	void unregisterEventNotifier(EventNotifier *notifier);
+
+	void registerTimer(Timer *timer);
+	void unregisterTimer(Timer *timer);
+
+	void processEvents();
+	void interrupt();
+
+	const TimerQueue &timers() const { return timers_; }
+
+	void setBusyPoll(utils::duration window);
+	utils::duration busyPoll() const { return busyPollWindow_; }
+
+private:
+	static constexpr unsigned int MaxEvents = 32;
+
+	struct EventNotifierSetEpoll {
+		uint32_t events() const;
+		EventNotifier *notifiers[3];
+
+		/* Arrival period of read events, for busy polling. */
+		utils::time_point lastEvent;
+		utils::duration interval;
+		unsigned int stableIntervals;
+	};
+
+	std::map<int, EventNotifierSetEpoll> notifiers_;
+	TimerQueue timers_;
+	int epollfd_;
+	int eventfd_;
+	int timerfd_;
+	utils::time_point timerfdDeadline_;
+
+	bool processingEvents_;
+
+	std::array<struct epoll_event, MaxEvents> events_;
+
+	utils::duration busyPollWindow_;
+	utils::duration wakeupLatency_;
+	utils::duration spinTime_;
+	bool blocking_;
+	utils::duration timerSlack_;
+
+	int update(int fd, uint32_t oldEvents, uint32_t newEvents);
+	int poll(bool block);
+	bool predictArrival(utils::time_point now, utils::time_point *arrival) const;
+	int spin(utils::time_point end);
+	void recordArrival(EventNotifierSetEpoll &set, utils::time_point now);
+	void setTimerSlack(utils::duration slack);
+	void armTimer(utils::time_point deadline);
+	void processInterrupt();
+	void processNotifiers(unsigned int count);
+	void processTimers();
+};
+
+} /* namespace libcamera */
+
+#endif /* __LIBCAMERA_EVENT_DISPATCHER_EPOLL_H__ */
@@ -7,12 +7,13 @@
 #ifndef __LIBCAMERA_EVENT_DISPATCHER_POLL_H__
 #define __LIBCAMERA_EVENT_DISPATCHER_POLL_H__
 
-#include <list>
 #include <map>
 #include <vector>
 
 #include <libcamera/event_dispatcher.h>
 
+#include "timer_queue.h"
+
 struct pollfd;
 
 namespace libcamera {
@@ -35,6 +36,8 @@ public:
 	void processEvents();
 	void interrupt();
 
+	const TimerQueue &timers() const { return timers_; }
+
 private:
 	struct EventNotifierSetPoll {
 		short events() const;
@@ -42,12 +45,12 @@ private:
 	};
 
 	std::map<int, EventNotifierSetPoll> notifiers_;
-	std::list<Timer *> timers_;
+	TimerQueue timers_;
 	int eventfd_;
 
 	bool processingEvents_;
 
-	int poll(std::vector<struct pollfd> *pollfds);
+	int poll(std::vector<struct pollfd> *pollfds, bool block);
 	void processInterrupt(const struct pollfd &pfd);
 	void processNotifiers(const std::vector<struct pollfd> &pollfds);
 	void processTimers();
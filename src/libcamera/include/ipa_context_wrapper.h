@@ -7,6 +7,8 @@
 #ifndef __LIBCAMERA_IPA_CONTEXT_WRAPPER_H__
 #define __LIBCAMERA_IPA_CONTEXT_WRAPPER_H__
 
+#include <vector>
+
 #include <ipa/ipa_interface.h>
 
 #include "control_serializer.h"
@@ -40,6 +42,11 @@ private:
 	IPAInterface *intf_;
 
 	ControlSerializer serializer_;
+
+	std::vector<uint8_t> eventData_;
+	std::vector<struct ipa_control_list> eventLists_;
+	IPAOperationData action_;
+	bool actionBusy_;
 };
 
 } /* namespace libcamera */
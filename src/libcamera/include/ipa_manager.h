@@ -13,6 +13,7 @@
 #include <ipa/ipa_module_info.h>
 
 #include "ipa_module.h"
+#include "ipa_module_cache.h"
 #include "pipeline_handler.h"
 
 namespace libcamera {
@@ -32,7 +33,7 @@ private:
 	IPAManager();
 	~IPAManager();
 
-	int addDir(const char *libDir);
+	int addDir(const char *libDir, IPAModuleCache *cache);
 };
 
 } /* namespace libcamera */
@@ -20,6 +20,7 @@ class IPAModule
 {
 public:
 	explicit IPAModule(const std::string &libPath);
+	IPAModule(const std::string &libPath, const struct IPAModuleInfo &info);
 	~IPAModule();
 
 	bool isValid() const;
@@ -0,0 +1,53 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * ipa_module_cache.h - Image Processing Algorithm module discovery cache
+ */
+#ifndef __LIBCAMERA_IPA_MODULE_CACHE_H__
+#define __LIBCAMERA_IPA_MODULE_CACHE_H__
+
+#include <map>
+#include <stdint.h>
+#include <string>
+#include <sys/stat.h>
+
+#include <ipa/ipa_module_info.h>
+
+namespace libcamera {
+
+class IPAModuleCache
+{
+public:
+	IPAModuleCache(const std::string &path);
+
+	const std::string &path() const { return path_; }
+
+	int load();
+	int save();
+
+	const struct IPAModuleInfo *find(const std::string &libPath,
+					 const struct stat &st);
+	void add(const std::string &libPath, const struct stat &st,
+		 const struct IPAModuleInfo &info);
+
+	static std::string defaultPath();
+
+private:
+	struct Entry {
+		uint64_t mtime;
+		uint64_t size;
+		struct IPAModuleInfo info;
+		bool used;
+	};
+
+	static uint64_t mtime(const struct stat &st);
+
+	std::string path_;
+	std::map<std::string, Entry> entries_;
+	bool dirty_;
+};
+
+} /* namespace libcamera */
+
+#endif /* __LIBCAMERA_IPA_MODULE_CACHE_H__ */
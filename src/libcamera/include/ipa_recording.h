@@ -0,0 +1,93 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * ipa_recording.h - Recording of IPA statistics for offline replay
+ */
+#ifndef __LIBCAMERA_IPA_RECORDING_H__
+#define __LIBCAMERA_IPA_RECORDING_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+
+#include <ipa/ipa_interface.h>
+#include <libcamera/controls.h>
+#include <libcamera/span.h>
+
+#include "control_serializer.h"
+
+namespace libcamera {
+
+struct IPARecordingFrame {
+	uint32_t sequence;
+	uint64_t timestamp;
+	Span<const uint8_t> stats;
+	ControlList sensorControls;
+};
+
+class IPARecordingWriter
+{
+public:
+	IPARecordingWriter();
+	~IPARecordingWriter();
+
+	int open(const std::string &path, const IPAStream &stream,
+		 const ControlInfoMap &sensorControls);
+	void close();
+	bool isOpen() const { return fd_ != -1; }
+
+	int write(uint32_t sequence, uint64_t timestamp,
+		  Span<const uint8_t> stats, const ControlList &sensorControls);
+
+	unsigned int frames() const { return frames_; }
+
+private:
+	IPARecordingWriter(const IPARecordingWriter &) = delete;
+	IPARecordingWriter &operator=(const IPARecordingWriter &) = delete;
+
+	uint8_t *reserve(size_t size);
+
+	ControlSerializer serializer_;
+
+	int fd_;
+	uint8_t *mem_;
+	size_t capacity_;
+	size_t size_;
+	unsigned int frames_;
+};
+
+class IPARecordingReader
+{
+public:
+	IPARecordingReader();
+	~IPARecordingReader();
+
+	int open(const std::string &path);
+	void close();
+	bool isOpen() const { return mem_ != nullptr; }
+
+	const IPAStream &stream() const { return stream_; }
+	const ControlInfoMap &sensorControls() const { return sensorControls_; }
+
+	int next(IPARecordingFrame *frame);
+	void rewind();
+
+private:
+	IPARecordingReader(const IPARecordingReader &) = delete;
+	IPARecordingReader &operator=(const IPARecordingReader &) = delete;
+
+	ControlSerializer serializer_;
+
+	const uint8_t *mem_;
+	size_t size_;
+	size_t dataOffset_;
+	size_t offset_;
+
+	IPAStream stream_;
+	ControlInfoMap sensorControls_;
+};
+
+} /* namespace libcamera */
+
+#endif /* __LIBCAMERA_IPA_RECORDING_H__ */
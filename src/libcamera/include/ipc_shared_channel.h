@@ -0,0 +1,60 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * ipc_shared_channel.h - IPC channel based on shared memory rings
+ */
+#ifndef __LIBCAMERA_IPC_SHARED_CHANNEL_H__
+#define __LIBCAMERA_IPC_SHARED_CHANNEL_H__
+
+#include <deque>
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+#include <libcamera/signal.h>
+#include <libcamera/span.h>
+
+#include "ipc_shared_ring.h"
+#include "ipc_unixsocket.h"
+
+namespace libcamera {
+
+class IPCSharedChannel
+{
+public:
+	IPCSharedChannel();
+	~IPCSharedChannel();
+
+	int create(size_t size, std::vector<int> *fds);
+	int bind(const std::vector<int> &fds);
+	void close();
+	bool isBound() const { return socket_.isBound(); }
+
+	Span<uint8_t> reserve(size_t size);
+	int commit(const std::vector<int32_t> &fds = {});
+
+	int receive(Span<const uint8_t> *data, std::vector<int32_t> *fds);
+	void release();
+
+	Signal<IPCSharedChannel *> readyRead;
+	Signal<IPCSharedChannel *> disconnected;
+
+private:
+	IPCSharedChannel(const IPCSharedChannel &) = delete;
+	IPCSharedChannel &operator=(const IPCSharedChannel &) = delete;
+
+	void doorbell(IPCUnixSocket *socket);
+
+	IPCUnixSocket socket_;
+	IPCUnixSocket::Payload doorbell_;
+	IPCSharedRing tx_;
+	IPCSharedRing rx_;
+	uint8_t *pending_;
+
+	std::deque<int32_t> fds_;
+};
+
+} /* namespace libcamera */
+
+#endif /* __LIBCAMERA_IPC_SHARED_CHANNEL_H__ */
@@ -0,0 +1,62 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * ipc_shared_ring.h - Shared memory ring buffer for IPC
+ */
+#ifndef __LIBCAMERA_IPC_SHARED_RING_H__
+#define __LIBCAMERA_IPC_SHARED_RING_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <libcamera/span.h>
+
+namespace libcamera {
+
+class IPCSharedRing
+{
+public:
+	IPCSharedRing();
+	~IPCSharedRing();
+
+	int create(size_t size);
+	int bind(int fd);
+	void close();
+	bool isBound() const { return header_ != nullptr; }
+
+	int fd() const { return fd_; }
+	size_t capacity() const { return size_; }
+
+	Span<uint8_t> reserve(size_t size);
+	bool commit();
+
+	Span<const uint8_t> front();
+	void pop();
+	bool sleep();
+
+private:
+	struct Header;
+
+	IPCSharedRing(const IPCSharedRing &) = delete;
+	IPCSharedRing &operator=(const IPCSharedRing &) = delete;
+
+	int map(int fd, size_t length);
+
+	int fd_;
+	void *mem_;
+	size_t length_;
+
+	Header *header_;
+	uint8_t *data_;
+	uint32_t size_;
+
+	bool reserved_;
+	uint32_t reservedEnd_;
+	bool front_;
+	uint32_t frontEnd_;
+};
+
+} /* namespace libcamera */
+
+#endif /* __LIBCAMERA_IPC_SHARED_RING_H__ */
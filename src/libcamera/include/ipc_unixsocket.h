@@ -24,13 +24,19 @@ public:
 		std::vector<int32_t> fds;
 	};
 
+	enum Type {
+		Datagram,
+		SeqPacket,
+	};
+
 	IPCUnixSocket();
 	~IPCUnixSocket();
 
-	int create();
+	int create(Type type = Datagram);
 	int bind(int fd);
 	void close();
 	bool isBound() const;
+	Type type() const { return type_; }
 
 	int send(const Payload &payload);
 	int receive(Payload *payload);
@@ -43,15 +49,24 @@ private:
 		uint8_t fds;
 	};
 
+	static constexpr size_t MaxPacketSize = 128 * 1024;
+	static constexpr unsigned int MaxPacketFds = 255;
+
 	int sendData(const void *buffer, size_t length, const int32_t *fds, unsigned int num);
 	int recvData(void *buffer, size_t length, int32_t *fds, unsigned int num);
+	int sendPacket(const Payload &payload);
+	int recvPacket(Payload *payload);
 
 	void dataNotifier(EventNotifier *notifier);
 
 	int fd_;
+	Type type_;
 	bool headerReceived_;
 	struct Header header_;
 	EventNotifier *notifier_;
+
+	std::vector<uint8_t> packet_;
+	std::vector<uint8_t> control_;
 };
 
 } /* namespace libcamera */
@@ -7,8 +7,10 @@
 #ifndef __LIBCAMERA_LOG_H__
 #define __LIBCAMERA_LOG_H__
 
+#include <atomic>
 #include <chrono>
 #include <sstream>
+#include <stdint.h>
 
 #include "utils.h"
 
@@ -31,6 +33,7 @@ public:
 
 	const char *name() const { return name_; }
 	LogSeverity severity() const { return severity_; }
+	LogSeverity threshold() const { return threshold_; }
 	void setSeverity(LogSeverity severity);
 
 	static const LogCategory &defaultCategory();
@@ -38,6 +41,7 @@ public:
 private:
 	const char *name_;
 	LogSeverity severity_;
+	LogSeverity threshold_;
 };
 
 #define LOG_DECLARE_CATEGORY(name)					\
@@ -66,7 +70,9 @@ public:
 	const utils::time_point &timestamp() const { return timestamp_; }
 	LogSeverity severity() const { return severity_; }
 	const LogCategory &category() const { return category_; }
-	const std::string &fileInfo() const { return fileInfo_; }
+	const char *fileName() const { return fileName_; }
+	unsigned int line() const { return line_; }
+	std::string fileInfo() const;
 	const std::string msg() const { return msgStream_.str(); }
 
 private:
@@ -76,7 +82,8 @@ private:
 	const LogCategory &category_;
 	LogSeverity severity_;
 	utils::time_point timestamp_;
-	std::string fileInfo_;
+	const char *fileName_;
+	unsigned int line_;
 };
 
 class Loggable
@@ -85,25 +92,90 @@ public:
 	virtual ~Loggable();
 
 protected:
+	Loggable();
+
 	virtual std::string logPrefix() const = 0;
+	void invalidateLogPrefix();
 
 	LogMessage _log(const char *file, unsigned int line,
 			LogSeverity severity) const;
 	LogMessage _log(const char *file, unsigned int line,
 			const LogCategory &category,
 			LogSeverity severity) const;
+
+private:
+	const std::string &cachedLogPrefix() const;
+
+	mutable std::string prefix_;
+	mutable bool prefixValid_;
 };
 
 LogMessage _log(const char *file, unsigned int line, LogSeverity severity);
 LogMessage _log(const char *file, unsigned int line,
 		const LogCategory &category, LogSeverity severity);
 
+class LogRateLimiter
+{
+public:
+	LogRateLimiter(unsigned int burst = 10,
+		       std::chrono::milliseconds interval = std::chrono::seconds(5));
+
+	bool allow(const char *file, unsigned int line,
+		   const LogCategory &category, LogSeverity severity);
+
+private:
+	const unsigned int burst_;
+	const int64_t interval_;
+
+	std::atomic<int64_t> windowStart_;
+	std::atomic<unsigned int> count_;
+	std::atomic<unsigned int> suppressed_;
+};
+
+class LogOnce
+{
+public:
+	LogOnce()
+		: done_(false)
+	{
+	}
+
+	bool allow(const char *file, unsigned int line,
+		   const LogCategory &category, LogSeverity severity)
+	{
+		return !done_.exchange(true, std::memory_order_relaxed);
+	}
+
+private:
+	std::atomic<bool> done_;
+};
+
 #ifndef __DOXYGEN__
 #define _LOG_CATEGORY(name) logCategory##name
 
+/*
+ * Check the category threshold before creating the LogMessage, to skip the
+ * message construction and the evaluation of the stream operands when the
+ * message would be discarded. The conditional operator keeps the macro a single
+ * expression, and the & operator of LogVoidify, which has a lower precedence
+ * than <<, turns the stream into a void expression after all operands have
+ * been streamed.
+ */
+class LogVoidify
+{
+public:
+	void operator&(std::ostream &) {}
+};
+
+#define _LOG_FILTER(category, level) \
+	(Log##level < (category).threshold()) ? static_cast<void>(0) : \
+	LogVoidify() &
+
 #define _LOG1(severity) \
+	_LOG_FILTER(LogCategory::defaultCategory(), severity) \
 	_log(__FILE__, __LINE__, Log##severity).stream()
 #define _LOG2(category, severity) \
+	_LOG_FILTER(_LOG_CATEGORY(category)(), severity) \
 	_log(__FILE__, __LINE__, _LOG_CATEGORY(category)(), Log##severity).stream()
 
 /*
@@ -112,8 +184,37 @@ LogMessage _log(const char *file, unsigned int line,
  */
 #define _LOG_MACRO(_1, _2, NAME, ...) NAME
 #define LOG(...) _LOG_MACRO(__VA_ARGS__, _LOG2, _LOG1)(__VA_ARGS__)
+
+/*
+ * The limiter is a static variable local to a statement expression, giving
+ * each call site its own state. It is only consulted for messages that pass
+ * the category threshold, including messages only kept by the flight recorder,
+ * and only once per message.
+ */
+#define _LOG_LIMIT(category, level, type) \
+	(Log##level < (category).threshold() || \
+	 !({ static type _limiter; &_limiter; })->allow(__FILE__, __LINE__, \
+							(category), Log##level)) ? \
+	static_cast<void>(0) : \
+	LogVoidify() & _log(__FILE__, __LINE__, (category), Log##level).stream()
+
+#define _LOG_RATELIMITED1(severity) \
+	_LOG_LIMIT(LogCategory::defaultCategory(), severity, LogRateLimiter)
+#define _LOG_RATELIMITED2(category, severity) \
+	_LOG_LIMIT(_LOG_CATEGORY(category)(), severity, LogRateLimiter)
+#define _LOG_ONCE1(severity) \
+	_LOG_LIMIT(LogCategory::defaultCategory(), severity, LogOnce)
+#define _LOG_ONCE2(category, severity) \
+	_LOG_LIMIT(_LOG_CATEGORY(category)(), severity, LogOnce)
+
+#define LOG_RATELIMITED(...) \
+	_LOG_MACRO(__VA_ARGS__, _LOG_RATELIMITED2, _LOG_RATELIMITED1)(__VA_ARGS__)
+#define LOG_ONCE(...) \
+	_LOG_MACRO(__VA_ARGS__, _LOG_ONCE2, _LOG_ONCE1)(__VA_ARGS__)
 #else /* __DOXYGEN___ */
 #define LOG(category, severity)
+#define LOG_RATELIMITED(category, severity)
+#define LOG_ONCE(category, severity)
 #endif /* __DOXYGEN__ */
 
 #ifndef NDEBUG
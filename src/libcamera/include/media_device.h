@@ -7,19 +7,26 @@
 #ifndef __LIBCAMERA_MEDIA_DEVICE_H__
 #define __LIBCAMERA_MEDIA_DEVICE_H__
 
+#include <functional>
 #include <map>
+#include <memory>
+#include <set>
 #include <sstream>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
 #include <linux/media.h>
 
 #include <libcamera/signal.h>
 
+#include "device_cache.h"
 #include "media_object.h"
 
 namespace libcamera {
 
+class MediaRequest;
+
 class MediaDevice
 {
 public:
@@ -28,14 +35,20 @@ public:
 
 	bool acquire();
 	void release();
-	bool busy() const { return acquired_; }
+	bool busy() const;
 
 	bool lock();
 	void unlock();
 
-	int populate();
+	std::unique_ptr<MediaRequest> allocateRequest();
+
+	int populate(DeviceCache *cache = nullptr);
+	int populate(const struct media_device_info &info,
+		     const struct media_v2_topology &topology);
 	bool valid() const { return valid_; }
 
+	DeviceCache::Entry *cacheEntry() const { return cacheEntry_.get(); }
+
 	const std::string driver() const { return driver_; }
 	const std::string deviceNode() const { return deviceNode_; }
 	const std::string model() const { return model_; }
@@ -48,6 +61,14 @@ public:
 	MediaLink *link(const MediaEntity *source, unsigned int sourceIdx,
 			const MediaEntity *sink, unsigned int sinkIdx);
 	MediaLink *link(const MediaPad *source, const MediaPad *sink);
+
+	std::vector<MediaLink *> findPath(const MediaEntity *source,
+					  const MediaEntity *sink) const;
+	std::vector<MediaLink *>
+	findPath(const MediaEntity *source,
+		 const std::function<bool(const MediaEntity *)> &match) const;
+
+	int setupLinks(const std::set<MediaLink *> &enabled);
 	int disableLinks();
 
 	Signal<MediaDevice *> disconnected;
@@ -60,8 +81,14 @@ private:
 
 	int fd_;
 	bool valid_;
+	bool simulated_;
+
+	mutable Mutex mutex_;
 	bool acquired_;
 	bool lockOwner_;
+	bool linksCached_;
+
+	std::shared_ptr<DeviceCache::Entry> cacheEntry_;
 
 	int open();
 	void close();
@@ -72,6 +99,7 @@ private:
 	void clear();
 
 	std::vector<MediaEntity *> entities_;
+	std::unordered_map<std::string, MediaEntity *> entitiesByName_;
 
 	struct media_v2_interface *findInterface(const struct media_v2_topology &topology,
 						 unsigned int entityId);
@@ -79,6 +107,7 @@ private:
 	bool populatePads(const struct media_v2_topology &topology);
 	bool populateLinks(const struct media_v2_topology &topology);
 	void fixupEntityFlags(struct media_v2_entity *entity);
+	int syncLinks();
 
 	friend int MediaLink::setEnabled(bool enable);
 	int setupLink(const MediaLink *link, unsigned int flags);
@@ -21,7 +21,7 @@ class MediaPad;
 class MediaObject
 {
 public:
-	MediaDevice *device() { return dev_; }
+	MediaDevice *device() const { return dev_; }
 	unsigned int id() const { return id_; }
 
 protected:
@@ -0,0 +1,43 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * media_request.h - Media device request
+ */
+#ifndef __LIBCAMERA_MEDIA_REQUEST_H__
+#define __LIBCAMERA_MEDIA_REQUEST_H__
+
+#include <libcamera/signal.h>
+
+namespace libcamera {
+
+class EventNotifier;
+
+class MediaRequest
+{
+public:
+	MediaRequest(int fd);
+	~MediaRequest();
+
+	MediaRequest(const MediaRequest &) = delete;
+	MediaRequest &operator=(const MediaRequest &) = delete;
+
+	int fd() const { return fd_; }
+	bool queued() const { return queued_; }
+
+	int queue();
+	int reinit();
+
+	Signal<MediaRequest *> completed;
+
+private:
+	void requestCompleted(EventNotifier *notifier);
+
+	int fd_;
+	bool queued_;
+	EventNotifier *notifier_;
+};
+
+} /* namespace libcamera */
+
+#endif /* __LIBCAMERA_MEDIA_REQUEST_H__ */
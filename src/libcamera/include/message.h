@@ -11,6 +11,8 @@
 
 #include <libcamera/bound_method.h>
 
+#include "utils.h"
+
 namespace libcamera {
 
 class BoundMethodBase;
@@ -25,22 +27,35 @@ public:
 		None = 0,
 		InvokeMessage = 1,
 		ThreadMoveMessage = 2,
+		DeferredDelete = 3,
 		UserMessage = 1000,
 	};
 
 	Message(Type type);
 	virtual ~Message();
 
+	static void *operator new(std::size_t size) { return MessagePool::allocate(size); }
+	static void operator delete(void *ptr) { MessagePool::release(ptr); }
+
 	Type type() const { return type_; }
 	Object *receiver() const { return receiver_; }
 
+	MessagePriority priority() const { return priority_; }
+	void setPriority(MessagePriority priority) { priority_ = priority; }
+
 	static Type registerMessageType();
 
 private:
+	friend class MessageQueue;
 	friend class Thread;
 
 	Type type_;
+	MessagePriority priority_;
 	Object *receiver_;
+	Message *next_;
+	Message *prev_;
+	Message *receiverNext_;
+	utils::time_point posted_;
 
 	static std::atomic_uint nextUserType_;
 };
@@ -63,6 +78,7 @@ private:
 	std::shared_ptr<BoundMethodPackBase> pack_;
 	Semaphore *semaphore_;
 	bool deleteMethod_;
+	bool invoked_;
 };
 
 } /* namespace libcamera */
@@ -7,9 +7,11 @@
 #ifndef __LIBCAMERA_PIPELINE_HANDLER_H__
 #define __LIBCAMERA_PIPELINE_HANDLER_H__
 
+#include <functional>
 #include <list>
 #include <map>
 #include <memory>
+#include <queue>
 #include <set>
 #include <string>
 #include <sys/types.h>
@@ -17,25 +19,36 @@
 
 #include <ipa/ipa_interface.h>
 #include <libcamera/controls.h>
+#include <libcamera/object.h>
+#include <libcamera/span.h>
 #include <libcamera/stream.h>
+#include <libcamera/timer.h>
+
+#include "utils.h"
 
 namespace libcamera {
 
+class BufferPoolUsage;
 class Camera;
 class CameraConfiguration;
 class CameraManager;
+class CameraStall;
 class DeviceEnumerator;
 class DeviceMatch;
 class FrameBuffer;
 class MediaDevice;
 class PipelineHandler;
 class Request;
+class Thread;
 
 class CameraData
 {
 public:
 	explicit CameraData(PipelineHandler *pipe)
-		: pipe_(pipe)
+		: pipe_(pipe), deviceRequests_(0), frameInterval_(0),
+		  stalled_(false), paused_(false), resuming_(false),
+		  frameIndex_(0), latestFrames_(false), latest_(nullptr),
+		  sparesQueued_(0)
 	{
 	}
 	virtual ~CameraData() {}
@@ -43,20 +56,42 @@ public:
 	Camera *camera_;
 	PipelineHandler *pipe_;
 	std::list<Request *> queuedRequests_;
+	std::queue<Request *> waitingRequests_;
+	unsigned int deviceRequests_;
 	ControlInfoMap controlInfo_;
 	std::unique_ptr<IPAInterface> ipa_;
+	utils::duration frameInterval_;
 
 private:
 	CameraData(const CameraData &) = delete;
 	CameraData &operator=(const CameraData &) = delete;
+
+	friend class PipelineHandler;
+	Timer watchdog_;
+	utils::time_point lastBuffer_;
+	bool stalled_;
+	Timer targetTimer_;
+	Timer idleTimer_;
+	bool paused_;
+	bool resuming_;
+	utils::time_point resumeTime_;
+	unsigned int frameIndex_;
+	bool latestFrames_;
+	std::vector<Request *> spares_;
+	Request *latest_;
+	unsigned int sparesQueued_;
 };
 
-class PipelineHandler : public std::enable_shared_from_this<PipelineHandler>
+class PipelineHandler : public std::enable_shared_from_this<PipelineHandler>,
+			public Object
 {
 public:
 	PipelineHandler(CameraManager *manager);
 	virtual ~PipelineHandler();
 
+	int createThread(const std::vector<unsigned int> &cpus);
+	bool hasThread() const { return handlerThread_ != nullptr; }
+
 	virtual bool match(DeviceEnumerator *enumerator) = 0;
 	MediaDevice *acquireMediaDevice(DeviceEnumerator *enumerator,
 					const DeviceMatch &dm);
@@ -64,6 +99,8 @@ public:
 	bool lock();
 	void unlock();
 
+	virtual int acquire(Camera *camera);
+
 	const ControlInfoMap &controls(Camera *camera);
 
 	virtual CameraConfiguration *generateConfiguration(Camera *camera,
@@ -74,15 +111,26 @@ public:
 				       std::vector<std::unique_ptr<FrameBuffer>> *buffers) = 0;
 	virtual int importFrameBuffers(Camera *camera, Stream *stream) = 0;
 	virtual void freeFrameBuffers(Camera *camera, Stream *stream) = 0;
+	virtual int addFrameBuffers(Camera *camera, Stream *stream,
+				    unsigned int count,
+				    std::vector<std::unique_ptr<FrameBuffer>> *buffers);
+	virtual void bufferUsage(const Camera *camera,
+				 std::vector<BufferPoolUsage> *pools);
+	virtual void stallReport(const Camera *camera, CameraStall *stall);
 
 	virtual int start(Camera *camera) = 0;
-	virtual void stop(Camera *camera) = 0;
+	void stop(Camera *camera);
+	virtual void release(Camera *camera);
 
 	int queueRequest(Camera *camera, Request *request);
+	void queueRequests(Camera *camera, Span<Request *const> requests);
 
 	bool completeBuffer(Camera *camera, Request *request,
 			    FrameBuffer *buffer);
 	void completeRequest(Camera *camera, Request *request);
+	void cancelRequest(Camera *camera, Request *request);
+	void statisticsSkipped(Camera *camera);
+	void ipaCompleted(Request *request);
 
 	const char *name() const { return name_; }
 
@@ -92,12 +140,46 @@ protected:
 	void hotplugMediaDevice(MediaDevice *media);
 
 	virtual int queueRequestDevice(Camera *camera, Request *request) = 0;
+	virtual unsigned int queueRequestsDevice(Camera *camera,
+						 Span<Request *const> requests);
+	virtual void stopDevice(Camera *camera) = 0;
+	virtual int recoverDevice(Camera *camera);
+	virtual int pauseDevice(Camera *camera);
+	virtual int resumeDevice(Camera *camera);
+	virtual utils::time_point targetQueueTime(Camera *camera,
+						  utils::time_point target);
 
 	CameraData *cameraData(const Camera *camera);
 
 	CameraManager *manager_;
 
 private:
+	static void destroy(PipelineHandler *handler);
+
+	void doQueueRequests(Camera *camera);
+	void queueDeviceBatch(Camera *camera, Span<Request *const> requests);
+	void completeQueuedRequests(Camera *camera);
+
+	void watchdogStart(CameraData *data);
+	void watchdogTimeout(Timer *timer);
+
+	bool requestDue(CameraData *data, Request *request);
+	void targetTimeout(Timer *timer);
+
+	void idleStart(CameraData *data);
+	void idleTimeout(Timer *timer);
+	int idleResume(Camera *camera);
+
+	void queueSubmittedRequests(Camera *camera, bool close);
+	void runCameraOperation(std::function<void()> operation);
+
+	void setSpareRequests(Camera *camera, Span<Request *const> spares);
+	bool spareCompatible(const Request *request, const Request *spare) const;
+	Request *takeLatest(CameraData *data, const Request *request);
+	void completeFromSpare(Camera *camera, Request *request, Request *spare);
+	void completeSpareRequest(Camera *camera, Request *spare);
+	void queueSpares(Camera *camera);
+
 	void mediaDeviceDisconnected(MediaDevice *media);
 	virtual void disconnect();
 
@@ -106,7 +188,10 @@ private:
 	std::map<const Camera *, std::unique_ptr<CameraData>> cameraData_;
 
 	const char *name_;
+	std::unique_ptr<Thread> handlerThread_;
+	unsigned int idleFrames_;
 
+	friend class Camera;
 	friend class PipelineHandlerFactory;
 };
 
@@ -7,9 +7,8 @@
 #ifndef __LIBCAMERA_SEMAPHORE_H__
 #define __LIBCAMERA_SEMAPHORE_H__
 
-#include <condition_variable>
-
-#include "thread.h"
+#include <atomic>
+#include <stdint.h>
 
 namespace libcamera {
 
@@ -24,9 +23,7 @@ public:
 	void release(unsigned int n = 1);
 
 private:
-	Mutex mutex_;
-	std::condition_variable cv_;
-	unsigned int available_;
+	std::atomic<uint32_t> value_;
 };
 
 } /* namespace libcamera */
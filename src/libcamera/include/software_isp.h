@@ -0,0 +1,152 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * software_isp.h - CPU image processing for raw Bayer sensors
+ */
+#ifndef __LIBCAMERA_SOFTWARE_ISP_H__
+#define __LIBCAMERA_SOFTWARE_ISP_H__
+
+#include <array>
+#include <atomic>
+#include <memory>
+#include <queue>
+#include <stdint.h>
+#include <vector>
+
+#include <libcamera/geometry.h>
+#include <libcamera/mapped_framebuffer.h>
+#include <libcamera/object.h>
+#include <libcamera/pixelformats.h>
+#include <libcamera/raw_unpacker.h>
+#include <libcamera/signal.h>
+
+#include "thread.h"
+#include "utils.h"
+#include "worker_pool.h"
+
+namespace libcamera {
+
+class FrameBuffer;
+struct StreamConfiguration;
+
+struct SoftwareIspParams {
+	SoftwareIspParams();
+
+	uint16_t blackLevel;
+	std::array<double, 3> gains;
+	double gamma;
+};
+
+struct SoftwareIspStats {
+	static constexpr unsigned int GridWidth = 16;
+	static constexpr unsigned int GridHeight = 12;
+
+	std::array<uint64_t, 3> sums;
+	std::array<uint64_t, 3> counts;
+	unsigned int bitDepth;
+	std::array<uint8_t, GridWidth * GridHeight> luminance;
+	utils::duration processingTime;
+};
+
+class SoftwareIsp : public Object
+{
+public:
+	SoftwareIsp(unsigned int threads = 0);
+	~SoftwareIsp();
+
+	static std::vector<PixelFormat> formats(uint32_t input);
+
+	int configure(const StreamConfiguration &inputCfg,
+		      unsigned int inputStride,
+		      const StreamConfiguration &outputCfg);
+	int exportBuffers(unsigned int count,
+			  std::vector<std::unique_ptr<FrameBuffer>> *buffers);
+
+	void setParams(const SoftwareIspParams &params);
+
+	int start();
+	void stop();
+
+	int queueBuffers(FrameBuffer *input, FrameBuffer *output);
+
+	Signal<FrameBuffer *> inputBufferReady;
+	Signal<FrameBuffer *, const SoftwareIspStats &> statsReady;
+	Signal<FrameBuffer *> outputBufferReady;
+
+private:
+	class Worker;
+
+	struct Stripe {
+		unsigned int start;
+		unsigned int end;
+
+		std::array<std::vector<uint16_t>, 4> lines;
+		std::array<std::vector<uint16_t>, 6> rgb;
+		std::vector<uint16_t> unpacked;
+
+		std::array<uint64_t, 3> sums;
+		std::array<uint64_t, SoftwareIspStats::GridWidth *
+				     SoftwareIspStats::GridHeight> zones;
+	};
+
+	struct Frame {
+		const uint8_t *src;
+		std::array<uint8_t *, 2> dst;
+		std::array<unsigned int, 2> strides;
+	};
+
+	struct Result {
+		FrameBuffer *input;
+		FrameBuffer *output;
+		SoftwareIspStats stats;
+	};
+
+	void process(FrameBuffer *input, FrameBuffer *output);
+	int processFrame(FrameBuffer *input, FrameBuffer *output,
+			 SoftwareIspStats *stats);
+	void processStripe(Stripe &stripe, const Frame &frame);
+	void linearizeLine(Stripe &stripe, const Frame &frame, int line);
+	void demosaicLine(const Stripe &stripe, unsigned int line,
+			  uint16_t *r, uint16_t *g, uint16_t *b) const;
+	void outputLines(Stripe &stripe, const Frame &frame,
+			 unsigned int line);
+	void updateTables();
+	void complete();
+
+	std::unique_ptr<Worker> worker_;
+	Thread thread_;
+	WorkerPool pool_;
+
+	uint32_t inputFormat_;
+	unsigned int bayerOrder_;
+	unsigned int bitDepth_;
+	unsigned int packing_;
+	Size size_;
+	unsigned int inputStride_;
+	PixelFormat outputFormat_;
+	const PixelFormatInfo *outputInfo_;
+	RawUnpacker unpacker_;
+
+	std::vector<Stripe> stripes_;
+	std::array<unsigned int, SoftwareIspStats::GridWidth + 1> zoneColumns_;
+	std::array<unsigned int, SoftwareIspStats::GridHeight + 1> zoneLines_;
+
+	std::array<std::vector<uint16_t>, 3> linearTables_;
+	std::array<uint8_t, 4096> gammaTable_;
+
+	MappedBufferCache inputs_;
+	MappedBufferCache outputs_;
+
+	std::atomic<bool> stopping_;
+	bool running_;
+
+	Mutex mutex_;
+	SoftwareIspParams params_;
+	bool paramsChanged_;
+	std::queue<Result> results_;
+};
+
+} /* namespace libcamera */
+
+#endif /* __LIBCAMERA_SOFTWARE_ISP_H__ */
@@ -7,13 +7,19 @@
 #ifndef __LIBCAMERA_THREAD_H__
 #define __LIBCAMERA_THREAD_H__
 
+#include <array>
 #include <memory>
 #include <mutex>
+#include <stdint.h>
+#include <string>
 #include <sys/types.h>
 #include <thread>
+#include <vector>
 
 #include <libcamera/signal.h>
 
+#include "utils.h"
+
 namespace libcamera {
 
 class EventDispatcher;
@@ -25,12 +31,50 @@ class ThreadMain;
 using Mutex = std::mutex;
 using MutexLocker = std::unique_lock<std::mutex>;
 
+struct ThreadStatistics {
+	static constexpr unsigned int LatencyBuckets = 16;
+	static constexpr unsigned int Lanes = MessagePriorityRealtime + 1;
+
+	ThreadStatistics();
+
+	static utils::duration latencyBucketLimit(unsigned int bucket);
+	utils::duration latencyPercentile(unsigned int percentile) const;
+
+	std::string toString() const;
+
+	utils::time_point start;
+
+	uint64_t messages;
+	unsigned int maxQueueDepth;
+	std::array<unsigned int, Lanes> maxLaneDepth;
+	std::array<uint64_t, LatencyBuckets> latency;
+
+	utils::duration busyTime;
+	utils::duration sleepTime;
+	utils::duration slowestHandler;
+
+	uint64_t busyPollHits;
+	uint64_t busyPollMisses;
+	utils::duration busyPollTime;
+	utils::duration busyPollSaved;
+};
+
 class Thread
 {
 public:
+	enum SchedulingPolicy {
+		SchedulingPolicyDefault,
+		SchedulingPolicyFifo,
+		SchedulingPolicyRoundRobin,
+	};
+
 	Thread();
 	virtual ~Thread();
 
+	int setName(const std::string &name);
+	int setSchedulingPolicy(SchedulingPolicy policy, int priority = 0);
+	int setAffinity(const std::vector<unsigned int> &cpus);
+
 	void start();
 	void exit(int code = 0);
 	void wait();
@@ -45,7 +89,15 @@ public:
 	EventDispatcher *eventDispatcher();
 	void setEventDispatcher(std::unique_ptr<EventDispatcher> dispatcher);
 
-	void dispatchMessages();
+	unsigned int dispatchMessages();
+
+	ThreadStatistics statistics(bool reset = false);
+	void setStatisticsInterval(utils::duration interval);
+
+	void recordSleep(utils::duration duration);
+	void recordHandler(utils::duration duration);
+	void recordBusyPoll(utils::duration duration, bool hit,
+			    utils::duration saved);
 
 protected:
 	int exec();
@@ -55,6 +107,10 @@ private:
 	void startThread();
 	void finishThread();
 
+	int applyName(pid_t tid);
+	int applySchedulingPolicy(pid_t tid);
+	int applyAffinity(pid_t tid);
+
 	void postMessage(std::unique_ptr<Message> msg, Object *receiver);
 	void removeMessages(Object *receiver);
 
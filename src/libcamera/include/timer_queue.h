@@ -0,0 +1,45 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * timer_queue.h - Priority queue of timers for event dispatchers
+ */
+#ifndef __LIBCAMERA_TIMER_QUEUE_H__
+#define __LIBCAMERA_TIMER_QUEUE_H__
+
+#include <array>
+#include <stdint.h>
+#include <vector>
+
+#include "utils.h"
+
+namespace libcamera {
+
+class Timer;
+
+class TimerQueue
+{
+public:
+	static constexpr unsigned int LatenessBuckets = 16;
+
+	TimerQueue();
+
+	void insert(Timer *timer);
+	void remove(Timer *timer);
+
+	bool empty() const { return timers_.empty(); }
+	Timer *next() const { return timers_.empty() ? nullptr : timers_.front(); }
+	utils::time_point wakeup(utils::duration *slack = nullptr) const;
+	Timer *expire(utils::time_point now);
+
+	const std::array<uint64_t, LatenessBuckets> &lateness() const { return lateness_; }
+	static utils::duration latenessBucketLimit(unsigned int bucket);
+
+private:
+	std::vector<Timer *> timers_;
+	std::array<uint64_t, LatenessBuckets> lateness_;
+};
+
+} /* namespace libcamera */
+
+#endif /* __LIBCAMERA_TIMER_QUEUE_H__ */
@@ -0,0 +1,133 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * tracer.h - Binary tracepoints
+ */
+#ifndef __LIBCAMERA_TRACER_H__
+#define __LIBCAMERA_TRACER_H__
+
+#include <atomic>
+#include <memory>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "thread.h"
+
+namespace libcamera {
+
+enum TracepointId : uint16_t {
+	TraceCameraQueueRequest,
+	TracePipelineQueueRequestDevice,
+	TracePipelineCompleteRequest,
+	TraceV4L2QueueBuffer,
+	TraceV4L2DequeueBuffer,
+	TraceIPAProcessEvent,
+	TraceIPAQueueFrameAction,
+	TraceTimelineAction,
+	TraceCameraManagerStartBegin,
+	TraceCameraManagerStartEnd,
+	TraceDeviceEnumerateBegin,
+	TraceDeviceEnumerateEnd,
+	TracePipelineMatchBegin,
+	TracePipelineMatchEnd,
+	TraceIPAManagerScanBegin,
+	TraceIPAManagerScanEnd,
+	TraceCameraAcquireBegin,
+	TraceCameraAcquireEnd,
+	TraceCameraConfigureBegin,
+	TraceCameraConfigureEnd,
+	TraceCameraStartBegin,
+	TraceCameraStartEnd,
+	TraceMax,
+};
+
+struct TraceRecord {
+	uint64_t timestamp;
+	uint32_t thread;
+	uint16_t id;
+	uint16_t reserved;
+	uint64_t args[4];
+};
+
+class Tracer
+{
+public:
+	static Tracer *instance();
+
+	bool enabled() const { return enabled_; }
+	void enable();
+
+	void record(TracepointId id, uint64_t arg0 = 0, uint64_t arg1 = 0,
+		    uint64_t arg2 = 0, uint64_t arg3 = 0);
+
+	std::vector<TraceRecord> records();
+	int dump(const std::string &path);
+
+	std::string startupProfile();
+
+	static const char *description(TracepointId id);
+
+private:
+	Tracer();
+	~Tracer();
+
+	struct ThreadBuffer;
+
+	ThreadBuffer *threadBuffer();
+
+	bool enabled_;
+	std::string path_;
+
+	bool startupReport_;
+	std::atomic<bool> startupReported_;
+
+	Mutex mutex_;
+	std::vector<std::unique_ptr<ThreadBuffer>> buffers_;
+};
+
+#if HAVE_TRACING
+#define LIBCAMERA_TRACEPOINT(name, ...)					\
+	do {								\
+		Tracer *tracer__ = Tracer::instance();			\
+		if (tracer__->enabled())				\
+			tracer__->record(Trace##name, __VA_ARGS__);	\
+	} while (0)
+#else
+#define LIBCAMERA_TRACEPOINT(name, ...) do { } while (0)
+#endif
+
+class TraceScope
+{
+public:
+	TraceScope(TracepointId begin, TracepointId end, uint64_t arg)
+		: end_(end), arg_(arg)
+	{
+		enabled_ = Tracer::instance()->enabled();
+		if (enabled_)
+			Tracer::instance()->record(begin, arg_);
+	}
+
+	~TraceScope()
+	{
+		if (enabled_)
+			Tracer::instance()->record(end_, arg_);
+	}
+
+private:
+	TracepointId end_;
+	uint64_t arg_;
+	bool enabled_;
+};
+
+#if HAVE_TRACING
+#define LIBCAMERA_TRACEPOINT_SCOPE(name, arg)				\
+	TraceScope traceScope__(Trace##name##Begin, Trace##name##End, arg)
+#else
+#define LIBCAMERA_TRACEPOINT_SCOPE(name, arg) do { } while (0)
+#endif
+
+} /* namespace libcamera */
+
+#endif /* __LIBCAMERA_TRACER_H__ */
@@ -0,0 +1,51 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * v4l2_control_writer.h - Write V4L2 controls, skipping unchanged values
+ */
+#ifndef __LIBCAMERA_V4L2_CONTROL_WRITER_H__
+#define __LIBCAMERA_V4L2_CONTROL_WRITER_H__
+
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <libcamera/controls.h>
+#include <libcamera/object.h>
+
+#include "thread.h"
+
+namespace libcamera {
+
+class V4L2Device;
+
+class V4L2ControlWriter : public Object
+{
+public:
+	V4L2ControlWriter(V4L2Device *device);
+	~V4L2ControlWriter();
+
+	void setDeferred(bool deferred, const std::string &name = "");
+	bool deferred() const { return worker_ != nullptr; }
+
+	int write(const ControlList &ctrls);
+	void flush();
+	void reset();
+
+private:
+	class Worker;
+
+	void invalidate(const std::vector<unsigned int> &ids);
+
+	V4L2Device *device_;
+	std::unordered_map<unsigned int, ControlValue> values_;
+
+	std::unique_ptr<Worker> worker_;
+	std::unique_ptr<Thread> thread_;
+};
+
+} /* namespace libcamera */
+
+#endif /* __LIBCAMERA_V4L2_CONTROL_WRITER_H__ */
@@ -13,11 +13,16 @@
 
 #include <linux/videodev2.h>
 
+#include <libcamera/signal.h>
+
 #include "log.h"
 #include "v4l2_controls.h"
 
 namespace libcamera {
 
+class EventNotifier;
+class MediaRequest;
+
 class V4L2Device : protected Loggable
 {
 public:
@@ -27,10 +32,13 @@ public:
 	const ControlInfoMap &controls() const { return controls_; }
 
 	int getControls(ControlList *ctrls);
-	int setControls(ControlList *ctrls);
+	int setControls(ControlList *ctrls, MediaRequest *request = nullptr);
 
 	const std::string &deviceNode() const { return deviceNode_; }
 
+	int setFrameStartEnabled(bool enable);
+	Signal<uint32_t, uint64_t> frameStart;
+
 protected:
 	V4L2Device(const std::string &deviceNode);
 	~V4L2Device();
@@ -43,15 +51,28 @@ protected:
 	int fd() { return fd_; }
 
 private:
+	struct ControlDesc {
+		unsigned int id;
+		ControlType type;
+	};
+
 	void listControls();
+	const ControlDesc *findControl(unsigned int id) const;
 	void updateControls(ControlList *ctrls,
 			    const struct v4l2_ext_control *v4l2Ctrls,
 			    unsigned int count);
 
+	void eventAvailable(EventNotifier *notifier);
+
 	std::vector<std::unique_ptr<V4L2ControlId>> controlIds_;
 	ControlInfoMap controls_;
+	std::vector<ControlDesc> controlDescs_;
+	std::vector<struct v4l2_ext_control> v4l2Ctrls_;
 	std::string deviceNode_;
 	int fd_;
+
+	EventNotifier *fdEventNotifier_;
+	bool frameStartEnabled_;
 };
 
 } /* namespace libcamera */
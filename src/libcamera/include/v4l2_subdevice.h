@@ -38,13 +38,14 @@ public:
 	~V4L2Subdevice();
 
 	int open();
+	void close();
 
 	const MediaEntity *entity() const { return entity_; }
 
 	int setCrop(unsigned int pad, Rectangle *rect);
 	int setCompose(unsigned int pad, Rectangle *rect);
 
-	ImageFormats formats(unsigned int pad);
+	ImageFormats formats(unsigned int pad, bool refresh = false);
 
 	int getFormat(unsigned int pad, V4L2SubdeviceFormat *format);
 	int setFormat(unsigned int pad, V4L2SubdeviceFormat *format);
@@ -64,6 +65,8 @@ private:
 			 Rectangle *rect);
 
 	const MediaEntity *entity_;
+
+	std::map<unsigned int, ImageFormats> formats_;
 };
 
 } /* namespace libcamera */
@@ -7,6 +7,7 @@
 #ifndef __LIBCAMERA_V4L2_VIDEODEVICE_H__
 #define __LIBCAMERA_V4L2_VIDEODEVICE_H__
 
+#include <array>
 #include <string>
 #include <vector>
 
@@ -17,6 +18,7 @@
 #include <libcamera/geometry.h>
 #include <libcamera/pixelformats.h>
 #include <libcamera/signal.h>
+#include <libcamera/span.h>
 
 #include "formats.h"
 #include "log.h"
@@ -28,6 +30,7 @@ class EventNotifier;
 class FileDescriptor;
 class MediaDevice;
 class MediaEntity;
+class MediaRequest;
 
 struct V4L2Capability final : v4l2_capability {
 	const char *driver() const
@@ -108,41 +111,55 @@ struct V4L2Capability final : v4l2_capability {
 class V4L2BufferCache
 {
 public:
+	struct Statistics {
+		unsigned int hits;
+		unsigned int misses;
+		unsigned int evictions;
+	};
+
 	V4L2BufferCache(unsigned int numEntries);
 	V4L2BufferCache(const std::vector<std::unique_ptr<FrameBuffer>> &buffers);
 	~V4L2BufferCache();
 
+	void grow(unsigned int index, unsigned int numEntries);
+	void grow(unsigned int index,
+		  const std::vector<std::unique_ptr<FrameBuffer>> &buffers);
+
 	int get(const FrameBuffer &buffer);
 	void put(unsigned int index);
 
+	const Statistics &statistics() const { return stats_; }
+
 private:
 	class Entry
 	{
 	public:
 		Entry();
-		Entry(bool free, const FrameBuffer &buffer);
+		Entry(bool free, uint64_t lastUsed, const FrameBuffer &buffer);
 
 		bool operator==(const FrameBuffer &buffer);
+		bool isEmpty() const { return numPlanes_ == 0; }
 
 		bool free;
+		uint64_t lastUsed;
 
 	private:
+		/* Non-owning view of a plane, compared by memory and length. */
 		struct Plane {
-			Plane(const FrameBuffer::Plane &plane)
-				: fd(plane.fd.fd()), length(plane.length)
-			{
-			}
-
 			int fd;
+			void *address;
 			unsigned int length;
 		};
 
-		std::vector<Plane> planes_;
+		unsigned int numPlanes_;
+		std::array<Plane, FrameMaxPlanes> planes_;
 	};
 
+	void pad(unsigned int index);
+
 	std::vector<Entry> cache_;
-	/* \todo Expose the miss counter through an instrumentation API. */
-	unsigned int missCounter_;
+	uint64_t lastUsedCounter_;
+	Statistics stats_;
 };
 
 class V4L2DeviceFormat
@@ -180,15 +197,32 @@ public:
 
 	int getFormat(V4L2DeviceFormat *format);
 	int setFormat(V4L2DeviceFormat *format);
-	ImageFormats formats();
+	ImageFormats formats(bool refresh = false);
+
+	int getFrameInterval(uint64_t *interval);
+	int setFrameInterval(uint64_t *interval);
+	int frameIntervalRange(const V4L2DeviceFormat &format, uint64_t *min,
+			       uint64_t *max);
 
+	int setCrop(Rectangle *rect);
+
+	void setCpuAccess(FrameBuffer::CpuAccess access) { cpuAccess_ = access; }
 	int exportBuffers(unsigned int count,
 			  std::vector<std::unique_ptr<FrameBuffer>> *buffers);
-	int importBuffers(unsigned int count);
+	int allocateBuffers(unsigned int count,
+			    std::vector<std::unique_ptr<FrameBuffer>> *buffers);
+	int importBuffers(unsigned int count,
+			  FrameBuffer::Memory memory = FrameBuffer::MemoryDmaBuf);
+	int addBuffers(unsigned int count,
+		       std::vector<std::unique_ptr<FrameBuffer>> *buffers = nullptr);
 	int releaseBuffers();
 
-	int queueBuffer(FrameBuffer *buffer);
+	int queueBuffer(FrameBuffer *buffer, MediaRequest *request = nullptr);
+	unsigned int queuedBuffers() const { return queuedCount_; }
 	Signal<FrameBuffer *> bufferReady;
+	Signal<Span<FrameBuffer *>> buffersReady;
+
+	V4L2BufferCache::Statistics cacheStatistics() const;
 
 	int streamOn();
 	int streamOff();
@@ -216,22 +250,61 @@ private:
 	std::vector<unsigned int> enumPixelformats();
 	std::vector<SizeRange> enumSizes(unsigned int pixelFormat);
 
+	struct BufferTemplate {
+		struct v4l2_buffer buf;
+		std::array<struct v4l2_plane, VIDEO_MAX_PLANES> planes;
+	};
+
+	using FillBufferFunc = void (*)(BufferTemplate *slot,
+					const FrameBuffer *buffer);
+	using ReadBufferFunc = void (*)(const BufferTemplate &slot,
+					FrameMetadata *metadata);
+
+	template<bool MultiPlanar, bool Output, enum v4l2_memory Memory>
+	static void fillBuffer(BufferTemplate *slot, const FrameBuffer *buffer);
+	template<bool MultiPlanar>
+	static void readBuffer(const BufferTemplate &slot, FrameMetadata *metadata);
+	template<bool MultiPlanar, bool Output>
+	static FillBufferFunc fillBufferFunc(enum v4l2_memory memory);
+
+	void selectBufferPaths();
+	void resizeBufferTemplates(unsigned int count);
+
 	int requestBuffers(unsigned int count);
+	int createBuffers(unsigned int count,
+			  std::vector<std::unique_ptr<FrameBuffer>> *buffers);
 	std::unique_ptr<FrameBuffer> createBuffer(const struct v4l2_buffer &buf);
+	std::unique_ptr<FrameBuffer> createMappedBuffer(const struct v4l2_buffer &buf);
+	void unmapBuffers();
 	FileDescriptor exportDmabufFd(unsigned int index, unsigned int plane);
 
 	void bufferAvailable(EventNotifier *notifier);
 	FrameBuffer *dequeueBuffer();
 
+	const MediaEntity *entity_;
 	V4L2Capability caps_;
 
 	enum v4l2_buf_type bufferType_;
 	enum v4l2_memory memoryType_;
 
+	FrameBuffer::CpuAccess cpuAccess_;
+	uint32_t cacheFlags_;
+
 	V4L2BufferCache *cache_;
-	std::map<unsigned int, FrameBuffer *> queuedBuffers_;
+	bool mapBuffers_;
+	std::vector<std::pair<void *, size_t>> mappings_;
+	std::vector<FrameBuffer *> queuedBuffers_;
+	unsigned int queuedCount_;
+	std::vector<BufferTemplate> bufferTemplates_;
+	BufferTemplate dequeueTemplate_;
+	FillBufferFunc fillBuffer_;
+	ReadBufferFunc readBuffer_;
+	std::vector<FrameBuffer *> completedBuffers_;
 
 	EventNotifier *fdEvent_;
+
+	ImageFormats formats_;
+	bool formatsValid_;
 };
 
 class V4L2M2MDevice
@@ -0,0 +1,74 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * worker_pool.h - Work-stealing pool of worker threads
+ */
+#ifndef __LIBCAMERA_WORKER_POOL_H__
+#define __LIBCAMERA_WORKER_POOL_H__
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <vector>
+
+#include <libcamera/bound_method.h>
+#include <libcamera/object.h>
+
+#include "thread.h"
+
+namespace libcamera {
+
+class WorkerPool
+{
+public:
+	using Task = std::function<void()>;
+
+	WorkerPool(unsigned int workers = 0);
+	~WorkerPool();
+
+	WorkerPool(const WorkerPool &) = delete;
+	WorkerPool &operator=(const WorkerPool &) = delete;
+
+	unsigned int workers() const { return workers_.size(); }
+
+	void run(Task task);
+
+	template<typename T, typename... FuncArgs, typename... Args,
+		 typename std::enable_if<std::is_base_of<Object, T>::value>::type * = nullptr>
+	void run(Task task, T *receiver, void (T::*done)(FuncArgs...),
+		 Args... args)
+	{
+		run([=]() mutable {
+			task();
+			receiver->invokeMethod(done, ConnectionTypeQueued,
+					       std::move(args)...);
+		});
+	}
+
+	void wait();
+
+	static WorkerPool *instance();
+
+private:
+	class Worker;
+
+	bool steal(unsigned int index, Task *task);
+	void finishTask();
+
+	std::vector<std::unique_ptr<Worker>> workers_;
+	std::atomic<unsigned int> next_;
+
+	Mutex mutex_;
+	std::condition_variable wakeup_;
+	std::condition_variable idle_;
+	unsigned int queued_;
+	unsigned int pending_;
+	bool exit_;
+};
+
+} /* namespace libcamera */
+
+#endif /* __LIBCAMERA_WORKER_POOL_H__ */
@@ -0,0 +1,90 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * yuv_stats.h - CPU statistics for YUV frames
+ */
+#ifndef __LIBCAMERA_YUV_STATS_H__
+#define __LIBCAMERA_YUV_STATS_H__
+
+#include <array>
+#include <memory>
+#include <stdint.h>
+#include <vector>
+
+#include <libcamera/geometry.h>
+#include <libcamera/mapped_framebuffer.h>
+#include <libcamera/pixelformats.h>
+
+#include "utils.h"
+
+namespace libcamera {
+
+class FrameBuffer;
+class WorkerPool;
+
+struct YuvStats {
+	static constexpr unsigned int GridWidth = 16;
+	static constexpr unsigned int GridHeight = 12;
+	static constexpr unsigned int HistogramBins = 64;
+
+	std::array<uint8_t, GridWidth * GridHeight> luminance;
+	std::array<uint8_t, GridWidth * GridHeight> cb;
+	std::array<uint8_t, GridWidth * GridHeight> cr;
+	std::array<uint32_t, HistogramBins> histogram;
+	utils::duration processingTime;
+};
+
+class YuvStatsEngine
+{
+public:
+	YuvStatsEngine(unsigned int threads = 1);
+	~YuvStatsEngine();
+
+	static bool isSupported(PixelFormat format);
+
+	int configure(PixelFormat format, const Size &size, unsigned int stride,
+		      unsigned int step = 2);
+
+	int process(const FrameBuffer *buffer, YuvStats *stats);
+	void process(const uint8_t *y, const uint8_t *uv, YuvStats *stats);
+	void clear();
+
+private:
+	static constexpr unsigned int Zones = YuvStats::GridWidth * YuvStats::GridHeight;
+
+	struct Format;
+
+	struct Stripe {
+		unsigned int firstRow;
+		unsigned int lastRow;
+		std::array<uint32_t, YuvStats::HistogramBins> histogram;
+	};
+
+	static const Format *findFormat(PixelFormat format);
+
+	void processStripe(Stripe &stripe, const uint8_t *y, const uint8_t *uv);
+	void sumLine(const uint8_t *line, unsigned int zoneRow,
+		     const std::array<uint8_t, 4> &lanes, unsigned int bytesPerPixel);
+
+	const Format *format_;
+	Size size_;
+	unsigned int stride_;
+	unsigned int step_;
+
+	std::unique_ptr<WorkerPool> pool_;
+	std::vector<Stripe> stripes_;
+
+	std::array<unsigned int, YuvStats::GridWidth + 1> zoneColumns_;
+	std::array<unsigned int, YuvStats::GridHeight + 1> zoneLines_;
+
+	/* Sums of the Y, Cb and Cr samples, and number of sampled lines. */
+	std::array<std::array<uint32_t, Zones>, 3> sums_;
+	std::array<unsigned int, YuvStats::GridHeight> lines_;
+
+	MappedBufferCache buffers_;
+};
+
+} /* namespace libcamera */
+
+#endif /* __LIBCAMERA_YUV_STATS_H__ */
@@ -12,6 +12,7 @@
 #include <libcamera/controls.h>
 
 #include "byte_stream_buffer.h"
+#include "tracer.h"
 #include "utils.h"
 
 /**
@@ -33,6 +34,10 @@ namespace libcamera {
  * The IPAInterface methods are converted to the ipa_context API by translating
  * all C++ arguments into plain C structures or byte arrays that contain no
  * pointer, as required by the ipa_context API.
+ *
+ * Events and frame actions are exchanged for every frame. To keep the heap out
+ * of this path, the wrapper reuses the same storage to translate them across
+ * calls. The storage grows to the largest operation seen and is never shrunk.
  */
 
 /**
@@ -44,7 +49,7 @@ namespace libcamera {
  * with it.
  */
 IPAContextWrapper::IPAContextWrapper(struct ipa_context *context)
-	: ctx_(context), intf_(nullptr)
+	: ctx_(context), intf_(nullptr), actionBusy_(false)
 {
 	if (!ctx_)
 		return;
@@ -110,24 +115,20 @@ void IPAContextWrapper::configure(const std::map<unsigned int, IPAStream> &strea
 		++i;
 	}
 
-	/* Translate the IPA entity controls map. */
+	/*
+	 * Translate the IPA entity controls map. The serialized data is cached
+	 * with the maps, which outlive this call.
+	 */
 	struct ipa_control_info_map c_info_maps[entityControls.size()];
-	std::vector<std::vector<uint8_t>> data(entityControls.size());
 
 	i = 0;
 	for (const auto &info : entityControls) {
 		struct ipa_control_info_map &c_info_map = c_info_maps[i];
-		unsigned int id = info.first;
-		const ControlInfoMap &infoMap = info.second;
-
-		size_t infoMapSize = serializer_.binarySize(infoMap);
-		data[i].resize(infoMapSize);
-		ByteStreamBuffer byteStream(data[i].data(), data[i].size());
-		serializer_.serialize(infoMap, byteStream);
+		Span<const uint8_t> data = serializer_.serialize(info.second);
 
-		c_info_map.id = id;
-		c_info_map.data = byteStream.base();
-		c_info_map.size = byteStream.size();
+		c_info_map.id = info.first;
+		c_info_map.data = data.data();
+		c_info_map.size = data.size();
 
 		++i;
 	}
@@ -177,6 +178,8 @@ void IPAContextWrapper::unmapBuffers(const std::vector<unsigned int> &ids)
 
 void IPAContextWrapper::processEvent(const IPAOperationData &data)
 {
+	LIBCAMERA_TRACEPOINT(IPAProcessEvent, data.operation);
+
 	if (intf_)
 		return intf_->processEvent(data);
 
@@ -188,20 +191,22 @@ void IPAContextWrapper::processEvent(const IPAOperationData &data)
 	c_data.data = data.data.data();
 	c_data.num_data = data.data.size();
 
-	struct ipa_control_list control_lists[data.controls.size()];
-	c_data.lists = control_lists;
-	c_data.num_lists = data.controls.size();
-
 	std::size_t listsSize = 0;
 	for (const auto &list : data.controls)
 		listsSize += serializer_.binarySize(list);
 
-	std::vector<uint8_t> binaryData(listsSize);
-	ByteStreamBuffer byteStreamBuffer(binaryData.data(), listsSize);
+	if (eventData_.size() < listsSize)
+		eventData_.resize(listsSize);
+	eventLists_.resize(data.controls.size());
+
+	c_data.lists = eventLists_.data();
+	c_data.num_lists = eventLists_.size();
+
+	ByteStreamBuffer byteStreamBuffer(eventData_.data(), listsSize);
 
 	unsigned int i = 0;
 	for (const auto &list : data.controls) {
-		struct ipa_control_list &c_list = control_lists[i];
+		struct ipa_control_list &c_list = eventLists_[i++];
 		c_list.size = serializer_.binarySize(list);
 		ByteStreamBuffer b = byteStreamBuffer.carveOut(c_list.size);
 
@@ -216,6 +221,8 @@ void IPAContextWrapper::processEvent(const IPAOperationData &data)
 void IPAContextWrapper::doQueueFrameAction(unsigned int frame,
 					   const IPAOperationData &data)
 {
+	LIBCAMERA_TRACEPOINT(IPAQueueFrameAction, frame, data.operation);
+
 	IPAInterface::queueFrameAction.emit(frame, data);
 }
 
@@ -223,19 +230,28 @@ void IPAContextWrapper::queue_frame_action(void *ctx, unsigned int frame,
 					   struct ipa_operation_data &data)
 {
 	IPAContextWrapper *_this = static_cast<IPAContextWrapper *>(ctx);
-	IPAOperationData opData;
+
+	/*
+	 * Reuse the action storage, unless the pipeline handler queues another
+	 * frame action recursively.
+	 */
+	IPAOperationData nested;
+	IPAOperationData &opData = _this->actionBusy_ ? nested : _this->action_;
+	bool busy = _this->actionBusy_;
 
 	opData.operation = data.operation;
-	for (unsigned int i = 0; i < data.num_data; ++i)
-		opData.data.push_back(data.data[i]);
+	opData.data.assign(data.data, data.data + data.num_data);
 
+	opData.controls.resize(data.num_lists);
 	for (unsigned int i = 0; i < data.num_lists; ++i) {
 		const struct ipa_control_list &c_list = data.lists[i];
 		ByteStreamBuffer b(c_list.data, c_list.size);
-		opData.controls.push_back(_this->serializer_.deserialize<ControlList>(b));
+		_this->serializer_.deserialize(b, &opData.controls[i]);
 	}
 
+	_this->actionBusy_ = true;
 	_this->doQueueFrameAction(frame, opData);
+	_this->actionBusy_ = busy;
 }
 
 #ifndef __DOXYGEN__
@@ -111,11 +111,36 @@
  * As for the ControlList packet, empty spaces may be present between the end of
  * the entries array and the data section, and after the data section. They
  * shall be ignored when parsing the packet.
+ *
+ * ControlList packets may be delta-encoded, as indicated by the
+ * IPA_CONTROLS_FLAG_DELTA flag in the header. A delta packet only contains the
+ * controls that have been added, changed or removed since the previous packet
+ * with the same handle, in the same direction of the same communication
+ * channel. Removed controls are stored as entries of type ControlTypeNone.
+ * Packets are numbered per handle through the ipa_controls_header::sequence
+ * field, starting at 1, and a delta packet applies to the packet with the
+ * immediately preceding sequence number. Packets that are not delta-encoded
+ * are keyframes, they contain the full list of controls. A sequence number
+ * of 0 denotes a packet that isn't part of a delta-encoded stream.
  */
 
 /**
  * \def IPA_CONTROLS_FORMAT_VERSION
  * \brief The current control serialization format version
+ *
+ * The version is incremented for every change to the packet layout. Version 2
+ * split the 32-bit type field of ipa_control_value_entry into the type, the
+ * is_array flag and reserved bytes, which version 1 parsers can't decode.
+ * Version 3 turned reserved header words into the flags and sequence fields,
+ * as version 2 parsers would process a delta packet as a full list.
+ *
+ * Parsers shall reject packets with a different version, or with flags they
+ * don't know.
+ */
+
+/**
+ * \def IPA_CONTROLS_FLAG_DELTA
+ * \brief The ControlList packet is delta-encoded
  */
 
 /**
@@ -133,8 +158,12 @@
  * The total packet size in bytes
  * \var ipa_controls_header::data_offset
  * Offset in bytes from the beginning of the packet of the data section start
+ * \var ipa_controls_header::flags
+ * Packet flags (IPA_CONTROLS_FLAG_*), shall be 0 for ControlInfoMap packets
+ * \var ipa_controls_header::sequence
+ * Sequence number of delta-encoded ControlList packets, 0 otherwise
  * \var ipa_controls_header::reserved
- * Reserved for future extensions
+ * Reserved for future extensions (shall be set to 0)
  */
 
 /**
@@ -144,6 +173,10 @@
  * The numerical ID of the control
  * \var ipa_control_value_entry::type
  * The type of the control (defined by enum ControlType)
+ * \var ipa_control_value_entry::is_array
+ * A flag describing whether the control is an array control
+ * \var ipa_control_value_entry::reserved
+ * Reserved for future extensions (shall be set to 0)
  * \var ipa_control_value_entry::count
  * The number of control array entries for array controls (1 otherwise)
  * \var ipa_control_value_entry::offset
@@ -170,10 +203,14 @@
  * \brief Serialized control value
  * \var ipa_control_value_data::b
  * Value for ControlTypeBool controls
+ * \var ipa_control_value_data::u8
+ * Value for ControlTypeByte controls
  * \var ipa_control_value_data::i32
  * Value for ControlTypeInteger32 controls
  * \var ipa_control_value_data::i64
  * Value for ControlTypeInteger64 controls
+ * \var ipa_control_value_data::f
+ * Value for ControlTypeFloat controls
  */
 
 /**
@@ -0,0 +1,505 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * ipa_data_serializer.cpp - Serialization of IPA interface data
+ */
+
+#include "ipa_data_serializer.h"
+
+#include <errno.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "log.h"
+
+/**
+ * \file ipa_data_serializer.h
+ * \brief Serialization of IPA interface data
+ */
+
+namespace libcamera {
+
+LOG_DEFINE_CATEGORY(IPADataSerializer)
+
+namespace {
+
+constexpr size_t Alignment = 8;
+
+size_t alignedSize(size_t size)
+{
+	return (size + Alignment - 1) & ~(Alignment - 1);
+}
+
+/*
+ * All items are stored as 32-bit words, and padded to a multiple of 8 bytes
+ * to keep the serialized controls aligned.
+ */
+void writePair(ByteStreamBuffer &buffer, uint32_t first, uint32_t second)
+{
+	buffer.write(&first);
+	buffer.write(&second);
+}
+
+bool readPair(ByteStreamBuffer &buffer, uint32_t *first, uint32_t *second)
+{
+	return !buffer.read(first) && !buffer.read(second);
+}
+
+} /* namespace */
+
+/**
+ * \struct IPAMessageHeader
+ * \brief Header of the messages exchanged with isolated IPAs
+ *
+ * Each message exchanged between an IPA proxy and its worker starts with an
+ * IPAMessageHeader, followed by the arguments of the command serialized with
+ * IPADataSerializer.
+ *
+ * \var IPAMessageHeader::command
+ * \brief The command, from the IPAMessageHeader::Command enumeration
+ *
+ * \var IPAMessageHeader::frame
+ * \brief The frame number for IPAMessageHeader::QueueFrameAction, 0 otherwise
+ *
+ * \var IPAMessageHeader::context
+ * \brief The IPA context the message is addressed to or originates from
+ *
+ * A worker process can host several IPA contexts of the same IPA module, each
+ * of them serving a different proxy. The context is ignored for
+ * IPAMessageHeader::LoadModule.
+ *
+ * \var IPAMessageHeader::reserved
+ * \brief Padding to keep the message arguments 8 bytes aligned, set to 0
+ */
+
+/**
+ * \enum IPAMessageHeader::Command
+ * \brief The IPAInterface operation carried by a message
+ *
+ * \var IPAMessageHeader::LoadModule
+ * \brief Load the IPA module in the worker, with the module path as payload
+ * \var IPAMessageHeader::CreateContext
+ * \brief Create an IPA context in the worker, with no argument
+ * \var IPAMessageHeader::DestroyContext
+ * \brief Destroy an IPA context in the worker, with no argument
+ * \var IPAMessageHeader::Init
+ * \brief IPAInterface::init(), with no argument
+ * \var IPAMessageHeader::Configure
+ * \brief IPAInterface::configure(), with a streams map and a ControlInfoMap map
+ * passed through file descriptors
+ * \var IPAMessageHeader::MapBuffers
+ * \brief IPAInterface::mapBuffers(), with a vector of IPABuffer
+ * \var IPAMessageHeader::UnmapBuffers
+ * \brief IPAInterface::unmapBuffers(), with a vector of buffer IDs
+ * \var IPAMessageHeader::ProcessEvent
+ * \brief IPAInterface::processEvent(), with an IPAOperationData
+ * \var IPAMessageHeader::QueueFrameAction
+ * \brief IPAInterface::queueFrameAction, with an IPAOperationData
+ */
+
+/**
+ * \class IPADataSerializer
+ * \brief Serialize and deserialize the arguments of IPAInterface operations
+ *
+ * The IPADataSerializer class converts the arguments of the IPAInterface
+ * methods to and from a flat binary representation that contains no pointer,
+ * in order to transport them across a process boundary. Controls are
+ * serialized with a ControlSerializer, using the format defined in
+ * ipa_controls.h, and the ControlInfoMap instances received through
+ * deserialize() are cached to deserialize the ControlList instances that
+ * reference them.
+ *
+ * File descriptors can't be serialized. They are instead collected in a
+ * separate vector, to be transported out of band. The same mechanism is used
+ * for ControlInfoMap instances, which are transported as sealed memfds
+ * containing their cached serialized form, to avoid copying them in every
+ * configuration message.
+ *
+ * The binary representation of all the arguments is 8 bytes aligned, and the
+ * buffers passed to serialize() and deserialize() shall be 8 bytes aligned.
+ */
+
+/**
+ * \brief Reset the serializer
+ *
+ * Reset the internal state of the control serializer, which invalidates all
+ * serialized and deserialized ControlInfoMap. This shall be called on both
+ * sides when the IPA is reconfigured.
+ */
+void IPADataSerializer::reset()
+{
+	controls_.reset();
+}
+
+/**
+ * \brief Retrieve the size of the serialized streams configuration
+ * \param[in] streams The streams configuration
+ * \return The size in bytes of \a streams once serialized
+ */
+size_t IPADataSerializer::binarySize(const std::map<unsigned int, IPAStream> &streams)
+{
+	return 8 + streams.size() * 16;
+}
+
+/**
+ * \brief Retrieve the size of the serialized control information maps
+ * \param[in] maps The control information maps
+ * \return The size in bytes of \a maps once serialized
+ */
+size_t IPADataSerializer::binarySize(const std::map<unsigned int, const ControlInfoMap &> &maps)
+{
+	return 8 + maps.size() * 8;
+}
+
+/**
+ * \brief Retrieve the size of the serialized buffers
+ * \param[in] buffers The buffers
+ * \return The size in bytes of \a buffers once serialized
+ */
+size_t IPADataSerializer::binarySize(const std::vector<IPABuffer> &buffers)
+{
+	size_t size = 8;
+
+	for (const IPABuffer &buffer : buffers)
+		size += 8 + buffer.planes.size() * 8;
+
+	return size;
+}
+
+/**
+ * \brief Retrieve the size of the serialized buffer IDs
+ * \param[in] ids The buffer IDs
+ * \return The size in bytes of \a ids once serialized
+ */
+size_t IPADataSerializer::binarySize(const std::vector<unsigned int> &ids)
+{
+	return 8 + alignedSize(ids.size() * 4);
+}
+
+/**
+ * \brief Retrieve the size of the serialized operation data
+ * \param[in] data The operation data
+ * \return The size in bytes of \a data once serialized
+ */
+size_t IPADataSerializer::binarySize(const IPAOperationData &data)
+{
+	size_t size = 16 + alignedSize(data.data.size() * 4);
+
+	for (const ControlList &list : data.controls)
+		size += 8 + alignedSize(ControlSerializer::binarySize(list));
+
+	return size;
+}
+
+/**
+ * \brief Serialize a streams configuration
+ * \param[in] streams The streams configuration
+ * \param[in] buffer The buffer to serialize to
+ * \return 0 on success or a negative error code otherwise
+ */
+int IPADataSerializer::serialize(const std::map<unsigned int, IPAStream> &streams,
+				 ByteStreamBuffer &buffer)
+{
+	writePair(buffer, streams.size(), 0);
+
+	for (const auto &stream : streams) {
+		writePair(buffer, stream.first, stream.second.pixelFormat);
+		writePair(buffer, stream.second.size.width,
+			  stream.second.size.height);
+	}
+
+	return buffer.overflow() ? -ENOSPC : 0;
+}
+
+/**
+ * \brief Serialize control information maps
+ * \param[in] maps The control information maps
+ * \param[in] buffer The buffer to serialize to
+ * \param[out] fds The file descriptors of the serialized maps
+ *
+ * The maps are serialized to sealed memfds, whose file descriptors are
+ * appended to \a fds in order. The file descriptors are owned by the maps and
+ * stay valid as long as the maps exist.
+ *
+ * \return 0 on success or a negative error code otherwise
+ */
+int IPADataSerializer::serialize(const std::map<unsigned int, const ControlInfoMap &> &maps,
+				 ByteStreamBuffer &buffer,
+				 std::vector<int32_t> *fds)
+{
+	writePair(buffer, maps.size(), 0);
+
+	for (const auto &map : maps) {
+		FileDescriptor fd = controls_.serializeToFd(map.second);
+		if (!fd.isValid())
+			return -ENOMEM;
+
+		writePair(buffer, map.first, ControlSerializer::binarySize(map.second));
+		fds->push_back(fd.fd());
+	}
+
+	return buffer.overflow() ? -ENOSPC : 0;
+}
+
+/**
+ * \brief Serialize buffers
+ * \param[in] buffers The buffers
+ * \param[in] buffer The buffer to serialize to
+ * \param[out] fds The file descriptors of the buffer planes
+ *
+ * The file descriptors of all planes of all \a buffers are appended to \a fds,
+ * in order.
+ *
+ * \return 0 on success or a negative error code otherwise
+ */
+int IPADataSerializer::serialize(const std::vector<IPABuffer> &buffers,
+				 ByteStreamBuffer &buffer,
+				 std::vector<int32_t> *fds)
+{
+	writePair(buffer, buffers.size(), 0);
+
+	for (const IPABuffer &ipaBuffer : buffers) {
+		writePair(buffer, ipaBuffer.id, ipaBuffer.planes.size());
+
+		for (const FrameBuffer::Plane &plane : ipaBuffer.planes) {
+			writePair(buffer, plane.length, 0);
+			fds->push_back(plane.fd.fd());
+		}
+	}
+
+	return buffer.overflow() ? -ENOSPC : 0;
+}
+
+/**
+ * \brief Serialize buffer IDs
+ * \param[in] ids The buffer IDs
+ * \param[in] buffer The buffer to serialize to
+ * \return 0 on success or a negative error code otherwise
+ */
+int IPADataSerializer::serialize(const std::vector<unsigned int> &ids,
+				 ByteStreamBuffer &buffer)
+{
+	writePair(buffer, ids.size(), 0);
+
+	buffer.write(Span<const uint32_t>(ids));
+	buffer.skip(alignedSize(ids.size() * 4) - ids.size() * 4);
+
+	return buffer.overflow() ? -ENOSPC : 0;
+}
+
+/**
+ * \brief Serialize operation data
+ * \param[in] data The operation data
+ * \param[in] buffer The buffer to serialize to
+ * \return 0 on success or a negative error code otherwise
+ */
+int IPADataSerializer::serialize(const IPAOperationData &data,
+				 ByteStreamBuffer &buffer)
+{
+	writePair(buffer, data.operation, data.data.size());
+	writePair(buffer, data.controls.size(), 0);
+
+	buffer.write(Span<const uint32_t>(data.data));
+	buffer.skip(alignedSize(data.data.size() * 4) - data.data.size() * 4);
+
+	for (const ControlList &list : data.controls) {
+		size_t size = ControlSerializer::binarySize(list);
+		writePair(buffer, size, 0);
+
+		ByteStreamBuffer b = buffer.carveOut(alignedSize(size));
+		int ret = controls_.serialize(list, b);
+		if (ret < 0)
+			return ret;
+	}
+
+	return buffer.overflow() ? -ENOSPC : 0;
+}
+
+/**
+ * \brief Deserialize a streams configuration
+ * \param[in] buffer The buffer to deserialize from
+ * \param[out] streams The streams configuration
+ * \return 0 on success or a negative error code otherwise
+ */
+int IPADataSerializer::deserialize(ByteStreamBuffer &buffer,
+				   std::map<unsigned int, IPAStream> *streams)
+{
+	uint32_t count, reserved;
+	if (!readPair(buffer, &count, &reserved))
+		return -EINVAL;
+
+	for (unsigned int i = 0; i < count; ++i) {
+		uint32_t id, pixelFormat, width, height;
+		if (!readPair(buffer, &id, &pixelFormat) ||
+		    !readPair(buffer, &width, &height))
+			return -EINVAL;
+
+		(*streams)[id] = { pixelFormat, Size(width, height) };
+	}
+
+	return 0;
+}
+
+/**
+ * \brief Deserialize control information maps
+ * \param[in] buffer The buffer to deserialize from
+ * \param[in] fds The file descriptors of the serialized maps
+ * \param[out] maps The control information maps
+ *
+ * The \a fds shall contain the file descriptors of all maps, in order. They
+ * are only mapped temporarily, the caller retains their ownership.
+ *
+ * \return 0 on success or a negative error code otherwise
+ */
+int IPADataSerializer::deserialize(ByteStreamBuffer &buffer,
+				   const std::vector<int32_t> &fds,
+				   std::map<unsigned int, ControlInfoMap> *maps)
+{
+	uint32_t count, reserved;
+	if (!readPair(buffer, &count, &reserved))
+		return -EINVAL;
+
+	if (count > fds.size()) {
+		LOG(IPADataSerializer, Error)
+			<< "Missing file descriptors for control info maps";
+		return -EINVAL;
+	}
+
+	for (unsigned int i = 0; i < count; ++i) {
+		uint32_t id, size;
+		if (!readPair(buffer, &id, &size))
+			return -EINVAL;
+
+		void *mem = mmap(nullptr, size, PROT_READ, MAP_SHARED, fds[i], 0);
+		if (mem == MAP_FAILED) {
+			int ret = -errno;
+			LOG(IPADataSerializer, Error)
+				<< "Failed to map control info map " << id
+				<< ": " << strerror(-ret);
+			return ret;
+		}
+
+		ByteStreamBuffer data(static_cast<const uint8_t *>(mem), size);
+		(*maps)[id] = controls_.deserialize<ControlInfoMap>(data);
+		munmap(mem, size);
+	}
+
+	return 0;
+}
+
+/**
+ * \brief Deserialize buffers
+ * \param[in] buffer The buffer to deserialize from
+ * \param[in] fds The file descriptors of the buffer planes
+ * \param[out] buffers The buffers
+ *
+ * The \a fds shall contain the file descriptors of all planes of all buffers,
+ * in order. They are duplicated, the caller retains their ownership.
+ *
+ * \return 0 on success or a negative error code otherwise
+ */
+int IPADataSerializer::deserialize(ByteStreamBuffer &buffer,
+				   const std::vector<int32_t> &fds,
+				   std::vector<IPABuffer> *buffers)
+{
+	uint32_t count, reserved;
+	if (!readPair(buffer, &count, &reserved))
+		return -EINVAL;
+
+	unsigned int fd = 0;
+
+	for (unsigned int i = 0; i < count; ++i) {
+		uint32_t id, numPlanes;
+		if (!readPair(buffer, &id, &numPlanes))
+			return -EINVAL;
+
+		if (numPlanes > fds.size() - fd) {
+			LOG(IPADataSerializer, Error)
+				<< "Missing file descriptors for buffer " << id;
+			return -EINVAL;
+		}
+
+		IPABuffer ipaBuffer;
+		ipaBuffer.id = id;
+		ipaBuffer.planes.resize(numPlanes);
+
+		for (FrameBuffer::Plane &plane : ipaBuffer.planes) {
+			uint32_t length;
+			if (!readPair(buffer, &length, &reserved))
+				return -EINVAL;
+
+			plane.fd = FileDescriptor(fds[fd++]);
+			plane.length = length;
+		}
+
+		buffers->push_back(std::move(ipaBuffer));
+	}
+
+	return 0;
+}
+
+/**
+ * \brief Deserialize buffer IDs
+ * \param[in] buffer The buffer to deserialize from
+ * \param[out] ids The buffer IDs
+ * \return 0 on success or a negative error code otherwise
+ */
+int IPADataSerializer::deserialize(ByteStreamBuffer &buffer,
+				   std::vector<unsigned int> *ids)
+{
+	uint32_t count, reserved;
+	if (!readPair(buffer, &count, &reserved))
+		return -EINVAL;
+
+	const uint32_t *data = buffer.read<uint32_t>(count);
+	if (!data)
+		return -EINVAL;
+
+	ids->assign(data, data + count);
+
+	return buffer.skip(alignedSize(count * 4) - count * 4);
+}
+
+/**
+ * \brief Deserialize operation data
+ * \param[in] buffer The buffer to deserialize from
+ * \param[out] data The operation data
+ * \return 0 on success or a negative error code otherwise
+ */
+int IPADataSerializer::deserialize(ByteStreamBuffer &buffer,
+				   IPAOperationData *data)
+{
+	uint32_t operation, numData, numLists, reserved;
+	if (!readPair(buffer, &operation, &numData) ||
+	    !readPair(buffer, &numLists, &reserved))
+		return -EINVAL;
+
+	const uint32_t *values = buffer.read<uint32_t>(numData);
+	if (!values)
+		return -EINVAL;
+
+	data->operation = operation;
+	data->data.assign(values, values + numData);
+
+	if (buffer.skip(alignedSize(numData * 4) - numData * 4))
+		return -EINVAL;
+
+	data->controls.clear();
+
+	for (unsigned int i = 0; i < numLists; ++i) {
+		uint32_t size;
+		if (!readPair(buffer, &size, &reserved))
+			return -EINVAL;
+
+		ByteStreamBuffer b = buffer.carveOut(alignedSize(size));
+		if (buffer.overflow())
+			return -EINVAL;
+
+		data->controls.push_back(controls_.deserialize<ControlList>(b));
+	}
+
+	return 0;
+}
+
+} /* namespace libcamera */
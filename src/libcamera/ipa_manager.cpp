@@ -10,6 +10,7 @@
 #include <algorithm>
 #include <dirent.h>
 #include <string.h>
+#include <sys/stat.h>
 #include <sys/types.h>
 
 #include "ipa_context_wrapper.h"
@@ -17,6 +18,7 @@
 #include "ipa_proxy.h"
 #include "log.h"
 #include "pipeline_handler.h"
+#include "tracer.h"
 #include "utils.h"
 
 /**
@@ -84,6 +86,12 @@ LOG_DEFINE_CATEGORY(IPAManager)
  * +---------------+      over IPC     +---------------+
  * ~~~~
  *
+ * Open-source modules can also be hosted on a dedicated thread by setting the
+ * LIBCAMERA_IPA_THREAD environment variable. The manager then instantiates an
+ * IPAProxyThread that wraps the IPAContextWrapper. IPA events are queued to
+ * the IPA thread without blocking the pipeline handler, and frame actions are
+ * delivered back in the pipeline handler thread.
+ *
  * The IPAInterface implemented by the IPAContextWrapper or IPAProxy is
  * returned to the pipeline handler, and all interactions with the IPA context
  * go the same interface regardless of process isolation.
@@ -98,7 +106,12 @@ IPAManager::IPAManager()
 	unsigned int ipaCount = 0;
 	int ret;
 
-	ret = addDir(IPA_MODULE_DIR);
+	LIBCAMERA_TRACEPOINT(IPAManagerScanBegin, 0);
+
+	IPAModuleCache cache(IPAModuleCache::defaultPath());
+	cache.load();
+
+	ret = addDir(IPA_MODULE_DIR, &cache);
 	if (ret > 0)
 		ipaCount += ret;
 
@@ -107,6 +120,8 @@ IPAManager::IPAManager()
 		if (!ipaCount)
 			LOG(IPAManager, Warning)
 				<< "No IPA found in '" IPA_MODULE_DIR "'";
+		cache.save();
+		LIBCAMERA_TRACEPOINT(IPAManagerScanEnd, ipaCount);
 		return;
 	}
 
@@ -117,7 +132,7 @@ IPAManager::IPAManager()
 
 		if (count) {
 			std::string path(paths, count);
-			ret = addDir(path.c_str());
+			ret = addDir(path.c_str(), &cache);
 			if (ret > 0)
 				ipaCount += ret;
 		}
@@ -132,6 +147,9 @@ IPAManager::IPAManager()
 		LOG(IPAManager, Warning)
 			<< "No IPA found in '" IPA_MODULE_DIR "' and '"
 			<< modulePaths << "'";
+
+	cache.save();
+	LIBCAMERA_TRACEPOINT(IPAManagerScanEnd, ipaCount);
 }
 
 IPAManager::~IPAManager()
@@ -158,14 +176,17 @@ IPAManager *IPAManager::instance()
 /**
  * \brief Load IPA modules from a directory
  * \param[in] libDir directory to search for IPA modules
+ * \param[in] cache The IPA module discovery cache
  *
  * This method tries to create an IPAModule instance for every shared object
- * found in \a libDir, and skips invalid IPA modules.
+ * found in \a libDir, and skips invalid IPA modules. The information of
+ * modules that are unchanged since they have been added to the \a cache is
+ * retrieved from the cache instead of being parsed from the shared object.
  *
  * \return Number of modules loaded by this call, or a negative error code
  * otherwise
  */
-int IPAManager::addDir(const char *libDir)
+int IPAManager::addDir(const char *libDir, IPAModuleCache *cache)
 {
 	struct dirent *ent;
 	DIR *dir;
@@ -191,13 +212,25 @@ int IPAManager::addDir(const char *libDir)
 
 	unsigned int count = 0;
 	for (const std::string &path : paths) {
-		IPAModule *ipaModule = new IPAModule(path);
+		struct stat st;
+		if (stat(path.c_str(), &st) < 0)
+			continue;
+
+		const struct IPAModuleInfo *info = cache->find(path, st);
+
+		IPAModule *ipaModule = info ? new IPAModule(path, *info)
+					    : new IPAModule(path);
 		if (!ipaModule->isValid()) {
 			delete ipaModule;
 			continue;
 		}
 
-		LOG(IPAManager, Debug) << "Loaded IPA module '" << path << "'";
+		if (!info)
+			cache->add(path, st, ipaModule->info());
+
+		LOG(IPAManager, Debug)
+			<< "Loaded IPA module '" << path << "'"
+			<< (info ? " from cache" : "");
 
 		modules_.push_back(ipaModule);
 		count++;
@@ -231,13 +264,23 @@ std::unique_ptr<IPAInterface> IPAManager::createIPA(PipelineHandler *pipe,
 	if (!m)
 		return nullptr;
 
-	if (!m->isOpenSource()) {
+	/*
+	 * Closed-source modules are isolated in a separate process. Open-source
+	 * modules can optionally be run in a dedicated thread.
+	 */
+	const char *proxyName = nullptr;
+	if (!m->isOpenSource())
+		proxyName = "IPAProxyLinux";
+	else if (utils::secure_getenv("LIBCAMERA_IPA_THREAD"))
+		proxyName = "IPAProxyThread";
+
+	if (proxyName) {
 		IPAProxyFactory *pf = nullptr;
 		std::vector<IPAProxyFactory *> &factories = IPAProxyFactory::factories();
 
 		for (IPAProxyFactory *factory : factories) {
 			/* TODO: Better matching */
-			if (!strcmp(factory->name().c_str(), "IPAProxyLinux")) {
+			if (!strcmp(factory->name().c_str(), proxyName)) {
 				pf = factory;
 				break;
 			}
@@ -275,6 +275,30 @@ IPAModule::IPAModule(const std::string &libPath)
 	valid_ = true;
 }
 
+/**
+ * \brief Construct an IPAModule instance from known module information
+ * \param[in] libPath path to IPA module shared object
+ * \param[in] info The IPA module information
+ *
+ * This constructor skips parsing the IPA module shared object, and uses the
+ * IPA module information \a info instead, typically retrieved from an
+ * IPAModuleCache. The information is verified against the content of the
+ * shared object when the module is loaded.
+ *
+ * The caller shall call the isValid() method after constructing an
+ * IPAModule instance to verify the validity of the IPAModule.
+ */
+IPAModule::IPAModule(const std::string &libPath,
+		     const struct IPAModuleInfo &info)
+	: info_(info), libPath_(libPath), valid_(false), loaded_(false),
+	  dlHandle_(nullptr), ipaCreate_(nullptr)
+{
+	if (info_.moduleAPIVersion != IPA_MODULE_API_VERSION)
+		return;
+
+	valid_ = true;
+}
+
 IPAModule::~IPAModule()
 {
 	if (dlHandle_)
@@ -415,6 +439,16 @@ bool IPAModule::load()
 		return false;
 	}
 
+	/* Catch stale module information, for instance from the cache. */
+	const void *info = dlsym(dlHandle_, "ipaModuleInfo");
+	if (!info || memcmp(info, &info_, sizeof(info_))) {
+		LOG(IPAModule, Error)
+			<< "IPA module information mismatch for " << libPath_;
+		dlclose(dlHandle_);
+		dlHandle_ = nullptr;
+		return false;
+	}
+
 	void *symbol = dlsym(dlHandle_, "ipaCreate");
 	if (!symbol) {
 		LOG(IPAModule, Error)
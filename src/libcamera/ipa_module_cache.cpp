@@ -0,0 +1,328 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * ipa_module_cache.cpp - Image Processing Algorithm module discovery cache
+ */
+
+#include "ipa_module_cache.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/types.h>
+#include <unistd.h>
+#include <vector>
+
+#include "byte_stream_buffer.h"
+#include "log.h"
+#include "utils.h"
+
+/**
+ * \file ipa_module_cache.h
+ * \brief Image Processing Algorithm module discovery cache
+ */
+
+namespace libcamera {
+
+LOG_DECLARE_CATEGORY(IPAModule)
+
+namespace {
+
+constexpr uint32_t CacheMagic = 0x4349504c; /* "LPIC" */
+constexpr uint32_t CacheVersion = 1;
+
+struct CacheHeader {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t infoSize;
+	uint32_t count;
+};
+
+struct CacheEntryHeader {
+	uint64_t mtime;
+	uint64_t size;
+	uint32_t pathLength;
+	uint32_t reserved;
+};
+
+} /* namespace */
+
+/**
+ * \class IPAModuleCache
+ * \brief Persistent cache of the IPA module information
+ *
+ * Discovering IPA modules requires opening every shared object found in the
+ * IPA module directories and parsing its ELF sections to locate the
+ * ipaModuleInfo symbol. On slow storage this noticeably delays the startup of
+ * the camera manager.
+ *
+ * The IPAModuleCache stores the IPAModuleInfo of every valid module in a file,
+ * keyed by the module path, modification time and size. When the module files
+ * are unchanged, the IPA manager retrieves the module information from the
+ * cache with a single stat() per module, without opening the module file.
+ *
+ * The cache is only a hint. The module information is verified against the
+ * shared object when the module is loaded with IPAModule::load().
+ */
+
+/**
+ * \brief Construct an IPA module cache stored in \a path
+ * \param[in] path The path to the cache file
+ *
+ * The cache is initially empty. An empty \a path disables the persistent
+ * storage, load() and save() then have no effect.
+ */
+IPAModuleCache::IPAModuleCache(const std::string &path)
+	: path_(path), dirty_(false)
+{
+}
+
+/**
+ * \fn IPAModuleCache::path()
+ * \brief Retrieve the path to the cache file
+ * \return The path to the cache file
+ */
+
+/**
+ * \brief Load the cache content from the cache file
+ *
+ * A missing, outdated or corrupted cache file is ignored and results in an
+ * empty cache.
+ *
+ * \return 0 on success or a negative error code otherwise
+ */
+int IPAModuleCache::load()
+{
+	entries_.clear();
+	dirty_ = false;
+
+	if (path_.empty())
+		return 0;
+
+	int fd = open(path_.c_str(), O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return -errno;
+
+	std::vector<uint8_t> data;
+	struct stat st;
+	int ret = fstat(fd, &st);
+	if (!ret) {
+		data.resize(st.st_size);
+		ssize_t size = read(fd, data.data(), data.size());
+		if (size != static_cast<ssize_t>(data.size()))
+			ret = -EIO;
+	} else {
+		ret = -errno;
+	}
+
+	close(fd);
+
+	if (ret < 0)
+		return ret;
+
+	ByteStreamBuffer buffer(static_cast<const uint8_t *>(data.data()),
+				data.size());
+
+	/* The entries are packed, copy the headers to avoid misaligned access. */
+	CacheHeader header;
+	if (buffer.read(&header) < 0 || header.magic != CacheMagic ||
+	    header.version != CacheVersion ||
+	    header.infoSize != sizeof(struct IPAModuleInfo)) {
+		LOG(IPAModule, Debug) << "Ignoring outdated cache " << path_;
+		return -EINVAL;
+	}
+
+	for (unsigned int i = 0; i < header.count; ++i) {
+		CacheEntryHeader entry;
+		if (buffer.read(&entry) < 0)
+			break;
+
+		const char *path = buffer.read<char>(entry.pathLength);
+		Entry cached;
+		if (!path || buffer.read(&cached.info) < 0)
+			break;
+
+		cached.mtime = entry.mtime;
+		cached.size = entry.size;
+		cached.used = false;
+
+		entries_[std::string(path, entry.pathLength)] = cached;
+	}
+
+	if (buffer.overflow()) {
+		LOG(IPAModule, Debug) << "Ignoring corrupted cache " << path_;
+		entries_.clear();
+		return -EINVAL;
+	}
+
+	return 0;
+}
+
+/**
+ * \brief Store the cache content to the cache file
+ *
+ * Only the entries that have been looked up with find() or added with add()
+ * since the cache was loaded are stored, to drop the modules that have been
+ * removed or modified. The cache file is only written when its content
+ * changes, and is replaced atomically.
+ *
+ * \return 0 on success or a negative error code otherwise
+ */
+int IPAModuleCache::save()
+{
+	if (path_.empty())
+		return 0;
+
+	size_t size = sizeof(CacheHeader);
+	unsigned int count = 0;
+	bool dirty = dirty_;
+
+	for (const auto &entry : entries_) {
+		if (!entry.second.used) {
+			dirty = true;
+			continue;
+		}
+
+		size += sizeof(CacheEntryHeader) + entry.first.size()
+		      + sizeof(struct IPAModuleInfo);
+		count++;
+	}
+
+	if (!dirty)
+		return 0;
+
+	std::vector<uint8_t> data(size);
+	ByteStreamBuffer buffer(data.data(), data.size());
+
+	CacheHeader header = {
+		CacheMagic, CacheVersion, sizeof(struct IPAModuleInfo), count
+	};
+	buffer.write(&header);
+
+	for (const auto &entry : entries_) {
+		if (!entry.second.used)
+			continue;
+
+		CacheEntryHeader entryHeader = {
+			entry.second.mtime, entry.second.size,
+			static_cast<uint32_t>(entry.first.size()), 0
+		};
+		buffer.write(&entryHeader);
+		buffer.write(Span<const char>(entry.first.data(),
+					      entry.first.size()));
+		buffer.write(&entry.second.info);
+	}
+
+	/* Create the parent directories. */
+	for (size_t pos = path_.find('/', 1); pos != std::string::npos;
+	     pos = path_.find('/', pos + 1)) {
+		std::string dir = path_.substr(0, pos);
+		if (mkdir(dir.c_str(), 0755) < 0 && errno != EEXIST) {
+			int ret = -errno;
+			LOG(IPAModule, Debug)
+				<< "Failed to create cache directory " << dir
+				<< ": " << strerror(-ret);
+			return ret;
+		}
+	}
+
+	std::string tmpPath = path_ + "." + std::to_string(getpid());
+	int fd = open(tmpPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+		      0644);
+	if (fd < 0) {
+		int ret = -errno;
+		LOG(IPAModule, Debug)
+			<< "Failed to create cache " << tmpPath << ": "
+			<< strerror(-ret);
+		return ret;
+	}
+
+	ssize_t written = write(fd, data.data(), data.size());
+	close(fd);
+
+	if (written != static_cast<ssize_t>(data.size()) ||
+	    rename(tmpPath.c_str(), path_.c_str()) < 0) {
+		unlink(tmpPath.c_str());
+		LOG(IPAModule, Debug) << "Failed to write cache " << path_;
+		return -EIO;
+	}
+
+	dirty_ = false;
+	return 0;
+}
+
+/**
+ * \brief Look up the information of an IPA module in the cache
+ * \param[in] libPath The path to the IPA module shared object
+ * \param[in] st The status of the IPA module file, as returned by stat()
+ *
+ * \return A pointer to the cached IPA module information if the module file
+ * is unchanged, or nullptr otherwise
+ */
+const struct IPAModuleInfo *IPAModuleCache::find(const std::string &libPath,
+						 const struct stat &st)
+{
+	auto it = entries_.find(libPath);
+	if (it == entries_.end())
+		return nullptr;
+
+	Entry &entry = it->second;
+	if (entry.mtime != mtime(st) ||
+	    entry.size != static_cast<uint64_t>(st.st_size))
+		return nullptr;
+
+	entry.used = true;
+	return &entry.info;
+}
+
+/**
+ * \brief Add the information of an IPA module to the cache
+ * \param[in] libPath The path to the IPA module shared object
+ * \param[in] st The status of the IPA module file, as returned by stat()
+ * \param[in] info The IPA module information
+ */
+void IPAModuleCache::add(const std::string &libPath, const struct stat &st,
+			 const struct IPAModuleInfo &info)
+{
+	Entry &entry = entries_[libPath];
+	entry.mtime = mtime(st);
+	entry.size = st.st_size;
+	entry.info = info;
+	entry.used = true;
+
+	dirty_ = true;
+}
+
+/**
+ * \brief Retrieve the default path of the IPA module cache file
+ *
+ * The cache is stored in the libcamera cache directory, see
+ * utils::cacheDirectory(). The LIBCAMERA_IPA_CACHE
+ * environment variable overrides the cache file path, an empty value disables
+ * the cache.
+ *
+ * \return The default path of the cache file, or an empty string if the cache
+ * is disabled or no cache directory is available
+ */
+std::string IPAModuleCache::defaultPath()
+{
+	const char *path = utils::secure_getenv("LIBCAMERA_IPA_CACHE");
+	if (path)
+		return path;
+
+	std::string dir = utils::cacheDirectory();
+	if (dir.empty())
+		return dir;
+
+	return dir + "/ipa_modules.cache";
+}
+
+uint64_t IPAModuleCache::mtime(const struct stat &st)
+{
+	return static_cast<uint64_t>(st.st_mtim.tv_sec) * 1000000000ULL
+	       + st.st_mtim.tv_nsec;
+}
+
+} /* namespace libcamera */
@@ -0,0 +1,462 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * ipa_recording.cpp - Recording of IPA statistics for offline replay
+ */
+
+#include "ipa_recording.h"
+
+#include <algorithm>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "byte_stream_buffer.h"
+#include "log.h"
+
+/**
+ * \file ipa_recording.h
+ * \brief Recording of IPA statistics for offline replay
+ */
+
+namespace libcamera {
+
+LOG_DEFINE_CATEGORY(IPARecording)
+
+namespace {
+
+constexpr uint32_t RecordingMagic = 0x5249434c; /* "LCIR" */
+constexpr uint32_t RecordingVersion = 1;
+constexpr size_t RecordAlignment = 8;
+constexpr size_t GrowthSize = 1 << 20;
+
+struct FileHeader {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t pixelFormat;
+	uint32_t width;
+	uint32_t height;
+	uint32_t infoMapSize;
+};
+
+struct RecordHeader {
+	uint32_t size;
+	uint32_t sequence;
+	uint64_t timestamp;
+	uint32_t statsSize;
+	uint32_t controlsSize;
+};
+
+size_t alignRecord(size_t size)
+{
+	return (size + RecordAlignment - 1) & ~(RecordAlignment - 1);
+}
+
+} /* namespace */
+
+/**
+ * \struct IPARecordingFrame
+ * \brief A frame stored in an IPA recording
+ *
+ * \var IPARecordingFrame::sequence
+ * \brief The frame sequence number
+ *
+ * \var IPARecordingFrame::timestamp
+ * \brief The frame timestamp, in nanoseconds
+ *
+ * \var IPARecordingFrame::stats
+ * \brief The raw content of the statistics buffer
+ *
+ * The statistics are stored as produced by the device, and are passed to the
+ * IPA as-is at replay time. When read from an IPARecordingReader, the span
+ * references the memory-mapped recording and stays valid until the reader is
+ * closed.
+ *
+ * \var IPARecordingFrame::sensorControls
+ * \brief The sensor controls applied to the frame
+ */
+
+/**
+ * \class IPARecordingWriter
+ * \brief Record the statistics and sensor controls of captured frames
+ *
+ * The IPARecordingWriter class writes the inputs of an IPA, the statistics
+ * buffers and the sensor controls of each frame, to a file that can be fed
+ * later to the IPA with the IPARecordingReader. This allows running the IPA
+ * algorithms repeatably and without hardware, to benchmark them and diff their
+ * output across changes.
+ *
+ * The recording starts with a header that stores the stream configuration and
+ * the sensor ControlInfoMap, followed by one record per frame. The file is
+ * memory-mapped and grown in large chunks, writing a frame thus costs a
+ * memcpy of its statistics. Records are written in place in the shared
+ * mapping, a recording interrupted without close() stays readable up to the
+ * last complete frame.
+ */
+
+IPARecordingWriter::IPARecordingWriter()
+	: fd_(-1), mem_(nullptr), capacity_(0), size_(0), frames_(0)
+{
+}
+
+IPARecordingWriter::~IPARecordingWriter()
+{
+	close();
+}
+
+/**
+ * \brief Create a recording
+ * \param[in] path The path of the recording file
+ * \param[in] stream The configuration of the stream the IPA is configured with
+ * \param[in] sensorControls The sensor controls information
+ *
+ * The file at \a path is created, or truncated if it exists. Any recording
+ * previously open is closed first.
+ *
+ * \return 0 on success or a negative error code otherwise
+ */
+int IPARecordingWriter::open(const std::string &path, const IPAStream &stream,
+			     const ControlInfoMap &sensorControls)
+{
+	close();
+
+	fd_ = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (fd_ == -1) {
+		int ret = -errno;
+		LOG(IPARecording, Error)
+			<< "Failed to create " << path << ": " << strerror(-ret);
+		return ret;
+	}
+
+	serializer_.reset();
+
+	size_t infoMapSize = ControlSerializer::binarySize(sensorControls);
+	uint8_t *data = reserve(sizeof(FileHeader) + infoMapSize);
+	if (!data) {
+		close();
+		return -ENOMEM;
+	}
+
+	FileHeader *header = reinterpret_cast<FileHeader *>(data);
+	header->magic = RecordingMagic;
+	header->version = RecordingVersion;
+	header->pixelFormat = stream.pixelFormat;
+	header->width = stream.size.width;
+	header->height = stream.size.height;
+	header->infoMapSize = infoMapSize;
+
+	ByteStreamBuffer buffer(data + sizeof(FileHeader), infoMapSize);
+	int ret = serializer_.serialize(sensorControls, buffer);
+	if (ret < 0) {
+		LOG(IPARecording, Error) << "Failed to serialize sensor controls";
+		close();
+		return ret;
+	}
+
+	return 0;
+}
+
+/**
+ * \brief Close the recording
+ *
+ * The file is truncated to the size of the recorded data.
+ */
+void IPARecordingWriter::close()
+{
+	if (mem_) {
+		munmap(mem_, capacity_);
+		mem_ = nullptr;
+	}
+
+	if (fd_ != -1) {
+		if (ftruncate(fd_, size_) < 0)
+			LOG(IPARecording, Warning)
+				<< "Failed to truncate recording: "
+				<< strerror(errno);
+
+		::close(fd_);
+		fd_ = -1;
+	}
+
+	capacity_ = 0;
+	size_ = 0;
+	frames_ = 0;
+}
+
+/**
+ * \fn IPARecordingWriter::isOpen()
+ * \brief Check if a recording is open
+ * \return True if a recording is open, false otherwise
+ */
+
+/**
+ * \brief Record a frame
+ * \param[in] sequence The frame sequence number
+ * \param[in] timestamp The frame timestamp, in nanoseconds
+ * \param[in] stats The content of the statistics buffer
+ * \param[in] sensorControls The sensor controls applied to the frame
+ *
+ * The \a sensorControls shall be bound to the ControlInfoMap passed to open().
+ *
+ * \return 0 on success or a negative error code otherwise
+ */
+int IPARecordingWriter::write(uint32_t sequence, uint64_t timestamp,
+			      Span<const uint8_t> stats,
+			      const ControlList &sensorControls)
+{
+	if (!isOpen())
+		return -EBADF;
+
+	size_t statsSize = alignRecord(stats.size());
+	size_t controlsSize = ControlSerializer::binarySize(sensorControls);
+	size_t size = sizeof(RecordHeader) + statsSize + controlsSize;
+
+	uint8_t *data = reserve(size);
+	if (!data)
+		return -ENOMEM;
+
+	ByteStreamBuffer buffer(data + sizeof(RecordHeader) + statsSize,
+				controlsSize);
+	int ret = serializer_.serialize(sensorControls, buffer);
+	if (ret < 0) {
+		/* Drop the record, the next one overwrites it. */
+		size_ -= alignRecord(size);
+		return ret;
+	}
+
+	memcpy(data + sizeof(RecordHeader), stats.data(), stats.size());
+
+	/* Write the size last to mark the record complete. */
+	RecordHeader *header = reinterpret_cast<RecordHeader *>(data);
+	header->sequence = sequence;
+	header->timestamp = timestamp;
+	header->statsSize = stats.size();
+	header->controlsSize = controlsSize;
+	header->size = alignRecord(size);
+
+	frames_++;
+
+	return 0;
+}
+
+/**
+ * \fn IPARecordingWriter::frames()
+ * \brief Retrieve the number of frames recorded
+ * \return The number of frames recorded since the recording has been opened
+ */
+
+/*
+ * Reserve \a size bytes at the end of the recording, growing the file and its
+ * mapping as needed, and return a pointer to the reserved memory.
+ */
+uint8_t *IPARecordingWriter::reserve(size_t size)
+{
+	size = alignRecord(size);
+
+	if (size_ + size > capacity_) {
+		size_t capacity = std::max(capacity_ * 2, capacity_ + size + GrowthSize);
+		capacity = (capacity + GrowthSize - 1) / GrowthSize * GrowthSize;
+
+		if (ftruncate(fd_, capacity) < 0) {
+			LOG(IPARecording, Error)
+				<< "Failed to grow recording: " << strerror(errno);
+			return nullptr;
+		}
+
+		void *mem = mem_ ? mremap(mem_, capacity_, capacity, MREMAP_MAYMOVE)
+				 : mmap(nullptr, capacity, PROT_READ | PROT_WRITE,
+					MAP_SHARED, fd_, 0);
+		if (mem == MAP_FAILED) {
+			LOG(IPARecording, Error)
+				<< "Failed to map recording: " << strerror(errno);
+			return nullptr;
+		}
+
+		mem_ = static_cast<uint8_t *>(mem);
+		capacity_ = capacity;
+	}
+
+	uint8_t *data = mem_ + size_;
+	size_ += size;
+
+	return data;
+}
+
+/**
+ * \class IPARecordingReader
+ * \brief Read the frames of an IPA recording
+ *
+ * The IPARecordingReader class reads a file produced by IPARecordingWriter.
+ * The file is memory-mapped, frames are retrieved in order with next()
+ * without copying their statistics. The recording can be read again from the
+ * start with rewind().
+ */
+
+IPARecordingReader::IPARecordingReader()
+	: mem_(nullptr), size_(0), dataOffset_(0), offset_(0), stream_{}
+{
+}
+
+IPARecordingReader::~IPARecordingReader()
+{
+	close();
+}
+
+/**
+ * \brief Open a recording
+ * \param[in] path The path of the recording file
+ * \return 0 on success or a negative error code otherwise
+ */
+int IPARecordingReader::open(const std::string &path)
+{
+	close();
+
+	int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+	if (fd == -1) {
+		int ret = -errno;
+		LOG(IPARecording, Error)
+			<< "Failed to open " << path << ": " << strerror(-ret);
+		return ret;
+	}
+
+	struct stat st;
+	if (fstat(fd, &st) < 0 ||
+	    static_cast<size_t>(st.st_size) < sizeof(FileHeader)) {
+		LOG(IPARecording, Error) << "Invalid recording " << path;
+		::close(fd);
+		return -EINVAL;
+	}
+
+	void *mem = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	::close(fd);
+	if (mem == MAP_FAILED) {
+		int ret = -errno;
+		LOG(IPARecording, Error)
+			<< "Failed to map " << path << ": " << strerror(-ret);
+		return ret;
+	}
+
+	mem_ = static_cast<const uint8_t *>(mem);
+	size_ = st.st_size;
+
+	const FileHeader *header = reinterpret_cast<const FileHeader *>(mem_);
+	if (header->magic != RecordingMagic ||
+	    header->version != RecordingVersion ||
+	    header->infoMapSize > size_ - sizeof(FileHeader)) {
+		LOG(IPARecording, Error) << "Invalid recording " << path;
+		close();
+		return -EINVAL;
+	}
+
+	stream_.pixelFormat = header->pixelFormat;
+	stream_.size = Size(header->width, header->height);
+
+	serializer_.reset();
+
+	ByteStreamBuffer buffer(mem_ + sizeof(FileHeader), header->infoMapSize);
+	sensorControls_ = serializer_.deserialize<ControlInfoMap>(buffer);
+	if (buffer.overflow()) {
+		LOG(IPARecording, Error) << "Invalid sensor controls in " << path;
+		close();
+		return -EINVAL;
+	}
+
+	dataOffset_ = alignRecord(sizeof(FileHeader) + header->infoMapSize);
+	offset_ = dataOffset_;
+
+	return 0;
+}
+
+/**
+ * \brief Close the recording
+ */
+void IPARecordingReader::close()
+{
+	if (!mem_)
+		return;
+
+	munmap(const_cast<uint8_t *>(mem_), size_);
+	mem_ = nullptr;
+	size_ = 0;
+	dataOffset_ = 0;
+	offset_ = 0;
+}
+
+/**
+ * \fn IPARecordingReader::isOpen()
+ * \brief Check if a recording is open
+ * \return True if a recording is open, false otherwise
+ */
+
+/**
+ * \fn IPARecordingReader::stream()
+ * \brief Retrieve the configuration of the recorded stream
+ * \return The stream configuration
+ */
+
+/**
+ * \fn IPARecordingReader::sensorControls()
+ * \brief Retrieve the sensor controls information of the recording
+ * \return The sensor controls information
+ */
+
+/**
+ * \brief Read the next frame of the recording
+ * \param[out] frame The frame
+ *
+ * The statistics of the \a frame reference the recording memory and stay
+ * valid until the reader is closed.
+ *
+ * \return 0 on success, -ENODATA when the end of the recording has been
+ * reached, or another negative error code if the recording is corrupted
+ */
+int IPARecordingReader::next(IPARecordingFrame *frame)
+{
+	if (!mem_)
+		return -EBADF;
+
+	if (size_ - offset_ < sizeof(RecordHeader))
+		return -ENODATA;
+
+	const RecordHeader *header =
+		reinterpret_cast<const RecordHeader *>(mem_ + offset_);
+
+	/* A zero size marks the end of an interrupted recording. */
+	if (!header->size)
+		return -ENODATA;
+
+	size_t statsSize = alignRecord(header->statsSize);
+	if (header->size > size_ - offset_ ||
+	    sizeof(RecordHeader) + statsSize + header->controlsSize > header->size) {
+		LOG(IPARecording, Error)
+			<< "Corrupted record at offset " << offset_;
+		return -EINVAL;
+	}
+
+	const uint8_t *data = mem_ + offset_ + sizeof(RecordHeader);
+
+	frame->sequence = header->sequence;
+	frame->timestamp = header->timestamp;
+	frame->stats = { data, header->statsSize };
+
+	ByteStreamBuffer buffer(data + statsSize, header->controlsSize);
+	frame->sensorControls = serializer_.deserialize<ControlList>(buffer);
+
+	offset_ += header->size;
+
+	return 0;
+}
+
+/**
+ * \brief Restart reading from the first frame of the recording
+ */
+void IPARecordingReader::rewind()
+{
+	offset_ = dataOffset_;
+}
+
+} /* namespace libcamera */
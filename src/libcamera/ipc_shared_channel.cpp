@@ -0,0 +1,311 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * ipc_shared_channel.cpp - IPC channel based on shared memory rings
+ */
+
+#include "ipc_shared_channel.h"
+
+#include <errno.h>
+#include <unistd.h>
+
+#include "log.h"
+
+/**
+ * \file ipc_shared_channel.h
+ * \brief IPC channel based on shared memory rings
+ */
+
+namespace libcamera {
+
+LOG_DEFINE_CATEGORY(IPCSharedChannel)
+
+namespace {
+
+struct MessageHeader {
+	uint32_t fds;
+	uint32_t reserved;
+};
+
+constexpr uint32_t MaxMessageFds = 255;
+
+} /* namespace */
+
+/**
+ * \class IPCSharedChannel
+ * \brief Bidirectional message channel based on shared memory rings
+ *
+ * The IPCSharedChannel class transports messages between two processes
+ * through a pair of IPCSharedRing, one per direction. An IPCUnixSocket is used
+ * as a doorbell to wake up the receiver, and to pass file descriptors along
+ * with messages. As the receiver drains all pending messages on every
+ * doorbell, and the sender only rings the doorbell when the receiver is idle,
+ * a burst of messages costs a single wakeup.
+ *
+ * Establishment of the channel follows the IPCUnixSocket model. One side
+ * creates the channel with create(), which returns file descriptors for the
+ * remote side. The remote side binds to the channel by passing the file
+ * descriptors to bind().
+ *
+ * Messages are written in place. The sender reserves space in the ring with
+ * reserve(), fills it, and sends the message with commit(). The receiver gets
+ * notified through the \ref readyRead signal, and shall then call receive()
+ * and release() in a loop until receive() returns -EAGAIN.
+ */
+
+IPCSharedChannel::IPCSharedChannel()
+	: pending_(nullptr)
+{
+	socket_.readyRead.connect(this, &IPCSharedChannel::doorbell);
+}
+
+IPCSharedChannel::~IPCSharedChannel()
+{
+	close();
+}
+
+/**
+ * \brief Create a new channel
+ * \param[in] size The size of each ring in bytes
+ * \param[out] fds The file descriptors for the remote side of the channel
+ *
+ * This method creates the doorbell socket and the shared memory rings. The
+ * file descriptors stored in \a fds shall be passed to the remote process,
+ * which binds to the channel with bind(). The caller owns the first file
+ * descriptor, which is the remote side of the socket, and shall close it once
+ * passed to the remote process. The other file descriptors are owned by the
+ * channel.
+ *
+ * \return 0 on success or a negative error code otherwise
+ */
+int IPCSharedChannel::create(size_t size, std::vector<int> *fds)
+{
+	if (isBound())
+		return -EINVAL;
+
+	int ret = tx_.create(size);
+	if (ret < 0)
+		return ret;
+
+	ret = rx_.create(size);
+	if (ret < 0) {
+		close();
+		return ret;
+	}
+
+	int fd = socket_.create(IPCUnixSocket::SeqPacket);
+	if (fd < 0) {
+		close();
+		return fd;
+	}
+
+	*fds = { fd, tx_.fd(), rx_.fd() };
+
+	return 0;
+}
+
+/**
+ * \brief Bind to an existing channel
+ * \param[in] fds The file descriptors returned by create() on the remote side
+ *
+ * Ownership of the file descriptors is transferred to the channel.
+ *
+ * \return 0 on success or a negative error code otherwise
+ */
+int IPCSharedChannel::bind(const std::vector<int> &fds)
+{
+	if (isBound())
+		return -EINVAL;
+
+	if (fds.size() != 3)
+		return -EINVAL;
+
+	int ret = rx_.bind(fds[1]);
+	if (ret < 0)
+		return ret;
+
+	ret = tx_.bind(fds[2]);
+	if (ret < 0) {
+		close();
+		return ret;
+	}
+
+	ret = socket_.bind(fds[0]);
+	if (ret < 0) {
+		close();
+		return ret;
+	}
+
+	return 0;
+}
+
+/**
+ * \brief Close the channel
+ *
+ * File descriptors received with messages that haven't been retrieved with
+ * receive() are closed.
+ */
+void IPCSharedChannel::close()
+{
+	socket_.close();
+	tx_.close();
+	rx_.close();
+	pending_ = nullptr;
+
+	for (int32_t fd : fds_)
+		::close(fd);
+	fds_.clear();
+}
+
+/**
+ * \fn IPCSharedChannel::isBound()
+ * \brief Check if the channel is bound
+ * \return True if the channel is bound, false otherwise
+ */
+
+/**
+ * \brief Reserve space to send a message
+ * \param[in] size The message size in bytes
+ *
+ * Reserving a new message discards any previously reserved message that hasn't
+ * been sent with commit().
+ *
+ * \return The memory to write the message to, or an empty span if the
+ * transmission ring doesn't have enough free space
+ */
+Span<uint8_t> IPCSharedChannel::reserve(size_t size)
+{
+	Span<uint8_t> record = tx_.reserve(sizeof(MessageHeader) + size);
+	if (record.empty()) {
+		LOG(IPCSharedChannel, Error)
+			<< "No space for a " << size << " bytes message";
+		return {};
+	}
+
+	pending_ = record.data();
+
+	return record.subspan(sizeof(MessageHeader));
+}
+
+/**
+ * \brief Send the message reserved with reserve()
+ * \param[in] fds The file descriptors to send along with the message
+ *
+ * The file descriptors are duplicated by the kernel, the caller retains
+ * ownership of \a fds.
+ *
+ * \return 0 on success or a negative error code otherwise
+ */
+int IPCSharedChannel::commit(const std::vector<int32_t> &fds)
+{
+	if (!pending_ || fds.size() > MaxMessageFds)
+		return -EINVAL;
+
+	MessageHeader *header = reinterpret_cast<MessageHeader *>(pending_);
+	header->fds = fds.size();
+	header->reserved = 0;
+	pending_ = nullptr;
+
+	bool wakeup = tx_.commit();
+	if (!wakeup && fds.empty())
+		return 0;
+
+	/* File descriptors can only be passed through the socket. */
+	IPCUnixSocket::Payload payload;
+	payload.data.resize(1);
+	payload.fds = fds;
+
+	return socket_.send(payload);
+}
+
+/**
+ * \brief Retrieve the oldest pending message
+ * \param[out] data The message contents
+ * \param[out] fds The file descriptors received with the message
+ *
+ * The message contents stay valid until release() is called. Ownership of the
+ * file descriptors is transferred to the caller.
+ *
+ * \return 0 on success or a negative error code otherwise
+ * \retval -EAGAIN No message is pending
+ */
+int IPCSharedChannel::receive(Span<const uint8_t> *data,
+			      std::vector<int32_t> *fds)
+{
+	while (true) {
+		Span<const uint8_t> record = rx_.front();
+		if (record.empty()) {
+			if (rx_.sleep())
+				return -EAGAIN;
+			continue;
+		}
+
+		if (record.size() < sizeof(MessageHeader)) {
+			LOG(IPCSharedChannel, Error) << "Message too short";
+			rx_.pop();
+			continue;
+		}
+
+		const MessageHeader *header =
+			reinterpret_cast<const MessageHeader *>(record.data());
+		uint32_t numFds = header->fds;
+		if (numFds > MaxMessageFds) {
+			LOG(IPCSharedChannel, Error) << "Too many file descriptors";
+			rx_.pop();
+			continue;
+		}
+
+		/* Wait for the doorbell that carries the file descriptors. */
+		if (numFds > fds_.size())
+			return -EAGAIN;
+
+		fds->assign(fds_.begin(), fds_.begin() + numFds);
+		fds_.erase(fds_.begin(), fds_.begin() + numFds);
+
+		*data = record.subspan(sizeof(MessageHeader));
+		return 0;
+	}
+}
+
+/**
+ * \brief Release the message retrieved with receive()
+ */
+void IPCSharedChannel::release()
+{
+	rx_.pop();
+}
+
+/**
+ * \var IPCSharedChannel::readyRead
+ * \brief A Signal emitted when messages are ready to be received
+ */
+
+/**
+ * \var IPCSharedChannel::disconnected
+ * \brief A Signal emitted when the remote side closes the channel
+ */
+
+void IPCSharedChannel::doorbell(IPCUnixSocket *socket)
+{
+	int ret;
+
+	/* Drain all the doorbells queued since the last wakeup. */
+	while (!(ret = socket->receive(&doorbell_)))
+		fds_.insert(fds_.end(), doorbell_.fds.begin(), doorbell_.fds.end());
+
+	if (ret == -ECONNRESET) {
+		disconnected.emit(this);
+		return;
+	}
+
+	if (ret != -EAGAIN) {
+		LOG(IPCSharedChannel, Error)
+			<< "Failed to receive doorbell: " << ret;
+		return;
+	}
+
+	readyRead.emit(this);
+}
+
+} /* namespace libcamera */
@@ -0,0 +1,455 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * ipc_shared_ring.cpp - Shared memory ring buffer for IPC
+ */
+
+#include "ipc_shared_ring.h"
+
+#include <atomic>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "log.h"
+
+/**
+ * \file ipc_shared_ring.h
+ * \brief Shared memory ring buffer for IPC
+ */
+
+namespace libcamera {
+
+LOG_DEFINE_CATEGORY(IPCSharedRing)
+
+static_assert(ATOMIC_INT_LOCK_FREE == 2,
+	      "Shared memory rings require lock-free atomics");
+
+namespace {
+
+constexpr uint32_t RingMagic = 0x4c435252; /* "LCRR" */
+constexpr size_t HeaderSize = 256;
+constexpr uint32_t RecordAlignment = 8;
+constexpr uint32_t RecordWrap = 0xffffffff;
+
+struct RecordHeader {
+	uint32_t length;
+	uint32_t reserved;
+};
+
+uint32_t alignRecord(size_t size)
+{
+	return (size + RecordAlignment - 1) & ~(RecordAlignment - 1);
+}
+
+} /* namespace */
+
+/*
+ * The head and tail indices are free-running and are only reduced modulo the
+ * ring size when accessing the data. They are written by the producer and the
+ * consumer respectively, and stored in separate cache lines to avoid false
+ * sharing.
+ */
+struct IPCSharedRing::Header {
+	uint32_t magic;
+	uint32_t size;
+
+	alignas(64) std::atomic<uint32_t> head;
+	alignas(64) std::atomic<uint32_t> tail;
+	alignas(64) std::atomic<uint32_t> sleeping;
+};
+
+/**
+ * \class IPCSharedRing
+ * \brief Single-producer single-consumer ring buffer in shared memory
+ *
+ * The IPCSharedRing class implements a ring buffer of variable-size records,
+ * stored in a memfd-backed memory area that is shared between two processes.
+ * One process produces records, the other consumes them, without any system
+ * call or copy through the kernel. Messages exchanged at frame rate between a
+ * pipeline handler and an isolated IPA are thus transported at the cost of a
+ * memcpy.
+ *
+ * The ring memory is allocated with create(). Its file descriptor, retrieved
+ * with fd(), is passed to the other process, which then maps the ring with
+ * bind().
+ *
+ * The producer reserves space for a record with reserve(), fills it in place,
+ * and publishes it with commit(). The consumer accesses the oldest record with
+ * front() and releases it with pop(). Records are delivered in order, and a
+ * reserved record that isn't committed is discarded by the next reserve()
+ * call.
+ *
+ * The ring doesn't notify the consumer of new records by itself. The consumer
+ * shall instead rely on an out-of-band doorbell, such as an IPCUnixSocket
+ * message. To minimize the number of doorbells, the consumer calls sleep()
+ * when it finds the ring empty, and the producer only rings the doorbell when
+ * commit() reports that the consumer is sleeping:
+ *
+ * \code{.cpp}
+ * // Producer
+ * Span<uint8_t> record = ring.reserve(size);
+ * if (record.empty())
+ *	return -ENOSPC;
+ * fill(record);
+ * if (ring.commit())
+ *	doorbell();
+ *
+ * // Consumer, on doorbell
+ * while (true) {
+ *	Span<const uint8_t> record = ring.front();
+ *	if (record.empty()) {
+ *		if (ring.sleep())
+ *			break;
+ *		continue;
+ *	}
+ *	process(record);
+ *	ring.pop();
+ * }
+ * \endcode
+ *
+ * The memory shared with the other process can't be trusted. The ring keeps
+ * its own copy of the size, and validates the indices and record lengths read
+ * from shared memory before using them.
+ */
+
+IPCSharedRing::IPCSharedRing()
+	: fd_(-1), mem_(MAP_FAILED), length_(0), header_(nullptr),
+	  data_(nullptr), size_(0), reserved_(false), reservedEnd_(0),
+	  front_(false), frontEnd_(0)
+{
+}
+
+IPCSharedRing::~IPCSharedRing()
+{
+	close();
+}
+
+/**
+ * \brief Create a new ring
+ * \param[in] size The size of the ring data area in bytes
+ *
+ * This method allocates the ring memory and maps it. The \a size is rounded
+ * up to the next power of two. The ring can hold records totalling up to
+ * \a size bytes, including an 8 bytes header per record. The file descriptor
+ * referencing the ring memory is retrieved with fd(), and can be passed to
+ * another process that binds to the ring with bind().
+ *
+ * \return 0 on success or a negative error code otherwise
+ */
+int IPCSharedRing::create(size_t size)
+{
+	static_assert(sizeof(Header) <= HeaderSize, "Ring header too large");
+
+	if (isBound())
+		return -EINVAL;
+
+	if (size < RecordAlignment * 2 || size > 1U << 30)
+		return -EINVAL;
+
+	uint32_t ringSize = RecordAlignment * 2;
+	while (ringSize < size)
+		ringSize <<= 1;
+
+	int fd = memfd_create("libcamera-ipc-ring", MFD_ALLOW_SEALING);
+	if (fd < 0) {
+		int ret = -errno;
+		LOG(IPCSharedRing, Error)
+			<< "Failed to create memfd: " << strerror(-ret);
+		return ret;
+	}
+
+	/* Seal the size to prevent the other process from shrinking it. */
+	int ret = ftruncate(fd, HeaderSize + ringSize);
+	if (!ret)
+		ret = fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL);
+	if (ret < 0) {
+		ret = -errno;
+		LOG(IPCSharedRing, Error)
+			<< "Failed to size memfd: " << strerror(-ret);
+		::close(fd);
+		return ret;
+	}
+
+	ret = map(fd, HeaderSize + ringSize);
+	if (ret < 0) {
+		::close(fd);
+		return ret;
+	}
+
+	header_->magic = RingMagic;
+	header_->size = ringSize;
+	header_->head.store(0, std::memory_order_relaxed);
+	header_->tail.store(0, std::memory_order_relaxed);
+	/* The consumer hasn't started, the first commit needs a doorbell. */
+	header_->sleeping.store(1, std::memory_order_relaxed);
+	size_ = ringSize;
+
+	return 0;
+}
+
+/**
+ * \brief Bind to an existing ring
+ * \param[in] fd The file descriptor of the ring memory
+ *
+ * This method maps the ring memory identified by \a fd, obtained from the
+ * fd() method of the ring instance that created it. Ownership of \a fd is
+ * transferred to the ring.
+ *
+ * \return 0 on success or a negative error code otherwise
+ */
+int IPCSharedRing::bind(int fd)
+{
+	if (isBound())
+		return -EINVAL;
+
+	struct stat st;
+	if (fstat(fd, &st) < 0) {
+		int ret = -errno;
+		LOG(IPCSharedRing, Error)
+			<< "Failed to stat ring: " << strerror(-ret);
+		return ret;
+	}
+
+	if (st.st_size <= static_cast<off_t>(HeaderSize)) {
+		LOG(IPCSharedRing, Error) << "Ring memory too small";
+		return -EINVAL;
+	}
+
+	int ret = map(fd, st.st_size);
+	if (ret < 0)
+		return ret;
+
+	uint32_t ringSize = header_->size;
+	if (header_->magic != RingMagic ||
+	    ringSize != st.st_size - HeaderSize ||
+	    ringSize & (ringSize - 1)) {
+		LOG(IPCSharedRing, Error) << "Invalid ring header";
+		close();
+		return -EINVAL;
+	}
+
+	size_ = ringSize;
+
+	return 0;
+}
+
+/**
+ * \brief Unmap the ring and close its file descriptor
+ */
+void IPCSharedRing::close()
+{
+	if (mem_ != MAP_FAILED)
+		munmap(mem_, length_);
+
+	if (fd_ != -1)
+		::close(fd_);
+
+	fd_ = -1;
+	mem_ = MAP_FAILED;
+	length_ = 0;
+	header_ = nullptr;
+	data_ = nullptr;
+	size_ = 0;
+	reserved_ = false;
+	front_ = false;
+}
+
+/**
+ * \fn IPCSharedRing::isBound()
+ * \brief Check if the ring is mapped
+ * \return True if the ring has been created or bound, false otherwise
+ */
+
+/**
+ * \fn IPCSharedRing::fd()
+ * \brief Retrieve the file descriptor of the ring memory
+ * \return The file descriptor, or -1 if the ring isn't bound
+ */
+
+/**
+ * \fn IPCSharedRing::capacity()
+ * \brief Retrieve the size of the ring data area
+ * \return The size of the ring data area in bytes
+ */
+
+/**
+ * \brief Reserve space to produce a record
+ * \param[in] size The record size in bytes
+ *
+ * The reserved space is only visible to the consumer once committed with
+ * commit(). Reserving a new record discards any previously reserved record
+ * that hasn't been committed.
+ *
+ * \return The reserved memory, or an empty span if the ring doesn't have
+ * enough free space
+ */
+Span<uint8_t> IPCSharedRing::reserve(size_t size)
+{
+	if (!isBound() || size > size_)
+		return {};
+
+	uint32_t need = sizeof(RecordHeader) + alignRecord(size);
+	uint32_t head = header_->head.load(std::memory_order_relaxed);
+	uint32_t tail = header_->tail.load(std::memory_order_acquire);
+	uint32_t used = head - tail;
+	if (used > size_) {
+		LOG(IPCSharedRing, Error) << "Corrupted ring indices";
+		return {};
+	}
+
+	/* Records are contiguous, wrap to the beginning if needed. */
+	uint32_t offset = head & (size_ - 1);
+	uint32_t contiguous = size_ - offset;
+	uint32_t position = head;
+
+	if (need > contiguous) {
+		if (need + contiguous > size_ - used)
+			return {};
+
+		position += contiguous;
+	} else if (need > size_ - used) {
+		return {};
+	}
+
+	reserved_ = true;
+	reservedEnd_ = position + need;
+
+	if (position != head) {
+		RecordHeader *wrap = reinterpret_cast<RecordHeader *>(data_ + offset);
+		wrap->length = RecordWrap;
+	}
+
+	RecordHeader *record =
+		reinterpret_cast<RecordHeader *>(data_ + (position & (size_ - 1)));
+	record->length = size;
+	record->reserved = 0;
+
+	return { reinterpret_cast<uint8_t *>(record + 1), size };
+}
+
+/**
+ * \brief Publish the reserved record to the consumer
+ *
+ * \return True if the consumer is sleeping and needs to be woken up, false
+ * otherwise
+ */
+bool IPCSharedRing::commit()
+{
+	if (!isBound() || !reserved_)
+		return false;
+
+	header_->head.store(reservedEnd_, std::memory_order_seq_cst);
+	reserved_ = false;
+
+	return header_->sleeping.exchange(0, std::memory_order_seq_cst);
+}
+
+/**
+ * \brief Retrieve the oldest record
+ *
+ * The record stays valid until it is released with pop().
+ *
+ * \return The record data, or an empty span if the ring is empty
+ */
+Span<const uint8_t> IPCSharedRing::front()
+{
+	if (!isBound())
+		return {};
+
+	uint32_t tail = header_->tail.load(std::memory_order_relaxed);
+	uint32_t head = header_->head.load(std::memory_order_acquire);
+
+	while (head != tail) {
+		if (head - tail > size_) {
+			LOG(IPCSharedRing, Error) << "Corrupted ring indices";
+			return {};
+		}
+
+		uint32_t offset = tail & (size_ - 1);
+		uint32_t contiguous = size_ - offset;
+		const RecordHeader *record =
+			reinterpret_cast<const RecordHeader *>(data_ + offset);
+		uint32_t length = record->length;
+
+		if (length == RecordWrap) {
+			tail += contiguous;
+			header_->tail.store(tail, std::memory_order_release);
+			continue;
+		}
+
+		uint32_t need = sizeof(RecordHeader) + alignRecord(length);
+		if (length > size_ || need > contiguous || need > head - tail) {
+			LOG(IPCSharedRing, Error) << "Corrupted ring record";
+			return {};
+		}
+
+		front_ = true;
+		frontEnd_ = tail + need;
+		return { reinterpret_cast<const uint8_t *>(record + 1), length };
+	}
+
+	return {};
+}
+
+/**
+ * \brief Release the record returned by front()
+ */
+void IPCSharedRing::pop()
+{
+	if (!isBound() || !front_)
+		return;
+
+	header_->tail.store(frontEnd_, std::memory_order_release);
+	front_ = false;
+}
+
+/**
+ * \brief Signal the producer that the consumer is about to sleep
+ *
+ * This method shall be called by the consumer when front() reports an empty
+ * ring, before waiting for a doorbell. It closes the race with a producer that
+ * commits a record concurrently: if the ring isn't empty anymore, the consumer
+ * shall process the new records instead of sleeping.
+ *
+ * \return True if the ring is empty and the next commit() will request a
+ * doorbell, false if the ring contains records
+ */
+bool IPCSharedRing::sleep()
+{
+	if (!isBound())
+		return true;
+
+	header_->sleeping.store(1, std::memory_order_seq_cst);
+
+	uint32_t tail = header_->tail.load(std::memory_order_relaxed);
+	uint32_t head = header_->head.load(std::memory_order_seq_cst);
+
+	return head == tail;
+}
+
+int IPCSharedRing::map(int fd, size_t length)
+{
+	void *mem = mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_SHARED,
+			 fd, 0);
+	if (mem == MAP_FAILED) {
+		int ret = -errno;
+		LOG(IPCSharedRing, Error)
+			<< "Failed to map ring: " << strerror(-ret);
+		return ret;
+	}
+
+	fd_ = fd;
+	mem_ = mem;
+	length_ = length;
+	header_ = static_cast<Header *>(mem);
+	data_ = static_cast<uint8_t *>(mem) + HeaderSize;
+
+	return 0;
+}
+
+} /* namespace libcamera */
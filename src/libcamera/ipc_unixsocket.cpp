@@ -62,10 +62,30 @@ LOG_DEFINE_CATEGORY(IPCUnixSocket)
  * communication method. The remote side then instantiates a socket, and binds
  * it to the other side by passing the file descriptor to bind(). At that point
  * the channel is operation and communication is bidirectional and symmmetrical.
+ *
+ * Two socket types are supported, selected at creation time. Datagram sockets
+ * transmit the message header and payload separately, and deliver a single
+ * message per \ref readyRead signal. SeqPacket sockets transmit the header,
+ * payload and file descriptors of a message in a single system call, and
+ * receive them in a single system call into a buffer preallocated when the
+ * socket is bound. Multiple messages can then be received in a row, and
+ * receivers should call receive() until it returns -EAGAIN to drain all queued
+ * messages on every \ref readyRead signal. SeqPacket sockets also detect when
+ * the remote side closes the channel. Their payload size is limited to
+ * 128kB.
+ */
+
+/**
+ * \enum IPCUnixSocket::Type
+ * \brief The type of the IPC socket
+ * \var IPCUnixSocket::Datagram
+ * \brief Connection-less socket, one message is received per readyRead signal
+ * \var IPCUnixSocket::SeqPacket
+ * \brief Connection-oriented socket, with single system call framing
  */
 
 IPCUnixSocket::IPCUnixSocket()
-	: fd_(-1), headerReceived_(false), notifier_(nullptr)
+	: fd_(-1), type_(Datagram), headerReceived_(false), notifier_(nullptr)
 {
 }
 
@@ -76,6 +96,7 @@ IPCUnixSocket::~IPCUnixSocket()
 
 /**
  * \brief Create an new IPC channel
+ * \param[in] type The socket type
  *
  * This method creates a new IPC channel. The socket instance is bound to the
  * local side of the channel, and the method returns a file descriptor bound to
@@ -85,12 +106,13 @@ IPCUnixSocket::~IPCUnixSocket()
  *
  * \return A file descriptor on success, negative error code on failure
  */
-int IPCUnixSocket::create()
+int IPCUnixSocket::create(Type type)
 {
 	int sockets[2];
 	int ret;
 
-	ret = socketpair(AF_UNIX, SOCK_DGRAM | SOCK_NONBLOCK, 0, sockets);
+	int sockType = type == SeqPacket ? SOCK_SEQPACKET : SOCK_DGRAM;
+	ret = socketpair(AF_UNIX, sockType | SOCK_NONBLOCK, 0, sockets);
 	if (ret) {
 		ret = -errno;
 		LOG(IPCUnixSocket, Error)
@@ -111,7 +133,7 @@ int IPCUnixSocket::create()
  *
  * This method binds the socket instance to an existing IPC channel identified
  * by the file descriptor \a fd. The file descriptor is obtained from the
- * IPCUnixSocket::create() method.
+ * IPCUnixSocket::create() method. The socket type is retrieved from \a fd.
  *
  * \return 0 on success or a negative error code otherwise
  */
@@ -120,6 +142,21 @@ int IPCUnixSocket::bind(int fd)
 	if (isBound())
 		return -EINVAL;
 
+	int sockType;
+	socklen_t len = sizeof(sockType);
+	if (getsockopt(fd, SOL_SOCKET, SO_TYPE, &sockType, &len) < 0) {
+		int ret = -errno;
+		LOG(IPCUnixSocket, Error)
+			<< "Failed to get socket type: " << strerror(-ret);
+		return ret;
+	}
+
+	type_ = sockType == SOCK_SEQPACKET ? SeqPacket : Datagram;
+	if (type_ == SeqPacket) {
+		packet_.resize(MaxPacketSize);
+		control_.resize(CMSG_SPACE(MaxPacketFds * sizeof(int32_t)));
+	}
+
 	fd_ = fd;
 	notifier_ = new EventNotifier(fd_, EventNotifier::Read);
 	notifier_->activated.connect(this, &IPCUnixSocket::dataNotifier);
@@ -144,6 +181,9 @@ void IPCUnixSocket::close()
 
 	fd_ = -1;
 	headerReceived_ = false;
+	packet_.clear();
+	packet_.shrink_to_fit();
+	control_.clear();
 }
 
 /**
@@ -155,6 +195,12 @@ bool IPCUnixSocket::isBound() const
 	return fd_ != -1;
 }
 
+/**
+ * \fn IPCUnixSocket::type()
+ * \brief Retrieve the socket type
+ * \return The socket type
+ */
+
 /**
  * \brief Send a message payload
  * \param[in] payload Message payload to send
@@ -164,6 +210,7 @@ bool IPCUnixSocket::isBound() const
  * the remote side.
  *
  * \return 0 on success or a negative error code otherwise
+ * \retval -EMSGSIZE The payload is too large for a SeqPacket socket
  */
 int IPCUnixSocket::send(const Payload &payload)
 {
@@ -172,6 +219,9 @@ int IPCUnixSocket::send(const Payload &payload)
 	if (!isBound())
 		return -ENOTCONN;
 
+	if (type_ == SeqPacket)
+		return sendPacket(payload);
+
 	Header hdr = {};
 	hdr.data = payload.data.size();
 	hdr.fds = payload.fds.size();
@@ -199,6 +249,10 @@ int IPCUnixSocket::send(const Payload &payload)
  * immediately with -EAGAIN. The \ref readyRead signal shall be used to receive
  * notification of message availability.
  *
+ * For SeqPacket sockets, the message is received with a single system call,
+ * and the memory of \a payload is reused. Callers should thus reuse the same
+ * \a payload to avoid memory allocations.
+ *
  * \todo Add state machine to make sure we don't block forever and that
  * a header is always followed by a payload.
  *
@@ -206,12 +260,16 @@ int IPCUnixSocket::send(const Payload &payload)
  * \retval -EAGAIN No message payload is available
  * \retval -ENOTCONN The socket is not connected (neither create() nor bind()
  * has been called)
+ * \retval -ECONNRESET The remote side of a SeqPacket socket has been closed
  */
 int IPCUnixSocket::receive(Payload *payload)
 {
 	if (!isBound())
 		return -ENOTCONN;
 
+	if (type_ == SeqPacket)
+		return recvPacket(payload);
+
 	if (!headerReceived_)
 		return -EAGAIN;
 
@@ -306,10 +364,126 @@ int IPCUnixSocket::recvData(void *buffer, size_t length,
 	return 0;
 }
 
+int IPCUnixSocket::sendPacket(const Payload &payload)
+{
+	Header hdr = {};
+	hdr.data = payload.data.size();
+	hdr.fds = payload.fds.size();
+
+	if (!hdr.data && !hdr.fds)
+		return -EINVAL;
+
+	if (payload.data.size() > MaxPacketSize ||
+	    payload.fds.size() > MaxPacketFds)
+		return -EMSGSIZE;
+
+	struct iovec iov[2];
+	iov[0].iov_base = &hdr;
+	iov[0].iov_len = sizeof(hdr);
+	iov[1].iov_base = const_cast<uint8_t *>(payload.data.data());
+	iov[1].iov_len = payload.data.size();
+
+	struct msghdr msg = {};
+	msg.msg_iov = iov;
+	msg.msg_iovlen = 2;
+
+	unsigned int num = payload.fds.size();
+	char buf[CMSG_SPACE(num * sizeof(int32_t))];
+
+	if (num) {
+		memset(buf, 0, sizeof(buf));
+
+		struct cmsghdr *cmsg = reinterpret_cast<struct cmsghdr *>(buf);
+		cmsg->cmsg_len = CMSG_LEN(num * sizeof(int32_t));
+		cmsg->cmsg_level = SOL_SOCKET;
+		cmsg->cmsg_type = SCM_RIGHTS;
+		memcpy(CMSG_DATA(cmsg), payload.fds.data(), num * sizeof(int32_t));
+
+		msg.msg_control = cmsg;
+		msg.msg_controllen = cmsg->cmsg_len;
+	}
+
+	if (sendmsg(fd_, &msg, MSG_NOSIGNAL) < 0) {
+		int ret = -errno;
+		LOG(IPCUnixSocket, Error)
+			<< "Failed to sendmsg: " << strerror(-ret);
+		return ret;
+	}
+
+	return 0;
+}
+
+int IPCUnixSocket::recvPacket(Payload *payload)
+{
+	Header hdr;
+
+	struct iovec iov[2];
+	iov[0].iov_base = &hdr;
+	iov[0].iov_len = sizeof(hdr);
+	iov[1].iov_base = packet_.data();
+	iov[1].iov_len = packet_.size();
+
+	struct msghdr msg = {};
+	msg.msg_iov = iov;
+	msg.msg_iovlen = 2;
+	msg.msg_control = control_.data();
+	msg.msg_controllen = control_.size();
+
+	ssize_t len = recvmsg(fd_, &msg, 0);
+	if (len < 0) {
+		int ret = -errno;
+		if (ret != -EAGAIN)
+			LOG(IPCUnixSocket, Error)
+				<< "Failed to recvmsg: " << strerror(-ret);
+		return ret;
+	}
+
+	/* The remote side has closed the connection. */
+	if (!len) {
+		notifier_->setEnabled(false);
+		return -ECONNRESET;
+	}
+
+	payload->fds.clear();
+
+	for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg;
+	     cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+		if (cmsg->cmsg_level != SOL_SOCKET ||
+		    cmsg->cmsg_type != SCM_RIGHTS)
+			continue;
+
+		unsigned int num = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int32_t);
+		const int32_t *fds = reinterpret_cast<const int32_t *>(CMSG_DATA(cmsg));
+		payload->fds.insert(payload->fds.end(), fds, fds + num);
+	}
+
+	if (msg.msg_flags & (MSG_TRUNC | MSG_CTRUNC) ||
+	    static_cast<size_t>(len) < sizeof(hdr) ||
+	    hdr.data != len - sizeof(hdr) || hdr.fds != payload->fds.size()) {
+		LOG(IPCUnixSocket, Error) << "Received invalid packet";
+
+		for (int32_t fd : payload->fds)
+			::close(fd);
+		payload->fds.clear();
+
+		return -EMSGSIZE;
+	}
+
+	payload->data.assign(packet_.begin(), packet_.begin() + hdr.data);
+
+	return 0;
+}
+
 void IPCUnixSocket::dataNotifier(EventNotifier *notifier)
 {
 	int ret;
 
+	/* Messages are received in one go, let the receiver drain them. */
+	if (type_ == SeqPacket) {
+		readyRead.emit(this);
+		return;
+	}
+
 	if (!headerReceived_) {
 		/* Receive the header. */
 		ret = ::recv(fd_, &header_, sizeof(header_), 0);
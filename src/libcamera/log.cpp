@@ -7,21 +7,31 @@
 
 #include "log.h"
 
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <errno.h>
 #if HAVE_BACKTRACE
 #include <execinfo.h>
 #endif
+#include <fcntl.h>
 #include <fstream>
 #include <iostream>
 #include <list>
+#include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <syslog.h>
 #include <time.h>
+#include <unistd.h>
 #include <unordered_set>
+#include <vector>
 
 #include <libcamera/logging.h>
 
+#include "cpu_accounting.h"
 #include "thread.h"
 #include "utils.h"
 
@@ -52,6 +62,17 @@
  * the file. The file must be writable and is truncated if it exists. If any
  * error occurs when opening the file, the file is ignored and the log is output
  * to stderr.
+ *
+ * When the LIBCAMERA_LOG_ASYNC environment variable is set to a value other
+ * than "0", log messages are written to the output asynchronously, see
+ * logSetAsync().
+ *
+ * When the LIBCAMERA_LOG_RECORDER environment variable is set to the name of a
+ * file, messages of all categories and severities are recorded in memory and
+ * dumped to the file when an error occurs, see logSetRecorder(). The number of
+ * recorded messages can be set with the LIBCAMERA_LOG_RECORDER_SIZE environment
+ * variable. The recorder is also dumped when the process receives the SIGUSR2
+ * signal, unless the application handles the signal itself.
  */
 
 /**
@@ -111,8 +132,10 @@ public:
 	~LogOutput();
 
 	bool isValid() const;
+	std::string format(const LogMessage &msg) const;
 	void write(const LogMessage &msg);
 	void write(const std::string &msg);
+	void write(LogSeverity severity, const std::string &str);
 
 private:
 	void writeSyslog(LogSeverity severity, const std::string &msg);
@@ -120,6 +143,7 @@ private:
 
 	std::ostream *stream_;
 	LoggingTarget target_;
+	Mutex mutex_;
 };
 
 /**
@@ -181,32 +205,49 @@ bool LogOutput::isValid() const
 }
 
 /**
- * \brief Write message to log output
- * \param[in] msg Message to write
+ * \brief Format a message for the log output
+ * \param[in] msg Message to format
+ * \return The formatted message, ready to be passed to write()
  */
-void LogOutput::write(const LogMessage &msg)
+std::string LogOutput::format(const LogMessage &msg) const
 {
 	std::string str;
 
 	switch (target_) {
 	case LoggingTargetSyslog:
-		str = std::string(log_severity_name(msg.severity())) + " "
-		    + msg.category().name() + " " + msg.fileInfo() + " "
-		    + msg.msg();
-		writeSyslog(msg.severity(), str);
 		break;
 	case LoggingTargetStream:
 	case LoggingTargetFile:
-		str = "[" + utils::time_point_to_string(msg.timestamp()) + "] ["
-		    + std::to_string(Thread::currentId()) + "] "
-		    + log_severity_name(msg.severity()) + " "
-		    + msg.category().name() + " " + msg.fileInfo() + " "
-		    + msg.msg();
-		writeStream(str);
+		str += "[";
+		str += utils::time_point_to_string(msg.timestamp());
+		str += "] [";
+		str += std::to_string(Thread::currentId());
+		str += "] ";
 		break;
 	default:
-		break;
+		return str;
 	}
+
+	str += log_severity_name(msg.severity());
+	str += " ";
+	str += msg.category().name();
+	str += " ";
+	str += utils::basename(msg.fileName());
+	str += ":";
+	str += std::to_string(msg.line());
+	str += " ";
+	str += msg.msg();
+
+	return str;
+}
+
+/**
+ * \brief Write message to log output
+ * \param[in] msg Message to write
+ */
+void LogOutput::write(const LogMessage &msg)
+{
+	write(msg.severity(), format(msg));
 }
 
 /**
@@ -214,10 +255,20 @@ void LogOutput::write(const LogMessage &msg)
  * \param[in] str String to write
  */
 void LogOutput::write(const std::string &str)
+{
+	write(LogDebug, str);
+}
+
+/**
+ * \brief Write a formatted message to log output
+ * \param[in] severity Severity of the message
+ * \param[in] str Message formatted with format()
+ */
+void LogOutput::write(LogSeverity severity, const std::string &str)
 {
 	switch (target_) {
 	case LoggingTargetSyslog:
-		writeSyslog(LogDebug, str);
+		writeSyslog(severity, str);
 		break;
 	case LoggingTargetStream:
 	case LoggingTargetFile:
@@ -235,10 +286,372 @@ void LogOutput::writeSyslog(LogSeverity severity, const std::string &str)
 
 void LogOutput::writeStream(const std::string &str)
 {
+	MutexLocker locker(mutex_);
 	stream_->write(str.c_str(), str.size());
 	stream_->flush();
 }
 
+/**
+ * \brief A formatted log message waiting to be written
+ */
+struct LogRecord {
+	std::shared_ptr<LogOutput> output;
+	LogSeverity severity;
+	std::string str;
+};
+
+namespace {
+
+constexpr size_t LogRingSize = 256;
+
+} /* namespace */
+
+/**
+ * \brief Bounded lock-free queue of log records
+ *
+ * The LogRing class stores log records in a fixed-size array of slots, each
+ * slot carrying a sequence number that tells producers and consumers whether
+ * the slot is free or filled. Any number of threads can push and pop records
+ * concurrently without locking. When the ring is full, push() fails instead of
+ * waiting for space.
+ */
+class LogRing
+{
+public:
+	LogRing();
+
+	bool push(LogRecord &&record);
+	bool pop(LogRecord *record);
+
+private:
+	struct Slot {
+		std::atomic<size_t> sequence;
+		LogRecord record;
+	};
+
+	std::array<Slot, LogRingSize> slots_;
+	std::atomic<size_t> head_;
+	std::atomic<size_t> tail_;
+};
+
+LogRing::LogRing()
+	: head_(0), tail_(0)
+{
+	for (size_t i = 0; i < slots_.size(); ++i)
+		slots_[i].sequence.store(i, std::memory_order_relaxed);
+}
+
+/**
+ * \brief Add a record at the tail of the ring
+ * \param[in] record The record
+ * \return True if the record has been added, false if the ring is full
+ */
+bool LogRing::push(LogRecord &&record)
+{
+	size_t pos = tail_.load(std::memory_order_relaxed);
+	Slot *slot;
+
+	while (true) {
+		slot = &slots_[pos % LogRingSize];
+		size_t sequence = slot->sequence.load(std::memory_order_acquire);
+		ssize_t diff = static_cast<ssize_t>(sequence - pos);
+
+		if (diff == 0) {
+			if (tail_.compare_exchange_weak(pos, pos + 1,
+							std::memory_order_relaxed))
+				break;
+		} else if (diff < 0) {
+			return false;
+		} else {
+			pos = tail_.load(std::memory_order_relaxed);
+		}
+	}
+
+	slot->record = std::move(record);
+	slot->sequence.store(pos + 1, std::memory_order_release);
+
+	return true;
+}
+
+/**
+ * \brief Remove the record at the head of the ring
+ * \param[out] record The record
+ * \return True if a record has been removed, false if the ring is empty
+ */
+bool LogRing::pop(LogRecord *record)
+{
+	size_t pos = head_.load(std::memory_order_relaxed);
+	Slot *slot;
+
+	while (true) {
+		slot = &slots_[pos % LogRingSize];
+		size_t sequence = slot->sequence.load(std::memory_order_acquire);
+		ssize_t diff = static_cast<ssize_t>(sequence - (pos + 1));
+
+		if (diff == 0) {
+			if (head_.compare_exchange_weak(pos, pos + 1,
+							std::memory_order_relaxed))
+				break;
+		} else if (diff < 0) {
+			return false;
+		} else {
+			pos = head_.load(std::memory_order_relaxed);
+		}
+	}
+
+	*record = std::move(slot->record);
+	slot->record.output.reset();
+	slot->sequence.store(pos + LogRingSize, std::memory_order_release);
+
+	return true;
+}
+
+namespace {
+
+constexpr unsigned int LogRecorderDefaultSize = 4096;
+constexpr size_t LogRecorderTextSize = 212;
+
+/*
+ * Helpers to format the recorded messages when dumping them. They only write to
+ * a caller-provided buffer to keep the dump async-signal-safe.
+ */
+char *log_append(char *p, char *end, const char *str, size_t len)
+{
+	len = std::min<size_t>(len, end - p);
+	memcpy(p, str, len);
+	return p + len;
+}
+
+char *log_append(char *p, char *end, const char *str)
+{
+	return log_append(p, end, str, strlen(str));
+}
+
+char *log_append(char *p, char *end, uint64_t value, unsigned int width = 1)
+{
+	char digits[20];
+	unsigned int count = 0;
+
+	do {
+		digits[count++] = '0' + value % 10;
+		value /= 10;
+	} while (value);
+
+	while (count < width && p < end) {
+		*p++ = '0';
+		width--;
+	}
+
+	while (count && p < end)
+		*p++ = digits[--count];
+
+	return p;
+}
+
+void log_write(int fd, const char *data, size_t length)
+{
+	while (length) {
+		ssize_t ret = ::write(fd, data, length);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			return;
+		}
+
+		data += ret;
+		length -= ret;
+	}
+}
+
+} /* namespace */
+
+/**
+ * \brief In-memory flight recorder of log messages
+ *
+ * The LogRecorder class records log messages of all severities in a fixed-size
+ * ring of compact records, overwriting the oldest records when the ring is
+ * full. The records store the call site (file name and line) and category as
+ * pointers to static strings, and the message text truncated to a fixed size.
+ * Recording a message thus only costs a copy of the text, without formatting
+ * the message or taking any lock.
+ *
+ * The ring is written to the recorder file by dump(), when an error calls for
+ * the history of the messages that led to it. Each slot carries a sequence
+ * number, updated before and after the record is written, which lets dump()
+ * skip the records being written concurrently. dump() doesn't allocate memory
+ * or take locks, and can be called from a signal handler.
+ */
+class LogRecorder
+{
+public:
+	LogRecorder(const char *path, unsigned int size);
+
+	const std::string &path() const { return path_; }
+
+	void record(const LogMessage &msg);
+	void dump(const char *reason);
+
+private:
+	struct Record {
+		int64_t timestamp;
+		const char *category;
+		const char *fileName;
+		unsigned int line;
+		pid_t thread;
+		uint8_t severity;
+		uint16_t length;
+		char text[LogRecorderTextSize];
+	};
+
+	struct Slot {
+		std::atomic<uint64_t> sequence;
+		Record record;
+	};
+
+	void dumpRecord(int fd, const Record &record);
+
+	std::string path_;
+	std::unique_ptr<Slot[]> slots_;
+	unsigned int size_;
+	std::atomic<uint64_t> head_;
+	std::atomic_flag dumping_;
+};
+
+/**
+ * \brief Construct a flight recorder
+ * \param[in] path Full path to the file the recorder is dumped to
+ * \param[in] size Number of messages held in the ring
+ */
+LogRecorder::LogRecorder(const char *path, unsigned int size)
+	: path_(path), slots_(new Slot[size]), size_(size), head_(0)
+{
+	for (unsigned int i = 0; i < size_; ++i)
+		slots_[i].sequence.store(0, std::memory_order_relaxed);
+
+	dumping_.clear();
+}
+
+/**
+ * \brief Record a message in the ring
+ * \param[in] msg The message
+ */
+void LogRecorder::record(const LogMessage &msg)
+{
+	uint64_t pos = head_.fetch_add(1, std::memory_order_relaxed);
+	Slot &slot = slots_[pos % size_];
+
+	/*
+	 * An odd sequence number marks the slot as being written, the next
+	 * even number as holding the record at position pos.
+	 */
+	slot.sequence.store(pos * 2 + 1, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+
+	Record &record = slot.record;
+	record.timestamp = std::chrono::duration_cast<std::chrono::nanoseconds>(
+		msg.timestamp().time_since_epoch()).count();
+	record.category = msg.category().name();
+	record.fileName = msg.fileName();
+	record.line = msg.line();
+	record.thread = Thread::currentId();
+	record.severity = msg.severity();
+
+	/* Drop the trailing newline added by ~LogMessage(). */
+	const std::string text = msg.msg();
+	size_t length = text.size();
+	if (length && text[length - 1] == '\n')
+		length--;
+	record.length = std::min(length, LogRecorderTextSize);
+	memcpy(record.text, text.data(), record.length);
+
+	slot.sequence.store(pos * 2 + 2, std::memory_order_release);
+}
+
+/**
+ * \brief Append the content of the ring to the recorder file
+ * \param[in] reason The reason for the dump, written in the dump header
+ *
+ * Records are written from the oldest to the most recent. Records that are
+ * overwritten or being written while the dump is in progress are skipped.
+ * Concurrent calls are ignored.
+ */
+void LogRecorder::dump(const char *reason)
+{
+	if (dumping_.test_and_set(std::memory_order_acquire))
+		return;
+
+	int fd = open(path_.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC,
+		      0644);
+	if (fd < 0) {
+		dumping_.clear(std::memory_order_release);
+		return;
+	}
+
+	char header[128];
+	char *end = header + sizeof(header);
+	char *p = log_append(header, end, "--- libcamera log recorder dump: ");
+	p = log_append(p, end, reason);
+	p = log_append(p, end, " ---\n");
+	log_write(fd, header, p - header);
+
+	uint64_t head = head_.load(std::memory_order_acquire);
+	uint64_t pos = head > size_ ? head - size_ : 0;
+
+	for (; pos < head; ++pos) {
+		const Slot &slot = slots_[pos % size_];
+
+		uint64_t sequence = slot.sequence.load(std::memory_order_acquire);
+		if (sequence != pos * 2 + 2)
+			continue;
+
+		Record record;
+		memcpy(&record, &slot.record, sizeof(record));
+
+		std::atomic_thread_fence(std::memory_order_acquire);
+		if (slot.sequence.load(std::memory_order_relaxed) != sequence)
+			continue;
+
+		dumpRecord(fd, record);
+	}
+
+	close(fd);
+	dumping_.clear(std::memory_order_release);
+}
+
+void LogRecorder::dumpRecord(int fd, const Record &record)
+{
+	char line[LogRecorderTextSize + 256];
+	char *end = line + sizeof(line) - 1;
+	char *p = line;
+
+	uint64_t nsecs = record.timestamp;
+	uint64_t secs = nsecs / 1000000000ULL;
+
+	p = log_append(p, end, "[");
+	p = log_append(p, end, secs / (60 * 60));
+	p = log_append(p, end, ":");
+	p = log_append(p, end, (secs / 60) % 60, 2);
+	p = log_append(p, end, ":");
+	p = log_append(p, end, secs % 60, 2);
+	p = log_append(p, end, ".");
+	p = log_append(p, end, nsecs % 1000000000ULL, 9);
+	p = log_append(p, end, "] [");
+	p = log_append(p, end, record.thread);
+	p = log_append(p, end, "] ");
+	p = log_append(p, end, log_severity_name(static_cast<LogSeverity>(record.severity)));
+	p = log_append(p, end, " ");
+	p = log_append(p, end, record.category);
+	p = log_append(p, end, " ");
+	p = log_append(p, end, utils::basename(record.fileName));
+	p = log_append(p, end, ":");
+	p = log_append(p, end, record.line);
+	p = log_append(p, end, " ");
+	p = log_append(p, end, record.text, record.length);
+	*p++ = '\n';
+
+	log_write(fd, line, p - line);
+}
+
 /**
  * \brief Message logger
  *
@@ -247,6 +660,8 @@ void LogOutput::writeStream(const std::string &str)
 class Logger
 {
 public:
+	~Logger();
+
 	static Logger *instance();
 
 	void write(const LogMessage &msg);
@@ -256,12 +671,20 @@ public:
 	int logSetStream(std::ostream *stream);
 	int logSetTarget(LoggingTarget target);
 	void logSetLevel(const char *category, const char *level);
+	void logSetAsync(bool async);
+	int logSetRecorder(const char *path, unsigned int size);
+	void logDumpRecorder(const char *reason);
+
+	bool recording() const { return recorder_.load(std::memory_order_relaxed); }
+	void record(const LogMessage &msg);
 
 private:
 	Logger();
 
 	void parseLogFile();
 	void parseLogLevels();
+	void parseLogAsync();
+	void parseLogRecorder();
 	static LogSeverity parseLogLevel(const std::string &level);
 
 	friend LogCategory;
@@ -272,6 +695,22 @@ private:
 	std::list<std::pair<std::string, LogSeverity>> levels_;
 
 	std::shared_ptr<LogOutput> output_;
+
+	void asyncMain();
+	void flush();
+
+	std::atomic<bool> async_;
+	std::unique_ptr<LogRing> ring_;
+	std::atomic<unsigned int> dropped_;
+
+	Mutex asyncMutex_;
+	std::condition_variable asyncCond_;
+	std::thread asyncThread_;
+	std::atomic<bool> asyncSleeping_;
+	bool asyncRunning_;
+
+	std::atomic<LogRecorder *> recorder_;
+	std::vector<std::unique_ptr<LogRecorder>> recorders_;
 };
 
 /**
@@ -368,6 +807,68 @@ void logSetLevel(const char *category, const char *level)
 	Logger::instance()->logSetLevel(category, level);
 }
 
+/**
+ * \brief Enable or disable asynchronous logging
+ * \param[in] async True to write log messages asynchronously
+ *
+ * By default log messages are written to the log output synchronously, in the
+ * context of the thread that logs them. This function enables asynchronous
+ * logging, where messages are formatted by the logging thread, stored in a
+ * bounded queue, and written to the log output by a background thread. This
+ * keeps the latency of slow log outputs, such as files or syslog, out of the
+ * logging threads.
+ *
+ * Logging threads never wait for the queue to have space. When the queue is
+ * full messages are dropped, and the number of dropped messages is reported in
+ * the log output. Fatal messages are always written synchronously, after all
+ * queued messages.
+ *
+ * Disabling asynchronous logging writes all queued messages before returning.
+ */
+void logSetAsync(bool async)
+{
+	Logger::instance()->logSetAsync(async);
+}
+
+/**
+ * \brief Record log messages in memory and dump them to a file on errors
+ * \param[in] path Full path to the file the recorded messages are dumped to
+ * \param[in] size Number of messages to record
+ *
+ * This function enables the log flight recorder. The recorder keeps the last
+ * \a size log messages of all categories, including debug messages that are
+ * not output due to the log levels, in a fixed-size in-memory ring. Recording a
+ * message doesn't take any lock and doesn't write to the log output, keeping
+ * the cost of the debug messages low enough to record them at all times.
+ *
+ * The recorded messages are appended to the file at \a path when a fatal error
+ * occurs, when a camera stalls, and when logDumpRecorder() is called. The file
+ * is created if it doesn't exist.
+ *
+ * A null \a path disables the recorder.
+ *
+ * \return Zero on success, or a negative error code otherwise
+ */
+int logSetRecorder(const char *path, unsigned int size)
+{
+	return Logger::instance()->logSetRecorder(path, size);
+}
+
+/**
+ * \brief Dump the messages recorded by the log flight recorder
+ * \param[in] reason The reason for the dump, written in the dump header
+ *
+ * This function appends the messages recorded since the recorder has been
+ * enabled, within the limit of the recorder size, to the recorder file. It
+ * performs no operation if the recorder is disabled.
+ *
+ * The function is async-signal-safe, and can be called from a signal handler.
+ */
+void logDumpRecorder(const char *reason)
+{
+	Logger::instance()->logDumpRecorder(reason);
+}
+
 /**
  * \brief Retrieve the logger instance
  *
@@ -392,7 +893,29 @@ void Logger::write(const LogMessage &msg)
 	if (!output)
 		return;
 
-	output->write(msg);
+	if (!async_.load(std::memory_order_acquire)) {
+		output->write(msg);
+		return;
+	}
+
+	/* Make sure all queued messages are output before aborting. */
+	if (msg.severity() == LogFatal) {
+		flush();
+		output->write(msg);
+		return;
+	}
+
+	LogSeverity severity = msg.severity();
+	std::string str = output->format(msg);
+	if (!ring_->push({ std::move(output), severity, std::move(str) })) {
+		dropped_.fetch_add(1, std::memory_order_relaxed);
+		return;
+	}
+
+	if (asyncSleeping_.load()) {
+		MutexLocker locker(asyncMutex_);
+		asyncCond_.notify_one();
+	}
 }
 
 /**
@@ -425,6 +948,8 @@ void Logger::backtrace()
 
 	free(strings);
 #endif
+
+	logDumpRecorder("fatal error");
 }
 
 /**
@@ -488,6 +1013,114 @@ int Logger::logSetTarget(enum LoggingTarget target)
 	return 0;
 }
 
+/**
+ * \brief Enable or disable asynchronous logging
+ * \param[in] async True to write log messages asynchronously
+ *
+ * \sa libcamera::logSetAsync()
+ */
+void Logger::logSetAsync(bool async)
+{
+	MutexLocker locker(asyncMutex_);
+
+	if (async == asyncRunning_)
+		return;
+
+	if (async) {
+		if (!ring_)
+			ring_ = std::make_unique<LogRing>();
+
+		asyncRunning_ = true;
+		asyncThread_ = std::thread(&Logger::asyncMain, this);
+		async_.store(true, std::memory_order_release);
+		return;
+	}
+
+	async_.store(false, std::memory_order_release);
+	asyncRunning_ = false;
+	asyncCond_.notify_one();
+	locker.unlock();
+
+	asyncThread_.join();
+
+	/* Write the messages queued after the thread stopped. */
+	flush();
+}
+
+namespace {
+
+void log_recorder_sigusr2(int signal)
+{
+	int err = errno;
+	logDumpRecorder("SIGUSR2");
+	errno = err;
+}
+
+} /* namespace */
+
+/**
+ * \brief Enable or disable the log flight recorder
+ * \param[in] path Full path to the file the recorded messages are dumped to
+ * \param[in] size Number of messages to record
+ *
+ * \sa libcamera::logSetRecorder()
+ *
+ * \return Zero on success, or a negative error code otherwise
+ */
+int Logger::logSetRecorder(const char *path, unsigned int size)
+{
+	if (!path) {
+		recorder_.store(nullptr, std::memory_order_release);
+	} else {
+		if (!size)
+			return -EINVAL;
+
+		int fd = open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC,
+			      0644);
+		if (fd < 0)
+			return -errno;
+		close(fd);
+
+		/*
+		 * Messages may be recorded concurrently in the previous
+		 * recorder, keep it around until the logger is destroyed.
+		 */
+		recorders_.push_back(std::make_unique<LogRecorder>(path, size));
+		recorder_.store(recorders_.back().get(),
+				std::memory_order_release);
+	}
+
+	/* Update the threshold of all categories. */
+	for (LogCategory *category : categories_)
+		category->setSeverity(category->severity());
+
+	return 0;
+}
+
+/**
+ * \brief Dump the messages recorded by the log flight recorder
+ * \param[in] reason The reason for the dump
+ *
+ * \sa libcamera::logDumpRecorder()
+ */
+void Logger::logDumpRecorder(const char *reason)
+{
+	LogRecorder *recorder = recorder_.load(std::memory_order_acquire);
+	if (recorder)
+		recorder->dump(reason);
+}
+
+/**
+ * \brief Record a message in the log flight recorder, if enabled
+ * \param[in] msg The message
+ */
+void Logger::record(const LogMessage &msg)
+{
+	LogRecorder *recorder = recorder_.load(std::memory_order_acquire);
+	if (recorder)
+		recorder->record(msg);
+}
+
 /**
  * \brief Set the log level
  * \param[in] category Logging category
@@ -513,9 +1146,65 @@ void Logger::logSetLevel(const char *category, const char *level)
  * \brief Construct a logger
  */
 Logger::Logger()
+	: async_(false), dropped_(0), asyncSleeping_(false),
+	  asyncRunning_(false), recorder_(nullptr)
 {
 	parseLogFile();
 	parseLogLevels();
+	parseLogAsync();
+	parseLogRecorder();
+}
+
+Logger::~Logger()
+{
+	logSetAsync(false);
+}
+
+/*
+ * Write queued log messages to their output until asynchronous logging gets
+ * disabled. Producers only wake the thread up when it sleeps, the timeout
+ * bounds the latency of the messages queued while it goes to sleep.
+ */
+void Logger::asyncMain()
+{
+	while (true) {
+		flush();
+
+		MutexLocker locker(asyncMutex_);
+		if (!asyncRunning_)
+			break;
+
+		asyncSleeping_.store(true);
+		asyncCond_.wait_for(locker, std::chrono::milliseconds(100));
+		asyncSleeping_.store(false);
+	}
+
+	flush();
+}
+
+/*
+ * Write all queued log messages, and report the messages dropped since the
+ * last flush.
+ */
+void Logger::flush()
+{
+	if (!ring_)
+		return;
+
+	LogRecord record;
+	while (ring_->pop(&record)) {
+		record.output->write(record.severity, record.str);
+		record.output.reset();
+	}
+
+	unsigned int dropped = dropped_.exchange(0, std::memory_order_relaxed);
+	if (!dropped)
+		return;
+
+	std::shared_ptr<LogOutput> output = std::atomic_load(&output_);
+	if (output)
+		output->write(LogWarning, std::to_string(dropped) +
+					  " log messages dropped\n");
 }
 
 /**
@@ -542,6 +1231,59 @@ void Logger::parseLogFile()
 	logSetFile(file);
 }
 
+/**
+ * \brief Parse the asynchronous logging mode from the environment
+ *
+ * If the LIBCAMERA_LOG_ASYNC environment variable is set to a value other than
+ * "0", enable asynchronous logging.
+ */
+void Logger::parseLogAsync()
+{
+	const char *async = utils::secure_getenv("LIBCAMERA_LOG_ASYNC");
+	if (!async || !strcmp(async, "0"))
+		return;
+
+	logSetAsync(true);
+}
+
+/**
+ * \brief Parse the log flight recorder configuration from the environment
+ *
+ * If the LIBCAMERA_LOG_RECORDER environment variable is set, enable the log
+ * flight recorder with the file it points to, and the size stored in the
+ * LIBCAMERA_LOG_RECORDER_SIZE environment variable if set. The recorder is
+ * additionally dumped on SIGUSR2, unless a handler is already installed for
+ * the signal. Errors are silently ignored.
+ */
+void Logger::parseLogRecorder()
+{
+	const char *path = utils::secure_getenv("LIBCAMERA_LOG_RECORDER");
+	if (!path)
+		return;
+
+	unsigned int size = LogRecorderDefaultSize;
+	const char *sizeStr = utils::secure_getenv("LIBCAMERA_LOG_RECORDER_SIZE");
+	if (sizeStr) {
+		char *endptr;
+		size = strtoul(sizeStr, &endptr, 10);
+		if (*endptr != '\0')
+			size = LogRecorderDefaultSize;
+	}
+
+	if (logSetRecorder(path, size))
+		return;
+
+	struct sigaction sa;
+	sigaction(SIGUSR2, nullptr, &sa);
+	if (sa.sa_flags & SA_SIGINFO || sa.sa_handler != SIG_DFL)
+		return;
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = &log_recorder_sigusr2;
+	sa.sa_flags = SA_RESTART;
+	sigaction(SIGUSR2, &sa, nullptr);
+}
+
 /**
  * \brief Parse the log levels from the environment
  *
@@ -642,6 +1384,7 @@ void Logger::registerCategory(LogCategory *category)
 {
 	categories_.insert(category);
 
+	LogSeverity severity = category->severity();
 	const std::string &name = category->name();
 	for (const std::pair<std::string, LogSeverity> &level : levels_) {
 		bool match = true;
@@ -658,10 +1401,12 @@ void Logger::registerCategory(LogCategory *category)
 		}
 
 		if (match) {
-			category->setSeverity(level.second);
+			severity = level.second;
 			break;
 		}
 	}
+
+	category->setSeverity(severity);
 }
 
 /**
@@ -705,7 +1450,8 @@ void Logger::unregisterCategory(LogCategory *category)
  * \param[in] name The category name
  */
 LogCategory::LogCategory(const char *name)
-	: name_(name), severity_(LogSeverity::LogInfo)
+	: name_(name), severity_(LogSeverity::LogInfo),
+	  threshold_(LogSeverity::LogInfo)
 {
 	Logger::instance()->registerCategory(this);
 }
@@ -728,6 +1474,18 @@ LogCategory::~LogCategory()
  * \return Return the severity of the log category
  */
 
+/**
+ * \fn LogCategory::threshold()
+ * \brief Retrieve the severity threshold of the log category
+ *
+ * The threshold is the lowest severity of messages that are created for the
+ * category. It is equal to the severity of the category, or to LogDebug when
+ * the log flight recorder is enabled, as the recorder stores messages of all
+ * severities.
+ *
+ * \return The severity threshold of the log category
+ */
+
 /**
  * \brief Set the severity of the log category
  *
@@ -737,6 +1495,7 @@ LogCategory::~LogCategory()
 void LogCategory::setSeverity(LogSeverity severity)
 {
 	severity_ = severity;
+	threshold_ = Logger::instance()->recording() ? LogDebug : severity;
 }
 
 /**
@@ -814,19 +1573,21 @@ LogMessage::LogMessage(const char *fileName, unsigned int line,
  */
 LogMessage::LogMessage(LogMessage &&other)
 	: msgStream_(std::move(other.msgStream_)), category_(other.category_),
-	  severity_(other.severity_)
+	  severity_(other.severity_), timestamp_(other.timestamp_),
+	  fileName_(other.fileName_), line_(other.line_)
 {
 	other.severity_ = LogInvalid;
 }
 
 void LogMessage::init(const char *fileName, unsigned int line)
 {
-	/* Log the timestamp, severity and file information. */
+	/*
+	 * Log the timestamp, severity and file information. The file
+	 * information is only formatted when the message is output.
+	 */
 	timestamp_ = utils::clock::now();
-
-	std::ostringstream ossFileInfo;
-	ossFileInfo << utils::basename(fileName) << ":" << line;
-	fileInfo_ = ossFileInfo.str();
+	fileName_ = fileName;
+	line_ = line;
 }
 
 LogMessage::~LogMessage()
@@ -837,11 +1598,16 @@ LogMessage::~LogMessage()
 
 	msgStream_ << std::endl;
 
-	if (severity_ >= category_.severity())
-		Logger::instance()->write(*this);
+	Logger *logger = Logger::instance();
+	logger->record(*this);
+
+	if (severity_ >= category_.severity()) {
+		CpuScope scope(CameraStatistics::CpuLogging);
+		logger->write(*this);
+	}
 
 	if (severity_ == LogSeverity::LogFatal) {
-		Logger::instance()->backtrace();
+		logger->backtrace();
 		std::abort();
 	}
 }
@@ -875,10 +1641,29 @@ LogMessage::~LogMessage()
  */
 
 /**
- * \fn LogMessage::fileInfo()
+ * \fn LogMessage::fileName()
+ * \brief Retrieve the name of the file the message is logged from
+ * \return The file name, as passed to the constructor
+ */
+
+/**
+ * \fn LogMessage::line()
+ * \brief Retrieve the line number the message is logged from
+ * \return The line number
+ */
+
+/**
  * \brief Retrieve the file info of the log message
+ *
+ * The file info is formatted as the base name of the file and the line number,
+ * separated by a colon.
+ *
  * \return The file info of the message
  */
+std::string LogMessage::fileInfo() const
+{
+	return std::string(utils::basename(fileName_)) + ":" + std::to_string(line_);
+}
 
 /**
  * \fn LogMessage::msg()
@@ -897,6 +1682,11 @@ LogMessage::~LogMessage()
  * methods.
  */
 
+Loggable::Loggable()
+	: prefixValid_(false)
+{
+}
+
 Loggable::~Loggable()
 {
 }
@@ -909,9 +1699,39 @@ Loggable::~Loggable()
  * logger with an object-specific prefix output right before the log message
  * contents.
  *
+ * The prefix is cached the first time a message is logged, to avoid formatting
+ * it for every message. Classes whose prefix depends on state that changes
+ * after the first message shall call invalidateLogPrefix() when the state
+ * changes.
+ *
  * \return A string to be prefixed to the log message
  */
 
+/**
+ * \brief Invalidate the cached log prefix
+ *
+ * Drop the cached log prefix, to retrieve it again from logPrefix() when the
+ * next message is logged.
+ */
+void Loggable::invalidateLogPrefix()
+{
+	prefixValid_ = false;
+}
+
+/*
+ * The prefix cache isn't protected by a lock, as Loggable objects are not
+ * thread-safe and are used from a single thread at a time.
+ */
+const std::string &Loggable::cachedLogPrefix() const
+{
+	if (!prefixValid_) {
+		prefix_ = logPrefix() + ": ";
+		prefixValid_ = true;
+	}
+
+	return prefix_;
+}
+
 /**
  * \brief Create a temporary LogMessage object to log a message
  * \param[in] fileName The file name where the message is logged from
@@ -928,7 +1748,7 @@ LogMessage Loggable::_log(const char *fileName, unsigned int line,
 {
 	LogMessage msg(fileName, line, severity);
 
-	msg.stream() << logPrefix() << ": ";
+	msg.stream() << cachedLogPrefix();
 	return msg;
 }
 
@@ -950,7 +1770,7 @@ LogMessage Loggable::_log(const char *fileName, unsigned int line,
 {
 	LogMessage msg(fileName, line, category, severity);
 
-	msg.stream() << logPrefix() << ": ";
+	msg.stream() << cachedLogPrefix();
 	return msg;
 }
 
@@ -1030,6 +1850,119 @@ LogMessage _log(const char *fileName, unsigned int line,
  *
  * If the severity is set to Fatal, execution is aborted and the program
  * terminates immediately after printing the message.
+ *
+ * The severity is checked against the log level of the category before the
+ * message is created. Messages that are discarded thus cost a single
+ * comparison, and the expressions streamed to them are not evaluated. Those
+ * expressions shall consequently not have side effects.
+ */
+
+/**
+ * \def LOG_RATELIMITED(category, severity)
+ * \hideinitializer
+ * \brief Log a message, limiting the rate of messages from the call site
+ * \param[in] category Category (optional)
+ * \param[in] severity Severity
+ *
+ * This macro behaves as LOG(), but limits the number of messages output by
+ * each call site with a LogRateLimiter. It is meant for errors that can repeat
+ * at a high rate, such as device errors reported for every frame, which would
+ * otherwise flood the log output.
+ */
+
+/**
+ * \def LOG_ONCE(category, severity)
+ * \hideinitializer
+ * \brief Log a message once only
+ * \param[in] category Category (optional)
+ * \param[in] severity Severity
+ *
+ * This macro behaves as LOG(), but outputs the message the first time the
+ * call site is executed only, for the lifetime of the process.
+ */
+
+/**
+ * \class LogRateLimiter
+ * \brief Limit the rate of log messages
+ *
+ * The LogRateLimiter class implements the per-call-site state of the
+ * LOG_RATELIMITED() macro. It allows a burst of messages in every time
+ * interval, and suppresses the messages exceeding the burst. The number of
+ * suppressed messages is reported once the interval elapses, right before the
+ * next message that is allowed.
+ *
+ * The state is updated with atomic operations only, to keep rate-limited call
+ * sites cheap and usable from any thread. Concurrent messages at the interval
+ * boundary may be counted in either interval.
+ */
+
+/**
+ * \brief Construct a rate limiter
+ * \param[in] burst The number of messages allowed in each interval
+ * \param[in] interval The rate limiting interval
+ */
+LogRateLimiter::LogRateLimiter(unsigned int burst,
+			       std::chrono::milliseconds interval)
+	: burst_(burst),
+	  interval_(std::chrono::duration_cast<std::chrono::nanoseconds>(interval).count()),
+	  windowStart_(INT64_MIN / 2), count_(0), suppressed_(0)
+{
+}
+
+/**
+ * \brief Check if a message is allowed
+ * \param[in] file The file name of the call site
+ * \param[in] line The line number of the call site
+ * \param[in] category The message category
+ * \param[in] severity The message severity
+ *
+ * When a new interval starts and messages have been suppressed in the previous
+ * interval, this function logs the number of suppressed messages with the
+ * \a file, \a line, \a category and \a severity of the call site.
+ *
+ * \return True if the message shall be output, false if it shall be suppressed
+ */
+bool LogRateLimiter::allow(const char *file, unsigned int line,
+			   const LogCategory &category, LogSeverity severity)
+{
+	int64_t now = std::chrono::duration_cast<std::chrono::nanoseconds>(
+		utils::clock::now().time_since_epoch()).count();
+	int64_t start = windowStart_.load(std::memory_order_relaxed);
+
+	if (now - start >= interval_ &&
+	    windowStart_.compare_exchange_strong(start, now,
+						 std::memory_order_relaxed)) {
+		count_.store(0, std::memory_order_relaxed);
+
+		unsigned int suppressed = suppressed_.exchange(0, std::memory_order_relaxed);
+		if (suppressed)
+			LogMessage(file, line, category, severity).stream()
+				<< suppressed << " similar messages suppressed";
+	}
+
+	if (count_.fetch_add(1, std::memory_order_relaxed) < burst_)
+		return true;
+
+	suppressed_.fetch_add(1, std::memory_order_relaxed);
+	return false;
+}
+
+/**
+ * \class LogOnce
+ * \brief Allow a single log message
+ *
+ * The LogOnce class implements the per-call-site state of the LOG_ONCE()
+ * macro.
+ */
+
+/**
+ * \fn LogOnce::allow()
+ * \brief Check if a message is allowed
+ * \param[in] file The file name of the call site
+ * \param[in] line The line number of the call site
+ * \param[in] category The message category
+ * \param[in] severity The message severity
+ * \return True the first time the function is called, false afterwards
  */
 
 /**
@@ -0,0 +1,420 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * mapped_framebuffer.cpp - CPU mappings of FrameBuffer memory
+ */
+
+#include <libcamera/mapped_framebuffer.h>
+
+#include <algorithm>
+#include <errno.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+
+#include <linux/dma-buf.h>
+
+#include <libcamera/buffer.h>
+
+#include "log.h"
+
+/**
+ * \file mapped_framebuffer.h
+ * \brief CPU mappings of FrameBuffer memory
+ */
+
+namespace libcamera {
+
+LOG_DECLARE_CATEGORY(Buffer)
+
+/**
+ * \class MappedFrameBuffer
+ * \brief Map the planes of a FrameBuffer to CPU-accessible memory
+ *
+ * The MappedFrameBuffer class maps all the planes of a FrameBuffer in the
+ * process address space with mmap() at construction time, and unmaps them at
+ * destruction time. Planes that share the same dmabuf file descriptor are
+ * mapped once, and point to the same memory mapping. This avoids creating
+ * duplicate virtual memory areas for buffers whose planes are stored in a
+ * single dmabuf. Planes that wrap user pointers are already accessible to the
+ * CPU, and are used directly without creating any mapping.
+ *
+ * The mapping may fail, in which case isValid() returns false and error()
+ * reports the cause of the failure. The planes() are only valid if the mapping
+ * succeeded.
+ *
+ * The FrameBuffer must outlive the MappedFrameBuffer.
+ */
+
+/**
+ * \enum MappedFrameBuffer::MapFlag
+ * \brief Specify the CPU access mode of the mapping
+ * \var MappedFrameBuffer::MapRead
+ * The memory is mapped for reading
+ * \var MappedFrameBuffer::MapWrite
+ * The memory is mapped for writing
+ * \var MappedFrameBuffer::MapReadWrite
+ * The memory is mapped for reading and writing
+ */
+
+/**
+ * \struct MappedFrameBuffer::Plane
+ * \brief CPU mapping of a FrameBuffer plane
+ *
+ * \var MappedFrameBuffer::Plane::data
+ * \brief Pointer to the first byte of the plane
+ *
+ * \var MappedFrameBuffer::Plane::length
+ * \brief Length of the plane in bytes
+ */
+
+/**
+ * \brief Map all planes of a FrameBuffer
+ * \param[in] buffer The FrameBuffer to map
+ * \param[in] flags The access mode, as a combination of MapFlag values
+ */
+MappedFrameBuffer::MappedFrameBuffer(const FrameBuffer *buffer,
+				     unsigned int flags)
+	: buffer_(buffer), flags_(flags), error_(0)
+{
+	int prot = 0;
+	if (flags & MapRead)
+		prot |= PROT_READ;
+	if (flags & MapWrite)
+		prot |= PROT_WRITE;
+
+	/* Compute the size of the mapping for each distinct dmabuf. */
+	for (const FrameBuffer::Plane &plane : buffer->planes()) {
+		if (plane.address)
+			continue;
+
+		const int fd = plane.fd.fd();
+
+		auto iter = std::find_if(maps_.begin(), maps_.end(),
+					 [fd](const Mapping &map) {
+						 return map.fd == fd;
+					 });
+		if (iter == maps_.end())
+			maps_.push_back({ fd, MAP_FAILED, plane.length });
+		else
+			iter->length = std::max<size_t>(iter->length, plane.length);
+	}
+
+	for (Mapping &map : maps_) {
+		map.address = mmap(nullptr, map.length, prot, MAP_SHARED,
+				   map.fd, 0);
+		if (map.address == MAP_FAILED) {
+			error_ = -errno;
+			LOG(Buffer, Error)
+				<< "Failed to mmap plane: " << strerror(-error_);
+			return;
+		}
+	}
+
+	for (const FrameBuffer::Plane &plane : buffer->planes()) {
+		if (plane.address) {
+			planes_.push_back({ static_cast<uint8_t *>(plane.address),
+					    plane.length });
+			continue;
+		}
+
+		const int fd = plane.fd.fd();
+
+		auto iter = std::find_if(maps_.begin(), maps_.end(),
+					 [fd](const Mapping &map) {
+						 return map.fd == fd;
+					 });
+		planes_.push_back({ static_cast<uint8_t *>(iter->address),
+				    plane.length });
+	}
+}
+
+MappedFrameBuffer::~MappedFrameBuffer()
+{
+	for (const Mapping &map : maps_) {
+		if (map.address != MAP_FAILED)
+			munmap(map.address, map.length);
+	}
+}
+
+/**
+ * \fn MappedFrameBuffer::isValid()
+ * \brief Check if the FrameBuffer has been mapped successfully
+ * \return True if all planes have been mapped, false otherwise
+ */
+
+/**
+ * \fn MappedFrameBuffer::error()
+ * \brief Retrieve the mapping error
+ * \return 0 if the FrameBuffer has been mapped successfully, or a negative
+ * error code otherwise
+ */
+
+/**
+ * \fn MappedFrameBuffer::buffer()
+ * \brief Retrieve the mapped FrameBuffer
+ * \return The FrameBuffer
+ */
+
+/**
+ * \fn MappedFrameBuffer::flags()
+ * \brief Retrieve the access mode of the mapping
+ * \return The MapFlag values the buffer has been mapped with
+ */
+
+/**
+ * \fn MappedFrameBuffer::planes()
+ * \brief Retrieve the mapped planes
+ *
+ * The planes are stored in the same order as the FrameBuffer planes.
+ *
+ * \return The mapped planes
+ */
+
+/**
+ * \class ScopedCpuAccess
+ * \brief Synchronise CPU access to dmabuf memory for a scope
+ *
+ * Devices may access memory without going through the CPU caches. On
+ * platforms where device DMA isn't cache-coherent, the CPU caches must be
+ * maintained around CPU accesses to memory written or read by devices, or the
+ * CPU would read stale data, or devices would miss data written by the CPU.
+ * Dmabufs provide the DMA_BUF_IOCTL_SYNC ioctl for this purpose, which the
+ * ScopedCpuAccess class wraps.
+ *
+ * A ScopedCpuAccess instance signals the start of CPU access to the kernel at
+ * construction time, and the end of CPU access at destruction time. It is
+ * meant to be created on the stack around the code that accesses the memory:
+ *
+ * \code{.cpp}
+ * MappedFrameBuffer mapped(buffer, MappedFrameBuffer::MapRead);
+ *
+ * {
+ *	ScopedCpuAccess access(mapped, 1 << 0);
+ *	process(mapped.planes()[0].data);
+ * }
+ * \endcode
+ *
+ * Only the planes actually accessed should be synchronised, as cache
+ * maintenance is costly. Planes that share the same dmabuf are synchronised
+ * once.
+ *
+ * File descriptors that don't refer to a dmabuf, and planes that wrap user
+ * pointers, are ignored, as they don't need any synchronisation.
+ */
+
+/**
+ * \var ScopedCpuAccess::AllPlanes
+ * \brief Plane mask that selects all the planes of a buffer
+ */
+constexpr uint32_t ScopedCpuAccess::AllPlanes;
+
+/**
+ * \brief Start CPU access to the planes of a mapped buffer
+ * \param[in] buffer The mapped buffer
+ * \param[in] planes Bitmask of the indices of planes to synchronise
+ *
+ * The access direction is derived from the flags \a buffer has been mapped
+ * with.
+ */
+ScopedCpuAccess::ScopedCpuAccess(const MappedFrameBuffer &buffer,
+				 uint32_t planes)
+	: flags_(0), error_(0), count_(0)
+{
+	if (buffer.flags() & MappedFrameBuffer::MapRead)
+		flags_ |= DMA_BUF_SYNC_READ;
+	if (buffer.flags() & MappedFrameBuffer::MapWrite)
+		flags_ |= DMA_BUF_SYNC_WRITE;
+
+	Span<const FrameBuffer::Plane> fbPlanes = buffer.buffer()->planes();
+	for (unsigned int i = 0; i < fbPlanes.size() && i < 32; ++i) {
+		if (planes & (1U << i))
+			begin(fbPlanes[i].fd.fd());
+	}
+}
+
+/**
+ * \brief Start CPU access to a single plane
+ * \param[in] plane The FrameBuffer plane
+ * \param[in] flags The access direction, as a combination of
+ * MappedFrameBuffer::MapFlag values
+ */
+ScopedCpuAccess::ScopedCpuAccess(const FrameBuffer::Plane &plane,
+				 unsigned int flags)
+	: flags_(0), error_(0), count_(0)
+{
+	if (flags & MappedFrameBuffer::MapRead)
+		flags_ |= DMA_BUF_SYNC_READ;
+	if (flags & MappedFrameBuffer::MapWrite)
+		flags_ |= DMA_BUF_SYNC_WRITE;
+
+	begin(plane.fd.fd());
+}
+
+ScopedCpuAccess::~ScopedCpuAccess()
+{
+	for (unsigned int i = 0; i < count_; ++i)
+		sync(fds_[i], flags_ | DMA_BUF_SYNC_END);
+}
+
+/**
+ * \fn ScopedCpuAccess::error()
+ * \brief Retrieve the synchronisation error
+ * \return 0 if CPU access has been started successfully for all dmabufs, or
+ * a negative error code otherwise
+ */
+
+void ScopedCpuAccess::begin(int fd)
+{
+	if (fd < 0)
+		return;
+
+	for (unsigned int i = 0; i < count_; ++i) {
+		if (fds_[i] == fd)
+			return;
+	}
+
+	if (count_ == MaxDmaBufs) {
+		error_ = -ENOSPC;
+		return;
+	}
+
+	int ret = sync(fd, flags_ | DMA_BUF_SYNC_START);
+	if (ret == -ENOTTY)
+		return;
+
+	if (ret < 0) {
+		LOG(Buffer, Error)
+			<< "Failed to start CPU access: " << strerror(-ret);
+		error_ = ret;
+		return;
+	}
+
+	fds_[count_++] = fd;
+}
+
+int ScopedCpuAccess::sync(int fd, uint64_t flags)
+{
+	struct dma_buf_sync sync = {};
+	sync.flags = flags;
+
+	int ret;
+	do {
+		ret = ioctl(fd, DMA_BUF_IOCTL_SYNC, &sync);
+	} while (ret < 0 && (errno == EINTR || errno == EAGAIN));
+
+	return ret < 0 ? -errno : 0;
+}
+
+/**
+ * \class MappedBufferCache
+ * \brief Cache of FrameBuffer memory mappings
+ *
+ * Mapping a buffer is a costly operation, which shouldn't be performed for
+ * every frame. The MappedBufferCache class maps FrameBuffer instances on first
+ * use and keeps the mappings alive until they're explicitly released with
+ * unmap() or clear(), or until the cache is destroyed. Components that access
+ * the same buffers from the CPU can share a cache to avoid mapping the
+ * buffers multiple times.
+ *
+ * The cache tracks the lifetime of the buffers it maps through their
+ * FrameBuffer::destroyed signal, and releases the mapping of a buffer when the
+ * buffer is destroyed. A new FrameBuffer allocated at the same address is thus
+ * never given the mapping of a destroyed buffer. As the cache isn't thread-safe,
+ * buffers shall be destroyed in the thread that uses the cache.
+ */
+
+/**
+ * \brief Construct a mapped buffer cache
+ * \param[in] flags The access mode for all buffers mapped through the cache
+ */
+MappedBufferCache::MappedBufferCache(unsigned int flags)
+	: flags_(flags)
+{
+}
+
+MappedBufferCache::~MappedBufferCache()
+{
+	clear();
+}
+
+/**
+ * \brief Retrieve the mapping of a buffer, mapping it if needed
+ * \param[in] buffer The FrameBuffer
+ *
+ * If \a buffer has already been mapped through the cache, return the existing
+ * mapping. Otherwise map the buffer and store the mapping in the cache.
+ *
+ * \return The mapped buffer, or nullptr if the buffer can't be mapped
+ */
+const MappedFrameBuffer *MappedBufferCache::map(const FrameBuffer *buffer)
+{
+	auto iter = mappings_.find(buffer);
+	if (iter != mappings_.end())
+		return iter->second.get();
+
+	std::unique_ptr<MappedFrameBuffer> mapped =
+		std::make_unique<MappedFrameBuffer>(buffer, flags_);
+	if (!mapped->isValid())
+		return nullptr;
+
+	buffer->destroyed.connect(this, &MappedBufferCache::bufferDestroyed);
+
+	const MappedFrameBuffer *ptr = mapped.get();
+	mappings_[buffer] = std::move(mapped);
+
+	return ptr;
+}
+
+/**
+ * \brief Retrieve the mapping of a buffer
+ * \param[in] buffer The FrameBuffer
+ * \return The mapped buffer, or nullptr if \a buffer hasn't been mapped
+ * through the cache
+ */
+const MappedFrameBuffer *MappedBufferCache::find(const FrameBuffer *buffer) const
+{
+	auto iter = mappings_.find(buffer);
+	if (iter == mappings_.end())
+		return nullptr;
+
+	return iter->second.get();
+}
+
+/**
+ * \brief Unmap a buffer and remove it from the cache
+ * \param[in] buffer The FrameBuffer
+ */
+void MappedBufferCache::unmap(const FrameBuffer *buffer)
+{
+	if (!mappings_.erase(buffer))
+		return;
+
+	buffer->destroyed.disconnect(this, &MappedBufferCache::bufferDestroyed);
+}
+
+/**
+ * \brief Unmap all buffers in the cache
+ */
+void MappedBufferCache::clear()
+{
+	for (const auto &mapping : mappings_)
+		mapping.first->destroyed.disconnect(this, &MappedBufferCache::bufferDestroyed);
+
+	mappings_.clear();
+}
+
+/**
+ * \fn MappedBufferCache::flags()
+ * \brief Retrieve the access mode of the mappings
+ * \return The MappedFrameBuffer::MapFlag values buffers are mapped with
+ */
+
+void MappedBufferCache::bufferDestroyed(const FrameBuffer *buffer)
+{
+	/* The signal is disconnected by the buffer itself. */
+	mappings_.erase(buffer);
+}
+
+} /* namespace libcamera */
@@ -7,10 +7,13 @@
 
 #include "media_device.h"
 
+#include <algorithm>
 #include <errno.h>
 #include <fcntl.h>
+#include <queue>
 #include <string>
 #include <string.h>
+#include <sys/eventfd.h>
 #include <sys/ioctl.h>
 #include <unistd.h>
 #include <vector>
@@ -18,6 +21,7 @@
 #include <linux/media.h>
 
 #include "log.h"
+#include "media_request.h"
 
 /**
  * \file media_device.h
@@ -52,6 +56,15 @@ LOG_DEFINE_CATEGORY(MediaDevice)
  * Media device can be claimed for exclusive use with acquire(), released with
  * release() and tested with busy(). This mechanism is aimed at pipeline
  * managers to claim media devices they support during enumeration.
+ *
+ * The MediaDevice caches the state of the links of the media graph. The cache
+ * is populated along with the graph, and refreshed from the kernel when the
+ * device is locked with lock(), as other instances of libcamera may have
+ * modified the links while the device was unlocked. Link setup operations
+ * that wouldn't change the state of a link are then skipped, avoiding
+ * unnecessary MEDIA_IOC_SETUP_LINK calls and the associated kernel pipeline
+ * validation. The setupLinks() function applies a complete link configuration
+ * with the minimum number of changes.
  */
 
 /**
@@ -62,8 +75,8 @@ LOG_DEFINE_CATEGORY(MediaDevice)
  * populate() before the media graph can be queried.
  */
 MediaDevice::MediaDevice(const std::string &deviceNode)
-	: deviceNode_(deviceNode), fd_(-1), valid_(false), acquired_(false),
-	  lockOwner_(false)
+	: deviceNode_(deviceNode), fd_(-1), valid_(false), simulated_(false),
+	  acquired_(false), lockOwner_(false), linksCached_(false)
 {
 }
 
@@ -98,6 +111,8 @@ MediaDevice::~MediaDevice()
  */
 bool MediaDevice::acquire()
 {
+	MutexLocker locker(mutex_);
+
 	if (acquired_)
 		return false;
 
@@ -114,6 +129,8 @@ bool MediaDevice::acquire()
  */
 void MediaDevice::release()
 {
+	MutexLocker locker(mutex_);
+
 	close();
 	acquired_ = false;
 }
@@ -137,6 +154,8 @@ void MediaDevice::release()
  */
 bool MediaDevice::lock()
 {
+	MutexLocker locker(mutex_);
+
 	if (fd_ == -1)
 		return false;
 
@@ -144,10 +163,24 @@ bool MediaDevice::lock()
 	if (lockOwner_)
 		return false;
 
-	if (lockf(fd_, F_TLOCK, 0))
+	lockOwner_ = true;
+
+	/* Simulated devices are private to this instance of libcamera. */
+	if (simulated_) {
+		linksCached_ = true;
+		return true;
+	}
+
+	if (lockf(fd_, F_TLOCK, 0)) {
+		lockOwner_ = false;
 		return false;
+	}
 
-	lockOwner_ = true;
+	/*
+	 * On failure to refresh the link state cache, fall back to applying
+	 * all link setup operations.
+	 */
+	linksCached_ = !syncLinks();
 
 	return true;
 }
@@ -163,6 +196,8 @@ bool MediaDevice::lock()
  */
 void MediaDevice::unlock()
 {
+	MutexLocker locker(mutex_);
+
 	if (fd_ == -1)
 		return;
 
@@ -170,17 +205,56 @@ void MediaDevice::unlock()
 		return;
 
 	lockOwner_ = false;
+	linksCached_ = false;
 
-	lockf(fd_, F_ULOCK, 0);
+	if (!simulated_)
+		lockf(fd_, F_ULOCK, 0);
 }
 
 /**
- * \fn MediaDevice::busy()
  * \brief Check if a device is in use
+ *
+ * The device claiming and locking state is protected by a mutex, as media
+ * devices are enumerated in the camera manager thread and claimed and
+ * locked by pipeline handlers that may run in their own threads.
+ *
  * \return true if the device has been claimed for exclusive use, or false if it
  * is available
  * \sa acquire(), release()
  */
+bool MediaDevice::busy() const
+{
+	MutexLocker locker(mutex_);
+
+	return acquired_;
+}
+
+/**
+ * \brief Allocate a request for the V4L2 Request API
+ *
+ * Requests can only be allocated when the device has been acquired. The
+ * request is bound to the media device and remains valid after the device is
+ * released, but shall not be used anymore at that point.
+ *
+ * \return A new MediaRequest, or nullptr if the device isn't acquired, or if
+ * the drivers don't support the Request API
+ */
+std::unique_ptr<MediaRequest> MediaDevice::allocateRequest()
+{
+	if (fd_ == -1)
+		return nullptr;
+
+	int requestFd;
+	int ret = ioctl(fd_, MEDIA_IOC_REQUEST_ALLOC, &requestFd);
+	if (ret < 0) {
+		ret = -errno;
+		LOG(MediaDevice, Debug)
+			<< "Failed to allocate request: " << strerror(-ret);
+		return nullptr;
+	}
+
+	return std::make_unique<MediaRequest>(requestFd);
+}
 
 /**
  * \brief Populate the MediaDevice with device information and media objects
@@ -195,9 +269,16 @@ void MediaDevice::unlock()
  * while pads are accessible from the entity they belong to and links from the
  * pads they connect.
  *
+ * When a device \a cache is given, the media graph is retrieved from the cache
+ * entry of the device if the topology version and object counts reported by
+ * the device match the cached graph, saving the retrieval of the full graph.
+ * The cached link flags may be outdated, they are refreshed when the device is
+ * locked. The cache entry is kept by the media device, for its subdevices and
+ * video devices to cache their formats.
+ *
  * \return 0 on success or a negative error code otherwise
  */
-int MediaDevice::populate()
+int MediaDevice::populate(DeviceCache *cache)
 {
 	struct media_v2_topology topology = {};
 	struct media_v2_entity *ents = nullptr;
@@ -205,9 +286,11 @@ int MediaDevice::populate()
 	struct media_v2_link *links = nullptr;
 	struct media_v2_pad *pads = nullptr;
 	__u64 version = -1;
+	bool cached = false;
 	int ret;
 
 	clear();
+	cacheEntry_.reset();
 
 	ret = open();
 	if (ret)
@@ -226,10 +309,50 @@ int MediaDevice::populate()
 	model_ = info.model;
 	version_ = info.media_version;
 
+	if (cache) {
+		std::ostringstream key;
+		key << info.driver << ":" << info.model << ":" << info.serial
+		    << ":" << info.bus_info << ":" << info.hw_revision << ":"
+		    << info.driver_version;
+		cacheEntry_ = cache->entry(key.str());
+	}
+
+	/*
+	 * Validate the cached graph with a G_TOPOLOGY call that only retrieves
+	 * the topology version and the object counts.
+	 */
+	if (cacheEntry_ && cacheEntry_->topology()) {
+		const DeviceCache::Topology &entry = *cacheEntry_->topology();
+
+		ret = ioctl(fd_, MEDIA_IOC_G_TOPOLOGY, &topology);
+		if (!ret && topology.topology_version == entry.version &&
+		    topology.num_entities == entry.entities.size() &&
+		    topology.num_interfaces == entry.interfaces.size() &&
+		    topology.num_pads == entry.pads.size() &&
+		    topology.num_links == entry.links.size()) {
+			ents = new struct media_v2_entity[topology.num_entities];
+			interfaces = new struct media_v2_interface[topology.num_interfaces];
+			links = new struct media_v2_link[topology.num_links];
+			pads = new struct media_v2_pad[topology.num_pads];
+
+			std::copy(entry.entities.begin(), entry.entities.end(), ents);
+			std::copy(entry.interfaces.begin(), entry.interfaces.end(), interfaces);
+			std::copy(entry.links.begin(), entry.links.end(), links);
+			std::copy(entry.pads.begin(), entry.pads.end(), pads);
+
+			topology.ptr_entities = reinterpret_cast<__u64>(ents);
+			topology.ptr_interfaces = reinterpret_cast<__u64>(interfaces);
+			topology.ptr_links = reinterpret_cast<__u64>(links);
+			topology.ptr_pads = reinterpret_cast<__u64>(pads);
+
+			cached = true;
+		}
+	}
+
 	/*
 	 * Keep calling G_TOPOLOGY until the version number stays stable.
 	 */
-	while (true) {
+	while (!cached) {
 		topology.topology_version = 0;
 		topology.ptr_entities = reinterpret_cast<__u64>(ents);
 		topology.ptr_interfaces = reinterpret_cast<__u64>(interfaces);
@@ -261,11 +384,27 @@ int MediaDevice::populate()
 		version = topology.topology_version;
 	}
 
+	if (cacheEntry_ && !cached) {
+		DeviceCache::Topology entry;
+		entry.version = topology.topology_version;
+		entry.entities.assign(ents, ents + topology.num_entities);
+		entry.interfaces.assign(interfaces, interfaces + topology.num_interfaces);
+		entry.links.assign(links, links + topology.num_links);
+		entry.pads.assign(pads, pads + topology.num_pads);
+		cacheEntry_->setTopology(std::move(entry));
+	}
+
 	/* Populate entities, pads and links. */
 	if (populateEntities(topology) &&
 	    populatePads(topology) &&
-	    populateLinks(topology))
+	    populateLinks(topology)) {
 		valid_ = true;
+		linksCached_ = !cached;
+	}
+
+	if (cached)
+		LOG(MediaDevice, Debug)
+			<< "Populated " << deviceNode_ << " from cache";
 
 	ret = 0;
 done:
@@ -284,6 +423,51 @@ done:
 	return ret;
 }
 
+/**
+ * \brief Populate the MediaDevice from an in-memory media graph
+ * \param[in] info The media device information
+ * \param[in] topology The media graph topology
+ *
+ * This function populates the media graph from a \a topology provided by the
+ * caller instead of retrieving it from the kernel. It is used by device
+ * enumerators that simulate media devices in userspace, to measure the
+ * overhead of libcamera without depending on hardware or kernel drivers.
+ *
+ * The pointers in the \a topology shall reference arrays of entities, pads
+ * and links, and interfaces if any, formatted as returned by the
+ * MEDIA_IOC_G_TOPOLOGY ioctl. Their content is copied, the arrays don't need
+ * to outlive the function call.
+ *
+ * Simulated media devices are not backed by a device node. Opening them
+ * creates an eventfd in place of the device file descriptor, locking them
+ * doesn't contend with other processes, and link setup only updates the link
+ * state cache.
+ *
+ * \return 0 on success or a negative error code otherwise
+ */
+int MediaDevice::populate(const struct media_device_info &info,
+			  const struct media_v2_topology &topology)
+{
+	clear();
+	cacheEntry_.reset();
+
+	driver_ = info.driver;
+	model_ = info.model;
+	version_ = info.media_version;
+	simulated_ = true;
+
+	if (!populateEntities(topology) || !populatePads(topology) ||
+	    !populateLinks(topology)) {
+		clear();
+		return -EINVAL;
+	}
+
+	valid_ = true;
+	linksCached_ = true;
+
+	return 0;
+}
+
 /**
  * \fn MediaDevice::valid()
  * \brief Query whether the media graph has been populated and is valid
@@ -321,11 +505,8 @@ done:
  */
 MediaEntity *MediaDevice::getEntityByName(const std::string &name) const
 {
-	for (MediaEntity *e : entities_)
-		if (e->name() == name)
-			return e;
-
-	return nullptr;
+	auto it = entitiesByName_.find(name);
+	return it != entitiesByName_.end() ? it->second : nullptr;
 }
 
 /**
@@ -409,34 +590,161 @@ MediaLink *MediaDevice::link(const MediaPad *source, const MediaPad *sink)
 }
 
 /**
- * \brief Disable all links in the media device
+ * \brief Find the shortest path between two entities
+ * \param[in] source The entity the path starts from
+ * \param[in] sink The entity the path ends at
  *
- * Disable all the media device links, clearing the MEDIA_LNK_FL_ENABLED flag
- * on links which are not flagged as IMMUTABLE.
+ * \sa findPath(const MediaEntity *source, const std::function<bool(const MediaEntity *)> &match) const
+ *
+ * \return The links of the path from \a source to \a sink, ordered from
+ * source to sink, or an empty vector if no path exists
+ */
+std::vector<MediaLink *> MediaDevice::findPath(const MediaEntity *source,
+					       const MediaEntity *sink) const
+{
+	return findPath(source, [sink](const MediaEntity *entity) {
+		return entity == sink;
+	});
+}
+
+/**
+ * \brief Find the shortest path to the closest entity matching a condition
+ * \param[in] source The entity the path starts from
+ * \param[in] match The condition the entity at the end of the path fulfils
+ *
+ * Walk the media graph breadth-first from \a source, following data links in
+ * the direction of the data flow regardless of their state, until an entity
+ * for which \a match returns true is found. This is typically used to find
+ * the links to enable between a camera sensor and the closest video node:
+ *
+ * \code{.cpp}
+ * std::vector<MediaLink *> path =
+ *	media->findPath(sensor, [](const MediaEntity *entity) {
+ *		return entity->function() == MEDIA_ENT_F_IO_V4L;
+ *	});
+ * \endcode
+ *
+ * The \a source entity itself is never matched.
+ *
+ * \return The links of the path from \a source to the closest matching entity,
+ * ordered from source to sink, or an empty vector if no entity matches
+ */
+std::vector<MediaLink *>
+MediaDevice::findPath(const MediaEntity *source,
+		      const std::function<bool(const MediaEntity *)> &match) const
+{
+	std::map<const MediaEntity *, MediaLink *> parents;
+	std::queue<const MediaEntity *> queue;
+	const MediaEntity *found = nullptr;
+
+	parents[source] = nullptr;
+	queue.push(source);
+
+	while (!queue.empty() && !found) {
+		const MediaEntity *entity = queue.front();
+		queue.pop();
+
+		for (const MediaPad *pad : entity->pads()) {
+			if (!(pad->flags() & MEDIA_PAD_FL_SOURCE))
+				continue;
+
+			for (MediaLink *link : pad->links()) {
+				const MediaEntity *next = link->sink()->entity();
+				if (parents.count(next))
+					continue;
+
+				parents[next] = link;
+				if (match(next)) {
+					found = next;
+					break;
+				}
+
+				queue.push(next);
+			}
+
+			if (found)
+				break;
+		}
+	}
+
+	std::vector<MediaLink *> path;
+	if (!found)
+		return path;
+
+	for (MediaLink *link = parents[found]; link;
+	     link = parents[link->source()->entity()])
+		path.push_back(link);
+
+	std::reverse(path.begin(), path.end());
+
+	return path;
+}
+
+/**
+ * \brief Configure the links of the media device
+ * \param[in] enabled The links to be enabled
+ *
+ * Enable all links in the \a enabled set and disable all other links of the
+ * media device, except for links flagged as IMMUTABLE. Only the links whose
+ * state differs from the requested configuration are modified. Links are
+ * disabled first, to release the pads they connect before enabling new links
+ * on them.
  *
  * \return 0 on success or a negative error code otherwise
+ * \retval -EINVAL A link in \a enabled doesn't belong to the media device
  */
-int MediaDevice::disableLinks()
+int MediaDevice::setupLinks(const std::set<MediaLink *> &enabled)
 {
+	std::vector<MediaLink *> enable;
+	std::vector<MediaLink *> disable;
+
 	for (MediaEntity *entity : entities_) {
 		for (MediaPad *pad : entity->pads()) {
 			if (!(pad->flags() & MEDIA_PAD_FL_SOURCE))
 				continue;
 
 			for (MediaLink *link : pad->links()) {
-				if (link->flags() & MEDIA_LNK_FL_IMMUTABLE)
-					continue;
-
-				int ret = link->setEnabled(false);
-				if (ret)
-					return ret;
+				if (enabled.count(link))
+					enable.push_back(link);
+				else if (!(link->flags() & MEDIA_LNK_FL_IMMUTABLE))
+					disable.push_back(link);
 			}
 		}
 	}
 
+	if (enable.size() != enabled.size()) {
+		LOG(MediaDevice, Error) << "Link not part of " << deviceNode_;
+		return -EINVAL;
+	}
+
+	for (MediaLink *link : disable) {
+		int ret = link->setEnabled(false);
+		if (ret)
+			return ret;
+	}
+
+	for (MediaLink *link : enable) {
+		int ret = link->setEnabled(true);
+		if (ret)
+			return ret;
+	}
+
 	return 0;
 }
 
+/**
+ * \brief Disable all links in the media device
+ *
+ * Disable all the media device links, clearing the MEDIA_LNK_FL_ENABLED flag
+ * on links which are not flagged as IMMUTABLE.
+ *
+ * \return 0 on success or a negative error code otherwise
+ */
+int MediaDevice::disableLinks()
+{
+	return setupLinks({});
+}
+
 /**
  * \var MediaDevice::disconnected
  * \brief Signal emitted when the media device is disconnected from the system
@@ -461,6 +769,11 @@ int MediaDevice::open()
 		return -EBUSY;
 	}
 
+	if (simulated_) {
+		fd_ = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+		return fd_ < 0 ? -errno : 0;
+	}
+
 	int ret = ::open(deviceNode_.c_str(), O_RDWR);
 	if (ret < 0) {
 		ret = -errno;
@@ -555,6 +868,7 @@ void MediaDevice::clear()
 
 	objects_.clear();
 	entities_.clear();
+	entitiesByName_.clear();
 	valid_ = false;
 }
 
@@ -563,6 +877,11 @@ void MediaDevice::clear()
  * \brief Global list of media entities in the media graph
  */
 
+/**
+ * \var MediaDevice::entitiesByName_
+ * \brief Index of the media entities in the media graph by name
+ */
+
 /**
  * \brief Find the interface associated with an entity
  * \param[in] topology The media topology as returned by MEDIA_IOC_G_TOPOLOGY
@@ -642,6 +961,7 @@ bool MediaDevice::populateEntities(const struct media_v2_topology &topology)
 		}
 
 		entities_.push_back(entity);
+		entitiesByName_.emplace(entity->name(), entity);
 	}
 
 	return true;
@@ -750,6 +1070,43 @@ void MediaDevice::fixupEntityFlags(struct media_v2_entity *entity)
 	entity->flags = desc.flags;
 }
 
+/**
+ * \brief Refresh the link state cache from the kernel
+ *
+ * Retrieve the flags of all links with MEDIA_IOC_G_TOPOLOGY and update the
+ * MediaLink instances accordingly.
+ *
+ * \return 0 on success or a negative error code otherwise
+ */
+int MediaDevice::syncLinks()
+{
+	struct media_v2_topology topology = {};
+	std::vector<struct media_v2_link> links;
+
+	/* Retrieve the number of links first, then the links. */
+	for (unsigned int i = 0; i < 2; ++i) {
+		links.resize(topology.num_links);
+		topology.ptr_links = reinterpret_cast<__u64>(links.data());
+
+		int ret = ioctl(fd_, MEDIA_IOC_G_TOPOLOGY, &topology);
+		if (ret < 0) {
+			ret = -errno;
+			LOG(MediaDevice, Warning)
+				<< "Failed to retrieve link state: "
+				<< strerror(-ret);
+			return ret;
+		}
+	}
+
+	for (const struct media_v2_link &mediaLink : links) {
+		MediaLink *link = dynamic_cast<MediaLink *>(object(mediaLink.id));
+		if (link)
+			link->flags_ = mediaLink.flags;
+	}
+
+	return 0;
+}
+
 /**
  * \brief Apply \a flags to a link between two pads
  * \param[in] link The link to apply flags to
@@ -781,7 +1138,7 @@ int MediaDevice::setupLink(const MediaLink *link, unsigned int flags)
 
 	linkDesc.flags = flags;
 
-	int ret = ioctl(fd_, MEDIA_IOC_SETUP_LINK, &linkDesc);
+	int ret = simulated_ ? 0 : ioctl(fd_, MEDIA_IOC_SETUP_LINK, &linkDesc);
 	if (ret) {
 		ret = -errno;
 		LOG(MediaDevice, Error)
@@ -111,17 +111,23 @@ LOG_DECLARE_CATEGORY(MediaDevice)
  * Enabling a link establishes a data connection between two pads, while
  * disabling it interrupts that connection.
  *
+ * The link is not modified if it is already in the requested state, as long as
+ * the MediaDevice link state cache is valid.
+ *
  * \return 0 on success or a negative error code otherwise
  */
 int MediaLink::setEnabled(bool enable)
 {
 	unsigned int flags = enable ? MEDIA_LNK_FL_ENABLED : 0;
 
+	if (dev_->linksCached_ && (flags_ & MEDIA_LNK_FL_ENABLED) == flags)
+		return 0;
+
 	int ret = dev_->setupLink(this, flags);
 	if (ret)
 		return ret;
 
-	flags_ = flags;
+	flags_ = (flags_ & ~MEDIA_LNK_FL_ENABLED) | flags;
 
 	return 0;
 }
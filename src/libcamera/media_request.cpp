@@ -0,0 +1,152 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * media_request.cpp - Media device request
+ */
+
+#include "media_request.h"
+
+#include <errno.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+#include <linux/media.h>
+
+#include <libcamera/event_notifier.h>
+
+#include "log.h"
+
+/**
+ * \file media_request.h
+ * \brief Media device request
+ */
+
+namespace libcamera {
+
+LOG_DECLARE_CATEGORY(MediaDevice)
+
+/**
+ * \class MediaRequest
+ * \brief A request of the V4L2 Request API
+ *
+ * The V4L2 Request API groups buffers and control values destined to the
+ * devices of a media graph in a single request, and applies them atomically
+ * when the request is processed by the drivers. This guarantees that controls
+ * apply to a precise frame, instead of the next frame processed when the
+ * control is set, which is otherwise impossible to control from userspace.
+ *
+ * A MediaRequest wraps a request file descriptor allocated by
+ * MediaDevice::allocateRequest(). Controls are added to the request with
+ * V4L2Device::setControls() and buffers with V4L2VideoDevice::queueBuffer(),
+ * passing the request in both cases. The request is then submitted with
+ * queue(), and the completed signal is emitted when the drivers have
+ * completed it. The request can then be recycled with reinit() to avoid
+ * allocating a new request for every frame.
+ *
+ * Drivers that don't support the Request API reject request allocation, in
+ * which case pipeline handlers shall fall back to applying controls and
+ * queueing buffers directly.
+ */
+
+/**
+ * \brief Construct a MediaRequest for a request file descriptor
+ * \param[in] fd The request file descriptor
+ *
+ * The MediaRequest takes ownership of \a fd, and closes it when destroyed.
+ * Instances are normally created by MediaDevice::allocateRequest().
+ */
+MediaRequest::MediaRequest(int fd)
+	: fd_(fd), queued_(false)
+{
+	notifier_ = new EventNotifier(fd_, EventNotifier::Exception);
+	notifier_->activated.connect(this, &MediaRequest::requestCompleted);
+	notifier_->setEnabled(false);
+}
+
+MediaRequest::~MediaRequest()
+{
+	delete notifier_;
+	::close(fd_);
+}
+
+/**
+ * \fn MediaRequest::fd()
+ * \brief Retrieve the request file descriptor
+ * \return The request file descriptor
+ */
+
+/**
+ * \fn MediaRequest::queued()
+ * \brief Check if the request has been queued and hasn't completed yet
+ * \return True if the request is queued, false otherwise
+ */
+
+/**
+ * \brief Queue the request to the media device
+ *
+ * Once queued, the request can't be modified until it completes. The
+ * completed signal is emitted when the request completes.
+ *
+ * \return 0 on success or a negative error code otherwise
+ * \retval -EBUSY The request is already queued
+ * \retval -ENOENT The request contains no buffer
+ */
+int MediaRequest::queue()
+{
+	if (queued_)
+		return -EBUSY;
+
+	int ret = ioctl(fd_, MEDIA_REQUEST_IOC_QUEUE);
+	if (ret < 0) {
+		ret = -errno;
+		LOG(MediaDevice, Error)
+			<< "Failed to queue request: " << strerror(-ret);
+		return ret;
+	}
+
+	queued_ = true;
+	notifier_->setEnabled(true);
+
+	return 0;
+}
+
+/**
+ * \brief Reinitialise the request for reuse
+ *
+ * Reinitialising a request clears all the buffers and controls it contains.
+ * A request can only be reinitialised when it isn't queued.
+ *
+ * \return 0 on success or a negative error code otherwise
+ */
+int MediaRequest::reinit()
+{
+	if (queued_)
+		return -EBUSY;
+
+	int ret = ioctl(fd_, MEDIA_REQUEST_IOC_REINIT);
+	if (ret < 0) {
+		ret = -errno;
+		LOG(MediaDevice, Error)
+			<< "Failed to reinitialise request: " << strerror(-ret);
+		return ret;
+	}
+
+	return 0;
+}
+
+/**
+ * \var MediaRequest::completed
+ * \brief Signal emitted when the request completes
+ */
+
+void MediaRequest::requestCompleted(EventNotifier *notifier)
+{
+	notifier_->setEnabled(false);
+	queued_ = false;
+
+	completed.emit(this);
+}
+
+} /* namespace libcamera */
@@ -49,6 +49,8 @@ std::atomic_uint Message::nextUserType_{ Message::UserMessage };
  * \brief Asynchronous method invocation across threads
  * \var Message::ThreadMoveMessage
  * \brief Object is being moved to a different thread
+ * \var Message::DeferredDelete
+ * \brief Object is scheduled for deletion
  * \var Message::UserMessage
  * \brief First value available for user-defined messages
  */
@@ -58,7 +60,8 @@ std::atomic_uint Message::nextUserType_{ Message::UserMessage };
  * \param[in] type The message type
  */
 Message::Message(Message::Type type)
-	: type_(type)
+	: type_(type), priority_(MessagePriorityNormal), receiver_(nullptr), next_(nullptr), prev_(nullptr),
+	  receiverNext_(nullptr)
 {
 }
 
@@ -78,6 +81,21 @@ Message::~Message()
  * \return The message receiver
  */
 
+/**
+ * \fn Message::priority()
+ * \brief Retrieve the message dispatch priority
+ * \return The message dispatch priority
+ */
+
+/**
+ * \fn Message::setPriority()
+ * \brief Set the message dispatch priority
+ * \param[in] priority The dispatch priority
+ *
+ * The priority shall be set before the message is posted. It defaults to
+ * MessagePriorityNormal.
+ */
+
 /**
  * \brief Reserve and register a custom user-defined message type
  *
@@ -118,7 +136,8 @@ Message::Type Message::registerMessageType()
 /**
  * \brief Construct an InvokeMessage for method invocation on an Object
  * \param[in] method The bound method
- * \param[in] pack The packed method arguments
+ * \param[in] pack The packed method arguments, or nullptr for a conflated
+ * invocation
  * \param[in] semaphore The semaphore used to signal message delivery
  * \param[in] deleteMethod True to delete the \a method when the message is
  * destroyed
@@ -127,12 +146,19 @@ InvokeMessage::InvokeMessage(BoundMethodBase *method,
 			     std::shared_ptr<BoundMethodPackBase> pack,
 			     Semaphore *semaphore, bool deleteMethod)
 	: Message(Message::InvokeMessage), method_(method), pack_(pack),
-	  semaphore_(semaphore), deleteMethod_(deleteMethod)
+	  semaphore_(semaphore), deleteMethod_(deleteMethod), invoked_(false)
 {
 }
 
 InvokeMessage::~InvokeMessage()
 {
+	/*
+	 * Drop the arguments of a conflated invocation that is discarded
+	 * without being delivered, to let the next one be queued.
+	 */
+	if (!pack_ && !invoked_)
+		std::atomic_exchange(&method_->conflatedPack_, {});
+
 	if (deleteMethod_)
 		delete method_;
 }
@@ -146,10 +172,23 @@ InvokeMessage::~InvokeMessage()
 /**
  * \brief Invoke the method bound to InvokeMessage::method_ with arguments
  * InvokeMessage::pack_
+ *
+ * Conflated invocations carry no arguments pack, the latest arguments stored
+ * in the bound method are used instead.
  */
 void InvokeMessage::invoke()
 {
-	method_->invokePack(pack_.get());
+	invoked_ = true;
+
+	if (pack_) {
+		method_->invokePack(pack_.get());
+		return;
+	}
+
+	std::shared_ptr<BoundMethodPackBase> pack =
+		std::atomic_exchange(&method_->conflatedPack_, {});
+	if (pack)
+		method_->invokePack(pack.get());
 }
 
 /**
@@ -59,7 +59,8 @@ LOG_DEFINE_CATEGORY(Object)
  * current thread if the \a parent is nullptr.
  */
 Object::Object(Object *parent)
-	: parent_(parent), pendingMessages_(0)
+	: parent_(parent), pendingMessages_(0), firstMessage_(nullptr),
+	  lastMessage_(nullptr)
 {
 	thread_ = parent ? parent->thread() : Thread::current();
 
@@ -98,6 +99,34 @@ Object::~Object()
 		child->parent_ = nullptr;
 }
 
+/**
+ * \brief Schedule deletion of the instance in the thread it belongs to
+ *
+ * This method schedules deletion of the Object when control returns to the
+ * event loop of the thread the object is bound to. This ensures the object is
+ * destroyed from the right context, as required by the libcamera threading
+ * model. It may be called from any thread.
+ *
+ * If this method is called before the thread's event loop is started or after
+ * it has stopped, the object will be deleted when the event loop (re)starts.
+ * If this never occurs, the object will be leaked.
+ *
+ * Deferred deletion can be used to control the destruction context of objects
+ * managed with shared pointers, whose last reference may be released in any
+ * thread, by using deleteLater() in a custom deleter.
+ *
+ * \code{.cpp}
+ * std::shared_ptr<MyObject> obj(new MyObject(),
+ *				 [](MyObject *o) { o->deleteLater(); });
+ * \endcode
+ *
+ * Pending messages for the object are discarded when it is deleted.
+ */
+void Object::deleteLater()
+{
+	postMessage(std::make_unique<Message>(Message::DeferredDelete));
+}
+
 /**
  * \brief Post a message to the object's thread
  * \param[in] msg The message
@@ -162,6 +191,28 @@ void Object::message(Message *msg)
  * are passed untouched. The caller shall ensure that any pointer argument
  * remains valid until the method is invoked.
  *
+ * The arguments are perfectly forwarded. Arguments passed as rvalues to
+ * parameters that \a func takes by value are moved instead of copied, both
+ * when the invocation is queued and when the method is called. Large
+ * arguments can thus be passed to a queued invocation without a deep copy with
+ * std::move().
+ *
+ * \return For connection types ConnectionTypeDirect and
+ * ConnectionTypeBlocking, return the return value of the invoked method. For
+ * connection type ConnectionTypeQueued, return a default-constructed R value.
+ */
+
+/**
+ * \fn R Object::invokeMethod(R (T::*func)(FuncArgs...), ConnectionType type, MessagePriority priority, Args &&... args)
+ * \brief Invoke a method asynchronously on an Object instance with a priority
+ * \param[in] func The object method to invoke
+ * \param[in] type Connection type for method invocation
+ * \param[in] priority Dispatch priority for queued invocations
+ * \param[in] args The method arguments
+ *
+ * This method behaves as the invokeMethod() overload without a \a priority,
+ * and additionally posts queued invocations with the given \a priority.
+ *
  * \return For connection types ConnectionTypeDirect and
  * ConnectionTypeBlocking, return the return value of the invoked method. For
  * connection type ConnectionTypeQueued, return a default-constructed R value.
@@ -6,19 +6,35 @@
  */
 
 #include <algorithm>
+#include <array>
+#include <deque>
 #include <iomanip>
+#include <limits>
+#include <map>
 #include <memory>
+#include <queue>
+#include <stdlib.h>
+#include <string.h>
 #include <vector>
 
 #include <linux/drm_fourcc.h>
 #include <linux/media-bus-format.h>
 
+#include <ipa/ipa_interface.h>
+#include <ipa/ipu3.h>
 #include <libcamera/camera.h>
+#include <libcamera/control_ids.h>
+#include <libcamera/mapped_framebuffer.h>
 #include <libcamera/request.h>
 #include <libcamera/stream.h>
 
+#include "buffer_metadata.h"
 #include "camera_sensor.h"
+#include "configuration_cache.h"
+#include "cpu_accounting.h"
+#include "delayed_controls.h"
 #include "device_enumerator.h"
+#include "ipa_manager.h"
 #include "log.h"
 #include "media_device.h"
 #include "pipeline_handler.h"
@@ -33,10 +49,15 @@ LOG_DEFINE_CATEGORY(IPU3)
 
 class IPU3CameraData;
 
+constexpr unsigned long MinPipelineDepth = 2;
+constexpr unsigned long MaxPipelineDepth = 16;
+constexpr unsigned long MaxZslDepth = 16;
+
 class ImgUDevice
 {
 public:
 	static constexpr unsigned int PAD_INPUT = 0;
+	static constexpr unsigned int PAD_PARAM = 1;
 	static constexpr unsigned int PAD_OUTPUT = 2;
 	static constexpr unsigned int PAD_VF = 3;
 	static constexpr unsigned int PAD_STAT = 4;
@@ -49,11 +70,27 @@ public:
 		std::vector<std::unique_ptr<FrameBuffer>> buffers;
 	};
 
+	/*
+	 * ImgU pipe configuration: sizes of the input feeder (IF) crop, of the
+	 * Bayer down-scaler (BDS) output and of the geometric distortion
+	 * correction (GDC) output.
+	 */
+	struct PipeConfig {
+		Size iif;
+		Size bds;
+		Size gdc;
+	};
+
+	static PipeConfig calculatePipeConfig(const Size &input,
+					      const Size &main,
+					      const Size &vf);
+
 	ImgUDevice()
-		: imgu_(nullptr), input_(nullptr)
+		: owner_(nullptr), imgu_(nullptr), input_(nullptr)
 	{
 		output_.dev = nullptr;
 		viewfinder_.dev = nullptr;
+		param_.dev = nullptr;
 		stat_.dev = nullptr;
 	}
 
@@ -63,11 +100,12 @@ public:
 		delete input_;
 		delete output_.dev;
 		delete viewfinder_.dev;
+		delete param_.dev;
 		delete stat_.dev;
 	}
 
 	int init(MediaDevice *media, unsigned int index);
-	int configureInput(const Size &size,
+	int configureInput(const PipeConfig &pipe,
 			   V4L2DeviceFormat *inputFormat);
 	int configureOutput(ImgUOutput *output,
 			    const StreamConfiguration &cfg);
@@ -86,12 +124,25 @@ public:
 	std::string name_;
 	MediaDevice *media_;
 
+	/* The camera the ImgU is assigned to, if any. */
+	IPU3CameraData *owner_;
+
 	V4L2Subdevice *imgu_;
 	V4L2VideoDevice *input_;
 	ImgUOutput output_;
 	ImgUOutput viewfinder_;
+	ImgUOutput param_;
 	ImgUOutput stat_;
-	/* \todo Add param video device for 3A tuning */
+
+	/* Parameters and statistics buffers not in use by a frame. */
+	std::queue<FrameBuffer *> availableParamBuffers_;
+	std::queue<FrameBuffer *> availableStatBuffers_;
+
+	/*
+	 * Reprocessing frames waiting to be queued to the input, along with
+	 * the CIO2 sequence of the first live frame they shall precede.
+	 */
+	std::deque<std::pair<unsigned int, FrameBuffer *>> reprocessFrames_;
 };
 
 class CIO2Device
@@ -100,7 +151,8 @@ public:
 	static constexpr unsigned int CIO2_BUFFER_COUNT = 4;
 
 	CIO2Device()
-		: output_(nullptr), csi2_(nullptr), sensor_(nullptr)
+		: output_(nullptr), csi2_(nullptr), sensor_(nullptr),
+		  requestDriven_(false)
 	{
 	}
 
@@ -115,20 +167,37 @@ public:
 	int configure(const Size &size,
 		      V4L2DeviceFormat *outputFormat);
 
-	int allocateBuffers();
+	int exportBuffers(unsigned int count, FrameBuffer::CpuAccess cpuAccess,
+			  std::vector<std::unique_ptr<FrameBuffer>> *buffers);
+	int allocateBuffers(unsigned int bufferCount,
+			    unsigned int rawBufferCount);
 	void freeBuffers();
+	const std::vector<std::unique_ptr<FrameBuffer>> &buffers() const
+	{
+		return buffers_;
+	}
+
+	int queueFrame(FrameBuffer *buffer);
+	void recycleBuffer(FrameBuffer *buffer);
 
 	int start();
 	int stop();
 
 	static int mediaBusToFormat(unsigned int code);
+	static bool isRawFormat(unsigned int fourcc);
 
 	V4L2VideoDevice *output_;
 	V4L2Subdevice *csi2_;
 	CameraSensor *sensor_;
 
 private:
+	int queuePendingFrames();
+
 	std::vector<std::unique_ptr<FrameBuffer>> buffers_;
+
+	bool requestDriven_;
+	std::queue<FrameBuffer *> availableBuffers_;
+	std::queue<FrameBuffer *> pendingFrames_;
 };
 
 class IPU3Stream : public Stream
@@ -148,19 +217,158 @@ class IPU3CameraData : public CameraData
 {
 public:
 	IPU3CameraData(PipelineHandler *pipe)
-		: CameraData(pipe)
+		: CameraData(pipe), imgu_(nullptr), secondaryImgu_(nullptr),
+		  prepared_(false), running_(false), cio2Sequence_(0),
+		  requestSequence_(0), liveSequence_(0), zslDepth_(0),
+		  frameStartEvents_(false)
 	{
 	}
 
-	void imguOutputBufferReady(FrameBuffer *buffer);
+	int loadIPA();
+	int startIPA();
+
+	void imguOutputBuffersReady(Span<FrameBuffer *> buffers);
 	void imguInputBufferReady(FrameBuffer *buffer);
+	void imguParamBufferReady(FrameBuffer *buffer);
+	void imguStatBufferReady(FrameBuffer *buffer);
 	void cio2BufferReady(FrameBuffer *buffer);
+	void rawBufferReady(FrameBuffer *buffer);
+	void holdFrame(FrameBuffer *buffer);
+	FrameBuffer *findHeldFrame(const ControlList &controls);
+	int copyHeldFrame(FrameBuffer *frame, FrameBuffer *buffer);
+	void frameStart(uint32_t sequence, uint64_t timestamp);
+
+	void queueImgUFrame(ImgUDevice *imgu, FrameBuffer *buffer);
+	void processImgUFrames(ImgUDevice *imgu);
+	void queueReadyImgUFrames(ImgUDevice *imgu);
+	void matchReprocessFrames();
+	void queueReprocessFrames(ImgUDevice *imgu, unsigned int sequence);
+	void flushImgUFrames();
+	void queueFrameAction(unsigned int frame,
+			      const IPAOperationData &action);
+
+	ImgUDevice::ImgUOutput *imguOutput(ImgUDevice *imgu,
+					   const IPU3Stream *stream)
+	{
+		return stream == &vfStream_ ? &imgu->viewfinder_ : &imgu->output_;
+	}
+
+	/*
+	 * Check if a request has processed buffers to capture, the buffers of
+	 * the streams decimated for the request frame are skipped.
+	 */
+	bool needsImgU(const Request *request) const
+	{
+		for (auto it : request->buffers()) {
+			if (it.first != &rawStream_ &&
+			    it.second->metadata().status != FrameMetadata::FrameSkipped)
+				return true;
+		}
+
+		return false;
+	}
+
+	/*
+	 * When a secondary ImgU is assigned, frames alternate between the two
+	 * ImgUs. Each ImgU processes its input and output queues in order, so
+	 * pairing CIO2 frames and requests with the same parity keeps them
+	 * matched.
+	 */
+	ImgUDevice *imguForSequence(unsigned int sequence)
+	{
+		return secondaryImgu_ && sequence % 2 ? secondaryImgu_ : imgu_;
+	}
 
 	CIO2Device cio2_;
 	ImgUDevice *imgu_;
+	ImgUDevice *secondaryImgu_;
+
+	/*
+	 * The internal buffers and the secondary ImgU are kept across stop()
+	 * and start() until the camera is reconfigured or released.
+	 */
+	bool prepared_;
+	bool running_;
+
+	Size imguInputSize_;
+	V4L2DeviceFormat imguInputFormat_;
+
+	/*
+	 * The ImgU input feeder crop, reported as the ScalerCrop. The ImgU pipe
+	 * can't be reconfigured while streaming, the requested crop is thus
+	 * ignored.
+	 *
+	 * \todo Apply the requested crop when the camera starts
+	 */
+	Rectangle scalerCrop_;
+
+	unsigned int cio2Sequence_;
+	unsigned int requestSequence_;
+
+	/*
+	 * Reprocessing requests take a slot in the requests sequence without
+	 * waiting for a CIO2 frame. Their input buffers wait, indexed by slot,
+	 * until the CIO2 frames of all the previous requests have been
+	 * matched. The live sequence is the CIO2 sequence following the last
+	 * frame matched with a request.
+	 */
+	std::map<unsigned int, FrameBuffer *> reprocessInputs_;
+	unsigned int liveSequence_;
+
+	/*
+	 * The most recent frames captured to internal buffers, oldest first,
+	 * held for zero-shutter-lag still captures to the raw stream.
+	 */
+	unsigned int zslDepth_;
+	std::deque<FrameBuffer *> heldFrames_;
+	MappedBufferCache heldMappings_;
+	std::queue<std::pair<Request *, FrameBuffer *>> zslRequests_;
 
 	IPU3Stream outStream_;
 	IPU3Stream vfStream_;
+	IPU3Stream rawStream_;
+	IPU3Stream inputStream_;
+
+	/*
+	 * Frames captured by the CIO2 and in flight through the ImgU, indexed
+	 * by the CIO2 frame sequence number. A frame waits for a parameters
+	 * and a statistics buffer, for the IPA to fill the parameters, and is
+	 * then queued to the ImgU. Without IPA frames are ready as soon as
+	 * they're captured. Frames are queued to each ImgU in capture order,
+	 * as the ImgU matches its input and output buffers by queue order,
+	 * while the parameters of the next frames are filled during the
+	 * processing of the previous ones.
+	 *
+	 * The entry is removed once the ImgU has released the input and
+	 * parameters buffers and the IPA has processed the statistics.
+	 */
+	struct IPU3Frame {
+		enum State {
+			FrameWaiting,
+			FrameFilling,
+			FrameReady,
+			FrameProcessing,
+		};
+
+		ImgUDevice *imgu;
+		FrameBuffer *input;
+		FrameBuffer *param;
+		FrameBuffer *stat;
+		State state;
+	};
+
+	void completeFrame(std::map<unsigned int, IPU3Frame>::iterator it);
+
+	std::map<unsigned int, IPU3Frame> frames_;
+	std::vector<IPABuffer> ipaBuffers_;
+	std::unique_ptr<DelayedControls> delayedCtrls_;
+	bool frameStartEvents_;
+
+	/*
+	 * Configurations are validated through a const reference to the
+	 * camera data, the cache is thus mutable.
+	 */
+	mutable ConfigurationCache configCache_;
 };
 
 class IPU3CameraConfiguration : public CameraConfiguration
@@ -176,7 +384,10 @@ public:
 private:
 	static constexpr unsigned int IPU3_BUFFER_COUNT = 4;
 
+	Status validateStreams();
 	void adjustStream(StreamConfiguration &cfg, bool scale);
+	void adjustRawStream(StreamConfiguration &cfg);
+	void updateTimings();
 
 	/*
 	 * The IPU3CameraData instance is guaranteed to be valid as long as the
@@ -200,8 +411,25 @@ public:
 		IPU3PipeModeStillCapture = 1,
 	};
 
+	/*
+	 * Frame size above which a single ImgU can't sustain the sensor frame
+	 * rate, and frames are processed alternately by two ImgUs when both
+	 * are available.
+	 *
+	 * \todo Tune the threshold based on measurements
+	 */
+	static constexpr unsigned int IMGU_SINGLE_MAX_PIXELS = 1920 * 1080;
+
+	/*
+	 * Throughput of a single ImgU in pixels per second, sustaining 30
+	 * frames per second at IMGU_SINGLE_MAX_PIXELS.
+	 */
+	static constexpr uint64_t IMGU_PIXEL_RATE = IMGU_SINGLE_MAX_PIXELS * 30ULL;
+
 	PipelineHandlerIPU3(CameraManager *manager);
 
+	int acquire(Camera *camera) override;
+
 	CameraConfiguration *generateConfiguration(Camera *camera,
 		const StreamRoles &roles) override;
 	int configure(Camera *camera, CameraConfiguration *config) override;
@@ -210,9 +438,13 @@ public:
 			       std::vector<std::unique_ptr<FrameBuffer>> *buffers) override;
 	int importFrameBuffers(Camera *camera, Stream *stream) override;
 	void freeFrameBuffers(Camera *camera, Stream *stream) override;
+	void bufferUsage(const Camera *camera,
+			 std::vector<BufferPoolUsage> *pools) override;
+	void stallReport(const Camera *camera, CameraStall *stall) override;
 
 	int start(Camera *camera) override;
-	void stop(Camera *camera) override;
+	void stopDevice(Camera *camera) override;
+	void release(Camera *camera) override;
 
 	int queueRequestDevice(Camera *camera, Request *request) override;
 
@@ -227,13 +459,40 @@ private:
 
 	int registerCameras();
 
-	int allocateBuffers(Camera *camera);
-	int freeBuffers(Camera *camera);
+	int queueZslRequest(IPU3CameraData *data, Request *request,
+			    FrameBuffer *buffer);
+	int queueReprocessRequest(IPU3CameraData *data, Request *request,
+				  FrameBuffer *input);
+	void completeZslRequests(Camera *camera);
+
+	ImgUDevice *acquireImgU(IPU3CameraData *data);
+	void releaseImgU(IPU3CameraData *data, ImgUDevice *imgu);
+	int configureImgU(IPU3CameraData *data, ImgUDevice *imgu,
+			  const StreamConfiguration &outCfg,
+			  const StreamConfiguration &vfCfg);
+
+	const ImgUDevice::PipeConfig &pipeConfig(const Size &input,
+						 const Size &main,
+						 const Size &vf);
+
+	int prepare(IPU3CameraData *data);
+	void unprepare(IPU3CameraData *data);
+
+	int allocateBuffers(IPU3CameraData *data);
+	int allocateImgUBuffers(IPU3CameraData *data, ImgUDevice *imgu,
+				unsigned int bufferCount);
+	int freeBuffers(IPU3CameraData *data);
 
 	ImgUDevice imgu0_;
 	ImgUDevice imgu1_;
 	MediaDevice *cio2MediaDev_;
 	MediaDevice *imguMediaDev_;
+
+	unsigned int pipelineDepth_;
+	unsigned int zslDepth_;
+
+	/* ImgU pipe configurations, by input, main and viewfinder sizes. */
+	std::map<std::array<unsigned int, 6>, ImgUDevice::PipeConfig> pipeConfigs_;
 };
 
 IPU3CameraConfiguration::IPU3CameraConfiguration(Camera *camera,
@@ -292,7 +551,73 @@ void IPU3CameraConfiguration::adjustStream(StreamConfiguration &cfg, bool scale)
 	cfg.bufferCount = IPU3_BUFFER_COUNT;
 }
 
+void IPU3CameraConfiguration::adjustRawStream(StreamConfiguration &cfg)
+{
+	/*
+	 * The CIO2 doesn't scale, raw frames have the sensor format. There's
+	 * no DRM fourcc for the IPU3 packed Bayer formats, use the V4L2 fourcc
+	 * of the CIO2 output.
+	 */
+	cfg.pixelFormat = CIO2Device::mediaBusToFormat(sensorFormat_.mbus_code);
+	cfg.size = sensorFormat_.size;
+	cfg.bufferCount = IPU3_BUFFER_COUNT;
+}
+
 CameraConfiguration::Status IPU3CameraConfiguration::validate()
+{
+	ConfigurationCache::Result result;
+
+	if (data_->configCache_.find(config_, &result)) {
+		sensorFormat_ = result.sensorFormat;
+		streams_.clear();
+		for (const Stream *stream : result.streams)
+			streams_.push_back(static_cast<const IPU3Stream *>(stream));
+
+		updateTimings();
+		return result.status;
+	}
+
+	const std::vector<StreamConfiguration> request = config_;
+	Status status = validateStreams();
+	if (status == Invalid)
+		return status;
+
+	result.status = status;
+	result.sensorFormat = sensorFormat_;
+	result.streams.assign(streams_.begin(), streams_.end());
+	data_->configCache_.insert(request, config_, result);
+
+	updateTimings();
+	return status;
+}
+
+/*
+ * The CIO2 captures frames at the rate of the sensor mode, and the ImgU then
+ * processes them from memory, which delays the processed streams and limits
+ * the frame rate to the ImgU throughput. Large frames are processed by two
+ * ImgUs alternately only when the second ImgU is free, the timings are thus
+ * reported for a single ImgU.
+ */
+void IPU3CameraConfiguration::updateTimings()
+{
+	const CameraSensor::Mode *mode = data_->cio2_.sensor_->mode(sensorFormat_);
+	uint64_t pixels = static_cast<uint64_t>(sensorFormat_.size.width)
+			* sensorFormat_.size.height;
+	uint64_t processing = pixels * 1000000000ULL
+			    / PipelineHandlerIPU3::IMGU_PIXEL_RATE;
+
+	minFrameDuration = std::max<uint64_t>(mode ? mode->minFrameDuration : 0,
+					      processing);
+	maxFrameDuration = mode ? std::max(mode->maxFrameDuration,
+					   minFrameDuration) : 0;
+
+	for (unsigned int i = 0; i < config_.size(); ++i)
+		config_[i].stallDuration = streams_[i] == &data_->rawStream_ ||
+					   streams_[i] == &data_->inputStream_
+					 ? 0 : processing;
+}
+
+CameraConfiguration::Status IPU3CameraConfiguration::validateStreams()
 {
 	const CameraSensor *sensor = data_->cio2_.sensor_;
 	Status status = Valid;
@@ -300,12 +625,35 @@ CameraConfiguration::Status IPU3CameraConfiguration::validate()
 	if (config_.empty())
 		return Invalid;
 
-	/* Cap the number of entries to the available streams. */
-	if (config_.size() > 2) {
-		config_.resize(2);
-		status = Adjusted;
+	/*
+	 * Cap the number of entries to the available streams, two processed
+	 * streams, one raw stream and one reprocessing input stream. Raw
+	 * frames are captured, and input frames reprocessed, alongside
+	 * processed frames only.
+	 */
+	unsigned int inputCount = 0;
+	unsigned int rawCount = 0;
+	unsigned int processedCount = 0;
+
+	for (auto it = config_.begin(); it != config_.end();) {
+		bool input = it->direction == StreamConfiguration::Input;
+		bool raw = !input && CIO2Device::isRawFormat(it->pixelFormat);
+		unsigned int &count = input ? inputCount
+				    : raw ? rawCount : processedCount;
+
+		if (count >= (input || raw ? 1U : 2U)) {
+			it = config_.erase(it);
+			status = Adjusted;
+			continue;
+		}
+
+		count++;
+		++it;
 	}
 
+	if (!processedCount)
+		return Invalid;
+
 	/*
 	 * Select the sensor format by collecting the maximum width and height
 	 * and picking the closest larger match, as the IPU3 can downscale
@@ -353,6 +701,50 @@ CameraConfiguration::Status IPU3CameraConfiguration::validate()
 		const Size size = cfg.size;
 		const IPU3Stream *stream;
 
+		/* All streams are imported to the ImgU or CIO2 as dmabufs. */
+		if (cfg.memory != FrameBuffer::MemoryDmaBuf) {
+			LOG(IPU3, Debug)
+				<< "Stream " << i << " doesn't support user pointers";
+			cfg.memory = FrameBuffer::MemoryDmaBuf;
+			status = Adjusted;
+		}
+
+		/* Only the raw stream holds frames for zero-shutter-lag. */
+		unsigned int zslFrames = cfg.direction == StreamConfiguration::Output &&
+					 CIO2Device::isRawFormat(cfg.pixelFormat)
+				       ? std::min<unsigned int>(cfg.zslFrames, MaxZslDepth)
+				       : 0;
+		if (cfg.zslFrames != zslFrames) {
+			LOG(IPU3, Debug)
+				<< "Stream " << i << " holds " << zslFrames
+				<< " frames for zero-shutter-lag";
+			cfg.zslFrames = zslFrames;
+			status = Adjusted;
+		}
+
+		/*
+		 * The ImgU reprocesses input frames in the format and size of
+		 * the frames it receives from the CIO2.
+		 */
+		if (cfg.direction == StreamConfiguration::Input ||
+		    CIO2Device::isRawFormat(cfg.pixelFormat)) {
+			if (cfg.direction == StreamConfiguration::Input)
+				stream = &data_->inputStream_;
+			else
+				stream = &data_->rawStream_;
+			adjustRawStream(cfg);
+
+			if (cfg.pixelFormat != pixelFormat || cfg.size != size) {
+				LOG(IPU3, Debug)
+					<< "Stream " << i << " configuration adjusted to "
+					<< cfg.toString();
+				status = Adjusted;
+			}
+
+			streams_.push_back(stream);
+			continue;
+		}
+
 		if (cfg.size == sensorFormat_.size)
 			stream = &data_->outStream_;
 		else
@@ -382,8 +774,51 @@ CameraConfiguration::Status IPU3CameraConfiguration::validate()
 }
 
 PipelineHandlerIPU3::PipelineHandlerIPU3(CameraManager *manager)
-	: PipelineHandler(manager), cio2MediaDev_(nullptr), imguMediaDev_(nullptr)
+	: PipelineHandler(manager), cio2MediaDev_(nullptr), imguMediaDev_(nullptr),
+	  pipelineDepth_(CIO2Device::CIO2_BUFFER_COUNT), zslDepth_(0)
+{
+	/*
+	 * The number of frames in flight between the CIO2 and the ImgU sizes
+	 * the CIO2 internal buffers pool and the ImgU parameters and
+	 * statistics pools. It can be overridden with the
+	 * LIBCAMERA_IPU3_PIPELINE_DEPTH environment variable, deeper pipelines
+	 * absorb longer IPA and ImgU processing latencies at the expense of
+	 * memory.
+	 */
+	const char *depth = utils::secure_getenv("LIBCAMERA_IPU3_PIPELINE_DEPTH");
+	if (depth) {
+		unsigned long value = strtoul(depth, nullptr, 10);
+		pipelineDepth_ = std::min(std::max(value, MinPipelineDepth),
+					  MaxPipelineDepth);
+	}
+
+	/*
+	 * Zero-shutter-lag still captures are enabled by setting the number
+	 * of recent frames to hold in StreamConfiguration::zslFrames for the
+	 * raw stream. The frames are held in additional CIO2 internal buffers.
+	 * The LIBCAMERA_IPU3_ZSL_FRAMES environment variable sets the default
+	 * value for the raw stream role.
+	 */
+	const char *zsl = utils::secure_getenv("LIBCAMERA_IPU3_ZSL_FRAMES");
+	if (zsl)
+		zslDepth_ = std::min(strtoul(zsl, nullptr, 10), MaxZslDepth);
+}
+
+int PipelineHandlerIPU3::acquire(Camera *camera)
 {
+	IPU3CameraData *data = cameraData(camera);
+	if (data->ipa_)
+		return 0;
+
+	/*
+	 * The IPA is optional, without it frames are processed by the ImgU
+	 * with its default parameters.
+	 */
+	if (data->loadIPA())
+		LOG(IPU3, Warning)
+			<< "IPA not available, 3A algorithms disabled";
+
+	return 0;
 }
 
 CameraConfiguration *PipelineHandlerIPU3::generateConfiguration(Camera *camera,
@@ -394,6 +829,8 @@ CameraConfiguration *PipelineHandlerIPU3::generateConfiguration(Camera *camera,
 	std::set<IPU3Stream *> streams = {
 		&data->outStream_,
 		&data->vfStream_,
+		&data->rawStream_,
+		&data->inputStream_,
 	};
 
 	config = new IPU3CameraConfiguration(camera, data);
@@ -466,6 +903,41 @@ CameraConfiguration *PipelineHandlerIPU3::generateConfiguration(Camera *camera,
 			break;
 		}
 
+		case StreamRole::Raw:
+		case StreamRole::Reprocessing: {
+			IPU3Stream *candidate = role == StreamRole::Raw
+					      ? &data->rawStream_
+					      : &data->inputStream_;
+			if (streams.find(candidate) == streams.end()) {
+				LOG(IPU3, Error)
+					<< "No stream available for requested role "
+					<< role;
+				break;
+			}
+
+			stream = candidate;
+			if (role == StreamRole::Reprocessing)
+				cfg.direction = StreamConfiguration::Input;
+			else
+				cfg.zslFrames = zslDepth_;
+
+			/*
+			 * Capture raw frames, and reprocess them, at the
+			 * sensor resolution.
+			 */
+			CameraSensor *sensor = data->cio2_.sensor_;
+			V4L2SubdeviceFormat sensorFormat =
+				sensor->getFormat({ MEDIA_BUS_FMT_SBGGR10_1X10,
+						    MEDIA_BUS_FMT_SGBRG10_1X10,
+						    MEDIA_BUS_FMT_SGRBG10_1X10,
+						    MEDIA_BUS_FMT_SRGGB10_1X10 },
+						  sensor->resolution());
+			cfg.pixelFormat = CIO2Device::mediaBusToFormat(sensorFormat.mbus_code);
+			cfg.size = sensorFormat.size;
+
+			break;
+		}
+
 		default:
 			LOG(IPU3, Error)
 				<< "Requested stream role not supported: " << role;
@@ -495,47 +967,52 @@ int PipelineHandlerIPU3::configure(Camera *camera, CameraConfiguration *c)
 	IPU3Stream *outStream = &data->outStream_;
 	IPU3Stream *vfStream = &data->vfStream_;
 	CIO2Device *cio2 = &data->cio2_;
-	ImgUDevice *imgu = data->imgu_;
+	ImgUDevice *imgu;
 	int ret;
 
 	/*
-	 * FIXME: enabled links in one ImgU pipe interfere with capture
-	 * operations on the other one. This can be easily triggered by
-	 * capturing from one camera and then trying to capture from the other
-	 * one right after, without disabling media links on the first used
-	 * pipe.
-	 *
-	 * The tricky part here is where to disable links on the ImgU instance
-	 * which is currently not in use:
-	 * 1) Link enable/disable cannot be done at start()/stop() time as video
-	 * devices needs to be linked first before format can be configured on
-	 * them.
-	 * 2) As link enable has to be done at the least in configure(),
-	 * before configuring formats, the only place where to disable links
-	 * would be 'stop()', but the Camera class state machine allows
-	 * start()<->stop() sequences without any configure() in between.
-	 *
-	 * As of now, disable all links in the ImgU media graph before
-	 * configuring the device, to allow alternate the usage of the two
-	 * ImgU pipes.
+	 * ImgUs are assigned to cameras dynamically. Release the ImgU assigned
+	 * by a previous configuration, if any, and acquire a free one. The
+	 * links of unused ImgUs are disabled, as enabled links in one ImgU
+	 * pipe interfere with capture operations on the other one.
 	 *
 	 * As a consequence, a Camera using an ImgU shall be configured before
-	 * any start()/stop() sequence. An application that wants to
-	 * pre-configure all the camera and then start/stop them alternatively
-	 * without going through any re-configuration (a sequence that is
-	 * allowed by the Camera state machine) would now fail on the IPU3.
+	 * any start()/stop() sequence, and configuring a camera fails when
+	 * both ImgUs are used by other cameras.
+	 *
+	 * Stopped cameras keep their secondary ImgU assigned, reclaim it if
+	 * no ImgU is free.
 	 */
-	ret = imguMediaDev_->disableLinks();
-	if (ret)
-		return ret;
+	unprepare(data);
 
-	/*
-	 * \todo: Enable links selectively based on the requested streams.
-	 * As of now, enable all links unconditionally.
-	 */
-	ret = data->imgu_->enableLinks(true);
-	if (ret)
-		return ret;
+	if (data->imgu_) {
+		releaseImgU(data, data->imgu_);
+		data->imgu_ = nullptr;
+	}
+
+	imgu = acquireImgU(data);
+	if (!imgu) {
+		for (ImgUDevice *other : { &imgu0_, &imgu1_ }) {
+			IPU3CameraData *owner = other->owner_;
+
+			if (owner && owner->secondaryImgu_ == other &&
+			    !owner->running_) {
+				unprepare(owner);
+				break;
+			}
+		}
+
+		imgu = acquireImgU(data);
+	}
+
+	if (!imgu) {
+		LOG(IPU3, Error) << "No ImgU available for " << camera->name();
+		return -EBUSY;
+	}
+
+	data->imgu_ = imgu;
+	outStream->device_ = &imgu->output_;
+	vfStream->device_ = &imgu->viewfinder_;
 
 	/*
 	 * Pass the requested stream size to the CIO2 unit and get back the
@@ -547,13 +1024,23 @@ int PipelineHandlerIPU3::configure(Camera *camera, CameraConfiguration *c)
 	if (ret)
 		return ret;
 
-	ret = imgu->configureInput(sensorSize, &cio2Format);
-	if (ret)
-		return ret;
+	data->imguInputSize_ = sensorSize;
+	data->imguInputFormat_ = cio2Format;
 
-	/* Apply the format to the configured streams output devices. */
+	/* Assign the configured streams. */
 	outStream->active_ = false;
 	vfStream->active_ = false;
+	data->rawStream_.active_ = false;
+	data->inputStream_.active_ = false;
+
+	/*
+	 * As we need to set format also on the non-active streams, use
+	 * the configuration of the active one for that purpose (there should
+	 * be at least one active processed stream in the configuration
+	 * request).
+	 */
+	const StreamConfiguration *outCfg = nullptr;
+	const StreamConfiguration *vfCfg = nullptr;
 
 	for (unsigned int i = 0; i < config->size(); ++i) {
 		/*
@@ -568,34 +1055,134 @@ int PipelineHandlerIPU3::configure(Camera *camera, CameraConfiguration *c)
 		stream->active_ = true;
 		cfg.setStream(stream);
 
-		ret = imgu->configureOutput(stream->device_, cfg);
-		if (ret)
-			return ret;
+		if (stream == outStream)
+			outCfg = &cfg;
+		else if (stream == vfStream)
+			vfCfg = &cfg;
+	}
+
+	if (!outCfg)
+		outCfg = vfCfg;
+	if (!vfCfg)
+		vfCfg = outCfg;
+
+	return configureImgU(data, imgu, *outCfg, *vfCfg);
+}
+
+/**
+ * \brief Assign a free ImgU to a camera
+ * \param[in] data The camera data
+ *
+ * Connect the ImgU buffer completion signals to the camera \a data.
+ *
+ * \return The assigned ImgU, or nullptr if both ImgUs are in use
+ */
+ImgUDevice *PipelineHandlerIPU3::acquireImgU(IPU3CameraData *data)
+{
+	for (ImgUDevice *imgu : { &imgu0_, &imgu1_ }) {
+		if (imgu->owner_)
+			continue;
+
+		imgu->owner_ = data;
+		imgu->input_->bufferReady.connect(data,
+					&IPU3CameraData::imguInputBufferReady);
+		imgu->output_.dev->buffersReady.connect(data,
+					&IPU3CameraData::imguOutputBuffersReady);
+		imgu->viewfinder_.dev->buffersReady.connect(data,
+					&IPU3CameraData::imguOutputBuffersReady);
+		imgu->param_.dev->bufferReady.connect(data,
+					&IPU3CameraData::imguParamBufferReady);
+		imgu->stat_.dev->bufferReady.connect(data,
+					&IPU3CameraData::imguStatBufferReady);
+
+		LOG(IPU3, Debug)
+			<< "Assigned " << imgu->name_ << " to sensor "
+			<< data->cio2_.sensor_->entity()->name();
+
+		return imgu;
 	}
 
+	return nullptr;
+}
+
+/**
+ * \brief Release an ImgU assigned to a camera
+ * \param[in] data The camera data
+ * \param[in] imgu The ImgU
+ *
+ * Disconnect the ImgU buffer completion signals and disable the ImgU links.
+ */
+void PipelineHandlerIPU3::releaseImgU(IPU3CameraData *data, ImgUDevice *imgu)
+{
+	imgu->input_->bufferReady.disconnect(data,
+				&IPU3CameraData::imguInputBufferReady);
+	imgu->output_.dev->buffersReady.disconnect(data,
+				&IPU3CameraData::imguOutputBuffersReady);
+	imgu->viewfinder_.dev->buffersReady.disconnect(data,
+				&IPU3CameraData::imguOutputBuffersReady);
+	imgu->param_.dev->bufferReady.disconnect(data,
+				&IPU3CameraData::imguParamBufferReady);
+	imgu->stat_.dev->bufferReady.disconnect(data,
+				&IPU3CameraData::imguStatBufferReady);
+
+	if (imgu->enableLinks(false))
+		LOG(IPU3, Warning)
+			<< "Failed to disable " << imgu->name_ << " links";
+
+	imgu->owner_ = nullptr;
+}
+
+/**
+ * \brief Configure an ImgU for the camera input and output formats
+ * \param[in] data The camera data
+ * \param[in] imgu The ImgU
+ * \param[in] outCfg The configuration of the ImgU main output
+ * \param[in] vfCfg The configuration of the ImgU viewfinder output
+ *
+ * \return 0 on success or a negative error code otherwise
+ */
+int PipelineHandlerIPU3::configureImgU(IPU3CameraData *data, ImgUDevice *imgu,
+				       const StreamConfiguration &outCfg,
+				       const StreamConfiguration &vfCfg)
+{
+	V4L2DeviceFormat inputFormat = data->imguInputFormat_;
+	int ret;
+
 	/*
-	 * As we need to set format also on the non-active streams, use
-	 * the configuration of the active one for that purpose (there should
-	 * be at least one active stream in the configuration request).
+	 * \todo: Enable links selectively based on the requested streams.
+	 * As of now, enable all links unconditionally.
 	 */
-	if (!outStream->active_) {
-		ret = imgu->configureOutput(outStream->device_, config->at(0));
-		if (ret)
-			return ret;
-	}
+	ret = imgu->enableLinks(true);
+	if (ret)
+		return ret;
 
-	if (!vfStream->active_) {
-		ret = imgu->configureOutput(vfStream->device_, config->at(0));
-		if (ret)
-			return ret;
-	}
+	const ImgUDevice::PipeConfig &pipe =
+		pipeConfig(data->imguInputSize_, outCfg.size, vfCfg.size);
+	ret = imgu->configureInput(pipe, &inputFormat);
+	if (ret)
+		return ret;
+
+	data->scalerCrop_ = { 0, 0, pipe.iif.width, pipe.iif.height };
+
+	/* Apply the format to the output devices. */
+	ret = imgu->configureOutput(&imgu->output_, outCfg);
+	if (ret)
+		return ret;
+
+	ret = imgu->configureOutput(&imgu->viewfinder_, vfCfg);
+	if (ret)
+		return ret;
 
 	/*
 	 * Apply the largest available format to the stat node.
 	 * \todo Revise this when we'll actually use the stat node.
 	 */
 	StreamConfiguration statCfg = {};
-	statCfg.size = cio2Format.size;
+	statCfg.size = inputFormat.size;
+
+	ret = imgu->configureOutput(&imgu->param_, statCfg);
+	if (ret)
+		return ret;
 
 	ret = imgu->configureOutput(&imgu->stat_, statCfg);
 	if (ret)
@@ -604,7 +1191,7 @@ int PipelineHandlerIPU3::configure(Camera *camera, CameraConfiguration *c)
 	/* Apply the "pipe_mode" control to the ImgU subdevice. */
 	ControlList ctrls(imgu->imgu_->controls());
 	ctrls.set(V4L2_CID_IPU3_PIPE_MODE,
-		  static_cast<int32_t>(vfStream->active_ ? IPU3PipeModeVideo :
+		  static_cast<int32_t>(data->vfStream_.active_ ? IPU3PipeModeVideo :
 				       IPU3PipeModeStillCapture));
 	ret = imgu->imgu_->setControls(&ctrls);
 	if (ret) {
@@ -618,116 +1205,390 @@ int PipelineHandlerIPU3::configure(Camera *camera, CameraConfiguration *c)
 int PipelineHandlerIPU3::exportFrameBuffers(Camera *camera, Stream *stream,
 					    std::vector<std::unique_ptr<FrameBuffer>> *buffers)
 {
+	IPU3CameraData *data = cameraData(camera);
 	IPU3Stream *ipu3stream = static_cast<IPU3Stream *>(stream);
-	V4L2VideoDevice *video = ipu3stream->device_->dev;
 	unsigned int count = stream->configuration().bufferCount;
 
+	if (ipu3stream == &data->rawStream_ || ipu3stream == &data->inputStream_)
+		return data->cio2_.exportBuffers(count, stream->cpuAccess(),
+						 buffers);
+
+	V4L2VideoDevice *video = ipu3stream->device_->dev;
+
+	video->setCpuAccess(stream->cpuAccess());
 	return video->exportBuffers(count, buffers);
 }
 
 int PipelineHandlerIPU3::importFrameBuffers(Camera *camera, Stream *stream)
 {
+	IPU3CameraData *data = cameraData(camera);
 	IPU3Stream *ipu3stream = static_cast<IPU3Stream *>(stream);
-	V4L2VideoDevice *video = ipu3stream->device_->dev;
 	unsigned int count = stream->configuration().bufferCount;
 
+	/*
+	 * Raw buffers are imported along with the CIO2 internal buffers, and
+	 * input buffers along with the ImgU input buffers.
+	 */
+	if (ipu3stream == &data->rawStream_ || ipu3stream == &data->inputStream_)
+		return 0;
+
+	V4L2VideoDevice *video = ipu3stream->device_->dev;
+
 	return video->importBuffers(count);
 }
 
 void PipelineHandlerIPU3::freeFrameBuffers(Camera *camera, Stream *stream)
 {
+	IPU3CameraData *data = cameraData(camera);
 	IPU3Stream *ipu3stream = static_cast<IPU3Stream *>(stream);
+
+	/* Raw and input buffers are released along with the internal buffers. */
+	if (ipu3stream == &data->rawStream_ || ipu3stream == &data->inputStream_)
+		return;
+
 	V4L2VideoDevice *video = ipu3stream->device_->dev;
 
 	video->releaseBuffers();
 }
 
-/**
- * \todo Clarify if 'viewfinder' and 'stat' nodes have to be set up and
- * started even if not in use. As of now, if not properly configured and
- * enabled, the ImgU processing pipeline stalls.
- *
- * In order to be able to start the 'viewfinder' and 'stat' nodes, we need
- * memory to be reserved.
- */
-int PipelineHandlerIPU3::allocateBuffers(Camera *camera)
+void PipelineHandlerIPU3::bufferUsage(const Camera *camera,
+				      std::vector<BufferPoolUsage> *pools)
 {
 	IPU3CameraData *data = cameraData(camera);
-	IPU3Stream *outStream = &data->outStream_;
-	IPU3Stream *vfStream = &data->vfStream_;
+
+	if (!data->cio2_.buffers().empty()) {
+		BufferPoolUsage usage(BufferPoolUsage::Internal, nullptr, "cio2");
+		usage.add(data->cio2_.buffers());
+		pools->push_back(usage);
+	}
+
+	for (ImgUDevice *imgu : { data->imgu_, data->secondaryImgu_ }) {
+		if (!imgu)
+			continue;
+
+		for (ImgUDevice::ImgUOutput *output :
+		     { &imgu->output_, &imgu->viewfinder_, &imgu->param_,
+		       &imgu->stat_ }) {
+			if (output->buffers.empty())
+				continue;
+
+			BufferPoolUsage usage(BufferPoolUsage::Internal, nullptr,
+					      imgu->name_ + " " + output->name);
+			usage.add(output->buffers);
+			pools->push_back(usage);
+		}
+	}
+}
+
+void PipelineHandlerIPU3::stallReport(const Camera *camera, CameraStall *stall)
+{
+	IPU3CameraData *data = cameraData(camera);
+
+	stall->devices.push_back({ data->cio2_.output_->deviceNode(),
+				   data->cio2_.output_->queuedBuffers() });
+
+	for (ImgUDevice *imgu : { data->imgu_, data->secondaryImgu_ }) {
+		if (!imgu)
+			continue;
+
+		stall->devices.push_back({ imgu->input_->deviceNode(),
+					   imgu->input_->queuedBuffers() });
+
+		for (ImgUDevice::ImgUOutput *output :
+		     { &imgu->output_, &imgu->viewfinder_, &imgu->param_,
+		       &imgu->stat_ })
+			stall->devices.push_back({ output->dev->deviceNode(),
+						   output->dev->queuedBuffers() });
+	}
+}
+
+/**
+ * \todo Clarify if 'viewfinder' and 'stat' nodes have to be set up and
+ * started even if not in use. As of now, if not properly configured and
+ * enabled, the ImgU processing pipeline stalls.
+ *
+ * In order to be able to start the 'viewfinder' and 'stat' nodes, buffers
+ * need to be requested on them.
+ */
+int PipelineHandlerIPU3::allocateBuffers(IPU3CameraData *data)
+{
 	CIO2Device *cio2 = &data->cio2_;
-	ImgUDevice *imgu = data->imgu_;
+	ImgUDevice *secondary = data->secondaryImgu_;
 	unsigned int bufferCount;
 	int ret;
 
-	/* Share buffers between CIO2 output and ImgU input. */
-	ret = cio2->allocateBuffers();
+	/*
+	 * Share buffers between CIO2 output and ImgU input. The application
+	 * raw buffers are captured by the CIO2 and processed by the ImgU too.
+	 */
+	unsigned int rawBufferCount = data->rawStream_.active_
+				    ? data->rawStream_.configuration().bufferCount
+				    : 0;
+
+	/*
+	 * Held frames can only be delivered to the raw stream, hold frames
+	 * only when it is configured.
+	 */
+	data->zslDepth_ = rawBufferCount
+			? data->rawStream_.configuration().zslFrames : 0;
+
+	ret = cio2->allocateBuffers(pipelineDepth_ + data->zslDepth_,
+				    rawBufferCount);
 	if (ret < 0)
 		return ret;
 
 	bufferCount = ret;
 
-	ret = imgu->input_->importBuffers(bufferCount);
+	ret = allocateImgUBuffers(data, data->imgu_, bufferCount);
+	if (ret)
+		goto error;
+
+	if (!secondary)
+		goto done;
+
+	ret = allocateImgUBuffers(data, secondary, bufferCount);
+	if (ret)
+		goto error;
+
+	/* The secondary ImgU outputs to the application buffers too. */
+	for (IPU3Stream *stream : { &data->outStream_, &data->vfStream_ }) {
+		if (!stream->active_)
+			continue;
+
+		ImgUDevice::ImgUOutput *output = data->imguOutput(secondary, stream);
+		ret = output->dev->importBuffers(stream->configuration().bufferCount);
+		if (ret) {
+			LOG(IPU3, Error) << "Failed to import " << secondary->name_
+					 << " " << output->name << " buffers";
+			goto error;
+		}
+	}
+
+done:
+	if (data->ipa_)
+		data->ipa_->mapBuffers(data->ipaBuffers_);
+
+	return 0;
+
+error:
+	freeBuffers(data);
+
+	return ret;
+}
+
+int PipelineHandlerIPU3::allocateImgUBuffers(IPU3CameraData *data,
+					     ImgUDevice *imgu,
+					     unsigned int bufferCount)
+{
+	unsigned int inputCount = bufferCount;
+	int ret;
+
+	/* The application reprocessing buffers are queued to the input too. */
+	if (data->inputStream_.active_)
+		inputCount += data->inputStream_.configuration().bufferCount;
+
+	ret = imgu->input_->importBuffers(inputCount);
 	if (ret) {
 		LOG(IPU3, Error) << "Failed to import ImgU input buffers";
-		goto error;
+		return ret;
 	}
 
 	/*
-	 * Use for the stat's internal pool the same number of buffers as for
-	 * the input pool.
-	 * \todo To be revised when we'll actually use the stat node.
+	 * Use for the parameters and stat internal pools the same number of
+	 * buffers as for the input pool, and share them with the IPA.
 	 */
+	ret = imgu->param_.dev->exportBuffers(bufferCount, &imgu->param_.buffers);
+	if (ret < 0) {
+		LOG(IPU3, Error) << "Failed to allocate ImgU parameters buffers";
+		return ret;
+	}
+
 	ret = imgu->stat_.dev->exportBuffers(bufferCount, &imgu->stat_.buffers);
 	if (ret < 0) {
 		LOG(IPU3, Error) << "Failed to allocate ImgU stat buffers";
-		goto error;
+		return ret;
+	}
+
+	for (ImgUDevice::ImgUOutput *output : { &imgu->param_, &imgu->stat_ }) {
+		for (std::unique_ptr<FrameBuffer> &buffer : output->buffers) {
+			buffer->setCookie(data->ipaBuffers_.size());
+			Span<const FrameBuffer::Plane> planes = buffer->planes();
+			data->ipaBuffers_.push_back({ .id = buffer->cookie(),
+						      .planes = { planes.begin(), planes.end() } });
+		}
 	}
 
 	/*
-	 * Allocate buffers also on non-active outputs; use the same number
-	 * of buffers as the active ones.
+	 * Request buffers on the non-active outputs too, for the nodes to be
+	 * started. No buffer is ever queued to them, the ImgU driver writes
+	 * the frames of outputs without a queued buffer to an internal dummy
+	 * buffer, so importing avoids allocating memory that would never be
+	 * used. The same applies per frame to the active outputs for which
+	 * the request carries no buffer.
 	 */
-	if (!outStream->active_) {
-		ImgUDevice::ImgUOutput *output = outStream->device_;
+	for (IPU3Stream *stream : { &data->outStream_, &data->vfStream_ }) {
+		if (stream->active_)
+			continue;
+
+		ImgUDevice::ImgUOutput *output = data->imguOutput(imgu, stream);
 
-		ret = output->dev->exportBuffers(bufferCount, &output->buffers);
-		if (ret < 0) {
-			LOG(IPU3, Error) << "Failed to allocate ImgU "
+		ret = output->dev->importBuffers(bufferCount);
+		if (ret) {
+			LOG(IPU3, Error) << "Failed to import ImgU "
 					 << output->name << " buffers";
-			goto error;
+			return ret;
 		}
 	}
 
-	if (!vfStream->active_) {
-		ImgUDevice::ImgUOutput *output = vfStream->device_;
+	return 0;
+}
+
+int PipelineHandlerIPU3::freeBuffers(IPU3CameraData *data)
+{
+	ImgUDevice *secondary = data->secondaryImgu_;
+
+	if (data->ipa_ && !data->ipaBuffers_.empty()) {
+		std::vector<unsigned int> ids;
+		for (const IPABuffer &ipabuf : data->ipaBuffers_)
+			ids.push_back(ipabuf.id);
+
+		data->ipa_->unmapBuffers(ids);
+	}
+	data->ipaBuffers_.clear();
+
+	data->heldMappings_.clear();
+	data->cio2_.freeBuffers();
+	data->imgu_->freeBuffers(data);
+
+	if (secondary) {
+		secondary->freeBuffers(data);
 
-		ret = output->dev->exportBuffers(bufferCount, &output->buffers);
-		if (ret < 0) {
-			LOG(IPU3, Error) << "Failed to allocate ImgU "
-					 << output->name << " buffers";
-			goto error;
+		for (IPU3Stream *stream : { &data->outStream_, &data->vfStream_ }) {
+			if (stream->active_)
+				data->imguOutput(secondary, stream)->dev->releaseBuffers();
 		}
 	}
 
 	return 0;
+}
 
-error:
-	freeBuffers(camera);
+/**
+ * \brief Retrieve the ImgU pipe configuration for a set of sizes
+ * \param[in] input The ImgU input size
+ * \param[in] main The ImgU main output size
+ * \param[in] vf The ImgU viewfinder output size
+ *
+ * The pipe configuration is calculated the first time it is needed, and
+ * cached for the lifetime of the pipeline handler.
+ *
+ * \return The ImgU pipe configuration
+ */
+const ImgUDevice::PipeConfig &
+PipelineHandlerIPU3::pipeConfig(const Size &input, const Size &main,
+				const Size &vf)
+{
+	std::array<unsigned int, 6> key = {
+		input.width, input.height, main.width, main.height,
+		vf.width, vf.height,
+	};
 
-	return ret;
+	auto it = pipeConfigs_.find(key);
+	if (it != pipeConfigs_.end())
+		return it->second;
+
+	ImgUDevice::PipeConfig pipe =
+		ImgUDevice::calculatePipeConfig(input, main, vf);
+
+	LOG(IPU3, Debug)
+		<< "ImgU pipe configuration for " << input.toString()
+		<< " -> " << main.toString() << ", " << vf.toString()
+		<< ": IF " << pipe.iif.toString()
+		<< ", BDS " << pipe.bds.toString()
+		<< ", GDC " << pipe.gdc.toString();
+
+	return pipeConfigs_.emplace(key, pipe).first->second;
 }
 
-int PipelineHandlerIPU3::freeBuffers(Camera *camera)
+/**
+ * \brief Prepare the pipeline for capture with the current configuration
+ * \param[in] data The camera data
+ *
+ * Assign a secondary ImgU if needed and available, and allocate the internal
+ * buffers. The resources are kept when the camera is stopped, for the next
+ * start() to skip this step, until they're released by unprepare().
+ *
+ * \return 0 on success or a negative error code otherwise
+ */
+int PipelineHandlerIPU3::prepare(IPU3CameraData *data)
 {
-	IPU3CameraData *data = cameraData(camera);
+	const Size &size = data->imguInputSize_;
+	int ret;
 
-	data->cio2_.freeBuffers();
-	data->imgu_->freeBuffers(data);
+	/*
+	 * Process frames alternately on the two ImgUs for large frame sizes,
+	 * if the other ImgU isn't assigned to another camera. The outputs of
+	 * the secondary ImgU mirror the configuration of the primary one.
+	 */
+	data->secondaryImgu_ = nullptr;
+	if (size.width * size.height > IMGU_SINGLE_MAX_PIXELS) {
+		ImgUDevice *secondary = acquireImgU(data);
+		if (secondary) {
+			IPU3Stream *outStream = &data->outStream_;
+			IPU3Stream *vfStream = &data->vfStream_;
+			const StreamConfiguration &outCfg = outStream->active_
+							  ? outStream->configuration()
+							  : vfStream->configuration();
+			const StreamConfiguration &vfCfg = vfStream->active_
+							 ? vfStream->configuration()
+							 : outStream->configuration();
+
+			ret = configureImgU(data, secondary, outCfg, vfCfg);
+			if (ret) {
+				LOG(IPU3, Warning)
+					<< "Failed to configure " << secondary->name_
+					<< ", using a single ImgU";
+				releaseImgU(data, secondary);
+			} else {
+				data->secondaryImgu_ = secondary;
+			}
+		}
+	}
+
+	/* Allocate buffers for internal pipeline usage. */
+	ret = allocateBuffers(data);
+	if (ret) {
+		if (data->secondaryImgu_) {
+			releaseImgU(data, data->secondaryImgu_);
+			data->secondaryImgu_ = nullptr;
+		}
+
+		return ret;
+	}
+
+	data->prepared_ = true;
 
 	return 0;
 }
 
+/**
+ * \brief Release the resources allocated by prepare()
+ * \param[in] data The camera data
+ */
+void PipelineHandlerIPU3::unprepare(IPU3CameraData *data)
+{
+	if (!data->prepared_)
+		return;
+
+	freeBuffers(data);
+
+	if (data->secondaryImgu_) {
+		releaseImgU(data, data->secondaryImgu_);
+		data->secondaryImgu_ = nullptr;
+	}
+
+	data->prepared_ = false;
+}
+
 int PipelineHandlerIPU3::start(Camera *camera)
 {
 	IPU3CameraData *data = cameraData(camera);
@@ -735,10 +1596,24 @@ int PipelineHandlerIPU3::start(Camera *camera)
 	ImgUDevice *imgu = data->imgu_;
 	int ret;
 
-	/* Allocate buffers for internal pipeline usage. */
-	ret = allocateBuffers(camera);
-	if (ret)
-		return ret;
+	if (!data->prepared_) {
+		ret = prepare(data);
+		if (ret) {
+			LOG(IPU3, Error)
+				<< "Failed to start camera " << camera->name();
+			return ret;
+		}
+	}
+
+	data->cio2Sequence_ = 0;
+	data->requestSequence_ = 0;
+	data->liveSequence_ = 0;
+
+	if (data->ipa_) {
+		ret = data->startIPA();
+		if (ret)
+			goto error;
+	}
 
 	/*
 	 * Start the ImgU video devices, buffers will be queued to the
@@ -755,38 +1630,118 @@ int PipelineHandlerIPU3::start(Camera *camera)
 		goto error;
 	}
 
+	if (data->secondaryImgu_) {
+		ret = data->secondaryImgu_->start();
+		if (ret) {
+			data->secondaryImgu_->stop();
+			imgu->stop();
+			cio2->stop();
+			goto error;
+		}
+	}
+
+	data->running_ = true;
+
 	return 0;
 
 error:
-	freeBuffers(camera);
+	unprepare(data);
+
 	LOG(IPU3, Error) << "Failed to start camera " << camera->name();
 
 	return ret;
 }
 
-void PipelineHandlerIPU3::stop(Camera *camera)
+void PipelineHandlerIPU3::stopDevice(Camera *camera)
 {
 	IPU3CameraData *data = cameraData(camera);
 	int ret;
 
 	ret = data->cio2_.stop();
+
+	/*
+	 * Hand the frames still waiting for their parameters to the ImgU, for
+	 * their input buffers to be cancelled when it stops.
+	 */
+	data->flushImgUFrames();
+
 	ret |= data->imgu_->stop();
+	if (data->secondaryImgu_)
+		ret |= data->secondaryImgu_->stop();
 	if (ret)
 		LOG(IPU3, Warning) << "Failed to stop camera "
 				   << camera->name();
 
-	freeBuffers(camera);
+	if (data->ipa_)
+		data->cio2_.csi2_->setFrameStartEnabled(false);
+	data->frames_.clear();
+
+	data->running_ = false;
+
+	/* The CIO2 reclaims all internal buffers when started again. */
+	data->heldFrames_.clear();
+	completeZslRequests(camera);
+}
+
+void PipelineHandlerIPU3::release(Camera *camera)
+{
+	unprepare(cameraData(camera));
 }
 
 int PipelineHandlerIPU3::queueRequestDevice(Camera *camera, Request *request)
 {
+	IPU3CameraData *data = cameraData(camera);
+	FrameBuffer *rawBuffer = request->findBuffer(&data->rawStream_);
+	ImgUDevice *imgu = nullptr;
 	int error = 0;
 
+	if (request->controls().contains(controls::ZslFrameSequence) ||
+	    request->controls().contains(controls::ZslFrameTimestamp))
+		return queueZslRequest(data, request, rawBuffer);
+
+	FrameBuffer *inputBuffer = request->findBuffer(&data->inputStream_);
+	if (inputBuffer)
+		return queueReprocessRequest(data, request, inputBuffer);
+
+	/*
+	 * The CIO2 captures to an internal buffer when the raw buffer is
+	 * skipped.
+	 */
+	if (rawBuffer && rawBuffer->metadata().status == FrameMetadata::FrameSkipped)
+		rawBuffer = nullptr;
+
+	/* Requests with a raw buffer only don't go through the ImgU. */
+	if (data->needsImgU(request)) {
+		imgu = data->imguForSequence(data->requestSequence_++);
+		if (request->metadataEnabled(controls::ScalerCrop))
+			request->metadata().set(controls::ScalerCrop, data->scalerCrop_);
+	}
+
 	for (auto it : request->buffers()) {
 		IPU3Stream *stream = static_cast<IPU3Stream *>(it.first);
 		FrameBuffer *buffer = it.second;
 
-		int ret = stream->device_->dev->queueBuffer(buffer);
+		/*
+		 * The ImgU writes the frames of outputs without a queued
+		 * buffer to its internal dummy buffer, skipped buffers are
+		 * simply not queued.
+		 */
+		if (stream == &data->rawStream_ ||
+		    buffer->metadata().status == FrameMetadata::FrameSkipped)
+			continue;
+
+		int ret = data->imguOutput(imgu, stream)->dev->queueBuffer(buffer);
+		if (ret < 0)
+			error = ret;
+	}
+
+	/*
+	 * When a raw stream is configured, the CIO2 captures one frame per
+	 * request, in the request raw buffer or in an internal buffer, to
+	 * keep the raw and processed frames of a request matched.
+	 */
+	if (data->rawStream_.active_) {
+		int ret = data->cio2_.queueFrame(rawBuffer);
 		if (ret < 0)
 			error = ret;
 	}
@@ -794,6 +1749,119 @@ int PipelineHandlerIPU3::queueRequestDevice(Camera *camera, Request *request)
 	return error;
 }
 
+/*
+ * Zero-shutter-lag requests are filled from a held frame instead of a new
+ * capture. They don't use the CIO2 nor the ImgU. The held frame is copied to
+ * the application buffer, as the CIO2 internal buffers are recycled and can't
+ * be handed to the application. The copy is deferred to the asynchronous
+ * completion of the request to keep it out of Camera::queueRequest(), and the
+ * held frame is removed from the held frames until then to prevent the CIO2
+ * from overwriting it. It is performed once per still capture, in the
+ * pipeline handler thread.
+ *
+ * \todo Reprocess the held frame through the ImgU for the processed streams
+ */
+int PipelineHandlerIPU3::queueZslRequest(IPU3CameraData *data, Request *request,
+					 FrameBuffer *buffer)
+{
+	if (!buffer || request->buffers().size() != 1) {
+		LOG(IPU3, Error)
+			<< "Zero-shutter-lag requests shall only capture the raw stream";
+		return -EINVAL;
+	}
+
+	FrameBuffer *frame = data->findHeldFrame(request->controls());
+	if (!frame) {
+		LOG(IPU3, Error) << "No held frame matches the request";
+		return -ENOENT;
+	}
+
+	data->heldFrames_.erase(std::find(data->heldFrames_.begin(),
+					  data->heldFrames_.end(), frame));
+
+	data->zslRequests_.emplace(request, frame);
+	if (data->zslRequests_.size() == 1)
+		invokeMethod(&PipelineHandlerIPU3::completeZslRequests,
+			     ConnectionTypeQueued, MessagePriorityRealtime,
+			     data->camera_);
+
+	return 0;
+}
+
+void PipelineHandlerIPU3::completeZslRequests(Camera *camera)
+{
+	IPU3CameraData *data = cameraData(camera);
+
+	while (!data->zslRequests_.empty()) {
+		Request *request = data->zslRequests_.front().first;
+		FrameBuffer *frame = data->zslRequests_.front().second;
+		data->zslRequests_.pop();
+
+		FrameBuffer *buffer = request->findBuffer(&data->rawStream_);
+		if (data->copyHeldFrame(frame, buffer)) {
+			FrameMetadata metadata = frame->metadata();
+			metadata.status = FrameMetadata::FrameError;
+			BufferMetadata::copy(buffer, metadata);
+		}
+
+		/* The CIO2 reclaims all internal buffers when started. */
+		if (data->running_)
+			data->cio2_.recycleBuffer(frame);
+
+		if (completeBuffer(camera, request, buffer))
+			completeRequest(camera, request);
+	}
+}
+
+/*
+ * Reprocessing requests feed a raw frame from the application to the ImgU in
+ * place of a CIO2 capture. They take a slot in the sequence of requests
+ * processed by the ImgUs, and their frame is queued to the ImgU input between
+ * the live frames of the previous and next requests, to keep the ImgU input
+ * and output queues matched without holding the live frames back.
+ */
+int PipelineHandlerIPU3::queueReprocessRequest(IPU3CameraData *data,
+					       Request *request,
+					       FrameBuffer *input)
+{
+	if (request->findBuffer(&data->rawStream_)) {
+		LOG(IPU3, Error)
+			<< "Reprocessing requests can't capture the raw stream";
+		return -EINVAL;
+	}
+
+	if (request->buffers().size() == 1) {
+		LOG(IPU3, Error)
+			<< "Reprocessing requests need a processed stream";
+		return -EINVAL;
+	}
+
+	unsigned int slot = data->requestSequence_++;
+	ImgUDevice *imgu = data->imguForSequence(slot);
+	int error = 0;
+
+	if (request->metadataEnabled(controls::ScalerCrop))
+		request->metadata().set(controls::ScalerCrop, data->scalerCrop_);
+
+	for (auto it : request->buffers()) {
+		IPU3Stream *stream = static_cast<IPU3Stream *>(it.first);
+		FrameBuffer *buffer = it.second;
+
+		if (stream == &data->inputStream_ ||
+		    buffer->metadata().status == FrameMetadata::FrameSkipped)
+			continue;
+
+		int ret = data->imguOutput(imgu, stream)->dev->queueBuffer(buffer);
+		if (ret < 0)
+			error = ret;
+	}
+
+	data->reprocessInputs_[slot] = input;
+	data->matchReprocessFrames();
+
+	return error;
+}
+
 bool PipelineHandlerIPU3::match(DeviceEnumerator *enumerator)
 {
 	int ret;
@@ -847,147 +1915,700 @@ bool PipelineHandlerIPU3::match(DeviceEnumerator *enumerator)
 }
 
 /**
- * \brief Initialise ImgU and CIO2 devices associated with cameras
- *
- * Initialise the two ImgU instances and create cameras with an associated
- * CIO2 device instance.
+ * \brief Initialise ImgU and CIO2 devices associated with cameras
+ *
+ * Initialise the two ImgU instances and create cameras with an associated
+ * CIO2 device instance.
+ *
+ * \return 0 on success or a negative error code for error or if no camera
+ * has been created
+ * \retval -ENODEV no camera has been created
+ */
+int PipelineHandlerIPU3::registerCameras()
+{
+	int ret;
+
+	ret = imgu0_.init(imguMediaDev_, 0);
+	if (ret)
+		return ret;
+
+	ret = imgu1_.init(imguMediaDev_, 1);
+	if (ret)
+		return ret;
+
+	/*
+	 * For each CSI-2 receiver on the IPU3, create a Camera if an
+	 * image sensor is connected to it and the sensor can produce images
+	 * in a compatible format.
+	 */
+	unsigned int numCameras = 0;
+	for (unsigned int id = 0; id < 4 && numCameras < 2; ++id) {
+		std::unique_ptr<IPU3CameraData> data =
+			std::make_unique<IPU3CameraData>(this);
+		std::set<Stream *> streams = {
+			&data->outStream_,
+			&data->vfStream_,
+			&data->rawStream_,
+			&data->inputStream_,
+		};
+		CIO2Device *cio2 = &data->cio2_;
+
+		ret = cio2->init(cio2MediaDev_, id);
+		if (ret)
+			continue;
+
+		/*
+		 * ImgUs are assigned to cameras at configure time. Limit
+		 * support to two cameras, one for each ImgU.
+		 */
+		data->outStream_.name_ = "output";
+		data->vfStream_.name_ = "viewfinder";
+		data->rawStream_.name_ = "raw";
+		data->inputStream_.name_ = "input";
+
+		/*
+		 * Connect video devices' 'bufferReady' signals to their
+		 * slot to implement the image processing pipeline. The ImgU
+		 * outputs use the 'buffersReady' signal to complete all the
+		 * buffers dequeued in one go.
+		 *
+		 * Frames produced by the CIO2 unit are passed to the
+		 * associated ImgU input where they get processed and
+		 * returned through the ImgU main and secondary outputs. The
+		 * ImgU signals are connected when the ImgU is assigned.
+		 */
+		data->cio2_.output_->bufferReady.connect(data.get(),
+					&IPU3CameraData::cio2BufferReady);
+		data->cio2_.csi2_->frameStart.connect(data.get(),
+					&IPU3CameraData::frameStart);
+
+		ControlInfoMap::Map controls(data->controlInfo_.begin(),
+					     data->controlInfo_.end());
+		const Size &resolution = cio2->sensor_->resolution();
+		controls.emplace(std::piecewise_construct,
+				 std::forward_as_tuple(&controls::ScalerCrop),
+				 std::forward_as_tuple(Rectangle{ 0, 0, 0, 0 },
+						       Rectangle{ 0, 0, resolution.width,
+								  resolution.height }));
+
+		/*
+		 * Zero-shutter-lag captures are enabled by the configuration
+		 * of the raw stream, the controls are always supported.
+		 */
+		controls.emplace(std::piecewise_construct,
+				 std::forward_as_tuple(&controls::ZslFrameSequence),
+				 std::forward_as_tuple(0, std::numeric_limits<int32_t>::max()));
+		controls.emplace(std::piecewise_construct,
+				 std::forward_as_tuple(&controls::ZslFrameTimestamp),
+				 std::forward_as_tuple(static_cast<int64_t>(0),
+						       std::numeric_limits<int64_t>::max()));
+
+		data->controlInfo_ = std::move(controls);
+
+		/* Create and register the Camera instance. */
+		std::string cameraName = cio2->sensor_->entity()->name() + " "
+				       + std::to_string(id);
+		std::shared_ptr<Camera> camera = Camera::create(this,
+								cameraName,
+								streams);
+
+		registerCamera(std::move(camera), std::move(data));
+
+		LOG(IPU3, Info)
+			<< "Registered Camera[" << numCameras << "] \""
+			<< cameraName << "\""
+			<< " connected to CSI-2 receiver " << id;
+
+		numCameras++;
+	}
+
+	return numCameras ? 0 : -ENODEV;
+}
+
+/* -----------------------------------------------------------------------------
+ * Buffer Ready slots
+ */
+
+/**
+ * \brief Handle buffers completion at the ImgU input
+ * \param[in] buffer The completed buffer
+ *
+ * Internal buffers completed from the ImgU input are immediately returned to
+ * the CIO2 unit to continue frame capture. Raw buffers are handed over to the
+ * application, which returns them to the CIO2 by queueing them in a new
+ * request.
+ */
+void IPU3CameraData::imguInputBufferReady(FrameBuffer *buffer)
+{
+	for (auto it = frames_.begin(); it != frames_.end(); ++it) {
+		if (it->second.input != buffer)
+			continue;
+
+		it->second.input = nullptr;
+		completeFrame(it);
+		break;
+	}
+
+	if (buffer->request()) {
+		rawBufferReady(buffer);
+		return;
+	}
+
+	/* \todo Handle buffer failures when state is set to BufferError. */
+	if (buffer->metadata().status == FrameMetadata::FrameCancelled)
+		return;
+
+	holdFrame(buffer);
+}
+
+/**
+ * \brief Handle buffers completion at the ImgU output
+ * \param[in] buffers The buffers completed in one batch
+ *
+ * Buffers completed from the ImgU output are directed to the application.
+ */
+void IPU3CameraData::imguOutputBuffersReady(Span<FrameBuffer *> buffers)
+{
+	for (FrameBuffer *buffer : buffers) {
+		Request *request = buffer->request();
+
+		if (!pipe_->completeBuffer(camera_, request, buffer))
+			/* Request not completed yet, continue. */
+			continue;
+
+		/* Mark the request as complete. */
+		pipe_->completeRequest(camera_, request);
+	}
+}
+
+/**
+ * \brief Handle buffers completion at the CIO2 output
+ * \param[in] buffer The completed buffer
+ *
+ * Buffers completed from the CIO2 are immediately queued to the ImgU unit
+ * for further processing. Raw buffers of requests without processed streams
+ * are directed to the application.
+ *
+ * Frames captured while no request waits for an ImgU output are returned to
+ * the CIO2 without being processed, as the ImgU would only write them to its
+ * internal dummy buffers.
+ */
+void IPU3CameraData::cio2BufferReady(FrameBuffer *buffer)
+{
+	Request *request = buffer->request();
+
+	/* \todo Handle buffer failures when state is set to BufferError. */
+	if (buffer->metadata().status == FrameMetadata::FrameCancelled) {
+		if (request)
+			rawBufferReady(buffer);
+		return;
+	}
+
+	/*
+	 * Without frame start events, approximate the start of the next frame
+	 * with the completion of the current one.
+	 */
+	if (ipa_ && !frameStartEvents_)
+		delayedCtrls_->applyControls(buffer->metadata().sequence + 1);
+
+	if (request && !needsImgU(request)) {
+		rawBufferReady(buffer);
+		return;
+	}
+
+	/*
+	 * Requests and frames are assigned to the ImgUs in the same order,
+	 * all the requests queued so far have been matched with a frame when
+	 * the sequences are equal.
+	 */
+	if (cio2Sequence_ == requestSequence_) {
+		holdFrame(buffer);
+		return;
+	}
+
+	liveSequence_ = buffer->metadata().sequence + 1;
+	queueImgUFrame(imguForSequence(cio2Sequence_++), buffer);
+
+	/* The next requests may be reprocessing requests. */
+	matchReprocessFrames();
+}
+
+/**
+ * \brief Complete a raw buffer once the pipeline has released it
+ * \param[in] buffer The raw buffer
+ */
+void IPU3CameraData::rawBufferReady(FrameBuffer *buffer)
+{
+	Request *request = buffer->request();
+
+	if (!pipe_->completeBuffer(camera_, request, buffer))
+		return;
+
+	pipe_->completeRequest(camera_, request);
+}
+
+/**
+ * \brief Return an internal buffer to the CIO2, holding the most recent frames
+ * \param[in] buffer The internal buffer, released by the ImgU
+ *
+ * When zero-shutter-lag is enabled, the buffer is held for later still
+ * captures, and the oldest held frame is returned to the CIO2 instead.
+ */
+void IPU3CameraData::holdFrame(FrameBuffer *buffer)
+{
+	if (!zslDepth_) {
+		cio2_.recycleBuffer(buffer);
+		return;
+	}
+
+	/* Frames pinned by pending zero-shutter-lag requests count as held. */
+	heldFrames_.push_back(buffer);
+	if (heldFrames_.size() + zslRequests_.size() <= zslDepth_)
+		return;
+
+	FrameBuffer *oldest = heldFrames_.front();
+	heldFrames_.pop_front();
+	cio2_.recycleBuffer(oldest);
+}
+
+/**
+ * \brief Find the held frame selected by the zero-shutter-lag controls
+ * \param[in] controls The request controls
+ * \return The held frame, or nullptr if no held frame matches
+ */
+FrameBuffer *IPU3CameraData::findHeldFrame(const ControlList &controls)
+{
+	if (controls.contains(controls::ZslFrameSequence)) {
+		unsigned int sequence = controls.get(controls::ZslFrameSequence);
+		auto it = std::find_if(heldFrames_.begin(), heldFrames_.end(),
+				       [sequence](const FrameBuffer *frame) {
+					       return frame->metadata().sequence == sequence;
+				       });
+		return it != heldFrames_.end() ? *it : nullptr;
+	}
+
+	int64_t timestamp = controls.get(controls::ZslFrameTimestamp);
+	FrameBuffer *closest = nullptr;
+	uint64_t distance = std::numeric_limits<uint64_t>::max();
+
+	for (FrameBuffer *frame : heldFrames_) {
+		int64_t delta = static_cast<int64_t>(frame->metadata().timestamp) - timestamp;
+		uint64_t d = delta < 0 ? -delta : delta;
+		if (d < distance) {
+			distance = d;
+			closest = frame;
+		}
+	}
+
+	return closest;
+}
+
+/**
+ * \brief Copy a held frame to an application raw buffer
+ * \param[in] frame The held frame
+ * \param[in] buffer The application raw buffer
+ * \return 0 on success or a negative error code otherwise
+ */
+int IPU3CameraData::copyHeldFrame(FrameBuffer *frame, FrameBuffer *buffer)
+{
+	const MappedFrameBuffer *src = heldMappings_.map(frame);
+	if (!src) {
+		LOG(IPU3, Error) << "Failed to map held frame";
+		return -ENOMEM;
+	}
+
+	MappedFrameBuffer dst(buffer, MappedFrameBuffer::MapWrite);
+	if (!dst.isValid()) {
+		LOG(IPU3, Error) << "Failed to map raw buffer";
+		return dst.error();
+	}
+
+	if (src->planes().size() != dst.planes().size()) {
+		LOG(IPU3, Error) << "Raw buffer doesn't match held frame";
+		return -EINVAL;
+	}
+
+	{
+		ScopedCpuAccess srcAccess(*src);
+		ScopedCpuAccess dstAccess(dst);
+
+		for (unsigned int i = 0; i < src->planes().size(); ++i) {
+			const MappedFrameBuffer::Plane &in = src->planes()[i];
+			const MappedFrameBuffer::Plane &out = dst.planes()[i];
+			memcpy(out.data, in.data, std::min(in.length, out.length));
+		}
+	}
+
+	BufferMetadata::copy(buffer, frame->metadata());
+
+	return 0;
+}
+
+/**
+ * \brief Handle the completion of a parameters buffer by the ImgU
+ * \param[in] buffer The completed buffer
+ */
+void IPU3CameraData::imguParamBufferReady(FrameBuffer *buffer)
+{
+	for (auto it = frames_.begin(); it != frames_.end(); ++it) {
+		IPU3Frame &frame = it->second;
+		if (frame.param != buffer)
+			continue;
+
+		ImgUDevice *imgu = frame.imgu;
+		imgu->availableParamBuffers_.push(buffer);
+		frame.param = nullptr;
+		completeFrame(it);
+
+		processImgUFrames(imgu);
+		return;
+	}
+}
+
+/**
+ * \brief Handle the completion of a statistics buffer by the ImgU
+ * \param[in] buffer The completed buffer
+ *
+ * The statistics are passed to the IPA along with the sensor controls in
+ * effect for the frame. The IPA returns the buffer when reporting the frame
+ * metadata.
+ */
+void IPU3CameraData::imguStatBufferReady(FrameBuffer *buffer)
+{
+	for (auto it = frames_.begin(); it != frames_.end(); ++it) {
+		IPU3Frame &frame = it->second;
+		if (frame.stat != buffer)
+			continue;
+
+		if (buffer->metadata().status != FrameMetadata::FrameSuccess) {
+			ImgUDevice *imgu = frame.imgu;
+			imgu->availableStatBuffers_.push(buffer);
+			frame.stat = nullptr;
+			completeFrame(it);
+
+			processImgUFrames(imgu);
+			return;
+		}
+
+		ControlList sensorControls = delayedCtrls_->get(it->first);
+
+		IPU3EventStatReady event;
+		event.frame = it->first;
+		event.bufferId = buffer->cookie();
+		event.sensorControls = &sensorControls;
+
+		CpuScope scope(CameraStatistics::CpuIPA, camera_);
+		ipa_->processEvent(event.pack());
+		return;
+	}
+}
+
+void IPU3CameraData::frameStart(uint32_t sequence, uint64_t timestamp)
+{
+	if (ipa_)
+		delayedCtrls_->applyControls(sequence);
+}
+
+/* -----------------------------------------------------------------------------
+ * IPA
+ */
+
+/**
+ * \brief Load the IPA module for the camera
+ * \return 0 on success or a negative error code otherwise
+ */
+int IPU3CameraData::loadIPA()
+{
+	ipa_ = IPAManager::instance()->createIPA(pipe_, 1, 1);
+	if (!ipa_)
+		return -ENOENT;
+
+	ipa_->queueFrameAction.connect(this,
+				       &IPU3CameraData::queueFrameAction);
+
+	/*
+	 * Sensors commonly apply the exposure time two frames after it's
+	 * written, and the analogue gain one frame after.
+	 */
+	std::map<unsigned int, unsigned int> delays = {
+		{ V4L2_CID_ANALOGUE_GAIN, 1 },
+		{ V4L2_CID_EXPOSURE, 2 },
+	};
+	delayedCtrls_ =
+		std::make_unique<DelayedControls>(cio2_.sensor_->device(), delays);
+
+	return 0;
+}
+
+/**
+ * \brief Prepare the IPA and the per-frame state for capture
+ * \return 0 on success or a negative error code otherwise
+ */
+int IPU3CameraData::startIPA()
+{
+	frames_.clear();
+
+	for (ImgUDevice *imgu : { imgu_, secondaryImgu_ }) {
+		if (!imgu)
+			continue;
+
+		imgu->availableParamBuffers_ = {};
+		for (std::unique_ptr<FrameBuffer> &buffer : imgu->param_.buffers)
+			imgu->availableParamBuffers_.push(buffer.get());
+
+		imgu->availableStatBuffers_ = {};
+		for (std::unique_ptr<FrameBuffer> &buffer : imgu->stat_.buffers)
+			imgu->availableStatBuffers_.push(buffer.get());
+	}
+
+	int ret = delayedCtrls_->reset();
+	if (ret)
+		return ret;
+
+	/* Inform the IPA of the stream configuration and sensor controls. */
+	std::map<unsigned int, IPAStream> streamConfig;
+	if (outStream_.active_)
+		streamConfig[0] = {
+			.pixelFormat = outStream_.configuration().pixelFormat,
+			.size = outStream_.configuration().size,
+		};
+	if (vfStream_.active_)
+		streamConfig[1] = {
+			.pixelFormat = vfStream_.configuration().pixelFormat,
+			.size = vfStream_.configuration().size,
+		};
+
+	std::map<unsigned int, const ControlInfoMap &> entityControls;
+	entityControls.emplace(0, cio2_.sensor_->controls());
+
+	ipa_->configure(streamConfig, entityControls);
+
+	frameStartEvents_ = !cio2_.csi2_->setFrameStartEnabled(true);
+
+	return 0;
+}
+
+/**
+ * \brief Queue a frame captured by the CIO2 to the ImgU
+ * \param[in] imgu The ImgU to process the frame
+ * \param[in] buffer The CIO2 buffer
+ *
+ * When the IPA is loaded, the frame waits for a parameters and a statistics
+ * buffer, and for the IPA to fill the parameters, before being queued to the
+ * ImgU. Without IPA the frame is queued to the ImgU input as soon as all the
+ * previous frames have been queued.
+ */
+void IPU3CameraData::queueImgUFrame(ImgUDevice *imgu, FrameBuffer *buffer)
+{
+	unsigned int id = buffer->metadata().sequence;
+	IPU3Frame::State state = ipa_ ? IPU3Frame::FrameWaiting
+				      : IPU3Frame::FrameReady;
+
+	frames_[id] = { imgu, buffer, nullptr, nullptr, state };
+
+	processImgUFrames(imgu);
+}
+
+/**
+ * \brief Advance the frames waiting to be processed by an ImgU
+ * \param[in] imgu The ImgU
  *
- * \return 0 on success or a negative error code for error or if no camera
- * has been created
- * \retval -ENODEV no camera has been created
+ * Hand the waiting frames to the IPA, in capture order, as long as
+ * parameters and statistics buffers are available, and queue the frames
+ * whose parameters are ready to the ImgU.
  */
-int PipelineHandlerIPU3::registerCameras()
+void IPU3CameraData::processImgUFrames(ImgUDevice *imgu)
 {
-	int ret;
+	for (auto &it : frames_) {
+		IPU3Frame &frame = it.second;
+		if (frame.imgu != imgu || frame.state != IPU3Frame::FrameWaiting)
+			continue;
 
-	ret = imgu0_.init(imguMediaDev_, 0);
-	if (ret)
-		return ret;
+		if (imgu->availableParamBuffers_.empty() ||
+		    imgu->availableStatBuffers_.empty())
+			break;
 
-	ret = imgu1_.init(imguMediaDev_, 1);
-	if (ret)
-		return ret;
+		frame.param = imgu->availableParamBuffers_.front();
+		imgu->availableParamBuffers_.pop();
+		frame.stat = imgu->availableStatBuffers_.front();
+		imgu->availableStatBuffers_.pop();
+		frame.state = IPU3Frame::FrameFilling;
 
-	/*
-	 * For each CSI-2 receiver on the IPU3, create a Camera if an
-	 * image sensor is connected to it and the sensor can produce images
-	 * in a compatible format.
-	 */
-	unsigned int numCameras = 0;
-	for (unsigned int id = 0; id < 4 && numCameras < 2; ++id) {
-		std::unique_ptr<IPU3CameraData> data =
-			std::make_unique<IPU3CameraData>(this);
-		std::set<Stream *> streams = {
-			&data->outStream_,
-			&data->vfStream_,
-		};
-		CIO2Device *cio2 = &data->cio2_;
+		IPU3EventFillParams event;
+		event.frame = it.first;
+		event.bufferId = frame.param->cookie();
 
-		ret = cio2->init(cio2MediaDev_, id);
-		if (ret)
-			continue;
+		CpuScope scope(CameraStatistics::CpuIPA, camera_);
+		ipa_->processEvent(event.pack());
+	}
 
-		/**
-		 * \todo Dynamically assign ImgU and output devices to each
-		 * stream and camera; as of now, limit support to two cameras
-		 * only, and assign imgu0 to the first one and imgu1 to the
-		 * second.
-		 */
-		data->imgu_ = numCameras ? &imgu1_ : &imgu0_;
-		data->outStream_.device_ = &data->imgu_->output_;
-		data->outStream_.name_ = "output";
-		data->vfStream_.device_ = &data->imgu_->viewfinder_;
-		data->vfStream_.name_ = "viewfinder";
+	queueReadyImgUFrames(imgu);
+}
 
-		/*
-		 * Connect video devices' 'bufferReady' signals to their
-		 * slot to implement the image processing pipeline.
-		 *
-		 * Frames produced by the CIO2 unit are passed to the
-		 * associated ImgU input where they get processed and
-		 * returned through the ImgU main and secondary outputs.
-		 */
-		data->cio2_.output_->bufferReady.connect(data.get(),
-					&IPU3CameraData::cio2BufferReady);
-		data->imgu_->input_->bufferReady.connect(data.get(),
-					&IPU3CameraData::imguInputBufferReady);
-		data->imgu_->output_.dev->bufferReady.connect(data.get(),
-					&IPU3CameraData::imguOutputBufferReady);
-		data->imgu_->viewfinder_.dev->bufferReady.connect(data.get(),
-					&IPU3CameraData::imguOutputBufferReady);
+/**
+ * \brief Queue the frames whose parameters are ready to an ImgU
+ * \param[in] imgu The ImgU
+ *
+ * Frames are queued in capture order, queuing stops at the first frame that
+ * isn't ready.
+ */
+void IPU3CameraData::queueReadyImgUFrames(ImgUDevice *imgu)
+{
+	for (auto &it : frames_) {
+		IPU3Frame &frame = it.second;
+		if (frame.imgu != imgu || frame.state == IPU3Frame::FrameProcessing)
+			continue;
 
-		/* Create and register the Camera instance. */
-		std::string cameraName = cio2->sensor_->entity()->name() + " "
-				       + std::to_string(id);
-		std::shared_ptr<Camera> camera = Camera::create(this,
-								cameraName,
-								streams);
+		queueReprocessFrames(imgu, it.first);
 
-		registerCamera(std::move(camera), std::move(data));
+		if (frame.state != IPU3Frame::FrameReady)
+			return;
 
-		LOG(IPU3, Info)
-			<< "Registered Camera[" << numCameras << "] \""
-			<< cameraName << "\""
-			<< " connected to CSI-2 receiver " << id;
+		if (frame.param) {
+			imgu->param_.dev->queueBuffer(frame.param);
+			imgu->stat_.dev->queueBuffer(frame.stat);
+		}
 
-		numCameras++;
+		imgu->input_->queueBuffer(frame.input);
+		frame.state = IPU3Frame::FrameProcessing;
 	}
 
-	return numCameras ? 0 : -ENODEV;
+	queueReprocessFrames(imgu, std::numeric_limits<unsigned int>::max());
 }
 
-/* -----------------------------------------------------------------------------
- * Buffer Ready slots
- */
-
 /**
- * \brief Handle buffers completion at the ImgU input
- * \param[in] buffer The completed buffer
+ * \brief Assign the reprocessing requests whose turn has come to their ImgU
  *
- * Buffers completed from the ImgU input are immediately queued back to the
- * CIO2 unit to continue frame capture.
+ * A reprocessing request is matched when the CIO2 frames of all the previous
+ * requests have been matched. Its input frame is then queued to the ImgU
+ * after the live frames captured so far, and before the next ones.
  */
-void IPU3CameraData::imguInputBufferReady(FrameBuffer *buffer)
+void IPU3CameraData::matchReprocessFrames()
 {
-	/* \todo Handle buffer failures when state is set to BufferError. */
-	if (buffer->metadata().status == FrameMetadata::FrameCancelled)
-		return;
+	auto it = reprocessInputs_.begin();
+	while (it != reprocessInputs_.end() && it->first == cio2Sequence_) {
+		ImgUDevice *imgu = imguForSequence(cio2Sequence_++);
+
+		imgu->reprocessFrames_.emplace_back(liveSequence_, it->second);
+		it = reprocessInputs_.erase(it);
 
-	cio2_.output_->queueBuffer(buffer);
+		queueReadyImgUFrames(imgu);
+	}
 }
 
 /**
- * \brief Handle buffers completion at the ImgU output
- * \param[in] buffer The completed buffer
+ * \brief Queue reprocessing frames to an ImgU input
+ * \param[in] imgu The ImgU
+ * \param[in] sequence The CIO2 sequence of the next live frame to be queued
  *
- * Buffers completed from the ImgU output are directed to the application.
+ * Queue the reprocessing frames that precede the live frame with \a sequence.
  */
-void IPU3CameraData::imguOutputBufferReady(FrameBuffer *buffer)
+void IPU3CameraData::queueReprocessFrames(ImgUDevice *imgu,
+					  unsigned int sequence)
 {
-	Request *request = buffer->request();
-
-	if (!pipe_->completeBuffer(camera_, request, buffer))
-		/* Request not completed yet, return here. */
-		return;
-
-	/* Mark the request as complete. */
-	pipe_->completeRequest(camera_, request);
+	while (!imgu->reprocessFrames_.empty() &&
+	       imgu->reprocessFrames_.front().first <= sequence) {
+		imgu->input_->queueBuffer(imgu->reprocessFrames_.front().second);
+		imgu->reprocessFrames_.pop_front();
+	}
 }
 
 /**
- * \brief Handle buffers completion at the CIO2 output
- * \param[in] buffer The completed buffer
+ * \brief Queue the frames not processed yet to the ImgU input
  *
- * Buffers completed from the CIO2 are immediately queued to the ImgU unit
- * for further processing.
+ * The frames are queued without parameters, for their input buffers to be
+ * cancelled when the ImgU stops. Their parameters and statistics buffers are
+ * released.
  */
-void IPU3CameraData::cio2BufferReady(FrameBuffer *buffer)
+void IPU3CameraData::flushImgUFrames()
 {
-	/* \todo Handle buffer failures when state is set to BufferError. */
-	if (buffer->metadata().status == FrameMetadata::FrameCancelled)
+	for (auto &it : frames_) {
+		IPU3Frame &frame = it.second;
+		if (frame.state == IPU3Frame::FrameProcessing)
+			continue;
+
+		queueReprocessFrames(frame.imgu, it.first);
+
+		if (frame.param) {
+			frame.imgu->availableParamBuffers_.push(frame.param);
+			frame.imgu->availableStatBuffers_.push(frame.stat);
+			frame.param = nullptr;
+			frame.stat = nullptr;
+		}
+
+		frame.imgu->input_->queueBuffer(frame.input);
+		frame.state = IPU3Frame::FrameProcessing;
+	}
+
+	/*
+	 * The reprocessing requests still waiting for the frames of previous
+	 * requests won't get them, queue their input frames as well.
+	 */
+	for (const auto &input : reprocessInputs_)
+		imguForSequence(input.first)->reprocessFrames_.emplace_back(0, input.second);
+	reprocessInputs_.clear();
+
+	for (ImgUDevice *imgu : { imgu_, secondaryImgu_ }) {
+		if (!imgu)
+			continue;
+
+		for (const auto &frame : imgu->reprocessFrames_)
+			imgu->input_->queueBuffer(frame.second);
+		imgu->reprocessFrames_.clear();
+	}
+}
+
+void IPU3CameraData::completeFrame(std::map<unsigned int, IPU3Frame>::iterator it)
+{
+	if (it->second.input || it->second.param || it->second.stat)
 		return;
 
-	imgu_->input_->queueBuffer(buffer);
+	frames_.erase(it);
+}
+
+void IPU3CameraData::queueFrameAction(unsigned int frame,
+				      const IPAOperationData &action)
+{
+	switch (action.operation) {
+	case IPU3_IPA_ACTION_V4L2_SET: {
+		IPU3ActionV4L2Set set;
+		if (set.unpack(action))
+			break;
+
+		delayedCtrls_->push(frame, *set.sensorControls);
+		break;
+	}
+
+	case IPU3_IPA_ACTION_PARAM_FILLED: {
+		auto it = frames_.find(frame);
+		if (it == frames_.end() ||
+		    it->second.state != IPU3Frame::FrameFilling)
+			break;
+
+		it->second.state = IPU3Frame::FrameReady;
+		queueReadyImgUFrames(it->second.imgu);
+		break;
+	}
+
+	case IPU3_IPA_ACTION_METADATA: {
+		auto it = frames_.find(frame);
+		if (it == frames_.end() || !it->second.stat)
+			break;
+
+		/* \todo Attach the metadata to the request. */
+		ImgUDevice *imgu = it->second.imgu;
+		imgu->availableStatBuffers_.push(it->second.stat);
+		it->second.stat = nullptr;
+		completeFrame(it);
+
+		processImgUFrames(imgu);
+		break;
+	}
+
+	default:
+		LOG(IPU3, Error) << "Unknown action " << action.operation;
+		break;
+	}
 }
 
 /* -----------------------------------------------------------------------------
@@ -1047,6 +2668,15 @@ int ImgUDevice::init(MediaDevice *media, unsigned int index)
 	viewfinder_.pad = PAD_VF;
 	viewfinder_.name = "viewfinder";
 
+	param_.dev = V4L2VideoDevice::fromEntityName(media,
+						     name_ + " parameters");
+	ret = param_.dev->open();
+	if (ret)
+		return ret;
+
+	param_.pad = PAD_PARAM;
+	param_.name = "parameters";
+
 	stat_.dev = V4L2VideoDevice::fromEntityName(media, name_ + " 3a stat");
 	ret = stat_.dev->open();
 	if (ret)
@@ -1058,13 +2688,164 @@ int ImgUDevice::init(MediaDevice *media, unsigned int index)
 	return 0;
 }
 
+/* IF crop, BDS and GDC alignments and limits, in pixels. */
+static constexpr unsigned int IF_ALIGN_W = 2;
+static constexpr unsigned int IF_ALIGN_H = 4;
+static constexpr unsigned int IF_CROP_MAX_W = 40;
+static constexpr unsigned int IF_CROP_MAX_H = 540;
+static constexpr unsigned int BDS_ALIGN_W = 2;
+static constexpr unsigned int BDS_ALIGN_H = 4;
+static constexpr unsigned int GDC_ALIGN_W = 4;
+static constexpr unsigned int GDC_ALIGN_H = 4;
+static constexpr unsigned int FILTER_W = 4;
+static constexpr unsigned int FILTER_H = 4;
+
+/* BDS scaling factors range, in steps of 1/32. */
+static constexpr unsigned int BDS_SF_STEPS = 32;
+static constexpr unsigned int BDS_SF_MIN = 32;
+static constexpr unsigned int BDS_SF_MAX = 80;
+
+/*
+ * Field of view loss tolerated in exchange for a lower processing cost,
+ * as a fraction of the best field of view.
+ */
+static constexpr double FOV_TOLERANCE = 0.01;
+
+/**
+ * \brief Calculate the ImgU pipe configuration for the given sizes
+ * \param[in] input The ImgU input size
+ * \param[in] main The ImgU main output size
+ * \param[in] vf The ImgU viewfinder output size
+ *
+ * The GDC output is sized to the largest output, extended to fit the aspect
+ * ratios of both outputs. All valid combinations of IF crop and BDS scaling
+ * factor producing a BDS output large enough for the GDC are then evaluated.
+ * Each combination is scored by the field of view it preserves and by its
+ * processing cost, which scales with the number of pixels output by the BDS.
+ * The cheapest combination whose field of view is within FOV_TOLERANCE of the
+ * best one is selected, which avoids running the ImgU at full input
+ * resolution when down-scaling early loses no field of view.
+ *
+ * When no valid combination exists, the input is processed without cropping
+ * or scaling.
+ *
+ * \return The ImgU pipe configuration
+ */
+ImgUDevice::PipeConfig ImgUDevice::calculatePipeConfig(const Size &input,
+						       const Size &main,
+						       const Size &vf)
+{
+	PipeConfig fallback = { input, input, input };
+
+	if (!input.width || !input.height || !main.width || !main.height ||
+	    !vf.width || !vf.height)
+		return fallback;
+
+	/*
+	 * The GDC output feeds both outputs, which are down-scaled from it by
+	 * the same factor in both directions. As the GDC output is at least
+	 * aligned to the IF alignment, the IF crop loops below can't wrap
+	 * around.
+	 */
+	Size gdc;
+	gdc.width = std::max(main.width, vf.width);
+	gdc.height = std::max(main.height * gdc.width / main.width,
+			      vf.height * gdc.width / vf.width);
+	gdc.width = (gdc.width + GDC_ALIGN_W - 1) & ~(GDC_ALIGN_W - 1);
+	gdc.height = (gdc.height + GDC_ALIGN_H - 1) & ~(GDC_ALIGN_H - 1);
+
+	if (gdc.width > input.width || gdc.height > input.height)
+		return fallback;
+
+	unsigned int maxIfWidth = input.width & ~(IF_ALIGN_W - 1);
+	unsigned int maxIfHeight = input.height & ~(IF_ALIGN_H - 1);
+	unsigned int minIfWidth = input.width > IF_CROP_MAX_W
+				? input.width - IF_CROP_MAX_W : 0;
+	unsigned int minIfHeight = input.height > IF_CROP_MAX_H
+				 ? input.height - IF_CROP_MAX_H : 0;
+
+	/* Call the function for all valid configurations. */
+	auto forEachConfig = [&](auto func) {
+		for (unsigned int ifWidth = maxIfWidth;
+		     ifWidth >= minIfWidth && ifWidth >= gdc.width;
+		     ifWidth -= IF_ALIGN_W) {
+			for (unsigned int ifHeight = maxIfHeight;
+			     ifHeight >= minIfHeight && ifHeight >= gdc.height;
+			     ifHeight -= IF_ALIGN_H) {
+				for (unsigned int sf = BDS_SF_MIN; sf <= BDS_SF_MAX; ++sf) {
+					Size bds;
+					bds.width = ifWidth * BDS_SF_STEPS / sf
+						  & ~(BDS_ALIGN_W - 1);
+					bds.height = ifHeight * BDS_SF_STEPS / sf
+						   & ~(BDS_ALIGN_H - 1);
+
+					/*
+					 * The GDC needs a filter envelope
+					 * around its input when the BDS scales.
+					 */
+					unsigned int marginW = sf != BDS_SF_MIN ? FILTER_W : 0;
+					unsigned int marginH = sf != BDS_SF_MIN ? FILTER_H : 0;
+					if (bds.width < gdc.width + marginW ||
+					    bds.height < gdc.height + marginH)
+						break;
+
+					func({ Size(ifWidth, ifHeight), bds, gdc });
+				}
+			}
+		}
+	};
+
+	/*
+	 * The GDC crops the BDS output to its aspect ratio, the field of view
+	 * is the fraction of the input area left after the IF and GDC crops.
+	 */
+	auto fieldOfView = [&](const PipeConfig &pipe) {
+		uint64_t cropWidth = pipe.bds.width;
+		uint64_t cropHeight = pipe.bds.height;
+		if (cropWidth * gdc.height > cropHeight * gdc.width)
+			cropWidth = cropHeight * gdc.width / gdc.height;
+		else
+			cropHeight = cropWidth * gdc.height / gdc.width;
+
+		return static_cast<double>(pipe.iif.width) * pipe.iif.height
+		       / (static_cast<double>(input.width) * input.height)
+		       * (cropWidth * cropHeight)
+		       / (static_cast<double>(pipe.bds.width) * pipe.bds.height);
+	};
+
+	double maxFov = 0.0;
+	forEachConfig([&](const PipeConfig &pipe) {
+		maxFov = std::max(maxFov, fieldOfView(pipe));
+	});
+
+	PipeConfig best = fallback;
+	double bestFov = 0.0;
+	uint64_t bestCost = UINT64_MAX;
+
+	forEachConfig([&](const PipeConfig &pipe) {
+		double fov = fieldOfView(pipe);
+		if (fov < maxFov * (1.0 - FOV_TOLERANCE))
+			return;
+
+		uint64_t cost = static_cast<uint64_t>(pipe.bds.width) * pipe.bds.height;
+		if (cost > bestCost || (cost == bestCost && fov <= bestFov))
+			return;
+
+		best = pipe;
+		bestFov = fov;
+		bestCost = cost;
+	});
+
+	return best;
+}
+
 /**
  * \brief Configure the ImgU unit input
- * \param[in] size The ImgU input frame size
+ * \param[in] pipe The ImgU pipe configuration
  * \param[in] inputFormat The format to be applied to ImgU input
  * \return 0 on success or a negative error code otherwise
  */
-int ImgUDevice::configureInput(const Size &size,
+int ImgUDevice::configureInput(const PipeConfig &pipe,
 			       V4L2DeviceFormat *inputFormat)
 {
 	/* Configure the ImgU input video device with the requested sizes. */
@@ -1075,35 +2856,33 @@ int ImgUDevice::configureInput(const Size &size,
 	LOG(IPU3, Debug) << "ImgU input format = " << inputFormat->toString();
 
 	/*
-	 * \todo The IPU3 driver implementation shall be changed to use the
-	 * input sizes as 'ImgU Input' subdevice sizes, and use the desired
-	 * GDC output sizes to configure the crop/compose rectangles.
-	 *
-	 * The current IPU3 driver implementation uses GDC sizes as the
-	 * 'ImgU Input' subdevice sizes, and the input video device sizes
-	 * to configure the crop/compose rectangles, contradicting the
-	 * V4L2 specification.
+	 * The ImgU driver uses the crop rectangle of the input pad for the
+	 * input feeder, the compose rectangle for the BDS output, and the
+	 * format for the GDC output.
 	 */
 	Rectangle rect = {
 		.x = 0,
 		.y = 0,
-		.w = inputFormat->size.width,
-		.h = inputFormat->size.height,
+		.w = pipe.iif.width,
+		.h = pipe.iif.height,
 	};
 	ret = imgu_->setCrop(PAD_INPUT, &rect);
 	if (ret)
 		return ret;
 
+	LOG(IPU3, Debug) << "ImgU input feeder rectangle = " << rect.toString();
+
+	rect.w = pipe.bds.width;
+	rect.h = pipe.bds.height;
 	ret = imgu_->setCompose(PAD_INPUT, &rect);
 	if (ret)
 		return ret;
 
-	LOG(IPU3, Debug) << "ImgU input feeder and BDS rectangle = "
-			 << rect.toString();
+	LOG(IPU3, Debug) << "ImgU BDS rectangle = " << rect.toString();
 
 	V4L2SubdeviceFormat imguFormat = {};
 	imguFormat.mbus_code = MEDIA_BUS_FMT_FIXED;
-	imguFormat.size = size;
+	imguFormat.size = pipe.gdc;
 
 	ret = imgu_->setFormat(PAD_INPUT, &imguFormat);
 	if (ret)
@@ -1134,8 +2913,8 @@ int ImgUDevice::configureOutput(ImgUOutput *output,
 	if (ret)
 		return ret;
 
-	/* No need to apply format to the stat node. */
-	if (output == &stat_)
+	/* No need to apply format to the parameters and stat nodes. */
+	if (output == &param_ || output == &stat_)
 		return 0;
 
 	V4L2DeviceFormat outputFormat = {};
@@ -1166,10 +2945,21 @@ void ImgUDevice::freeBuffers(IPU3CameraData *data)
 			LOG(IPU3, Error) << "Failed to release ImgU output buffers";
 	}
 
+	ret = param_.dev->releaseBuffers();
+	if (ret)
+		LOG(IPU3, Error) << "Failed to release ImgU parameters buffers";
+
 	ret = stat_.dev->releaseBuffers();
 	if (ret)
 		LOG(IPU3, Error) << "Failed to release ImgU stat buffers";
 
+	output_.buffers.clear();
+	viewfinder_.buffers.clear();
+	param_.buffers.clear();
+	stat_.buffers.clear();
+	availableParamBuffers_ = {};
+	availableStatBuffers_ = {};
+
 	if (!data->vfStream_.active_) {
 		ret = viewfinder_.dev->releaseBuffers();
 		if (ret)
@@ -1198,6 +2988,12 @@ int ImgUDevice::start()
 		return ret;
 	}
 
+	ret = param_.dev->streamOn();
+	if (ret) {
+		LOG(IPU3, Error) << "Failed to start ImgU parameters";
+		return ret;
+	}
+
 	ret = stat_.dev->streamOn();
 	if (ret) {
 		LOG(IPU3, Error) << "Failed to start ImgU stat";
@@ -1219,6 +3015,7 @@ int ImgUDevice::stop()
 
 	ret = output_.dev->streamOff();
 	ret |= viewfinder_.dev->streamOff();
+	ret |= param_.dev->streamOff();
 	ret |= stat_.dev->streamOff();
 	ret |= input_->streamOff();
 
@@ -1261,6 +3058,7 @@ int ImgUDevice::enableLinks(bool enable)
 {
 	std::string viewfinderName = name_ + " viewfinder";
 	std::string outputName = name_ + " output";
+	std::string paramName = name_ + " parameters";
 	std::string statName = name_ + " 3a stat";
 	std::string inputName = name_ + " input";
 	int ret;
@@ -1269,6 +3067,10 @@ int ImgUDevice::enableLinks(bool enable)
 	if (ret)
 		return ret;
 
+	ret = linkSetup(paramName, 0, name_, PAD_PARAM, enable);
+	if (ret)
+		return ret;
+
 	ret = linkSetup(name_, PAD_OUTPUT, outputName, 0, enable);
 	if (ret)
 		return ret;
@@ -1409,35 +3211,163 @@ int CIO2Device::configure(const Size &size,
 	return 0;
 }
 
+/**
+ * \brief Export frame buffers from the CIO2 output for the raw stream
+ * \param[in] count Number of buffers to export
+ * \param[in] cpuAccess The CPU access pattern of the buffers
+ * \param[out] buffers Vector to store the exported buffers
+ *
+ * The buffers are queued to the CIO2 output by import along with the internal
+ * buffers, the video device is thus released after exporting them.
+ *
+ * \return Number of buffers exported or negative error code
+ */
+int CIO2Device::exportBuffers(unsigned int count,
+			      FrameBuffer::CpuAccess cpuAccess,
+			      std::vector<std::unique_ptr<FrameBuffer>> *buffers)
+{
+	output_->setCpuAccess(cpuAccess);
+
+	int ret = output_->exportBuffers(count, buffers);
+	if (ret < 0)
+		return ret;
+
+	output_->releaseBuffers();
+
+	return ret;
+}
+
 /**
  * \brief Allocate frame buffers for the CIO2 output
+ * \param[in] bufferCount Number of internal buffers
+ * \param[in] rawBufferCount Number of application raw buffers
  *
  * Allocate frame buffers in the CIO2 video device to be used to capture frames
  * from the CIO2 output. The buffers are stored in the CIO2Device::buffers_
  * vector.
  *
- * \return Number of buffers allocated or negative error code
+ * Without raw buffers, the internal buffers are all queued at start time and
+ * recycled as soon as the ImgU releases them. Otherwise the CIO2 is driven by
+ * requests through queueFrame(), and the device imports both the internal and
+ * the application raw buffers.
+ *
+ * \return Number of buffers the CIO2 captures to or negative error code
  */
-int CIO2Device::allocateBuffers()
+int CIO2Device::allocateBuffers(unsigned int bufferCount,
+				unsigned int rawBufferCount)
 {
-	int ret = output_->exportBuffers(CIO2_BUFFER_COUNT, &buffers_);
-	if (ret < 0)
+	/* The internal buffers are only accessed by the ImgU. */
+	output_->setCpuAccess(FrameBuffer::CpuAccessNone);
+
+	int ret = output_->exportBuffers(bufferCount, &buffers_);
+	if (ret < 0) {
 		LOG(IPU3, Error) << "Failed to export CIO2 buffers";
+		return ret;
+	}
 
-	return ret;
+	requestDriven_ = rawBufferCount != 0;
+	if (!requestDriven_)
+		return ret;
+
+	/*
+	 * The exported dmabufs keep the internal buffers memory alive, switch
+	 * the device to import mode to queue the raw buffers as well.
+	 */
+	output_->releaseBuffers();
+
+	unsigned int count = bufferCount + rawBufferCount;
+	ret = output_->importBuffers(count);
+	if (ret) {
+		LOG(IPU3, Error) << "Failed to import CIO2 buffers";
+		buffers_.clear();
+		return ret;
+	}
+
+	return count;
 }
 
 void CIO2Device::freeBuffers()
 {
+	availableBuffers_ = {};
+	pendingFrames_ = {};
 	buffers_.clear();
 
 	if (output_->releaseBuffers())
 		LOG(IPU3, Error) << "Failed to release CIO2 buffers";
 }
 
+/**
+ * \brief Capture a frame for a request
+ * \param[in] buffer The request raw buffer, or nullptr to capture to an
+ * internal buffer
+ *
+ * Frames are captured in the order they're queued. When no internal buffer is
+ * available, the frame is held until the ImgU releases one.
+ *
+ * \return 0 on success or a negative error code otherwise
+ */
+int CIO2Device::queueFrame(FrameBuffer *buffer)
+{
+	pendingFrames_.push(buffer);
+
+	return queuePendingFrames();
+}
+
+/**
+ * \brief Return an internal buffer released by the ImgU to the CIO2
+ * \param[in] buffer The internal buffer
+ */
+void CIO2Device::recycleBuffer(FrameBuffer *buffer)
+{
+	if (!requestDriven_) {
+		output_->queueBuffer(buffer);
+		return;
+	}
+
+	availableBuffers_.push(buffer);
+	queuePendingFrames();
+}
+
+int CIO2Device::queuePendingFrames()
+{
+	while (!pendingFrames_.empty()) {
+		FrameBuffer *buffer = pendingFrames_.front();
+
+		if (!buffer) {
+			if (availableBuffers_.empty())
+				return 0;
+
+			buffer = availableBuffers_.front();
+			availableBuffers_.pop();
+		}
+
+		pendingFrames_.pop();
+
+		int ret = output_->queueBuffer(buffer);
+		if (ret) {
+			LOG(IPU3, Error) << "Failed to queue CIO2 buffer";
+			return ret;
+		}
+	}
+
+	return 0;
+}
+
 int CIO2Device::start()
 {
+	/*
+	 * The buffers are kept across stop() and start(), all of them have
+	 * been returned by the devices when stopping.
+	 */
+	availableBuffers_ = {};
+	pendingFrames_ = {};
+
 	for (const std::unique_ptr<FrameBuffer> &buffer : buffers_) {
+		if (requestDriven_) {
+			availableBuffers_.push(buffer.get());
+			continue;
+		}
+
 		int ret = output_->queueBuffer(buffer.get());
 		if (ret) {
 			LOG(IPU3, Error) << "Failed to queue CIO2 buffer";
@@ -1450,9 +3380,39 @@ int CIO2Device::start()
 
 int CIO2Device::stop()
 {
+	/*
+	 * Queue the held raw buffers for them to be cancelled by stream off,
+	 * frames waiting for an internal buffer are dropped.
+	 */
+	while (!pendingFrames_.empty()) {
+		FrameBuffer *buffer = pendingFrames_.front();
+		pendingFrames_.pop();
+
+		if (buffer)
+			output_->queueBuffer(buffer);
+	}
+
 	return output_->streamOff();
 }
 
+/**
+ * \brief Check if a pixel format is a CIO2 raw Bayer format
+ * \param[in] fourcc The pixel format
+ * \return True if \a fourcc is a CIO2 raw Bayer format, false otherwise
+ */
+bool CIO2Device::isRawFormat(unsigned int fourcc)
+{
+	switch (fourcc) {
+	case V4L2_PIX_FMT_IPU3_SBGGR10:
+	case V4L2_PIX_FMT_IPU3_SGBRG10:
+	case V4L2_PIX_FMT_IPU3_SGRBG10:
+	case V4L2_PIX_FMT_IPU3_SRGGB10:
+		return true;
+	default:
+		return false;
+	}
+}
+
 int CIO2Device::mediaBusToFormat(unsigned int code)
 {
 	switch (code) {
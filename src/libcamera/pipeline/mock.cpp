@@ -0,0 +1,533 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * mock.cpp - Pipeline handler for simulated cameras
+ */
+
+#include <algorithm>
+#include <array>
+#include <deque>
+#include <errno.h>
+#include <memory>
+#include <set>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <linux/drm_fourcc.h>
+
+#include <libcamera/buffer.h>
+#include <libcamera/camera.h>
+#include <libcamera/event_notifier.h>
+#include <libcamera/raw_video.h>
+#include <libcamera/request.h>
+#include <libcamera/stream.h>
+#include <libcamera/timer.h>
+
+#include "buffer_metadata.h"
+#include "cpu_accounting.h"
+#include "device_enumerator.h"
+#include "formats.h"
+#include "log.h"
+#include "media_device.h"
+#include "pipeline_handler.h"
+#include "utils.h"
+
+namespace libcamera {
+
+LOG_DEFINE_CATEGORY(Mock)
+
+/*
+ * The mock pipeline handler exposes the media devices created by the mock
+ * device enumerator as cameras. Frames are simulated in userspace: each camera
+ * signals frame completion through an eventfd monitored by an EventNotifier,
+ * exactly as a V4L2 video device signals dequeuable buffers, either as soon as
+ * a buffer is queued or at the frame interval given in microseconds by the
+ * LIBCAMERA_MOCK_FRAME_INTERVAL environment variable. Buffers are not written
+ * to, unless the LIBCAMERA_MOCK_REPLAY environment variable names a raw video
+ * container, in which case the frames of its first stream are copied to the
+ * buffers in a loop.
+ */
+
+class MockCameraData : public CameraData
+{
+public:
+	MockCameraData(PipelineHandler *pipe)
+		: CameraData(pipe), eventFd_(-1), notifier_(nullptr),
+		  signalled_(0), sequence_(0), streaming_(false)
+	{
+	}
+
+	~MockCameraData()
+	{
+		delete notifier_;
+		if (eventFd_ != -1)
+			::close(eventFd_);
+	}
+
+	int init();
+
+	int start();
+	void stop();
+	void queueBuffer(FrameBuffer *buffer);
+
+	Stream stream_;
+
+private:
+	void signalFrame();
+	void frameTimeout(Timer *timer);
+	void eventReady(EventNotifier *notifier);
+	void completeBuffer(FrameBuffer *buffer, FrameMetadata::Status status);
+	unsigned int replayFrame(FrameBuffer *buffer, unsigned int sequence);
+
+	int eventFd_;
+	EventNotifier *notifier_;
+	Timer frameTimer_;
+	utils::duration interval_;
+
+	RawVideoReader replay_;
+	std::vector<unsigned int> replayFrames_;
+
+	std::deque<FrameBuffer *> queue_;
+	unsigned int signalled_;
+	unsigned int sequence_;
+	bool streaming_;
+};
+
+class MockCameraConfiguration : public CameraConfiguration
+{
+public:
+	MockCameraConfiguration();
+
+	Status validate() override;
+};
+
+class PipelineHandlerMock : public PipelineHandler
+{
+public:
+	PipelineHandlerMock(CameraManager *manager);
+
+	CameraConfiguration *generateConfiguration(Camera *camera,
+		const StreamRoles &roles) override;
+	int configure(Camera *camera, CameraConfiguration *config) override;
+
+	int exportFrameBuffers(Camera *camera, Stream *stream,
+			       std::vector<std::unique_ptr<FrameBuffer>> *buffers) override;
+	int importFrameBuffers(Camera *camera, Stream *stream) override;
+	void freeFrameBuffers(Camera *camera, Stream *stream) override;
+
+	int start(Camera *camera) override;
+	void stopDevice(Camera *camera) override;
+
+	int queueRequestDevice(Camera *camera, Request *request) override;
+
+	bool match(DeviceEnumerator *enumerator) override;
+
+private:
+	MockCameraData *cameraData(const Camera *camera)
+	{
+		return static_cast<MockCameraData *>(
+			PipelineHandler::cameraData(camera));
+	}
+};
+
+namespace {
+
+constexpr std::array<unsigned int, 2> pixelformats{
+	DRM_FORMAT_YUYV,
+	DRM_FORMAT_NV12,
+};
+
+unsigned int frameSize(unsigned int pixelformat, const Size &size)
+{
+	unsigned int pixels = size.width * size.height;
+
+	return pixelformat == DRM_FORMAT_NV12 ? pixels * 3 / 2 : pixels * 2;
+}
+
+} /* namespace */
+
+MockCameraConfiguration::MockCameraConfiguration()
+	: CameraConfiguration()
+{
+}
+
+CameraConfiguration::Status MockCameraConfiguration::validate()
+{
+	Status status = Valid;
+
+	if (config_.empty())
+		return Invalid;
+
+	/* Cap the number of entries to the available streams. */
+	if (config_.size() > 1) {
+		config_.resize(1);
+		status = Adjusted;
+	}
+
+	StreamConfiguration &cfg = config_[0];
+
+	if (std::find(pixelformats.begin(), pixelformats.end(), cfg.pixelFormat) ==
+	    pixelformats.end()) {
+		LOG(Mock, Debug) << "Adjusting format to YUYV";
+		cfg.pixelFormat = DRM_FORMAT_YUYV;
+		status = Adjusted;
+	}
+
+	const Size size = cfg.size;
+
+	cfg.size.width = std::max(32U, std::min(4096U, cfg.size.width & ~1U));
+	cfg.size.height = std::max(32U, std::min(4096U, cfg.size.height & ~1U));
+
+	if (cfg.size != size) {
+		LOG(Mock, Debug)
+			<< "Adjusting size to " << cfg.size.toString();
+		status = Adjusted;
+	}
+
+	if (!cfg.bufferCount)
+		cfg.bufferCount = 4;
+
+	return status;
+}
+
+PipelineHandlerMock::PipelineHandlerMock(CameraManager *manager)
+	: PipelineHandler(manager)
+{
+}
+
+CameraConfiguration *PipelineHandlerMock::generateConfiguration(Camera *camera,
+	const StreamRoles &roles)
+{
+	CameraConfiguration *config = new MockCameraConfiguration();
+
+	if (roles.empty())
+		return config;
+
+	ImageFormats formats;
+
+	for (unsigned int pixelformat : pixelformats) {
+		std::vector<SizeRange> sizes{
+			SizeRange{ 32, 32, 4096, 4096 }
+		};
+		formats.addFormat(pixelformat, sizes);
+	}
+
+	StreamConfiguration cfg(formats.data());
+
+	cfg.pixelFormat = DRM_FORMAT_YUYV;
+	cfg.size = { 640, 480 };
+	cfg.bufferCount = 4;
+
+	config->addConfiguration(cfg);
+
+	config->validate();
+
+	return config;
+}
+
+int PipelineHandlerMock::configure(Camera *camera, CameraConfiguration *config)
+{
+	MockCameraData *data = cameraData(camera);
+	StreamConfiguration &cfg = config->at(0);
+
+	cfg.setStream(&data->stream_);
+
+	return 0;
+}
+
+int PipelineHandlerMock::exportFrameBuffers(Camera *camera, Stream *stream,
+					    std::vector<std::unique_ptr<FrameBuffer>> *buffers)
+{
+	const StreamConfiguration &cfg = stream->configuration();
+	unsigned int length = frameSize(cfg.pixelFormat, cfg.size);
+
+	/* Memory is only allocated if the application touches the buffers. */
+	for (unsigned int i = 0; i < cfg.bufferCount; ++i) {
+		int fd = memfd_create("libcamera-mock", MFD_CLOEXEC);
+		if (fd < 0) {
+			int ret = -errno;
+			LOG(Mock, Error)
+				<< "Failed to allocate buffer: " << strerror(-ret);
+			buffers->clear();
+			return ret;
+		}
+
+		if (ftruncate(fd, length) < 0) {
+			int ret = -errno;
+			LOG(Mock, Error)
+				<< "Failed to size buffer: " << strerror(-ret);
+			::close(fd);
+			buffers->clear();
+			return ret;
+		}
+
+		FrameBuffer::Plane plane;
+		plane.fd = FileDescriptor(fd);
+		plane.length = length;
+		::close(fd);
+
+		buffers->push_back(std::make_unique<FrameBuffer>(std::vector<FrameBuffer::Plane>{ plane }));
+	}
+
+	return cfg.bufferCount;
+}
+
+int PipelineHandlerMock::importFrameBuffers(Camera *camera, Stream *stream)
+{
+	return 0;
+}
+
+void PipelineHandlerMock::freeFrameBuffers(Camera *camera, Stream *stream)
+{
+}
+
+int PipelineHandlerMock::start(Camera *camera)
+{
+	MockCameraData *data = cameraData(camera);
+
+	return data->start();
+}
+
+void PipelineHandlerMock::stopDevice(Camera *camera)
+{
+	MockCameraData *data = cameraData(camera);
+
+	data->stop();
+}
+
+int PipelineHandlerMock::queueRequestDevice(Camera *camera, Request *request)
+{
+	MockCameraData *data = cameraData(camera);
+	FrameBuffer *buffer = request->findBuffer(&data->stream_);
+	if (!buffer) {
+		LOG(Mock, Error)
+			<< "Attempt to queue request with invalid stream";
+
+		return -ENOENT;
+	}
+
+	data->queueBuffer(buffer);
+
+	return 0;
+}
+
+bool PipelineHandlerMock::match(DeviceEnumerator *enumerator)
+{
+	DeviceMatch dm("mock");
+
+	dm.add("Mock Sensor");
+	dm.add("Mock Capture");
+
+	MediaDevice *media = acquireMediaDevice(enumerator, dm);
+	if (!media)
+		return false;
+
+	std::unique_ptr<MockCameraData> data = std::make_unique<MockCameraData>(this);
+
+	if (data->init())
+		return false;
+
+	/* Create and register the camera. */
+	std::set<Stream *> streams{ &data->stream_ };
+	std::shared_ptr<Camera> camera = Camera::create(this, media->model(),
+							streams);
+	registerCamera(std::move(camera), std::move(data));
+
+	return true;
+}
+
+int MockCameraData::init()
+{
+	eventFd_ = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (eventFd_ < 0) {
+		int ret = -errno;
+		LOG(Mock, Error)
+			<< "Failed to create eventfd: " << strerror(-ret);
+		return ret;
+	}
+
+	notifier_ = new EventNotifier(eventFd_, EventNotifier::Read);
+	notifier_->setEnabled(false);
+	notifier_->activated.connect(this, &MockCameraData::eventReady);
+
+	frameTimer_.timeout.connect(this, &MockCameraData::frameTimeout);
+
+	const char *interval = utils::secure_getenv("LIBCAMERA_MOCK_FRAME_INTERVAL");
+	interval_ = std::chrono::microseconds(interval ? strtoul(interval, nullptr, 10) : 0);
+	frameInterval_ = interval_;
+
+	const char *replay = utils::secure_getenv("LIBCAMERA_MOCK_REPLAY");
+	if (replay) {
+		int ret = replay_.open(replay);
+		if (ret < 0) {
+			LOG(Mock, Error)
+				<< "Failed to open replay file " << replay
+				<< ": " << strerror(-ret);
+			return ret;
+		}
+
+		RawVideoFrame frame;
+		for (unsigned int i = 0; i < replay_.frames(); ++i) {
+			if (!replay_.frame(i, &frame) && frame.stream == 0)
+				replayFrames_.push_back(i);
+		}
+
+		LOG(Mock, Debug)
+			<< "Replaying " << replayFrames_.size()
+			<< " frames from " << replay;
+	}
+
+	return 0;
+}
+
+int MockCameraData::start()
+{
+	sequence_ = 0;
+	streaming_ = true;
+	notifier_->setEnabled(true);
+
+	if (interval_ > utils::duration::zero())
+		frameTimer_.start(utils::clock::now() + interval_);
+
+	return 0;
+}
+
+void MockCameraData::stop()
+{
+	streaming_ = false;
+	frameTimer_.stop();
+	notifier_->setEnabled(false);
+
+	uint64_t count;
+	if (::read(eventFd_, &count, sizeof(count)) < 0 && errno != EAGAIN)
+		LOG(Mock, Warning) << "Failed to drain eventfd";
+
+	signalled_ = 0;
+
+	while (!queue_.empty()) {
+		FrameBuffer *buffer = queue_.front();
+		queue_.pop_front();
+		completeBuffer(buffer, FrameMetadata::FrameCancelled);
+	}
+}
+
+void MockCameraData::queueBuffer(FrameBuffer *buffer)
+{
+	queue_.push_back(buffer);
+
+	/* Without a frame interval buffers complete immediately. */
+	if (interval_ == utils::duration::zero())
+		signalFrame();
+}
+
+void MockCameraData::signalFrame()
+{
+	uint64_t value = 1;
+
+	if (::write(eventFd_, &value, sizeof(value)) < 0) {
+		LOG(Mock, Error)
+			<< "Failed to signal frame: " << strerror(errno);
+		return;
+	}
+
+	signalled_++;
+}
+
+void MockCameraData::frameTimeout(Timer *timer)
+{
+	if (!streaming_)
+		return;
+
+	/* Frames captured without a queued buffer are dropped. */
+	if (queue_.size() > signalled_)
+		signalFrame();
+	else
+		sequence_++;
+
+	frameTimer_.start(frameTimer_.deadline() + interval_);
+}
+
+void MockCameraData::eventReady(EventNotifier *notifier)
+{
+	uint64_t count;
+
+	if (::read(eventFd_, &count, sizeof(count)) < 0)
+		return;
+
+	count = std::min<uint64_t>(count, queue_.size());
+	signalled_ -= count;
+
+	CpuScope scope(CameraStatistics::CpuPipeline, camera_);
+
+	while (count--) {
+		FrameBuffer *buffer = queue_.front();
+		queue_.pop_front();
+		completeBuffer(buffer, FrameMetadata::FrameSuccess);
+	}
+}
+
+void MockCameraData::completeBuffer(FrameBuffer *buffer,
+				    FrameMetadata::Status status)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	FrameMetadata metadata = buffer->metadata();
+	metadata.status = status;
+	metadata.sequence = sequence_++;
+	metadata.timestamp = ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+	BufferMetadata::setNumPlanes(&metadata, 1);
+	metadata.planes()[0].bytesused = buffer->planes()[0].length;
+
+	if (status == FrameMetadata::FrameSuccess && !replayFrames_.empty())
+		metadata.planes()[0].bytesused = replayFrame(buffer, metadata.sequence);
+
+	BufferMetadata::copy(buffer, metadata);
+
+	Request *request = buffer->request();
+
+	pipe_->completeBuffer(camera_, request, buffer);
+	pipe_->completeRequest(camera_, request);
+}
+
+/*
+ * Copy the planes of a replayed frame back to back into the buffer, truncated
+ * to the buffer size, and return the number of bytes copied.
+ */
+unsigned int MockCameraData::replayFrame(FrameBuffer *buffer,
+					 unsigned int sequence)
+{
+	const FrameBuffer::Plane &plane = buffer->planes()[0];
+	RawVideoFrame frame;
+
+	if (replay_.frame(replayFrames_[sequence % replayFrames_.size()], &frame))
+		return 0;
+
+	unsigned int offset = 0;
+	for (const Span<const uint8_t> &data : frame.planes) {
+		size_t length = std::min<size_t>(data.size(), plane.length - offset);
+		if (!length)
+			break;
+
+		ssize_t ret = pwrite(plane.fd.fd(), data.data(), length, offset);
+		if (ret < 0) {
+			LOG(Mock, Error)
+				<< "Failed to replay frame: " << strerror(errno);
+			return 0;
+		}
+
+		offset += ret;
+	}
+
+	return offset;
+}
+
+REGISTER_PIPELINE_HANDLER(PipelineHandlerMock);
+
+} /* namespace libcamera */
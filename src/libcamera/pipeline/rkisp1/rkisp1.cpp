@@ -8,22 +8,33 @@
 #include <algorithm>
 #include <array>
 #include <iomanip>
+#include <map>
 #include <memory>
 #include <queue>
+#include <set>
+#include <stdlib.h>
+#include <string>
+#include <vector>
 
 #include <linux/drm_fourcc.h>
 #include <linux/media-bus-format.h>
+#include <linux/v4l2-controls.h>
 
 #include <ipa/rkisp1.h>
 #include <libcamera/buffer.h>
 #include <libcamera/camera.h>
 #include <libcamera/control_ids.h>
+#include <libcamera/mapped_framebuffer.h>
 #include <libcamera/request.h>
 #include <libcamera/stream.h>
 
 #include "camera_sensor.h"
+#include "configuration_cache.h"
+#include "cpu_accounting.h"
+#include "delayed_controls.h"
 #include "device_enumerator.h"
 #include "ipa_manager.h"
+#include "ipa_recording.h"
 #include "log.h"
 #include "media_device.h"
 #include "pipeline_handler.h"
@@ -37,10 +48,19 @@ namespace libcamera {
 LOG_DEFINE_CATEGORY(RkISP1)
 
 class PipelineHandlerRkISP1;
-class RkISP1ActionQueueBuffers;
+class RkISP1CameraData;
+
+constexpr unsigned long MinPipelineDepth = 2;
+constexpr unsigned long MaxPipelineDepth = 16;
+
+/*
+ * Requests with a target capture time are handed to the pipeline handler this
+ * number of frames before the target, to leave time to program the sensor and
+ * the ISP for the target frame.
+ */
+constexpr unsigned int TargetLeadFrames = 4;
 
 enum RkISP1ActionType {
-	SetSensor,
 	SOE,
 	QueueBuffers,
 };
@@ -51,19 +71,34 @@ struct RkISP1FrameInfo {
 
 	FrameBuffer *paramBuffer;
 	FrameBuffer *statBuffer;
-	FrameBuffer *videoBuffer;
+	FrameBuffer *mainPathBuffer;
+	FrameBuffer *selfPathBuffer;
+	Rectangle scalerCrop;
 
+	bool statFromStream;
 	bool paramFilled;
 	bool paramDequeued;
 	bool metadataProcessed;
 };
 
+/*
+ * Track the frames in flight in a ring of preallocated RkISP1FrameInfo,
+ * indexed by frame number. The internal parameters and statistics buffers
+ * point back to the frame they're used for through a table indexed by the
+ * buffer cookie, to locate the frame of a buffer without a lookup. Buffers of
+ * the statistics stream belong to the application, they are located through
+ * their request instead.
+ */
 class RkISP1Frames
 {
 public:
 	RkISP1Frames(PipelineHandler *pipe);
 
-	RkISP1FrameInfo *create(unsigned int frame, Request *request, Stream *stream);
+	void init(unsigned int depth, unsigned int maxCookie);
+	void clear();
+
+	RkISP1FrameInfo *create(unsigned int frame, Request *request,
+				RkISP1CameraData *data);
 	int destroy(unsigned int frame);
 
 	RkISP1FrameInfo *find(unsigned int frame);
@@ -71,23 +106,98 @@ public:
 	RkISP1FrameInfo *find(Request *request);
 
 private:
+	RkISP1FrameInfo *slot(unsigned int frame)
+	{
+		return &frames_[frame & (frames_.size() - 1)];
+	}
+
 	PipelineHandlerRkISP1 *pipe_;
-	std::map<unsigned int, RkISP1FrameInfo *> frameInfo_;
+	std::vector<RkISP1FrameInfo> frames_;
+	std::vector<RkISP1FrameInfo *> buffers_;
 };
 
 class RkISP1Timeline : public Timeline
 {
 public:
 	RkISP1Timeline()
-		: Timeline()
+		: Timeline(), frameStartEvents_(false), frameStartSequence_(0),
+		  frameStartTime_(0), readoutSamples_(0), readoutMin_(0),
+		  readoutMax_(0)
 	{
-		setDelay(SetSensor, -1, 5);
-		setDelay(SOE, 0, -1);
-		setDelay(QueueBuffers, -1, 10);
+		setDefaultDelays();
+
+		/*
+		 * The LIBCAMERA_RKISP1_TIMELINE_CALIBRATION environment variable
+		 * enables the runtime calibration of the buffers queueing time
+		 * offset, based on the measured slack before the SOE.
+		 */
+		setCalibrated(QueueBuffers);
+		setCalibration(!!utils::secure_getenv("LIBCAMERA_RKISP1_TIMELINE_CALIBRATION"),
+			       std::chrono::milliseconds(2));
+	}
+
+	void reset() override
+	{
+		if (readoutSamples_)
+			LOG(RkISP1, Debug)
+				<< "SOE to buffer ready: " << readoutMin_ / 1000
+				<< "us - " << readoutMax_ / 1000 << "us over "
+				<< readoutSamples_ << " frames";
+
+		Timeline::reset();
+		frameStartEvents_ = false;
+		readoutSamples_ = 0;
+		readoutMin_ = 0;
+		readoutMax_ = 0;
+
+		/* Calibrated offsets only apply to the session they were measured in. */
+		setDefaultDelays();
+	}
+
+	void setFrameStartEvents(bool enable)
+	{
+		frameStartEvents_ = enable;
+	}
+
+	bool frameStartEvents() const { return frameStartEvents_; }
+
+	void frameStart(uint32_t sequence, uint64_t timestamp)
+	{
+		/*
+		 * The frame start event is generated by the ISP when it starts
+		 * receiving the frame, use it as the SOE reference.
+		 */
+		utils::time_point soe = std::chrono::time_point<utils::clock>()
+			+ std::chrono::nanoseconds(timestamp);
+
+		frameStartSequence_ = sequence;
+		frameStartTime_ = timestamp;
+
+		notifyStartOfExposure(sequence, soe);
 	}
 
 	void bufferReady(FrameBuffer *buffer)
 	{
+		/*
+		 * Frame start events, when available, provide a better SOE. Use
+		 * them to measure the time between the SOE and the end of DMA,
+		 * which the SOE estimate below relies on.
+		 */
+		if (frameStartEvents_) {
+			const FrameMetadata &metadata = buffer->metadata();
+			if (metadata.sequence != frameStartSequence_ ||
+			    metadata.timestamp < frameStartTime_)
+				return;
+
+			uint64_t readout = metadata.timestamp - frameStartTime_;
+			if (!readoutSamples_ || readout < readoutMin_)
+				readoutMin_ = readout;
+			if (readout > readoutMax_)
+				readoutMax_ = readout;
+			readoutSamples_++;
+			return;
+		}
+
 		/*
 		 * Calculate SOE by taking the end of DMA set by the kernel and applying
 		 * the time offsets provideprovided by the IPA to find the best estimate
@@ -108,6 +218,37 @@ public:
 		utils::duration delay = std::chrono::milliseconds(msdelay);
 		setRawDelay(type, frame, delay);
 	}
+
+private:
+	void setDefaultDelays()
+	{
+		setDelay(SOE, 0, -1);
+		setDelay(QueueBuffers, -1, 10);
+	}
+
+	bool frameStartEvents_;
+
+	uint32_t frameStartSequence_;
+	uint64_t frameStartTime_;
+
+	unsigned int readoutSamples_;
+	uint64_t readoutMin_;
+	uint64_t readoutMax_;
+};
+
+class RkISP1ActionQueueBuffers : public FrameAction
+{
+public:
+	RkISP1ActionQueueBuffers(RkISP1CameraData *data)
+		: FrameAction(QueueBuffers), data_(data)
+	{
+	}
+
+protected:
+	void run(unsigned int frame) override;
+
+private:
+	RkISP1CameraData *data_;
 };
 
 class RkISP1CameraData : public CameraData
@@ -115,7 +256,9 @@ class RkISP1CameraData : public CameraData
 public:
 	RkISP1CameraData(PipelineHandler *pipe)
 		: CameraData(pipe), sensor_(nullptr), frame_(0),
-		  frameInfo_(pipe)
+		  frameInfo_(pipe), queueBuffersAction_(this), pixelRate_(0),
+		  lineLength_(0), frameHeight_(0), vblank_(-1),
+		  statsInFlight_(false), pendingStats_(nullptr)
 	{
 	}
 
@@ -125,19 +268,65 @@ public:
 	}
 
 	int loadIPA();
-
-	Stream stream_;
+	int initFrameTiming(const Size &size);
+	void setFrameDuration(unsigned int frame, int64_t duration);
+	void setScalerCrop(const Rectangle &crop);
+	void statsReady(RkISP1FrameInfo *info);
+	void resetStats();
+	void unmapStatStreamBuffers();
+
+	Stream mainPathStream_;
+	Stream selfPathStream_;
+	Stream statStream_;
 	CameraSensor *sensor_;
 	unsigned int frame_;
 	std::vector<IPABuffer> ipaBuffers_;
+	/* IPA buffer ids of the statistics stream buffers, mapped on use. */
+	std::map<FrameBuffer *, unsigned int> statStreamIds_;
 	RkISP1Frames frameInfo_;
 	RkISP1Timeline timeline_;
+	RkISP1ActionQueueBuffers queueBuffersAction_;
+	std::unique_ptr<DelayedControls> delayedCtrls_;
+	std::queue<Request *> pendingRequests_;
+
+	/*
+	 * Sensor timings, to compute the vertical blanking for a frame
+	 * duration.
+	 */
+	int64_t pixelRate_;
+	unsigned int lineLength_;
+	unsigned int frameHeight_;
+	int32_t vblank_;
+
+	/*
+	 * Size of the frames output by the sensor, the crop requested by the
+	 * application, and the crop applied to the paths.
+	 */
+	Size sensorSize_;
+	Rectangle requestedCrop_;
+	Rectangle scalerCrop_;
+
+	/*
+	 * Configurations are validated through a const reference to the
+	 * camera data, the cache is thus mutable.
+	 */
+	mutable ConfigurationCache configCache_;
 
 private:
 	void queueFrameAction(unsigned int frame,
 			      const IPAOperationData &action);
 
+	void processStats(RkISP1FrameInfo *info);
+	void skipStats(RkISP1FrameInfo *info);
 	void metadataReady(unsigned int frame, const ControlList &metadata);
+	unsigned int statBufferId(RkISP1FrameInfo *info);
+
+	/*
+	 * Statistics handed to the IPA and not processed yet, and the most
+	 * recent statistics waiting for the IPA to catch up.
+	 */
+	bool statsInFlight_;
+	RkISP1FrameInfo *pendingStats_;
 };
 
 class RkISP1CameraConfiguration : public CameraConfiguration
@@ -148,10 +337,20 @@ public:
 	Status validate() override;
 
 	const V4L2SubdeviceFormat &sensorFormat() { return sensorFormat_; }
+	const std::vector<const Stream *> &streams() { return streams_; }
 
 private:
 	static constexpr unsigned int RKISP1_BUFFER_COUNT = 4;
 
+	static bool isStatStream(const StreamConfiguration &cfg)
+	{
+		return cfg.pixelFormat == V4L2_META_FMT_RK_ISP1_STAT_3A;
+	}
+
+	Status validateStreams();
+	Status adjustStream(StreamConfiguration &cfg, bool mainPath);
+	void updateTimings();
+
 	/*
 	 * The RkISP1CameraData instance is guaranteed to be valid as long as the
 	 * corresponding Camera instance is valid. In order to borrow a
@@ -161,6 +360,7 @@ private:
 	const RkISP1CameraData *data_;
 
 	V4L2SubdeviceFormat sensorFormat_;
+	std::vector<const Stream *> streams_;
 };
 
 class PipelineHandlerRkISP1 : public PipelineHandler
@@ -169,6 +369,8 @@ public:
 	PipelineHandlerRkISP1(CameraManager *manager);
 	~PipelineHandlerRkISP1();
 
+	int acquire(Camera *camera) override;
+
 	CameraConfiguration *generateConfiguration(Camera *camera,
 		const StreamRoles &roles) override;
 	int configure(Camera *camera, CameraConfiguration *config) override;
@@ -177,11 +379,17 @@ public:
 			       std::vector<std::unique_ptr<FrameBuffer>> *buffers) override;
 	int importFrameBuffers(Camera *camera, Stream *stream) override;
 	void freeFrameBuffers(Camera *camera, Stream *stream) override;
+	void bufferUsage(const Camera *camera,
+			 std::vector<BufferPoolUsage> *pools) override;
+	void stallReport(const Camera *camera, CameraStall *stall) override;
 
 	int start(Camera *camera) override;
-	void stop(Camera *camera) override;
+	void stopDevice(Camera *camera) override;
+	void release(Camera *camera) override;
 
 	int queueRequestDevice(Camera *camera, Request *request) override;
+	utils::time_point targetQueueTime(Camera *camera,
+					  utils::time_point target) override;
 
 	bool match(DeviceEnumerator *enumerator) override;
 
@@ -196,12 +404,22 @@ private:
 	friend RkISP1CameraData;
 	friend RkISP1Frames;
 
+	V4L2VideoDevice *videoDevice(RkISP1CameraData *data, const Stream *stream)
+	{
+		return stream == &data->mainPathStream_ ? mainPath_ : selfPath_;
+	}
+
 	int initLinks();
+	int configurePath(V4L2VideoDevice *video, StreamConfiguration *cfg);
 	int createCamera(MediaEntity *sensor);
+	void queuePendingRequests(RkISP1CameraData *data);
+	void queueBuffers(RkISP1FrameInfo *info);
 	void tryCompleteRequest(Request *request);
+	void frameStart(uint32_t sequence, uint64_t timestamp);
 	void bufferReady(FrameBuffer *buffer);
 	void paramReady(FrameBuffer *buffer);
 	void statReady(FrameBuffer *buffer);
+	void recordStats(RkISP1CameraData *data, RkISP1FrameInfo *info);
 
 	int allocateBuffers(Camera *camera);
 	int freeBuffers(Camera *camera);
@@ -209,16 +427,37 @@ private:
 	MediaDevice *media_;
 	V4L2Subdevice *dphy_;
 	V4L2Subdevice *isp_;
-	V4L2VideoDevice *video_;
+	V4L2VideoDevice *mainPath_;
+	V4L2VideoDevice *selfPath_;
 	V4L2VideoDevice *param_;
 	V4L2VideoDevice *stat_;
 
+	MediaLink *dphyLink_;
+	MediaLink *mainPathLink_;
+	MediaLink *selfPathLink_;
+
 	std::vector<std::unique_ptr<FrameBuffer>> paramBuffers_;
 	std::vector<std::unique_ptr<FrameBuffer>> statBuffers_;
 	std::queue<FrameBuffer *> availableParamBuffers_;
 	std::queue<FrameBuffer *> availableStatBuffers_;
 
 	Camera *activeCamera_;
+	/*
+	 * The camera the parameters and statistics buffers are allocated for.
+	 * They are kept across stop() and start() until the camera is
+	 * reconfigured or released.
+	 */
+	Camera *buffersCamera_;
+	bool mainPathActive_;
+	bool selfPathActive_;
+	bool statStreamActive_;
+
+	unsigned int pipelineDepth_;
+	bool lowLatency_;
+
+	std::string recordPath_;
+	IPARecordingWriter recorder_;
+	MappedBufferCache statMappings_;
 };
 
 RkISP1Frames::RkISP1Frames(PipelineHandler *pipe)
@@ -226,42 +465,105 @@ RkISP1Frames::RkISP1Frames(PipelineHandler *pipe)
 {
 }
 
-RkISP1FrameInfo *RkISP1Frames::create(unsigned int frame, Request *request, Stream *stream)
+/*
+ * Preallocate the ring for \a depth frames in flight, and the back-pointers
+ * table for internal buffers with cookies lower than \a maxCookie.
+ *
+ * Frame numbers follow the sensor sequence and may skip values, the ring is
+ * thus sized with headroom to avoid collisions between frames in flight.
+ */
+void RkISP1Frames::init(unsigned int depth, unsigned int maxCookie)
+{
+	unsigned int size = 1;
+	while (size < depth * 2)
+		size <<= 1;
+
+	frames_.assign(size, RkISP1FrameInfo{});
+	buffers_.assign(maxCookie, nullptr);
+}
+
+void RkISP1Frames::clear()
 {
+	frames_.clear();
+	buffers_.clear();
+}
+
+RkISP1FrameInfo *RkISP1Frames::create(unsigned int frame, Request *request,
+				      RkISP1CameraData *data)
+{
+	if (frames_.empty())
+		return nullptr;
+
+	RkISP1FrameInfo *info = slot(frame);
+	if (info->request) {
+		LOG(RkISP1, Debug)
+			<< "Frame " << frame << " collides with frame "
+			<< info->frame << " in flight";
+		return nullptr;
+	}
+
 	if (pipe_->availableParamBuffers_.empty()) {
 		LOG(RkISP1, Error) << "Parameters buffer underrun";
 		return nullptr;
 	}
 	FrameBuffer *paramBuffer = pipe_->availableParamBuffers_.front();
 
-	if (pipe_->availableStatBuffers_.empty()) {
-		LOG(RkISP1, Error) << "Statisitc buffer underrun";
-		return nullptr;
+	FrameBuffer *mainPathBuffer = request->findBuffer(&data->mainPathStream_);
+	FrameBuffer *selfPathBuffer = request->findBuffer(&data->selfPathStream_);
+
+	/*
+	 * The ISP writes the statistics to the buffer of the statistics stream
+	 * when the request has one, and to an internal buffer otherwise.
+	 */
+	FrameBuffer *statBuffer = request->findBuffer(&data->statStream_);
+	if (statBuffer &&
+	    statBuffer->metadata().status == FrameMetadata::FrameSkipped)
+		statBuffer = nullptr;
+
+	bool statFromStream = statBuffer != nullptr;
+	if (!statFromStream) {
+		if (pipe_->availableStatBuffers_.empty()) {
+			LOG(RkISP1, Error) << "Statisitc buffer underrun";
+			return nullptr;
+		}
+		statBuffer = pipe_->availableStatBuffers_.front();
 	}
-	FrameBuffer *statBuffer = pipe_->availableStatBuffers_.front();
 
-	FrameBuffer *videoBuffer = request->findBuffer(stream);
-	if (!videoBuffer) {
+	/*
+	 * Buffers skipped by the stream decimation are not queued, the
+	 * corresponding path doesn't write the frame to memory.
+	 */
+	if (mainPathBuffer &&
+	    mainPathBuffer->metadata().status == FrameMetadata::FrameSkipped)
+		mainPathBuffer = nullptr;
+	if (selfPathBuffer &&
+	    selfPathBuffer->metadata().status == FrameMetadata::FrameSkipped)
+		selfPathBuffer = nullptr;
+
+	if (!mainPathBuffer && !selfPathBuffer) {
 		LOG(RkISP1, Error)
 			<< "Attempt to queue request with invalid stream";
 		return nullptr;
 	}
 
 	pipe_->availableParamBuffers_.pop();
-	pipe_->availableStatBuffers_.pop();
-
-	RkISP1FrameInfo *info = new RkISP1FrameInfo;
+	if (!statFromStream)
+		pipe_->availableStatBuffers_.pop();
 
 	info->frame = frame;
 	info->request = request;
 	info->paramBuffer = paramBuffer;
-	info->videoBuffer = videoBuffer;
+	info->mainPathBuffer = mainPathBuffer;
+	info->selfPathBuffer = selfPathBuffer;
 	info->statBuffer = statBuffer;
+	info->statFromStream = statFromStream;
 	info->paramFilled = false;
 	info->paramDequeued = false;
 	info->metadataProcessed = false;
 
-	frameInfo_[frame] = info;
+	buffers_[paramBuffer->cookie()] = info;
+	if (!statFromStream)
+		buffers_[statBuffer->cookie()] = info;
 
 	return info;
 }
@@ -273,21 +575,25 @@ int RkISP1Frames::destroy(unsigned int frame)
 		return -ENOENT;
 
 	pipe_->availableParamBuffers_.push(info->paramBuffer);
-	pipe_->availableStatBuffers_.push(info->statBuffer);
+	buffers_[info->paramBuffer->cookie()] = nullptr;
 
-	frameInfo_.erase(info->frame);
+	if (!info->statFromStream) {
+		pipe_->availableStatBuffers_.push(info->statBuffer);
+		buffers_[info->statBuffer->cookie()] = nullptr;
+	}
 
-	delete info;
+	*info = RkISP1FrameInfo{};
 
 	return 0;
 }
 
 RkISP1FrameInfo *RkISP1Frames::find(unsigned int frame)
 {
-	auto itInfo = frameInfo_.find(frame);
-
-	if (itInfo != frameInfo_.end())
-		return itInfo->second;
+	if (!frames_.empty()) {
+		RkISP1FrameInfo *info = slot(frame);
+		if (info->request && info->frame == frame)
+			return info;
+	}
 
 	LOG(RkISP1, Error) << "Can't locate info from frame";
 	return nullptr;
@@ -295,12 +601,20 @@ RkISP1FrameInfo *RkISP1Frames::find(unsigned int frame)
 
 RkISP1FrameInfo *RkISP1Frames::find(FrameBuffer *buffer)
 {
-	for (auto &itInfo : frameInfo_) {
-		RkISP1FrameInfo *info = itInfo.second;
+	/* Internal buffers point back to their frame. */
+	if (buffer->cookie() < buffers_.size()) {
+		RkISP1FrameInfo *info = buffers_[buffer->cookie()];
+		if (info && (info->paramBuffer == buffer ||
+			     info->statBuffer == buffer))
+			return info;
+	}
 
-		if (info->paramBuffer == buffer ||
-		    info->statBuffer == buffer ||
-		    info->videoBuffer == buffer)
+	/* Application buffers are located through their request. */
+	if (buffer->request()) {
+		RkISP1FrameInfo *info = find(buffer->request());
+		if (info && (info->mainPathBuffer == buffer ||
+			     info->selfPathBuffer == buffer ||
+			     info->statBuffer == buffer))
 			return info;
 	}
 
@@ -310,65 +624,27 @@ RkISP1FrameInfo *RkISP1Frames::find(FrameBuffer *buffer)
 
 RkISP1FrameInfo *RkISP1Frames::find(Request *request)
 {
-	for (auto &itInfo : frameInfo_) {
-		RkISP1FrameInfo *info = itInfo.second;
-
-		if (info->request == request)
-			return info;
+	/* The ring is small, scan it without an additional index. */
+	for (RkISP1FrameInfo &info : frames_) {
+		if (info.request == request)
+			return &info;
 	}
 
 	LOG(RkISP1, Error) << "Can't locate info from request";
 	return nullptr;
 }
 
-class RkISP1ActionSetSensor : public FrameAction
-{
-public:
-	RkISP1ActionSetSensor(unsigned int frame, CameraSensor *sensor, const ControlList &controls)
-		: FrameAction(frame, SetSensor), sensor_(sensor), controls_(controls) {}
-
-protected:
-	void run() override
-	{
-		sensor_->setControls(&controls_);
-	}
-
-private:
-	CameraSensor *sensor_;
-	ControlList controls_;
-};
-
-class RkISP1ActionQueueBuffers : public FrameAction
+void RkISP1ActionQueueBuffers::run(unsigned int frame)
 {
-public:
-	RkISP1ActionQueueBuffers(unsigned int frame, RkISP1CameraData *data,
-				 PipelineHandlerRkISP1 *pipe)
-		: FrameAction(frame, QueueBuffers), data_(data), pipe_(pipe)
-	{
-	}
-
-protected:
-	void run() override
-	{
-		RkISP1FrameInfo *info = data_->frameInfo_.find(frame());
-		if (!info)
-			LOG(RkISP1, Fatal) << "Frame not known";
-
-		if (info->paramFilled)
-			pipe_->param_->queueBuffer(info->paramBuffer);
-		else
-			LOG(RkISP1, Error)
-				<< "Parameters not ready on time for frame "
-				<< frame() << ", ignore parameters.";
+	PipelineHandlerRkISP1 *pipe =
+		static_cast<PipelineHandlerRkISP1 *>(data_->pipe_);
 
-		pipe_->stat_->queueBuffer(info->statBuffer);
-		pipe_->video_->queueBuffer(info->videoBuffer);
-	}
+	RkISP1FrameInfo *info = data_->frameInfo_.find(frame);
+	if (!info)
+		LOG(RkISP1, Fatal) << "Frame not known";
 
-private:
-	RkISP1CameraData *data_;
-	PipelineHandlerRkISP1 *pipe_;
-};
+	pipe->queueBuffers(info);
+}
 
 int RkISP1CameraData::loadIPA()
 {
@@ -387,27 +663,245 @@ void RkISP1CameraData::queueFrameAction(unsigned int frame,
 {
 	switch (action.operation) {
 	case RKISP1_IPA_ACTION_V4L2_SET: {
-		const ControlList &controls = action.controls[0];
-		timeline_.scheduleAction(std::make_unique<RkISP1ActionSetSensor>(frame,
-										 sensor_,
-										 controls));
+		RkISP1ActionV4L2Set set;
+		if (set.unpack(action))
+			break;
+
+		delayedCtrls_->push(frame, *set.sensorControls);
 		break;
 	}
 	case RKISP1_IPA_ACTION_PARAM_FILLED: {
+		PipelineHandlerRkISP1 *pipe =
+			static_cast<PipelineHandlerRkISP1 *>(pipe_);
 		RkISP1FrameInfo *info = frameInfo_.find(frame);
-		if (info)
-			info->paramFilled = true;
+		if (!info)
+			break;
+
+		info->paramFilled = true;
+
+		/* In low-latency mode, queue the buffers without delay. */
+		if (pipe->lowLatency_)
+			pipe->queueBuffers(info);
 		break;
 	}
-	case RKISP1_IPA_ACTION_METADATA:
-		metadataReady(frame, action.controls[0]);
+	case RKISP1_IPA_ACTION_METADATA: {
+		RkISP1ActionMetadata metadata;
+		if (metadata.unpack(action))
+			break;
+
+		metadataReady(frame, *metadata.metadata);
+
+		/* Hand the most recent statistics to the IPA. */
+		statsInFlight_ = false;
+		RkISP1FrameInfo *info = pendingStats_;
+		if (info) {
+			pendingStats_ = nullptr;
+			processStats(info);
+		}
 		break;
+	}
 	default:
 		LOG(RkISP1, Error) << "Unkown action " << action.operation;
 		break;
 	}
 }
 
+/*
+ * Hand the statistics of a frame to the IPA. When the IPA is slower than the
+ * frame rate, statistics would pile up in its event queue, and its decisions
+ * would be based on increasingly outdated frames. Only one statistics buffer
+ * is thus processed by the IPA at a time. Statistics that become available in
+ * the meantime replace each other, and only the most recent ones are handed to
+ * the IPA when it completes. The frames of the skipped statistics complete
+ * immediately, without the metadata computed by the IPA, which returns their
+ * statistics buffer to the device.
+ */
+void RkISP1CameraData::statsReady(RkISP1FrameInfo *info)
+{
+	if (!statsInFlight_) {
+		processStats(info);
+		return;
+	}
+
+	if (pendingStats_)
+		skipStats(pendingStats_);
+
+	pendingStats_ = info;
+}
+
+/*
+ * Forget about the statistics handed to the IPA, to be called when starting
+ * the camera as the IPA doesn't process events across stop and start.
+ */
+void RkISP1CameraData::resetStats()
+{
+	statsInFlight_ = false;
+	pendingStats_ = nullptr;
+}
+
+void RkISP1CameraData::processStats(RkISP1FrameInfo *info)
+{
+	statsInFlight_ = true;
+
+	ControlList sensorControls = delayedCtrls_->get(info->frame);
+
+	/* Let the IPA skip the metadata the application doesn't need. */
+	RkISP1EventSignalStatBuffer event;
+	event.frame = info->frame;
+	event.bufferId = statBufferId(info);
+	event.reportAeState = info->request->metadataEnabled(controls::AeLocked);
+	event.sensorControls = &sensorControls;
+
+	CpuScope scope(CameraStatistics::CpuIPA, camera_);
+	ipa_->processEvent(event.pack());
+}
+
+void RkISP1CameraData::skipStats(RkISP1FrameInfo *info)
+{
+	LOG(RkISP1, Debug)
+		<< "IPA running late, skipping statistics of frame "
+		<< info->frame;
+
+	pipe_->statisticsSkipped(camera_);
+	metadataReady(info->frame, ControlList(controls::controls));
+}
+
+/*
+ * Retrieve the IPA id of the statistics buffer of a frame. Buffers of the
+ * statistics stream are provided by the application and can't be mapped to
+ * the IPA in advance, they are mapped the first time they're used, with ids
+ * following the ones of the internal buffers.
+ */
+unsigned int RkISP1CameraData::statBufferId(RkISP1FrameInfo *info)
+{
+	FrameBuffer *buffer = info->statBuffer;
+	if (!info->statFromStream)
+		return buffer->cookie();
+
+	auto it = statStreamIds_.find(buffer);
+	if (it != statStreamIds_.end())
+		return it->second;
+
+	Span<const FrameBuffer::Plane> planes = buffer->planes();
+	IPABuffer ipaBuffer{ .id = ipaBuffers_.back().id + 1,
+			     .planes = { planes.begin(), planes.end() } };
+
+	ipa_->mapBuffers({ ipaBuffer });
+	ipaBuffers_.push_back(ipaBuffer);
+	statStreamIds_[buffer] = ipaBuffer.id;
+
+	return ipaBuffer.id;
+}
+
+/*
+ * Unmap the buffers of the statistics stream from the IPA, when they're freed
+ * by the application.
+ */
+void RkISP1CameraData::unmapStatStreamBuffers()
+{
+	if (statStreamIds_.empty())
+		return;
+
+	std::vector<unsigned int> ids;
+	for (const auto &it : statStreamIds_) {
+		ids.push_back(it.second);
+		ipaBuffers_.erase(std::remove_if(ipaBuffers_.begin(), ipaBuffers_.end(),
+						 [&](const IPABuffer &ipaBuffer) {
+							 return ipaBuffer.id == it.second;
+						 }),
+				  ipaBuffers_.end());
+	}
+
+	ipa_->unmapBuffers(ids);
+	statStreamIds_.clear();
+}
+
+/*
+ * Retrieve the sensor pixel rate and horizontal blanking for a sensor output
+ * size, from which the frame duration is controlled through the vertical
+ * blanking. Sensors that don't expose those controls can't control the frame
+ * duration.
+ */
+int RkISP1CameraData::initFrameTiming(const Size &size)
+{
+	const ControlInfoMap &infoMap = sensor_->controls();
+
+	pixelRate_ = 0;
+	vblank_ = -1;
+
+	if (infoMap.find(V4L2_CID_PIXEL_RATE) == infoMap.end() ||
+	    infoMap.find(V4L2_CID_HBLANK) == infoMap.end() ||
+	    infoMap.find(V4L2_CID_VBLANK) == infoMap.end())
+		return -ENOTTY;
+
+	ControlList ctrls(infoMap);
+	ctrls.set(V4L2_CID_PIXEL_RATE, static_cast<int64_t>(0));
+	ctrls.set(V4L2_CID_HBLANK, 0);
+	ctrls.set(V4L2_CID_VBLANK, 0);
+
+	int ret = sensor_->getControls(&ctrls);
+	if (ret)
+		return ret;
+
+	int64_t pixelRate = ctrls.get(V4L2_CID_PIXEL_RATE).get<int64_t>();
+	if (pixelRate <= 0)
+		return -EINVAL;
+
+	pixelRate_ = pixelRate;
+	lineLength_ = size.width + ctrls.get(V4L2_CID_HBLANK).get<int32_t>();
+	frameHeight_ = size.height;
+	vblank_ = ctrls.get(V4L2_CID_VBLANK).get<int32_t>();
+
+	return 0;
+}
+
+/*
+ * Schedule the vertical blanking corresponding to a frame duration in
+ * microseconds, clamped to the range supported by the sensor, to be applied
+ * for a frame.
+ */
+void RkISP1CameraData::setFrameDuration(unsigned int frame, int64_t duration)
+{
+	if (!pixelRate_)
+		return;
+
+	const ControlRange &range =
+		sensor_->controls().find(V4L2_CID_VBLANK)->second;
+	int64_t lines = duration * pixelRate_ / (lineLength_ * 1000000LL);
+	int32_t vblank = utils::clamp<int64_t>(lines - frameHeight_,
+					       range.min().get<int32_t>(),
+					       range.max().get<int32_t>());
+	if (vblank == vblank_)
+		return;
+
+	vblank_ = vblank;
+
+	ControlList ctrls(sensor_->controls());
+	ctrls.set(V4L2_CID_VBLANK, vblank);
+	delayedCtrls_->push(frame, ctrls);
+}
+
+/*
+ * Store the crop requested by the application, clipped to the sensor output
+ * and aligned to the dual crop unit constraints, to be applied to the frames
+ * queued from now on.
+ */
+void RkISP1CameraData::setScalerCrop(const Rectangle &crop)
+{
+	static constexpr unsigned int MinCropWidth = 32;
+	static constexpr unsigned int MinCropHeight = 16;
+
+	Rectangle rect;
+	rect.x = utils::clamp<int>(crop.x, 0, sensorSize_.width - MinCropWidth) & ~1;
+	rect.y = utils::clamp<int>(crop.y, 0, sensorSize_.height - MinCropHeight) & ~1;
+	rect.w = utils::clamp<unsigned int>(crop.w, MinCropWidth,
+					    sensorSize_.width - rect.x) & ~1;
+	rect.h = utils::clamp<unsigned int>(crop.h, MinCropHeight,
+					    sensorSize_.height - rect.y) & ~1;
+
+	requestedCrop_ = rect;
+}
+
 void RkISP1CameraData::metadataReady(unsigned int frame, const ControlList &metadata)
 {
 	PipelineHandlerRkISP1 *pipe =
@@ -417,10 +911,51 @@ void RkISP1CameraData::metadataReady(unsigned int frame, const ControlList &meta
 	if (!info)
 		return;
 
-	info->request->metadata() = metadata;
+	Request *request = info->request;
+	request->metadata() = metadata;
 	info->metadataProcessed = true;
+	pipe->ipaCompleted(request);
+
+	/*
+	 * The IPA is done with the statistics, hand the buffer of the
+	 * statistics stream over to the application, which holds it until it
+	 * queues it again.
+	 */
+	if (info->statFromStream)
+		pipe->completeBuffer(camera_, request, info->statBuffer);
+
+	/* Report the sensor configuration the frame was captured with. */
+	ControlList &requestMetadata = request->metadata();
+	bool gain = request->metadataEnabled(controls::ManualGain);
+	bool exposure = request->metadataEnabled(controls::ManualExposure);
+	bool duration = request->metadataEnabled(controls::FrameDuration);
+
+	ControlList sensorCtrls;
+	if (gain || exposure || duration)
+		sensorCtrls = delayedCtrls_->get(frame);
+
+	if (gain && sensorCtrls.contains(V4L2_CID_ANALOGUE_GAIN))
+		requestMetadata.set(controls::ManualGain,
+				    sensorCtrls.get(V4L2_CID_ANALOGUE_GAIN).get<int32_t>());
+
+	if (pixelRate_) {
+		if (exposure && sensorCtrls.contains(V4L2_CID_EXPOSURE)) {
+			int64_t exposure = sensorCtrls.get(V4L2_CID_EXPOSURE).get<int32_t>();
+			requestMetadata.set(controls::ManualExposure,
+					    static_cast<int32_t>(exposure * lineLength_ * 1000 / pixelRate_));
+		}
+
+		if (duration && sensorCtrls.contains(V4L2_CID_VBLANK)) {
+			int64_t lines = frameHeight_ + sensorCtrls.get(V4L2_CID_VBLANK).get<int32_t>();
+			requestMetadata.set(controls::FrameDuration,
+					    static_cast<int64_t>(lines * lineLength_ * 1000000LL / pixelRate_));
+		}
+	}
 
-	pipe->tryCompleteRequest(info->request);
+	if (request->metadataEnabled(controls::ScalerCrop))
+		requestMetadata.set(controls::ScalerCrop, info->scalerCrop);
+
+	pipe->tryCompleteRequest(request);
 }
 
 RkISP1CameraConfiguration::RkISP1CameraConfiguration(Camera *camera,
@@ -431,9 +966,10 @@ RkISP1CameraConfiguration::RkISP1CameraConfiguration(Camera *camera,
 	data_ = data;
 }
 
-CameraConfiguration::Status RkISP1CameraConfiguration::validate()
+CameraConfiguration::Status RkISP1CameraConfiguration::adjustStream(StreamConfiguration &cfg,
+								bool mainPath)
 {
-	static const std::array<unsigned int, 8> formats{
+	static const std::array<unsigned int, 7> formats{
 		DRM_FORMAT_YUYV,
 		DRM_FORMAT_YVYU,
 		DRM_FORMAT_VYUY,
@@ -444,29 +980,136 @@ CameraConfiguration::Status RkISP1CameraConfiguration::validate()
 		/* \todo Add support for 8-bit greyscale to DRM formats */
 	};
 
+	/* The self path resizer output is limited to 1920x1920. */
+	const Size maxSize = mainPath ? Size{ 4416, 3312 } : Size{ 1920, 1920 };
+	Status status = Valid;
+
+	/* Adjust the pixel format. */
+	if (std::find(formats.begin(), formats.end(), cfg.pixelFormat) ==
+	    formats.end()) {
+		LOG(RkISP1, Debug) << "Adjusting format to NV12";
+		cfg.pixelFormat = DRM_FORMAT_NV12,
+		status = Adjusted;
+	}
+
+	/*
+	 * Provide a suitable default that matches the sensor aspect
+	 * ratio and clamp the size to the hardware bounds.
+	 *
+	 * \todo: Check the hardware alignment constraints.
+	 */
+	const Size size = cfg.size;
+
+	if (!cfg.size.width || !cfg.size.height) {
+		cfg.size.width = 1280;
+		cfg.size.height = 1280 * sensorFormat_.size.height
+				/ sensorFormat_.size.width;
+	}
+
+	cfg.size.width = std::max(32U, std::min(maxSize.width, cfg.size.width));
+	cfg.size.height = std::max(16U, std::min(maxSize.height, cfg.size.height));
+
+	if (cfg.size != size) {
+		LOG(RkISP1, Debug)
+			<< "Adjusting size from " << size.toString()
+			<< " to " << cfg.size.toString();
+		status = Adjusted;
+	}
+
+	cfg.bufferCount = RKISP1_BUFFER_COUNT;
+
+	return status;
+}
+
+CameraConfiguration::Status RkISP1CameraConfiguration::validate()
+{
+	ConfigurationCache::Result result;
+
+	if (data_->configCache_.find(config_, &result)) {
+		sensorFormat_ = result.sensorFormat;
+		streams_ = result.streams;
+		updateTimings();
+		return result.status;
+	}
+
+	const std::vector<StreamConfiguration> request = config_;
+	Status status = validateStreams();
+	if (status == Invalid)
+		return status;
+
+	result.status = status;
+	result.sensorFormat = sensorFormat_;
+	result.streams = streams_;
+	data_->configCache_.insert(request, config_, result);
+
+	updateTimings();
+	return status;
+}
+
+/*
+ * The ISP processes frames inline as the sensor outputs them, the timings are
+ * those of the sensor mode and the streams don't stall.
+ */
+void RkISP1CameraConfiguration::updateTimings()
+{
+	const CameraSensor::Mode *mode = data_->sensor_->mode(sensorFormat_);
+
+	minFrameDuration = mode ? mode->minFrameDuration : 0;
+	maxFrameDuration = mode ? mode->maxFrameDuration : 0;
+
+	for (StreamConfiguration &cfg : config_)
+		cfg.stallDuration = 0;
+}
+
+CameraConfiguration::Status RkISP1CameraConfiguration::validateStreams()
+{
 	const CameraSensor *sensor = data_->sensor_;
 	Status status = Valid;
 
 	if (config_.empty())
 		return Invalid;
 
-	/* Cap the number of entries to the available streams. */
-	if (config_.size() > 1) {
-		config_.resize(1);
-		status = Adjusted;
+	/*
+	 * Cap the number of entries to the available streams, two image
+	 * streams and the statistics stream, selected by its format.
+	 */
+	unsigned int imageStreams = 0;
+	bool statStream = false;
+
+	for (auto it = config_.begin(); it != config_.end();) {
+		bool stats = isStatStream(*it);
+		if (stats ? statStream : imageStreams == 2) {
+			it = config_.erase(it);
+			status = Adjusted;
+			continue;
+		}
+
+		if (stats)
+			statStream = true;
+		else
+			imageStreams++;
+		++it;
 	}
 
-	StreamConfiguration &cfg = config_[0];
+	/* The statistics are only captured along with an image. */
+	if (!imageStreams)
+		return Invalid;
 
-	/* Adjust the pixel format. */
-	if (std::find(formats.begin(), formats.end(), cfg.pixelFormat) ==
-	    formats.end()) {
-		LOG(RkISP1, Debug) << "Adjusting format to NV12";
-		cfg.pixelFormat = DRM_FORMAT_NV12,
-		status = Adjusted;
+	/*
+	 * Select the sensor format by collecting the maximum width and height
+	 * of all streams, as both paths scale the same ISP output.
+	 */
+	Size size = {};
+
+	for (const StreamConfiguration &cfg : config_) {
+		if (isStatStream(cfg))
+			continue;
+		if (cfg.size.width > size.width)
+			size.width = cfg.size.width;
+		if (cfg.size.height > size.height)
+			size.height = cfg.size.height;
 	}
 
-	/* Select the sensor format. */
 	sensorFormat_ = sensor->getFormat({ MEDIA_BUS_FMT_SBGGR12_1X12,
 					    MEDIA_BUS_FMT_SGBRG12_1X12,
 					    MEDIA_BUS_FMT_SGRBG12_1X12,
@@ -479,50 +1122,115 @@ CameraConfiguration::Status RkISP1CameraConfiguration::validate()
 					    MEDIA_BUS_FMT_SGBRG8_1X8,
 					    MEDIA_BUS_FMT_SGRBG8_1X8,
 					    MEDIA_BUS_FMT_SRGGB8_1X8 },
-					  cfg.size);
+					  size);
 	if (!sensorFormat_.size.width || !sensorFormat_.size.height)
 		sensorFormat_.size = sensor->resolution();
 
 	/*
-	 * Provide a suitable default that matches the sensor aspect
-	 * ratio and clamp the size to the hardware bounds.
-	 *
-	 * \todo: Check the hardware alignment constraints.
+	 * Assign the main path to the largest stream, as only the main path
+	 * can output resolutions larger than 1920x1920, and the self path to
+	 * the other stream.
 	 */
-	const Size size = cfg.size;
+	unsigned int mainPathIndex = isStatStream(config_[0]) ? 1 : 0;
+	for (unsigned int i = mainPathIndex + 1; i < config_.size(); ++i) {
+		if (isStatStream(config_[i]))
+			continue;
 
-	if (!cfg.size.width || !cfg.size.height) {
-		cfg.size.width = 1280;
-		cfg.size.height = 1280 * sensorFormat_.size.height
-				/ sensorFormat_.size.width;
+		const Size &cfgSize = config_[i].size;
+		const Size &mainSize = config_[mainPathIndex].size;
+
+		if (cfgSize.width * cfgSize.height > mainSize.width * mainSize.height)
+			mainPathIndex = i;
 	}
 
-	cfg.size.width = std::max(32U, std::min(4416U, cfg.size.width));
-	cfg.size.height = std::max(16U, std::min(3312U, cfg.size.height));
+	streams_.clear();
+	streams_.reserve(config_.size());
 
-	if (cfg.size != size) {
-		LOG(RkISP1, Debug)
-			<< "Adjusting size from " << size.toString()
-			<< " to " << cfg.size.toString();
-		status = Adjusted;
-	}
+	for (unsigned int i = 0; i < config_.size(); ++i) {
+		StreamConfiguration &cfg = config_[i];
+
+		/*
+		 * The statistics stream has no size, its buffers are sized by
+		 * the statistics device.
+		 */
+		if (isStatStream(cfg)) {
+			if (cfg.size != Size{} ||
+			    cfg.memory != FrameBuffer::MemoryDmaBuf) {
+				cfg.size = {};
+				cfg.memory = FrameBuffer::MemoryDmaBuf;
+				status = Adjusted;
+			}
+
+			cfg.bufferCount = RKISP1_BUFFER_COUNT;
+			streams_.push_back(&data_->statStream_);
+			continue;
+		}
+
+		bool mainPath = i == mainPathIndex;
+		const Stream *stream = mainPath ? &data_->mainPathStream_
+						: &data_->selfPathStream_;
+
+		LOG(RkISP1, Debug)
+			<< "Assigned " << (mainPath ? "main" : "self")
+			<< " path to stream " << i;
 
-	cfg.bufferCount = RKISP1_BUFFER_COUNT;
+		if (adjustStream(config_[i], mainPath) == Adjusted)
+			status = Adjusted;
+
+		if (config_[i].memory != FrameBuffer::MemoryDmaBuf) {
+			LOG(RkISP1, Debug)
+				<< "Stream " << i << " doesn't support user pointers";
+			config_[i].memory = FrameBuffer::MemoryDmaBuf;
+			status = Adjusted;
+		}
+
+		streams_.push_back(stream);
+	}
 
 	return status;
 }
 
 PipelineHandlerRkISP1::PipelineHandlerRkISP1(CameraManager *manager)
 	: PipelineHandler(manager), dphy_(nullptr), isp_(nullptr),
-	  video_(nullptr), param_(nullptr), stat_(nullptr)
+	  mainPath_(nullptr), selfPath_(nullptr), param_(nullptr),
+	  stat_(nullptr), dphyLink_(nullptr), mainPathLink_(nullptr),
+	  selfPathLink_(nullptr), activeCamera_(nullptr), buffersCamera_(nullptr),
+	  mainPathActive_(false), selfPathActive_(false),
+	  statStreamActive_(false), pipelineDepth_(0)
 {
+	/*
+	 * The number of frames in flight defaults to the number of buffers of
+	 * the stream, and can be overridden with the
+	 * LIBCAMERA_RKISP1_PIPELINE_DEPTH environment variable. The
+	 * LIBCAMERA_RKISP1_LOW_LATENCY environment variable selects the
+	 * low-latency mode, which runs with the minimum depth and queues
+	 * buffers to the device as soon as their parameters are filled, to
+	 * minimize the capture latency at the expense of throughput.
+	 *
+	 * The LIBCAMERA_RKISP1_RECORD environment variable names a file to
+	 * record the statistics and sensor controls of all captured frames
+	 * to, for offline replay of the IPA.
+	 */
+	const char *depth = utils::secure_getenv("LIBCAMERA_RKISP1_PIPELINE_DEPTH");
+	if (depth) {
+		unsigned long value = strtoul(depth, nullptr, 10);
+		pipelineDepth_ = std::min(std::max(value, MinPipelineDepth),
+					  MaxPipelineDepth);
+	}
+
+	lowLatency_ = !!utils::secure_getenv("LIBCAMERA_RKISP1_LOW_LATENCY");
+
+	const char *record = utils::secure_getenv("LIBCAMERA_RKISP1_RECORD");
+	if (record)
+		recordPath_ = record;
 }
 
 PipelineHandlerRkISP1::~PipelineHandlerRkISP1()
 {
 	delete param_;
 	delete stat_;
-	delete video_;
+	delete selfPath_;
+	delete mainPath_;
 	delete isp_;
 	delete dphy_;
 }
@@ -531,6 +1239,19 @@ PipelineHandlerRkISP1::~PipelineHandlerRkISP1()
  * Pipeline Operations
  */
 
+int PipelineHandlerRkISP1::acquire(Camera *camera)
+{
+	RkISP1CameraData *data = cameraData(camera);
+	if (data->ipa_)
+		return 0;
+
+	int ret = data->loadIPA();
+	if (ret)
+		LOG(RkISP1, Error) << "Failed to load IPA";
+
+	return ret;
+}
+
 CameraConfiguration *PipelineHandlerRkISP1::generateConfiguration(Camera *camera,
 	const StreamRoles &roles)
 {
@@ -540,11 +1261,31 @@ CameraConfiguration *PipelineHandlerRkISP1::generateConfiguration(Camera *camera
 	if (roles.empty())
 		return config;
 
-	StreamConfiguration cfg{};
-	cfg.pixelFormat = DRM_FORMAT_NV12;
-	cfg.size = data->sensor_->resolution();
+	if (roles.size() > 2) {
+		LOG(RkISP1, Error) << "Too many stream roles requested";
+		delete config;
+		return nullptr;
+	}
 
-	config->addConfiguration(cfg);
+	/*
+	 * The first stream captures at the sensor resolution on the main path.
+	 * A second stream is scaled down by the self path, default to a
+	 * viewfinder-sized output.
+	 */
+	for (unsigned int i = 0; i < roles.size(); ++i) {
+		StreamConfiguration cfg{};
+		cfg.pixelFormat = DRM_FORMAT_NV12;
+
+		if (i == 0) {
+			cfg.size = data->sensor_->resolution();
+		} else {
+			const Size &res = data->sensor_->resolution();
+			cfg.size = { std::min(640U, res.width),
+				     std::min(480U, res.height) };
+		}
+
+		config->addConfiguration(cfg);
+	}
 
 	config->validate();
 
@@ -556,33 +1297,46 @@ int PipelineHandlerRkISP1::configure(Camera *camera, CameraConfiguration *c)
 	RkISP1CameraConfiguration *config =
 		static_cast<RkISP1CameraConfiguration *>(c);
 	RkISP1CameraData *data = cameraData(camera);
-	StreamConfiguration &cfg = config->at(0);
 	CameraSensor *sensor = data->sensor_;
 	int ret;
 
+	/* The internal buffers depend on the configuration, free them. */
+	if (buffersCamera_)
+		freeBuffers(buffersCamera_);
+
 	/*
-	 * Configure the sensor links: enable the link corresponding to this
-	 * camera and disable all the other sensor links.
+	 * Configure the links: enable the link from the sensor corresponding
+	 * to this camera and the links to the paths in use, and disable all
+	 * the others. Links already in the right state are left untouched.
 	 */
-	const MediaPad *pad = dphy_->entity()->getPadByIndex(0);
+	std::set<MediaLink *> links = { dphyLink_ };
 
+	const MediaPad *pad = dphy_->entity()->getPadByIndex(0);
 	for (MediaLink *link : pad->links()) {
-		bool enable = link->source()->entity() == sensor->entity();
-
-		if (!!(link->flags() & MEDIA_LNK_FL_ENABLED) == enable)
-			continue;
-
-		LOG(RkISP1, Debug)
-			<< (enable ? "Enabling" : "Disabling")
-			<< " link from sensor '"
-			<< link->source()->entity()->name()
-			<< "' to CSI-2 receiver";
+		if (link->source()->entity() == sensor->entity())
+			links.insert(link);
+	}
 
-		ret = link->setEnabled(enable);
-		if (ret < 0)
-			return ret;
+	mainPathActive_ = false;
+	selfPathActive_ = false;
+	statStreamActive_ = false;
+
+	for (const Stream *stream : config->streams()) {
+		if (stream == &data->statStream_) {
+			statStreamActive_ = true;
+		} else if (stream == &data->mainPathStream_) {
+			links.insert(mainPathLink_);
+			mainPathActive_ = true;
+		} else {
+			links.insert(selfPathLink_);
+			selfPathActive_ = true;
+		}
 	}
 
+	ret = media_->setupLinks(links);
+	if (ret < 0)
+		return ret;
+
 	/*
 	 * Configure the format on the sensor output and propagate it through
 	 * the pipeline.
@@ -596,6 +1350,12 @@ int PipelineHandlerRkISP1::configure(Camera *camera, CameraConfiguration *c)
 
 	LOG(RkISP1, Debug) << "Sensor configured with " << format.toString();
 
+	data->initFrameTiming(format.size);
+
+	data->sensorSize_ = format.size;
+	data->requestedCrop_ = { 0, 0, format.size.width, format.size.height };
+	data->scalerCrop_ = data->requestedCrop_;
+
 	ret = dphy_->setFormat(0, &format);
 	if (ret < 0)
 		return ret;
@@ -622,20 +1382,17 @@ int PipelineHandlerRkISP1::configure(Camera *camera, CameraConfiguration *c)
 
 	LOG(RkISP1, Debug) << "ISP output pad configured with " << format.toString();
 
-	V4L2DeviceFormat outputFormat = {};
-	outputFormat.fourcc = video_->toV4L2Fourcc(cfg.pixelFormat);
-	outputFormat.size = cfg.size;
-	outputFormat.planesCount = 2;
+	for (unsigned int i = 0; i < config->size(); ++i) {
+		StreamConfiguration &cfg = config->at(i);
+		const Stream *stream = config->streams()[i];
 
-	ret = video_->setFormat(&outputFormat);
-	if (ret)
-		return ret;
+		if (stream != &data->statStream_) {
+			ret = configurePath(videoDevice(data, stream), &cfg);
+			if (ret)
+				return ret;
+		}
 
-	if (outputFormat.size != cfg.size ||
-	    outputFormat.fourcc != video_->toV4L2Fourcc(cfg.pixelFormat)) {
-		LOG(RkISP1, Error)
-			<< "Unable to configure capture in " << cfg.toString();
-		return -EINVAL;
+		cfg.setStream(const_cast<Stream *>(stream));
 	}
 
 	V4L2DeviceFormat paramFormat = {};
@@ -650,7 +1407,29 @@ int PipelineHandlerRkISP1::configure(Camera *camera, CameraConfiguration *c)
 	if (ret)
 		return ret;
 
-	cfg.setStream(&data->stream_);
+	return 0;
+}
+
+int PipelineHandlerRkISP1::configurePath(V4L2VideoDevice *video,
+					 StreamConfiguration *cfg)
+{
+	int ret;
+
+	V4L2DeviceFormat outputFormat = {};
+	outputFormat.fourcc = video->toV4L2Fourcc(cfg->pixelFormat);
+	outputFormat.size = cfg->size;
+	outputFormat.planesCount = 2;
+
+	ret = video->setFormat(&outputFormat);
+	if (ret)
+		return ret;
+
+	if (outputFormat.size != cfg->size ||
+	    outputFormat.fourcc != video->toV4L2Fourcc(cfg->pixelFormat)) {
+		LOG(RkISP1, Error)
+			<< "Unable to configure capture in " << cfg->toString();
+		return -EINVAL;
+	}
 
 	return 0;
 }
@@ -658,19 +1437,82 @@ int PipelineHandlerRkISP1::configure(Camera *camera, CameraConfiguration *c)
 int PipelineHandlerRkISP1::exportFrameBuffers(Camera *camera, Stream *stream,
 					      std::vector<std::unique_ptr<FrameBuffer>> *buffers)
 {
+	RkISP1CameraData *data = cameraData(camera);
 	unsigned int count = stream->configuration().bufferCount;
-	return video_->exportBuffers(count, buffers);
+
+	/*
+	 * The statistics buffers are exported from the statistics device, which
+	 * then imports them along with the internal buffers at start time.
+	 */
+	if (stream == &data->statStream_) {
+		if (buffersCamera_)
+			freeBuffers(buffersCamera_);
+
+		stat_->setCpuAccess(stream->cpuAccess());
+		int ret = stat_->exportBuffers(count, buffers);
+		if (ret < 0)
+			return ret;
+
+		stat_->releaseBuffers();
+		return ret;
+	}
+
+	V4L2VideoDevice *video = videoDevice(data, stream);
+
+	video->setCpuAccess(stream->cpuAccess());
+	return video->exportBuffers(count, buffers);
 }
 
 int PipelineHandlerRkISP1::importFrameBuffers(Camera *camera, Stream *stream)
 {
+	RkISP1CameraData *data = cameraData(camera);
 	unsigned int count = stream->configuration().bufferCount;
-	return video_->importBuffers(count);
+
+	/* The statistics buffers are imported in allocateBuffers(). */
+	if (stream == &data->statStream_)
+		return 0;
+
+	return videoDevice(data, stream)->importBuffers(count);
 }
 
 void PipelineHandlerRkISP1::freeFrameBuffers(Camera *camera, Stream *stream)
 {
-	video_->releaseBuffers();
+	RkISP1CameraData *data = cameraData(camera);
+
+	/*
+	 * The statistics device keeps running with the internal buffers, only
+	 * forget about the application buffers.
+	 */
+	if (stream == &data->statStream_) {
+		data->unmapStatStreamBuffers();
+		statMappings_.clear();
+		return;
+	}
+
+	videoDevice(data, stream)->releaseBuffers();
+}
+
+void PipelineHandlerRkISP1::bufferUsage(const Camera *camera,
+					std::vector<BufferPoolUsage> *pools)
+{
+	/* The parameters and statistics buffers belong to a single camera. */
+	if (camera != buffersCamera_)
+		return;
+
+	BufferPoolUsage param(BufferPoolUsage::Internal, nullptr, "param");
+	param.add(paramBuffers_);
+	pools->push_back(param);
+
+	BufferPoolUsage stat(BufferPoolUsage::Internal, nullptr, "stat");
+	stat.add(statBuffers_);
+	pools->push_back(stat);
+}
+
+void PipelineHandlerRkISP1::stallReport(const Camera *camera, CameraStall *stall)
+{
+	for (const V4L2VideoDevice *video : { mainPath_, selfPath_, param_, stat_ })
+		stall->devices.push_back({ video->deviceNode(),
+					   video->queuedBuffers() });
 }
 
 int PipelineHandlerRkISP1::allocateBuffers(Camera *camera)
@@ -683,6 +1525,17 @@ int PipelineHandlerRkISP1::allocateBuffers(Camera *camera)
 	for (const Stream *s : camera->streams())
 		maxBuffers = std::max(maxBuffers, s->configuration().bufferCount);
 
+	/*
+	 * The parameters and statistics buffers bound the number of frames in
+	 * flight.
+	 */
+	if (lowLatency_)
+		maxBuffers = MinPipelineDepth;
+	else if (pipelineDepth_)
+		maxBuffers = pipelineDepth_;
+
+	LOG(RkISP1, Debug) << "Running with " << maxBuffers << " frames in flight";
+
 	ret = param_->exportBuffers(maxBuffers, &paramBuffers_);
 	if (ret < 0)
 		goto error;
@@ -691,28 +1544,47 @@ int PipelineHandlerRkISP1::allocateBuffers(Camera *camera)
 	if (ret < 0)
 		goto error;
 
+	/*
+	 * The exported dmabufs keep the internal buffers memory alive, switch
+	 * the statistics device to import mode to queue the buffers of the
+	 * statistics stream as well.
+	 */
+	if (statStreamActive_) {
+		stat_->releaseBuffers();
+
+		ret = stat_->importBuffers(maxBuffers +
+					   data->statStream_.configuration().bufferCount);
+		if (ret)
+			goto error;
+	}
+
 	for (std::unique_ptr<FrameBuffer> &buffer : paramBuffers_) {
 		buffer->setCookie(count++);
+		Span<const FrameBuffer::Plane> planes = buffer->planes();
 		data->ipaBuffers_.push_back({ .id = buffer->cookie(),
-					      .planes = buffer->planes() });
-		availableParamBuffers_.push(buffer.get());
+					      .planes = { planes.begin(), planes.end() } });
 	}
 
 	for (std::unique_ptr<FrameBuffer> &buffer : statBuffers_) {
 		buffer->setCookie(count++);
+		Span<const FrameBuffer::Plane> planes = buffer->planes();
 		data->ipaBuffers_.push_back({ .id = buffer->cookie(),
-					      .planes = buffer->planes() });
-		availableStatBuffers_.push(buffer.get());
+					      .planes = { planes.begin(), planes.end() } });
 	}
 
 	data->ipa_->mapBuffers(data->ipaBuffers_);
 
+	buffersCamera_ = camera;
+
 	return 0;
 
 error:
 	paramBuffers_.clear();
 	statBuffers_.clear();
-	video_->releaseBuffers();
+	if (mainPathActive_)
+		mainPath_->releaseBuffers();
+	if (selfPathActive_)
+		selfPath_->releaseBuffers();
 
 	return ret;
 }
@@ -727,15 +1599,19 @@ int PipelineHandlerRkISP1::freeBuffers(Camera *camera)
 	while (!availableParamBuffers_.empty())
 		availableParamBuffers_.pop();
 
+	statMappings_.clear();
 	paramBuffers_.clear();
 	statBuffers_.clear();
 
+	data->frameInfo_.clear();
+
 	std::vector<unsigned int> ids;
 	for (IPABuffer &ipabuf : data->ipaBuffers_)
 		ids.push_back(ipabuf.id);
 
 	data->ipa_->unmapBuffers(ids);
 	data->ipaBuffers_.clear();
+	data->statStreamIds_.clear();
 
 	if (param_->releaseBuffers())
 		LOG(RkISP1, Error) << "Failed to release parameters buffers";
@@ -743,6 +1619,8 @@ int PipelineHandlerRkISP1::freeBuffers(Camera *camera)
 	if (stat_->releaseBuffers())
 		LOG(RkISP1, Error) << "Failed to release stat buffers";
 
+	buffersCamera_ = nullptr;
+
 	return 0;
 }
 
@@ -751,12 +1629,38 @@ int PipelineHandlerRkISP1::start(Camera *camera)
 	RkISP1CameraData *data = cameraData(camera);
 	int ret;
 
-	/* Allocate buffers for internal pipeline usage. */
-	ret = allocateBuffers(camera);
-	if (ret)
-		return ret;
+	/*
+	 * Allocate buffers for internal pipeline usage, unless they have been
+	 * kept from a previous start() with the same configuration.
+	 */
+	if (buffersCamera_ != camera) {
+		if (buffersCamera_)
+			freeBuffers(buffersCamera_);
+
+		ret = allocateBuffers(camera);
+		if (ret)
+			return ret;
+	}
+
+	availableParamBuffers_ = {};
+	availableStatBuffers_ = {};
+
+	for (std::unique_ptr<FrameBuffer> &buffer : paramBuffers_)
+		availableParamBuffers_.push(buffer.get());
+	for (std::unique_ptr<FrameBuffer> &buffer : statBuffers_)
+		availableStatBuffers_.push(buffer.get());
+
+	data->frameInfo_.init(paramBuffers_.size(),
+			      paramBuffers_.size() + statBuffers_.size() + 1);
 
 	data->frame_ = 0;
+	data->resetStats();
+
+	ret = data->delayedCtrls_->reset();
+	if (ret) {
+		freeBuffers(camera);
+		return ret;
+	}
 
 	ret = param_->streamOn();
 	if (ret) {
@@ -775,42 +1679,92 @@ int PipelineHandlerRkISP1::start(Camera *camera)
 		return ret;
 	}
 
-	ret = video_->streamOn();
-	if (ret) {
-		param_->streamOff();
-		stat_->streamOff();
-		freeBuffers(camera);
+	if (mainPathActive_) {
+		ret = mainPath_->streamOn();
+		if (ret) {
+			param_->streamOff();
+			stat_->streamOff();
+			freeBuffers(camera);
+			LOG(RkISP1, Error)
+				<< "Failed to start main path " << camera->name();
+			return ret;
+		}
+	}
 
-		LOG(RkISP1, Error)
-			<< "Failed to start camera " << camera->name();
+	if (selfPathActive_) {
+		ret = selfPath_->streamOn();
+		if (ret) {
+			if (mainPathActive_)
+				mainPath_->streamOff();
+			param_->streamOff();
+			stat_->streamOff();
+			freeBuffers(camera);
+			LOG(RkISP1, Error)
+				<< "Failed to start self path " << camera->name();
+			return ret;
+		}
 	}
 
 	activeCamera_ = camera;
 
+	/*
+	 * Drive the timeline from the ISP frame start events when supported,
+	 * and fall back to estimating SOE from buffer completion otherwise.
+	 */
+	data->timeline_.setFrameStartEvents(!isp_->setFrameStartEnabled(true));
+
 	/* Inform IPA of stream configuration and sensor controls. */
 	std::map<unsigned int, IPAStream> streamConfig;
-	streamConfig[0] = {
-		.pixelFormat = data->stream_.configuration().pixelFormat,
-		.size = data->stream_.configuration().size,
-	};
+	if (mainPathActive_)
+		streamConfig[0] = {
+			.pixelFormat = data->mainPathStream_.configuration().pixelFormat,
+			.size = data->mainPathStream_.configuration().size,
+		};
+	if (selfPathActive_)
+		streamConfig[1] = {
+			.pixelFormat = data->selfPathStream_.configuration().pixelFormat,
+			.size = data->selfPathStream_.configuration().size,
+		};
 
 	std::map<unsigned int, const ControlInfoMap &> entityControls;
 	entityControls.emplace(0, data->sensor_->controls());
 
 	data->ipa_->configure(streamConfig, entityControls);
 
+	if (!recordPath_.empty() &&
+	    recorder_.open(recordPath_, streamConfig.begin()->second,
+			   data->sensor_->controls()) < 0)
+		LOG(RkISP1, Warning) << "Recording disabled";
+
 	return ret;
 }
 
-void PipelineHandlerRkISP1::stop(Camera *camera)
+void PipelineHandlerRkISP1::stopDevice(Camera *camera)
 {
 	RkISP1CameraData *data = cameraData(camera);
 	int ret;
 
-	ret = video_->streamOff();
-	if (ret)
-		LOG(RkISP1, Warning)
-			<< "Failed to stop camera " << camera->name();
+	/*
+	 * Take the requests not queued to the device yet out of the pending
+	 * queue, to prevent them from being queued when the frames in flight
+	 * complete at stream off.
+	 */
+	std::queue<Request *> pendingRequests;
+	std::swap(pendingRequests, data->pendingRequests_);
+
+	if (selfPathActive_) {
+		ret = selfPath_->streamOff();
+		if (ret)
+			LOG(RkISP1, Warning)
+				<< "Failed to stop self path " << camera->name();
+	}
+
+	if (mainPathActive_) {
+		ret = mainPath_->streamOff();
+		if (ret)
+			LOG(RkISP1, Warning)
+				<< "Failed to stop main path " << camera->name();
+	}
 
 	ret = stat_->streamOff();
 	if (ret)
@@ -822,69 +1776,171 @@ void PipelineHandlerRkISP1::stop(Camera *camera)
 		LOG(RkISP1, Warning)
 			<< "Failed to stop parameters " << camera->name();
 
+	isp_->setFrameStartEnabled(false);
 	data->timeline_.reset();
 
-	freeBuffers(camera);
+	if (recorder_.isOpen()) {
+		LOG(RkISP1, Info)
+			<< "Recorded " << recorder_.frames() << " frames to "
+			<< recordPath_;
+		recorder_.close();
+	}
+
+	while (!pendingRequests.empty()) {
+		cancelRequest(camera, pendingRequests.front());
+		pendingRequests.pop();
+	}
 
 	activeCamera_ = nullptr;
 }
 
+void PipelineHandlerRkISP1::release(Camera *camera)
+{
+	if (buffersCamera_ == camera)
+		freeBuffers(camera);
+}
+
 int PipelineHandlerRkISP1::queueRequestDevice(Camera *camera,
 					      Request *request)
 {
 	RkISP1CameraData *data = cameraData(camera);
-	Stream *stream = &data->stream_;
 
-	RkISP1FrameInfo *info = data->frameInfo_.create(data->frame_, request,
-							stream);
-	if (!info)
+	if (!request->findBuffer(&data->mainPathStream_) &&
+	    !request->findBuffer(&data->selfPathStream_)) {
+		LOG(RkISP1, Error)
+			<< "Attempt to queue request with invalid stream";
 		return -ENOENT;
+	}
+
+	/*
+	 * Requests wait in the pending queue until a parameters and a
+	 * statistics buffer are available, which bounds the number of frames
+	 * in flight to the pipeline depth.
+	 */
+	data->pendingRequests_.push(request);
+	queuePendingRequests(data);
 
-	IPAOperationData op;
-	op.operation = RKISP1_IPA_EVENT_QUEUE_REQUEST;
-	op.data = { data->frame_, info->paramBuffer->cookie() };
-	op.controls = { request->controls() };
-	data->ipa_->processEvent(op);
+	return 0;
+}
 
-	data->timeline_.scheduleAction(std::make_unique<RkISP1ActionQueueBuffers>(data->frame_,
-										  data,
-										  this));
+utils::time_point PipelineHandlerRkISP1::targetQueueTime(Camera *camera,
+							  utils::time_point target)
+{
+	RkISP1CameraData *data = cameraData(camera);
+	utils::duration interval = data->timeline_.frameInterval();
 
-	data->frame_++;
+	/*
+	 * The target frame is selected through the timeline, which requires
+	 * buffers to be queued by the timeline too.
+	 */
+	if (lowLatency_ || interval <= utils::duration::zero())
+		return target;
 
-	return 0;
+	return target - interval * TargetLeadFrames;
 }
 
-/* -----------------------------------------------------------------------------
- * Match and Setup
- */
+void PipelineHandlerRkISP1::queuePendingRequests(RkISP1CameraData *data)
+{
+	while (!data->pendingRequests_.empty()) {
+		if (availableParamBuffers_.empty() || availableStatBuffers_.empty())
+			return;
 
-int PipelineHandlerRkISP1::initLinks()
+		Request *request = data->pendingRequests_.front();
+
+		/*
+		 * Skip the frames before the target capture time, the timeline
+		 * then queues the buffers for the target frame.
+		 */
+		if (!lowLatency_ &&
+		    request->controls().contains(controls::FrameTargetTime)) {
+			std::chrono::nanoseconds target{ request->controls().get(controls::FrameTargetTime) };
+			unsigned int frame;
+			if (data->timeline_.predictFrame(utils::time_point(target), &frame) &&
+			    frame > data->frame_)
+				data->frame_ = frame;
+		}
+
+		RkISP1FrameInfo *info = data->frameInfo_.create(data->frame_, request,
+								data);
+		if (!info)
+			return;
+
+		data->pendingRequests_.pop();
+
+		RkISP1EventQueueRequest event;
+		event.frame = data->frame_;
+		event.bufferId = info->paramBuffer->cookie();
+		event.controls = &request->controls();
+
+		CpuScope scope(CameraStatistics::CpuIPA, data->camera_);
+		data->ipa_->processEvent(event.pack());
+
+		if (request->controls().contains(controls::FrameDuration))
+			data->setFrameDuration(data->frame_,
+					       request->controls().get(controls::FrameDuration));
+
+		if (request->controls().contains(controls::ScalerCrop))
+			data->setScalerCrop(request->controls().get(controls::ScalerCrop));
+		info->scalerCrop = data->requestedCrop_;
+
+		if (!lowLatency_)
+			data->timeline_.scheduleAction(data->frame_,
+						       &data->queueBuffersAction_);
+
+		data->frame_++;
+	}
+}
+
+void PipelineHandlerRkISP1::queueBuffers(RkISP1FrameInfo *info)
 {
-	MediaLink *link;
-	int ret;
+	if (info->paramFilled)
+		param_->queueBuffer(info->paramBuffer);
+	else
+		LOG(RkISP1, Error)
+			<< "Parameters not ready on time for frame "
+			<< info->frame << ", ignore parameters.";
 
-	ret = media_->disableLinks();
-	if (ret < 0)
-		return ret;
+	stat_->queueBuffer(info->statBuffer);
 
-	link = media_->link("rockchip-sy-mipi-dphy", 1, "rkisp1-isp-subdev", 0);
-	if (!link)
-		return -ENODEV;
+	/*
+	 * The dual crop units of the paths latch their configuration at the
+	 * next frame start, update them along with the frame buffers. The
+	 * frame reports the crop actually in effect.
+	 */
+	RkISP1CameraData *data = cameraData(activeCamera_);
+	if (info->scalerCrop != data->scalerCrop_) {
+		Rectangle crop = info->scalerCrop;
+		int ret = 0;
 
-	ret = link->setEnabled(true);
-	if (ret < 0)
-		return ret;
+		if (mainPathActive_)
+			ret = mainPath_->setCrop(&crop);
+		if (!ret && selfPathActive_)
+			ret = selfPath_->setCrop(&crop);
 
-	link = media_->link("rkisp1-isp-subdev", 2, "rkisp1_mainpath", 0);
-	if (!link)
-		return -ENODEV;
+		if (!ret)
+			data->scalerCrop_ = crop;
+	}
+	info->scalerCrop = data->scalerCrop_;
 
-	ret = link->setEnabled(true);
-	if (ret < 0)
-		return ret;
+	if (info->mainPathBuffer)
+		mainPath_->queueBuffer(info->mainPathBuffer);
+	if (info->selfPathBuffer)
+		selfPath_->queueBuffer(info->selfPathBuffer);
+}
 
-	return 0;
+/* -----------------------------------------------------------------------------
+ * Match and Setup
+ */
+
+int PipelineHandlerRkISP1::initLinks()
+{
+	dphyLink_ = media_->link("rockchip-sy-mipi-dphy", 1, "rkisp1-isp-subdev", 0);
+	mainPathLink_ = media_->link("rkisp1-isp-subdev", 2, "rkisp1_mainpath", 0);
+	selfPathLink_ = media_->link("rkisp1-isp-subdev", 2, "rkisp1_selfpath", 0);
+	if (!dphyLink_ || !mainPathLink_ || !selfPathLink_)
+		return -ENODEV;
+
+	return media_->setupLinks({ dphyLink_, mainPathLink_ });
 }
 
 int PipelineHandlerRkISP1::createCamera(MediaEntity *sensor)
@@ -894,23 +1950,59 @@ int PipelineHandlerRkISP1::createCamera(MediaEntity *sensor)
 	std::unique_ptr<RkISP1CameraData> data =
 		std::make_unique<RkISP1CameraData>(this);
 
+	data->sensor_ = new CameraSensor(sensor);
+	ret = data->sensor_->init();
+	if (ret)
+		return ret;
+
+	/*
+	 * Sensors commonly apply the exposure time and vertical blanking two
+	 * frames after they're written, and the analogue gain one frame after.
+	 */
+	std::map<unsigned int, unsigned int> delays = {
+		{ V4L2_CID_ANALOGUE_GAIN, 1 },
+		{ V4L2_CID_EXPOSURE, 2 },
+		{ V4L2_CID_VBLANK, 2 },
+	};
+	data->delayedCtrls_ =
+		std::make_unique<DelayedControls>(data->sensor_->device(), delays);
+
 	ControlInfoMap::Map ctrls;
 	ctrls.emplace(std::piecewise_construct,
 		      std::forward_as_tuple(&controls::AeEnable),
 		      std::forward_as_tuple(false, true));
 
-	data->controlInfo_ = std::move(ctrls);
+	/*
+	 * Report the range of frame durations supported by the sensor at its
+	 * full resolution, from the range of the vertical blanking.
+	 */
+	const Size &resolution = data->sensor_->resolution();
+	if (!data->initFrameTiming(resolution)) {
+		const ControlRange &vblank =
+			data->sensor_->controls().find(V4L2_CID_VBLANK)->second;
+		int64_t lineDuration = data->lineLength_ * 1000000LL;
+		int64_t minLines = resolution.height + vblank.min().get<int32_t>();
+		int64_t maxLines = resolution.height + vblank.max().get<int32_t>();
+
+		ctrls.emplace(std::piecewise_construct,
+			      std::forward_as_tuple(&controls::FrameDuration),
+			      std::forward_as_tuple(minLines * lineDuration / data->pixelRate_,
+						    maxLines * lineDuration / data->pixelRate_));
+	}
 
-	data->sensor_ = new CameraSensor(sensor);
-	ret = data->sensor_->init();
-	if (ret)
-		return ret;
+	ctrls.emplace(std::piecewise_construct,
+		      std::forward_as_tuple(&controls::ScalerCrop),
+		      std::forward_as_tuple(Rectangle{ 0, 0, 32, 16 },
+					    Rectangle{ 0, 0, resolution.width,
+						       resolution.height }));
 
-	ret = data->loadIPA();
-	if (ret)
-		return ret;
+	data->controlInfo_ = std::move(ctrls);
 
-	std::set<Stream *> streams{ &data->stream_ };
+	std::set<Stream *> streams{
+		&data->mainPathStream_,
+		&data->selfPathStream_,
+		&data->statStream_,
+	};
 	std::shared_ptr<Camera> camera =
 		Camera::create(this, sensor->name(), streams);
 	registerCamera(std::move(camera), std::move(data));
@@ -943,9 +2035,13 @@ bool PipelineHandlerRkISP1::match(DeviceEnumerator *enumerator)
 	if (isp_->open() < 0)
 		return false;
 
-	/* Locate and open the capture video node. */
-	video_ = V4L2VideoDevice::fromEntityName(media_, "rkisp1_mainpath");
-	if (video_->open() < 0)
+	/* Locate and open the capture video nodes. */
+	mainPath_ = V4L2VideoDevice::fromEntityName(media_, "rkisp1_mainpath");
+	if (mainPath_->open() < 0)
+		return false;
+
+	selfPath_ = V4L2VideoDevice::fromEntityName(media_, "rkisp1_selfpath");
+	if (selfPath_->open() < 0)
 		return false;
 
 	stat_ = V4L2VideoDevice::fromEntityName(media_, "rkisp1-statistics");
@@ -956,7 +2052,9 @@ bool PipelineHandlerRkISP1::match(DeviceEnumerator *enumerator)
 	if (param_->open() < 0)
 		return false;
 
-	video_->bufferReady.connect(this, &PipelineHandlerRkISP1::bufferReady);
+	isp_->frameStart.connect(this, &PipelineHandlerRkISP1::frameStart);
+	mainPath_->bufferReady.connect(this, &PipelineHandlerRkISP1::bufferReady);
+	selfPath_->bufferReady.connect(this, &PipelineHandlerRkISP1::bufferReady);
 	stat_->bufferReady.connect(this, &PipelineHandlerRkISP1::statReady);
 	param_->bufferReady.connect(this, &PipelineHandlerRkISP1::paramReady);
 
@@ -1003,6 +2101,18 @@ void PipelineHandlerRkISP1::tryCompleteRequest(Request *request)
 	data->frameInfo_.destroy(info->frame);
 
 	completeRequest(activeCamera_, request);
+
+	queuePendingRequests(data);
+}
+
+void PipelineHandlerRkISP1::frameStart(uint32_t sequence, uint64_t timestamp)
+{
+	if (!activeCamera_)
+		return;
+
+	RkISP1CameraData *data = cameraData(activeCamera_);
+	data->timeline_.frameStart(sequence, timestamp);
+	data->delayedCtrls_->applyControls(sequence);
 }
 
 void PipelineHandlerRkISP1::bufferReady(FrameBuffer *buffer)
@@ -1011,7 +2121,21 @@ void PipelineHandlerRkISP1::bufferReady(FrameBuffer *buffer)
 	RkISP1CameraData *data = cameraData(activeCamera_);
 	Request *request = buffer->request();
 
-	data->timeline_.bufferReady(buffer);
+	/*
+	 * Both paths complete the same frame, drive the timeline from the
+	 * main path buffer when the frame has one.
+	 */
+	RkISP1FrameInfo *info = data->frameInfo_.find(buffer);
+	if (info && (buffer == info->mainPathBuffer || !info->mainPathBuffer)) {
+		data->timeline_.bufferReady(buffer);
+
+		/*
+		 * Without frame start events, approximate the start of the
+		 * next frame with the completion of the current one.
+		 */
+		if (!data->timeline_.frameStartEvents())
+			data->delayedCtrls_->applyControls(buffer->metadata().sequence + 1);
+	}
 
 	if (data->frame_ <= buffer->metadata().sequence)
 		data->frame_ = buffer->metadata().sequence + 1;
@@ -1040,10 +2164,43 @@ void PipelineHandlerRkISP1::statReady(FrameBuffer *buffer)
 	if (!info)
 		return;
 
-	IPAOperationData op;
-	op.operation = RKISP1_IPA_EVENT_SIGNAL_STAT_BUFFER;
-	op.data = { info->frame, info->statBuffer->cookie() };
-	data->ipa_->processEvent(op);
+	if (recorder_.isOpen())
+		recordStats(data, info);
+
+	data->statsReady(info);
+}
+
+/*
+ * Record the statistics of a frame along with the sensor exposure and gain
+ * in effect for the frame, which the IPA bases its computations on.
+ */
+void PipelineHandlerRkISP1::recordStats(RkISP1CameraData *data,
+					RkISP1FrameInfo *info)
+{
+	FrameBuffer *buffer = info->statBuffer;
+	const MappedFrameBuffer *mapped = statMappings_.map(buffer);
+	if (!mapped)
+		return;
+
+	ControlList sensorCtrls = data->delayedCtrls_->get(info->frame);
+	ControlList ctrls(data->sensor_->controls());
+	for (unsigned int id : { V4L2_CID_EXPOSURE, V4L2_CID_ANALOGUE_GAIN }) {
+		if (sensorCtrls.contains(id))
+			ctrls.set(id, sensorCtrls.get(id));
+	}
+
+	const MappedFrameBuffer::Plane &plane = mapped->planes()[0];
+	size_t size = std::min<size_t>(buffer->metadata().planes()[0].bytesused,
+				       plane.length);
+
+	ScopedCpuAccess access(*mapped);
+	int ret = recorder_.write(info->frame, buffer->metadata().timestamp,
+				  { plane.data, size }, ctrls);
+	if (ret < 0) {
+		LOG(RkISP1, Error) << "Failed to record frame " << info->frame
+				   << ", stopping recording";
+		recorder_.close();
+	}
 }
 
 REGISTER_PIPELINE_HANDLER(PipelineHandlerRkISP1);
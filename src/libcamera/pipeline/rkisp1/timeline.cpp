@@ -7,7 +7,11 @@
 
 #include "timeline.h"
 
+#include <algorithm>
+#include <chrono>
+
 #include "log.h"
+#include "tracer.h"
 
 /**
  * \file timeline.h
@@ -23,11 +27,12 @@ LOG_DEFINE_CATEGORY(Timeline)
  * \brief Action that can be schedule on a Timeline
  *
  * A frame action is an event schedule to be executed on a Timeline. A frame
- * action has two primal attributes a frame number and a type.
+ * action has a type, a numerical ID which identifies the action within the
+ * pipeline and IPA protocol.
  *
- * The frame number describes the frame to which the action is associated. The
- * type is a numerical ID which identifies the action within the pipeline and
- * IPA protocol.
+ * Frame actions are allocated once by the pipeline handler, and scheduled for
+ * every frame they act on. The frame number is passed to run() when the
+ * action is executed.
  */
 
 /**
@@ -57,11 +62,53 @@ LOG_DEFINE_CATEGORY(Timeline)
  *    FrameAction which contains an abstract description of what frame and
  *    what type of action it contains and turning that into an time point
  *    and make sure the action is executed at that time.
+ *
+ *    Scheduled actions are stored in a ring of preallocated slots indexed by
+ *    frame number, and the action with the earliest deadline is tracked to
+ *    program the timer. Scheduling and executing actions thus don't allocate
+ *    memory.
+ *
+ * The timeline additionally measures, for every action, the slack between the
+ * time it is executed and the SOE of the frame it acts on. An action executed
+ * after the SOE of its frame has missed its deadline. The measurements are
+ * available through actionStats(). When calibration is enabled with
+ * setCalibration(), the time offsets of the action types selected with
+ * setCalibrated() are adjusted at runtime based on the measured slack:
+ * deadlines are tightened when the slack exceeds the margin consistently, and
+ * loosened as soon as the slack falls below the margin.
+ */
+
+/**
+ * \struct Timeline::ActionStats
+ * \brief Execution statistics for an action type
+ *
+ * \var Timeline::ActionStats::executed
+ * \brief Number of executed actions
+ * \var Timeline::ActionStats::late
+ * \brief Number of actions scheduled after their deadline
+ * \var Timeline::ActionStats::missed
+ * \brief Number of actions executed after the SOE of their frame
+ * \var Timeline::ActionStats::measured
+ * \brief Number of actions whose slack has been measured
+ * \var Timeline::ActionStats::minSlack
+ * \brief Minimum measured time between execution and the SOE of the frame
+ * \var Timeline::ActionStats::maxSlack
+ * \brief Maximum measured time between execution and the SOE of the frame
  */
 
+Timeline::ActionStats::ActionStats()
+	: executed(0), late(0), missed(0), measured(0),
+	  minSlack(utils::duration::max()), maxSlack(utils::duration::min())
+{
+}
+
 Timeline::Timeline()
-	: frameInterval_(0)
+	: historySize_(0), historyHead_(0), frameInterval_(0),
+	  nextAction_(nullptr), calibration_(false), margin_(0)
 {
+	for (FrameSlot &slot : slots_)
+		slot.count = 0;
+
 	timer_.timeout.connect(this, &Timeline::timeout);
 }
 
@@ -74,14 +121,34 @@ Timeline::Timeline()
  */
 void Timeline::reset()
 {
+	using std::chrono::duration_cast;
+	using std::chrono::microseconds;
+
 	timer_.stop();
 
-	actions_.clear();
-	history_.clear();
+	for (const auto &it : stats_) {
+		const ActionStats &stats = it.second;
+		LOG(Timeline, Debug)
+			<< "Action type " << it.first << ": " << stats.executed
+			<< " executed, " << stats.late << " late, "
+			<< stats.missed << " missed, slack "
+			<< (stats.measured ? duration_cast<microseconds>(stats.minSlack).count() : 0)
+			<< "us - "
+			<< (stats.measured ? duration_cast<microseconds>(stats.maxSlack).count() : 0)
+			<< "us";
+	}
+
+	for (FrameSlot &slot : slots_)
+		slot.count = 0;
+	nextAction_ = nullptr;
+	historySize_ = 0;
+	stats_.clear();
+	calibrations_.clear();
 }
 
 /**
  * \brief Schedule an action on the timeline
+ * \param[in] frame The frame the action acts on
  * \param[in] action FrameAction to schedule
  *
  * The act of scheduling an action to the timeline is the process of taking
@@ -89,18 +156,22 @@ void Timeline::reset()
  * that to a time point using the current values for the action type timings
  * value recorded in the timeline. If an action is scheduled too late, execute
  * it immediately.
+ *
+ * The \a action isn't owned by the timeline, and shall stay valid until it is
+ * executed or the timeline is reset. The same action may be scheduled for
+ * multiple frames.
  */
-void Timeline::scheduleAction(std::unique_ptr<FrameAction> action)
+void Timeline::scheduleAction(unsigned int frame, FrameAction *action)
 {
 	unsigned int lastFrame;
 	utils::time_point lastTime;
 
-	if (history_.empty()) {
+	if (!historySize_) {
 		lastFrame = 0;
 		lastTime = std::chrono::steady_clock::now();
 	} else {
-		lastFrame = history_.back().first;
-		lastTime = history_.back().second;
+		lastFrame = history_[historyHead_].frame;
+		lastTime = history_[historyHead_].time;
 	}
 
 	/*
@@ -111,50 +182,135 @@ void Timeline::scheduleAction(std::unique_ptr<FrameAction> action)
 	 * (SOE) as the fixed offset. Lastly add the action time offset to the
 	 * time point.
 	 */
-	int frame = action->frame() - lastFrame + frameOffset(action->type());
-	utils::time_point deadline = lastTime + frame * frameInterval_
+	int frames = frame - lastFrame + frameOffset(action->type());
+	utils::time_point deadline = lastTime + frames * frameInterval_
 		+ timeOffset(action->type());
 
+	ScheduledAction *scheduled = allocateAction(frame);
 	utils::time_point now = std::chrono::steady_clock::now();
-	if (deadline < now) {
-		LOG(Timeline, Warning)
-			<< "Action scheduled too late "
-			<< utils::time_point_to_string(deadline)
-			<< ", run now " << utils::time_point_to_string(now);
-		action->run();
-	} else {
-		actions_.emplace(deadline, std::move(action));
+
+	if (deadline < now || !scheduled) {
+		if (scheduled)
+			LOG(Timeline, Warning)
+				<< "Action scheduled too late "
+				<< utils::time_point_to_string(deadline)
+				<< ", run now " << utils::time_point_to_string(now);
+		stats_[action->type()].late++;
+		runAction(frame, action, scheduled, now);
+		return;
+	}
+
+	scheduled->action = action;
+	scheduled->deadline = deadline;
+	scheduled->pending = true;
+
+	if (!nextAction_ || deadline < nextAction_->deadline) {
+		nextAction_ = scheduled;
 		updateDeadline();
 	}
 }
 
 void Timeline::notifyStartOfExposure(unsigned int frame, utils::time_point time)
 {
-	history_.push_back(std::make_pair(frame, time));
+	/*
+	 * Measure the slack of the actions executed for this frame, and
+	 * release them. The actions executed for frames that have been skipped
+	 * are released when their slot is reused.
+	 */
+	FrameSlot &current = slot(frame);
+	if (current.count && current.frame == frame) {
+		unsigned int count = 0;
+
+		for (unsigned int i = 0; i < current.count; ++i) {
+			ScheduledAction &scheduled = current.actions[i];
+			if (!scheduled.pending) {
+				measureSlack(scheduled, time);
+				continue;
+			}
+
+			if (nextAction_ == &scheduled)
+				nextAction_ = &current.actions[count];
+			current.actions[count++] = scheduled;
+		}
+
+		current.count = count;
+	}
+
+	historyHead_ = (historyHead_ + 1) % HISTORY_DEPTH;
+	history_[historyHead_] = { frame, time };
+	if (historySize_ < HISTORY_DEPTH)
+		historySize_++;
 
-	if (history_.size() <= HISTORY_DEPTH / 2)
+	if (historySize_ <= HISTORY_DEPTH / 2)
 		return;
 
-	while (history_.size() > HISTORY_DEPTH)
-		history_.pop_front();
+	/*
+	 * Update esitmated time between two start of exposures, averaged over
+	 * the history.
+	 */
+	unsigned int oldest = (historyHead_ + HISTORY_DEPTH - historySize_ + 1)
+			    % HISTORY_DEPTH;
+	frameInterval_ = (time - history_[oldest].time) / (historySize_ - 1);
+}
 
-	/* Update esitmated time between two start of exposures. */
-	utils::duration sumExposures(0);
-	unsigned int numExposures = 0;
+/**
+ * \brief Predict the first frame whose exposure starts at or after a time
+ * \param[in] time The time point
+ * \param[out] frame The predicted frame number
+ *
+ * The prediction extrapolates the last recorded SOE with the estimated frame
+ * interval, and is thus only possible once enough SOE events have been
+ * recorded to estimate the frame interval.
+ *
+ * \return True if the frame has been predicted, false otherwise
+ */
+bool Timeline::predictFrame(utils::time_point time, unsigned int *frame) const
+{
+	if (!historySize_ || frameInterval_ <= utils::duration::zero())
+		return false;
 
-	utils::time_point lastTime;
-	for (auto it = history_.begin(); it != history_.end(); it++) {
-		if (it != history_.begin()) {
-			sumExposures += it->second - lastTime;
-			numExposures++;
-		}
+	unsigned int lastFrame = history_[historyHead_].frame;
+	utils::time_point lastTime = history_[historyHead_].time;
 
-		lastTime = it->second;
+	if (time <= lastTime) {
+		*frame = lastFrame;
+		return true;
 	}
 
-	frameInterval_ = sumExposures;
-	if (numExposures)
-		frameInterval_ /= numExposures;
+	/* Round up to the first SOE not before the time point. */
+	utils::duration delta = time - lastTime;
+	*frame = lastFrame + (delta + frameInterval_ - utils::duration(1)) / frameInterval_;
+	return true;
+}
+
+/**
+ * \brief Enable or disable the runtime calibration of the action time offsets
+ * \param[in] enable True to enable calibration, false to disable it
+ * \param[in] margin The minimum slack to preserve between the execution of an
+ * action and the SOE of its frame
+ */
+void Timeline::setCalibration(bool enable, utils::duration margin)
+{
+	calibration_ = enable;
+	margin_ = margin;
+	calibrations_.clear();
+}
+
+/**
+ * \brief Retrieve the execution statistics for an action type
+ * \param[in] type The action type
+ *
+ * The statistics are reset when the timeline is reset.
+ *
+ * \return The execution statistics for the action \a type
+ */
+Timeline::ActionStats Timeline::actionStats(unsigned int type) const
+{
+	const auto it = stats_.find(type);
+	if (it == stats_.end())
+		return ActionStats();
+
+	return it->second;
 }
 
 int Timeline::frameOffset(unsigned int type) const
@@ -186,12 +342,151 @@ void Timeline::setRawDelay(unsigned int type, int frame, utils::duration time)
 	delays_[type] = std::make_pair(frame, time);
 }
 
+void Timeline::setCalibrated(unsigned int type)
+{
+	calibratedTypes_.insert(type);
+}
+
+/*
+ * Allocate an action in the slot of \a frame. Slots only holding actions that
+ * have been executed for an earlier frame are reused, their slack is then not
+ * measured. Return nullptr when no action can be allocated.
+ */
+Timeline::ScheduledAction *Timeline::allocateAction(unsigned int frame)
+{
+	FrameSlot &frameSlot = slot(frame);
+
+	if (frameSlot.count && frameSlot.frame != frame) {
+		for (unsigned int i = 0; i < frameSlot.count; ++i) {
+			if (frameSlot.actions[i].pending) {
+				LOG(Timeline, Warning)
+					<< "No slot for frame " << frame
+					<< ", frame " << frameSlot.frame
+					<< " still pending";
+				return nullptr;
+			}
+		}
+
+		frameSlot.count = 0;
+	}
+
+	if (frameSlot.count == SLOT_ACTIONS) {
+		LOG(Timeline, Warning)
+			<< "Too many actions for frame " << frame;
+		return nullptr;
+	}
+
+	frameSlot.frame = frame;
+
+	ScheduledAction *scheduled = &frameSlot.actions[frameSlot.count++];
+	scheduled->frame = frame;
+	scheduled->pending = false;
+
+	return scheduled;
+}
+
+/* Locate the pending action with the earliest deadline. */
+void Timeline::findNextAction()
+{
+	nextAction_ = nullptr;
+
+	for (FrameSlot &frameSlot : slots_) {
+		for (unsigned int i = 0; i < frameSlot.count; ++i) {
+			ScheduledAction &scheduled = frameSlot.actions[i];
+			if (!scheduled.pending)
+				continue;
+
+			if (!nextAction_ || scheduled.deadline < nextAction_->deadline)
+				nextAction_ = &scheduled;
+		}
+	}
+}
+
+void Timeline::runAction(unsigned int frame, FrameAction *action,
+			 ScheduledAction *scheduled, utils::time_point now)
+{
+	LIBCAMERA_TRACEPOINT(TimelineAction, frame, action->type());
+
+	/* Record the execution to measure the slack at the frame SOE. */
+	if (scheduled) {
+		scheduled->action = action;
+		scheduled->executed = now;
+		scheduled->pending = false;
+	}
+
+	action->run(frame);
+
+	stats_[action->type()].executed++;
+}
+
+void Timeline::measureSlack(const ScheduledAction &scheduled,
+			    utils::time_point soe)
+{
+	unsigned int type = scheduled.action->type();
+	utils::duration slack = soe - scheduled.executed;
+	ActionStats &stats = stats_[type];
+
+	stats.measured++;
+	stats.minSlack = std::min(stats.minSlack, slack);
+	stats.maxSlack = std::max(stats.maxSlack, slack);
+
+	if (slack < utils::duration::zero()) {
+		stats.missed++;
+		LOG(Timeline, Debug)
+			<< "Action type " << type << " for frame "
+			<< scheduled.frame << " missed its deadline by "
+			<< std::chrono::duration_cast<std::chrono::microseconds>(-slack).count()
+			<< "us";
+	}
+
+	if (calibration_ && calibratedTypes_.count(type))
+		calibrate(type, slack);
+}
+
+void Timeline::calibrate(unsigned int type, utils::duration slack)
+{
+	auto delay = delays_.find(type);
+	if (delay == delays_.end())
+		return;
+
+	auto it = calibrations_.find(type);
+	if (it == calibrations_.end())
+		it = calibrations_.emplace(type, Calibration{ 0, utils::duration::max() }).first;
+
+	Calibration &calibration = it->second;
+
+	/* Loosen the deadline immediately when the slack is too small. */
+	if (slack < margin_) {
+		delay->second.second -= margin_ - slack;
+		calibration = { 0, utils::duration::max() };
+
+		LOG(Timeline, Debug)
+			<< "Loosened action type " << type << " time offset to "
+			<< std::chrono::duration_cast<std::chrono::microseconds>(delay->second.second).count()
+			<< "us";
+		return;
+	}
+
+	calibration.minSlack = std::min(calibration.minSlack, slack);
+	if (++calibration.samples < CALIBRATION_WINDOW)
+		return;
+
+	/* Tighten the deadline by half the excess slack over the window. */
+	delay->second.second += (calibration.minSlack - margin_) / 2;
+	calibration = { 0, utils::duration::max() };
+
+	LOG(Timeline, Debug)
+		<< "Tightened action type " << type << " time offset to "
+		<< std::chrono::duration_cast<std::chrono::microseconds>(delay->second.second).count()
+		<< "us";
+}
+
 void Timeline::updateDeadline()
 {
-	if (actions_.empty())
+	if (!nextAction_)
 		return;
 
-	const utils::time_point &deadline = actions_.begin()->first;
+	utils::time_point deadline = nextAction_->deadline;
 
 	if (timer_.isRunning() && deadline >= timer_.deadline())
 		return;
@@ -208,17 +503,13 @@ void Timeline::timeout(Timer *timer)
 {
 	utils::time_point now = std::chrono::steady_clock::now();
 
-	for (auto it = actions_.begin(); it != actions_.end();) {
-		const utils::time_point &sched = it->first;
-
-		if (sched > now)
-			break;
-
-		FrameAction *action = it->second.get();
-
-		action->run();
+	/* Run the due actions in deadline order. */
+	while (nextAction_ && nextAction_->deadline <= now) {
+		ScheduledAction *scheduled = nextAction_;
+		nextAction_ = nullptr;
 
-		it = actions_.erase(it);
+		runAction(scheduled->frame, scheduled->action, scheduled, now);
+		findNextAction();
 	}
 
 	updateDeadline();
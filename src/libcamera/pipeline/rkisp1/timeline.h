@@ -7,8 +7,10 @@
 #ifndef __LIBCAMERA_TIMELINE_H__
 #define __LIBCAMERA_TIMELINE_H__
 
-#include <list>
+#include <array>
 #include <map>
+#include <set>
+#include <stdint.h>
 
 #include <libcamera/timer.h>
 
@@ -19,51 +21,112 @@ namespace libcamera {
 class FrameAction
 {
 public:
-	FrameAction(unsigned int frame, unsigned int type)
-		: frame_(frame), type_(type) {}
+	FrameAction(unsigned int type)
+		: type_(type) {}
 
 	virtual ~FrameAction() {}
 
-	unsigned int frame() const { return frame_; }
 	unsigned int type() const { return type_; }
 
-	virtual void run() = 0;
+	virtual void run(unsigned int frame) = 0;
 
 private:
-	unsigned int frame_;
 	unsigned int type_;
 };
 
 class Timeline
 {
 public:
+	struct ActionStats {
+		ActionStats();
+
+		uint64_t executed;
+		uint64_t late;
+		uint64_t missed;
+		uint64_t measured;
+		utils::duration minSlack;
+		utils::duration maxSlack;
+	};
+
 	Timeline();
 	virtual ~Timeline() {}
 
 	virtual void reset();
-	virtual void scheduleAction(std::unique_ptr<FrameAction> action);
+	virtual void scheduleAction(unsigned int frame, FrameAction *action);
 	virtual void notifyStartOfExposure(unsigned int frame, utils::time_point time);
 
 	utils::duration frameInterval() const { return frameInterval_; }
+	bool predictFrame(utils::time_point time, unsigned int *frame) const;
+
+	void setCalibration(bool enable, utils::duration margin);
+	ActionStats actionStats(unsigned int type) const;
 
 protected:
 	int frameOffset(unsigned int type) const;
 	utils::duration timeOffset(unsigned int type) const;
 
 	void setRawDelay(unsigned int type, int frame, utils::duration time);
+	void setCalibrated(unsigned int type);
 
 	std::map<unsigned int, std::pair<int, utils::duration>> delays_;
 
 private:
 	static constexpr unsigned int HISTORY_DEPTH = 10;
+	static constexpr unsigned int FRAME_SLOTS = 32;
+	static constexpr unsigned int SLOT_ACTIONS = 4;
+	static constexpr unsigned int CALIBRATION_WINDOW = 16;
+
+	struct Exposure {
+		unsigned int frame;
+		utils::time_point time;
+	};
+
+	struct ScheduledAction {
+		unsigned int frame;
+		FrameAction *action;
+		utils::time_point deadline;
+		utils::time_point executed;
+		bool pending;
+	};
+
+	struct FrameSlot {
+		unsigned int frame;
+		unsigned int count;
+		std::array<ScheduledAction, SLOT_ACTIONS> actions;
+	};
+
+	struct Calibration {
+		unsigned int samples;
+		utils::duration minSlack;
+	};
+
+	FrameSlot &slot(unsigned int frame) { return slots_[frame % FRAME_SLOTS]; }
+	ScheduledAction *allocateAction(unsigned int frame);
+	void findNextAction();
 
 	void timeout(Timer *timer);
 	void updateDeadline();
 
-	std::list<std::pair<unsigned int, utils::time_point>> history_;
-	std::multimap<utils::time_point, std::unique_ptr<FrameAction>> actions_;
+	void runAction(unsigned int frame, FrameAction *action,
+		       ScheduledAction *scheduled, utils::time_point now);
+	void measureSlack(const ScheduledAction &scheduled, utils::time_point soe);
+	void calibrate(unsigned int type, utils::duration slack);
+
+	std::array<Exposure, HISTORY_DEPTH> history_;
+	unsigned int historySize_;
+	unsigned int historyHead_;
 	utils::duration frameInterval_;
 
+	std::array<FrameSlot, FRAME_SLOTS> slots_;
+	ScheduledAction *nextAction_;
+
+	std::map<unsigned int, ActionStats> stats_;
+
+	bool calibration_;
+	utils::duration margin_;
+	std::set<unsigned int> calibratedTypes_;
+	std::map<unsigned int, Calibration> calibrations_;
+
 	Timer timer_;
 };
 
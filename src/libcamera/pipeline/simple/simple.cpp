@@ -0,0 +1,1217 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * simple.cpp - Pipeline handler for simple pipelines
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <list>
+#include <map>
+#include <memory>
+#include <queue>
+#include <set>
+#include <string>
+#include <string.h>
+#include <utility>
+#include <vector>
+
+#include <linux/media-bus-format.h>
+
+#include <ipa/ipa_interface.h>
+#include <ipa/simple.h>
+#include <libcamera/camera.h>
+#include <libcamera/request.h>
+#include <libcamera/stream.h>
+
+#include "camera_sensor.h"
+#include "converter.h"
+#include "cpu_accounting.h"
+#include "device_enumerator.h"
+#include "ipa_manager.h"
+#include "log.h"
+#include "media_device.h"
+#include "pipeline_handler.h"
+#include "software_isp.h"
+#include "v4l2_subdevice.h"
+#include "v4l2_videodevice.h"
+#include "yuv_stats.h"
+
+namespace libcamera {
+
+LOG_DEFINE_CATEGORY(SimplePipeline)
+
+/*
+ * The simple pipeline handler supports platforms made of a CSI-2 receiver, or
+ * a parallel capture interface, optionally paired with a memory-to-memory
+ * converter. The supported platforms are listed by the driver name of their
+ * capture media device, and of the converter media device if any.
+ *
+ * Raw Bayer formats, which applications can't use directly, are processed by
+ * the CPU with the SoftwareIsp, driven by the simple IPA when available. YUV
+ * captures have no hardware statistics either, the YuvStatsEngine computes
+ * them from the captured frames for the IPA to control the sensor.
+ */
+struct SimplePipelineInfo {
+	const char *driver;
+	const char *converter;
+};
+
+static const SimplePipelineInfo supportedDevices[] = {
+	{ "imx7-csi", "pxp" },
+	{ "sun6i-csi", nullptr },
+};
+
+class SimpleCameraData : public CameraData
+{
+public:
+	SimpleCameraData(PipelineHandler *pipe, MediaEntity *sensor);
+
+	bool isValid() const { return video_ != nullptr; }
+
+	int init();
+	void loadIPA();
+	int setupLinks();
+	int setupFormats(V4L2SubdeviceFormat *format);
+	void queueFrameAction(unsigned int frame,
+			      const IPAOperationData &action);
+
+	struct Entity {
+		MediaEntity *entity;
+		MediaLink *link;
+	};
+
+	struct Configuration {
+		uint32_t code;
+		uint32_t fourcc;
+		PixelFormat pixelFormat;
+		Size captureSize;
+		std::vector<PixelFormat> outputFormats;
+		SizeRange outputSizes;
+		bool softwareIsp;
+	};
+
+	Stream stream_;
+	std::unique_ptr<CameraSensor> sensor_;
+	std::list<Entity> entities_;
+	MediaEntity *videoEntity_;
+	V4L2VideoDevice *video_;
+
+	std::vector<Configuration> configs_;
+	std::map<PixelFormat, const Configuration *> formats_;
+
+	bool useConverter_;
+	bool useSoftwareIsp_;
+	bool useYuvStats_;
+	std::vector<std::unique_ptr<FrameBuffer>> captureBuffers_;
+	std::queue<FrameBuffer *> availableBuffers_;
+	std::map<FrameBuffer *, Request *> captureRequests_;
+	std::queue<Request *> pendingRequests_;
+};
+
+class SimpleCameraConfiguration : public CameraConfiguration
+{
+public:
+	SimpleCameraConfiguration(Camera *camera, SimpleCameraData *data);
+
+	Status validate() override;
+
+	const SimpleCameraData::Configuration *pipeConfig() const
+	{
+		return pipeConfig_;
+	}
+
+private:
+	/*
+	 * The SimpleCameraData instance is guaranteed to be valid as long as
+	 * the camera is valid as the camera holds a reference to its pipeline
+	 * handler.
+	 */
+	std::shared_ptr<Camera> camera_;
+	const SimpleCameraData *data_;
+	const SimpleCameraData::Configuration *pipeConfig_;
+};
+
+class PipelineHandlerSimple : public PipelineHandler
+{
+public:
+	PipelineHandlerSimple(CameraManager *manager);
+
+	int acquire(Camera *camera) override;
+
+	CameraConfiguration *generateConfiguration(Camera *camera,
+		const StreamRoles &roles) override;
+	int configure(Camera *camera, CameraConfiguration *config) override;
+
+	int exportFrameBuffers(Camera *camera, Stream *stream,
+			       std::vector<std::unique_ptr<FrameBuffer>> *buffers) override;
+	int importFrameBuffers(Camera *camera, Stream *stream) override;
+	int addFrameBuffers(Camera *camera, Stream *stream, unsigned int count,
+			    std::vector<std::unique_ptr<FrameBuffer>> *buffers) override;
+	void freeFrameBuffers(Camera *camera, Stream *stream) override;
+	void bufferUsage(const Camera *camera,
+			 std::vector<BufferPoolUsage> *pools) override;
+	void stallReport(const Camera *camera, CameraStall *stall) override;
+
+	int start(Camera *camera) override;
+	void stopDevice(Camera *camera) override;
+
+	int queueRequestDevice(Camera *camera, Request *request) override;
+
+	bool match(DeviceEnumerator *enumerator) override;
+
+	V4L2VideoDevice *video(const MediaEntity *entity);
+	V4L2Subdevice *subdev(const MediaEntity *entity);
+	Converter *converter() { return converter_.get(); }
+	SoftwareIsp *softwareIsp() { return softwareIsp_.get(); }
+
+private:
+	SimpleCameraData *cameraData(const Camera *camera)
+	{
+		return static_cast<SimpleCameraData *>(
+			PipelineHandler::cameraData(camera));
+	}
+
+	int createDevices(SimpleCameraData *data);
+	void queuePendingRequests(SimpleCameraData *data);
+
+	void bufferReady(FrameBuffer *buffer);
+	void converterInputDone(FrameBuffer *buffer);
+	void converterOutputDone(FrameBuffer *buffer);
+	void softwareIspStatsReady(FrameBuffer *buffer,
+				   const SoftwareIspStats &stats);
+	void processYuvStats(SimpleCameraData *data, FrameBuffer *buffer);
+
+	MediaDevice *media_;
+	std::map<const MediaEntity *, std::unique_ptr<V4L2VideoDevice>> videos_;
+	std::map<const MediaEntity *, std::unique_ptr<V4L2Subdevice>> subdevs_;
+	std::unique_ptr<Converter> converter_;
+	std::unique_ptr<SoftwareIsp> softwareIsp_;
+	YuvStatsEngine yuvStats_;
+
+	Camera *activeCamera_;
+};
+
+/* -----------------------------------------------------------------------------
+ * Camera Data
+ */
+
+SimpleCameraData::SimpleCameraData(PipelineHandler *pipe, MediaEntity *sensor)
+	: CameraData(pipe), videoEntity_(nullptr), video_(nullptr),
+	  useConverter_(false), useSoftwareIsp_(false), useYuvStats_(false)
+{
+	/* Find the closest video node and record the path to it. */
+	std::vector<MediaLink *> path =
+		sensor->device()->findPath(sensor, [](const MediaEntity *entity) {
+			return entity->function() == MEDIA_ENT_F_IO_V4L;
+		});
+	if (path.empty())
+		return;
+
+	for (MediaLink *link : path)
+		entities_.push_back({ link->source()->entity(), link });
+
+	videoEntity_ = path.back()->sink()->entity();
+}
+
+int SimpleCameraData::init()
+{
+	PipelineHandlerSimple *pipe = static_cast<PipelineHandlerSimple *>(pipe_);
+	Converter *converter = pipe->converter();
+	int ret;
+
+	video_ = pipe->video(videoEntity_);
+	if (!video_)
+		return -ENODEV;
+
+	sensor_ = std::make_unique<CameraSensor>(entities_.front().entity);
+	ret = sensor_->init();
+	if (ret)
+		return ret;
+
+	ret = setupLinks();
+	if (ret < 0)
+		return ret;
+
+	/*
+	 * Enumerate the capture configurations supported by the pipeline, by
+	 * propagating each media bus code of the sensor at its full
+	 * resolution down to the video node.
+	 */
+	for (unsigned int code : sensor_->mbusCodes()) {
+		V4L2SubdeviceFormat format = {};
+		format.mbus_code = code;
+		format.size = sensor_->resolution();
+
+		ret = setupFormats(&format);
+		if (ret < 0) {
+			LOG(SimplePipeline, Debug)
+				<< "Media bus code " << utils::hex(code, 4)
+				<< " not supported by the pipeline";
+			continue;
+		}
+
+		for (unsigned int fourcc : video_->formats(true).formats()) {
+			PixelFormat pixelFormat = V4L2VideoDevice::toPixelFormat(fourcc);
+
+			Configuration config;
+			config.code = code;
+			config.fourcc = fourcc;
+			config.pixelFormat = pixelFormat;
+			config.captureSize = format.size;
+			config.softwareIsp = !pixelFormat;
+
+			if (config.softwareIsp) {
+				/*
+				 * Formats without a pixel format, such as raw
+				 * Bayer, can only be captured through the
+				 * software ISP, at the capture size.
+				 */
+				config.outputFormats = SoftwareIsp::formats(fourcc);
+				if (config.outputFormats.empty())
+					continue;
+
+				config.outputSizes = SizeRange(format.size.width,
+							       format.size.height);
+			} else if (converter) {
+				config.outputFormats = converter->formats(pixelFormat);
+				config.outputSizes = converter->sizes(format.size);
+			}
+
+			configs_.push_back(config);
+		}
+	}
+
+	if (configs_.empty()) {
+		LOG(SimplePipeline, Error) << "No valid configuration found";
+		return -EINVAL;
+	}
+
+	/*
+	 * Map the output formats to the capture configurations. Native
+	 * formats take precedence over converted formats, and formats
+	 * converted by hardware over formats processed by the software ISP.
+	 */
+	for (const Configuration &config : configs_) {
+		if (!config.softwareIsp)
+			formats_.emplace(config.pixelFormat, &config);
+	}
+
+	for (bool softwareIsp : { false, true }) {
+		for (const Configuration &config : configs_) {
+			if (config.softwareIsp != softwareIsp)
+				continue;
+
+			for (PixelFormat pixelFormat : config.outputFormats)
+				formats_.emplace(pixelFormat, &config);
+		}
+	}
+
+	return 0;
+}
+
+void SimpleCameraData::loadIPA()
+{
+	/*
+	 * The IPA is optional, the software ISP can run with fixed parameters
+	 * and YUV captures without sensor control. It's only useful when
+	 * statistics can be computed for the IPA.
+	 */
+	bool statistics = std::any_of(configs_.begin(), configs_.end(),
+				      [](const Configuration &config) {
+					      return config.softwareIsp ||
+						     YuvStatsEngine::isSupported(config.pixelFormat);
+				      });
+	if (!statistics)
+		return;
+
+	ipa_ = IPAManager::instance()->createIPA(pipe_, 1, 1);
+	if (ipa_)
+		ipa_->queueFrameAction.connect(this,
+					       &SimpleCameraData::queueFrameAction);
+	else
+		LOG(SimplePipeline, Info)
+			<< "No IPA found, using fixed parameters";
+}
+
+void SimpleCameraData::queueFrameAction(unsigned int frame,
+					const IPAOperationData &action)
+{
+	PipelineHandlerSimple *pipe = static_cast<PipelineHandlerSimple *>(pipe_);
+
+	switch (action.operation) {
+	case SIMPLE_IPA_ACTION_V4L2_SET: {
+		ControlList controls = action.controls[0];
+		sensor_->setControls(&controls);
+		break;
+	}
+	case SIMPLE_IPA_ACTION_ISP_PARAMS: {
+		SoftwareIsp *isp = pipe->softwareIsp();
+		if (!isp || action.data.size() != 4)
+			break;
+
+		SoftwareIspParams params;
+		params.blackLevel = action.data[0];
+		for (unsigned int i = 0; i < params.gains.size(); ++i)
+			params.gains[i] = action.data[i + 1] / 256.0;
+
+		isp->setParams(params);
+		break;
+	}
+	default:
+		LOG(SimplePipeline, Error) << "Unknown action " << action.operation;
+		break;
+	}
+}
+
+int SimpleCameraData::setupLinks()
+{
+	int ret;
+
+	/*
+	 * Configure all links along the pipeline. Some entities may not allow
+	 * multiple sink links to be enabled together, even on different sink
+	 * pads. Start by disabling all the other sink links of each entity
+	 * before enabling the pipeline link.
+	 */
+	for (const Entity &e : entities_) {
+		MediaEntity *remote = e.link->sink()->entity();
+
+		for (MediaPad *pad : remote->pads()) {
+			if (!(pad->flags() & MEDIA_PAD_FL_SINK))
+				continue;
+
+			for (MediaLink *link : pad->links()) {
+				if (link == e.link)
+					continue;
+
+				if ((link->flags() & MEDIA_LNK_FL_ENABLED) &&
+				    !(link->flags() & MEDIA_LNK_FL_IMMUTABLE)) {
+					ret = link->setEnabled(false);
+					if (ret < 0)
+						return ret;
+				}
+			}
+		}
+
+		if (!(e.link->flags() & MEDIA_LNK_FL_ENABLED)) {
+			ret = e.link->setEnabled(true);
+			if (ret < 0)
+				return ret;
+		}
+	}
+
+	return 0;
+}
+
+int SimpleCameraData::setupFormats(V4L2SubdeviceFormat *format)
+{
+	PipelineHandlerSimple *pipe = static_cast<PipelineHandlerSimple *>(pipe_);
+	int ret;
+
+	/*
+	 * Configure the format on the sensor output and propagate it through
+	 * the pipeline, requiring every entity to accept the format produced
+	 * by its source unmodified.
+	 */
+	ret = sensor_->setFormat(format);
+	if (ret < 0)
+		return ret;
+
+	for (const Entity &e : entities_) {
+		MediaPad *source = e.link->source();
+		MediaPad *sink = e.link->sink();
+
+		if (source->entity() != sensor_->entity()) {
+			V4L2Subdevice *subdev = pipe->subdev(source->entity());
+			ret = subdev->getFormat(source->index(), format);
+			if (ret < 0)
+				return ret;
+		}
+
+		if (sink->entity()->function() == MEDIA_ENT_F_IO_V4L)
+			continue;
+
+		V4L2SubdeviceFormat sourceFormat = *format;
+		V4L2Subdevice *subdev = pipe->subdev(sink->entity());
+		ret = subdev->setFormat(sink->index(), format);
+		if (ret < 0)
+			return ret;
+
+		if (format->mbus_code != sourceFormat.mbus_code ||
+		    format->size != sourceFormat.size) {
+			LOG(SimplePipeline, Debug)
+				<< "Source '" << source->entity()->name()
+				<< "':" << source->index()
+				<< " produces " << sourceFormat.toString()
+				<< ", sink '" << sink->entity()->name()
+				<< "':" << sink->index()
+				<< " requires " << format->toString();
+			return -EINVAL;
+		}
+	}
+
+	return 0;
+}
+
+/* -----------------------------------------------------------------------------
+ * Camera Configuration
+ */
+
+SimpleCameraConfiguration::SimpleCameraConfiguration(Camera *camera,
+						     SimpleCameraData *data)
+	: CameraConfiguration(), camera_(camera->shared_from_this()),
+	  data_(data), pipeConfig_(nullptr)
+{
+}
+
+CameraConfiguration::Status SimpleCameraConfiguration::validate()
+{
+	Status status = Valid;
+
+	if (config_.empty())
+		return Invalid;
+
+	/* Cap the number of entries to the available streams. */
+	if (config_.size() > 1) {
+		config_.resize(1);
+		status = Adjusted;
+	}
+
+	StreamConfiguration &cfg = config_[0];
+
+	/* Adjust the pixel format. */
+	auto it = data_->formats_.find(cfg.pixelFormat);
+	if (it == data_->formats_.end()) {
+		it = data_->formats_.begin();
+		LOG(SimplePipeline, Debug)
+			<< "Adjusting pixel format from " << cfg.pixelFormat
+			<< " to " << it->first;
+		cfg.pixelFormat = it->first;
+		status = Adjusted;
+	}
+
+	pipeConfig_ = it->second;
+
+	/*
+	 * Adjust the size. The converter can scale, direct capture is limited
+	 * to the sensor resolution.
+	 */
+	const std::vector<PixelFormat> &outputFormats = pipeConfig_->outputFormats;
+	bool convert = std::find(outputFormats.begin(), outputFormats.end(),
+				 cfg.pixelFormat) != outputFormats.end();
+
+	Size size = pipeConfig_->captureSize;
+	if (convert) {
+		const SizeRange &range = pipeConfig_->outputSizes;
+		size.width = std::min(std::max(cfg.size.width, range.min.width),
+				      range.max.width);
+		size.height = std::min(std::max(cfg.size.height, range.min.height),
+				       range.max.height);
+	}
+
+	if (cfg.size != size) {
+		LOG(SimplePipeline, Debug)
+			<< "Adjusting size from " << cfg.size.toString()
+			<< " to " << size.toString();
+		cfg.size = size;
+		status = Adjusted;
+	}
+
+	if (cfg.memory != FrameBuffer::MemoryDmaBuf) {
+		LOG(SimplePipeline, Debug) << "User pointers not supported";
+		cfg.memory = FrameBuffer::MemoryDmaBuf;
+		status = Adjusted;
+	}
+
+	cfg.bufferCount = 4;
+
+	/*
+	 * The sensor always outputs its full resolution with the media bus
+	 * code of the pipeline configuration.
+	 *
+	 * \todo Estimate the processing time of the converter and the
+	 * software ISP, and report it as the stall duration.
+	 */
+	V4L2SubdeviceFormat format = {};
+	format.mbus_code = pipeConfig_->code;
+	format.size = data_->sensor_->resolution();
+
+	const CameraSensor::Mode *mode = data_->sensor_->mode(format);
+	minFrameDuration = mode ? mode->minFrameDuration : 0;
+	maxFrameDuration = mode ? mode->maxFrameDuration : 0;
+	cfg.stallDuration = 0;
+
+	return status;
+}
+
+/* -----------------------------------------------------------------------------
+ * Pipeline Handler
+ */
+
+PipelineHandlerSimple::PipelineHandlerSimple(CameraManager *manager)
+	: PipelineHandler(manager), media_(nullptr), activeCamera_(nullptr)
+{
+}
+
+int PipelineHandlerSimple::acquire(Camera *camera)
+{
+	SimpleCameraData *data = cameraData(camera);
+	if (!data->ipa_)
+		data->loadIPA();
+
+	return 0;
+}
+
+CameraConfiguration *PipelineHandlerSimple::generateConfiguration(Camera *camera,
+	const StreamRoles &roles)
+{
+	SimpleCameraData *data = cameraData(camera);
+	CameraConfiguration *config = new SimpleCameraConfiguration(camera, data);
+
+	if (roles.empty())
+		return config;
+
+	/* Create the formats map. */
+	std::map<PixelFormat, std::vector<SizeRange>> formats;
+
+	for (const auto &format : data->formats_) {
+		const SimpleCameraData::Configuration *pipeConfig = format.second;
+		const std::vector<PixelFormat> &outputFormats = pipeConfig->outputFormats;
+
+		if (std::find(outputFormats.begin(), outputFormats.end(),
+			      format.first) != outputFormats.end())
+			formats[format.first] = { pipeConfig->outputSizes };
+		else
+			formats[format.first] = { SizeRange(pipeConfig->captureSize.width,
+							    pipeConfig->captureSize.height) };
+	}
+
+	StreamConfiguration cfg{ StreamFormats{ formats } };
+	cfg.pixelFormat = formats.begin()->first;
+	cfg.size = formats.begin()->second[0].max;
+
+	config->addConfiguration(cfg);
+
+	config->validate();
+
+	return config;
+}
+
+int PipelineHandlerSimple::configure(Camera *camera, CameraConfiguration *c)
+{
+	SimpleCameraConfiguration *config =
+		static_cast<SimpleCameraConfiguration *>(c);
+	SimpleCameraData *data = cameraData(camera);
+	StreamConfiguration &cfg = config->at(0);
+	const SimpleCameraData::Configuration *pipeConfig = config->pipeConfig();
+	int ret;
+
+	/* Configure the media graph for the camera. */
+	ret = data->setupLinks();
+	if (ret < 0)
+		return ret;
+
+	V4L2SubdeviceFormat format = {};
+	format.mbus_code = pipeConfig->code;
+	format.size = pipeConfig->captureSize;
+
+	ret = data->setupFormats(&format);
+	if (ret < 0)
+		return ret;
+
+	/* Configure the video node. */
+	V4L2DeviceFormat captureFormat = {};
+	captureFormat.fourcc = pipeConfig->fourcc;
+	captureFormat.size = pipeConfig->captureSize;
+
+	ret = data->video_->setFormat(&captureFormat);
+	if (ret)
+		return ret;
+
+	if (captureFormat.fourcc != pipeConfig->fourcc ||
+	    captureFormat.size != pipeConfig->captureSize) {
+		LOG(SimplePipeline, Error)
+			<< "Unable to configure capture in "
+			<< captureFormat.toString();
+		return -EINVAL;
+	}
+
+	/*
+	 * Configure the software ISP for raw captures, and the converter if
+	 * the output differs from the capture.
+	 */
+	data->useSoftwareIsp_ = pipeConfig->softwareIsp;
+	data->useConverter_ = !data->useSoftwareIsp_ &&
+			      (cfg.pixelFormat != pipeConfig->pixelFormat ||
+			       cfg.size != pipeConfig->captureSize);
+
+	if (data->useSoftwareIsp_) {
+		if (!softwareIsp_) {
+			softwareIsp_ = std::make_unique<SoftwareIsp>();
+			softwareIsp_->inputBufferReady.connect(this, &PipelineHandlerSimple::converterInputDone);
+			softwareIsp_->statsReady.connect(this, &PipelineHandlerSimple::softwareIspStatsReady);
+			softwareIsp_->outputBufferReady.connect(this, &PipelineHandlerSimple::converterOutputDone);
+		}
+
+		StreamConfiguration inputCfg;
+		inputCfg.pixelFormat = pipeConfig->fourcc;
+		inputCfg.size = pipeConfig->captureSize;
+		inputCfg.bufferCount = cfg.bufferCount;
+
+		ret = softwareIsp_->configure(inputCfg, captureFormat.planes[0].bpl,
+					      cfg);
+		if (ret < 0) {
+			LOG(SimplePipeline, Error)
+				<< "Unable to configure software ISP";
+			return ret;
+		}
+
+		LOG(SimplePipeline, Debug)
+			<< "Processing " << captureFormat.toString()
+			<< " to " << cfg.toString();
+	}
+
+	/*
+	 * Compute statistics from YUV captures for the IPA to control the
+	 * sensor. Failure to do so isn't fatal, the frames are still captured.
+	 */
+	data->useYuvStats_ = !data->useSoftwareIsp_ && data->ipa_ &&
+			     YuvStatsEngine::isSupported(pipeConfig->pixelFormat);
+	if (data->useYuvStats_) {
+		ret = yuvStats_.configure(pipeConfig->pixelFormat,
+					  pipeConfig->captureSize,
+					  captureFormat.planes[0].bpl);
+		if (ret < 0) {
+			LOG(SimplePipeline, Warning)
+				<< "Unable to compute statistics for "
+				<< captureFormat.toString();
+			data->useYuvStats_ = false;
+		}
+	}
+
+	if (data->useConverter_) {
+		StreamConfiguration inputCfg;
+		inputCfg.pixelFormat = pipeConfig->pixelFormat;
+		inputCfg.size = pipeConfig->captureSize;
+		inputCfg.bufferCount = cfg.bufferCount;
+
+		ret = converter_->configure(inputCfg, { cfg });
+		if (ret < 0) {
+			LOG(SimplePipeline, Error)
+				<< "Unable to configure converter";
+			return ret;
+		}
+
+		LOG(SimplePipeline, Debug)
+			<< "Converting from " << inputCfg.toString()
+			<< " to " << cfg.toString();
+	}
+
+	cfg.setStream(&data->stream_);
+
+	return 0;
+}
+
+int PipelineHandlerSimple::exportFrameBuffers(Camera *camera, Stream *stream,
+					      std::vector<std::unique_ptr<FrameBuffer>> *buffers)
+{
+	SimpleCameraData *data = cameraData(camera);
+	unsigned int count = stream->configuration().bufferCount;
+
+	if (data->useConverter_)
+		return converter_->exportBuffers(0, count, buffers);
+
+	if (data->useSoftwareIsp_)
+		return softwareIsp_->exportBuffers(count, buffers);
+
+	data->video_->setCpuAccess(stream->cpuAccess());
+	return data->video_->exportBuffers(count, buffers);
+}
+
+int PipelineHandlerSimple::importFrameBuffers(Camera *camera, Stream *stream)
+{
+	SimpleCameraData *data = cameraData(camera);
+	unsigned int count = stream->configuration().bufferCount;
+
+	/*
+	 * The converter imports the application buffers when started, and
+	 * the software ISP maps them when processing frames.
+	 */
+	if (data->useConverter_ || data->useSoftwareIsp_)
+		return 0;
+
+	return data->video_->importBuffers(count);
+}
+
+int PipelineHandlerSimple::addFrameBuffers(Camera *camera, Stream *stream,
+					   unsigned int count,
+					   std::vector<std::unique_ptr<FrameBuffer>> *buffers)
+{
+	SimpleCameraData *data = cameraData(camera);
+
+	if (data->useConverter_ || data->useSoftwareIsp_)
+		return -ENOTSUP;
+
+	return data->video_->addBuffers(count, buffers);
+}
+
+void PipelineHandlerSimple::freeFrameBuffers(Camera *camera, Stream *stream)
+{
+	SimpleCameraData *data = cameraData(camera);
+
+	if (data->useConverter_ || data->useSoftwareIsp_)
+		return;
+
+	data->video_->releaseBuffers();
+}
+
+void PipelineHandlerSimple::bufferUsage(const Camera *camera,
+					std::vector<BufferPoolUsage> *pools)
+{
+	SimpleCameraData *data = cameraData(camera);
+
+	if (data->captureBuffers_.empty())
+		return;
+
+	BufferPoolUsage usage(BufferPoolUsage::Internal, nullptr, "capture");
+	usage.add(data->captureBuffers_);
+	pools->push_back(usage);
+}
+
+void PipelineHandlerSimple::stallReport(const Camera *camera, CameraStall *stall)
+{
+	SimpleCameraData *data = cameraData(camera);
+
+	stall->devices.push_back({ data->video_->deviceNode(),
+				   data->video_->queuedBuffers() });
+}
+
+int PipelineHandlerSimple::start(Camera *camera)
+{
+	SimpleCameraData *data = cameraData(camera);
+	int ret;
+
+	activeCamera_ = camera;
+
+	/* Inform the IPA of the stream configuration and sensor controls. */
+	if (data->ipa_ && (data->useSoftwareIsp_ || data->useYuvStats_)) {
+		const StreamConfiguration &cfg = data->stream_.configuration();
+		std::map<unsigned int, IPAStream> streamConfig;
+		streamConfig[0] = {
+			.pixelFormat = cfg.pixelFormat,
+			.size = cfg.size,
+		};
+
+		std::map<unsigned int, const ControlInfoMap &> entityControls;
+		entityControls.emplace(0, data->sensor_->controls());
+
+		data->ipa_->configure(streamConfig, entityControls);
+	}
+
+	if (!data->useConverter_ && !data->useSoftwareIsp_) {
+		ret = data->video_->streamOn();
+		if (ret < 0)
+			activeCamera_ = nullptr;
+
+		return ret;
+	}
+
+	/*
+	 * Capture to an internal pool of buffers, shared with the converter
+	 * as dmabufs, or processed in place by the software ISP. The latter
+	 * only accesses the buffers from the CPU, there's no need to export
+	 * them.
+	 */
+	unsigned int count = data->stream_.configuration().bufferCount;
+	if (data->useSoftwareIsp_)
+		ret = data->video_->allocateBuffers(count, &data->captureBuffers_);
+	else
+		ret = data->video_->exportBuffers(count, &data->captureBuffers_);
+	if (ret < 0) {
+		activeCamera_ = nullptr;
+		return ret;
+	}
+
+	for (std::unique_ptr<FrameBuffer> &buffer : data->captureBuffers_)
+		data->availableBuffers_.push(buffer.get());
+
+	if (data->useSoftwareIsp_)
+		ret = softwareIsp_->start();
+	else
+		ret = converter_->start();
+	if (ret < 0)
+		goto error;
+
+	ret = data->video_->streamOn();
+	if (ret < 0) {
+		if (data->useSoftwareIsp_)
+			softwareIsp_->stop();
+		else
+			converter_->stop();
+		goto error;
+	}
+
+	return 0;
+
+error:
+	data->availableBuffers_ = {};
+	data->captureBuffers_.clear();
+	data->video_->releaseBuffers();
+	activeCamera_ = nullptr;
+
+	return ret;
+}
+
+void PipelineHandlerSimple::stopDevice(Camera *camera)
+{
+	SimpleCameraData *data = cameraData(camera);
+
+	/* Release the mappings of the buffers before they get freed. */
+	yuvStats_.clear();
+
+	if (!data->useConverter_ && !data->useSoftwareIsp_) {
+		data->video_->streamOff();
+		activeCamera_ = nullptr;
+		return;
+	}
+
+	/*
+	 * Take the requests not queued to the device yet out of the pending
+	 * queue, to prevent them from being queued when the buffers in flight
+	 * are returned.
+	 */
+	std::queue<Request *> pendingRequests;
+	std::swap(pendingRequests, data->pendingRequests_);
+
+	data->video_->streamOff();
+	if (data->useSoftwareIsp_)
+		softwareIsp_->stop();
+	else
+		converter_->stop();
+
+	while (!pendingRequests.empty()) {
+		cancelRequest(camera, pendingRequests.front());
+		pendingRequests.pop();
+	}
+
+	data->captureRequests_.clear();
+	data->availableBuffers_ = {};
+	data->captureBuffers_.clear();
+	data->video_->releaseBuffers();
+
+	activeCamera_ = nullptr;
+}
+
+int PipelineHandlerSimple::queueRequestDevice(Camera *camera, Request *request)
+{
+	SimpleCameraData *data = cameraData(camera);
+	FrameBuffer *buffer = request->findBuffer(&data->stream_);
+	if (!buffer) {
+		LOG(SimplePipeline, Error)
+			<< "Attempt to queue request with invalid stream";
+		return -ENOENT;
+	}
+
+	if (data->useConverter_ || data->useSoftwareIsp_) {
+		data->pendingRequests_.push(request);
+		queuePendingRequests(data);
+		return 0;
+	}
+
+	return data->video_->queueBuffer(buffer);
+}
+
+void PipelineHandlerSimple::queuePendingRequests(SimpleCameraData *data)
+{
+	while (!data->pendingRequests_.empty() &&
+	       !data->availableBuffers_.empty()) {
+		Request *request = data->pendingRequests_.front();
+		FrameBuffer *buffer = data->availableBuffers_.front();
+
+		data->pendingRequests_.pop();
+		data->availableBuffers_.pop();
+
+		int ret = data->video_->queueBuffer(buffer);
+		if (ret < 0) {
+			data->availableBuffers_.push(buffer);
+			cancelRequest(activeCamera_, request);
+			continue;
+		}
+
+		data->captureRequests_[buffer] = request;
+	}
+}
+
+/* -----------------------------------------------------------------------------
+ * Match and Setup
+ */
+
+bool PipelineHandlerSimple::match(DeviceEnumerator *enumerator)
+{
+	const SimplePipelineInfo *info = nullptr;
+
+	for (const SimplePipelineInfo &inf : supportedDevices) {
+		DeviceMatch dm(inf.driver);
+		media_ = acquireMediaDevice(enumerator, dm);
+		if (media_) {
+			info = &inf;
+			break;
+		}
+	}
+
+	if (!media_)
+		return false;
+
+	if (info->converter) {
+		DeviceMatch converterMatch(info->converter);
+		MediaDevice *converter = acquireMediaDevice(enumerator, converterMatch);
+		if (converter) {
+			converter_ = std::make_unique<Converter>(converter);
+			if (converter_->open() < 0) {
+				LOG(SimplePipeline, Warning)
+					<< "Failed to open converter, disabling format conversion";
+				converter_.reset();
+			} else {
+				converter_->inputBufferReady.connect(this, &PipelineHandlerSimple::converterInputDone);
+				converter_->outputBufferReady.connect(this, &PipelineHandlerSimple::converterOutputDone);
+			}
+		}
+	}
+
+	/* Locate the sensors and create one camera data instance per sensor. */
+	std::vector<std::unique_ptr<SimpleCameraData>> pipelines;
+
+	for (MediaEntity *entity : media_->entities()) {
+		if (entity->function() != MEDIA_ENT_F_CAM_SENSOR)
+			continue;
+
+		std::unique_ptr<SimpleCameraData> data =
+			std::make_unique<SimpleCameraData>(this, entity);
+		if (!data->isValid()) {
+			LOG(SimplePipeline, Error)
+				<< "No valid pipeline for sensor '"
+				<< entity->name() << "', skipping";
+			continue;
+		}
+
+		if (createDevices(data.get()))
+			continue;
+
+		pipelines.push_back(std::move(data));
+	}
+
+	if (pipelines.empty()) {
+		LOG(SimplePipeline, Error) << "No sensor found";
+		return false;
+	}
+
+	/* Initialize each pipeline and register a camera for it. */
+	bool registered = false;
+
+	for (std::unique_ptr<SimpleCameraData> &data : pipelines) {
+		int ret = data->init();
+		if (ret < 0)
+			continue;
+
+		std::set<Stream *> streams{ &data->stream_ };
+		std::shared_ptr<Camera> camera =
+			Camera::create(this, data->sensor_->entity()->name(),
+				       streams);
+		registerCamera(std::move(camera), std::move(data));
+		registered = true;
+	}
+
+	return registered;
+}
+
+/*
+ * Create and open the video device and subdevices along the pipeline of a
+ * camera, sharing them with the other cameras using the same entities.
+ */
+int PipelineHandlerSimple::createDevices(SimpleCameraData *data)
+{
+	for (const SimpleCameraData::Entity &e : data->entities_) {
+		/* The sensor subdevice is managed by the CameraSensor. */
+		if (e.entity == data->entities_.front().entity)
+			continue;
+
+		if (subdevs_.count(e.entity))
+			continue;
+
+		std::unique_ptr<V4L2Subdevice> subdev =
+			std::make_unique<V4L2Subdevice>(e.entity);
+		int ret = subdev->open();
+		if (ret < 0) {
+			LOG(SimplePipeline, Error)
+				<< "Failed to open " << e.entity->name();
+			return ret;
+		}
+
+		subdevs_[e.entity] = std::move(subdev);
+	}
+
+	if (videos_.count(data->videoEntity_))
+		return 0;
+
+	std::unique_ptr<V4L2VideoDevice> video =
+		std::make_unique<V4L2VideoDevice>(data->videoEntity_);
+	int ret = video->open();
+	if (ret < 0) {
+		LOG(SimplePipeline, Error)
+			<< "Failed to open " << data->videoEntity_->name();
+		return ret;
+	}
+
+	video->bufferReady.connect(this, &PipelineHandlerSimple::bufferReady);
+	videos_[data->videoEntity_] = std::move(video);
+
+	return 0;
+}
+
+V4L2VideoDevice *PipelineHandlerSimple::video(const MediaEntity *entity)
+{
+	auto iter = videos_.find(entity);
+	if (iter == videos_.end())
+		return nullptr;
+
+	return iter->second.get();
+}
+
+V4L2Subdevice *PipelineHandlerSimple::subdev(const MediaEntity *entity)
+{
+	auto iter = subdevs_.find(entity);
+	if (iter == subdevs_.end())
+		return nullptr;
+
+	return iter->second.get();
+}
+
+/* -----------------------------------------------------------------------------
+ * Buffer Handling
+ */
+
+void PipelineHandlerSimple::bufferReady(FrameBuffer *buffer)
+{
+	ASSERT(activeCamera_);
+	SimpleCameraData *data = cameraData(activeCamera_);
+
+	if (data->useYuvStats_ &&
+	    buffer->metadata().status == FrameMetadata::FrameSuccess)
+		processYuvStats(data, buffer);
+
+	if (!data->useConverter_ && !data->useSoftwareIsp_) {
+		Request *request = buffer->request();
+
+		completeBuffer(activeCamera_, request, buffer);
+		completeRequest(activeCamera_, request);
+		return;
+	}
+
+	auto it = data->captureRequests_.find(buffer);
+	if (it == data->captureRequests_.end())
+		return;
+
+	Request *request = it->second;
+	data->captureRequests_.erase(it);
+
+	if (buffer->metadata().status == FrameMetadata::FrameSuccess) {
+		FrameBuffer *output = request->findBuffer(&data->stream_);
+		int ret = data->useSoftwareIsp_
+			? softwareIsp_->queueBuffers(buffer, output)
+			: converter_->queueBuffers(buffer, { { 0, output } });
+		if (!ret)
+			return;
+	}
+
+	data->availableBuffers_.push(buffer);
+	cancelRequest(activeCamera_, request);
+	queuePendingRequests(data);
+}
+
+void PipelineHandlerSimple::converterInputDone(FrameBuffer *buffer)
+{
+	ASSERT(activeCamera_);
+	SimpleCameraData *data = cameraData(activeCamera_);
+
+	data->availableBuffers_.push(buffer);
+	queuePendingRequests(data);
+}
+
+void PipelineHandlerSimple::converterOutputDone(FrameBuffer *buffer)
+{
+	ASSERT(activeCamera_);
+	Request *request = buffer->request();
+
+	completeBuffer(activeCamera_, request, buffer);
+	completeRequest(activeCamera_, request);
+}
+
+void PipelineHandlerSimple::softwareIspStatsReady(FrameBuffer *buffer,
+						  const SoftwareIspStats &stats)
+{
+	ASSERT(activeCamera_);
+	SimpleCameraData *data = cameraData(activeCamera_);
+
+	LOG(SimplePipeline, Debug)
+		<< "Frame " << buffer->metadata().sequence << " processed in "
+		<< std::chrono::duration_cast<std::chrono::microseconds>(stats.processingTime).count()
+		<< "us";
+
+	if (!data->ipa_)
+		return;
+
+	/* Pass the means on a 16-bit scale and the luminance grid inline. */
+	IPAOperationData op;
+	op.operation = SIMPLE_IPA_EVENT_STATS;
+	op.data.reserve(4 + stats.luminance.size());
+	op.data.push_back(buffer->metadata().sequence);
+
+	for (unsigned int i = 0; i < stats.sums.size(); ++i)
+		op.data.push_back(stats.counts[i]
+				  ? (stats.sums[i] << (16 - stats.bitDepth)) / stats.counts[i]
+				  : 0);
+
+	op.data.insert(op.data.end(), stats.luminance.begin(),
+		       stats.luminance.end());
+
+	CpuScope scope(CameraStatistics::CpuIPA, data->camera_);
+	data->ipa_->processEvent(op);
+}
+
+void PipelineHandlerSimple::processYuvStats(SimpleCameraData *data,
+					    FrameBuffer *buffer)
+{
+	YuvStats stats;
+
+	int ret = yuvStats_.process(buffer, &stats);
+	if (ret < 0) {
+		LOG(SimplePipeline, Warning)
+			<< "Failed to compute statistics: " << strerror(-ret);
+		return;
+	}
+
+	LOG(SimplePipeline, Debug)
+		<< "Frame " << buffer->metadata().sequence << " statistics in "
+		<< std::chrono::duration_cast<std::chrono::microseconds>(stats.processingTime).count()
+		<< "us";
+
+	IPAOperationData op;
+	op.operation = SIMPLE_IPA_EVENT_YUV_STATS;
+	op.data.reserve(1 + stats.luminance.size() * 3 + stats.histogram.size());
+	op.data.push_back(buffer->metadata().sequence);
+	op.data.insert(op.data.end(), stats.luminance.begin(),
+		       stats.luminance.end());
+	op.data.insert(op.data.end(), stats.cb.begin(), stats.cb.end());
+	op.data.insert(op.data.end(), stats.cr.begin(), stats.cr.end());
+	op.data.insert(op.data.end(), stats.histogram.begin(),
+		       stats.histogram.end());
+
+	CpuScope scope(CameraStatistics::CpuIPA, data->camera_);
+	data->ipa_->processEvent(op);
+}
+
+REGISTER_PIPELINE_HANDLER(PipelineHandlerSimple);
+
+} /* namespace libcamera */
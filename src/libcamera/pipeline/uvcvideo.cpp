@@ -6,21 +6,30 @@
  */
 
 #include <algorithm>
+#include <deque>
 #include <iomanip>
+#include <limits.h>
+#include <map>
+#include <queue>
+#include <string.h>
 #include <sys/sysmacros.h>
 #include <tuple>
 
 #include <libcamera/camera.h>
 #include <libcamera/control_ids.h>
 #include <libcamera/controls.h>
+#include <libcamera/mapped_framebuffer.h>
 #include <libcamera/request.h>
 #include <libcamera/stream.h>
 
+#include "buffer_metadata.h"
+#include "converter.h"
 #include "device_enumerator.h"
 #include "log.h"
 #include "media_device.h"
 #include "pipeline_handler.h"
 #include "utils.h"
+#include "v4l2_control_writer.h"
 #include "v4l2_controls.h"
 #include "v4l2_videodevice.h"
 
@@ -28,32 +37,243 @@ namespace libcamera {
 
 LOG_DEFINE_CATEGORY(UVC)
 
+/* UVC payload header flags, as defined by the USB Video Class specification. */
+static constexpr uint8_t UVCStreamPts = 1 << 2;
+static constexpr uint8_t UVCStreamScr = 1 << 3;
+
+/*
+ * Size of the struct uvc_meta_buf fields that precede the payload header data:
+ * the host timestamp, USB frame number, and the header length and flags.
+ */
+static constexpr size_t UVCMetaBufSize = 12;
+
+static uint32_t readLE32(const uint8_t *data)
+{
+	return data[0] | (data[1] << 8) | (data[2] << 16) |
+	       (static_cast<uint32_t>(data[3]) << 24);
+}
+
+/*
+ * Convert device clock values to the host clock. The Source Clock Reference
+ * (SCR) of the UVC payload headers samples the device clock when the payload
+ * is transmitted, and the uvcvideo driver records the host time at which the
+ * payload is received. Those pairs are affected by the USB transfer jitter,
+ * a linear regression over the most recent samples estimates the relationship
+ * between the two clocks, including their frequency drift.
+ */
+class UVCClock
+{
+public:
+	UVCClock()
+	{
+		reset();
+	}
+
+	void reset();
+	void addSample(uint32_t stc, uint64_t ns);
+	void update();
+	bool toHost(uint32_t pts, uint64_t *ns) const;
+
+private:
+	static constexpr unsigned int MinSamples = 8;
+	static constexpr unsigned int MaxSamples = 64;
+
+	/* Unwrapped device clock ticks and host time in nanoseconds. */
+	std::deque<std::pair<int64_t, uint64_t>> samples_;
+	uint32_t lastStc_;
+	int64_t lastTicks_;
+
+	/* Regression line, relative to the first sample of the window. */
+	bool valid_;
+	int64_t ticks0_;
+	uint64_t ns0_;
+	double meanTicks_;
+	double meanNs_;
+	double slope_;
+};
+
+void UVCClock::reset()
+{
+	samples_.clear();
+	lastStc_ = 0;
+	lastTicks_ = 0;
+	valid_ = false;
+}
+
+void UVCClock::addSample(uint32_t stc, uint64_t ns)
+{
+	if (!samples_.empty()) {
+		const int32_t delta = static_cast<int32_t>(stc - lastStc_);
+
+		/* The same payload header may be reported multiple times. */
+		if (!delta)
+			return;
+
+		/*
+		 * Start over if either clock went backwards or samples have
+		 * been missing for a long time, as when the stream restarts.
+		 */
+		if (delta < 0 || ns <= samples_.back().second ||
+		    ns - samples_.back().second > 1000000000ULL) {
+			reset();
+		} else {
+			lastTicks_ += delta;
+		}
+	}
+
+	lastStc_ = stc;
+	samples_.emplace_back(lastTicks_, ns);
+	if (samples_.size() > MaxSamples)
+		samples_.pop_front();
+}
+
+void UVCClock::update()
+{
+	valid_ = false;
+
+	if (samples_.size() < MinSamples)
+		return;
+
+	/* Compute relative to the first sample to preserve precision. */
+	ticks0_ = samples_.front().first;
+	ns0_ = samples_.front().second;
+	meanTicks_ = 0.0;
+	meanNs_ = 0.0;
+
+	for (const auto &sample : samples_) {
+		meanTicks_ += sample.first - ticks0_;
+		meanNs_ += sample.second - ns0_;
+	}
+
+	meanTicks_ /= samples_.size();
+	meanNs_ /= samples_.size();
+
+	double covariance = 0.0;
+	double variance = 0.0;
+
+	for (const auto &sample : samples_) {
+		const double dt = sample.first - ticks0_ - meanTicks_;
+		const double dn = sample.second - ns0_ - meanNs_;
+
+		covariance += dt * dn;
+		variance += dt * dt;
+	}
+
+	if (variance <= 0.0 || covariance <= 0.0)
+		return;
+
+	slope_ = covariance / variance;
+	valid_ = true;
+}
+
+bool UVCClock::toHost(uint32_t pts, uint64_t *ns) const
+{
+	if (!valid_)
+		return false;
+
+	/* The PTS is close to the last SCR, unwrap it relatively. */
+	const int64_t ticks = lastTicks_ + static_cast<int32_t>(pts - lastStc_);
+	const double offset = meanNs_ + slope_ * (ticks - ticks0_ - meanTicks_);
+
+	if (offset < 0 && static_cast<uint64_t>(-offset) > ns0_)
+		return false;
+
+	*ns = ns0_ + static_cast<int64_t>(offset);
+	return true;
+}
+
 class UVCCameraData : public CameraData
 {
 public:
 	UVCCameraData(PipelineHandler *pipe)
-		: CameraData(pipe), video_(nullptr)
+		: CameraData(pipe), video_(nullptr), useConverter_(false),
+		  streaming_(false), frameDuration_(0), recovering_(false),
+		  metadataStreaming_(false), metadataSequenceValid_(false),
+		  metadataSequence_(0)
 	{
 	}
 
 	~UVCCameraData()
 	{
+		controlWriter_.reset();
+		metadata_.reset();
 		delete video_;
 	}
 
 	int init(MediaEntity *entity);
+	int initConverter(MediaDevice *media);
+	void initMetadata(MediaDevice *media);
+	Size captureSize(PixelFormat pixelFormat, const Size &size);
+
+	void startMetadata();
+	void stopMetadata();
+	void resetMetadata();
+
 	void bufferReady(FrameBuffer *buffer);
+	void processBuffer(FrameBuffer *buffer);
+	void metadataReady(FrameBuffer *buffer);
+	void parseMetadata(FrameBuffer *buffer);
+	void completeWaitingBuffers(bool all);
+	void converterInputReady(FrameBuffer *buffer);
+	void converterOutputReady(FrameBuffer *buffer);
+	void queuePendingRequests();
+	int streamOn();
+
+	static constexpr unsigned int MetadataBufferCount = 8;
 
 	V4L2VideoDevice *video_;
+	std::unique_ptr<V4L2ControlWriter> controlWriter_;
 	Stream stream_;
+
+	std::unique_ptr<Converter> converter_;
+	std::map<PixelFormat, PixelFormat> conversions_;
+	std::map<PixelFormat, std::vector<SizeRange>> convertedFormats_;
+	bool useConverter_;
+
+	std::vector<std::unique_ptr<FrameBuffer>> captureBuffers_;
+	std::queue<FrameBuffer *> availableBuffers_;
+	std::map<FrameBuffer *, Request *> captureRequests_;
+	std::queue<Request *> pendingRequests_;
+
+	/*
+	 * UVC devices can't change the frame interval while streaming, the
+	 * video node is thus only streamed on when the first request is
+	 * queued, after applying its frame duration.
+	 */
+	bool streaming_;
+	uint64_t frameDuration_;
+
+	/* Buffers returned by the device while restarting a stalled stream. */
+	bool recovering_;
+	std::vector<FrameBuffer *> recoveredBuffers_;
+
+	/*
+	 * The UVC metadata node, when available, provides the payload headers
+	 * of each frame. Their Presentation Time Stamp (PTS) records the start
+	 * of exposure in the device clock, which is converted to the host
+	 * clock to timestamp frames. Successfully captured frames wait for the
+	 * metadata buffer with the same sequence number.
+	 */
+	std::unique_ptr<V4L2VideoDevice> metadata_;
+	std::vector<std::unique_ptr<FrameBuffer>> metadataBuffers_;
+	MappedBufferCache metadataMappings_;
+	bool metadataStreaming_;
+	UVCClock clock_;
+	std::map<unsigned int, uint64_t> timestamps_;
+	std::deque<FrameBuffer *> waitingBuffers_;
+	bool metadataSequenceValid_;
+	unsigned int metadataSequence_;
 };
 
 class UVCCameraConfiguration : public CameraConfiguration
 {
 public:
-	UVCCameraConfiguration();
+	UVCCameraConfiguration(const UVCCameraData *data);
 
 	Status validate() override;
+
+private:
+	const UVCCameraData *data_;
 };
 
 class PipelineHandlerUVC : public PipelineHandler
@@ -68,10 +288,18 @@ public:
 	int exportFrameBuffers(Camera *camera, Stream *stream,
 			       std::vector<std::unique_ptr<FrameBuffer>> *buffers) override;
 	int importFrameBuffers(Camera *camera, Stream *stream) override;
+	int addFrameBuffers(Camera *camera, Stream *stream, unsigned int count,
+			    std::vector<std::unique_ptr<FrameBuffer>> *buffers) override;
 	void freeFrameBuffers(Camera *camera, Stream *stream) override;
+	void bufferUsage(const Camera *camera,
+			 std::vector<BufferPoolUsage> *pools) override;
+	void stallReport(const Camera *camera, CameraStall *stall) override;
 
 	int start(Camera *camera) override;
-	void stop(Camera *camera) override;
+	void stopDevice(Camera *camera) override;
+	int recoverDevice(Camera *camera) override;
+	int pauseDevice(Camera *camera) override;
+	int resumeDevice(Camera *camera) override;
 
 	int queueRequestDevice(Camera *camera, Request *request) override;
 
@@ -87,8 +315,8 @@ private:
 	}
 };
 
-UVCCameraConfiguration::UVCCameraConfiguration()
-	: CameraConfiguration()
+UVCCameraConfiguration::UVCCameraConfiguration(const UVCCameraData *data)
+	: CameraConfiguration(), data_(data)
 {
 }
 
@@ -136,6 +364,14 @@ CameraConfiguration::Status UVCCameraConfiguration::validate()
 		status = Adjusted;
 	}
 
+	/* The converter only imports dmabufs. */
+	if (cfg.memory != FrameBuffer::MemoryDmaBuf &&
+	    data_->conversions_.count(cfg.pixelFormat)) {
+		LOG(UVC, Debug) << "User pointers not supported with conversion";
+		cfg.memory = FrameBuffer::MemoryDmaBuf;
+		status = Adjusted;
+	}
+
 	cfg.bufferCount = 4;
 
 	return status;
@@ -150,13 +386,18 @@ CameraConfiguration *PipelineHandlerUVC::generateConfiguration(Camera *camera,
 	const StreamRoles &roles)
 {
 	UVCCameraData *data = cameraData(camera);
-	CameraConfiguration *config = new UVCCameraConfiguration();
+	CameraConfiguration *config = new UVCCameraConfiguration(data);
 
 	if (roles.empty())
 		return config;
 
-	ImageFormats v4l2formats = data->video_->formats();
-	StreamFormats formats(v4l2formats.data());
+	/* Add the formats produced by the converter, if any. */
+	std::map<PixelFormat, std::vector<SizeRange>> streamFormats =
+		data->video_->formats().data();
+	streamFormats.insert(data->convertedFormats_.begin(),
+			     data->convertedFormats_.end());
+
+	StreamFormats formats(streamFormats);
 	StreamConfiguration cfg(formats);
 
 	cfg.pixelFormat = formats.pixelformats().front();
@@ -176,18 +417,56 @@ int PipelineHandlerUVC::configure(Camera *camera, CameraConfiguration *config)
 	StreamConfiguration &cfg = config->at(0);
 	int ret;
 
+	auto conversion = data->conversions_.find(cfg.pixelFormat);
+	data->useConverter_ = conversion != data->conversions_.end();
+
+	if (!data->useConverter_) {
+		V4L2DeviceFormat format = {};
+		format.fourcc = data->video_->toV4L2Fourcc(cfg.pixelFormat);
+		format.size = cfg.size;
+
+		ret = data->video_->setFormat(&format);
+		if (ret)
+			return ret;
+
+		if (format.size != cfg.size ||
+		    format.fourcc != data->video_->toV4L2Fourcc(cfg.pixelFormat))
+			return -EINVAL;
+
+		cfg.setStream(&data->stream_);
+
+		return 0;
+	}
+
+	/*
+	 * Capture in the native format the converter produces the requested
+	 * format from, and scale to the requested size in the converter.
+	 */
+	StreamConfiguration inputCfg;
+	inputCfg.pixelFormat = conversion->second;
+	inputCfg.size = data->captureSize(inputCfg.pixelFormat, cfg.size);
+	inputCfg.bufferCount = cfg.bufferCount;
+
 	V4L2DeviceFormat format = {};
-	format.fourcc = data->video_->toV4L2Fourcc(cfg.pixelFormat);
-	format.size = cfg.size;
+	format.fourcc = data->video_->toV4L2Fourcc(inputCfg.pixelFormat);
+	format.size = inputCfg.size;
 
 	ret = data->video_->setFormat(&format);
 	if (ret)
 		return ret;
 
-	if (format.size != cfg.size ||
-	    format.fourcc != data->video_->toV4L2Fourcc(cfg.pixelFormat))
+	if (format.size != inputCfg.size ||
+	    format.fourcc != data->video_->toV4L2Fourcc(inputCfg.pixelFormat))
 		return -EINVAL;
 
+	ret = data->converter_->configure(inputCfg, { cfg });
+	if (ret)
+		return ret;
+
+	LOG(UVC, Debug)
+		<< "Converting from " << inputCfg.toString()
+		<< " to " << cfg.toString();
+
 	cfg.setStream(&data->stream_);
 
 	return 0;
@@ -199,6 +478,10 @@ int PipelineHandlerUVC::exportFrameBuffers(Camera *camera, Stream *stream,
 	UVCCameraData *data = cameraData(camera);
 	unsigned int count = stream->configuration().bufferCount;
 
+	if (data->useConverter_)
+		return data->converter_->exportBuffers(0, count, buffers);
+
+	data->video_->setCpuAccess(stream->cpuAccess());
 	return data->video_->exportBuffers(count, buffers);
 }
 
@@ -207,26 +490,236 @@ int PipelineHandlerUVC::importFrameBuffers(Camera *camera, Stream *stream)
 	UVCCameraData *data = cameraData(camera);
 	unsigned int count = stream->configuration().bufferCount;
 
-	return data->video_->importBuffers(count);
+	/* The converter imports the application buffers when started. */
+	if (data->useConverter_)
+		return 0;
+
+	return data->video_->importBuffers(count, stream->configuration().memory);
+}
+
+int PipelineHandlerUVC::addFrameBuffers(Camera *camera, Stream *stream,
+					unsigned int count,
+					std::vector<std::unique_ptr<FrameBuffer>> *buffers)
+{
+	UVCCameraData *data = cameraData(camera);
+
+	if (data->useConverter_)
+		return -ENOTSUP;
+
+	return data->video_->addBuffers(count, buffers);
 }
 
 void PipelineHandlerUVC::freeFrameBuffers(Camera *camera, Stream *stream)
 {
 	UVCCameraData *data = cameraData(camera);
 
+	if (data->useConverter_)
+		return;
+
 	data->video_->releaseBuffers();
 }
 
+void PipelineHandlerUVC::bufferUsage(const Camera *camera,
+				     std::vector<BufferPoolUsage> *pools)
+{
+	UVCCameraData *data = cameraData(camera);
+
+	if (data->captureBuffers_.empty())
+		return;
+
+	BufferPoolUsage usage(BufferPoolUsage::Internal, nullptr, "capture");
+	usage.add(data->captureBuffers_);
+	pools->push_back(usage);
+}
+
+void PipelineHandlerUVC::stallReport(const Camera *camera, CameraStall *stall)
+{
+	UVCCameraData *data = cameraData(camera);
+
+	stall->devices.push_back({ data->video_->deviceNode(),
+				   data->video_->queuedBuffers() });
+}
+
 int PipelineHandlerUVC::start(Camera *camera)
 {
 	UVCCameraData *data = cameraData(camera);
-	return data->video_->streamOn();
+	int ret;
+
+	data->streaming_ = false;
+	data->frameDuration_ = 0;
+	data->video_->getFrameInterval(&data->frameDuration_);
+
+	/*
+	 * UVC control writes are USB control transfers that take milliseconds
+	 * each, defer them to a separate thread to avoid delaying buffer
+	 * handling. The controls may have been changed by other users of the
+	 * device since the last capture session, forget their values.
+	 */
+	data->controlWriter_->reset();
+	data->controlWriter_->setDeferred(true, "uvc:controls");
+
+	data->startMetadata();
+
+	if (!data->useConverter_)
+		return 0;
+
+	/*
+	 * Capture to an internal pool of buffers, shared with the converter
+	 * as dmabufs.
+	 */
+	unsigned int count = data->stream_.configuration().bufferCount;
+	ret = data->video_->exportBuffers(count, &data->captureBuffers_);
+	if (ret < 0) {
+		data->stopMetadata();
+		data->controlWriter_->setDeferred(false);
+		return ret;
+	}
+
+	for (std::unique_ptr<FrameBuffer> &buffer : data->captureBuffers_)
+		data->availableBuffers_.push(buffer.get());
+
+	ret = data->converter_->start();
+	if (ret)
+		goto error;
+
+	return 0;
+
+error:
+	data->availableBuffers_ = {};
+	data->captureBuffers_.clear();
+	data->video_->releaseBuffers();
+	data->stopMetadata();
+	data->controlWriter_->setDeferred(false);
+
+	return ret;
 }
 
-void PipelineHandlerUVC::stop(Camera *camera)
+void PipelineHandlerUVC::stopDevice(Camera *camera)
 {
 	UVCCameraData *data = cameraData(camera);
+
+	data->streaming_ = false;
+	data->controlWriter_->setDeferred(false);
+
+	/*
+	 * Stop the metadata stream first, to complete the frames waiting for
+	 * their metadata before the video buffers get cancelled.
+	 */
+	data->stopMetadata();
+
+	if (!data->useConverter_) {
+		data->video_->streamOff();
+		return;
+	}
+
+	/*
+	 * Take the requests not queued to the device yet out of the pending
+	 * queue, to prevent them from being queued when the buffers in flight
+	 * are returned.
+	 */
+	std::queue<Request *> pendingRequests;
+	std::swap(pendingRequests, data->pendingRequests_);
+
 	data->video_->streamOff();
+	data->converter_->stop();
+
+	while (!pendingRequests.empty()) {
+		cancelRequest(camera, pendingRequests.front());
+		pendingRequests.pop();
+	}
+
+	data->captureRequests_.clear();
+	data->availableBuffers_ = {};
+	data->captureBuffers_.clear();
+	data->video_->releaseBuffers();
+}
+
+int PipelineHandlerUVC::recoverDevice(Camera *camera)
+{
+	UVCCameraData *data = cameraData(camera);
+
+	if (!data->streaming_)
+		return -EINVAL;
+
+	/*
+	 * Restart streaming, catching the buffers the device returns when
+	 * stopped to queue them again. The requests they belong to are thus
+	 * not completed, and the stall is transparent to the application
+	 * except for the frames lost. The frame sequence numbers restart from
+	 * zero, complete the frames still waiting for their metadata.
+	 */
+	data->completeWaitingBuffers(true);
+	data->resetMetadata();
+
+	data->recovering_ = true;
+	int ret = data->video_->streamOff();
+	data->recovering_ = false;
+
+	std::vector<FrameBuffer *> buffers = std::move(data->recoveredBuffers_);
+	data->recoveredBuffers_.clear();
+
+	if (ret)
+		return ret;
+
+	ret = data->video_->streamOn();
+
+	auto iter = buffers.begin();
+	for (; !ret && iter != buffers.end(); ++iter) {
+		ret = data->video_->queueBuffer(*iter);
+		if (ret)
+			break;
+	}
+
+	if (ret) {
+		/*
+		 * Give up and complete all buffers in error, the buffers
+		 * queued again are returned by stopping the stream.
+		 */
+		data->video_->streamOff();
+		data->streaming_ = false;
+
+		for (; iter != buffers.end(); ++iter)
+			data->bufferReady(*iter);
+
+		return ret;
+	}
+
+	return 0;
+}
+
+int PipelineHandlerUVC::pauseDevice(Camera *camera)
+{
+	UVCCameraData *data = cameraData(camera);
+
+	/*
+	 * The converter keeps internal buffers queued to the device, only the
+	 * direct capture path can be paused.
+	 */
+	if (data->useConverter_)
+		return -ENOTSUP;
+
+	if (!data->streaming_)
+		return 0;
+
+	/*
+	 * Stop the video stream only, the metadata stream produces no data
+	 * without frames. The frame sequence numbers restart from zero when
+	 * streaming resumes.
+	 */
+	int ret = data->video_->streamOff();
+	if (ret)
+		return ret;
+
+	data->resetMetadata();
+	data->streaming_ = false;
+
+	return 0;
+}
+
+int PipelineHandlerUVC::resumeDevice(Camera *camera)
+{
+	/* Streaming restarts when the next request is queued to the device. */
+	return 0;
 }
 
 int PipelineHandlerUVC::processControls(UVCCameraData *data, Request *request)
@@ -248,6 +741,22 @@ int PipelineHandlerUVC::processControls(UVCCameraData *data, Request *request)
 			controls.set(V4L2_CID_EXPOSURE_ABSOLUTE, value);
 		} else if (id == controls::ManualGain) {
 			controls.set(V4L2_CID_GAIN, value);
+		} else if (id == controls::FrameDuration) {
+			uint64_t interval = value.get<int64_t>();
+			if (interval == data->frameDuration_)
+				continue;
+
+			if (data->streaming_) {
+				LOG(UVC, Warning)
+					<< "Can't change the frame duration while streaming";
+				continue;
+			}
+
+			int ret = data->video_->setFrameInterval(&interval);
+			if (ret)
+				return ret;
+
+			data->frameDuration_ = interval;
 		}
 	}
 
@@ -256,7 +765,7 @@ int PipelineHandlerUVC::processControls(UVCCameraData *data, Request *request)
 			<< "Setting control " << utils::hex(ctrl.first)
 			<< " to " << ctrl.second.toString();
 
-	int ret = data->video_->setControls(&controls);
+	int ret = data->controlWriter_->write(controls);
 	if (ret) {
 		LOG(UVC, Error) << "Failed to set controls: " << ret;
 		return ret < 0 ? ret : -EINVAL;
@@ -280,11 +789,16 @@ int PipelineHandlerUVC::queueRequestDevice(Camera *camera, Request *request)
 	if (ret < 0)
 		return ret;
 
-	ret = data->video_->queueBuffer(buffer);
-	if (ret < 0)
-		return ret;
+	if (data->useConverter_) {
+		data->pendingRequests_.push(request);
+		data->queuePendingRequests();
+	} else {
+		ret = data->video_->queueBuffer(buffer);
+		if (ret < 0)
+			return ret;
+	}
 
-	return 0;
+	return data->streamOn();
 }
 
 bool PipelineHandlerUVC::match(DeviceEnumerator *enumerator)
@@ -312,6 +826,23 @@ bool PipelineHandlerUVC::match(DeviceEnumerator *enumerator)
 	if (data->init(*entity))
 		return false;
 
+	/*
+	 * Chain a memory-to-memory converter to the camera to extend the
+	 * supported formats and sizes. As any converter could be used with
+	 * any UVC camera, the converter is selected by its driver name through
+	 * an environment variable.
+	 */
+	const char *converter = utils::secure_getenv("LIBCAMERA_UVC_CONVERTER");
+	if (converter) {
+		DeviceMatch converterMatch(converter);
+		MediaDevice *m2m = acquireMediaDevice(enumerator, converterMatch);
+		if (!m2m || data->initConverter(m2m))
+			LOG(UVC, Warning)
+				<< "Converter " << converter << " not available";
+	}
+
+	data->initMetadata(media);
+
 	dev_t devnum = makedev((*entity)->deviceMajor(), (*entity)->deviceMinor());
 
 	/* Create and register the camera. */
@@ -337,6 +868,8 @@ int UVCCameraData::init(MediaEntity *entity)
 
 	video_->bufferReady.connect(this, &UVCCameraData::bufferReady);
 
+	controlWriter_ = std::make_unique<V4L2ControlWriter>(video_);
+
 	/* Initialise the supported controls. */
 	const ControlInfoMap &controls = video_->controls();
 	ControlInfoMap::Map ctrls;
@@ -368,12 +901,369 @@ int UVCCameraData::init(MediaEntity *entity)
 		ctrls.emplace(id, range);
 	}
 
+	/*
+	 * Report the range of frame durations supported with the default
+	 * format, if the device supports setting the frame interval.
+	 */
+	V4L2DeviceFormat format = {};
+	uint64_t interval, minInterval, maxInterval;
+
+	if (!video_->getFormat(&format) &&
+	    !video_->getFrameInterval(&interval) &&
+	    !video_->frameIntervalRange(format, &minInterval, &maxInterval) &&
+	    minInterval <= maxInterval)
+		ctrls.emplace(std::piecewise_construct,
+			      std::forward_as_tuple(&controls::FrameDuration),
+			      std::forward_as_tuple(static_cast<int64_t>(minInterval),
+						    static_cast<int64_t>(maxInterval)));
+
 	controlInfo_ = std::move(ctrls);
 
 	return 0;
 }
 
+int UVCCameraData::initConverter(MediaDevice *media)
+{
+	converter_ = std::make_unique<Converter>(media);
+
+	int ret = converter_->open();
+	if (ret) {
+		converter_.reset();
+		return ret;
+	}
+
+	/*
+	 * List the formats that the converter can produce from the native
+	 * formats of the camera, and aren't supported natively. The output
+	 * sizes are computed from the largest native size.
+	 */
+	ImageFormats formats = video_->formats();
+	const std::vector<unsigned int> fourccs = formats.formats();
+
+	for (unsigned int fourcc : fourccs) {
+		PixelFormat input = V4L2VideoDevice::toPixelFormat(fourcc);
+		if (!input)
+			continue;
+
+		for (PixelFormat output : converter_->formats(input)) {
+			unsigned int outputFourcc = video_->toV4L2Fourcc(output);
+			if (std::find(fourccs.begin(), fourccs.end(), outputFourcc) != fourccs.end() ||
+			    conversions_.count(output))
+				continue;
+
+			SizeRange sizes = converter_->sizes(captureSize(input, Size(UINT_MAX, UINT_MAX)));
+			if (sizes.max.width == 0 || sizes.max.height == 0)
+				continue;
+
+			conversions_[output] = input;
+			convertedFormats_[output] = { sizes };
+		}
+	}
+
+	if (conversions_.empty()) {
+		LOG(UVC, Debug) << "Converter provides no additional format";
+		converter_.reset();
+		return 0;
+	}
+
+	converter_->inputBufferReady.connect(this, &UVCCameraData::converterInputReady);
+	converter_->outputBufferReady.connect(this, &UVCCameraData::converterOutputReady);
+
+	return 0;
+}
+
+/*
+ * Locate the metadata video node of the camera, if any. It is created by the
+ * uvcvideo driver alongside the default video node, and produces buffers in
+ * the V4L2_META_FMT_UVC format.
+ */
+void UVCCameraData::initMetadata(MediaDevice *media)
+{
+	for (MediaEntity *entity : media->entities()) {
+		if (entity->function() != MEDIA_ENT_F_IO_V4L ||
+		    entity->flags() & MEDIA_ENT_FL_DEFAULT)
+			continue;
+
+		std::unique_ptr<V4L2VideoDevice> video =
+			std::make_unique<V4L2VideoDevice>(entity);
+		if (video->open())
+			continue;
+
+		V4L2DeviceFormat format = {};
+		if (video->getFormat(&format) ||
+		    format.fourcc != V4L2_META_FMT_UVC)
+			continue;
+
+		video->bufferReady.connect(this, &UVCCameraData::metadataReady);
+		metadata_ = std::move(video);
+
+		LOG(UVC, Debug)
+			<< "Using metadata node " << metadata_->deviceNode();
+		return;
+	}
+
+	LOG(UVC, Debug) << "No metadata node, using transfer timestamps";
+}
+
+/*
+ * Prepare the metadata stream, which is started along with the video stream.
+ * Timestamping frames is best effort, failures are not fatal.
+ */
+void UVCCameraData::startMetadata()
+{
+	if (!metadata_)
+		return;
+
+	clock_.reset();
+	resetMetadata();
+
+	int ret = metadata_->allocateBuffers(MetadataBufferCount, &metadataBuffers_);
+	if (ret < 0) {
+		LOG(UVC, Warning)
+			<< "Failed to allocate metadata buffers, using transfer timestamps";
+		return;
+	}
+
+	for (std::unique_ptr<FrameBuffer> &buffer : metadataBuffers_) {
+		if (!metadataMappings_.map(buffer.get()) ||
+		    metadata_->queueBuffer(buffer.get())) {
+			LOG(UVC, Warning)
+				<< "Failed to queue metadata buffers, using transfer timestamps";
+			stopMetadata();
+			return;
+		}
+	}
+}
+
+void UVCCameraData::stopMetadata()
+{
+	if (metadataBuffers_.empty())
+		return;
+
+	metadataStreaming_ = false;
+	metadata_->streamOff();
+
+	completeWaitingBuffers(true);
+
+	metadataMappings_.clear();
+	metadataBuffers_.clear();
+	metadata_->releaseBuffers();
+
+	resetMetadata();
+}
+
+void UVCCameraData::resetMetadata()
+{
+	timestamps_.clear();
+	metadataSequenceValid_ = false;
+}
+
+/*
+ * Select the native capture size to convert from, the smallest size larger
+ * than or equal to the requested size, or the largest size otherwise.
+ */
+Size UVCCameraData::captureSize(PixelFormat pixelFormat, const Size &size)
+{
+	unsigned int fourcc = video_->toV4L2Fourcc(pixelFormat);
+	bool fits = false;
+	Size best;
+
+	for (const SizeRange &range : video_->formats().sizes(fourcc)) {
+		const Size &candidate = range.max;
+
+		if (candidate.width >= size.width &&
+		    candidate.height >= size.height) {
+			if (!fits || candidate < best)
+				best = candidate;
+			fits = true;
+		} else if (!fits && best < candidate) {
+			best = candidate;
+		}
+	}
+
+	return best;
+}
+
 void UVCCameraData::bufferReady(FrameBuffer *buffer)
+{
+	if (recovering_) {
+		recoveredBuffers_.push_back(buffer);
+		return;
+	}
+
+	/*
+	 * Wait for the metadata of successfully captured frames, unless it has
+	 * been processed already. Frames are completed in order.
+	 */
+	const FrameMetadata &metadata = buffer->metadata();
+	if (metadataStreaming_ &&
+	    (!waitingBuffers_.empty() ||
+	     (metadata.status == FrameMetadata::FrameSuccess &&
+	      (!metadataSequenceValid_ || metadata.sequence > metadataSequence_)))) {
+		waitingBuffers_.push_back(buffer);
+		return;
+	}
+
+	processBuffer(buffer);
+}
+
+void UVCCameraData::processBuffer(FrameBuffer *buffer)
+{
+	/*
+	 * Replace the V4L2 timestamp, which records the completion of the USB
+	 * transfer, with the start of exposure. Discard values inconsistent
+	 * with the transfer time, which could result from a clock glitch.
+	 */
+	auto ts = timestamps_.find(buffer->metadata().sequence);
+	if (ts != timestamps_.end()) {
+		FrameMetadata metadata = buffer->metadata();
+
+		if (metadata.status == FrameMetadata::FrameSuccess &&
+		    ts->second <= metadata.timestamp &&
+		    metadata.timestamp - ts->second < 1000000000ULL) {
+			metadata.timestamp = ts->second;
+			BufferMetadata::copy(buffer, metadata);
+		}
+
+		timestamps_.erase(ts);
+	}
+
+	if (!useConverter_) {
+		Request *request = buffer->request();
+
+		pipe_->completeBuffer(camera_, request, buffer);
+		pipe_->completeRequest(camera_, request);
+		return;
+	}
+
+	auto it = captureRequests_.find(buffer);
+	if (it == captureRequests_.end())
+		return;
+
+	Request *request = it->second;
+	captureRequests_.erase(it);
+
+	if (buffer->metadata().status == FrameMetadata::FrameSuccess) {
+		FrameBuffer *output = request->findBuffer(&stream_);
+		if (!converter_->queueBuffers(buffer, { { 0, output } }))
+			return;
+	}
+
+	availableBuffers_.push(buffer);
+	pipe_->cancelRequest(camera_, request);
+	queuePendingRequests();
+}
+
+void UVCCameraData::metadataReady(FrameBuffer *buffer)
+{
+	/* Buffers are cancelled when stopping the metadata stream. */
+	if (!metadataStreaming_)
+		return;
+
+	const FrameMetadata &metadata = buffer->metadata();
+	if (metadata.status == FrameMetadata::FrameSuccess)
+		parseMetadata(buffer);
+
+	metadataSequence_ = metadata.sequence;
+	metadataSequenceValid_ = true;
+
+	if (metadata_->queueBuffer(buffer) && !metadata_->queuedBuffers()) {
+		LOG(UVC, Warning)
+			<< "Metadata stream starved, using transfer timestamps";
+		metadataStreaming_ = false;
+		completeWaitingBuffers(true);
+		return;
+	}
+
+	completeWaitingBuffers(false);
+}
+
+void UVCCameraData::parseMetadata(FrameBuffer *buffer)
+{
+	const MappedFrameBuffer *mapped = metadataMappings_.find(buffer);
+	if (!mapped)
+		return;
+
+	ScopedCpuAccess access(*mapped);
+
+	const MappedFrameBuffer::Plane &plane = mapped->planes()[0];
+	const size_t size = std::min<size_t>(buffer->metadata().planes()[0].bytesused,
+					     plane.length);
+	bool hasPts = false;
+	uint32_t pts = 0;
+
+	/*
+	 * The buffer contains a sequence of struct uvc_meta_buf, each made of
+	 * the host timestamp in nanoseconds and USB frame number recorded by
+	 * the driver, followed by a copy of a UVC payload header. The header
+	 * starts with its length and flags, and optionally stores the PTS and
+	 * the SCR, made of a device clock value and a USB frame number.
+	 */
+	for (size_t offset = 0; offset + UVCMetaBufSize <= size;) {
+		const uint8_t *block = plane.data + offset;
+		const uint8_t length = block[10];
+		const uint8_t flags = block[11];
+
+		if (length < 2 || offset + UVCMetaBufSize + length - 2 > size)
+			break;
+
+		const uint8_t *header = block + UVCMetaBufSize;
+		const unsigned int headerLength = length - 2;
+		unsigned int pos = 0;
+		uint64_t ns;
+
+		memcpy(&ns, block, sizeof(ns));
+
+		if (flags & UVCStreamPts) {
+			if (headerLength < 4)
+				break;
+
+			if (!hasPts) {
+				pts = readLE32(header);
+				hasPts = true;
+			}
+
+			pos = 4;
+		}
+
+		if ((flags & UVCStreamScr) && headerLength >= pos + 6)
+			clock_.addSample(readLE32(header + pos), ns);
+
+		offset += UVCMetaBufSize + headerLength;
+	}
+
+	clock_.update();
+
+	uint64_t timestamp;
+	if (!hasPts || !clock_.toHost(pts, &timestamp))
+		return;
+
+	timestamps_[buffer->metadata().sequence] = timestamp;
+
+	/* Drop the timestamps of frames that have been lost. */
+	while (timestamps_.size() > MetadataBufferCount)
+		timestamps_.erase(timestamps_.begin());
+}
+
+void UVCCameraData::completeWaitingBuffers(bool all)
+{
+	while (!waitingBuffers_.empty()) {
+		FrameBuffer *buffer = waitingBuffers_.front();
+		if (!all && buffer->metadata().sequence > metadataSequence_)
+			break;
+
+		waitingBuffers_.pop_front();
+		processBuffer(buffer);
+	}
+}
+
+void UVCCameraData::converterInputReady(FrameBuffer *buffer)
+{
+	availableBuffers_.push(buffer);
+	queuePendingRequests();
+}
+
+void UVCCameraData::converterOutputReady(FrameBuffer *buffer)
 {
 	Request *request = buffer->request();
 
@@ -381,6 +1271,49 @@ void UVCCameraData::bufferReady(FrameBuffer *buffer)
 	pipe_->completeRequest(camera_, request);
 }
 
+void UVCCameraData::queuePendingRequests()
+{
+	while (!pendingRequests_.empty() && !availableBuffers_.empty()) {
+		Request *request = pendingRequests_.front();
+		FrameBuffer *buffer = availableBuffers_.front();
+
+		pendingRequests_.pop();
+		availableBuffers_.pop();
+
+		int ret = video_->queueBuffer(buffer);
+		if (ret < 0) {
+			availableBuffers_.push(buffer);
+			pipe_->cancelRequest(camera_, request);
+			continue;
+		}
+
+		captureRequests_[buffer] = request;
+	}
+}
+
+int UVCCameraData::streamOn()
+{
+	if (streaming_)
+		return 0;
+
+	if (!metadataBuffers_.empty() && !metadataStreaming_) {
+		if (metadata_->streamOn())
+			LOG(UVC, Warning)
+				<< "Failed to start metadata stream, using transfer timestamps";
+		else
+			metadataStreaming_ = true;
+	}
+
+	int ret = video_->streamOn();
+	if (ret)
+		return ret;
+
+	streaming_ = true;
+	frameInterval_ = std::chrono::microseconds(frameDuration_);
+
+	return 0;
+}
+
 REGISTER_PIPELINE_HANDLER(PipelineHandlerUVC);
 
 } /* namespace libcamera */
@@ -8,6 +8,7 @@
 #include <algorithm>
 #include <array>
 #include <iomanip>
+#include <memory>
 #include <tuple>
 
 #include <linux/drm_fourcc.h>
@@ -28,6 +29,7 @@
 #include "media_device.h"
 #include "pipeline_handler.h"
 #include "utils.h"
+#include "v4l2_control_writer.h"
 #include "v4l2_controls.h"
 #include "v4l2_subdevice.h"
 #include "v4l2_videodevice.h"
@@ -47,6 +49,7 @@ public:
 
 	~VimcCameraData()
 	{
+		controlWriter_.reset();
 		delete sensor_;
 		delete debayer_;
 		delete scaler_;
@@ -58,6 +61,7 @@ public:
 	void bufferReady(FrameBuffer *buffer);
 
 	CameraSensor *sensor_;
+	std::unique_ptr<V4L2ControlWriter> controlWriter_;
 	V4L2Subdevice *debayer_;
 	V4L2Subdevice *scaler_;
 	V4L2VideoDevice *video_;
@@ -78,6 +82,8 @@ class PipelineHandlerVimc : public PipelineHandler
 public:
 	PipelineHandlerVimc(CameraManager *manager);
 
+	int acquire(Camera *camera) override;
+
 	CameraConfiguration *generateConfiguration(Camera *camera,
 		const StreamRoles &roles) override;
 	int configure(Camera *camera, CameraConfiguration *config) override;
@@ -85,10 +91,15 @@ public:
 	int exportFrameBuffers(Camera *camera, Stream *stream,
 			       std::vector<std::unique_ptr<FrameBuffer>> *buffers) override;
 	int importFrameBuffers(Camera *camera, Stream *stream) override;
+	int addFrameBuffers(Camera *camera, Stream *stream, unsigned int count,
+			    std::vector<std::unique_ptr<FrameBuffer>> *buffers) override;
 	void freeFrameBuffers(Camera *camera, Stream *stream) override;
+	void stallReport(const Camera *camera, CameraStall *stall) override;
 
 	int start(Camera *camera) override;
-	void stop(Camera *camera) override;
+	void stopDevice(Camera *camera) override;
+	int pauseDevice(Camera *camera) override;
+	int resumeDevice(Camera *camera) override;
 
 	int queueRequestDevice(Camera *camera, Request *request) override;
 
@@ -167,6 +178,21 @@ PipelineHandlerVimc::PipelineHandlerVimc(CameraManager *manager)
 {
 }
 
+int PipelineHandlerVimc::acquire(Camera *camera)
+{
+	VimcCameraData *data = cameraData(camera);
+	if (data->ipa_)
+		return 0;
+
+	data->ipa_ = IPAManager::instance()->createIPA(this, 0, 0);
+	if (data->ipa_ == nullptr)
+		LOG(VIMC, Warning) << "no matching IPA found";
+	else
+		data->ipa_->init();
+
+	return 0;
+}
+
 CameraConfiguration *PipelineHandlerVimc::generateConfiguration(Camera *camera,
 	const StreamRoles &roles)
 {
@@ -265,15 +291,25 @@ int PipelineHandlerVimc::exportFrameBuffers(Camera *camera, Stream *stream,
 	VimcCameraData *data = cameraData(camera);
 	unsigned int count = stream->configuration().bufferCount;
 
+	data->video_->setCpuAccess(stream->cpuAccess());
 	return data->video_->exportBuffers(count, buffers);
 }
 
 int PipelineHandlerVimc::importFrameBuffers(Camera *camera, Stream *stream)
 {
 	VimcCameraData *data = cameraData(camera);
-	unsigned int count = stream->configuration().bufferCount;
+	const StreamConfiguration &cfg = stream->configuration();
 
-	return data->video_->importBuffers(count);
+	return data->video_->importBuffers(cfg.bufferCount, cfg.memory);
+}
+
+int PipelineHandlerVimc::addFrameBuffers(Camera *camera, Stream *stream,
+					 unsigned int count,
+					 std::vector<std::unique_ptr<FrameBuffer>> *buffers)
+{
+	VimcCameraData *data = cameraData(camera);
+
+	return data->video_->addBuffers(count, buffers);
 }
 
 void PipelineHandlerVimc::freeFrameBuffers(Camera *camera, Stream *stream)
@@ -283,18 +319,40 @@ void PipelineHandlerVimc::freeFrameBuffers(Camera *camera, Stream *stream)
 	data->video_->releaseBuffers();
 }
 
+void PipelineHandlerVimc::stallReport(const Camera *camera, CameraStall *stall)
+{
+	VimcCameraData *data = cameraData(camera);
+
+	stall->devices.push_back({ data->video_->deviceNode(),
+				   data->video_->queuedBuffers() });
+}
+
 int PipelineHandlerVimc::start(Camera *camera)
 {
 	VimcCameraData *data = cameraData(camera);
+
+	data->controlWriter_->reset();
 	return data->video_->streamOn();
 }
 
-void PipelineHandlerVimc::stop(Camera *camera)
+void PipelineHandlerVimc::stopDevice(Camera *camera)
 {
 	VimcCameraData *data = cameraData(camera);
 	data->video_->streamOff();
 }
 
+int PipelineHandlerVimc::pauseDevice(Camera *camera)
+{
+	VimcCameraData *data = cameraData(camera);
+	return data->video_->streamOff();
+}
+
+int PipelineHandlerVimc::resumeDevice(Camera *camera)
+{
+	VimcCameraData *data = cameraData(camera);
+	return data->video_->streamOn();
+}
+
 int PipelineHandlerVimc::processControls(VimcCameraData *data, Request *request)
 {
 	ControlList controls(data->sensor_->controls());
@@ -316,7 +374,7 @@ int PipelineHandlerVimc::processControls(VimcCameraData *data, Request *request)
 			<< "Setting control " << utils::hex(ctrl.first)
 			<< " to " << ctrl.second.toString();
 
-	int ret = data->sensor_->setControls(&controls);
+	int ret = data->controlWriter_->write(controls);
 	if (ret) {
 		LOG(VIMC, Error) << "Failed to set controls: " << ret;
 		return ret < 0 ? ret : -EINVAL;
@@ -367,12 +425,6 @@ bool PipelineHandlerVimc::match(DeviceEnumerator *enumerator)
 
 	std::unique_ptr<VimcCameraData> data = std::make_unique<VimcCameraData>(this);
 
-	data->ipa_ = IPAManager::instance()->createIPA(this, 0, 0);
-	if (data->ipa_ == nullptr)
-		LOG(VIMC, Warning) << "no matching IPA found";
-	else
-		data->ipa_->init();
-
 	/* Locate and open the capture video node. */
 	if (data->init(media))
 		return false;
@@ -390,15 +442,11 @@ int VimcCameraData::init(MediaDevice *media)
 {
 	int ret;
 
-	ret = media->disableLinks();
-	if (ret < 0)
-		return ret;
-
 	MediaLink *link = media->link("Debayer B", 1, "Scaler", 0);
 	if (!link)
 		return -ENODEV;
 
-	ret = link->setEnabled(true);
+	ret = media->setupLinks({ link });
 	if (ret < 0)
 		return ret;
 
@@ -408,6 +456,8 @@ int VimcCameraData::init(MediaDevice *media)
 	if (ret)
 		return ret;
 
+	controlWriter_ = std::make_unique<V4L2ControlWriter>(sensor_->device());
+
 	debayer_ = new V4L2Subdevice(media->getEntityByName("Debayer B"));
 	if (debayer_->open())
 		return -ENODEV;
@@ -7,15 +7,26 @@
 
 #include "pipeline_handler.h"
 
+#include <algorithm>
+#include <chrono>
+#include <limits>
+#include <stdlib.h>
+#include <string.h>
 #include <sys/sysmacros.h>
 
 #include <libcamera/buffer.h>
 #include <libcamera/camera.h>
 #include <libcamera/camera_manager.h>
+#include <libcamera/control_ids.h>
+#include <libcamera/logging.h>
+#include <libcamera/request.h>
 
+#include "cpu_accounting.h"
 #include "device_enumerator.h"
 #include "log.h"
 #include "media_device.h"
+#include "thread.h"
+#include "tracer.h"
 #include "utils.h"
 
 /**
@@ -36,6 +47,48 @@ namespace libcamera {
 
 LOG_DEFINE_CATEGORY(Pipeline)
 
+namespace {
+
+/*
+ * A camera is considered stalled when no buffer completes for this number of
+ * frame intervals, with a lower bound to account for the device start time.
+ */
+constexpr unsigned int kWatchdogFrames = 10;
+constexpr std::chrono::seconds kWatchdogMinTimeout{ 1 };
+constexpr std::chrono::milliseconds kWatchdogSlack{ 100 };
+constexpr std::chrono::milliseconds kIdleSlack{ 50 };
+
+/*
+ * The frame interval assumed by the idle policy when the pipeline handler
+ * doesn't report one.
+ */
+constexpr std::chrono::microseconds kIdleDefaultInterval{ 33333 };
+
+utils::duration watchdogPeriod(const CameraData *data)
+{
+	return std::max<utils::duration>(kWatchdogMinTimeout,
+					 data->frameInterval_ * kWatchdogFrames);
+}
+
+utils::time_point targetTime(Request *request)
+{
+	std::chrono::nanoseconds time{ request->controls().get(controls::FrameTargetTime) };
+	return utils::time_point(time);
+}
+
+/* Report \a time in the \a control metadata, unless unset or filtered out. */
+void setTimeMetadata(Request *request, const Control<int64_t> &control,
+		     utils::time_point time)
+{
+	if (time == utils::time_point() || !request->metadataEnabled(control))
+		return;
+
+	std::chrono::nanoseconds ns = time.time_since_epoch();
+	request->metadata().set(control, static_cast<int64_t>(ns.count()));
+}
+
+} /* namespace */
+
 /**
  * \class CameraData
  * \brief Base class for platform-specific data associated with a camera
@@ -90,6 +143,25 @@ LOG_DEFINE_CATEGORY(Pipeline)
  * PipelineHandler::completeRequest()
  */
 
+/**
+ * \var CameraData::waitingRequests_
+ * \brief The queue of requests waiting for room in the device
+ *
+ * Requests queued while the device is processing as many requests as the
+ * streams have buffers wait in this queue, and are passed to the device in
+ * order as previous requests complete.
+ *
+ * Requests with a controls::FrameTargetTime also wait in this queue until
+ * their target time approaches, holding back the requests queued after them.
+ *
+ * \sa PipelineHandler::queueRequest()
+ */
+
+/**
+ * \var CameraData::deviceRequests_
+ * \brief The number of requests queued to the device and not yet completed
+ */
+
 /**
  * \var CameraData::controlInfo_
  * \brief The set of controls supported by the camera
@@ -106,6 +178,17 @@ LOG_DEFINE_CATEGORY(Pipeline)
  * stream(s). If no IPA exists for the camera, this field is set to nullptr.
  */
 
+/**
+ * \var CameraData::frameInterval_
+ * \brief The expected interval between frames while the camera is running
+ *
+ * Pipeline handlers that know the frame rate of the device should set the
+ * frame interval when starting the camera. It is used to detect stalled
+ * cameras, a zero value selects a conservative default.
+ *
+ * \sa Camera::stalled
+ */
+
 /**
  * \class PipelineHandler
  * \brief Create and manage cameras based on a set of media devices
@@ -117,6 +200,17 @@ LOG_DEFINE_CATEGORY(Pipeline)
  * They implement std::enable_shared_from_this<> in order to create new
  * std::shared_ptr<> in code paths originating from member functions of the
  * PipelineHandler class where only the 'this' pointer is available.
+ *
+ * Pipeline handlers run by default in the thread of the camera manager, and
+ * thus share a single event loop with all the other pipeline handlers. A
+ * pipeline handler can instead be given a thread of its own with
+ * createThread(), in which case all its event notifiers, timers and signal
+ * handlers, as well as the ones of the devices and IPA modules it creates,
+ * run in that thread. The Camera class then calls the pipeline handler
+ * methods synchronously in the pipeline handler thread, ensuring that all
+ * cameras created by the same pipeline handler, and the hardware resources
+ * they share, are accessed from a single thread without any additional
+ * locking.
  */
 
 /**
@@ -129,8 +223,16 @@ LOG_DEFINE_CATEGORY(Pipeline)
  * respective factories.
  */
 PipelineHandler::PipelineHandler(CameraManager *manager)
-	: manager_(manager)
+	: manager_(manager), idleFrames_(0)
 {
+	/*
+	 * The idle policy is opt-in, the LIBCAMERA_PIPELINE_IDLE_FRAMES
+	 * environment variable sets the number of frame intervals without
+	 * any queued request after which the device is paused.
+	 */
+	const char *idle = utils::secure_getenv("LIBCAMERA_PIPELINE_IDLE_FRAMES");
+	if (idle)
+		idleFrames_ = strtoul(idle, nullptr, 10);
 }
 
 PipelineHandler::~PipelineHandler()
@@ -139,6 +241,81 @@ PipelineHandler::~PipelineHandler()
 		media->release();
 }
 
+/**
+ * \brief Run the pipeline handler in a dedicated thread
+ * \param[in] cpus The CPUs the thread is allowed to run on
+ *
+ * Create and start a thread for the pipeline handler, and move the pipeline
+ * handler to it. The thread is named after the pipeline handler, and is
+ * restricted to the \a cpus if the list isn't empty.
+ *
+ * This method shall be called before match(), which shall then be invoked in
+ * the pipeline handler thread, to ensure that all the objects created by the
+ * pipeline handler are bound to its thread. The thread is stopped when the
+ * pipeline handler is destroyed.
+ *
+ * \return 0 on success or a negative error code otherwise
+ * \retval -EBUSY The pipeline handler already runs in a dedicated thread
+ * \retval -EINVAL The CPU list is invalid
+ */
+int PipelineHandler::createThread(const std::vector<unsigned int> &cpus)
+{
+	if (handlerThread_)
+		return -EBUSY;
+
+	std::unique_ptr<Thread> thread = std::make_unique<Thread>();
+
+	std::string name(name_);
+	if (!name.compare(0, strlen("PipelineHandler"), "PipelineHandler"))
+		name.erase(0, strlen("PipelineHandler"));
+	thread->setName(name);
+
+	if (!cpus.empty()) {
+		int ret = thread->setAffinity(cpus);
+		if (ret)
+			return ret;
+	}
+
+	thread->start();
+	moveToThread(thread.get());
+
+	handlerThread_ = std::move(thread);
+
+	LOG(Pipeline, Debug)
+		<< "Pipeline handler " << name_ << " running in thread " << name;
+
+	return 0;
+}
+
+/**
+ * \fn PipelineHandler::hasThread()
+ * \brief Check if the pipeline handler runs in a dedicated thread
+ * \return True if the pipeline handler runs in a thread created with
+ * createThread(), false otherwise
+ */
+
+/**
+ * \brief Destroy a pipeline handler and stop its thread
+ * \param[in] handler The pipeline handler
+ *
+ * The pipeline handler thread is stopped before the pipeline handler is
+ * deleted, to guarantee that no event or message is processed for the objects
+ * being destroyed. It is thus not allowed to release the last reference to a
+ * pipeline handler from its own thread.
+ */
+void PipelineHandler::destroy(PipelineHandler *handler)
+{
+	std::unique_ptr<Thread> thread = std::move(handler->handlerThread_);
+	if (thread) {
+		ASSERT(Thread::current() != thread.get());
+
+		thread->exit();
+		thread->wait();
+	}
+
+	delete handler;
+}
+
 /**
  * \fn PipelineHandler::match(DeviceEnumerator *enumerator)
  * \brief Match media devices and create camera instances
@@ -235,6 +412,30 @@ void PipelineHandler::unlock()
 		media->unlock();
 }
 
+/**
+ * \brief Prepare a camera for exclusive use
+ * \param[in] camera The camera being acquired
+ *
+ * Pipeline handlers should only perform the work needed to enumerate cameras
+ * and report their properties and controls in match(), as all pipeline
+ * handlers are matched when the camera manager starts, regardless of whether
+ * the cameras will be used. Resources that are only needed to operate the
+ * camera, such as the IPA module and its context, should instead be created
+ * when the application acquires the \a camera, and may be kept until the
+ * pipeline handler is destroyed to speed up subsequent acquisitions.
+ *
+ * This method is called with the pipeline handler locked. The default
+ * implementation does nothing.
+ *
+ * The only intended caller is Camera::acquire().
+ *
+ * \return 0 on success or a negative error code otherwise
+ */
+int PipelineHandler::acquire(Camera *camera)
+{
+	return 0;
+}
+
 /**
  * \brief Retrieve the list of controls for a camera
  * \param[in] camera The camera
@@ -299,7 +500,10 @@ const ControlInfoMap &PipelineHandler::controls(Camera *camera)
  * This method allocates buffers for the \a stream from the devices associated
  * with the stream in the corresponding pipeline handler. Those buffers shall be
  * suitable to be added to a Request for the stream, and shall be mappable to
- * the CPU through their associated dmabufs with mmap().
+ * the CPU through their associated dmabufs with mmap(). Pipeline handlers
+ * should pass the stream CPU access pattern, as reported by
+ * Stream::cpuAccess(), to the device the buffers are allocated from, to skip
+ * unnecessary cache maintenance operations.
  *
  * The method may only be called after the Camera has been configured and before
  * it gets started, or after it gets stopped. It shall be called only for
@@ -342,7 +546,8 @@ const ControlInfoMap &PipelineHandler::controls(Camera *camera)
  * exportFrameBuffers() and importFrameBuffers() for the streams contained in
  * any camera configuration.
  *
- * The only intended caller is Camera::start().
+ * The only intended callers are Camera::start() and the FrameBufferAllocator,
+ * when it reuses buffers previously exported for a stream.
  *
  * \return 0 on success or a negative error code otherwise
  */
@@ -361,6 +566,74 @@ const ControlInfoMap &PipelineHandler::controls(Camera *camera)
  * The only intended callers are Camera::stop() and Camera::freeFrameBuffers().
  */
 
+/**
+ * \brief Allocate additional buffers for \a stream
+ * \param[in] camera The camera
+ * \param[in] stream The stream to allocate buffers for
+ * \param[in] count The number of buffers to allocate
+ * \param[out] buffers Array to append the allocated buffers to
+ *
+ * This method grows the pool of buffers previously allocated for the \a stream
+ * with exportFrameBuffers() by \a count buffers, and appends them to \a
+ * buffers. As opposed to exportFrameBuffers(), it may be called while the
+ * Camera is running, and shall not disturb the capture of the buffers already
+ * queued. The new buffers are freed along with the other buffers of the stream
+ * by freeFrameBuffers().
+ *
+ * The default implementation returns -ENOTSUP, pipeline handlers that can grow
+ * their buffer pools at runtime shall override it.
+ *
+ * The only intended caller is Camera::addFrameBuffers().
+ *
+ * \return The number of allocated buffers on success or a negative error code
+ * otherwise
+ * \retval -ENOTSUP The pipeline handler can't add buffers to the \a stream
+ */
+int PipelineHandler::addFrameBuffers(Camera *camera, Stream *stream,
+				     unsigned int count,
+				     std::vector<std::unique_ptr<FrameBuffer>> *buffers)
+{
+	return -ENOTSUP;
+}
+
+/**
+ * \brief Report the internal buffer pools of a camera
+ * \param[in] camera The camera
+ * \param[out] pools The buffer pools usage to append to
+ *
+ * This method shall append a BufferPoolUsage::Internal entry to \a pools for
+ * each pool of buffers currently allocated internally by the pipeline handler
+ * for the \a camera, such as raw frame, ISP parameters or statistics buffers.
+ * Buffers allocated for streams through exportFrameBuffers() are accounted for
+ * by the Camera and shall not be reported.
+ *
+ * The default implementation reports no internal pool, pipeline handlers that
+ * allocate internal buffers shall override it.
+ *
+ * The only intended caller is Camera::bufferUsage().
+ */
+void PipelineHandler::bufferUsage(const Camera *camera,
+				  std::vector<BufferPoolUsage> *pools)
+{
+}
+
+/**
+ * \brief Report the state of the devices of a stalled camera
+ * \param[in] camera The camera
+ * \param[out] stall The stall report to fill
+ *
+ * This method shall append to CameraStall::devices an entry for each video
+ * device used by the \a camera, with the number of buffers queued to the
+ * device, to help locating the device that stopped returning buffers. The
+ * default implementation reports no device.
+ *
+ * The only intended caller is the stall watchdog, before emitting the
+ * Camera::stalled signal.
+ */
+void PipelineHandler::stallReport(const Camera *camera, CameraStall *stall)
+{
+}
+
 /**
  * \fn PipelineHandler::start()
  * \brief Start capturing from a group of streams
@@ -375,16 +648,100 @@ const ControlInfoMap &PipelineHandler::controls(Camera *camera)
  */
 
 /**
- * \fn PipelineHandler::stop()
  * \brief Stop capturing from all running streams
  * \param[in] camera The camera to stop
  *
- * This method stops capturing and processing requests immediately. All pending
- * requests are cancelled and complete immediately in an error state.
+ * This method stops capturing and processing requests immediately. The
+ * requests queued to the device are completed by the pipeline handler in
+ * stopDevice(), and the requests still waiting for room in the device are then
+ * cancelled. All pending requests thus complete immediately, those that have
+ * not been processed in an error state.
+ */
+void PipelineHandler::stop(Camera *camera)
+{
+	CameraData *data = cameraData(camera);
+
+	/*
+	 * Queue the requests submitted from other threads before stopping, and
+	 * reject all further submissions. They will be cancelled with the
+	 * other pending requests.
+	 */
+	queueSubmittedRequests(camera, true);
+
+	/* Return the spare requests completed by the device to the pool. */
+	data->latestFrames_ = false;
+
+	data->watchdog_.stop();
+	data->targetTimer_.stop();
+	data->idleTimer_.stop();
+
+	/*
+	 * Take the waiting requests out of the queue, to prevent them from
+	 * being queued to the device when the requests in flight complete.
+	 */
+	std::queue<Request *> waitingRequests;
+	std::swap(waitingRequests, data->waitingRequests_);
+
+	stopDevice(camera);
+
+	while (!waitingRequests.empty()) {
+		Request *request = waitingRequests.front();
+		waitingRequests.pop();
+
+		request->cancel();
+		for (auto it : request->buffers())
+			completeBuffer(camera, request, it.second);
+		request->complete();
+	}
+
+	completeQueuedRequests(camera);
+
+	data->watchdog_.stop();
+	data->stalled_ = false;
+
+	data->idleTimer_.stop();
+	data->paused_ = false;
+	data->resuming_ = false;
+
+	data->frameIndex_ = 0;
+
+	data->spares_.clear();
+	data->latest_ = nullptr;
+	data->sparesQueued_ = 0;
+}
+
+/**
+ * \brief Release the resources allocated for a camera
+ * \param[in] camera The camera being released
+ *
+ * Pipeline handlers may keep internal buffers and other resources allocated
+ * when the camera is stopped, to speed up a subsequent start(), until the
+ * camera is reconfigured. This method is called when the application releases
+ * the \a camera, and shall free all those resources. The default
+ * implementation does nothing.
+ *
+ * The only intended caller is Camera::release().
+ */
+void PipelineHandler::release(Camera *camera)
+{
+}
+
+/*
+ * The device can't process more requests than any of the streams they use has
+ * buffers.
  */
+static bool deviceHasRoom(const CameraData *data, const Request *request)
+{
+	for (auto it : request->buffers()) {
+		unsigned int bufferCount = it.first->configuration().bufferCount;
+		if (bufferCount && data->deviceRequests_ >= bufferCount)
+			return false;
+	}
+
+	return true;
+}
 
 /**
- * \fn PipelineHandler::queueRequest()
  * \brief Queue a request to the camera
  * \param[in] camera The camera to queue the request to
  * \param[in] request The request to queue
@@ -393,6 +750,41 @@ const ControlInfoMap &PipelineHandler::controls(Camera *camera)
  * The request is first added to the internal list of queued requests, and
  * then passed to the pipeline handler with a call to queueRequestDevice().
  *
+ * The number of requests in flight in the device is bounded by the number of
+ * buffers of the streams, as configured by StreamConfiguration::bufferCount.
+ * Requests queued beyond that limit are held in the list of waiting requests,
+ * and are passed to the device as previous requests complete. Errors returned
+ * by queueRequestDevice() for those requests are reported by cancelling them.
+ *
+ * Requests that carry a controls::FrameTargetTime are held in the list of
+ * waiting requests until the time returned by targetQueueTime(), and the
+ * requests queued after them wait behind them. The difference between the
+ * capture time and the target time is reported in the request metadata with
+ * controls::FrameTargetOffset.
+ *
+ * When the idle policy is enabled with the LIBCAMERA_PIPELINE_IDLE_FRAMES
+ * environment variable, the device is paused with pauseDevice() once no
+ * request has been queued for that number of frame intervals. It is resumed
+ * with resumeDevice() before the next request is queued to the device.
+ *
+ * The buffers of streams decimated with StreamConfiguration::decimation are
+ * completed with the FrameMetadata::FrameSkipped status when the request is
+ * queued, for the frames that the stream doesn't capture. Pipeline handlers
+ * shall not queue those buffers to the device.
+ *
+ * In the latest frames mode selected with Camera::setLatestFrames(), the device
+ * captures frames to spare requests when the application doesn't queue
+ * requests fast enough. A request queued when no earlier request is pending
+ * then completes immediately with the latest captured frame, its buffers being
+ * exchanged with the buffers of the spare request, and requests queued while
+ * spare requests are in the device wait for them to complete. Requests that
+ * carry controls, or whose buffers are skipped by decimation, are always
+ * captured by the device.
+ *
+ * Repeating requests re-armed with Camera::releaseRequest() are queued through
+ * this method as well. When released from a thread other than the pipeline
+ * handler thread, they are picked up by the next call to completeRequest().
+ *
  * Keeping track of queued requests ensures automatic completion of all requests
  * when the pipeline handler is stopped with stop(). Request completion shall be
  * signalled by the pipeline handler using the completeRequest() method.
@@ -401,14 +793,367 @@ const ControlInfoMap &PipelineHandler::controls(Camera *camera)
  */
 int PipelineHandler::queueRequest(Camera *camera, Request *request)
 {
+	CpuScope scope(CameraStatistics::CpuPipeline, camera);
 	CameraData *data = cameraData(camera);
-	data->queuedRequests_.push_back(request);
 
-	int ret = queueRequestDevice(camera, request);
+	int ret = idleResume(camera);
 	if (ret)
+		return ret;
+
+	request->decimate(data->frameIndex_++);
+	data->queuedRequests_.push_back(request);
+
+	Request *spare = takeLatest(data, request);
+	if (spare) {
+		completeFromSpare(camera, request, spare);
+		return 0;
+	}
+
+	if (!data->waitingRequests_.empty() || data->sparesQueued_ ||
+	    !deviceHasRoom(data, request) || !requestDue(data, request)) {
+		data->waitingRequests_.push(request);
+		return 0;
+	}
+
+	data->deviceRequests_++;
+	request->deviceTime_ = utils::clock::now();
+
+	LIBCAMERA_TRACEPOINT(PipelineQueueRequestDevice,
+			     reinterpret_cast<uintptr_t>(request));
+
+	ret = queueRequestDevice(camera, request);
+	if (ret) {
+		data->deviceRequests_--;
 		data->queuedRequests_.remove(request);
+		return ret;
+	}
+
+	watchdogStart(data);
+
+	return 0;
+}
+
+/**
+ * \brief Queue a batch of requests to the camera
+ * \param[in] camera The camera to queue the requests to
+ * \param[in] requests The requests to queue, in order
+ *
+ * This method queues multiple capture requests at once. The requests are added
+ * to the internal list of queued requests as with queueRequest(), and those
+ * that can be processed by the device immediately are passed to the pipeline
+ * handler in a single call to queueRequestsDevice(), allowing the pipeline
+ * handler to coalesce device operations.
+ *
+ * As the requests of the batch are queued independently, errors returned by
+ * the pipeline handler are reported by cancelling the failed requests.
+ */
+void PipelineHandler::queueRequests(Camera *camera,
+				    Span<Request *const> requests)
+{
+	CpuScope scope(CameraStatistics::CpuPipeline, camera);
+	CameraData *data = cameraData(camera);
+	std::vector<Request *> ready;
+	Request *served = nullptr;
+	Request *spare = nullptr;
+
+	if (idleResume(camera)) {
+		for (Request *request : requests) {
+			data->queuedRequests_.push_back(request);
+			data->deviceRequests_++;
+			cancelRequest(camera, request);
+		}
+
+		return;
+	}
+
+	for (Request *request : requests) {
+		request->decimate(data->frameIndex_++);
+		data->queuedRequests_.push_back(request);
+
+		/*
+		 * Complete the request with the latest frame once the whole
+		 * batch has been queued, as completion may queue more requests.
+		 */
+		if (!served) {
+			spare = takeLatest(data, request);
+			if (spare) {
+				served = request;
+				continue;
+			}
+		}
+
+		if (!data->waitingRequests_.empty() || data->sparesQueued_ ||
+		    !deviceHasRoom(data, request) ||
+		    !requestDue(data, request)) {
+			data->waitingRequests_.push(request);
+			continue;
+		}
+
+		data->deviceRequests_++;
+		ready.push_back(request);
+	}
+
+	queueDeviceBatch(camera, ready);
+
+	if (served)
+		completeFromSpare(camera, served, spare);
+}
+
+/*
+ * Pass a batch of requests, already accounted for in the queued and device
+ * requests, to the pipeline handler. The requests that fail to be queued are
+ * cancelled once the whole batch has been processed, to avoid later requests
+ * overtaking the rest of the batch when the cancellation makes room in the
+ * device.
+ */
+void PipelineHandler::queueDeviceBatch(Camera *camera,
+				       Span<Request *const> requests)
+{
+	CameraData *data = cameraData(camera);
+	std::vector<Request *> failed;
+
+	while (!requests.empty()) {
+		utils::time_point now = utils::clock::now();
+		for (Request *request : requests) {
+			request->deviceTime_ = now;
+			LIBCAMERA_TRACEPOINT(PipelineQueueRequestDevice,
+					     reinterpret_cast<uintptr_t>(request));
+		}
+
+		unsigned int count = queueRequestsDevice(camera, requests);
+		ASSERT(count <= requests.size());
+
+		if (count)
+			watchdogStart(data);
+
+		if (count == requests.size())
+			break;
+
+		failed.push_back(requests[count]);
+		requests = requests.subspan(count + 1);
+	}
+
+	for (Request *request : failed) {
+		LOG(Pipeline, Error) << "Failed to queue request in batch";
+		cancelRequest(camera, request);
+	}
+}
+
+void PipelineHandler::doQueueRequests(Camera *camera)
+{
+	CameraData *data = cameraData(camera);
+
+	/* The waiting requests are completed by the spare requests. */
+	if (data->sparesQueued_)
+		return;
+
+	while (!data->waitingRequests_.empty()) {
+		Request *request = data->waitingRequests_.front();
+		if (!deviceHasRoom(data, request) || !requestDue(data, request))
+			return;
+
+		data->waitingRequests_.pop();
+		data->deviceRequests_++;
+		request->deviceTime_ = utils::clock::now();
+
+		LIBCAMERA_TRACEPOINT(PipelineQueueRequestDevice,
+				     reinterpret_cast<uintptr_t>(request));
+
+		int ret = queueRequestDevice(camera, request);
+		if (ret) {
+			LOG(Pipeline, Error)
+				<< "Failed to queue waiting request: "
+				<< strerror(-ret);
+			cancelRequest(camera, request);
+			continue;
+		}
+
+		watchdogStart(data);
+	}
+}
+
+/*
+ * Queue the requests handed over by Camera::queueRequest() from threads other
+ * than the pipeline handler thread, in submission order, as a single batch.
+ * Errors can't be reported to the caller anymore, the failed requests are
+ * cancelled instead.
+ */
+void PipelineHandler::queueSubmittedRequests(Camera *camera, bool close)
+{
+	Request *request = camera->takeSubmittedRequests(close);
+	if (!request)
+		return;
+
+	std::vector<Request *> requests;
+	while (request) {
+		Request *next = request->submitNext_;
+		request->submitNext_ = nullptr;
+		requests.push_back(request);
+		request = next;
+	}
+
+	queueRequests(camera, requests);
+}
+
+/*
+ * Run a Camera operation deferred by Camera::configureAsync() or
+ * Camera::startAsync() in the pipeline handler thread.
+ */
+void PipelineHandler::runCameraOperation(std::function<void()> operation)
+{
+	operation();
+}
+
+/*
+ * Store the spare requests of the latest frames mode, created by
+ * Camera::start() with one spare buffer for each active stream. An empty list
+ * disables the mode.
+ */
+void PipelineHandler::setSpareRequests(Camera *camera,
+				       Span<Request *const> spares)
+{
+	CameraData *data = cameraData(camera);
+
+	data->spares_.assign(spares.begin(), spares.end());
+	data->latest_ = nullptr;
+	data->sparesQueued_ = 0;
+	data->latestFrames_ = !spares.empty();
+}
+
+/*
+ * A request can take the frame captured by a spare request if it doesn't need
+ * the device to apply controls or to skip buffers, and if the spare request
+ * has captured all its streams.
+ */
+bool PipelineHandler::spareCompatible(const Request *request,
+				      const Request *spare) const
+{
+	if (!request->controls_->empty())
+		return false;
 
-	return ret;
+	for (auto it : request->buffers()) {
+		if (it.second->metadata().status == FrameMetadata::FrameSkipped)
+			return false;
+		if (!spare->findBuffer(it.first))
+			return false;
+	}
+
+	return true;
+}
+
+/*
+ * Take the latest frame to complete a request with. The frame can only be
+ * used when no earlier request is in the device or waiting for it, to keep
+ * frames in capture order.
+ */
+Request *PipelineHandler::takeLatest(CameraData *data, const Request *request)
+{
+	Request *spare = data->latest_;
+
+	if (!spare || !data->waitingRequests_.empty() ||
+	    data->deviceRequests_ != data->sparesQueued_ ||
+	    !spareCompatible(request, spare))
+		return nullptr;
+
+	data->latest_ = nullptr;
+	return spare;
+}
+
+/*
+ * Complete a request with the frame captured by a spare request, without
+ * copies. The spare request receives the buffers of the request and returns
+ * to the pool.
+ */
+void PipelineHandler::completeFromSpare(Camera *camera, Request *request,
+					Request *spare)
+{
+	CameraData *data = cameraData(camera);
+
+	request->takeBuffers(spare);
+	data->spares_.push_back(spare);
+
+	/* Account for the request as if it had been processed by the device. */
+	data->deviceRequests_++;
+
+	for (auto it : request->buffers())
+		completeBuffer(camera, request, it.second);
+
+	completeRequest(camera, request);
+}
+
+/*
+ * Handle the completion of a spare request. The frame completes the oldest
+ * waiting request if possible, or is kept as the latest frame otherwise.
+ */
+void PipelineHandler::completeSpareRequest(Camera *camera, Request *spare)
+{
+	CameraData *data = cameraData(camera);
+
+	spare->complete();
+
+	ASSERT(data->deviceRequests_ && data->sparesQueued_);
+	data->deviceRequests_--;
+	data->sparesQueued_--;
+
+	if (!data->deviceRequests_)
+		data->watchdog_.stop();
+
+	if (!data->latestFrames_ ||
+	    spare->status() != Request::RequestComplete) {
+		data->spares_.push_back(spare);
+	} else if (!data->waitingRequests_.empty() &&
+		   spareCompatible(data->waitingRequests_.front(), spare)) {
+		Request *request = data->waitingRequests_.front();
+		data->waitingRequests_.pop();
+		completeFromSpare(camera, request, spare);
+	} else {
+		if (data->latest_)
+			data->spares_.push_back(data->latest_);
+		data->latest_ = spare;
+	}
+
+	doQueueRequests(camera);
+	queueSpares(camera);
+}
+
+/*
+ * Keep the device capturing to spare requests while the application has no
+ * request in the device or waiting for it.
+ */
+void PipelineHandler::queueSpares(Camera *camera)
+{
+	CameraData *data = cameraData(camera);
+
+	if (!data->latestFrames_ || data->paused_ ||
+	    !data->waitingRequests_.empty() ||
+	    data->deviceRequests_ != data->sparesQueued_)
+		return;
+
+	while (!data->spares_.empty()) {
+		Request *spare = data->spares_.back();
+		if (!deviceHasRoom(data, spare))
+			return;
+
+		data->spares_.pop_back();
+		spare->rearm();
+
+		data->deviceRequests_++;
+		data->sparesQueued_++;
+		spare->deviceTime_ = utils::clock::now();
+
+		int ret = queueRequestDevice(camera, spare);
+		if (ret) {
+			LOG(Pipeline, Error)
+				<< "Failed to queue spare request: "
+				<< strerror(-ret);
+			data->deviceRequests_--;
+			data->sparesQueued_--;
+			data->spares_.push_back(spare);
+			return;
+		}
+
+		watchdogStart(data);
+	}
 }
 
 /**
@@ -426,6 +1171,127 @@ int PipelineHandler::queueRequest(Camera *camera, Request *request)
  * \return 0 on success or a negative error code otherwise
  */
 
+/**
+ * \brief Queue a batch of requests to the device
+ * \param[in] camera The camera to queue the requests to
+ * \param[in] requests The requests to queue, in order
+ *
+ * This method queues multiple capture requests to the device for processing,
+ * as queueRequestDevice() does for a single request. Pipeline handlers can
+ * override it to coalesce the device operations of the requests, such as
+ * parameter updates or wakeups of the hardware. The requests shall be queued
+ * in order, and processing shall stop at the first request that fails to be
+ * queued.
+ *
+ * The default implementation calls queueRequestDevice() for each request.
+ *
+ * \return The number of requests successfully queued. If lower than the size
+ * of \a requests, the request at that index has failed to be queued and the
+ * following requests have not been processed
+ */
+unsigned int PipelineHandler::queueRequestsDevice(Camera *camera,
+						  Span<Request *const> requests)
+{
+	unsigned int count = 0;
+
+	for (Request *request : requests) {
+		if (queueRequestDevice(camera, request))
+			break;
+
+		count++;
+	}
+
+	return count;
+}
+
+/**
+ * \fn PipelineHandler::stopDevice()
+ * \brief Stop capturing from all running streams
+ * \param[in] camera The camera to stop
+ *
+ * This method stops capturing and processing requests immediately. All requests
+ * queued to the device with queueRequestDevice() shall be completed before the
+ * method returns, those that haven't been processed in an error state.
+ */
+
+/**
+ * \brief Restart streaming on a stalled camera
+ * \param[in] camera The camera to recover
+ *
+ * This method is called when the \a camera hasn't completed any buffer for
+ * longer than expected while requests are queued to the device. Pipeline
+ * handlers may implement it to restart streaming in place, requeuing the
+ * buffers in flight to the device without completing the requests they belong
+ * to. The default implementation returns -ENOTSUP.
+ *
+ * \return 0 on success or a negative error code otherwise
+ */
+int PipelineHandler::recoverDevice(Camera *camera)
+{
+	return -ENOTSUP;
+}
+
+/**
+ * \brief Pause streaming on an idle camera
+ * \param[in] camera The camera to pause
+ *
+ * This method is called by the idle policy when no request has been queued
+ * to the running \a camera for the configured number of frame intervals. No
+ * request is in flight in the device at that point. Pipeline handlers may
+ * implement it to stop streaming on the capture path, to save power and
+ * memory bandwidth, while keeping the buffers and configuration in place for
+ * resumeDevice(). The camera may be stopped with stopDevice() while paused.
+ *
+ * The default implementation returns -ENOTSUP, which keeps the device
+ * streaming.
+ *
+ * \return 0 on success or a negative error code otherwise
+ */
+int PipelineHandler::pauseDevice(Camera *camera)
+{
+	return -ENOTSUP;
+}
+
+/**
+ * \brief Resume streaming on a camera paused by pauseDevice()
+ * \param[in] camera The camera to resume
+ *
+ * This method is called before queuing the first request to a \a camera that
+ * has been paused with pauseDevice(). The time from the call to the first
+ * completed buffer is reported in CameraStatistics::resumeLatency.
+ *
+ * The default implementation returns -ENOTSUP, it shall be overridden by
+ * pipeline handlers that implement pauseDevice().
+ *
+ * \return 0 on success or a negative error code otherwise
+ */
+int PipelineHandler::resumeDevice(Camera *camera)
+{
+	return -ENOTSUP;
+}
+
+/**
+ * \brief Compute when to queue a request with a target capture time
+ * \param[in] camera The camera the request is queued to
+ * \param[in] target The controls::FrameTargetTime of the request
+ *
+ * Requests with a target capture time are held until the time returned by
+ * this method, and are then passed to queueRequestDevice(). The default
+ * implementation returns \a target, as a buffer queued to the device is filled
+ * with the next frame, which guarantees that the frame isn't captured before
+ * the target time. Pipeline handlers that can predict the capture time of
+ * frames may return an earlier time to queue the request to the device in
+ * advance, and then hold it internally until the frame that matches the
+ * target.
+ *
+ * \return The time at which to queue the request to the device
+ */
+utils::time_point PipelineHandler::targetQueueTime(Camera *camera,
+						   utils::time_point target)
+{
+	return target;
+}
+
 /**
  * \brief Complete a buffer for a request
  * \param[in] camera The camera the request belongs to
@@ -445,7 +1311,41 @@ int PipelineHandler::queueRequest(Camera *camera, Request *request)
 bool PipelineHandler::completeBuffer(Camera *camera, Request *request,
 				     FrameBuffer *buffer)
 {
-	camera->bufferCompleted.emit(request, buffer);
+	CpuScope::setCamera(camera);
+
+	/* Skipped buffers have been completed when the request was queued. */
+	if (buffer->metadata().status == FrameMetadata::FrameSkipped)
+		return !request->hasPendingBuffers();
+
+	if (buffer->metadata().status != FrameMetadata::FrameCancelled) {
+		CameraData *data = cameraData(camera);
+
+		data->lastBuffer_ = utils::clock::now();
+		if (data->resuming_) {
+			data->resuming_ = false;
+			uint64_t latency = std::chrono::duration_cast<std::chrono::microseconds>(
+				data->lastBuffer_ - data->resumeTime_).count();
+			LOG(Pipeline, Debug)
+				<< "Camera '" << camera->name() << "' resumed in "
+				<< latency << "us";
+			camera->idleResumed(latency);
+		}
+
+		if (data->stalled_) {
+			LOG(Pipeline, Info)
+				<< "Camera '" << camera->name() << "' resumed";
+			data->stalled_ = false;
+			watchdogStart(data);
+		}
+	}
+
+	request->bufferTime_ = utils::clock::now();
+
+	if (!request->spare_) {
+		CpuScope scope(CameraStatistics::CpuApplication, camera);
+		camera->bufferCompleted.emit(request, buffer);
+	}
+
 	return request->completeBuffer(buffer);
 }
 
@@ -459,26 +1359,353 @@ bool PipelineHandler::completeBuffer(Camera *camera, Request *request,
  * this method returns.
  *
  * This method ensures that requests will be returned to the application in
- * submission order, the pipeline handler may call it on any complete request
- * without any ordering constraint.
+ * the order selected by Camera::setCompletionOrder(), the pipeline handler may
+ * call it on any complete request without any ordering constraint.
  */
 void PipelineHandler::completeRequest(Camera *camera, Request *request)
 {
+	CpuScope::setCamera(camera);
+
+	if (request->spare_) {
+		completeSpareRequest(camera, request);
+		return;
+	}
+
+	if (request->controls().contains(controls::FrameTargetTime) &&
+	    request->metadataEnabled(controls::FrameTargetOffset) &&
+	    !request->buffers().empty()) {
+		const FrameMetadata &metadata = request->buffers().begin()->second->metadata();
+		if (metadata.status == FrameMetadata::FrameSuccess) {
+			int64_t target = request->controls().get(controls::FrameTargetTime);
+			request->metadata().set(controls::FrameTargetOffset,
+						static_cast<int64_t>(metadata.timestamp) - target);
+		}
+	}
+
+	setTimeMetadata(request, controls::RequestQueueTime, request->queueTime_);
+	setTimeMetadata(request, controls::RequestDeviceTime, request->deviceTime_);
+	setTimeMetadata(request, controls::BufferCompleteTime, request->bufferTime_);
+	setTimeMetadata(request, controls::IPACompleteTime, request->ipaTime_);
+	setTimeMetadata(request, controls::RequestCompleteTime, utils::clock::now());
+
+	if (request->metadataEnabled(controls::FrameStartTime) &&
+	    !request->buffers().empty()) {
+		const FrameMetadata &metadata = request->buffers().begin()->second->metadata();
+		if (metadata.status == FrameMetadata::FrameSuccess)
+			request->metadata().set(controls::FrameStartTime,
+						static_cast<int64_t>(metadata.timestamp));
+	}
+
 	request->complete();
 
+	LIBCAMERA_TRACEPOINT(PipelineCompleteRequest,
+			     reinterpret_cast<uintptr_t>(request),
+			     request->status());
+
+	bool completed = request->status() == Request::RequestComplete;
 	CameraData *data = cameraData(camera);
 
-	while (!data->queuedRequests_.empty()) {
-		Request *req = data->queuedRequests_.front();
-		if (req->status() == Request::RequestPending)
-			break;
+	ASSERT(data->deviceRequests_);
+	data->deviceRequests_--;
+
+	/* Nothing left to monitor until the next request reaches the device. */
+	if (!data->deviceRequests_)
+		data->watchdog_.stop();
+
+	/* The latest frame is older than the one just completed. */
+	if (data->latest_) {
+		data->spares_.push_back(data->latest_);
+		data->latest_ = nullptr;
+	}
+
+	completeQueuedRequests(camera);
+
+	/*
+	 * Pick up the requests released by the application from other threads,
+	 * to re-arm repeating requests as soon as a frame completes without
+	 * waiting for the queued submission call. Cancellations are skipped,
+	 * as they are completed while queuing other requests.
+	 */
+	if (completed)
+		queueSubmittedRequests(camera, false);
+
+	if (data->queuedRequests_.empty())
+		idleStart(data);
+
+	if (data->waitingRequests_.empty()) {
+		queueSpares(camera);
+		camera->requestQueueAvailable.emit(camera);
+		return;
+	}
+
+	doQueueRequests(camera);
+}
+
+/*
+ * Monitor the completion of buffers once requests are queued to the device.
+ * The timer is armed when the camera goes from idle to busy, completing
+ * buffers only records the time to keep the fast path cheap, and the timer
+ * reschedules itself when it expires while buffers are still flowing.
+ */
+void PipelineHandler::watchdogStart(CameraData *data)
+{
+	if (data->watchdog_.isRunning() || data->stalled_)
+		return;
+
+	data->lastBuffer_ = utils::clock::now();
+	data->watchdog_.start(data->lastBuffer_ + watchdogPeriod(data));
+}
+
+void PipelineHandler::watchdogTimeout(Timer *timer)
+{
+	auto iter = std::find_if(cameraData_.begin(), cameraData_.end(),
+				 [timer](const auto &it) {
+					 return &it.second->watchdog_ == timer;
+				 });
+	if (iter == cameraData_.end())
+		return;
+
+	CameraData *data = iter->second.get();
+	Camera *camera = data->camera_;
+
+	utils::time_point now = utils::clock::now();
+	utils::time_point deadline = data->lastBuffer_ + watchdogPeriod(data);
+	if (deadline > now) {
+		timer->start(deadline);
+		return;
+	}
+
+	CameraStall stall;
+	stall.elapsed = std::chrono::duration_cast<std::chrono::microseconds>(
+		now - data->lastBuffer_).count();
+	stallReport(camera, &stall);
+
+	LOG(Pipeline, Warning)
+		<< "Camera '" << camera->name() << "' stalled, no buffer completed in "
+		<< stall.elapsed / 1000 << "ms";
+	for (const CameraStall::Device &device : stall.devices)
+		LOG(Pipeline, Warning)
+			<< device.name << ": " << device.queuedBuffers
+			<< " buffers queued";
+
+	logDumpRecorder("camera stall");
+
+	int ret = recoverDevice(camera);
+	if (!ret) {
+		LOG(Pipeline, Info)
+			<< "Camera '" << camera->name() << "' restarted";
+		stall.recovered = true;
+		data->lastBuffer_ = utils::clock::now();
+		timer->start(data->lastBuffer_ + watchdogPeriod(data));
+	} else {
+		if (ret != -ENOTSUP)
+			LOG(Pipeline, Error)
+				<< "Failed to restart camera '" << camera->name()
+				<< "': " << strerror(-ret);
+		data->stalled_ = true;
+	}
+
+	camera->stalled.emit(camera, stall);
+}
+
+/*
+ * Check if a request can be queued to the device, and arm the target timer to
+ * retry when the request has a target capture time that isn't close enough.
+ */
+bool PipelineHandler::requestDue(CameraData *data, Request *request)
+{
+	if (!request->controls().contains(controls::FrameTargetTime))
+		return true;
+
+	utils::time_point time = targetQueueTime(data->camera_, targetTime(request));
+	if (time <= utils::clock::now())
+		return true;
+
+	data->targetTimer_.start(time);
+	return false;
+}
+
+void PipelineHandler::targetTimeout(Timer *timer)
+{
+	auto iter = std::find_if(cameraData_.begin(), cameraData_.end(),
+				 [timer](const auto &it) {
+					 return &it.second->targetTimer_ == timer;
+				 });
+	if (iter == cameraData_.end())
+		return;
+
+	doQueueRequests(iter->second->camera_);
+}
+
+/*
+ * Pause the device when the application stops queuing requests. The idle timer
+ * is armed when the last queued request completes, and stopped when a new
+ * request is queued.
+ */
+void PipelineHandler::idleStart(CameraData *data)
+{
+	if (!idleFrames_ || data->paused_ || data->latestFrames_)
+		return;
+
+	utils::duration interval = data->frameInterval_ > utils::duration::zero()
+				 ? data->frameInterval_ : kIdleDefaultInterval;
+	data->idleTimer_.start(utils::clock::now() + interval * idleFrames_);
+}
+
+void PipelineHandler::idleTimeout(Timer *timer)
+{
+	auto iter = std::find_if(cameraData_.begin(), cameraData_.end(),
+				 [timer](const auto &it) {
+					 return &it.second->idleTimer_ == timer;
+				 });
+	if (iter == cameraData_.end())
+		return;
+
+	CameraData *data = iter->second.get();
+	Camera *camera = data->camera_;
+
+	if (!data->queuedRequests_.empty())
+		return;
+
+	int ret = pauseDevice(camera);
+	if (ret) {
+		if (ret != -ENOTSUP)
+			LOG(Pipeline, Error)
+				<< "Failed to pause camera '" << camera->name()
+				<< "': " << strerror(-ret);
+		return;
+	}
+
+	LOG(Pipeline, Debug) << "Camera '" << camera->name() << "' paused";
+
+	data->paused_ = true;
+	data->resuming_ = false;
+	camera->idlePaused();
+}
+
+int PipelineHandler::idleResume(Camera *camera)
+{
+	CameraData *data = cameraData(camera);
+
+	data->idleTimer_.stop();
+	if (!data->paused_)
+		return 0;
+
+	data->resumeTime_ = utils::clock::now();
+
+	int ret = resumeDevice(camera);
+	if (ret) {
+		LOG(Pipeline, Error)
+			<< "Failed to resume camera '" << camera->name()
+			<< "': " << strerror(-ret);
+		return ret;
+	}
+
+	data->paused_ = false;
+	data->resuming_ = true;
+
+	return 0;
+}
+
+void PipelineHandler::completeQueuedRequests(Camera *camera)
+{
+	CameraData *data = cameraData(camera);
+
+	if (camera->completionOrder() == Camera::QueueOrder) {
+		while (!data->queuedRequests_.empty()) {
+			Request *req = data->queuedRequests_.front();
+			if (req->status() == Request::RequestPending)
+				break;
+
+			ASSERT(!req->hasPendingBuffers());
+			data->queuedRequests_.pop_front();
+			camera->requestComplete(req);
+		}
+
+		return;
+	}
+
+	/*
+	 * Complete the requests whose streams are not used by any earlier
+	 * request still queued. The requests using a stream thus complete in
+	 * queue order for that stream.
+	 */
+	std::set<const Stream *> blocked;
+
+	for (auto iter = data->queuedRequests_.begin();
+	     iter != data->queuedRequests_.end();) {
+		Request *req = *iter;
+		bool ready = req->status() != Request::RequestPending;
+
+		for (auto it : req->buffers()) {
+			if (blocked.count(it.first)) {
+				ready = false;
+				break;
+			}
+		}
+
+		if (!ready) {
+			for (auto it : req->buffers())
+				blocked.insert(it.first);
+			++iter;
+			continue;
+		}
 
 		ASSERT(!req->hasPendingBuffers());
-		data->queuedRequests_.pop_front();
+		iter = data->queuedRequests_.erase(iter);
 		camera->requestComplete(req);
 	}
 }
 
+/**
+ * \brief Cancel a request that hasn't been queued to the device
+ * \param[in] camera The camera that the request belongs to
+ * \param[in] request The request to cancel
+ *
+ * Pipeline handlers that delay queuing requests to the device, for instance
+ * to bound the number of frames in flight, shall call this method to cancel
+ * the requests they still hold when the camera is stopped. All buffers of the
+ * \a request are completed with the FrameMetadata::FrameCancelled status, and
+ * the request is completed with the Request::RequestCancelled status.
+ *
+ * The request is deleted and shall not be accessed once this method returns.
+ */
+void PipelineHandler::cancelRequest(Camera *camera, Request *request)
+{
+	request->cancel();
+
+	for (auto it : request->buffers())
+		completeBuffer(camera, request, it.second);
+
+	completeRequest(camera, request);
+}
+
+/**
+ * \brief Account for frame statistics not handed to the IPA
+ * \param[in] camera The camera
+ *
+ * Pipeline handlers that skip the statistics of frames when their IPA runs
+ * late shall call this method for every skipped frame, to account for it in
+ * CameraStatistics::statisticsSkipped.
+ */
+void PipelineHandler::statisticsSkipped(Camera *camera)
+{
+	camera->statisticsSkipped();
+}
+
+/**
+ * \brief Notify that the IPA has produced the metadata of a request
+ * \param[in] request The request whose metadata has been produced
+ *
+ * Pipeline handlers that run an IPA module per frame shall call this method
+ * when the IPA module has produced the metadata of \a request, to report the
+ * time in the controls::IPACompleteTime metadata.
+ */
+void PipelineHandler::ipaCompleted(Request *request)
+{
+	request->ipaTime_ = utils::clock::now();
+}
+
 /**
  * \brief Register a camera to the camera manager and pipeline handler
  * \param[in] camera The camera to be added
@@ -500,6 +1727,26 @@ void PipelineHandler::registerCamera(std::shared_ptr<Camera> camera,
 				     dev_t devnum)
 {
 	data->camera_ = camera.get();
+	data->watchdog_.timeout.connect(this, &PipelineHandler::watchdogTimeout);
+	data->targetTimer_.timeout.connect(this, &PipelineHandler::targetTimeout);
+	data->idleTimer_.timeout.connect(this, &PipelineHandler::idleTimeout);
+
+	/*
+	 * Stall detection and idle pauses don't need precise timing, let their
+	 * timers be coalesced with other wake-ups. Target capture times do.
+	 */
+	data->watchdog_.setSlack(kWatchdogSlack);
+	data->idleTimer_.setSlack(kIdleSlack);
+
+	/* Target capture times are handled here for all pipeline handlers. */
+	ControlInfoMap::Map controls(data->controlInfo_.begin(),
+				     data->controlInfo_.end());
+	controls.emplace(std::piecewise_construct,
+			 std::forward_as_tuple(&controls::FrameTargetTime),
+			 std::forward_as_tuple(static_cast<int64_t>(0),
+					       std::numeric_limits<int64_t>::max()));
+	data->controlInfo_ = std::move(controls);
+
 	cameraData_[camera.get()] = std::move(data);
 	cameras_.push_back(camera);
 	manager_->addCamera(std::move(camera), devnum);
@@ -628,7 +1875,7 @@ std::shared_ptr<PipelineHandler> PipelineHandlerFactory::create(CameraManager *m
 {
 	PipelineHandler *handler = createInstance(manager);
 	handler->name_ = name_.c_str();
-	return std::shared_ptr<PipelineHandler>(handler);
+	return std::shared_ptr<PipelineHandler>(handler, PipelineHandler::destroy);
 }
 
 /**
@@ -7,6 +7,9 @@
 
 #include <libcamera/pixelformats.h>
 
+#include <linux/drm_fourcc.h>
+#include <linux/videodev2.h>
+
 /**
  * \file pixelformats.h
  * \brief libcamera pixel formats
@@ -25,4 +28,219 @@ namespace libcamera {
  * \todo Add support for format modifiers
  */
 
+/**
+ * \struct PixelFormatPlaneInfo
+ * \brief Memory layout of one plane of a pixel format
+ *
+ * \var PixelFormatPlaneInfo::bitsPerPixel
+ * \brief The number of bits per sample stored in the plane, covering all the
+ * components interleaved in the plane
+ *
+ * \var PixelFormatPlaneInfo::horizontalSubSampling
+ * \brief The horizontal subsampling factor of the plane
+ *
+ * \var PixelFormatPlaneInfo::verticalSubSampling
+ * \brief The vertical subsampling factor of the plane
+ */
+
+/**
+ * \struct PixelFormatInfo
+ * \brief Information about a pixel format
+ *
+ * The PixelFormatInfo structure describes the memory layout of a pixel format
+ * and its mapping to the V4L2 pixel formats. It is used to compute line
+ * strides and frame sizes, and to translate pixel formats between the
+ * libcamera and V4L2 APIs. Instances are stored in a constant table and are
+ * retrieved with info() or fromV4L2().
+ *
+ * Line strides and frame sizes are computed without any padding. Compressed
+ * formats have no fixed layout, their stride and frame size are reported as 0.
+ */
+
+/**
+ * \enum PixelFormatInfo::ColourEncoding
+ * \brief The colour encoding of the pixel format
+ * \var PixelFormatInfo::ColourEncodingRGB
+ * \brief RGB colour encoding
+ * \var PixelFormatInfo::ColourEncodingYUV
+ * \brief YUV colour encoding
+ */
+
+/**
+ * \fn PixelFormatInfo::isValid()
+ * \brief Check if the pixel format information is valid
+ * \return True if the information describes a known pixel format, false
+ * otherwise
+ */
+
+/**
+ * \var PixelFormatInfo::format
+ * \brief The pixel format
+ *
+ * \var PixelFormatInfo::v4l2Format
+ * \brief The V4L2 pixel format with contiguous planes
+ *
+ * \var PixelFormatInfo::v4l2FormatMultiPlane
+ * \brief The V4L2 pixel format with non-contiguous planes, or 0 if the format
+ * has a single plane
+ *
+ * \var PixelFormatInfo::colourEncoding
+ * \brief The colour encoding of the pixel format
+ *
+ * \var PixelFormatInfo::compressed
+ * \brief True if the pixel format is compressed
+ *
+ * \var PixelFormatInfo::numPlanes
+ * \brief The number of planes of the pixel format
+ *
+ * \var PixelFormatInfo::planes
+ * \brief The layout of the planes of the pixel format, the first numPlanes
+ * entries are valid
+ */
+
+namespace {
+
+constexpr PixelFormatInfo invalidInfo{};
+
+constexpr std::array<PixelFormatInfo, 14> pixelFormatInfo = {{
+	/* RGB formats. */
+	{ DRM_FORMAT_RGB888, V4L2_PIX_FMT_BGR24, 0,
+	  PixelFormatInfo::ColourEncodingRGB, false,
+	  1, {{ { 24, 1, 1 }, { 0, 0, 0 }, { 0, 0, 0 } }} },
+	{ DRM_FORMAT_BGR888, V4L2_PIX_FMT_RGB24, 0,
+	  PixelFormatInfo::ColourEncodingRGB, false,
+	  1, {{ { 24, 1, 1 }, { 0, 0, 0 }, { 0, 0, 0 } }} },
+	{ DRM_FORMAT_BGRA8888, V4L2_PIX_FMT_ARGB32, 0,
+	  PixelFormatInfo::ColourEncodingRGB, false,
+	  1, {{ { 32, 1, 1 }, { 0, 0, 0 }, { 0, 0, 0 } }} },
+
+	/* YUV packed formats. */
+	{ DRM_FORMAT_YUYV, V4L2_PIX_FMT_YUYV, 0,
+	  PixelFormatInfo::ColourEncodingYUV, false,
+	  1, {{ { 16, 1, 1 }, { 0, 0, 0 }, { 0, 0, 0 } }} },
+	{ DRM_FORMAT_YVYU, V4L2_PIX_FMT_YVYU, 0,
+	  PixelFormatInfo::ColourEncodingYUV, false,
+	  1, {{ { 16, 1, 1 }, { 0, 0, 0 }, { 0, 0, 0 } }} },
+	{ DRM_FORMAT_UYVY, V4L2_PIX_FMT_UYVY, 0,
+	  PixelFormatInfo::ColourEncodingYUV, false,
+	  1, {{ { 16, 1, 1 }, { 0, 0, 0 }, { 0, 0, 0 } }} },
+	{ DRM_FORMAT_VYUY, V4L2_PIX_FMT_VYUY, 0,
+	  PixelFormatInfo::ColourEncodingYUV, false,
+	  1, {{ { 16, 1, 1 }, { 0, 0, 0 }, { 0, 0, 0 } }} },
+
+	/* YUV planar formats. */
+	{ DRM_FORMAT_NV12, V4L2_PIX_FMT_NV12, V4L2_PIX_FMT_NV12M,
+	  PixelFormatInfo::ColourEncodingYUV, false,
+	  2, {{ { 8, 1, 1 }, { 16, 2, 2 }, { 0, 0, 0 } }} },
+	{ DRM_FORMAT_NV21, V4L2_PIX_FMT_NV21, V4L2_PIX_FMT_NV21M,
+	  PixelFormatInfo::ColourEncodingYUV, false,
+	  2, {{ { 8, 1, 1 }, { 16, 2, 2 }, { 0, 0, 0 } }} },
+	{ DRM_FORMAT_NV16, V4L2_PIX_FMT_NV16, V4L2_PIX_FMT_NV16M,
+	  PixelFormatInfo::ColourEncodingYUV, false,
+	  2, {{ { 8, 1, 1 }, { 16, 2, 1 }, { 0, 0, 0 } }} },
+	{ DRM_FORMAT_NV61, V4L2_PIX_FMT_NV61, V4L2_PIX_FMT_NV61M,
+	  PixelFormatInfo::ColourEncodingYUV, false,
+	  2, {{ { 8, 1, 1 }, { 16, 2, 1 }, { 0, 0, 0 } }} },
+	{ DRM_FORMAT_NV24, V4L2_PIX_FMT_NV24, 0,
+	  PixelFormatInfo::ColourEncodingYUV, false,
+	  2, {{ { 8, 1, 1 }, { 16, 1, 1 }, { 0, 0, 0 } }} },
+	{ DRM_FORMAT_NV42, V4L2_PIX_FMT_NV42, 0,
+	  PixelFormatInfo::ColourEncodingYUV, false,
+	  2, {{ { 8, 1, 1 }, { 16, 1, 1 }, { 0, 0, 0 } }} },
+
+	/* Compressed formats. */
+	{ DRM_FORMAT_MJPEG, V4L2_PIX_FMT_MJPEG, 0,
+	  PixelFormatInfo::ColourEncodingYUV, true,
+	  1, {{ { 0, 1, 1 }, { 0, 0, 0 }, { 0, 0, 0 } }} },
+}};
+
+} /* namespace */
+
+/**
+ * \brief Compute the line stride of a plane
+ * \param[in] width The frame width in pixels
+ * \param[in] plane The plane index
+ * \return The number of bytes per line of \a plane, or 0 if the plane doesn't
+ * exist or the format is compressed
+ */
+unsigned int PixelFormatInfo::stride(unsigned int width, unsigned int plane) const
+{
+	if (plane >= numPlanes || !planes[plane].bitsPerPixel)
+		return 0;
+
+	const PixelFormatPlaneInfo &info = planes[plane];
+	unsigned int samples = (width + info.horizontalSubSampling - 1)
+			     / info.horizontalSubSampling;
+
+	return (samples * info.bitsPerPixel + 7) / 8;
+}
+
+/**
+ * \brief Compute the size of a plane
+ * \param[in] size The frame size in pixels
+ * \param[in] plane The plane index
+ * \return The size of \a plane in bytes, or 0 if the plane doesn't exist or the
+ * format is compressed
+ */
+unsigned int PixelFormatInfo::planeSize(const Size &size, unsigned int plane) const
+{
+	unsigned int stride = this->stride(size.width, plane);
+	if (!stride)
+		return 0;
+
+	unsigned int subSampling = planes[plane].verticalSubSampling;
+	return stride * ((size.height + subSampling - 1) / subSampling);
+}
+
+/**
+ * \brief Compute the size of a frame
+ * \param[in] size The frame size in pixels
+ * \return The size of a frame of \a size in bytes, summed over all planes, or 0
+ * if the format is compressed
+ */
+unsigned int PixelFormatInfo::frameSize(const Size &size) const
+{
+	unsigned int sum = 0;
+
+	for (unsigned int i = 0; i < numPlanes; ++i)
+		sum += planeSize(size, i);
+
+	return sum;
+}
+
+/**
+ * \brief Retrieve information about a pixel format
+ * \param[in] format The pixel format
+ * \return The PixelFormatInfo describing \a format, or an invalid
+ * PixelFormatInfo if the format is unknown
+ */
+const PixelFormatInfo &PixelFormatInfo::info(PixelFormat format)
+{
+	for (const PixelFormatInfo &info : pixelFormatInfo) {
+		if (info.format == format)
+			return info;
+	}
+
+	return invalidInfo;
+}
+
+/**
+ * \brief Retrieve information about a pixel format from a V4L2 pixel format
+ * \param[in] v4l2Format The V4L2 pixel format, with contiguous or
+ * non-contiguous planes
+ * \return The PixelFormatInfo corresponding to \a v4l2Format, or an invalid
+ * PixelFormatInfo if the format is unknown
+ */
+const PixelFormatInfo &PixelFormatInfo::fromV4L2(uint32_t v4l2Format)
+{
+	for (const PixelFormatInfo &info : pixelFormatInfo) {
+		if (info.v4l2Format == v4l2Format ||
+		    (info.v4l2FormatMultiPlane &&
+		     info.v4l2FormatMultiPlane == v4l2Format))
+			return info;
+	}
+
+	return invalidInfo;
+}
+
 } /* namespace libcamera */
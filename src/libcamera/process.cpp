@@ -15,6 +15,7 @@
 #include <signal.h>
 #include <string.h>
 #include <sys/socket.h>
+#include <sys/syscall.h>
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <unistd.h>
@@ -288,6 +289,33 @@ void Process::closeAllFdsExcept(const std::vector<int> &fds)
 	std::vector<int> v(fds);
 	sort(v.begin(), v.end());
 
+#ifdef __NR_close_range
+	/*
+	 * Close the ranges between the file descriptors to keep, avoiding a
+	 * walk of /proc/self/fd. Fall back to the walk on kernels older than
+	 * v5.9 that don't implement close_range().
+	 */
+	unsigned int first = 0;
+	int ret = 0;
+
+	for (int fd : v) {
+		if (fd < 0 || static_cast<unsigned int>(fd) < first)
+			continue;
+
+		if (static_cast<unsigned int>(fd) > first)
+			ret = syscall(__NR_close_range, first, fd - 1, 0);
+		if (ret < 0)
+			break;
+
+		first = fd + 1;
+	}
+
+	if (!ret)
+		ret = syscall(__NR_close_range, first, ~0U, 0);
+	if (!ret)
+		return;
+#endif
+
 	DIR *dir = opendir("/proc/self/fd");
 	if (!dir)
 		return;
@@ -373,7 +401,8 @@ void Process::died(int wstatus)
  */
 void Process::kill()
 {
-	::kill(pid_, SIGKILL);
+	if (pid_ > 0)
+		::kill(pid_, SIGKILL);
 }
 
 } /* namespace libcamera */
@@ -5,52 +5,344 @@
  * ipa_proxy_linux.cpp - Default Image Processing Algorithm proxy for Linux
  */
 
+#include <deque>
+#include <map>
+#include <memory>
+#include <unistd.h>
 #include <vector>
 
 #include <ipa/ipa_interface.h>
 #include <ipa/ipa_module_info.h>
 
+#include "byte_stream_buffer.h"
+#include "ipa_data_serializer.h"
 #include "ipa_module.h"
 #include "ipa_proxy.h"
-#include "ipc_unixsocket.h"
+#include "ipc_shared_channel.h"
 #include "log.h"
 #include "process.h"
+#include "thread.h"
+#include "utils.h"
 
 namespace libcamera {
 
 LOG_DECLARE_CATEGORY(IPAProxy)
 
+class IPAProxyLinux;
+
+namespace {
+
+constexpr size_t RingSize = 256 * 1024;
+
+/* A proxy worker process and its IPC channel. */
+struct WorkerProcess {
+	Process process;
+	IPCSharedChannel channel;
+};
+
+/*
+ * A worker process hosting the IPA contexts of several proxies for the same
+ * IPA module. The IPA module is loaded once, and each proxy gets its own IPA
+ * context in the worker, identified by a context id carried in the header of
+ * all messages. Messages received from the worker are dispatched to the proxy
+ * owning the context.
+ *
+ * The worker exits when the last proxy detaches from it, as the IPC channel is
+ * then closed.
+ */
+class SharedWorker : public std::enable_shared_from_this<SharedWorker>
+{
+public:
+	SharedWorker(std::unique_ptr<WorkerProcess> worker,
+		     const std::string &modulePath);
+
+	bool isRunning() const;
+	const std::string &modulePath() const { return modulePath_; }
+	Thread *thread() const { return thread_; }
+	unsigned int contexts() const { return proxies_.size(); }
+
+	uint32_t attach(IPAProxyLinux *proxy);
+	void detach(uint32_t context);
+
+	template<typename Func>
+	int send(uint32_t context, IPAMessageHeader::Command command,
+		 size_t size, Func serialize,
+		 const std::vector<int32_t> &fds = {});
+
+private:
+	void readyRead(IPCSharedChannel *channel);
+
+	std::unique_ptr<WorkerProcess> worker_;
+	std::string modulePath_;
+	Thread *thread_;
+
+	std::map<uint32_t, IPAProxyLinux *> proxies_;
+	uint32_t nextContext_;
+
+	std::vector<uint8_t> message_;
+};
+
+/*
+ * Spawning a proxy worker costs a fork() and exec(), and the worker needs to
+ * initialize before it can load the IPA module. To hide that latency, the pool
+ * keeps pre-spawned idle workers that wait for the path of the IPA module to
+ * load. The pool is refilled every time a worker is handed out, so the first
+ * proxy pays the full spawning cost, and the next ones get a warm worker.
+ *
+ * The number of idle workers defaults to 1, and can be set with the
+ * LIBCAMERA_IPA_WORKER_POOL environment variable (0 disables the pool).
+ *
+ * Proxies for the same IPA module share a worker, up to a maximum number of
+ * IPA contexts per worker. This saves the memory of a process, with its copy
+ * of libcamera and of the IPA module, for every camera. The maximum defaults
+ * to 4, and can be set with the LIBCAMERA_IPA_WORKER_CONTEXTS environment
+ * variable (1 gives each proxy its own worker).
+ */
+class WorkerProcessPool
+{
+public:
+	static WorkerProcessPool *instance();
+
+	std::shared_ptr<SharedWorker> attach(const std::string &path,
+					     const std::string &modulePath);
+
+private:
+	WorkerProcessPool();
+
+	std::unique_ptr<WorkerProcess> get(const std::string &path);
+	std::unique_ptr<WorkerProcess> spawn();
+
+	std::deque<std::unique_ptr<WorkerProcess>> workers_;
+	unsigned int size_;
+
+	std::vector<std::weak_ptr<SharedWorker>> shared_;
+	unsigned int maxContexts_;
+
+	std::string path_;
+	Thread *thread_;
+};
+
+WorkerProcessPool::WorkerProcessPool()
+	: size_(1), maxContexts_(4), thread_(nullptr)
+{
+	const char *size = utils::secure_getenv("LIBCAMERA_IPA_WORKER_POOL");
+	if (size)
+		size_ = std::min(strtoul(size, nullptr, 10), 16UL);
+
+	const char *contexts = utils::secure_getenv("LIBCAMERA_IPA_WORKER_CONTEXTS");
+	if (contexts)
+		maxContexts_ = utils::clamp(strtoul(contexts, nullptr, 10), 1UL, 64UL);
+}
+
+WorkerProcessPool *WorkerProcessPool::instance()
+{
+	static WorkerProcessPool pool;
+	return &pool;
+}
+
+std::shared_ptr<SharedWorker>
+WorkerProcessPool::attach(const std::string &path, const std::string &modulePath)
+{
+	/* Look for a running worker for the module with room for a context. */
+	for (auto it = shared_.begin(); it != shared_.end();) {
+		std::shared_ptr<SharedWorker> shared = it->lock();
+		if (!shared || !shared->isRunning()) {
+			it = shared_.erase(it);
+			continue;
+		}
+
+		/* The channel event notifiers are bound to their thread. */
+		if (shared->modulePath() == modulePath &&
+		    shared->thread() == Thread::current() &&
+		    shared->contexts() < maxContexts_)
+			return shared;
+
+		++it;
+	}
+
+	std::unique_ptr<WorkerProcess> worker = get(path);
+	if (!worker)
+		return nullptr;
+
+	auto shared = std::make_shared<SharedWorker>(std::move(worker),
+						     modulePath);
+	if (!shared->isRunning())
+		return nullptr;
+
+	shared_.push_back(shared);
+
+	return shared;
+}
+
+std::unique_ptr<WorkerProcess> WorkerProcessPool::get(const std::string &path)
+{
+	/*
+	 * The channel event notifiers are bound to the thread that created
+	 * them, drop the idle workers if the caller lives in a different
+	 * thread.
+	 */
+	if (path != path_ || Thread::current() != thread_) {
+		workers_.clear();
+		path_ = path;
+		thread_ = Thread::current();
+	}
+
+	std::unique_ptr<WorkerProcess> worker;
+
+	while (!workers_.empty() && !worker) {
+		worker = std::move(workers_.front());
+		workers_.pop_front();
+
+		/* Skip workers that died while idle. */
+		if (worker->process.exitStatus() != Process::NotExited)
+			worker.reset();
+	}
+
+	if (!worker)
+		worker = spawn();
+
+	while (workers_.size() < size_) {
+		std::unique_ptr<WorkerProcess> idle = spawn();
+		if (!idle)
+			break;
+
+		workers_.push_back(std::move(idle));
+	}
+
+	return worker;
+}
+
+std::unique_ptr<WorkerProcess> WorkerProcessPool::spawn()
+{
+	std::unique_ptr<WorkerProcess> worker = std::make_unique<WorkerProcess>();
+
+	std::vector<int> fds;
+	int ret = worker->channel.create(RingSize, &fds);
+	if (ret < 0) {
+		LOG(IPAProxy, Error)
+			<< "Failed to create IPC channel";
+		return nullptr;
+	}
+
+	std::vector<std::string> args;
+	for (int fd : fds)
+		args.push_back(std::to_string(fd));
+
+	ret = worker->process.start(path_, args, fds);
+
+	/* The remote side of the socket is now owned by the worker. */
+	::close(fds[0]);
+
+	if (ret) {
+		LOG(IPAProxy, Error)
+			<< "Failed to start proxy worker process";
+		return nullptr;
+	}
+
+	return worker;
+}
+
+SharedWorker::SharedWorker(std::unique_ptr<WorkerProcess> worker,
+			   const std::string &modulePath)
+	: worker_(std::move(worker)), modulePath_(modulePath),
+	  thread_(Thread::current()), nextContext_(0)
+{
+	worker_->channel.readyRead.connect(this, &SharedWorker::readyRead);
+
+	/* Hand the IPA module to the worker. */
+	int ret = send(0, IPAMessageHeader::LoadModule, modulePath.size(),
+		       [&](ByteStreamBuffer &buffer) {
+			       return buffer.write(Span<const char>(modulePath.data(),
+								    modulePath.size()));
+		       });
+	if (ret < 0)
+		worker_.reset();
+}
+
+bool SharedWorker::isRunning() const
+{
+	return worker_ && worker_->process.exitStatus() == Process::NotExited;
+}
+
+uint32_t SharedWorker::attach(IPAProxyLinux *proxy)
+{
+	uint32_t context = nextContext_++;
+	proxies_[context] = proxy;
+	return context;
+}
+
+void SharedWorker::detach(uint32_t context)
+{
+	proxies_.erase(context);
+}
+
+/*
+ * Serialize a message in place in the transmission ring, and send it to the
+ * worker.
+ */
+template<typename Func>
+int SharedWorker::send(uint32_t context, IPAMessageHeader::Command command,
+		       size_t size, Func serialize,
+		       const std::vector<int32_t> &fds)
+{
+	if (!worker_)
+		return -ENOTCONN;
+
+	IPCSharedChannel &channel = worker_->channel;
+	Span<uint8_t> data = channel.reserve(sizeof(IPAMessageHeader) + size);
+	if (data.empty()) {
+		LOG(IPAProxy, Error) << "Failed to send command " << command;
+		return -ENOSPC;
+	}
+
+	ByteStreamBuffer buffer(data.data(), data.size());
+	IPAMessageHeader header = { command, 0, context, 0 };
+	buffer.write(&header);
+
+	int ret = serialize(buffer);
+	if (ret < 0) {
+		LOG(IPAProxy, Error)
+			<< "Failed to serialize command " << command;
+		return ret;
+	}
+
+	return channel.commit(fds);
+}
+
+} /* namespace */
+
 class IPAProxyLinux : public IPAProxy
 {
 public:
 	IPAProxyLinux(IPAModule *ipam);
 	~IPAProxyLinux();
 
-	int init() override { return 0; }
+	int init() override;
 	void configure(const std::map<unsigned int, IPAStream> &streamConfig,
-		       const std::map<unsigned int, const ControlInfoMap &> &entityControls) override {}
-	void mapBuffers(const std::vector<IPABuffer> &buffers) override {}
-	void unmapBuffers(const std::vector<unsigned int> &ids) override {}
-	void processEvent(const IPAOperationData &event) override {}
+		       const std::map<unsigned int, const ControlInfoMap &> &entityControls) override;
+	void mapBuffers(const std::vector<IPABuffer> &buffers) override;
+	void unmapBuffers(const std::vector<unsigned int> &ids) override;
+	void processEvent(const IPAOperationData &event) override;
+
+	void receive(const IPAMessageHeader &header, ByteStreamBuffer &buffer);
 
 private:
-	void readyRead(IPCUnixSocket *ipc);
+	template<typename Func>
+	int send(IPAMessageHeader::Command command, size_t size, Func serialize,
+		 const std::vector<int32_t> &fds = {});
 
-	Process *proc_;
+	std::shared_ptr<SharedWorker> worker_;
+	uint32_t context_;
 
-	IPCUnixSocket *socket_;
+	IPADataSerializer serializer_;
 };
 
 IPAProxyLinux::IPAProxyLinux(IPAModule *ipam)
-	: proc_(nullptr), socket_(nullptr)
+	: context_(0)
 {
 	LOG(IPAProxy, Debug)
-		<< "initializing dummy proxy: loading IPA from "
-		<< ipam->path();
+		<< "initializing proxy: loading IPA from " << ipam->path();
 
-	std::vector<int> fds;
-	std::vector<std::string> args;
-	args.push_back(ipam->path());
 	const std::string path = resolvePath("ipa_proxy_linux");
 	if (path.empty()) {
 		LOG(IPAProxy, Error)
@@ -58,38 +350,157 @@ IPAProxyLinux::IPAProxyLinux(IPAModule *ipam)
 		return;
 	}
 
-	socket_ = new IPCUnixSocket();
-	int fd = socket_->create();
-	if (fd < 0) {
-		LOG(IPAProxy, Error)
-			<< "Failed to create socket";
-		return;
-	}
-	socket_->readyRead.connect(this, &IPAProxyLinux::readyRead);
-	args.push_back(std::to_string(fd));
-	fds.push_back(fd);
-
-	proc_ = new Process();
-	int ret = proc_->start(path, args, fds);
-	if (ret) {
-		LOG(IPAProxy, Error)
-			<< "Failed to start proxy worker process";
+	worker_ = WorkerProcessPool::instance()->attach(path, ipam->path());
+	if (!worker_)
 		return;
-	}
 
+	context_ = worker_->attach(this);
 	valid_ = true;
+
+	int ret = send(IPAMessageHeader::CreateContext, 0,
+		       [](ByteStreamBuffer &buffer) { return 0; });
+	if (ret < 0)
+		valid_ = false;
 }
 
 IPAProxyLinux::~IPAProxyLinux()
 {
-	delete proc_;
-	delete socket_;
+	if (!worker_)
+		return;
+
+	send(IPAMessageHeader::DestroyContext, 0,
+	     [](ByteStreamBuffer &buffer) { return 0; });
+	worker_->detach(context_);
+}
+
+int IPAProxyLinux::init()
+{
+	return send(IPAMessageHeader::Init, 0,
+		    [](ByteStreamBuffer &buffer) { return 0; });
 }
 
-void IPAProxyLinux::readyRead(IPCUnixSocket *ipc)
+void IPAProxyLinux::configure(const std::map<unsigned int, IPAStream> &streamConfig,
+			      const std::map<unsigned int, const ControlInfoMap &> &entityControls)
 {
+	/* The worker resets its serializer when receiving the message. */
+	serializer_.reset();
+
+	size_t size = IPADataSerializer::binarySize(streamConfig)
+		    + IPADataSerializer::binarySize(entityControls);
+
+	/*
+	 * The control info maps are passed as sealed memfds, owned by the
+	 * maps themselves.
+	 */
+	std::vector<int32_t> fds;
+
+	send(IPAMessageHeader::Configure, size,
+	     [&](ByteStreamBuffer &buffer) {
+		     int ret = serializer_.serialize(streamConfig, buffer);
+		     if (ret < 0)
+			     return ret;
+
+		     return serializer_.serialize(entityControls, buffer, &fds);
+	     }, fds);
 }
 
+void IPAProxyLinux::mapBuffers(const std::vector<IPABuffer> &buffers)
+{
+	/* The file descriptors are collected during serialization. */
+	std::vector<int32_t> fds;
+
+	send(IPAMessageHeader::MapBuffers, IPADataSerializer::binarySize(buffers),
+	     [&](ByteStreamBuffer &buffer) {
+		     return serializer_.serialize(buffers, buffer, &fds);
+	     }, fds);
+}
+
+void IPAProxyLinux::unmapBuffers(const std::vector<unsigned int> &ids)
+{
+	send(IPAMessageHeader::UnmapBuffers, IPADataSerializer::binarySize(ids),
+	     [&](ByteStreamBuffer &buffer) {
+		     return serializer_.serialize(ids, buffer);
+	     });
+}
+
+void IPAProxyLinux::processEvent(const IPAOperationData &event)
+{
+	send(IPAMessageHeader::ProcessEvent, IPADataSerializer::binarySize(event),
+	     [&](ByteStreamBuffer &buffer) {
+		     return serializer_.serialize(event, buffer);
+	     });
+}
+
+template<typename Func>
+int IPAProxyLinux::send(IPAMessageHeader::Command command, size_t size,
+			Func serialize, const std::vector<int32_t> &fds)
+{
+	if (!valid_)
+		return -ENOTCONN;
+
+	return worker_->send(context_, command, size, serialize, fds);
+}
+
+void IPAProxyLinux::receive(const IPAMessageHeader &header,
+			    ByteStreamBuffer &buffer)
+{
+	if (header.command != IPAMessageHeader::QueueFrameAction) {
+		LOG(IPAProxy, Error) << "Invalid message from worker";
+		return;
+	}
+
+	IPAOperationData action;
+	if (serializer_.deserialize(buffer, &action) < 0) {
+		LOG(IPAProxy, Error) << "Invalid frame action from worker";
+		return;
+	}
+
+	queueFrameAction.emit(header.frame, action);
+}
+
+namespace {
+
+void SharedWorker::readyRead(IPCSharedChannel *channel)
+{
+	/* Proxies may be destroyed by the frame action handlers. */
+	std::shared_ptr<SharedWorker> self = shared_from_this();
+
+	Span<const uint8_t> data;
+	std::vector<int32_t> fds;
+
+	while (!channel->receive(&data, &fds)) {
+		/*
+		 * Copy the message out of the shared memory before parsing it,
+		 * as the worker could modify it concurrently.
+		 */
+		message_.assign(data.begin(), data.end());
+		channel->release();
+
+		for (int32_t fd : fds)
+			::close(fd);
+
+		ByteStreamBuffer buffer(static_cast<const uint8_t *>(message_.data()),
+					message_.size());
+		IPAMessageHeader header;
+		if (buffer.read(&header) < 0) {
+			LOG(IPAProxy, Error) << "Invalid message from worker";
+			continue;
+		}
+
+		auto it = proxies_.find(header.context);
+		if (it == proxies_.end()) {
+			/* The proxy may have been destroyed in the meantime. */
+			LOG(IPAProxy, Debug)
+				<< "Message for unknown context " << header.context;
+			continue;
+		}
+
+		it->second->receive(header, buffer);
+	}
+}
+
+} /* namespace */
+
 REGISTER_IPA_PROXY(IPAProxyLinux)
 
 } /* namespace libcamera */
@@ -0,0 +1,230 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * ipa_proxy_thread.cpp - Proxy running an Image Processing Algorithm in a thread
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <memory>
+
+#include <ipa/ipa_interface.h>
+#include <ipa/ipa_module_info.h>
+#include <libcamera/object.h>
+
+#include "cpu_accounting.h"
+#include "ipa_context_wrapper.h"
+#include "ipa_module.h"
+#include "ipa_proxy.h"
+#include "log.h"
+#include "thread.h"
+#include "utils.h"
+
+namespace libcamera {
+
+LOG_DECLARE_CATEGORY(IPAProxy)
+
+/*
+ * The IPAProxyThread hosts an IPA module loaded in the libcamera process on a
+ * dedicated thread. Events are queued to the IPA thread without waiting for
+ * them to be processed, so that the IPA processing time overlaps with the
+ * pipeline handler work instead of adding to it. Frame actions emitted by the
+ * IPA are marshalled back to the thread of the proxy.
+ *
+ * All other operations are invoked synchronously, to guarantee that the
+ * configuration and buffers are visible to the IPA when the next event is
+ * processed.
+ *
+ * To bound the memory and latency, at most MaxPendingEvents events can be
+ * queued to the IPA thread. When the limit is reached, processEvent() blocks
+ * until the event has been processed.
+ */
+class IPAProxyThread : public IPAProxy, public Object
+{
+public:
+	IPAProxyThread(IPAModule *ipam);
+	~IPAProxyThread();
+
+	int init() override;
+	void configure(const std::map<unsigned int, IPAStream> &streamConfig,
+		       const std::map<unsigned int, const ControlInfoMap &> &entityControls) override;
+	void mapBuffers(const std::vector<IPABuffer> &buffers) override;
+	void unmapBuffers(const std::vector<unsigned int> &ids) override;
+	void processEvent(const IPAOperationData &event) override;
+
+private:
+	static constexpr unsigned int MaxPendingEvents = 8;
+
+	/* Helper class to invoke the IPA methods in the IPA thread. */
+	class Worker : public Object
+	{
+	public:
+		Worker(IPAInterface *ipa, std::atomic<unsigned int> *pending)
+			: events_(0), totalLatency_(0), maxLatency_(0),
+			  ipa_(ipa), pending_(pending)
+		{
+		}
+
+		int init() { return ipa_->init(); }
+		void configure(const std::map<unsigned int, IPAStream> &streamConfig,
+			       const std::map<unsigned int, const ControlInfoMap &> &entityControls)
+		{
+			ipa_->configure(streamConfig, entityControls);
+		}
+		void mapBuffers(const std::vector<IPABuffer> &buffers)
+		{
+			ipa_->mapBuffers(buffers);
+		}
+		void unmapBuffers(const std::vector<unsigned int> &ids)
+		{
+			ipa_->unmapBuffers(ids);
+		}
+		void processEvent(const IPAOperationData &event,
+				  utils::time_point queued, Camera *camera);
+
+		uint64_t events_;
+		utils::duration totalLatency_;
+		utils::duration maxLatency_;
+
+	private:
+		IPAInterface *ipa_;
+		std::atomic<unsigned int> *pending_;
+	};
+
+	void queueFrameAction(unsigned int frame, const IPAOperationData &data);
+
+	std::unique_ptr<IPAInterface> ipa_;
+	std::unique_ptr<Worker> worker_;
+	Thread thread_;
+
+	std::atomic<unsigned int> pending_;
+	unsigned int maxPending_;
+	uint64_t blocked_;
+};
+
+IPAProxyThread::IPAProxyThread(IPAModule *ipam)
+	: pending_(0), maxPending_(0), blocked_(0)
+{
+	LOG(IPAProxy, Debug)
+		<< "initializing thread proxy for IPA " << ipam->path();
+
+	if (!ipam->load())
+		return;
+
+	struct ipa_context *ctx = ipam->createContext();
+	if (!ctx) {
+		LOG(IPAProxy, Error)
+			<< "Failed to create IPA context for " << ipam->path();
+		return;
+	}
+
+	ipa_ = std::make_unique<IPAContextWrapper>(ctx);
+	ipa_->queueFrameAction.connect(this, &IPAProxyThread::queueFrameAction);
+
+	worker_ = std::make_unique<Worker>(ipa_.get(), &pending_);
+	worker_->moveToThread(&thread_);
+
+	thread_.setName(std::string("ipa:") + ipam->info().name);
+	thread_.start();
+
+	valid_ = true;
+}
+
+IPAProxyThread::~IPAProxyThread()
+{
+	if (!valid_)
+		return;
+
+	thread_.exit();
+	thread_.wait();
+
+	/*
+	 * Destroy the worker while the thread still exists, to discard the
+	 * messages that may still be queued for it.
+	 */
+	std::unique_ptr<Worker> worker = std::move(worker_);
+
+	/* The statistics are safe to access once the thread has stopped. */
+	utils::duration mean(0);
+	if (worker->events_)
+		mean = worker->totalLatency_ / worker->events_;
+
+	LOG(IPAProxy, Debug)
+		<< "IPA thread processed " << worker->events_ << " events, "
+		<< "latency mean "
+		<< std::chrono::duration_cast<std::chrono::microseconds>(mean).count()
+		<< "us max "
+		<< std::chrono::duration_cast<std::chrono::microseconds>(worker->maxLatency_).count()
+		<< "us, max queue depth " << maxPending_
+		<< ", " << blocked_ << " blocked";
+}
+
+int IPAProxyThread::init()
+{
+	return worker_->invokeMethod(&Worker::init, ConnectionTypeBlocking);
+}
+
+void IPAProxyThread::configure(const std::map<unsigned int, IPAStream> &streamConfig,
+			       const std::map<unsigned int, const ControlInfoMap &> &entityControls)
+{
+	worker_->invokeMethod(&Worker::configure, ConnectionTypeBlocking,
+			      streamConfig, entityControls);
+}
+
+void IPAProxyThread::mapBuffers(const std::vector<IPABuffer> &buffers)
+{
+	worker_->invokeMethod(&Worker::mapBuffers, ConnectionTypeBlocking,
+			      buffers);
+}
+
+void IPAProxyThread::unmapBuffers(const std::vector<unsigned int> &ids)
+{
+	worker_->invokeMethod(&Worker::unmapBuffers, ConnectionTypeBlocking,
+			      ids);
+}
+
+void IPAProxyThread::processEvent(const IPAOperationData &event)
+{
+	unsigned int pending = pending_.fetch_add(1, std::memory_order_relaxed) + 1;
+	maxPending_ = std::max(maxPending_, pending);
+
+	/* Apply back-pressure when the IPA can't keep up. */
+	ConnectionType type = ConnectionTypeQueued;
+	if (pending > MaxPendingEvents) {
+		type = ConnectionTypeBlocking;
+		blocked_++;
+	}
+
+	worker_->invokeMethod(&Worker::processEvent, type, event,
+			      utils::clock::now(), CpuScope::camera());
+}
+
+void IPAProxyThread::queueFrameAction(unsigned int frame,
+				      const IPAOperationData &data)
+{
+	IPAInterface::queueFrameAction.emit(frame, data);
+}
+
+void IPAProxyThread::Worker::processEvent(const IPAOperationData &event,
+					  utils::time_point queued,
+					  Camera *camera)
+{
+	/* Account the IPA processing time to the camera that queued the event. */
+	{
+		CpuScope scope(CameraStatistics::CpuIPA, camera);
+		ipa_->processEvent(event);
+	}
+
+	pending_->fetch_sub(1, std::memory_order_relaxed);
+
+	utils::duration latency = utils::clock::now() - queued;
+	totalLatency_ += latency;
+	maxLatency_ = std::max(maxLatency_, latency);
+	events_++;
+}
+
+REGISTER_IPA_PROXY(IPAProxyThread)
+
+} /* namespace libcamera */
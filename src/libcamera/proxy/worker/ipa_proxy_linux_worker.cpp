@@ -6,6 +6,8 @@
  */
 
 #include <iostream>
+#include <map>
+#include <memory>
 #include <sys/types.h>
 #include <unistd.h>
 
@@ -13,8 +15,11 @@
 #include <libcamera/event_dispatcher.h>
 #include <libcamera/logging.h>
 
+#include "byte_stream_buffer.h"
+#include "ipa_context_wrapper.h"
+#include "ipa_data_serializer.h"
 #include "ipa_module.h"
-#include "ipc_unixsocket.h"
+#include "ipc_shared_channel.h"
 #include "log.h"
 #include "thread.h"
 
@@ -22,19 +27,269 @@ using namespace libcamera;
 
 LOG_DEFINE_CATEGORY(IPAProxyLinuxWorker)
 
-void readyRead(IPCUnixSocket *ipc)
+class IPAProxyLinuxWorker;
+
+/*
+ * An IPA context hosted by the worker on behalf of one proxy. Each context has
+ * its own serializer, as the ControlInfoMap instances and their IDs are
+ * specific to the camera the proxy serves.
+ */
+class WorkerContext
+{
+public:
+	WorkerContext(IPAProxyLinuxWorker *worker, uint32_t id,
+		      struct ipa_context *ipac);
+
+	IPAContextWrapper ipa;
+	IPADataSerializer serializer;
+	std::map<unsigned int, ControlInfoMap> infoMaps;
+
+private:
+	void queueFrameAction(unsigned int frame, const IPAOperationData &data);
+
+	IPAProxyLinuxWorker *worker_;
+	uint32_t id_;
+};
+
+class IPAProxyLinuxWorker
 {
-	IPCUnixSocket::Payload message;
-	int ret;
+public:
+	IPAProxyLinuxWorker()
+	{
+		channel_.readyRead.connect(this, &IPAProxyLinuxWorker::readyRead);
+		channel_.disconnected.connect(this, &IPAProxyLinuxWorker::disconnected);
+	}
+
+	int bind(const std::vector<int> &fds)
+	{
+		return channel_.bind(fds);
+	}
+
+	void queueFrameAction(uint32_t context, IPADataSerializer &serializer,
+			      unsigned int frame, const IPAOperationData &data);
+
+private:
+	void readyRead(IPCSharedChannel *channel);
+	void disconnected(IPCSharedChannel *channel);
+	int dispatch(ByteStreamBuffer &buffer, const std::vector<int32_t> &fds);
+	int dispatch(WorkerContext *context, const IPAMessageHeader &header,
+		     ByteStreamBuffer &buffer, const std::vector<int32_t> &fds);
+	int loadModule(const std::string &path);
+	int createContext(uint32_t id);
+
+	std::unique_ptr<IPAModule> module_;
+	IPCSharedChannel channel_;
+
+	std::map<uint32_t, std::unique_ptr<WorkerContext>> contexts_;
+};
+
+WorkerContext::WorkerContext(IPAProxyLinuxWorker *worker, uint32_t id,
+			     struct ipa_context *ipac)
+	: ipa(ipac), worker_(worker), id_(id)
+{
+	ipa.queueFrameAction.connect(this, &WorkerContext::queueFrameAction);
+}
+
+void WorkerContext::queueFrameAction(unsigned int frame,
+				     const IPAOperationData &data)
+{
+	worker_->queueFrameAction(id_, serializer, frame, data);
+}
+
+void IPAProxyLinuxWorker::readyRead(IPCSharedChannel *channel)
+{
+	Span<const uint8_t> data;
+	std::vector<int32_t> fds;
+
+	/* Drain all the pending messages. */
+	while (!channel->receive(&data, &fds)) {
+		ByteStreamBuffer buffer(data.data(), data.size());
+
+		int ret = dispatch(buffer, fds);
+		if (ret < 0)
+			LOG(IPAProxyLinuxWorker, Error)
+				<< "Failed to process message: " << ret;
+
+		channel->release();
+
+		for (int32_t fd : fds)
+			::close(fd);
+	}
+}
+
+void IPAProxyLinuxWorker::disconnected(IPCSharedChannel *channel)
+{
+	/* The proxy is gone, there's nothing left to do. */
+	LOG(IPAProxyLinuxWorker, Debug) << "IPC channel closed, exiting";
+	exit(EXIT_SUCCESS);
+}
+
+int IPAProxyLinuxWorker::dispatch(ByteStreamBuffer &buffer,
+				  const std::vector<int32_t> &fds)
+{
+	IPAMessageHeader header;
+	if (buffer.read(&header) < 0)
+		return -EINVAL;
+
+	if (header.command == IPAMessageHeader::LoadModule) {
+		size_t size = buffer.size() - buffer.offset();
+		const char *path = buffer.read<char>(size);
+		if (!path)
+			return -EINVAL;
+
+		return loadModule(std::string(path, size));
+	}
+
+	if (!module_)
+		return -ENODEV;
+
+	if (header.command == IPAMessageHeader::CreateContext)
+		return createContext(header.context);
+
+	auto it = contexts_.find(header.context);
+	if (it == contexts_.end())
+		return -ENOENT;
+
+	if (header.command == IPAMessageHeader::DestroyContext) {
+		LOG(IPAProxyLinuxWorker, Debug)
+			<< "Destroying IPA context " << header.context;
+		contexts_.erase(it);
+		return 0;
+	}
+
+	return dispatch(it->second.get(), header, buffer, fds);
+}
+
+int IPAProxyLinuxWorker::dispatch(WorkerContext *context,
+				  const IPAMessageHeader &header,
+				  ByteStreamBuffer &buffer,
+				  const std::vector<int32_t> &fds)
+{
+	IPADataSerializer &serializer = context->serializer;
+
+	switch (header.command) {
+	case IPAMessageHeader::Init:
+		context->ipa.init();
+		return 0;
+
+	case IPAMessageHeader::Configure: {
+		std::map<unsigned int, IPAStream> streams;
+		std::map<unsigned int, const ControlInfoMap &> entityControls;
+
+		serializer.reset();
+		context->infoMaps.clear();
+
+		int ret = serializer.deserialize(buffer, &streams);
+		if (ret < 0)
+			return ret;
+
+		ret = serializer.deserialize(buffer, fds, &context->infoMaps);
+		if (ret < 0)
+			return ret;
+
+		for (const auto &map : context->infoMaps)
+			entityControls.emplace(map.first, map.second);
 
-	ret = ipc->receive(&message);
-	if (ret) {
+		context->ipa.configure(streams, entityControls);
+		return 0;
+	}
+
+	case IPAMessageHeader::MapBuffers: {
+		std::vector<IPABuffer> buffers;
+
+		int ret = serializer.deserialize(buffer, fds, &buffers);
+		if (ret < 0)
+			return ret;
+
+		context->ipa.mapBuffers(buffers);
+		return 0;
+	}
+
+	case IPAMessageHeader::UnmapBuffers: {
+		std::vector<unsigned int> ids;
+
+		int ret = serializer.deserialize(buffer, &ids);
+		if (ret < 0)
+			return ret;
+
+		context->ipa.unmapBuffers(ids);
+		return 0;
+	}
+
+	case IPAMessageHeader::ProcessEvent: {
+		IPAOperationData event;
+
+		int ret = serializer.deserialize(buffer, &event);
+		if (ret < 0)
+			return ret;
+
+		context->ipa.processEvent(event);
+		return 0;
+	}
+
+	default:
+		return -EINVAL;
+	}
+}
+
+int IPAProxyLinuxWorker::loadModule(const std::string &path)
+{
+	if (module_)
+		return -EBUSY;
+
+	LOG(IPAProxyLinuxWorker, Debug) << "Loading IPA module " << path;
+
+	module_ = std::make_unique<IPAModule>(path);
+	if (!module_->isValid() || !module_->load()) {
+		LOG(IPAProxyLinuxWorker, Error)
+			<< "IPAModule " << path << " should be valid but isn't";
+		exit(EXIT_FAILURE);
+	}
+
+	return 0;
+}
+
+int IPAProxyLinuxWorker::createContext(uint32_t id)
+{
+	if (contexts_.count(id))
+		return -EBUSY;
+
+	struct ipa_context *ipac = module_->createContext();
+	if (!ipac) {
+		LOG(IPAProxyLinuxWorker, Error) << "Failed to create IPA context";
+		return -ENOMEM;
+	}
+
+	LOG(IPAProxyLinuxWorker, Debug) << "Created IPA context " << id;
+
+	contexts_[id] = std::make_unique<WorkerContext>(this, id, ipac);
+
+	return 0;
+}
+
+void IPAProxyLinuxWorker::queueFrameAction(uint32_t context,
+					   IPADataSerializer &serializer,
+					   unsigned int frame,
+					   const IPAOperationData &data)
+{
+	size_t size = sizeof(IPAMessageHeader) + IPADataSerializer::binarySize(data);
+	Span<uint8_t> message = channel_.reserve(size);
+	if (message.empty())
+		return;
+
+	ByteStreamBuffer buffer(message.data(), message.size());
+	IPAMessageHeader header = { IPAMessageHeader::QueueFrameAction, frame,
+				    context, 0 };
+	buffer.write(&header);
+
+	int ret = serializer.serialize(data, buffer);
+	if (ret < 0) {
 		LOG(IPAProxyLinuxWorker, Error)
-			<< "Receive message failed: " << ret;
+			<< "Failed to serialize frame action: " << ret;
 		return;
 	}
 
-	LOG(IPAProxyLinuxWorker, Debug) << "Received a message!";
+	channel_.commit();
 }
 
 int main(int argc, char **argv)
@@ -46,34 +301,23 @@ int main(int argc, char **argv)
 	logSetFile(logPath.c_str());
 #endif
 
-	if (argc < 3) {
+	if (argc < 4) {
 		LOG(IPAProxyLinuxWorker, Debug)
 			<< "Tried to start worker with no args";
 		return EXIT_FAILURE;
 	}
 
-	int fd = std::stoi(argv[2]);
-	LOG(IPAProxyLinuxWorker, Debug)
-		<< "Starting worker for IPA module " << argv[1]
-		<< " with IPC fd = " << fd;
-
-	std::unique_ptr<IPAModule> ipam = std::make_unique<IPAModule>(argv[1]);
-	if (!ipam->isValid() || !ipam->load()) {
-		LOG(IPAProxyLinuxWorker, Error)
-			<< "IPAModule " << argv[1] << " should be valid but isn't";
-		return EXIT_FAILURE;
-	}
+	std::vector<int> fds;
+	for (int i = 1; i < 4; ++i)
+		fds.push_back(std::stoi(argv[i]));
 
-	IPCUnixSocket socket;
-	if (socket.bind(fd) < 0) {
-		LOG(IPAProxyLinuxWorker, Error) << "IPC socket binding failed";
-		return EXIT_FAILURE;
-	}
-	socket.readyRead.connect(&readyRead);
+	LOG(IPAProxyLinuxWorker, Debug)
+		<< "Starting worker with IPC fd = " << fds[0];
 
-	struct ipa_context *ipac = ipam->createContext();
-	if (!ipac) {
-		LOG(IPAProxyLinuxWorker, Error) << "Failed to create IPA context";
+	/* The IPA module to load and its contexts are received from the proxy. */
+	IPAProxyLinuxWorker worker;
+	if (worker.bind(fds) < 0) {
+		LOG(IPAProxyLinuxWorker, Error) << "IPC channel binding failed";
 		return EXIT_FAILURE;
 	}
 
@@ -84,7 +328,5 @@ int main(int argc, char **argv)
 	while (1)
 		dispatcher->processEvents();
 
-	ipac->ops->destroy(ipac);
-
 	return 0;
 }
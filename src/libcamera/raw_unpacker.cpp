@@ -0,0 +1,506 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * raw_unpacker.cpp - Unpacking of packed raw Bayer formats
+ */
+
+#include <libcamera/raw_unpacker.h>
+
+#include <algorithm>
+#include <errno.h>
+
+#include <linux/videodev2.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define RAW_UNPACKER_AVX2 1
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#define RAW_UNPACKER_NEON 1
+#endif
+
+/**
+ * \file raw_unpacker.h
+ * \brief Unpacking of packed raw Bayer formats
+ */
+
+namespace libcamera {
+
+namespace {
+
+/*
+ * CSI-2 packed formats store groups of pixels as the 8 most significant bits
+ * of each pixel, followed by the remaining least significant bits of all the
+ * pixels of the group packed in little-endian order. A group holds 4 pixels
+ * in 5 bytes for 10-bit formats, 2 pixels in 3 bytes for 12-bit formats and
+ * 4 pixels in 7 bytes for 14-bit formats.
+ */
+template<unsigned int Bits>
+struct Csi2Packing {
+	static constexpr unsigned int LsbBits = Bits - 8;
+	static constexpr unsigned int Pixels = Bits == 12 ? 2 : 4;
+	static constexpr unsigned int GroupBytes = Pixels * Bits / 8;
+};
+
+template<unsigned int Bits>
+void unpackCsi2Line(const uint8_t *src, uint16_t *dst, unsigned int width)
+{
+	using Packing = Csi2Packing<Bits>;
+	constexpr uint32_t mask = (1U << Packing::LsbBits) - 1;
+
+	for (unsigned int x = 0; x < width;
+	     x += Packing::Pixels, src += Packing::GroupBytes) {
+		uint32_t lsbs = 0;
+
+		for (unsigned int i = Packing::Pixels; i < Packing::GroupBytes; ++i)
+			lsbs |= src[i] << ((i - Packing::Pixels) * 8);
+
+		unsigned int count = std::min(Packing::Pixels, width - x);
+		for (unsigned int i = 0; i < count; ++i)
+			dst[x + i] = src[i] << Packing::LsbBits
+				   | ((lsbs >> (i * Packing::LsbBits)) & mask);
+	}
+}
+
+/*
+ * The IPU3 packed format stores 25 10-bit pixels as a little-endian bit
+ * stream in blocks of 32 bytes, the last 6 bits of each block are unused.
+ */
+constexpr unsigned int Ipu3BlockPixels = 25;
+constexpr unsigned int Ipu3BlockBytes = 32;
+
+inline uint16_t ipu3Pixel(const uint8_t *block, unsigned int index)
+{
+	unsigned int bit = index * 10;
+	const uint8_t *data = block + bit / 8;
+
+	return ((data[0] | data[1] << 8) >> (bit % 8)) & 0x3ff;
+}
+
+void unpackIpu3Line(const uint8_t *src, uint16_t *dst, unsigned int width)
+{
+	for (unsigned int x = 0; x < width;
+	     x += Ipu3BlockPixels, src += Ipu3BlockBytes) {
+		unsigned int count = std::min(Ipu3BlockPixels, width - x);
+
+		for (unsigned int i = 0; i < count; ++i)
+			dst[x + i] = ipu3Pixel(src, i);
+	}
+}
+
+#if defined(RAW_UNPACKER_AVX2) || defined(RAW_UNPACKER_NEON)
+
+/*
+ * The vector kernels unpack 8 pixels per 128-bit lane. A byte shuffle gathers,
+ * in each 16-bit lane, the bytes storing the bits of one pixel. The bits are
+ * then aligned to the top of the 16-bit lane by a multiplication by a power of
+ * two, and shifted down to their final position. This handles the variable
+ * bit offsets of the pixels without per-lane shifts.
+ *
+ * For CSI-2 formats, the most significant bits are shuffled to the top byte
+ * of a separate vector and shifted down by the number of least significant
+ * bits.
+ */
+struct ShuffleTables {
+	alignas(16) uint8_t msb[16];
+	alignas(16) uint8_t lsb[16];
+	alignas(16) uint16_t mul[8];
+};
+
+constexpr uint8_t ShuffleZero = 0x80;
+
+template<unsigned int Bits>
+const ShuffleTables &csi2Tables()
+{
+	using Packing = Csi2Packing<Bits>;
+
+	static const ShuffleTables tables = []() {
+		ShuffleTables t;
+
+		for (unsigned int k = 0; k < 8; ++k) {
+			unsigned int base = k / Packing::Pixels * Packing::GroupBytes;
+			unsigned int index = k % Packing::Pixels;
+			unsigned int bit = index * Packing::LsbBits;
+			unsigned int lsb = base + Packing::Pixels + bit / 8;
+			unsigned int shift = bit % 8;
+
+			t.msb[k * 2] = ShuffleZero;
+			t.msb[k * 2 + 1] = base + index;
+			t.lsb[k * 2] = lsb;
+			t.lsb[k * 2 + 1] = shift + Packing::LsbBits > 8 ? lsb + 1
+									: ShuffleZero;
+			t.mul[k] = 1 << (16 - Packing::LsbBits - shift);
+		}
+
+		return t;
+	}();
+
+	return tables;
+}
+
+/*
+ * The 8 pixels of a lane span 10 bytes in an IPU3 block. The first three
+ * lanes start at pixels 0, 8 and 16, at byte offsets 0, 10 and 20. The third
+ * lane is loaded from offset 16 to avoid reading past the end of the block,
+ * its shuffle indices are thus offset by 4.
+ */
+template<unsigned int Offset>
+const ShuffleTables &ipu3Tables()
+{
+	static const ShuffleTables tables = []() {
+		ShuffleTables t = {};
+
+		for (unsigned int k = 0; k < 8; ++k) {
+			unsigned int bit = k * 10;
+
+			t.lsb[k * 2] = bit / 8 + Offset;
+			t.lsb[k * 2 + 1] = bit / 8 + 1 + Offset;
+			t.mul[k] = 1 << (6 - bit % 8);
+		}
+
+		return t;
+	}();
+
+	return tables;
+}
+
+#endif /* RAW_UNPACKER_AVX2 || RAW_UNPACKER_NEON */
+
+#if defined(RAW_UNPACKER_AVX2)
+
+/*
+ * AVX2 isn't part of the x86-64 baseline, the kernels are compiled for AVX2
+ * explicitly and selected at runtime when the CPU supports it.
+ */
+#define AVX2_FUNCTION __attribute__((target("avx2")))
+
+bool cpuHasAvx2()
+{
+	static const bool avx2 = []() {
+		__builtin_cpu_init();
+		return __builtin_cpu_supports("avx2") != 0;
+	}();
+
+	return avx2;
+}
+
+AVX2_FUNCTION inline __m256i loadTables(const void *table)
+{
+	return _mm256_broadcastsi128_si256(_mm_load_si128(static_cast<const __m128i *>(table)));
+}
+
+AVX2_FUNCTION inline __m256i loadLanes(const uint8_t *lane0, const uint8_t *lane1)
+{
+	__m128i lo = _mm_loadu_si128(reinterpret_cast<const __m128i *>(lane0));
+	__m128i hi = _mm_loadu_si128(reinterpret_cast<const __m128i *>(lane1));
+
+	return _mm256_inserti128_si256(_mm256_castsi128_si256(lo), hi, 1);
+}
+
+template<unsigned int Bits>
+AVX2_FUNCTION void unpackCsi2LineAvx2(const uint8_t *src, uint16_t *dst,
+				      unsigned int width)
+{
+	using Packing = Csi2Packing<Bits>;
+	const ShuffleTables &tables = csi2Tables<Bits>();
+	const __m256i msbShuffle = loadTables(tables.msb);
+	const __m256i lsbShuffle = loadTables(tables.lsb);
+	const __m256i mul = loadTables(tables.mul);
+
+	/* Each lane covers 8 pixels, stored in Bits bytes. */
+	const unsigned int groups = (width + Packing::Pixels - 1) / Packing::Pixels;
+	const unsigned int lineBytes = groups * Packing::GroupBytes;
+	unsigned int x = 0;
+
+	for (; x + 16 <= width && x * Bits / 8 + Bits + 16 <= lineBytes; x += 16) {
+		const uint8_t *in = src + x * Bits / 8;
+		__m256i data = loadLanes(in, in + Bits);
+
+		__m256i msb = _mm256_shuffle_epi8(data, msbShuffle);
+		__m256i lsb = _mm256_shuffle_epi8(data, lsbShuffle);
+
+		msb = _mm256_srli_epi16(msb, 8 - Packing::LsbBits);
+		lsb = _mm256_srli_epi16(_mm256_mullo_epi16(lsb, mul),
+					16 - Packing::LsbBits);
+
+		_mm256_storeu_si256(reinterpret_cast<__m256i *>(dst + x),
+				    _mm256_or_si256(msb, lsb));
+	}
+
+	unpackCsi2Line<Bits>(src + x * Bits / 8, dst + x, width - x);
+}
+
+AVX2_FUNCTION void unpackIpu3LineAvx2(const uint8_t *src, uint16_t *dst,
+				      unsigned int width)
+{
+	const __m256i shuffle = loadTables(ipu3Tables<0>().lsb);
+	const __m256i mul = loadTables(ipu3Tables<0>().mul);
+	const __m128i shuffle16 = _mm_load_si128(reinterpret_cast<const __m128i *>(ipu3Tables<4>().lsb));
+	const __m128i mul16 = _mm256_castsi256_si128(mul);
+	unsigned int x = 0;
+
+	for (; x + Ipu3BlockPixels <= width;
+	     x += Ipu3BlockPixels, src += Ipu3BlockBytes) {
+		/* Pixels 0 to 15. */
+		__m256i data = loadLanes(src, src + 10);
+		data = _mm256_mullo_epi16(_mm256_shuffle_epi8(data, shuffle), mul);
+		_mm256_storeu_si256(reinterpret_cast<__m256i *>(dst + x),
+				    _mm256_srli_epi16(data, 6));
+
+		/* Pixels 16 to 23. */
+		__m128i data16 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + 16));
+		data16 = _mm_mullo_epi16(_mm_shuffle_epi8(data16, shuffle16), mul16);
+		_mm_storeu_si128(reinterpret_cast<__m128i *>(dst + x + 16),
+				 _mm_srli_epi16(data16, 6));
+
+		dst[x + 24] = ipu3Pixel(src, 24);
+	}
+
+	unpackIpu3Line(src, dst + x, width - x);
+}
+
+#endif /* RAW_UNPACKER_AVX2 */
+
+#if defined(RAW_UNPACKER_NEON)
+
+inline uint8x16_t loadTable(const uint8_t *table)
+{
+	return vld1q_u8(table);
+}
+
+template<unsigned int Bits>
+void unpackCsi2LineNeon(const uint8_t *src, uint16_t *dst, unsigned int width)
+{
+	using Packing = Csi2Packing<Bits>;
+	const ShuffleTables &tables = csi2Tables<Bits>();
+	const uint8x16_t msbShuffle = loadTable(tables.msb);
+	const uint8x16_t lsbShuffle = loadTable(tables.lsb);
+	const uint16x8_t mul = vld1q_u16(tables.mul);
+
+	const unsigned int groups = (width + Packing::Pixels - 1) / Packing::Pixels;
+	const unsigned int lineBytes = groups * Packing::GroupBytes;
+	unsigned int x = 0;
+
+	for (; x + 8 <= width && x * Bits / 8 + 16 <= lineBytes; x += 8) {
+		uint8x16_t data = vld1q_u8(src + x * Bits / 8);
+
+		uint16x8_t msb = vreinterpretq_u16_u8(vqtbl1q_u8(data, msbShuffle));
+		uint16x8_t lsb = vreinterpretq_u16_u8(vqtbl1q_u8(data, lsbShuffle));
+
+		msb = vshrq_n_u16(msb, 8 - Packing::LsbBits);
+		lsb = vshrq_n_u16(vmulq_u16(lsb, mul), 16 - Packing::LsbBits);
+
+		vst1q_u16(dst + x, vorrq_u16(msb, lsb));
+	}
+
+	unpackCsi2Line<Bits>(src + x * Bits / 8, dst + x, width - x);
+}
+
+void unpackIpu3LineNeon(const uint8_t *src, uint16_t *dst, unsigned int width)
+{
+	const uint8x16_t shuffle = loadTable(ipu3Tables<0>().lsb);
+	const uint8x16_t shuffle16 = loadTable(ipu3Tables<4>().lsb);
+	const uint16x8_t mul = vld1q_u16(ipu3Tables<0>().mul);
+	unsigned int x = 0;
+
+	for (; x + Ipu3BlockPixels <= width;
+	     x += Ipu3BlockPixels, src += Ipu3BlockBytes) {
+		static const unsigned int offsets[] = { 0, 10, 16 };
+
+		for (unsigned int i = 0; i < 3; ++i) {
+			uint8x16_t data = vld1q_u8(src + offsets[i]);
+			uint8x16_t bytes = vqtbl1q_u8(data, i == 2 ? shuffle16 : shuffle);
+			uint16x8_t pixels = vmulq_u16(vreinterpretq_u16_u8(bytes), mul);
+
+			vst1q_u16(dst + x + i * 8, vshrq_n_u16(pixels, 6));
+		}
+
+		dst[x + 24] = ipu3Pixel(src, 24);
+	}
+
+	unpackIpu3Line(src, dst + x, width - x);
+}
+
+#endif /* RAW_UNPACKER_NEON */
+
+} /* namespace */
+
+/**
+ * \class RawUnpacker
+ * \brief Unpack packed raw Bayer frames to 16-bit pixels
+ *
+ * The RawUnpacker class converts frames stored in the packed raw Bayer
+ * formats produced by CSI-2 receivers to one 16-bit value per pixel,
+ * holding the pixel value in its least significant bits. It supports the
+ * IPU3 10-bit packed format (V4L2_PIX_FMT_IPU3_S*10) and the MIPI CSI-2
+ * 10-bit, 12-bit and 14-bit packed formats (V4L2_PIX_FMT_S*1[024]P). The
+ * Bayer pattern is not modified.
+ *
+ * The unpacker is configured for a format and frame width with configure().
+ * Frames are then unpacked with unpack(), which converts a range of lines.
+ * Disjoint line ranges of the same frame can be unpacked concurrently from
+ * multiple threads, to split the work in stripes.
+ *
+ * Lines are unpacked with AVX2 on x86 CPUs that support it, with NEON on
+ * 64-bit ARM, and with scalar code otherwise. All implementations produce the
+ * same results.
+ */
+
+RawUnpacker::RawUnpacker()
+	: width_(0), bitDepth_(0), minStride_(0), unpackLine_(nullptr)
+{
+}
+
+/**
+ * \brief Configure the unpacker for a format and frame width
+ * \param[in] format The packed raw pixel format
+ * \param[in] width The frame width in pixels
+ *
+ * \return 0 on success or a negative error code otherwise
+ * \retval -EINVAL The format isn't a supported packed raw format, or the width
+ * is 0
+ */
+int RawUnpacker::configure(PixelFormat format, unsigned int width)
+{
+	unsigned int bitDepth;
+	unsigned int groupPixels;
+	unsigned int groupBytes;
+	LineUnpacker unpackLine;
+
+	width_ = 0;
+	bitDepth_ = 0;
+	minStride_ = 0;
+	unpackLine_ = nullptr;
+
+	if (!width)
+		return -EINVAL;
+
+	switch (format) {
+	case V4L2_PIX_FMT_IPU3_SBGGR10:
+	case V4L2_PIX_FMT_IPU3_SGBRG10:
+	case V4L2_PIX_FMT_IPU3_SGRBG10:
+	case V4L2_PIX_FMT_IPU3_SRGGB10:
+		bitDepth = 10;
+		groupPixels = Ipu3BlockPixels;
+		groupBytes = Ipu3BlockBytes;
+		unpackLine = unpackIpu3Line;
+#if defined(RAW_UNPACKER_AVX2)
+		if (cpuHasAvx2())
+			unpackLine = unpackIpu3LineAvx2;
+#elif defined(RAW_UNPACKER_NEON)
+		unpackLine = unpackIpu3LineNeon;
+#endif
+		break;
+
+	case V4L2_PIX_FMT_SBGGR10P:
+	case V4L2_PIX_FMT_SGBRG10P:
+	case V4L2_PIX_FMT_SGRBG10P:
+	case V4L2_PIX_FMT_SRGGB10P:
+		bitDepth = 10;
+		groupPixels = Csi2Packing<10>::Pixels;
+		groupBytes = Csi2Packing<10>::GroupBytes;
+		unpackLine = unpackCsi2Line<10>;
+#if defined(RAW_UNPACKER_AVX2)
+		if (cpuHasAvx2())
+			unpackLine = unpackCsi2LineAvx2<10>;
+#elif defined(RAW_UNPACKER_NEON)
+		unpackLine = unpackCsi2LineNeon<10>;
+#endif
+		break;
+
+	case V4L2_PIX_FMT_SBGGR12P:
+	case V4L2_PIX_FMT_SGBRG12P:
+	case V4L2_PIX_FMT_SGRBG12P:
+	case V4L2_PIX_FMT_SRGGB12P:
+		bitDepth = 12;
+		groupPixels = Csi2Packing<12>::Pixels;
+		groupBytes = Csi2Packing<12>::GroupBytes;
+		unpackLine = unpackCsi2Line<12>;
+#if defined(RAW_UNPACKER_AVX2)
+		if (cpuHasAvx2())
+			unpackLine = unpackCsi2LineAvx2<12>;
+#elif defined(RAW_UNPACKER_NEON)
+		unpackLine = unpackCsi2LineNeon<12>;
+#endif
+		break;
+
+	case V4L2_PIX_FMT_SBGGR14P:
+	case V4L2_PIX_FMT_SGBRG14P:
+	case V4L2_PIX_FMT_SGRBG14P:
+	case V4L2_PIX_FMT_SRGGB14P:
+		bitDepth = 14;
+		groupPixels = Csi2Packing<14>::Pixels;
+		groupBytes = Csi2Packing<14>::GroupBytes;
+		unpackLine = unpackCsi2Line<14>;
+#if defined(RAW_UNPACKER_AVX2)
+		if (cpuHasAvx2())
+			unpackLine = unpackCsi2LineAvx2<14>;
+#elif defined(RAW_UNPACKER_NEON)
+		unpackLine = unpackCsi2LineNeon<14>;
+#endif
+		break;
+
+	default:
+		return -EINVAL;
+	}
+
+	width_ = width;
+	bitDepth_ = bitDepth;
+	minStride_ = (width + groupPixels - 1) / groupPixels * groupBytes;
+	unpackLine_ = unpackLine;
+
+	return 0;
+}
+
+/**
+ * \fn RawUnpacker::width()
+ * \brief Retrieve the configured frame width
+ * \return The frame width in pixels, or 0 if the unpacker isn't configured
+ */
+
+/**
+ * \fn RawUnpacker::bitDepth()
+ * \brief Retrieve the number of bits per pixel of the configured format
+ * \return The number of bits per pixel, or 0 if the unpacker isn't configured
+ */
+
+/**
+ * \fn RawUnpacker::minStride()
+ * \brief Retrieve the minimum stride of the packed lines
+ *
+ * Packed lines store full pixel groups (or 32-byte blocks for the IPU3
+ * format), the last group of a line being padded if the width isn't a
+ * multiple of the group size. The source stride passed to unpack() shall be
+ * at least equal to the minimum stride.
+ *
+ * \return The minimum number of bytes per packed line
+ */
+
+/**
+ * \brief Unpack a range of lines
+ * \param[in] src The packed frame
+ * \param[in] srcStride The number of bytes per line of the packed frame
+ * \param[out] dst The unpacked frame
+ * \param[in] dstStride The number of bytes per line of the unpacked frame
+ * \param[in] start The index of the first line to unpack
+ * \param[in] end The index of the line following the last line to unpack
+ *
+ * Unpack lines \a start to \a end - 1 of the frame \a src to \a dst. The \a
+ * dstStride shall be a multiple of 2, and at least twice the frame width.
+ * This method doesn't modify the unpacker, and may be called concurrently for
+ * disjoint line ranges.
+ */
+void RawUnpacker::unpack(const uint8_t *src, unsigned int srcStride,
+			 uint16_t *dst, unsigned int dstStride,
+			 unsigned int start, unsigned int end) const
+{
+	if (!unpackLine_)
+		return;
+
+	for (unsigned int y = start; y < end; ++y)
+		unpackLine_(src + y * srcStride, dst + y * (dstStride / 2),
+			    width_);
+}
+
+} /* namespace libcamera */
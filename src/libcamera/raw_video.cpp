@@ -0,0 +1,733 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * raw_video.cpp - Indexed raw video container
+ */
+
+#include <libcamera/raw_video.h>
+
+#include <algorithm>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "buffer_metadata.h"
+#include "byte_stream_buffer.h"
+#include "control_serializer.h"
+#include "log.h"
+
+/**
+ * \file raw_video.h
+ * \brief Indexed raw video container
+ */
+
+namespace libcamera {
+
+LOG_DEFINE_CATEGORY(RawVideo)
+
+namespace {
+
+constexpr uint32_t FileMagic = 0x5643434c; /* "LCCV" */
+constexpr uint32_t RecordMagic = 0x4652434c; /* "LCRF" */
+constexpr uint32_t IndexMagic = 0x5849434c; /* "LCIX" */
+constexpr uint32_t FileVersion = 1;
+
+constexpr size_t BlockSize = 4096;
+constexpr size_t ScratchSize = 1 << 20;
+constexpr unsigned int MaxStreams = 16;
+
+struct FileHeader {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t streams;
+	uint32_t reserved;
+};
+
+struct StreamHeader {
+	uint32_t pixelFormat;
+	uint32_t width;
+	uint32_t height;
+	char name[36];
+};
+
+struct PlaneHeader {
+	uint64_t offset;
+	uint32_t bytesused;
+	uint32_t reserved;
+};
+
+struct RecordHeader {
+	uint32_t magic;
+	uint32_t stream;
+	uint32_t status;
+	uint32_t sequence;
+	uint64_t timestamp;
+	uint64_t size;
+	uint32_t numPlanes;
+	uint32_t controlsSize;
+	PlaneHeader planes[FrameMaxPlanes];
+};
+
+struct IndexEntry {
+	uint64_t offset;
+	uint32_t stream;
+	uint32_t sequence;
+	uint64_t timestamp;
+};
+
+struct Trailer {
+	uint64_t indexOffset;
+	uint32_t frames;
+	uint32_t magic;
+};
+
+static_assert(sizeof(FileHeader) + MaxStreams * sizeof(StreamHeader) <= BlockSize,
+	      "Container header doesn't fit in a block");
+
+size_t alignBlock(size_t size)
+{
+	return (size + BlockSize - 1) & ~(BlockSize - 1);
+}
+
+} /* namespace */
+
+/**
+ * \struct RawVideoStream
+ * \brief The description of a stream stored in a raw video container
+ *
+ * \var RawVideoStream::name
+ * \brief The stream name, truncated to 35 characters when stored
+ *
+ * \var RawVideoStream::pixelFormat
+ * \brief The pixel format of the frames
+ *
+ * \var RawVideoStream::size
+ * \brief The size of the frames
+ */
+
+/**
+ * \struct RawVideoFrame
+ * \brief A frame stored in a raw video container
+ *
+ * \var RawVideoFrame::stream
+ * \brief The index of the frame's stream in RawVideoReader::streams()
+ *
+ * \var RawVideoFrame::metadata
+ * \brief The metadata of the captured buffer
+ *
+ * \var RawVideoFrame::planes
+ * \brief The frame payload, one span per plane
+ *
+ * The spans reference the memory-mapped container, and stay valid until the
+ * reader is closed.
+ */
+
+class RawVideoWriter::Private
+{
+public:
+	Private();
+	~Private();
+
+	int writeData(const uint8_t *data, size_t size);
+	int writeScratch(size_t size);
+	int writePlane(Span<const uint8_t> data);
+
+	ControlSerializer serializer_;
+
+	int fd_;
+	off_t offset_;
+	uint8_t *scratch_;
+	unsigned int streams_;
+	std::vector<IndexEntry> index_;
+};
+
+RawVideoWriter::Private::Private()
+	: fd_(-1), offset_(0), scratch_(nullptr), streams_(0)
+{
+}
+
+RawVideoWriter::Private::~Private()
+{
+	free(scratch_);
+}
+
+/* Write \a size bytes at the end of the file, advancing the write offset. */
+int RawVideoWriter::Private::writeData(const uint8_t *data, size_t size)
+{
+	while (size) {
+		ssize_t ret = pwrite(fd_, data, size, offset_);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			return -errno;
+		}
+
+		data += ret;
+		size -= ret;
+		offset_ += ret;
+	}
+
+	return 0;
+}
+
+/* Write the first \a size bytes of the scratch buffer, padded to a block. */
+int RawVideoWriter::Private::writeScratch(size_t size)
+{
+	size_t padded = alignBlock(size);
+	memset(scratch_ + size, 0, padded - size);
+
+	return writeData(scratch_, padded);
+}
+
+/*
+ * Write the payload of a plane. The block-aligned part of the plane memory is
+ * written directly, direct I/O then transfers it to the storage without going
+ * through the page cache. The unaligned tail is copied to the scratch buffer
+ * and padded, as is the whole plane if its memory can't be used for direct
+ * I/O, which is the case of some dmabuf mappings.
+ */
+int RawVideoWriter::Private::writePlane(Span<const uint8_t> data)
+{
+	off_t start = offset_;
+	size_t direct = 0;
+
+	if (!(reinterpret_cast<uintptr_t>(data.data()) & (BlockSize - 1)))
+		direct = data.size() & ~(BlockSize - 1);
+
+	if (direct) {
+		int ret = writeData(data.data(), direct);
+		if (ret < 0 && ret != -EFAULT && ret != -EINVAL)
+			return ret;
+	}
+
+	for (size_t pos = offset_ - start; pos < data.size();) {
+		size_t size = std::min(data.size() - pos, ScratchSize);
+		memcpy(scratch_, data.data() + pos, size);
+
+		int ret = writeScratch(size);
+		if (ret < 0)
+			return ret;
+
+		pos += size;
+	}
+
+	return 0;
+}
+
+/**
+ * \class RawVideoWriter
+ * \brief Write captured frames to a raw video container
+ *
+ * The RawVideoWriter class stores frames of one or more streams, along with
+ * their FrameMetadata and a ControlList, typically the request metadata, in a
+ * single file that can be read back with the RawVideoReader.
+ *
+ * The container starts with a header block that describes the streams,
+ * followed by one record per frame, and ends with an index of the records
+ * written by close(). Each record starts with a header block that stores the
+ * frame metadata and the serialized controls, followed by the frame planes.
+ * All headers and planes are aligned to 4kB, which lets readers memory-map the
+ * file and access any frame without parsing or copying, and lets the writer
+ * append frames with direct I/O when the file system supports it.
+ *
+ * A container whose writer hasn't been closed, for instance when the capture
+ * is interrupted, has no index. Readers then rebuild the index by walking the
+ * records, up to the last complete frame.
+ */
+
+RawVideoWriter::RawVideoWriter()
+	: p_(new Private())
+{
+}
+
+RawVideoWriter::~RawVideoWriter()
+{
+	close();
+}
+
+/**
+ * \brief Create a raw video container
+ * \param[in] path The path of the container file
+ * \param[in] streams The streams stored in the container
+ *
+ * The file at \a path is created, or truncated if it exists. Any container
+ * previously open is closed first. Up to 16 streams can be stored.
+ *
+ * \return 0 on success or a negative error code otherwise
+ */
+int RawVideoWriter::open(const std::string &path,
+			 const std::vector<RawVideoStream> &streams)
+{
+	close();
+
+	if (streams.empty() || streams.size() > MaxStreams)
+		return -EINVAL;
+
+	if (!p_->scratch_) {
+		void *scratch;
+		if (posix_memalign(&scratch, BlockSize, ScratchSize))
+			return -ENOMEM;
+		p_->scratch_ = static_cast<uint8_t *>(scratch);
+	}
+
+	/* Fall back to buffered I/O if the file system lacks direct I/O. */
+	int flags = O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC;
+	p_->fd_ = ::open(path.c_str(), flags | O_DIRECT, 0644);
+	if (p_->fd_ == -1 && errno == EINVAL)
+		p_->fd_ = ::open(path.c_str(), flags, 0644);
+	if (p_->fd_ == -1) {
+		int ret = -errno;
+		LOG(RawVideo, Error)
+			<< "Failed to create " << path << ": " << strerror(-ret);
+		return ret;
+	}
+
+	p_->offset_ = 0;
+	p_->streams_ = streams.size();
+
+	memset(p_->scratch_, 0, BlockSize);
+
+	FileHeader *header = reinterpret_cast<FileHeader *>(p_->scratch_);
+	header->magic = FileMagic;
+	header->version = FileVersion;
+	header->streams = streams.size();
+
+	StreamHeader *streamHeaders = reinterpret_cast<StreamHeader *>(header + 1);
+	for (unsigned int i = 0; i < streams.size(); ++i) {
+		const RawVideoStream &stream = streams[i];
+		StreamHeader &streamHeader = streamHeaders[i];
+
+		streamHeader.pixelFormat = stream.pixelFormat;
+		streamHeader.width = stream.size.width;
+		streamHeader.height = stream.size.height;
+		strncpy(streamHeader.name, stream.name.c_str(),
+			sizeof(streamHeader.name) - 1);
+	}
+
+	int ret = p_->writeScratch(BlockSize);
+	if (ret < 0) {
+		LOG(RawVideo, Error)
+			<< "Failed to write " << path << ": " << strerror(-ret);
+		::close(p_->fd_);
+		p_->fd_ = -1;
+		return ret;
+	}
+
+	return 0;
+}
+
+/**
+ * \brief Close the container
+ *
+ * Write the index of the frames at the end of the container and close the
+ * file.
+ *
+ * \return 0 on success or a negative error code otherwise
+ */
+int RawVideoWriter::close()
+{
+	if (!isOpen())
+		return 0;
+
+	/* The trailer is stored at the very end of the file. */
+	size_t indexSize = p_->index_.size() * sizeof(IndexEntry);
+	size_t size = alignBlock(indexSize + sizeof(Trailer));
+	int ret;
+
+	void *mem;
+	if (!posix_memalign(&mem, BlockSize, size)) {
+		uint8_t *data = static_cast<uint8_t *>(mem);
+		memset(data, 0, size);
+		memcpy(data, p_->index_.data(), indexSize);
+
+		Trailer *trailer = reinterpret_cast<Trailer *>(data + size - sizeof(Trailer));
+		trailer->indexOffset = p_->offset_;
+		trailer->frames = p_->index_.size();
+		trailer->magic = IndexMagic;
+
+		ret = p_->writeData(data, size);
+		free(mem);
+	} else {
+		ret = -ENOMEM;
+	}
+
+	if (ret < 0)
+		LOG(RawVideo, Error)
+			<< "Failed to write index: " << strerror(-ret);
+
+	::close(p_->fd_);
+	p_->fd_ = -1;
+	p_->index_.clear();
+
+	return ret;
+}
+
+/**
+ * \brief Check if a container is open
+ * \return True if a container is open, false otherwise
+ */
+bool RawVideoWriter::isOpen() const
+{
+	return p_->fd_ != -1;
+}
+
+/**
+ * \brief Write a frame
+ * \param[in] stream The index of the frame's stream in the streams passed to
+ * open()
+ * \param[in] metadata The metadata of the captured buffer
+ * \param[in] planes The frame payload, one span per plane
+ * \param[in] controls The controls to store with the frame
+ *
+ * The \a controls are typically the metadata of the request the frame has been
+ * captured for. Only lists that aren't bound to a ControlInfoMap are stored,
+ * other lists are ignored.
+ *
+ * A frame that fails to be written is dropped, and overwritten by the next
+ * frame.
+ *
+ * \return 0 on success or a negative error code otherwise
+ */
+int RawVideoWriter::write(unsigned int stream, const FrameMetadata &metadata,
+			  const std::vector<Span<const uint8_t>> &planes,
+			  const ControlList &controls)
+{
+	if (!isOpen())
+		return -EBADF;
+
+	if (stream >= p_->streams_ || planes.size() > FrameMaxPlanes)
+		return -EINVAL;
+
+	size_t controlsSize = controls.infoMap()
+			    ? 0 : ControlSerializer::binarySize(controls);
+	size_t headerSize = alignBlock(sizeof(RecordHeader) + controlsSize);
+	if (headerSize > ScratchSize)
+		return -E2BIG;
+
+	RecordHeader *header = reinterpret_cast<RecordHeader *>(p_->scratch_);
+	memset(header, 0, sizeof(*header));
+	header->magic = RecordMagic;
+	header->stream = stream;
+	header->status = metadata.status;
+	header->sequence = metadata.sequence;
+	header->timestamp = metadata.timestamp;
+	header->numPlanes = planes.size();
+	header->controlsSize = controlsSize;
+
+	uint64_t size = headerSize;
+	for (unsigned int i = 0; i < planes.size(); ++i) {
+		header->planes[i].offset = size;
+		header->planes[i].bytesused = planes[i].size();
+		size += alignBlock(planes[i].size());
+	}
+	header->size = size;
+
+	if (controlsSize) {
+		ByteStreamBuffer buffer(p_->scratch_ + sizeof(RecordHeader),
+					controlsSize);
+		int ret = p_->serializer_.serialize(controls, buffer);
+		if (ret < 0)
+			return ret;
+	}
+
+	off_t offset = p_->offset_;
+
+	int ret = p_->writeScratch(sizeof(RecordHeader) + controlsSize);
+	for (unsigned int i = 0; i < planes.size() && !ret; ++i)
+		ret = p_->writePlane(planes[i]);
+
+	if (ret < 0) {
+		p_->offset_ = offset;
+		return ret;
+	}
+
+	p_->index_.push_back({ static_cast<uint64_t>(offset), stream,
+			       metadata.sequence, metadata.timestamp });
+
+	return 0;
+}
+
+/**
+ * \brief Retrieve the number of frames written
+ * \return The number of frames written since the container has been opened
+ */
+unsigned int RawVideoWriter::frames() const
+{
+	return p_->index_.size();
+}
+
+class RawVideoReader::Private
+{
+public:
+	Private();
+
+	const RecordHeader *record(unsigned int index) const;
+
+	ControlSerializer serializer_;
+
+	const uint8_t *mem_;
+	size_t size_;
+
+	std::vector<RawVideoStream> streams_;
+	const IndexEntry *index_;
+	unsigned int frames_;
+	std::vector<IndexEntry> scannedIndex_;
+};
+
+RawVideoReader::Private::Private()
+	: mem_(nullptr), size_(0), index_(nullptr), frames_(0)
+{
+}
+
+/* Locate and validate the header of the record of frame \a index. */
+const RecordHeader *RawVideoReader::Private::record(unsigned int index) const
+{
+	if (index >= frames_)
+		return nullptr;
+
+	uint64_t offset = index_[index].offset;
+	if (offset % BlockSize || offset + sizeof(RecordHeader) > size_)
+		return nullptr;
+
+	const RecordHeader *header =
+		reinterpret_cast<const RecordHeader *>(mem_ + offset);
+	if (header->magic != RecordMagic || header->size > size_ - offset ||
+	    header->numPlanes > FrameMaxPlanes ||
+	    sizeof(RecordHeader) + header->controlsSize > header->size)
+		return nullptr;
+
+	return header;
+}
+
+/**
+ * \class RawVideoReader
+ * \brief Read the frames of a raw video container
+ *
+ * The RawVideoReader class reads a file produced by RawVideoWriter. The file
+ * is memory-mapped, and frames are retrieved in any order with frame() in
+ * constant time, without copying their payload. The controls stored with the
+ * frames are only deserialized when requested with controls().
+ */
+
+RawVideoReader::RawVideoReader()
+	: p_(new Private())
+{
+}
+
+RawVideoReader::~RawVideoReader()
+{
+	close();
+}
+
+/**
+ * \brief Open a raw video container
+ * \param[in] path The path of the container file
+ * \return 0 on success or a negative error code otherwise
+ */
+int RawVideoReader::open(const std::string &path)
+{
+	close();
+
+	int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+	if (fd == -1) {
+		int ret = -errno;
+		LOG(RawVideo, Error)
+			<< "Failed to open " << path << ": " << strerror(-ret);
+		return ret;
+	}
+
+	struct stat st;
+	if (fstat(fd, &st) < 0 || static_cast<size_t>(st.st_size) < BlockSize) {
+		LOG(RawVideo, Error) << "Invalid container " << path;
+		::close(fd);
+		return -EINVAL;
+	}
+
+	void *mem = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	::close(fd);
+	if (mem == MAP_FAILED) {
+		int ret = -errno;
+		LOG(RawVideo, Error)
+			<< "Failed to map " << path << ": " << strerror(-ret);
+		return ret;
+	}
+
+	p_->mem_ = static_cast<const uint8_t *>(mem);
+	p_->size_ = st.st_size;
+
+	const FileHeader *header = reinterpret_cast<const FileHeader *>(p_->mem_);
+	if (header->magic != FileMagic || header->version != FileVersion ||
+	    header->streams > MaxStreams) {
+		LOG(RawVideo, Error) << "Invalid container " << path;
+		close();
+		return -EINVAL;
+	}
+
+	const StreamHeader *streamHeaders =
+		reinterpret_cast<const StreamHeader *>(header + 1);
+	for (unsigned int i = 0; i < header->streams; ++i) {
+		const StreamHeader &streamHeader = streamHeaders[i];
+		RawVideoStream stream;
+
+		stream.name = std::string(streamHeader.name,
+					  strnlen(streamHeader.name,
+						  sizeof(streamHeader.name)));
+		stream.pixelFormat = streamHeader.pixelFormat;
+		stream.size = { streamHeader.width, streamHeader.height };
+
+		p_->streams_.push_back(stream);
+	}
+
+	/* Use the index in place when the container has been closed. */
+	const Trailer *trailer =
+		reinterpret_cast<const Trailer *>(p_->mem_ + p_->size_ - sizeof(Trailer));
+	if (p_->size_ >= 2 * BlockSize && trailer->magic == IndexMagic &&
+	    trailer->indexOffset >= BlockSize &&
+	    !(trailer->indexOffset % BlockSize) &&
+	    trailer->indexOffset + uint64_t(trailer->frames) * sizeof(IndexEntry)
+	    <= p_->size_ - sizeof(Trailer)) {
+		p_->index_ = reinterpret_cast<const IndexEntry *>(p_->mem_ + trailer->indexOffset);
+		p_->frames_ = trailer->frames;
+		return 0;
+	}
+
+	LOG(RawVideo, Warning)
+		<< "Container " << path << " has no index, scanning frames";
+
+	size_t offset = BlockSize;
+	while (offset + sizeof(RecordHeader) <= p_->size_) {
+		const RecordHeader *record =
+			reinterpret_cast<const RecordHeader *>(p_->mem_ + offset);
+		if (record->magic != RecordMagic || !record->size ||
+		    record->size % BlockSize || record->size > p_->size_ - offset)
+			break;
+
+		p_->scannedIndex_.push_back({ offset, record->stream,
+					      record->sequence,
+					      record->timestamp });
+		offset += record->size;
+	}
+
+	p_->index_ = p_->scannedIndex_.data();
+	p_->frames_ = p_->scannedIndex_.size();
+
+	return 0;
+}
+
+/**
+ * \brief Close the container
+ *
+ * The spans of the frames retrieved from the container become invalid.
+ */
+void RawVideoReader::close()
+{
+	if (p_->mem_)
+		munmap(const_cast<uint8_t *>(p_->mem_), p_->size_);
+
+	p_->mem_ = nullptr;
+	p_->size_ = 0;
+	p_->streams_.clear();
+	p_->index_ = nullptr;
+	p_->frames_ = 0;
+	p_->scannedIndex_.clear();
+}
+
+/**
+ * \brief Check if a container is open
+ * \return True if a container is open, false otherwise
+ */
+bool RawVideoReader::isOpen() const
+{
+	return p_->mem_ != nullptr;
+}
+
+/**
+ * \brief Retrieve the streams stored in the container
+ * \return The streams stored in the container
+ */
+const std::vector<RawVideoStream> &RawVideoReader::streams() const
+{
+	return p_->streams_;
+}
+
+/**
+ * \brief Retrieve the number of frames stored in the container
+ * \return The number of frames stored in the container, for all streams
+ */
+unsigned int RawVideoReader::frames() const
+{
+	return p_->frames_;
+}
+
+/**
+ * \brief Retrieve a frame
+ * \param[in] index The frame index, in the order the frames have been written
+ * \param[out] frame The frame
+ *
+ * The frame payload isn't copied, the \a frame planes point to the container
+ * memory.
+ *
+ * \return 0 on success or a negative error code otherwise
+ */
+int RawVideoReader::frame(unsigned int index, RawVideoFrame *frame) const
+{
+	const RecordHeader *header = p_->record(index);
+	if (!header)
+		return -EINVAL;
+
+	const uint8_t *data = reinterpret_cast<const uint8_t *>(header);
+
+	frame->stream = header->stream;
+	frame->planes.clear();
+
+	FrameMetadata &metadata = frame->metadata;
+	metadata.status = static_cast<FrameMetadata::Status>(header->status);
+	metadata.sequence = header->sequence;
+	metadata.timestamp = header->timestamp;
+	BufferMetadata::setNumPlanes(&metadata, header->numPlanes);
+
+	for (unsigned int i = 0; i < header->numPlanes; ++i) {
+		const PlaneHeader &plane = header->planes[i];
+		if (plane.offset + plane.bytesused > header->size)
+			return -EINVAL;
+
+		metadata.planes()[i].bytesused = plane.bytesused;
+		frame->planes.emplace_back(data + plane.offset, plane.bytesused);
+	}
+
+	return 0;
+}
+
+/**
+ * \brief Retrieve the controls stored with a frame
+ * \param[in] index The frame index, in the order the frames have been written
+ * \param[out] controls The controls
+ *
+ * The controls are deserialized from the container. \a controls is left empty
+ * if no controls have been stored with the frame.
+ *
+ * \return 0 on success or a negative error code otherwise
+ */
+int RawVideoReader::controls(unsigned int index, ControlList *controls)
+{
+	const RecordHeader *header = p_->record(index);
+	if (!header)
+		return -EINVAL;
+
+	if (!header->controlsSize) {
+		controls->clear();
+		return 0;
+	}
+
+	const uint8_t *data = reinterpret_cast<const uint8_t *>(header + 1);
+	ByteStreamBuffer buffer(data, header->controlsSize);
+
+	return p_->serializer_.deserialize(buffer, controls);
+}
+
+} /* namespace libcamera */
@@ -7,6 +7,7 @@
 
 #include <libcamera/request.h>
 
+#include <algorithm>
 #include <map>
 
 #include <libcamera/buffer.h>
@@ -14,7 +15,6 @@
 #include <libcamera/control_ids.h>
 #include <libcamera/stream.h>
 
-#include "camera_controls.h"
 #include "log.h"
 
 /**
@@ -43,6 +43,21 @@ LOG_DEFINE_CATEGORY(Request)
  *
  * A Request allows an application to associate buffers and controls on a
  * per-frame basis to be queued to the camera device for processing.
+ *
+ * Requests are owned by the application. Once a request has completed, it can
+ * be prepared for a new capture with reuse() and queued again, which avoids
+ * any memory allocation in steady state.
+ *
+ * Requests that capture the same streams with the same controls for every
+ * frame can be marked as repeating with setRepeating(). Once a repeating
+ * request has been queued and has completed, it is returned to the camera
+ * with Camera::releaseRequest(), which re-arms it with its buffers and
+ * controls without going through reuse() and the validation of
+ * Camera::queueRequest().
+ *
+ * Applications that only use part of the metadata reported by the camera can
+ * restrict it with setMetadataFilter(), which saves the pipeline handler and
+ * the IPA the cost of computing and transporting the other metadata.
  */
 
 /**
@@ -57,15 +72,12 @@ LOG_DEFINE_CATEGORY(Request)
  *
  */
 Request::Request(Camera *camera, uint64_t cookie)
-	: camera_(camera), cookie_(cookie), status_(RequestPending),
-	  cancelled_(false)
+	: camera_(camera), numSlots_(0), pending_(0), cookie_(cookie),
+	  status_(RequestPending), cancelled_(false), repeating_(false),
+	  spare_(false), filterMetadata_(false), completion_(nullptr),
+	  submitNext_(nullptr)
 {
-	/**
-	 * \todo Should the Camera expose a validator instance, to avoid
-	 * creating a new instance for each request?
-	 */
-	validator_ = new CameraControlValidator(camera);
-	controls_ = new ControlList(controls::controls, validator_);
+	controls_ = new ControlList(controls::controls, camera->validator());
 
 	/**
 	 * \todo: Add a validator for metadata controls.
@@ -75,9 +87,207 @@ Request::Request(Camera *camera, uint64_t cookie)
 
 Request::~Request()
 {
+	delete completion_;
 	delete metadata_;
 	delete controls_;
-	delete validator_;
+}
+
+/**
+ * \brief Reset the request for reuse
+ *
+ * Reset the status of a completed request, and clear its controls and
+ * metadata, to prepare it for being queued to the camera again. The buffers
+ * associated with the request are kept, and will be captured to again when
+ * the request is queued.
+ *
+ * Resetting a request doesn't release the memory it holds, queuing a reused
+ * request thus doesn't allocate memory. This method shall not be called on a
+ * request that is queued to the camera and hasn't completed yet.
+ */
+void Request::reuse()
+{
+	controls_->clear();
+	metadata_->clear();
+
+	status_ = RequestPending;
+	cancelled_ = false;
+	deviceTime_ = {};
+	bufferTime_ = {};
+	ipaTime_ = {};
+
+	for (unsigned int i = 0; i < numSlots_; ++i)
+		slots_[i].buffer->request_ = this;
+
+	pending_ = (1U << numSlots_) - 1;
+}
+
+/**
+ * \fn Request::setRepeating()
+ * \brief Mark the request as repeating
+ * \param[in] repeating True to make the request repeating
+ *
+ * A repeating request keeps its buffers and controls across captures, and is
+ * queued again with Camera::releaseRequest() once the application is done
+ * with its buffers. The repeating state shall not be changed while the
+ * request is queued to the camera.
+ */
+
+/**
+ * \fn Request::repeating()
+ * \brief Check if the request is repeating
+ * \return True if the request is repeating, false otherwise
+ */
+
+/**
+ * \brief Restrict the metadata reported in the request
+ * \param[in] ids The metadata controls the application is interested in
+ *
+ * Pipeline handlers and IPAs skip computing the metadata controls that are not
+ * listed in \a ids, and don't report them in metadata(). An empty \a ids
+ * disables all metadata controls. The buffers metadata, including the frame
+ * timestamps, is always reported.
+ *
+ * The filter is kept when the request is reused. Requests are created with the
+ * filter set on the camera with Camera::setMetadataFilter().
+ */
+void Request::setMetadataFilter(const std::vector<const ControlId *> &ids)
+{
+	metadataFilter_.clear();
+	for (const ControlId *id : ids)
+		metadataFilter_.push_back(id->id());
+
+	std::sort(metadataFilter_.begin(), metadataFilter_.end());
+	filterMetadata_ = true;
+}
+
+/**
+ * \brief Report all metadata in the request
+ *
+ * Remove the filter set with setMetadataFilter().
+ */
+void Request::clearMetadataFilter()
+{
+	metadataFilter_.clear();
+	filterMetadata_ = false;
+}
+
+/**
+ * \brief Check if a metadata control shall be reported in the request
+ * \param[in] id The metadata control
+ *
+ * Pipeline handlers shall check if metadata controls are enabled before
+ * computing them.
+ *
+ * \return True if the metadata control \a id is enabled, false otherwise
+ */
+bool Request::metadataEnabled(const ControlId &id) const
+{
+	if (!filterMetadata_)
+		return true;
+
+	return std::binary_search(metadataFilter_.begin(), metadataFilter_.end(),
+				  id.id());
+}
+
+/**
+ * \brief Re-arm a completed repeating request
+ *
+ * Reset the status of the request to capture again with the same buffers and
+ * controls. Unlike reuse(), only the metadata is cleared.
+ */
+void Request::rearm()
+{
+	metadata_->clear();
+
+	status_ = RequestPending;
+	cancelled_ = false;
+	deviceTime_ = {};
+	bufferTime_ = {};
+	ipaTime_ = {};
+
+	for (unsigned int i = 0; i < numSlots_; ++i)
+		slots_[i].buffer->request_ = this;
+
+	pending_ = (1U << numSlots_) - 1;
+}
+
+/**
+ * \brief Exchange the buffers of the request with those of a spare request
+ * \param[in] spare The spare request
+ *
+ * Swap the buffers of all streams of the request with the buffers of the same
+ * streams in the completed \a spare request, and copy the metadata of the
+ * \a spare request. The buffers stay pending in the request, and shall be
+ * completed as if they had been captured for it. The \a spare request receives
+ * the buffers of the request, and shall be re-armed before being queued again.
+ *
+ * The \a spare request shall contain a buffer for every stream of the request.
+ */
+void Request::takeBuffers(Request *spare)
+{
+	for (unsigned int i = 0; i < numSlots_; ++i) {
+		BufferSlot &slot = slots_[i];
+		unsigned int j;
+
+		for (j = 0; j < spare->numSlots_; ++j) {
+			if (spare->slots_[j].stream == slot.stream)
+				break;
+		}
+
+		ASSERT(j < spare->numSlots_);
+
+		std::swap(slot.buffer, spare->slots_[j].buffer);
+		bufferMap_[slot.stream] = slot.buffer;
+		spare->bufferMap_[slot.stream] = spare->slots_[j].buffer;
+
+		slot.buffer->request_ = this;
+		spare->slots_[j].buffer->request_ = nullptr;
+	}
+
+	*metadata_ = *spare->metadata_;
+	deviceTime_ = spare->deviceTime_;
+	ipaTime_ = spare->ipaTime_;
+}
+
+/**
+ * \brief Skip the buffers of decimated streams for a frame
+ * \param[in] frame The index of the frame captured by the request
+ *
+ * Complete the buffers of the streams whose decimation factor doesn't select
+ * \a frame with the FrameMetadata::FrameSkipped status, before the request is
+ * processed by the pipeline handler. The buffers are not skipped if none of
+ * the request buffers would be left to capture.
+ *
+ * \sa StreamConfiguration::decimation
+ */
+void Request::decimate(unsigned int frame)
+{
+	uint32_t skipped = 0;
+
+	for (unsigned int i = 0; i < numSlots_; ++i) {
+		unsigned int decimation = slots_[i].stream->configuration().decimation;
+		if (decimation > 1 && frame % decimation)
+			skipped |= 1U << i;
+	}
+
+	if (skipped == pending_)
+		skipped = 0;
+
+	for (unsigned int i = 0; i < numSlots_; ++i) {
+		FrameBuffer *buffer = slots_[i].buffer;
+
+		/* Reset the status left by a previous skip. */
+		if (!(skipped & (1U << i))) {
+			if (buffer->metadata_.status == FrameMetadata::FrameSkipped)
+				buffer->metadata_.status = FrameMetadata::FrameSuccess;
+			continue;
+		}
+
+		buffer->metadata_.status = FrameMetadata::FrameSkipped;
+		buffer->request_ = nullptr;
+	}
+
+	pending_ &= ~skipped;
 }
 
 /**
@@ -117,10 +327,12 @@ Request::~Request()
  *
  * A request can only contain one buffer per stream. If a buffer has already
  * been added to the request for the same stream, this method returns -EEXIST.
+ * A request can contain up to 8 buffers.
  *
  * \return 0 on success or a negative error code otherwise
  * \retval -EEXIST The request already contains a buffer for the stream
  * \retval -EINVAL The buffer does not reference a valid Stream
+ * \retval -ENOSPC The request can't contain more buffers
  */
 int Request::addBuffer(Stream *stream, FrameBuffer *buffer)
 {
@@ -129,14 +341,21 @@ int Request::addBuffer(Stream *stream, FrameBuffer *buffer)
 		return -EINVAL;
 	}
 
-	auto it = bufferMap_.find(stream);
-	if (it != bufferMap_.end()) {
+	if (findBuffer(stream)) {
 		LOG(Request, Error) << "FrameBuffer already set for stream";
 		return -EEXIST;
 	}
 
+	if (numSlots_ == MaxBuffers) {
+		LOG(Request, Error) << "Too many buffers in request";
+		return -ENOSPC;
+	}
+
 	buffer->request_ = this;
-	pending_.insert(buffer);
+	slots_[numSlots_] = { stream, buffer };
+	pending_ |= 1U << numSlots_;
+	numSlots_++;
+
 	bufferMap_[stream] = buffer;
 
 	return 0;
@@ -151,6 +370,16 @@ int Request::addBuffer(Stream *stream, FrameBuffer *buffer)
  * map.
  */
 
+/**
+ * \var Request::slots_
+ * \brief Inline storage of the streams and buffers for this request
+ *
+ * The slots_ store the buffers in the order they have been added to the
+ * request, and back findBuffer() and the completion tracking. Only the first
+ * numSlots_ entries are valid. Bit i of pending_ is set when the buffer in slot
+ * i hasn't completed yet.
+ */
+
 /**
  * \brief Return the buffer associated with a stream
  * \param[in] stream The stream the buffer is associated to
@@ -159,11 +388,12 @@ int Request::addBuffer(Stream *stream, FrameBuffer *buffer)
  */
 FrameBuffer *Request::findBuffer(Stream *stream) const
 {
-	auto it = bufferMap_.find(stream);
-	if (it == bufferMap_.end())
-		return nullptr;
+	for (unsigned int i = 0; i < numSlots_; ++i) {
+		if (slots_[i].stream == stream)
+			return slots_[i].buffer;
+	}
 
-	return it->second;
+	return nullptr;
 }
 
 /**
@@ -212,15 +442,54 @@ void Request::complete()
 {
 	ASSERT(!hasPendingBuffers());
 	status_ = cancelled_ ? RequestCancelled : RequestComplete;
+
+	/*
+	 * Identify the frame the skipped buffers belong to with the sequence
+	 * and timestamp of a captured buffer.
+	 */
+	const FrameBuffer *captured = nullptr;
+	for (unsigned int i = 0; i < numSlots_; ++i) {
+		if (slots_[i].buffer->metadata_.status != FrameMetadata::FrameSkipped) {
+			captured = slots_[i].buffer;
+			break;
+		}
+	}
+
+	if (!captured)
+		return;
+
+	for (unsigned int i = 0; i < numSlots_; ++i) {
+		FrameMetadata &metadata = slots_[i].buffer->metadata_;
+		if (metadata.status != FrameMetadata::FrameSkipped)
+			continue;
+
+		metadata.sequence = captured->metadata_.sequence;
+		metadata.timestamp = captured->metadata_.timestamp;
+	}
+}
+
+/**
+ * \brief Cancel a request that hasn't been processed by the device
+ *
+ * Mark all the pending buffers of the request as cancelled. The buffers shall
+ * then be completed with completeBuffer() and the request with complete(), as
+ * for requests processed by the device.
+ */
+void Request::cancel()
+{
+	for (unsigned int i = 0; i < numSlots_; ++i) {
+		if (pending_ & (1U << i))
+			slots_[i].buffer->metadata_.status = FrameMetadata::FrameCancelled;
+	}
 }
 
 /**
  * \brief Complete a buffer for the request
  * \param[in] buffer The buffer that has completed
  *
- * A request tracks the status of all buffers it contains through a set of
- * pending buffers. This function removes the \a buffer from the set to mark it
- * as complete. All buffers associate with the request shall be marked as
+ * A request tracks the status of all buffers it contains through a bitmask of
+ * pending buffers. This function clears the bit of the \a buffer to mark it as
+ * complete. All buffers associate with the request shall be marked as
  * complete by calling this function once and once only before reporting the
  * request as complete with the complete() method.
  *
@@ -229,8 +498,14 @@ void Request::complete()
  */
 bool Request::completeBuffer(FrameBuffer *buffer)
 {
-	int ret = pending_.erase(buffer);
-	ASSERT(ret == 1);
+	unsigned int i;
+	for (i = 0; i < numSlots_; ++i) {
+		if (slots_[i].buffer == buffer)
+			break;
+	}
+
+	ASSERT(i < numSlots_ && (pending_ & (1U << i)));
+	pending_ &= ~(1U << i);
 
 	buffer->request_ = nullptr;
 
@@ -6,7 +6,11 @@
  */
 
 #include "semaphore.h"
-#include "thread.h"
+
+#include <limits.h>
+#include <unistd.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
 
 /**
  * \file semaphore.h
@@ -25,14 +29,42 @@ namespace libcamera {
  * acquire a number of resources, and blocks if not enough resources are
  * available until they get released. The release() method releases a number of
  * resources, waking up any consumer blocked on an acquire() call.
+ *
+ * The resource count is stored in an atomic variable, and the semaphore uses
+ * a futex to sleep and wake up consumers. Acquiring available resources and
+ * releasing resources without any blocked consumer thus don't involve any
+ * system call.
+ *
+ * The futex word stores the resource count in its upper 31 bits and a waiters
+ * flag in bit 0. Consumers set the flag before sleeping, and release() clears
+ * it in the same atomic operation that publishes the new count. This tells the
+ * releaser whether to wake consumers without accessing the semaphore again
+ * afterwards, as a woken consumer may destroy it right away.
  */
 
+namespace {
+
+void futexWait(std::atomic<uint32_t> *addr, uint32_t value)
+{
+	syscall(SYS_futex, addr, FUTEX_WAIT_PRIVATE, value, nullptr, nullptr, 0);
+}
+
+void futexWakeAll(std::atomic<uint32_t> *addr)
+{
+	syscall(SYS_futex, addr, FUTEX_WAKE_PRIVATE, INT_MAX, nullptr, nullptr, 0);
+}
+
+constexpr uint32_t WaitersFlag = 1;
+constexpr unsigned int CountShift = 1;
+
+} /* namespace */
+
 /**
  * \brief Construct a semaphore with \a n resources
  * \param[in] n The resource count
  */
 Semaphore::Semaphore(unsigned int n)
-	: available_(n)
+	: value_(n << CountShift)
 {
 }
 
@@ -42,8 +74,7 @@ Semaphore::Semaphore(unsigned int n)
  */
 unsigned int Semaphore::available()
 {
-	MutexLocker locker(mutex_);
-	return available_;
+	return value_.load(std::memory_order_relaxed) >> CountShift;
 }
 
 /**
@@ -56,9 +87,18 @@ unsigned int Semaphore::available()
  */
 void Semaphore::acquire(unsigned int n)
 {
-	MutexLocker locker(mutex_);
-	cv_.wait(locker, [&] { return available_ >= n; });
-	available_ -= n;
+	while (!tryAcquire(n)) {
+		/*
+		 * Set the waiters flag and check the count in a single atomic
+		 * operation, to ensure that either the check sees the resources
+		 * released concurrently, or release() sees the flag and wakes
+		 * us up. The futex wait returns immediately if the word has
+		 * changed since the flag was set.
+		 */
+		uint32_t value = value_.fetch_or(WaitersFlag) | WaitersFlag;
+		if ((value >> CountShift) < n)
+			futexWait(&value_, value);
+	}
 }
 
 /**
@@ -74,11 +114,15 @@ void Semaphore::acquire(unsigned int n)
  */
 bool Semaphore::tryAcquire(unsigned int n)
 {
-	MutexLocker locker(mutex_);
-	if (available_ < n)
-		return false;
+	uint32_t value = value_.load(std::memory_order_relaxed);
+
+	do {
+		if ((value >> CountShift) < n)
+			return false;
+	} while (!value_.compare_exchange_weak(value, value - (n << CountShift),
+					       std::memory_order_acquire,
+					       std::memory_order_relaxed));
 
-	available_ -= n;
 	return true;
 }
 
@@ -92,12 +136,24 @@ bool Semaphore::tryAcquire(unsigned int n)
  */
 void Semaphore::release(unsigned int n)
 {
-	{
-		MutexLocker locker(mutex_);
-		available_ += n;
-	}
+	uint32_t value = value_.load(std::memory_order_relaxed);
+	uint32_t next;
+
+	do {
+		next = (value & ~WaitersFlag) + (n << CountShift);
+	} while (!value_.compare_exchange_weak(value, next,
+					       std::memory_order_release,
+					       std::memory_order_relaxed));
 
-	cv_.notify_all();
+	/*
+	 * Consumers may wait for different resource counts, wake them all up
+	 * and let them check the count again. Those that still lack resources
+	 * set the waiters flag again before going back to sleep. The semaphore
+	 * may have been destroyed by a woken consumer at this point, only its
+	 * address is passed to the futex call.
+	 */
+	if (value & WaitersFlag)
+		futexWakeAll(&value_);
 }
 
 } /* namespace libcamera */
@@ -14,40 +14,67 @@
 
 namespace libcamera {
 
+/*
+ * The slots list is immutable once created. Connecting or disconnecting slots
+ * creates a new list and replaces the current one, while emissions in progress
+ * keep a reference to the list they iterate over. This keeps emission free of
+ * memory allocation, and keeps the slots valid until all emissions that may
+ * call them complete. Disconnected slots are marked as such, for emissions in
+ * progress to skip them, as the receiver may have been destroyed.
+ */
+
 void SignalBase::connect(BoundMethodBase *slot)
 {
 	Object *object = slot->object();
 	if (object)
 		object->connect(this);
-	slots_.push_back(slot);
+
+	std::shared_ptr<SlotList> slots = std::make_shared<SlotList>();
+	if (slots_) {
+		slots->reserve(slots_->size() + 1);
+		*slots = *slots_;
+	}
+
+	slots->emplace_back(slot);
+	slots_ = std::move(slots);
 }
 
 void SignalBase::disconnect(Object *object)
 {
-	disconnect([object](SlotList::iterator &iter) {
-		return (*iter)->match(object);
+	disconnect([object](BoundMethodBase *slot) {
+		return slot->match(object);
 	});
 }
 
-void SignalBase::disconnect(std::function<bool(SlotList::iterator &)> match)
+void SignalBase::disconnect(std::function<bool(BoundMethodBase *)> match)
 {
-	for (auto iter = slots_.begin(); iter != slots_.end(); ) {
-		if (match(iter)) {
-			Object *object = (*iter)->object();
-			if (object)
-				object->disconnect(this);
-
-			delete *iter;
-			iter = slots_.erase(iter);
-		} else {
-			++iter;
+	if (!slots_)
+		return;
+
+	std::shared_ptr<SlotList> slots = std::make_shared<SlotList>();
+	bool modified = false;
+
+	for (const std::shared_ptr<BoundMethodBase> &slot : *slots_) {
+		if (!match(slot.get())) {
+			slots->push_back(slot);
+			continue;
 		}
+
+		Object *object = slot->object();
+		if (object)
+			object->disconnect(this);
+
+		slot->disconnected_ = true;
+		modified = true;
 	}
-}
 
-SignalBase::SlotList SignalBase::slots()
-{
-	return slots_;
+	if (!modified)
+		return;
+
+	if (slots->empty())
+		slots_.reset();
+	else
+		slots_ = std::move(slots);
 }
 
 /**
@@ -99,6 +126,11 @@ SignalBase::SlotList SignalBase::slots()
  * disconnected from the \a func slot of \a object when \a object is destroyed.
  * Otherwise the caller shall disconnect signals manually before destroying \a
  * object.
+ *
+ * Slots of Object instances additionally accept a ConnectionType and a
+ * MessagePriority. The priority applies to queued invocations, and lets slots
+ * on latency-sensitive paths be dispatched ahead of bulk work pending in the
+ * receiver's thread.
  */
 
 /**
@@ -141,6 +173,22 @@ SignalBase::SlotList SignalBase::slots()
  * function are passed to the slot functions unchanged. If a slot modifies one
  * of the arguments (when passed by pointer or reference), the modification is
  * thus visible to all subsequently called slots.
+ *
+ * Slots connected by a slot during emission aren't called by the emission in
+ * progress, which only calls the slots that were connected when it started.
+ * Slots disconnected during emission, however, are not called anymore, even
+ * by the emission in progress. A slot can thus safely disconnect another slot
+ * and destroy its receiver.
+ *
+ * Arguments for slots bound to an Object are stored in a reference-counted
+ * pack, to be delivered asynchronously if needed. When a signal has a single
+ * slot, the arguments the signal takes by value are moved into the pack. When
+ * multiple slots are bound to Object instances, the arguments are copied once
+ * in a pack shared between all those slots, unless the signal has non-const
+ * reference parameters. Slots shall thus not cast away the constness of their
+ * reference parameters to modify them. Large read-only arguments should be
+ * passed by const reference, or wrapped in a std::shared_ptr<const T> to avoid
+ * copies altogether.
  */
 
 } /* namespace libcamera */
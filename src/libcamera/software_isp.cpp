@@ -0,0 +1,1066 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * software_isp.cpp - CPU image processing for raw Bayer sensors
+ */
+
+#include "software_isp.h"
+
+#include <algorithm>
+#include <errno.h>
+#include <math.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <linux/drm_fourcc.h>
+#include <linux/videodev2.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+#include <libcamera/buffer.h>
+#include <libcamera/stream.h>
+
+#include "buffer_metadata.h"
+#include "log.h"
+
+/**
+ * \file software_isp.h
+ * \brief CPU image processing for raw Bayer sensors
+ */
+
+namespace libcamera {
+
+LOG_DEFINE_CATEGORY(SoftwareIsp)
+
+namespace {
+
+/*
+ * The pixels are linearized to 12-bit values, which leaves enough headroom in
+ * 16-bit lanes to sum the four neighbours of a pixel during demosaicing.
+ */
+constexpr unsigned int LinearBits = 12;
+constexpr unsigned int LinearMax = (1 << LinearBits) - 1;
+
+/* Number of padding pixels on each side of the linearized lines. */
+constexpr unsigned int LinePadding = 8;
+
+enum Colour {
+	Red = 0,
+	Green = 1,
+	Blue = 2,
+};
+
+enum BayerOrder {
+	BGGR,
+	GBRG,
+	GRBG,
+	RGGB,
+};
+
+enum RawPacking {
+	Unpacked8,
+	Unpacked16,
+	Packed,
+};
+
+/*
+ * Colour of the pixels for each Bayer order, indexed by the parity of the line
+ * and column.
+ */
+const Colour bayerColours[4][2][2] = {
+	{ { Blue, Green }, { Green, Red } },	/* BGGR */
+	{ { Green, Blue }, { Red, Green } },	/* GBRG */
+	{ { Green, Red }, { Blue, Green } },	/* GRBG */
+	{ { Red, Green }, { Green, Blue } },	/* RGGB */
+};
+
+struct RawFormat {
+	uint32_t fourcc;
+	BayerOrder order;
+	unsigned int bitDepth;
+	RawPacking packing;
+};
+
+const RawFormat rawFormats[] = {
+	{ V4L2_PIX_FMT_SBGGR8, BGGR, 8, Unpacked8 },
+	{ V4L2_PIX_FMT_SGBRG8, GBRG, 8, Unpacked8 },
+	{ V4L2_PIX_FMT_SGRBG8, GRBG, 8, Unpacked8 },
+	{ V4L2_PIX_FMT_SRGGB8, RGGB, 8, Unpacked8 },
+	{ V4L2_PIX_FMT_SBGGR10, BGGR, 10, Unpacked16 },
+	{ V4L2_PIX_FMT_SGBRG10, GBRG, 10, Unpacked16 },
+	{ V4L2_PIX_FMT_SGRBG10, GRBG, 10, Unpacked16 },
+	{ V4L2_PIX_FMT_SRGGB10, RGGB, 10, Unpacked16 },
+	{ V4L2_PIX_FMT_SBGGR12, BGGR, 12, Unpacked16 },
+	{ V4L2_PIX_FMT_SGBRG12, GBRG, 12, Unpacked16 },
+	{ V4L2_PIX_FMT_SGRBG12, GRBG, 12, Unpacked16 },
+	{ V4L2_PIX_FMT_SRGGB12, RGGB, 12, Unpacked16 },
+	{ V4L2_PIX_FMT_SBGGR10P, BGGR, 10, Packed },
+	{ V4L2_PIX_FMT_SGBRG10P, GBRG, 10, Packed },
+	{ V4L2_PIX_FMT_SGRBG10P, GRBG, 10, Packed },
+	{ V4L2_PIX_FMT_SRGGB10P, RGGB, 10, Packed },
+	{ V4L2_PIX_FMT_SBGGR12P, BGGR, 12, Packed },
+	{ V4L2_PIX_FMT_SGBRG12P, GBRG, 12, Packed },
+	{ V4L2_PIX_FMT_SGRBG12P, GRBG, 12, Packed },
+	{ V4L2_PIX_FMT_SRGGB12P, RGGB, 12, Packed },
+	{ V4L2_PIX_FMT_SBGGR14P, BGGR, 14, Packed },
+	{ V4L2_PIX_FMT_SGBRG14P, GBRG, 14, Packed },
+	{ V4L2_PIX_FMT_SGRBG14P, GRBG, 14, Packed },
+	{ V4L2_PIX_FMT_SRGGB14P, RGGB, 14, Packed },
+	{ V4L2_PIX_FMT_IPU3_SBGGR10, BGGR, 10, Packed },
+	{ V4L2_PIX_FMT_IPU3_SGBRG10, GBRG, 10, Packed },
+	{ V4L2_PIX_FMT_IPU3_SGRBG10, GRBG, 10, Packed },
+	{ V4L2_PIX_FMT_IPU3_SRGGB10, RGGB, 10, Packed },
+};
+
+const RawFormat *findRawFormat(uint32_t fourcc)
+{
+	for (const RawFormat &format : rawFormats) {
+		if (format.fourcc == fourcc)
+			return &format;
+	}
+
+	return nullptr;
+}
+
+/*
+ * Linearize a line, storing the black-level-corrected and white-balanced
+ * values to dst, and accumulating the raw values of the even and odd columns
+ * and the linearized green values of each statistics zone.
+ */
+template<typename T>
+void linearize(const T *src, uint16_t *dst, unsigned int mask,
+	       const uint16_t *evenTable, const uint16_t *oddTable,
+	       bool greenEven, const unsigned int *zoneColumns,
+	       uint64_t *sums, uint64_t *zones)
+{
+	unsigned int x = 0;
+
+	for (unsigned int zone = 0; zone < SoftwareIspStats::GridWidth; ++zone) {
+		unsigned int end = zoneColumns[zone + 1];
+		uint32_t evenSum = 0;
+		uint32_t oddSum = 0;
+		uint32_t green = 0;
+
+		for (; x < end; x += 2) {
+			unsigned int even = src[x] & mask;
+			unsigned int odd = src[x + 1] & mask;
+			uint16_t evenValue = evenTable[even];
+			uint16_t oddValue = oddTable[odd];
+
+			dst[x] = evenValue;
+			dst[x + 1] = oddValue;
+
+			evenSum += even;
+			oddSum += odd;
+			green += greenEven ? evenValue : oddValue;
+		}
+
+		sums[0] += evenSum;
+		sums[1] += oddSum;
+		zones[zone] = green;
+	}
+}
+
+/*
+ * Bilinear demosaicing interpolates the missing colours of a pixel from the
+ * pixel itself (C), the average of its horizontal (H), vertical (V), cross (X)
+ * or diagonal (D) neighbours, depending on the colour of the pixel and of its
+ * horizontal neighbours.
+ */
+enum Source {
+	SourceC,
+	SourceH,
+	SourceV,
+	SourceX,
+	SourceD,
+};
+
+constexpr Source source(Colour channel, Colour site, Colour neighbour)
+{
+	return channel == site ? SourceC
+	     : site == Green ? (channel == neighbour ? SourceH : SourceV)
+	     : channel == Green ? SourceX : SourceD;
+}
+
+template<Colour Site, Colour Neighbour>
+inline void demosaicPixel(const uint16_t *above, const uint16_t *line,
+			  const uint16_t *below, unsigned int x,
+			  uint16_t *r, uint16_t *g, uint16_t *b)
+{
+	const unsigned int values[] = {
+		line[x],
+		(line[x - 1] + line[x + 1] + 1U) >> 1,
+		(above[x] + below[x] + 1U) >> 1,
+		(line[x - 1] + line[x + 1] + above[x] + below[x] + 2U) >> 2,
+		(above[x - 1] + above[x + 1] + below[x - 1] + below[x + 1] + 2U) >> 2,
+	};
+
+	r[x] = values[source(Red, Site, Neighbour)];
+	g[x] = values[source(Green, Site, Neighbour)];
+	b[x] = values[source(Blue, Site, Neighbour)];
+}
+
+#if defined(__SSE2__)
+
+inline __m128i load(const uint16_t *src)
+{
+	return _mm_loadu_si128(reinterpret_cast<const __m128i *>(src));
+}
+
+inline void store(uint16_t *dst, __m128i even, __m128i odd, __m128i mask)
+{
+	__m128i value = _mm_or_si128(_mm_and_si128(mask, even),
+				     _mm_andnot_si128(mask, odd));
+	_mm_storeu_si128(reinterpret_cast<__m128i *>(dst), value);
+}
+
+#endif
+
+/*
+ * Demosaic a line whose even and odd columns store the Even and Odd colours.
+ * The vector code processes 8 pixels per iteration, and produces exactly the
+ * same results as the scalar code.
+ */
+template<Colour Even, Colour Odd>
+void demosaic(const uint16_t *above, const uint16_t *line,
+	      const uint16_t *below, unsigned int width,
+	      uint16_t *r, uint16_t *g, uint16_t *b)
+{
+	unsigned int x = 0;
+
+#if defined(__SSE2__)
+	const __m128i evenMask = _mm_set1_epi32(0x0000ffff);
+	const __m128i two = _mm_set1_epi16(2);
+
+	for (; x + 8 <= width; x += 8) {
+		__m128i left = load(line + x - 1);
+		__m128i right = load(line + x + 1);
+		__m128i up = load(above + x);
+		__m128i down = load(below + x);
+		__m128i cross = _mm_add_epi16(_mm_add_epi16(left, right),
+					      _mm_add_epi16(up, down));
+		__m128i diagonal = _mm_add_epi16(_mm_add_epi16(load(above + x - 1),
+							       load(above + x + 1)),
+						 _mm_add_epi16(load(below + x - 1),
+							       load(below + x + 1)));
+		const __m128i values[] = {
+			load(line + x),
+			_mm_avg_epu16(left, right),
+			_mm_avg_epu16(up, down),
+			_mm_srli_epi16(_mm_add_epi16(cross, two), 2),
+			_mm_srli_epi16(_mm_add_epi16(diagonal, two), 2),
+		};
+
+		store(r + x, values[source(Red, Even, Odd)],
+		      values[source(Red, Odd, Even)], evenMask);
+		store(g + x, values[source(Green, Even, Odd)],
+		      values[source(Green, Odd, Even)], evenMask);
+		store(b + x, values[source(Blue, Even, Odd)],
+		      values[source(Blue, Odd, Even)], evenMask);
+	}
+#elif defined(__ARM_NEON)
+	static const uint16_t mask[] = { 0xffff, 0, 0xffff, 0, 0xffff, 0, 0xffff, 0 };
+	const uint16x8_t evenMask = vld1q_u16(mask);
+
+	for (; x + 8 <= width; x += 8) {
+		uint16x8_t left = vld1q_u16(line + x - 1);
+		uint16x8_t right = vld1q_u16(line + x + 1);
+		uint16x8_t up = vld1q_u16(above + x);
+		uint16x8_t down = vld1q_u16(below + x);
+		uint16x8_t cross = vaddq_u16(vaddq_u16(left, right),
+					     vaddq_u16(up, down));
+		uint16x8_t diagonal = vaddq_u16(vaddq_u16(vld1q_u16(above + x - 1),
+							  vld1q_u16(above + x + 1)),
+						vaddq_u16(vld1q_u16(below + x - 1),
+							  vld1q_u16(below + x + 1)));
+		const uint16x8_t values[] = {
+			vld1q_u16(line + x),
+			vrhaddq_u16(left, right),
+			vrhaddq_u16(up, down),
+			vrshrq_n_u16(cross, 2),
+			vrshrq_n_u16(diagonal, 2),
+		};
+
+		vst1q_u16(r + x, vbslq_u16(evenMask, values[source(Red, Even, Odd)],
+					   values[source(Red, Odd, Even)]));
+		vst1q_u16(g + x, vbslq_u16(evenMask, values[source(Green, Even, Odd)],
+					   values[source(Green, Odd, Even)]));
+		vst1q_u16(b + x, vbslq_u16(evenMask, values[source(Blue, Even, Odd)],
+					   values[source(Blue, Odd, Even)]));
+	}
+#endif
+
+	for (; x < width; x += 2) {
+		demosaicPixel<Even, Odd>(above, line, below, x, r, g, b);
+		demosaicPixel<Odd, Even>(above, line, below, x + 1, r, g, b);
+	}
+}
+
+/* Convert RGB to YUV with the BT.601 limited range matrix. */
+inline uint8_t rgbToY(int r, int g, int b)
+{
+	return ((66 * r + 129 * g + 25 * b + 128) >> 8) + 16;
+}
+
+inline uint8_t rgbToU(int r, int g, int b)
+{
+	return ((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128;
+}
+
+inline uint8_t rgbToV(int r, int g, int b)
+{
+	return ((112 * r - 94 * g - 18 * b + 128) >> 8) + 128;
+}
+
+const std::vector<PixelFormat> outputFormats = {
+	DRM_FORMAT_NV12,
+	DRM_FORMAT_RGB888,
+	DRM_FORMAT_BGR888,
+};
+
+} /* namespace */
+
+/**
+ * \struct SoftwareIspParams
+ * \brief Processing parameters of the SoftwareIsp
+ *
+ * \var SoftwareIspParams::blackLevel
+ * \brief The sensor black level, expressed on a 16-bit scale
+ *
+ * \var SoftwareIspParams::gains
+ * \brief The white balance gains of the red, green and blue channels
+ *
+ * \var SoftwareIspParams::gamma
+ * \brief The gamma of the output, 1.0 for a linear output
+ */
+
+/**
+ * \brief Construct processing parameters for a linear sensor without black
+ * level, with unity gains and a 2.2 gamma
+ */
+SoftwareIspParams::SoftwareIspParams()
+	: blackLevel(0), gains({ 1.0, 1.0, 1.0 }), gamma(2.2)
+{
+}
+
+/**
+ * \struct SoftwareIspStats
+ * \brief Statistics computed by the SoftwareIsp while processing a frame
+ *
+ * The statistics are gathered while linearizing the raw pixels, without
+ * reading the frame a second time.
+ *
+ * \var SoftwareIspStats::GridWidth
+ * \brief The number of horizontal zones of the luminance grid
+ *
+ * \var SoftwareIspStats::GridHeight
+ * \brief The number of vertical zones of the luminance grid
+ *
+ * \var SoftwareIspStats::sums
+ * \brief The sums of the raw values of the red, green and blue pixels of the
+ * frame, before black level correction and white balance
+ *
+ * \var SoftwareIspStats::counts
+ * \brief The number of red, green and blue pixels of the frame
+ *
+ * \var SoftwareIspStats::bitDepth
+ * \brief The number of bits per pixel of the raw values
+ *
+ * \var SoftwareIspStats::luminance
+ * \brief The mean linear green value of each zone of the frame, after black
+ * level correction and white balance, on an 8-bit scale
+ *
+ * The zones are stored in raster order, GridWidth zones per line.
+ *
+ * \var SoftwareIspStats::processingTime
+ * \brief The time spent processing the frame
+ */
+
+/**
+ * \class SoftwareIsp
+ * \brief Process raw Bayer frames on the CPU
+ *
+ * Sensors connected to a capture interface without an ISP only produce raw
+ * Bayer frames. The SoftwareIsp class processes those frames on the CPU into
+ * NV12 or RGB frames suitable for applications, with black level correction,
+ * white balance, bilinear demosaicing and gamma correction. It offers an
+ * interface similar to the Converter, for pipeline handlers to chain it after
+ * their capture video node.
+ *
+ * Frames are processed in a dedicated thread, split in horizontal stripes
+ * processed concurrently by a pool of worker threads. The raw pixels are first
+ * linearized through per-channel lookup tables, that apply the black level and
+ * white balance gains, to 12-bit values. Statistics for the auto-exposure and
+ * auto white balance algorithms are accumulated in the same pass, and reported
+ * with the statsReady signal. The linearized lines are demosaiced with SIMD
+ * code, and converted to the output format through a gamma lookup table.
+ *
+ * The signals are emitted in the thread the SoftwareIsp belongs to.
+ */
+
+/**
+ * \brief A thread-bound proxy that processes the frames queued to a SoftwareIsp
+ */
+class SoftwareIsp::Worker : public Object
+{
+public:
+	Worker(SoftwareIsp *isp)
+		: isp_(isp)
+	{
+	}
+
+	void process(FrameBuffer *input, FrameBuffer *output)
+	{
+		isp_->process(input, output);
+	}
+
+	void sync()
+	{
+	}
+
+private:
+	SoftwareIsp *isp_;
+};
+
+/**
+ * \brief Construct a SoftwareIsp
+ * \param[in] threads The number of worker threads, 0 for one per CPU
+ */
+SoftwareIsp::SoftwareIsp(unsigned int threads)
+	: pool_(threads), inputFormat_(0), bayerOrder_(0), bitDepth_(0),
+	  packing_(0), inputStride_(0),
+	  outputFormat_(0), outputInfo_(nullptr), zoneColumns_{}, zoneLines_{},
+	  gammaTable_{}, inputs_(MappedFrameBuffer::MapRead),
+	  outputs_(MappedFrameBuffer::MapWrite), stopping_(false),
+	  running_(false), paramsChanged_(true)
+{
+	worker_ = std::make_unique<Worker>(this);
+	worker_->moveToThread(&thread_);
+
+	thread_.setName("lc-soft-isp");
+	thread_.start();
+}
+
+SoftwareIsp::~SoftwareIsp()
+{
+	stop();
+
+	thread_.exit();
+	thread_.wait();
+}
+
+/**
+ * \brief Retrieve the output formats supported for an input format
+ * \param[in] input The V4L2 fourcc of the raw Bayer input format
+ * \return The list of supported output pixel formats, empty if the \a input
+ * format isn't supported
+ */
+std::vector<PixelFormat> SoftwareIsp::formats(uint32_t input)
+{
+	if (!findRawFormat(input))
+		return {};
+
+	return outputFormats;
+}
+
+/**
+ * \brief Configure the SoftwareIsp for a given input and output
+ * \param[in] inputCfg The input configuration, with the V4L2 fourcc of the raw
+ * Bayer format stored as the pixel format
+ * \param[in] inputStride The number of bytes per line of the input frames
+ * \param[in] outputCfg The output configuration
+ *
+ * The output size shall be equal to the input size, with an even width and
+ * height.
+ *
+ * \return 0 on success, -EBUSY if the SoftwareIsp is running, or -EINVAL if
+ * the configuration isn't supported
+ */
+int SoftwareIsp::configure(const StreamConfiguration &inputCfg,
+			   unsigned int inputStride,
+			   const StreamConfiguration &outputCfg)
+{
+	if (running_)
+		return -EBUSY;
+
+	const RawFormat *format = findRawFormat(inputCfg.pixelFormat);
+	if (!format) {
+		LOG(SoftwareIsp, Error)
+			<< "Unsupported input format "
+			<< utils::hex(inputCfg.pixelFormat);
+		return -EINVAL;
+	}
+
+	if (std::find(outputFormats.begin(), outputFormats.end(),
+		      outputCfg.pixelFormat) == outputFormats.end()) {
+		LOG(SoftwareIsp, Error)
+			<< "Unsupported output format " << outputCfg.pixelFormat;
+		return -EINVAL;
+	}
+
+	const Size &size = inputCfg.size;
+	if (outputCfg.size != size || size.width < 2 || size.height < 2 ||
+	    size.width % 2 || size.height % 2) {
+		LOG(SoftwareIsp, Error)
+			<< "Unsupported sizes " << size.toString() << " -> "
+			<< outputCfg.size.toString();
+		return -EINVAL;
+	}
+
+	unsigned int minStride;
+	switch (format->packing) {
+	case Unpacked8:
+		minStride = size.width;
+		break;
+	case Unpacked16:
+		minStride = size.width * 2;
+		break;
+	default:
+		unpacker_.configure(format->fourcc, size.width);
+		minStride = unpacker_.minStride();
+		break;
+	}
+
+	if (inputStride < minStride) {
+		LOG(SoftwareIsp, Error)
+			<< "Input stride " << inputStride << " too small";
+		return -EINVAL;
+	}
+
+	inputFormat_ = format->fourcc;
+	bayerOrder_ = format->order;
+	bitDepth_ = format->bitDepth;
+	packing_ = format->packing;
+	size_ = size;
+	inputStride_ = inputStride;
+	outputFormat_ = outputCfg.pixelFormat;
+	outputInfo_ = &PixelFormatInfo::info(outputFormat_);
+
+	/* Split the frame in stripes of an even number of lines. */
+	unsigned int pairs = size_.height / 2;
+	unsigned int count = std::min(pool_.workers(), pairs);
+	unsigned int stripeHeight = (pairs + count - 1) / count * 2;
+	unsigned int lineLength = (size_.width + 7) / 8 * 8 + LinePadding * 2;
+
+	stripes_.clear();
+	stripes_.resize((size_.height + stripeHeight - 1) / stripeHeight);
+
+	for (unsigned int i = 0; i < stripes_.size(); ++i) {
+		Stripe &stripe = stripes_[i];
+
+		stripe.start = i * stripeHeight;
+		stripe.end = std::min(stripe.start + stripeHeight, size_.height);
+
+		for (std::vector<uint16_t> &line : stripe.lines)
+			line.assign(lineLength, 0);
+		for (std::vector<uint16_t> &line : stripe.rgb)
+			line.assign(lineLength, 0);
+		if (format->packing == Packed)
+			stripe.unpacked.assign(lineLength, 0);
+	}
+
+	/* Statistics zones span an even number of columns. */
+	for (unsigned int i = 0; i <= SoftwareIspStats::GridWidth; ++i)
+		zoneColumns_[i] = i * size_.width / SoftwareIspStats::GridWidth & ~1U;
+	for (unsigned int i = 0; i <= SoftwareIspStats::GridHeight; ++i)
+		zoneLines_[i] = (i * size_.height + SoftwareIspStats::GridHeight - 1)
+			      / SoftwareIspStats::GridHeight;
+
+	for (std::vector<uint16_t> &table : linearTables_)
+		table.assign(1 << format->bitDepth, 0);
+
+	MutexLocker locker(mutex_);
+	paramsChanged_ = true;
+
+	LOG(SoftwareIsp, Debug)
+		<< "Processing " << size_.toString() << "-"
+		<< utils::hex(format->fourcc) << " to " << outputFormat_
+		<< " in " << stripes_.size() << " stripes";
+
+	return 0;
+}
+
+/**
+ * \brief Allocate output buffers
+ * \param[in] count The number of buffers to allocate
+ * \param[out] buffers The allocated buffers
+ *
+ * The buffers are allocated from anonymous shared memory, with a single plane
+ * storing all the planes of the output format contiguously.
+ *
+ * \return The number of allocated buffers on success or a negative error code
+ * otherwise
+ */
+int SoftwareIsp::exportBuffers(unsigned int count,
+			       std::vector<std::unique_ptr<FrameBuffer>> *buffers)
+{
+	if (!outputInfo_)
+		return -EINVAL;
+
+	unsigned int length = outputInfo_->frameSize(size_);
+
+	for (unsigned int i = 0; i < count; ++i) {
+		int fd = memfd_create("libcamera-soft-isp", 0);
+		if (fd < 0) {
+			int ret = -errno;
+			LOG(SoftwareIsp, Error)
+				<< "Failed to allocate buffer: " << strerror(-ret);
+			buffers->clear();
+			return ret;
+		}
+
+		if (ftruncate(fd, length) < 0) {
+			int ret = -errno;
+			LOG(SoftwareIsp, Error)
+				<< "Failed to size buffer: " << strerror(-ret);
+			::close(fd);
+			buffers->clear();
+			return ret;
+		}
+
+		FrameBuffer::Plane plane;
+		plane.fd = FileDescriptor(fd);
+		plane.length = length;
+		::close(fd);
+
+		buffers->push_back(std::make_unique<FrameBuffer>(std::vector<FrameBuffer::Plane>{ plane }));
+	}
+
+	return count;
+}
+
+/**
+ * \brief Set the processing parameters
+ * \param[in] params The processing parameters
+ *
+ * The parameters are applied from the next frame to be processed. This method
+ * may be called while frames are being processed.
+ */
+void SoftwareIsp::setParams(const SoftwareIspParams &params)
+{
+	MutexLocker locker(mutex_);
+	params_ = params;
+	paramsChanged_ = true;
+}
+
+/**
+ * \brief Start the SoftwareIsp
+ * \return 0 on success, or -EINVAL if the SoftwareIsp isn't configured
+ */
+int SoftwareIsp::start()
+{
+	if (!inputFormat_)
+		return -EINVAL;
+
+	running_ = true;
+
+	return 0;
+}
+
+/**
+ * \brief Stop the SoftwareIsp
+ *
+ * The frames queued and not processed yet are cancelled. All queued buffers
+ * are returned through the inputBufferReady and outputBufferReady signals
+ * before this method returns.
+ */
+void SoftwareIsp::stop()
+{
+	if (!running_)
+		return;
+
+	stopping_ = true;
+	worker_->invokeMethod(&Worker::sync, ConnectionTypeBlocking);
+	complete();
+	stopping_ = false;
+
+	inputs_.clear();
+	outputs_.clear();
+
+	running_ = false;
+}
+
+/**
+ * \brief Queue buffers to the SoftwareIsp
+ * \param[in] input The raw Bayer input buffer
+ * \param[in] output The output buffer
+ *
+ * The input buffer is returned through the inputBufferReady signal once
+ * processed, and the output buffer through the outputBufferReady signal,
+ * preceded by the statsReady signal if the frame was processed successfully.
+ *
+ * \return 0 on success, or -EINVAL if the SoftwareIsp isn't running
+ */
+int SoftwareIsp::queueBuffers(FrameBuffer *input, FrameBuffer *output)
+{
+	if (!running_)
+		return -EINVAL;
+
+	worker_->invokeMethod(&Worker::process, ConnectionTypeQueued,
+			      input, output);
+
+	return 0;
+}
+
+/**
+ * \var SoftwareIsp::inputBufferReady
+ * \brief A signal emitted when an input buffer has been consumed
+ */
+
+/**
+ * \var SoftwareIsp::statsReady
+ * \brief A signal emitted with the statistics of a processed frame, before
+ * its output buffer is returned
+ */
+
+/**
+ * \var SoftwareIsp::outputBufferReady
+ * \brief A signal emitted when an output buffer is ready
+ */
+
+void SoftwareIsp::process(FrameBuffer *input, FrameBuffer *output)
+{
+	Result result = { input, output, {} };
+	int ret = stopping_ ? -ECANCELED
+			    : processFrame(input, output, &result.stats);
+
+	FrameMetadata metadata = output->metadata();
+	metadata.status = !ret ? FrameMetadata::FrameSuccess
+			: ret == -ECANCELED ? FrameMetadata::FrameCancelled
+			: FrameMetadata::FrameError;
+	metadata.sequence = input->metadata().sequence;
+	metadata.timestamp = input->metadata().timestamp;
+	BufferMetadata::setNumPlanes(&metadata, output->planes().size());
+	for (unsigned int i = 0; i < metadata.planes().size(); ++i)
+		metadata.planes()[i].bytesused = ret ? 0 : output->planes()[i].length;
+	BufferMetadata::copy(output, metadata);
+
+	{
+		MutexLocker locker(mutex_);
+		results_.push(result);
+	}
+
+	invokeMethod(&SoftwareIsp::complete, ConnectionTypeQueued,
+		     MessagePriorityRealtime);
+}
+
+int SoftwareIsp::processFrame(FrameBuffer *input, FrameBuffer *output,
+			      SoftwareIspStats *stats)
+{
+	utils::time_point start = utils::clock::now();
+
+	const MappedFrameBuffer *in = inputs_.map(input);
+	const MappedFrameBuffer *out = outputs_.map(output);
+	if (!in || !out) {
+		LOG(SoftwareIsp, Error) << "Failed to map buffers";
+		return -ENOMEM;
+	}
+
+	const std::vector<MappedFrameBuffer::Plane> &inPlanes = in->planes();
+	const std::vector<MappedFrameBuffer::Plane> &outPlanes = out->planes();
+	Frame frame;
+
+	if (inPlanes[0].length < inputStride_ * size_.height) {
+		LOG(SoftwareIsp, Error) << "Input buffer too small";
+		return -EINVAL;
+	}
+
+	frame.src = inPlanes[0].data;
+
+	for (unsigned int i = 0; i < outputInfo_->numPlanes; ++i) {
+		size_t length = outputInfo_->planeSize(size_, i);
+
+		frame.strides[i] = outputInfo_->stride(size_.width, i);
+
+		if (outPlanes.size() == 1) {
+			frame.dst[i] = i ? frame.dst[i - 1] +
+					   outputInfo_->planeSize(size_, i - 1)
+					 : outPlanes[0].data;
+			if (frame.dst[i] + length > outPlanes[0].data + outPlanes[0].length)
+				length = SIZE_MAX;
+		} else if (i < outPlanes.size()) {
+			frame.dst[i] = outPlanes[i].data;
+			if (outPlanes[i].length < length)
+				length = SIZE_MAX;
+		} else {
+			length = SIZE_MAX;
+		}
+
+		if (length == SIZE_MAX) {
+			LOG(SoftwareIsp, Error) << "Output buffer too small";
+			return -EINVAL;
+		}
+	}
+
+	ScopedCpuAccess inAccess(*in);
+	ScopedCpuAccess outAccess(*out);
+	if (inAccess.error() || outAccess.error())
+		return -EIO;
+
+	updateTables();
+
+	for (Stripe &stripe : stripes_) {
+		stripe.sums.fill(0);
+		stripe.zones.fill(0);
+
+		pool_.run([this, &stripe, &frame]() {
+			processStripe(stripe, frame);
+		});
+	}
+
+	pool_.wait();
+
+	/* Gather the statistics of all stripes. */
+	unsigned int quadrants = size_.width / 2 * size_.height / 2;
+	std::array<uint64_t, SoftwareIspStats::GridWidth *
+			     SoftwareIspStats::GridHeight> zones{};
+
+	stats->sums.fill(0);
+	stats->counts = { quadrants, quadrants * 2ULL, quadrants };
+	stats->bitDepth = bitDepth_;
+
+	for (const Stripe &stripe : stripes_) {
+		for (unsigned int i = 0; i < stats->sums.size(); ++i)
+			stats->sums[i] += stripe.sums[i];
+		for (unsigned int i = 0; i < zones.size(); ++i)
+			zones[i] += stripe.zones[i];
+	}
+
+	for (unsigned int y = 0; y < SoftwareIspStats::GridHeight; ++y) {
+		unsigned int lines = zoneLines_[y + 1] - zoneLines_[y];
+
+		for (unsigned int x = 0; x < SoftwareIspStats::GridWidth; ++x) {
+			unsigned int index = y * SoftwareIspStats::GridWidth + x;
+			uint64_t count = (zoneColumns_[x + 1] - zoneColumns_[x]) / 2 * lines;
+
+			stats->luminance[index] = count
+				? zones[index] / count >> (LinearBits - 8) : 0;
+		}
+	}
+
+	stats->processingTime = utils::clock::now() - start;
+
+	return 0;
+}
+
+void SoftwareIsp::processStripe(Stripe &stripe, const Frame &frame)
+{
+	/*
+	 * Demosaic the stripe two lines at a time, keeping the lines above and
+	 * below them in a ring of four linearized lines.
+	 */
+	linearizeLine(stripe, frame, static_cast<int>(stripe.start) - 1);
+	linearizeLine(stripe, frame, stripe.start);
+
+	for (unsigned int y = stripe.start; y < stripe.end; y += 2) {
+		linearizeLine(stripe, frame, y + 1);
+		linearizeLine(stripe, frame, y + 2);
+
+		demosaicLine(stripe, y, stripe.rgb[0].data(),
+			     stripe.rgb[1].data(), stripe.rgb[2].data());
+		demosaicLine(stripe, y + 1, stripe.rgb[3].data(),
+			     stripe.rgb[4].data(), stripe.rgb[5].data());
+
+		outputLines(stripe, frame, y);
+	}
+}
+
+void SoftwareIsp::linearizeLine(Stripe &stripe, const Frame &frame, int line)
+{
+	const int height = size_.height;
+	const unsigned int width = size_.width;
+
+	/* Mirror the lines outside of the frame, preserving the Bayer order. */
+	unsigned int y = line < 0 ? 1 : line >= height ? height - 2 : line;
+
+	const Colour *colours = bayerColours[bayerOrder_][y & 1];
+	const uint16_t *evenTable = linearTables_[colours[0]].data();
+	const uint16_t *oddTable = linearTables_[colours[1]].data();
+	const unsigned int mask = (1 << bitDepth_) - 1;
+	const bool greenEven = colours[0] == Green;
+
+	const uint8_t *src = frame.src + y * inputStride_;
+	uint16_t *dst = stripe.lines[line & 3].data() + LinePadding;
+
+	uint64_t sums[2] = { 0, 0 };
+	uint64_t zones[SoftwareIspStats::GridWidth];
+
+	switch (packing_) {
+	case Unpacked8:
+		linearize(src, dst, mask, evenTable, oddTable, greenEven,
+			  zoneColumns_.data(), sums, zones);
+		break;
+	case Unpacked16:
+		linearize(reinterpret_cast<const uint16_t *>(src), dst, mask,
+			  evenTable, oddTable, greenEven, zoneColumns_.data(),
+			  sums, zones);
+		break;
+	default:
+		unpacker_.unpack(src, inputStride_, stripe.unpacked.data(),
+				 width * 2, 0, 1);
+		linearize(stripe.unpacked.data(), dst, mask, evenTable,
+			  oddTable, greenEven, zoneColumns_.data(), sums, zones);
+		break;
+	}
+
+	dst[-1] = dst[1];
+	dst[width] = dst[width - 2];
+
+	/* Only account for the lines of the stripe in the statistics. */
+	if (line < static_cast<int>(stripe.start) ||
+	    line >= static_cast<int>(stripe.end))
+		return;
+
+	stripe.sums[colours[0]] += sums[0];
+	stripe.sums[colours[1]] += sums[1];
+
+	unsigned int zoneLine = y * SoftwareIspStats::GridHeight / height;
+	uint64_t *zoneSums = &stripe.zones[zoneLine * SoftwareIspStats::GridWidth];
+	for (unsigned int i = 0; i < SoftwareIspStats::GridWidth; ++i)
+		zoneSums[i] += zones[i];
+}
+
+void SoftwareIsp::demosaicLine(const Stripe &stripe, unsigned int line,
+			       uint16_t *r, uint16_t *g, uint16_t *b) const
+{
+	const uint16_t *above = stripe.lines[(line - 1) & 3].data() + LinePadding;
+	const uint16_t *current = stripe.lines[line & 3].data() + LinePadding;
+	const uint16_t *below = stripe.lines[(line + 1) & 3].data() + LinePadding;
+	const Colour *colours = bayerColours[bayerOrder_][line & 1];
+	const unsigned int width = size_.width;
+
+	if (colours[0] == Red)
+		demosaic<Red, Green>(above, current, below, width, r, g, b);
+	else if (colours[0] == Blue)
+		demosaic<Blue, Green>(above, current, below, width, r, g, b);
+	else if (colours[1] == Red)
+		demosaic<Green, Red>(above, current, below, width, r, g, b);
+	else
+		demosaic<Green, Blue>(above, current, below, width, r, g, b);
+}
+
+void SoftwareIsp::outputLines(Stripe &stripe, const Frame &frame,
+			      unsigned int line)
+{
+	const unsigned int width = size_.width;
+	const uint8_t *gamma = gammaTable_.data();
+
+	if (outputFormat_ == DRM_FORMAT_NV12) {
+		uint8_t *uv = frame.dst[1] + line / 2 * frame.strides[1];
+
+		for (unsigned int i = 0; i < 2; ++i) {
+			const uint16_t *r = stripe.rgb[i * 3].data();
+			const uint16_t *g = stripe.rgb[i * 3 + 1].data();
+			const uint16_t *b = stripe.rgb[i * 3 + 2].data();
+			uint8_t *y = frame.dst[0] + (line + i) * frame.strides[0];
+
+			for (unsigned int x = 0; x < width; ++x)
+				y[x] = rgbToY(gamma[r[x]], gamma[g[x]], gamma[b[x]]);
+		}
+
+		/* Subsample the chroma by averaging 2x2 blocks. */
+		const uint16_t *r0 = stripe.rgb[0].data();
+		const uint16_t *g0 = stripe.rgb[1].data();
+		const uint16_t *b0 = stripe.rgb[2].data();
+		const uint16_t *r1 = stripe.rgb[3].data();
+		const uint16_t *g1 = stripe.rgb[4].data();
+		const uint16_t *b1 = stripe.rgb[5].data();
+
+		for (unsigned int x = 0; x < width; x += 2) {
+			int r = (gamma[r0[x]] + gamma[r0[x + 1]] +
+				 gamma[r1[x]] + gamma[r1[x + 1]] + 2) >> 2;
+			int g = (gamma[g0[x]] + gamma[g0[x + 1]] +
+				 gamma[g1[x]] + gamma[g1[x + 1]] + 2) >> 2;
+			int b = (gamma[b0[x]] + gamma[b0[x + 1]] +
+				 gamma[b1[x]] + gamma[b1[x + 1]] + 2) >> 2;
+
+			uv[x] = rgbToU(r, g, b);
+			uv[x + 1] = rgbToV(r, g, b);
+		}
+
+		return;
+	}
+
+	/* DRM RGB formats are stored in little-endian order. */
+	const unsigned int first = outputFormat_ == DRM_FORMAT_RGB888 ? 2 : 0;
+
+	for (unsigned int i = 0; i < 2; ++i) {
+		const uint16_t *r = stripe.rgb[i * 3 + first].data();
+		const uint16_t *g = stripe.rgb[i * 3 + 1].data();
+		const uint16_t *b = stripe.rgb[i * 3 + 2 - first].data();
+		uint8_t *dst = frame.dst[0] + (line + i) * frame.strides[0];
+
+		for (unsigned int x = 0; x < width; ++x) {
+			dst[x * 3] = gamma[r[x]];
+			dst[x * 3 + 1] = gamma[g[x]];
+			dst[x * 3 + 2] = gamma[b[x]];
+		}
+	}
+}
+
+void SoftwareIsp::updateTables()
+{
+	SoftwareIspParams params;
+
+	{
+		MutexLocker locker(mutex_);
+		if (!paramsChanged_)
+			return;
+
+		params = params_;
+		paramsChanged_ = false;
+	}
+
+	const unsigned int bitDepth = bitDepth_;
+	const unsigned int maxValue = (1 << bitDepth) - 1;
+	const unsigned int black = std::min<unsigned int>(params.blackLevel >> (16 - bitDepth),
+							  maxValue - 1);
+	const double scale = static_cast<double>(LinearMax) / (maxValue - black);
+
+	for (unsigned int c = 0; c < linearTables_.size(); ++c) {
+		std::vector<uint16_t> &table = linearTables_[c];
+		const double gain = std::max(params.gains[c], 0.0) * scale;
+
+		for (unsigned int value = 0; value <= maxValue; ++value) {
+			double linear = value > black ? (value - black) * gain + 0.5 : 0.0;
+			table[value] = std::min<double>(linear, LinearMax);
+		}
+	}
+
+	const double exponent = params.gamma > 0.0 ? 1.0 / params.gamma : 1.0;
+
+	for (unsigned int value = 0; value <= LinearMax; ++value)
+		gammaTable_[value] = 255.0 * pow(static_cast<double>(value) / LinearMax,
+						 exponent) + 0.5;
+}
+
+void SoftwareIsp::complete()
+{
+	while (true) {
+		Result result;
+
+		{
+			MutexLocker locker(mutex_);
+			if (results_.empty())
+				return;
+
+			result = results_.front();
+			results_.pop();
+		}
+
+		inputBufferReady.emit(result.input);
+
+		if (result.output->metadata().status == FrameMetadata::FrameSuccess)
+			statsReady.emit(result.output, result.stats);
+
+		outputBufferReady.emit(result.output);
+	}
+}
+
+} /* namespace libcamera */
@@ -0,0 +1,151 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * span.cpp - C++20 std::span<> implementation for C++14
+ */
+
+#include <libcamera/span.h>
+
+/**
+ * \file span.h
+ * \brief A view over a contiguous sequence of objects
+ */
+
+namespace libcamera {
+
+/**
+ * \class Span
+ * \brief A view over a contiguous sequence of objects
+ *
+ * The Span class is a minimal implementation of the C++20 std::span<> class
+ * template, limited to dynamic extents. It references a contiguous sequence
+ * of objects of type \a T without owning them, and is thus cheap to copy and
+ * pass by value. The referenced memory shall outlive the Span.
+ *
+ * A Span can be constructed from a pointer and a size, from a C array, or from
+ * any container that stores its elements contiguously and exposes them
+ * through data() and size() methods, such as std::array and std::vector. A
+ * Span<T> is implicitly convertible to a Span<const T>.
+ */
+
+/**
+ * \fn Span::Span()
+ * \brief Construct an empty span
+ */
+
+/**
+ * \fn Span::Span(pointer ptr, size_type count)
+ * \brief Construct a span from a pointer and a number of elements
+ * \param[in] ptr Pointer to the first element
+ * \param[in] count The number of elements
+ */
+
+/**
+ * \fn Span::Span(pointer first, pointer last)
+ * \brief Construct a span from a range of elements
+ * \param[in] first Pointer to the first element
+ * \param[in] last Pointer past the last element
+ */
+
+/**
+ * \fn Span::Span(element_type (&arr)[N])
+ * \brief Construct a span referencing all elements of a C array
+ * \param[in] arr The array
+ */
+
+/**
+ * \fn Span::Span(Container &cont)
+ * \brief Construct a span referencing all elements of a container
+ * \param[in] cont The container
+ */
+
+/**
+ * \fn Span::Span(const Container &cont)
+ * \copydoc Span::Span(Container &cont)
+ */
+
+/**
+ * \fn Span::Span(const Span<U> &other)
+ * \brief Construct a span from a span of a compatible element type
+ * \param[in] other The other span
+ */
+
+/**
+ * \fn Span::begin()
+ * \brief Retrieve an iterator to the first element
+ * \return An iterator to the first element
+ */
+
+/**
+ * \fn Span::end()
+ * \brief Retrieve an iterator past the last element
+ * \return An iterator past the last element
+ */
+
+/**
+ * \fn Span::front()
+ * \brief Retrieve the first element, the span shall not be empty
+ * \return A reference to the first element
+ */
+
+/**
+ * \fn Span::back()
+ * \brief Retrieve the last element, the span shall not be empty
+ * \return A reference to the last element
+ */
+
+/**
+ * \fn Span::operator[]()
+ * \brief Retrieve an element, without bounds checking
+ * \param[in] idx The element index
+ * \return A reference to the element at index \a idx
+ */
+
+/**
+ * \fn Span::data()
+ * \brief Retrieve a pointer to the first element
+ * \return A pointer to the first element
+ */
+
+/**
+ * \fn Span::size()
+ * \brief Retrieve the number of elements
+ * \return The number of elements
+ */
+
+/**
+ * \fn Span::size_bytes()
+ * \brief Retrieve the size of the referenced memory in bytes
+ * \return The size of the referenced memory in bytes
+ */
+
+/**
+ * \fn Span::empty()
+ * \brief Check if the span is empty
+ * \return True if the span references no element, false otherwise
+ */
+
+/**
+ * \fn Span::first()
+ * \brief Create a span referencing the first elements of this span
+ * \param[in] count The number of elements
+ * \return A span referencing the first \a count elements
+ */
+
+/**
+ * \fn Span::last()
+ * \brief Create a span referencing the last elements of this span
+ * \param[in] count The number of elements
+ * \return A span referencing the last \a count elements
+ */
+
+/**
+ * \fn Span::subspan()
+ * \brief Create a span referencing a subset of the elements of this span
+ * \param[in] offset The index of the first element
+ * \param[in] count The number of elements, or npos for all remaining elements
+ * \return A span referencing \a count elements starting at \a offset
+ */
+
+} /* namespace libcamera */
@@ -279,7 +279,8 @@ SizeRange StreamFormats::range(PixelFormat pixelformat) const
  * handlers provied StreamFormats.
  */
 StreamConfiguration::StreamConfiguration()
-	: pixelFormat(0), stream_(nullptr)
+	: direction(Output), pixelFormat(0), memory(FrameBuffer::MemoryDmaBuf), decimation(1),
+	  zslFrames(0), stallDuration(0), stream_(nullptr)
 {
 }
 
@@ -287,10 +288,35 @@ StreamConfiguration::StreamConfiguration()
  * \brief Construct a configuration with stream formats
  */
 StreamConfiguration::StreamConfiguration(const StreamFormats &formats)
-	: pixelFormat(0), stream_(nullptr), formats_(formats)
+	: direction(Output), pixelFormat(0), memory(FrameBuffer::MemoryDmaBuf), decimation(1),
+	  zslFrames(0), stallDuration(0), stream_(nullptr), formats_(formats)
 {
 }
 
+/**
+ * \enum StreamConfiguration::Direction
+ * \brief Direction of the frames of a stream
+ * \var StreamConfiguration::Output
+ * The camera produces frames to the buffers of the stream
+ * \var StreamConfiguration::Input
+ * The camera consumes the frames the application provides in the buffers of
+ * the stream
+ */
+
+/**
+ * \var StreamConfiguration::direction
+ * \brief Direction of the frames of the stream
+ *
+ * Input streams feed frames from the application to the camera, for instance
+ * to reprocess raw frames captured earlier. A request that contains a buffer
+ * for an input stream processes the frame stored in that buffer instead of a
+ * frame captured from the sensor, and outputs the result to the buffers of
+ * the output streams of the request. The input buffer completes once the
+ * camera has consumed the frame.
+ *
+ * The direction defaults to StreamConfiguration::Output.
+ */
+
 /**
  * \var StreamConfiguration::size
  * \brief Stream size in pixels
@@ -306,6 +332,67 @@ StreamConfiguration::StreamConfiguration(const StreamFormats &formats)
  * \brief Requested number of buffers to allocate for the stream
  */
 
+/**
+ * \var StreamConfiguration::memory
+ * \brief Type of memory of the buffers the application queues for the stream
+ *
+ * Applications that capture to memory allocated in their own address space
+ * set the memory type to FrameBuffer::MemoryUserPtr, and queue FrameBuffer
+ * instances wrapping user pointers. Pipeline handlers that can't capture to
+ * user pointers adjust the memory type to FrameBuffer::MemoryDmaBuf when
+ * validating the configuration. Buffers for user pointer streams can't be
+ * allocated with the FrameBufferAllocator.
+ *
+ * The memory type defaults to FrameBuffer::MemoryDmaBuf.
+ */
+
+/**
+ * \var StreamConfiguration::decimation
+ * \brief Frame decimation factor of the stream
+ *
+ * A stream with a decimation factor of N only captures one frame out of N,
+ * counted from the start of the camera. The buffers the stream has in the
+ * requests for the other frames are not written, and complete with the
+ * FrameMetadata::FrameSkipped status without being signalled through
+ * Camera::bufferCompleted. This allows applications to capture streams at
+ * different frame rates with the same requests, and pipeline handlers to save
+ * memory bandwidth by disabling the corresponding hardware output for the
+ * skipped frames.
+ *
+ * A request always captures at least one buffer, buffers of decimated streams
+ * are not skipped when all the buffers of a request would be.
+ *
+ * The decimation factor defaults to 1. Values of 0 and 1 disable decimation.
+ */
+
+/**
+ * \var StreamConfiguration::zslFrames
+ * \brief Number of recent frames held for zero-shutter-lag captures
+ *
+ * Pipeline handlers that support zero-shutter-lag still captures, as reported
+ * by the controls::ZslFrameSequence control, hold the most recent frames of
+ * the stream in internal buffers, and fill requests that carry the
+ * controls::ZslFrameSequence or controls::ZslFrameTimestamp control from a
+ * held frame. Holding frames costs one internal buffer per frame.
+ *
+ * CameraConfiguration::validate() adjusts the value to the maximum number of
+ * frames the pipeline handler can hold for the stream, which is 0 for streams
+ * that don't support zero-shutter-lag. Pipeline handlers that don't support
+ * zero-shutter-lag at all ignore the value. It defaults to 0.
+ */
+
+/**
+ * \var StreamConfiguration::stallDuration
+ * \brief The processing time of a frame for the stream after its capture
+ *
+ * The stall duration, in nanoseconds, is the time the pipeline needs to
+ * process a frame for the stream once the frame has been captured by the
+ * sensor, and thus delays the completion of the buffers of the stream. It is
+ * 0 for streams produced while the frame is captured, such as raw streams or
+ * streams processed inline by the ISP. The stall duration is set by
+ * CameraConfiguration::validate() and ignored by Camera::configure().
+ */
+
 /**
  * \fn StreamConfiguration::stream()
  * \brief Retrieve the stream associated with the configuration
@@ -371,6 +458,15 @@ std::string StreamConfiguration::toString() const
  * The stream is intended to capture video for the purpose of display on the
  * local screen. Trade-offs between quality and usage of system resources are
  * acceptable.
+ * \var Raw
+ * The stream is intended to capture the raw frames produced by the image
+ * sensor, without processing. Raw streams may be captured alongside processed
+ * streams of the same frames.
+ * \var Reprocessing
+ * The stream is intended to feed raw frames from the application back to the
+ * camera, for instance frames captured earlier through a Raw stream, to
+ * process them with the camera ISP. The stream configuration is an input
+ * stream, see StreamConfiguration::direction.
  */
 
 /**
@@ -400,6 +496,7 @@ std::string StreamConfiguration::toString() const
  * \brief Construct a stream with default parameters
  */
 Stream::Stream()
+	: cpuAccess_(FrameBuffer::CpuAccessReadWrite)
 {
 }
 
@@ -409,6 +506,19 @@ Stream::Stream()
  * \return The active configuration of the stream
  */
 
+/**
+ * \fn Stream::cpuAccess()
+ * \brief Retrieve the CPU access pattern of the buffers allocated for the
+ * stream
+ *
+ * Pipeline handlers use the access pattern to skip cache maintenance
+ * operations when allocating buffers for the stream.
+ *
+ * \sa FrameBufferAllocator::allocate()
+ *
+ * \return The CPU access pattern of the stream buffers
+ */
+
 /**
  * \var Stream::configuration_
  * \brief The stream configuration
@@ -418,4 +528,12 @@ Stream::Stream()
  * next call to Camera::configure() regardless of if it includes the stream.
  */
 
+/**
+ * \var Stream::cpuAccess_
+ * \brief The CPU access pattern of the stream buffers
+ *
+ * The access pattern is set when buffers are allocated for the stream with a
+ * FrameBufferAllocator.
+ */
+
 } /* namespace libcamera */
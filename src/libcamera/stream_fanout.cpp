@@ -0,0 +1,283 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * stream_fanout.cpp - Share the buffers of a stream between multiple consumers
+ */
+
+#include <libcamera/stream_fanout.h>
+
+#include <algorithm>
+
+#include <libcamera/buffer.h>
+#include <libcamera/camera.h>
+#include <libcamera/request.h>
+
+#include "log.h"
+
+/**
+ * \file stream_fanout.h
+ * \brief Share the buffers of a stream between multiple consumers
+ */
+
+namespace libcamera {
+
+LOG_DEFINE_CATEGORY(StreamFanout)
+
+/**
+ * \class StreamFanout
+ * \brief Deliver the buffers of a stream to multiple consumers
+ *
+ * The StreamFanout class shares the frames captured for a stream between
+ * several independent consumers, such as a video encoder, an inference engine
+ * and a preview compositor, and tracks their usage of the buffers on behalf of
+ * the application.
+ *
+ * Consumers are registered with addConsumer(), with a handler called for each
+ * buffer of the stream. The handler runs in the thread of the consumer, which
+ * can thus process frames at its own pace. Requests are queued to the camera
+ * through queueRequest(). When a request completes, its buffer for the stream
+ * is handed to all consumers, which shall return it with release() when done.
+ * Once all consumers have released the buffer, the requestReleased signal is
+ * emitted, and the request can be reused and queued again. The buffer metadata
+ * stays valid until then, but FrameBuffer::request() returns nullptr as the
+ * request has completed.
+ *
+ * Requests that complete with an error, and requests that contain no buffer
+ * for the stream, are released immediately without being dispatched to the
+ * consumers. Requests queued through the fanout shall not be reused before
+ * the requestReleased signal is emitted for them, and the camera
+ * requestCompleted signal shall not be relied upon for those requests.
+ *
+ * The fanout keeps per-consumer statistics, retrieved with statistics(), to
+ * identify the consumers that hold buffers for the longest time and starve
+ * the camera.
+ */
+
+/**
+ * \struct StreamFanout::ConsumerStatistics
+ * \brief Buffer usage statistics of a consumer
+ * \var StreamFanout::ConsumerStatistics::name
+ * \brief The consumer name
+ * \var StreamFanout::ConsumerStatistics::buffers
+ * \brief The number of buffers delivered to the consumer
+ * \var StreamFanout::ConsumerStatistics::held
+ * \brief The number of buffers currently held by the consumer
+ * \var StreamFanout::ConsumerStatistics::totalHoldTime
+ * \brief The cumulated time the released buffers have been held for
+ * \var StreamFanout::ConsumerStatistics::maxHoldTime
+ * \brief The longest time a buffer has been held for
+ */
+
+/**
+ * \brief Create a fanout for a stream of a camera
+ * \param[in] camera The camera
+ * \param[in] stream The stream whose buffers to share
+ *
+ * The \a camera shall be configured with the \a stream. Other streams of the
+ * requests queued through the fanout are not dispatched, their buffers are
+ * available to the application until the request is released.
+ */
+StreamFanout::StreamFanout(std::shared_ptr<Camera> camera, Stream *stream)
+	: camera_(camera), stream_(stream), nextId_(0)
+{
+}
+
+StreamFanout::~StreamFanout()
+{
+	if (!dispatched_.empty())
+		LOG(StreamFanout, Warning)
+			<< "Destroying fanout with " << dispatched_.size()
+			<< " buffers held by consumers";
+}
+
+/**
+ * \fn StreamFanout::stream()
+ * \brief Retrieve the stream whose buffers are shared
+ * \return The stream
+ */
+
+/**
+ * \fn StreamFanout::addConsumer()
+ * \brief Register a consumer
+ * \param[in] name The consumer name, for statistics
+ * \param[in] receiver The object to deliver buffers to
+ * \param[in] func The method of \a receiver to call for each buffer
+ *
+ * The \a func method is called on \a receiver, in the thread of the receiver,
+ * for each buffer of the stream completed after the consumer is registered.
+ * The consumer shall release each buffer it receives with release().
+ *
+ * \return The consumer identifier
+ */
+
+StreamFanout::Consumer *StreamFanout::createConsumer(const std::string &name)
+{
+	std::unique_ptr<Consumer> consumer = std::make_unique<Consumer>();
+	consumer->id = nextId_++;
+	consumer->stats = { name, 0, 0, {}, {} };
+
+	Consumer *ptr = consumer.get();
+	consumers_[ptr->id] = std::move(consumer);
+
+	return ptr;
+}
+
+/**
+ * \brief Unregister a consumer
+ * \param[in] consumer The consumer identifier
+ *
+ * The buffers held by the \a consumer are released, and no buffer is delivered
+ * to the consumer anymore. Buffers already delivered to a consumer running in
+ * a different thread, but not processed yet, may still be received and shall
+ * be ignored.
+ */
+void StreamFanout::removeConsumer(unsigned int consumer)
+{
+	auto it = consumers_.find(consumer);
+	if (it == consumers_.end())
+		return;
+
+	std::unique_ptr<Consumer> removed = std::move(it->second);
+	consumers_.erase(it);
+
+	for (const auto &held : removed->held)
+		unref(held.first);
+}
+
+/**
+ * \brief Queue a request to the camera
+ * \param[in] request The request to queue
+ *
+ * The \a request is queued to the camera with a completion handler that
+ * dispatches its buffer for the stream to the consumers.
+ *
+ * \return 0 on success or a negative error code otherwise, as for
+ * Camera::queueRequest()
+ */
+int StreamFanout::queueRequest(Request *request)
+{
+	return camera_->queueRequest(request, this, &StreamFanout::requestComplete);
+}
+
+/**
+ * \brief Release a buffer held by a consumer
+ * \param[in] consumer The consumer identifier
+ * \param[in] buffer The buffer to release
+ *
+ * Consumers shall call this method when they are done with a \a buffer they
+ * received. The method is thread-safe, and may be called from the thread of
+ * the consumer.
+ */
+void StreamFanout::release(unsigned int consumer, FrameBuffer *buffer)
+{
+	invokeMethod(&StreamFanout::releaseBuffer, ConnectionTypeAuto,
+		     consumer, buffer);
+}
+
+/**
+ * \brief Retrieve the buffer usage statistics of the consumers
+ *
+ * The hold times are measured from the time a buffer is dispatched to the time
+ * the consumer releases it, and thus include the time spent by the buffer in
+ * the consumer's message queue.
+ *
+ * \return The statistics of all registered consumers, sorted by descending
+ * maximum hold time
+ */
+std::vector<StreamFanout::ConsumerStatistics> StreamFanout::statistics() const
+{
+	std::vector<ConsumerStatistics> stats;
+
+	for (const auto &it : consumers_) {
+		ConsumerStatistics s = it.second->stats;
+		s.held = it.second->held.size();
+		stats.push_back(s);
+	}
+
+	std::stable_sort(stats.begin(), stats.end(),
+			 [](const ConsumerStatistics &a, const ConsumerStatistics &b) {
+				 return a.maxHoldTime > b.maxHoldTime;
+			 });
+
+	return stats;
+}
+
+/**
+ * \var StreamFanout::requestReleased
+ * \brief Signal emitted when all consumers have released a request
+ *
+ * The request may be reused and queued again from the signal handler.
+ */
+
+void StreamFanout::requestComplete(Request *request)
+{
+	FrameBuffer *buffer = request->findBuffer(stream_);
+
+	if (!buffer || consumers_.empty() ||
+	    request->status() != Request::RequestComplete ||
+	    buffer->metadata().status != FrameMetadata::FrameSuccess) {
+		requestReleased.emit(request);
+		return;
+	}
+
+	/*
+	 * Take all the references before dispatching, as consumers running in
+	 * the same thread may release the buffer synchronously.
+	 */
+	clock::time_point now = clock::now();
+
+	dispatched_[buffer] = { request, static_cast<unsigned int>(consumers_.size()) };
+	for (auto &it : consumers_) {
+		Consumer *consumer = it.second.get();
+		consumer->held[buffer] = now;
+		consumer->stats.buffers++;
+	}
+
+	std::vector<unsigned int> ids;
+	for (const auto &it : consumers_)
+		ids.push_back(it.first);
+
+	for (unsigned int id : ids) {
+		auto it = consumers_.find(id);
+		if (it != consumers_.end())
+			it->second->bufferReady.emit(buffer);
+	}
+}
+
+void StreamFanout::releaseBuffer(unsigned int consumer, FrameBuffer *buffer)
+{
+	auto it = consumers_.find(consumer);
+	if (it == consumers_.end())
+		return;
+
+	Consumer *c = it->second.get();
+	auto held = c->held.find(buffer);
+	if (held == c->held.end()) {
+		LOG(StreamFanout, Warning)
+			<< "Consumer " << c->stats.name
+			<< " released a buffer it doesn't hold";
+		return;
+	}
+
+	std::chrono::microseconds time =
+		std::chrono::duration_cast<std::chrono::microseconds>(clock::now() - held->second);
+	c->stats.totalHoldTime += time;
+	c->stats.maxHoldTime = std::max(c->stats.maxHoldTime, time);
+	c->held.erase(held);
+
+	unref(buffer);
+}
+
+void StreamFanout::unref(FrameBuffer *buffer)
+{
+	auto it = dispatched_.find(buffer);
+	if (it == dispatched_.end() || --it->second.refs)
+		return;
+
+	Request *request = it->second.request;
+	dispatched_.erase(it);
+	requestReleased.emit(request);
+}
+
+} /* namespace libcamera */
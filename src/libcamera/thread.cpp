@@ -8,14 +8,18 @@
 #include "thread.h"
 
 #include <atomic>
-#include <list>
+#include <errno.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <sstream>
+#include <string.h>
 #include <unistd.h>
 #include <sys/syscall.h>
 #include <sys/types.h>
 
 #include <libcamera/event_dispatcher.h>
 
-#include "event_dispatcher_poll.h"
+#include "event_dispatcher_epoll.h"
 #include "log.h"
 #include "message.h"
 
@@ -32,16 +36,283 @@ class ThreadMain;
 
 /**
  * \brief A queue of posted messages
+ *
+ * Messages are posted from any thread with push(), which is lock-free, and
+ * stored in an intrusive stack. The thread owning the queue moves them to an
+ * intrusive FIFO list with collect() before dispatching them. The FIFO list is
+ * protected by the \ref mutex_, which is only taken by the owning thread and
+ * by the rare operations that need to remove messages from the queue.
+ *
+ * The queue is split in one lane per MessagePriority, each with its own stack
+ * and FIFO list. pop() returns messages from the highest priority non-empty
+ * lane. The dispatcher collects the realtime lane before every pop(), so that
+ * a realtime message posted while a long batch of normal messages is being
+ * dispatched overtakes the remainder of the batch.
+ *
+ * The FIFO lists are doubly linked, and the messages they contain are also
+ * linked in a per-receiver list stored in the receiver Object. Removing the
+ * messages of a receiver is thus proportional to the number of messages
+ * pending for that receiver, not to the size of the queue.
  */
 class MessageQueue
 {
 public:
+	static constexpr unsigned int NumLanes = ThreadStatistics::Lanes;
+
+	/**
+	 * \brief A message queue lane for one priority level
+	 */
+	struct Lane {
+		Lane()
+			: stack(nullptr), first(nullptr), last(nullptr), size(0)
+		{
+		}
+
+		/**
+		 * \brief Stack of posted messages, in LIFO order
+		 */
+		std::atomic<Message *> stack;
+		/**
+		 * \brief First message of the FIFO list
+		 */
+		Message *first;
+		/**
+		 * \brief Last message of the FIFO list
+		 */
+		Message *last;
+		/**
+		 * \brief Number of messages in the FIFO list
+		 */
+		unsigned int size;
+	};
+
+	~MessageQueue()
+	{
+		/*
+		 * Delete the remaining messages without touching their
+		 * receivers, which may have been destroyed already.
+		 */
+		for (Lane &lane : lanes_) {
+			Message *msg = lane.stack.exchange(nullptr, std::memory_order_acquire);
+			while (msg) {
+				Message *next = msg->next_;
+				delete msg;
+				msg = next;
+			}
+
+			msg = lane.first;
+			while (msg) {
+				Message *next = msg->next_;
+				delete msg;
+				msg = next;
+			}
+		}
+	}
+
+	/**
+	 * \brief Push a message to the queue
+	 * \param[in] msg The message
+	 * \return True if the lane of posted messages was empty
+	 */
+	bool push(Message *msg)
+	{
+		std::atomic<Message *> &stack = lanes_[msg->priority_].stack;
+
+		Message *head = stack.load(std::memory_order_relaxed);
+		do {
+			msg->next_ = head;
+		} while (!stack.compare_exchange_weak(head, msg,
+						      std::memory_order_release,
+						      std::memory_order_relaxed));
+
+		return !head;
+	}
+
+	/**
+	 * \brief Move all posted messages to the FIFO lists
+	 *
+	 * The caller shall hold the \ref mutex_.
+	 */
+	void collect()
+	{
+		for (unsigned int i = NumLanes; i > 0; --i)
+			collect(lanes_[i - 1]);
+	}
+
+	/**
+	 * \brief Move the posted messages of a lane to its FIFO list
+	 * \param[in] lane The lane
+	 *
+	 * The caller shall hold the \ref mutex_.
+	 *
+	 * \return True if messages have been collected, false otherwise
+	 */
+	bool collect(Lane &lane)
+	{
+		Message *msg = lane.stack.exchange(nullptr, std::memory_order_acquire);
+		if (!msg)
+			return false;
+
+		/* The stack is in LIFO order, reverse it. */
+		Message *first = nullptr;
+		while (msg) {
+			Message *next = msg->next_;
+			msg->next_ = first;
+			first = msg;
+			msg = next;
+		}
+
+		while (first) {
+			Message *next = first->next_;
+			append(first);
+			first = next;
+		}
+
+		return true;
+	}
+
+	/**
+	 * \brief Append a message to its lane's FIFO list and to its receiver's
+	 * list
+	 * \param[in] msg The message
+	 *
+	 * The caller shall hold the \ref mutex_.
+	 */
+	void append(Message *msg)
+	{
+		Lane &lane = lanes_[msg->priority_];
+
+		msg->next_ = nullptr;
+		msg->prev_ = lane.last;
+		if (lane.last)
+			lane.last->next_ = msg;
+		else
+			lane.first = msg;
+		lane.last = msg;
+		lane.size++;
+
+		Object *receiver = msg->receiver_;
+		msg->receiverNext_ = nullptr;
+		if (receiver->lastMessage_)
+			receiver->lastMessage_->receiverNext_ = msg;
+		else
+			receiver->firstMessage_ = msg;
+		receiver->lastMessage_ = msg;
+	}
+
+	/**
+	 * \brief Remove a message from its lane's FIFO list
+	 * \param[in] msg The message
+	 *
+	 * The message is left in its receiver's list. The caller shall hold the
+	 * \ref mutex_.
+	 */
+	void unlink(Message *msg)
+	{
+		Lane &lane = lanes_[msg->priority_];
+
+		if (msg->prev_)
+			msg->prev_->next_ = msg->next_;
+		else
+			lane.first = msg->next_;
+
+		if (msg->next_)
+			msg->next_->prev_ = msg->prev_;
+		else
+			lane.last = msg->prev_;
+
+		msg->prev_ = nullptr;
+		lane.size--;
+	}
+
+	/**
+	 * \brief Remove the first message of the highest priority lane
+	 *
+	 * The caller shall hold the \ref mutex_.
+	 *
+	 * \return The message, or nullptr if all FIFO lists are empty
+	 */
+	Message *pop()
+	{
+		Message *msg = nullptr;
+		for (unsigned int i = NumLanes; i > 0 && !msg; --i)
+			msg = lanes_[i - 1].first;
+		if (!msg)
+			return nullptr;
+
+		unlink(msg);
+		msg->next_ = nullptr;
+
+		/*
+		 * The oldest message of a lane is usually also the oldest one of
+		 * its receiver, unless a higher priority message overtook lower
+		 * priority ones.
+		 */
+		Object *receiver = msg->receiver_;
+		Message *prev = nullptr;
+		Message *cur = receiver->firstMessage_;
+		while (cur != msg) {
+			prev = cur;
+			cur = cur->receiverNext_;
+			ASSERT(cur);
+		}
+
+		if (prev)
+			prev->receiverNext_ = msg->receiverNext_;
+		else
+			receiver->firstMessage_ = msg->receiverNext_;
+		if (receiver->lastMessage_ == msg)
+			receiver->lastMessage_ = prev;
+		msg->receiverNext_ = nullptr;
+
+		return msg;
+	}
+
+	/**
+	 * \brief Remove all messages for a receiver from the FIFO lists
+	 * \param[in] receiver The receiver
+	 *
+	 * The caller shall hold the \ref mutex_ and have collected the posted
+	 * messages.
+	 *
+	 * \return The chain of removed messages, in the receiver's order
+	 */
+	Message *extract(Object *receiver)
+	{
+		Message *removed = receiver->firstMessage_;
+
+		for (Message *msg = removed; msg; msg = msg->receiverNext_) {
+			unlink(msg);
+			msg->next_ = msg->receiverNext_;
+		}
+
+		receiver->firstMessage_ = nullptr;
+		receiver->lastMessage_ = nullptr;
+
+		return removed;
+	}
+
 	/**
-	 * \brief List of queued Message instances
+	 * \brief Retrieve the total number of messages in the FIFO lists
+	 *
+	 * The caller shall hold the \ref mutex_.
+	 *
+	 * \return The number of messages in the FIFO lists
 	 */
-	std::list<std::unique_ptr<Message>> list_;
+	unsigned int size() const
+	{
+		unsigned int size = 0;
+		for (const Lane &lane : lanes_)
+			size += lane.size;
+		return size;
+	}
+
 	/**
-	 * \brief Protects the \ref list_
+	 * \brief The queue lanes, indexed by MessagePriority
+	 */
+	std::array<Lane, NumLanes> lanes_;
+	/**
+	 * \brief Protects the FIFO lists
 	 */
 	Mutex mutex_;
 };
@@ -53,7 +324,9 @@ class ThreadData
 {
 public:
 	ThreadData()
-		: thread_(nullptr), running_(false), dispatcher_(nullptr)
+		: thread_(nullptr), running_(false), tid_(0),
+		  policy_(Thread::SchedulingPolicyDefault), priority_(0),
+		  dispatcher_(nullptr)
 	{
 	}
 
@@ -69,12 +342,21 @@ private:
 
 	Mutex mutex_;
 
+	std::string name_;
+	Thread::SchedulingPolicy policy_;
+	int priority_;
+	std::vector<unsigned int> cpus_;
+
 	std::atomic<EventDispatcher *> dispatcher_;
 
 	std::atomic<bool> exit_;
 	int exitCode_;
 
 	MessageQueue messages_;
+
+	Mutex statsMutex_;
+	ThreadStatistics stats_;
+	utils::duration statsInterval_;
 };
 
 /**
@@ -112,7 +394,9 @@ ThreadData *ThreadData::current()
 	 * started, set it here.
 	 */
 	ThreadData *data = mainThread.data_;
+	data->mutex_.lock();
 	data->tid_ = syscall(SYS_gettid);
+	data->mutex_.unlock();
 	currentThreadData = data;
 	return data;
 }
@@ -127,6 +411,153 @@ ThreadData *ThreadData::current()
  * \brief An alias for std::unique_lock<std::mutex>
  */
 
+/**
+ * \struct ThreadStatistics
+ * \brief Event loop statistics of a thread
+ *
+ * The ThreadStatistics structure stores counters describing the activity of a
+ * thread's event loop over an interval of time, which starts when the
+ * statistics are reset. They help identifying whether a thread is overloaded,
+ * blocked in a handler, or accumulates a backlog of messages.
+ *
+ * Handlers cover the dispatching of messages (including queued method
+ * invocations and signals delivered across threads), and the event notifier
+ * and timer callbacks.
+ *
+ * \var ThreadStatistics::LatencyBuckets
+ * \brief Number of buckets of the latency histogram
+ *
+ * \var ThreadStatistics::Lanes
+ * \brief Number of message queue lanes, one per MessagePriority
+ *
+ * \var ThreadStatistics::start
+ * \brief Start time of the statistics interval
+ *
+ * \var ThreadStatistics::messages
+ * \brief Number of messages dispatched
+ *
+ * \var ThreadStatistics::maxQueueDepth
+ * \brief Maximum number of messages waiting in the queue for dispatch
+ *
+ * \var ThreadStatistics::maxLaneDepth
+ * \brief Maximum number of messages waiting for dispatch, per priority lane
+ *
+ * The array is indexed by MessagePriority.
+ *
+ * \var ThreadStatistics::latency
+ * \brief Histogram of the delay between posting and dispatching messages
+ *
+ * Bucket \a i counts the messages whose latency was lower than
+ * latencyBucketLimit(i) and not lower than the limit of the previous bucket.
+ * The last bucket also counts all larger latencies.
+ *
+ * \var ThreadStatistics::busyTime
+ * \brief Total time spent in handlers
+ *
+ * \var ThreadStatistics::sleepTime
+ * \brief Total time spent waiting for events
+ *
+ * \var ThreadStatistics::slowestHandler
+ * \brief Duration of the slowest handler
+ *
+ * \var ThreadStatistics::busyPollHits
+ * \brief Number of events caught by the event dispatcher while busy polling
+ *
+ * \var ThreadStatistics::busyPollMisses
+ * \brief Number of busy polling windows that expired without an event
+ *
+ * \var ThreadStatistics::busyPollTime
+ * \brief Total time spent busy polling, at the cost of CPU time
+ *
+ * \var ThreadStatistics::busyPollSaved
+ * \brief Estimated wake-up latency saved by busy polling
+ *
+ * The estimate sums the wake-up latency of the thread, measured on timer
+ * expirations, for every event caught while busy polling.
+ */
+
+/**
+ * \brief Construct zeroed statistics starting now
+ */
+ThreadStatistics::ThreadStatistics()
+	: start(utils::clock::now()), messages(0), maxQueueDepth(0), maxLaneDepth({}),
+	  latency({}),
+	  busyTime(0), sleepTime(0), slowestHandler(0), busyPollHits(0),
+	  busyPollMisses(0), busyPollTime(0), busyPollSaved(0)
+{
+}
+
+/**
+ * \brief Retrieve the upper limit of a latency histogram bucket
+ * \param[in] bucket The bucket index
+ *
+ * Buckets limits are powers of two, starting at 1µs.
+ *
+ * \return The upper limit of the bucket, exclusive
+ */
+utils::duration ThreadStatistics::latencyBucketLimit(unsigned int bucket)
+{
+	return std::chrono::microseconds(1ULL << bucket);
+}
+
+/**
+ * \brief Estimate a percentile of the message latency
+ * \param[in] percentile The percentile, between 0 and 100
+ *
+ * The estimate is the upper limit of the histogram bucket that contains the
+ * percentile, and thus has the precision of the histogram.
+ *
+ * \return The latency percentile, or 0 if no message has been dispatched
+ */
+utils::duration ThreadStatistics::latencyPercentile(unsigned int percentile) const
+{
+	uint64_t count = 0;
+	for (uint64_t value : latency)
+		count += value;
+
+	if (!count)
+		return utils::duration(0);
+
+	uint64_t target = (count * std::min(percentile, 100U) + 99) / 100;
+	uint64_t total = 0;
+
+	for (unsigned int i = 0; i < LatencyBuckets; ++i) {
+		total += latency[i];
+		if (total >= target && total)
+			return latencyBucketLimit(i);
+	}
+
+	return latencyBucketLimit(LatencyBuckets - 1);
+}
+
+/**
+ * \brief Assemble and return a string describing the statistics
+ * \return A string describing the statistics
+ */
+std::string ThreadStatistics::toString() const
+{
+	auto us = [](utils::duration d) {
+		return std::chrono::duration_cast<std::chrono::microseconds>(d).count();
+	};
+
+	std::stringstream ss;
+	ss << messages << " messages, max queue depth " << maxQueueDepth
+	   << " (normal " << maxLaneDepth[MessagePriorityNormal]
+	   << ", realtime " << maxLaneDepth[MessagePriorityRealtime] << ")"
+	   << ", latency p50 " << us(latencyPercentile(50))
+	   << "us p90 " << us(latencyPercentile(90))
+	   << "us p99 " << us(latencyPercentile(99))
+	   << "us, busy " << us(busyTime) << "us, asleep " << us(sleepTime)
+	   << "us, slowest handler " << us(slowestHandler) << "us";
+
+	if (busyPollHits || busyPollMisses)
+		ss << ", busy poll " << busyPollHits << " hits "
+		   << busyPollMisses << " misses, spinning " << us(busyPollTime)
+		   << "us, saved " << us(busyPollSaved) << "us";
+
+	return ss.str();
+}
+
 /**
  * \class Thread
  * \brief A thread of execution
@@ -136,8 +567,14 @@ ThreadData *ThreadData::current()
  *
  * Thread instances by default run an event loop until the exit() method is
  * called. A custom event dispatcher may be installed with
- * setEventDispatcher(), otherwise a poll-based event dispatcher is used. This
+ * setEventDispatcher(), otherwise an epoll-based event dispatcher is used. This
  * behaviour can be overriden by overloading the run() method.
+ *
+ * The thread name, scheduling policy and CPU affinity can be configured with
+ * setName(), setSchedulingPolicy() and setAffinity(). Attributes set before
+ * the thread is started are applied when it starts, before run() is called.
+ * This applies to the main thread too, which allows configuring the thread in
+ * which the CameraManager dispatches events.
  */
 
 /**
@@ -147,6 +584,7 @@ Thread::Thread()
 {
 	data_ = new ThreadData;
 	data_->thread_ = this;
+	data_->statsInterval_ = utils::duration(0);
 }
 
 Thread::~Thread()
@@ -155,6 +593,197 @@ Thread::~Thread()
 	delete data_;
 }
 
+/**
+ * \enum Thread::SchedulingPolicy
+ * \brief Scheduling policy of a thread
+ * \var Thread::SchedulingPolicyDefault
+ * The default time-sharing scheduling policy (SCHED_OTHER)
+ * \var Thread::SchedulingPolicyFifo
+ * The first-in first-out real-time scheduling policy (SCHED_FIFO)
+ * \var Thread::SchedulingPolicyRoundRobin
+ * The round-robin real-time scheduling policy (SCHED_RR)
+ */
+
+/**
+ * \brief Set the thread name
+ * \param[in] name The thread name
+ *
+ * The name is visible to system tools such as ps or top, and is truncated to
+ * 15 characters. If the thread is running the name is applied immediately,
+ * otherwise it is applied when the thread is started.
+ *
+ * \return 0 on success or a negative error code otherwise
+ */
+int Thread::setName(const std::string &name)
+{
+	MutexLocker locker(data_->mutex_);
+
+	data_->name_ = name.substr(0, 15);
+
+	if (!data_->running_ || !data_->tid_)
+		return 0;
+
+	return applyName(data_->tid_);
+}
+
+/**
+ * \brief Set the thread scheduling policy and priority
+ * \param[in] policy The scheduling policy
+ * \param[in] priority The static priority for real-time policies
+ *
+ * Real-time policies run the thread in preference to all threads using the
+ * default policy, which lowers the latency of event processing when the system
+ * is loaded. The \a priority shall be in the range reported by
+ * sched_get_priority_min() and sched_get_priority_max() for real-time
+ * policies, and 0 for the default policy. Selecting a real-time policy
+ * typically requires the CAP_SYS_NICE capability or an appropriate
+ * RLIMIT_RTPRIO.
+ *
+ * If the thread is running the policy is applied immediately, otherwise it is
+ * applied when the thread is started. Errors occurring at thread start time
+ * are logged.
+ *
+ * \return 0 on success or a negative error code otherwise
+ * \retval -EINVAL The priority is out of range for the policy
+ * \retval -EPERM The caller isn't allowed to set the policy
+ */
+int Thread::setSchedulingPolicy(SchedulingPolicy policy, int priority)
+{
+	int min = 0;
+	int max = 0;
+
+	switch (policy) {
+	case SchedulingPolicyDefault:
+		break;
+	case SchedulingPolicyFifo:
+		min = sched_get_priority_min(SCHED_FIFO);
+		max = sched_get_priority_max(SCHED_FIFO);
+		break;
+	case SchedulingPolicyRoundRobin:
+		min = sched_get_priority_min(SCHED_RR);
+		max = sched_get_priority_max(SCHED_RR);
+		break;
+	}
+
+	if (priority < min || priority > max)
+		return -EINVAL;
+
+	MutexLocker locker(data_->mutex_);
+
+	data_->policy_ = policy;
+	data_->priority_ = priority;
+
+	if (!data_->running_ || !data_->tid_)
+		return 0;
+
+	return applySchedulingPolicy(data_->tid_);
+}
+
+/**
+ * \brief Set the CPU affinity of the thread
+ * \param[in] cpus The list of CPUs the thread is allowed to run on
+ *
+ * Restrict the thread to run on the \a cpus only. An empty list allows the
+ * thread to run on all CPUs. If the thread is running the affinity is applied
+ * immediately, otherwise it is applied when the thread is started. Errors
+ * occurring at thread start time are logged.
+ *
+ * \return 0 on success or a negative error code otherwise
+ * \retval -EINVAL The list contains an invalid CPU number, or none of the
+ * CPUs is available
+ */
+int Thread::setAffinity(const std::vector<unsigned int> &cpus)
+{
+	for (unsigned int cpu : cpus) {
+		if (cpu >= CPU_SETSIZE)
+			return -EINVAL;
+	}
+
+	MutexLocker locker(data_->mutex_);
+
+	data_->cpus_ = cpus;
+
+	if (!data_->running_ || !data_->tid_)
+		return 0;
+
+	return applyAffinity(data_->tid_);
+}
+
+int Thread::applyName(pid_t tid)
+{
+	std::string path = "/proc/self/task/" + std::to_string(tid) + "/comm";
+	int ret = 0;
+
+	int fd = ::open(path.c_str(), O_WRONLY | O_CLOEXEC);
+	if (fd < 0 ||
+	    ::write(fd, data_->name_.c_str(), data_->name_.size()) < 0)
+		ret = -errno;
+
+	if (fd >= 0)
+		::close(fd);
+
+	if (ret < 0)
+		LOG(Thread, Warning)
+			<< "Failed to set thread name: " << strerror(-ret);
+
+	return ret;
+}
+
+int Thread::applySchedulingPolicy(pid_t tid)
+{
+	struct sched_param param = {};
+	int policy;
+
+	switch (data_->policy_) {
+	case SchedulingPolicyDefault:
+	default:
+		policy = SCHED_OTHER;
+		break;
+	case SchedulingPolicyFifo:
+		policy = SCHED_FIFO;
+		break;
+	case SchedulingPolicyRoundRobin:
+		policy = SCHED_RR;
+		break;
+	}
+
+	param.sched_priority = data_->priority_;
+
+	int ret = sched_setscheduler(tid, policy, &param);
+	if (ret < 0) {
+		ret = -errno;
+		LOG(Thread, Warning)
+			<< "Failed to set scheduling policy: " << strerror(-ret);
+		return ret;
+	}
+
+	return 0;
+}
+
+int Thread::applyAffinity(pid_t tid)
+{
+	cpu_set_t cpuset;
+	CPU_ZERO(&cpuset);
+
+	if (data_->cpus_.empty()) {
+		for (unsigned int cpu = 0; cpu < CPU_SETSIZE; ++cpu)
+			CPU_SET(cpu, &cpuset);
+	} else {
+		for (unsigned int cpu : data_->cpus_)
+			CPU_SET(cpu, &cpuset);
+	}
+
+	int ret = sched_setaffinity(tid, sizeof(cpuset), &cpuset);
+	if (ret < 0) {
+		ret = -errno;
+		LOG(Thread, Warning)
+			<< "Failed to set CPU affinity: " << strerror(-ret);
+		return ret;
+	}
+
+	return 0;
+}
+
 /**
  * \brief Start the thread
  */
@@ -166,6 +795,7 @@ void Thread::start()
 		return;
 
 	data_->running_ = true;
+	data_->tid_ = 0;
 	data_->exitCode_ = -1;
 	data_->exit_.store(false, std::memory_order_relaxed);
 
@@ -194,9 +824,27 @@ void Thread::startThread()
 	 */
 	thread_local ThreadCleaner cleaner(this, &Thread::finishThread);
 
-	data_->tid_ = syscall(SYS_gettid);
+	pid_t tid = syscall(SYS_gettid);
+
+	/*
+	 * Apply the thread attributes set before the thread was started.
+	 * Attributes set after the TID is published are applied directly by
+	 * the setters.
+	 */
+	MutexLocker locker(data_->mutex_);
+
+	data_->tid_ = tid;
 	currentThreadData = data_;
 
+	if (!data_->name_.empty())
+		applyName(tid);
+	if (data_->policy_ != SchedulingPolicyDefault)
+		applySchedulingPolicy(tid);
+	if (!data_->cpus_.empty())
+		applyAffinity(tid);
+
+	locker.unlock();
+
 	run();
 }
 
@@ -336,7 +984,7 @@ pid_t Thread::currentId()
  * event notification and timers with the loop. Users that want to provide
  * their own event dispatcher shall call this method once and only once before
  * the thread is started with start(). If no event dispatcher is provided, a
- * default poll-based implementation will be used.
+ * default epoll-based implementation will be used.
  *
  * The Thread takes ownership of the event dispatcher and will delete it when
  * the thread is destroyed.
@@ -356,8 +1004,9 @@ void Thread::setEventDispatcher(std::unique_ptr<EventDispatcher> dispatcher)
  * \brief Retrieve the event dispatcher
  *
  * This method retrieves the event dispatcher set with setEventDispatcher().
- * If no dispatcher has been set, a default poll-based implementation is created
- * and returned, and no custom event dispatcher may be installed anymore.
+ * If no dispatcher has been set, a default epoll-based implementation is
+ * created and returned, and no custom event dispatcher may be installed
+ * anymore.
  *
  * The returned event dispatcher is valid until the thread is destroyed.
  *
@@ -366,7 +1015,7 @@ void Thread::setEventDispatcher(std::unique_ptr<EventDispatcher> dispatcher)
 EventDispatcher *Thread::eventDispatcher()
 {
 	if (!data_->dispatcher_.load(std::memory_order_relaxed))
-		data_->dispatcher_.store(new EventDispatcherPoll(),
+		data_->dispatcher_.store(new EventDispatcherEpoll(),
 					 std::memory_order_release);
 
 	return data_->dispatcher_.load(std::memory_order_relaxed);
@@ -392,13 +1041,19 @@ EventDispatcher *Thread::eventDispatcher()
 void Thread::postMessage(std::unique_ptr<Message> msg, Object *receiver)
 {
 	msg->receiver_ = receiver;
+	msg->posted_ = utils::clock::now();
 
 	ASSERT(data_ == receiver->thread()->data_);
 
-	MutexLocker locker(data_->messages_.mutex_);
-	data_->messages_.list_.push_back(std::move(msg));
 	receiver->pendingMessages_++;
-	locker.unlock();
+
+	/*
+	 * Only wake up the event loop when the queue goes from empty to
+	 * non-empty, the thread will dispatch all queued messages when it
+	 * wakes up.
+	 */
+	if (!data_->messages_.push(msg.release()))
+		return;
 
 	EventDispatcher *dispatcher =
 		data_->dispatcher_.load(std::memory_order_acquire);
@@ -420,51 +1075,206 @@ void Thread::removeMessages(Object *receiver)
 	if (!receiver->pendingMessages_)
 		return;
 
-	std::vector<std::unique_ptr<Message>> toDelete;
-	for (std::unique_ptr<Message> &msg : data_->messages_.list_) {
-		if (!msg)
-			continue;
-		if (msg->receiver_ != receiver)
-			continue;
+	/*
+	 * Extract the messages to delete them after releasing the lock, as
+	 * deleting a message may post new messages.
+	 */
+	data_->messages_.collect();
+	Message *msg = data_->messages_.extract(receiver);
+	locker.unlock();
 
-		/*
-		 * Move the message to the pending deletion list to delete it
-		 * after releasing the lock. The messages list element will
-		 * contain a null pointer, and will be removed when dispatching
-		 * messages.
-		 */
-		toDelete.push_back(std::move(msg));
+	while (msg) {
+		Message *next = msg->next_;
 		receiver->pendingMessages_--;
+		delete msg;
+		msg = next;
 	}
 
 	ASSERT(!receiver->pendingMessages_);
-	locker.unlock();
-
-	toDelete.clear();
 }
 
 /**
  * \brief Dispatch all posted messages for this thread
+ *
+ * Event dispatchers shall not block waiting for events when messages have
+ * been dispatched, as the message handlers may have changed the state the
+ * caller of EventDispatcher::processEvents() waits for.
+ *
+ * \return The number of messages dispatched
  */
-void Thread::dispatchMessages()
+unsigned int Thread::dispatchMessages()
 {
+	ThreadStatistics stats;
+	utils::time_point now = utils::clock::now();
+
 	MutexLocker locker(data_->messages_.mutex_);
 
-	while (!data_->messages_.list_.empty()) {
-		std::unique_ptr<Message> msg = std::move(data_->messages_.list_.front());
-		data_->messages_.list_.pop_front();
-		if (!msg)
-			continue;
+	MessageQueue &queue = data_->messages_;
+	auto updateDepth = [&]() {
+		stats.maxQueueDepth = std::max(stats.maxQueueDepth, queue.size());
+		for (unsigned int i = 0; i < MessageQueue::NumLanes; ++i)
+			stats.maxLaneDepth[i] = std::max(stats.maxLaneDepth[i],
+							 queue.lanes_[i].size);
+	};
 
-		Object *receiver = msg->receiver_;
+	updateDepth();
+
+	while (true) {
+		if (queue.collect(queue.lanes_[MessagePriorityRealtime]))
+			updateDepth();
+
+		Message *msg = queue.pop();
+		if (!msg) {
+			queue.collect();
+			updateDepth();
+			msg = queue.pop();
+			if (!msg)
+				break;
+		}
+
+		std::unique_ptr<Message> message(msg);
+
+		Object *receiver = message->receiver_;
 		ASSERT(data_ == receiver->thread()->data_);
 
 		receiver->pendingMessages_--;
 
 		locker.unlock();
-		receiver->message(msg.get());
+
+		utils::duration latency = now - message->posted_;
+		unsigned int bucket = 0;
+		while (bucket < ThreadStatistics::LatencyBuckets - 1 &&
+		       latency >= ThreadStatistics::latencyBucketLimit(bucket))
+			bucket++;
+		stats.latency[bucket]++;
+		stats.messages++;
+
+		if (message->type() == Message::DeferredDelete)
+			delete receiver;
+		else
+			receiver->message(message.get());
+		message.reset();
+
+		utils::time_point end = utils::clock::now();
+		stats.busyTime += end - now;
+		stats.slowestHandler = std::max(stats.slowestHandler, end - now);
+		now = end;
+
 		locker.lock();
 	}
+
+	locker.unlock();
+
+	MutexLocker statsLocker(data_->statsMutex_);
+	ThreadStatistics &total = data_->stats_;
+
+	total.messages += stats.messages;
+	total.maxQueueDepth = std::max(total.maxQueueDepth, stats.maxQueueDepth);
+	for (unsigned int i = 0; i < ThreadStatistics::Lanes; ++i)
+		total.maxLaneDepth[i] = std::max(total.maxLaneDepth[i],
+						 stats.maxLaneDepth[i]);
+	for (unsigned int i = 0; i < ThreadStatistics::LatencyBuckets; ++i)
+		total.latency[i] += stats.latency[i];
+	total.busyTime += stats.busyTime;
+	total.slowestHandler = std::max(total.slowestHandler, stats.slowestHandler);
+
+	/* Log and reset the statistics periodically if requested. */
+	if (data_->statsInterval_ == utils::duration(0) ||
+	    now - total.start < data_->statsInterval_)
+		return stats.messages;
+
+	std::string report = total.toString();
+	total = ThreadStatistics();
+	statsLocker.unlock();
+
+	LOG(Thread, Info) << "Event loop statistics: " << report;
+
+	return stats.messages;
+}
+
+/**
+ * \brief Retrieve the event loop statistics of the thread
+ * \param[in] reset Reset the statistics after retrieving them
+ *
+ * This method may be called from any thread. Resetting the statistics starts
+ * a new statistics interval.
+ *
+ * \return The statistics accumulated since the last reset
+ */
+ThreadStatistics Thread::statistics(bool reset)
+{
+	MutexLocker locker(data_->statsMutex_);
+
+	ThreadStatistics stats = data_->stats_;
+	if (reset)
+		data_->stats_ = ThreadStatistics();
+
+	return stats;
+}
+
+/**
+ * \brief Log the event loop statistics periodically
+ * \param[in] interval The logging interval, or 0 to disable logging
+ *
+ * When an interval is set, the thread logs its statistics with the Info level
+ * and resets them every \a interval. The log is emitted from the thread's
+ * event loop, an idle thread thus doesn't log statistics until it wakes up.
+ */
+void Thread::setStatisticsInterval(utils::duration interval)
+{
+	MutexLocker locker(data_->statsMutex_);
+
+	data_->statsInterval_ = interval;
+	data_->stats_ = ThreadStatistics();
+}
+
+/**
+ * \brief Account time spent waiting for events
+ * \param[in] duration The wait duration
+ *
+ * This method is meant to be called by event dispatchers from the thread they
+ * belong to.
+ */
+void Thread::recordSleep(utils::duration duration)
+{
+	MutexLocker locker(data_->statsMutex_);
+	data_->stats_.sleepTime += duration;
+}
+
+/**
+ * \brief Account time spent in an event handler
+ * \param[in] duration The handler duration
+ *
+ * This method is meant to be called by event dispatchers from the thread they
+ * belong to, for each event notifier or timer handler they call.
+ */
+void Thread::recordHandler(utils::duration duration)
+{
+	MutexLocker locker(data_->statsMutex_);
+	data_->stats_.busyTime += duration;
+	data_->stats_.slowestHandler = std::max(data_->stats_.slowestHandler,
+						duration);
+}
+
+/**
+ * \brief Account time spent busy polling for events
+ * \param[in] duration The busy polling duration
+ * \param[in] hit True if an event was caught, false if the window expired
+ * \param[in] saved The wake-up latency saved by catching the event
+ *
+ * This method is meant to be called by event dispatchers from the thread they
+ * belong to.
+ */
+void Thread::recordBusyPoll(utils::duration duration, bool hit,
+			    utils::duration saved)
+{
+	MutexLocker locker(data_->statsMutex_);
+	data_->stats_.busyPollTime += duration;
+	data_->stats_.busyPollSaved += saved;
+	if (hit)
+		data_->stats_.busyPollHits++;
+	else
+		data_->stats_.busyPollMisses++;
 }
 
 /**
@@ -488,19 +1298,17 @@ void Thread::moveObject(Object *object, ThreadData *currentData,
 {
 	/* Move pending messages to the message queue of the new thread. */
 	if (object->pendingMessages_) {
-		unsigned int movedMessages = 0;
-
-		for (std::unique_ptr<Message> &msg : currentData->messages_.list_) {
-			if (!msg)
-				continue;
-			if (msg->receiver_ != object)
-				continue;
+		currentData->messages_.collect();
+		Message *msg = currentData->messages_.extract(object);
 
-			targetData->messages_.list_.push_back(std::move(msg));
-			movedMessages++;
-		}
+		if (msg) {
+			targetData->messages_.collect();
+			while (msg) {
+				Message *next = msg->next_;
+				targetData->messages_.append(msg);
+				msg = next;
+			}
 
-		if (movedMessages) {
 			EventDispatcher *dispatcher =
 				targetData->dispatcher_.load(std::memory_order_acquire);
 			if (dispatcher)
@@ -7,6 +7,7 @@
 
 #include <libcamera/timer.h>
 
+#include <algorithm>
 #include <chrono>
 
 #include <libcamera/camera_manager.h>
@@ -42,6 +43,13 @@ LOG_DEFINE_CATEGORY(Timer)
  * past, the timer will time out immediately when execution returns to the
  * event loop of the timer's thread.
  *
+ * Not all timers need to time out precisely at their deadline. Timers that
+ * can tolerate a delay, such as watchdogs or timers that batch housekeeping
+ * work, should declare it with setSlack(). The event dispatcher then
+ * coalesces their expiration with other wake-ups of the thread. This reduces
+ * the number of idle wake-ups, which matters on battery-powered devices.
+ * Timers have no slack by default.
+ *
  * Timers run in the thread they belong to, and thus emit the \a ref timeout
  * signal from that thread. To avoid race conditions they must not be started
  * or stopped from a different thread, attempts to do so will be rejected and
@@ -53,7 +61,7 @@ LOG_DEFINE_CATEGORY(Timer)
  * \param[in] parent The parent Object
  */
 Timer::Timer(Object *parent)
-	: Object(parent), running_(false)
+	: Object(parent), running_(false), slack_(0)
 {
 }
 
@@ -158,6 +166,26 @@ bool Timer::isRunning() const
  * \return The timer deadline
  */
 
+/**
+ * \brief Set the timer slack
+ * \param[in] slack The maximum delay tolerated after the deadline
+ *
+ * The timer slack allows the event dispatcher to delay the timeout by up to
+ * \a slack after the deadline, in order to coalesce it with other wake-ups.
+ * The timeout is never emitted before the deadline. The slack should be set
+ * before starting the timer.
+ */
+void Timer::setSlack(std::chrono::microseconds slack)
+{
+	slack_ = std::max(slack, std::chrono::microseconds(0));
+}
+
+/**
+ * \fn Timer::slack()
+ * \brief Retrieve the timer slack
+ * \return The timer slack
+ */
+
 /**
  * \var Timer::timeout
  * \brief Signal emitted when the timer times out
@@ -0,0 +1,197 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * timer_queue.cpp - Priority queue of timers for event dispatchers
+ */
+
+#include "timer_queue.h"
+
+#include <algorithm>
+#include <chrono>
+
+#include <libcamera/timer.h>
+
+/**
+ * \file timer_queue.h
+ * \brief Priority queue of timers for event dispatchers
+ */
+
+namespace libcamera {
+
+namespace {
+
+bool laterDeadline(const Timer *a, const Timer *b)
+{
+	return a->deadline() > b->deadline();
+}
+
+} /* namespace */
+
+/**
+ * \class TimerQueue
+ * \brief Store running timers ordered by deadline
+ *
+ * The TimerQueue class stores the timers registered with an event dispatcher
+ * in a binary heap ordered by deadline. Inserting a timer and expiring the
+ * next timer have a logarithmic complexity, and the storage is reused once it
+ * has grown to the maximum number of simultaneously running timers, avoiding
+ * memory allocations when timers are restarted at a high rate.
+ *
+ * Timers with a slack can be expired together at a shared wake-up time, given
+ * by wakeup(), to reduce the number of wake-ups of the event loop.
+ *
+ * The queue also records how late timers expire compared to their deadline
+ * and slack, in a histogram of lateness() with power of two buckets. The histogram helps
+ * evaluating whether the event loop is able to honour timer deadlines.
+ */
+
+/**
+ * \var TimerQueue::LatenessBuckets
+ * \brief The number of buckets in the lateness histogram
+ */
+
+/**
+ * \brief Construct an empty timer queue
+ */
+TimerQueue::TimerQueue()
+	: lateness_({})
+{
+}
+
+/**
+ * \brief Insert a timer in the queue
+ * \param[in] timer The timer
+ *
+ * The \a timer is ordered according to its deadline at insertion time. If the
+ * deadline of a timer changes, the timer shall be removed from the queue
+ * before being inserted again.
+ */
+void TimerQueue::insert(Timer *timer)
+{
+	timers_.push_back(timer);
+	std::push_heap(timers_.begin(), timers_.end(), laterDeadline);
+}
+
+/**
+ * \brief Remove a timer from the queue
+ * \param[in] timer The timer
+ *
+ * Removing a timer that isn't in the queue is allowed and has no effect.
+ */
+void TimerQueue::remove(Timer *timer)
+{
+	auto iter = std::find(timers_.begin(), timers_.end(), timer);
+	if (iter == timers_.end())
+		return;
+
+	*iter = timers_.back();
+	timers_.pop_back();
+	std::make_heap(timers_.begin(), timers_.end(), laterDeadline);
+}
+
+/**
+ * \fn TimerQueue::empty()
+ * \brief Check if the queue contains no timer
+ * \return True if the queue is empty, false otherwise
+ */
+
+/**
+ * \fn TimerQueue::next()
+ * \brief Retrieve the timer with the earliest deadline
+ * \return The timer with the earliest deadline, or nullptr if the queue is
+ * empty
+ */
+
+/**
+ * \brief Compute the time at which the event loop shall wake up
+ * \param[out] slack The smallest slack of the timers in the queue
+ *
+ * Timers can expire at any time between their deadline and the end of their
+ * slack. The event loop shall wake up at the latest at the end of the
+ * earliest slack. All timers whose deadline has passed then expire together.
+ * When the queue only contains timers with a slack, the event loop may
+ * additionally delay its wake-up by a fraction of the smallest \a slack.
+ *
+ * \return The wake-up time, or a default-constructed time point if the queue
+ * is empty
+ */
+utils::time_point TimerQueue::wakeup(utils::duration *slack) const
+{
+	utils::time_point time;
+	utils::duration minSlack(0);
+
+	for (unsigned int i = 0; i < timers_.size(); ++i) {
+		const Timer *timer = timers_[i];
+		utils::time_point end = timer->deadline() + timer->slack();
+
+		if (!i || end < time)
+			time = end;
+		if (!i || timer->slack() < minSlack)
+			minSlack = timer->slack();
+	}
+
+	if (slack)
+		*slack = minSlack;
+
+	return time;
+}
+
+/**
+ * \brief Remove the next expired timer from the queue
+ * \param[in] now The current time
+ *
+ * If the earliest deadline in the queue is not later than \a now, remove the
+ * corresponding timer from the queue, record its lateness, and return it.
+ * Callers shall call this method repeatedly until it returns nullptr to expire
+ * all timers.
+ *
+ * \return The expired timer, or nullptr if no timer has expired
+ */
+Timer *TimerQueue::expire(utils::time_point now)
+{
+	if (timers_.empty())
+		return nullptr;
+
+	Timer *timer = timers_.front();
+	if (timer->deadline() > now)
+		return nullptr;
+
+	std::pop_heap(timers_.begin(), timers_.end(), laterDeadline);
+	timers_.pop_back();
+
+	utils::duration late = std::max<utils::duration>(now - timer->deadline() - timer->slack(),
+							 utils::duration(0));
+	unsigned int bucket = 0;
+	while (bucket < LatenessBuckets - 1 && late >= latenessBucketLimit(bucket))
+		bucket++;
+
+	lateness_[bucket]++;
+
+	return timer;
+}
+
+/**
+ * \fn TimerQueue::lateness()
+ * \brief Retrieve the timer lateness histogram
+ *
+ * The lateness is measured from the end of the timer slack. Bucket 0 counts
+ * the timers that expired less than 1µs late, and bucket n counts the timers
+ * that expired between 2^(n-1)µs and 2^nµs late. The last bucket additionally
+ * counts all timers that expired later.
+ *
+ * \return The number of expired timers for each lateness bucket
+ */
+
+/**
+ * \brief Retrieve the upper limit of a lateness histogram bucket
+ * \param[in] bucket The bucket index
+ * \return The exclusive upper limit of the lateness of the timers counted in
+ * \a bucket
+ */
+utils::duration TimerQueue::latenessBucketLimit(unsigned int bucket)
+{
+	return std::chrono::microseconds(1ULL << bucket);
+}
+
+} /* namespace libcamera */
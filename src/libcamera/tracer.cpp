@@ -0,0 +1,539 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * tracer.cpp - Binary tracepoints
+ */
+
+#include "tracer.h"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <errno.h>
+#include <fcntl.h>
+#include <iomanip>
+#include <map>
+#include <sstream>
+#include <string.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "log.h"
+#include "utils.h"
+
+/**
+ * \file tracer.h
+ * \brief Binary tracepoints for the frame pipeline
+ *
+ * Tracepoints record the progress of requests and buffers through the camera
+ * stack with a low overhead, to analyse the latencies of the frame pipeline.
+ * Each tracepoint records a timestamp, the calling thread ID and up to four
+ * integer arguments in a fixed-size binary record.
+ *
+ * Tracepoints are compiled in when libcamera is configured with the 'tracing'
+ * meson option, and compile to nothing otherwise. When compiled in, they are
+ * enabled at runtime by setting the LIBCAMERA_TRACE_FILE environment variable
+ * to the path of the trace file. The trace records are stored in memory and
+ * appended to the trace file when the process exits. The
+ * utils/trace-to-json.py script converts the trace file to the JSON trace
+ * event format, which can be viewed as a per-request timeline in trace viewers
+ * such as Perfetto or chrome://tracing.
+ *
+ * Another set of tracepoints covers the startup phases, from the camera
+ * manager start to the first completed request. Setting the
+ * LIBCAMERA_TRACE_STARTUP environment variable enables tracing and logs a
+ * breakdown of those phases when the first request completes, see
+ * Tracer::startupProfile().
+ */
+
+namespace libcamera {
+
+LOG_DEFINE_CATEGORY(Tracer)
+
+/**
+ * \enum TracepointId
+ * \brief Identify a tracepoint
+ * \var TraceCameraQueueRequest
+ * \brief A request has been queued to the camera
+ * \var TracePipelineQueueRequestDevice
+ * \brief A request has been queued to the pipeline handler
+ * \var TracePipelineCompleteRequest
+ * \brief A request has been completed by the pipeline handler
+ * \var TraceV4L2QueueBuffer
+ * \brief A buffer has been queued to a V4L2 video device
+ * \var TraceV4L2DequeueBuffer
+ * \brief A buffer has been dequeued from a V4L2 video device
+ * \var TraceIPAProcessEvent
+ * \brief An event has been sent to an IPA module
+ * \var TraceIPAQueueFrameAction
+ * \brief An IPA module has queued a frame action
+ * \var TraceTimelineAction
+ * \brief A timeline frame action has been executed
+ * \var TraceCameraManagerStartBegin
+ * \brief The camera manager is being started
+ * \var TraceCameraManagerStartEnd
+ * \brief The camera manager has been started
+ * \var TraceDeviceEnumerateBegin
+ * \brief The device enumerator is scanning the system for media devices
+ * \var TraceDeviceEnumerateEnd
+ * \brief The device enumerator has scanned the system
+ * \var TracePipelineMatchBegin
+ * \brief A pipeline handler is being matched
+ * \var TracePipelineMatchEnd
+ * \brief A pipeline handler has been matched, successfully or not
+ * \var TraceIPAManagerScanBegin
+ * \brief The IPA manager is scanning the IPA module directories
+ * \var TraceIPAManagerScanEnd
+ * \brief The IPA manager has scanned the IPA module directories
+ * \var TraceCameraAcquireBegin
+ * \brief A camera is being acquired
+ * \var TraceCameraAcquireEnd
+ * \brief Camera::acquire() has returned
+ * \var TraceCameraConfigureBegin
+ * \brief A camera is being configured
+ * \var TraceCameraConfigureEnd
+ * \brief Camera::configure() has returned
+ * \var TraceCameraStartBegin
+ * \brief A camera is being started
+ * \var TraceCameraStartEnd
+ * \brief Camera::start() has returned
+ * \var TraceMax
+ * \brief The number of tracepoints
+ */
+
+/**
+ * \struct TraceRecord
+ * \brief A binary trace record
+ *
+ * \var TraceRecord::timestamp
+ * \brief The CLOCK_MONOTONIC time of the record, in nanoseconds
+ * \var TraceRecord::thread
+ * \brief The ID of the thread that recorded the trace
+ * \var TraceRecord::id
+ * \brief The TracepointId
+ * \var TraceRecord::reserved
+ * \brief Reserved for future use, set to 0
+ * \var TraceRecord::args
+ * \brief The tracepoint arguments
+ */
+
+/**
+ * \def LIBCAMERA_TRACEPOINT
+ * \brief Record a trace at a tracepoint
+ * \param[in] name The tracepoint name, without the Trace prefix
+ *
+ * The tracepoint name is followed by up to four integer arguments. When
+ * tracing is not compiled in, the macro expands to nothing and its arguments
+ * are not evaluated.
+ */
+
+/**
+ * \def LIBCAMERA_TRACEPOINT_SCOPE
+ * \brief Record a trace at the beginning and end of the enclosing scope
+ * \param[in] name The tracepoint name, without the Trace prefix and the Begin
+ * and End suffixes
+ * \param[in] arg The argument of both tracepoints
+ *
+ * This macro records the name##Begin tracepoint immediately, and the name##End
+ * tracepoint when the enclosing scope is exited, regardless of the return path.
+ * It may be used once per scope. When tracing is not compiled in, the macro
+ * expands to nothing.
+ */
+
+/**
+ * \class TraceScope
+ * \brief Record a pair of tracepoints around a scope
+ *
+ * This class is meant to be used through the LIBCAMERA_TRACEPOINT_SCOPE()
+ * macro. The end tracepoint is only recorded if tracing was enabled when the
+ * begin tracepoint was reached, to keep the pairs balanced.
+ */
+
+/**
+ * \fn TraceScope::TraceScope()
+ * \brief Record the \a begin tracepoint
+ * \param[in] begin The tracepoint recorded at construction time
+ * \param[in] end The tracepoint recorded at destruction time
+ * \param[in] arg The argument of both tracepoints
+ */
+
+namespace {
+
+constexpr unsigned int TraceBufferSize = 16384;
+
+/*
+ * The tracepoint descriptions store the tracepoint name, the phase of the
+ * event in the JSON trace event format and the argument names. Events with
+ * the 'b' and 'e' phases begin and end a span identified by their first
+ * argument, 'i' events are instants.
+ */
+const char *const tracepointDescriptions[] = {
+	"camera_queue_request b request cookie",
+	"pipeline_queue_request_device i request",
+	"pipeline_complete_request e request status",
+	"v4l2_queue_buffer i fd index",
+	"v4l2_dequeue_buffer i fd index sequence timestamp",
+	"ipa_process_event i operation",
+	"ipa_queue_frame_action i frame operation",
+	"timeline_action i frame type",
+	"camera_manager_start B",
+	"camera_manager_start E cameras",
+	"device_enumerate B",
+	"device_enumerate E status",
+	"pipeline_match B factory",
+	"pipeline_match E factory matched",
+	"ipa_manager_scan B",
+	"ipa_manager_scan E modules",
+	"camera_acquire B",
+	"camera_acquire E",
+	"camera_configure B",
+	"camera_configure E",
+	"camera_start B",
+	"camera_start E",
+};
+
+static_assert(ARRAY_SIZE(tracepointDescriptions) == TraceMax,
+	      "Missing tracepoint descriptions");
+
+struct TraceFileHeader {
+	char magic[8];
+	uint32_t pid;
+	uint32_t numTracepoints;
+	uint32_t descriptionsSize;
+	uint32_t recordSize;
+	uint64_t numRecords;
+};
+
+const char TraceFileMagic[8] = { 'L', 'C', 'T', 'R', 'A', 'C', 'E', '1' };
+
+/* The time at which libcamera has been loaded, the origin of startup profiles. */
+const uint64_t libraryLoadTime =
+	std::chrono::duration_cast<std::chrono::nanoseconds>(
+		utils::clock::now().time_since_epoch()).count();
+
+} /* namespace */
+
+/*
+ * Each thread records traces to its own buffer, without locking. The buffers
+ * wrap around, keeping the most recent records only, and are owned by the
+ * tracer to outlive their thread.
+ */
+struct Tracer::ThreadBuffer {
+	std::array<TraceRecord, TraceBufferSize> records;
+	std::atomic<uint64_t> count;
+	uint32_t thread;
+};
+
+/**
+ * \class Tracer
+ * \brief Record binary traces from the tracepoints
+ *
+ * The Tracer class is a singleton that stores the trace records in per-thread
+ * memory buffers. It is enabled automatically when the LIBCAMERA_TRACE_FILE
+ * environment variable is set, and writes the trace to that file upon
+ * destruction. It is also enabled when the LIBCAMERA_TRACE_STARTUP environment
+ * variable is set, and then logs the startup profile when the first request
+ * completes.
+ */
+
+Tracer::Tracer()
+	: enabled_(false), startupReport_(false), startupReported_(false)
+{
+	if (utils::secure_getenv("LIBCAMERA_TRACE_STARTUP")) {
+		startupReport_ = true;
+		enabled_ = true;
+	}
+
+	const char *path = utils::secure_getenv("LIBCAMERA_TRACE_FILE");
+	if (!path)
+		return;
+
+	path_ = path;
+	enabled_ = true;
+}
+
+Tracer::~Tracer()
+{
+	if (!path_.empty())
+		dump(path_);
+}
+
+/**
+ * \brief Retrieve the tracer instance
+ * \return The tracer instance
+ */
+Tracer *Tracer::instance()
+{
+	static Tracer instance;
+	return &instance;
+}
+
+/**
+ * \fn Tracer::enabled()
+ * \brief Check if tracing is enabled
+ * \return True if the tracepoints record traces, false otherwise
+ */
+
+/**
+ * \brief Enable tracing
+ *
+ * Tracing is enabled automatically when the LIBCAMERA_TRACE_FILE environment
+ * variable is set. This function enables tracing without a trace file, the
+ * records can then be retrieved with records() or written with dump().
+ */
+void Tracer::enable()
+{
+	enabled_ = true;
+}
+
+Tracer::ThreadBuffer *Tracer::threadBuffer()
+{
+	thread_local ThreadBuffer *buffer = nullptr;
+	if (buffer)
+		return buffer;
+
+	std::unique_ptr<ThreadBuffer> newBuffer = std::make_unique<ThreadBuffer>();
+	newBuffer->count.store(0, std::memory_order_relaxed);
+	newBuffer->thread = Thread::currentId();
+	buffer = newBuffer.get();
+
+	MutexLocker locker(mutex_);
+	buffers_.push_back(std::move(newBuffer));
+
+	return buffer;
+}
+
+/**
+ * \brief Record a trace
+ * \param[in] id The tracepoint
+ * \param[in] arg0 The first tracepoint argument
+ * \param[in] arg1 The second tracepoint argument
+ * \param[in] arg2 The third tracepoint argument
+ * \param[in] arg3 The fourth tracepoint argument
+ *
+ * This function is meant to be called through the LIBCAMERA_TRACEPOINT()
+ * macro. It doesn't lock, and allocates memory only for the first record of
+ * each thread.
+ */
+void Tracer::record(TracepointId id, uint64_t arg0, uint64_t arg1,
+		    uint64_t arg2, uint64_t arg3)
+{
+	ThreadBuffer *buffer = threadBuffer();
+	uint64_t count = buffer->count.load(std::memory_order_relaxed);
+
+	TraceRecord &record = buffer->records[count % TraceBufferSize];
+	record.timestamp = std::chrono::duration_cast<std::chrono::nanoseconds>(
+		utils::clock::now().time_since_epoch()).count();
+	record.thread = buffer->thread;
+	record.id = id;
+	record.reserved = 0;
+	record.args[0] = arg0;
+	record.args[1] = arg1;
+	record.args[2] = arg2;
+	record.args[3] = arg3;
+
+	buffer->count.store(count + 1, std::memory_order_release);
+
+	if (id == TracePipelineCompleteRequest && startupReport_ &&
+	    !startupReported_.exchange(true))
+		LOG(Tracer, Info) << startupProfile();
+}
+
+/**
+ * \brief Retrieve the recorded traces
+ *
+ * The records of all threads are merged and sorted by timestamp. Records
+ * written concurrently with this function may be inconsistent, the traces
+ * should thus be retrieved when the camera is idle.
+ *
+ * \return The trace records
+ */
+std::vector<TraceRecord> Tracer::records()
+{
+	std::vector<TraceRecord> records;
+
+	MutexLocker locker(mutex_);
+
+	for (const std::unique_ptr<ThreadBuffer> &buffer : buffers_) {
+		uint64_t count = buffer->count.load(std::memory_order_acquire);
+		uint64_t first = count > TraceBufferSize ? count - TraceBufferSize : 0;
+
+		for (uint64_t i = first; i < count; ++i)
+			records.push_back(buffer->records[i % TraceBufferSize]);
+	}
+
+	locker.unlock();
+
+	std::stable_sort(records.begin(), records.end(),
+			 [](const TraceRecord &a, const TraceRecord &b) {
+				 return a.timestamp < b.timestamp;
+			 });
+
+	return records;
+}
+
+/**
+ * \brief Write the recorded traces to a file
+ * \param[in] path The path to the trace file
+ *
+ * The traces are appended to the file at \a path, which is created if it
+ * doesn't exist. Appending allows multiple processes, such as isolated IPA
+ * modules, to share the same trace file.
+ *
+ * \return 0 on success or a negative error code otherwise
+ */
+int Tracer::dump(const std::string &path)
+{
+	std::vector<TraceRecord> records = this->records();
+
+	std::string descriptions;
+	for (const char *description : tracepointDescriptions) {
+		descriptions += description;
+		descriptions += '\0';
+	}
+
+	TraceFileHeader header;
+	memcpy(header.magic, TraceFileMagic, sizeof(header.magic));
+	header.pid = getpid();
+	header.numTracepoints = TraceMax;
+	header.descriptionsSize = descriptions.size();
+	header.recordSize = sizeof(TraceRecord);
+	header.numRecords = records.size();
+
+	std::string data(reinterpret_cast<const char *>(&header), sizeof(header));
+	data += descriptions;
+	data.append(reinterpret_cast<const char *>(records.data()),
+		    records.size() * sizeof(TraceRecord));
+
+	int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+	if (fd < 0) {
+		int ret = -errno;
+		LOG(Tracer, Error)
+			<< "Failed to open trace file " << path << ": "
+			<< strerror(-ret);
+		return ret;
+	}
+
+	ssize_t ret = write(fd, data.data(), data.size());
+	int err = ret < 0 ? -errno : 0;
+	close(fd);
+
+	if (ret < 0) {
+		LOG(Tracer, Error)
+			<< "Failed to write trace file " << path << ": "
+			<< strerror(-err);
+		return err;
+	}
+
+	return 0;
+}
+
+/**
+ * \brief Compute the startup profile from the recorded traces
+ *
+ * The startup profile lists the startup phases recorded by the startup
+ * tracepoints, from the camera manager start to the camera start, followed by
+ * the completion of the first request. Each phase is reported with its start
+ * time relative to the time libcamera has been loaded, its duration, and the
+ * arguments of its end tracepoint. Nested phases, such as the pipeline handler
+ * matches within the camera manager start, are indented.
+ *
+ * \return The startup profile, as a human-readable multi-line text
+ */
+std::string Tracer::startupProfile()
+{
+	struct Phase {
+		uint64_t start;
+		uint64_t duration;
+		unsigned int depth;
+		std::string label;
+	};
+
+	std::vector<TraceRecord> records = this->records();
+	std::map<uint32_t, std::vector<size_t>> stacks;
+	std::vector<Phase> phases;
+	bool started = false;
+
+	for (const TraceRecord &record : records) {
+		if (record.id == TracePipelineCompleteRequest) {
+			if (!started)
+				continue;
+
+			phases.push_back({ record.timestamp, 0, 0,
+					   "first_request_completed" });
+			break;
+		}
+
+		if (record.id < TraceCameraManagerStartBegin || record.id >= TraceMax)
+			continue;
+
+		std::istringstream description(tracepointDescriptions[record.id]);
+		std::string name;
+		char phase;
+		description >> name >> phase;
+
+		std::vector<size_t> &stack = stacks[record.thread];
+
+		if (phase == 'B') {
+			phases.push_back({ record.timestamp, 0,
+					   static_cast<unsigned int>(stack.size()),
+					   name });
+			stack.push_back(phases.size() - 1);
+
+			if (record.id == TraceCameraStartBegin)
+				started = true;
+			continue;
+		}
+
+		if (stack.empty())
+			continue;
+
+		Phase &begin = phases[stack.back()];
+		stack.pop_back();
+
+		begin.duration = record.timestamp - begin.start;
+
+		std::string arg;
+		for (unsigned int i = 0; i < 4 && description >> arg; ++i)
+			begin.label += " " + arg + "=" + std::to_string(record.args[i]);
+	}
+
+	std::ostringstream profile;
+	profile << "Startup profile (start and duration in ms since library load)"
+		<< std::fixed << std::setprecision(3);
+
+	for (const Phase &phase : phases) {
+		profile << std::endl << std::setw(10)
+			<< (phase.start - libraryLoadTime) / 1e6 << " ";
+
+		if (phase.duration)
+			profile << std::setw(10) << phase.duration / 1e6;
+		else
+			profile << std::setw(10) << "-";
+
+		profile << " " << std::string(phase.depth * 2, ' ') << phase.label;
+	}
+
+	return profile.str();
+}
+
+/**
+ * \brief Retrieve the description of a tracepoint
+ * \param[in] id The tracepoint
+ *
+ * The description is a space-separated list of the tracepoint name, the phase
+ * of the event in the JSON trace event format, and the names of the tracepoint
+ * arguments.
+ *
+ * \return The tracepoint description, or nullptr if \a id is invalid
+ */
+const char *Tracer::description(TracepointId id)
+{
+	if (id >= TraceMax)
+		return nullptr;
+
+	return tracepointDescriptions[id];
+}
+
+} /* namespace libcamera */
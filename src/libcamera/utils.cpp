@@ -70,6 +70,28 @@ char *secure_getenv(const char *name)
 #endif
 }
 
+/**
+ * \brief Retrieve the libcamera cache directory
+ *
+ * The libcamera cache directory is the libcamera directory of the XDG cache
+ * directory ($XDG_CACHE_HOME, defaulting to $HOME/.cache).
+ *
+ * \return The path to the libcamera cache directory, or an empty string if no
+ * cache directory is available
+ */
+std::string cacheDirectory()
+{
+	const char *cacheHome = secure_getenv("XDG_CACHE_HOME");
+	if (cacheHome && cacheHome[0] == '/')
+		return std::string(cacheHome) + "/libcamera";
+
+	const char *home = secure_getenv("HOME");
+	if (!home || home[0] != '/')
+		return std::string();
+
+	return std::string(home) + "/.cache/libcamera";
+}
+
 /**
  * \fn libcamera::utils::set_overlap(InputIt1 first1, InputIt1 last1,
  *				     InputIt2 first2, InputIt2 last2)
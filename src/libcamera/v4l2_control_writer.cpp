@@ -0,0 +1,217 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * v4l2_control_writer.cpp - Write V4L2 controls, skipping unchanged values
+ */
+
+#include "v4l2_control_writer.h"
+
+#include "log.h"
+#include "utils.h"
+#include "v4l2_device.h"
+
+/**
+ * \file v4l2_control_writer.h
+ * \brief Write V4L2 controls, skipping unchanged values
+ */
+
+namespace libcamera {
+
+LOG_DECLARE_CATEGORY(V4L2)
+
+/*
+ * Helper class to write controls to the device from the writer thread. Write
+ * failures are reported back to the writer in its own thread.
+ */
+class V4L2ControlWriter::Worker : public Object
+{
+public:
+	Worker(V4L2ControlWriter *writer, V4L2Device *device)
+		: writer_(writer), device_(device)
+	{
+	}
+
+	void write(ControlList ctrls)
+	{
+		int ret = device_->setControls(&ctrls);
+		if (!ret)
+			return;
+
+		LOG(V4L2, Error) << "Failed to set deferred controls: " << ret;
+
+		std::vector<unsigned int> ids;
+		for (const auto &ctrl : ctrls)
+			ids.push_back(ctrl.first);
+
+		writer_->invokeMethod(&V4L2ControlWriter::invalidate,
+				      ConnectionTypeQueued, ids);
+	}
+
+	void flush()
+	{
+	}
+
+private:
+	V4L2ControlWriter *writer_;
+	V4L2Device *device_;
+};
+
+/**
+ * \class V4L2ControlWriter
+ * \brief Write controls to a V4L2 device, skipping unchanged values
+ *
+ * Pipeline handlers commonly translate the controls of every request to V4L2
+ * controls and write them all to the device, even when their value hasn't
+ * changed since the previous request. Writing a control can be expensive,
+ * for instance UVC devices translate each control write to a USB control
+ * transfer that takes milliseconds to complete.
+ *
+ * The V4L2ControlWriter class remembers the last value written for each
+ * control, and only writes the controls whose value has changed.
+ *
+ * Writes can additionally be deferred to a dedicated thread with
+ * setDeferred(), to avoid blocking the thread of the pipeline handler. The
+ * deferred writes are performed in order. As write errors can't be reported
+ * to the caller in that mode, they are logged, and the controls that failed
+ * to be written are written again the next time they're passed to write().
+ * While writes are deferred, the device controls shall only be accessed
+ * through the writer.
+ */
+
+/**
+ * \brief Construct a V4L2ControlWriter for a device
+ * \param[in] device The V4L2 device to write controls to
+ *
+ * Writes are performed synchronously by default.
+ */
+V4L2ControlWriter::V4L2ControlWriter(V4L2Device *device)
+	: device_(device)
+{
+}
+
+V4L2ControlWriter::~V4L2ControlWriter()
+{
+	setDeferred(false);
+}
+
+/**
+ * \brief Enable or disable deferred writes
+ * \param[in] deferred True to defer writes to a dedicated thread
+ * \param[in] name The name of the writer thread
+ *
+ * Disabling deferred writes waits for all pending writes to complete.
+ */
+void V4L2ControlWriter::setDeferred(bool deferred, const std::string &name)
+{
+	if (deferred == this->deferred())
+		return;
+
+	if (deferred) {
+		thread_ = std::make_unique<Thread>();
+		worker_ = std::make_unique<Worker>(this, device_);
+		worker_->moveToThread(thread_.get());
+
+		if (!name.empty())
+			thread_->setName(name);
+		thread_->start();
+		return;
+	}
+
+	flush();
+
+	thread_->exit();
+	thread_->wait();
+
+	/*
+	 * Destroy the worker while the thread still exists, to discard the
+	 * messages that may still be queued for it.
+	 */
+	worker_.reset();
+	thread_.reset();
+}
+
+/**
+ * \fn V4L2ControlWriter::deferred()
+ * \brief Check if writes are deferred to a dedicated thread
+ * \return True if writes are deferred, false otherwise
+ */
+
+/**
+ * \brief Write the controls whose value has changed to the device
+ * \param[in] ctrls The list of controls
+ *
+ * Compare the value of each control in \a ctrls with the last value written
+ * for the same control, and write the controls whose value differs. When
+ * writes are deferred, the controls are queued to the writer thread and this
+ * method returns immediately.
+ *
+ * \return 0 on success or an error code otherwise, as returned by
+ * V4L2Device::setControls(). Deferred writes always return 0.
+ */
+int V4L2ControlWriter::write(const ControlList &ctrls)
+{
+	ControlList changed(device_->controls());
+
+	for (const auto &ctrl : ctrls) {
+		auto it = values_.find(ctrl.first);
+		if (it != values_.end() && it->second == ctrl.second)
+			continue;
+
+		changed.set(ctrl.first, ctrl.second);
+	}
+
+	if (changed.empty())
+		return 0;
+
+	for (const auto &ctrl : changed)
+		values_[ctrl.first] = ctrl.second;
+
+	if (worker_) {
+		worker_->invokeMethod(&Worker::write, ConnectionTypeQueued,
+				      std::move(changed));
+		return 0;
+	}
+
+	std::vector<unsigned int> ids;
+	for (const auto &ctrl : changed)
+		ids.push_back(ctrl.first);
+
+	int ret = device_->setControls(&changed);
+	if (ret)
+		invalidate(ids);
+
+	return ret;
+}
+
+/**
+ * \brief Wait for all deferred writes to complete
+ *
+ * This method has no effect when writes are not deferred.
+ */
+void V4L2ControlWriter::flush()
+{
+	if (worker_)
+		worker_->invokeMethod(&Worker::flush, ConnectionTypeBlocking);
+}
+
+/**
+ * \brief Forget the values last written to the device
+ *
+ * All controls passed to the next write() are written to the device. This
+ * method shall be called when the device controls may have been modified
+ * without the writer, for instance by another process while the device
+ * wasn't in use.
+ */
+void V4L2ControlWriter::reset()
+{
+	values_.clear();
+}
+
+void V4L2ControlWriter::invalidate(const std::vector<unsigned int> &ids)
+{
+	for (unsigned int id : ids)
+		values_.erase(id);
+}
+
+} /* namespace libcamera */
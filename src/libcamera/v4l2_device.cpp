@@ -7,6 +7,7 @@
 
 #include "v4l2_device.h"
 
+#include <algorithm>
 #include <fcntl.h>
 #include <iomanip>
 #include <string.h>
@@ -14,7 +15,10 @@
 #include <sys/syscall.h>
 #include <unistd.h>
 
+#include <libcamera/event_notifier.h>
+
 #include "log.h"
+#include "media_request.h"
 #include "utils.h"
 #include "v4l2_controls.h"
 
@@ -49,7 +53,8 @@ LOG_DEFINE_CATEGORY(V4L2)
  * at open() time, and the \a logTag to prefix log messages with.
  */
 V4L2Device::V4L2Device(const std::string &deviceNode)
-	: deviceNode_(deviceNode), fd_(-1)
+	: deviceNode_(deviceNode), fd_(-1), fdEventNotifier_(nullptr),
+	  frameStartEnabled_(false)
 {
 }
 
@@ -86,7 +91,12 @@ int V4L2Device::open(unsigned int flags)
 
 	fd_ = ret;
 
-	listControls();
+	/*
+	 * The controls exposed by a device node don't change, only enumerate
+	 * them the first time the device is opened.
+	 */
+	if (controlDescs_.empty())
+		listControls();
 
 	return 0;
 }
@@ -127,6 +137,10 @@ void V4L2Device::close()
 	if (!isOpen())
 		return;
 
+	delete fdEventNotifier_;
+	fdEventNotifier_ = nullptr;
+	frameStartEnabled_ = false;
+
 	if (::close(fd_) < 0)
 		LOG(V4L2, Error) << "Failed to close V4L2 device: "
 				 << strerror(errno);
@@ -172,14 +186,18 @@ int V4L2Device::getControls(ControlList *ctrls)
 	if (count == 0)
 		return 0;
 
-	struct v4l2_ext_control v4l2Ctrls[count];
-	memset(v4l2Ctrls, 0, sizeof(v4l2Ctrls));
+	if (count > v4l2Ctrls_.size()) {
+		LOG(V4L2, Error) << "Too many controls";
+		return -EINVAL;
+	}
+
+	struct v4l2_ext_control *v4l2Ctrls = v4l2Ctrls_.data();
+	memset(v4l2Ctrls, 0, sizeof(*v4l2Ctrls) * count);
 
 	unsigned int i = 0;
 	for (const auto &ctrl : *ctrls) {
 		unsigned int id = ctrl.first;
-		const auto iter = controls_.find(id);
-		if (iter == controls_.end()) {
+		if (!findControl(id)) {
 			LOG(V4L2, Error)
 				<< "Control " << utils::hex(id) << " not found";
 			return -EINVAL;
@@ -200,14 +218,15 @@ int V4L2Device::getControls(ControlList *ctrls)
 
 		/* Generic validation error. */
 		if (errorIdx == 0 || errorIdx >= count) {
-			LOG(V4L2, Error) << "Unable to read controls: "
-					 << strerror(ret);
+			LOG_RATELIMITED(V4L2, Error)
+				<< "Unable to read controls: " << strerror(ret);
 			return -EINVAL;
 		}
 
 		/* A specific control failed. */
-		LOG(V4L2, Error) << "Unable to read control " << errorIdx
-				 << ": " << strerror(ret);
+		LOG_RATELIMITED(V4L2, Error)
+			<< "Unable to read control " << errorIdx << ": "
+			<< strerror(ret);
 		count = errorIdx - 1;
 		ret = errorIdx;
 	}
@@ -220,11 +239,16 @@ int V4L2Device::getControls(ControlList *ctrls)
 /**
  * \brief Write controls to the device
  * \param[in] ctrls The list of controls to write
+ * \param[in] request The media request to store the controls in (optional)
  *
  * This method writes the value of all controls contained in \a ctrls, and
  * stores the values actually applied to the device in the corresponding
  * \a ctrls entry.
  *
+ * If a \a request is specified, the controls are not applied immediately but
+ * stored in the request, and applied by the driver when the request is
+ * processed.
+ *
  * If any control in \a ctrls is not supported by the device, is disabled (i.e.
  * has the V4L2_CTRL_FLAG_DISABLED flag set), is read-only, is a
  * compound control, or if any other error occurs during validation of
@@ -240,20 +264,25 @@ int V4L2Device::getControls(ControlList *ctrls)
  * \retval -EINVAL One of the control is not supported or not accessible
  * \retval i The index of the control that failed
  */
-int V4L2Device::setControls(ControlList *ctrls)
+int V4L2Device::setControls(ControlList *ctrls, MediaRequest *request)
 {
 	unsigned int count = ctrls->size();
 	if (count == 0)
 		return 0;
 
-	struct v4l2_ext_control v4l2Ctrls[count];
-	memset(v4l2Ctrls, 0, sizeof(v4l2Ctrls));
+	if (count > v4l2Ctrls_.size()) {
+		LOG(V4L2, Error) << "Too many controls";
+		return -EINVAL;
+	}
+
+	struct v4l2_ext_control *v4l2Ctrls = v4l2Ctrls_.data();
+	memset(v4l2Ctrls, 0, sizeof(*v4l2Ctrls) * count);
 
 	unsigned int i = 0;
 	for (const auto &ctrl : *ctrls) {
 		unsigned int id = ctrl.first;
-		const auto iter = controls_.find(id);
-		if (iter == controls_.end()) {
+		const ControlDesc *desc = findControl(id);
+		if (!desc) {
 			LOG(V4L2, Error)
 				<< "Control " << utils::hex(id) << " not found";
 			return -EINVAL;
@@ -263,7 +292,7 @@ int V4L2Device::setControls(ControlList *ctrls)
 
 		/* Set the v4l2_ext_control value for the write operation. */
 		const ControlValue &value = ctrl.second;
-		switch (iter->first->type()) {
+		switch (desc->type) {
 		case ControlTypeInteger64:
 			v4l2Ctrls[i].value64 = value.get<int64_t>();
 			break;
@@ -280,7 +309,12 @@ int V4L2Device::setControls(ControlList *ctrls)
 	}
 
 	struct v4l2_ext_controls v4l2ExtCtrls = {};
-	v4l2ExtCtrls.which = V4L2_CTRL_WHICH_CUR_VAL;
+	if (request) {
+		v4l2ExtCtrls.which = V4L2_CTRL_WHICH_REQUEST_VAL;
+		v4l2ExtCtrls.request_fd = request->fd();
+	} else {
+		v4l2ExtCtrls.which = V4L2_CTRL_WHICH_CUR_VAL;
+	}
 	v4l2ExtCtrls.controls = v4l2Ctrls;
 	v4l2ExtCtrls.count = count;
 
@@ -290,14 +324,15 @@ int V4L2Device::setControls(ControlList *ctrls)
 
 		/* Generic validation error. */
 		if (errorIdx == 0 || errorIdx >= count) {
-			LOG(V4L2, Error) << "Unable to set controls: "
-					 << strerror(ret);
+			LOG_RATELIMITED(V4L2, Error)
+				<< "Unable to set controls: " << strerror(ret);
 			return -EINVAL;
 		}
 
 		/* A specific control failed. */
-		LOG(V4L2, Error) << "Unable to set control " << errorIdx
-				 << ": " << strerror(ret);
+		LOG_RATELIMITED(V4L2, Error)
+			<< "Unable to set control " << errorIdx << ": "
+			<< strerror(ret);
 		count = errorIdx - 1;
 		ret = errorIdx;
 	}
@@ -307,6 +342,54 @@ int V4L2Device::setControls(ControlList *ctrls)
 	return ret;
 }
 
+/**
+ * \brief Enable or disable frame start event notification
+ * \param[in] enable True to enable frame start events, false to disable them
+ *
+ * This method enables or disables generation of frame start events. Once
+ * enabled, the events are signalled through the frameStart signal.
+ *
+ * \return 0 on success, a negative error code otherwise
+ */
+int V4L2Device::setFrameStartEnabled(bool enable)
+{
+	if (frameStartEnabled_ == enable)
+		return 0;
+
+	struct v4l2_event_subscription event{};
+	event.type = V4L2_EVENT_FRAME_SYNC;
+
+	unsigned long request = enable ? VIDIOC_SUBSCRIBE_EVENT
+			      : VIDIOC_UNSUBSCRIBE_EVENT;
+	int ret = ioctl(request, &event);
+	if (enable && ret) {
+		LOG(V4L2, Debug) << "Unable to subscribe to frame start events: "
+				 << strerror(-ret);
+		return ret;
+	}
+
+	if (!fdEventNotifier_) {
+		fdEventNotifier_ = new EventNotifier(fd_, EventNotifier::Exception);
+		fdEventNotifier_->activated.connect(this, &V4L2Device::eventAvailable);
+	}
+
+	fdEventNotifier_->setEnabled(enable);
+	frameStartEnabled_ = enable;
+
+	return ret;
+}
+
+/**
+ * \var V4L2Device::frameStart
+ * \brief A Signal emitted when capture of a frame has started
+ *
+ * The signal carries the frame sequence number and the time, expressed in
+ * nanoseconds on the CLOCK_MONOTONIC clock, at which the device started
+ * receiving the frame. As the event is generated by the driver at the start of
+ * frame, it provides a more accurate reference for frame timing than buffer
+ * completion. Frame start events must be enabled with setFrameStartEnabled().
+ */
+
 /**
  * \brief Perform an IOCTL system call on the device node
  * \param[in] request The IOCTL request code
@@ -340,12 +423,21 @@ int V4L2Device::ioctl(unsigned long request, void *argp)
 /*
  * \brief List and store information about all controls supported by the
  * V4L2 device
+ *
+ * In addition to the ControlInfoMap exposed through controls(), a compact
+ * array of control descriptors sorted by control ID is stored to look up
+ * controls without hashing when reading or writing them. The extended control
+ * array used by getControls() and setControls() is also preallocated to the
+ * number of controls, to avoid memory allocations in those methods.
  */
 void V4L2Device::listControls()
 {
 	ControlInfoMap::Map ctrls;
 	struct v4l2_query_ext_ctrl ctrl = {};
 
+	controlIds_.clear();
+	controlDescs_.clear();
+
 	/* \todo Add support for menu and compound controls. */
 	while (1) {
 		ctrl.id |= V4L2_CTRL_FLAG_NEXT_CTRL;
@@ -382,9 +474,36 @@ void V4L2Device::listControls()
 
 		controlIds_.emplace_back(std::make_unique<V4L2ControlId>(ctrl));
 		ctrls.emplace(controlIds_.back().get(), V4L2ControlRange(ctrl));
+		controlDescs_.push_back({ ctrl.id, controlIds_.back()->type() });
 	}
 
 	controls_ = std::move(ctrls);
+
+	/* Controls are enumerated in ID order, but don't rely on it. */
+	std::sort(controlDescs_.begin(), controlDescs_.end(),
+		  [](const ControlDesc &a, const ControlDesc &b) {
+			  return a.id < b.id;
+		  });
+
+	v4l2Ctrls_.resize(controlDescs_.size());
+}
+
+/*
+ * \brief Find the descriptor of a control supported by the device
+ * \param[in] id The V4L2 control ID
+ * \return A pointer to the control descriptor, or nullptr if the device
+ * doesn't support the control
+ */
+const V4L2Device::ControlDesc *V4L2Device::findControl(unsigned int id) const
+{
+	auto iter = std::lower_bound(controlDescs_.begin(), controlDescs_.end(), id,
+				     [](const ControlDesc &desc, unsigned int key) {
+					     return desc.id < key;
+				     });
+	if (iter == controlDescs_.end() || iter->id != id)
+		return nullptr;
+
+	return &*iter;
 }
 
 /*
@@ -407,8 +526,8 @@ void V4L2Device::updateControls(ControlList *ctrls,
 		unsigned int id = ctrl.first;
 		ControlValue &value = ctrl.second;
 
-		const auto iter = controls_.find(id);
-		switch (iter->first->type()) {
+		const ControlDesc *desc = findControl(id);
+		switch (desc->type) {
 		case ControlTypeInteger64:
 			value.set<int64_t>(v4l2Ctrl->value64);
 			break;
@@ -425,4 +544,36 @@ void V4L2Device::updateControls(ControlList *ctrls,
 	}
 }
 
+/**
+ * \brief Slot to handle V4L2 events from the V4L2 device
+ * \param[in] notifier The event notifier
+ *
+ * When this slot is called, a V4L2 event is available to be dequeued from the
+ * device.
+ */
+void V4L2Device::eventAvailable(EventNotifier *notifier)
+{
+	struct v4l2_event event{};
+	int ret = ioctl(VIDIOC_DQEVENT, &event);
+	if (ret < 0) {
+		LOG(V4L2, Error)
+			<< "Failed to dequeue event, disabling event notifier";
+		notifier->setEnabled(false);
+		return;
+	}
+
+	if (event.type != V4L2_EVENT_FRAME_SYNC) {
+		LOG(V4L2, Error)
+			<< "Spurious event (" << event.type
+			<< "), disabling event notifier";
+		notifier->setEnabled(false);
+		return;
+	}
+
+	uint64_t timestamp = event.timestamp.tv_sec * 1000000000ULL
+			   + event.timestamp.tv_nsec;
+
+	frameStart.emit(event.u.frame_sync.frame_sequence, timestamp);
+}
+
 } /* namespace libcamera */
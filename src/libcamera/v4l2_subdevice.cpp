@@ -118,6 +118,16 @@ int V4L2Subdevice::open()
 	return V4L2Device::open(O_RDWR);
 }
 
+/**
+ * \brief Close the subdevice, releasing any resources acquired by open()
+ */
+void V4L2Subdevice::close()
+{
+	formats_.clear();
+
+	V4L2Device::close();
+}
+
 /**
  * \fn V4L2Subdevice::entity()
  * \brief Retrieve the media entity associated with the subdevice
@@ -149,13 +159,23 @@ int V4L2Subdevice::setCompose(unsigned int pad, Rectangle *rect)
 /**
  * \brief Enumerate all media bus codes and frame sizes on a \a pad
  * \param[in] pad The 0-indexed pad number to enumerate formats on
+ * \param[in] refresh Force enumeration of the formats from the subdevice
  *
  * Enumerate all media bus codes and frame sizes supported by the subdevice on
  * a \a pad.
  *
+ * The result of the first successful enumeration on a pad is cached and
+ * returned by subsequent calls, until the subdevice is closed. The formats
+ * supported on the source pads of some subdevices depend on the format
+ * configured on their sink pads, callers that need to enumerate formats after
+ * reconfiguring a subdevice shall set \a refresh to true.
+ *
+ * When the media device has been populated with a DeviceCache, the result is
+ * also stored in the cache, and retrieved from there by later processes.
+ *
  * \return A list of the supported device formats
  */
-ImageFormats V4L2Subdevice::formats(unsigned int pad)
+ImageFormats V4L2Subdevice::formats(unsigned int pad, bool refresh)
 {
 	ImageFormats formats;
 
@@ -164,6 +184,22 @@ ImageFormats V4L2Subdevice::formats(unsigned int pad)
 		return {};
 	}
 
+	if (!refresh) {
+		auto iter = formats_.find(pad);
+		if (iter != formats_.end())
+			return iter->second;
+	}
+
+	DeviceCache::Entry *cache = entity_->device()->cacheEntry();
+	std::string cacheKey = "subdev:" + entity_->name() + ":" + std::to_string(pad);
+	if (cache && !refresh) {
+		const ImageFormats *cached = cache->formats(cacheKey);
+		if (cached) {
+			formats_[pad] = *cached;
+			return *cached;
+		}
+	}
+
 	for (unsigned int code : enumPadCodes(pad)) {
 		std::vector<SizeRange> sizes = enumPadSizes(pad, code);
 		if (sizes.empty())
@@ -177,6 +213,11 @@ ImageFormats V4L2Subdevice::formats(unsigned int pad)
 		}
 	}
 
+	formats_[pad] = formats;
+
+	if (cache)
+		cache->setFormats(cacheKey, formats);
+
 	return formats;
 }
 
@@ -7,8 +7,10 @@
 
 #include "v4l2_videodevice.h"
 
+#include <algorithm>
 #include <fcntl.h>
 #include <iomanip>
+#include <iterator>
 #include <sstream>
 #include <string.h>
 #include <sys/ioctl.h>
@@ -18,16 +20,22 @@
 #include <unistd.h>
 #include <vector>
 
-#include <linux/drm_fourcc.h>
-
 #include <libcamera/event_notifier.h>
 #include <libcamera/file_descriptor.h>
+#include <libcamera/pixelformats.h>
 
+#include "cpu_accounting.h"
 #include "log.h"
 #include "media_device.h"
 #include "media_object.h"
+#include "media_request.h"
+#include "tracer.h"
 #include "utils.h"
 
+#ifndef V4L2_BUF_CAP_SUPPORTS_MMAP_CACHE_HINTS
+#define V4L2_BUF_CAP_SUPPORTS_MMAP_CACHE_HINTS	(1 << 6)
+#endif
+
 /**
  * \file v4l2_videodevice.h
  * \brief V4L2 Video Device
@@ -151,6 +159,32 @@ LOG_DECLARE_CATEGORY(V4L2)
  * index associations to help selecting V4L2 buffers. It tracks, for every
  * entry, if the V4L2 buffer is in use, and offers lookup of the best free V4L2
  * buffer for a set of dmabufs.
+ *
+ * When no free V4L2 buffer matches the dmabufs, the least recently used free
+ * entry is replaced. Entries that have never been used are picked first, as
+ * replacing them doesn't evict any mapping. This keeps the mappings of
+ * frequently queued dmabufs alive when an application rotates more frame
+ * buffers than the number of V4L2 buffers.
+ *
+ * The cache records the number of hits, misses and evictions, which can be
+ * retrieved with statistics() to assess how efficiently V4L2 buffers are
+ * reused.
+ */
+
+/**
+ * \struct V4L2BufferCache::Statistics
+ * \brief Usage statistics of a V4L2BufferCache
+ *
+ * \var V4L2BufferCache::Statistics::hits
+ * \brief Number of lookups that found a free V4L2 buffer previously used with
+ * the same dmabufs
+ *
+ * \var V4L2BufferCache::Statistics::misses
+ * \brief Number of lookups that didn't find a matching free V4L2 buffer
+ *
+ * \var V4L2BufferCache::Statistics::evictions
+ * \brief Number of misses that replaced a previous dmabufs association,
+ * causing the kernel to unmap the old dmabufs
  */
 
 /**
@@ -162,7 +196,7 @@ LOG_DECLARE_CATEGORY(V4L2)
  * buffer import, with buffers added to the cache as they are queued.
  */
 V4L2BufferCache::V4L2BufferCache(unsigned int numEntries)
-	: missCounter_(0)
+	: lastUsedCounter_(0), stats_()
 {
 	cache_.resize(numEntries);
 }
@@ -176,16 +210,59 @@ V4L2BufferCache::V4L2BufferCache(unsigned int numEntries)
  * allocated.
  */
 V4L2BufferCache::V4L2BufferCache(const std::vector<std::unique_ptr<FrameBuffer>> &buffers)
-	: missCounter_(0)
+	: lastUsedCounter_(0), stats_()
+{
+	for (const std::unique_ptr<FrameBuffer> &buffer : buffers)
+		cache_.emplace_back(true, 0, *buffer);
+}
+
+/**
+ * \brief Add empty entries to the cache
+ * \param[in] index Index of the first entry to add
+ * \param[in] numEntries Number of entries to add
+ *
+ * Add \a numEntries entries all marked as unused, starting at \a index. This
+ * is used to grow the cache of a device that imports buffers when V4L2 buffers
+ * are added to it.
+ *
+ * The \a index shall not be lower than the number of entries in the cache. If
+ * it is higher, the entries in-between are never used, as they correspond to
+ * V4L2 buffers unknown to the cache.
+ */
+void V4L2BufferCache::grow(unsigned int index, unsigned int numEntries)
+{
+	pad(index);
+	cache_.resize(index + numEntries);
+}
+
+/**
+ * \brief Add pre-populated entries to the cache
+ * \param[in] index Index of the first entry to add
+ * \param[in] buffers Array of buffers to populate the entries with
+ *
+ * Add one entry for each buffer in \a buffers, starting at \a index. This is
+ * used to grow the cache of a device that exports buffers when V4L2 buffers
+ * are added to it.
+ *
+ * The \a index shall not be lower than the number of entries in the cache. If
+ * it is higher, the entries in-between are never used, as they correspond to
+ * V4L2 buffers unknown to the cache.
+ */
+void V4L2BufferCache::grow(unsigned int index,
+			   const std::vector<std::unique_ptr<FrameBuffer>> &buffers)
 {
+	pad(index);
 	for (const std::unique_ptr<FrameBuffer> &buffer : buffers)
-		cache_.emplace_back(true, buffer->planes());
+		cache_.emplace_back(true, 0, *buffer);
 }
 
 V4L2BufferCache::~V4L2BufferCache()
 {
-	if (missCounter_ > cache_.size())
-		LOG(V4L2, Debug) << "Cache misses: " << missCounter_;
+	if (stats_.misses > cache_.size())
+		LOG(V4L2, Debug)
+			<< "Cache hits: " << stats_.hits
+			<< ", misses: " << stats_.misses
+			<< ", evictions: " << stats_.evictions;
 }
 
 /**
@@ -195,41 +272,54 @@ V4L2BufferCache::~V4L2BufferCache()
  * Find the best V4L2 buffer index to be used for the FrameBuffer \a buffer
  * based on previous mappings of frame buffers to V4L2 buffers. If a free V4L2
  * buffer previously used with the same dmabufs as \a buffer is found in the
- * cache, return its index. Otherwise return the index of the first free V4L2
- * buffer and record its association with the dmabufs of \a buffer.
+ * cache, return its index. Otherwise return the index of the least recently
+ * used free V4L2 buffer, preferring entries that have never been used, and
+ * record its association with the dmabufs of \a buffer.
  *
  * \return The index of the best V4L2 buffer, or -ENOENT if no free V4L2 buffer
  * is available
  */
 int V4L2BufferCache::get(const FrameBuffer &buffer)
 {
-	bool hit = false;
 	int use = -1;
 
 	for (unsigned int index = 0; index < cache_.size(); index++) {
-		const Entry &entry = cache_[index];
+		Entry &entry = cache_[index];
 
 		if (!entry.free)
 			continue;
 
-		if (use < 0)
-			use = index;
-
 		/* Try to find a cache hit by comparing the planes. */
-		if (cache_[index] == buffer) {
-			hit = true;
+		if (entry == buffer) {
+			stats_.hits++;
+			entry.free = false;
+			entry.lastUsed = ++lastUsedCounter_;
+			return index;
+		}
+
+		if (use < 0) {
 			use = index;
-			break;
+			continue;
 		}
+
+		/* Prefer empty entries, then the least recently used one. */
+		const Entry &candidate = cache_[use];
+		if (candidate.isEmpty())
+			continue;
+
+		if (entry.isEmpty() || entry.lastUsed < candidate.lastUsed)
+			use = index;
 	}
 
-	if (!hit)
-		missCounter_++;
+	stats_.misses++;
 
 	if (use < 0)
 		return -ENOENT;
 
-	cache_[use] = Entry(false, buffer);
+	if (!cache_[use].isEmpty())
+		stats_.evictions++;
+
+	cache_[use] = Entry(false, ++lastUsedCounter_, buffer);
 
 	return use;
 }
@@ -244,27 +334,46 @@ void V4L2BufferCache::put(unsigned int index)
 	cache_[index].free = true;
 }
 
+void V4L2BufferCache::pad(unsigned int index)
+{
+	ASSERT(index >= cache_.size());
+
+	/* Mark the padding entries as in use to never hand them out. */
+	Entry unused;
+	unused.free = false;
+	cache_.resize(index, unused);
+}
+
+/**
+ * \fn V4L2BufferCache::statistics()
+ * \brief Retrieve the cache usage statistics
+ * \return The cache hits, misses and evictions counters
+ */
+
 V4L2BufferCache::Entry::Entry()
-	: free(true)
+	: free(true), lastUsed(0), numPlanes_(0)
 {
 }
 
-V4L2BufferCache::Entry::Entry(bool free, const FrameBuffer &buffer)
-	: free(free)
+V4L2BufferCache::Entry::Entry(bool free, uint64_t lastUsed,
+			      const FrameBuffer &buffer)
+	: free(free), lastUsed(lastUsed), numPlanes_(0)
 {
 	for (const FrameBuffer::Plane &plane : buffer.planes())
-		planes_.emplace_back(plane);
+		planes_[numPlanes_++] = { plane.fd.fd(), plane.address,
+					  plane.length };
 }
 
 bool V4L2BufferCache::Entry::operator==(const FrameBuffer &buffer)
 {
-	const std::vector<FrameBuffer::Plane> &planes = buffer.planes();
+	Span<const FrameBuffer::Plane> planes = buffer.planes();
 
-	if (planes_.size() != planes.size())
+	if (numPlanes_ != planes.size())
 		return false;
 
 	for (unsigned int i = 0; i < planes.size(); i++)
 		if (planes_[i].fd != planes[i].fd.fd() ||
+		    planes_[i].address != planes[i].address ||
 		    planes_[i].length != planes[i].length)
 			return false;
 	return true;
@@ -399,7 +508,8 @@ const std::string V4L2DeviceFormat::toString() const
  *
  * The V4L2VideoDevice class tracks queued buffers and handles buffer events. It
  * automatically dequeues completed buffers and emits the \ref bufferReady
- * signal.
+ * signal for each of them, and the \ref buffersReady signal for each batch of
+ * buffers dequeued together.
  *
  * Upon destruction any device left open will be closed, and any resources
  * released.
@@ -410,7 +520,12 @@ const std::string V4L2DeviceFormat::toString() const
  * \param[in] deviceNode The file-system path to the video device node
  */
 V4L2VideoDevice::V4L2VideoDevice(const std::string &deviceNode)
-	: V4L2Device(deviceNode), cache_(nullptr), fdEvent_(nullptr)
+	: V4L2Device(deviceNode), entity_(nullptr),
+	  cpuAccess_(FrameBuffer::CpuAccessReadWrite), cacheFlags_(0),
+	  cache_(nullptr), mapBuffers_(false), queuedCount_(0),
+	  dequeueTemplate_(), fillBuffer_(nullptr), readBuffer_(nullptr),
+	  fdEvent_(nullptr),
+	  formatsValid_(false)
 {
 	/*
 	 * We default to an MMAP based CAPTURE video device, however this will
@@ -429,6 +544,7 @@ V4L2VideoDevice::V4L2VideoDevice(const std::string &deviceNode)
 V4L2VideoDevice::V4L2VideoDevice(const MediaEntity *entity)
 	: V4L2VideoDevice(entity->deviceNode())
 {
+	entity_ = entity;
 }
 
 V4L2VideoDevice::~V4L2VideoDevice()
@@ -491,6 +607,9 @@ int V4L2VideoDevice::open()
 	fdEvent_->activated.connect(this, &V4L2VideoDevice::bufferAvailable);
 	fdEvent_->setEnabled(false);
 
+	/* The log prefix depends on the buffer type. */
+	invalidateLogPrefix();
+
 	LOG(V4L2, Debug)
 		<< "Opened device " << caps_.bus_info() << ": "
 		<< caps_.driver() << ": " << caps_.card();
@@ -577,6 +696,9 @@ int V4L2VideoDevice::open(int handle, enum v4l2_buf_type type)
 	fdEvent_->activated.connect(this, &V4L2VideoDevice::bufferAvailable);
 	fdEvent_->setEnabled(false);
 
+	/* The log prefix depends on the buffer type. */
+	invalidateLogPrefix();
+
 	LOG(V4L2, Debug)
 		<< "Opened device " << caps_.bus_info() << ": "
 		<< caps_.driver() << ": " << caps_.card();
@@ -595,6 +717,9 @@ void V4L2VideoDevice::close()
 	releaseBuffers();
 	delete fdEvent_;
 
+	formats_ = {};
+	formatsValid_ = false;
+
 	V4L2Device::close();
 }
 
@@ -830,13 +955,38 @@ int V4L2VideoDevice::setFormatSingleplane(V4L2DeviceFormat *format)
 
 /**
  * \brief Enumerate all pixel formats and frame sizes
+ * \param[in] refresh Force enumeration of the formats from the device
  *
  * Enumerate all pixel formats and frame sizes supported by the video device.
  *
+ * Enumerating formats requires one ioctl per pixel format and frame size, which
+ * is costly on devices that support many frame sizes. The result of the first
+ * successful enumeration is thus cached and returned by subsequent calls. The
+ * cache is invalidated when the device is closed, and enumeration can be forced
+ * by setting \a refresh to true.
+ *
+ * When the video device has been created from a media entity whose media
+ * device has been populated with a DeviceCache, the result is also stored in
+ * the cache, and retrieved from there by later processes.
+ *
  * \return A list of the supported video device formats
  */
-ImageFormats V4L2VideoDevice::formats()
+ImageFormats V4L2VideoDevice::formats(bool refresh)
 {
+	if (formatsValid_ && !refresh)
+		return formats_;
+
+	DeviceCache::Entry *cache = entity_ ? entity_->device()->cacheEntry() : nullptr;
+	std::string cacheKey = entity_ ? "video:" + entity_->name() : std::string();
+	if (cache && !refresh) {
+		const ImageFormats *cached = cache->formats(cacheKey);
+		if (cached) {
+			formats_ = *cached;
+			formatsValid_ = true;
+			return formats_;
+		}
+	}
+
 	ImageFormats formats;
 
 	for (unsigned int pixelformat : enumPixelformats()) {
@@ -852,9 +1002,167 @@ ImageFormats V4L2VideoDevice::formats()
 		}
 	}
 
+	formats_ = formats;
+	formatsValid_ = true;
+
+	if (cache)
+		cache->setFormats(cacheKey, formats);
+
 	return formats;
 }
 
+/**
+ * \brief Retrieve the frame interval of the V4L2 video device
+ * \param[out] interval The frame interval in microseconds
+ *
+ * \return 0 on success, -ENOTTY if the device doesn't support setting the
+ * frame interval, or another negative error code otherwise
+ */
+int V4L2VideoDevice::getFrameInterval(uint64_t *interval)
+{
+	struct v4l2_streamparm parm = {};
+	struct v4l2_fract *tpf = &parm.parm.capture.timeperframe;
+	int ret;
+
+	parm.type = bufferType_;
+	ret = ioctl(VIDIOC_G_PARM, &parm);
+	if (ret)
+		return ret;
+
+	if (!(parm.parm.capture.capability & V4L2_CAP_TIMEPERFRAME) ||
+	    !tpf->denominator)
+		return -ENOTTY;
+
+	*interval = static_cast<uint64_t>(tpf->numerator) * 1000000
+		  / tpf->denominator;
+
+	return 0;
+}
+
+/**
+ * \brief Set the frame interval of the V4L2 video device
+ * \param[inout] interval The frame interval in microseconds
+ *
+ * Apply the frame \a interval to the video device, and return the interval
+ * actually applied by the driver, which picks the closest interval it
+ * supports. Most drivers don't allow changing the frame interval while
+ * streaming.
+ *
+ * \return 0 on success, -ENOTTY if the device doesn't support setting the
+ * frame interval, or another negative error code otherwise
+ */
+int V4L2VideoDevice::setFrameInterval(uint64_t *interval)
+{
+	struct v4l2_streamparm parm = {};
+	struct v4l2_fract *tpf = &parm.parm.capture.timeperframe;
+	int ret;
+
+	parm.type = bufferType_;
+	tpf->numerator = *interval;
+	tpf->denominator = 1000000;
+
+	ret = ioctl(VIDIOC_S_PARM, &parm);
+	if (ret) {
+		LOG(V4L2, Error)
+			<< "Unable to set frame interval: " << strerror(-ret);
+		return ret;
+	}
+
+	if (!(parm.parm.capture.capability & V4L2_CAP_TIMEPERFRAME) ||
+	    !tpf->denominator)
+		return -ENOTTY;
+
+	*interval = static_cast<uint64_t>(tpf->numerator) * 1000000
+		  / tpf->denominator;
+
+	return 0;
+}
+
+/**
+ * \brief Retrieve the range of frame intervals supported for a format
+ * \param[in] format The pixel format and frame size
+ * \param[out] min The shortest frame interval in microseconds
+ * \param[out] max The longest frame interval in microseconds
+ *
+ * \return 0 on success or a negative error code otherwise
+ */
+int V4L2VideoDevice::frameIntervalRange(const V4L2DeviceFormat &format,
+					uint64_t *min, uint64_t *max)
+{
+	auto toInterval = [](const struct v4l2_fract &fract) -> uint64_t {
+		return fract.denominator ? static_cast<uint64_t>(fract.numerator)
+					   * 1000000 / fract.denominator : 0;
+	};
+
+	*min = UINT64_MAX;
+	*max = 0;
+
+	for (unsigned int index = 0;; index++) {
+		struct v4l2_frmivalenum frameInterval = {};
+		frameInterval.index = index;
+		frameInterval.pixel_format = format.fourcc;
+		frameInterval.width = format.size.width;
+		frameInterval.height = format.size.height;
+
+		int ret = ioctl(VIDIOC_ENUM_FRAMEINTERVALS, &frameInterval);
+		if (ret == -EINVAL && index != 0)
+			break;
+		if (ret)
+			return ret;
+
+		if (frameInterval.type == V4L2_FRMIVAL_TYPE_DISCRETE) {
+			uint64_t interval = toInterval(frameInterval.discrete);
+			*min = std::min(*min, interval);
+			*max = std::max(*max, interval);
+			continue;
+		}
+
+		*min = toInterval(frameInterval.stepwise.min);
+		*max = toInterval(frameInterval.stepwise.max);
+		break;
+	}
+
+	return 0;
+}
+
+/**
+ * \brief Set the crop rectangle of the V4L2 video device
+ * \param[inout] rect The crop rectangle, in pixels of the device input
+ *
+ * Apply the crop rectangle \a rect to the frames processed by the video
+ * device, and return the rectangle actually applied by the driver. Whether the
+ * crop rectangle can be changed while streaming depends on the driver.
+ *
+ * \return 0 on success or a negative error code otherwise
+ */
+int V4L2VideoDevice::setCrop(Rectangle *rect)
+{
+	struct v4l2_selection sel = {};
+
+	sel.type = bufferType_;
+	sel.target = V4L2_SEL_TGT_CROP;
+	sel.flags = 0;
+
+	sel.r.left = rect->x;
+	sel.r.top = rect->y;
+	sel.r.width = rect->w;
+	sel.r.height = rect->h;
+
+	int ret = ioctl(VIDIOC_S_SELECTION, &sel);
+	if (ret < 0) {
+		LOG(V4L2, Error)
+			<< "Unable to set crop rectangle: " << strerror(-ret);
+		return ret;
+	}
+
+	rect->x = sel.r.left;
+	rect->y = sel.r.top;
+	rect->w = sel.r.width;
+	rect->h = sel.r.height;
+
+	return 0;
+}
+
 std::vector<unsigned int> V4L2VideoDevice::enumPixelformats()
 {
 	std::vector<unsigned int> formats;
@@ -940,6 +1248,147 @@ std::vector<SizeRange> V4L2VideoDevice::enumSizes(unsigned int pixelFormat)
 	return sizes;
 }
 
+/*
+ * The buffer I/O paths are specialised at compile time for the buffer type and
+ * memory type of the device, which are fixed when buffers are requested. The
+ * v4l2_buffer structures passed to VIDIOC_QBUF are prebuilt for each buffer
+ * index, and the specialised functions below only update the fields that
+ * depend on the queued FrameBuffer, without testing the device configuration.
+ */
+
+/*
+ * Fill the fields of the \a slot buffer template that depend on the queued
+ * \a buffer. All fields the driver may have written back when the slot was
+ * last queued are set again.
+ */
+template<bool MultiPlanar, bool Output, enum v4l2_memory Memory>
+void V4L2VideoDevice::fillBuffer(BufferTemplate *slot, const FrameBuffer *buffer)
+{
+	struct v4l2_buffer &buf = slot->buf;
+	Span<const FrameBuffer::Plane> planes = buffer->planes();
+	const FrameMetadata &metadata = buffer->metadata();
+
+	buf.field = V4L2_FIELD_NONE;
+
+	if (MultiPlanar) {
+		buf.length = planes.size();
+
+		for (unsigned int p = 0; p < planes.size(); ++p) {
+			struct v4l2_plane &plane = slot->planes[p];
+
+			if (Memory == V4L2_MEMORY_DMABUF)
+				plane.m.fd = planes[p].fd.fd();
+			else if (Memory == V4L2_MEMORY_USERPTR)
+				plane.m.userptr =
+					reinterpret_cast<unsigned long>(planes[p].address);
+
+			plane.length = Output || Memory == V4L2_MEMORY_USERPTR
+				     ? planes[p].length : 0;
+			plane.bytesused = Output && p < metadata.planes().size()
+					? metadata.planes()[p].bytesused : 0;
+			plane.data_offset = 0;
+		}
+	} else {
+		if (Memory == V4L2_MEMORY_DMABUF)
+			buf.m.fd = planes[0].fd.fd();
+		else if (Memory == V4L2_MEMORY_USERPTR)
+			buf.m.userptr = reinterpret_cast<unsigned long>(planes[0].address);
+
+		buf.length = Memory == V4L2_MEMORY_USERPTR ? planes[0].length : 0;
+		buf.bytesused = Output && metadata.planes().size()
+			      ? metadata.planes()[0].bytesused : 0;
+	}
+
+	if (Output) {
+		buf.sequence = metadata.sequence;
+		buf.timestamp.tv_sec = metadata.timestamp / 1000000000;
+		buf.timestamp.tv_usec = (metadata.timestamp / 1000) % 1000000;
+	}
+}
+
+/* Update the planes of the \a metadata from the dequeued buffer \a slot. */
+template<bool MultiPlanar>
+void V4L2VideoDevice::readBuffer(const BufferTemplate &slot,
+				 FrameMetadata *metadata)
+{
+	if (MultiPlanar) {
+		metadata->numPlanes_ = std::min<unsigned int>(slot.buf.length,
+							      FrameMaxPlanes);
+		for (unsigned int p = 0; p < metadata->numPlanes_; p++)
+			metadata->planes_[p].bytesused = slot.planes[p].bytesused;
+	} else {
+		metadata->numPlanes_ = 1;
+		metadata->planes_[0].bytesused = slot.buf.bytesused;
+	}
+}
+
+template<bool MultiPlanar, bool Output>
+V4L2VideoDevice::FillBufferFunc
+V4L2VideoDevice::fillBufferFunc(enum v4l2_memory memory)
+{
+	switch (memory) {
+	case V4L2_MEMORY_DMABUF:
+		return &fillBuffer<MultiPlanar, Output, V4L2_MEMORY_DMABUF>;
+	case V4L2_MEMORY_USERPTR:
+		return &fillBuffer<MultiPlanar, Output, V4L2_MEMORY_USERPTR>;
+	default:
+		return &fillBuffer<MultiPlanar, Output, V4L2_MEMORY_MMAP>;
+	}
+}
+
+/*
+ * Select the buffer I/O paths matching the buffer and memory types of the
+ * device, and prepare the VIDIOC_DQBUF buffer template.
+ */
+void V4L2VideoDevice::selectBufferPaths()
+{
+	const bool multiPlanar = V4L2_TYPE_IS_MULTIPLANAR(bufferType_);
+	const bool output = V4L2_TYPE_IS_OUTPUT(bufferType_);
+
+	if (multiPlanar) {
+		fillBuffer_ = output ? fillBufferFunc<true, true>(memoryType_)
+				     : fillBufferFunc<true, false>(memoryType_);
+		readBuffer_ = &readBuffer<true>;
+	} else {
+		fillBuffer_ = output ? fillBufferFunc<false, true>(memoryType_)
+				     : fillBufferFunc<false, false>(memoryType_);
+		readBuffer_ = &readBuffer<false>;
+	}
+
+	dequeueTemplate_ = {};
+	dequeueTemplate_.buf.type = bufferType_;
+	dequeueTemplate_.buf.memory = memoryType_;
+	if (multiPlanar)
+		dequeueTemplate_.buf.m.planes = dequeueTemplate_.planes.data();
+}
+
+/*
+ * Resize the per-index VIDIOC_QBUF buffer templates to \a count buffers. The
+ * new templates are initialised with the fields that never change, and the
+ * plane pointers of all templates are updated as the vector may have been
+ * reallocated.
+ */
+void V4L2VideoDevice::resizeBufferTemplates(unsigned int count)
+{
+	const bool multiPlanar = V4L2_TYPE_IS_MULTIPLANAR(bufferType_);
+	unsigned int first = bufferTemplates_.size();
+
+	bufferTemplates_.resize(count);
+
+	for (unsigned int i = 0; i < count; ++i) {
+		BufferTemplate &slot = bufferTemplates_[i];
+
+		if (i >= first) {
+			slot.buf.index = i;
+			slot.buf.type = bufferType_;
+			slot.buf.memory = memoryType_;
+		}
+
+		if (multiPlanar)
+			slot.buf.m.planes = slot.planes.data();
+	}
+}
+
 int V4L2VideoDevice::requestBuffers(unsigned int count)
 {
 	struct v4l2_requestbuffers rb = {};
@@ -966,13 +1415,57 @@ int V4L2VideoDevice::requestBuffers(unsigned int count)
 
 	LOG(V4L2, Debug) << rb.count << " buffers requested.";
 
+	/*
+	 * Translate the CPU access pattern to cache maintenance hints, which
+	 * drivers only honour for MMAP buffers.
+	 */
+	cacheFlags_ = 0;
+	if (count && memoryType_ == V4L2_MEMORY_MMAP &&
+	    rb.capabilities & V4L2_BUF_CAP_SUPPORTS_MMAP_CACHE_HINTS) {
+		if (!(cpuAccess_ & FrameBuffer::CpuAccessRead))
+			cacheFlags_ |= V4L2_BUF_FLAG_NO_CACHE_INVALIDATE;
+		if (!(cpuAccess_ & FrameBuffer::CpuAccessWrite))
+			cacheFlags_ |= V4L2_BUF_FLAG_NO_CACHE_CLEAN;
+	}
+
+	/*
+	 * Size the queued buffers table to the number of buffers used by the
+	 * cache, to avoid any memory allocation when queuing and dequeuing
+	 * buffers. As V4L2 buffer indices are dense, the table is addressed
+	 * directly by index, with null entries marking free slots.
+	 */
+	queuedBuffers_.assign(count, nullptr);
+	queuedCount_ = 0;
+
+	bufferTemplates_.clear();
+	resizeBufferTemplates(count);
+	selectBufferPaths();
+
 	return 0;
 }
 
+/**
+ * \fn V4L2VideoDevice::setCpuAccess()
+ * \brief Set the CPU access pattern of the buffers allocated by the device
+ * \param[in] access The CPU access pattern
+ *
+ * Drivers that support cache maintenance hints skip the CPU cache clean and
+ * invalidate operations that \a access makes unnecessary when buffers are
+ * queued and dequeued. The access pattern applies to the buffers allocated by
+ * the next call to exportBuffers(), and is reset to
+ * FrameBuffer::CpuAccessReadWrite when the buffers are released. It has no
+ * effect on imported buffers.
+ */
+
 /**
  * \brief Allocate buffers from the video device
  * \param[in] count Number of buffers to allocate
  * \param[out] buffers Vector to store allocated buffers
+ *
+ * The buffers are exported as dmabufs, one file descriptor per plane, and can
+ * be shared with applications and other devices. Buffers that never leave the
+ * pipeline handler should be allocated with allocateBuffers() instead.
+ *
  * \return The number of allocated buffers on success or a negative error code
  * otherwise
  */
@@ -984,6 +1477,44 @@ int V4L2VideoDevice::exportBuffers(unsigned int count,
 		return -EINVAL;
 	}
 
+	mapBuffers_ = false;
+
+	return createBuffers(count, buffers);
+}
+
+/**
+ * \brief Allocate buffers internal to the pipeline from the video device
+ * \param[in] count Number of buffers to allocate
+ * \param[out] buffers Vector to store allocated buffers
+ *
+ * As opposed to exportBuffers(), the buffers are not exported as dmabufs, but
+ * mapped to the CPU through the video device. They are of the
+ * FrameBuffer::MemoryMmap type, with the plane addresses pointing to the
+ * mappings, and don't consume any file descriptor. The buffers can only be
+ * queued to this video device, and are meant for internal pools that the
+ * pipeline handler accesses from the CPU only, such as metadata or statistics
+ * buffers. They shall not be used after releaseBuffers() is called, which
+ * unmaps them.
+ *
+ * \return The number of allocated buffers on success or a negative error code
+ * otherwise
+ */
+int V4L2VideoDevice::allocateBuffers(unsigned int count,
+				     std::vector<std::unique_ptr<FrameBuffer>> *buffers)
+{
+	if (cache_) {
+		LOG(V4L2, Error) << "Buffers already allocated";
+		return -EINVAL;
+	}
+
+	mapBuffers_ = true;
+
+	return createBuffers(count, buffers);
+}
+
+int V4L2VideoDevice::createBuffers(unsigned int count,
+				   std::vector<std::unique_ptr<FrameBuffer>> *buffers)
+{
 	memoryType_ = V4L2_MEMORY_MMAP;
 
 	int ret = requestBuffers(count);
@@ -1008,7 +1539,9 @@ int V4L2VideoDevice::exportBuffers(unsigned int count,
 			goto err_buf;
 		}
 
-		std::unique_ptr<FrameBuffer> buffer = createBuffer(buf);
+		std::unique_ptr<FrameBuffer> buffer = mapBuffers_
+						    ? createMappedBuffer(buf)
+						    : createBuffer(buf);
 		if (!buffer) {
 			LOG(V4L2, Error) << "Unable to create buffer";
 			ret = -EINVAL;
@@ -1023,9 +1556,10 @@ int V4L2VideoDevice::exportBuffers(unsigned int count,
 	return count;
 
 err_buf:
-	requestBuffers(0);
-
 	buffers->clear();
+	unmapBuffers();
+
+	requestBuffers(0);
 
 	return ret;
 }
@@ -1079,19 +1613,78 @@ FileDescriptor V4L2VideoDevice::exportDmabufFd(unsigned int index,
 	return FileDescriptor(expbuf.fd);
 }
 
+std::unique_ptr<FrameBuffer>
+V4L2VideoDevice::createMappedBuffer(const struct v4l2_buffer &buf)
+{
+	const bool multiPlanar = V4L2_TYPE_IS_MULTIPLANAR(buf.type);
+	const unsigned int numPlanes = multiPlanar ? buf.length : 1;
+
+	if (numPlanes == 0 || numPlanes > VIDEO_MAX_PLANES) {
+		LOG(V4L2, Error) << "Invalid number of planes";
+		return nullptr;
+	}
+
+	std::vector<FrameBuffer::Plane> planes;
+	for (unsigned int nplane = 0; nplane < numPlanes; nplane++) {
+		size_t length = multiPlanar ? buf.m.planes[nplane].length
+					    : buf.length;
+		off_t offset = multiPlanar ? buf.m.planes[nplane].m.mem_offset
+					   : buf.m.offset;
+
+		void *address = mmap(nullptr, length, PROT_READ | PROT_WRITE,
+				     MAP_SHARED, fd(), offset);
+		if (address == MAP_FAILED) {
+			LOG(V4L2, Error)
+				<< "Failed to map buffer: " << strerror(errno);
+			return nullptr;
+		}
+
+		mappings_.emplace_back(address, length);
+
+		FrameBuffer::Plane plane;
+		plane.length = length;
+		plane.address = address;
+
+		planes.push_back(std::move(plane));
+	}
+
+	std::unique_ptr<FrameBuffer> buffer =
+		std::make_unique<FrameBuffer>(std::move(planes));
+	buffer->memory_ = FrameBuffer::MemoryMmap;
+
+	return buffer;
+}
+
+void V4L2VideoDevice::unmapBuffers()
+{
+	for (const auto &mapping : mappings_)
+		munmap(mapping.first, mapping.second);
+
+	mappings_.clear();
+}
+
 /**
  * \brief Prepare the device to import \a count buffers
  * \param[in] count Number of buffers to prepare to import
+ * \param[in] memory The type of memory of the buffers to import
+ *
+ * Buffers are imported as dmabufs by default. When \a memory is
+ * FrameBuffer::MemoryUserPtr, the device captures directly to the application
+ * memory the user pointer buffers wrap, without any copy. All buffers queued
+ * to the device shall then be of the \a memory type.
+ *
  * \return 0 on success or a negative error code otherwise
  */
-int V4L2VideoDevice::importBuffers(unsigned int count)
+int V4L2VideoDevice::importBuffers(unsigned int count,
+				   FrameBuffer::Memory memory)
 {
 	if (cache_) {
 		LOG(V4L2, Error) << "Buffers already allocated";
 		return -EINVAL;
 	}
 
-	memoryType_ = V4L2_MEMORY_DMABUF;
+	memoryType_ = memory == FrameBuffer::MemoryUserPtr
+		    ? V4L2_MEMORY_USERPTR : V4L2_MEMORY_DMABUF;
 
 	int ret = requestBuffers(count);
 	if (ret)
@@ -1104,6 +1697,129 @@ int V4L2VideoDevice::importBuffers(unsigned int count)
 	return 0;
 }
 
+/**
+ * \brief Add buffers to the video device
+ * \param[in] count Number of buffers to add
+ * \param[out] buffers Vector to store the allocated buffers
+ *
+ * Grow the pool of V4L2 buffers of the device by \a count buffers, without
+ * affecting the buffers already allocated. As opposed to exportBuffers() and
+ * importBuffers(), this method may be called while the device is streaming,
+ * which allows increasing the number of buffers in flight without stopping
+ * the device.
+ *
+ * If the device buffers have been allocated with exportBuffers() or
+ * allocateBuffers(), the new buffers are created the same way and appended to
+ * \a buffers, which shall not be null.
+ * If the device has been prepared to import buffers with importBuffers(), \a
+ * count additional buffers can be queued at the same time, and \a buffers
+ * shall be null.
+ *
+ * Buffers added to the device are only freed by releaseBuffers().
+ *
+ * \return The number of added buffers on success or a negative error code
+ * otherwise
+ * \retval -EINVAL No buffers have been allocated, or \a buffers doesn't
+ * match the memory type of the device
+ */
+int V4L2VideoDevice::addBuffers(unsigned int count,
+				std::vector<std::unique_ptr<FrameBuffer>> *buffers)
+{
+	int ret;
+
+	if (!cache_) {
+		LOG(V4L2, Error) << "No buffers allocated";
+		return -EINVAL;
+	}
+
+	if ((memoryType_ == V4L2_MEMORY_MMAP) != (buffers != nullptr)) {
+		LOG(V4L2, Error)
+			<< "Can't "
+			<< (buffers ? "export buffers from an importing"
+				    : "import buffers to an exporting")
+			<< " device";
+		return -EINVAL;
+	}
+
+	if (!count)
+		return 0;
+
+	struct v4l2_create_buffers create = {};
+	create.count = count;
+	create.memory = memoryType_;
+	create.format.type = bufferType_;
+
+	/* Size the buffers for the current format. */
+	ret = ioctl(VIDIOC_G_FMT, &create.format);
+	if (ret < 0) {
+		LOG(V4L2, Error) << "Unable to get format: " << strerror(-ret);
+		return ret;
+	}
+
+	ret = ioctl(VIDIOC_CREATE_BUFS, &create);
+	if (ret < 0) {
+		LOG(V4L2, Error)
+			<< "Unable to create " << count << " buffers: "
+			<< strerror(-ret);
+		return ret;
+	}
+
+	/*
+	 * Buffers can't be freed individually, use all the buffers the driver
+	 * has created, even if it's less than requested.
+	 */
+	if (create.count < count)
+		LOG(V4L2, Warning)
+			<< "Only " << create.count << " buffers of " << count
+			<< " created";
+
+	if (!buffers) {
+		cache_->grow(create.index, create.count);
+	} else {
+		std::vector<std::unique_ptr<FrameBuffer>> created;
+
+		for (unsigned int i = 0; i < create.count; ++i) {
+			struct v4l2_buffer buf = {};
+			struct v4l2_plane planes[VIDEO_MAX_PLANES] = {};
+
+			buf.index = create.index + i;
+			buf.type = bufferType_;
+			buf.memory = memoryType_;
+			buf.length = ARRAY_SIZE(planes);
+			buf.m.planes = planes;
+
+			ret = ioctl(VIDIOC_QUERYBUF, &buf);
+			if (ret < 0) {
+				LOG(V4L2, Error)
+					<< "Unable to query buffer " << buf.index
+					<< ": " << strerror(-ret);
+				return ret;
+			}
+
+			std::unique_ptr<FrameBuffer> buffer = mapBuffers_
+							    ? createMappedBuffer(buf)
+							    : createBuffer(buf);
+			if (!buffer) {
+				LOG(V4L2, Error) << "Unable to create buffer";
+				return -EINVAL;
+			}
+
+			created.push_back(std::move(buffer));
+		}
+
+		cache_->grow(create.index, created);
+		std::move(created.begin(), created.end(),
+			  std::back_inserter(*buffers));
+	}
+
+	queuedBuffers_.resize(create.index + create.count, nullptr);
+	resizeBufferTemplates(create.index + create.count);
+
+	LOG(V4L2, Debug) << "Added " << create.count << " buffers";
+
+	return create.count;
+}
+
 /**
  * \brief Release all internally allocated buffers
  */
@@ -1114,12 +1830,18 @@ int V4L2VideoDevice::releaseBuffers()
 	delete cache_;
 	cache_ = nullptr;
 
+	unmapBuffers();
+	mapBuffers_ = false;
+
+	cpuAccess_ = FrameBuffer::CpuAccessReadWrite;
+
 	return requestBuffers(0);
 }
 
 /**
  * \brief Queue a buffer to the video device
  * \param[in] buffer The buffer to be queued
+ * \param[in] request The media request to queue the buffer to (optional)
  *
  * For capture video devices the \a buffer will be filled with data by the
  * device. For output video devices the \a buffer shall contain valid data and
@@ -1127,127 +1849,136 @@ int V4L2VideoDevice::releaseBuffers()
  * buffer, it will be available for dequeue.
  *
  * The best available V4L2 buffer is picked for \a buffer using the V4L2 buffer
- * cache.
+ * cache. The memory type of \a buffer shall match the memory type the device
+ * buffers have been allocated or imported with.
+ *
+ * If a \a request is specified, the buffer is bound to the request, and is only
+ * queued to the driver when the request is queued with MediaRequest::queue().
  *
  * \return 0 on success or a negative error code otherwise
  */
-int V4L2VideoDevice::queueBuffer(FrameBuffer *buffer)
+int V4L2VideoDevice::queueBuffer(FrameBuffer *buffer, MediaRequest *request)
 {
-	struct v4l2_plane v4l2Planes[VIDEO_MAX_PLANES] = {};
-	struct v4l2_buffer buf = {};
 	int ret;
 
+	bool userptr = buffer->memory() == FrameBuffer::MemoryUserPtr;
+	bool mapped = buffer->memory() == FrameBuffer::MemoryMmap;
+	if (userptr != (memoryType_ == V4L2_MEMORY_USERPTR) ||
+	    mapped != mapBuffers_) {
+		LOG(V4L2, Error) << "Buffer memory type mismatch";
+		return -EINVAL;
+	}
+
 	ret = cache_->get(*buffer);
 	if (ret < 0)
 		return ret;
 
-	buf.index = ret;
-	buf.type = bufferType_;
-	buf.memory = memoryType_;
-	buf.field = V4L2_FIELD_NONE;
-
-	bool multiPlanar = V4L2_TYPE_IS_MULTIPLANAR(buf.type);
-	const std::vector<FrameBuffer::Plane> &planes = buffer->planes();
+	BufferTemplate &slot = bufferTemplates_[ret];
+	struct v4l2_buffer &buf = slot.buf;
 
-	if (buf.memory == V4L2_MEMORY_DMABUF) {
-		if (multiPlanar) {
-			for (unsigned int p = 0; p < planes.size(); ++p)
-				v4l2Planes[p].m.fd = planes[p].fd.fd();
-		} else {
-			buf.m.fd = planes[0].fd.fd();
-		}
-	}
+	buf.flags = cacheFlags_;
+	buf.request_fd = 0;
 
-	if (multiPlanar) {
-		buf.length = planes.size();
-		buf.m.planes = v4l2Planes;
+	if (request) {
+		buf.flags |= V4L2_BUF_FLAG_REQUEST_FD;
+		buf.request_fd = request->fd();
 	}
 
-	if (V4L2_TYPE_IS_OUTPUT(buf.type)) {
-		const FrameMetadata &metadata = buffer->metadata();
-
-		if (multiPlanar) {
-			unsigned int nplane = 0;
-			for (const FrameMetadata::Plane &plane : metadata.planes) {
-				v4l2Planes[nplane].bytesused = plane.bytesused;
-				v4l2Planes[nplane].length = buffer->planes()[nplane].length;
-				nplane++;
-			}
-		} else {
-			if (metadata.planes.size())
-				buf.bytesused = metadata.planes[0].bytesused;
-		}
-
-		buf.sequence = metadata.sequence;
-		buf.timestamp.tv_sec = metadata.timestamp / 1000000000;
-		buf.timestamp.tv_usec = (metadata.timestamp / 1000) % 1000000;
-	}
+	fillBuffer_(&slot, buffer);
 
 	LOG(V4L2, Debug) << "Queueing buffer " << buf.index;
+	LIBCAMERA_TRACEPOINT(V4L2QueueBuffer, fd(), buf.index);
 
 	ret = ioctl(VIDIOC_QBUF, &buf);
 	if (ret < 0) {
-		LOG(V4L2, Error)
+		LOG_RATELIMITED(V4L2, Error)
 			<< "Failed to queue buffer " << buf.index << ": "
 			<< strerror(-ret);
 		return ret;
 	}
 
-	if (queuedBuffers_.empty())
+	if (!queuedCount_)
 		fdEvent_->setEnabled(true);
 
 	queuedBuffers_[buf.index] = buffer;
+	queuedCount_++;
 
 	return 0;
 }
 
+/**
+ * \fn V4L2VideoDevice::queuedBuffers()
+ * \brief Retrieve the number of buffers queued to the device
+ * \return The number of buffers queued and not dequeued yet
+ */
+
 /**
  * \brief Slot to handle completed buffer events from the V4L2 video device
  * \param[in] notifier The event notifier
  *
- * When this slot is called, a Buffer has become available from the device, and
- * will be emitted through the bufferReady Signal.
+ * When this slot is called, one or more Buffers have become available from the
+ * device. All of them are dequeued and emitted one by one through the
+ * bufferReady Signal, and then emitted together through the buffersReady
+ * Signal. Draining the queue avoids going through the event loop once per
+ * completed buffer when the thread handling the device falls behind.
  *
  * For Capture video devices the FrameBuffer will contain valid data.
  * For Output video devices the FrameBuffer can be considered empty.
  */
 void V4L2VideoDevice::bufferAvailable(EventNotifier *notifier)
 {
-	FrameBuffer *buffer = dequeueBuffer();
-	if (!buffer)
-		return;
+	completedBuffers_.clear();
+
+	/*
+	 * Emit bufferReady as buffers are dequeued. If a slot stops the stream,
+	 * the queue is emptied and the loop terminates.
+	 */
+	while (queuedCount_) {
+		FrameBuffer *buffer = dequeueBuffer();
+		if (!buffer)
+			break;
 
-	/* Notify anyone listening to the device. */
-	bufferReady.emit(buffer);
+		completedBuffers_.push_back(buffer);
+
+		/* Notify anyone listening to the device. */
+		CpuScope scope(CameraStatistics::CpuPipeline);
+		bufferReady.emit(buffer);
+	}
+
+	if (!completedBuffers_.empty()) {
+		CpuScope scope(CameraStatistics::CpuPipeline);
+		buffersReady.emit(completedBuffers_);
+	}
 }
 
 /**
  * \brief Dequeue the next available buffer from the video device
  *
  * This method dequeues the next available buffer from the device. If no buffer
- * is available to be dequeued it will return nullptr immediately.
+ * is available to be dequeued it will return nullptr immediately, without
+ * logging an error.
  *
  * \return A pointer to the dequeued buffer on success, or nullptr otherwise
  */
 FrameBuffer *V4L2VideoDevice::dequeueBuffer()
 {
-	struct v4l2_buffer buf = {};
-	struct v4l2_plane planes[VIDEO_MAX_PLANES] = {};
+	struct v4l2_buffer &buf = dequeueTemplate_.buf;
 	int ret;
 
-	buf.type = bufferType_;
-	buf.memory = memoryType_;
-
-	bool multiPlanar = V4L2_TYPE_IS_MULTIPLANAR(buf.type);
-
-	if (multiPlanar) {
-		buf.length = VIDEO_MAX_PLANES;
-		buf.m.planes = planes;
-	}
+	/*
+	 * The driver overwrites the flags, which must not request a media
+	 * request file descriptor, and the number of planes of multiplanar
+	 * buffers. Reset them, the length is ignored for single-planar buffers.
+	 */
+	buf.flags = 0;
+	buf.length = VIDEO_MAX_PLANES;
 
 	ret = ioctl(VIDIOC_DQBUF, &buf);
+	if (ret == -EAGAIN)
+		return nullptr;
+
 	if (ret < 0) {
-		LOG(V4L2, Error)
+		LOG_RATELIMITED(V4L2, Error)
 			<< "Failed to dequeue buffer: " << strerror(-ret);
 		return nullptr;
 	}
@@ -1256,11 +1987,13 @@ FrameBuffer *V4L2VideoDevice::dequeueBuffer()
 
 	cache_->put(buf.index);
 
-	auto it = queuedBuffers_.find(buf.index);
-	FrameBuffer *buffer = it->second;
-	queuedBuffers_.erase(it);
+	ASSERT(buf.index < queuedBuffers_.size() && queuedBuffers_[buf.index]);
 
-	if (queuedBuffers_.empty())
+	FrameBuffer *buffer = queuedBuffers_[buf.index];
+	queuedBuffers_[buf.index] = nullptr;
+	queuedCount_--;
+
+	if (!queuedCount_)
 		fdEvent_->setEnabled(false);
 
 	buffer->metadata_.status = buf.flags & V4L2_BUF_FLAG_ERROR
@@ -1270,13 +2003,10 @@ FrameBuffer *V4L2VideoDevice::dequeueBuffer()
 	buffer->metadata_.timestamp = buf.timestamp.tv_sec * 1000000000ULL
 				    + buf.timestamp.tv_usec * 1000ULL;
 
-	buffer->metadata_.planes.clear();
-	if (multiPlanar) {
-		for (unsigned int nplane = 0; nplane < buf.length; nplane++)
-			buffer->metadata_.planes.push_back({ planes[nplane].bytesused });
-	} else {
-		buffer->metadata_.planes.push_back({ buf.bytesused });
-	}
+	LIBCAMERA_TRACEPOINT(V4L2DequeueBuffer, fd(), buf.index, buf.sequence,
+			     buffer->metadata_.timestamp);
+
+	readBuffer_(dequeueTemplate_, &buffer->metadata_);
 
 	return buffer;
 }
@@ -1286,6 +2016,37 @@ FrameBuffer *V4L2VideoDevice::dequeueBuffer()
  * \brief A Signal emitted when a framebuffer completes
  */
 
+/**
+ * \var V4L2VideoDevice::buffersReady
+ * \brief A Signal emitted with all the framebuffers completed in one batch
+ *
+ * The signal is emitted after the bufferReady signal has been emitted for
+ * every buffer in the batch. Users of the video device shall connect to one of
+ * the two signals only, depending on whether they benefit from processing
+ * completed buffers in batches. The span passed to the slots is only valid
+ * for the duration of the signal emission, the signal shall thus not be
+ * connected to slots invoked asynchronously.
+ */
+
+/**
+ * \brief Retrieve the V4L2 buffer cache statistics
+ *
+ * The statistics report how often queued buffers could reuse the V4L2 buffer
+ * they were previously associated with. When importing buffers, every miss
+ * causes the kernel to map the dmabufs again at VIDIOC_QBUF time. The counters
+ * are reset when buffers are released.
+ *
+ * \return The buffer cache statistics, or all counters set to 0 if no buffers
+ * have been allocated or imported
+ */
+V4L2BufferCache::Statistics V4L2VideoDevice::cacheStatistics() const
+{
+	if (!cache_)
+		return {};
+
+	return cache_->statistics();
+}
+
 /**
  * \brief Start the video stream
  * \return 0 on success or a negative error code otherwise
@@ -1309,8 +2070,8 @@ int V4L2VideoDevice::streamOn()
  *
  * Buffers that are still queued when the video stream is stopped are
  * immediately dequeued with their status set to FrameMetadata::FrameCancelled,
- * and the bufferReady signal is emitted for them. The order in which those
- * buffers are dequeued is not specified.
+ * and the bufferReady and buffersReady signals are emitted for them. The order
+ * in which those buffers are dequeued is not specified.
  *
  * \return 0 on success or a negative error code otherwise
  */
@@ -1325,17 +2086,30 @@ int V4L2VideoDevice::streamOff()
 		return ret;
 	}
 
-	/* Send back all queued buffers. */
-	for (auto it : queuedBuffers_) {
-		FrameBuffer *buffer = it.second;
+	/*
+	 * Send back all queued buffers. Use a local list, as this can be called
+	 * from a buffersReady slot while completedBuffers_ is being iterated.
+	 */
+	std::vector<FrameBuffer *> buffers;
+
+	for (FrameBuffer *&buffer : queuedBuffers_) {
+		if (!buffer)
+			continue;
 
 		buffer->metadata_.status = FrameMetadata::FrameCancelled;
-		bufferReady.emit(buffer);
+		buffers.push_back(buffer);
+		buffer = nullptr;
 	}
 
-	queuedBuffers_.clear();
+	queuedCount_ = 0;
 	fdEvent_->setEnabled(false);
 
+	for (FrameBuffer *buffer : buffers)
+		bufferReady.emit(buffer);
+
+	if (!buffers.empty())
+		buffersReady.emit(buffers);
+
 	return 0;
 }
 
@@ -1367,56 +2141,19 @@ V4L2VideoDevice *V4L2VideoDevice::fromEntityName(const MediaDevice *media,
  */
 PixelFormat V4L2VideoDevice::toPixelFormat(uint32_t v4l2Fourcc)
 {
-	switch (v4l2Fourcc) {
-	/* RGB formats. */
-	case V4L2_PIX_FMT_RGB24:
-		return DRM_FORMAT_BGR888;
-	case V4L2_PIX_FMT_BGR24:
-		return DRM_FORMAT_RGB888;
-	case V4L2_PIX_FMT_ARGB32:
-		return DRM_FORMAT_BGRA8888;
-
-	/* YUV packed formats. */
-	case V4L2_PIX_FMT_YUYV:
-		return DRM_FORMAT_YUYV;
-	case V4L2_PIX_FMT_YVYU:
-		return DRM_FORMAT_YVYU;
-	case V4L2_PIX_FMT_UYVY:
-		return DRM_FORMAT_UYVY;
-	case V4L2_PIX_FMT_VYUY:
-		return DRM_FORMAT_VYUY;
-
-	/* YUY planar formats. */
-	case V4L2_PIX_FMT_NV16:
-	case V4L2_PIX_FMT_NV16M:
-		return DRM_FORMAT_NV16;
-	case V4L2_PIX_FMT_NV61:
-	case V4L2_PIX_FMT_NV61M:
-		return DRM_FORMAT_NV61;
-	case V4L2_PIX_FMT_NV12:
-	case V4L2_PIX_FMT_NV12M:
-		return DRM_FORMAT_NV12;
-	case V4L2_PIX_FMT_NV21:
-	case V4L2_PIX_FMT_NV21M:
-		return DRM_FORMAT_NV21;
-
-	/* Compressed formats. */
-	case V4L2_PIX_FMT_MJPEG:
-		return DRM_FORMAT_MJPEG;
-
-	/* V4L2 formats not yet supported by DRM. */
-	case V4L2_PIX_FMT_GREY:
-	default:
-		/*
-		 * \todo We can't use LOG() in a static method of a Loggable
-		 * class. Until we fix the logger, work around it.
-		 */
-		libcamera::_log(__FILE__, __LINE__, _LOG_CATEGORY(V4L2)(),
-				LogError).stream()
-			<< "Unsupported V4L2 pixel format "
-			<< utils::hex(v4l2Fourcc);
-		return 0;
-	}
+	const PixelFormatInfo &info = PixelFormatInfo::fromV4L2(v4l2Fourcc);
+	if (info.isValid())
+		return info.format;
+
+	/*
+	 * \todo We can't use LOG() in a static method of a Loggable
+	 * class. Until we fix the logger, work around it.
+	 */
+	libcamera::_log(__FILE__, __LINE__, _LOG_CATEGORY(V4L2)(),
+			LogError).stream()
+		<< "Unsupported V4L2 pixel format "
+		<< utils::hex(v4l2Fourcc);
+	return 0;
 }
 
 /**
@@ -1450,44 +2187,14 @@ uint32_t V4L2VideoDevice::toV4L2Fourcc(PixelFormat pixelFormat)
  */
 uint32_t V4L2VideoDevice::toV4L2Fourcc(PixelFormat pixelFormat, bool multiplanar)
 {
-	switch (pixelFormat) {
-	/* RGB formats. */
-	case DRM_FORMAT_BGR888:
-		return V4L2_PIX_FMT_RGB24;
-	case DRM_FORMAT_RGB888:
-		return V4L2_PIX_FMT_BGR24;
-	case DRM_FORMAT_BGRA8888:
-		return V4L2_PIX_FMT_ARGB32;
-
-	/* YUV packed formats. */
-	case DRM_FORMAT_YUYV:
-		return V4L2_PIX_FMT_YUYV;
-	case DRM_FORMAT_YVYU:
-		return V4L2_PIX_FMT_YVYU;
-	case DRM_FORMAT_UYVY:
-		return V4L2_PIX_FMT_UYVY;
-	case DRM_FORMAT_VYUY:
-		return V4L2_PIX_FMT_VYUY;
-
 	/*
-	 * YUY planar formats.
 	 * \todo Add support for non-contiguous memory planes
 	 * \todo Select the format variant not only based on \a multiplanar but
 	 * also take into account the formats supported by the device.
 	 */
-	case DRM_FORMAT_NV16:
-		return V4L2_PIX_FMT_NV16;
-	case DRM_FORMAT_NV61:
-		return V4L2_PIX_FMT_NV61;
-	case DRM_FORMAT_NV12:
-		return V4L2_PIX_FMT_NV12;
-	case DRM_FORMAT_NV21:
-		return V4L2_PIX_FMT_NV21;
-
-	/* Compressed formats. */
-	case DRM_FORMAT_MJPEG:
-		return V4L2_PIX_FMT_MJPEG;
-	}
+	const PixelFormatInfo &info = PixelFormatInfo::info(pixelFormat);
+	if (info.isValid())
+		return info.v4l2Format;
 
 	/*
 	 * \todo We can't use LOG() in a static method of a Loggable
@@ -0,0 +1,265 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * worker_pool.cpp - Work-stealing pool of worker threads
+ */
+
+#include "worker_pool.h"
+
+#include <algorithm>
+#include <string>
+#include <thread>
+
+/**
+ * \file worker_pool.h
+ * \brief Work-stealing pool of worker threads
+ */
+
+namespace libcamera {
+
+/**
+ * \brief A worker thread of a WorkerPool
+ *
+ * Each worker owns a double-ended queue of tasks. The worker pops tasks from
+ * the back of its own queue, while idle workers steal tasks from the front of
+ * the queues of other workers.
+ */
+class WorkerPool::Worker : public Thread
+{
+public:
+	Worker(WorkerPool *pool, unsigned int index)
+		: pool_(pool), index_(index)
+	{
+		setName("lc-worker-" + std::to_string(index));
+	}
+
+	void push(Task task)
+	{
+		MutexLocker locker(mutex_);
+		tasks_.push_back(std::move(task));
+	}
+
+	bool pop(Task *task)
+	{
+		MutexLocker locker(mutex_);
+		if (tasks_.empty())
+			return false;
+
+		*task = std::move(tasks_.back());
+		tasks_.pop_back();
+		return true;
+	}
+
+	bool steal(Task *task)
+	{
+		MutexLocker locker(mutex_);
+		if (tasks_.empty())
+			return false;
+
+		*task = std::move(tasks_.front());
+		tasks_.pop_front();
+		return true;
+	}
+
+protected:
+	void run() override;
+
+private:
+	WorkerPool *pool_;
+	unsigned int index_;
+
+	Mutex mutex_;
+	std::deque<Task> tasks_;
+};
+
+static thread_local WorkerPool *currentPool = nullptr;
+static thread_local unsigned int currentIndex = 0;
+
+void WorkerPool::Worker::run()
+{
+	currentPool = pool_;
+	currentIndex = index_;
+
+	while (true) {
+		Task task;
+
+		if (pop(&task) || pool_->steal(index_, &task)) {
+			{
+				MutexLocker locker(pool_->mutex_);
+				pool_->queued_--;
+			}
+
+			task();
+			task = nullptr;
+
+			pool_->finishTask();
+			continue;
+		}
+
+		MutexLocker locker(pool_->mutex_);
+		pool_->wakeup_.wait(locker, [this]() {
+			return pool_->exit_ || pool_->queued_;
+		});
+
+		if (pool_->exit_ && !pool_->queued_)
+			break;
+	}
+
+	currentPool = nullptr;
+}
+
+/**
+ * \class WorkerPool
+ * \brief A pool of threads to offload CPU-intensive work
+ *
+ * Event loops shall not be blocked by long computations, as they delay the
+ * processing of all other events handled by the thread. The WorkerPool runs
+ * such computations, for instance parsing of statistics, software format
+ * conversion or image encoding, in a set of worker threads without the need
+ * for every component to create its own thread.
+ *
+ * Tasks are submitted with run(). To spread the load, tasks submitted from
+ * outside of the pool are distributed across the workers in a round-robin
+ * fashion, while tasks submitted from within a task are queued to the current
+ * worker. Idle workers steal tasks from busy workers.
+ *
+ * Completion of a task can be reported to an Object through run() with a
+ * receiver, which invokes a method of the receiver in the receiver's thread
+ * once the task completes. The receiver shall not be destroyed before pending
+ * tasks complete.
+ *
+ * Tasks run concurrently and in no particular order. They shall protect all
+ * the data they share, with each other or with other threads.
+ *
+ * A pool shared throughout libcamera can be retrieved with instance().
+ */
+
+/**
+ * \typedef WorkerPool::Task
+ * \brief A task to be run by a WorkerPool
+ */
+
+/**
+ * \brief Create a pool of worker threads
+ * \param[in] workers The number of worker threads, or 0 to use the number of
+ * CPUs
+ */
+WorkerPool::WorkerPool(unsigned int workers)
+	: next_(0), queued_(0), pending_(0), exit_(false)
+{
+	if (!workers)
+		workers = std::max(std::thread::hardware_concurrency(), 1U);
+
+	for (unsigned int i = 0; i < workers; ++i) {
+		workers_.emplace_back(std::make_unique<Worker>(this, i));
+		workers_.back()->start();
+	}
+}
+
+/**
+ * \brief Destroy the pool
+ *
+ * All the tasks queued to the pool are completed before the worker threads are
+ * stopped.
+ */
+WorkerPool::~WorkerPool()
+{
+	{
+		MutexLocker locker(mutex_);
+		exit_ = true;
+	}
+
+	wakeup_.notify_all();
+
+	for (std::unique_ptr<Worker> &worker : workers_)
+		worker->wait();
+}
+
+/**
+ * \fn WorkerPool::workers()
+ * \brief Retrieve the number of worker threads
+ * \return The number of worker threads
+ */
+
+/**
+ * \brief Queue a task to the pool
+ * \param[in] task The task
+ */
+void WorkerPool::run(Task task)
+{
+	unsigned int index = currentPool == this
+			   ? currentIndex : next_++ % workers_.size();
+	Worker *worker = workers_[index].get();
+
+	/*
+	 * Account for the task before queuing it, to ensure the counter never
+	 * underflows if a worker picks the task immediately.
+	 */
+	{
+		MutexLocker locker(mutex_);
+		queued_++;
+		pending_++;
+	}
+
+	worker->push(std::move(task));
+
+	wakeup_.notify_one();
+}
+
+/**
+ * \fn WorkerPool::run(Task task, T *receiver, void (T::*done)(FuncArgs...), Args... args)
+ * \brief Queue a task to the pool and notify \a receiver of its completion
+ * \param[in] task The task
+ * \param[in] receiver The object to notify
+ * \param[in] done The method of \a receiver to call upon completion
+ * \param[in] args The arguments to pass to \a done
+ *
+ * When \a task completes, the \a done method is invoked with \a args in the
+ * thread of \a receiver, through a queued method invocation.
+ */
+
+/**
+ * \brief Wait for all tasks queued to the pool to complete
+ *
+ * This method shall not be called from a task.
+ */
+void WorkerPool::wait()
+{
+	MutexLocker locker(mutex_);
+	idle_.wait(locker, [this]() { return !pending_; });
+}
+
+/**
+ * \brief Retrieve the pool shared throughout libcamera
+ *
+ * The shared pool is created on first use, with one worker thread per CPU.
+ *
+ * \return The shared worker pool
+ */
+WorkerPool *WorkerPool::instance()
+{
+	static WorkerPool pool;
+	return &pool;
+}
+
+bool WorkerPool::steal(unsigned int index, Task *task)
+{
+	for (unsigned int i = 1; i < workers_.size(); ++i) {
+		Worker *worker = workers_[(index + i) % workers_.size()].get();
+		if (worker->steal(task))
+			return true;
+	}
+
+	return false;
+}
+
+void WorkerPool::finishTask()
+{
+	MutexLocker locker(mutex_);
+
+	if (!--pending_)
+		idle_.notify_all();
+}
+
+} /* namespace libcamera */
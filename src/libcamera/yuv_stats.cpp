@@ -0,0 +1,522 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * yuv_stats.cpp - CPU statistics for YUV frames
+ */
+
+#include "yuv_stats.h"
+
+#include <algorithm>
+#include <errno.h>
+
+#include <linux/drm_fourcc.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define YUV_STATS_AVX2 1
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#define YUV_STATS_NEON 1
+#endif
+
+#include <libcamera/buffer.h>
+
+#include "log.h"
+#include "worker_pool.h"
+
+/**
+ * \file yuv_stats.h
+ * \brief CPU statistics for YUV frames
+ */
+
+namespace libcamera {
+
+LOG_DEFINE_CATEGORY(YuvStats)
+
+namespace {
+
+enum Component {
+	Y = 0,
+	Cb = 1,
+	Cr = 2,
+};
+
+/*
+ * Sum the bytes of a line in four lanes, by position modulo 4, adding the
+ * lane sums to \a sums. The lanes map to the components of packed YUV formats
+ * and of the interleaved chroma planes of semi-planar formats.
+ */
+void sumLanes(const uint8_t *src, unsigned int length, uint32_t *sums)
+{
+	for (unsigned int x = 0; x < length; ++x)
+		sums[x & 3] += src[x];
+}
+
+#if defined(__SSE2__)
+
+/*
+ * Each lane is isolated in the low byte of the 32-bit words, and summed by the
+ * SAD instruction against zero.
+ */
+void sumLanesSse2(const uint8_t *src, unsigned int length, uint32_t *sums)
+{
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i mask = _mm_set1_epi32(0xff);
+	__m128i acc[4] = { zero, zero, zero, zero };
+	unsigned int x = 0;
+
+	for (; x + 16 <= length; x += 16) {
+		__m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + x));
+
+		acc[0] = _mm_add_epi64(acc[0], _mm_sad_epu8(_mm_and_si128(v, mask), zero));
+		acc[1] = _mm_add_epi64(acc[1], _mm_sad_epu8(_mm_and_si128(_mm_srli_epi32(v, 8), mask), zero));
+		acc[2] = _mm_add_epi64(acc[2], _mm_sad_epu8(_mm_and_si128(_mm_srli_epi32(v, 16), mask), zero));
+		acc[3] = _mm_add_epi64(acc[3], _mm_sad_epu8(_mm_srli_epi32(v, 24), zero));
+	}
+
+	for (unsigned int i = 0; i < 4; ++i)
+		sums[i] += _mm_cvtsi128_si32(acc[i]) +
+			   _mm_cvtsi128_si32(_mm_unpackhi_epi64(acc[i], acc[i]));
+
+	sumLanes(src + x, length - x, sums);
+}
+
+#endif /* __SSE2__ */
+
+#if defined(YUV_STATS_AVX2)
+
+/*
+ * AVX2 isn't part of the x86-64 baseline, the kernel is compiled for AVX2
+ * explicitly and selected at runtime when the CPU supports it.
+ */
+__attribute__((target("avx2")))
+void sumLanesAvx2(const uint8_t *src, unsigned int length, uint32_t *sums)
+{
+	const __m256i zero = _mm256_setzero_si256();
+	const __m256i mask = _mm256_set1_epi32(0xff);
+	__m256i acc[4] = { zero, zero, zero, zero };
+	unsigned int x = 0;
+
+	for (; x + 32 <= length; x += 32) {
+		__m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src + x));
+
+		acc[0] = _mm256_add_epi64(acc[0], _mm256_sad_epu8(_mm256_and_si256(v, mask), zero));
+		acc[1] = _mm256_add_epi64(acc[1], _mm256_sad_epu8(_mm256_and_si256(_mm256_srli_epi32(v, 8), mask), zero));
+		acc[2] = _mm256_add_epi64(acc[2], _mm256_sad_epu8(_mm256_and_si256(_mm256_srli_epi32(v, 16), mask), zero));
+		acc[3] = _mm256_add_epi64(acc[3], _mm256_sad_epu8(_mm256_srli_epi32(v, 24), zero));
+	}
+
+	for (unsigned int i = 0; i < 4; ++i) {
+		__m128i sum = _mm_add_epi64(_mm256_castsi256_si128(acc[i]),
+					    _mm256_extracti128_si256(acc[i], 1));
+		sums[i] += _mm_cvtsi128_si32(sum) +
+			   _mm_cvtsi128_si32(_mm_unpackhi_epi64(sum, sum));
+	}
+
+	sumLanes(src + x, length - x, sums);
+}
+
+bool cpuHasAvx2()
+{
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("avx2") != 0;
+}
+
+#endif /* YUV_STATS_AVX2 */
+
+#if defined(YUV_STATS_NEON)
+
+/* The lanes are deinterleaved by the load, and accumulated pairwise. */
+void sumLanesNeon(const uint8_t *src, unsigned int length, uint32_t *sums)
+{
+	uint32x4_t acc[4] = { vdupq_n_u32(0), vdupq_n_u32(0),
+			      vdupq_n_u32(0), vdupq_n_u32(0) };
+	unsigned int x = 0;
+
+	for (; x + 64 <= length; x += 64) {
+		uint8x16x4_t v = vld4q_u8(src + x);
+
+		for (unsigned int i = 0; i < 4; ++i)
+			acc[i] = vpadalq_u16(acc[i], vpaddlq_u8(v.val[i]));
+	}
+
+	for (unsigned int i = 0; i < 4; ++i)
+		sums[i] += vaddvq_u32(acc[i]);
+
+	sumLanes(src + x, length - x, sums);
+}
+
+#endif /* YUV_STATS_NEON */
+
+using SumLanesFunc = void (*)(const uint8_t *src, unsigned int length,
+			      uint32_t *sums);
+
+SumLanesFunc selectSumLanes()
+{
+#if defined(YUV_STATS_AVX2)
+	if (cpuHasAvx2())
+		return sumLanesAvx2;
+#endif
+#if defined(__SSE2__)
+	return sumLanesSse2;
+#elif defined(YUV_STATS_NEON)
+	return sumLanesNeon;
+#else
+	return sumLanes;
+#endif
+}
+
+const SumLanesFunc sumLanesOptimized = selectSumLanes();
+
+} /* namespace */
+
+/*
+ * Layout of the supported formats. The lanes map the bytes of a packed line,
+ * or of a chroma line for semi-planar formats, to the components they store,
+ * by position modulo 4.
+ */
+struct YuvStatsEngine::Format {
+	PixelFormat format;
+	bool packed;
+	unsigned int lumaOffset;
+	unsigned int vertSubSampling;
+	std::array<uint8_t, 4> lanes;
+};
+
+const YuvStatsEngine::Format *YuvStatsEngine::findFormat(PixelFormat format)
+{
+	static const Format formats[] = {
+		{ DRM_FORMAT_NV12, false, 0, 2, { Cb, Cr, Cb, Cr } },
+		{ DRM_FORMAT_NV21, false, 0, 2, { Cr, Cb, Cr, Cb } },
+		{ DRM_FORMAT_NV16, false, 0, 1, { Cb, Cr, Cb, Cr } },
+		{ DRM_FORMAT_NV61, false, 0, 1, { Cr, Cb, Cr, Cb } },
+		{ DRM_FORMAT_YUYV, true, 0, 1, { Y, Cb, Y, Cr } },
+		{ DRM_FORMAT_YVYU, true, 0, 1, { Y, Cr, Y, Cb } },
+		{ DRM_FORMAT_UYVY, true, 1, 1, { Cb, Y, Cr, Y } },
+		{ DRM_FORMAT_VYUY, true, 1, 1, { Cr, Y, Cb, Y } },
+	};
+
+	for (const Format &info : formats) {
+		if (info.format == format)
+			return &info;
+	}
+
+	return nullptr;
+}
+
+/**
+ * \struct YuvStats
+ * \brief Statistics computed from a YUV frame by the YuvStatsEngine
+ *
+ * The frame is divided in a grid of GridWidth x GridHeight zones of equal
+ * size, stored in raster order. The grids report the mean value of the
+ * components of each zone on an 8-bit scale, in the encoding of the frame,
+ * without any linearization.
+ *
+ * \var YuvStats::GridWidth
+ * \brief Number of zone columns
+ * \var YuvStats::GridHeight
+ * \brief Number of zone rows
+ * \var YuvStats::HistogramBins
+ * \brief Number of bins of the luma histogram
+ * \var YuvStats::luminance
+ * \brief Mean luma value of the zones
+ * \var YuvStats::cb
+ * \brief Mean blue-difference chroma value of the zones
+ * \var YuvStats::cr
+ * \brief Mean red-difference chroma value of the zones
+ * \var YuvStats::histogram
+ * \brief Histogram of the sampled luma values, each bin covering 256 /
+ * HistogramBins values
+ * \var YuvStats::processingTime
+ * \brief The time spent computing the statistics
+ */
+
+/**
+ * \class YuvStatsEngine
+ * \brief Compute statistics for the 3A algorithms from YUV frames on the CPU
+ *
+ * Cameras that produce YUV frames without an ISP, such as USB webcams or
+ * sensors with an embedded ISP connected to a simple capture interface,
+ * provide no statistics to drive auto-exposure and auto white balance. The
+ * YuvStatsEngine computes a grid of mean luma and chroma values, and a luma
+ * histogram, from the frames in memory.
+ *
+ * Only one line every \a step lines is sampled, as configured with
+ * configure(). The sampled lines are summed per zone with SIMD code, and the
+ * histogram samples one pixel every \a step pixels. The frame is split in
+ * horizontal stripes of zone rows processed concurrently when multiple
+ * threads are requested.
+ *
+ * The frame buffers are mapped once, the mappings are cached until clear() is
+ * called. Callers that already access the frame from the CPU can pass the
+ * planes directly to avoid mapping and synchronizing the buffer twice.
+ */
+
+/**
+ * \brief Construct a YuvStatsEngine
+ * \param[in] threads The number of threads, 0 for one per CPU
+ *
+ * With a single thread, the default, the statistics are computed in the
+ * calling thread.
+ */
+YuvStatsEngine::YuvStatsEngine(unsigned int threads)
+	: format_(nullptr), stride_(0), step_(1), zoneColumns_{}, zoneLines_{},
+	  sums_{}, lines_{}, buffers_(MappedFrameBuffer::MapRead)
+{
+	if (threads != 1)
+		pool_ = std::make_unique<WorkerPool>(threads);
+}
+
+YuvStatsEngine::~YuvStatsEngine()
+{
+}
+
+/**
+ * \brief Check if statistics can be computed for a format
+ * \param[in] format The pixel format
+ * \return True if \a format is supported, false otherwise
+ */
+bool YuvStatsEngine::isSupported(PixelFormat format)
+{
+	return findFormat(format) != nullptr;
+}
+
+/**
+ * \brief Configure the engine for a frame format
+ * \param[in] format The pixel format of the frames
+ * \param[in] size The size of the frames
+ * \param[in] stride The line stride of the frames, in bytes
+ * \param[in] step The sampling step, in lines and pixels
+ *
+ * The chroma plane of semi-planar formats is expected to have the same stride
+ * as the luma plane.
+ *
+ * \return 0 on success or a negative error code otherwise
+ * \retval -EINVAL The format, size or step isn't supported
+ */
+int YuvStatsEngine::configure(PixelFormat format, const Size &size,
+			      unsigned int stride, unsigned int step)
+{
+	const Format *info = findFormat(format);
+	if (!info || !step || size.width % 2 ||
+	    size.width < YuvStats::GridWidth * 2 ||
+	    size.height < YuvStats::GridHeight) {
+		LOG(YuvStats, Error)
+			<< "Unsupported format " << utils::hex(format) << " "
+			<< size.toString();
+		return -EINVAL;
+	}
+
+	if (stride < size.width * (info->packed ? 2 : 1)) {
+		LOG(YuvStats, Error) << "Stride " << stride << " too small";
+		return -EINVAL;
+	}
+
+	format_ = info;
+	size_ = size;
+	stride_ = stride;
+	step_ = step;
+
+	/* Zones span an even number of columns to cover whole chroma pairs. */
+	for (unsigned int i = 0; i <= YuvStats::GridWidth; ++i)
+		zoneColumns_[i] = i * size.width / YuvStats::GridWidth & ~1U;
+	for (unsigned int i = 0; i <= YuvStats::GridHeight; ++i)
+		zoneLines_[i] = i * size.height / YuvStats::GridHeight;
+
+	/* Split the frame in stripes of whole zone rows. */
+	unsigned int count = pool_ ? std::min(pool_->workers(), YuvStats::GridHeight) : 1;
+
+	stripes_.resize(count);
+	for (unsigned int i = 0; i < count; ++i) {
+		stripes_[i].firstRow = i * YuvStats::GridHeight / count;
+		stripes_[i].lastRow = (i + 1) * YuvStats::GridHeight / count;
+	}
+
+	buffers_.clear();
+
+	return 0;
+}
+
+/**
+ * \brief Compute the statistics of a frame buffer
+ * \param[in] buffer The frame buffer
+ * \param[out] stats The statistics
+ *
+ * The \a buffer is mapped on first use, and synchronized for CPU access for
+ * the duration of the computation.
+ *
+ * \return 0 on success or a negative error code otherwise
+ */
+int YuvStatsEngine::process(const FrameBuffer *buffer, YuvStats *stats)
+{
+	if (!format_)
+		return -EINVAL;
+
+	const MappedFrameBuffer *mapped = buffers_.map(buffer);
+	if (!mapped) {
+		LOG(YuvStats, Error) << "Failed to map buffer";
+		return -ENOMEM;
+	}
+
+	const std::vector<MappedFrameBuffer::Plane> &planes = mapped->planes();
+	size_t lumaSize = static_cast<size_t>(stride_) * size_.height;
+	size_t chromaSize = format_->packed ? 0
+			  : lumaSize / format_->vertSubSampling;
+	const uint8_t *y = planes[0].data;
+	const uint8_t *uv = nullptr;
+
+	if (planes.size() == 1) {
+		if (planes[0].length < lumaSize + chromaSize)
+			return -EINVAL;
+		uv = y + lumaSize;
+	} else {
+		if (planes[0].length < lumaSize || planes[1].length < chromaSize)
+			return -EINVAL;
+		uv = planes[1].data;
+	}
+
+	ScopedCpuAccess access(*mapped, format_->packed ? 1 : ScopedCpuAccess::AllPlanes);
+	if (access.error())
+		return -EIO;
+
+	process(y, uv, stats);
+	return 0;
+}
+
+/**
+ * \brief Compute the statistics of a frame in memory
+ * \param[in] y The luma plane, or the frame for packed formats
+ * \param[in] uv The chroma plane, ignored for packed formats
+ * \param[out] stats The statistics
+ *
+ * The caller is responsible for synchronizing the frame memory for CPU
+ * access.
+ */
+void YuvStatsEngine::process(const uint8_t *y, const uint8_t *uv,
+			     YuvStats *stats)
+{
+	utils::time_point start = utils::clock::now();
+
+	if (!pool_ || stripes_.size() == 1) {
+		for (Stripe &stripe : stripes_)
+			processStripe(stripe, y, uv);
+	} else {
+		for (Stripe &stripe : stripes_) {
+			pool_->run([this, &stripe, y, uv]() {
+				processStripe(stripe, y, uv);
+			});
+		}
+
+		pool_->wait();
+	}
+
+	/*
+	 * Chroma is subsampled horizontally by two, and sampled on the same
+	 * lines as luma.
+	 */
+	for (unsigned int row = 0; row < YuvStats::GridHeight; ++row) {
+		for (unsigned int col = 0; col < YuvStats::GridWidth; ++col) {
+			unsigned int zone = row * YuvStats::GridWidth + col;
+			unsigned int count = (zoneColumns_[col + 1] - zoneColumns_[col])
+					   * lines_[row];
+			if (!count) {
+				stats->luminance[zone] = 0;
+				stats->cb[zone] = 128;
+				stats->cr[zone] = 128;
+				continue;
+			}
+
+			stats->luminance[zone] = sums_[Y][zone] / count;
+			stats->cb[zone] = sums_[Cb][zone] * 2 / count;
+			stats->cr[zone] = sums_[Cr][zone] * 2 / count;
+		}
+	}
+
+	stats->histogram.fill(0);
+	for (const Stripe &stripe : stripes_) {
+		for (unsigned int i = 0; i < YuvStats::HistogramBins; ++i)
+			stats->histogram[i] += stripe.histogram[i];
+	}
+
+	stats->processingTime = utils::clock::now() - start;
+}
+
+/**
+ * \brief Release the cached buffer mappings
+ *
+ * The mappings shall be released before the buffers passed to process() are
+ * freed.
+ */
+void YuvStatsEngine::clear()
+{
+	buffers_.clear();
+}
+
+void YuvStatsEngine::processStripe(Stripe &stripe, const uint8_t *y,
+				   const uint8_t *uv)
+{
+	constexpr unsigned int BinShift = 2;
+	static_assert(256 >> BinShift == YuvStats::HistogramBins,
+		      "Invalid histogram bin shift");
+	static const std::array<uint8_t, 4> lumaLanes = { Y, Y, Y, Y };
+
+	const Format &format = *format_;
+	const unsigned int bytesPerPixel = format.packed ? 2 : 1;
+
+	for (unsigned int row = stripe.firstRow; row < stripe.lastRow; ++row) {
+		for (std::array<uint32_t, Zones> &sums : sums_)
+			std::fill_n(&sums[row * YuvStats::GridWidth],
+				    YuvStats::GridWidth, 0);
+		lines_[row] = 0;
+	}
+
+	stripe.histogram.fill(0);
+
+	/* Sample the lines at fixed positions independently of the stripes. */
+	unsigned int first = zoneLines_[stripe.firstRow];
+	first = (first + step_ - 1) / step_ * step_;
+
+	unsigned int row = stripe.firstRow;
+
+	for (unsigned int line = first; line < zoneLines_[stripe.lastRow];
+	     line += step_) {
+		while (line >= zoneLines_[row + 1])
+			row++;
+
+		const uint8_t *src = y + line * stride_;
+
+		if (format.packed) {
+			sumLine(src, row, format.lanes, bytesPerPixel);
+		} else {
+			const uint8_t *chroma = uv + line / format.vertSubSampling * stride_;
+			sumLine(src, row, lumaLanes, bytesPerPixel);
+			sumLine(chroma, row, format.lanes, bytesPerPixel);
+		}
+
+		lines_[row]++;
+
+		for (unsigned int x = 0; x < size_.width; x += step_)
+			stripe.histogram[src[x * bytesPerPixel + format.lumaOffset] >> BinShift]++;
+	}
+}
+
+void YuvStatsEngine::sumLine(const uint8_t *line, unsigned int zoneRow,
+			     const std::array<uint8_t, 4> &lanes,
+			     unsigned int bytesPerPixel)
+{
+	for (unsigned int col = 0; col < YuvStats::GridWidth; ++col) {
+		unsigned int begin = zoneColumns_[col] * bytesPerPixel;
+		unsigned int end = zoneColumns_[col + 1] * bytesPerPixel;
+		uint32_t sums[4] = {};
+
+		sumLanesOptimized(line + begin, end - begin, sums);
+
+		unsigned int zone = zoneRow * YuvStats::GridWidth + col;
+		for (unsigned int i = 0; i < 4; ++i)
+			sums_[lanes[i]][zone] += sums[i];
+	}
+}
+
+} /* namespace libcamera */
@@ -7,246 +7,116 @@
 
 #include <errno.h>
 
-#include <linux/drm_fourcc.h>
-
 #include <QImage>
 
+#include <libcamera/pixelformats.h>
+
 #include "format_converter.h"
 
-#define RGBSHIFT		8
-#ifndef MAX
-#define MAX(a,b)		((a)>(b)?(a):(b))
-#endif
-#ifndef MIN
-#define MIN(a,b)		((a)<(b)?(a):(b))
-#endif
-#ifndef CLAMP
-#define CLAMP(a,low,high)	MAX((low),MIN((high),(a)))
-#endif
-#ifndef CLIP
-#define CLIP(x)			CLAMP(x,0,255)
-#endif
+FormatConverter::FormatConverter()
+	: format_(0), width_(0), height_(0), compressed_(false),
+	  displayWidth_(0), displayHeight_(0)
+{
+}
 
 int FormatConverter::configure(unsigned int format, unsigned int width,
 			       unsigned int height)
 {
-	switch (format) {
-	case DRM_FORMAT_NV12:
-		formatFamily_ = NV;
-		horzSubSample_ = 2;
-		vertSubSample_ = 2;
-		nvSwap_ = false;
-		break;
-	case DRM_FORMAT_NV21:
-		formatFamily_ = NV;
-		horzSubSample_ = 2;
-		vertSubSample_ = 2;
-		nvSwap_ = true;
-		break;
-	case DRM_FORMAT_NV16:
-		formatFamily_ = NV;
-		horzSubSample_ = 2;
-		vertSubSample_ = 1;
-		nvSwap_ = false;
-		break;
-	case DRM_FORMAT_NV61:
-		formatFamily_ = NV;
-		horzSubSample_ = 2;
-		vertSubSample_ = 1;
-		nvSwap_ = true;
-		break;
-	case DRM_FORMAT_NV24:
-		formatFamily_ = NV;
-		horzSubSample_ = 1;
-		vertSubSample_ = 1;
-		nvSwap_ = false;
-		break;
-	case DRM_FORMAT_NV42:
-		formatFamily_ = NV;
-		horzSubSample_ = 1;
-		vertSubSample_ = 1;
-		nvSwap_ = true;
-		break;
-	case DRM_FORMAT_RGB888:
-		formatFamily_ = RGB;
-		r_pos_ = 2;
-		g_pos_ = 1;
-		b_pos_ = 0;
-		bpp_ = 3;
-		break;
-	case DRM_FORMAT_BGR888:
-		formatFamily_ = RGB;
-		r_pos_ = 0;
-		g_pos_ = 1;
-		b_pos_ = 2;
-		bpp_ = 3;
-		break;
-	case DRM_FORMAT_BGRA8888:
-		formatFamily_ = RGB;
-		r_pos_ = 1;
-		g_pos_ = 2;
-		b_pos_ = 3;
-		bpp_ = 4;
-		break;
-	case DRM_FORMAT_VYUY:
-		formatFamily_ = YUV;
-		y_pos_ = 1;
-		cb_pos_ = 2;
-		break;
-	case DRM_FORMAT_YVYU:
-		formatFamily_ = YUV;
-		y_pos_ = 0;
-		cb_pos_ = 3;
-		break;
-	case DRM_FORMAT_UYVY:
-		formatFamily_ = YUV;
-		y_pos_ = 1;
-		cb_pos_ = 0;
-		break;
-	case DRM_FORMAT_YUYV:
-		formatFamily_ = YUV;
-		y_pos_ = 0;
-		cb_pos_ = 1;
-		break;
-	case DRM_FORMAT_MJPEG:
-		formatFamily_ = MJPEG;
-		break;
-	default:
+	const libcamera::PixelFormatInfo &info =
+		libcamera::PixelFormatInfo::info(format);
+	if (!info.isValid())
 		return -EINVAL;
-	};
 
+	convertLine_ = lineConverter(format);
+	if (!convertLine_ && !info.compressed)
+		return -EINVAL;
+
+	compressed_ = info.compressed;
 	format_ = format;
 	width_ = width;
 	height_ = height;
 
+	if (compressed_)
+		return 0;
+
+	/* The chroma plane, if any, follows the luma plane. */
+	const libcamera::Size size(width, height);
+	unsigned int vertSubSample = info.numPlanes > 1
+				   ? info.planes[1].verticalSubSampling : 1;
+
+	stripes_.configure(convertLine_, width, height, info.stride(width, 0),
+			   info.planeSize(size, 0), info.stride(width, 1),
+			   vertSubSample);
+
 	return 0;
 }
 
+/*
+ * Convert the frame line by line. The line converters are selected at
+ * configure() time for the format, and vectorized when possible. Frames are
+ * split in row stripes converted concurrently when multiple threads are
+ * configured with setThreads().
+ */
 void FormatConverter::convert(const unsigned char *src, size_t size,
 			      QImage *dst)
 {
-	switch (formatFamily_) {
-	case MJPEG:
+	if (compressed_) {
+#ifdef HAVE_LIBJPEG
+		convertJpeg(src, size, dst);
+#else
 		dst->loadFromData(src, size, "JPEG");
-		break;
-	case YUV:
-		convertYUV(src, dst->bits());
-		break;
-	case RGB:
-		convertRGB(src, dst->bits());
-		break;
-	case NV:
-		convertNV(src, dst->bits());
-		break;
-	};
-}
+#endif
+		return;
+	}
 
-static void yuv_to_rgb(int y, int u, int v, int *r, int *g, int *b)
-{
-	int c = y - 16;
-	int d = u - 128;
-	int e = v - 128;
-	*r = CLIP(( 298 * c           + 409 * e + 128) >> RGBSHIFT);
-	*g = CLIP(( 298 * c - 100 * d - 208 * e + 128) >> RGBSHIFT);
-	*b = CLIP(( 298 * c + 516 * d           + 128) >> RGBSHIFT);
+	stripes_.convert(src, dst->bits());
 }
 
-void FormatConverter::convertNV(const unsigned char *src, unsigned char *dst)
+#ifdef HAVE_LIBJPEG
+/*
+ * Decode MJPEG frames in place in the destination image. When the display is
+ * smaller than the stream, frames are downscaled by the largest power of two
+ * (up to 8) that keeps them at least as large as the display. The destination
+ * image is only reallocated when the scaling factor changes.
+ */
+void FormatConverter::convertJpeg(const unsigned char *src, size_t size,
+				  QImage *dst)
 {
-	unsigned int c_stride = width_ * (2 / horzSubSample_);
-	unsigned int c_inc = horzSubSample_ == 1 ? 2 : 0;
-	unsigned int cb_pos = nvSwap_ ? 1 : 0;
-	unsigned int cr_pos = nvSwap_ ? 0 : 1;
-	const unsigned char *src_c = src + width_ * height_;
-	int r, g, b;
-
-	for (unsigned int y = 0; y < height_; y++) {
-		const unsigned char *src_y = src + y * width_;
-		const unsigned char *src_cb = src_c + (y / vertSubSample_) *
-					      c_stride + cb_pos;
-		const unsigned char *src_cr = src_c + (y / vertSubSample_) *
-					      c_stride + cr_pos;
-
-		for (unsigned int x = 0; x < width_; x += 2) {
-			yuv_to_rgb(*src_y, *src_cb, *src_cr, &r, &g, &b);
-			dst[0] = b;
-			dst[1] = g;
-			dst[2] = r;
-			dst[3] = 0xff;
-			src_y++;
-			src_cb += c_inc;
-			src_cr += c_inc;
-			dst += 4;
-
-			yuv_to_rgb(*src_y, *src_cb, *src_cr, &r, &g, &b);
-			dst[0] = b;
-			dst[1] = g;
-			dst[2] = r;
-			dst[3] = 0xff;
-			src_y++;
-			src_cb += 2;
-			src_cr += 2;
-			dst += 4;
-		}
+	unsigned int scale = displayWidth_ && displayHeight_ ? 8 : 1;
+
+	for (; scale > 1; scale /= 2) {
+		if (JpegDecoder::scaledSize(width_, scale) >= displayWidth_ &&
+		    JpegDecoder::scaledSize(height_, scale) >= displayHeight_)
+			break;
 	}
+
+	unsigned int width = JpegDecoder::scaledSize(width_, scale);
+	unsigned int height = JpegDecoder::scaledSize(height_, scale);
+
+	if (dst->width() != static_cast<int>(width) ||
+	    dst->height() != static_cast<int>(height))
+		*dst = QImage(width, height, QImage::Format_RGB32);
+
+	if (!jpeg_)
+		jpeg_ = std::make_unique<JpegDecoder>();
+
+	jpeg_->decode(src, size, scale, dst->bits(), width, height,
+		      dst->bytesPerLine());
 }
+#endif
 
-void FormatConverter::convertRGB(const unsigned char *src, unsigned char *dst)
+void FormatConverter::setThreads(unsigned int threads)
 {
-	unsigned int x, y;
-	int r, g, b;
-
-	for (y = 0; y < height_; y++) {
-		for (x = 0; x < width_; x++) {
-			r = src[bpp_ * x + r_pos_];
-			g = src[bpp_ * x + g_pos_];
-			b = src[bpp_ * x + b_pos_];
-
-			dst[4 * x + 0] = b;
-			dst[4 * x + 1] = g;
-			dst[4 * x + 2] = r;
-			dst[4 * x + 3] = 0xff;
-		}
-
-		src += width_ * bpp_;
-		dst += width_ * 4;
-	}
+	stripes_.setThreads(threads);
 }
 
-void FormatConverter::convertYUV(const unsigned char *src, unsigned char *dst)
+/*
+ * Set the size at which frames are displayed. This allows decoding compressed
+ * formats at a lower resolution, other formats are always converted at the
+ * stream resolution.
+ */
+void FormatConverter::setDisplaySize(unsigned int width, unsigned int height)
 {
-	unsigned int src_x, src_y, dst_x, dst_y;
-	unsigned int src_stride;
-	unsigned int dst_stride;
-	unsigned int cr_pos;
-	int r, g, b, y, cr, cb;
-
-	cr_pos = (cb_pos_ + 2) % 4;
-	src_stride = width_ * 2;
-	dst_stride = width_ * 4;
-
-	for (src_y = 0, dst_y = 0; dst_y < height_; src_y++, dst_y++) {
-		for (src_x = 0, dst_x = 0; dst_x < width_; ) {
-			cb = src[src_y * src_stride + src_x * 4 + cb_pos_];
-			cr = src[src_y * src_stride + src_x * 4 + cr_pos];
-
-			y = src[src_y * src_stride + src_x * 4 + y_pos_];
-			yuv_to_rgb(y, cb, cr, &r, &g, &b);
-			dst[dst_y * dst_stride + 4 * dst_x + 0] = b;
-			dst[dst_y * dst_stride + 4 * dst_x + 1] = g;
-			dst[dst_y * dst_stride + 4 * dst_x + 2] = r;
-			dst[dst_y * dst_stride + 4 * dst_x + 3] = 0xff;
-			dst_x++;
-
-			y = src[src_y * src_stride + src_x * 4 + y_pos_ + 2];
-			yuv_to_rgb(y, cb, cr, &r, &g, &b);
-			dst[dst_y * dst_stride + 4 * dst_x + 0] = b;
-			dst[dst_y * dst_stride + 4 * dst_x + 1] = g;
-			dst[dst_y * dst_stride + 4 * dst_x + 2] = r;
-			dst[dst_y * dst_stride + 4 * dst_x + 3] = 0xff;
-			dst_x++;
-
-			src_x++;
-		}
-	}
+	displayWidth_ = width;
+	displayHeight_ = height;
 }
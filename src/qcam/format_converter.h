@@ -7,50 +7,47 @@
 #ifndef __QCAM_FORMAT_CONVERTER_H__
 #define __QCAM_FORMAT_CONVERTER_H__
 
+#include <memory>
 #include <stddef.h>
 
+#include "format_kernels.h"
+#ifdef HAVE_LIBJPEG
+#include "jpeg_decoder.h"
+#endif
+#include "stripe_converter.h"
+
 class QImage;
 
 class FormatConverter
 {
 public:
+	FormatConverter();
+
 	int configure(unsigned int format, unsigned int width,
 		      unsigned int height);
 
 	void convert(const unsigned char *src, size_t size, QImage *dst);
 
-private:
-	enum FormatFamily {
-		MJPEG,
-		NV,
-		RGB,
-		YUV,
-	};
-
-	void convertNV(const unsigned char *src, unsigned char *dst);
-	void convertRGB(const unsigned char *src, unsigned char *dst);
-	void convertYUV(const unsigned char *src, unsigned char *dst);
+	void setThreads(unsigned int threads);
+	void setDisplaySize(unsigned int width, unsigned int height);
 
+private:
 	unsigned int format_;
 	unsigned int width_;
 	unsigned int height_;
+	bool compressed_;
 
-	enum FormatFamily formatFamily_;
-
-	/* NV parameters */
-	unsigned int horzSubSample_;
-	unsigned int vertSubSample_;
-	bool nvSwap_;
+	LineConverter convertLine_;
+	StripeConverter stripes_;
 
-	/* RGB parameters */
-	unsigned int bpp_;
-	unsigned int r_pos_;
-	unsigned int g_pos_;
-	unsigned int b_pos_;
+	/* MJPEG parameters */
+	unsigned int displayWidth_;
+	unsigned int displayHeight_;
+#ifdef HAVE_LIBJPEG
+	void convertJpeg(const unsigned char *src, size_t size, QImage *dst);
 
-	/* YUV parameters */
-	unsigned int y_pos_;
-	unsigned int cb_pos_;
+	std::unique_ptr<JpegDecoder> jpeg_;
+#endif
 };
 
 #endif /* __QCAM_FORMAT_CONVERTER_H__ */
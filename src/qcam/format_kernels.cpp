@@ -0,0 +1,426 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * format_kernels.cpp - qcam - Line conversion kernels to RGB
+ */
+
+#include <stdint.h>
+
+#include <linux/drm_fourcc.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+#include "format_kernels.h"
+
+/*
+ * The kernels are templates on the format parameters (chroma subsampling and
+ * component positions), so that the inner loops are free of branches. Each
+ * kernel converts as many pixels as possible with SSE2 on x86 or NEON on ARM,
+ * both available unconditionally on the 64-bit variants of the architectures,
+ * and the remaining pixels with scalar code. The vector code produces exactly
+ * the same results as the scalar code.
+ *
+ * YUV is converted to RGB with the BT.601 limited range matrix, in 8-bit
+ * fixed point.
+ */
+
+namespace {
+
+inline unsigned char clip(int value)
+{
+	return value < 0 ? 0 : value > 255 ? 255 : value;
+}
+
+inline void yuvToBgra(int y, int u, int v, unsigned char *dst)
+{
+	int c = y - 16;
+	int d = u - 128;
+	int e = v - 128;
+
+	dst[0] = clip((298 * c + 516 * d + 128) >> 8);
+	dst[1] = clip((298 * c - 100 * d - 208 * e + 128) >> 8);
+	dst[2] = clip((298 * c + 409 * e + 128) >> 8);
+	dst[3] = 0xff;
+}
+
+#if defined(__SSE2__)
+
+/* Number of pixels converted per vector iteration. */
+constexpr unsigned int SimdPixels = 8;
+
+/* Pack the coefficients a and b for _mm_madd_epi16() on (a, b) pairs. */
+inline __m128i coefficients(int16_t a, int16_t b)
+{
+	uint32_t value = static_cast<uint32_t>(static_cast<uint16_t>(b)) << 16 |
+			 static_cast<uint16_t>(a);
+	return _mm_set1_epi32(static_cast<int32_t>(value));
+}
+
+inline __m128i fixedPoint(__m128i lo, __m128i hi)
+{
+	const __m128i round = _mm_set1_epi32(128);
+
+	lo = _mm_srai_epi32(_mm_add_epi32(lo, round), 8);
+	hi = _mm_srai_epi32(_mm_add_epi32(hi, round), 8);
+
+	return _mm_packs_epi32(lo, hi);
+}
+
+/*
+ * Convert 8 pixels, with the Y, U and V components stored in the 16-bit lanes
+ * of y, u and v.
+ */
+inline void yuvToBgra8(__m128i y, __m128i u, __m128i v, unsigned char *dst)
+{
+	const __m128i zero = _mm_setzero_si128();
+
+	__m128i c = _mm_sub_epi16(y, _mm_set1_epi16(16));
+	__m128i d = _mm_sub_epi16(u, _mm_set1_epi16(128));
+	__m128i e = _mm_sub_epi16(v, _mm_set1_epi16(128));
+
+	__m128i cdLo = _mm_unpacklo_epi16(c, d);
+	__m128i cdHi = _mm_unpackhi_epi16(c, d);
+	__m128i ceLo = _mm_unpacklo_epi16(c, e);
+	__m128i ceHi = _mm_unpackhi_epi16(c, e);
+	__m128i ezLo = _mm_unpacklo_epi16(e, zero);
+	__m128i ezHi = _mm_unpackhi_epi16(e, zero);
+
+	const __m128i kB = coefficients(298, 516);
+	const __m128i kG = coefficients(298, -100);
+	const __m128i kGe = coefficients(-208, 0);
+	const __m128i kR = coefficients(298, 409);
+
+	__m128i b = fixedPoint(_mm_madd_epi16(cdLo, kB), _mm_madd_epi16(cdHi, kB));
+	__m128i g = fixedPoint(_mm_add_epi32(_mm_madd_epi16(cdLo, kG),
+					     _mm_madd_epi16(ezLo, kGe)),
+			       _mm_add_epi32(_mm_madd_epi16(cdHi, kG),
+					     _mm_madd_epi16(ezHi, kGe)));
+	__m128i r = fixedPoint(_mm_madd_epi16(ceLo, kR), _mm_madd_epi16(ceHi, kR));
+
+	/* Saturate to 8 bits and interleave to BGRA. */
+	__m128i bg = _mm_unpacklo_epi8(_mm_packus_epi16(b, b), _mm_packus_epi16(g, g));
+	__m128i ra = _mm_unpacklo_epi8(_mm_packus_epi16(r, r), _mm_set1_epi8(-1));
+
+	_mm_storeu_si128(reinterpret_cast<__m128i *>(dst),
+			 _mm_unpacklo_epi16(bg, ra));
+	_mm_storeu_si128(reinterpret_cast<__m128i *>(dst + 16),
+			 _mm_unpackhi_epi16(bg, ra));
+}
+
+/* Duplicate the low or high 16-bit half of each 32-bit lane. */
+inline __m128i duplicateLow(__m128i value)
+{
+	value = _mm_and_si128(value, _mm_set1_epi32(0xffff));
+	return _mm_or_si128(value, _mm_slli_epi32(value, 16));
+}
+
+inline __m128i duplicateHigh(__m128i value)
+{
+	value = _mm_srli_epi32(value, 16);
+	return _mm_or_si128(value, _mm_slli_epi32(value, 16));
+}
+
+template<bool Swap, unsigned int HSub>
+unsigned int convertNVSimd(const unsigned char *src, const unsigned char *chroma,
+			   unsigned char *dst, unsigned int width)
+{
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i lowBytes = _mm_set1_epi16(0xff);
+	unsigned int x;
+
+	for (x = 0; x + SimdPixels <= width; x += SimdPixels) {
+		__m128i y = _mm_loadl_epi64(reinterpret_cast<const __m128i *>(src + x));
+		y = _mm_unpacklo_epi8(y, zero);
+
+		__m128i first, second;
+		if (HSub == 2) {
+			/* 4 chroma pairs, one for every two pixels. */
+			__m128i uv = _mm_loadl_epi64(reinterpret_cast<const __m128i *>(chroma + x));
+			uv = _mm_unpacklo_epi8(uv, zero);
+			first = duplicateLow(uv);
+			second = duplicateHigh(uv);
+		} else {
+			/* 8 chroma pairs, one per pixel. */
+			__m128i uv = _mm_loadu_si128(reinterpret_cast<const __m128i *>(chroma + x * 2));
+			first = _mm_and_si128(uv, lowBytes);
+			second = _mm_srli_epi16(uv, 8);
+		}
+
+		yuvToBgra8(y, Swap ? second : first, Swap ? first : second,
+			   dst + x * 4);
+	}
+
+	return x;
+}
+
+template<unsigned int YPos, unsigned int CbPos>
+unsigned int convertYUVSimd(const unsigned char *src, unsigned char *dst,
+			    unsigned int width)
+{
+	const __m128i lowBytes = _mm_set1_epi16(0xff);
+	unsigned int x;
+
+	for (x = 0; x + SimdPixels <= width; x += SimdPixels) {
+		__m128i yuv = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + x * 2));
+
+		/* Luma and chroma alternate in bytes, chroma pairs in 16-bit words. */
+		__m128i y = YPos == 0 ? _mm_and_si128(yuv, lowBytes) : _mm_srli_epi16(yuv, 8);
+		__m128i uv = YPos == 0 ? _mm_srli_epi16(yuv, 8) : _mm_and_si128(yuv, lowBytes);
+		__m128i first = duplicateLow(uv);
+		__m128i second = duplicateHigh(uv);
+
+		yuvToBgra8(y, CbPos < 2 ? first : second, CbPos < 2 ? second : first,
+			   dst + x * 4);
+	}
+
+	return x;
+}
+
+template<unsigned int Bpp, unsigned int RPos, unsigned int GPos, unsigned int BPos>
+unsigned int convertRGBSimd(const unsigned char *src, unsigned char *dst,
+			    unsigned int width)
+{
+	/* Shuffling bytes with SSE2 is not faster than the scalar code. */
+	return 0;
+}
+
+#elif defined(__ARM_NEON)
+
+constexpr unsigned int SimdPixels = 16;
+
+inline uint8x8_t fixedPoint(int32x4_t lo, int32x4_t hi)
+{
+	return vqmovun_s16(vcombine_s16(vqrshrn_n_s32(lo, 8), vqrshrn_n_s32(hi, 8)));
+}
+
+/* Convert 8 pixels. */
+inline void yuvToBgra8(uint8x8_t y, uint8x8_t u, uint8x8_t v, unsigned char *dst)
+{
+	int16x8_t c = vsubq_s16(vreinterpretq_s16_u16(vmovl_u8(y)), vdupq_n_s16(16));
+	int16x8_t d = vsubq_s16(vreinterpretq_s16_u16(vmovl_u8(u)), vdupq_n_s16(128));
+	int16x8_t e = vsubq_s16(vreinterpretq_s16_u16(vmovl_u8(v)), vdupq_n_s16(128));
+
+	int16x4_t cLo = vget_low_s16(c), cHi = vget_high_s16(c);
+	int16x4_t dLo = vget_low_s16(d), dHi = vget_high_s16(d);
+	int16x4_t eLo = vget_low_s16(e), eHi = vget_high_s16(e);
+
+	int32x4_t cLo32 = vmull_n_s16(cLo, 298);
+	int32x4_t cHi32 = vmull_n_s16(cHi, 298);
+
+	uint8x8x4_t bgra;
+	bgra.val[0] = fixedPoint(vmlal_n_s16(cLo32, dLo, 516),
+				 vmlal_n_s16(cHi32, dHi, 516));
+	bgra.val[1] = fixedPoint(vmlsl_n_s16(vmlsl_n_s16(cLo32, dLo, 100), eLo, 208),
+				 vmlsl_n_s16(vmlsl_n_s16(cHi32, dHi, 100), eHi, 208));
+	bgra.val[2] = fixedPoint(vmlal_n_s16(cLo32, eLo, 409),
+				 vmlal_n_s16(cHi32, eHi, 409));
+	bgra.val[3] = vdup_n_u8(0xff);
+
+	vst4_u8(dst, bgra);
+}
+
+template<bool Swap, unsigned int HSub>
+unsigned int convertNVSimd(const unsigned char *src, const unsigned char *chroma,
+			   unsigned char *dst, unsigned int width)
+{
+	unsigned int x;
+
+	for (x = 0; x + SimdPixels <= width; x += SimdPixels) {
+		uint8x16_t y = vld1q_u8(src + x);
+		uint8x8x2_t u, v;
+
+		if (HSub == 2) {
+			uint8x8x2_t uv = vld2_u8(chroma + x);
+			u = vzip_u8(uv.val[Swap ? 1 : 0], uv.val[Swap ? 1 : 0]);
+			v = vzip_u8(uv.val[Swap ? 0 : 1], uv.val[Swap ? 0 : 1]);
+		} else {
+			uint8x16x2_t uv = vld2q_u8(chroma + x * 2);
+			u.val[0] = vget_low_u8(uv.val[Swap ? 1 : 0]);
+			u.val[1] = vget_high_u8(uv.val[Swap ? 1 : 0]);
+			v.val[0] = vget_low_u8(uv.val[Swap ? 0 : 1]);
+			v.val[1] = vget_high_u8(uv.val[Swap ? 0 : 1]);
+		}
+
+		yuvToBgra8(vget_low_u8(y), u.val[0], v.val[0], dst + x * 4);
+		yuvToBgra8(vget_high_u8(y), u.val[1], v.val[1], dst + x * 4 + 32);
+	}
+
+	return x;
+}
+
+template<unsigned int YPos, unsigned int CbPos>
+unsigned int convertYUVSimd(const unsigned char *src, unsigned char *dst,
+			    unsigned int width)
+{
+	constexpr unsigned int CrPos = (CbPos + 2) % 4;
+	unsigned int x;
+
+	for (x = 0; x + SimdPixels <= width; x += SimdPixels) {
+		uint8x8x4_t yuv = vld4_u8(src + x * 2);
+
+		uint8x8x2_t y = vzip_u8(yuv.val[YPos], yuv.val[YPos + 2]);
+		uint8x8x2_t u = vzip_u8(yuv.val[CbPos], yuv.val[CbPos]);
+		uint8x8x2_t v = vzip_u8(yuv.val[CrPos], yuv.val[CrPos]);
+
+		yuvToBgra8(y.val[0], u.val[0], v.val[0], dst + x * 4);
+		yuvToBgra8(y.val[1], u.val[1], v.val[1], dst + x * 4 + 32);
+	}
+
+	return x;
+}
+
+template<unsigned int Bpp, unsigned int RPos, unsigned int GPos, unsigned int BPos>
+unsigned int convertRGBSimd(const unsigned char *src, unsigned char *dst,
+			    unsigned int width)
+{
+	unsigned int x;
+
+	for (x = 0; x + 8 <= width; x += 8) {
+		uint8x8x4_t bgra;
+
+		if (Bpp == 3) {
+			uint8x8x3_t rgb = vld3_u8(src + x * 3);
+			bgra.val[0] = rgb.val[BPos];
+			bgra.val[1] = rgb.val[GPos];
+			bgra.val[2] = rgb.val[RPos];
+		} else {
+			uint8x8x4_t rgb = vld4_u8(src + x * 4);
+			bgra.val[0] = rgb.val[BPos];
+			bgra.val[1] = rgb.val[GPos];
+			bgra.val[2] = rgb.val[RPos];
+		}
+
+		bgra.val[3] = vdup_n_u8(0xff);
+		vst4_u8(dst + x * 4, bgra);
+	}
+
+	return x;
+}
+
+#else
+
+template<bool Swap, unsigned int HSub>
+unsigned int convertNVSimd(const unsigned char *src, const unsigned char *chroma,
+			   unsigned char *dst, unsigned int width)
+{
+	return 0;
+}
+
+template<unsigned int YPos, unsigned int CbPos>
+unsigned int convertYUVSimd(const unsigned char *src, unsigned char *dst,
+			    unsigned int width)
+{
+	return 0;
+}
+
+template<unsigned int Bpp, unsigned int RPos, unsigned int GPos, unsigned int BPos>
+unsigned int convertRGBSimd(const unsigned char *src, unsigned char *dst,
+			    unsigned int width)
+{
+	return 0;
+}
+
+#endif
+
+/*
+ * Semi-planar YUV, with one CbCr pair (CrCb if Swap is true) for every HSub
+ * pixels.
+ */
+template<bool Swap, unsigned int HSub, bool Simd>
+void convertNV(const unsigned char *src, const unsigned char *chroma,
+	       unsigned char *dst, unsigned int width)
+{
+	constexpr unsigned int CbPos = Swap ? 1 : 0;
+	constexpr unsigned int CrPos = Swap ? 0 : 1;
+
+	unsigned int x = Simd ? convertNVSimd<Swap, HSub>(src, chroma, dst, width) : 0;
+
+	for (; x < width; ++x) {
+		const unsigned char *uv = chroma + x / HSub * 2;
+		yuvToBgra(src[x], uv[CbPos], uv[CrPos], dst + x * 4);
+	}
+}
+
+/*
+ * Packed YUV 4:2:2, with the first luma sample at YPos and the Cb sample at
+ * CbPos in each group of 4 bytes.
+ */
+template<unsigned int YPos, unsigned int CbPos, bool Simd>
+void convertYUV(const unsigned char *src, const unsigned char *chroma,
+		unsigned char *dst, unsigned int width)
+{
+	constexpr unsigned int CrPos = (CbPos + 2) % 4;
+
+	unsigned int x = Simd ? convertYUVSimd<YPos, CbPos>(src, dst, width) : 0;
+
+	for (; x < width; ++x) {
+		const unsigned char *group = src + x / 2 * 4;
+		yuvToBgra(group[YPos + x % 2 * 2], group[CbPos], group[CrPos],
+			  dst + x * 4);
+	}
+}
+
+template<unsigned int Bpp, unsigned int RPos, unsigned int GPos,
+	 unsigned int BPos, bool Simd>
+void convertRGB(const unsigned char *src, const unsigned char *chroma,
+		unsigned char *dst, unsigned int width)
+{
+	unsigned int x = Simd ? convertRGBSimd<Bpp, RPos, GPos, BPos>(src, dst, width) : 0;
+
+	for (; x < width; ++x) {
+		dst[x * 4 + 0] = src[x * Bpp + BPos];
+		dst[x * 4 + 1] = src[x * Bpp + GPos];
+		dst[x * 4 + 2] = src[x * Bpp + RPos];
+		dst[x * 4 + 3] = 0xff;
+	}
+}
+
+template<bool Simd>
+LineConverter findConverter(unsigned int format)
+{
+	switch (format) {
+	case DRM_FORMAT_NV12:
+	case DRM_FORMAT_NV16:
+		return &convertNV<false, 2, Simd>;
+	case DRM_FORMAT_NV21:
+	case DRM_FORMAT_NV61:
+		return &convertNV<true, 2, Simd>;
+	case DRM_FORMAT_NV24:
+		return &convertNV<false, 1, Simd>;
+	case DRM_FORMAT_NV42:
+		return &convertNV<true, 1, Simd>;
+	case DRM_FORMAT_RGB888:
+		return &convertRGB<3, 2, 1, 0, Simd>;
+	case DRM_FORMAT_BGR888:
+		return &convertRGB<3, 0, 1, 2, Simd>;
+	case DRM_FORMAT_BGRA8888:
+		return &convertRGB<4, 1, 2, 3, Simd>;
+	case DRM_FORMAT_VYUY:
+		return &convertYUV<1, 2, Simd>;
+	case DRM_FORMAT_YVYU:
+		return &convertYUV<0, 3, Simd>;
+	case DRM_FORMAT_UYVY:
+		return &convertYUV<1, 0, Simd>;
+	case DRM_FORMAT_YUYV:
+		return &convertYUV<0, 1, Simd>;
+	default:
+		return nullptr;
+	}
+}
+
+} /* namespace */
+
+/*
+ * Return the line converter for the format, or nullptr if the format isn't
+ * supported. The simd argument selects the vector implementation when
+ * available, and is meant to compare the implementations.
+ */
+LineConverter lineConverter(unsigned int format, bool simd)
+{
+	return simd ? findConverter<true>(format) : findConverter<false>(format);
+}
@@ -0,0 +1,21 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * format_kernels.h - qcam - Line conversion kernels to RGB
+ */
+#ifndef __QCAM_FORMAT_KERNELS_H__
+#define __QCAM_FORMAT_KERNELS_H__
+
+/*
+ * Convert one line of width pixels to 32-bit BGRA, the memory layout of
+ * QImage::Format_RGB32. The chroma argument points to the chroma line for
+ * semi-planar formats, and is ignored for other formats.
+ */
+using LineConverter = void (*)(const unsigned char *src,
+			       const unsigned char *chroma,
+			       unsigned char *dst, unsigned int width);
+
+LineConverter lineConverter(unsigned int format, bool simd = true);
+
+#endif /* __QCAM_FORMAT_KERNELS_H__ */
@@ -0,0 +1,102 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * jpeg_decoder.cpp - qcam - JPEG decoder based on libjpeg
+ */
+
+#include <errno.h>
+
+#include "jpeg_decoder.h"
+
+/*
+ * Decode JPEG frames to 32-bit BGRX, the memory layout of
+ * QImage::Format_RGB32, directly into a caller-provided buffer. The
+ * decompressor is created once and reused for all frames. Frames can be
+ * downscaled by 2, 4 or 8 in the DCT domain, which skips most of the
+ * inverse DCT and colour conversion work.
+ */
+JpegDecoder::JpegDecoder()
+{
+	cinfo_.err = jpeg_std_error(&error_.base);
+	error_.base.error_exit = &JpegDecoder::errorExit;
+	error_.base.output_message = &JpegDecoder::outputMessage;
+
+	jpeg_create_decompress(&cinfo_);
+}
+
+JpegDecoder::~JpegDecoder()
+{
+	jpeg_destroy_decompress(&cinfo_);
+}
+
+void JpegDecoder::errorExit(j_common_ptr cinfo)
+{
+	ErrorManager *error = reinterpret_cast<ErrorManager *>(cinfo->err);
+	longjmp(error->jump, 1);
+}
+
+void JpegDecoder::outputMessage(j_common_ptr cinfo)
+{
+	/*
+	 * Many UVC cameras produce frames with extraneous bytes or truncated
+	 * data, don't flood the console with warnings for every frame.
+	 */
+}
+
+/*
+ * Compute the size of a frame dimension after downscaling, which libjpeg
+ * rounds up.
+ */
+unsigned int JpegDecoder::scaledSize(unsigned int size, unsigned int scale)
+{
+	return (size + scale - 1) / scale;
+}
+
+/*
+ * Decode the JPEG frame in src, downscaled by a factor of scale (1, 2, 4 or
+ * 8), to dst. The dst buffer is width x height pixels with a line stride in
+ * bytes, and must match the size of the decoded frame.
+ *
+ * Return 0 on success, or a negative error code if the frame can't be decoded
+ * or doesn't match the destination size.
+ */
+int JpegDecoder::decode(const unsigned char *src, size_t size,
+			unsigned int scale, unsigned char *dst,
+			unsigned int width, unsigned int height,
+			unsigned int stride)
+{
+	if (setjmp(error_.jump)) {
+		jpeg_abort_decompress(&cinfo_);
+		return -EINVAL;
+	}
+
+	jpeg_mem_src(&cinfo_, const_cast<unsigned char *>(src), size);
+
+	if (jpeg_read_header(&cinfo_, TRUE) != JPEG_HEADER_OK) {
+		jpeg_abort_decompress(&cinfo_);
+		return -EINVAL;
+	}
+
+	cinfo_.out_color_space = JCS_EXT_BGRX;
+	cinfo_.scale_num = 1;
+	cinfo_.scale_denom = scale;
+	cinfo_.dct_method = JDCT_IFAST;
+
+	jpeg_calc_output_dimensions(&cinfo_);
+	if (cinfo_.output_width != width || cinfo_.output_height != height) {
+		jpeg_abort_decompress(&cinfo_);
+		return -EINVAL;
+	}
+
+	jpeg_start_decompress(&cinfo_);
+
+	while (cinfo_.output_scanline < cinfo_.output_height) {
+		JSAMPROW row = dst + cinfo_.output_scanline * stride;
+		jpeg_read_scanlines(&cinfo_, &row, 1);
+	}
+
+	jpeg_finish_decompress(&cinfo_);
+
+	return 0;
+}
@@ -0,0 +1,41 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * jpeg_decoder.h - qcam - JPEG decoder based on libjpeg
+ */
+#ifndef __QCAM_JPEG_DECODER_H__
+#define __QCAM_JPEG_DECODER_H__
+
+#include <setjmp.h>
+#include <stddef.h>
+#include <stdio.h>
+
+#include <jpeglib.h>
+
+class JpegDecoder
+{
+public:
+	JpegDecoder();
+	~JpegDecoder();
+
+	int decode(const unsigned char *src, size_t size, unsigned int scale,
+		   unsigned char *dst, unsigned int width, unsigned int height,
+		   unsigned int stride);
+
+	static unsigned int scaledSize(unsigned int size, unsigned int scale);
+
+private:
+	struct ErrorManager {
+		struct jpeg_error_mgr base;
+		jmp_buf jump;
+	};
+
+	static void errorExit(j_common_ptr cinfo);
+	static void outputMessage(j_common_ptr cinfo);
+
+	struct jpeg_decompress_struct cinfo_;
+	ErrorManager error_;
+};
+
+#endif /* __QCAM_JPEG_DECODER_H__ */
@@ -37,8 +37,17 @@ OptionsParser::Options parseOptions(int argc, char *argv[])
 			 ArgumentRequired, "camera");
 	parser.addOption(OptHelp, OptionNone, "Display this help message",
 			 "help");
+	parser.addOption(OptRenderer, OptionString,
+			 "Choose the renderer type {qt,gles} (default: gles)",
+			 "renderer", ArgumentRequired, "renderer");
+	parser.addOption(OptReplay, OptionString,
+			 "Replay the first stream of a raw video container instead of using a camera",
+			 "replay", ArgumentRequired, "filename");
 	parser.addOption(OptSize, &sizeParser, "Set the stream size",
 			 "size", true);
+	parser.addOption(OptThreads, OptionInteger,
+			 "Set the number of format conversion threads (default: number of CPUs)",
+			 "threads", ArgumentRequired, "threads");
 
 	OptionsParser::Options options = parser.parse(argc, argv);
 	if (options.isSet(OptHelp))
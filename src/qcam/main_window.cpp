@@ -5,10 +5,12 @@
  * main_window.cpp - qcam - Main application window
  */
 
+#include <algorithm>
 #include <iomanip>
 #include <iostream>
+#include <string.h>
 #include <string>
-#include <sys/mman.h>
+#include <thread>
 
 #include <QCoreApplication>
 #include <QInputDialog>
@@ -18,12 +20,17 @@
 #include <libcamera/version.h>
 
 #include "main_window.h"
-#include "viewfinder.h"
+#include "viewfinder_qt.h"
+#ifdef HAVE_QT_OPENGL
+#include "viewfinder_gl.h"
+#endif
 
 using namespace libcamera;
 
 MainWindow::MainWindow(CameraManager *cm, const OptionsParser::Options &options)
-	: options_(options), allocator_(nullptr), isCapturing_(false)
+	: options_(options), allocator_(nullptr), isCapturing_(false),
+	  displayRequest_(nullptr), heldRequest_(nullptr), displayQueued_(false),
+	  viewfinder_(nullptr), viewfinderGL_(false), replayIndex_(0)
 {
 	int ret;
 
@@ -31,14 +38,19 @@ MainWindow::MainWindow(CameraManager *cm, const OptionsParser::Options &options)
 	setWindowTitle(title_);
 	connect(&titleTimer_, SIGNAL(timeout()), this, SLOT(updateTitle()));
 
-	viewfinder_ = new ViewFinder(this);
-	setCentralWidget(viewfinder_);
+	std::string renderer = options_.isSet(OptRenderer)
+			     ? options_[OptRenderer].toString() : "gles";
+	createViewFinder(renderer == "gles");
 	adjustSize();
 
-	ret = openCamera(cm);
-	if (!ret) {
-		allocator_ = FrameBufferAllocator::create(camera_);
-		ret = startCapture();
+	if (options_.isSet(OptReplay)) {
+		ret = startReplay();
+	} else {
+		ret = openCamera(cm);
+		if (!ret) {
+			allocator_ = FrameBufferAllocator::create(camera_);
+			ret = startCapture();
+		}
 	}
 
 	if (ret < 0)
@@ -48,6 +60,12 @@ MainWindow::MainWindow(CameraManager *cm, const OptionsParser::Options &options)
 
 MainWindow::~MainWindow()
 {
+	/* The viewfinder may reference the frames mapped by the reader. */
+	if (replay_.isOpen()) {
+		replayTimer_.stop();
+		viewfinder_->stop();
+	}
+
 	if (camera_) {
 		stopCapture();
 		delete allocator_;
@@ -60,13 +78,16 @@ void MainWindow::updateTitle()
 {
 	unsigned int duration = frameRateInterval_.elapsed();
 	unsigned int frames = framesCaptured_ - previousFrames_;
+	unsigned int dropped = framesDropped_ - previousDropped_;
 	double fps = frames * 1000.0 / duration;
 
 	/* Restart counters. */
 	frameRateInterval_.start();
 	previousFrames_ = framesCaptured_;
+	previousDropped_ = framesDropped_;
 
-	setWindowTitle(title_ + " : " + QString::number(fps, 'f', 2) + " fps");
+	setWindowTitle(title_ + " : " + QString::number(fps, 'f', 2) + " fps, " +
+		       QString::number(dropped) + " dropped");
 }
 
 std::string MainWindow::chooseCamera(CameraManager *cm)
@@ -121,6 +142,35 @@ int MainWindow::openCamera(CameraManager *cm)
 	return 0;
 }
 
+/*
+ * Create the viewfinder widget. The OpenGL viewfinder converts frames to RGB
+ * on the GPU, and is used by default when qcam is built with OpenGL support.
+ * The QPainter viewfinder converts frames on the CPU, and supports more
+ * formats.
+ */
+void MainWindow::createViewFinder(bool useGL)
+{
+#ifdef HAVE_QT_OPENGL
+	if (useGL) {
+		ViewFinderGL *viewfinder = new ViewFinderGL(this);
+		setCentralWidget(viewfinder);
+		viewfinder_ = viewfinder;
+		viewfinderGL_ = true;
+		return;
+	}
+#endif
+
+	unsigned int threads = options_.isSet(OptThreads)
+			     ? options_[OptThreads].toInteger()
+			     : std::thread::hardware_concurrency();
+
+	ViewFinderQt *viewfinder = new ViewFinderQt(this);
+	viewfinder->setThreads(threads);
+	setCentralWidget(viewfinder);
+	viewfinder_ = viewfinder;
+	viewfinderGL_ = false;
+}
+
 int MainWindow::startCapture()
 {
 	int ret;
@@ -144,6 +194,18 @@ int MainWindow::startCapture()
 		}
 	}
 
+	/*
+	 * Prefer a format the viewfinder displays without conversion when the
+	 * camera supports one.
+	 */
+	std::vector<PixelFormat> formats = cfg.formats().pixelformats();
+	for (unsigned int format : viewfinder_->nativeFormats()) {
+		if (std::find(formats.begin(), formats.end(), format) != formats.end()) {
+			cfg.pixelFormat = format;
+			break;
+		}
+	}
+
 	CameraConfiguration::Status validation = config_->validate();
 	if (validation == CameraConfiguration::Invalid) {
 		std::cerr << "Failed to create valid camera configuration";
@@ -164,6 +226,13 @@ int MainWindow::startCapture()
 	Stream *stream = cfg.stream();
 	ret = viewfinder_->setFormat(cfg.pixelFormat, cfg.size.width,
 				     cfg.size.height);
+	if (ret < 0 && viewfinderGL_) {
+		std::cout << "Pixel format not supported by OpenGL viewfinder, "
+			  << "using CPU conversion" << std::endl;
+		createViewFinder(false);
+		ret = viewfinder_->setFormat(cfg.pixelFormat, cfg.size.width,
+					     cfg.size.height);
+	}
 	if (ret < 0) {
 		std::cout << "Failed to set viewfinder format" << std::endl;
 		return ret;
@@ -177,9 +246,8 @@ int MainWindow::startCapture()
 		return ret;
 	}
 
-	std::vector<Request *> requests;
 	for (const std::unique_ptr<FrameBuffer> &buffer : allocator_->buffers(stream)) {
-		Request *request = camera_->createRequest();
+		std::unique_ptr<Request> request = camera_->createRequest();
 		if (!request) {
 			std::cerr << "Can't create request" << std::endl;
 			ret = -ENOMEM;
@@ -192,20 +260,22 @@ int MainWindow::startCapture()
 			goto error;
 		}
 
-		requests.push_back(request);
+		requests_.push_back(std::move(request));
 
 		/* Map memory buffers and cache the mappings. */
-		const FrameBuffer::Plane &plane = buffer->planes().front();
-		void *memory = mmap(NULL, plane.length, PROT_READ, MAP_SHARED,
-				    plane.fd.fd(), 0);
-		mappedBuffers_[plane.fd.fd()] =
-			std::make_pair(memory, plane.length);
+		if (!mappedBuffers_.map(buffer.get())) {
+			std::cerr << "Can't map buffer" << std::endl;
+			ret = -ENOMEM;
+			goto error;
+		}
 	}
 
 	titleTimer_.start(2000);
 	frameRateInterval_.start();
 	previousFrames_ = 0;
 	framesCaptured_ = 0;
+	previousDropped_ = 0;
+	framesDropped_ = 0;
 	lastBufferTime_ = 0;
 
 	ret = camera_->start();
@@ -214,10 +284,11 @@ int MainWindow::startCapture()
 		goto error;
 	}
 
-	for (Request *request : requests) {
-		ret = camera_->queueRequest(request);
+	for (std::unique_ptr<Request> &request : requests_) {
+		ret = camera_->queueRequest(request.get());
 		if (ret < 0) {
 			std::cerr << "Can't queue request" << std::endl;
+			camera_->stop();
 			goto error;
 		}
 	}
@@ -226,14 +297,7 @@ int MainWindow::startCapture()
 	return 0;
 
 error:
-	for (Request *request : requests)
-		delete request;
-
-	for (auto &iter : mappedBuffers_) {
-		void *memory = iter.second.first;
-		unsigned int length = iter.second.second;
-		munmap(memory, length);
-	}
+	requests_.clear();
 	mappedBuffers_.clear();
 
 	return ret;
@@ -248,11 +312,11 @@ void MainWindow::stopCapture()
 	if (ret)
 		std::cout << "Failed to stop capture" << std::endl;
 
-	for (auto &iter : mappedBuffers_) {
-		void *memory = iter.second.first;
-		unsigned int length = iter.second.second;
-		munmap(memory, length);
-	}
+	viewfinder_->stop();
+
+	displayRequest_ = nullptr;
+	heldRequest_ = nullptr;
+	requests_.clear();
 	mappedBuffers_.clear();
 
 	isCapturing_ = false;
@@ -263,6 +327,99 @@ void MainWindow::stopCapture()
 	setWindowTitle(title_);
 }
 
+/*
+ * Replay the first stream of a raw video container. Frames are displayed
+ * straight from the memory-mapped file, at the pace given by their recorded
+ * timestamps, and the replay loops when the end of the file is reached.
+ */
+int MainWindow::startReplay()
+{
+	std::string path = options_[OptReplay].toString();
+
+	int ret = replay_.open(path);
+	if (ret < 0) {
+		std::cerr << "Failed to open " << path << ": "
+			  << strerror(-ret) << std::endl;
+		return ret;
+	}
+
+	RawVideoFrame frame;
+	for (unsigned int i = 0; i < replay_.frames(); ++i) {
+		if (!replay_.frame(i, &frame) && frame.stream == 0 &&
+		    frame.planes.size() == 1)
+			replayFrames_.push_back(i);
+	}
+
+	if (replay_.streams().empty() || replayFrames_.empty()) {
+		std::cerr << "No frame to replay in " << path << std::endl;
+		return -EINVAL;
+	}
+
+	const RawVideoStream &stream = replay_.streams()[0];
+	ret = viewfinder_->setFormat(stream.pixelFormat, stream.size.width,
+				     stream.size.height);
+	if (ret < 0 && viewfinderGL_) {
+		std::cout << "Pixel format not supported by OpenGL viewfinder, "
+			  << "using CPU conversion" << std::endl;
+		createViewFinder(false);
+		ret = viewfinder_->setFormat(stream.pixelFormat, stream.size.width,
+					     stream.size.height);
+	}
+	if (ret < 0) {
+		std::cout << "Failed to set viewfinder format" << std::endl;
+		return ret;
+	}
+
+	adjustSize();
+
+	std::cout << "Replaying " << replayFrames_.size() << " frames of stream "
+		  << stream.name << " from " << path << std::endl;
+
+	replayTimer_.setSingleShot(true);
+	connect(&replayTimer_, SIGNAL(timeout()), this, SLOT(replayFrame()));
+
+	titleTimer_.start(2000);
+	frameRateInterval_.start();
+	previousFrames_ = 0;
+	framesCaptured_ = 0;
+	previousDropped_ = 0;
+	framesDropped_ = 0;
+
+	replayIndex_ = 0;
+	replayFrame();
+
+	return 0;
+}
+
+void MainWindow::replayFrame()
+{
+	RawVideoFrame frame;
+	RawVideoFrame next;
+
+	if (replay_.frame(replayFrames_[replayIndex_], &frame))
+		return;
+
+	framesCaptured_++;
+	viewfinder_->display(frame.planes[0].data(), frame.planes[0].size());
+
+	replayIndex_ = (replayIndex_ + 1) % replayFrames_.size();
+	if (replay_.frame(replayFrames_[replayIndex_], &next))
+		return;
+
+	/*
+	 * Wait for the recorded interval between the two frames, bounded to
+	 * a second to cope with gaps in the capture. Looping back to the first
+	 * frame doesn't wait.
+	 */
+	int interval = 0;
+	if (next.metadata.timestamp > frame.metadata.timestamp)
+		interval = std::min<uint64_t>((next.metadata.timestamp -
+					       frame.metadata.timestamp) / 1000000,
+					      1000);
+
+	replayTimer_.start(interval);
+}
+
 void MainWindow::requestComplete(Request *request)
 {
 	if (request->status() == Request::RequestCancelled)
@@ -280,26 +437,58 @@ void MainWindow::requestComplete(Request *request)
 	lastBufferTime_ = metadata.timestamp;
 
 	std::cout << "seq: " << std::setw(6) << std::setfill('0') << metadata.sequence
-		  << " bytesused: " << metadata.planes[0].bytesused
+		  << " bytesused: " << metadata.planes()[0].bytesused
 		  << " timestamp: " << metadata.timestamp
 		  << " fps: " << std::fixed << std::setprecision(2) << fps
 		  << std::endl;
 
-	display(buffer);
-
-	request = camera_->createRequest();
-	if (!request) {
-		std::cerr << "Can't create request" << std::endl;
-		return;
+	/*
+	 * Only the most recent frame is kept for display. When the viewfinder
+	 * can't keep up with the camera, frames waiting for display are
+	 * superseded by newer ones and given back to the camera immediately,
+	 * which bounds the display latency to a single frame.
+	 */
+	if (displayRequest_) {
+		framesDropped_++;
+		queueRequest(displayRequest_);
 	}
 
-	for (auto it = buffers.begin(); it != buffers.end(); ++it) {
-		Stream *stream = it->first;
-		FrameBuffer *buffer = it->second;
+	displayRequest_ = request;
 
-		request->addBuffer(stream, buffer);
+	if (!displayQueued_) {
+		displayQueued_ = true;
+		QMetaObject::invokeMethod(this, "processDisplay",
+					  Qt::QueuedConnection);
 	}
+}
+
+void MainWindow::processDisplay()
+{
+	displayQueued_ = false;
+
+	Request *request = displayRequest_;
+	if (!request)
+		return;
+
+	displayRequest_ = nullptr;
+
+	int ret = display(request->buffers().begin()->second);
+
+	/*
+	 * Viewfinders that retain frames display them in place, hold the
+	 * request until the next frame is displayed, and give the previous one
+	 * back to the camera.
+	 */
+	if (!ret && viewfinder_->retainsFrames())
+		std::swap(request, heldRequest_);
+
+	if (request)
+		queueRequest(request);
+}
 
+void MainWindow::queueRequest(Request *request)
+{
+	request->reuse();
 	camera_->queueRequest(request);
 }
 
@@ -308,10 +497,14 @@ int MainWindow::display(FrameBuffer *buffer)
 	if (buffer->planes().size() != 1)
 		return -EINVAL;
 
-	const FrameBuffer::Plane &plane = buffer->planes().front();
-	void *memory = mappedBuffers_[plane.fd.fd()].first;
-	unsigned char *raw = static_cast<unsigned char *>(memory);
-	viewfinder_->display(raw, buffer->metadata().planes[0].bytesused);
+	const MappedFrameBuffer *mapped = mappedBuffers_.find(buffer);
+	if (!mapped)
+		return -EINVAL;
+
+	ScopedCpuAccess access(*mapped, 1 << 0);
+
+	unsigned char *raw = mapped->planes().front().data;
+	viewfinder_->display(raw, buffer->metadata().planes()[0].bytesused);
 
 	return 0;
 }
@@ -8,6 +8,7 @@
 #define __QCAM_MAIN_WINDOW_H__
 
 #include <memory>
+#include <vector>
 
 #include <QElapsedTimer>
 #include <QMainWindow>
@@ -18,6 +19,8 @@
 #include <libcamera/camera.h>
 #include <libcamera/camera_manager.h>
 #include <libcamera/framebuffer_allocator.h>
+#include <libcamera/mapped_framebuffer.h>
+#include <libcamera/raw_video.h>
 #include <libcamera/stream.h>
 
 #include "../cam/options.h"
@@ -29,7 +32,10 @@ class ViewFinder;
 enum {
 	OptCamera = 'c',
 	OptHelp = 'h',
+	OptRenderer = 'r',
+	OptReplay = 'R',
 	OptSize = 's',
+	OptThreads = 't',
 };
 
 class MainWindow : public QMainWindow
@@ -42,15 +48,21 @@ public:
 
 private Q_SLOTS:
 	void updateTitle();
+	void processDisplay();
+	void replayFrame();
 
 private:
 	std::string chooseCamera(CameraManager *cm);
 	int openCamera(CameraManager *cm);
+	void createViewFinder(bool useGL);
 
 	int startCapture();
 	void stopCapture();
 
+	int startReplay();
+
 	void requestComplete(Request *request);
+	void queueRequest(Request *request);
 	int display(FrameBuffer *buffer);
 
 	QString title_;
@@ -69,9 +81,22 @@ private:
 	QElapsedTimer frameRateInterval_;
 	uint32_t previousFrames_;
 	uint32_t framesCaptured_;
+	uint32_t previousDropped_;
+	uint32_t framesDropped_;
+
+	Request *displayRequest_;
+	Request *heldRequest_;
+	bool displayQueued_;
 
 	ViewFinder *viewfinder_;
-	std::map<int, std::pair<void *, unsigned int>> mappedBuffers_;
+	bool viewfinderGL_;
+	MappedBufferCache mappedBuffers_;
+	std::vector<std::unique_ptr<Request>> requests_;
+
+	RawVideoReader replay_;
+	QTimer replayTimer_;
+	std::vector<unsigned int> replayFrames_;
+	unsigned int replayIndex_;
 };
 
 #endif /* __QCAM_MAIN_WINDOW__ */
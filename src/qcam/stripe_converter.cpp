@@ -0,0 +1,152 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * stripe_converter.cpp - qcam - Convert frames in parallel row stripes
+ */
+
+#include <algorithm>
+
+#include "stripe_converter.h"
+
+/*
+ * The frame is split in one stripe of rows per thread. The calling thread
+ * converts the first stripe and the worker threads the other ones. Stripe
+ * boundaries are aligned to the vertical chroma subsampling, so that a chroma
+ * line is never shared between two stripes. As every line is converted
+ * independently, the result is identical to the serial conversion.
+ */
+StripeConverter::StripeConverter()
+	: convertLine_(nullptr), width_(0), height_(0), stride_(0),
+	  chromaOffset_(0), chromaStride_(0), vertSubSample_(1),
+	  src_(nullptr), dst_(nullptr), generation_(0), pending_(0),
+	  stop_(false)
+{
+}
+
+StripeConverter::~StripeConverter()
+{
+	stopWorkers();
+}
+
+void StripeConverter::setThreads(unsigned int threads)
+{
+	threads = std::max(threads, 1U);
+	if (threads == this->threads())
+		return;
+
+	stopWorkers();
+
+	for (unsigned int i = 1; i < threads; ++i)
+		workers_.emplace_back(&StripeConverter::worker, this, i);
+}
+
+/*
+ * Configure the frame layout. The chromaStride is the size of a chroma line
+ * in bytes, located at chromaOffset from the start of the frame. A zero
+ * chromaStride denotes a format without a separate chroma plane.
+ */
+void StripeConverter::configure(LineConverter convertLine, unsigned int width,
+				unsigned int height, unsigned int stride,
+				unsigned int chromaOffset,
+				unsigned int chromaStride,
+				unsigned int vertSubSample)
+{
+	convertLine_ = convertLine;
+	width_ = width;
+	height_ = height;
+	stride_ = stride;
+	chromaOffset_ = chromaOffset;
+	chromaStride_ = chromaStride;
+	vertSubSample_ = std::max(vertSubSample, 1U);
+}
+
+void StripeConverter::convert(const unsigned char *src, unsigned char *dst)
+{
+	src_ = src;
+	dst_ = dst;
+
+	if (workers_.empty() || height_ < threads() * vertSubSample_) {
+		convertStripe(0);
+		return;
+	}
+
+	{
+		std::lock_guard<std::mutex> locker(mutex_);
+		pending_ = workers_.size();
+		generation_++;
+	}
+	startCond_.notify_all();
+
+	convertStripe(0);
+
+	std::unique_lock<std::mutex> locker(mutex_);
+	doneCond_.wait(locker, [&] { return pending_ == 0; });
+}
+
+void StripeConverter::stopWorkers()
+{
+	{
+		std::lock_guard<std::mutex> locker(mutex_);
+		stop_ = true;
+	}
+	startCond_.notify_all();
+
+	for (std::thread &thread : workers_)
+		thread.join();
+
+	workers_.clear();
+	generation_ = 0;
+	stop_ = false;
+}
+
+void StripeConverter::worker(unsigned int index)
+{
+	/*
+	 * Workers are started with the generation counter reset, this avoids
+	 * missing a conversion started before the thread acquires the lock.
+	 */
+	std::unique_lock<std::mutex> locker(mutex_);
+	unsigned int generation = 0;
+
+	while (true) {
+		startCond_.wait(locker, [&] {
+			return stop_ || generation_ != generation;
+		});
+		if (stop_)
+			return;
+
+		generation = generation_;
+
+		locker.unlock();
+		convertStripe(index);
+		locker.lock();
+
+		if (--pending_ == 0)
+			doneCond_.notify_one();
+	}
+}
+
+void StripeConverter::convertStripe(unsigned int index)
+{
+	/* Process the whole frame when it's too small to be split. */
+	unsigned int count = threads();
+	if (height_ < count * vertSubSample_)
+		count = 1;
+
+	unsigned int groups = (height_ + vertSubSample_ - 1) / vertSubSample_;
+	unsigned int start = groups * index / count * vertSubSample_;
+	unsigned int end = std::min(groups * (index + 1) / count * vertSubSample_,
+				    height_);
+
+	const unsigned char *chroma = chromaStride_ ? src_ + chromaOffset_
+						    : nullptr;
+
+	for (unsigned int y = start; y < end; ++y) {
+		const unsigned char *chromaLine = chroma
+			? chroma + y / vertSubSample_ * chromaStride_ : nullptr;
+
+		convertLine_(src_ + y * stride_, chromaLine,
+			     dst_ + y * width_ * 4, width_);
+	}
+}
@@ -0,0 +1,58 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * stripe_converter.h - qcam - Convert frames in parallel row stripes
+ */
+#ifndef __QCAM_STRIPE_CONVERTER_H__
+#define __QCAM_STRIPE_CONVERTER_H__
+
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "format_kernels.h"
+
+class StripeConverter
+{
+public:
+	StripeConverter();
+	~StripeConverter();
+
+	void setThreads(unsigned int threads);
+	unsigned int threads() const { return workers_.size() + 1; }
+
+	void configure(LineConverter convertLine, unsigned int width,
+		       unsigned int height, unsigned int stride,
+		       unsigned int chromaOffset, unsigned int chromaStride,
+		       unsigned int vertSubSample);
+
+	void convert(const unsigned char *src, unsigned char *dst);
+
+private:
+	void stopWorkers();
+	void worker(unsigned int index);
+	void convertStripe(unsigned int index);
+
+	LineConverter convertLine_;
+	unsigned int width_;
+	unsigned int height_;
+	unsigned int stride_;
+	unsigned int chromaOffset_;
+	unsigned int chromaStride_;
+	unsigned int vertSubSample_;
+
+	const unsigned char *src_;
+	unsigned char *dst_;
+
+	std::vector<std::thread> workers_;
+	std::mutex mutex_;
+	std::condition_variable startCond_;
+	std::condition_variable doneCond_;
+	unsigned int generation_;
+	unsigned int pending_;
+	bool stop_;
+};
+
+#endif /* __QCAM_STRIPE_CONVERTER_H__ */
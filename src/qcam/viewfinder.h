@@ -1,39 +1,33 @@
 /* SPDX-License-Identifier: GPL-2.0-or-later */
 /*
- * Copyright (C) 2019, Google Inc.
+ * Copyright (C) 2020, Google Inc.
  *
- * viewfinder.h - qcam - Viewfinder
+ * viewfinder.h - qcam - Viewfinder interface
  */
 #ifndef __QCAM_VIEWFINDER_H__
 #define __QCAM_VIEWFINDER_H__
 
-#include <QWidget>
+#include <stddef.h>
+#include <vector>
 
-#include "format_converter.h"
-
-class QImage;
-
-class ViewFinder : public QWidget
+class ViewFinder
 {
 public:
-	ViewFinder(QWidget *parent);
-	~ViewFinder();
-
-	int setFormat(unsigned int format, unsigned int width,
-		      unsigned int height);
-	void display(const unsigned char *rgb, size_t size);
+	virtual ~ViewFinder() {}
 
-protected:
-	void paintEvent(QPaintEvent *) override;
-	QSize sizeHint() const override;
+	virtual int setFormat(unsigned int format, unsigned int width,
+			      unsigned int height) = 0;
+	virtual void display(const unsigned char *raw, size_t size) = 0;
 
-private:
-	unsigned int format_;
-	unsigned int width_;
-	unsigned int height_;
+	/* Formats displayed without any conversion, in preference order. */
+	virtual std::vector<unsigned int> nativeFormats() const { return {}; }
 
-	FormatConverter converter_;
-	QImage *image_;
+	/*
+	 * Viewfinders that retain frames reference the memory passed to
+	 * display() until the next frame is displayed or stop() is called.
+	 */
+	virtual bool retainsFrames() const { return false; }
+	virtual void stop() {}
 };
 
-#endif /* __QCAM_VIEWFINDER__ */
+#endif /* __QCAM_VIEWFINDER_H__ */
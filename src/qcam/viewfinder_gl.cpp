@@ -0,0 +1,323 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * viewfinder_gl.cpp - qcam - Viewfinder rendering with OpenGL
+ */
+
+#include <errno.h>
+
+#include <linux/drm_fourcc.h>
+
+#include <QDebug>
+
+#include "viewfinder_gl.h"
+
+/*
+ * The frames are uploaded to textures without any CPU processing, and
+ * converted from YUV to RGB by a fragment shader. Semi-planar formats use a
+ * luminance texture for the Y plane and a luminance-alpha texture for the CbCr
+ * plane. Packed formats use an RGBA texture of half the frame width, holding
+ * two pixels per texel. The shaders are compatible with both OpenGL 2 and
+ * OpenGL ES 2.
+ */
+static const char *vertexShaderSource = R"(
+attribute vec4 vertexIn;
+attribute vec2 textureIn;
+varying vec2 textureOut;
+
+void main(void)
+{
+	gl_Position = vertexIn;
+	textureOut = textureIn;
+}
+)";
+
+static const char *fragmentShaderHeader = R"(
+#ifdef GL_ES
+precision mediump float;
+#endif
+
+varying vec2 textureOut;
+
+/* BT.601 limited range, matching the CPU converter. */
+const mat3 yuv2rgb = mat3(1.164, 1.164, 1.164,
+			  0.0, -0.391, 2.016,
+			  1.598, -0.813, 0.0);
+)";
+
+static const char *fragmentShaderNV = R"(
+uniform sampler2D tex_y;
+uniform sampler2D tex_uv;
+
+void main(void)
+{
+	vec3 yuv;
+
+	yuv.x = texture2D(tex_y, textureOut).r - 0.0625;
+#if defined(SWAP_UV)
+	yuv.y = texture2D(tex_uv, textureOut).a - 0.5;
+	yuv.z = texture2D(tex_uv, textureOut).r - 0.5;
+#else
+	yuv.y = texture2D(tex_uv, textureOut).r - 0.5;
+	yuv.z = texture2D(tex_uv, textureOut).a - 0.5;
+#endif
+
+	gl_FragColor = vec4(yuv2rgb * yuv, 1.0);
+}
+)";
+
+static const char *fragmentShaderPacked = R"(
+uniform sampler2D tex_packed;
+uniform float width;
+
+void main(void)
+{
+	vec4 c = texture2D(tex_packed, textureOut);
+	float odd = mod(floor(textureOut.x * width), 2.0);
+	vec3 yuv;
+
+	yuv.x = mix(Y0, Y1, odd) - 0.0625;
+	yuv.y = U - 0.5;
+	yuv.z = V - 0.5;
+
+	gl_FragColor = vec4(yuv2rgb * yuv, 1.0);
+}
+)";
+
+static const GLfloat vertices[] = {
+	-1.0f, -1.0f,
+	-1.0f, +1.0f,
+	+1.0f, -1.0f,
+	+1.0f, +1.0f,
+};
+
+static const GLfloat textureCoords[] = {
+	0.0f, 1.0f,
+	0.0f, 0.0f,
+	1.0f, 1.0f,
+	1.0f, 0.0f,
+};
+
+ViewFinderGL::ViewFinderGL(QWidget *parent)
+	: QOpenGLWidget(parent), format_(0), width_(0), height_(0),
+	  numTextures_(0), horzSubSample_(1), vertSubSample_(1),
+	  programDirty_(false), frameAvailable_(false), textures_{ 0, 0 }
+{
+}
+
+ViewFinderGL::~ViewFinderGL()
+{
+	if (!isValid())
+		return;
+
+	makeCurrent();
+	glDeleteTextures(2, textures_);
+	program_.removeAllShaders();
+	doneCurrent();
+}
+
+int ViewFinderGL::setFormat(unsigned int format, unsigned int width,
+			    unsigned int height)
+{
+	/* Packed formats store two pixels per texel. */
+	unsigned int numTextures = 1;
+	unsigned int horzSubSample = 2;
+	unsigned int vertSubSample = 1;
+	const char *defines;
+
+	switch (format) {
+	case DRM_FORMAT_NV12:
+		numTextures = 2;
+		vertSubSample = 2;
+		defines = "";
+		break;
+	case DRM_FORMAT_NV21:
+		numTextures = 2;
+		vertSubSample = 2;
+		defines = "#define SWAP_UV\n";
+		break;
+	case DRM_FORMAT_NV16:
+		numTextures = 2;
+		defines = "";
+		break;
+	case DRM_FORMAT_NV61:
+		numTextures = 2;
+		defines = "#define SWAP_UV\n";
+		break;
+	case DRM_FORMAT_NV24:
+		numTextures = 2;
+		horzSubSample = 1;
+		defines = "";
+		break;
+	case DRM_FORMAT_NV42:
+		numTextures = 2;
+		horzSubSample = 1;
+		defines = "#define SWAP_UV\n";
+		break;
+	case DRM_FORMAT_YUYV:
+		defines = "#define Y0 c.r\n#define U c.g\n#define Y1 c.b\n#define V c.a\n";
+		break;
+	case DRM_FORMAT_YVYU:
+		defines = "#define Y0 c.r\n#define V c.g\n#define Y1 c.b\n#define U c.a\n";
+		break;
+	case DRM_FORMAT_UYVY:
+		defines = "#define U c.r\n#define Y0 c.g\n#define V c.b\n#define Y1 c.a\n";
+		break;
+	case DRM_FORMAT_VYUY:
+		defines = "#define V c.r\n#define Y0 c.g\n#define U c.b\n#define Y1 c.a\n";
+		break;
+	default:
+		return -EINVAL;
+	}
+
+	if (numTextures == 1 && width % 2)
+		return -EINVAL;
+
+	fragmentDefines_ = defines;
+	numTextures_ = numTextures;
+	horzSubSample_ = horzSubSample;
+	vertSubSample_ = vertSubSample;
+	format_ = format;
+	width_ = width;
+	height_ = height;
+
+	programDirty_ = true;
+	frameAvailable_ = false;
+
+	updateGeometry();
+	return 0;
+}
+
+void ViewFinderGL::display(const unsigned char *raw, size_t size)
+{
+	if (!isValid() || !numTextures_)
+		return;
+
+	/*
+	 * Upload the frame immediately, as the buffer is given back to the
+	 * camera when this function returns.
+	 */
+	makeCurrent();
+
+	if (numTextures_ == 2) {
+		unsigned int cwidth = width_ / horzSubSample_;
+		unsigned int cheight = height_ / vertSubSample_;
+
+		if (size < width_ * height_ + cwidth * cheight * 2) {
+			doneCurrent();
+			return;
+		}
+
+		uploadTexture(0, GL_LUMINANCE, width_, height_, raw);
+		uploadTexture(1, GL_LUMINANCE_ALPHA, cwidth, cheight,
+			      raw + width_ * height_);
+	} else {
+		if (size < width_ * height_ * 2) {
+			doneCurrent();
+			return;
+		}
+
+		uploadTexture(0, GL_RGBA, width_ / 2, height_, raw);
+	}
+
+	doneCurrent();
+
+	frameAvailable_ = true;
+	update();
+}
+
+void ViewFinderGL::initializeGL()
+{
+	initializeOpenGLFunctions();
+
+	glGenTextures(2, textures_);
+	glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+}
+
+bool ViewFinderGL::createProgram()
+{
+	program_.removeAllShaders();
+
+	QString fragmentSource = fragmentDefines_ + fragmentShaderHeader +
+				 (numTextures_ == 2 ? fragmentShaderNV
+						    : fragmentShaderPacked);
+
+	if (!program_.addShaderFromSourceCode(QOpenGLShader::Vertex,
+					      vertexShaderSource) ||
+	    !program_.addShaderFromSourceCode(QOpenGLShader::Fragment,
+					      fragmentSource) ||
+	    !program_.link()) {
+		qWarning() << "Failed to create shader program:" << program_.log();
+		return false;
+	}
+
+	programDirty_ = false;
+	return true;
+}
+
+void ViewFinderGL::uploadTexture(unsigned int index, GLenum format,
+				 unsigned int width, unsigned int height,
+				 const unsigned char *data)
+{
+	/* Packed formats must not interpolate between texels. */
+	GLint filter = numTextures_ == 1 ? GL_NEAREST : GL_LINEAR;
+
+	glBindTexture(GL_TEXTURE_2D, textures_[index]);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format,
+		     GL_UNSIGNED_BYTE, data);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, filter);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, filter);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+}
+
+void ViewFinderGL::paintGL()
+{
+	glClear(GL_COLOR_BUFFER_BIT);
+
+	if (!frameAvailable_)
+		return;
+
+	if (programDirty_ && !createProgram())
+		return;
+
+	program_.bind();
+
+	int vertexIn = program_.attributeLocation("vertexIn");
+	int textureIn = program_.attributeLocation("textureIn");
+	program_.enableAttributeArray(vertexIn);
+	program_.setAttributeArray(vertexIn, vertices, 2);
+	program_.enableAttributeArray(textureIn);
+	program_.setAttributeArray(textureIn, textureCoords, 2);
+
+	for (unsigned int i = 0; i < numTextures_; ++i) {
+		glActiveTexture(GL_TEXTURE0 + i);
+		glBindTexture(GL_TEXTURE_2D, textures_[i]);
+	}
+
+	if (numTextures_ == 2) {
+		program_.setUniformValue("tex_y", 0);
+		program_.setUniformValue("tex_uv", 1);
+	} else {
+		program_.setUniformValue("tex_packed", 0);
+		program_.setUniformValue("width", static_cast<GLfloat>(width_));
+	}
+
+	glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+
+	program_.disableAttributeArray(vertexIn);
+	program_.disableAttributeArray(textureIn);
+	program_.release();
+}
+
+void ViewFinderGL::resizeGL(int w, int h)
+{
+	glViewport(0, 0, w, h);
+}
+
+QSize ViewFinderGL::sizeHint() const
+{
+	return width_ && height_ ? QSize(width_, height_) : QSize(640, 480);
+}
@@ -0,0 +1,55 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * viewfinder_gl.h - qcam - Viewfinder rendering with OpenGL
+ */
+#ifndef __QCAM_VIEWFINDER_GL_H__
+#define __QCAM_VIEWFINDER_GL_H__
+
+#include <QOpenGLFunctions>
+#include <QOpenGLShaderProgram>
+#include <QOpenGLWidget>
+
+#include "viewfinder.h"
+
+class ViewFinderGL : public QOpenGLWidget, public ViewFinder,
+		     protected QOpenGLFunctions
+{
+public:
+	ViewFinderGL(QWidget *parent);
+	~ViewFinderGL();
+
+	int setFormat(unsigned int format, unsigned int width,
+		      unsigned int height) override;
+	void display(const unsigned char *raw, size_t size) override;
+
+protected:
+	void initializeGL() override;
+	void paintGL() override;
+	void resizeGL(int w, int h) override;
+	QSize sizeHint() const override;
+
+private:
+	bool createProgram();
+	void uploadTexture(unsigned int index, GLenum format,
+			   unsigned int width, unsigned int height,
+			   const unsigned char *data);
+
+	unsigned int format_;
+	unsigned int width_;
+	unsigned int height_;
+
+	/* Format parameters, set by setFormat(). */
+	QString fragmentDefines_;
+	unsigned int numTextures_;
+	unsigned int horzSubSample_;
+	unsigned int vertSubSample_;
+
+	QOpenGLShaderProgram program_;
+	bool programDirty_;
+	bool frameAvailable_;
+	GLuint textures_[2];
+};
+
+#endif /* __QCAM_VIEWFINDER_GL_H__ */
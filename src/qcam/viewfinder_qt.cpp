@@ -0,0 +1,139 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2019, Google Inc.
+ *
+ * viewfinder_qt.cpp - qcam - Viewfinder rendering with QPainter
+ */
+
+#include <linux/drm_fourcc.h>
+
+#include <QImage>
+#include <QPainter>
+#include <QtGlobal>
+
+#include <libcamera/pixelformats.h>
+
+#include "format_converter.h"
+#include "viewfinder_qt.h"
+
+namespace {
+
+struct NativeFormat {
+	unsigned int format;
+	QImage::Format qformat;
+};
+
+/*
+ * Formats whose memory layout matches a QImage format. DRM_FORMAT_BGRA8888 is
+ * stored as A, R, G, B bytes, which no QImage format matches, and is converted.
+ */
+const NativeFormat nativeFormatMap[] = {
+	{ DRM_FORMAT_BGR888, QImage::Format_RGB888 },
+#if QT_VERSION >= QT_VERSION_CHECK(5, 14, 0)
+	{ DRM_FORMAT_RGB888, QImage::Format_BGR888 },
+#endif
+};
+
+} /* namespace */
+
+ViewFinderQt::ViewFinderQt(QWidget *parent)
+	: QWidget(parent), format_(0), width_(0), height_(0), native_(false),
+	  nativeFormat_(QImage::Format_Invalid), stride_(0), image_(nullptr)
+{
+}
+
+ViewFinderQt::~ViewFinderQt()
+{
+	delete image_;
+}
+
+/*
+ * Frames in native formats are wrapped in the image without any copy, and the
+ * caller shall keep the frame memory valid until the next frame is displayed
+ * or the viewfinder is stopped. Other formats are converted to RGB.
+ */
+void ViewFinderQt::display(const unsigned char *raw, size_t size)
+{
+	if (!native_) {
+		converter_.convert(raw, size, image_);
+	} else if (size >= static_cast<size_t>(stride_) * height_) {
+		*image_ = QImage(raw, width_, height_, stride_, nativeFormat_);
+	} else {
+		/* Drop the reference to the previous frame on short frames. */
+		*image_ = image_->copy();
+		return;
+	}
+
+	update();
+}
+
+std::vector<unsigned int> ViewFinderQt::nativeFormats() const
+{
+	std::vector<unsigned int> formats;
+	for (const NativeFormat &entry : nativeFormatMap)
+		formats.push_back(entry.format);
+
+	return formats;
+}
+
+/*
+ * Detach the image from the frame memory, which is about to be released, and
+ * keep displaying the last frame.
+ */
+void ViewFinderQt::stop()
+{
+	if (native_ && image_)
+		*image_ = image_->copy();
+}
+
+void ViewFinderQt::setThreads(unsigned int threads)
+{
+	converter_.setThreads(threads);
+}
+
+int ViewFinderQt::setFormat(unsigned int format, unsigned int width,
+			  unsigned int height)
+{
+	native_ = false;
+	for (const NativeFormat &entry : nativeFormatMap) {
+		if (entry.format == format) {
+			native_ = true;
+			nativeFormat_ = entry.qformat;
+			break;
+		}
+	}
+
+	if (!native_) {
+		int ret = converter_.configure(format, width, height);
+		if (ret < 0)
+			return ret;
+	}
+
+	stride_ = libcamera::PixelFormatInfo::info(format).stride(width, 0);
+	format_ = format;
+	width_ = width;
+	height_ = height;
+
+	delete image_;
+	image_ = new QImage(width, height, QImage::Format_RGB32);
+
+	updateGeometry();
+	return 0;
+}
+
+void ViewFinderQt::resizeEvent(QResizeEvent *)
+{
+	converter_.setDisplaySize(width(), height());
+}
+
+void ViewFinderQt::paintEvent(QPaintEvent *)
+{
+	QPainter painter(this);
+	painter.drawImage(rect(), *image_, image_->rect());
+}
+
+QSize ViewFinderQt::sizeHint() const
+{
+	/* The image may be smaller than the stream for scaled formats. */
+	return width_ && height_ ? QSize(width_, height_) : QSize(640, 480);
+}
@@ -0,0 +1,51 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2019, Google Inc.
+ *
+ * viewfinder_qt.h - qcam - Viewfinder rendering with QPainter
+ */
+#ifndef __QCAM_VIEWFINDER_QT_H__
+#define __QCAM_VIEWFINDER_QT_H__
+
+#include <QImage>
+#include <QWidget>
+
+#include "format_converter.h"
+#include "viewfinder.h"
+
+class ViewFinderQt : public QWidget, public ViewFinder
+{
+public:
+	ViewFinderQt(QWidget *parent);
+	~ViewFinderQt();
+
+	int setFormat(unsigned int format, unsigned int width,
+		      unsigned int height) override;
+	void display(const unsigned char *raw, size_t size) override;
+
+	std::vector<unsigned int> nativeFormats() const override;
+	bool retainsFrames() const override { return native_; }
+	void stop() override;
+
+	void setThreads(unsigned int threads);
+
+protected:
+	void paintEvent(QPaintEvent *) override;
+	void resizeEvent(QResizeEvent *) override;
+	QSize sizeHint() const override;
+
+private:
+	unsigned int format_;
+	unsigned int width_;
+	unsigned int height_;
+
+	/* Native formats are displayed in place, without conversion. */
+	bool native_;
+	QImage::Format nativeFormat_;
+	unsigned int stride_;
+
+	FormatConverter converter_;
+	QImage *image_;
+};
+
+#endif /* __QCAM_VIEWFINDER_QT_H__ */
@@ -8,6 +8,11 @@
 #include "v4l2_camera.h"
 
 #include <errno.h>
+#include <stdint.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <libcamera/control_ids.h>
 
 #include "log.h"
 
@@ -15,83 +20,245 @@ using namespace libcamera;
 
 LOG_DECLARE_CATEGORY(V4L2Compat);
 
+V4L2Camera::Node::Node()
+	: isOpen(false), isStreaming(false), efd(-1), completedHead(0),
+	  completedTail(0)
+{
+}
+
 V4L2Camera::V4L2Camera(std::shared_ptr<Camera> camera)
-	: camera_(camera), isRunning_(false), bufferAllocator_(nullptr)
+	: camera_(camera), isRunning_(false), openCount_(0),
+	  frameDuration_(0), bufferAllocator_(nullptr)
 {
 	camera_->requestCompleted.connect(this, &V4L2Camera::requestComplete);
 }
 
 V4L2Camera::~V4L2Camera()
 {
-	close();
+	for (unsigned int i = 0; i < MaxNodes; ++i)
+		close(i);
 }
 
-int V4L2Camera::open()
+/*
+ * The camera is shared by up to MaxNodes V4L2 nodes, each of them capturing
+ * from a separate stream. All the streams supported by the camera, up to one
+ * per node, are configured when the first node is opened. This allows nodes
+ * to be opened and started while the camera is already running, without
+ * reconfiguring it, and thus without capturing twice from the sensor.
+ *
+ * The efd is an eventfd in semaphore mode, signalled once for every buffer
+ * completed for the node. It backs the file descriptor handed to the
+ * application, which can thus poll() it for buffer availability.
+ */
+int V4L2Camera::open(unsigned int node, int efd)
 {
-	/* \todo Support multiple open. */
-	if (camera_->acquire() < 0) {
-		LOG(V4L2Compat, Error) << "Failed to acquire camera";
+	if (node >= MaxNodes)
 		return -EINVAL;
+
+	Node &n = nodes_[node];
+	if (n.isOpen)
+		return -EBUSY;
+
+	if (!openCount_) {
+		if (camera_->acquire() < 0) {
+			LOG(V4L2Compat, Error) << "Failed to acquire camera";
+			return -EINVAL;
+		}
+
+		config_ = camera_->generateConfiguration({ StreamRole::Viewfinder,
+							   StreamRole::VideoRecording });
+		if (config_ && config_->validate() == CameraConfiguration::Invalid)
+			config_.reset();
+		if (!config_)
+			config_ = camera_->generateConfiguration({ StreamRole::Viewfinder });
+		if (!config_) {
+			camera_->release();
+			return -EINVAL;
+		}
+
+		bufferAllocator_ = FrameBufferAllocator::create(camera_);
 	}
 
-	config_ = camera_->generateConfiguration({ StreamRole::Viewfinder });
-	if (!config_) {
-		camera_->release();
-		return -EINVAL;
+	if (node >= config_->size()) {
+		LOG(V4L2Compat, Debug)
+			<< "No stream available for node " << node;
+
+		if (!openCount_) {
+			delete bufferAllocator_;
+			bufferAllocator_ = nullptr;
+			config_.reset();
+			camera_->release();
+		}
+
+		return -EBUSY;
 	}
 
-	bufferAllocator_ = FrameBufferAllocator::create(camera_);
+	n.isOpen = true;
+	n.efd = efd;
+	openCount_++;
 
 	return 0;
 }
 
-void V4L2Camera::close()
+void V4L2Camera::close(unsigned int node)
 {
+	Node &n = nodes_[node];
+	if (!n.isOpen)
+		return;
+
+	streamOff(node);
+	freeBuffers(node);
+
+	n.isOpen = false;
+	n.efd = -1;
+
+	if (--openCount_)
+		return;
+
 	delete bufferAllocator_;
 	bufferAllocator_ = nullptr;
+	config_.reset();
 
 	camera_->release();
 }
 
-void V4L2Camera::getStreamConfig(StreamConfiguration *streamConfig)
+void V4L2Camera::getStreamConfig(unsigned int node,
+				 StreamConfiguration *streamConfig)
 {
-	*streamConfig = config_->at(0);
+	*streamConfig = config_->at(node);
+}
+
+uint64_t V4L2Camera::requestCookie(unsigned int node, unsigned int index)
+{
+	return static_cast<uint64_t>(node) << 32 | index;
+}
+
+Stream *V4L2Camera::nodeStream(unsigned int node) const
+{
+	if (!config_ || node >= config_->size())
+		return nullptr;
+
+	return config_->at(node).stream();
+}
+
+/*
+ * The camera can't be reconfigured while it runs or while another node holds
+ * buffers.
+ */
+bool V4L2Camera::isBusy(unsigned int except) const
+{
+	if (isRunning_)
+		return true;
+
+	for (unsigned int i = 0; i < MaxNodes; ++i) {
+		if (i != except && !nodes_[i].requests.empty())
+			return true;
+	}
+
+	return false;
+}
+
+/*
+ * Pop the oldest completed buffer. This is called from the application thread
+ * after consuming one count from the eventfd, which guarantees that a buffer
+ * is available.
+ */
+bool V4L2Camera::dequeueBuffer(unsigned int node, Buffer *buffer)
+{
+	Node &n = nodes_[node];
+
+	unsigned int tail = n.completedTail.load(std::memory_order_relaxed);
+	if (tail == n.completedHead.load(std::memory_order_acquire))
+		return false;
+
+	*buffer = n.completedBuffers[tail % n.completedBuffers.size()];
+	n.completedTail.store(tail + 1, std::memory_order_release);
+
+	return true;
 }
 
-std::vector<V4L2Camera::Buffer> V4L2Camera::completedBuffers()
+/*
+ * Size the completed buffers ring for count buffers. A buffer can't complete
+ * again before being dequeued and requeued, so the ring can't overflow. This
+ * must only be called when the node isn't streaming.
+ */
+void V4L2Camera::resetCompletedBuffers(Node &node, unsigned int count)
 {
-	std::vector<Buffer> v;
+	node.completedBuffers.clear();
+	node.completedBuffers.resize(count);
+	node.completedHead.store(0, std::memory_order_relaxed);
+	node.completedTail.store(0, std::memory_order_relaxed);
+}
 
-	bufferLock_.lock();
-	for (std::unique_ptr<Buffer> &metadata : completedBuffers_)
-		v.push_back(*metadata.get());
-	completedBuffers_.clear();
-	bufferLock_.unlock();
+/*
+ * Discard the buffers that have completed but haven't been dequeued,
+ * consuming their eventfd counts.
+ */
+void V4L2Camera::discardCompletedBuffers(Node &node)
+{
+	while (node.completedTail.load() != node.completedHead.load()) {
+		uint64_t value;
+		if (::read(node.efd, &value, sizeof(value)) != sizeof(value))
+			break;
 
-	return v;
+		node.completedTail++;
+	}
 }
 
 void V4L2Camera::requestComplete(Request *request)
 {
-	if (request->status() == Request::RequestCancelled)
+	unsigned int node = request->cookie() >> 32;
+	unsigned int index = request->cookie() & 0xffffffff;
+	if (node >= MaxNodes)
 		return;
 
-	/* We only have one stream at the moment. */
-	bufferLock_.lock();
+	Node &n = nodes_[node];
+	n.inFlight.erase(index);
+
+	if (request->status() == Request::RequestCancelled || !n.isStreaming)
+		return;
+
+	unsigned int head = n.completedHead.load(std::memory_order_relaxed);
+	if (head - n.completedTail.load(std::memory_order_acquire) >=
+	    n.completedBuffers.size()) {
+		LOG(V4L2Compat, Error) << "Completed buffers queue overflow";
+		return;
+	}
+
+	/* Requests contain a single buffer, for the node's stream. */
 	FrameBuffer *buffer = request->buffers().begin()->second;
-	std::unique_ptr<Buffer> metadata =
-		std::make_unique<Buffer>(request->cookie(), buffer->metadata());
-	completedBuffers_.push_back(std::move(metadata));
-	bufferLock_.unlock();
+	n.completedBuffers[head % n.completedBuffers.size()] =
+		Buffer(index, buffer->metadata());
+	n.completedHead.store(head + 1, std::memory_order_release);
 
-	bufferSema_.release();
+	uint64_t value = 1;
+	if (::write(n.efd, &value, sizeof(value)) != sizeof(value))
+		LOG(V4L2Compat, Error) << "Failed to signal buffer completion";
 }
 
-int V4L2Camera::configure(StreamConfiguration *streamConfigOut,
+int V4L2Camera::configure(unsigned int node,
+			  StreamConfiguration *streamConfigOut,
 			  const Size &size, PixelFormat pixelformat,
 			  unsigned int bufferCount)
 {
-	StreamConfiguration &streamConfig = config_->at(0);
+	StreamConfiguration &streamConfig = config_->at(node);
+
+	/*
+	 * When the camera is in use by other nodes, the current configuration
+	 * can be retrieved but not modified.
+	 */
+	if (isBusy(node)) {
+		if (streamConfig.size != size ||
+		    streamConfig.pixelFormat != pixelformat) {
+			LOG(V4L2Compat, Debug)
+				<< "Can't reconfigure camera in use";
+			return -EBUSY;
+		}
+
+		*streamConfigOut = streamConfig;
+		return 0;
+	}
+
 	streamConfig.size.width = size.width;
 	streamConfig.size.height = size.height;
 	streamConfig.pixelFormat = pixelformat;
@@ -113,27 +280,176 @@ int V4L2Camera::configure(StreamConfiguration *streamConfigOut,
 	if (ret < 0)
 		return ret;
 
-	*streamConfigOut = config_->at(0);
+	*streamConfigOut = config_->at(node);
 
 	return 0;
 }
 
-int V4L2Camera::allocBuffers(unsigned int count)
+/*
+ * Buffers can only be allocated while the camera is stopped. Buffers are thus
+ * allocated for all the streams at once, in order for nodes opened later to
+ * use them while the camera is running.
+ */
+int V4L2Camera::allocBuffers(unsigned int node, unsigned int count)
 {
-	Stream *stream = *camera_->streams().begin();
+	Stream *stream = nodeStream(node);
+	if (!stream)
+		return -EINVAL;
+
+	for (const StreamConfiguration &cfg : *config_) {
+		if (!bufferAllocator_->buffers(cfg.stream()).empty())
+			continue;
+
+		if (isRunning_)
+			return -EBUSY;
 
-	return bufferAllocator_->allocate(stream);
+		int ret = bufferAllocator_->allocate(cfg.stream());
+		if (ret < 0)
+			return ret;
+	}
+
+	Node &n = nodes_[node];
+	if (!n.inFlight.empty())
+		return -EBUSY;
+
+	const std::vector<std::unique_ptr<FrameBuffer>> &buffers =
+		bufferAllocator_->buffers(stream);
+
+	/* Create one request per buffer, to be reused for every capture. */
+	n.requests.clear();
+	for (unsigned int i = 0; i < buffers.size(); i++) {
+		std::unique_ptr<Request> request =
+			camera_->createRequest(requestCookie(node, i));
+		if (!request) {
+			n.requests.clear();
+			return -ENOMEM;
+		}
+
+		request->addBuffer(stream, buffers[i].get());
+
+		n.requests.push_back(std::move(request));
+	}
+
+	resetCompletedBuffers(n, buffers.size());
+
+	return buffers.size();
 }
 
-void V4L2Camera::freeBuffers()
+/*
+ * Prepare count requests for buffers provided by the application as dmabufs.
+ * The requests are created when the buffers are imported at queue time.
+ */
+int V4L2Camera::importBuffers(unsigned int node, unsigned int count)
 {
-	Stream *stream = *camera_->streams().begin();
-	bufferAllocator_->free(stream);
+	if (!nodeStream(node))
+		return -EINVAL;
+
+	Node &n = nodes_[node];
+	if (!n.inFlight.empty())
+		return -EBUSY;
+
+	n.requests.clear();
+	n.requests.resize(count);
+
+	n.importedBuffers.clear();
+	n.importedBuffers.resize(count);
+
+	resetCompletedBuffers(n, count);
+
+	return count;
 }
 
-FileDescriptor V4L2Camera::getBufferFd(unsigned int index)
+/*
+ * Import the dmabuf fd for the buffer at index. V4L2 allows applications to
+ * queue a different dmabuf every time, but they usually cycle through a fixed
+ * set. The FrameBuffer, and the request it belongs to, are thus only recreated
+ * when the dmabuf changes, which lets the pipeline handler reuse its cached
+ * V4L2 buffer for the same dmabuf.
+ */
+int V4L2Camera::importBuffer(unsigned int node, unsigned int index, int fd,
+			     unsigned int length)
 {
-	Stream *stream = *camera_->streams().begin();
+	Node &n = nodes_[node];
+
+	if (index >= n.importedBuffers.size()) {
+		LOG(V4L2Compat, Error) << "Invalid buffer index " << index;
+		return -EINVAL;
+	}
+
+	if (n.inFlight.count(index))
+		return -EBUSY;
+
+	struct stat st;
+	if (fstat(fd, &st) < 0)
+		return -EBADF;
+
+	ImportedBuffer &imported = n.importedBuffers[index];
+	if (imported.buffer && imported.fd == fd && imported.inode == st.st_ino &&
+	    imported.buffer->planes()[0].length == length)
+		return 0;
+
+	FrameBuffer::Plane plane;
+	plane.fd = FileDescriptor(fd);
+	plane.length = length;
+	if (!plane.fd.isValid())
+		return -EBADF;
+
+	std::unique_ptr<Request> request =
+		camera_->createRequest(requestCookie(node, index));
+	if (!request)
+		return -ENOMEM;
+
+	std::unique_ptr<FrameBuffer> buffer =
+		std::make_unique<FrameBuffer>(std::vector<FrameBuffer::Plane>{ plane });
+
+	int ret = request->addBuffer(nodeStream(node), buffer.get());
+	if (ret < 0)
+		return ret;
+
+	n.requests[index] = std::move(request);
+	imported.buffer = std::move(buffer);
+	imported.fd = fd;
+	imported.inode = st.st_ino;
+
+	return 0;
+}
+
+int V4L2Camera::freeBuffers(unsigned int node)
+{
+	Node &n = nodes_[node];
+
+	if (!n.inFlight.empty())
+		return -EBUSY;
+
+	n.pendingRequests.clear();
+	n.requests.clear();
+	n.importedBuffers.clear();
+	resetCompletedBuffers(n, 0);
+
+	/*
+	 * Release the buffers once the camera is stopped and no node uses them
+	 * anymore.
+	 */
+	if (isRunning_)
+		return 0;
+
+	for (unsigned int i = 0; i < MaxNodes; ++i) {
+		if (!nodes_[i].requests.empty())
+			return 0;
+	}
+
+	for (const StreamConfiguration &cfg : *config_)
+		bufferAllocator_->free(cfg.stream());
+
+	return 0;
+}
+
+FileDescriptor V4L2Camera::getBufferFd(unsigned int node, unsigned int index)
+{
+	Stream *stream = nodeStream(node);
+	if (!stream)
+		return FileDescriptor();
+
 	const std::vector<std::unique_ptr<FrameBuffer>> &buffers =
 		bufferAllocator_->buffers(stream);
 
@@ -143,71 +459,130 @@ FileDescriptor V4L2Camera::getBufferFd(unsigned int index)
 	return buffers[index]->planes()[0].fd;
 }
 
-int V4L2Camera::streamOn()
+/*
+ * The camera is started when the first node starts streaming, and stopped
+ * when the last node stops.
+ */
+int V4L2Camera::streamOn(unsigned int node)
 {
-	if (isRunning_)
+	Node &n = nodes_[node];
+	if (n.isStreaming)
 		return 0;
 
-	int ret = camera_->start();
-	if (ret < 0)
-		return ret == -EACCES ? -EBUSY : ret;
+	if (!isRunning_) {
+		int ret = camera_->start();
+		if (ret < 0)
+			return ret == -EACCES ? -EBUSY : ret;
 
-	isRunning_ = true;
+		isRunning_ = true;
+	}
+
+	n.isStreaming = true;
 
-	for (std::unique_ptr<Request> &req : pendingRequests_) {
+	for (Request *req : n.pendingRequests) {
 		/* \todo What should we do if this returns -EINVAL? */
-		ret = camera_->queueRequest(req.release());
+		int ret = camera_->queueRequest(req);
 		if (ret < 0)
 			return ret == -EACCES ? -EBUSY : ret;
+
+		n.inFlight.insert(req->cookie() & 0xffffffff);
 	}
 
-	pendingRequests_.clear();
+	n.pendingRequests.clear();
 
 	return 0;
 }
 
-int V4L2Camera::streamOff()
+int V4L2Camera::streamOff(unsigned int node)
 {
 	/* \todo Restore buffers to reqbufs state? */
-	if (!isRunning_)
+	Node &n = nodes_[node];
+	if (!n.isStreaming)
 		return 0;
 
-	int ret = camera_->stop();
-	if (ret < 0)
-		return ret == -EACCES ? -EBUSY : ret;
+	bool lastNode = true;
+	for (unsigned int i = 0; i < MaxNodes; ++i) {
+		if (i != node && nodes_[i].isStreaming)
+			lastNode = false;
+	}
+
+	/*
+	 * When other nodes are still streaming, the requests in flight for
+	 * the node complete normally, and are dropped.
+	 */
+	if (lastNode) {
+		int ret = camera_->stop();
+		if (ret < 0)
+			return ret == -EACCES ? -EBUSY : ret;
+
+		isRunning_ = false;
+	}
 
-	isRunning_ = false;
+	n.isStreaming = false;
+	n.pendingRequests.clear();
+	discardCompletedBuffers(n);
 
 	return 0;
 }
 
-int V4L2Camera::qbuf(unsigned int index)
+int V4L2Camera::qbuf(unsigned int node, unsigned int index)
 {
-	std::unique_ptr<Request> request =
-		std::unique_ptr<Request>(camera_->createRequest(index));
-	if (!request) {
-		LOG(V4L2Compat, Error) << "Can't create request";
-		return -ENOMEM;
-	}
+	Node &n = nodes_[node];
 
-	Stream *stream = config_->at(0).stream();
-	FrameBuffer *buffer = bufferAllocator_->buffers(stream)[index].get();
-	int ret = request->addBuffer(stream, buffer);
-	if (ret < 0) {
-		LOG(V4L2Compat, Error) << "Can't set buffer for request";
-		return -ENOMEM;
+	if (index >= n.requests.size() || !n.requests[index]) {
+		LOG(V4L2Compat, Error) << "Invalid buffer index " << index;
+		return -EINVAL;
 	}
 
-	if (!isRunning_) {
-		pendingRequests_.push_back(std::move(request));
+	/* The buffer may still be in flight after a stream off. */
+	if (n.inFlight.count(index))
+		return -EBUSY;
+
+	Request *request = n.requests[index].get();
+	request->reuse();
+
+	if (frameDuration_)
+		request->controls().set(controls::FrameDuration, frameDuration_);
+
+	if (!n.isStreaming) {
+		n.pendingRequests.push_back(request);
 		return 0;
 	}
 
-	ret = camera_->queueRequest(request.release());
+	int ret = camera_->queueRequest(request);
 	if (ret < 0) {
 		LOG(V4L2Compat, Error) << "Can't queue request";
 		return ret == -EACCES ? -EBUSY : ret;
 	}
 
+	n.inFlight.insert(index);
+
+	return 0;
+}
+
+/*
+ * Retrieve the range of frame durations in microseconds supported by the
+ * camera, or return -ENOTTY if the camera can't control its frame rate.
+ */
+int V4L2Camera::frameDurationRange(int64_t *min, int64_t *max)
+{
+	const ControlInfoMap &controls = camera_->controls();
+	auto iter = controls.find(&controls::FrameDuration);
+	if (iter == controls.end())
+		return -ENOTTY;
+
+	*min = iter->second.min().get<int64_t>();
+	*max = iter->second.max().get<int64_t>();
+
 	return 0;
 }
+
+/*
+ * Set the frame duration applied to all requests queued from now on, for all
+ * nodes of the camera. The camera is shared by the nodes and runs at a single
+ * frame rate.
+ */
+void V4L2Camera::setFrameDuration(int64_t duration)
+{
+	frameDuration_ = duration;
+}
@@ -8,23 +8,30 @@
 #ifndef __V4L2_CAMERA_H__
 #define __V4L2_CAMERA_H__
 
+#include <array>
+#include <atomic>
 #include <deque>
-#include <mutex>
+#include <set>
+#include <sys/types.h>
 #include <utility>
+#include <vector>
 
 #include <libcamera/buffer.h>
 #include <libcamera/camera.h>
 #include <libcamera/file_descriptor.h>
 #include <libcamera/framebuffer_allocator.h>
 
-#include "semaphore.h"
-
 using namespace libcamera;
 
 class V4L2Camera : public Object
 {
 public:
 	struct Buffer {
+		Buffer()
+			: index(0)
+		{
+		}
+
 		Buffer(unsigned int index, const FrameMetadata &data)
 			: index(index), data(data)
 		{
@@ -34,42 +41,90 @@ public:
 		FrameMetadata data;
 	};
 
+	/*
+	 * Number of V4L2 nodes exposed per camera. Each node captures from a
+	 * separate stream of the camera.
+	 */
+	static constexpr unsigned int MaxNodes = 2;
+
 	V4L2Camera(std::shared_ptr<Camera> camera);
 	~V4L2Camera();
 
-	int open();
-	void close();
-	void getStreamConfig(StreamConfiguration *streamConfig);
-	std::vector<Buffer> completedBuffers();
+	int open(unsigned int node, int efd);
+	void close(unsigned int node);
+	void getStreamConfig(unsigned int node,
+			     StreamConfiguration *streamConfig);
+	bool dequeueBuffer(unsigned int node, Buffer *buffer);
 
-	int configure(StreamConfiguration *streamConfigOut,
+	int configure(unsigned int node, StreamConfiguration *streamConfigOut,
 		      const Size &size, PixelFormat pixelformat,
 		      unsigned int bufferCount);
 
-	int allocBuffers(unsigned int count);
-	void freeBuffers();
-	FileDescriptor getBufferFd(unsigned int index);
+	int allocBuffers(unsigned int node, unsigned int count);
+	int importBuffers(unsigned int node, unsigned int count);
+	int importBuffer(unsigned int node, unsigned int index, int fd,
+			 unsigned int length);
+	int freeBuffers(unsigned int node);
+	FileDescriptor getBufferFd(unsigned int node, unsigned int index);
 
-	int streamOn();
-	int streamOff();
+	int streamOn(unsigned int node);
+	int streamOff(unsigned int node);
 
-	int qbuf(unsigned int index);
+	int qbuf(unsigned int node, unsigned int index);
 
-	Semaphore bufferSema_;
+	int frameDurationRange(int64_t *min, int64_t *max);
+	int64_t frameDuration() const { return frameDuration_; }
+	void setFrameDuration(int64_t duration);
 
 private:
+	struct ImportedBuffer {
+		std::unique_ptr<FrameBuffer> buffer;
+		int fd;
+		ino_t inode;
+	};
+
+	struct Node {
+		Node();
+
+		bool isOpen;
+		bool isStreaming;
+		int efd;
+
+		std::vector<std::unique_ptr<Request>> requests;
+		std::vector<ImportedBuffer> importedBuffers;
+		std::deque<Request *> pendingRequests;
+		std::set<unsigned int> inFlight;
+
+		/*
+		 * Single-producer single-consumer ring of completed buffers,
+		 * filled by the camera manager thread and drained by the
+		 * application thread.
+		 */
+		std::vector<Buffer> completedBuffers;
+		std::atomic<unsigned int> completedHead;
+		std::atomic<unsigned int> completedTail;
+	};
+
+	static uint64_t requestCookie(unsigned int node, unsigned int index);
+
 	void requestComplete(Request *request);
+	void resetCompletedBuffers(Node &node, unsigned int count);
+	void discardCompletedBuffers(Node &node);
+	Stream *nodeStream(unsigned int node) const;
+	bool isBusy(unsigned int except) const;
 
 	std::shared_ptr<Camera> camera_;
 	std::unique_ptr<CameraConfiguration> config_;
 
 	bool isRunning_;
+	unsigned int openCount_;
+
+	/* Frame duration shared by all nodes, 0 for the camera default. */
+	int64_t frameDuration_;
 
-	std::mutex bufferLock_;
 	FrameBufferAllocator *bufferAllocator_;
 
-	std::deque<std::unique_ptr<Request>> pendingRequests_;
-	std::deque<std::unique_ptr<Buffer>> completedBuffers_;
+	std::array<Node, MaxNodes> nodes_;
 };
 
 #endif /* __V4L2_CAMERA_H__ */
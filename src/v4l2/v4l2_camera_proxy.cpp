@@ -8,15 +8,16 @@
 #include "v4l2_camera_proxy.h"
 
 #include <algorithm>
-#include <array>
 #include <errno.h>
-#include <linux/drm_fourcc.h>
+#include <fcntl.h>
 #include <linux/videodev2.h>
 #include <string.h>
 #include <sys/mman.h>
+#include <unistd.h>
 
 #include <libcamera/camera.h>
 #include <libcamera/object.h>
+#include <libcamera/pixelformats.h>
 
 #include "log.h"
 #include "utils.h"
@@ -29,29 +30,47 @@ using namespace libcamera;
 
 LOG_DECLARE_CATEGORY(V4L2Compat);
 
-V4L2CameraProxy::V4L2CameraProxy(unsigned int index,
+/*
+ * Each proxy implements one V4L2 node of a camera. The nodes of a camera share
+ * the same V4L2Camera, and capture from separate streams.
+ */
+V4L2CameraProxy::V4L2CameraProxy(unsigned int index, unsigned int node,
+				 std::shared_ptr<V4L2Camera> vcam,
 				 std::shared_ptr<Camera> camera)
-	: refcount_(0), index_(index), bufferCount_(0), currentBuf_(0),
-	  vcam_(std::make_unique<V4L2Camera>(camera))
+	: refcount_(0), index_(index), node_(node), efd_(-1), bufferCount_(0),
+	  memory_(V4L2_MEMORY_MMAP), vcam_(vcam)
 {
 	querycap(camera);
 }
 
-int V4L2CameraProxy::open(bool nonBlocking)
+/*
+ * The efd is the eventfd handed to the application as the device file
+ * descriptor. The proxy keeps its own duplicate, which shares the file status
+ * flags, and thus the blocking mode, with the application's descriptor.
+ */
+int V4L2CameraProxy::open(int efd)
 {
 	LOG(V4L2Compat, Debug) << "Servicing open";
 
+	const V4L2CompatManager::FileOperations &fops =
+		V4L2CompatManager::instance()->fops();
+
+	int proxyEfd = fops.dup(efd);
+	if (proxyEfd < 0)
+		return -1;
+
 	int ret = vcam_->invokeMethod(&V4L2Camera::open,
-				      ConnectionTypeBlocking);
+				      ConnectionTypeBlocking, node_, proxyEfd);
 	if (ret < 0) {
+		fops.close(proxyEfd);
 		errno = -ret;
 		return -1;
 	}
 
-	nonBlocking_ = nonBlocking;
+	efd_ = proxyEfd;
 
 	vcam_->invokeMethod(&V4L2Camera::getStreamConfig,
-			    ConnectionTypeBlocking, &streamConfig_);
+			    ConnectionTypeBlocking, node_, &streamConfig_);
 	setFmtFromConfig(streamConfig_);
 	sizeimage_ = calculateSizeImage(streamConfig_);
 
@@ -72,7 +91,11 @@ void V4L2CameraProxy::close()
 	if (--refcount_ > 0)
 		return;
 
-	vcam_->invokeMethod(&V4L2Camera::close, ConnectionTypeBlocking);
+	vcam_->invokeMethod(&V4L2Camera::close, ConnectionTypeBlocking,
+			    node_);
+
+	V4L2CompatManager::instance()->fops().close(efd_);
+	efd_ = -1;
 }
 
 void *V4L2CameraProxy::mmap(void *addr, size_t length, int prot, int flags,
@@ -92,7 +115,7 @@ void *V4L2CameraProxy::mmap(void *addr, size_t length, int prot, int flags,
 		return MAP_FAILED;
 	}
 
-	FileDescriptor fd = vcam_->getBufferFd(index);
+	FileDescriptor fd = vcam_->getBufferFd(node_, index);
 	if (!fd.isValid()) {
 		errno = EINVAL;
 		return MAP_FAILED;
@@ -136,40 +159,38 @@ bool V4L2CameraProxy::validateBufferType(uint32_t type)
 
 bool V4L2CameraProxy::validateMemoryType(uint32_t memory)
 {
-	return memory == V4L2_MEMORY_MMAP;
+	return memory == V4L2_MEMORY_MMAP || memory == V4L2_MEMORY_DMABUF;
 }
 
 void V4L2CameraProxy::setFmtFromConfig(StreamConfiguration &streamConfig)
 {
+	const PixelFormatInfo &info = PixelFormatInfo::info(streamConfig.pixelFormat);
+
 	curV4L2Format_.fmt.pix.width = streamConfig.size.width;
 	curV4L2Format_.fmt.pix.height = streamConfig.size.height;
 	curV4L2Format_.fmt.pix.pixelformat = drmToV4L2(streamConfig.pixelFormat);
 	curV4L2Format_.fmt.pix.field = V4L2_FIELD_NONE;
-	curV4L2Format_.fmt.pix.bytesperline =
-		bplMultiplier(curV4L2Format_.fmt.pix.pixelformat) *
-		curV4L2Format_.fmt.pix.width;
-	curV4L2Format_.fmt.pix.sizeimage =
-		imageSize(curV4L2Format_.fmt.pix.pixelformat,
-			  curV4L2Format_.fmt.pix.width,
-			  curV4L2Format_.fmt.pix.height);
+	curV4L2Format_.fmt.pix.bytesperline = info.stride(streamConfig.size.width, 0);
+	curV4L2Format_.fmt.pix.sizeimage = info.frameSize(streamConfig.size);
 	curV4L2Format_.fmt.pix.colorspace = V4L2_COLORSPACE_SRGB;
 }
 
 unsigned int V4L2CameraProxy::calculateSizeImage(StreamConfiguration &streamConfig)
 {
 	/*
-	 * \todo Merge this method with setFmtFromConfig (need imageSize to
-	 * support all libcamera formats first, or filter out MJPEG for now).
+	 * \todo Merge this method with setFmtFromConfig (need frameSize() to
+	 * support compressed formats first, or filter out MJPEG for now).
 	 */
-	return imageSize(drmToV4L2(streamConfig.pixelFormat),
-			 streamConfig.size.width,
-			 streamConfig.size.height);
+	const PixelFormatInfo &info = PixelFormatInfo::info(streamConfig.pixelFormat);
+	return info.frameSize(streamConfig.size);
 }
 
 void V4L2CameraProxy::querycap(std::shared_ptr<Camera> camera)
 {
 	std::string driver = "libcamera";
 	std::string bus_info = driver + ":" + std::to_string(index_);
+	if (node_)
+		bus_info += "." + std::to_string(node_);
 
 	utils::strlcpy(reinterpret_cast<char *>(capabilities_.driver), driver.c_str(),
 		       sizeof(capabilities_.driver));
@@ -185,29 +206,26 @@ void V4L2CameraProxy::querycap(std::shared_ptr<Camera> camera)
 	memset(capabilities_.reserved, 0, sizeof(capabilities_.reserved));
 }
 
-void V4L2CameraProxy::updateBuffers()
-{
-	std::vector<V4L2Camera::Buffer> completedBuffers = vcam_->completedBuffers();
-	for (const V4L2Camera::Buffer &buffer : completedBuffers) {
-		const FrameMetadata &fmd = buffer.data;
-		struct v4l2_buffer &buf = buffers_[buffer.index];
-
-		switch (fmd.status) {
-		case FrameMetadata::FrameSuccess:
-			buf.bytesused = fmd.planes[0].bytesused;
-			buf.field = V4L2_FIELD_NONE;
-			buf.timestamp.tv_sec = fmd.timestamp / 1000000000;
-			buf.timestamp.tv_usec = fmd.timestamp % 1000000;
-			buf.sequence = fmd.sequence;
-
-			buf.flags |= V4L2_BUF_FLAG_DONE;
-			break;
-		case FrameMetadata::FrameError:
-			buf.flags |= V4L2_BUF_FLAG_ERROR;
-			break;
-		default:
-			break;
-		}
+void V4L2CameraProxy::updateBuffer(const V4L2Camera::Buffer &buffer)
+{
+	const FrameMetadata &fmd = buffer.data;
+	struct v4l2_buffer &buf = buffers_[buffer.index];
+
+	switch (fmd.status) {
+	case FrameMetadata::FrameSuccess:
+		buf.bytesused = fmd.planes()[0].bytesused;
+		buf.field = V4L2_FIELD_NONE;
+		buf.timestamp.tv_sec = fmd.timestamp / 1000000000;
+		buf.timestamp.tv_usec = fmd.timestamp % 1000000;
+		buf.sequence = fmd.sequence;
+
+		buf.flags |= V4L2_BUF_FLAG_DONE;
+		break;
+	case FrameMetadata::FrameError:
+		buf.flags |= V4L2_BUF_FLAG_ERROR;
+		break;
+	default:
+		break;
 	}
 }
 
@@ -266,11 +284,8 @@ void V4L2CameraProxy::tryFormat(struct v4l2_format *arg)
 	arg->fmt.pix.height       = size.height;
 	arg->fmt.pix.pixelformat  = drmToV4L2(format);
 	arg->fmt.pix.field        = V4L2_FIELD_NONE;
-	arg->fmt.pix.bytesperline = bplMultiplier(drmToV4L2(format)) *
-				    arg->fmt.pix.width;
-	arg->fmt.pix.sizeimage    = imageSize(drmToV4L2(format),
-					      arg->fmt.pix.width,
-					      arg->fmt.pix.height);
+	arg->fmt.pix.bytesperline = PixelFormatInfo::info(format).stride(size.width, 0);
+	arg->fmt.pix.sizeimage    = PixelFormatInfo::info(format).frameSize(size);
 	arg->fmt.pix.colorspace   = V4L2_COLORSPACE_SRGB;
 }
 
@@ -285,12 +300,12 @@ int V4L2CameraProxy::vidioc_s_fmt(struct v4l2_format *arg)
 
 	Size size(arg->fmt.pix.width, arg->fmt.pix.height);
 	int ret = vcam_->invokeMethod(&V4L2Camera::configure,
-				      ConnectionTypeBlocking,
+				      ConnectionTypeBlocking, node_,
 				      &streamConfig_, size,
 				      v4l2ToDrm(arg->fmt.pix.pixelformat),
 				      bufferCount_);
 	if (ret < 0)
-		return -EINVAL;
+		return ret == -EBUSY ? ret : -EINVAL;
 
 	unsigned int sizeimage = calculateSizeImage(streamConfig_);
 	if (sizeimage == 0)
@@ -320,17 +335,100 @@ int V4L2CameraProxy::freeBuffers()
 	LOG(V4L2Compat, Debug) << "Freeing libcamera bufs";
 
 	int ret = vcam_->invokeMethod(&V4L2Camera::streamOff,
-				      ConnectionTypeBlocking);
+				      ConnectionTypeBlocking, node_);
 	if (ret < 0) {
 		LOG(V4L2Compat, Error) << "Failed to stop stream";
 		return ret;
 	}
-	vcam_->invokeMethod(&V4L2Camera::freeBuffers, ConnectionTypeBlocking);
+
+	ret = vcam_->invokeMethod(&V4L2Camera::freeBuffers,
+				  ConnectionTypeBlocking, node_);
+	if (ret < 0) {
+		LOG(V4L2Compat, Error) << "Failed to free buffers";
+		return ret;
+	}
+
 	bufferCount_ = 0;
 
 	return 0;
 }
 
+/*
+ * Frame intervals are expressed in microseconds, the unit of the FrameDuration
+ * control they're mapped to.
+ */
+int V4L2CameraProxy::vidioc_enum_frameintervals(struct v4l2_frmivalenum *arg)
+{
+	LOG(V4L2Compat, Debug) << "Servicing vidioc_enum_frameintervals";
+
+	const std::vector<PixelFormat> &formats =
+		streamConfig_.formats().pixelformats();
+	if (arg->index > 0 ||
+	    std::find(formats.begin(), formats.end(),
+		      v4l2ToDrm(arg->pixel_format)) == formats.end())
+		return -EINVAL;
+
+	int64_t min, max;
+	if (vcam_->frameDurationRange(&min, &max))
+		return -EINVAL;
+
+	arg->type = V4L2_FRMIVAL_TYPE_CONTINUOUS;
+	arg->stepwise.min = { static_cast<uint32_t>(min), 1000000 };
+	arg->stepwise.max = { static_cast<uint32_t>(max), 1000000 };
+	arg->stepwise.step = { 1, 1000000 };
+
+	return 0;
+}
+
+int V4L2CameraProxy::vidioc_g_parm(struct v4l2_streamparm *arg)
+{
+	LOG(V4L2Compat, Debug) << "Servicing vidioc_g_parm";
+
+	if (!validateBufferType(arg->type))
+		return -EINVAL;
+
+	int64_t min, max;
+	if (vcam_->frameDurationRange(&min, &max))
+		return -ENOTTY;
+
+	/* Report the shortest duration until the application sets one. */
+	int64_t duration = vcam_->frameDuration();
+	if (!duration)
+		duration = min;
+
+	memset(&arg->parm, 0, sizeof(arg->parm));
+	arg->parm.capture.capability = V4L2_CAP_TIMEPERFRAME;
+	arg->parm.capture.timeperframe = { static_cast<uint32_t>(duration), 1000000 };
+	arg->parm.capture.readbuffers = 0;
+
+	return 0;
+}
+
+int V4L2CameraProxy::vidioc_s_parm(struct v4l2_streamparm *arg)
+{
+	LOG(V4L2Compat, Debug) << "Servicing vidioc_s_parm";
+
+	if (!validateBufferType(arg->type))
+		return -EINVAL;
+
+	int64_t min, max;
+	if (vcam_->frameDurationRange(&min, &max))
+		return -ENOTTY;
+
+	/* A zero time per frame resets the camera to its default frame rate. */
+	const struct v4l2_fract &tpf = arg->parm.capture.timeperframe;
+	int64_t duration = 0;
+	if (tpf.numerator && tpf.denominator)
+		duration = utils::clamp<int64_t>(static_cast<int64_t>(tpf.numerator)
+						 * 1000000 / tpf.denominator,
+						 min, max);
+
+	vcam_->invokeMethod(&V4L2Camera::setFrameDuration,
+			    ConnectionTypeBlocking, duration);
+
+	return vidioc_g_parm(arg);
+}
+
 int V4L2CameraProxy::vidioc_reqbufs(struct v4l2_requestbuffers *arg)
 {
 	int ret;
@@ -343,19 +441,20 @@ int V4L2CameraProxy::vidioc_reqbufs(struct v4l2_requestbuffers *arg)
 
 	LOG(V4L2Compat, Debug) << arg->count << " buffers requested ";
 
-	arg->capabilities = V4L2_BUF_CAP_SUPPORTS_MMAP;
+	arg->capabilities = V4L2_BUF_CAP_SUPPORTS_MMAP |
+			    V4L2_BUF_CAP_SUPPORTS_DMABUF;
 
 	if (arg->count == 0)
 		return freeBuffers();
 
 	Size size(curV4L2Format_.fmt.pix.width, curV4L2Format_.fmt.pix.height);
 	ret = vcam_->invokeMethod(&V4L2Camera::configure,
-				  ConnectionTypeBlocking,
+				  ConnectionTypeBlocking, node_,
 				  &streamConfig_, size,
 				  v4l2ToDrm(curV4L2Format_.fmt.pix.pixelformat),
 				  arg->count);
 	if (ret < 0)
-		return -EINVAL;
+		return ret == -EBUSY ? ret : -EINVAL;
 
 	sizeimage_ = calculateSizeImage(streamConfig_);
 	if (sizeimage_ == 0)
@@ -365,21 +464,43 @@ int V4L2CameraProxy::vidioc_reqbufs(struct v4l2_requestbuffers *arg)
 
 	arg->count = streamConfig_.bufferCount;
 	bufferCount_ = arg->count;
+	memory_ = arg->memory;
 
-	ret = vcam_->invokeMethod(&V4L2Camera::allocBuffers,
-				  ConnectionTypeBlocking, arg->count);
+	/*
+	 * DMABUF buffers are provided by the application at queue time and
+	 * imported by libcamera, there's nothing to allocate.
+	 */
+	if (memory_ == V4L2_MEMORY_DMABUF)
+		ret = vcam_->invokeMethod(&V4L2Camera::importBuffers,
+					  ConnectionTypeBlocking, node_,
+					  arg->count);
+	else
+		ret = vcam_->invokeMethod(&V4L2Camera::allocBuffers,
+					  ConnectionTypeBlocking, node_,
+					  arg->count);
 	if (ret < 0) {
 		arg->count = 0;
+		bufferCount_ = 0;
 		return ret;
 	}
 
+	/*
+	 * Buffers may have been allocated already for all nodes, in which
+	 * case their number can differ from the requested count.
+	 */
+	arg->count = ret;
+	bufferCount_ = ret;
+
 	buffers_.resize(arg->count);
 	for (unsigned int i = 0; i < arg->count; i++) {
 		struct v4l2_buffer buf = {};
 		buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
 		buf.length = curV4L2Format_.fmt.pix.sizeimage;
-		buf.memory = V4L2_MEMORY_MMAP;
-		buf.m.offset = i * curV4L2Format_.fmt.pix.sizeimage;
+		buf.memory = memory_;
+		if (memory_ == V4L2_MEMORY_MMAP)
+			buf.m.offset = i * curV4L2Format_.fmt.pix.sizeimage;
+		else
+			buf.m.fd = -1;
 		buf.index = i;
 
 		buffers_[i] = buf;
@@ -398,8 +519,6 @@ int V4L2CameraProxy::vidioc_querybuf(struct v4l2_buffer *arg)
 	    arg->index >= bufferCount_)
 		return -EINVAL;
 
-	updateBuffers();
-
 	*arg = buffers_[arg->index];
 
 	return 0;
@@ -411,12 +530,29 @@ int V4L2CameraProxy::vidioc_qbuf(struct v4l2_buffer *arg)
 			       << arg->index;
 
 	if (!validateBufferType(arg->type) ||
-	    !validateMemoryType(arg->memory) ||
+	    arg->memory != memory_ ||
 	    arg->index >= bufferCount_)
 		return -EINVAL;
 
-	int ret = vcam_->invokeMethod(&V4L2Camera::qbuf, ConnectionTypeBlocking,
-				      arg->index);
+	int ret;
+
+	if (memory_ == V4L2_MEMORY_DMABUF) {
+		unsigned int length = arg->length ? arg->length : sizeimage_;
+		if (length < sizeimage_)
+			return -EINVAL;
+
+		ret = vcam_->invokeMethod(&V4L2Camera::importBuffer,
+					  ConnectionTypeBlocking, node_,
+					  arg->index, arg->m.fd, length);
+		if (ret < 0)
+			return ret == -EBADF ? -EINVAL : ret;
+
+		buffers_[arg->index].m.fd = arg->m.fd;
+		buffers_[arg->index].length = length;
+	}
+
+	ret = vcam_->invokeMethod(&V4L2Camera::qbuf, ConnectionTypeBlocking,
+				  node_, arg->index);
 	if (ret < 0)
 		return ret;
 
@@ -431,23 +567,57 @@ int V4L2CameraProxy::vidioc_dqbuf(struct v4l2_buffer *arg)
 	LOG(V4L2Compat, Debug) << "Servicing vidioc_dqbuf";
 
 	if (!validateBufferType(arg->type) ||
-	    !validateMemoryType(arg->memory))
+	    arg->memory != memory_)
 		return -EINVAL;
 
-	if (nonBlocking_ && !vcam_->bufferSema_.tryAcquire())
-		return -EAGAIN;
-	else
-		vcam_->bufferSema_.acquire();
+	/*
+	 * Consume one completion from the eventfd. This blocks until a buffer
+	 * completes, unless the file has been opened in non-blocking mode.
+	 */
+	uint64_t value;
+	if (::read(efd_, &value, sizeof(value)) < 0)
+		return -errno;
+
+	V4L2Camera::Buffer buffer;
+	if (!vcam_->dequeueBuffer(node_, &buffer))
+		return -EIO;
 
-	updateBuffers();
+	updateBuffer(buffer);
 
-	struct v4l2_buffer &buf = buffers_[currentBuf_];
+	struct v4l2_buffer &buf = buffers_[buffer.index];
 
 	buf.flags &= ~V4L2_BUF_FLAG_QUEUED;
-	buf.length = sizeimage_;
+	if (memory_ == V4L2_MEMORY_MMAP)
+		buf.length = sizeimage_;
 	*arg = buf;
 
-	currentBuf_ = (currentBuf_ + 1) % bufferCount_;
+	return 0;
+}
+
+int V4L2CameraProxy::vidioc_expbuf(struct v4l2_exportbuffer *arg)
+{
+	LOG(V4L2Compat, Debug) << "Servicing vidioc_expbuf";
+
+	if (!validateBufferType(arg->type) ||
+	    memory_ != V4L2_MEMORY_MMAP ||
+	    arg->index >= bufferCount_ || arg->plane != 0 ||
+	    arg->flags & ~(O_CLOEXEC | O_ACCMODE))
+		return -EINVAL;
+
+	FileDescriptor fd = vcam_->getBufferFd(node_, arg->index);
+	if (!fd.isValid())
+		return -EINVAL;
+
+	/*
+	 * Hand the application a new file descriptor referencing the dmabuf of
+	 * the libcamera buffer, which it then owns and closes.
+	 */
+	int cmd = arg->flags & O_CLOEXEC ? F_DUPFD_CLOEXEC : F_DUPFD;
+	int ret = fcntl(fd.fd(), cmd, 0);
+	if (ret < 0)
+		return -errno;
+
+	arg->fd = ret;
 
 	return 0;
 }
@@ -460,7 +630,7 @@ int V4L2CameraProxy::vidioc_streamon(int *arg)
 		return -EINVAL;
 
 	int ret = vcam_->invokeMethod(&V4L2Camera::streamOn,
-				      ConnectionTypeBlocking);
+				      ConnectionTypeBlocking, node_);
 
 	return ret;
 }
@@ -473,7 +643,7 @@ int V4L2CameraProxy::vidioc_streamoff(int *arg)
 		return -EINVAL;
 
 	int ret = vcam_->invokeMethod(&V4L2Camera::streamOff,
-				      ConnectionTypeBlocking);
+				      ConnectionTypeBlocking, node_);
 
 	for (struct v4l2_buffer &buf : buffers_)
 		buf.flags &= ~(V4L2_BUF_FLAG_QUEUED | V4L2_BUF_FLAG_DONE);
@@ -500,6 +670,15 @@ int V4L2CameraProxy::ioctl(unsigned long request, void *arg)
 	case VIDIOC_TRY_FMT:
 		ret = vidioc_try_fmt(static_cast<struct v4l2_format *>(arg));
 		break;
+	case VIDIOC_ENUM_FRAMEINTERVALS:
+		ret = vidioc_enum_frameintervals(static_cast<struct v4l2_frmivalenum *>(arg));
+		break;
+	case VIDIOC_G_PARM:
+		ret = vidioc_g_parm(static_cast<struct v4l2_streamparm *>(arg));
+		break;
+	case VIDIOC_S_PARM:
+		ret = vidioc_s_parm(static_cast<struct v4l2_streamparm *>(arg));
+		break;
 	case VIDIOC_REQBUFS:
 		ret = vidioc_reqbufs(static_cast<struct v4l2_requestbuffers *>(arg));
 		break;
@@ -512,6 +691,9 @@ int V4L2CameraProxy::ioctl(unsigned long request, void *arg)
 	case VIDIOC_DQBUF:
 		ret = vidioc_dqbuf(static_cast<struct v4l2_buffer *>(arg));
 		break;
+	case VIDIOC_EXPBUF:
+		ret = vidioc_expbuf(static_cast<struct v4l2_exportbuffer *>(arg));
+		break;
 	case VIDIOC_STREAMON:
 		ret = vidioc_streamon(static_cast<int *>(arg));
 		break;
@@ -531,94 +713,20 @@ int V4L2CameraProxy::ioctl(unsigned long request, void *arg)
 	return ret;
 }
 
-struct PixelFormatPlaneInfo {
-	unsigned int bitsPerPixel;
-	unsigned int hSubSampling;
-	unsigned int vSubSampling;
-};
-
-struct PixelFormatInfo {
-	PixelFormat format;
-	uint32_t v4l2Format;
-	unsigned int numPlanes;
-	std::array<PixelFormatPlaneInfo, 3> planes;
-};
-
-namespace {
-
-constexpr std::array<PixelFormatInfo, 13> pixelFormatInfo = {{
-	/* RGB formats. */
-	{ DRM_FORMAT_RGB888,	V4L2_PIX_FMT_BGR24,	1, {{ { 24, 1, 1 }, {  0, 0, 0 }, {  0, 0, 0 } }} },
-	{ DRM_FORMAT_BGR888,	V4L2_PIX_FMT_RGB24,	1, {{ { 24, 1, 1 }, {  0, 0, 0 }, {  0, 0, 0 } }} },
-	{ DRM_FORMAT_BGRA8888,	V4L2_PIX_FMT_ARGB32,	1, {{ { 32, 1, 1 }, {  0, 0, 0 }, {  0, 0, 0 } }} },
-	/* YUV packed formats. */
-	{ DRM_FORMAT_UYVY,	V4L2_PIX_FMT_UYVY,	1, {{ { 16, 1, 1 }, {  0, 0, 0 }, {  0, 0, 0 } }} },
-	{ DRM_FORMAT_VYUY,	V4L2_PIX_FMT_VYUY,	1, {{ { 16, 1, 1 }, {  0, 0, 0 }, {  0, 0, 0 } }} },
-	{ DRM_FORMAT_YUYV,	V4L2_PIX_FMT_YUYV,	1, {{ { 16, 1, 1 }, {  0, 0, 0 }, {  0, 0, 0 } }} },
-	{ DRM_FORMAT_YVYU,	V4L2_PIX_FMT_YVYU,	1, {{ { 16, 1, 1 }, {  0, 0, 0 }, {  0, 0, 0 } }} },
-	/* YUY planar formats. */
-	{ DRM_FORMAT_NV12,	V4L2_PIX_FMT_NV12,	2, {{ {  8, 1, 1 }, { 16, 2, 2 }, {  0, 0, 0 } }} },
-	{ DRM_FORMAT_NV21,	V4L2_PIX_FMT_NV21,	2, {{ {  8, 1, 1 }, { 16, 2, 2 }, {  0, 0, 0 } }} },
-	{ DRM_FORMAT_NV16,	V4L2_PIX_FMT_NV16,	2, {{ {  8, 1, 1 }, { 16, 2, 1 }, {  0, 0, 0 } }} },
-	{ DRM_FORMAT_NV61,	V4L2_PIX_FMT_NV61,	2, {{ {  8, 1, 1 }, { 16, 2, 1 }, {  0, 0, 0 } }} },
-	{ DRM_FORMAT_NV24,	V4L2_PIX_FMT_NV24,	2, {{ {  8, 1, 1 }, { 16, 2, 1 }, {  0, 0, 0 } }} },
-	{ DRM_FORMAT_NV42,	V4L2_PIX_FMT_NV42,	2, {{ {  8, 1, 1 }, { 16, 1, 1 }, {  0, 0, 0 } }} },
-}};
-
-} /* namespace */
-
-/* \todo make libcamera export these */
-unsigned int V4L2CameraProxy::bplMultiplier(uint32_t format)
-{
-	auto info = std::find_if(pixelFormatInfo.begin(), pixelFormatInfo.end(),
-				 [format](const PixelFormatInfo &info) {
-					 return info.v4l2Format == format;
-				 });
-	if (info == pixelFormatInfo.end())
-		return 0;
-
-	return info->planes[0].bitsPerPixel / 8;
-}
-
-unsigned int V4L2CameraProxy::imageSize(uint32_t format, unsigned int width,
-					unsigned int height)
-{
-	auto info = std::find_if(pixelFormatInfo.begin(), pixelFormatInfo.end(),
-				 [format](const PixelFormatInfo &info) {
-					 return info.v4l2Format == format;
-				 });
-	if (info == pixelFormatInfo.end())
-		return 0;
-
-	unsigned int multiplier = 0;
-	for (unsigned int i = 0; i < info->numPlanes; ++i)
-		multiplier += info->planes[i].bitsPerPixel
-			    / info->planes[i].hSubSampling
-			    / info->planes[i].vSubSampling;
-
-	return width * height * multiplier / 8;
-}
-
 PixelFormat V4L2CameraProxy::v4l2ToDrm(uint32_t format)
 {
-	auto info = std::find_if(pixelFormatInfo.begin(), pixelFormatInfo.end(),
-				 [format](const PixelFormatInfo &info) {
-					 return info.v4l2Format == format;
-				 });
-	if (info == pixelFormatInfo.end())
+	const PixelFormatInfo &info = PixelFormatInfo::fromV4L2(format);
+	if (!info.isValid())
 		return format;
 
-	return info->format;
+	return info.format;
 }
 
 uint32_t V4L2CameraProxy::drmToV4L2(PixelFormat format)
 {
-	auto info = std::find_if(pixelFormatInfo.begin(), pixelFormatInfo.end(),
-				 [format](const PixelFormatInfo &info) {
-					 return info.format == format;
-				 });
-	if (info == pixelFormatInfo.end())
+	const PixelFormatInfo &info = PixelFormatInfo::info(format);
+	if (!info.isValid())
 		return format;
 
-	return info->v4l2Format;
+	return info.v4l2Format;
 }
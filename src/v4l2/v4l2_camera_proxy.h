@@ -23,9 +23,14 @@ using namespace libcamera;
 class V4L2CameraProxy
 {
 public:
-	V4L2CameraProxy(unsigned int index, std::shared_ptr<Camera> camera);
+	V4L2CameraProxy(unsigned int index, unsigned int node,
+			std::shared_ptr<V4L2Camera> vcam,
+			std::shared_ptr<Camera> camera);
 
-	int open(bool nonBlocking);
+	bool isOpen() const { return refcount_ > 0; }
+	unsigned int index() const { return index_; }
+
+	int open(int efd);
 	void dup();
 	void close();
 	void *mmap(void *addr, size_t length, int prot, int flags, off_t offset);
@@ -40,7 +45,7 @@ private:
 	unsigned int calculateSizeImage(StreamConfiguration &streamConfig);
 	void querycap(std::shared_ptr<Camera> camera);
 	void tryFormat(struct v4l2_format *arg);
-	void updateBuffers();
+	void updateBuffer(const V4L2Camera::Buffer &buffer);
 	int freeBuffers();
 
 	int vidioc_querycap(struct v4l2_capability *arg);
@@ -48,35 +53,36 @@ private:
 	int vidioc_g_fmt(struct v4l2_format *arg);
 	int vidioc_s_fmt(struct v4l2_format *arg);
 	int vidioc_try_fmt(struct v4l2_format *arg);
+	int vidioc_enum_frameintervals(struct v4l2_frmivalenum *arg);
+	int vidioc_g_parm(struct v4l2_streamparm *arg);
+	int vidioc_s_parm(struct v4l2_streamparm *arg);
 	int vidioc_reqbufs(struct v4l2_requestbuffers *arg);
 	int vidioc_querybuf(struct v4l2_buffer *arg);
 	int vidioc_qbuf(struct v4l2_buffer *arg);
 	int vidioc_dqbuf(struct v4l2_buffer *arg);
+	int vidioc_expbuf(struct v4l2_exportbuffer *arg);
 	int vidioc_streamon(int *arg);
 	int vidioc_streamoff(int *arg);
 
-	static unsigned int bplMultiplier(uint32_t format);
-	static unsigned int imageSize(uint32_t format, unsigned int width,
-				      unsigned int height);
-
 	static PixelFormat v4l2ToDrm(uint32_t format);
 	static uint32_t drmToV4L2(PixelFormat format);
 
 	unsigned int refcount_;
 	unsigned int index_;
-	bool nonBlocking_;
+	unsigned int node_;
+	int efd_;
 
 	struct v4l2_format curV4L2Format_;
 	StreamConfiguration streamConfig_;
 	struct v4l2_capability capabilities_;
 	unsigned int bufferCount_;
-	unsigned int currentBuf_;
+	uint32_t memory_;
 	unsigned int sizeimage_;
 
 	std::vector<struct v4l2_buffer> buffers_;
 	std::map<void *, unsigned int> mmaps_;
 
-	std::unique_ptr<V4L2Camera> vcam_;
+	std::shared_ptr<V4L2Camera> vcam_;
 };
 
 #endif /* __V4L2_CAMERA_PROXY_H__ */
@@ -37,8 +37,11 @@ void get_symbol(T &func, const char *name)
 } /* namespace */
 
 V4L2CompatManager::V4L2CompatManager()
-	: cm_(nullptr), initialized_(false)
+	: cm_(nullptr), initialized_(false), highFdCount_(0), mmapCount_(0)
 {
+	for (std::atomic<V4L2CameraProxy *> &entry : fdTable_)
+		entry.store(nullptr, std::memory_order_relaxed);
+
 	get_symbol(fops_.openat, "openat");
 	get_symbol(fops_.dup, "dup");
 	get_symbol(fops_.close, "close");
@@ -49,6 +52,11 @@ V4L2CompatManager::V4L2CompatManager()
 
 V4L2CompatManager::~V4L2CompatManager()
 {
+	for (std::atomic<V4L2CameraProxy *> &entry : fdTable_)
+		entry.store(nullptr, std::memory_order_relaxed);
+	highFdCount_ = 0;
+	mmapCount_ = 0;
+
 	devices_.clear();
 	mmaps_.clear();
 
@@ -73,6 +81,12 @@ void V4L2CompatManager::run()
 {
 	cm_ = new CameraManager();
 
+	/*
+	 * Applications commonly probe all video nodes, bring up the camera of
+	 * a node only when it gets opened instead of all cameras in the system.
+	 */
+	cm_->setDeferredMatching(true);
+
 	int ret = cm_->start();
 	if (ret) {
 		LOG(V4L2Compat, Error) << "Failed to start camera manager: "
@@ -82,17 +96,6 @@ void V4L2CompatManager::run()
 
 	LOG(V4L2Compat, Debug) << "Started camera manager";
 
-	/*
-	 * For each Camera registered in the system, a V4L2CameraProxy gets
-	 * created here to wrap a camera device.
-	 */
-	unsigned int index = 0;
-	for (auto &camera : cm_->cameras()) {
-		V4L2CameraProxy *proxy = new V4L2CameraProxy(index, camera);
-		proxies_.emplace_back(proxy);
-		++index;
-	}
-
 	/*
 	 * libcamera has been initialized. Unlock the init() caller as we're
 	 * now ready to handle calls from the framework.
@@ -105,7 +108,11 @@ void V4L2CompatManager::run()
 	/* Now start processing events and messages. */
 	exec();
 
-	proxies_.clear();
+	{
+		MutexLocker locker(proxiesMutex_);
+		proxies_.clear();
+	}
+
 	cm_->stop();
 	delete cm_;
 	cm_ = nullptr;
@@ -117,8 +124,23 @@ V4L2CompatManager *V4L2CompatManager::instance()
 	return &instance;
 }
 
+/*
+ * All file operations of the process are intercepted, the lookup must thus
+ * be as cheap as possible for file descriptors that don't belong to a camera.
+ */
 V4L2CameraProxy *V4L2CompatManager::getProxy(int fd)
 {
+	if (fd < 0)
+		return nullptr;
+
+	if (fd < FdTableSize)
+		return fdTable_[fd].load(std::memory_order_acquire);
+
+	if (!highFdCount_.load(std::memory_order_acquire))
+		return nullptr;
+
+	MutexLocker locker(mapsMutex_);
+
 	auto device = devices_.find(fd);
 	if (device == devices_.end())
 		return nullptr;
@@ -126,6 +148,61 @@ V4L2CameraProxy *V4L2CompatManager::getProxy(int fd)
 	return device->second;
 }
 
+void V4L2CompatManager::setProxy(int fd, V4L2CameraProxy *proxy)
+{
+	if (fd < FdTableSize) {
+		fdTable_[fd].store(proxy, std::memory_order_release);
+		return;
+	}
+
+	MutexLocker locker(mapsMutex_);
+
+	if (proxy) {
+		if (devices_.emplace(fd, proxy).second)
+			highFdCount_.fetch_add(1, std::memory_order_release);
+	} else {
+		if (devices_.erase(fd))
+			highFdCount_.fetch_sub(1, std::memory_order_release);
+	}
+}
+
+/*
+ * V4L2CameraProxy instances are created the first time a camera is opened, to
+ * wrap the camera device, one per V4L2 node. The nodes share a single
+ * V4L2Camera.
+ */
+V4L2CameraProxy *V4L2CompatManager::getFreeProxy(unsigned int index)
+{
+	MutexLocker locker(proxiesMutex_);
+
+	bool found = false;
+	for (std::unique_ptr<V4L2CameraProxy> &proxy : proxies_) {
+		if (proxy->index() != index)
+			continue;
+
+		found = true;
+		if (!proxy->isOpen())
+			return proxy.get();
+	}
+
+	if (found)
+		return nullptr;
+
+	std::vector<std::shared_ptr<Camera>> cameras = cm_->cameras();
+	if (index >= cameras.size())
+		return nullptr;
+
+	std::shared_ptr<Camera> camera = cameras[index];
+	/* The camera signals are delivered in the camera manager thread. */
+	std::shared_ptr<V4L2Camera> vcam = std::make_shared<V4L2Camera>(camera);
+	vcam->moveToThread(this);
+
+	for (unsigned int node = 0; node < V4L2Camera::MaxNodes; ++node)
+		proxies_.emplace_back(new V4L2CameraProxy(index, node, vcam, camera));
+
+	return proxies_[proxies_.size() - V4L2Camera::MaxNodes].get();
+}
+
 int V4L2CompatManager::getCameraIndex(int fd)
 {
 	struct stat statbuf;
@@ -133,9 +210,19 @@ int V4L2CompatManager::getCameraIndex(int fd)
 	if (ret < 0)
 		return -1;
 
+	/* Match the pipeline handler of the node the first time it's opened. */
 	std::shared_ptr<Camera> target = cm_->get(statbuf.st_rdev);
-	if (!target)
-		return -1;
+	if (!target) {
+		ret = cm_->invokeMethod(&CameraManager::matchDevice,
+					ConnectionTypeBlocking,
+					statbuf.st_rdev);
+		if (ret < 0)
+			return -1;
+
+		target = cm_->get(statbuf.st_rdev);
+		if (!target)
+			return -1;
+	}
 
 	unsigned int index = 0;
 	for (auto &camera : cm_->cameras()) {
@@ -172,18 +259,37 @@ int V4L2CompatManager::openat(int dirfd, const char *path, int oflag, mode_t mod
 
 	unsigned int camera_index = static_cast<unsigned int>(ret);
 
-	V4L2CameraProxy *proxy = proxies_[camera_index].get();
-	ret = proxy->open(oflag & O_NONBLOCK);
-	if (ret < 0)
-		return ret;
-
-	int efd = eventfd(0, oflag & (O_CLOEXEC | O_NONBLOCK));
-	if (efd < 0) {
-		proxy->close();
+	/*
+	 * The application is given an eventfd in semaphore mode, signalled for
+	 * every completed buffer, which makes the file descriptor pollable.
+	 */
+	int efd = eventfd(0, EFD_SEMAPHORE |
+			     (oflag & (O_CLOEXEC | O_NONBLOCK)));
+	if (efd < 0)
 		return efd;
+
+	/*
+	 * Every open of the device creates a new file, bound to the first node
+	 * of the camera that isn't open yet. This allows multiple applications
+	 * to capture from the camera concurrently, each from its own stream.
+	 */
+	V4L2CameraProxy *proxy = getFreeProxy(camera_index);
+
+	if (!proxy) {
+		fops_.close(efd);
+		errno = EBUSY;
+		return -1;
 	}
 
-	devices_.emplace(efd, proxy);
+	ret = proxy->open(efd);
+	if (ret < 0) {
+		int err = errno;
+		fops_.close(efd);
+		errno = err;
+		return ret;
+	}
+
+	setProxy(efd, proxy);
 
 	return efd;
 }
@@ -194,10 +300,9 @@ int V4L2CompatManager::dup(int oldfd)
 	if (newfd < 0)
 		return newfd;
 
-	auto device = devices_.find(oldfd);
-	if (device != devices_.end()) {
-		V4L2CameraProxy *proxy = device->second;
-		devices_[newfd] = proxy;
+	V4L2CameraProxy *proxy = getProxy(oldfd);
+	if (proxy) {
+		setProxy(newfd, proxy);
 		proxy->dup();
 	}
 
@@ -209,8 +314,8 @@ int V4L2CompatManager::close(int fd)
 	V4L2CameraProxy *proxy = getProxy(fd);
 	if (proxy) {
 		proxy->close();
-		devices_.erase(fd);
-		return 0;
+		setProxy(fd, nullptr);
+		return fops_.close(fd);
 	}
 
 	return fops_.close(fd);
@@ -227,23 +332,42 @@ void *V4L2CompatManager::mmap(void *addr, size_t length, int prot, int flags,
 	if (map == MAP_FAILED)
 		return map;
 
-	mmaps_[map] = proxy;
+	MutexLocker locker(mapsMutex_);
+
+	if (mmaps_.emplace(map, proxy).second)
+		mmapCount_.fetch_add(1, std::memory_order_release);
+
 	return map;
 }
 
 int V4L2CompatManager::munmap(void *addr, size_t length)
 {
-	auto device = mmaps_.find(addr);
-	if (device == mmaps_.end())
+	if (!mmapCount_.load(std::memory_order_acquire))
 		return fops_.munmap(addr, length);
 
-	V4L2CameraProxy *proxy = device->second;
+	V4L2CameraProxy *proxy;
+
+	{
+		MutexLocker locker(mapsMutex_);
+
+		auto device = mmaps_.find(addr);
+		if (device == mmaps_.end())
+			proxy = nullptr;
+		else
+			proxy = device->second;
+	}
+
+	if (!proxy)
+		return fops_.munmap(addr, length);
 
 	int ret = proxy->munmap(addr, length);
 	if (ret < 0)
 		return ret;
 
-	mmaps_.erase(device);
+	MutexLocker locker(mapsMutex_);
+
+	if (mmaps_.erase(addr))
+		mmapCount_.fetch_sub(1, std::memory_order_release);
 
 	return 0;
 }
@@ -8,6 +8,8 @@
 #ifndef __V4L2_COMPAT_MANAGER_H__
 #define __V4L2_COMPAT_MANAGER_H__
 
+#include <array>
+#include <atomic>
 #include <condition_variable>
 #include <fcntl.h>
 #include <map>
@@ -64,8 +66,16 @@ private:
 	V4L2CompatManager();
 	~V4L2CompatManager();
 
+	/*
+	 * Size of the table of camera file descriptors, covering the default
+	 * limit of open files per process.
+	 */
+	static constexpr int FdTableSize = 1024;
+
 	void run() override;
 	int getCameraIndex(int fd);
+	V4L2CameraProxy *getFreeProxy(unsigned int index);
+	void setProxy(int fd, V4L2CameraProxy *proxy);
 
 	FileOperations fops_;
 
@@ -75,7 +85,21 @@ private:
 	std::condition_variable cv_;
 	bool initialized_;
 
+	/* Proxies are created on the first open of their camera. */
+	std::mutex proxiesMutex_;
 	std::vector<std::unique_ptr<V4L2CameraProxy>> proxies_;
+
+	/*
+	 * Camera file descriptors lower than FdTableSize are looked up in
+	 * fdTable_ without locking. The rare higher file descriptors, and the
+	 * memory mappings, are stored in maps protected by mapsMutex_, only
+	 * looked up when the corresponding counter is non-zero.
+	 */
+	std::array<std::atomic<V4L2CameraProxy *>, FdTableSize> fdTable_;
+	std::atomic<unsigned int> highFdCount_;
+	std::atomic<unsigned int> mmapCount_;
+
+	std::mutex mapsMutex_;
 	std::map<int, V4L2CameraProxy *> devices_;
 	std::map<void *, V4L2CameraProxy *> mmaps_;
 };
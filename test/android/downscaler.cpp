@@ -0,0 +1,206 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * downscaler.cpp - Android HAL multi-output downscaler test
+ */
+
+#include <iostream>
+#include <random>
+#include <string.h>
+#include <vector>
+
+#include "downscaler.h"
+
+#include "test.h"
+
+using namespace libcamera;
+using namespace std;
+
+struct TestCase {
+	Size input;
+	unsigned int stride;
+	vector<Size> outputs;
+};
+
+static const TestCase testCases[] = {
+	{ { 16, 2 }, 16, { { 16, 2 }, { 8, 1 }, { 2, 1 } } },
+	{ { 62, 7 }, 64, { { 62, 7 }, { 30, 5 }, { 18, 3 } } },
+	{ { 640, 482 }, 640, { { 320, 240 }, { 176, 144 } } },
+	{ { 1920, 1080 }, 1920, { { 1920, 1080 }, { 1280, 720 }, { 640, 480 } } },
+};
+
+static const unsigned int threadCounts[] = { 1, 2, 3, 8 };
+
+class DownscalerTest : public Test
+{
+protected:
+	int run()
+	{
+		mt19937 gen(42);
+		uniform_int_distribution<int> dist(0, 255);
+
+		src_.resize(1920 * 1080 * 3 / 2);
+		for (uint8_t &value : src_)
+			value = dist(gen);
+
+		Downscaler scaler;
+		if (scaler.configure({ 640, 480 }, 640, { { 1280, 720 } }) != -EINVAL ||
+		    scaler.configure({ 640, 480 }, 640, { { 321, 240 } }) != -EINVAL ||
+		    scaler.configure({ 640, 480 }, 320, { { 320, 240 } }) != -EINVAL) {
+			cerr << "Invalid configuration accepted" << endl;
+			return TestFail;
+		}
+
+		for (const TestCase &test : testCases) {
+			if (compare(test))
+				return TestFail;
+		}
+
+		/* A uniform frame must stay uniform. */
+		memset(src_.data(), 0x80, src_.size());
+		if (scaler.configure({ 640, 480 }, 640, { { 200, 150 } }))
+			return TestFail;
+
+		vector<uint8_t> dst(200 * 150 * 3 / 2 + 200);
+		scaler.scale(src_.data(), src_.data() + 640 * 480,
+			     { { dst.data(), dst.data() + 200 * 150 } });
+		for (unsigned int i = 0; i < 200 * 150 * 3 / 2; ++i) {
+			if (dst[i] != 0x80) {
+				cerr << "Uniform frame altered" << endl;
+				return TestFail;
+			}
+		}
+
+		return TestPass;
+	}
+
+private:
+	static unsigned int interpolate(unsigned int a, unsigned int b,
+					unsigned int weight)
+	{
+		return (a * (256 - weight) + b * weight + 128) >> 8;
+	}
+
+	static void position(unsigned int input, unsigned int output,
+			     unsigned int i, unsigned int *first,
+			     unsigned int *second, unsigned int *weight)
+	{
+		uint64_t step = (static_cast<uint64_t>(input) << 16) / output;
+		int64_t pos = static_cast<int64_t>(i * step + step / 2) - (1 << 15);
+		if (pos < 0)
+			pos = 0;
+
+		*first = pos >> 16;
+		*weight = (pos & 0xffff) >> 8;
+		if (*first >= input - 1) {
+			*first = input - 1;
+			*weight = 0;
+		}
+		*second = min(*first + 1, input - 1);
+	}
+
+	/* Straightforward bilinear scaling of one plane, used as reference. */
+	static void reference(const uint8_t *src, unsigned int stride,
+			      unsigned int width, unsigned int height,
+			      unsigned int components, uint8_t *dst,
+			      unsigned int outWidth, unsigned int outHeight)
+	{
+		for (unsigned int y = 0; y < outHeight; ++y) {
+			unsigned int y0, y1, wy;
+			position(height, outHeight, y, &y0, &y1, &wy);
+
+			for (unsigned int x = 0; x < outWidth; ++x) {
+				unsigned int x0, x1, wx;
+				position(width, outWidth, x, &x0, &x1, &wx);
+
+				for (unsigned int c = 0; c < components; ++c) {
+					const uint8_t *l0 = src + y0 * stride + c;
+					const uint8_t *l1 = src + y1 * stride + c;
+					unsigned int a = interpolate(l0[x0 * components],
+								     l0[x1 * components], wx);
+					unsigned int b = interpolate(l1[x0 * components],
+								     l1[x1 * components], wx);
+
+					dst[(y * outWidth + x) * components + c] =
+						interpolate(a, b, wy);
+				}
+			}
+		}
+	}
+
+	int compare(const TestCase &test)
+	{
+		const uint8_t *y = src_.data();
+		const uint8_t *uv = y + test.stride * test.input.height;
+
+		vector<vector<uint8_t>> expected;
+		for (const Size &size : test.outputs) {
+			unsigned int lumaSize = size.width * size.height;
+			vector<uint8_t> frame(lumaSize * 3 / 2 + size.width);
+
+			reference(y, test.stride, test.input.width,
+				  test.input.height, 1, frame.data(),
+				  size.width, size.height);
+			reference(uv, test.stride, test.input.width / 2,
+				  (test.input.height + 1) / 2, 2,
+				  frame.data() + lumaSize, size.width / 2,
+				  (size.height + 1) / 2);
+
+			expected.push_back(move(frame));
+		}
+
+		Downscaler scaler;
+		if (scaler.configure(test.input, test.stride, test.outputs)) {
+			cerr << "Failed to configure downscaler" << endl;
+			return -1;
+		}
+
+		for (unsigned int threads : threadCounts) {
+			scaler.setThreads(threads);
+
+			vector<vector<uint8_t>> results;
+			vector<Downscaler::Image> images;
+			for (unsigned int i = 0; i < test.outputs.size(); ++i) {
+				const Size &size = test.outputs[i];
+				results.emplace_back(expected[i].size(), 0);
+				images.push_back({ results[i].data(),
+						   results[i].data() + size.width * size.height });
+			}
+
+			/* Skip the last output to test partial requests. */
+			images.back() = { nullptr, nullptr };
+
+			scaler.scale(y, uv, images);
+
+			for (unsigned int i = 0; i < test.outputs.size(); ++i) {
+				const Size &size = test.outputs[i];
+				bool skipped = i == test.outputs.size() - 1;
+
+				if (skipped) {
+					for (uint8_t value : results[i]) {
+						if (value) {
+							cerr << "Skipped output written" << endl;
+							return -1;
+						}
+					}
+					continue;
+				}
+
+				if (results[i] != expected[i]) {
+					cerr << test.input.toString() << " -> "
+					     << size.toString() << ": " << threads
+					     << " threads differ from the reference"
+					     << endl;
+					return -1;
+				}
+			}
+		}
+
+		return 0;
+	}
+
+	vector<uint8_t> src_;
+};
+
+TEST_REGISTER(DownscalerTest)
@@ -0,0 +1,61 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * benchmark.cpp - Base class for micro-benchmarks
+ */
+
+#include "benchmark.h"
+
+#include <atomic>
+#include <iomanip>
+#include <iostream>
+#include <new>
+#include <stdlib.h>
+
+using namespace std;
+
+static atomic<unsigned long> allocationCount(0);
+
+void *operator new(size_t size)
+{
+	allocationCount.fetch_add(1, memory_order_relaxed);
+
+	void *ptr = malloc(size ? size : 1);
+	if (!ptr)
+		throw bad_alloc();
+
+	return ptr;
+}
+
+void operator delete(void *ptr) noexcept
+{
+	free(ptr);
+}
+
+void operator delete(void *ptr, size_t size) noexcept
+{
+	free(ptr);
+}
+
+/*
+ * Return the number of allocations performed through operator new since the
+ * program started, in all threads.
+ */
+unsigned long Benchmark::allocations()
+{
+	return allocationCount.load(memory_order_relaxed);
+}
+
+void Benchmark::report(const string &name, array<Sample, Rounds> &samples)
+{
+	sort(samples.begin(), samples.end(),
+	     [](const Sample &a, const Sample &b) { return a.ns < b.ns; });
+
+	const Sample &median = samples[Rounds / 2];
+
+	cout << left << setw(44) << name << right << fixed
+	     << setprecision(1) << setw(10) << median.ns << " ns/op (min "
+	     << setw(8) << samples[0].ns << ")" << setprecision(2)
+	     << setw(8) << median.allocations << " allocs/op" << endl;
+}
@@ -0,0 +1,66 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * benchmark.h - Base class for micro-benchmarks
+ */
+#ifndef __LIBCAMERA_BENCHMARK_H__
+#define __LIBCAMERA_BENCHMARK_H__
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <string>
+
+#include "test.h"
+
+class Benchmark : public Test
+{
+protected:
+	struct Sample {
+		double ns;
+		double allocations;
+	};
+
+	static constexpr unsigned int Rounds = 5;
+
+	static unsigned long allocations();
+
+	/*
+	 * Run func for a warm-up pass, then for Rounds rounds of iterations
+	 * calls, and report the median time and allocations per operation.
+	 * Each call to func performs ops operations.
+	 */
+	template<typename Func>
+	void measure(const std::string &name, unsigned int iterations,
+		     Func func, unsigned int ops = 1)
+	{
+		for (unsigned int i = 0; i < std::max(iterations / 10, 1U); ++i)
+			func();
+
+		std::array<Sample, Rounds> samples;
+
+		for (Sample &sample : samples) {
+			unsigned long allocs = allocations();
+			auto start = std::chrono::steady_clock::now();
+
+			for (unsigned int i = 0; i < iterations; ++i)
+				func();
+
+			std::chrono::duration<double, std::nano> elapsed =
+				std::chrono::steady_clock::now() - start;
+
+			sample.ns = elapsed.count() / iterations / ops;
+			sample.allocations = static_cast<double>(allocations() - allocs)
+					   / iterations / ops;
+		}
+
+		report(name, samples);
+	}
+
+private:
+	static void report(const std::string &name,
+			   std::array<Sample, Rounds> &samples);
+};
+
+#endif /* __LIBCAMERA_BENCHMARK_H__ */
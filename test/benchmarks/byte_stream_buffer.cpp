@@ -0,0 +1,67 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * byte_stream_buffer.cpp - ByteStreamBuffer benchmark
+ */
+
+#include <array>
+#include <iostream>
+#include <stdint.h>
+
+#include "byte_stream_buffer.h"
+
+#include "benchmark.h"
+
+using namespace std;
+using namespace libcamera;
+
+static constexpr unsigned int Iterations = 100000;
+static constexpr unsigned int Values = 64;
+
+class ByteStreamBufferBenchmark : public Benchmark
+{
+protected:
+	int run()
+	{
+		array<uint8_t, Values * sizeof(uint32_t)> data;
+		uint64_t sum = 0;
+		bool overflow = false;
+
+		measure("ByteStreamBuffer::write(), 64 x uint32_t", Iterations,
+			[&]() {
+				ByteStreamBuffer buffer(data.data(), data.size());
+				for (uint32_t i = 0; i < Values; ++i)
+					buffer.write(&i);
+				overflow |= buffer.overflow();
+			}, Values);
+
+		measure("ByteStreamBuffer::read(), 64 x uint32_t", Iterations,
+			[&]() {
+				ByteStreamBuffer buffer(const_cast<const uint8_t *>(data.data()),
+							data.size());
+				for (unsigned int i = 0; i < Values; ++i) {
+					uint32_t value;
+					buffer.read(&value);
+					sum += value;
+				}
+				overflow |= buffer.overflow();
+			}, Values);
+
+		if (overflow) {
+			cerr << "Buffer overflow" << endl;
+			return TestFail;
+		}
+
+		/* Every read pass returns the values 0 to 63. */
+		unsigned int passes = Iterations * Rounds + Iterations / 10;
+		if (sum != static_cast<uint64_t>(passes) * Values * (Values - 1) / 2) {
+			cerr << "Read values don't match written values" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+};
+
+TEST_REGISTER(ByteStreamBufferBenchmark)
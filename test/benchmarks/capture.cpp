@@ -0,0 +1,381 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * capture.cpp - End-to-end capture throughput and latency benchmark
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <dirent.h>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+#include <libcamera/libcamera.h>
+
+#include "benchmark.h"
+
+using namespace std;
+using namespace libcamera;
+
+/*
+ * The benchmark is configured through environment variables:
+ *
+ * LIBCAMERA_BENCHMARK_CAMERA	Camera name filter (default: "VIMC")
+ * LIBCAMERA_BENCHMARK_CAMERAS	Maximum number of cameras (default: 1)
+ * LIBCAMERA_BENCHMARK_STREAMS	Number of streams per camera (default: 1)
+ * LIBCAMERA_BENCHMARK_BUFFERS	Buffers per stream (default: pipeline default)
+ * LIBCAMERA_BENCHMARK_SIZE	Stream resolution as WxH (default: pipeline default)
+ * LIBCAMERA_BENCHMARK_DURATION	Capture duration in ms (default: 1000)
+ *
+ * When libcamera is compiled with the mock_devices option, setting
+ * LIBCAMERA_MOCK_CAMERAS to a number of cameras and LIBCAMERA_BENCHMARK_CAMERA
+ * to "Mock" measures the libcamera overhead in isolation from the kernel, with
+ * simulated cameras completing frames immediately or at the interval set in
+ * microseconds by LIBCAMERA_MOCK_FRAME_INTERVAL.
+ *
+ * Setting LIBCAMERA_CPU_ACCOUNTING breaks down the CPU time per frame of each
+ * camera by component.
+ *
+ * Results are printed as one JSON object per line, one per camera followed by
+ * the process-wide CPU time and allocation counts.
+ */
+
+namespace {
+
+using Clock = chrono::steady_clock;
+
+unsigned int envValue(const char *name, unsigned int defaultValue)
+{
+	const char *value = getenv(name);
+	return value ? strtoul(value, nullptr, 10) : defaultValue;
+}
+
+string envString(const char *name, const char *defaultValue)
+{
+	const char *value = getenv(name);
+	return value ? value : defaultValue;
+}
+
+/*
+ * Retrieve the CPU time consumed by each thread of the process, in
+ * nanoseconds, aggregated by thread name.
+ */
+map<string, uint64_t> threadCpuTime()
+{
+	map<string, uint64_t> times;
+
+	DIR *dir = opendir("/proc/self/task");
+	if (!dir)
+		return times;
+
+	struct dirent *ent;
+	while ((ent = readdir(dir))) {
+		if (ent->d_name[0] == '.')
+			continue;
+
+		string task = string("/proc/self/task/") + ent->d_name;
+		string name;
+		uint64_t runtime = 0;
+
+		ifstream(task + "/comm") >> name;
+		ifstream(task + "/schedstat") >> runtime;
+
+		times[name] += runtime;
+	}
+
+	closedir(dir);
+
+	return times;
+}
+
+} /* namespace */
+
+class CaptureBenchmark : public Benchmark
+{
+protected:
+	struct CameraRun {
+		shared_ptr<Camera> camera;
+		unique_ptr<CameraConfiguration> config;
+		unique_ptr<FrameBufferAllocator> allocator;
+		vector<unique_ptr<Request>> requests;
+		vector<Clock::time_point> queued;
+		vector<double> latencies;
+		unsigned int failed;
+	};
+
+	int init()
+	{
+		cm_ = make_unique<CameraManager>();
+		if (cm_->start()) {
+			cerr << "Failed to start camera manager" << endl;
+			return TestFail;
+		}
+
+		string filter = envString("LIBCAMERA_BENCHMARK_CAMERA", "VIMC");
+		unsigned int count = envValue("LIBCAMERA_BENCHMARK_CAMERAS", 1);
+
+		for (const shared_ptr<Camera> &camera : cm_->cameras()) {
+			if (runs_.size() == count)
+				break;
+
+			if (camera->name().find(filter) == string::npos)
+				continue;
+
+			int ret = setup(camera);
+			if (ret)
+				return ret;
+		}
+
+		if (runs_.empty()) {
+			cerr << "No camera matching '" << filter << "'" << endl;
+			return TestSkip;
+		}
+
+		return TestPass;
+	}
+
+	int run()
+	{
+		unsigned int duration = envValue("LIBCAMERA_BENCHMARK_DURATION", 1000);
+
+		for (CameraRun &run : runs_) {
+			if (run.camera->start()) {
+				cerr << "Failed to start " << run.camera->name() << endl;
+				return TestFail;
+			}
+		}
+
+		map<string, uint64_t> cpuStart = threadCpuTime();
+		unsigned long allocsStart = allocations();
+
+		for (unsigned int i = 0; i < runs_.size(); ++i) {
+			for (unsigned int j = 0; j < runs_[i].requests.size(); ++j) {
+				if (queue(i, j))
+					return TestFail;
+			}
+		}
+
+		EventDispatcher *dispatcher = cm_->eventDispatcher();
+
+		Timer timer;
+		timer.start(duration);
+		while (timer.isRunning())
+			dispatcher->processEvents();
+
+		unsigned long allocs = allocations() - allocsStart;
+		map<string, uint64_t> cpuEnd = threadCpuTime();
+
+		for (CameraRun &run : runs_)
+			run.camera->stop();
+
+		uint64_t frames = 0;
+		for (CameraRun &run : runs_) {
+			report(run, duration);
+			frames += run.latencies.size();
+		}
+
+		if (!frames) {
+			cerr << "No frame captured" << endl;
+			return TestFail;
+		}
+
+		/* Threads started during the capture count from zero. */
+		uint64_t cpuTotal = 0;
+		ostringstream threads;
+		for (const auto &entry : cpuEnd) {
+			uint64_t time = entry.second - cpuStart[entry.first];
+			cpuTotal += time;
+
+			if (threads.tellp())
+				threads << ",";
+			threads << "\"" << entry.first << "\":" << time / frames;
+		}
+
+		cout << "{\"benchmark\":\"capture-process\""
+		     << ",\"frames\":" << frames
+		     << ",\"cpu_ns_per_frame\":" << cpuTotal / frames
+		     << ",\"thread_cpu_ns_per_frame\":{" << threads.str() << "}"
+		     << ",\"allocs_per_frame\":"
+		     << static_cast<double>(allocs) / frames
+		     << "}" << endl;
+
+		return TestPass;
+	}
+
+	void cleanup()
+	{
+		for (CameraRun &run : runs_) {
+			run.requests.clear();
+			run.allocator.reset();
+			run.camera->release();
+		}
+
+		runs_.clear();
+		cm_->stop();
+	}
+
+private:
+	int setup(const shared_ptr<Camera> &camera)
+	{
+		unsigned int streams = envValue("LIBCAMERA_BENCHMARK_STREAMS", 1);
+		unsigned int buffers = envValue("LIBCAMERA_BENCHMARK_BUFFERS", 0);
+		string size = envString("LIBCAMERA_BENCHMARK_SIZE", "");
+
+		CameraRun run;
+		run.camera = camera;
+		run.failed = 0;
+
+		StreamRoles roles(streams, StreamRole::VideoRecording);
+		run.config = camera->generateConfiguration(roles);
+		if (!run.config || run.config->size() != streams) {
+			cerr << camera->name() << " doesn't support " << streams
+			     << " streams" << endl;
+			return TestSkip;
+		}
+
+		for (StreamConfiguration &cfg : *run.config) {
+			unsigned int width, height;
+			if (sscanf(size.c_str(), "%ux%u", &width, &height) == 2)
+				cfg.size = { width, height };
+			if (buffers)
+				cfg.bufferCount = buffers;
+		}
+
+		if (run.config->validate() == CameraConfiguration::Invalid) {
+			cerr << "Invalid configuration for " << camera->name() << endl;
+			return TestFail;
+		}
+
+		if (camera->acquire() || camera->configure(run.config.get())) {
+			cerr << "Failed to configure " << camera->name() << endl;
+			return TestFail;
+		}
+
+		run.allocator.reset(FrameBufferAllocator::create(camera));
+
+		/* Create one request per buffer, with a buffer from each stream. */
+		unsigned int index = runs_.size();
+		unsigned int count = ~0U;
+
+		for (StreamConfiguration &cfg : *run.config) {
+			if (run.allocator->allocate(cfg.stream()) < 0) {
+				cerr << "Failed to allocate buffers" << endl;
+				return TestFail;
+			}
+
+			count = min<unsigned int>(count, run.allocator->buffers(cfg.stream()).size());
+		}
+
+		for (unsigned int i = 0; i < count; ++i) {
+			uint64_t cookie = (static_cast<uint64_t>(index) << 32) | i;
+			unique_ptr<Request> request = camera->createRequest(cookie);
+
+			for (StreamConfiguration &cfg : *run.config) {
+				Stream *stream = cfg.stream();
+				request->addBuffer(stream,
+						   run.allocator->buffers(stream)[i].get());
+			}
+
+			run.requests.push_back(move(request));
+		}
+
+		run.queued.resize(count);
+		run.latencies.reserve(1 << 16);
+
+		camera->requestCompleted.connect(this, &CaptureBenchmark::requestComplete);
+
+		runs_.push_back(move(run));
+
+		return TestPass;
+	}
+
+	int queue(unsigned int camera, unsigned int index)
+	{
+		CameraRun &run = runs_[camera];
+
+		run.queued[index] = Clock::now();
+		if (run.camera->queueRequest(run.requests[index].get())) {
+			cerr << "Failed to queue request" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+	void requestComplete(Request *request)
+	{
+		if (request->status() == Request::RequestCancelled)
+			return;
+
+		unsigned int camera = request->cookie() >> 32;
+		unsigned int index = request->cookie() & 0xffffffff;
+		CameraRun &run = runs_[camera];
+
+		chrono::duration<double, micro> latency = Clock::now() - run.queued[index];
+		if (request->status() == Request::RequestComplete)
+			run.latencies.push_back(latency.count());
+		else
+			run.failed++;
+
+		request->reuse();
+		queue(camera, index);
+	}
+
+	void report(CameraRun &run, unsigned int duration)
+	{
+		vector<double> &latencies = run.latencies;
+		sort(latencies.begin(), latencies.end());
+
+		auto percentile = [&](unsigned int p) {
+			if (latencies.empty())
+				return 0.0;
+			return latencies[(latencies.size() - 1) * p / 100];
+		};
+
+		const StreamConfiguration &cfg = run.config->at(0);
+		CameraStatistics stats = run.camera->statistics();
+
+		static const char *const components[] = {
+			"events", "pipeline", "ipa", "serialization",
+			"logging", "application",
+		};
+
+		ostringstream cpu;
+		for (unsigned int i = 0; i < CameraStatistics::CpuComponents; ++i) {
+			auto component = static_cast<CameraStatistics::CpuComponent>(i);
+			cpu << (i ? "," : "") << "\"" << components[i] << "\":"
+			    << stats.cpuTimePerFrame(component);
+		}
+
+		cout << "{\"benchmark\":\"capture\""
+		     << ",\"camera\":\"" << run.camera->name() << "\""
+		     << ",\"streams\":" << run.config->size()
+		     << ",\"buffers\":" << run.requests.size()
+		     << ",\"size\":\"" << cfg.size.toString() << "\""
+		     << ",\"duration_ms\":" << duration
+		     << ",\"frames\":" << latencies.size()
+		     << ",\"failed\":" << run.failed
+		     << ",\"dropped\":" << stats.framesDroppedNoRequest + stats.framesDroppedKernel
+		     << ",\"fps\":" << latencies.size() * 1000.0 / duration
+		     << ",\"latency_us\":{\"p50\":" << percentile(50)
+		     << ",\"p90\":" << percentile(90)
+		     << ",\"p99\":" << percentile(99)
+		     << ",\"max\":" << percentile(100) << "}"
+		     << ",\"cpu_ns_per_frame\":{" << cpu.str() << "}"
+		     << "}" << endl;
+	}
+
+	unique_ptr<CameraManager> cm_;
+	vector<CameraRun> runs_;
+};
+
+TEST_REGISTER(CaptureBenchmark)
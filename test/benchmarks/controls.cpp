@@ -0,0 +1,145 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * controls.cpp - ControlList and ControlSerializer benchmark
+ */
+
+#include <iostream>
+#include <stdint.h>
+#include <vector>
+
+#include <libcamera/control_ids.h>
+#include <libcamera/controls.h>
+
+#include "byte_stream_buffer.h"
+#include "control_serializer.h"
+
+#include "benchmark.h"
+
+using namespace std;
+using namespace libcamera;
+
+static constexpr unsigned int Iterations = 100000;
+
+class ControlsBenchmark : public Benchmark
+{
+protected:
+	int init()
+	{
+		info_ = ControlInfoMap({
+			{ &controls::Brightness, ControlRange(-255, 255) },
+			{ &controls::Contrast, ControlRange(0, 511) },
+			{ &controls::Saturation, ControlRange(0, 511) },
+			{ &controls::ManualExposure, ControlRange(1, 100000) },
+			{ &controls::ManualGain, ControlRange(1, 64) },
+		});
+
+		return TestPass;
+	}
+
+	int run()
+	{
+		if (controlList())
+			return TestFail;
+
+		if (serialization())
+			return TestFail;
+
+		return TestPass;
+	}
+
+private:
+	void fill(ControlList &list, int32_t value)
+	{
+		list.set(controls::Brightness, value);
+		list.set(controls::Contrast, value);
+		list.set(controls::Saturation, value);
+		list.set(controls::ManualExposure, value);
+		list.set(controls::ManualGain, value);
+	}
+
+	int controlList()
+	{
+		ControlList list(info_);
+		int64_t sum = 0;
+
+		measure("ControlList::set(), 5 controls", Iterations,
+			[&]() { fill(list, 1); }, 5);
+
+		measure("ControlList::get(), 5 controls", Iterations,
+			[&]() {
+				sum += list.get(controls::Brightness);
+				sum += list.get(controls::Contrast);
+				sum += list.get(controls::Saturation);
+				sum += list.get(controls::ManualExposure);
+				sum += list.get(controls::ManualGain);
+			}, 5);
+
+		measure("ControlList iteration, 5 controls", Iterations,
+			[&]() {
+				for (const auto &ctrl : list)
+					sum += ctrl.second.get<int32_t>();
+			}, 5);
+
+		/* Every control is set to 1, each pass adds 5 to the sum. */
+		int64_t passes = Iterations * Rounds + Iterations / 10;
+		if (sum != passes * 5 * 2) {
+			cerr << "Control values don't match" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+	int serialization()
+	{
+		ControlSerializer serializer;
+		ControlSerializer deserializer;
+
+		/* Share the info map between the two ends, as IPC does. */
+		vector<uint8_t> infoData(serializer.binarySize(info_));
+		ByteStreamBuffer infoBuffer(infoData.data(), infoData.size());
+		if (serializer.serialize(info_, infoBuffer) < 0) {
+			cerr << "Failed to serialize info map" << endl;
+			return TestFail;
+		}
+
+		ByteStreamBuffer infoReader(const_cast<const uint8_t *>(infoData.data()),
+					    infoData.size());
+		ControlInfoMap info = deserializer.deserialize<ControlInfoMap>(infoReader);
+		if (info.empty()) {
+			cerr << "Failed to deserialize info map" << endl;
+			return TestFail;
+		}
+
+		ControlList list(info_);
+		fill(list, 42);
+
+		ControlList result;
+		vector<uint8_t> data(serializer.binarySize(list));
+		int failures = 0;
+
+		measure("ControlSerializer round trip, 5 controls", Iterations / 10,
+			[&]() {
+				ByteStreamBuffer writer(data.data(), data.size());
+				failures += serializer.serialize(list, writer) < 0;
+
+				ByteStreamBuffer reader(const_cast<const uint8_t *>(data.data()),
+							data.size());
+				failures += deserializer.deserialize(reader, &result) < 0;
+			});
+
+		if (failures || result.size() != list.size() ||
+		    result.get(controls::ManualGain) != 42) {
+			cerr << "Control list round trip failed" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+	ControlInfoMap info_;
+};
+
+TEST_REGISTER(ControlsBenchmark)
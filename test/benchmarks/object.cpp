@@ -0,0 +1,132 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * object.cpp - Method invocation and message passing benchmark
+ */
+
+#include <atomic>
+#include <iostream>
+#include <memory>
+
+#include <libcamera/object.h>
+
+#include "message.h"
+#include "semaphore.h"
+#include "thread.h"
+
+#include "benchmark.h"
+
+using namespace std;
+using namespace libcamera;
+
+static constexpr unsigned int Iterations = 10000;
+static constexpr unsigned int Batch = 100;
+
+class Receiver : public Object
+{
+public:
+	Receiver()
+		: count_(0), pending_(0)
+	{
+	}
+
+	/* Expect count calls or messages, and release done once received. */
+	void expect(unsigned int count) { pending_ = count; }
+
+	void method(int value)
+	{
+		count_ += value;
+		received();
+	}
+
+	unsigned int count_;
+	Semaphore done_;
+
+protected:
+	void message(Message *msg)
+	{
+		if (msg->type() != Message::None) {
+			Object::message(msg);
+			return;
+		}
+
+		count_++;
+		received();
+	}
+
+private:
+	void received()
+	{
+		if (pending_ && !--pending_)
+			done_.release();
+	}
+
+	atomic<unsigned int> pending_;
+};
+
+class ObjectBenchmark : public Benchmark
+{
+protected:
+	int init()
+	{
+		thread_.start();
+		remote_.moveToThread(&thread_);
+
+		return TestPass;
+	}
+
+	int run()
+	{
+		measure("invokeMethod() direct", Iterations * 10, [&]() {
+			local_.invokeMethod(&Receiver::method,
+					    ConnectionTypeDirect, 1);
+		});
+
+		measure("invokeMethod() queued, same thread", Iterations, [&]() {
+			local_.invokeMethod(&Receiver::method,
+					    ConnectionTypeQueued, 1);
+			Thread::current()->dispatchMessages();
+		});
+
+		measure("invokeMethod() blocking, cross-thread", Iterations / 10, [&]() {
+			remote_.invokeMethod(&Receiver::method,
+					     ConnectionTypeBlocking, 1);
+		});
+
+		measure("invokeMethod() queued, cross-thread", Iterations / Batch, [&]() {
+			remote_.expect(Batch);
+			for (unsigned int i = 0; i < Batch; ++i)
+				remote_.invokeMethod(&Receiver::method,
+						     ConnectionTypeQueued, 1);
+			remote_.done_.acquire();
+		}, Batch);
+
+		measure("postMessage(), cross-thread", Iterations / Batch, [&]() {
+			remote_.expect(Batch);
+			for (unsigned int i = 0; i < Batch; ++i)
+				remote_.postMessage(make_unique<Message>(Message::None));
+			remote_.done_.acquire();
+		}, Batch);
+
+		if (!local_.count_ || !remote_.count_) {
+			cerr << "Methods not invoked" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+	void cleanup()
+	{
+		thread_.exit(0);
+		thread_.wait();
+	}
+
+private:
+	Receiver local_;
+	Receiver remote_;
+	Thread thread_;
+};
+
+TEST_REGISTER(ObjectBenchmark)
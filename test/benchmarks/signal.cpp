@@ -0,0 +1,108 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * signal.cpp - Signal emission benchmark
+ */
+
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <libcamera/object.h>
+#include <libcamera/signal.h>
+
+#include "thread.h"
+
+#include "benchmark.h"
+
+using namespace std;
+using namespace libcamera;
+
+static constexpr unsigned int Iterations = 100000;
+
+class Receiver : public Object
+{
+public:
+	Receiver()
+		: count_(0)
+	{
+	}
+
+	void slot(int value) { count_ += value; }
+
+	unsigned int count_;
+};
+
+class SignalBenchmark : public Benchmark
+{
+protected:
+	int run()
+	{
+		for (unsigned int slots : { 1U, 2U, 4U, 8U }) {
+			if (emitDirect(slots))
+				return TestFail;
+		}
+
+		for (unsigned int slots : { 1U, 2U, 4U, 8U }) {
+			if (emitQueued(slots))
+				return TestFail;
+		}
+
+		return TestPass;
+	}
+
+private:
+	int emitDirect(unsigned int slots)
+	{
+		Signal<int> signal;
+		vector<unique_ptr<Receiver>> receivers;
+
+		for (unsigned int i = 0; i < slots; ++i) {
+			receivers.emplace_back(new Receiver());
+			signal.connect(receivers.back().get(), &Receiver::slot);
+		}
+
+		measure("Signal::emit() direct, " + to_string(slots) + " slots",
+			Iterations, [&]() { signal.emit(1); });
+
+		return check(receivers);
+	}
+
+	int emitQueued(unsigned int slots)
+	{
+		Signal<int> signal;
+		vector<unique_ptr<Receiver>> receivers;
+
+		for (unsigned int i = 0; i < slots; ++i) {
+			receivers.emplace_back(new Receiver());
+			signal.connect(receivers.back().get(), &Receiver::slot,
+				       ConnectionTypeQueued);
+		}
+
+		/* Include the delivery of the messages in the measurement. */
+		measure("Signal::emit() queued, " + to_string(slots) + " slots",
+			Iterations / 10, [&]() {
+				signal.emit(1);
+				Thread::current()->dispatchMessages();
+			});
+
+		return check(receivers);
+	}
+
+	int check(const vector<unique_ptr<Receiver>> &receivers)
+	{
+		for (const unique_ptr<Receiver> &receiver : receivers) {
+			if (receiver->count_ != receivers[0]->count_ ||
+			    !receiver->count_) {
+				cerr << "Slot not invoked for every emission" << endl;
+				return TestFail;
+			}
+		}
+
+		return TestPass;
+	}
+};
+
+TEST_REGISTER(SignalBenchmark)
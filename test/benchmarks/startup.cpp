@@ -0,0 +1,194 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * startup.cpp - Time-to-camera-list and time-to-first-frame benchmark
+ */
+
+#include <chrono>
+#include <iostream>
+#include <memory>
+#include <stdlib.h>
+#include <string>
+#include <vector>
+
+#include <libcamera/libcamera.h>
+
+#include "benchmark.h"
+#include "tracer.h"
+
+using namespace std;
+using namespace libcamera;
+
+/*
+ * The benchmark measures the startup phases as seen by the application, from
+ * the camera manager creation to the completion of the first request. When
+ * libcamera is compiled with tracing support, the startup profile recorded by
+ * the library tracepoints is printed as well.
+ *
+ * LIBCAMERA_BENCHMARK_CAMERA	Camera name filter (default: "VIMC")
+ */
+
+namespace {
+
+using Clock = chrono::steady_clock;
+
+double elapsed(Clock::time_point start, Clock::time_point end)
+{
+	return chrono::duration<double, milli>(end - start).count();
+}
+
+} /* namespace */
+
+class StartupBenchmark : public Benchmark
+{
+protected:
+	int init()
+	{
+		Tracer::instance()->enable();
+		completed_ = false;
+
+		return TestPass;
+	}
+
+	int run()
+	{
+		const char *filter = getenv("LIBCAMERA_BENCHMARK_CAMERA");
+		if (!filter)
+			filter = "VIMC";
+
+		Clock::time_point start = Clock::now();
+
+		cm_ = make_unique<CameraManager>();
+		if (cm_->start()) {
+			cerr << "Failed to start camera manager" << endl;
+			return TestFail;
+		}
+
+		for (const shared_ptr<Camera> &camera : cm_->cameras()) {
+			if (camera->name().find(filter) != string::npos) {
+				camera_ = camera;
+				break;
+			}
+		}
+
+		Clock::time_point listed = Clock::now();
+
+		if (!camera_) {
+			cerr << "No camera matching '" << filter << "'" << endl;
+			return TestSkip;
+		}
+
+		if (camera_->acquire()) {
+			cerr << "Failed to acquire " << camera_->name() << endl;
+			return TestFail;
+		}
+
+		Clock::time_point acquired = Clock::now();
+
+		config_ = camera_->generateConfiguration({ StreamRole::VideoRecording });
+		if (!config_ || config_->validate() == CameraConfiguration::Invalid ||
+		    camera_->configure(config_.get())) {
+			cerr << "Failed to configure " << camera_->name() << endl;
+			return TestFail;
+		}
+
+		Clock::time_point configured = Clock::now();
+
+		Stream *stream = config_->at(0).stream();
+		allocator_.reset(FrameBufferAllocator::create(camera_));
+		if (allocator_->allocate(stream) < 0) {
+			cerr << "Failed to allocate buffers" << endl;
+			return TestFail;
+		}
+
+		for (const unique_ptr<FrameBuffer> &buffer : allocator_->buffers(stream)) {
+			unique_ptr<Request> request = camera_->createRequest();
+			request->addBuffer(stream, buffer.get());
+			requests_.push_back(move(request));
+		}
+
+		camera_->requestCompleted.connect(this, &StartupBenchmark::requestComplete);
+
+		Clock::time_point allocated = Clock::now();
+
+		if (camera_->start()) {
+			cerr << "Failed to start " << camera_->name() << endl;
+			return TestFail;
+		}
+
+		Clock::time_point started = Clock::now();
+
+		for (unique_ptr<Request> &request : requests_) {
+			if (camera_->queueRequest(request.get())) {
+				cerr << "Failed to queue request" << endl;
+				return TestFail;
+			}
+		}
+
+		EventDispatcher *dispatcher = cm_->eventDispatcher();
+
+		Timer timer;
+		timer.start(1000);
+		while (timer.isRunning() && !completed_)
+			dispatcher->processEvents();
+
+		if (!completed_) {
+			cerr << "No frame captured" << endl;
+			return TestFail;
+		}
+
+		cout << "{\"benchmark\":\"startup\""
+		     << ",\"camera\":\"" << camera_->name() << "\""
+		     << ",\"camera_list_ms\":" << elapsed(start, listed)
+		     << ",\"acquire_ms\":" << elapsed(listed, acquired)
+		     << ",\"configure_ms\":" << elapsed(acquired, configured)
+		     << ",\"allocate_ms\":" << elapsed(configured, allocated)
+		     << ",\"start_ms\":" << elapsed(allocated, started)
+		     << ",\"first_frame_ms\":" << elapsed(start, firstFrame_)
+		     << "}" << endl;
+
+#if HAVE_TRACING
+		cout << Tracer::instance()->startupProfile() << endl;
+#endif
+
+		return TestPass;
+	}
+
+	void cleanup()
+	{
+		if (!camera_) {
+			if (cm_)
+				cm_->stop();
+			return;
+		}
+
+		camera_->stop();
+		requests_.clear();
+		allocator_.reset();
+		camera_->release();
+		camera_.reset();
+		cm_->stop();
+	}
+
+private:
+	void requestComplete(Request *request)
+	{
+		if (completed_ || request->status() != Request::RequestComplete)
+			return;
+
+		firstFrame_ = Clock::now();
+		completed_ = true;
+	}
+
+	unique_ptr<CameraManager> cm_;
+	shared_ptr<Camera> camera_;
+	unique_ptr<CameraConfiguration> config_;
+	unique_ptr<FrameBufferAllocator> allocator_;
+	vector<unique_ptr<Request>> requests_;
+
+	Clock::time_point firstFrame_;
+	bool completed_;
+};
+
+TEST_REGISTER(StartupBenchmark)
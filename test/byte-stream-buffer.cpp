@@ -165,6 +165,38 @@ protected:
 			return TestFail;
 		}
 
+		/*
+		 * In-place write mode.
+		 */
+		alignas(uint32_t) std::array<uint8_t, 16> aligned;
+		ByteStreamBuffer resbuf(aligned.data(), aligned.size());
+
+		/* Test reserve. */
+		uint32_t *words = resbuf.reserve<uint32_t>(2);
+		if (!words || resbuf.offset() != 8 || resbuf.overflow()) {
+			cerr << "Reserve failed on write buffer" << endl;
+			return TestFail;
+		}
+
+		/* Test misaligned reserve, this should fail without overflow. */
+		if (!resbuf.reserve<uint8_t>() || resbuf.reserve<uint32_t>() ||
+		    resbuf.overflow()) {
+			cerr << "Misaligned reserve should fail" << endl;
+			return TestFail;
+		}
+
+		/* Test reserve overflow. */
+		if (resbuf.reserve<uint8_t>(8) || !resbuf.overflow()) {
+			cerr << "Reserve failed to overflow" << endl;
+			return TestFail;
+		}
+
+		/* Test reserve, this should fail on a read buffer. */
+		if (rbuf.reserve<uint8_t>() || rbuf.overflow()) {
+			cerr << "Reserve should fail on read buffer" << endl;
+			return TestFail;
+		}
+
 		return TestPass;
 	}
 };
@@ -97,6 +97,49 @@ protected:
 			return TestFail;
 		}
 
+		/* The mode table shall cover all codes and sizes. */
+		const std::vector<CameraSensor::Mode> &modes = sensor_->modes();
+		if (modes.size() != codes.size() * sizes.size()) {
+			cerr << "Invalid number of sensor modes" << endl;
+			return TestFail;
+		}
+
+		for (CameraSensor::ModePolicy policy : { CameraSensor::ModeMinReadoutTime,
+							 CameraSensor::ModeMaxFrameRate }) {
+			format = sensor_->getFormat({ MEDIA_BUS_FMT_SBGGR10_1X10 },
+						    Size(1024, 768), policy);
+			if (format.mbus_code != MEDIA_BUS_FMT_SBGGR10_1X10 ||
+			    format.size != Size(4096, 2160)) {
+				cerr << "Failed to get a format with policy "
+				     << policy << ", got " << format.toString()
+				     << endl;
+				return TestFail;
+			}
+		}
+
+		/* The selected format shall map to a mode with valid timings. */
+		const CameraSensor::Mode *mode = sensor_->mode(format);
+		if (!mode || mode->mbusCode != format.mbus_code ||
+		    mode->size != format.size) {
+			cerr << "Failed to find the mode of " << format.toString()
+			     << endl;
+			return TestFail;
+		}
+
+		if (mode->maxFrameDuration < mode->minFrameDuration) {
+			cerr << "Invalid frame duration limits" << endl;
+			return TestFail;
+		}
+
+		/* Sizes larger than the sensor resolution can't be selected. */
+		format = sensor_->getFormat({ MEDIA_BUS_FMT_SBGGR10_1X10 },
+					    Size(8192, 4320));
+		if (format.size != Size()) {
+			cerr << "Selected a format too small for the desired size"
+			     << endl;
+			return TestFail;
+		}
+
 		return TestPass;
 	}
 
@@ -0,0 +1,201 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * libcamera Camera API tests
+ *
+ * Test asynchronous camera configuration and start
+ */
+
+#include <iostream>
+#include <stdlib.h>
+
+#include <libcamera/libcamera.h>
+
+#include "test.h"
+
+using namespace libcamera;
+using namespace std;
+
+namespace {
+
+class AsyncBringupTest : public Test, public Object
+{
+protected:
+	void configureComplete(Camera *camera, int ret)
+	{
+		configureResult_ = ret;
+	}
+
+	void startComplete(Camera *camera, int ret)
+	{
+		startResult_ = ret;
+	}
+
+	void requestComplete(Request *request)
+	{
+		if (request->status() != Request::RequestComplete)
+			return;
+
+		completeRequestsCount_++;
+	}
+
+	bool waitFor(const int &result, unsigned int msec)
+	{
+		EventDispatcher *dispatcher = cm_->eventDispatcher();
+
+		Timer timer;
+		timer.start(msec);
+		while (timer.isRunning() && result == Pending)
+			dispatcher->processEvents();
+
+		return result != Pending;
+	}
+
+	void processEvents(unsigned int msec)
+	{
+		EventDispatcher *dispatcher = cm_->eventDispatcher();
+
+		Timer timer;
+		timer.start(msec);
+		while (timer.isRunning())
+			dispatcher->processEvents();
+	}
+
+	int init() override
+	{
+		setenv("LIBCAMERA_PIPELINE_THREADS", "1", 1);
+
+		cm_ = new CameraManager();
+		if (cm_->start()) {
+			cerr << "Failed to start camera manager" << endl;
+			return TestFail;
+		}
+
+		camera_ = cm_->get("VIMC Sensor B");
+		if (!camera_) {
+			cerr << "Can not find VIMC camera" << endl;
+			return TestSkip;
+		}
+
+		config_ = camera_->generateConfiguration({ StreamRole::VideoRecording });
+		if (!config_ || config_->size() != 1) {
+			cerr << "Failed to generate default configuration" << endl;
+			return TestFail;
+		}
+
+		allocator_ = FrameBufferAllocator::create(camera_);
+
+		return TestPass;
+	}
+
+	void cleanup() override
+	{
+		if (camera_) {
+			delete allocator_;
+			camera_->release();
+			camera_.reset();
+		}
+
+		cm_->stop();
+		delete cm_;
+
+		unsetenv("LIBCAMERA_PIPELINE_THREADS");
+	}
+
+	int run() override
+	{
+		if (camera_->acquire()) {
+			cerr << "Failed to acquire the camera" << endl;
+			return TestFail;
+		}
+
+		camera_->configureCompleted.connect(this, &AsyncBringupTest::configureComplete);
+		camera_->startCompleted.connect(this, &AsyncBringupTest::startComplete);
+		camera_->requestCompleted.connect(this, &AsyncBringupTest::requestComplete);
+
+		if (camera_->startAsync() != -EACCES) {
+			cerr << "Unconfigured camera shall not be started" << endl;
+			return TestFail;
+		}
+
+		configureResult_ = Pending;
+		if (camera_->configureAsync(config_.get())) {
+			cerr << "Failed to schedule configuration" << endl;
+			return TestFail;
+		}
+
+		if (!waitFor(configureResult_, 1000) || configureResult_) {
+			cerr << "Asynchronous configuration failed" << endl;
+			return TestFail;
+		}
+
+		Stream *stream = config_->at(0).stream();
+		if (!stream || allocator_->allocate(stream) < 0) {
+			cerr << "Failed to allocate buffers" << endl;
+			return TestFail;
+		}
+
+		std::vector<std::unique_ptr<Request>> requests;
+		for (const std::unique_ptr<FrameBuffer> &buffer : allocator_->buffers(stream)) {
+			std::unique_ptr<Request> request = camera_->createRequest();
+			request->addBuffer(stream, buffer.get());
+			requests.push_back(std::move(request));
+		}
+
+		startResult_ = Pending;
+		if (camera_->startAsync()) {
+			cerr << "Failed to schedule start" << endl;
+			return TestFail;
+		}
+
+		if (!waitFor(startResult_, 1000) || startResult_) {
+			cerr << "Asynchronous start failed" << endl;
+			return TestFail;
+		}
+
+		completeRequestsCount_ = 0;
+		for (std::unique_ptr<Request> &request : requests) {
+			if (camera_->queueRequest(request.get())) {
+				cerr << "Failed to queue request" << endl;
+				return TestFail;
+			}
+		}
+
+		processEvents(1000);
+
+		if (camera_->stop()) {
+			cerr << "Failed to stop camera" << endl;
+			return TestFail;
+		}
+
+		processEvents(100);
+
+		camera_->configureCompleted.disconnect(this);
+		camera_->startCompleted.disconnect(this);
+		camera_->requestCompleted.disconnect(this);
+
+		if (completeRequestsCount_ != requests.size()) {
+			cerr << "Failed to complete requests" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+private:
+	static constexpr int Pending = 1;
+
+	CameraManager *cm_;
+	std::shared_ptr<Camera> camera_;
+	std::unique_ptr<CameraConfiguration> config_;
+	FrameBufferAllocator *allocator_;
+
+	int configureResult_;
+	int startResult_;
+	unsigned int completeRequestsCount_;
+};
+
+} /* namespace */
+
+TEST_REGISTER(AsyncBringupTest);
@@ -0,0 +1,149 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * libcamera Camera API tests
+ *
+ * Test capturing to buffers allocated from a DMA heap
+ */
+
+#include <iostream>
+
+#include "camera_test.h"
+#include "test.h"
+
+using namespace std;
+
+namespace {
+
+class BufferHeapTest : public CameraTest, public Test
+{
+public:
+	BufferHeapTest()
+		: CameraTest("VIMC Sensor B")
+	{
+	}
+
+protected:
+	void requestComplete(Request *request)
+	{
+		if (request->status() != Request::RequestComplete)
+			return;
+
+		completeRequestsCount_++;
+
+		request->reuse();
+		camera_->queueRequest(request);
+	}
+
+	int init() override
+	{
+		if (status_ != TestPass)
+			return status_;
+
+		config_ = camera_->generateConfiguration({ StreamRole::VideoRecording });
+		if (!config_ || config_->size() != 1) {
+			cout << "Failed to generate default configuration" << endl;
+			return TestFail;
+		}
+
+		allocator_ = FrameBufferAllocator::create(camera_);
+
+		if (allocator_->setHeap(FrameBufferAllocator::HeapSystem)) {
+			cout << "System DMA heap not available" << endl;
+			return TestSkip;
+		}
+
+		return TestPass;
+	}
+
+	void cleanup() override
+	{
+		delete allocator_;
+	}
+
+	int run() override
+	{
+		if (camera_->acquire()) {
+			cout << "Failed to acquire the camera" << endl;
+			return TestFail;
+		}
+
+		if (camera_->configure(config_.get())) {
+			cout << "Failed to set default configuration" << endl;
+			return TestFail;
+		}
+
+		Stream *stream = config_->at(0).stream();
+		if (allocator_->allocate(stream) < 0) {
+			cout << "Failed to allocate buffers from the heap" << endl;
+			return TestFail;
+		}
+
+		/* The heap can't be changed while buffers are allocated. */
+		if (allocator_->setHeap(FrameBufferAllocator::HeapNone) != -EBUSY) {
+			cout << "Heap changed with allocated buffers" << endl;
+			return TestFail;
+		}
+
+		vector<unique_ptr<Request>> requests;
+		for (const unique_ptr<FrameBuffer> &buffer : allocator_->buffers(stream)) {
+			/* Heap buffers are single contiguous dmabufs. */
+			if (buffer->planes().size() != 1) {
+				cout << "Unexpected number of planes" << endl;
+				return TestFail;
+			}
+
+			unique_ptr<Request> request = camera_->createRequest();
+			if (!request || request->addBuffer(stream, buffer.get())) {
+				cout << "Failed to create request" << endl;
+				return TestFail;
+			}
+
+			requests.push_back(move(request));
+		}
+
+		completeRequestsCount_ = 0;
+		camera_->requestCompleted.connect(this, &BufferHeapTest::requestComplete);
+
+		if (camera_->start()) {
+			cout << "Failed to start camera" << endl;
+			return TestFail;
+		}
+
+		for (unique_ptr<Request> &request : requests) {
+			if (camera_->queueRequest(request.get())) {
+				cout << "Failed to queue request" << endl;
+				return TestFail;
+			}
+		}
+
+		EventDispatcher *dispatcher = cm_->eventDispatcher();
+
+		Timer timer;
+		timer.start(1000);
+		while (timer.isRunning())
+			dispatcher->processEvents();
+
+		if (camera_->stop()) {
+			cout << "Failed to stop camera" << endl;
+			return TestFail;
+		}
+
+		if (completeRequestsCount_ <= requests.size()) {
+			cout << "Failed to capture enough frames (got "
+			     << completeRequestsCount_ << ")" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+	unsigned int completeRequestsCount_;
+	unique_ptr<CameraConfiguration> config_;
+	FrameBufferAllocator *allocator_;
+};
+
+} /* namespace */
+
+TEST_REGISTER(BufferHeapTest);
@@ -137,16 +137,10 @@ protected:
 		if (request->status() != Request::RequestComplete)
 			return;
 
-		const std::map<Stream *, FrameBuffer *> &buffers = request->buffers();
-
 		completeRequestsCount_++;
 
-		/* Create a new request. */
-		Stream *stream = buffers.begin()->first;
-		FrameBuffer *buffer = buffers.begin()->second;
-
-		request = camera_->createRequest();
-		request->addBuffer(stream, buffer);
+		/* Reuse the request and queue it again. */
+		request->reuse();
 		camera_->queueRequest(request);
 	}
 
@@ -185,9 +179,8 @@ protected:
 		if (ret != TestPass)
 			return ret;
 
-		std::vector<Request *> requests;
 		for (const std::unique_ptr<FrameBuffer> &buffer : source.buffers()) {
-			Request *request = camera_->createRequest();
+			std::unique_ptr<Request> request = camera_->createRequest();
 			if (!request) {
 				std::cout << "Failed to create request" << std::endl;
 				return TestFail;
@@ -198,7 +191,7 @@ protected:
 				return TestFail;
 			}
 
-			requests.push_back(request);
+			requests_.push_back(std::move(request));
 		}
 
 		completeRequestsCount_ = 0;
@@ -212,8 +205,8 @@ protected:
 			return TestFail;
 		}
 
-		for (Request *request : requests) {
-			if (camera_->queueRequest(request)) {
+		for (std::unique_ptr<Request> &request : requests_) {
+			if (camera_->queueRequest(request.get())) {
 				std::cout << "Failed to queue request" << std::endl;
 				return TestFail;
 			}
@@ -249,6 +242,7 @@ protected:
 private:
 	unsigned int completeBuffersCount_;
 	unsigned int completeRequestsCount_;
+	std::vector<std::unique_ptr<Request>> requests_;
 	std::unique_ptr<CameraConfiguration> config_;
 };
 
@@ -0,0 +1,265 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * libcamera FrameBufferAllocator buffer reuse test
+ */
+
+#include <iostream>
+#include <set>
+
+#include "camera_test.h"
+#include "test.h"
+
+using namespace std;
+
+namespace {
+
+class BufferReuseTest : public CameraTest, public Test
+{
+public:
+	BufferReuseTest()
+		: CameraTest("VIMC Sensor B")
+	{
+	}
+
+protected:
+	void requestComplete(Request *request)
+	{
+		if (request->status() != Request::RequestComplete)
+			return;
+
+		completeRequestsCount_++;
+
+		request->reuse();
+		camera_->queueRequest(request);
+	}
+
+	int init() override
+	{
+		if (status_ != TestPass)
+			return status_;
+
+		config_ = camera_->generateConfiguration({ StreamRole::VideoRecording });
+		if (!config_ || config_->size() != 1) {
+			cout << "Failed to generate default configuration" << endl;
+			return TestFail;
+		}
+
+		allocator_ = FrameBufferAllocator::create(camera_);
+
+		camera_->requestCompleted.connect(this, &BufferReuseTest::requestComplete);
+
+		return TestPass;
+	}
+
+	void cleanup() override
+	{
+		delete allocator_;
+	}
+
+	int configure(const Size &size)
+	{
+		config_->at(0).size = size;
+		if (config_->validate() != CameraConfiguration::Valid) {
+			cout << "Failed to validate configuration" << endl;
+			return TestFail;
+		}
+
+		if (camera_->configure(config_.get())) {
+			cout << "Failed to configure camera" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+	int allocate(set<const FrameBuffer *> *buffers)
+	{
+		Stream *stream = config_->at(0).stream();
+
+		if (allocator_->allocate(stream) < 0) {
+			cout << "Failed to allocate buffers" << endl;
+			return TestFail;
+		}
+
+		buffers->clear();
+		for (const unique_ptr<FrameBuffer> &buffer : allocator_->buffers(stream))
+			buffers->insert(buffer.get());
+
+		return TestPass;
+	}
+
+	const BufferPoolUsage *poolUsage()
+	{
+		pools_ = camera_->bufferUsage();
+		for (const BufferPoolUsage &usage : pools_) {
+			if (usage.name == "pool")
+				return &usage;
+		}
+
+		return nullptr;
+	}
+
+	int capture()
+	{
+		Stream *stream = config_->at(0).stream();
+		vector<unique_ptr<Request>> requests;
+
+		for (const unique_ptr<FrameBuffer> &buffer : allocator_->buffers(stream)) {
+			unique_ptr<Request> request = camera_->createRequest();
+			if (!request || request->addBuffer(stream, buffer.get())) {
+				cout << "Failed to create request" << endl;
+				return TestFail;
+			}
+
+			requests.push_back(move(request));
+		}
+
+		completeRequestsCount_ = 0;
+
+		if (camera_->start()) {
+			cout << "Failed to start camera" << endl;
+			return TestFail;
+		}
+
+		for (unique_ptr<Request> &request : requests) {
+			if (camera_->queueRequest(request.get())) {
+				cout << "Failed to queue request" << endl;
+				return TestFail;
+			}
+		}
+
+		EventDispatcher *dispatcher = cm_->eventDispatcher();
+
+		Timer timer;
+		timer.start(500);
+		while (timer.isRunning())
+			dispatcher->processEvents();
+
+		if (camera_->stop()) {
+			cout << "Failed to stop camera" << endl;
+			return TestFail;
+		}
+
+		if (completeRequestsCount_ <= requests.size()) {
+			cout << "Failed to capture enough frames (got "
+			     << completeRequestsCount_ << ")" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+	int run() override
+	{
+		Stream *stream;
+		set<const FrameBuffer *> first;
+		set<const FrameBuffer *> buffers;
+		const BufferPoolUsage *pool;
+
+		if (camera_->acquire()) {
+			cout << "Failed to acquire the camera" << endl;
+			return TestFail;
+		}
+
+		const Size size = config_->at(0).size;
+
+		/* Freed buffers must be kept in the pool. */
+		if (configure(size) || allocate(&first) || capture())
+			return TestFail;
+
+		stream = config_->at(0).stream();
+		if (allocator_->free(stream)) {
+			cout << "Failed to free buffers" << endl;
+			return TestFail;
+		}
+
+		pool = poolUsage();
+		if (!pool || pool->buffers != first.size()) {
+			cout << "Freed buffers not reported in the pool" << endl;
+			return TestFail;
+		}
+
+		/* A compatible configuration must reuse the pooled buffers. */
+		if (configure(size) || allocate(&buffers))
+			return TestFail;
+
+		if (buffers != first) {
+			cout << "Pooled buffers not reused" << endl;
+			return TestFail;
+		}
+
+		if (poolUsage()) {
+			cout << "Reused buffers still reported in the pool" << endl;
+			return TestFail;
+		}
+
+		if (capture())
+			return TestFail;
+
+		/* A different size must not reuse the pooled buffers. */
+		allocator_->free(stream);
+
+		if (configure({ size.width / 2, size.height / 2 }) ||
+		    allocate(&buffers))
+			return TestFail;
+
+		for (const FrameBuffer *buffer : buffers) {
+			if (first.count(buffer)) {
+				cout << "Incompatible buffers reused" << endl;
+				return TestFail;
+			}
+		}
+
+		if (capture())
+			return TestFail;
+
+		allocator_->free(stream);
+		allocator_->releasePool();
+
+		if (poolUsage()) {
+			cout << "Pool not released" << endl;
+			return TestFail;
+		}
+
+		/* Reserved buffers must be pooled and then reused. */
+		if (configure(size))
+			return TestFail;
+
+		int ret = allocator_->reserve(stream);
+		if (ret <= 0) {
+			cout << "Failed to reserve buffers" << endl;
+			return TestFail;
+		}
+
+		pool = poolUsage();
+		if (allocator_->allocated() || !pool ||
+		    pool->buffers != static_cast<unsigned int>(ret)) {
+			cout << "Reserved buffers not reported in the pool" << endl;
+			return TestFail;
+		}
+
+		if (allocate(&buffers))
+			return TestFail;
+
+		if (poolUsage() || buffers.size() != static_cast<unsigned int>(ret)) {
+			cout << "Reserved buffers not reused" << endl;
+			return TestFail;
+		}
+
+		if (capture())
+			return TestFail;
+
+		return TestPass;
+	}
+
+	unsigned int completeRequestsCount_;
+	vector<BufferPoolUsage> pools_;
+	unique_ptr<CameraConfiguration> config_;
+	FrameBufferAllocator *allocator_;
+};
+
+} /* namespace */
+
+TEST_REGISTER(BufferReuseTest);
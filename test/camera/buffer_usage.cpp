@@ -0,0 +1,97 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * libcamera Camera buffer usage test
+ */
+
+#include <iostream>
+
+#include "camera_test.h"
+#include "test.h"
+
+using namespace std;
+
+namespace {
+
+class BufferUsageTest : public CameraTest, public Test
+{
+public:
+	BufferUsageTest()
+		: CameraTest("VIMC Sensor B")
+	{
+	}
+
+protected:
+	int init() override
+	{
+		if (status_ != TestPass)
+			return status_;
+
+		config_ = camera_->generateConfiguration({ StreamRole::VideoRecording });
+		if (!config_ || config_->size() != 1) {
+			cout << "Failed to generate default configuration" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+	int run() override
+	{
+		if (camera_->acquire()) {
+			cout << "Failed to acquire the camera" << endl;
+			return TestFail;
+		}
+
+		if (camera_->configure(config_.get())) {
+			cout << "Failed to set default configuration" << endl;
+			return TestFail;
+		}
+
+		if (!camera_->bufferUsage().empty()) {
+			cout << "Buffers reported before allocation" << endl;
+			return TestFail;
+		}
+
+		Stream *stream = config_->at(0).stream();
+		FrameBufferAllocator *allocator = FrameBufferAllocator::create(camera_);
+
+		int ret = allocator->allocate(stream);
+		if (ret < 0) {
+			delete allocator;
+			return TestFail;
+		}
+
+		uint64_t bytes = 0;
+		for (const std::unique_ptr<FrameBuffer> &buffer : allocator->buffers(stream)) {
+			for (const FrameBuffer::Plane &plane : buffer->planes())
+				bytes += plane.length;
+		}
+
+		std::vector<BufferPoolUsage> pools = camera_->bufferUsage();
+		if (pools.size() != 1 || pools[0].type != BufferPoolUsage::Exported ||
+		    pools[0].stream != stream ||
+		    pools[0].buffers != allocator->buffers(stream).size() ||
+		    pools[0].bytes != bytes || !bytes) {
+			cout << "Invalid exported buffers usage" << endl;
+			delete allocator;
+			return TestFail;
+		}
+
+		delete allocator;
+
+		if (!camera_->bufferUsage().empty()) {
+			cout << "Buffers reported after being freed" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+	std::unique_ptr<CameraConfiguration> config_;
+};
+
+} /* namespace */
+
+TEST_REGISTER(BufferUsageTest);
@@ -0,0 +1,160 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * libcamera Camera API tests
+ *
+ * Test synchronised capture with camera groups
+ */
+
+#include <iostream>
+
+#include <libcamera/camera_group.h>
+
+#include "camera_test.h"
+#include "test.h"
+
+using namespace std;
+
+namespace {
+
+class CameraGroupTest : public CameraTest, public Test
+{
+public:
+	CameraGroupTest()
+		: CameraTest("VIMC Sensor B"), completed_(0), dropped_(0)
+	{
+	}
+
+protected:
+	void requestsCompleted(const std::vector<Request *> &requests)
+	{
+		if (requests.size() != 1)
+			return;
+
+		completed_++;
+
+		requests[0]->reuse();
+		group_->queueRequests(requests);
+	}
+
+	void requestDropped(unsigned int index, Request *request)
+	{
+		dropped_++;
+	}
+
+	int init() override
+	{
+		if (status_ != TestPass)
+			return status_;
+
+		config_ = camera_->generateConfiguration({ StreamRole::VideoRecording });
+		if (!config_ || config_->size() != 1) {
+			cout << "Failed to generate default configuration" << endl;
+			return TestFail;
+		}
+
+		allocator_ = FrameBufferAllocator::create(camera_);
+
+		return TestPass;
+	}
+
+	void cleanup() override
+	{
+		group_.reset();
+		delete allocator_;
+	}
+
+	int run() override
+	{
+		/* A group can't contain the same camera twice. */
+		CameraGroup invalid({ camera_, camera_ });
+		if (invalid.start() != -EINVAL) {
+			cout << "Group with duplicated camera started" << endl;
+			return TestFail;
+		}
+
+		if (camera_->acquire()) {
+			cout << "Failed to acquire the camera" << endl;
+			return TestFail;
+		}
+
+		if (camera_->configure(config_.get())) {
+			cout << "Failed to set default configuration" << endl;
+			return TestFail;
+		}
+
+		Stream *stream = config_->at(0).stream();
+		if (allocator_->allocate(stream) < 0)
+			return TestFail;
+
+		group_ = std::make_unique<CameraGroup>(std::vector<std::shared_ptr<Camera>>{ camera_ });
+		group_->setTolerance(std::chrono::nanoseconds(0));
+		group_->requestsCompleted.connect(this, &CameraGroupTest::requestsCompleted);
+		group_->requestDropped.connect(this, &CameraGroupTest::requestDropped);
+
+		if (group_->start()) {
+			cout << "Failed to start camera group" << endl;
+			return TestFail;
+		}
+
+		if (group_->queueRequests({}) != -EINVAL) {
+			cout << "Invalid number of requests accepted" << endl;
+			return TestFail;
+		}
+
+		for (const std::unique_ptr<FrameBuffer> &buffer : allocator_->buffers(stream)) {
+			std::unique_ptr<Request> request = camera_->createRequest();
+			request->addBuffer(stream, buffer.get());
+
+			if (group_->queueRequests({ request.get() })) {
+				cout << "Failed to queue requests" << endl;
+				return TestFail;
+			}
+
+			requests_.push_back(std::move(request));
+		}
+
+		EventDispatcher *dispatcher = cm_->eventDispatcher();
+
+		Timer timer;
+		timer.start(1000);
+		while (timer.isRunning())
+			dispatcher->processEvents();
+
+		if (group_->stop()) {
+			cout << "Failed to stop camera group" << endl;
+			return TestFail;
+		}
+
+		unsigned int nbuffers = allocator_->buffers(stream).size();
+
+		if (completed_ <= nbuffers * 2) {
+			cout << "Failed to capture enough frames (got "
+			     << completed_ << " expected at least "
+			     << nbuffers * 2 << ")" << endl;
+			return TestFail;
+		}
+
+		/* The requests in flight are dropped when stopping the group. */
+		if (dropped_ != nbuffers) {
+			cout << "Expected " << nbuffers << " dropped requests, got "
+			     << dropped_ << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+	std::unique_ptr<CameraConfiguration> config_;
+	FrameBufferAllocator *allocator_;
+	std::unique_ptr<CameraGroup> group_;
+	std::vector<std::unique_ptr<Request>> requests_;
+
+	unsigned int completed_;
+	unsigned int dropped_;
+};
+
+} /* namespace */
+
+TEST_REGISTER(CameraGroupTest);
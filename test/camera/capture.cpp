@@ -39,16 +39,10 @@ protected:
 		if (request->status() != Request::RequestComplete)
 			return;
 
-		const std::map<Stream *, FrameBuffer *> &buffers = request->buffers();
-
 		completeRequestsCount_++;
 
-		/* Create a new request. */
-		Stream *stream = buffers.begin()->first;
-		FrameBuffer *buffer = buffers.begin()->second;
-
-		request = camera_->createRequest();
-		request->addBuffer(stream, buffer);
+		/* Reuse the request and queue it again. */
+		request->reuse();
 		camera_->queueRequest(request);
 	}
 
@@ -93,9 +87,8 @@ protected:
 		if (ret < 0)
 			return TestFail;
 
-		std::vector<Request *> requests;
 		for (const std::unique_ptr<FrameBuffer> &buffer : allocator_->buffers(stream)) {
-			Request *request = camera_->createRequest();
+			std::unique_ptr<Request> request = camera_->createRequest();
 			if (!request) {
 				cout << "Failed to create request" << endl;
 				return TestFail;
@@ -106,7 +99,7 @@ protected:
 				return TestFail;
 			}
 
-			requests.push_back(request);
+			requests_.push_back(std::move(request));
 		}
 
 		completeRequestsCount_ = 0;
@@ -120,8 +113,8 @@ protected:
 			return TestFail;
 		}
 
-		for (Request *request : requests) {
-			if (camera_->queueRequest(request)) {
+		for (std::unique_ptr<Request> &request : requests_) {
+			if (camera_->queueRequest(request.get())) {
 				cout << "Failed to queue request" << endl;
 				return TestFail;
 			}
@@ -153,9 +146,26 @@ protected:
 			return TestFail;
 		}
 
+		CameraStatistics stats = camera_->statistics();
+		if (stats.framesDelivered != completeRequestsCount_ ||
+		    stats.framesCaptured < stats.framesDelivered) {
+			cout << "Invalid frame statistics" << endl;
+			return TestFail;
+		}
+
+		uint64_t latencies = 0;
+		for (uint64_t count : stats.latency)
+			latencies += count;
+
+		if (latencies != stats.framesDelivered + stats.requestsCancelled) {
+			cout << "Invalid latency histogram" << endl;
+			return TestFail;
+		}
+
 		return TestPass;
 	}
 
+	std::vector<std::unique_ptr<Request>> requests_;
 	std::unique_ptr<CameraConfiguration> config_;
 	FrameBufferAllocator *allocator_;
 };
@@ -0,0 +1,179 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * libcamera Camera API tests
+ *
+ * Test pausing and resuming the device when the application stops queuing
+ * requests
+ */
+
+#include <iostream>
+#include <stdlib.h>
+
+#include <libcamera/libcamera.h>
+
+#include "test.h"
+
+using namespace libcamera;
+using namespace std;
+
+namespace {
+
+class IdlePauseTest : public Test
+{
+protected:
+	void requestComplete(Request *request)
+	{
+		if (request->status() == Request::RequestComplete)
+			completeRequestsCount_++;
+	}
+
+	void processEvents(unsigned int msec)
+	{
+		EventDispatcher *dispatcher = cm_->eventDispatcher();
+
+		Timer timer;
+		timer.start(msec);
+		while (timer.isRunning())
+			dispatcher->processEvents();
+	}
+
+	int queueRequests()
+	{
+		for (std::unique_ptr<Request> &request : requests_) {
+			request->reuse();
+			if (camera_->queueRequest(request.get())) {
+				cerr << "Failed to queue request" << endl;
+				return TestFail;
+			}
+		}
+
+		return TestPass;
+	}
+
+	int init() override
+	{
+		/* Pause after 5 frame intervals without queued request. */
+		setenv("LIBCAMERA_PIPELINE_IDLE_FRAMES", "5", 1);
+
+		cm_ = new CameraManager();
+		if (cm_->start()) {
+			cerr << "Failed to start camera manager" << endl;
+			return TestFail;
+		}
+
+		camera_ = cm_->get("VIMC Sensor B");
+		if (!camera_) {
+			cerr << "Can not find VIMC camera" << endl;
+			return TestSkip;
+		}
+
+		config_ = camera_->generateConfiguration({ StreamRole::VideoRecording });
+		if (!config_ || config_->size() != 1) {
+			cerr << "Failed to generate default configuration" << endl;
+			return TestFail;
+		}
+
+		allocator_ = FrameBufferAllocator::create(camera_);
+
+		return TestPass;
+	}
+
+	void cleanup() override
+	{
+		if (camera_) {
+			delete allocator_;
+			camera_->release();
+			camera_.reset();
+		}
+
+		cm_->stop();
+		delete cm_;
+
+		unsetenv("LIBCAMERA_PIPELINE_IDLE_FRAMES");
+	}
+
+	int run() override
+	{
+		if (camera_->acquire()) {
+			cerr << "Failed to acquire the camera" << endl;
+			return TestFail;
+		}
+
+		if (camera_->configure(config_.get())) {
+			cerr << "Failed to set default configuration" << endl;
+			return TestFail;
+		}
+
+		Stream *stream = config_->at(0).stream();
+		if (allocator_->allocate(stream) < 0)
+			return TestFail;
+
+		for (const std::unique_ptr<FrameBuffer> &buffer : allocator_->buffers(stream)) {
+			std::unique_ptr<Request> request = camera_->createRequest();
+			request->addBuffer(stream, buffer.get());
+			requests_.push_back(std::move(request));
+		}
+
+		completeRequestsCount_ = 0;
+		camera_->requestCompleted.connect(this, &IdlePauseTest::requestComplete);
+
+		if (camera_->start()) {
+			cerr << "Failed to start camera" << endl;
+			return TestFail;
+		}
+
+		/*
+		 * Run dry twice, the device shall be paused after each batch
+		 * of requests completes, and resumed by the next batch.
+		 */
+		for (unsigned int i = 0; i < 2; ++i) {
+			if (queueRequests() != TestPass)
+				return TestFail;
+
+			processEvents(1000);
+
+			if (completeRequestsCount_ != (i + 1) * requests_.size()) {
+				cerr << "Failed to complete requests after resume" << endl;
+				return TestFail;
+			}
+		}
+
+		CameraStatistics stats = camera_->statistics();
+
+		if (camera_->stop()) {
+			cerr << "Failed to stop camera" << endl;
+			return TestFail;
+		}
+
+		camera_->requestCompleted.disconnect(this, &IdlePauseTest::requestComplete);
+
+		if (stats.idlePauses != 2) {
+			cerr << "Unexpected number of idle pauses: "
+			     << stats.idlePauses << endl;
+			return TestFail;
+		}
+
+		if (!stats.resumeLatency ||
+		    stats.resumeLatencyMax < stats.resumeLatency) {
+			cerr << "Invalid resume latency" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+private:
+	CameraManager *cm_;
+	std::shared_ptr<Camera> camera_;
+	std::unique_ptr<CameraConfiguration> config_;
+	FrameBufferAllocator *allocator_;
+	std::vector<std::unique_ptr<Request>> requests_;
+
+	unsigned int completeRequestsCount_;
+};
+
+} /* namespace */
+
+TEST_REGISTER(IdlePauseTest);
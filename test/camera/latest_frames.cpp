@@ -0,0 +1,205 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * libcamera Camera API tests
+ *
+ * Test delivering the latest frame to requests queued late
+ */
+
+#include <algorithm>
+#include <iostream>
+#include <time.h>
+
+#include <libcamera/libcamera.h>
+
+#include "test.h"
+
+using namespace libcamera;
+using namespace std;
+
+namespace {
+
+class LatestFramesTest : public Test
+{
+protected:
+	void requestComplete(Request *request)
+	{
+		if (request->status() != Request::RequestComplete)
+			return;
+
+		completeRequestsCount_++;
+
+		struct timespec ts;
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		uint64_t now = ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+
+		const FrameBuffer *buffer = request->buffers().begin()->second;
+		frameAge_ = now - buffer->metadata().timestamp;
+		lastBuffer_ = buffer;
+	}
+
+	void processEvents(unsigned int msec)
+	{
+		EventDispatcher *dispatcher = cm_->eventDispatcher();
+
+		Timer timer;
+		timer.start(msec);
+		while (timer.isRunning())
+			dispatcher->processEvents();
+	}
+
+	int init() override
+	{
+		cm_ = new CameraManager();
+		if (cm_->start()) {
+			cerr << "Failed to start camera manager" << endl;
+			return TestFail;
+		}
+
+		camera_ = cm_->get("VIMC Sensor B");
+		if (!camera_) {
+			cerr << "Can not find VIMC camera" << endl;
+			return TestSkip;
+		}
+
+		config_ = camera_->generateConfiguration({ StreamRole::VideoRecording });
+		if (!config_ || config_->size() != 1) {
+			cerr << "Failed to generate default configuration" << endl;
+			return TestFail;
+		}
+
+		allocator_ = FrameBufferAllocator::create(camera_);
+
+		return TestPass;
+	}
+
+	void cleanup() override
+	{
+		if (camera_) {
+			delete allocator_;
+			camera_->release();
+			camera_.reset();
+		}
+
+		cm_->stop();
+		delete cm_;
+	}
+
+	int run() override
+	{
+		if (camera_->acquire()) {
+			cerr << "Failed to acquire the camera" << endl;
+			return TestFail;
+		}
+
+		if (camera_->setLatestFrames(1) != -EINVAL) {
+			cerr << "A single spare buffer shall be rejected" << endl;
+			return TestFail;
+		}
+
+		if (camera_->setLatestFrames(2) || camera_->latestFrames() != 2) {
+			cerr << "Failed to enable the latest frames mode" << endl;
+			return TestFail;
+		}
+
+		if (camera_->configure(config_.get())) {
+			cerr << "Failed to set default configuration" << endl;
+			return TestFail;
+		}
+
+		Stream *stream = config_->at(0).stream();
+		if (allocator_->allocate(stream) < 0)
+			return TestFail;
+
+		for (const std::unique_ptr<FrameBuffer> &buffer : allocator_->buffers(stream)) {
+			std::unique_ptr<Request> request = camera_->createRequest();
+			request->addBuffer(stream, buffer.get());
+			requests_.push_back(std::move(request));
+		}
+
+		completeRequestsCount_ = 0;
+		camera_->requestCompleted.connect(this, &LatestFramesTest::requestComplete);
+
+		if (camera_->start()) {
+			cerr << "Failed to start camera" << endl;
+			return TestFail;
+		}
+
+		const std::vector<std::unique_ptr<FrameBuffer>> &spares =
+			allocator_->spareBuffers(stream);
+		if (spares.size() != 2) {
+			cerr << "Spare buffers not allocated" << endl;
+			return TestFail;
+		}
+
+		for (std::unique_ptr<Request> &request : requests_) {
+			if (camera_->queueRequest(request.get())) {
+				cerr << "Failed to queue request" << endl;
+				return TestFail;
+			}
+		}
+
+		processEvents(1000);
+
+		if (completeRequestsCount_ != requests_.size()) {
+			cerr << "Failed to complete requests" << endl;
+			return TestFail;
+		}
+
+		/*
+		 * Queue a request late, it shall complete with a recent frame
+		 * captured to a spare buffer.
+		 */
+		Request *request = requests_[0].get();
+		request->reuse();
+		if (camera_->queueRequest(request)) {
+			cerr << "Failed to queue late request" << endl;
+			return TestFail;
+		}
+
+		processEvents(100);
+
+		if (completeRequestsCount_ != requests_.size() + 1) {
+			cerr << "Failed to complete late request" << endl;
+			return TestFail;
+		}
+
+		auto isSpare = [&](const std::unique_ptr<FrameBuffer> &spare) {
+			return spare.get() == lastBuffer_;
+		};
+		if (std::find_if(spares.begin(), spares.end(), isSpare) == spares.end()) {
+			cerr << "Late request not completed with a spare buffer" << endl;
+			return TestFail;
+		}
+
+		if (frameAge_ > 200000000) {
+			cerr << "Late request completed with a stale frame" << endl;
+			return TestFail;
+		}
+
+		if (camera_->stop()) {
+			cerr << "Failed to stop camera" << endl;
+			return TestFail;
+		}
+
+		camera_->requestCompleted.disconnect(this, &LatestFramesTest::requestComplete);
+
+		return TestPass;
+	}
+
+private:
+	CameraManager *cm_;
+	std::shared_ptr<Camera> camera_;
+	std::unique_ptr<CameraConfiguration> config_;
+	FrameBufferAllocator *allocator_;
+	std::vector<std::unique_ptr<Request>> requests_;
+
+	unsigned int completeRequestsCount_;
+	const FrameBuffer *lastBuffer_;
+	uint64_t frameAge_;
+};
+
+} /* namespace */
+
+TEST_REGISTER(LatestFramesTest);
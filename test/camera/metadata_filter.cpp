@@ -0,0 +1,187 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * libcamera Camera API tests
+ *
+ * Test restricting the metadata reported in requests
+ */
+
+#include <iostream>
+#include <time.h>
+
+#include <libcamera/control_ids.h>
+
+#include "camera_test.h"
+#include "test.h"
+
+using namespace std;
+
+namespace {
+
+class MetadataFilter : public CameraTest, public Test
+{
+public:
+	MetadataFilter()
+		: CameraTest("VIMC Sensor B"), completed_(0)
+	{
+	}
+
+protected:
+	void requestComplete(Request *request)
+	{
+		if (request->status() == Request::RequestComplete)
+			completed_++;
+	}
+
+	int init() override
+	{
+		if (status_ != TestPass)
+			return status_;
+
+		config_ = camera_->generateConfiguration({ StreamRole::VideoRecording });
+		if (!config_ || config_->size() != 1) {
+			cout << "Failed to generate default configuration" << endl;
+			return TestFail;
+		}
+
+		allocator_ = FrameBufferAllocator::create(camera_);
+
+		return TestPass;
+	}
+
+	void cleanup() override
+	{
+		delete allocator_;
+	}
+
+	int run() override
+	{
+		if (camera_->setMetadataFilter({}) != -EACCES) {
+			cout << "Metadata filter set on a released camera" << endl;
+			return TestFail;
+		}
+
+		if (camera_->acquire()) {
+			cout << "Failed to acquire the camera" << endl;
+			return TestFail;
+		}
+
+		if (camera_->configure(config_.get())) {
+			cout << "Failed to set default configuration" << endl;
+			return TestFail;
+		}
+
+		Stream *stream = config_->at(0).stream();
+		if (allocator_->allocate(stream) < 3)
+			return TestFail;
+
+		/*
+		 * Create a request with all metadata, a request with the camera
+		 * filter disabling all metadata, and a request overriding the
+		 * camera filter to report the target offset only.
+		 */
+		std::vector<std::unique_ptr<Request>> requests;
+		requests.push_back(camera_->createRequest());
+
+		if (camera_->setMetadataFilter({})) {
+			cout << "Failed to set the metadata filter" << endl;
+			return TestFail;
+		}
+
+		requests.push_back(camera_->createRequest());
+		requests.push_back(camera_->createRequest());
+		requests[2]->setMetadataFilter({ &controls::FrameTargetOffset });
+
+		if (!requests[0]->metadataEnabled(controls::FrameTargetOffset) ||
+		    requests[1]->metadataEnabled(controls::FrameTargetOffset) ||
+		    !requests[2]->metadataEnabled(controls::FrameTargetOffset) ||
+		    requests[2]->metadataEnabled(controls::ScalerCrop)) {
+			cout << "Invalid metadata filter" << endl;
+			return TestFail;
+		}
+
+		camera_->requestCompleted.connect(this, &MetadataFilter::requestComplete);
+
+		if (camera_->start()) {
+			cout << "Failed to start camera" << endl;
+			return TestFail;
+		}
+
+		struct timespec ts;
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		int64_t target = ts.tv_sec * 1000000000LL + ts.tv_nsec;
+
+		for (unsigned int i = 0; i < requests.size(); ++i) {
+			Request *request = requests[i].get();
+			request->addBuffer(stream, allocator_->buffers(stream)[i].get());
+			request->controls().set(controls::FrameTargetTime, target);
+
+			if (camera_->queueRequest(request)) {
+				cout << "Failed to queue request" << endl;
+				return TestFail;
+			}
+		}
+
+		EventDispatcher *dispatcher = cm_->eventDispatcher();
+
+		Timer timer;
+		timer.start(1000);
+		while (timer.isRunning() && completed_ < requests.size())
+			dispatcher->processEvents();
+
+		if (camera_->stop()) {
+			cout << "Failed to stop camera" << endl;
+			return TestFail;
+		}
+
+		if (completed_ != requests.size()) {
+			cout << "Failed to complete requests" << endl;
+			return TestFail;
+		}
+
+		if (!requests[0]->metadata().contains(controls::FrameTargetOffset) ||
+		    !requests[2]->metadata().contains(controls::FrameTargetOffset)) {
+			cout << "Enabled metadata not reported" << endl;
+			return TestFail;
+		}
+
+		if (!requests[1]->metadata().empty() ||
+		    requests[2]->metadata().contains(controls::RequestCompleteTime)) {
+			cout << "Disabled metadata reported" << endl;
+			return TestFail;
+		}
+
+		/* The request processing stages must be reported in order. */
+		const ControlList &metadata = requests[0]->metadata();
+		if (!metadata.contains(controls::RequestQueueTime) ||
+		    !metadata.contains(controls::RequestDeviceTime) ||
+		    !metadata.contains(controls::FrameStartTime) ||
+		    !metadata.contains(controls::BufferCompleteTime) ||
+		    !metadata.contains(controls::RequestCompleteTime)) {
+			cout << "Request timings not reported" << endl;
+			return TestFail;
+		}
+
+		int64_t queued = metadata.get(controls::RequestQueueTime);
+		int64_t device = metadata.get(controls::RequestDeviceTime);
+		int64_t buffer = metadata.get(controls::BufferCompleteTime);
+		int64_t complete = metadata.get(controls::RequestCompleteTime);
+		if (queued > device || device > buffer || buffer > complete ||
+		    metadata.get(controls::FrameStartTime) > buffer) {
+			cout << "Invalid request timings" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+	std::unique_ptr<CameraConfiguration> config_;
+	FrameBufferAllocator *allocator_;
+
+	unsigned int completed_;
+};
+
+} /* namespace */
+
+TEST_REGISTER(MetadataFilter);
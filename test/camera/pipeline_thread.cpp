@@ -0,0 +1,183 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * libcamera Camera API tests
+ *
+ * Test capture with the pipeline handler running in a dedicated thread
+ */
+
+#include <atomic>
+#include <iostream>
+#include <stdlib.h>
+
+#include <libcamera/libcamera.h>
+
+#include "thread.h"
+#include "test.h"
+
+using namespace libcamera;
+using namespace std;
+
+namespace {
+
+std::atomic<Thread *> bufferThread(nullptr);
+
+void bufferComplete(Request *request, FrameBuffer *buffer)
+{
+	bufferThread = Thread::current();
+}
+
+class PipelineThreadTest : public Test, public Object
+{
+protected:
+	void requestComplete(Request *request)
+	{
+		if (Thread::current() != thread())
+			wrongThread_ = true;
+
+		if (request->status() != Request::RequestComplete)
+			return;
+
+		completeRequestsCount_++;
+
+		request->reuse();
+		camera_->queueRequest(request);
+	}
+
+	void processEvents(unsigned int msec)
+	{
+		EventDispatcher *dispatcher = cm_->eventDispatcher();
+
+		Timer timer;
+		timer.start(msec);
+		while (timer.isRunning())
+			dispatcher->processEvents();
+	}
+
+	int init() override
+	{
+		setenv("LIBCAMERA_PIPELINE_THREADS", "1", 1);
+
+		cm_ = new CameraManager();
+		if (cm_->start()) {
+			cerr << "Failed to start camera manager" << endl;
+			return TestFail;
+		}
+
+		camera_ = cm_->get("VIMC Sensor B");
+		if (!camera_) {
+			cerr << "Can not find VIMC camera" << endl;
+			return TestSkip;
+		}
+
+		config_ = camera_->generateConfiguration({ StreamRole::VideoRecording });
+		if (!config_ || config_->size() != 1) {
+			cerr << "Failed to generate default configuration" << endl;
+			return TestFail;
+		}
+
+		allocator_ = FrameBufferAllocator::create(camera_);
+
+		return TestPass;
+	}
+
+	void cleanup() override
+	{
+		if (camera_) {
+			delete allocator_;
+			camera_->release();
+			camera_.reset();
+		}
+
+		cm_->stop();
+		delete cm_;
+
+		unsetenv("LIBCAMERA_PIPELINE_THREADS");
+	}
+
+	int run() override
+	{
+		if (camera_->acquire()) {
+			cerr << "Failed to acquire the camera" << endl;
+			return TestFail;
+		}
+
+		if (camera_->configure(config_.get())) {
+			cerr << "Failed to set default configuration" << endl;
+			return TestFail;
+		}
+
+		Stream *stream = config_->at(0).stream();
+		if (allocator_->allocate(stream) < 0)
+			return TestFail;
+
+		std::vector<std::unique_ptr<Request>> requests;
+		for (const std::unique_ptr<FrameBuffer> &buffer : allocator_->buffers(stream)) {
+			std::unique_ptr<Request> request = camera_->createRequest();
+			request->addBuffer(stream, buffer.get());
+			requests.push_back(std::move(request));
+		}
+
+		completeRequestsCount_ = 0;
+		wrongThread_ = false;
+
+		camera_->bufferCompleted.connect(bufferComplete);
+		camera_->requestCompleted.connect(this, &PipelineThreadTest::requestComplete);
+
+		if (camera_->start()) {
+			cerr << "Failed to start camera" << endl;
+			return TestFail;
+		}
+
+		for (std::unique_ptr<Request> &request : requests) {
+			if (camera_->queueRequest(request.get())) {
+				cerr << "Failed to queue request" << endl;
+				return TestFail;
+			}
+		}
+
+		processEvents(1000);
+
+		if (camera_->stop()) {
+			cerr << "Failed to stop camera" << endl;
+			return TestFail;
+		}
+
+		/* Completions are queued to this thread, flush them. */
+		processEvents(100);
+
+		camera_->bufferCompleted.disconnect(bufferComplete);
+		camera_->requestCompleted.disconnect(this);
+
+		if (completeRequestsCount_ <= requests.size()) {
+			cerr << "Failed to capture enough frames" << endl;
+			return TestFail;
+		}
+
+		if (wrongThread_) {
+			cerr << "Request completion delivered in the wrong thread" << endl;
+			return TestFail;
+		}
+
+		if (!bufferThread || bufferThread == thread()) {
+			cerr << "Pipeline handler not running in its own thread" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+private:
+	CameraManager *cm_;
+	std::shared_ptr<Camera> camera_;
+	std::unique_ptr<CameraConfiguration> config_;
+	FrameBufferAllocator *allocator_;
+
+	unsigned int completeRequestsCount_;
+	bool wrongThread_;
+};
+
+} /* namespace */
+
+TEST_REGISTER(PipelineThreadTest);
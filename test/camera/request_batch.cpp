@@ -0,0 +1,162 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * libcamera Camera API tests
+ *
+ * Test queuing requests in batches
+ */
+
+#include <iostream>
+
+#include "camera_test.h"
+#include "test.h"
+
+using namespace std;
+
+namespace {
+
+class RequestBatch : public CameraTest, public Test
+{
+public:
+	RequestBatch()
+		: CameraTest("VIMC Sensor B")
+	{
+	}
+
+protected:
+	static constexpr unsigned int BatchSize = 2;
+
+	void requestComplete(Request *request)
+	{
+		if (request->status() != Request::RequestComplete)
+			return;
+
+		completeRequestsCount_++;
+
+		/* Queue the completed requests again once a batch is ready. */
+		completed_.push_back(request);
+		if (completed_.size() < BatchSize)
+			return;
+
+		for (Request *req : completed_)
+			req->reuse();
+
+		if (camera_->queueRequests(completed_))
+			batchFailures_++;
+
+		completed_.clear();
+	}
+
+	int init() override
+	{
+		if (status_ != TestPass)
+			return status_;
+
+		config_ = camera_->generateConfiguration({ StreamRole::VideoRecording });
+		if (!config_ || config_->size() != 1) {
+			cout << "Failed to generate default configuration" << endl;
+			return TestFail;
+		}
+
+		allocator_ = FrameBufferAllocator::create(camera_);
+
+		return TestPass;
+	}
+
+	void cleanup() override
+	{
+		delete allocator_;
+	}
+
+	int run() override
+	{
+		if (camera_->acquire()) {
+			cout << "Failed to acquire the camera" << endl;
+			return TestFail;
+		}
+
+		if (camera_->configure(config_.get())) {
+			cout << "Failed to set default configuration" << endl;
+			return TestFail;
+		}
+
+		Stream *stream = config_->at(0).stream();
+		int ret = allocator_->allocate(stream);
+		if (ret < 0 || ret % BatchSize)
+			return TestFail;
+
+		std::vector<std::unique_ptr<Request>> requests;
+		std::vector<Request *> batch;
+		for (const std::unique_ptr<FrameBuffer> &buffer : allocator_->buffers(stream)) {
+			std::unique_ptr<Request> request = camera_->createRequest();
+			request->addBuffer(stream, buffer.get());
+			batch.push_back(request.get());
+			requests.push_back(std::move(request));
+		}
+
+		completeRequestsCount_ = 0;
+		batchFailures_ = 0;
+		camera_->requestCompleted.connect(this, &RequestBatch::requestComplete);
+
+		if (camera_->start()) {
+			cout << "Failed to start camera" << endl;
+			return TestFail;
+		}
+
+		/* Batches are validated as a whole. */
+		std::unique_ptr<Request> empty = camera_->createRequest();
+		std::vector<Request *> invalid = { batch[0], empty.get() };
+		if (camera_->queueRequests(invalid) != -EINVAL) {
+			cout << "Invalid batch queued" << endl;
+			return TestFail;
+		}
+
+		invalid = { batch[0], batch[0] };
+		if (camera_->queueRequests(invalid) != -EINVAL) {
+			cout << "Batch with duplicated request queued" << endl;
+			return TestFail;
+		}
+
+		if (camera_->queueRequests(batch)) {
+			cout << "Failed to queue batch" << endl;
+			return TestFail;
+		}
+
+		EventDispatcher *dispatcher = cm_->eventDispatcher();
+
+		Timer timer;
+		timer.start(1000);
+		while (timer.isRunning())
+			dispatcher->processEvents();
+
+		if (camera_->stop()) {
+			cout << "Failed to stop camera" << endl;
+			return TestFail;
+		}
+
+		if (batchFailures_) {
+			cout << "Failed to queue batch again" << endl;
+			return TestFail;
+		}
+
+		if (completeRequestsCount_ <= requests.size() * 2) {
+			cout << "Failed to capture enough frames (got "
+			     << completeRequestsCount_ << ")" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+	std::unique_ptr<CameraConfiguration> config_;
+	FrameBufferAllocator *allocator_;
+
+	std::vector<Request *> completed_;
+	unsigned int completeRequestsCount_;
+	unsigned int batchFailures_;
+};
+
+} /* namespace */
+
+TEST_REGISTER(RequestBatch);
@@ -0,0 +1,159 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * libcamera Camera API tests
+ *
+ * Test re-arming repeating requests
+ */
+
+#include <iostream>
+
+#include "camera_test.h"
+#include "test.h"
+
+using namespace std;
+
+namespace {
+
+class RequestRepeating : public CameraTest, public Test
+{
+public:
+	RequestRepeating()
+		: CameraTest("VIMC Sensor B")
+	{
+	}
+
+protected:
+	void requestComplete(Request *request)
+	{
+		if (request->status() != Request::RequestComplete)
+			return;
+
+		completeRequestsCount_++;
+
+		/* The controls of repeating requests are kept. */
+		if (!request->controls().contains(controls::Brightness))
+			lostControls_++;
+
+		if (camera_->releaseRequest(request))
+			releaseFailures_++;
+	}
+
+	int init() override
+	{
+		if (status_ != TestPass)
+			return status_;
+
+		config_ = camera_->generateConfiguration({ StreamRole::VideoRecording });
+		if (!config_ || config_->size() != 1) {
+			cout << "Failed to generate default configuration" << endl;
+			return TestFail;
+		}
+
+		allocator_ = FrameBufferAllocator::create(camera_);
+
+		return TestPass;
+	}
+
+	void cleanup() override
+	{
+		delete allocator_;
+	}
+
+	int run() override
+	{
+		if (camera_->acquire()) {
+			cout << "Failed to acquire the camera" << endl;
+			return TestFail;
+		}
+
+		if (camera_->configure(config_.get())) {
+			cout << "Failed to set default configuration" << endl;
+			return TestFail;
+		}
+
+		Stream *stream = config_->at(0).stream();
+		if (allocator_->allocate(stream) < 0)
+			return TestFail;
+
+		std::vector<std::unique_ptr<Request>> requests;
+		for (const std::unique_ptr<FrameBuffer> &buffer : allocator_->buffers(stream)) {
+			std::unique_ptr<Request> request = camera_->createRequest();
+			request->addBuffer(stream, buffer.get());
+			request->controls().set(controls::Brightness, 10);
+			request->setRepeating(true);
+			requests.push_back(std::move(request));
+		}
+
+		completeRequestsCount_ = 0;
+		lostControls_ = 0;
+		releaseFailures_ = 0;
+		camera_->requestCompleted.connect(this, &RequestRepeating::requestComplete);
+
+		if (camera_->start()) {
+			cout << "Failed to start camera" << endl;
+			return TestFail;
+		}
+
+		/* Requests that haven't completed can't be re-armed. */
+		if (camera_->releaseRequest(requests[0].get()) != -EINVAL) {
+			cout << "Pending request re-armed" << endl;
+			return TestFail;
+		}
+
+		for (std::unique_ptr<Request> &request : requests) {
+			if (camera_->queueRequest(request.get())) {
+				cout << "Failed to queue request" << endl;
+				return TestFail;
+			}
+		}
+
+		EventDispatcher *dispatcher = cm_->eventDispatcher();
+
+		Timer timer;
+		timer.start(1000);
+		while (timer.isRunning())
+			dispatcher->processEvents();
+
+		if (camera_->stop()) {
+			cout << "Failed to stop camera" << endl;
+			return TestFail;
+		}
+
+		if (releaseFailures_) {
+			cout << "Failed to re-arm request" << endl;
+			return TestFail;
+		}
+
+		if (lostControls_) {
+			cout << "Controls lost when re-arming request" << endl;
+			return TestFail;
+		}
+
+		if (completeRequestsCount_ <= requests.size() * 2) {
+			cout << "Failed to capture enough frames (got "
+			     << completeRequestsCount_ << ")" << endl;
+			return TestFail;
+		}
+
+		/* Requests can't be re-armed once the camera is stopped. */
+		if (camera_->releaseRequest(requests[0].get()) != -EACCES) {
+			cout << "Request re-armed on stopped camera" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+	std::unique_ptr<CameraConfiguration> config_;
+	FrameBufferAllocator *allocator_;
+
+	unsigned int completeRequestsCount_;
+	unsigned int lostControls_;
+	unsigned int releaseFailures_;
+};
+
+} /* namespace */
+
+TEST_REGISTER(RequestRepeating);
@@ -0,0 +1,177 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * libcamera Camera API tests
+ *
+ * Test queuing requests from a thread other than the pipeline handler thread
+ */
+
+#include <atomic>
+#include <iostream>
+
+#include "camera_test.h"
+#include "thread.h"
+#include "test.h"
+
+using namespace std;
+
+namespace {
+
+class Submitter : public Object
+{
+public:
+	Submitter(Camera *camera)
+		: camera_(camera), failures_(0)
+	{
+	}
+
+	void submit(Request *request)
+	{
+		request->reuse();
+		if (camera_->queueRequest(request))
+			failures_++;
+	}
+
+	Camera *camera_;
+	std::atomic<unsigned int> failures_;
+};
+
+class RequestSubmitThread : public CameraTest, public Test
+{
+public:
+	RequestSubmitThread()
+		: CameraTest("VIMC Sensor B"), allocator_(nullptr),
+		  submitter_(nullptr)
+	{
+	}
+
+protected:
+	void requestComplete(Request *request)
+	{
+		if (request->status() != Request::RequestComplete)
+			return;
+
+		completeRequestsCount_++;
+
+		/* Queue the request again from the submitter thread. */
+		submitter_->invokeMethod(&Submitter::submit,
+					 ConnectionTypeQueued, request);
+	}
+
+	int init() override
+	{
+		if (status_ != TestPass)
+			return status_;
+
+		config_ = camera_->generateConfiguration({ StreamRole::VideoRecording });
+		if (!config_ || config_->size() != 1) {
+			cout << "Failed to generate default configuration" << endl;
+			return TestFail;
+		}
+
+		allocator_ = FrameBufferAllocator::create(camera_);
+
+		submitter_ = new Submitter(camera_.get());
+		submitter_->moveToThread(&thread_);
+		thread_.start();
+
+		return TestPass;
+	}
+
+	void cleanup() override
+	{
+		thread_.exit();
+		thread_.wait();
+
+		delete submitter_;
+		delete allocator_;
+	}
+
+	int run() override
+	{
+		if (camera_->acquire()) {
+			cout << "Failed to acquire the camera" << endl;
+			return TestFail;
+		}
+
+		if (camera_->configure(config_.get())) {
+			cout << "Failed to set default configuration" << endl;
+			return TestFail;
+		}
+
+		Stream *stream = config_->at(0).stream();
+		if (allocator_->allocate(stream) < 0)
+			return TestFail;
+
+		std::vector<std::unique_ptr<Request>> requests;
+		for (const std::unique_ptr<FrameBuffer> &buffer : allocator_->buffers(stream)) {
+			std::unique_ptr<Request> request = camera_->createRequest();
+			request->addBuffer(stream, buffer.get());
+			requests.push_back(std::move(request));
+		}
+
+		completeRequestsCount_ = 0;
+		camera_->requestCompleted.connect(this, &RequestSubmitThread::requestComplete);
+
+		if (camera_->start()) {
+			cout << "Failed to start camera" << endl;
+			return TestFail;
+		}
+
+		/* Queue the initial requests from the submitter thread too. */
+		for (std::unique_ptr<Request> &request : requests) {
+			submitter_->invokeMethod(&Submitter::submit,
+						 ConnectionTypeBlocking,
+						 request.get());
+		}
+
+		EventDispatcher *dispatcher = cm_->eventDispatcher();
+
+		Timer timer;
+		timer.start(1000);
+		while (timer.isRunning())
+			dispatcher->processEvents();
+
+		/* Stop the submitter before the camera to avoid rejected requests. */
+		camera_->requestCompleted.disconnect(this);
+		thread_.exit();
+		thread_.wait();
+
+		if (camera_->stop()) {
+			cout << "Failed to stop camera" << endl;
+			return TestFail;
+		}
+
+		if (submitter_->failures_) {
+			cout << "Failed to queue requests from the submitter thread" << endl;
+			return TestFail;
+		}
+
+		if (completeRequestsCount_ <= requests.size() * 2) {
+			cout << "Failed to capture enough frames (got "
+			     << completeRequestsCount_ << ")" << endl;
+			return TestFail;
+		}
+
+		/* Requests can't be queued from any thread once stopped. */
+		requests[0]->reuse();
+		if (camera_->queueRequest(requests[0].get()) != -EACCES) {
+			cout << "Request queued to a stopped camera" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+	std::unique_ptr<CameraConfiguration> config_;
+	FrameBufferAllocator *allocator_;
+
+	Thread thread_;
+	Submitter *submitter_;
+	unsigned int completeRequestsCount_;
+};
+
+} /* namespace */
+
+TEST_REGISTER(RequestSubmitThread);
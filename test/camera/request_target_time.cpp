@@ -0,0 +1,155 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * libcamera Camera API tests
+ *
+ * Test requests with a target capture time
+ */
+
+#include <chrono>
+#include <iostream>
+#include <time.h>
+
+#include <libcamera/control_ids.h>
+
+#include "camera_test.h"
+#include "test.h"
+
+using namespace std;
+
+namespace {
+
+class RequestTargetTime : public CameraTest, public Test
+{
+public:
+	RequestTargetTime()
+		: CameraTest("VIMC Sensor B"), offset_(-1)
+	{
+	}
+
+protected:
+	void requestComplete(Request *request)
+	{
+		if (request->status() != Request::RequestComplete)
+			return;
+
+		completed_.push_back(request);
+		if (request->metadata().contains(controls::FrameTargetOffset))
+			offset_ = request->metadata().get(controls::FrameTargetOffset);
+	}
+
+	int init() override
+	{
+		if (status_ != TestPass)
+			return status_;
+
+		config_ = camera_->generateConfiguration({ StreamRole::VideoRecording });
+		if (!config_ || config_->size() != 1) {
+			cout << "Failed to generate default configuration" << endl;
+			return TestFail;
+		}
+
+		allocator_ = FrameBufferAllocator::create(camera_);
+
+		return TestPass;
+	}
+
+	void cleanup() override
+	{
+		delete allocator_;
+	}
+
+	int run() override
+	{
+		if (camera_->acquire()) {
+			cout << "Failed to acquire the camera" << endl;
+			return TestFail;
+		}
+
+		if (camera_->configure(config_.get())) {
+			cout << "Failed to set default configuration" << endl;
+			return TestFail;
+		}
+
+		if (!camera_->controls().count(&controls::FrameTargetTime)) {
+			cout << "Target capture time not supported" << endl;
+			return TestFail;
+		}
+
+		Stream *stream = config_->at(0).stream();
+		if (allocator_->allocate(stream) < 2)
+			return TestFail;
+
+		camera_->requestCompleted.connect(this, &RequestTargetTime::requestComplete);
+
+		if (camera_->start()) {
+			cout << "Failed to start camera" << endl;
+			return TestFail;
+		}
+
+		struct timespec ts;
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		int64_t target = ts.tv_sec * 1000000000LL + ts.tv_nsec + 300000000LL;
+
+		/*
+		 * Queue a request with a target time 300ms in the future, and a
+		 * request without a target, which must wait behind it.
+		 */
+		std::vector<std::unique_ptr<Request>> requests;
+		for (unsigned int i = 0; i < 2; ++i) {
+			std::unique_ptr<Request> request = camera_->createRequest();
+			request->addBuffer(stream, allocator_->buffers(stream)[i].get());
+			if (!i)
+				request->controls().set(controls::FrameTargetTime, target);
+
+			if (camera_->queueRequest(request.get())) {
+				cout << "Failed to queue request" << endl;
+				return TestFail;
+			}
+
+			requests.push_back(std::move(request));
+		}
+
+		EventDispatcher *dispatcher = cm_->eventDispatcher();
+
+		Timer timer;
+		timer.start(1000);
+		while (timer.isRunning() && completed_.size() < 2)
+			dispatcher->processEvents();
+
+		if (camera_->stop()) {
+			cout << "Failed to stop camera" << endl;
+			return TestFail;
+		}
+
+		if (completed_.size() != 2 || completed_[0] != requests[0].get()) {
+			cout << "Requests not completed in order" << endl;
+			return TestFail;
+		}
+
+		const FrameBuffer *buffer = requests[0]->buffers().begin()->second;
+		if (static_cast<int64_t>(buffer->metadata().timestamp) < target ||
+		    offset_ != static_cast<int64_t>(buffer->metadata().timestamp) - target) {
+			cout << "Frame captured before the target time" << endl;
+			return TestFail;
+		}
+
+		if (requests[1]->metadata().contains(controls::FrameTargetOffset)) {
+			cout << "Target offset reported without a target" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+	std::unique_ptr<CameraConfiguration> config_;
+	FrameBufferAllocator *allocator_;
+
+	std::vector<Request *> completed_;
+	int64_t offset_;
+};
+
+} /* namespace */
+
+TEST_REGISTER(RequestTargetTime);
@@ -99,13 +99,10 @@ protected:
 			return TestFail;
 
 		/* Test operations which should pass. */
-		Request *request2 = camera_->createRequest();
+		std::unique_ptr<Request> request2 = camera_->createRequest();
 		if (!request2)
 			return TestFail;
 
-		/* Never handed to hardware so need to manually delete it. */
-		delete request2;
-
 		/* Test valid state transitions, end in Running state. */
 		if (camera_->release())
 			return TestFail;
@@ -144,7 +141,7 @@ protected:
 			return TestFail;
 
 		/* Test operations which should pass. */
-		Request *request = camera_->createRequest();
+		std::unique_ptr<Request> request = camera_->createRequest();
 		if (!request)
 			return TestFail;
 
@@ -152,7 +149,7 @@ protected:
 		if (request->addBuffer(stream, allocator_->buffers(stream)[0].get()))
 			return TestFail;
 
-		if (camera_->queueRequest(request))
+		if (camera_->queueRequest(request.get()))
 			return TestFail;
 
 		/* Test valid state transitions, end in Available state. */
@@ -0,0 +1,199 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * libcamera Camera API tests
+ *
+ * Test sharing a stream between multiple consumers
+ */
+
+#include <iostream>
+
+#include <libcamera/stream_fanout.h>
+
+#include "camera_test.h"
+#include "test.h"
+
+using namespace std;
+
+namespace {
+
+class Consumer : public Object
+{
+public:
+	Consumer(StreamFanout *fanout, const std::string &name, bool hold)
+		: fanout_(fanout), hold_(hold), held_(nullptr), received_(0)
+	{
+		id_ = fanout_->addConsumer(name, this, &Consumer::bufferReady);
+	}
+
+	void flush()
+	{
+		if (held_)
+			fanout_->release(id_, held_);
+		held_ = nullptr;
+	}
+
+	unsigned int received() const { return received_; }
+
+private:
+	void bufferReady(FrameBuffer *buffer)
+	{
+		received_++;
+
+		/* Hold the buffer until the next one arrives. */
+		if (hold_) {
+			flush();
+			held_ = buffer;
+			return;
+		}
+
+		fanout_->release(id_, buffer);
+	}
+
+	StreamFanout *fanout_;
+	unsigned int id_;
+	bool hold_;
+	FrameBuffer *held_;
+	unsigned int received_;
+};
+
+class StreamFanoutTest : public CameraTest, public Test
+{
+public:
+	StreamFanoutTest()
+		: CameraTest("VIMC Sensor B"), running_(false), released_(0)
+	{
+	}
+
+protected:
+	void requestReleased(Request *request)
+	{
+		released_++;
+
+		if (!running_)
+			return;
+
+		request->reuse();
+		fanout_->queueRequest(request);
+	}
+
+	int init() override
+	{
+		if (status_ != TestPass)
+			return status_;
+
+		config_ = camera_->generateConfiguration({ StreamRole::VideoRecording });
+		if (!config_ || config_->size() != 1) {
+			cout << "Failed to generate default configuration" << endl;
+			return TestFail;
+		}
+
+		allocator_ = FrameBufferAllocator::create(camera_);
+
+		return TestPass;
+	}
+
+	void cleanup() override
+	{
+		delete allocator_;
+	}
+
+	int run() override
+	{
+		if (camera_->acquire()) {
+			cout << "Failed to acquire the camera" << endl;
+			return TestFail;
+		}
+
+		if (camera_->configure(config_.get())) {
+			cout << "Failed to set default configuration" << endl;
+			return TestFail;
+		}
+
+		Stream *stream = config_->at(0).stream();
+		if (allocator_->allocate(stream) < 0)
+			return TestFail;
+
+		StreamFanout fanout(camera_, stream);
+		fanout.requestReleased.connect(this, &StreamFanoutTest::requestReleased);
+		fanout_ = &fanout;
+
+		Consumer encoder(&fanout, "encoder", false);
+		Consumer preview(&fanout, "preview", true);
+
+		if (camera_->start()) {
+			cout << "Failed to start camera" << endl;
+			return TestFail;
+		}
+
+		running_ = true;
+
+		std::vector<std::unique_ptr<Request>> requests;
+		for (const std::unique_ptr<FrameBuffer> &buffer : allocator_->buffers(stream)) {
+			std::unique_ptr<Request> request = camera_->createRequest();
+			request->addBuffer(stream, buffer.get());
+
+			if (fanout.queueRequest(request.get())) {
+				cout << "Failed to queue request" << endl;
+				return TestFail;
+			}
+
+			requests.push_back(std::move(request));
+		}
+
+		EventDispatcher *dispatcher = cm_->eventDispatcher();
+
+		Timer timer;
+		timer.start(1000);
+		while (timer.isRunning())
+			dispatcher->processEvents();
+
+		running_ = false;
+
+		if (camera_->stop()) {
+			cout << "Failed to stop camera" << endl;
+			return TestFail;
+		}
+
+		/*
+		 * The preview consumer holds one buffer, whose request is only
+		 * released once the consumer returns it.
+		 */
+		unsigned int released = released_;
+		preview.flush();
+		if (released_ != released + 1) {
+			cout << "Held request not released by the last consumer" << endl;
+			return TestFail;
+		}
+
+		unsigned int nbuffers = allocator_->buffers(stream).size();
+		if (encoder.received() <= nbuffers * 2 ||
+		    encoder.received() != preview.received()) {
+			cout << "Invalid number of buffers delivered ("
+			     << encoder.received() << ", " << preview.received()
+			     << ")" << endl;
+			return TestFail;
+		}
+
+		std::vector<StreamFanout::ConsumerStatistics> stats = fanout.statistics();
+		if (stats.size() != 2 || stats[0].name != "preview" ||
+		    stats[0].held || stats[0].buffers != preview.received()) {
+			cout << "Invalid consumer statistics" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+	std::unique_ptr<CameraConfiguration> config_;
+	FrameBufferAllocator *allocator_;
+	StreamFanout *fanout_;
+	bool running_;
+
+	unsigned int released_;
+};
+
+} /* namespace */
+
+TEST_REGISTER(StreamFanoutTest);
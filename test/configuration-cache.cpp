@@ -0,0 +1,133 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * configuration-cache.cpp - ConfigurationCache tests
+ */
+
+#include <iostream>
+#include <vector>
+
+#include <linux/drm_fourcc.h>
+
+#include "configuration_cache.h"
+
+#include "test.h"
+
+using namespace std;
+using namespace libcamera;
+
+class ConfigurationCacheTest : public Test
+{
+protected:
+	static vector<StreamConfiguration> config(unsigned int width,
+						  unsigned int height)
+	{
+		vector<StreamConfiguration> config(1);
+		config[0].pixelFormat = DRM_FORMAT_YUYV;
+		config[0].size = { width, height };
+		config[0].bufferCount = 0;
+
+		return config;
+	}
+
+	int run()
+	{
+		ConfigurationCache cache(2);
+		ConfigurationCache::Result result;
+		Stream stream;
+
+		vector<StreamConfiguration> request = config(640, 480);
+		if (cache.find(request, &result)) {
+			cerr << "Lookup in empty cache succeeded" << endl;
+			return TestFail;
+		}
+
+		vector<StreamConfiguration> validated = config(640, 480);
+		validated[0].pixelFormat = DRM_FORMAT_NV12;
+		validated[0].bufferCount = 4;
+
+		result.status = CameraConfiguration::Adjusted;
+		result.sensorFormat = { 0x3007, { 1920, 1080 } };
+		result.streams = { &stream };
+		cache.insert(request, validated, result);
+
+		/* A hit must replay the adjustments and restore the result. */
+		result = {};
+		if (!cache.find(request, &result)) {
+			cerr << "Cached configuration not found" << endl;
+			return TestFail;
+		}
+
+		if (request[0].pixelFormat != DRM_FORMAT_NV12 ||
+		    request[0].size != Size(640, 480) ||
+		    request[0].bufferCount != 4) {
+			cerr << "Cached adjustments not applied" << endl;
+			return TestFail;
+		}
+
+		if (result.status != CameraConfiguration::Adjusted ||
+		    result.sensorFormat.size != Size(1920, 1080) ||
+		    result.streams.size() != 1 || result.streams[0] != &stream) {
+			cerr << "Cached result not restored" << endl;
+			return TestFail;
+		}
+
+		/* Any difference in the request must miss. */
+		request = config(640, 480);
+		request[0].bufferCount = 2;
+		if (cache.find(request, &result)) {
+			cerr << "Different buffer count matched" << endl;
+			return TestFail;
+		}
+
+		request = config(640, 480);
+		request[0].direction = StreamConfiguration::Input;
+		if (cache.find(request, &result)) {
+			cerr << "Different direction matched" << endl;
+			return TestFail;
+		}
+
+		request = config(640, 480);
+		request[0].zslFrames = 4;
+		if (cache.find(request, &result)) {
+			cerr << "Different zero-shutter-lag depth matched" << endl;
+			return TestFail;
+		}
+
+		/* Changing the number of streams must not be cached. */
+		cache.insert(config(320, 240), {}, result);
+		if (cache.size() != 1) {
+			cerr << "Configuration with removed streams cached" << endl;
+			return TestFail;
+		}
+
+		/* The least recently used entry must be evicted. */
+		cache.insert(config(320, 240), config(320, 240), result);
+		request = config(640, 480);
+		cache.find(request, &result);
+		cache.insert(config(160, 120), config(160, 120), result);
+
+		request = config(320, 240);
+		if (cache.size() != 2 || cache.find(request, &result)) {
+			cerr << "Least recently used entry not evicted" << endl;
+			return TestFail;
+		}
+
+		request = config(640, 480);
+		if (!cache.find(request, &result)) {
+			cerr << "Recently used entry evicted" << endl;
+			return TestFail;
+		}
+
+		cache.clear();
+		if (cache.size() || cache.find(request, &result)) {
+			cerr << "Cache not cleared" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+};
+
+TEST_REGISTER(ConfigurationCacheTest)
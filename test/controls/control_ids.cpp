@@ -0,0 +1,66 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * control_ids.cpp - Control ID table lookup tests
+ */
+
+#include <iostream>
+
+#include <libcamera/control_ids.h>
+#include <libcamera/controls.h>
+
+#include "test.h"
+
+using namespace std;
+using namespace libcamera;
+
+class ControlIdsTest : public Test
+{
+protected:
+	int run()
+	{
+		static_assert(controls::index_of<controls::AE_ENABLE>::value == 0,
+			      "Invalid index for AeEnable");
+
+		if (controls::controls.size() != controls::ControlCount) {
+			cout << "Control count mismatch" << endl;
+			return TestFail;
+		}
+
+		/* All controls shall be found by ID and by name. */
+		for (const auto &ctrl : controls::controls) {
+			const ControlId *id = ctrl.second;
+
+			if (controls::find(id->id()) != id) {
+				cout << "Failed to find " << id->name()
+				     << " by ID" << endl;
+				return TestFail;
+			}
+
+			if (controls::find(id->name()) != id) {
+				cout << "Failed to find " << id->name()
+				     << " by name" << endl;
+				return TestFail;
+			}
+		}
+
+		/* Invalid IDs and names shall not be found. */
+		if (controls::find(0U) ||
+		    controls::find(controls::ControlCount + 1) ||
+		    controls::find(0x00980900)) {
+			cout << "Invalid control ID found" << endl;
+			return TestFail;
+		}
+
+		if (controls::find("") || controls::find("Brightnes") ||
+		    controls::find("brightness")) {
+			cout << "Invalid control name found" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+};
+
+TEST_REGISTER(ControlIdsTest)
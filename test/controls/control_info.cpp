@@ -75,6 +75,32 @@ protected:
 			return TestFail;
 		}
 
+		/* Test that iteration visits controls in increasing ID order. */
+		unsigned int prevId = 0;
+		for (const auto &ctrl : info) {
+			if (ctrl.first->id() <= prevId) {
+				cerr << "Controls not sorted by ID" << endl;
+				return TestFail;
+			}
+
+			prevId = ctrl.first->id();
+		}
+
+		/* Test that copies share the contents of the original map. */
+		ControlInfoMap copy = info;
+		if (&copy.idmap() != &info.idmap() ||
+		    &copy.at(&controls::Brightness) != &info.at(&controls::Brightness)) {
+			cerr << "Copied map doesn't share contents" << endl;
+			return TestFail;
+		}
+
+		/* Test an empty map. */
+		ControlInfoMap empty;
+		if (!empty.empty() || empty.find(controls::Brightness.id()) != empty.end()) {
+			cerr << "Empty map lookup failed" << endl;
+			return TestFail;
+		}
+
 		return TestPass;
 	}
 };
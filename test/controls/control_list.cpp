@@ -138,6 +138,16 @@ protected:
 			return TestFail;
 		}
 
+		/* Verify that iteration visits controls in increasing ID order. */
+		unsigned int prevId = 0;
+		for (const auto &ctrl : list) {
+			if (ctrl.first < prevId) {
+				cout << "List iteration not sorted by ID" << endl;
+				return TestFail;
+			}
+			prevId = ctrl.first;
+		}
+
 		/*
 		 * Attempt to set an invalid control and verify that the
 		 * operation failed.
@@ -149,6 +159,46 @@ protected:
 			return TestFail;
 		}
 
+		/* Validate values against the camera control ranges. */
+		const ControlRange &brightness =
+			camera_->controls().at(&controls::Brightness);
+
+		if (!validator.validate(list)) {
+			cout << "Valid list failed validation" << endl;
+			return TestFail;
+		}
+
+		if (validator.validate(controls::BRIGHTNESS, ControlValue(true))) {
+			cout << "Value of invalid type passed validation" << endl;
+			return TestFail;
+		}
+
+		list.set(controls::Brightness,
+			 brightness.max().get<int32_t>() + 1);
+
+		if (validator.validate(controls::BRIGHTNESS,
+				       list.get(controls::BRIGHTNESS)) ||
+		    validator.validate(list)) {
+			cout << "Out of range value passed validation" << endl;
+			return TestFail;
+		}
+
+		/*
+		 * Setting a control to a value stored in the same list must
+		 * work when the list storage is reallocated.
+		 */
+		ControlList ids;
+		ids.set(1, ControlValue(static_cast<int32_t>(42)));
+		for (unsigned int id = 2; id < 64; ++id)
+			ids.set(id, ids.get(1));
+
+		for (unsigned int id = 2; id < 64; ++id) {
+			if (ids.get(id).get<int32_t>() != 42) {
+				cout << "Invalid value copied from the list" << endl;
+				return TestFail;
+			}
+		}
+
 		return TestPass;
 	}
 };
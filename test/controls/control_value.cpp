@@ -5,6 +5,8 @@
  * control_value.cpp - ControlValue tests
  */
 
+#include <algorithm>
+#include <array>
 #include <iostream>
 
 #include <libcamera/controls.h>
@@ -62,6 +64,94 @@ protected:
 			return TestFail;
 		}
 
+		/* Test the byte and float types. */
+		value.set<uint8_t>(42);
+		if (value.type() != ControlTypeByte || value.get<uint8_t>() != 42) {
+			cerr << "Failed to get Byte" << endl;
+			return TestFail;
+		}
+
+		value.set<float>(0.5f);
+		if (value.type() != ControlTypeFloat || value.get<float>() != 0.5f) {
+			cerr << "Failed to get Float" << endl;
+			return TestFail;
+		}
+
+		/* Test a small array, stored inline. */
+		const std::array<float, 2> gains{ { 1.5f, 2.25f } };
+		value.set(Span<const float>(gains));
+		if (!value.isArray() || value.numElements() != gains.size() ||
+		    value.type() != ControlTypeFloat) {
+			cerr << "Failed to set float array" << endl;
+			return TestFail;
+		}
+
+		Span<const float> gainsSpan = value.get<Span<const float>>();
+		if (gainsSpan.size() != gains.size() ||
+		    gainsSpan[0] != gains[0] || gainsSpan[1] != gains[1]) {
+			cerr << "Failed to get float array" << endl;
+			return TestFail;
+		}
+
+		/* Test a large array, and sharing of its data between copies. */
+		std::array<int32_t, 9> ccm;
+		for (unsigned int i = 0; i < ccm.size(); ++i)
+			ccm[i] = i * 100 - 400;
+
+		ControlValue matrix{ Span<const int32_t>(ccm) };
+		ControlValue copy = matrix;
+
+		Span<const int32_t> matrixSpan = matrix.get<Span<const int32_t>>();
+		Span<const int32_t> copySpan = copy.get<Span<const int32_t>>();
+		if (matrixSpan.size() != ccm.size() ||
+		    !std::equal(ccm.begin(), ccm.end(), matrixSpan.begin())) {
+			cerr << "Failed to get integer array" << endl;
+			return TestFail;
+		}
+
+		if (copySpan.data() != matrixSpan.data() || copy != matrix) {
+			cerr << "Array copy doesn't share data" << endl;
+			return TestFail;
+		}
+
+		cout << "Array: " << matrix.toString() << endl;
+
+		/* Updating a value must not affect copies. */
+		matrix.set<int32_t>(1);
+		if (copy.get<Span<const int32_t>>()[8] != ccm[8] ||
+		    matrix.get<int32_t>() != 1) {
+			cerr << "Updating array affected its copy" << endl;
+			return TestFail;
+		}
+
+		/* Test values stored outside of the ControlValue. */
+		Rectangle crop{ 16, 8, 640, 480 };
+		ControlValue rect(crop);
+		if (rect.type() != ControlTypeRectangle || rect.isArray() ||
+		    rect.get<Rectangle>() != crop) {
+			cerr << "Failed to get rectangle" << endl;
+			return TestFail;
+		}
+
+		ControlValue rectCopy = rect;
+		crop.w = 320;
+		rect.set(crop);
+		if (rect.get<Rectangle>().w != 320 ||
+		    rectCopy.get<Rectangle>().w != 640) {
+			cerr << "Updating rectangle affected its copy" << endl;
+			return TestFail;
+		}
+
+		cout << "Rectangle: " << rect.toString() << endl;
+
+		/* Setting a value from its own data must be supported. */
+		copy.set(copy.get<Span<const int32_t>>().subspan(1));
+		if (copy.numElements() != ccm.size() - 1 ||
+		    copy.get<Span<const int32_t>>()[0] != ccm[1]) {
+			cerr << "Failed to set array from its own data" << endl;
+			return TestFail;
+		}
+
 		return TestPass;
 	}
 };
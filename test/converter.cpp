@@ -0,0 +1,217 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * converter.cpp - Format converter test
+ */
+
+#include <array>
+#include <iostream>
+#include <map>
+#include <linux/drm_fourcc.h>
+
+#include <libcamera/buffer.h>
+#include <libcamera/event_dispatcher.h>
+#include <libcamera/stream.h>
+#include <libcamera/timer.h>
+
+#include "converter.h"
+#include "device_enumerator.h"
+#include "media_device.h"
+#include "thread.h"
+#include "v4l2_videodevice.h"
+
+#include "test.h"
+
+using namespace std;
+using namespace libcamera;
+
+class ConverterTest : public Test
+{
+public:
+	ConverterTest()
+		: source_(nullptr), frames_(0)
+	{
+	}
+
+protected:
+	void inputBufferReady(FrameBuffer *buffer)
+	{
+		bufferDone(buffer, buffer);
+	}
+
+	void outputBufferReady(FrameBuffer *buffer)
+	{
+		bufferDone(inputs_[buffer], buffer);
+	}
+
+	/*
+	 * Requeue the input and output buffers for a frame once the input and
+	 * both outputs have completed.
+	 */
+	void bufferDone(FrameBuffer *input, FrameBuffer *buffer)
+	{
+		if (buffer->metadata().status != FrameMetadata::FrameSuccess)
+			return;
+
+		if (--pending_[input])
+			return;
+
+		frames_++;
+		queueFrame(input);
+	}
+
+	int queueFrame(FrameBuffer *input)
+	{
+		pending_[input] = 3;
+		return converter_->queueBuffers(input, { { 0, outputs_[input][0] },
+							 { 1, outputs_[input][1] } });
+	}
+
+	int init() override
+	{
+		enumerator_ = DeviceEnumerator::create();
+		if (!enumerator_) {
+			cerr << "Failed to create device enumerator" << endl;
+			return TestFail;
+		}
+
+		if (enumerator_->enumerate()) {
+			cerr << "Failed to enumerate media devices" << endl;
+			return TestFail;
+		}
+
+		DeviceMatch dm("vim2m");
+		dm.add("vim2m-source");
+		dm.add("vim2m-sink");
+
+		media_ = enumerator_->search(dm);
+		if (!media_) {
+			cerr << "No vim2m device found" << endl;
+			return TestSkip;
+		}
+
+		return TestPass;
+	}
+
+	int run() override
+	{
+		constexpr unsigned int bufferCount = 4;
+		EventDispatcher *dispatcher = Thread::current()->eventDispatcher();
+
+		converter_ = std::make_unique<Converter>(media_.get());
+		if (converter_->open()) {
+			cerr << "Failed to open converter" << endl;
+			return TestFail;
+		}
+
+		std::vector<PixelFormat> formats = converter_->formats(DRM_FORMAT_YUYV);
+		if (formats.empty()) {
+			cerr << "No output format for YUYV input" << endl;
+			return TestFail;
+		}
+
+		SizeRange sizes = converter_->sizes(Size(640, 480));
+		if (!sizes.contains(Size(640, 480))) {
+			cerr << "Invalid output sizes " << sizes.toString() << endl;
+			return TestFail;
+		}
+
+		/* Convert the input to two outputs with different formats. */
+		StreamConfiguration inputCfg;
+		inputCfg.pixelFormat = DRM_FORMAT_YUYV;
+		inputCfg.size = Size(640, 480);
+		inputCfg.bufferCount = bufferCount;
+
+		StreamConfiguration outputCfgs[2];
+		outputCfgs[0] = inputCfg;
+		outputCfgs[1] = inputCfg;
+		outputCfgs[1].pixelFormat = formats.back();
+
+		if (converter_->configure(inputCfg, { outputCfgs[0], outputCfgs[1] })) {
+			cerr << "Failed to configure converter" << endl;
+			return TestFail;
+		}
+
+		for (unsigned int i = 0; i < 2; ++i) {
+			if (converter_->exportBuffers(i, bufferCount, &outputBuffers_[i]) < 0) {
+				cerr << "Failed to export output buffers" << endl;
+				return TestFail;
+			}
+		}
+
+		/* Allocate the input buffers from a separate vim2m context. */
+		MediaEntity *entity = media_->getEntityByName("vim2m-source");
+		source_ = new V4L2M2MDevice(entity->deviceNode());
+		if (source_->open()) {
+			cerr << "Failed to open source device" << endl;
+			return TestFail;
+		}
+
+		V4L2DeviceFormat format = {};
+		format.fourcc = V4L2_PIX_FMT_YUYV;
+		format.size = inputCfg.size;
+		if (source_->capture()->setFormat(&format) ||
+		    source_->capture()->exportBuffers(bufferCount, &inputBuffers_) < 0) {
+			cerr << "Failed to allocate input buffers" << endl;
+			return TestFail;
+		}
+
+		converter_->inputBufferReady.connect(this, &ConverterTest::inputBufferReady);
+		converter_->outputBufferReady.connect(this, &ConverterTest::outputBufferReady);
+
+		if (converter_->start()) {
+			cerr << "Failed to start converter" << endl;
+			return TestFail;
+		}
+
+		for (unsigned int i = 0; i < bufferCount; ++i) {
+			FrameBuffer *input = inputBuffers_[i].get();
+			outputs_[input][0] = outputBuffers_[0][i].get();
+			outputs_[input][1] = outputBuffers_[1][i].get();
+			inputs_[outputs_[input][0]] = input;
+			inputs_[outputs_[input][1]] = input;
+
+			if (queueFrame(input)) {
+				cerr << "Failed to queue buffers" << endl;
+				return TestFail;
+			}
+		}
+
+		Timer timeout;
+		timeout.start(5000);
+		while (timeout.isRunning() && frames_ < 30)
+			dispatcher->processEvents();
+
+		converter_->stop();
+
+		if (frames_ < 30) {
+			cerr << "Failed to convert 30 frames within timeout" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+	void cleanup() override
+	{
+		converter_.reset();
+		delete source_;
+	}
+
+private:
+	std::unique_ptr<DeviceEnumerator> enumerator_;
+	std::shared_ptr<MediaDevice> media_;
+	std::unique_ptr<Converter> converter_;
+	V4L2M2MDevice *source_;
+
+	std::vector<std::unique_ptr<FrameBuffer>> inputBuffers_;
+	std::vector<std::unique_ptr<FrameBuffer>> outputBuffers_[2];
+	std::map<FrameBuffer *, std::array<FrameBuffer *, 2>> outputs_;
+	std::map<FrameBuffer *, FrameBuffer *> inputs_;
+	std::map<FrameBuffer *, unsigned int> pending_;
+
+	unsigned int frames_;
+};
+
+TEST_REGISTER(ConverterTest)
@@ -0,0 +1,244 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * delayed_controls.cpp - DelayedControls tests
+ */
+
+#include <errno.h>
+#include <iostream>
+#include <memory>
+
+#include <linux/videodev2.h>
+
+#include "delayed_controls.h"
+#include "device_enumerator.h"
+#include "media_device.h"
+#include "v4l2_videodevice.h"
+
+#include "test.h"
+
+using namespace std;
+using namespace libcamera;
+
+class DelayedControlsTest : public Test
+{
+protected:
+	int init() override
+	{
+		enumerator_ = DeviceEnumerator::create();
+		if (!enumerator_) {
+			cerr << "Failed to create device enumerator" << endl;
+			return TestFail;
+		}
+
+		if (enumerator_->enumerate()) {
+			cerr << "Failed to enumerate media devices" << endl;
+			return TestFail;
+		}
+
+		DeviceMatch dm("vivid");
+		dm.add("vivid-000-vid-cap");
+
+		media_ = enumerator_->search(dm);
+		if (!media_) {
+			cerr << "No vivid video device found" << endl;
+			return TestSkip;
+		}
+
+		dev_ = V4L2VideoDevice::fromEntityName(media_.get(), "vivid-000-vid-cap");
+		if (dev_->open())
+			return TestFail;
+
+		const ControlInfoMap &infoMap = dev_->controls();
+		if (infoMap.find(V4L2_CID_BRIGHTNESS) == infoMap.end() ||
+		    infoMap.find(V4L2_CID_CONTRAST) == infoMap.end()) {
+			cerr << "Missing controls" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+	int readControl(unsigned int id)
+	{
+		ControlList ctrls(dev_->controls());
+		ctrls.set(id, 0);
+		if (dev_->getControls(&ctrls))
+			return -1;
+
+		return ctrls.get(id).get<int32_t>();
+	}
+
+	int singleControlNoDelay()
+	{
+		DelayedControls delayed(dev_, { { V4L2_CID_BRIGHTNESS, 0 } });
+		ControlList ctrls(dev_->controls());
+
+		for (uint32_t frame = 0; frame < 16; frame++) {
+			ctrls.set(V4L2_CID_BRIGHTNESS, static_cast<int32_t>(10 + frame));
+			delayed.push(frame, ctrls);
+
+			delayed.applyControls(frame);
+
+			int32_t value = delayed.get(frame).get(V4L2_CID_BRIGHTNESS).get<int32_t>();
+			if (value != static_cast<int32_t>(10 + frame) ||
+			    readControl(V4L2_CID_BRIGHTNESS) != value) {
+				cerr << "Failed single control without delay, frame "
+				     << frame << ", value " << value << endl;
+				return TestFail;
+			}
+		}
+
+		return TestPass;
+	}
+
+	int singleControlWithDelay()
+	{
+		ControlList ctrls(dev_->controls());
+		ctrls.set(V4L2_CID_BRIGHTNESS, 4);
+		dev_->setControls(&ctrls);
+
+		DelayedControls delayed(dev_, { { V4L2_CID_BRIGHTNESS, 1 } });
+
+		/* Queue the controls ahead, as a closed loop algorithm would. */
+		for (uint32_t frame = 2; frame < 18; frame++) {
+			ctrls.set(V4L2_CID_BRIGHTNESS, static_cast<int32_t>(20 + frame));
+			delayed.push(frame, ctrls);
+		}
+
+		for (uint32_t frame = 0; frame < 16; frame++) {
+			delayed.applyControls(frame);
+
+			/* The control written at frame N applies to frame N + 1. */
+			int32_t expected = frame < 2 ? 4 : 20 + frame;
+			int32_t written = frame < 1 ? 4 : 21 + frame;
+			int32_t value = delayed.get(frame).get(V4L2_CID_BRIGHTNESS).get<int32_t>();
+			if (value != expected ||
+			    readControl(V4L2_CID_BRIGHTNESS) != written) {
+				cerr << "Failed single control with delay, frame "
+				     << frame << ", value " << value << endl;
+				return TestFail;
+			}
+		}
+
+		return TestPass;
+	}
+
+	int dualControlsWithDelay()
+	{
+		ControlList ctrls(dev_->controls());
+		ctrls.set(V4L2_CID_BRIGHTNESS, 4);
+		ctrls.set(V4L2_CID_CONTRAST, 4);
+		dev_->setControls(&ctrls);
+
+		DelayedControls delayed(dev_, { { V4L2_CID_BRIGHTNESS, 1 },
+						 { V4L2_CID_CONTRAST, 2 } });
+
+		for (uint32_t frame = 2; frame < 18; frame++) {
+			ctrls.set(V4L2_CID_BRIGHTNESS, static_cast<int32_t>(30 + frame));
+			ctrls.set(V4L2_CID_CONTRAST, static_cast<int32_t>(30 + frame));
+			delayed.push(frame, ctrls);
+		}
+
+		for (uint32_t frame = 0; frame < 16; frame++) {
+			delayed.applyControls(frame);
+
+			/* Both controls take effect on the same frame. */
+			ControlList result = delayed.get(frame);
+			int32_t brightness = result.get(V4L2_CID_BRIGHTNESS).get<int32_t>();
+			int32_t contrast = result.get(V4L2_CID_CONTRAST).get<int32_t>();
+			int32_t expected = frame < 2 ? 4 : 30 + frame;
+			if (brightness != expected || contrast != expected) {
+				cerr << "Failed dual controls, frame " << frame
+				     << ", brightness " << brightness
+				     << ", contrast " << contrast << endl;
+				return TestFail;
+			}
+		}
+
+		return TestPass;
+	}
+
+	int lateControls()
+	{
+		ControlList ctrls(dev_->controls());
+		ctrls.set(V4L2_CID_BRIGHTNESS, 4);
+		ctrls.set(V4L2_CID_CONTRAST, 4);
+		dev_->setControls(&ctrls);
+
+		DelayedControls delayed(dev_, { { V4L2_CID_BRIGHTNESS, 1 },
+						 { V4L2_CID_CONTRAST, 2 } });
+
+		delayed.applyControls(0);
+		delayed.applyControls(1);
+
+		/*
+		 * Controls for frame 2 pushed after the start of frame 1 can't
+		 * take effect before frame 4.
+		 */
+		ctrls.set(V4L2_CID_BRIGHTNESS, 50);
+		ctrls.set(V4L2_CID_CONTRAST, 50);
+		delayed.push(2, ctrls);
+
+		for (uint32_t frame = 2; frame < 8; frame++) {
+			delayed.applyControls(frame);
+
+			ControlList result = delayed.get(frame);
+			int32_t brightness = result.get(V4L2_CID_BRIGHTNESS).get<int32_t>();
+			int32_t contrast = result.get(V4L2_CID_CONTRAST).get<int32_t>();
+			int32_t expected = frame < 4 ? 4 : 50;
+			if (brightness != expected || contrast != expected) {
+				cerr << "Failed late controls, frame " << frame
+				     << ", brightness " << brightness
+				     << ", contrast " << contrast << endl;
+				return TestFail;
+			}
+		}
+
+		/* Controls not managed by the instance are rejected. */
+		ControlList invalid(dev_->controls());
+		invalid.set(V4L2_CID_SATURATION, 10);
+		if (delayed.push(10, invalid) != -EINVAL) {
+			cerr << "Unmanaged control accepted" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+	int run() override
+	{
+		int ret;
+
+		ret = singleControlNoDelay();
+		if (ret)
+			return ret;
+
+		ret = singleControlWithDelay();
+		if (ret)
+			return ret;
+
+		ret = dualControlsWithDelay();
+		if (ret)
+			return ret;
+
+		ret = lateControls();
+		if (ret)
+			return ret;
+
+		return TestPass;
+	}
+
+	void cleanup() override
+	{
+		delete dev_;
+	}
+
+private:
+	std::unique_ptr<DeviceEnumerator> enumerator_;
+	std::shared_ptr<MediaDevice> media_;
+	V4L2VideoDevice *dev_ = nullptr;
+};
+
+TEST_REGISTER(DelayedControlsTest)
@@ -0,0 +1,200 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * device-cache.cpp - Persistent device cache tests
+ */
+
+#include <fcntl.h>
+#include <iostream>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <linux/media-bus-format.h>
+
+#include "device_cache.h"
+
+#include "test.h"
+
+using namespace std;
+using namespace libcamera;
+
+class DeviceCacheTest : public Test
+{
+protected:
+	int init() override
+	{
+		char path[] = "/tmp/libcamera.device-cache.XXXXXX";
+		int fd = mkstemp(path);
+		if (fd < 0) {
+			cerr << "Failed to create temporary file" << endl;
+			return TestFail;
+		}
+
+		close(fd);
+		path_ = path;
+
+		return TestPass;
+	}
+
+	void cleanup() override
+	{
+		unlink(path_.c_str());
+	}
+
+	static DeviceCache::Topology topology()
+	{
+		DeviceCache::Topology topology;
+		topology.version = 42;
+
+		topology.entities.resize(2);
+		topology.entities[0].id = 1;
+		strcpy(topology.entities[0].name, "sensor");
+		topology.entities[1].id = 3;
+		strcpy(topology.entities[1].name, "capture");
+
+		topology.interfaces.resize(1);
+		topology.interfaces[0].id = 5;
+
+		topology.pads.resize(2);
+		topology.pads[0] = { 2, 1, MEDIA_PAD_FL_SOURCE, 0, {} };
+		topology.pads[1] = { 4, 3, MEDIA_PAD_FL_SINK, 0, {} };
+
+		topology.links.resize(1);
+		topology.links[0] = { 6, 2, 4, MEDIA_LNK_FL_ENABLED, {} };
+
+		return topology;
+	}
+
+	static ImageFormats formats()
+	{
+		ImageFormats formats;
+		formats.addFormat(MEDIA_BUS_FMT_SBGGR10_1X10,
+				  { SizeRange(640, 480), SizeRange(1920, 1080) });
+		formats.addFormat(MEDIA_BUS_FMT_SGRBG8_1X8,
+				  { SizeRange(32, 32, 4096, 3072, 2, 2) });
+		return formats;
+	}
+
+	int testRoundTrip()
+	{
+		DeviceCache cache(path_);
+		std::shared_ptr<DeviceCache::Entry> entry = cache.entry("vimc:0");
+		if (entry->topology() || entry->formats("subdev:sensor:0")) {
+			cerr << "New entry isn't empty" << endl;
+			return TestFail;
+		}
+
+		entry->setTopology(topology());
+		entry->setFormats("subdev:sensor:0", formats());
+		cache.entry("uvcvideo:0")->setTopology(topology());
+
+		if (cache.save() < 0) {
+			cerr << "Failed to save cache" << endl;
+			return TestFail;
+		}
+
+		DeviceCache loaded(path_);
+		if (loaded.load() < 0) {
+			cerr << "Failed to load cache" << endl;
+			return TestFail;
+		}
+
+		entry = loaded.entry("vimc:0");
+		const DeviceCache::Topology *cached = entry->topology();
+		DeviceCache::Topology reference = topology();
+		if (!cached || cached->version != reference.version ||
+		    cached->entities.size() != 2 || cached->interfaces.size() != 1 ||
+		    cached->pads.size() != 2 || cached->links.size() != 1 ||
+		    strcmp(cached->entities[1].name, "capture") ||
+		    cached->pads[1].entity_id != 3 ||
+		    cached->links[0].sink_id != 4) {
+			cerr << "Invalid cached topology" << endl;
+			return TestFail;
+		}
+
+		const ImageFormats *fmts = entry->formats("subdev:sensor:0");
+		if (!fmts || fmts->data() != formats().data()) {
+			cerr << "Invalid cached formats" << endl;
+			return TestFail;
+		}
+
+		/* Entries that are unused at save time are dropped. */
+		if (loaded.save() < 0) {
+			cerr << "Failed to save cache" << endl;
+			return TestFail;
+		}
+
+		DeviceCache reloaded(path_);
+		reloaded.load();
+		if (!reloaded.entry("vimc:0")->topology() ||
+		    reloaded.entry("uvcvideo:0")->topology()) {
+			cerr << "Unused entry not dropped" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+	int testInvalidation()
+	{
+		/* A new topology drops the formats of the previous one. */
+		DeviceCache cache(path_);
+		std::shared_ptr<DeviceCache::Entry> entry = cache.entry("vimc:0");
+		entry->setFormats("video:capture", formats());
+		entry->setTopology(topology());
+
+		if (entry->formats("video:capture")) {
+			cerr << "Formats not invalidated by topology" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+	int testCorrupted()
+	{
+		DeviceCache cache(path_);
+		cache.entry("vimc:0")->setTopology(topology());
+		cache.save();
+
+		/* Truncate the cache in the middle of the entry. */
+		if (truncate(path_.c_str(), 64) < 0)
+			return TestFail;
+
+		DeviceCache corrupted(path_);
+		if (corrupted.load() != -EINVAL ||
+		    corrupted.entry("vimc:0")->topology()) {
+			cerr << "Corrupted cache accepted" << endl;
+			return TestFail;
+		}
+
+		DeviceCache disabled("");
+		if (disabled.load() || disabled.save()) {
+			cerr << "Disabled cache failed" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+	int run() override
+	{
+		if (testRoundTrip() != TestPass)
+			return TestFail;
+
+		if (testInvalidation() != TestPass)
+			return TestFail;
+
+		if (testCorrupted() != TestPass)
+			return TestFail;
+
+		return TestPass;
+	}
+
+private:
+	std::string path_;
+};
+
+TEST_REGISTER(DeviceCacheTest)
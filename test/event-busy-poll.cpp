@@ -0,0 +1,146 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * event-busy-poll.cpp - Epoll-based event dispatcher busy polling test
+ */
+
+#include <chrono>
+#include <iostream>
+#include <memory>
+#include <thread>
+#include <unistd.h>
+
+#include <libcamera/event_notifier.h>
+#include <libcamera/timer.h>
+
+#include "event_dispatcher_epoll.h"
+#include "test.h"
+#include "thread.h"
+
+using namespace std;
+using namespace libcamera;
+
+class EventBusyPollTest : public Test
+{
+protected:
+	static constexpr unsigned int Events = 40;
+
+	void readReady(EventNotifier *notifier)
+	{
+		char data;
+		if (read(notifier->fd(), &data, 1) == 1)
+			received_++;
+	}
+
+	/* Write to the pipe periodically, as a video device would complete frames. */
+	void writeEvents(chrono::milliseconds interval)
+	{
+		chrono::steady_clock::time_point next = chrono::steady_clock::now();
+
+		for (unsigned int i = 0; i < Events; ++i) {
+			next += interval;
+			this_thread::sleep_until(next);
+
+			char data = i;
+			if (write(pipefd_[1], &data, 1) != 1)
+				return;
+		}
+	}
+
+	int capture(EventDispatcher *dispatcher)
+	{
+		received_ = 0;
+
+		std::thread writer(&EventBusyPollTest::writeEvents, this,
+				   chrono::milliseconds(10));
+
+		Timer timeout;
+		timeout.start(2000);
+		while (timeout.isRunning() && received_ < Events)
+			dispatcher->processEvents();
+
+		writer.join();
+
+		if (received_ != Events) {
+			cout << "Received " << received_ << " events, "
+			     << Events << " expected" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+	int init()
+	{
+		Thread::current()->setEventDispatcher(std::make_unique<EventDispatcherEpoll>());
+
+		return pipe(pipefd_);
+	}
+
+	int run()
+	{
+		EventDispatcherEpoll *dispatcher =
+			dynamic_cast<EventDispatcherEpoll *>(Thread::current()->eventDispatcher());
+		if (!dispatcher) {
+			cout << "Failed to install epoll-based dispatcher" << endl;
+			return TestFail;
+		}
+
+		EventNotifier notifier(pipefd_[0], EventNotifier::Read);
+		notifier.activated.connect(this, &EventBusyPollTest::readReady);
+
+		/* Busy polling is disabled by default. */
+		if (dispatcher->busyPoll() != utils::duration(0)) {
+			cout << "Busy polling enabled by default" << endl;
+			return TestFail;
+		}
+
+		Thread::current()->statistics(true);
+
+		if (capture(dispatcher) != TestPass)
+			return TestFail;
+
+		ThreadStatistics stats = Thread::current()->statistics(true);
+		if (stats.busyPollHits || stats.busyPollMisses ||
+		    stats.busyPollTime != utils::duration(0)) {
+			cout << "Busy polled while disabled" << endl;
+			return TestFail;
+		}
+
+		/*
+		 * Enable busy polling, the periodic events should be caught
+		 * while spinning once their period has been measured.
+		 */
+		dispatcher->setBusyPoll(chrono::milliseconds(2));
+
+		if (capture(dispatcher) != TestPass)
+			return TestFail;
+
+		stats = Thread::current()->statistics(true);
+		if (!stats.busyPollHits || stats.busyPollTime == utils::duration(0)) {
+			cout << "No event caught while busy polling: "
+			     << stats.toString() << endl;
+			return TestFail;
+		}
+
+		if (stats.toString().find("busy poll") == string::npos) {
+			cout << "Busy polling statistics not reported" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+	void cleanup()
+	{
+		close(pipefd_[0]);
+		close(pipefd_[1]);
+	}
+
+private:
+	int pipefd_[2];
+	unsigned int received_;
+};
+
+TEST_REGISTER(EventBusyPollTest)
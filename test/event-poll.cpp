@@ -0,0 +1,106 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * event-poll.cpp - Poll-based event dispatcher test
+ */
+
+#include <iostream>
+#include <memory>
+#include <string.h>
+#include <unistd.h>
+
+#include <libcamera/event_notifier.h>
+#include <libcamera/timer.h>
+
+#include "event_dispatcher_poll.h"
+#include "test.h"
+#include "thread.h"
+
+using namespace std;
+using namespace libcamera;
+
+class EventPollTest : public Test
+{
+protected:
+	void readReady(EventNotifier *notifier)
+	{
+		size_ = read(notifier->fd(), data_, sizeof(data_));
+		notified_ = true;
+	}
+
+	int init()
+	{
+		/*
+		 * The default event dispatcher is epoll-based, install the
+		 * poll-based dispatcher to keep exercising it.
+		 */
+		Thread::current()->setEventDispatcher(std::make_unique<EventDispatcherPoll>());
+
+		return pipe(pipefd_);
+	}
+
+	int run()
+	{
+		EventDispatcher *dispatcher = Thread::current()->eventDispatcher();
+		if (!dynamic_cast<EventDispatcherPoll *>(dispatcher)) {
+			cout << "Failed to install poll-based dispatcher" << endl;
+			return TestFail;
+		}
+
+		std::string data("H2G2");
+		Timer timeout;
+		ssize_t ret;
+
+		EventNotifier readNotifier(pipefd_[0], EventNotifier::Read);
+		readNotifier.activated.connect(this, &EventPollTest::readReady);
+
+		/* Test read notification with data. */
+		memset(data_, 0, sizeof(data_));
+		notified_ = false;
+		size_ = 0;
+
+		ret = write(pipefd_[1], data.data(), data.size());
+		if (ret < 0) {
+			cout << "Pipe write failed" << endl;
+			return TestFail;
+		}
+
+		timeout.start(100);
+		dispatcher->processEvents();
+		timeout.stop();
+
+		if (!notified_ || static_cast<size_t>(size_) != data.size()) {
+			cout << "Event notifier read ready test failed" << endl;
+			return TestFail;
+		}
+
+		/* Test timer expiration without any event. */
+		notified_ = false;
+
+		timeout.start(100);
+		dispatcher->processEvents();
+
+		if (notified_ || timeout.isRunning()) {
+			cout << "Timer expiration test failed" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+	void cleanup()
+	{
+		close(pipefd_[0]);
+		close(pipefd_[1]);
+	}
+
+private:
+	int pipefd_[2];
+
+	bool notified_;
+	char data_[16];
+	ssize_t size_;
+};
+
+TEST_REGISTER(EventPollTest)
@@ -0,0 +1,128 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * ipa_algorithm_test.cpp - Test the IPA algorithms framework
+ */
+
+#include <chrono>
+#include <iostream>
+#include <memory>
+#include <thread>
+
+#include <libipa/algorithm.h>
+
+#include "test.h"
+
+using namespace std;
+using namespace libcamera;
+
+struct Params {
+	unsigned int prepared;
+};
+
+struct Stats {
+	std::chrono::milliseconds load;
+};
+
+class TestAlgorithm : public Algorithm<Params, Stats>
+{
+public:
+	TestAlgorithm(const char *name, bool critical)
+		: name_(name), critical_(critical), processed_(0)
+	{
+	}
+
+	const char *name() const override { return name_; }
+	bool critical() const override { return critical_; }
+
+	void prepare(unsigned int, Params *params) override
+	{
+		params->prepared++;
+	}
+
+	void process(unsigned int, const Stats *stats) override
+	{
+		std::this_thread::sleep_for(stats->load);
+		processed_++;
+	}
+
+	unsigned int processed() const { return processed_; }
+
+private:
+	const char *name_;
+	bool critical_;
+	unsigned int processed_;
+};
+
+class IPAAlgorithmTest : public Test
+{
+protected:
+	int run() override
+	{
+		AlgorithmList<Params, Stats> algorithms;
+		TestAlgorithm *agc = new TestAlgorithm("Agc", true);
+		TestAlgorithm *awb = new TestAlgorithm("Awb", false);
+
+		algorithms.add(std::unique_ptr<TestAlgorithm>(agc));
+		algorithms.add(std::unique_ptr<TestAlgorithm>(awb));
+		algorithms.setBudget(std::chrono::milliseconds(5));
+
+		/* Within budget, all algorithms run for every frame. */
+		Params params = {};
+		Stats stats = { std::chrono::milliseconds(0) };
+		unsigned int frame;
+
+		for (frame = 0; frame < 4; ++frame) {
+			algorithms.prepare(frame, &params);
+			algorithms.process(frame, &stats);
+		}
+
+		if (params.prepared != 8 || agc->processed() != 4 ||
+		    awb->processed() != 4 || algorithms.overruns() != 0) {
+			cerr << "Algorithms not run for every frame" << endl;
+			return TestFail;
+		}
+
+		/* An overrun shall decimate the non-critical algorithms. */
+		stats.load = std::chrono::milliseconds(10);
+		algorithms.process(frame++, &stats);
+
+		if (algorithms.overruns() != 1 || algorithms.decimation() != 2) {
+			cerr << "Budget overrun not detected" << endl;
+			return TestFail;
+		}
+
+		stats.load = std::chrono::milliseconds(0);
+		for (unsigned int i = 0; i < 4; ++i)
+			algorithms.process(frame++, &stats);
+
+		if (agc->processed() != 9 || awb->processed() != 7 ||
+		    algorithms.timing(1).skipped() != 2) {
+			cerr << "Non-critical algorithm not decimated" << endl;
+			return TestFail;
+		}
+
+		/* The decimation shall be lifted once back within budget. */
+		for (unsigned int i = 0; i < 16; ++i)
+			algorithms.process(frame++, &stats);
+
+		if (algorithms.decimation() != 1) {
+			cerr << "Decimation not lifted" << endl;
+			return TestFail;
+		}
+
+		const AlgorithmTiming &timing = algorithms.timing(0);
+		if (timing.count() != 29 ||
+		    timing.max() < std::chrono::milliseconds(10) ||
+		    timing.percentile(0.5) >= std::chrono::milliseconds(10) ||
+		    timing.percentile(1.0) != timing.max()) {
+			cerr << "Invalid timing statistics" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+};
+
+TEST_REGISTER(IPAAlgorithmTest)
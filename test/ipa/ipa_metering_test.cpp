@@ -0,0 +1,160 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * ipa_metering_test.cpp - Test the IPA exposure metering helpers
+ */
+
+#include <iostream>
+#include <math.h>
+#include <string.h>
+
+#include <libipa/metering.h>
+
+#include "test.h"
+
+using namespace std;
+using namespace libcamera;
+
+class IPAMeteringTest : public Test
+{
+protected:
+	static bool near(double a, double b)
+	{
+		return fabs(a - b) < 1e-6;
+	}
+
+	int testGrid()
+	{
+		Metering metering;
+
+		if (metering.configure(0, 5, Metering::MeteringAverage) != -EINVAL) {
+			cerr << "Invalid grid size accepted" << endl;
+			return TestFail;
+		}
+
+		/* A dark 5x5 grid with a bright centre block. */
+		uint8_t grid[25];
+		memset(grid, 10, sizeof(grid));
+		grid[12] = 200;
+
+		metering.configure(5, 5, Metering::MeteringAverage);
+		if (!near(metering.mean(grid), (24 * 10 + 200) / 25.0)) {
+			cerr << "Invalid average metering " << metering.mean(grid)
+			     << endl;
+			return TestFail;
+		}
+
+		/* Blocks at or below the threshold shall be ignored. */
+		metering.setThreshold(10);
+		if (!near(metering.mean(grid), 200)) {
+			cerr << "Threshold not applied" << endl;
+			return TestFail;
+		}
+
+		grid[12] = 10;
+		if (metering.mean(grid) != 0.0) {
+			cerr << "Fully dark grid shall meter to 0" << endl;
+			return TestFail;
+		}
+
+		grid[12] = 200;
+		metering.setThreshold(0);
+
+		metering.configure(5, 5, Metering::MeteringSpot);
+		if (!near(metering.mean(grid), 200)) {
+			cerr << "Invalid spot metering " << metering.mean(grid)
+			     << endl;
+			return TestFail;
+		}
+
+		/* Centre-weighted metering weighs the centre more. */
+		metering.configure(5, 5, Metering::MeteringCentreWeighted);
+		double centre = metering.mean(grid);
+		if (centre <= (24 * 10 + 200) / 25.0 || centre >= 200) {
+			cerr << "Invalid centre-weighted metering " << centre
+			     << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+	int testHistogram()
+	{
+		uint16_t bins[4] = { 0, 0, 0, 0 };
+
+		if (Metering::histogramMean(bins) != 0.0 ||
+		    Metering::histogramQuantile(bins, 0.5) != 0.0) {
+			cerr << "Empty histogram shall return 0" << endl;
+			return TestFail;
+		}
+
+		bins[1] = 10;
+		bins[3] = 10;
+
+		if (!near(Metering::histogramMean(bins), 2.5)) {
+			cerr << "Invalid histogram mean "
+			     << Metering::histogramMean(bins) << endl;
+			return TestFail;
+		}
+
+		if (!near(Metering::histogramQuantile(bins, 0.25), 1.5) ||
+		    !near(Metering::histogramQuantile(bins, 0.5), 2.0) ||
+		    !near(Metering::histogramQuantile(bins, 1.0), 4.0)) {
+			cerr << "Invalid histogram quantile" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+	int testSmoother()
+	{
+		EvSmoother smoother(0.5);
+
+		if (smoother.value() != 0.0) {
+			cerr << "Uninitialized smoother shall return 0" << endl;
+			return TestFail;
+		}
+
+		if (!near(smoother.update(100), 100)) {
+			cerr << "First update shall jump to the target" << endl;
+			return TestFail;
+		}
+
+		/* Half way in EV space, from 100 to 400, is 200. */
+		if (!near(smoother.update(400), 200)) {
+			cerr << "Invalid EV smoothing " << smoother.value() << endl;
+			return TestFail;
+		}
+
+		if (!near(smoother.update(-1), 200)) {
+			cerr << "Invalid target not ignored" << endl;
+			return TestFail;
+		}
+
+		smoother.reset(50);
+		if (!near(smoother.value(), 50)) {
+			cerr << "Failed to reset smoother" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+	int run() override
+	{
+		int ret = testGrid();
+		if (ret != TestPass)
+			return ret;
+
+		ret = testHistogram();
+		if (ret != TestPass)
+			return ret;
+
+		return testSmoother();
+	}
+};
+
+TEST_REGISTER(IPAMeteringTest)
@@ -0,0 +1,121 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * ipa_module_cache_test.cpp - Test the IPA module discovery cache
+ */
+
+#include <iostream>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "ipa_module.h"
+#include "ipa_module_cache.h"
+
+#include "test.h"
+
+using namespace std;
+using namespace libcamera;
+
+class IPAModuleCacheTest : public Test
+{
+protected:
+	int init() override
+	{
+		path_ = "/tmp/libcamera.ipa_module_cache." + to_string(getpid());
+		return TestPass;
+	}
+
+	int run() override
+	{
+		const string libPath = "src/ipa/ipa_vimc.so";
+
+		struct stat st;
+		if (stat(libPath.c_str(), &st) < 0) {
+			cerr << "Failed to stat " << libPath << endl;
+			return TestFail;
+		}
+
+		IPAModule module(libPath);
+		if (!module.isValid()) {
+			cerr << "Failed to parse " << libPath << endl;
+			return TestFail;
+		}
+
+		/* Store the module information and reload it. */
+		IPAModuleCache cache(path_);
+		cache.add(libPath, st, module.info());
+		if (cache.save() < 0) {
+			cerr << "Failed to save cache" << endl;
+			return TestFail;
+		}
+
+		IPAModuleCache loaded(path_);
+		if (loaded.load() < 0) {
+			cerr << "Failed to load cache" << endl;
+			return TestFail;
+		}
+
+		const struct IPAModuleInfo *info = loaded.find(libPath, st);
+		if (!info || memcmp(info, &module.info(), sizeof(*info))) {
+			cerr << "Cached module information mismatch" << endl;
+			return TestFail;
+		}
+
+		/* A cached module shall load without parsing the ELF file. */
+		IPAModule cached(libPath, *info);
+		if (!cached.isValid() || !cached.load()) {
+			cerr << "Failed to load cached module" << endl;
+			return TestFail;
+		}
+
+		/* Modified files shall miss the cache. */
+		struct stat modified = st;
+		modified.st_size++;
+		if (loaded.find(libPath, modified)) {
+			cerr << "Modified module found in cache" << endl;
+			return TestFail;
+		}
+
+		modified = st;
+		modified.st_mtim.tv_nsec ^= 1;
+		if (loaded.find(libPath, modified)) {
+			cerr << "Modified module found in cache" << endl;
+			return TestFail;
+		}
+
+		/* Stale module information shall be caught at load time. */
+		struct IPAModuleInfo stale = *info;
+		stale.pipelineVersion++;
+		IPAModule staleModule(libPath, stale);
+		if (staleModule.load()) {
+			cerr << "Stale module information not detected" << endl;
+			return TestFail;
+		}
+
+		/* A corrupted cache shall be ignored. */
+		if (truncate(path_.c_str(), 20) < 0) {
+			cerr << "Failed to truncate cache" << endl;
+			return TestFail;
+		}
+
+		IPAModuleCache corrupted(path_);
+		if (corrupted.load() >= 0 || corrupted.find(libPath, st)) {
+			cerr << "Corrupted cache not detected" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+	void cleanup() override
+	{
+		unlink(path_.c_str());
+	}
+
+private:
+	string path_;
+};
+
+TEST_REGISTER(IPAModuleCacheTest)
@@ -0,0 +1,89 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * ipa_operations_test.cpp - Test the generated typed IPA operations
+ */
+
+#include <iostream>
+
+#include <ipa/rkisp1.h>
+#include <libcamera/control_ids.h>
+
+#include "test.h"
+
+using namespace std;
+using namespace libcamera;
+
+class IPAOperationsTest : public Test
+{
+protected:
+	int run() override
+	{
+		ControlList sensorControls(controls::controls);
+		sensorControls.set(controls::AeEnable, true);
+
+		/* Round-trip an event with all its fields. */
+		RkISP1EventSignalStatBuffer stat;
+		stat.frame = 42;
+		stat.bufferId = 7;
+		stat.reportAeState = false;
+		stat.sensorControls = &sensorControls;
+
+		IPAOperationData op = stat.pack();
+		if (op.operation != RKISP1_IPA_EVENT_SIGNAL_STAT_BUFFER ||
+		    op.data.size() != RkISP1EventSignalStatBuffer::DataSize ||
+		    op.controls.size() != 1) {
+			cerr << "Invalid packed layout" << endl;
+			return TestFail;
+		}
+
+		RkISP1EventSignalStatBuffer unpacked;
+		if (unpacked.unpack(op)) {
+			cerr << "Failed to unpack event" << endl;
+			return TestFail;
+		}
+
+		if (unpacked.frame != 42 || unpacked.bufferId != 7 ||
+		    unpacked.reportAeState ||
+		    unpacked.sensorControls != &op.controls[0] ||
+		    !unpacked.sensorControls->get(controls::AeEnable)) {
+			cerr << "Invalid unpacked event" << endl;
+			return TestFail;
+		}
+
+		/* Optional trailing fields take their default value. */
+		op.data.resize(RkISP1EventSignalStatBuffer::MinDataSize);
+		op.controls.clear();
+		if (unpacked.unpack(op) || !unpacked.reportAeState ||
+		    unpacked.sensorControls) {
+			cerr << "Invalid defaults for optional fields" << endl;
+			return TestFail;
+		}
+
+		/* Malformed operations shall be rejected. */
+		op.data.resize(1);
+		if (unpacked.unpack(op) != -EINVAL) {
+			cerr << "Truncated event accepted" << endl;
+			return TestFail;
+		}
+
+		RkISP1EventQueueRequest request;
+		if (request.unpack(stat.pack()) != -EINVAL) {
+			cerr << "Mismatched operation accepted" << endl;
+			return TestFail;
+		}
+
+		op = {};
+		op.operation = RKISP1_IPA_EVENT_QUEUE_REQUEST;
+		op.data = { 1, 2 };
+		if (request.unpack(op) != -EINVAL) {
+			cerr << "Event without mandatory controls accepted" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+};
+
+TEST_REGISTER(IPAOperationsTest)
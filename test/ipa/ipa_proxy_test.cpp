@@ -0,0 +1,218 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * ipa_proxy_test.cpp - Test and benchmark the IPA proxies
+ */
+
+#include <chrono>
+#include <iostream>
+#include <memory>
+#include <stdlib.h>
+
+#include <libcamera/control_ids.h>
+#include <libcamera/event_dispatcher.h>
+#include <libcamera/timer.h>
+
+#include "ipa_context_wrapper.h"
+#include "ipa_module.h"
+#include "ipa_proxy.h"
+#include "test.h"
+#include "thread.h"
+
+using namespace libcamera;
+using namespace std;
+
+class IPAProxyTest : public Test
+{
+protected:
+	int init() override
+	{
+		/* Locate the proxy worker in the build tree. */
+		setenv("LIBCAMERA_IPA_PROXY_PATH", "src/libcamera/proxy/worker", 1);
+
+		module_ = make_unique<IPAModule>("src/ipa/ipa_vimc.so");
+		isolated_ = make_unique<IPAModule>("src/ipa/ipa_vimc_isolate.so");
+		if (!module_->isValid() || !isolated_->isValid()) {
+			cerr << "Failed to open vimc IPA modules" << endl;
+			return TestSkip;
+		}
+
+		return TestPass;
+	}
+
+	int run() override
+	{
+		if (!module_->load()) {
+			cerr << "Failed to load vimc IPA module" << endl;
+			return TestFail;
+		}
+
+		IPAContextWrapper local(module_->createContext());
+
+		unique_ptr<IPAProxy> thread = createProxy("IPAProxyThread",
+							  module_.get());
+		if (!thread)
+			return TestFail;
+
+		unique_ptr<IPAProxy> proxy = createProxy("IPAProxyLinux",
+							 isolated_.get());
+		if (!proxy)
+			return TestFail;
+
+		thread->init();
+		proxy->init();
+
+		/* Measure the event round-trip latency in all cases. */
+		double localLatency;
+		double threadLatency;
+		double proxyLatency;
+
+		if (measure(&local, &localLatency) != TestPass)
+			return TestFail;
+
+		if (measure(thread.get(), &threadLatency) != TestPass)
+			return TestFail;
+
+		if (measure(proxy.get(), &proxyLatency) != TestPass)
+			return TestFail;
+
+		cout << "Round-trip latency: in-process " << localLatency
+		     << " us, threaded " << threadLatency
+		     << " us, proxied " << proxyLatency << " us" << endl;
+
+		/*
+		 * A second proxy for the same module shall get its own IPA
+		 * context in the worker of the first proxy, and be functional.
+		 * Its frame actions shall not leak to the first proxy.
+		 */
+		auto begin = chrono::steady_clock::now();
+
+		unique_ptr<IPAProxy> shared = createProxy("IPAProxyLinux",
+							  isolated_.get());
+		if (!shared)
+			return TestFail;
+
+		shared->init();
+
+		strayActions_ = 0;
+		proxy->queueFrameAction.connect(this, &IPAProxyTest::strayFrameAction);
+
+		double sharedLatency;
+		if (measure(shared.get(), &sharedLatency, 1) != TestPass)
+			return TestFail;
+
+		chrono::duration<double, milli> startup =
+			chrono::steady_clock::now() - begin;
+		cout << "Shared proxy startup " << startup.count() << " ms"
+		     << endl;
+
+		proxy->queueFrameAction.disconnect(this, &IPAProxyTest::strayFrameAction);
+
+		if (strayActions_) {
+			cerr << "Frame action delivered to the wrong proxy" << endl;
+			return TestFail;
+		}
+
+		/* The first proxy shall still be functional. */
+		shared.reset();
+
+		if (measure(proxy.get(), &proxyLatency, 1) != TestPass)
+			return TestFail;
+
+		return TestPass;
+	}
+
+private:
+	static constexpr unsigned int Iterations = 1000;
+
+	unique_ptr<IPAProxy> createProxy(const string &name, IPAModule *module)
+	{
+		for (IPAProxyFactory *factory : IPAProxyFactory::factories()) {
+			if (factory->name() != name)
+				continue;
+
+			unique_ptr<IPAProxy> proxy = factory->create(module);
+			if (!proxy->isValid()) {
+				cerr << "Failed to create " << name << endl;
+				return nullptr;
+			}
+
+			return proxy;
+		}
+
+		cerr << name << " not found" << endl;
+		return nullptr;
+	}
+
+	void queueFrameAction(unsigned int frame, const IPAOperationData &data)
+	{
+		received_ = data;
+		done_ = true;
+	}
+
+	void strayFrameAction(unsigned int frame, const IPAOperationData &data)
+	{
+		strayActions_++;
+	}
+
+	int measure(IPAInterface *ipa, double *latency,
+		    unsigned int iterations = Iterations)
+	{
+		EventDispatcher *dispatcher = Thread::current()->eventDispatcher();
+
+		ipa->queueFrameAction.connect(this, &IPAProxyTest::queueFrameAction);
+
+		ControlList controls(controls::controls);
+		IPAOperationData event;
+		event.operation = 1;
+
+		auto begin = chrono::steady_clock::now();
+
+		for (unsigned int i = 0; i < iterations; ++i) {
+			controls.set(controls::Brightness, static_cast<int32_t>(i));
+			event.data = { i, i * 2 };
+			event.controls = { controls };
+
+			done_ = false;
+			ipa->processEvent(event);
+
+			Timer timer;
+			timer.start(1000);
+			while (!done_ && timer.isRunning())
+				dispatcher->processEvents();
+
+			if (!done_) {
+				cerr << "Event " << i << " not echoed" << endl;
+				return TestFail;
+			}
+
+			if (received_.operation != event.operation ||
+			    received_.data != event.data ||
+			    received_.controls.size() != 1 ||
+			    received_.controls[0].get(controls::Brightness) !=
+			    static_cast<int32_t>(i)) {
+				cerr << "Event " << i << " corrupted" << endl;
+				return TestFail;
+			}
+		}
+
+		auto end = chrono::steady_clock::now();
+
+		ipa->queueFrameAction.disconnect(this, &IPAProxyTest::queueFrameAction);
+
+		chrono::duration<double, micro> duration = end - begin;
+		*latency = duration.count() / iterations;
+
+		return TestPass;
+	}
+
+	unique_ptr<IPAModule> module_;
+	unique_ptr<IPAModule> isolated_;
+
+	IPAOperationData received_;
+	bool done_;
+	unsigned int strayActions_;
+};
+
+TEST_REGISTER(IPAProxyTest)
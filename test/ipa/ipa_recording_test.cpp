@@ -0,0 +1,241 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * ipa_recording_test.cpp - Test the IPA statistics recording
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <iostream>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <vector>
+
+#include <linux/drm_fourcc.h>
+#include <linux/v4l2-controls.h>
+
+#include "ipa_recording.h"
+
+#include "test.h"
+
+using namespace std;
+using namespace libcamera;
+
+class IPARecordingTest : public Test
+{
+public:
+	IPARecordingTest()
+		: exposure_(V4L2_CID_EXPOSURE, "Exposure", ControlTypeInteger32),
+		  gain_(V4L2_CID_ANALOGUE_GAIN, "Analogue Gain", ControlTypeInteger32)
+	{
+	}
+
+protected:
+	int init() override
+	{
+		char path[] = "/tmp/libcamera.ipa-recording.XXXXXX";
+		int fd = mkstemp(path);
+		if (fd < 0) {
+			cerr << "Failed to create temporary file" << endl;
+			return TestFail;
+		}
+
+		close(fd);
+		path_ = path;
+
+		ControlInfoMap::Map map;
+		map.emplace(&exposure_, ControlRange(1, 1000));
+		map.emplace(&gain_, ControlRange(1, 16));
+		infoMap_ = std::move(map);
+
+		stream_.pixelFormat = DRM_FORMAT_NV12;
+		stream_.size = Size(1920, 1080);
+
+		return TestPass;
+	}
+
+	void cleanup() override
+	{
+		unlink(path_.c_str());
+	}
+
+	std::vector<uint8_t> stats(unsigned int frame)
+	{
+		/* Vary the size to exercise the record alignment. */
+		std::vector<uint8_t> data(1000 + frame % 7);
+		for (unsigned int i = 0; i < data.size(); ++i)
+			data[i] = frame + i;
+
+		return data;
+	}
+
+	int write(IPARecordingWriter &writer, unsigned int frames)
+	{
+		for (unsigned int frame = 0; frame < frames; ++frame) {
+			ControlList ctrls(infoMap_);
+			ctrls.set(V4L2_CID_EXPOSURE, ControlValue(static_cast<int32_t>(frame)));
+			ctrls.set(V4L2_CID_ANALOGUE_GAIN, ControlValue(static_cast<int32_t>(frame % 16 + 1)));
+
+			std::vector<uint8_t> data = stats(frame);
+			if (writer.write(frame, frame * 33333333ULL, data, ctrls) < 0) {
+				cerr << "Failed to record frame " << frame << endl;
+				return TestFail;
+			}
+		}
+
+		return TestPass;
+	}
+
+	int check(IPARecordingReader &reader, unsigned int frames)
+	{
+		IPARecordingFrame frame;
+
+		for (unsigned int i = 0; i < frames; ++i) {
+			if (reader.next(&frame) < 0) {
+				cerr << "Failed to read frame " << i << endl;
+				return TestFail;
+			}
+
+			std::vector<uint8_t> data = stats(i);
+			if (frame.sequence != i || frame.timestamp != i * 33333333ULL ||
+			    frame.stats.size() != data.size() ||
+			    memcmp(frame.stats.data(), data.data(), data.size())) {
+				cerr << "Invalid data for frame " << i << endl;
+				return TestFail;
+			}
+
+			if (frame.sensorControls.size() != 2 ||
+			    frame.sensorControls.get(V4L2_CID_EXPOSURE).get<int32_t>() != static_cast<int32_t>(i) ||
+			    frame.sensorControls.get(V4L2_CID_ANALOGUE_GAIN).get<int32_t>() != static_cast<int32_t>(i % 16 + 1)) {
+				cerr << "Invalid sensor controls for frame " << i << endl;
+				return TestFail;
+			}
+		}
+
+		if (reader.next(&frame) != -ENODATA) {
+			cerr << "Recording end not detected" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+	int testRoundTrip()
+	{
+		/* Record enough frames to grow the file mapping. */
+		const unsigned int frames = 2000;
+
+		IPARecordingWriter writer;
+		if (writer.open(path_, stream_, infoMap_) < 0) {
+			cerr << "Failed to create recording" << endl;
+			return TestFail;
+		}
+
+		if (write(writer, frames) != TestPass)
+			return TestFail;
+
+		if (writer.frames() != frames) {
+			cerr << "Invalid number of recorded frames" << endl;
+			return TestFail;
+		}
+
+		writer.close();
+
+		IPARecordingReader reader;
+		if (reader.open(path_) < 0) {
+			cerr << "Failed to open recording" << endl;
+			return TestFail;
+		}
+
+		if (reader.stream().pixelFormat != stream_.pixelFormat ||
+		    reader.stream().size != stream_.size) {
+			cerr << "Invalid stream configuration" << endl;
+			return TestFail;
+		}
+
+		const ControlInfoMap &infoMap = reader.sensorControls();
+		auto it = infoMap.find(V4L2_CID_ANALOGUE_GAIN);
+		if (infoMap.size() != 2 || it == infoMap.end() ||
+		    it->second.max().get<int32_t>() != 16) {
+			cerr << "Invalid sensor controls information" << endl;
+			return TestFail;
+		}
+
+		if (check(reader, frames) != TestPass)
+			return TestFail;
+
+		/* Replay the recording a second time. */
+		reader.rewind();
+		return check(reader, frames);
+	}
+
+	int testInterrupted()
+	{
+		/*
+		 * Read the recording while the writer is still open, as left by
+		 * an application that crashed.
+		 */
+		IPARecordingWriter writer;
+		if (writer.open(path_, stream_, infoMap_) < 0) {
+			cerr << "Failed to create recording" << endl;
+			return TestFail;
+		}
+
+		if (write(writer, 3) != TestPass)
+			return TestFail;
+
+		IPARecordingReader reader;
+		if (reader.open(path_) < 0) {
+			cerr << "Failed to open interrupted recording" << endl;
+			return TestFail;
+		}
+
+		return check(reader, 3);
+	}
+
+	int testInvalid()
+	{
+		int fd = ::open(path_.c_str(), O_WRONLY | O_TRUNC);
+		if (fd < 0)
+			return TestFail;
+
+		const char garbage[64] = "not a recording";
+		ssize_t ret = ::write(fd, garbage, sizeof(garbage));
+		close(fd);
+		if (ret != sizeof(garbage))
+			return TestFail;
+
+		IPARecordingReader reader;
+		if (reader.open(path_) != -EINVAL) {
+			cerr << "Invalid recording accepted" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+	int run() override
+	{
+		if (testRoundTrip() != TestPass)
+			return TestFail;
+
+		if (testInterrupted() != TestPass)
+			return TestFail;
+
+		if (testInvalid() != TestPass)
+			return TestFail;
+
+		return TestPass;
+	}
+
+private:
+	ControlId exposure_;
+	ControlId gain_;
+	ControlInfoMap infoMap_;
+	IPAStream stream_;
+	std::string path_;
+};
+
+TEST_REGISTER(IPARecordingTest)
@@ -0,0 +1,233 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * camera_share.cpp - Camera frame sharing test
+ */
+
+#include <iostream>
+#include <memory>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <libcamera/buffer.h>
+#include <libcamera/camera_share.h>
+#include <libcamera/control_ids.h>
+#include <libcamera/event_dispatcher.h>
+#include <libcamera/stream.h>
+#include <libcamera/timer.h>
+
+#include "thread.h"
+#include "test.h"
+
+using namespace std;
+using namespace libcamera;
+
+class ShareClient : public Object
+{
+public:
+	ShareClient(bool hold)
+		: hold_(hold), frames_(0), tag_(0), exposure_(0)
+	{
+		client_.frameReceived.connect(this, &ShareClient::frameReceived);
+	}
+
+	CameraShareClient client_;
+	bool hold_;
+	vector<FrameBuffer *> held_;
+
+	unsigned int frames_;
+	unsigned int tag_;
+	int32_t exposure_;
+
+private:
+	void frameReceived(FrameBuffer *buffer, const ControlList &metadata)
+	{
+		frames_++;
+		exposure_ = metadata.get(controls::ManualExposure);
+
+		/* The buffer memory is shared, not copied. */
+		const FrameBuffer::Plane &plane = buffer->planes()[0];
+		void *mem = mmap(nullptr, plane.length, PROT_READ, MAP_SHARED,
+				 plane.fd.fd(), 0);
+		if (mem != MAP_FAILED) {
+			tag_ = *static_cast<uint8_t *>(mem);
+			munmap(mem, plane.length);
+		}
+
+		if (hold_)
+			held_.push_back(buffer);
+		else
+			client_.release(buffer);
+	}
+};
+
+class CameraShareTest : public Test
+{
+protected:
+	int init() override
+	{
+		dispatcher_ = Thread::current()->eventDispatcher();
+		path_ = "/tmp/libcamera.camera-share." + to_string(getpid());
+
+		for (unsigned int i = 0; i < 2; ++i) {
+			int fd = memfd_create("camera-share-test", 0);
+			if (fd < 0 || ftruncate(fd, 4096) < 0) {
+				cerr << "Failed to allocate buffer" << endl;
+				return TestFail;
+			}
+
+			FrameBuffer::Plane plane;
+			plane.fd = FileDescriptor(fd);
+			plane.length = 4096;
+			close(fd);
+
+			buffers_.push_back(make_unique<FrameBuffer>(vector<FrameBuffer::Plane>{ plane }));
+		}
+
+		return TestPass;
+	}
+
+	void frameReleased(FrameBuffer *buffer)
+	{
+		released_.push_back(buffer);
+	}
+
+	void processEvents(unsigned int msec)
+	{
+		Timer timer;
+		timer.start(msec);
+		while (timer.isRunning())
+			dispatcher_->processEvents();
+	}
+
+	bool queueFrame(CameraShareServer &server, FrameBuffer *buffer,
+			unsigned int sequence)
+	{
+		/* Tag the buffer memory with the sequence number. */
+		const FrameBuffer::Plane &plane = buffer->planes()[0];
+		void *mem = mmap(nullptr, plane.length, PROT_WRITE, MAP_SHARED,
+				 plane.fd.fd(), 0);
+		if (mem == MAP_FAILED)
+			return false;
+		*static_cast<uint8_t *>(mem) = sequence;
+		munmap(mem, plane.length);
+
+		ControlList metadata(controls::controls);
+		metadata.set(controls::ManualExposure,
+			     static_cast<int32_t>(1000 + sequence));
+
+		return server.queueFrame(buffer, metadata);
+	}
+
+	int run() override
+	{
+		CameraShareServer server;
+		server.frameReleased.connect(this, &CameraShareTest::frameReleased);
+
+		if (server.listen(path_)) {
+			cerr << "Failed to listen on " << path_ << endl;
+			return TestFail;
+		}
+
+		/* Frames can't be shared without clients. */
+		if (queueFrame(server, buffers_[0].get(), 0)) {
+			cerr << "Frame shared without clients" << endl;
+			return TestFail;
+		}
+
+		StreamConfiguration cfg;
+		cfg.pixelFormat = 0x56595559; /* YUYV */
+		cfg.size = Size(640, 480);
+		server.configure(cfg);
+
+		ShareClient analytics(false);
+		ShareClient streaming(true);
+
+		if (analytics.client_.connect(path_) ||
+		    streaming.client_.connect(path_)) {
+			cerr << "Failed to connect to server" << endl;
+			return TestFail;
+		}
+
+		processEvents(100);
+
+		if (server.clients() != 2 ||
+		    analytics.client_.pixelFormat() != cfg.pixelFormat ||
+		    analytics.client_.size() != cfg.size) {
+			cerr << "Clients not connected or configured" << endl;
+			return TestFail;
+		}
+
+		for (unsigned int sequence = 1; sequence <= 2; ++sequence) {
+			if (!queueFrame(server, buffers_[sequence - 1].get(), sequence)) {
+				cerr << "Failed to share frame" << endl;
+				return TestFail;
+			}
+		}
+
+		processEvents(100);
+
+		if (analytics.frames_ != 2 || streaming.frames_ != 2 ||
+		    streaming.tag_ != 2 || streaming.exposure_ != 1002) {
+			cerr << "Invalid frames received" << endl;
+			return TestFail;
+		}
+
+		/* Frames are held until all clients release them. */
+		if (!released_.empty()) {
+			cerr << "Frame released while held by a client" << endl;
+			return TestFail;
+		}
+
+		streaming.client_.release(streaming.held_[0]);
+		processEvents(100);
+
+		if (released_.size() != 1 || released_[0] != buffers_[0].get()) {
+			cerr << "Frame not released by the last client" << endl;
+			return TestFail;
+		}
+
+		/* Buffers are only sent once, reuse the first one. */
+		if (!queueFrame(server, buffers_[0].get(), 3)) {
+			cerr << "Failed to share reused frame" << endl;
+			return TestFail;
+		}
+
+		processEvents(100);
+
+		if (analytics.frames_ != 3 || streaming.tag_ != 3) {
+			cerr << "Reused frame not received" << endl;
+			return TestFail;
+		}
+
+		/* Disconnecting a client releases the frames it holds. */
+		streaming.client_.disconnect();
+		processEvents(100);
+
+		if (released_.size() != 3 || server.clients() != 1) {
+			cerr << "Frames not released on disconnection" << endl;
+			return TestFail;
+		}
+
+		server.close();
+		processEvents(100);
+
+		if (analytics.client_.isConnected()) {
+			cerr << "Client still connected after server close" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+private:
+	EventDispatcher *dispatcher_;
+	string path_;
+
+	vector<unique_ptr<FrameBuffer>> buffers_;
+	vector<FrameBuffer *> released_;
+};
+
+TEST_REGISTER(CameraShareTest)
@@ -0,0 +1,136 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * shared_ring.cpp - Shared memory ring IPC test
+ */
+
+#include <iostream>
+#include <string.h>
+#include <unistd.h>
+
+#include "ipc_shared_ring.h"
+#include "test.h"
+
+using namespace std;
+using namespace libcamera;
+
+class SharedRingTest : public Test
+{
+protected:
+	int produce(IPCSharedRing &ring, uint8_t value, size_t size)
+	{
+		Span<uint8_t> record = ring.reserve(size);
+		if (record.size() != size)
+			return -ENOSPC;
+
+		memset(record.data(), value, size);
+		return ring.commit();
+	}
+
+	int consume(IPCSharedRing &ring, uint8_t value, size_t size)
+	{
+		Span<const uint8_t> record = ring.front();
+		if (record.size() != size)
+			return -EINVAL;
+
+		for (uint8_t byte : record) {
+			if (byte != value)
+				return -EINVAL;
+		}
+
+		ring.pop();
+		return 0;
+	}
+
+	int run()
+	{
+		IPCSharedRing producer;
+		IPCSharedRing consumer;
+
+		if (producer.create(1000) < 0) {
+			cerr << "Failed to create ring" << endl;
+			return TestFail;
+		}
+
+		if (producer.capacity() != 1024) {
+			cerr << "Invalid ring capacity " << producer.capacity()
+			     << endl;
+			return TestFail;
+		}
+
+		if (consumer.bind(dup(producer.fd())) < 0) {
+			cerr << "Failed to bind ring" << endl;
+			return TestFail;
+		}
+
+		/* The first commit shall request a doorbell. */
+		if (produce(producer, 1, 100) != 1) {
+			cerr << "First commit didn't request a doorbell" << endl;
+			return TestFail;
+		}
+
+		/* The consumer isn't sleeping, no doorbell is needed. */
+		if (produce(producer, 2, 200) != 0) {
+			cerr << "Unexpected doorbell request" << endl;
+			return TestFail;
+		}
+
+		if (consume(consumer, 1, 100) || consume(consumer, 2, 200)) {
+			cerr << "Failed to consume records" << endl;
+			return TestFail;
+		}
+
+		if (!consumer.front().empty() || !consumer.sleep()) {
+			cerr << "Ring should be empty" << endl;
+			return TestFail;
+		}
+
+		/*
+		 * Fill the ring to test wrap-around. 320 bytes have been used,
+		 * a 500 bytes record fits at the end, the next one wraps.
+		 */
+		if (produce(producer, 3, 500) != 1) {
+			cerr << "Commit after sleep didn't request a doorbell"
+			     << endl;
+			return TestFail;
+		}
+
+		if (produce(producer, 4, 400) != -ENOSPC) {
+			cerr << "Overflow not detected" << endl;
+			return TestFail;
+		}
+
+		if (consume(consumer, 3, 500)) {
+			cerr << "Failed to consume record before wrap" << endl;
+			return TestFail;
+		}
+
+		if (produce(producer, 4, 400) < 0) {
+			cerr << "Failed to produce wrapping record" << endl;
+			return TestFail;
+		}
+
+		if (consume(consumer, 4, 400)) {
+			cerr << "Failed to consume wrapping record" << endl;
+			return TestFail;
+		}
+
+		/* An uncommitted record shall not be visible. */
+		producer.reserve(10);
+		if (!consumer.front().empty()) {
+			cerr << "Uncommitted record is visible" << endl;
+			return TestFail;
+		}
+
+		/* A record larger than the ring shall be rejected. */
+		if (!producer.reserve(2000).empty()) {
+			cerr << "Oversized record accepted" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+};
+
+TEST_REGISTER(SharedRingTest)
@@ -349,15 +349,83 @@ protected:
 		return 0;
 	}
 
+	int testDrain()
+	{
+		IPCUnixSocket sender;
+		IPCUnixSocket receiver;
+		IPCUnixSocket::Payload message;
+		int ret;
+
+		int fd = sender.create(IPCUnixSocket::SeqPacket);
+		if (fd < 0 || receiver.bind(fd))
+			return TestFail;
+
+		if (receiver.type() != IPCUnixSocket::SeqPacket)
+			return TestFail;
+
+		/* Queue several messages and receive them all in one go. */
+		for (uint8_t i = 0; i < 4; i++) {
+			message.data.assign(i + 1, i);
+			if (sender.send(message))
+				return TestFail;
+		}
+
+		unsigned int count = 0;
+		while (!(ret = receiver.receive(&message))) {
+			if (message.data.size() != count + 1u ||
+			    message.data[0] != count)
+				return TestFail;
+			count++;
+		}
+
+		if (ret != -EAGAIN || count != 4)
+			return TestFail;
+
+		/* Oversized messages shall be rejected. */
+		message.data.resize(256 * 1024);
+		if (sender.send(message) != -EMSGSIZE)
+			return TestFail;
+
+		/* Closing the sender shall be reported to the receiver. */
+		sender.close();
+		if (receiver.receive(&message) != -ECONNRESET)
+			return TestFail;
+
+		return 0;
+	}
+
 	int init()
 	{
 		callResponse_ = nullptr;
+		ipc_.readyRead.connect(this, &UnixSocketTest::readyRead);
 		return 0;
 	}
 
 	int run()
 	{
-		int slavefd = ipc_.create();
+		if (runSlave(IPCUnixSocket::Datagram)) {
+			cerr << "Datagram socket test failed" << endl;
+			return TestFail;
+		}
+
+		if (runSlave(IPCUnixSocket::SeqPacket)) {
+			cerr << "SeqPacket socket test failed" << endl;
+			return TestFail;
+		}
+
+		/* Test draining multiple queued packets. */
+		if (testDrain()) {
+			cerr << "Drain test failed" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+private:
+	int runSlave(IPCUnixSocket::Type type)
+	{
+		int slavefd = ipc_.create(type);
 		if (slavefd < 0)
 			return TestFail;
 
@@ -366,7 +434,7 @@ protected:
 			return TestFail;
 		}
 
-		ipc_.readyRead.connect(this, &UnixSocketTest::readyRead);
+		close(slavefd);
 
 		/* Test reversing a string, this test sending only data. */
 		if (testReverse()) {
@@ -415,7 +483,6 @@ protected:
 		return TestPass;
 	}
 
-private:
 	int call(const IPCUnixSocket::Payload &message, IPCUnixSocket::Payload *response)
 	{
 		Timer timeout;
@@ -18,9 +18,17 @@ using namespace libcamera;
 class ListTest : public Test
 {
 protected:
+	void cameraAdded(std::shared_ptr<Camera> camera)
+	{
+		added_++;
+	}
+
 	int init()
 	{
+		added_ = 0;
+
 		cm_ = new CameraManager();
+		cm_->cameraAdded.connect(this, &ListTest::cameraAdded);
 		cm_->start();
 
 		return 0;
@@ -35,6 +43,12 @@ protected:
 			count++;
 		}
 
+		if (count != added_) {
+			cout << "Camera added signal emitted " << added_
+			     << " times for " << count << " cameras" << endl;
+			return TestFail;
+		}
+
 		return count ? 0 : -ENODEV;
 	}
 
@@ -46,6 +60,7 @@ protected:
 
 private:
 	CameraManager *cm_;
+	unsigned int added_;
 };
 
 TEST_REGISTER(ListTest)
@@ -6,6 +6,8 @@
  */
 
 #include <algorithm>
+#include <chrono>
+#include <errno.h>
 #include <fcntl.h>
 #include <iostream>
 #include <list>
@@ -14,6 +16,7 @@
 #include <string.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <thread>
 #include <unistd.h>
 
 #include <libcamera/logging.h>
@@ -115,6 +118,22 @@ protected:
 		return verifyOutput(log);
 	}
 
+	int testAsync()
+	{
+		stringstream log;
+		logSetStream(&log);
+
+		/* Disabling asynchronous logging flushes the queued messages. */
+		logSetAsync(true);
+		doLogging();
+		logSetAsync(false);
+
+		int ret = verifyOutput(log);
+		logSetTarget(LoggingTargetNone);
+
+		return ret;
+	}
+
 	int testTarget()
 	{
 		logSetTarget(LoggingTargetNone);
@@ -130,6 +149,180 @@ protected:
 		return TestPass;
 	}
 
+	int testFiltered()
+	{
+		unsigned int evaluated = 0;
+
+		/* Operands of filtered out messages shall not be evaluated. */
+		logSetLevel("LogAPITest", "WARN");
+		LOG(LogAPITest, Debug) << "bad " << ++evaluated;
+		LOG(LogAPITest, Info) << "bad " << ++evaluated;
+
+		if (evaluated) {
+			cout << "Filtered log message evaluated" << endl;
+			return TestFail;
+		}
+
+		/* The macro shall behave as a single statement. */
+		if (evaluated)
+			LOG(LogAPITest, Error) << "bad";
+		else
+			evaluated++;
+
+		if (evaluated != 1) {
+			cout << "LOG() macro is not a single statement" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+	int testRateLimited()
+	{
+		stringstream log;
+		logSetStream(&log);
+		logSetLevel("LogAPITest", "DEBUG");
+
+		for (unsigned int i = 0; i < 20; ++i)
+			LOG_RATELIMITED(LogAPITest, Info) << "rate limited";
+
+		for (unsigned int i = 0; i < 5; ++i)
+			LOG_ONCE(LogAPITest, Info) << "once";
+
+		unsigned int lines = 0;
+		string line;
+		while (getline(log, line))
+			lines++;
+
+		if (lines != 11) {
+			cout << "Invalid number of rate-limited lines " << lines
+			     << endl;
+			return TestFail;
+		}
+
+		/* Test the suppressed messages summary. */
+		LogRateLimiter limiter(2, std::chrono::milliseconds(10));
+		const LogCategory &category = _LOG_CATEGORY(LogAPITest)();
+		unsigned int allowed = 0;
+
+		for (unsigned int i = 0; i < 5; ++i)
+			allowed += limiter.allow(__FILE__, __LINE__, category, LogInfo);
+
+		if (allowed != 2) {
+			cout << "Rate limiter allowed " << allowed << " messages"
+			     << endl;
+			return TestFail;
+		}
+
+		this_thread::sleep_for(std::chrono::milliseconds(20));
+
+		log.clear();
+		log.str("");
+
+		if (!limiter.allow(__FILE__, __LINE__, category, LogInfo)) {
+			cout << "Rate limiter didn't reset" << endl;
+			return TestFail;
+		}
+
+		if (log.str().find("3 similar messages suppressed") == string::npos) {
+			cout << "Missing suppressed messages summary" << endl;
+			return TestFail;
+		}
+
+		logSetTarget(LoggingTargetNone);
+
+		return TestPass;
+	}
+
+	int testRecorder()
+	{
+		int fd = open("/tmp", O_TMPFILE | O_RDWR, S_IRUSR | S_IWUSR);
+		if (fd < 0) {
+			cerr << "Failed to open tmp recorder file" << endl;
+			return TestFail;
+		}
+
+		char path[32];
+		snprintf(path, sizeof(path), "/proc/self/fd/%u", fd);
+
+		if (logSetRecorder(path, 0) != -EINVAL) {
+			cout << "Recorder accepted an invalid size" << endl;
+			return TestFail;
+		}
+
+		if (logSetRecorder(path, 8) < 0) {
+			cerr << "Failed to set recorder file" << endl;
+			return TestFail;
+		}
+
+		stringstream log;
+		logSetStream(&log);
+		logSetLevel("LogAPITest", "WARN");
+
+		/* Messages below the log level are recorded but not output. */
+		for (unsigned int i = 0; i < 20; ++i)
+			LOG(LogAPITest, Debug) << "recorded " << i;
+
+		/* So are once-only messages, a single time. */
+		for (unsigned int i = 0; i < 2; ++i)
+			LOG_ONCE(LogAPITest, Debug) << "recorded once";
+
+		logDumpRecorder("test");
+		logSetRecorder(nullptr, 0);
+
+		/* Messages are not recorded anymore once the recorder is disabled. */
+		unsigned int evaluated = 0;
+		LOG(LogAPITest, Debug) << "bad " << ++evaluated;
+		logDumpRecorder("test");
+
+		if (!log.str().empty() || evaluated) {
+			cout << "Recorded messages leaked to the log" << endl;
+			return TestFail;
+		}
+
+		char buf[2000];
+		memset(buf, 0, sizeof(buf));
+		lseek(fd, 0, SEEK_SET);
+		if (read(fd, buf, sizeof(buf) - 1) < 0) {
+			cerr << "Failed to read tmp recorder file" << endl;
+			return TestFail;
+		}
+		close(fd);
+
+		istringstream iss(buf);
+		string line;
+
+		if (!getline(iss, line) || line.find("dump: test") == string::npos) {
+			cout << "Missing recorder dump header" << endl;
+			return TestFail;
+		}
+
+		/* Only the last 8 messages fit in the recorder. */
+		for (unsigned int i = 13; i < 20; ++i) {
+			if (!getline(iss, line) ||
+			    line.find("DEBUG LogAPITest") == string::npos ||
+			    line.find("recorded " + to_string(i)) == string::npos) {
+				cout << "Incorrect recorded message " << i << endl;
+				return TestFail;
+			}
+		}
+
+		if (!getline(iss, line) ||
+		    line.find("recorded once") == string::npos) {
+			cout << "Once-only message not recorded" << endl;
+			return TestFail;
+		}
+
+		if (getline(iss, line)) {
+			cout << "Too many recorded messages" << endl;
+			return TestFail;
+		}
+
+		logSetTarget(LoggingTargetNone);
+
+		return TestPass;
+	}
+
 	int run() override
 	{
 		int ret = testFile();
@@ -140,10 +333,26 @@ protected:
 		if (ret != TestPass)
 			return TestFail;
 
+		ret = testAsync();
+		if (ret != TestPass)
+			return TestFail;
+
 		ret = testTarget();
 		if (ret != TestPass)
 			return TestFail;
 
+		ret = testFiltered();
+		if (ret != TestPass)
+			return TestFail;
+
+		ret = testRateLimited();
+		if (ret != TestPass)
+			return TestFail;
+
+		ret = testRecorder();
+		if (ret != TestPass)
+			return TestFail;
+
 		return TestPass;
 	}
 };
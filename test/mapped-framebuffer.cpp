@@ -0,0 +1,200 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * mapped-framebuffer.cpp - MappedFrameBuffer and MappedBufferCache tests
+ */
+
+#include <fcntl.h>
+#include <iostream>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <libcamera/buffer.h>
+#include <libcamera/mapped_framebuffer.h>
+
+#include "test.h"
+
+using namespace libcamera;
+using namespace std;
+
+class MappedFrameBufferTest : public Test
+{
+protected:
+	int init()
+	{
+		fd_ = open("/tmp", O_TMPFILE | O_RDWR, S_IRUSR | S_IWUSR);
+		if (fd_ < 0)
+			return TestFail;
+
+		if (ftruncate(fd_, 8192) < 0)
+			return TestFail;
+
+		FileDescriptor fd(fd_);
+		FrameBuffer::Plane luma{ fd, 8192 };
+		FrameBuffer::Plane chroma{ fd, 4096 };
+
+		buffer_ = new FrameBuffer({ luma, chroma });
+
+		return TestPass;
+	}
+
+	int run()
+	{
+		MappedFrameBuffer mapped(buffer_, MappedFrameBuffer::MapReadWrite);
+		if (!mapped.isValid()) {
+			cout << "Failed to map buffer" << endl;
+			return TestFail;
+		}
+
+		const vector<MappedFrameBuffer::Plane> &planes = mapped.planes();
+		if (planes.size() != 2) {
+			cout << "Invalid number of planes" << endl;
+			return TestFail;
+		}
+
+		/* Planes sharing a dmabuf must share the same mapping. */
+		if (planes[0].data != planes[1].data ||
+		    planes[0].length != 8192 || planes[1].length != 4096) {
+			cout << "Planes don't share the mapping" << endl;
+			return TestFail;
+		}
+
+		{
+			/* Files that are not dmabufs need no synchronisation. */
+			ScopedCpuAccess access(mapped);
+			if (access.error()) {
+				cout << "CPU access synchronisation failed" << endl;
+				return TestFail;
+			}
+
+			memset(planes[0].data, 0xa5, planes[0].length);
+		}
+
+		uint8_t value;
+		if (pread(fd_, &value, 1, 4095) != 1 || value != 0xa5) {
+			cout << "Mapping doesn't reflect buffer memory" << endl;
+			return TestFail;
+		}
+
+		/* The cache must return the same mapping until unmapped. */
+		MappedBufferCache cache;
+		const MappedFrameBuffer *first = cache.map(buffer_);
+		if (!first || cache.map(buffer_) != first ||
+		    cache.find(buffer_) != first) {
+			cout << "Cache didn't reuse the mapping" << endl;
+			return TestFail;
+		}
+
+		if (first->planes()[0].data[0] != 0xa5) {
+			cout << "Cached mapping has invalid content" << endl;
+			return TestFail;
+		}
+
+		cache.unmap(buffer_);
+		if (cache.find(buffer_)) {
+			cout << "Buffer still mapped after unmap" << endl;
+			return TestFail;
+		}
+
+		if (testDestroyedBuffer() != TestPass)
+			return TestFail;
+
+		return testUserPtr();
+	}
+
+	int testDestroyedBuffer()
+	{
+		uint8_t first[4096];
+		uint8_t second[4096];
+		alignas(FrameBuffer) uint8_t storage[sizeof(FrameBuffer)];
+
+		FrameBuffer::Plane plane;
+		plane.length = sizeof(first);
+		plane.address = first;
+
+		MappedBufferCache cache;
+		FrameBuffer *buffer = new (storage) FrameBuffer({ plane });
+		if (!cache.map(buffer)) {
+			cout << "Failed to map buffer" << endl;
+			return TestFail;
+		}
+		buffer->~FrameBuffer();
+
+		/* Destroying the buffer must release its mapping. */
+		if (cache.find(buffer)) {
+			cout << "Mapping not released when destroying buffer" << endl;
+			return TestFail;
+		}
+
+		/*
+		 * A buffer allocated at the address of a destroyed buffer must
+		 * be given a new mapping.
+		 */
+		plane.address = second;
+		buffer = new (storage) FrameBuffer({ plane });
+
+		const MappedFrameBuffer *mapped = cache.map(buffer);
+		bool valid = mapped && mapped->planes()[0].data == second;
+
+		/* Buffers may outlive the cache. */
+		{
+			MappedBufferCache other;
+			other.map(buffer);
+		}
+
+		buffer->~FrameBuffer();
+
+		if (!valid) {
+			cout << "Stale mapping returned for a new buffer" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+	int testUserPtr()
+	{
+		uint8_t memory[4096];
+
+		FrameBuffer::Plane plane;
+		plane.length = sizeof(memory);
+		plane.address = memory;
+
+		FrameBuffer buffer({ plane });
+		if (buffer.memory() != FrameBuffer::MemoryUserPtr) {
+			cout << "Invalid user pointer buffer memory type" << endl;
+			return TestFail;
+		}
+
+		/* User pointer planes are used directly, without mapping. */
+		MappedFrameBuffer mapped(&buffer, MappedFrameBuffer::MapReadWrite);
+		if (!mapped.isValid() || mapped.planes()[0].data != memory) {
+			cout << "Failed to map user pointer buffer" << endl;
+			return TestFail;
+		}
+
+		ScopedCpuAccess access(mapped);
+		if (access.error()) {
+			cout << "User pointer synchronisation failed" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+	void cleanup()
+	{
+		delete buffer_;
+
+		if (fd_ >= 0)
+			close(fd_);
+	}
+
+private:
+	int fd_;
+	FrameBuffer *buffer_;
+};
+
+TEST_REGISTER(MappedFrameBufferTest);
@@ -210,6 +210,35 @@ class MediaDeviceLinkTest : public MediaDeviceTest
 			return TestFail;
 		}
 
+		/*
+		 * Apply a link configuration, and verify it is preserved when
+		 * the link states are refreshed from the kernel.
+		 */
+		MediaLink *other = media_->link("Debayer A", 1, "Scaler", 0);
+		if (!other) {
+			cerr << "Unable to find link: 'Debayer A':[1] -> 'Scaler':[0]"
+			     << endl;
+			return TestFail;
+		}
+
+		if (media_->setupLinks({ link })) {
+			cerr << "Failed to setup links in the media graph" << endl;
+			return TestFail;
+		}
+
+		if (!media_->lock()) {
+			cerr << "Failed to lock media device" << endl;
+			return TestFail;
+		}
+
+		media_->unlock();
+
+		if (!(link->flags() & MEDIA_LNK_FL_ENABLED) ||
+		    other->flags() & MEDIA_LNK_FL_ENABLED) {
+			cerr << "Link configuration not applied" << endl;
+			return TestFail;
+		}
+
 		return 0;
 	}
 
@@ -0,0 +1,86 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * media_device_path_test.cpp - Tests path search on VIMC media device
+ */
+
+#include <iostream>
+
+#include "media_device_test.h"
+
+using namespace libcamera;
+using namespace std;
+
+/*
+ * This test requires a vimc device in order to exercise the MediaDevice path
+ * search API on a graph with a predetermined topology. If no vimc device is
+ * found the test is skipped.
+ */
+
+class MediaDevicePathTest : public MediaDeviceTest
+{
+	int checkPath(const vector<MediaLink *> &path,
+		      const vector<const char *> &entities)
+	{
+		if (path.size() + 1 != entities.size()) {
+			cerr << "Invalid path length " << path.size() << endl;
+			return TestFail;
+		}
+
+		for (unsigned int i = 0; i < path.size(); ++i) {
+			MediaLink *link = path[i];
+
+			if (link->source()->entity()->name() != entities[i] ||
+			    link->sink()->entity()->name() != entities[i + 1]) {
+				cerr << "Invalid link " << i << " in path" << endl;
+				return TestFail;
+			}
+		}
+
+		return TestPass;
+	}
+
+	int run()
+	{
+		MediaEntity *sensor = media_->getEntityByName("Sensor A");
+		MediaEntity *raw = media_->getEntityByName("Raw Capture 0");
+		MediaEntity *rgb = media_->getEntityByName("RGB/YUV Capture");
+		if (!sensor || !raw || !rgb) {
+			cerr << "Unable to find entities" << endl;
+			return TestFail;
+		}
+
+		if (media_->getEntityByName("Nonexistent")) {
+			cerr << "Found nonexistent entity" << endl;
+			return TestFail;
+		}
+
+		/* The raw capture node is directly linked to the sensor. */
+		vector<MediaLink *> path = media_->findPath(sensor, raw);
+		if (checkPath(path, { "Sensor A", "Raw Capture 0" }) != TestPass)
+			return TestFail;
+
+		path = media_->findPath(sensor, rgb);
+		if (checkPath(path, { "Sensor A", "Debayer A", "Scaler",
+				      "RGB/YUV Capture" }) != TestPass)
+			return TestFail;
+
+		/* Links are only followed in the direction of the data flow. */
+		if (!media_->findPath(rgb, sensor).empty()) {
+			cerr << "Found path against the data flow" << endl;
+			return TestFail;
+		}
+
+		/* The closest video node is the raw capture node. */
+		path = media_->findPath(sensor, [](const MediaEntity *entity) {
+			return entity->function() == MEDIA_ENT_F_IO_V4L;
+		});
+		if (checkPath(path, { "Sensor A", "Raw Capture 0" }) != TestPass)
+			return TestFail;
+
+		return TestPass;
+	}
+};
+
+TEST_REGISTER(MediaDevicePathTest);
@@ -0,0 +1,292 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * media_device_request.cpp - Test media requests allocation and usage
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <iostream>
+#include <memory>
+#include <vector>
+
+#include <linux/videodev2.h>
+
+#include <libcamera/buffer.h>
+#include <libcamera/event_dispatcher.h>
+#include <libcamera/timer.h>
+
+#include "device_enumerator.h"
+#include "media_device.h"
+#include "media_request.h"
+#include "thread.h"
+#include "v4l2_videodevice.h"
+
+#include "test.h"
+
+using namespace libcamera;
+using namespace std;
+
+class MediaDeviceRequestTest : public Test
+{
+public:
+	MediaDeviceRequestTest()
+		: completed_(0), captured_(0)
+	{
+	}
+
+protected:
+	int init()
+	{
+		enumerator_ = unique_ptr<DeviceEnumerator>(DeviceEnumerator::create());
+		if (!enumerator_) {
+			cerr << "Failed to create device enumerator" << endl;
+			return TestFail;
+		}
+
+		if (enumerator_->enumerate()) {
+			cerr << "Failed to enumerate media devices" << endl;
+			return TestFail;
+		}
+
+		/* VIMC doesn't support the Request API, VIVID does. */
+		vimc_ = enumerator_->search(DeviceMatch("vimc"));
+
+		DeviceMatch dm("vivid");
+		dm.add("vivid-000-vid-cap");
+		vivid_ = enumerator_->search(dm);
+
+		if (!vimc_ && !vivid_) {
+			cerr << "No VIMC or VIVID media device found: skip test" << endl;
+			return TestSkip;
+		}
+
+		return TestPass;
+	}
+
+	int run()
+	{
+		if (vimc_ && testUnsupported() != TestPass)
+			return TestFail;
+
+		if (!vivid_)
+			return TestPass;
+
+		if (testLifetime() != TestPass)
+			return TestFail;
+
+		return testBinding();
+	}
+
+	void cleanup()
+	{
+		if (vivid_)
+			vivid_->release();
+	}
+
+private:
+	void requestCompleted(MediaRequest *request)
+	{
+		completed_++;
+	}
+
+	void bufferReady(FrameBuffer *buffer)
+	{
+		captured_++;
+	}
+
+	int testUnsupported()
+	{
+		/* Requests can't be allocated before acquiring the device. */
+		if (vimc_->allocateRequest()) {
+			cerr << "Request allocated on a device not acquired" << endl;
+			return TestFail;
+		}
+
+		if (!vimc_->acquire()) {
+			cerr << "Failed to acquire VIMC media device" << endl;
+			return TestFail;
+		}
+
+		unique_ptr<MediaRequest> request = vimc_->allocateRequest();
+		vimc_->release();
+
+		if (request) {
+			cerr << "Request allocated without Request API support" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+	int testLifetime()
+	{
+		if (!vivid_->acquire()) {
+			cerr << "Failed to acquire VIVID media device" << endl;
+			return TestFail;
+		}
+
+		unique_ptr<MediaRequest> request = vivid_->allocateRequest();
+		if (!request) {
+			cerr << "Failed to allocate request" << endl;
+			return TestFail;
+		}
+
+		int fd = request->fd();
+		if (fd < 0 || request->queued()) {
+			cerr << "Invalid request state after allocation" << endl;
+			return TestFail;
+		}
+
+		if (request->reinit()) {
+			cerr << "Failed to reinitialise idle request" << endl;
+			return TestFail;
+		}
+
+		/* Destroying the request must close its file descriptor. */
+		request.reset();
+		if (fcntl(fd, F_GETFD) != -1 || errno != EBADF) {
+			cerr << "Request file descriptor not closed" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+	int testBinding()
+	{
+		MediaEntity *entity = vivid_->getEntityByName("vivid-000-vid-cap");
+		unique_ptr<V4L2VideoDevice> capture = make_unique<V4L2VideoDevice>(entity);
+		if (capture->open())
+			return TestFail;
+
+		V4L2DeviceFormat format = {};
+		if (capture->getFormat(&format))
+			return TestFail;
+
+		format.size.width = 640;
+		format.size.height = 480;
+		if (capture->setFormat(&format))
+			return TestFail;
+
+		const ControlInfoMap &info = capture->controls();
+		auto iter = info.find(V4L2_CID_BRIGHTNESS);
+		if (iter == info.end()) {
+			cerr << "Missing brightness control" << endl;
+			return TestFail;
+		}
+
+		const ControlRange &brightness = iter->second;
+		ControlList ctrls(info);
+		ctrls.set(V4L2_CID_BRIGHTNESS, brightness.max());
+		if (capture->setControls(&ctrls)) {
+			cerr << "Failed to set controls" << endl;
+			return TestFail;
+		}
+
+		/*
+		 * Bind a control to the first request, and a buffer to each
+		 * request, as the driver needs two buffers to start streaming.
+		 */
+		const unsigned int count = 2;
+		vector<unique_ptr<FrameBuffer>> buffers;
+		int ret = capture->exportBuffers(count, &buffers);
+		if (ret != static_cast<int>(count)) {
+			cerr << "Failed to export buffers" << endl;
+			return TestFail;
+		}
+
+		capture->bufferReady.connect(this, &MediaDeviceRequestTest::bufferReady);
+
+		vector<unique_ptr<MediaRequest>> requests;
+		for (unsigned int i = 0; i < count; ++i) {
+			unique_ptr<MediaRequest> request = vivid_->allocateRequest();
+			if (!request) {
+				cerr << "Failed to allocate request" << endl;
+				return TestFail;
+			}
+
+			request->completed.connect(this, &MediaDeviceRequestTest::requestCompleted);
+
+			if (!i) {
+				ctrls.set(V4L2_CID_BRIGHTNESS, brightness.min());
+				if (capture->setControls(&ctrls, request.get())) {
+					cerr << "Failed to bind control to request" << endl;
+					return TestFail;
+				}
+			}
+
+			if (capture->queueBuffer(buffers[i].get(), request.get())) {
+				cerr << "Failed to bind buffer to request" << endl;
+				return TestFail;
+			}
+
+			requests.push_back(move(request));
+		}
+
+		/* Buffers bound to requests are only queued with the request. */
+		if (capture->queuedBuffers()) {
+			cerr << "Buffer queued before its request" << endl;
+			return TestFail;
+		}
+
+		if (capture->streamOn())
+			return TestFail;
+
+		for (unique_ptr<MediaRequest> &request : requests) {
+			if (request->queue()) {
+				cerr << "Failed to queue request" << endl;
+				return TestFail;
+			}
+
+			if (request->reinit() != -EBUSY) {
+				cerr << "Queued request reinitialised" << endl;
+				return TestFail;
+			}
+		}
+
+		EventDispatcher *dispatcher = Thread::current()->eventDispatcher();
+		Timer timeout;
+		timeout.start(5000);
+		while (timeout.isRunning() &&
+		       (completed_ < count || captured_ < count))
+			dispatcher->processEvents();
+
+		capture->streamOff();
+
+		if (completed_ != count || captured_ != count) {
+			cerr << "Requests didn't complete: " << completed_
+			     << " requests, " << captured_ << " buffers" << endl;
+			return TestFail;
+		}
+
+		ctrls.set(V4L2_CID_BRIGHTNESS, -1);
+		if (capture->getControls(&ctrls) ||
+		    ctrls.get(V4L2_CID_BRIGHTNESS) != brightness.min()) {
+			cerr << "Control bound to request not applied" << endl;
+			return TestFail;
+		}
+
+		/* Completed requests can be reused. */
+		for (unique_ptr<MediaRequest> &request : requests) {
+			if (request->queued() || request->reinit()) {
+				cerr << "Failed to reinitialise completed request" << endl;
+				return TestFail;
+			}
+		}
+
+		capture->releaseBuffers();
+
+		return TestPass;
+	}
+
+	unique_ptr<DeviceEnumerator> enumerator_;
+	shared_ptr<MediaDevice> vimc_;
+	shared_ptr<MediaDevice> vivid_;
+
+	unsigned int completed_;
+	unsigned int captured_;
+};
+
+TEST_REGISTER(MediaDeviceRequestTest);
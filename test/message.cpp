@@ -5,9 +5,13 @@
  * message.cpp - Messages test
  */
 
+#include <atomic>
 #include <chrono>
 #include <iostream>
+#include <new>
+#include <stdlib.h>
 #include <thread>
+#include <vector>
 
 #include "message.h"
 #include "thread.h"
@@ -16,6 +20,31 @@
 using namespace std;
 using namespace libcamera;
 
+static std::atomic<bool> countAllocations(false);
+static std::atomic<unsigned int> allocations(0);
+
+void *operator new(std::size_t size)
+{
+	if (countAllocations)
+		allocations++;
+
+	void *ptr = malloc(size ? size : 1);
+	if (!ptr)
+		throw std::bad_alloc();
+
+	return ptr;
+}
+
+void operator delete(void *ptr) noexcept
+{
+	free(ptr);
+}
+
+void operator delete(void *ptr, std::size_t size) noexcept
+{
+	free(ptr);
+}
+
 class MessageReceiver : public Object
 {
 public:
@@ -70,6 +99,110 @@ protected:
 	}
 };
 
+class SequenceMessage : public Message
+{
+public:
+	SequenceMessage(Type type, unsigned int producer, unsigned int sequence)
+		: Message(type), producer_(producer), sequence_(sequence)
+	{
+	}
+
+	unsigned int producer_;
+	unsigned int sequence_;
+};
+
+class SequenceReceiver : public Object
+{
+public:
+	SequenceReceiver(Message::Type type, unsigned int producers)
+		: type_(type), next_(producers, 0), received_(0), outOfOrder_(false)
+	{
+	}
+
+	unsigned int received() const { return received_; }
+	bool outOfOrder() const { return outOfOrder_; }
+
+protected:
+	void message(Message *msg)
+	{
+		if (msg->type() != type_) {
+			Object::message(msg);
+			return;
+		}
+
+		SequenceMessage *seq = static_cast<SequenceMessage *>(msg);
+		if (seq->sequence_ != next_[seq->producer_])
+			outOfOrder_ = true;
+
+		next_[seq->producer_] = seq->sequence_ + 1;
+		received_++;
+	}
+
+private:
+	Message::Type type_;
+	std::vector<unsigned int> next_;
+	std::atomic<unsigned int> received_;
+	std::atomic<bool> outOfOrder_;
+};
+
+class PriorityReceiver : public Object
+{
+public:
+	PriorityReceiver()
+		: received_(0)
+	{
+	}
+
+	unsigned int received() const { return received_; }
+	const std::vector<unsigned int> &order() const { return order_; }
+
+	void receive(unsigned int value)
+	{
+		order_.push_back(value);
+		received_++;
+	}
+
+private:
+	std::vector<unsigned int> order_;
+	std::atomic<unsigned int> received_;
+};
+
+class DeferredReceiver : public Object
+{
+public:
+	DeferredReceiver(std::atomic<Thread *> *deleted)
+		: deleted_(deleted)
+	{
+	}
+
+	~DeferredReceiver()
+	{
+		*deleted_ = Thread::current();
+	}
+
+private:
+	std::atomic<Thread *> *deleted_;
+};
+
+class InvokeReceiver : public Object
+{
+public:
+	InvokeReceiver()
+		: received_(0)
+	{
+	}
+
+	unsigned int received() const { return received_; }
+
+	void receive(unsigned int value)
+	{
+		received_++;
+	}
+
+private:
+	std::atomic<unsigned int> received_;
+};
+
 class MessageTest : public Test
 {
 protected:
@@ -119,6 +252,206 @@ protected:
 
 		delete slowReceiver;
 
+		/*
+		 * Post messages concurrently from multiple threads, and verify
+		 * that they are all delivered, in order for each producer.
+		 */
+		static constexpr unsigned int producers = 4;
+		static constexpr unsigned int messages = 10000;
+
+		SequenceReceiver seqReceiver(msgType[0], producers);
+		seqReceiver.moveToThread(&thread_);
+
+		std::vector<std::thread> threads;
+		for (unsigned int i = 0; i < producers; ++i) {
+			threads.emplace_back([&seqReceiver, &msgType, i]() {
+				for (unsigned int j = 0; j < messages; ++j)
+					seqReceiver.postMessage(std::make_unique<SequenceMessage>(msgType[0], i, j));
+			});
+		}
+
+		for (std::thread &thread : threads)
+			thread.join();
+
+		for (unsigned int i = 0; i < 100; ++i) {
+			if (seqReceiver.received() == producers * messages)
+				break;
+			this_thread::sleep_for(chrono::milliseconds(10));
+		}
+
+		if (seqReceiver.received() != producers * messages) {
+			cout << "Received " << seqReceiver.received() << " of "
+			     << producers * messages << " messages" << endl;
+			return TestFail;
+		}
+
+		if (seqReceiver.outOfOrder()) {
+			cout << "Messages received out of order" << endl;
+			return TestFail;
+		}
+
+		/*
+		 * Queue interleaved messages for several receivers on a stopped
+		 * thread, delete some of the receivers, and verify that the
+		 * remaining messages are all delivered in order.
+		 */
+		Thread idleThread;
+		SequenceReceiver *receivers[3];
+		for (SequenceReceiver *&seq : receivers) {
+			seq = new SequenceReceiver(msgType[1], 1);
+			seq->moveToThread(&idleThread);
+		}
+
+		for (unsigned int i = 0; i < 100; ++i) {
+			for (SequenceReceiver *seq : receivers)
+				seq->postMessage(std::make_unique<SequenceMessage>(msgType[1], 0, i));
+		}
+
+		delete receivers[0];
+		delete receivers[2];
+
+		idleThread.start();
+
+		for (unsigned int i = 0; i < 100; ++i) {
+			if (receivers[1]->received() == 100)
+				break;
+			this_thread::sleep_for(chrono::milliseconds(10));
+		}
+
+		idleThread.exit(0);
+		idleThread.wait();
+
+		unsigned int received = receivers[1]->received();
+		bool outOfOrder = receivers[1]->outOfOrder();
+		delete receivers[1];
+
+		if (received != 100 || outOfOrder) {
+			cout << "Messages lost or reordered after receiver deletion"
+			     << endl;
+			return TestFail;
+		}
+
+		/*
+		 * Queue normal priority invocations on a stopped thread, followed
+		 * by realtime ones, and verify that the realtime invocations are
+		 * dispatched first, in order, for all receivers. Delete one of
+		 * the receivers to exercise removal of messages from both lanes.
+		 */
+		Thread priorityThread;
+		PriorityReceiver *prioReceivers[3];
+		for (PriorityReceiver *&prio : prioReceivers) {
+			prio = new PriorityReceiver();
+			prio->moveToThread(&priorityThread);
+		}
+
+		for (unsigned int i = 0; i < 50; ++i) {
+			for (PriorityReceiver *prio : prioReceivers)
+				prio->invokeMethod(&PriorityReceiver::receive,
+						   ConnectionTypeQueued, i);
+		}
+
+		for (unsigned int i = 50; i < 53; ++i) {
+			for (PriorityReceiver *prio : prioReceivers)
+				prio->invokeMethod(&PriorityReceiver::receive,
+						   ConnectionTypeQueued,
+						   MessagePriorityRealtime, i);
+		}
+
+		delete prioReceivers[1];
+
+		priorityThread.start();
+
+		for (unsigned int i = 0; i < 100; ++i) {
+			if (prioReceivers[0]->received() == 53 &&
+			    prioReceivers[2]->received() == 53)
+				break;
+			this_thread::sleep_for(chrono::milliseconds(10));
+		}
+
+		priorityThread.exit(0);
+		priorityThread.wait();
+
+		ThreadStatistics prioStats = priorityThread.statistics();
+
+		for (unsigned int r : { 0, 2 }) {
+			const std::vector<unsigned int> &order = prioReceivers[r]->order();
+			bool valid = order.size() == 53;
+			for (unsigned int i = 0; valid && i < 53; ++i)
+				valid = order[i] == (i < 3 ? 50 + i : i - 3);
+
+			delete prioReceivers[r];
+
+			if (!valid) {
+				cout << "Realtime invocations not dispatched first"
+				     << endl;
+				return TestFail;
+			}
+		}
+
+		if (prioStats.maxLaneDepth[MessagePriorityNormal] != 100 ||
+		    prioStats.maxLaneDepth[MessagePriorityRealtime] != 6) {
+			cout << "Invalid lane depths "
+			     << prioStats.maxLaneDepth[MessagePriorityNormal] << " "
+			     << prioStats.maxLaneDepth[MessagePriorityRealtime]
+			     << endl;
+			return TestFail;
+		}
+
+		/*
+		 * Verify that deferred deletion happens in the object's thread.
+		 */
+		std::atomic<Thread *> deleted(nullptr);
+		DeferredReceiver *deferred = new DeferredReceiver(&deleted);
+		deferred->moveToThread(&thread_);
+		deferred->deleteLater();
+
+		for (unsigned int i = 0; i < 100 && !deleted; ++i)
+			this_thread::sleep_for(chrono::milliseconds(10));
+
+		if (deleted != &thread_) {
+			cout << "Deferred deletion failed" << endl;
+			return TestFail;
+		}
+
+		/*
+		 * Verify that queued method invocations don't allocate memory
+		 * once the message pools have been populated.
+		 */
+		static constexpr unsigned int invocations = 100;
+
+		InvokeReceiver invokeReceiver;
+		invokeReceiver.moveToThread(&thread_);
+
+		for (unsigned int pass = 0; pass < 2; ++pass) {
+			allocations = 0;
+			countAllocations = pass == 1;
+
+			for (unsigned int i = 0; i < invocations; ++i)
+				invokeReceiver.invokeMethod(&InvokeReceiver::receive,
+							    ConnectionTypeQueued, i);
+
+			for (unsigned int i = 0; i < 100; ++i) {
+				if (invokeReceiver.received() == (pass + 1) * invocations)
+					break;
+				this_thread::sleep_for(chrono::milliseconds(10));
+			}
+
+			countAllocations = false;
+
+			if (invokeReceiver.received() != (pass + 1) * invocations) {
+				cout << "Received " << invokeReceiver.received()
+				     << " of " << (pass + 1) * invocations
+				     << " invocations" << endl;
+				return TestFail;
+			}
+		}
+
+		if (allocations) {
+			cout << allocations << " allocations for "
+			     << invocations << " queued invocations" << endl;
+			return TestFail;
+		}
+
 		return TestPass;
 	}
 
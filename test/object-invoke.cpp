@@ -17,6 +17,18 @@
 using namespace std;
 using namespace libcamera;
 
+class Payload
+{
+public:
+	Payload() {}
+	Payload(const Payload &) { copies++; }
+	Payload(Payload &&) {}
+
+	static unsigned int copies;
+};
+
+unsigned int Payload::copies = 0;
+
 class InvokedObject : public Object
 {
 public:
@@ -58,6 +70,10 @@ public:
 		return 42;
 	}
 
+	void methodWithPayload(Payload payload)
+	{
+	}
+
 private:
 	Status status_;
 	int value_;
@@ -186,6 +202,16 @@ protected:
 			return TestFail;
 		}
 
+		/* Test that rvalue arguments are moved through the invocation. */
+		Payload payload;
+		object_.invokeMethod(&InvokedObject::methodWithPayload,
+				     ConnectionTypeBlocking, std::move(payload));
+		if (Payload::copies) {
+			cout << "Rvalue argument copied " << Payload::copies
+			     << " times" << endl;
+			return TestFail;
+		}
+
 		return TestPass;
 	}
 
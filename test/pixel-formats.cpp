@@ -0,0 +1,90 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * pixel-formats.cpp - PixelFormatInfo tests
+ */
+
+#include <iostream>
+
+#include <linux/drm_fourcc.h>
+#include <linux/videodev2.h>
+
+#include <libcamera/pixelformats.h>
+
+#include "test.h"
+
+using namespace std;
+using namespace libcamera;
+
+class PixelFormatsTest : public Test
+{
+protected:
+	int checkLayout(PixelFormat format, const Size &size,
+			unsigned int stride0, unsigned int stride1,
+			unsigned int frameSize)
+	{
+		const PixelFormatInfo &info = PixelFormatInfo::info(format);
+
+		if (!info.isValid()) {
+			cerr << "No information for format " << format << endl;
+			return TestFail;
+		}
+
+		if (info.stride(size.width, 0) != stride0 ||
+		    info.stride(size.width, 1) != stride1 ||
+		    info.frameSize(size) != frameSize) {
+			cerr << "Invalid layout for format " << format << " at "
+			     << size.toString() << ": " << info.stride(size.width, 0)
+			     << "/" << info.stride(size.width, 1) << "/"
+			     << info.frameSize(size) << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+	int run()
+	{
+		if (checkLayout(DRM_FORMAT_NV12, { 640, 480 }, 640, 640, 640 * 480 * 3 / 2) ||
+		    checkLayout(DRM_FORMAT_NV16, { 640, 480 }, 640, 640, 640 * 480 * 2) ||
+		    checkLayout(DRM_FORMAT_NV24, { 640, 480 }, 640, 1280, 640 * 480 * 3) ||
+		    checkLayout(DRM_FORMAT_YUYV, { 640, 480 }, 1280, 0, 640 * 480 * 2) ||
+		    checkLayout(DRM_FORMAT_RGB888, { 640, 480 }, 1920, 0, 640 * 480 * 3) ||
+		    checkLayout(DRM_FORMAT_BGRA8888, { 640, 480 }, 2560, 0, 640 * 480 * 4) ||
+		    checkLayout(DRM_FORMAT_MJPEG, { 640, 480 }, 0, 0, 0))
+			return TestFail;
+
+		/* Subsampled planes of odd sizes must be rounded up. */
+		if (checkLayout(DRM_FORMAT_NV12, { 641, 481 }, 641, 642,
+				641 * 481 + 642 * 241))
+			return TestFail;
+
+		/* V4L2 formats must map to their PixelFormat. */
+		if (PixelFormatInfo::fromV4L2(V4L2_PIX_FMT_NV12).format != DRM_FORMAT_NV12 ||
+		    PixelFormatInfo::fromV4L2(V4L2_PIX_FMT_NV12M).format != DRM_FORMAT_NV12 ||
+		    PixelFormatInfo::fromV4L2(V4L2_PIX_FMT_BGR24).format != DRM_FORMAT_RGB888 ||
+		    PixelFormatInfo::info(DRM_FORMAT_BGR888).v4l2Format != V4L2_PIX_FMT_RGB24) {
+			cerr << "Invalid V4L2 pixel format mapping" << endl;
+			return TestFail;
+		}
+
+		/* Unknown formats must be reported as invalid. */
+		if (PixelFormatInfo::info(0).isValid() ||
+		    PixelFormatInfo::info(DRM_FORMAT_XRGB2101010).isValid() ||
+		    PixelFormatInfo::fromV4L2(0).isValid() ||
+		    PixelFormatInfo::fromV4L2(V4L2_PIX_FMT_GREY).isValid()) {
+			cerr << "Unknown format reported as valid" << endl;
+			return TestFail;
+		}
+
+		if (PixelFormatInfo::info(0).frameSize({ 640, 480 })) {
+			cerr << "Invalid format has a non-zero frame size" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+};
+
+TEST_REGISTER(PixelFormatsTest)
@@ -0,0 +1,139 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * format_kernels.cpp - qcam format conversion kernels test and benchmark
+ */
+
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <string.h>
+#include <vector>
+
+#include <linux/drm_fourcc.h>
+
+#include "format_kernels.h"
+
+#include "test.h"
+
+using namespace std;
+
+struct FormatDesc {
+	const char *name;
+	unsigned int format;
+};
+
+static const FormatDesc formats[] = {
+	{ "NV12", DRM_FORMAT_NV12 },
+	{ "NV21", DRM_FORMAT_NV21 },
+	{ "NV24", DRM_FORMAT_NV24 },
+	{ "NV42", DRM_FORMAT_NV42 },
+	{ "YUYV", DRM_FORMAT_YUYV },
+	{ "YVYU", DRM_FORMAT_YVYU },
+	{ "UYVY", DRM_FORMAT_UYVY },
+	{ "VYUY", DRM_FORMAT_VYUY },
+	{ "RGB888", DRM_FORMAT_RGB888 },
+	{ "BGR888", DRM_FORMAT_BGR888 },
+	{ "BGRA8888", DRM_FORMAT_BGRA8888 },
+};
+
+static constexpr unsigned int MaxWidth = 1926;
+static constexpr unsigned int BenchmarkWidth = 1920;
+static constexpr unsigned int BenchmarkLines = 1080 * 10;
+
+class FormatKernelsTest : public Test
+{
+protected:
+	int run()
+	{
+		mt19937 gen(42);
+		uniform_int_distribution<int> dist(0, 255);
+
+		src_.resize(MaxWidth * 4);
+		chroma_.resize(MaxWidth * 2);
+		for (unsigned char &value : src_)
+			value = dist(gen);
+		for (unsigned char &value : chroma_)
+			value = dist(gen);
+
+		for (const FormatDesc &desc : formats) {
+			LineConverter scalar = lineConverter(desc.format, false);
+			LineConverter simd = lineConverter(desc.format, true);
+			if (!scalar || !simd) {
+				cerr << desc.name << ": no line converter" << endl;
+				return TestFail;
+			}
+
+			/* Test widths with and without a scalar tail. */
+			for (unsigned int width : { 2U, 16U, 62U, 1920U, MaxWidth }) {
+				if (compare(desc, scalar, simd, width))
+					return TestFail;
+			}
+
+			benchmark(desc, scalar, simd);
+		}
+
+		return TestPass;
+	}
+
+private:
+	int compare(const FormatDesc &desc, LineConverter scalar,
+		    LineConverter simd, unsigned int width)
+	{
+		vector<unsigned char> expected(width * 4);
+		vector<unsigned char> result(width * 4);
+
+		scalar(src_.data(), chroma_.data(), expected.data(), width);
+		simd(src_.data(), chroma_.data(), result.data(), width);
+
+		for (unsigned int i = 0; i < width * 4; ++i) {
+			if (expected[i] != result[i]) {
+				cerr << desc.name << ": width " << width
+				     << ": mismatch at pixel " << i / 4
+				     << " component " << i % 4 << ": expected "
+				     << static_cast<unsigned int>(expected[i])
+				     << ", got "
+				     << static_cast<unsigned int>(result[i])
+				     << endl;
+				return -1;
+			}
+		}
+
+		return 0;
+	}
+
+	double measure(LineConverter convert, unsigned char *dst)
+	{
+		auto start = chrono::steady_clock::now();
+
+		for (unsigned int i = 0; i < BenchmarkLines; ++i)
+			convert(src_.data(), chroma_.data(), dst, BenchmarkWidth);
+
+		chrono::duration<double, milli> elapsed =
+			chrono::steady_clock::now() - start;
+
+		/* Time per 1080p frame. */
+		return elapsed.count() * 1080 / BenchmarkLines;
+	}
+
+	void benchmark(const FormatDesc &desc, LineConverter scalar,
+		       LineConverter simd)
+	{
+		vector<unsigned char> dst(BenchmarkWidth * 4);
+
+		double scalarTime = measure(scalar, dst.data());
+		double simdTime = measure(simd, dst.data());
+
+		cout << left << setw(10) << desc.name << right << fixed
+		     << setprecision(3) << " scalar " << setw(8) << scalarTime
+		     << " ms, vector " << setw(8) << simdTime
+		     << " ms per 1920x1080 frame" << endl;
+	}
+
+	vector<unsigned char> src_;
+	vector<unsigned char> chroma_;
+};
+
+TEST_REGISTER(FormatKernelsTest)
@@ -0,0 +1,189 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * jpeg_decoder.cpp - qcam JPEG decoder test and benchmark
+ */
+
+#include <chrono>
+#include <errno.h>
+#include <iomanip>
+#include <iostream>
+#include <stdlib.h>
+#include <vector>
+
+#include "jpeg_decoder.h"
+
+#include "test.h"
+
+using namespace std;
+
+static constexpr unsigned int Width = 1920;
+static constexpr unsigned int Height = 1080;
+static constexpr unsigned int BenchmarkFrames = 20;
+
+/* Maximum error allowed on a component, accounting for the lossy encoding. */
+static constexpr int Tolerance = 12;
+
+class JpegDecoderTest : public Test
+{
+protected:
+	int init()
+	{
+		if (encode())
+			return TestFail;
+
+		return TestPass;
+	}
+
+	int run()
+	{
+		JpegDecoder decoder;
+
+		for (unsigned int scale : { 1U, 2U, 4U, 8U }) {
+			if (check(decoder, scale))
+				return TestFail;
+		}
+
+		/* Size mismatches and invalid data must be reported as errors. */
+		vector<unsigned char> dst(Width * Height * 4);
+
+		int ret = decoder.decode(jpeg_.data(), jpeg_.size(), 1, dst.data(),
+					 Width / 2, Height / 2, Width * 2);
+		if (ret != -EINVAL) {
+			cerr << "Size mismatch not detected" << endl;
+			return TestFail;
+		}
+
+		vector<unsigned char> garbage(4096, 0x55);
+		ret = decoder.decode(garbage.data(), garbage.size(), 1, dst.data(),
+				     Width, Height, Width * 4);
+		if (ret != -EINVAL) {
+			cerr << "Invalid data not detected" << endl;
+			return TestFail;
+		}
+
+		/* The decoder must remain usable after an error. */
+		if (check(decoder, 1))
+			return TestFail;
+
+		benchmark(decoder);
+
+		return TestPass;
+	}
+
+private:
+	static unsigned char red(unsigned int x) { return x * 255 / (Width - 1); }
+	static unsigned char green(unsigned int y) { return y * 255 / (Height - 1); }
+	static constexpr unsigned char Blue = 128;
+
+	int encode()
+	{
+		struct jpeg_compress_struct cinfo;
+		struct jpeg_error_mgr jerr;
+		unsigned char *buffer = nullptr;
+		unsigned long size = 0;
+
+		cinfo.err = jpeg_std_error(&jerr);
+		jpeg_create_compress(&cinfo);
+		jpeg_mem_dest(&cinfo, &buffer, &size);
+
+		cinfo.image_width = Width;
+		cinfo.image_height = Height;
+		cinfo.input_components = 3;
+		cinfo.in_color_space = JCS_RGB;
+		jpeg_set_defaults(&cinfo);
+		jpeg_set_quality(&cinfo, 90, TRUE);
+		jpeg_start_compress(&cinfo, TRUE);
+
+		/* Encode a smooth gradient, preserved well by the compression. */
+		vector<unsigned char> line(Width * 3);
+		while (cinfo.next_scanline < cinfo.image_height) {
+			for (unsigned int x = 0; x < Width; ++x) {
+				line[x * 3] = red(x);
+				line[x * 3 + 1] = green(cinfo.next_scanline);
+				line[x * 3 + 2] = Blue;
+			}
+
+			JSAMPROW row = line.data();
+			jpeg_write_scanlines(&cinfo, &row, 1);
+		}
+
+		jpeg_finish_compress(&cinfo);
+		jpeg_destroy_compress(&cinfo);
+
+		jpeg_.assign(buffer, buffer + size);
+		free(buffer);
+
+		return jpeg_.empty() ? -1 : 0;
+	}
+
+	int check(JpegDecoder &decoder, unsigned int scale)
+	{
+		unsigned int width = JpegDecoder::scaledSize(Width, scale);
+		unsigned int height = JpegDecoder::scaledSize(Height, scale);
+		unsigned int stride = width * 4;
+		vector<unsigned char> dst(stride * height);
+
+		int ret = decoder.decode(jpeg_.data(), jpeg_.size(), scale,
+					 dst.data(), width, height, stride);
+		if (ret) {
+			cerr << "Failed to decode at scale 1/" << scale << endl;
+			return -1;
+		}
+
+		/*
+		 * Compare the BGRX output against the gradient, sampled at the
+		 * center of the source area covered by each output pixel.
+		 */
+		for (unsigned int y = 0; y < height; ++y) {
+			for (unsigned int x = 0; x < width; ++x) {
+				unsigned int sx = min(x * scale + scale / 2, Width - 1);
+				unsigned int sy = min(y * scale + scale / 2, Height - 1);
+				const unsigned char *pixel = &dst[y * stride + x * 4];
+
+				if (abs(pixel[0] - Blue) > Tolerance ||
+				    abs(pixel[1] - green(sy)) > Tolerance ||
+				    abs(pixel[2] - red(sx)) > Tolerance) {
+					cerr << "Scale 1/" << scale
+					     << ": wrong pixel at " << x << ","
+					     << y << endl;
+					return -1;
+				}
+			}
+		}
+
+		return 0;
+	}
+
+	void benchmark(JpegDecoder &decoder)
+	{
+		vector<unsigned char> dst(Width * Height * 4);
+
+		cout << "MJPEG " << Width << "x" << Height << fixed
+		     << setprecision(3);
+
+		for (unsigned int scale : { 1U, 2U, 4U, 8U }) {
+			unsigned int width = JpegDecoder::scaledSize(Width, scale);
+			unsigned int height = JpegDecoder::scaledSize(Height, scale);
+
+			auto start = chrono::steady_clock::now();
+
+			for (unsigned int i = 0; i < BenchmarkFrames; ++i)
+				decoder.decode(jpeg_.data(), jpeg_.size(), scale,
+					       dst.data(), width, height, width * 4);
+
+			chrono::duration<double, milli> elapsed =
+				chrono::steady_clock::now() - start;
+
+			cout << " 1/" << scale << " " << setw(7)
+			     << elapsed.count() / BenchmarkFrames << " ms";
+		}
+
+		cout << " per frame" << endl;
+	}
+
+	vector<unsigned char> jpeg_;
+};
+
+TEST_REGISTER(JpegDecoderTest)
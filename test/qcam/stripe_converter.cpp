@@ -0,0 +1,160 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * stripe_converter.cpp - qcam stripe-parallel conversion test and benchmark
+ */
+
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <string.h>
+#include <vector>
+
+#include <linux/drm_fourcc.h>
+
+#include "format_kernels.h"
+#include "stripe_converter.h"
+
+#include "test.h"
+
+using namespace std;
+
+struct FormatDesc {
+	const char *name;
+	unsigned int format;
+	/* Bytes per pixel of the first plane, and chroma subsampling. */
+	unsigned int bpp;
+	unsigned int horzSubSample;
+	unsigned int vertSubSample;
+};
+
+static const FormatDesc formats[] = {
+	{ "NV12", DRM_FORMAT_NV12, 1, 2, 2 },
+	{ "NV16", DRM_FORMAT_NV16, 1, 2, 1 },
+	{ "NV24", DRM_FORMAT_NV24, 1, 1, 1 },
+	{ "YUYV", DRM_FORMAT_YUYV, 2, 0, 1 },
+	{ "RGB888", DRM_FORMAT_RGB888, 3, 0, 1 },
+};
+
+struct FrameSize {
+	unsigned int width;
+	unsigned int height;
+};
+
+static const FrameSize sizes[] = {
+	{ 16, 2 },
+	{ 62, 7 },
+	{ 640, 482 },
+	{ 1920, 1080 },
+};
+
+static const unsigned int threadCounts[] = { 2, 3, 4, 8 };
+
+static constexpr unsigned int BenchmarkFrames = 20;
+
+class StripeConverterTest : public Test
+{
+protected:
+	int run()
+	{
+		mt19937 gen(42);
+		uniform_int_distribution<int> dist(0, 255);
+
+		/* Large enough for all formats at the largest size. */
+		src_.resize(1920 * 1080 * 3);
+		for (unsigned char &value : src_)
+			value = dist(gen);
+
+		for (const FormatDesc &desc : formats) {
+			for (const FrameSize &size : sizes) {
+				if (compare(desc, size))
+					return TestFail;
+			}
+
+			benchmark(desc);
+		}
+
+		return TestPass;
+	}
+
+private:
+	void configure(StripeConverter &converter, const FormatDesc &desc,
+		       const FrameSize &size)
+	{
+		unsigned int chromaStride = desc.horzSubSample
+					  ? size.width * 2 / desc.horzSubSample : 0;
+
+		converter.configure(lineConverter(desc.format), size.width,
+				    size.height, size.width * desc.bpp,
+				    size.width * size.height, chromaStride,
+				    desc.vertSubSample);
+	}
+
+	int compare(const FormatDesc &desc, const FrameSize &size)
+	{
+		unsigned int frameSize = size.width * size.height * 4;
+		vector<unsigned char> expected(frameSize);
+		vector<unsigned char> result(frameSize);
+
+		StripeConverter converter;
+		configure(converter, desc, size);
+		converter.convert(src_.data(), expected.data());
+
+		for (unsigned int threads : threadCounts) {
+			memset(result.data(), 0, frameSize);
+
+			converter.setThreads(threads);
+			configure(converter, desc, size);
+			converter.convert(src_.data(), result.data());
+
+			if (memcmp(expected.data(), result.data(), frameSize)) {
+				cerr << desc.name << ": " << size.width << "x"
+				     << size.height << ": " << threads
+				     << " threads differ from serial conversion"
+				     << endl;
+				return -1;
+			}
+		}
+
+		return 0;
+	}
+
+	double measure(StripeConverter &converter, unsigned char *dst)
+	{
+		auto start = chrono::steady_clock::now();
+
+		for (unsigned int i = 0; i < BenchmarkFrames; ++i)
+			converter.convert(src_.data(), dst);
+
+		chrono::duration<double, milli> elapsed =
+			chrono::steady_clock::now() - start;
+
+		return elapsed.count() / BenchmarkFrames;
+	}
+
+	void benchmark(const FormatDesc &desc)
+	{
+		const FrameSize size = { 1920, 1080 };
+		vector<unsigned char> dst(size.width * size.height * 4);
+		StripeConverter converter;
+
+		configure(converter, desc, size);
+
+		cout << left << setw(8) << desc.name << right << fixed
+		     << setprecision(3);
+
+		for (unsigned int threads : { 1U, 2U, 4U }) {
+			converter.setThreads(threads);
+			cout << " " << threads << " thread(s) " << setw(7)
+			     << measure(converter, dst.data()) << " ms";
+		}
+
+		cout << " per 1920x1080 frame" << endl;
+	}
+
+	vector<unsigned char> src_;
+};
+
+TEST_REGISTER(StripeConverterTest)
@@ -0,0 +1,166 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * raw-unpacker.cpp - RawUnpacker tests
+ */
+
+#include <errno.h>
+#include <iostream>
+#include <stdlib.h>
+#include <vector>
+
+#include <linux/videodev2.h>
+
+#include <libcamera/raw_unpacker.h>
+
+#include "test.h"
+
+using namespace std;
+using namespace libcamera;
+
+class RawUnpackerTest : public Test
+{
+protected:
+	static constexpr unsigned int Lines = 4;
+	static constexpr uint16_t Sentinel = 0xdead;
+
+	/* Pack pixels as a little-endian bit stream, as on IPU3. */
+	static void packIpu3(const uint16_t *pixels, unsigned int width,
+			     uint8_t *line)
+	{
+		for (unsigned int x = 0; x < width; ++x) {
+			uint8_t *block = line + x / 25 * 32;
+			unsigned int bit = x % 25 * 10;
+
+			for (unsigned int i = 0; i < 10; ++i, ++bit) {
+				if (pixels[x] & (1 << i))
+					block[bit / 8] |= 1 << (bit % 8);
+			}
+		}
+	}
+
+	/* Pack pixels in CSI-2 groups of most significant bytes and LSBs. */
+	static void packCsi2(const uint16_t *pixels, unsigned int width,
+			     unsigned int bits, uint8_t *line)
+	{
+		unsigned int lsbBits = bits - 8;
+		unsigned int groupPixels = bits == 12 ? 2 : 4;
+		unsigned int groupBytes = groupPixels * bits / 8;
+
+		for (unsigned int x = 0; x < width; ++x) {
+			uint8_t *group = line + x / groupPixels * groupBytes;
+			unsigned int index = x % groupPixels;
+			unsigned int bit = index * lsbBits;
+
+			group[index] = pixels[x] >> lsbBits;
+
+			for (unsigned int i = 0; i < lsbBits; ++i, ++bit) {
+				if (pixels[x] & (1 << i))
+					group[groupPixels + bit / 8] |= 1 << (bit % 8);
+			}
+		}
+	}
+
+	int check(uint32_t format, unsigned int bits, unsigned int width)
+	{
+		RawUnpacker unpacker;
+
+		if (unpacker.configure(format, width) || unpacker.bitDepth() != bits) {
+			cerr << "Failed to configure unpacker" << endl;
+			return TestFail;
+		}
+
+		/* Pad the lines to check that strides are honoured. */
+		unsigned int srcStride = unpacker.minStride() + 32;
+		unsigned int dstStride = width * 2 + 16;
+
+		vector<uint16_t> pixels(width * Lines);
+		vector<uint8_t> packed(srcStride * Lines, 0);
+
+		for (unsigned int y = 0; y < Lines; ++y) {
+			uint16_t *line = &pixels[y * width];
+
+			for (unsigned int x = 0; x < width; ++x)
+				line[x] = rand() & ((1 << bits) - 1);
+
+			if (format == V4L2_PIX_FMT_IPU3_SGRBG10)
+				packIpu3(line, width, &packed[y * srcStride]);
+			else
+				packCsi2(line, width, bits, &packed[y * srcStride]);
+
+			for (unsigned int i = unpacker.minStride(); i < srcStride; ++i)
+				packed[y * srcStride + i] = rand();
+		}
+
+		/* Unpack in two stripes. */
+		vector<uint16_t> unpacked(dstStride / 2 * Lines, Sentinel);
+
+		unpacker.unpack(packed.data(), srcStride, unpacked.data(),
+				dstStride, 0, Lines / 2);
+		unpacker.unpack(packed.data(), srcStride, unpacked.data(),
+				dstStride, Lines / 2, Lines);
+
+		for (unsigned int y = 0; y < Lines; ++y) {
+			const uint16_t *line = &unpacked[y * dstStride / 2];
+
+			for (unsigned int x = 0; x < width; ++x) {
+				if (line[x] == pixels[y * width + x])
+					continue;
+
+				cerr << bits << "-bit format " << format
+				     << ", width " << width << ": pixel " << x
+				     << "," << y << " is " << line[x]
+				     << ", expected " << pixels[y * width + x]
+				     << endl;
+				return TestFail;
+			}
+
+			for (unsigned int x = width; x < dstStride / 2; ++x) {
+				if (line[x] != Sentinel) {
+					cerr << "Write past the end of line " << y
+					     << " at width " << width << endl;
+					return TestFail;
+				}
+			}
+		}
+
+		return TestPass;
+	}
+
+	int run()
+	{
+		static const struct {
+			uint32_t format;
+			unsigned int bits;
+		} formats[] = {
+			{ V4L2_PIX_FMT_IPU3_SGRBG10, 10 },
+			{ V4L2_PIX_FMT_SBGGR10P, 10 },
+			{ V4L2_PIX_FMT_SRGGB12P, 12 },
+			{ V4L2_PIX_FMT_SGBRG14P, 14 },
+		};
+
+		static const unsigned int widths[] = {
+			1, 3, 8, 16, 24, 25, 33, 50, 99, 640, 641, 1922,
+		};
+
+		for (const auto &format : formats) {
+			for (unsigned int width : widths) {
+				if (check(format.format, format.bits, width))
+					return TestFail;
+			}
+		}
+
+		RawUnpacker unpacker;
+		if (unpacker.configure(V4L2_PIX_FMT_NV12, 640) != -EINVAL ||
+		    unpacker.configure(V4L2_PIX_FMT_SBGGR10P, 0) != -EINVAL ||
+		    unpacker.width() || unpacker.minStride()) {
+			cerr << "Invalid configuration accepted" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+};
+
+TEST_REGISTER(RawUnpackerTest)
@@ -0,0 +1,202 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * raw-video.cpp - Raw video container tests
+ */
+
+#include <iostream>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <vector>
+
+#include <linux/drm_fourcc.h>
+
+#include <libcamera/control_ids.h>
+#include <libcamera/raw_video.h>
+
+#include "test.h"
+
+using namespace std;
+using namespace libcamera;
+
+class RawVideoTest : public Test
+{
+protected:
+	static constexpr unsigned int Frames = 6;
+
+	/*
+	 * Fill the planes of a frame with a pattern that depends on the frame,
+	 * with sizes that aren't multiples of the container alignment.
+	 */
+	static vector<vector<uint8_t>> payload(unsigned int frame)
+	{
+		vector<vector<uint8_t>> planes{
+			vector<uint8_t>(640 * 480 + frame),
+			vector<uint8_t>(640 * 240 + 7),
+		};
+
+		for (unsigned int i = 0; i < planes.size(); ++i) {
+			for (unsigned int j = 0; j < planes[i].size(); ++j)
+				planes[i][j] = frame * 7 + i * 13 + j;
+		}
+
+		return planes;
+	}
+
+	static FrameMetadata metadata(unsigned int frame)
+	{
+		FrameMetadata metadata{};
+		metadata.status = FrameMetadata::FrameSuccess;
+		metadata.sequence = frame * 2;
+		metadata.timestamp = 1000000000ULL + frame * 33333333ULL;
+
+		return metadata;
+	}
+
+	int check(const RawVideoReader &reader, unsigned int index)
+	{
+		RawVideoFrame frame;
+		if (reader.frame(index, &frame)) {
+			cerr << "Failed to read frame " << index << endl;
+			return TestFail;
+		}
+
+		FrameMetadata expected = metadata(index);
+		if (frame.stream != index % 2 ||
+		    frame.metadata.status != expected.status ||
+		    frame.metadata.sequence != expected.sequence ||
+		    frame.metadata.timestamp != expected.timestamp) {
+			cerr << "Invalid metadata for frame " << index << endl;
+			return TestFail;
+		}
+
+		vector<vector<uint8_t>> planes = payload(index);
+		if (frame.planes.size() != planes.size() ||
+		    frame.metadata.planes().size() != planes.size()) {
+			cerr << "Invalid planes for frame " << index << endl;
+			return TestFail;
+		}
+
+		for (unsigned int i = 0; i < planes.size(); ++i) {
+			if (frame.planes[i].size() != planes[i].size() ||
+			    frame.metadata.planes()[i].bytesused != planes[i].size() ||
+			    memcmp(frame.planes[i].data(), planes[i].data(),
+				   planes[i].size())) {
+				cerr << "Invalid payload for frame " << index
+				     << " plane " << i << endl;
+				return TestFail;
+			}
+
+			/* Payloads are page-aligned for zero-copy access. */
+			if (reinterpret_cast<uintptr_t>(frame.planes[i].data()) % 4096) {
+				cerr << "Unaligned payload for frame " << index
+				     << " plane " << i << endl;
+				return TestFail;
+			}
+		}
+
+		return TestPass;
+	}
+
+	int init()
+	{
+		char path[] = "/tmp/libcamera.test.XXXXXX";
+		int fd = mkstemp(path);
+		if (fd < 0)
+			return TestFail;
+
+		::close(fd);
+		path_ = path;
+
+		return TestPass;
+	}
+
+	int run()
+	{
+		RawVideoWriter writer;
+		int ret = writer.open(path_, {
+			{ "main", DRM_FORMAT_NV12, { 640, 480 } },
+			{ "viewfinder", DRM_FORMAT_NV12, { 320, 240 } },
+		});
+		if (ret) {
+			cerr << "Failed to create container" << endl;
+			return TestFail;
+		}
+
+		for (unsigned int i = 0; i < Frames; ++i) {
+			vector<vector<uint8_t>> planes = payload(i);
+			vector<Span<const uint8_t>> spans(planes.begin(), planes.end());
+
+			ControlList controls(controls::controls);
+			controls.set(controls::ManualGain, static_cast<int32_t>(i * 10));
+
+			ret = writer.write(i % 2, metadata(i), spans, controls);
+			if (ret) {
+				cerr << "Failed to write frame " << i << endl;
+				return TestFail;
+			}
+		}
+
+		/* A container that hasn't been closed is scanned. */
+		RawVideoReader reader;
+		if (reader.open(path_) || reader.frames() != Frames) {
+			cerr << "Failed to scan unindexed container" << endl;
+			return TestFail;
+		}
+
+		if (check(reader, Frames - 1) != TestPass)
+			return TestFail;
+
+		if (writer.close()) {
+			cerr << "Failed to close container" << endl;
+			return TestFail;
+		}
+
+		if (reader.open(path_) || reader.frames() != Frames) {
+			cerr << "Failed to open indexed container" << endl;
+			return TestFail;
+		}
+
+		const vector<RawVideoStream> &streams = reader.streams();
+		if (streams.size() != 2 || streams[1].name != "viewfinder" ||
+		    streams[1].pixelFormat != DRM_FORMAT_NV12 ||
+		    streams[1].size != Size(320, 240)) {
+			cerr << "Invalid streams" << endl;
+			return TestFail;
+		}
+
+		/* Access the frames out of order. */
+		for (unsigned int i : { 3U, 0U, 5U, 1U, 4U, 2U }) {
+			if (check(reader, i) != TestPass)
+				return TestFail;
+
+			ControlList controls;
+			if (reader.controls(i, &controls) ||
+			    controls.get(controls::ManualGain) != static_cast<int32_t>(i * 10)) {
+				cerr << "Invalid controls for frame " << i << endl;
+				return TestFail;
+			}
+		}
+
+		RawVideoFrame frame;
+		if (reader.frame(Frames, &frame) != -EINVAL) {
+			cerr << "Out of range frame retrieved" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+	void cleanup()
+	{
+		if (!path_.empty())
+			unlink(path_.c_str());
+	}
+
+private:
+	string path_;
+};
+
+TEST_REGISTER(RawVideoTest)
@@ -0,0 +1,120 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * semaphore.cpp - Semaphore test
+ */
+
+#include <chrono>
+#include <iostream>
+
+#include <libcamera/object.h>
+
+#include "semaphore.h"
+#include "thread.h"
+#include "test.h"
+#include "utils.h"
+
+using namespace std;
+using namespace libcamera;
+
+class ReleaseThread : public Thread
+{
+public:
+	ReleaseThread(Semaphore *semaphore, unsigned int count)
+		: semaphore_(semaphore), count_(count)
+	{
+	}
+
+protected:
+	void run()
+	{
+		for (unsigned int i = 0; i < count_; ++i)
+			semaphore_->release();
+	}
+
+private:
+	Semaphore *semaphore_;
+	unsigned int count_;
+};
+
+class InvokeTarget : public Object
+{
+public:
+	void ping()
+	{
+	}
+};
+
+class SemaphoreTest : public Test
+{
+protected:
+	int run()
+	{
+		/* Test the counting semantics. */
+		Semaphore semaphore(2);
+
+		if (semaphore.available() != 2) {
+			cout << "Invalid initial count" << endl;
+			return TestFail;
+		}
+
+		if (!semaphore.tryAcquire(2) || semaphore.tryAcquire()) {
+			cout << "Failed to acquire available resources" << endl;
+			return TestFail;
+		}
+
+		semaphore.release(3);
+		semaphore.acquire(3);
+		if (semaphore.available() != 0) {
+			cout << "Invalid count after acquisition" << endl;
+			return TestFail;
+		}
+
+		/* Test acquisition of resources released by another thread. */
+		static constexpr unsigned int releases = 10000;
+
+		ReleaseThread releaser(&semaphore, releases);
+		releaser.start();
+
+		for (unsigned int i = 0; i < releases / 10; ++i)
+			semaphore.acquire(10);
+
+		releaser.wait();
+
+		if (semaphore.available() != 0) {
+			cout << "Invalid count after concurrent release" << endl;
+			return TestFail;
+		}
+
+		/*
+		 * Measure the round-trip latency of blocking method invocations,
+		 * which wait on a semaphore for completion.
+		 */
+		static constexpr unsigned int invocations = 10000;
+
+		Thread thread;
+		InvokeTarget target;
+		target.moveToThread(&thread);
+		thread.start();
+
+		utils::time_point start = utils::clock::now();
+
+		for (unsigned int i = 0; i < invocations; ++i)
+			target.invokeMethod(&InvokeTarget::ping,
+					    ConnectionTypeBlocking);
+
+		utils::duration elapsed = utils::clock::now() - start;
+
+		thread.exit(0);
+		thread.wait();
+
+		cout << "Blocking invocation round-trip: "
+		     << chrono::duration_cast<chrono::nanoseconds>(elapsed).count() / invocations
+		     << " ns" << endl;
+
+		return TestPass;
+	}
+};
+
+TEST_REGISTER(SemaphoreTest)
@@ -0,0 +1,87 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * control_array_serialization.cpp - Serialize and deserialize array controls
+ */
+
+#include <array>
+#include <iostream>
+#include <vector>
+
+#include <libcamera/controls.h>
+
+#include "byte_stream_buffer.h"
+#include "control_serializer.h"
+#include "serialization_test.h"
+#include "test.h"
+
+using namespace std;
+using namespace libcamera;
+
+class ControlArraySerializationTest : public Test
+{
+protected:
+	int run() override
+	{
+		ControlSerializer serializer;
+		ControlSerializer deserializer;
+
+		/*
+		 * Create a control list without a ControlInfoMap, with scalar,
+		 * small array and large array values.
+		 */
+		const std::array<float, 2> gains{ { 1.25f, 1.75f } };
+		const std::array<float, 9> ccm{ {
+			1.5f, -0.25f, -0.25f,
+			-0.5f, 1.75f, -0.25f,
+			0.0f, -0.75f, 1.75f,
+		} };
+		std::vector<uint8_t> table(16 * 12);
+		for (unsigned int i = 0; i < table.size(); ++i)
+			table[i] = i;
+
+		ControlList list;
+		list.set(1, ControlValue(true));
+		list.set(2, ControlValue(Span<const float>(gains)));
+		list.set(3, ControlValue(Span<const float>(ccm)));
+		list.set(4, ControlValue(Span<const uint8_t>(table)));
+		list.set(5, ControlValue(static_cast<int64_t>(1) << 40));
+
+		std::vector<uint8_t> data(serializer.binarySize(list));
+		ByteStreamBuffer buffer(data.data(), data.size());
+
+		int ret = serializer.serialize(list, buffer);
+		if (ret < 0 || buffer.overflow()) {
+			cerr << "Failed to serialize ControlList" << endl;
+			return TestFail;
+		}
+
+		buffer = ByteStreamBuffer(const_cast<const uint8_t *>(data.data()),
+					  data.size());
+
+		ControlList newList = deserializer.deserialize<ControlList>(buffer);
+		if (buffer.overflow() ||
+		    !SerializationTest::equals(list, newList)) {
+			cerr << "Deserialized list doesn't match original" << endl;
+			return TestFail;
+		}
+
+		const ControlValue &value = newList.get(3);
+		if (!value.isArray() || value.type() != ControlTypeFloat ||
+		    value.numElements() != ccm.size()) {
+			cerr << "Invalid deserialized array type" << endl;
+			return TestFail;
+		}
+
+		Span<const float> values = value.get<Span<const float>>();
+		if (values[4] != ccm[4]) {
+			cerr << "Invalid deserialized array value" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+};
+
+TEST_REGISTER(ControlArraySerializationTest)
@@ -0,0 +1,158 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * control_delta_serialization.cpp - Delta-encoded ControlList serialization
+ */
+
+#include <iostream>
+#include <vector>
+
+#include <libcamera/controls.h>
+
+#include <ipa/ipa_controls.h>
+
+#include "byte_stream_buffer.h"
+#include "control_serializer.h"
+#include "serialization_test.h"
+#include "test.h"
+
+using namespace std;
+using namespace libcamera;
+
+class ControlDeltaSerializationTest : public Test
+{
+protected:
+	int transfer(const ControlList &list, size_t *size)
+	{
+		data_.resize(serializer_.binarySize(list));
+		ByteStreamBuffer buffer(data_.data(), data_.size());
+
+		if (serializer_.serialize(list, buffer) < 0 || buffer.overflow()) {
+			cerr << "Failed to serialize ControlList" << endl;
+			return TestFail;
+		}
+
+		*size = buffer.offset();
+
+		buffer = ByteStreamBuffer(const_cast<const uint8_t *>(data_.data()),
+					  data_.size());
+		ControlList newList = deserializer_.deserialize<ControlList>(buffer);
+		if (!SerializationTest::equals(list, newList)) {
+			cerr << "Deserialized list doesn't match original" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+	int run() override
+	{
+		const unsigned int keyframeInterval = 4;
+		size_t size;
+
+		serializer_.setDeltaEncoding(keyframeInterval);
+
+		ControlList list;
+		for (unsigned int id = 1; id <= 16; ++id)
+			list.set(id, ControlValue(static_cast<int32_t>(id * 10)));
+
+		/* The first packet is a keyframe. */
+		if (transfer(list, &size) != TestPass)
+			return TestFail;
+
+		const size_t keyframeSize = size;
+
+		/* Change, add and remove controls. */
+		ControlList next = list;
+		next.set(3, ControlValue(42));
+		if (transfer(next, &size) != TestPass)
+			return TestFail;
+
+		if (size >= keyframeSize) {
+			cerr << "Delta packet not smaller than keyframe" << endl;
+			return TestFail;
+		}
+
+		ControlList shrunk;
+		for (const auto &ctrl : next) {
+			if (ctrl.first != 5)
+				shrunk.set(ctrl.first, ctrl.second);
+		}
+		shrunk.set(100, ControlValue(true));
+
+		if (transfer(shrunk, &size) != TestPass)
+			return TestFail;
+
+		if (size >= keyframeSize) {
+			cerr << "Delta packet not smaller than keyframe" << endl;
+			return TestFail;
+		}
+
+		/* An unchanged list produces an empty delta. */
+		if (transfer(shrunk, &size) != TestPass)
+			return TestFail;
+
+		if (size != serializer_.binarySize(ControlList())) {
+			cerr << "Unchanged list produced a non-empty delta" << endl;
+			return TestFail;
+		}
+
+		/* The keyframe interval has elapsed, a full list is expected. */
+		if (transfer(shrunk, &size) != TestPass)
+			return TestFail;
+
+		if (size != serializer_.binarySize(shrunk)) {
+			cerr << "Keyframe expected after " << keyframeInterval
+			     << " packets" << endl;
+			return TestFail;
+		}
+
+		/* A delta applied out of sequence must be rejected. */
+		ControlList other = shrunk;
+		other.set(1, ControlValue(0));
+
+		data_.resize(serializer_.binarySize(other));
+		ByteStreamBuffer buffer(data_.data(), data_.size());
+		serializer_.serialize(other, buffer);
+
+		other.set(2, ControlValue(0));
+		std::vector<uint8_t> skipped(serializer_.binarySize(other));
+		buffer = ByteStreamBuffer(skipped.data(), skipped.size());
+		serializer_.serialize(other, buffer);
+
+		buffer = ByteStreamBuffer(const_cast<const uint8_t *>(skipped.data()),
+					  skipped.size());
+		ControlList newList = deserializer_.deserialize<ControlList>(buffer);
+		if (!newList.empty()) {
+			cerr << "Out of sequence delta not detected" << endl;
+			return TestFail;
+		}
+
+		/* Packets with unknown flags must be rejected. */
+		ControlSerializer plain;
+		data_.resize(plain.binarySize(list));
+		buffer = ByteStreamBuffer(data_.data(), data_.size());
+		plain.serialize(list, buffer);
+
+		reinterpret_cast<ipa_controls_header *>(data_.data())->flags |= 1U << 31;
+
+		ControlSerializer fresh;
+		buffer = ByteStreamBuffer(const_cast<const uint8_t *>(data_.data()),
+					  data_.size());
+		newList = fresh.deserialize<ControlList>(buffer);
+		if (!newList.empty()) {
+			cerr << "Packet with unknown flags not rejected" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+private:
+	ControlSerializer serializer_;
+	ControlSerializer deserializer_;
+	std::vector<uint8_t> data_;
+};
+
+TEST_REGISTER(ControlDeltaSerializationTest)
@@ -0,0 +1,103 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * control_list_view.cpp - Access serialized controls through a ControlListView
+ */
+
+#include <array>
+#include <iostream>
+#include <vector>
+
+#include <libcamera/control_ids.h>
+#include <libcamera/controls.h>
+
+#include "byte_stream_buffer.h"
+#include "control_serializer.h"
+#include "serialization_test.h"
+#include "test.h"
+
+using namespace std;
+using namespace libcamera;
+
+static const Control<Span<const float>> ColourGains(1000, "ColourGains");
+
+class ControlListViewTest : public Test
+{
+protected:
+	int run() override
+	{
+		ControlSerializer serializer;
+		ControlSerializer deserializer;
+
+		const std::array<float, 2> gains{ { 1.25f, 1.75f } };
+
+		ControlList list;
+		list.set(controls::AeEnable, true);
+		list.set(controls::Brightness, 128);
+		list.set(controls::ManualExposure, 2000);
+		list.set(ColourGains, Span<const float>(gains));
+
+		std::vector<uint8_t> data(serializer.binarySize(list));
+		ByteStreamBuffer buffer(data.data(), data.size());
+
+		if (serializer.serialize(list, buffer) < 0 || buffer.overflow()) {
+			cerr << "Failed to serialize ControlList" << endl;
+			return TestFail;
+		}
+
+		buffer = ByteStreamBuffer(const_cast<const uint8_t *>(data.data()),
+					  data.size());
+		ControlListView view = deserializer.deserialize<ControlListView>(buffer);
+
+		/* Release the serialized data, the view must keep its own copy. */
+		data.assign(data.size(), 0xff);
+
+		if (view.size() != list.size()) {
+			cerr << "Invalid view size " << view.size() << endl;
+			return TestFail;
+		}
+
+		if (!view.contains(controls::BRIGHTNESS) ||
+		    view.contains(controls::CONTRAST)) {
+			cerr << "Invalid view contents" << endl;
+			return TestFail;
+		}
+
+		if (view.get(controls::AeEnable) != true ||
+		    view.get(controls::Brightness) != 128 ||
+		    view.get(controls::ManualExposure) != 2000 ||
+		    view.get(controls::Contrast) != 0) {
+			cerr << "Invalid scalar values" << endl;
+			return TestFail;
+		}
+
+		Span<const float> values = view.get(ColourGains);
+		if (values.size() != gains.size() || values[0] != gains[0] ||
+		    values[1] != gains[1]) {
+			cerr << "Invalid array value" << endl;
+			return TestFail;
+		}
+
+		/* Copies of the view should share the packet. */
+		ControlListView copy = view;
+		if (copy.get(ColourGains).data() != values.data()) {
+			cerr << "View copy doesn't share data" << endl;
+			return TestFail;
+		}
+
+		if (view.get(controls::BRIGHTNESS) != ControlValue(128)) {
+			cerr << "Invalid value by ID" << endl;
+			return TestFail;
+		}
+
+		if (!SerializationTest::equals(list, view.toControlList())) {
+			cerr << "Reconstructed list doesn't match original" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+};
+
+TEST_REGISTER(ControlListViewTest)
@@ -0,0 +1,113 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * control_malformed_serialization.cpp - Deserialize malformed control packets
+ */
+
+#include <iostream>
+#include <vector>
+
+#include <libcamera/control_ids.h>
+#include <libcamera/controls.h>
+
+#include <ipa/ipa_controls.h>
+
+#include "byte_stream_buffer.h"
+#include "control_serializer.h"
+#include "test.h"
+
+using namespace std;
+using namespace libcamera;
+
+class ControlMalformedSerializationTest : public Test
+{
+protected:
+	/*
+	 * Serialize a single entry \a list, and patch the type and element
+	 * count of its entry.
+	 */
+	vector<uint8_t> malformedList(const ControlList &list, uint32_t type,
+				      uint32_t count)
+	{
+		ControlSerializer serializer;
+		vector<uint8_t> data(serializer.binarySize(list));
+		ByteStreamBuffer buffer(data.data(), data.size());
+		serializer.serialize(list, buffer);
+
+		auto *entry = reinterpret_cast<ipa_control_value_entry *>(
+			data.data() + sizeof(ipa_controls_header));
+		entry->type = type;
+		entry->count = count;
+		entry->is_array = count > 1;
+
+		return data;
+	}
+
+	int run() override
+	{
+		ControlList list(controls::controls);
+		list.set(controls::AeEnable, true);
+
+		/* Invalid types and oversized arrays shall be rejected. */
+		const struct {
+			uint32_t type;
+			uint32_t count;
+		} cases[] = {
+			{ ControlTypeRectangle + 1, 1 },
+			{ 0xff, 1 },
+			{ ControlTypeInteger32, 0x20000000 },
+			{ ControlTypeRectangle, 2 },
+		};
+
+		for (const auto &c : cases) {
+			vector<uint8_t> data = malformedList(list, c.type, c.count);
+
+			ControlSerializer deserializer;
+			ByteStreamBuffer buffer(const_cast<const uint8_t *>(data.data()),
+						data.size());
+			ControlList result = deserializer.deserialize<ControlList>(buffer);
+			if (!result.empty()) {
+				cerr << "Malformed ControlList entry (type " << c.type
+				     << ", count " << c.count << ") accepted" << endl;
+				return TestFail;
+			}
+
+			buffer = ByteStreamBuffer(const_cast<const uint8_t *>(data.data()),
+						  data.size());
+			ControlListView view = deserializer.deserialize<ControlListView>(buffer);
+			if (!view.empty()) {
+				cerr << "Malformed ControlListView entry (type " << c.type
+				     << ", count " << c.count << ") accepted" << endl;
+				return TestFail;
+			}
+		}
+
+		/* Range entries with an invalid type shall be rejected. */
+		ControlInfoMap infoMap({
+			{ &controls::Brightness, ControlRange(0, 255) },
+		});
+
+		ControlSerializer serializer;
+		vector<uint8_t> data(serializer.binarySize(infoMap));
+		ByteStreamBuffer buffer(data.data(), data.size());
+		serializer.serialize(infoMap, buffer);
+
+		auto *entry = reinterpret_cast<ipa_control_range_entry *>(
+			data.data() + sizeof(ipa_controls_header));
+		entry->type = ControlTypeRectangle + 1;
+
+		ControlSerializer deserializer;
+		buffer = ByteStreamBuffer(const_cast<const uint8_t *>(data.data()),
+					  data.size());
+		ControlInfoMap result = deserializer.deserialize<ControlInfoMap>(buffer);
+		if (!result.empty()) {
+			cerr << "Malformed ControlInfoMap entry accepted" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+};
+
+TEST_REGISTER(ControlMalformedSerializationTest)
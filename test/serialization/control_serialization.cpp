@@ -6,6 +6,7 @@
  */
 
 #include <iostream>
+#include <string.h>
 
 #include <libcamera/camera.h>
 #include <libcamera/control_ids.h>
@@ -83,6 +84,19 @@ protected:
 			return TestFail;
 		}
 
+		/*
+		 * The serialized map is cached and shared with copies of the
+		 * map, serializing a copy shall produce identical data.
+		 */
+		ControlSerializer otherSerializer;
+		ControlInfoMap infoMapCopy = infoMap;
+		Span<const uint8_t> cached = otherSerializer.serialize(infoMapCopy);
+		if (cached.size() != infoData.size() ||
+		    memcmp(cached.data(), infoData.data(), infoData.size())) {
+			cerr << "Cached ControlInfoMap data doesn't match" << endl;
+			return TestFail;
+		}
+
 		/* Serialize the control list, this should now succeed. */
 		size = serializer.binarySize(list);
 		listData.resize(size);
@@ -159,6 +173,27 @@ protected:
 			return TestFail;
 		}
 
+		/* Deserialize the list in place, reusing its storage. */
+		buffer = ByteStreamBuffer(const_cast<const uint8_t *>(listData.data()),
+					  listData.size());
+
+		const void *storage = &*newList.begin();
+		if (deserializer.deserialize(buffer, &newList) < 0) {
+			cerr << "Failed to deserialize ControlList in place" << endl;
+			return TestFail;
+		}
+
+		if (!equals(list, newList)) {
+			cerr << "Deserialized list doesn't match original" << endl;
+			return TestFail;
+		}
+
+		if (&*newList.begin() != storage) {
+			cerr << "In-place deserialization reallocated storage"
+			     << endl;
+			return TestFail;
+		}
+
 		return TestPass;
 	}
 };
@@ -5,11 +5,13 @@
  * signal-threads.cpp - Cross-thread signal delivery test
  */
 
+#include <atomic>
 #include <chrono>
 #include <iostream>
 #include <thread>
 
 #include "message.h"
+#include "semaphore.h"
 #include "thread.h"
 #include "test.h"
 #include "utils.h"
@@ -17,6 +19,18 @@
 using namespace std;
 using namespace libcamera;
 
+class Payload
+{
+public:
+	Payload() {}
+	Payload(const Payload &) { copies++; }
+	Payload(Payload &&) {}
+
+	static std::atomic<unsigned int> copies;
+};
+
+std::atomic<unsigned int> Payload::copies(0);
+
 class SignalReceiver : public Object
 {
 public:
@@ -27,16 +41,18 @@ public:
 	};
 
 	SignalReceiver()
-		: status_(NoSignal)
+		: status_(NoSignal), value_(0), count_(0)
 	{
 	}
 
 	Status status() const { return status_; }
 	int value() const { return value_; }
+	unsigned int count() const { return count_; }
 	void reset()
 	{
 		status_ = NoSignal;
 		value_ = 0;
+		count_ = 0;
 	}
 
 	void slot(int value)
@@ -47,11 +63,23 @@ public:
 			status_ = SignalReceived;
 
 		value_ = value;
+		count_++;
+	}
+
+	void wait(Semaphore *semaphore)
+	{
+		semaphore->acquire();
+	}
+
+	void payloadSlot(const Payload &payload)
+	{
+		status_ = SignalReceived;
 	}
 
 private:
 	Status status_;
 	int value_;
+	unsigned int count_;
 };
 
 class SignalThreadsTest : public Test
@@ -107,6 +135,68 @@ protected:
 			return TestFail;
 		}
 
+		/*
+		 * Test that queued delivery to multiple slots copies read-only
+		 * arguments once.
+		 */
+		SignalReceiver other;
+		other.moveToThread(&thread_);
+		receiver.reset();
+
+		Signal<const Payload &> payloadSignal;
+		payloadSignal.connect(&receiver, &SignalReceiver::payloadSlot);
+		payloadSignal.connect(&other, &SignalReceiver::payloadSlot);
+
+		payloadSignal.emit(Payload());
+
+		this_thread::sleep_for(chrono::milliseconds(100));
+
+		if (receiver.status() != SignalReceiver::SignalReceived ||
+		    other.status() != SignalReceiver::SignalReceived) {
+			cout << "Payload signal not received" << endl;
+			return TestFail;
+		}
+
+		if (Payload::copies != 1) {
+			cout << "Payload copied " << Payload::copies
+			     << " times for two slots" << endl;
+			return TestFail;
+		}
+
+		/*
+		 * Test that conflated emissions are delivered once, with the
+		 * latest value, while the receiver is busy.
+		 */
+		Semaphore semaphore;
+		Signal<int> conflatedSignal;
+		conflatedSignal.connect(&receiver, &SignalReceiver::slot,
+					ConnectionTypeConflated);
+		receiver.reset();
+
+		receiver.invokeMethod(&SignalReceiver::wait, ConnectionTypeQueued,
+				      &semaphore);
+		for (int i = 1; i <= 10; ++i)
+			conflatedSignal.emit(i);
+		semaphore.release();
+
+		this_thread::sleep_for(chrono::milliseconds(100));
+
+		if (receiver.count() != 1 || receiver.value() != 10) {
+			cout << "Conflated signal received " << receiver.count()
+			     << " times with value " << receiver.value() << endl;
+			return TestFail;
+		}
+
+		/* Emissions after delivery must be queued again. */
+		conflatedSignal.emit(11);
+
+		this_thread::sleep_for(chrono::milliseconds(100));
+
+		if (receiver.count() != 2 || receiver.value() != 11) {
+			cout << "Conflated signal not received after delivery" << endl;
+			return TestFail;
+		}
+
 		return TestPass;
 	}
 
@@ -6,6 +6,8 @@
  */
 
 #include <iostream>
+#include <new>
+#include <stdlib.h>
 #include <string.h>
 
 #include <libcamera/object.h>
@@ -16,6 +18,31 @@
 using namespace std;
 using namespace libcamera;
 
+static bool countAllocations = false;
+static unsigned int allocations = 0;
+
+void *operator new(std::size_t size)
+{
+	if (countAllocations)
+		allocations++;
+
+	void *ptr = malloc(size ? size : 1);
+	if (!ptr)
+		throw std::bad_alloc();
+
+	return ptr;
+}
+
+void operator delete(void *ptr) noexcept
+{
+	free(ptr);
+}
+
+void operator delete(void *ptr, std::size_t size) noexcept
+{
+	free(ptr);
+}
+
 static int valueStatic_ = 0;
 
 static void slotStatic(int value)
@@ -74,6 +101,12 @@ protected:
 		signalVoid_.disconnect(this, &SignalTest::slotDisconnect);
 	}
 
+	void slotDisconnectInteger(int value)
+	{
+		values_[0] = value;
+		signalInt_.disconnect(this, &SignalTest::slotInteger2);
+	}
+
 	void slotInteger1(int value)
 	{
 		values_[0] = value;
@@ -184,6 +217,47 @@ protected:
 			return TestFail;
 		}
 
+		/*
+		 * Test disconnection of another slot from a slot. Neither the
+		 * emission in progress nor subsequent emissions shall call the
+		 * disconnected slot.
+		 */
+		signalInt_.disconnect();
+		signalInt_.connect(this, &SignalTest::slotDisconnectInteger);
+		signalInt_.connect(this, &SignalTest::slotInteger2);
+
+		memset(values_, 0, sizeof(values_));
+		signalInt_.emit(42);
+		if (values_[0] != 42 || values_[1] != 0) {
+			cout << "Signal emission during disconnection test failed" << endl;
+			return TestFail;
+		}
+
+		memset(values_, 0, sizeof(values_));
+		signalInt_.emit(42);
+		if (values_[0] != 42 || values_[1] != 0) {
+			cout << "Signal disconnection from other slot test failed" << endl;
+			return TestFail;
+		}
+
+		/* Test that signal emission doesn't allocate memory. */
+		signalInt_.disconnect();
+		signalInt_.connect(this, &SignalTest::slotInteger1);
+		signalInt_.connect(this, &SignalTest::slotInteger2);
+		signalInt_.connect(slotStatic);
+
+		allocations = 0;
+		countAllocations = true;
+		signalInt_.emit(42);
+		countAllocations = false;
+
+		if (allocations) {
+			cout << "Signal emission allocated memory" << endl;
+			return TestFail;
+		}
+
+		signalInt_.disconnect();
+
 		/*
 		 * Test connecting to slots that return a value. This targets
 		 * compilation, there's no need to check runtime results.
@@ -0,0 +1,448 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * software-isp.cpp - SoftwareIsp test and benchmark
+ */
+
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <vector>
+
+#include <linux/drm_fourcc.h>
+#include <linux/videodev2.h>
+
+#include <libcamera/buffer.h>
+#include <libcamera/event_dispatcher.h>
+#include <libcamera/mapped_framebuffer.h>
+#include <libcamera/stream.h>
+#include <libcamera/timer.h>
+
+#include "software_isp.h"
+#include "thread.h"
+
+#include "test.h"
+
+using namespace std;
+using namespace libcamera;
+
+namespace {
+
+enum Colour {
+	Red,
+	Green,
+	Blue,
+};
+
+struct BayerFormat {
+	uint32_t fourcc;
+	Colour colours[2][2];
+};
+
+const BayerFormat bayerFormats[] = {
+	{ V4L2_PIX_FMT_SBGGR10, { { Blue, Green }, { Green, Red } } },
+	{ V4L2_PIX_FMT_SGBRG10, { { Green, Blue }, { Red, Green } } },
+	{ V4L2_PIX_FMT_SGRBG10, { { Green, Red }, { Blue, Green } } },
+	{ V4L2_PIX_FMT_SRGGB10, { { Red, Green }, { Green, Blue } } },
+};
+
+/* A scene whose colours vary linearly, reproduced exactly by bilinear demosaicing. */
+unsigned int sceneColour(Colour colour, unsigned int x, unsigned int y)
+{
+	switch (colour) {
+	case Red:
+		return 2 * x + 100;
+	case Green:
+		return 3 * y + 50;
+	default:
+		return 400;
+	}
+}
+
+} /* namespace */
+
+class SoftwareIspTest : public Test
+{
+public:
+	SoftwareIspTest()
+		: inputs_(0), outputs_(0), status_(FrameMetadata::FrameError)
+	{
+	}
+
+protected:
+	void inputBufferReady(FrameBuffer *buffer)
+	{
+		inputs_++;
+	}
+
+	void statsReady(FrameBuffer *buffer, const SoftwareIspStats &stats)
+	{
+		stats_ = stats;
+	}
+
+	void outputBufferReady(FrameBuffer *buffer)
+	{
+		outputs_++;
+		status_ = buffer->metadata().status;
+	}
+
+	unique_ptr<FrameBuffer> createBuffer(unsigned int length)
+	{
+		int fd = memfd_create("software-isp-test", 0);
+		if (fd < 0 || ftruncate(fd, length) < 0) {
+			if (fd >= 0)
+				close(fd);
+			return nullptr;
+		}
+
+		FrameBuffer::Plane plane;
+		plane.fd = FileDescriptor(fd);
+		plane.length = length;
+		close(fd);
+
+		return make_unique<FrameBuffer>(vector<FrameBuffer::Plane>{ plane });
+	}
+
+	int configure(uint32_t input, PixelFormat output, const Size &size,
+		      unsigned int stride)
+	{
+		StreamConfiguration inputCfg;
+		inputCfg.pixelFormat = input;
+		inputCfg.size = size;
+
+		StreamConfiguration outputCfg;
+		outputCfg.pixelFormat = output;
+		outputCfg.size = size;
+
+		if (isp_->configure(inputCfg, stride, outputCfg)) {
+			cerr << "Failed to configure " << size.toString() << endl;
+			return -1;
+		}
+
+		buffers_.clear();
+		if (isp_->exportBuffers(1, &buffers_) != 1) {
+			cerr << "Failed to export buffers" << endl;
+			return -1;
+		}
+
+		input_ = createBuffer(stride * size.height);
+		if (!input_) {
+			cerr << "Failed to create input buffer" << endl;
+			return -1;
+		}
+
+		return 0;
+	}
+
+	int processFrame()
+	{
+		EventDispatcher *dispatcher = Thread::current()->eventDispatcher();
+		unsigned int outputs = outputs_;
+
+		if (isp_->start() ||
+		    isp_->queueBuffers(input_.get(), buffers_[0].get())) {
+			cerr << "Failed to queue buffers" << endl;
+			return -1;
+		}
+
+		Timer timeout;
+		timeout.start(1000);
+		while (outputs_ == outputs && timeout.isRunning())
+			dispatcher->processEvents();
+
+		isp_->stop();
+
+		if (outputs_ != outputs + 1 || inputs_ != outputs_ ||
+		    status_ != FrameMetadata::FrameSuccess) {
+			cerr << "Frame not processed" << endl;
+			return -1;
+		}
+
+		return 0;
+	}
+
+	/* Check the demosaicing of all Bayer orders on a gradient. */
+	int testDemosaic()
+	{
+		/* Use a width that exercises the scalar code of the kernels. */
+		const Size size(250, 180);
+		const unsigned int stride = size.width * 2;
+
+		SoftwareIspParams params;
+		params.gamma = 1.0;
+		isp_->setParams(params);
+
+		for (const BayerFormat &format : bayerFormats) {
+			if (configure(format.fourcc, DRM_FORMAT_RGB888, size, stride))
+				return TestFail;
+
+			{
+				MappedFrameBuffer mapped(input_.get(), MappedFrameBuffer::MapWrite);
+				uint16_t *src = reinterpret_cast<uint16_t *>(mapped.planes()[0].data);
+
+				for (unsigned int y = 0; y < size.height; ++y) {
+					for (unsigned int x = 0; x < size.width; ++x) {
+						Colour colour = format.colours[y % 2][x % 2];
+						src[y * size.width + x] = sceneColour(colour, x, y);
+					}
+				}
+			}
+
+			if (processFrame())
+				return TestFail;
+
+			MappedFrameBuffer mapped(buffers_[0].get());
+			const uint8_t *dst = mapped.planes()[0].data;
+
+			/*
+			 * The frame borders are mirrored, check the interior
+			 * only. RGB888 is stored as BGR in memory.
+			 */
+			for (unsigned int y = 1; y < size.height - 1; ++y) {
+				for (unsigned int x = 1; x < size.width - 1; ++x) {
+					const uint8_t *pixel = &dst[(y * size.width + x) * 3];
+
+					for (unsigned int c = 0; c < 3; ++c) {
+						Colour colour = static_cast<Colour>(c);
+						int expected = sceneColour(colour, x, y) * 255 / 1023.0 + 0.5;
+
+						if (abs(pixel[2 - c] - expected) > 1) {
+							cerr << "Wrong colour " << c << " at "
+							     << x << "," << y << " for format "
+							     << utils::hex(format.fourcc) << ": "
+							     << static_cast<int>(pixel[2 - c])
+							     << " instead of " << expected << endl;
+							return TestFail;
+						}
+					}
+				}
+			}
+		}
+
+		return TestPass;
+	}
+
+	/*
+	 * Check the black level, white balance and statistics on a flat field
+	 * stored in a packed format, processed to NV12.
+	 */
+	int testFlatField()
+	{
+		const Size size(320, 240);
+		const unsigned int stride = size.width * 5 / 4;
+		const unsigned int values[] = { 464, 864, 264 };
+
+		SoftwareIspParams params;
+		params.blackLevel = 64 << 6;
+		params.gains = { 2.0, 1.0, 4.0 };
+		params.gamma = 1.0;
+		isp_->setParams(params);
+
+		if (configure(V4L2_PIX_FMT_SRGGB10P, DRM_FORMAT_NV12, size, stride))
+			return TestFail;
+
+		{
+			MappedFrameBuffer mapped(input_.get(), MappedFrameBuffer::MapWrite);
+			uint8_t *src = mapped.planes()[0].data;
+
+			for (unsigned int y = 0; y < size.height; ++y) {
+				const Colour *colours = bayerFormats[3].colours[y % 2];
+				uint8_t *line = src + y * stride;
+
+				for (unsigned int x = 0; x < size.width; x += 4, line += 5) {
+					line[4] = 0;
+
+					for (unsigned int i = 0; i < 4; ++i) {
+						unsigned int value = values[colours[i % 2]];
+						line[i] = value >> 2;
+						line[4] |= (value & 3) << (i * 2);
+					}
+				}
+			}
+		}
+
+		if (processFrame())
+			return TestFail;
+
+		/* The balanced values are 800 above the black level, on 959. */
+		const int grey = 800 * 255 / 959.0 + 0.5;
+		const int luma = (((66 + 129 + 25) * grey + 128) >> 8) + 16;
+
+		MappedFrameBuffer mapped(buffers_[0].get());
+		const uint8_t *y = mapped.planes()[0].data;
+		const uint8_t *uv = y + size.width * size.height;
+
+		for (unsigned int i = 0; i < size.width * size.height; ++i) {
+			if (abs(y[i] - luma) > 1) {
+				cerr << "Wrong luma " << static_cast<int>(y[i])
+				     << " instead of " << luma << endl;
+				return TestFail;
+			}
+		}
+
+		for (unsigned int i = 0; i < size.width * size.height / 2; ++i) {
+			if (abs(uv[i] - 128) > 1) {
+				cerr << "Wrong chroma " << static_cast<int>(uv[i]) << endl;
+				return TestFail;
+			}
+		}
+
+		const unsigned int pixels = size.width * size.height;
+		if (stats_.counts[0] != pixels / 4 || stats_.counts[1] != pixels / 2 ||
+		    stats_.counts[2] != pixels / 4 || stats_.bitDepth != 10) {
+			cerr << "Wrong statistics pixel counts" << endl;
+			return TestFail;
+		}
+
+		for (unsigned int c = 0; c < 3; ++c) {
+			if (stats_.sums[c] != values[c] * stats_.counts[c]) {
+				cerr << "Wrong statistics sum for colour " << c << endl;
+				return TestFail;
+			}
+		}
+
+		for (uint8_t value : stats_.luminance) {
+			if (abs(value - grey) > 1) {
+				cerr << "Wrong luminance " << static_cast<int>(value)
+				     << " instead of " << grey << endl;
+				return TestFail;
+			}
+		}
+
+		return TestPass;
+	}
+
+	/* Stopping the SoftwareIsp shall return all queued buffers. */
+	int testStop()
+	{
+		constexpr unsigned int Frames = 8;
+		const Size size(1280, 720);
+
+		if (configure(V4L2_PIX_FMT_SGRBG10, DRM_FORMAT_BGR888, size,
+			      size.width * 2))
+			return TestFail;
+
+		inputs_ = 0;
+		outputs_ = 0;
+
+		if (isp_->start())
+			return TestFail;
+
+		for (unsigned int i = 0; i < Frames; ++i)
+			isp_->queueBuffers(input_.get(), buffers_[0].get());
+
+		isp_->stop();
+
+		if (inputs_ != Frames || outputs_ != Frames) {
+			cerr << "Buffers not returned when stopping: "
+			     << inputs_ << " inputs, " << outputs_ << " outputs"
+			     << endl;
+			return TestFail;
+		}
+
+		if (isp_->queueBuffers(input_.get(), buffers_[0].get()) != -EINVAL) {
+			cerr << "Buffers queued to a stopped ISP" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+	void benchmark()
+	{
+		constexpr unsigned int Frames = 10;
+		const Size size(1920, 1080);
+
+		if (configure(V4L2_PIX_FMT_SRGGB10, DRM_FORMAT_NV12, size,
+			      size.width * 2))
+			return;
+
+		utils::duration total{};
+		for (unsigned int i = 0; i < Frames; ++i) {
+			if (processFrame())
+				return;
+
+			total += stats_.processingTime;
+		}
+
+		chrono::duration<double, milli> elapsed = total;
+		cout << "SRGGB10 " << size.toString() << " to NV12: " << fixed
+		     << setprecision(3) << elapsed.count() / Frames
+		     << " ms per frame" << endl;
+	}
+
+	int init() override
+	{
+		isp_ = make_unique<SoftwareIsp>(4);
+		isp_->inputBufferReady.connect(this, &SoftwareIspTest::inputBufferReady);
+		isp_->statsReady.connect(this, &SoftwareIspTest::statsReady);
+		isp_->outputBufferReady.connect(this, &SoftwareIspTest::outputBufferReady);
+
+		return TestPass;
+	}
+
+	int run() override
+	{
+		if (!SoftwareIsp::formats(V4L2_PIX_FMT_YUYV).empty()) {
+			cerr << "Non-Bayer input format reported as supported" << endl;
+			return TestFail;
+		}
+
+		/* Odd sizes and mismatched output sizes are rejected. */
+		StreamConfiguration inputCfg;
+		inputCfg.pixelFormat = V4L2_PIX_FMT_SRGGB8;
+		inputCfg.size = Size(641, 480);
+		StreamConfiguration outputCfg;
+		outputCfg.pixelFormat = DRM_FORMAT_NV12;
+		outputCfg.size = inputCfg.size;
+
+		if (isp_->configure(inputCfg, 1024, outputCfg) != -EINVAL) {
+			cerr << "Odd size accepted" << endl;
+			return TestFail;
+		}
+
+		inputCfg.size = Size(640, 480);
+		if (isp_->configure(inputCfg, 1024, outputCfg) != -EINVAL) {
+			cerr << "Output size mismatch accepted" << endl;
+			return TestFail;
+		}
+
+		if (testDemosaic() != TestPass)
+			return TestFail;
+
+		if (testFlatField() != TestPass)
+			return TestFail;
+
+		if (testStop() != TestPass)
+			return TestFail;
+
+		benchmark();
+
+		return TestPass;
+	}
+
+	void cleanup() override
+	{
+		buffers_.clear();
+		input_.reset();
+		isp_.reset();
+	}
+
+private:
+	unique_ptr<SoftwareIsp> isp_;
+	unique_ptr<FrameBuffer> input_;
+	vector<unique_ptr<FrameBuffer>> buffers_;
+
+	unsigned int inputs_;
+	unsigned int outputs_;
+	FrameMetadata::Status status_;
+	SoftwareIspStats stats_;
+};
+
+TEST_REGISTER(SoftwareIspTest)
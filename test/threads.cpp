@@ -6,9 +6,15 @@
  */
 
 #include <chrono>
+#include <errno.h>
+#include <fstream>
 #include <iostream>
+#include <sched.h>
+#include <string>
 #include <thread>
 
+#include <libcamera/object.h>
+
 #include "thread.h"
 #include "test.h"
 
@@ -35,6 +41,46 @@ private:
 	unsigned int iterations_;
 };
 
+class AttributesThread : public Thread
+{
+public:
+	AttributesThread()
+		: cpus_(0), policy_(-1)
+	{
+	}
+
+	const std::string &name() const { return name_; }
+	int cpus() const { return cpus_; }
+	int policy() const { return policy_; }
+
+protected:
+	void run()
+	{
+		std::ifstream comm("/proc/thread-self/comm");
+		std::getline(comm, name_);
+
+		cpu_set_t cpuset;
+		if (!sched_getaffinity(0, sizeof(cpuset), &cpuset))
+			cpus_ = CPU_COUNT(&cpuset);
+
+		policy_ = sched_getscheduler(0);
+	}
+
+private:
+	std::string name_;
+	int cpus_;
+	int policy_;
+};
+
+class SlowObject : public Object
+{
+public:
+	void work()
+	{
+		this_thread::sleep_for(chrono::milliseconds(10));
+	}
+};
+
 class ThreadTest : public Test
 {
 protected:
@@ -82,6 +128,91 @@ protected:
 
 		delete thread;
 
+		/* Test thread attributes applied at start time. */
+		AttributesThread attrThread;
+
+		if (attrThread.setName("libcamera-test-thread") ||
+		    attrThread.setAffinity({ 0 })) {
+			cout << "Failed to set thread attributes" << endl;
+			return TestFail;
+		}
+
+		if (attrThread.setSchedulingPolicy(Thread::SchedulingPolicyDefault, 1) != -EINVAL) {
+			cout << "Invalid priority accepted" << endl;
+			return TestFail;
+		}
+
+		attrThread.start();
+		attrThread.wait();
+
+		if (attrThread.name() != "libcamera-test-") {
+			cout << "Thread name not applied: " << attrThread.name()
+			     << endl;
+			return TestFail;
+		}
+
+		if (attrThread.cpus() != 1) {
+			cout << "Thread affinity not applied" << endl;
+			return TestFail;
+		}
+
+		if (attrThread.policy() != SCHED_OTHER) {
+			cout << "Unexpected scheduling policy" << endl;
+			return TestFail;
+		}
+
+		/* Test event loop statistics. */
+		Thread statsThread;
+		SlowObject slowObject;
+		slowObject.moveToThread(&statsThread);
+		statsThread.start();
+
+		this_thread::sleep_for(chrono::milliseconds(50));
+
+		for (unsigned int i = 0; i < 5; ++i)
+			slowObject.invokeMethod(&SlowObject::work,
+						ConnectionTypeQueued);
+
+		this_thread::sleep_for(chrono::milliseconds(100));
+
+		ThreadStatistics stats = statsThread.statistics(true);
+
+		statsThread.exit(0);
+		statsThread.wait();
+
+		if (stats.messages != 5) {
+			cout << "Invalid number of dispatched messages: "
+			     << stats.messages << endl;
+			return TestFail;
+		}
+
+		if (stats.maxQueueDepth < 1 || stats.maxQueueDepth > 5) {
+			cout << "Invalid maximum queue depth" << endl;
+			return TestFail;
+		}
+
+		if (stats.slowestHandler < chrono::milliseconds(10) ||
+		    stats.busyTime < chrono::milliseconds(50)) {
+			cout << "Invalid handler time" << endl;
+			return TestFail;
+		}
+
+		if (stats.sleepTime < chrono::milliseconds(40)) {
+			cout << "Invalid sleep time" << endl;
+			return TestFail;
+		}
+
+		/* The last message waited for the four previous ones. */
+		if (stats.latencyPercentile(100) < chrono::milliseconds(20)) {
+			cout << "Invalid dispatch latency" << endl;
+			return TestFail;
+		}
+
+		if (statsThread.statistics().messages) {
+			cout << "Statistics not reset" << endl;
+			return TestFail;
+		}
+
 		return TestPass;
 	}
 
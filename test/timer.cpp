@@ -11,6 +11,7 @@
 #include <libcamera/event_dispatcher.h>
 #include <libcamera/timer.h>
 
+#include "event_dispatcher_epoll.h"
 #include "test.h"
 #include "thread.h"
 
@@ -55,6 +56,11 @@ public:
 		return isRunning() || count_ != 1 || jitter() > 50;
 	}
 
+	bool early()
+	{
+		return expiration_ < deadline();
+	}
+
 private:
 	void timeoutHandler(Timer *timer)
 	{
@@ -200,6 +206,47 @@ protected:
 		timer.start(200);
 		dispatcher->processEvents();
 
+		/*
+		 * Timers with a slack are coalesced with the next wake-up after
+		 * their deadline, and never expire early.
+		 */
+		timer.setSlack(std::chrono::milliseconds(200));
+		timer.start(100);
+		timer2.start(200);
+
+		dispatcher->processEvents();
+
+		if (timer.isRunning() || timer.early() || timer2.hasFailed()) {
+			cout << "Timer coalescing test failed" << endl;
+			return TestFail;
+		}
+
+		/* Timers with only a slack wait with a coarse timeout. */
+		timer.setSlack(std::chrono::milliseconds(20));
+		timer.start(100);
+
+		dispatcher->processEvents();
+
+		if (timer.hasFailed() || timer.early()) {
+			cout << "Timer slack test failed" << endl;
+			return TestFail;
+		}
+
+		timer.setSlack(std::chrono::microseconds(0));
+
+		/* Test that timer expirations are accounted for in lateness. */
+		EventDispatcherEpoll *epoll = dynamic_cast<EventDispatcherEpoll *>(dispatcher);
+		if (epoll) {
+			uint64_t expired = 0;
+			for (uint64_t count : epoll->timers().lateness())
+				expired += count;
+
+			if (!expired) {
+				cout << "Timer lateness not recorded" << endl;
+				return TestFail;
+			}
+		}
+
 		return TestPass;
 	}
 
@@ -0,0 +1,141 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * tracer.cpp - Tracer test
+ */
+
+#include <fcntl.h>
+#include <iostream>
+#include <stdio.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "thread.h"
+#include "test.h"
+#include "tracer.h"
+
+using namespace std;
+using namespace libcamera;
+
+class RecordThread : public Thread
+{
+protected:
+	void run()
+	{
+		for (unsigned int i = 0; i < 100; ++i)
+			Tracer::instance()->record(TraceV4L2DequeueBuffer, 1, i);
+	}
+};
+
+class TracerTest : public Test
+{
+protected:
+	int run()
+	{
+		Tracer *tracer = Tracer::instance();
+		tracer->enable();
+
+		if (!tracer->enabled()) {
+			cout << "Failed to enable tracing" << endl;
+			return TestFail;
+		}
+
+		/* Record traces from two threads. */
+		RecordThread thread;
+		thread.start();
+
+		for (unsigned int i = 0; i < 100; ++i)
+			tracer->record(TraceV4L2QueueBuffer, 1, i);
+
+		thread.wait();
+
+		vector<TraceRecord> records = tracer->records();
+		if (records.size() != 200) {
+			cout << "Invalid number of records " << records.size()
+			     << endl;
+			return TestFail;
+		}
+
+		unsigned int queued = 0;
+		unsigned int dequeued = 0;
+		uint64_t timestamp = 0;
+
+		for (const TraceRecord &record : records) {
+			if (record.timestamp < timestamp) {
+				cout << "Records not sorted by timestamp" << endl;
+				return TestFail;
+			}
+			timestamp = record.timestamp;
+
+			unsigned int &index = record.id == TraceV4L2QueueBuffer
+					    ? queued : dequeued;
+			if (record.args[1] != index++) {
+				cout << "Records out of order" << endl;
+				return TestFail;
+			}
+		}
+
+		if (queued != 100 || dequeued != 100) {
+			cout << "Records lost" << endl;
+			return TestFail;
+		}
+
+		if (!Tracer::description(TraceTimelineAction) ||
+		    Tracer::description(TraceMax)) {
+			cout << "Invalid tracepoint descriptions" << endl;
+			return TestFail;
+		}
+
+		/* Test the startup profile, nested phases are indented. */
+		tracer->record(TraceCameraManagerStartBegin);
+		tracer->record(TracePipelineMatchBegin, 2);
+		tracer->record(TracePipelineMatchEnd, 2, 1);
+		tracer->record(TraceCameraManagerStartEnd, 1);
+		tracer->record(TracePipelineCompleteRequest, 1, 0);
+		tracer->record(TraceCameraStartBegin, 1);
+		tracer->record(TraceCameraStartEnd, 1);
+		tracer->record(TracePipelineCompleteRequest, 2, 0);
+
+		string profile = tracer->startupProfile();
+		if (profile.find(" camera_manager_start cameras=1\n") == string::npos ||
+		    profile.find("   pipeline_match factory=2 matched=1\n") == string::npos ||
+		    profile.find(" camera_start\n") == string::npos ||
+		    profile.find(" first_request_completed") == string::npos) {
+			cout << "Invalid startup profile" << endl << profile << endl;
+			return TestFail;
+		}
+
+		records = tracer->records();
+
+		/* Test writing the trace to a file. */
+		int fd = open("/tmp", O_TMPFILE | O_RDWR, S_IRUSR | S_IWUSR);
+		if (fd < 0) {
+			cout << "Failed to open trace file" << endl;
+			return TestFail;
+		}
+
+		char path[32];
+		snprintf(path, sizeof(path), "/proc/self/fd/%u", fd);
+
+		int ret = tracer->dump(path);
+		if (ret < 0) {
+			cout << "Failed to write trace file" << endl;
+			close(fd);
+			return TestFail;
+		}
+
+		struct stat st;
+		fstat(fd, &st);
+		close(fd);
+
+		if (static_cast<size_t>(st.st_size) < records.size() * sizeof(TraceRecord)) {
+			cout << "Trace file too small" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+};
+
+TEST_REGISTER(TracerTest)
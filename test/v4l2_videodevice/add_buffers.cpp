@@ -0,0 +1,123 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * libcamera V4L2 API tests
+ *
+ * Test adding buffers to a streaming video device
+ */
+
+#include <iostream>
+#include <set>
+
+#include <libcamera/buffer.h>
+#include <libcamera/event_dispatcher.h>
+#include <libcamera/timer.h>
+
+#include "thread.h"
+#include "v4l2_videodevice_test.h"
+
+class AddBuffersTest : public V4L2VideoDeviceTest
+{
+public:
+	AddBuffersTest()
+		: V4L2VideoDeviceTest("vimc", "Raw Capture 0"), frames_(0) {}
+
+	void receiveBuffer(FrameBuffer *buffer)
+	{
+		frames_++;
+		completed_.insert(buffer);
+
+		capture_->queueBuffer(buffer);
+	}
+
+protected:
+	int capture(unsigned int count)
+	{
+		EventDispatcher *dispatcher = Thread::current()->eventDispatcher();
+		Timer timeout;
+
+		frames_ = 0;
+		completed_.clear();
+
+		timeout.start(10000);
+		while (timeout.isRunning()) {
+			dispatcher->processEvents();
+			if (frames_ >= count)
+				return TestPass;
+		}
+
+		std::cout << "Failed to capture " << count
+			  << " frames within timeout" << std::endl;
+		return TestFail;
+	}
+
+	int run()
+	{
+		const unsigned int bufferCount = 4;
+		int ret;
+
+		ret = capture_->exportBuffers(bufferCount, &buffers_);
+		if (ret < 0)
+			return TestFail;
+
+		capture_->bufferReady.connect(this, &AddBuffersTest::receiveBuffer);
+
+		for (const std::unique_ptr<FrameBuffer> &buffer : buffers_) {
+			if (capture_->queueBuffer(buffer.get())) {
+				std::cout << "Failed to queue buffer" << std::endl;
+				return TestFail;
+			}
+		}
+
+		ret = capture_->streamOn();
+		if (ret)
+			return TestFail;
+
+		if (capture(bufferCount) != TestPass)
+			return TestFail;
+
+		/* Grow the pool while streaming and queue the new buffers. */
+		if (capture_->addBuffers(bufferCount) != -EINVAL) {
+			std::cout << "Imported buffers added to exporting device"
+				  << std::endl;
+			return TestFail;
+		}
+
+		ret = capture_->addBuffers(bufferCount, &buffers_);
+		if (ret != static_cast<int>(bufferCount)) {
+			std::cout << "Failed to add buffers" << std::endl;
+			return TestFail;
+		}
+
+		for (unsigned int i = bufferCount; i < buffers_.size(); ++i) {
+			if (capture_->queueBuffer(buffers_[i].get())) {
+				std::cout << "Failed to queue added buffer"
+					  << std::endl;
+				return TestFail;
+			}
+		}
+
+		if (capture(bufferCount * 4) != TestPass)
+			return TestFail;
+
+		if (completed_.size() != buffers_.size()) {
+			std::cout << "Only " << completed_.size() << " of "
+				  << buffers_.size() << " buffers completed"
+				  << std::endl;
+			return TestFail;
+		}
+
+		ret = capture_->streamOff();
+		if (ret)
+			return TestFail;
+
+		return TestPass;
+	}
+
+private:
+	unsigned int frames_;
+	std::set<FrameBuffer *> completed_;
+};
+
+TEST_REGISTER(AddBuffersTest);
@@ -0,0 +1,164 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * libcamera V4L2 API tests
+ *
+ * Test the V4L2BufferCache replacement policy and statistics
+ */
+
+#include <fcntl.h>
+#include <iostream>
+#include <memory>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+#include <libcamera/buffer.h>
+
+#include "test.h"
+
+#include "v4l2_videodevice.h"
+
+using namespace libcamera;
+
+class BufferCacheTest : public Test
+{
+protected:
+	int init()
+	{
+		for (unsigned int i = 0; i < 5; ++i) {
+			int fd = open("/tmp", O_TMPFILE | O_RDWR, S_IRUSR | S_IWUSR);
+			if (fd < 0)
+				return TestFail;
+
+			FrameBuffer::Plane plane;
+			plane.fd = FileDescriptor(fd);
+			plane.length = 4096;
+			close(fd);
+
+			buffers_.emplace_back(new FrameBuffer({ plane }));
+		}
+
+		return TestPass;
+	}
+
+	int checkStats(const V4L2BufferCache &cache, unsigned int hits,
+		       unsigned int misses, unsigned int evictions)
+	{
+		const V4L2BufferCache::Statistics &stats = cache.statistics();
+
+		if (stats.hits != hits || stats.misses != misses ||
+		    stats.evictions != evictions) {
+			std::cout << "Invalid statistics: " << stats.hits
+				  << " hits, " << stats.misses << " misses, "
+				  << stats.evictions << " evictions (expected "
+				  << hits << ", " << misses << ", "
+				  << evictions << ")" << std::endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+	int run()
+	{
+		V4L2BufferCache cache(4);
+		int index[5];
+
+		/* Fill the cache with the first four buffers. */
+		for (unsigned int i = 0; i < 4; ++i) {
+			index[i] = cache.get(*buffers_[i]);
+			if (index[i] < 0) {
+				std::cout << "Failed to get free entry" << std::endl;
+				return TestFail;
+			}
+		}
+
+		if (cache.get(*buffers_[4]) != -ENOENT) {
+			std::cout << "Cache should be full" << std::endl;
+			return TestFail;
+		}
+
+		if (checkStats(cache, 0, 5, 0) != TestPass)
+			return TestFail;
+
+		for (unsigned int i = 0; i < 4; ++i)
+			cache.put(index[i]);
+
+		/* Reuse the first two buffers, they must hit their entry. */
+		for (unsigned int i = 0; i < 2; ++i) {
+			if (cache.get(*buffers_[i]) != index[i]) {
+				std::cout << "Cache hit on wrong entry" << std::endl;
+				return TestFail;
+			}
+			cache.put(index[i]);
+		}
+
+		if (checkStats(cache, 2, 5, 0) != TestPass)
+			return TestFail;
+
+		/*
+		 * A new buffer must replace the least recently used entry, which
+		 * is the one of the third buffer.
+		 */
+		if (cache.get(*buffers_[4]) != index[2]) {
+			std::cout << "Least recently used entry not evicted"
+				  << std::endl;
+			return TestFail;
+		}
+		cache.put(index[2]);
+
+		if (checkStats(cache, 2, 6, 1) != TestPass)
+			return TestFail;
+
+		/* The first, second and fourth buffers must still hit. */
+		for (unsigned int i : { 0, 1, 3 }) {
+			if (cache.get(*buffers_[i]) != index[i]) {
+				std::cout << "Hot entry evicted" << std::endl;
+				return TestFail;
+			}
+			cache.put(index[i]);
+		}
+
+		if (checkStats(cache, 5, 6, 1) != TestPass)
+			return TestFail;
+
+		return grow();
+	}
+
+	int grow()
+	{
+		V4L2BufferCache cache(2);
+
+		for (unsigned int i = 0; i < 2; ++i)
+			cache.get(*buffers_[i]);
+
+		/*
+		 * Grow the cache with a gap, the entry in the gap must never be
+		 * used.
+		 */
+		cache.grow(3, 2);
+
+		for (unsigned int i = 2; i < 4; ++i) {
+			int index = cache.get(*buffers_[i]);
+			if (index != 3 && index != 4) {
+				std::cout << "Invalid entry " << index
+					  << " after growing" << std::endl;
+				return TestFail;
+			}
+		}
+
+		if (cache.get(*buffers_[4]) != -ENOENT) {
+			std::cout << "Grown cache should be full" << std::endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+private:
+	std::vector<std::unique_ptr<FrameBuffer>> buffers_;
+};
+
+TEST_REGISTER(BufferCacheTest);
@@ -18,7 +18,8 @@ class CaptureAsyncTest : public V4L2VideoDeviceTest
 {
 public:
 	CaptureAsyncTest()
-		: V4L2VideoDeviceTest("vimc", "Raw Capture 0"), frames(0) {}
+		: V4L2VideoDeviceTest("vimc", "Raw Capture 0"), frames(0),
+		  batchedFrames(0) {}
 
 	void receiveBuffer(FrameBuffer *buffer)
 	{
@@ -29,6 +30,11 @@ public:
 		capture_->queueBuffer(buffer);
 	}
 
+	void receiveBuffers(Span<FrameBuffer *> buffers)
+	{
+		batchedFrames += buffers.size();
+	}
+
 protected:
 	int run()
 	{
@@ -43,6 +49,7 @@ protected:
 			return TestFail;
 
 		capture_->bufferReady.connect(this, &CaptureAsyncTest::receiveBuffer);
+		capture_->buffersReady.connect(this, &CaptureAsyncTest::receiveBuffers);
 
 		for (const std::unique_ptr<FrameBuffer> &buffer : buffers_) {
 			if (capture_->queueBuffer(buffer.get())) {
@@ -72,6 +79,12 @@ protected:
 			return TestFail;
 		}
 
+		if (batchedFrames != frames) {
+			std::cout << "Batched buffers count " << batchedFrames
+				  << " doesn't match " << frames << std::endl;
+			return TestFail;
+		}
+
 		std::cout << "Processed " << frames << " frames" << std::endl;
 
 		ret = capture_->streamOff();
@@ -83,6 +96,7 @@ protected:
 
 private:
 	unsigned int frames;
+	unsigned int batchedFrames;
 };
 
 TEST_REGISTER(CaptureAsyncTest);
@@ -0,0 +1,109 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * libcamera V4L2 API tests
+ *
+ * Test capturing to buffers mapped without exporting dmabufs
+ */
+
+#include <iostream>
+
+#include <libcamera/buffer.h>
+#include <libcamera/event_dispatcher.h>
+#include <libcamera/timer.h>
+
+#include "thread.h"
+#include "v4l2_videodevice_test.h"
+
+class CaptureMmapTest : public V4L2VideoDeviceTest
+{
+public:
+	CaptureMmapTest()
+		: V4L2VideoDeviceTest("vimc", "Raw Capture 0"), frames_(0),
+		  error_(false) {}
+
+	void receiveBuffer(FrameBuffer *buffer)
+	{
+		const FrameMetadata &metadata = buffer->metadata();
+		if (metadata.status != FrameMetadata::FrameSuccess ||
+		    !metadata.planes()[0].bytesused)
+			error_ = true;
+
+		frames_++;
+		capture_->queueBuffer(buffer);
+	}
+
+protected:
+	int run()
+	{
+		const unsigned int bufferCount = 4;
+
+		EventDispatcher *dispatcher = Thread::current()->eventDispatcher();
+		Timer timeout;
+		int ret;
+
+		ret = capture_->allocateBuffers(bufferCount, &buffers_);
+		if (ret < 0) {
+			std::cout << "Failed to allocate buffers" << std::endl;
+			return TestFail;
+		}
+
+		for (const std::unique_ptr<FrameBuffer> &buffer : buffers_) {
+			if (buffer->memory() != FrameBuffer::MemoryMmap) {
+				std::cout << "Invalid buffer memory type" << std::endl;
+				return TestFail;
+			}
+
+			for (const FrameBuffer::Plane &plane : buffer->planes()) {
+				if (plane.fd.isValid() || !plane.address) {
+					std::cout << "Invalid buffer plane" << std::endl;
+					return TestFail;
+				}
+			}
+		}
+
+		capture_->bufferReady.connect(this, &CaptureMmapTest::receiveBuffer);
+
+		for (const std::unique_ptr<FrameBuffer> &buffer : buffers_) {
+			if (capture_->queueBuffer(buffer.get())) {
+				std::cout << "Failed to queue buffer" << std::endl;
+				return TestFail;
+			}
+		}
+
+		ret = capture_->streamOn();
+		if (ret)
+			return TestFail;
+
+		timeout.start(10000);
+		while (timeout.isRunning()) {
+			dispatcher->processEvents();
+			if (frames_ > 30)
+				break;
+		}
+
+		if (frames_ < 30) {
+			std::cout << "Failed to capture 30 frames within timeout"
+				  << std::endl;
+			return TestFail;
+		}
+
+		if (error_) {
+			std::cout << "Invalid frame captured" << std::endl;
+			return TestFail;
+		}
+
+		ret = capture_->streamOff();
+		if (ret)
+			return TestFail;
+
+		return TestPass;
+	}
+
+private:
+	unsigned int frames_;
+	bool error_;
+};
+
+TEST_REGISTER(CaptureMmapTest);
@@ -0,0 +1,135 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * libcamera V4L2 API tests
+ *
+ * Test capturing to user pointer buffers
+ */
+
+#include <iostream>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <libcamera/buffer.h>
+#include <libcamera/event_dispatcher.h>
+#include <libcamera/timer.h>
+
+#include "thread.h"
+#include "v4l2_videodevice_test.h"
+
+class CaptureUserPtrTest : public V4L2VideoDeviceTest
+{
+public:
+	CaptureUserPtrTest()
+		: V4L2VideoDeviceTest("vimc", "Raw Capture 0"), frames_(0),
+		  error_(false) {}
+
+	void receiveBuffer(FrameBuffer *buffer)
+	{
+		const FrameMetadata &metadata = buffer->metadata();
+		if (metadata.status != FrameMetadata::FrameSuccess ||
+		    !metadata.planes()[0].bytesused)
+			error_ = true;
+
+		frames_++;
+		capture_->queueBuffer(buffer);
+	}
+
+protected:
+	int run()
+	{
+		const unsigned int bufferCount = 4;
+
+		EventDispatcher *dispatcher = Thread::current()->eventDispatcher();
+		Timer timeout;
+		int ret;
+
+		V4L2DeviceFormat format = {};
+		if (capture_->getFormat(&format))
+			return TestFail;
+
+		ret = capture_->importBuffers(bufferCount, FrameBuffer::MemoryUserPtr);
+		if (ret == -EINVAL) {
+			std::cout << "User pointers not supported" << std::endl;
+			return TestSkip;
+		}
+		if (ret)
+			return TestFail;
+
+		/* Allocate page-aligned memory for each buffer. */
+		long pageSize = sysconf(_SC_PAGESIZE);
+		unsigned int length = format.planes[0].size;
+
+		for (unsigned int i = 0; i < bufferCount; ++i) {
+			void *address;
+			if (posix_memalign(&address, pageSize, length))
+				return TestFail;
+
+			memory_.push_back(address);
+
+			FrameBuffer::Plane plane;
+			plane.length = length;
+			plane.address = address;
+			buffers_.emplace_back(new FrameBuffer({ plane }));
+
+			if (buffers_.back()->memory() != FrameBuffer::MemoryUserPtr) {
+				std::cout << "Invalid buffer memory type" << std::endl;
+				return TestFail;
+			}
+		}
+
+		capture_->bufferReady.connect(this, &CaptureUserPtrTest::receiveBuffer);
+
+		for (const std::unique_ptr<FrameBuffer> &buffer : buffers_) {
+			if (capture_->queueBuffer(buffer.get())) {
+				std::cout << "Failed to queue buffer" << std::endl;
+				return TestFail;
+			}
+		}
+
+		ret = capture_->streamOn();
+		if (ret)
+			return TestFail;
+
+		timeout.start(10000);
+		while (timeout.isRunning()) {
+			dispatcher->processEvents();
+			if (frames_ > 30)
+				break;
+		}
+
+		if (frames_ < 30) {
+			std::cout << "Failed to capture 30 frames within timeout"
+				  << std::endl;
+			return TestFail;
+		}
+
+		if (error_) {
+			std::cout << "Invalid frame captured" << std::endl;
+			return TestFail;
+		}
+
+		ret = capture_->streamOff();
+		if (ret)
+			return TestFail;
+
+		return TestPass;
+	}
+
+	void cleanup()
+	{
+		V4L2VideoDeviceTest::cleanup();
+
+		for (void *address : memory_)
+			free(address);
+	}
+
+private:
+	unsigned int frames_;
+	bool error_;
+	std::vector<void *> memory_;
+};
+
+TEST_REGISTER(CaptureUserPtrTest);
@@ -0,0 +1,102 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * control_writer.cpp - V4L2 control writer test
+ */
+
+#include <iostream>
+
+#include "v4l2_control_writer.h"
+#include "v4l2_videodevice.h"
+
+#include "v4l2_videodevice_test.h"
+
+using namespace std;
+using namespace libcamera;
+
+class V4L2ControlWriterTest : public V4L2VideoDeviceTest
+{
+public:
+	V4L2ControlWriterTest()
+		: V4L2VideoDeviceTest("vivid", "vivid-000-vid-cap")
+	{
+	}
+
+protected:
+	int readBrightness()
+	{
+		ControlList ctrls(capture_->controls());
+		ctrls.set(V4L2_CID_BRIGHTNESS, 0);
+		if (capture_->getControls(&ctrls))
+			return -1;
+
+		return ctrls.get(V4L2_CID_BRIGHTNESS).get<int32_t>();
+	}
+
+	int writeBrightness(int32_t value)
+	{
+		ControlList ctrls(capture_->controls());
+		ctrls.set(V4L2_CID_BRIGHTNESS, value);
+		return capture_->setControls(&ctrls);
+	}
+
+	int run()
+	{
+		V4L2ControlWriter writer(capture_);
+		ControlList ctrls(capture_->controls());
+
+		/* Test that a changed value is written. */
+		ctrls.set(V4L2_CID_BRIGHTNESS, 10);
+		if (writer.write(ctrls) || readBrightness() != 10) {
+			cerr << "Failed to write control" << endl;
+			return TestFail;
+		}
+
+		/*
+		 * Modify the control behind the writer's back, writing the same
+		 * value again shall be skipped.
+		 */
+		if (writeBrightness(20))
+			return TestFail;
+
+		if (writer.write(ctrls) || readBrightness() != 20) {
+			cerr << "Unchanged control written" << endl;
+			return TestFail;
+		}
+
+		/* Test that reset() forgets the values last written. */
+		writer.reset();
+		if (writer.write(ctrls) || readBrightness() != 10) {
+			cerr << "Control not written after reset" << endl;
+			return TestFail;
+		}
+
+		/* Test deferred writes. */
+		writer.setDeferred(true, "test:controls");
+
+		for (int32_t value = 30; value < 40; ++value) {
+			ctrls.set(V4L2_CID_BRIGHTNESS, value);
+			if (writer.write(ctrls)) {
+				cerr << "Failed to queue deferred write" << endl;
+				return TestFail;
+			}
+		}
+
+		writer.flush();
+		if (readBrightness() != 39) {
+			cerr << "Deferred writes not applied in order" << endl;
+			return TestFail;
+		}
+
+		writer.setDeferred(false);
+		if (writer.deferred()) {
+			cerr << "Failed to disable deferred writes" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+};
+
+TEST_REGISTER(V4L2ControlWriterTest);
@@ -0,0 +1,133 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * libcamera V4L2 API tests
+ *
+ * Verify that queuing and dequeuing buffers doesn't allocate memory in steady
+ * state
+ */
+
+#include <atomic>
+#include <iostream>
+#include <new>
+#include <stdlib.h>
+
+#include <libcamera/buffer.h>
+#include <libcamera/event_dispatcher.h>
+#include <libcamera/timer.h>
+
+#include "thread.h"
+#include "v4l2_videodevice_test.h"
+
+static std::atomic<bool> countAllocations(false);
+static std::atomic<unsigned int> allocations(0);
+
+void *operator new(std::size_t size)
+{
+	if (countAllocations)
+		allocations++;
+
+	void *ptr = malloc(size ? size : 1);
+	if (!ptr)
+		throw std::bad_alloc();
+
+	return ptr;
+}
+
+void operator delete(void *ptr) noexcept
+{
+	free(ptr);
+}
+
+void operator delete(void *ptr, std::size_t size) noexcept
+{
+	free(ptr);
+}
+
+class QueueAllocationsTest : public V4L2VideoDeviceTest
+{
+public:
+	QueueAllocationsTest()
+		: V4L2VideoDeviceTest("vimc", "Raw Capture 0"), frames_(0)
+	{
+	}
+
+	void receiveBuffer(FrameBuffer *buffer)
+	{
+		frames_++;
+
+		/*
+		 * Start counting allocations once all the buffers have gone
+		 * through the device at least once. Counting then covers the
+		 * full cycle of requeuing buffers, waiting for them in the
+		 * event loop, dequeuing them and emitting the bufferReady
+		 * signal.
+		 */
+		if (frames_ == buffers_.size() + 1) {
+			allocations = 0;
+			countAllocations = true;
+		}
+
+		capture_->queueBuffer(buffer);
+	}
+
+protected:
+	int run()
+	{
+		const unsigned int bufferCount = 8;
+
+		EventDispatcher *dispatcher = Thread::current()->eventDispatcher();
+		Timer timeout;
+		int ret;
+
+		ret = capture_->exportBuffers(bufferCount, &buffers_);
+		if (ret < 0)
+			return TestFail;
+
+		capture_->bufferReady.connect(this, &QueueAllocationsTest::receiveBuffer);
+
+		for (const std::unique_ptr<FrameBuffer> &buffer : buffers_) {
+			if (capture_->queueBuffer(buffer.get())) {
+				std::cout << "Failed to queue buffer" << std::endl;
+				return TestFail;
+			}
+		}
+
+		ret = capture_->streamOn();
+		if (ret)
+			return TestFail;
+
+		timeout.start(10000);
+		while (timeout.isRunning()) {
+			dispatcher->processEvents();
+			if (frames_ > 30)
+				break;
+		}
+
+		countAllocations = false;
+
+		ret = capture_->streamOff();
+		if (ret)
+			return TestFail;
+
+		if (frames_ < 30) {
+			std::cout << "Failed to capture 30 frames within timeout." << std::endl;
+			return TestFail;
+		}
+
+		if (allocations) {
+			std::cout << allocations
+				  << " allocations when queuing and dequeuing buffers"
+				  << std::endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+private:
+	unsigned int frames_;
+};
+
+TEST_REGISTER(QueueAllocationsTest);
@@ -0,0 +1,106 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * worker-pool.cpp - Worker pool test
+ */
+
+#include <atomic>
+#include <chrono>
+#include <iostream>
+
+#include <libcamera/event_dispatcher.h>
+#include <libcamera/timer.h>
+
+#include "thread.h"
+#include "test.h"
+#include "worker_pool.h"
+
+using namespace std;
+using namespace libcamera;
+
+class CompletionReceiver : public Object
+{
+public:
+	CompletionReceiver()
+		: completed_(0), invalidThread_(false)
+	{
+	}
+
+	unsigned int completed() const { return completed_; }
+	bool invalidThread() const { return invalidThread_; }
+
+	void taskCompleted(unsigned int index)
+	{
+		if (thread() != Thread::current())
+			invalidThread_ = true;
+
+		completed_++;
+	}
+
+private:
+	unsigned int completed_;
+	bool invalidThread_;
+};
+
+class WorkerPoolTest : public Test
+{
+protected:
+	int run()
+	{
+		static constexpr unsigned int tasks = 1000;
+
+		WorkerPool pool(4);
+		if (pool.workers() != 4) {
+			cout << "Invalid number of workers" << endl;
+			return TestFail;
+		}
+
+		/* Test task execution, including tasks queued from tasks. */
+		std::atomic<unsigned int> executed(0);
+
+		for (unsigned int i = 0; i < tasks; ++i) {
+			pool.run([&pool, &executed]() {
+				executed++;
+				pool.run([&executed]() { executed++; });
+			});
+		}
+
+		pool.wait();
+
+		if (executed != 2 * tasks) {
+			cout << "Executed " << executed << " of " << 2 * tasks
+			     << " tasks" << endl;
+			return TestFail;
+		}
+
+		/* Test completion notification in the receiver's thread. */
+		CompletionReceiver receiver;
+
+		for (unsigned int i = 0; i < tasks; ++i)
+			pool.run([]() {}, &receiver,
+				 &CompletionReceiver::taskCompleted, i);
+
+		EventDispatcher *dispatcher = Thread::current()->eventDispatcher();
+		Timer timeout;
+
+		timeout.start(1000);
+		while (timeout.isRunning() && receiver.completed() < tasks)
+			dispatcher->processEvents();
+
+		if (receiver.completed() != tasks) {
+			cout << "Received " << receiver.completed() << " of "
+			     << tasks << " completions" << endl;
+			return TestFail;
+		}
+
+		if (receiver.invalidThread()) {
+			cout << "Completion received in incorrect thread" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+};
+
+TEST_REGISTER(WorkerPoolTest)
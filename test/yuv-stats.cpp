@@ -0,0 +1,252 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * yuv-stats.cpp - YuvStatsEngine test
+ */
+
+#include <iostream>
+#include <memory>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <vector>
+
+#include <linux/drm_fourcc.h>
+
+#include <libcamera/buffer.h>
+#include <libcamera/mapped_framebuffer.h>
+
+#include "utils.h"
+#include "yuv_stats.h"
+
+#include "test.h"
+
+using namespace std;
+using namespace libcamera;
+
+namespace {
+
+struct YuvFormat {
+	PixelFormat format;
+	bool packed;
+	unsigned int vertSubSampling;
+	/* Byte offsets of Y0, Cb, Y1 and Cr in a pixel pair. */
+	unsigned int offsets[4];
+};
+
+const YuvFormat yuvFormats[] = {
+	{ DRM_FORMAT_NV12, false, 2, { 0, 0, 1, 1 } },
+	{ DRM_FORMAT_NV21, false, 2, { 0, 1, 1, 0 } },
+	{ DRM_FORMAT_NV16, false, 1, { 0, 0, 1, 1 } },
+	{ DRM_FORMAT_YUYV, true, 1, { 0, 1, 2, 3 } },
+	{ DRM_FORMAT_UYVY, true, 1, { 1, 0, 3, 2 } },
+	{ DRM_FORMAT_VYUY, true, 1, { 1, 2, 3, 0 } },
+};
+
+constexpr unsigned int Width = 320;
+constexpr unsigned int Height = 240;
+
+/* A scene with constant components within each zone of the grid. */
+uint8_t sceneLuma(unsigned int col, unsigned int row)
+{
+	return 16 + col * 8 + row * 4;
+}
+
+uint8_t sceneCb(unsigned int col, unsigned int row)
+{
+	return 64 + col * 4;
+}
+
+uint8_t sceneCr(unsigned int col, unsigned int row)
+{
+	return 192 - row * 4;
+}
+
+} /* namespace */
+
+class YuvStatsTest : public Test
+{
+protected:
+	void fillFrame(const YuvFormat &format, unsigned int stride, uint8_t *y,
+		       uint8_t *uv)
+	{
+		const unsigned int zoneWidth = Width / YuvStats::GridWidth;
+		const unsigned int zoneHeight = Height / YuvStats::GridHeight;
+
+		for (unsigned int line = 0; line < Height; ++line) {
+			unsigned int row = line / zoneHeight;
+
+			for (unsigned int x = 0; x < Width; x += 2) {
+				unsigned int col = x / zoneWidth;
+				uint8_t luma = sceneLuma(col, row);
+
+				if (format.packed) {
+					uint8_t *pixel = y + line * stride + x * 2;
+					pixel[format.offsets[0]] = luma;
+					pixel[format.offsets[1]] = sceneCb(col, row);
+					pixel[format.offsets[2]] = luma;
+					pixel[format.offsets[3]] = sceneCr(col, row);
+				} else {
+					uint8_t *chroma = uv + line / format.vertSubSampling * stride + x;
+					y[line * stride + x] = luma;
+					y[line * stride + x + 1] = luma;
+					chroma[format.offsets[1]] = sceneCb(col, row);
+					chroma[format.offsets[3]] = sceneCr(col, row);
+				}
+			}
+		}
+	}
+
+	int checkStats(const YuvStats &stats, unsigned int step)
+	{
+		for (unsigned int row = 0; row < YuvStats::GridHeight; ++row) {
+			for (unsigned int col = 0; col < YuvStats::GridWidth; ++col) {
+				unsigned int zone = row * YuvStats::GridWidth + col;
+
+				if (stats.luminance[zone] != sceneLuma(col, row) ||
+				    stats.cb[zone] != sceneCb(col, row) ||
+				    stats.cr[zone] != sceneCr(col, row)) {
+					cerr << "Invalid zone " << col << "x" << row
+					     << ": " << static_cast<unsigned int>(stats.luminance[zone])
+					     << " " << static_cast<unsigned int>(stats.cb[zone])
+					     << " " << static_cast<unsigned int>(stats.cr[zone])
+					     << endl;
+					return TestFail;
+				}
+			}
+		}
+
+		/* The luma values of the first zone row map to distinct bins. */
+		unsigned int samples = 0;
+		for (uint32_t count : stats.histogram)
+			samples += count;
+
+		unsigned int expected = (Height + step - 1) / step *
+					((Width + step - 1) / step);
+		if (samples != expected) {
+			cerr << "Invalid histogram, " << samples << " samples, "
+			     << expected << " expected" << endl;
+			return TestFail;
+		}
+
+		if (!stats.histogram[sceneLuma(0, 0) / 4] ||
+		    stats.histogram[0] || stats.histogram[YuvStats::HistogramBins - 1]) {
+			cerr << "Invalid histogram distribution" << endl;
+			return TestFail;
+		}
+
+		return TestPass;
+	}
+
+	int testFormat(const YuvFormat &format)
+	{
+		/* Pad the lines to catch stride handling errors. */
+		unsigned int stride = Width * (format.packed ? 2 : 1) + 64;
+		unsigned int chromaLines = format.packed ? 0 : Height / format.vertSubSampling;
+		vector<uint8_t> frame(stride * (Height + chromaLines), 0xff);
+		uint8_t *y = frame.data();
+		uint8_t *uv = y + stride * Height;
+
+		fillFrame(format, stride, y, uv);
+
+		for (unsigned int threads : { 1, 0 }) {
+			for (unsigned int step : { 1, 2, 3 }) {
+				YuvStatsEngine engine(threads);
+				YuvStats stats;
+
+				int ret = engine.configure(format.format, { Width, Height },
+							   stride, step);
+				if (ret) {
+					cerr << "Failed to configure format "
+					     << utils::hex(format.format) << endl;
+					return TestFail;
+				}
+
+				engine.process(y, uv, &stats);
+
+				if (checkStats(stats, step) != TestPass) {
+					cerr << "Format " << utils::hex(format.format)
+					     << ", threads " << threads << ", step "
+					     << step << endl;
+					return TestFail;
+				}
+			}
+		}
+
+		return TestPass;
+	}
+
+	int testBuffer()
+	{
+		const YuvFormat &format = yuvFormats[0];
+		unsigned int length = Width * Height * 3 / 2;
+
+		int fd = memfd_create("yuv-stats-test", 0);
+		if (fd < 0 || ftruncate(fd, length) < 0) {
+			if (fd >= 0)
+				close(fd);
+			cerr << "Failed to allocate buffer" << endl;
+			return TestFail;
+		}
+
+		FrameBuffer::Plane plane;
+		plane.fd = FileDescriptor(fd);
+		plane.length = length;
+		close(fd);
+
+		FrameBuffer buffer({ plane });
+
+		{
+			MappedFrameBuffer mapped(&buffer, MappedFrameBuffer::MapWrite);
+			if (!mapped.isValid()) {
+				cerr << "Failed to map buffer" << endl;
+				return TestFail;
+			}
+
+			uint8_t *data = mapped.planes()[0].data;
+			fillFrame(format, Width, data, data + Width * Height);
+		}
+
+		YuvStatsEngine engine;
+		YuvStats stats;
+
+		if (engine.configure(format.format, { Width, Height }, Width) ||
+		    engine.process(&buffer, &stats)) {
+			cerr << "Failed to process buffer" << endl;
+			return TestFail;
+		}
+
+		engine.clear();
+
+		return checkStats(stats, 2);
+	}
+
+	int run()
+	{
+		for (const YuvFormat &format : yuvFormats) {
+			if (!YuvStatsEngine::isSupported(format.format)) {
+				cerr << "Format " << utils::hex(format.format)
+				     << " not supported" << endl;
+				return TestFail;
+			}
+
+			int ret = testFormat(format);
+			if (ret != TestPass)
+				return ret;
+		}
+
+		/* Formats without luma, and odd widths, are rejected. */
+		YuvStatsEngine engine;
+		if (YuvStatsEngine::isSupported(DRM_FORMAT_BGR888) ||
+		    !engine.configure(DRM_FORMAT_YUYV, { Width + 1, Height },
+				      Width * 2 + 2)) {
+			cerr << "Invalid format accepted" << endl;
+			return TestFail;
+		}
+
+		return testBuffer();
+	}
+};
+
+TEST_REGISTER(YuvStatsTest)
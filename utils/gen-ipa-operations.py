@@ -0,0 +1,232 @@
+#!/usr/bin/env python3
+# SPDX-License-Identifier: GPL-2.0-or-later
+# Copyright (C) 2020, Google Inc.
+#
+# gen-ipa-operations.py - Generate typed IPA operations from YAML
+
+import argparse
+import re
+import string
+import sys
+import yaml
+
+
+# Scalar field types, with their C++ type and conversions to and from the
+# 32-bit words of IPAOperationData::data.
+scalar_types = {
+    'uint32': ('uint32_t', '${value}', '${word}'),
+    'int32': ('int32_t', 'static_cast<uint32_t>(${value})', 'static_cast<int32_t>(${word})'),
+    'bool': ('bool', 'static_cast<uint32_t>(${value})', '${word} != 0'),
+}
+
+
+def snake_case(s):
+    return re.sub(r'(?<=[a-z])(?=[A-Z])|(?<=[0-9A-Z])(?=[A-Z][a-z])', '_', s)
+
+
+def format_comment(text, indent=''):
+    lines = text.strip('\n').split('\n')
+    if len(lines) == 1 and len(indent) * 8 + len(lines[0]) < 74:
+        return indent + '/* ' + lines[0] + ' */'
+    lines = [indent + (line and ' * ' or ' *') + line for line in lines]
+    return '\n'.join([indent + '/*'] + lines + [indent + ' */'])
+
+
+def c_literal(field, value):
+    if field['type'] == 'bool':
+        return value and 'true' or 'false'
+    return str(value)
+
+
+class Operation(object):
+    def __init__(self, interface, prefix, name, data):
+        self.name = name
+        self.struct = interface + name
+        self.enum = prefix + snake_case(name).upper()
+        self.id = data['id']
+        self.description = data['description']
+        self.scalars = []
+        self.lists = []
+
+        for field in data.get('fields', []):
+            fname, field = field.popitem()
+            field['name'] = fname
+
+            if field['type'] == 'ControlList':
+                fields = self.lists
+            elif field['type'] in scalar_types:
+                fields = self.scalars
+            else:
+                raise RuntimeError('Unknown type %s for field %s of %s' %
+                                   (field['type'], fname, name))
+
+            # Optional fields shall come last, to keep the layout fixed.
+            optional = field['type'] == 'ControlList' and field.get('optional', False) \
+                or 'default' in field
+            if fields and fields[-1]['optional'] and not optional:
+                raise RuntimeError('Mandatory field %s of %s follows optional fields' %
+                                   (fname, name))
+            field['optional'] = optional
+
+            fields.append(field)
+
+    def generate(self):
+        members = []
+        pack = []
+        unpack = []
+
+        for field in self.scalars + self.lists:
+            members.append(format_comment(field['description'], '\t'))
+            if field['type'] == 'ControlList':
+                members.append('\tconst ControlList *%s = nullptr;' % field['name'])
+            else:
+                ctype = scalar_types[field['type']][0]
+                default = c_literal(field, field.get('default', 0))
+                members.append('\t%s %s = %s;' % (ctype, field['name'], default))
+
+        for index, field in enumerate(self.scalars):
+            to_word = string.Template(scalar_types[field['type']][1])
+            pack.append('\t\top.data[%u] = %s;' %
+                        (index, to_word.substitute(value=field['name'])))
+
+            from_word = string.Template(scalar_types[field['type']][2])
+            value = from_word.substitute(word='op.data[%u]' % index)
+            if field['optional']:
+                value = 'op.data.size() > %u ? %s : %s' % \
+                    (index, value, c_literal(field, field['default']))
+            unpack.append('\t\t%s = %s;' % (field['name'], value))
+
+        for index, field in enumerate(self.lists):
+            if field['optional']:
+                pack.append('\t\tif (%s)' % field['name'])
+                pack.append('\t\t\top.controls.push_back(*%s);' % field['name'])
+                unpack.append('\t\t%s = op.controls.size() > %u ? &op.controls[%u] : nullptr;' %
+                              (field['name'], index, index))
+            else:
+                pack.append('\t\top.controls.push_back(*%s);' % field['name'])
+                unpack.append('\t\t%s = &op.controls[%u];' % (field['name'], index))
+
+        if self.scalars:
+            pack.insert(0, '\t\top.data.resize(DataSize);')
+        if self.lists:
+            pack.insert(len(self.scalars) and 1 + len(self.scalars) or 0,
+                        '\t\top.controls.reserve(ControlsSize);')
+
+        # Skip the size checks that can't fail, to avoid type limits warnings.
+        data_size = len(self.scalars)
+        min_data_size = len([f for f in self.scalars if not f['optional']])
+        controls_size = len(self.lists)
+        min_controls_size = len([f for f in self.lists if not f['optional']])
+
+        checks = ['op.operation != Operation']
+        if min_data_size:
+            checks.append('op.data.size() < MinDataSize')
+        checks.append('op.data.size() > DataSize')
+        if min_controls_size:
+            checks.append('op.controls.size() < MinControlsSize')
+        checks.append('op.controls.size() > ControlsSize')
+
+        info = {
+            'description': format_comment(self.description),
+            'struct': self.struct,
+            'enum': self.enum,
+            'data_size': data_size,
+            'min_data_size': min_data_size,
+            'controls_size': controls_size,
+            'min_controls_size': min_controls_size,
+            'members': ''.join([m + '\n' for m in members]) + (members and '\n' or ''),
+            'pack': ''.join([p + '\n' for p in pack]),
+            'checks': ' ||\n\t\t    '.join(checks),
+            'unpack': ''.join([u + '\n' for u in unpack]) + (unpack and '\n' or ''),
+        }
+
+        template = string.Template('''${description}
+struct ${struct} {
+	static constexpr unsigned int Operation = ${enum};
+	static constexpr unsigned int DataSize = ${data_size};
+	static constexpr unsigned int MinDataSize = ${min_data_size};
+	static constexpr unsigned int ControlsSize = ${controls_size};
+	static constexpr unsigned int MinControlsSize = ${min_controls_size};
+
+${members}	IPAOperationData pack() const
+	{
+		IPAOperationData op;
+		op.operation = Operation;
+${pack}
+		return op;
+	}
+
+	int unpack(const IPAOperationData &op)
+	{
+		if (${checks})
+			return -EINVAL;
+
+${unpack}		return 0;
+	}
+};''')
+
+        return template.substitute(info)
+
+
+def generate_h(data, output):
+    interface = data['interface']
+    prefix = data['prefix']
+
+    operations = []
+    for op in data['operations']:
+        name, op = op.popitem()
+        operations.append(Operation(interface, prefix, name, op))
+
+    ids = ['\t%s = %u,' % (op.enum, op.id) for op in operations]
+    structs = [op.generate() for op in operations]
+
+    header = output.split('/')[-1] if output else interface.lower() + '.h'
+
+    return {
+        'header': header,
+        'guard': interface.upper(),
+        'interface': interface,
+        'description': format_comment(data['description']),
+        'ids': '\n'.join(ids),
+        'operations': '\n\n'.join(structs),
+    }
+
+
+def fill_template(template, data):
+
+    template = open(template, 'rb').read()
+    template = template.decode('utf-8')
+    template = string.Template(template)
+    return template.substitute(data)
+
+
+def main(argv):
+
+    # Parse command line arguments
+    parser = argparse.ArgumentParser()
+    parser.add_argument('-o', dest='output', metavar='file', type=str,
+                        help='Output file name. Defaults to standard output if not specified.')
+    parser.add_argument('input', type=str,
+                        help='Input file name.')
+    parser.add_argument('template', type=str,
+                        help='Template file name.')
+    args = parser.parse_args(argv[1:])
+
+    data = open(args.input, 'rb').read()
+    data = yaml.safe_load(data)
+
+    data = generate_h(data, args.output)
+    data = fill_template(args.template, data)
+
+    if args.output:
+        output = open(args.output, 'wb')
+        output.write(data.encode('utf-8'))
+        output.close()
+    else:
+        sys.stdout.write(data)
+
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main(sys.argv))
@@ -0,0 +1,407 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2020, Google Inc.
+ *
+ * rkisp1-replay.cpp - Replay a recording of RkISP1 statistics through the IPA
+ *
+ * Recordings are captured by setting the LIBCAMERA_RKISP1_RECORD environment
+ * variable to a file path when running a libcamera application. The replay
+ * feeds the recorded statistics to an IPA module as fast as possible, or at
+ * the capture rate with --realtime, and prints the actions the IPA emits for
+ * each frame. The output is stable across runs and can be diffed to catch
+ * regressions in the algorithms. Latency statistics are printed on stderr.
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <errno.h>
+#include <getopt.h>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#include <linux/rkisp1-config.h>
+
+#include <ipa/ipa_interface.h>
+#include <ipa/rkisp1.h>
+#include <libcamera/buffer.h>
+#include <libcamera/control_ids.h>
+#include <libcamera/mapped_framebuffer.h>
+
+#include "ipa_context_wrapper.h"
+#include "ipa_module.h"
+#include "ipa_recording.h"
+
+using namespace libcamera;
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+struct Options {
+	bool realtime = false;
+	bool latency = false;
+	bool sensor = false;
+	const char *module = nullptr;
+	const char *recording = nullptr;
+};
+
+enum BufferId {
+	ParamsBufferId = 1,
+	StatsBufferId = 2,
+};
+
+void usage(const char *argv0)
+{
+	std::cerr
+		<< "Usage: " << argv0 << " [options] <ipa-module> <recording>" << std::endl
+		<< std::endl
+		<< "Options:" << std::endl
+		<< "  -r, --realtime   Replay frames at the rate they were captured" << std::endl
+		<< "  -l, --latency    Print the per-frame processing latency" << std::endl
+		<< "  -s, --sensor     Print the recorded sensor controls" << std::endl
+		<< "  -h, --help       Display this help message" << std::endl;
+}
+
+int parseOptions(int argc, char *argv[], Options *options)
+{
+	static const struct option longOptions[] = {
+		{ "realtime", no_argument, nullptr, 'r' },
+		{ "latency", no_argument, nullptr, 'l' },
+		{ "sensor", no_argument, nullptr, 's' },
+		{ "help", no_argument, nullptr, 'h' },
+		{ nullptr, 0, nullptr, 0 },
+	};
+
+	int c;
+	while ((c = getopt_long(argc, argv, "rlsh", longOptions, nullptr)) != -1) {
+		switch (c) {
+		case 'r':
+			options->realtime = true;
+			break;
+		case 'l':
+			options->latency = true;
+			break;
+		case 's':
+			options->sensor = true;
+			break;
+		case 'h':
+		default:
+			usage(argv[0]);
+			return -EINVAL;
+		}
+	}
+
+	if (argc - optind != 2) {
+		usage(argv[0]);
+		return -EINVAL;
+	}
+
+	options->module = argv[optind];
+	options->recording = argv[optind + 1];
+
+	return 0;
+}
+
+std::unique_ptr<FrameBuffer> createBuffer(size_t size)
+{
+	int fd = memfd_create("rkisp1-replay", 0);
+	if (fd < 0)
+		return nullptr;
+
+	if (ftruncate(fd, size) < 0) {
+		close(fd);
+		return nullptr;
+	}
+
+	FrameBuffer::Plane plane;
+	plane.fd = FileDescriptor(fd);
+	plane.length = size;
+	close(fd);
+
+	return std::make_unique<FrameBuffer>(std::vector<FrameBuffer::Plane>{ plane });
+}
+
+/* Print controls by name when known, and by numerical ID otherwise. */
+std::string toString(const ControlList &list)
+{
+	std::ostringstream ss;
+
+	for (const auto &ctrl : list) {
+		auto id = controls::controls.find(ctrl.first);
+		if (!list.infoMap() && id != controls::controls.end())
+			ss << " " << id->second->name();
+		else
+			ss << " 0x" << std::hex << std::setw(8) << std::setfill('0')
+			   << ctrl.first << std::dec;
+
+		ss << "=" << ctrl.second.toString();
+	}
+
+	return ss.str();
+}
+
+/* FNV-1a hash, to compare parameters buffers in a compact form. */
+uint32_t hash(const uint8_t *data, size_t size)
+{
+	uint32_t value = 2166136261U;
+
+	for (size_t i = 0; i < size; ++i)
+		value = (value ^ data[i]) * 16777619U;
+
+	return value;
+}
+
+class Replay
+{
+public:
+	Replay(const Options &options);
+
+	int init();
+	int run();
+
+private:
+	void queueFrameAction(unsigned int frame, const IPAOperationData &action);
+	void printLatency(const char *name, std::vector<double> &latencies);
+
+	const Options &options_;
+
+	std::unique_ptr<IPAModule> module_;
+	std::unique_ptr<IPAInterface> ipa_;
+	IPARecordingReader reader_;
+
+	std::unique_ptr<FrameBuffer> params_;
+	std::unique_ptr<FrameBuffer> stats_;
+	std::unique_ptr<MappedFrameBuffer> paramsMemory_;
+	std::unique_ptr<MappedFrameBuffer> statsMemory_;
+};
+
+Replay::Replay(const Options &options)
+	: options_(options)
+{
+}
+
+int Replay::init()
+{
+	int ret = reader_.open(options_.recording);
+	if (ret < 0)
+		return ret;
+
+	module_ = std::make_unique<IPAModule>(options_.module);
+	if (!module_->isValid() || !module_->load()) {
+		std::cerr << "Failed to load IPA module " << options_.module
+			  << std::endl;
+		return -EINVAL;
+	}
+
+	struct ipa_context *ctx = module_->createContext();
+	if (!ctx) {
+		std::cerr << "Failed to create IPA context" << std::endl;
+		return -EINVAL;
+	}
+
+	ipa_ = std::make_unique<IPAContextWrapper>(ctx);
+	ipa_->queueFrameAction.connect(this, &Replay::queueFrameAction);
+
+	ret = ipa_->init();
+	if (ret < 0)
+		return ret;
+
+	params_ = createBuffer(sizeof(rkisp1_isp_params_cfg));
+	stats_ = createBuffer(sizeof(rkisp1_stat_buffer));
+	if (!params_ || !stats_) {
+		std::cerr << "Failed to allocate buffers" << std::endl;
+		return -ENOMEM;
+	}
+
+	paramsMemory_ = std::make_unique<MappedFrameBuffer>(params_.get());
+	statsMemory_ = std::make_unique<MappedFrameBuffer>(stats_.get(),
+							   MappedFrameBuffer::MapWrite);
+	if (!paramsMemory_->isValid() || !statsMemory_->isValid()) {
+		std::cerr << "Failed to map buffers" << std::endl;
+		return -ENOMEM;
+	}
+
+	std::vector<IPABuffer> buffers = {
+		{ ParamsBufferId, { params_->planes()[0] } },
+		{ StatsBufferId, { stats_->planes()[0] } },
+	};
+	ipa_->mapBuffers(buffers);
+
+	std::map<unsigned int, IPAStream> streamConfig;
+	streamConfig[0] = reader_.stream();
+
+	std::map<unsigned int, const ControlInfoMap &> entityControls;
+	entityControls.emplace(0, reader_.sensorControls());
+
+	ipa_->configure(streamConfig, entityControls);
+
+	return 0;
+}
+
+int Replay::run()
+{
+	std::vector<double> prepareLatencies;
+	std::vector<double> processLatencies;
+	IPARecordingFrame frame;
+	uint64_t firstTimestamp = 0;
+	int ret;
+
+	Clock::time_point start = Clock::now();
+
+	while (!(ret = reader_.next(&frame))) {
+		if (prepareLatencies.empty())
+			firstTimestamp = frame.timestamp;
+
+		if (options_.realtime)
+			std::this_thread::sleep_until(start +
+				std::chrono::nanoseconds(frame.timestamp - firstTimestamp));
+
+		if (options_.sensor)
+			std::cout << frame.sequence << " SENSOR"
+				  << toString(frame.sensorControls) << std::endl;
+
+		/*
+		 * Queue the request for the frame and signal its statistics
+		 * back to back. The pipeline handler queues requests a few
+		 * frames ahead, the IPA doesn't depend on that ordering.
+		 */
+		ControlList requestControls(controls::controls);
+
+		RkISP1EventQueueRequest request;
+		request.frame = frame.sequence;
+		request.bufferId = ParamsBufferId;
+		request.controls = &requestControls;
+		IPAOperationData op = request.pack();
+
+		Clock::time_point begin = Clock::now();
+		ipa_->processEvent(op);
+		Clock::time_point end = Clock::now();
+		prepareLatencies.push_back(std::chrono::duration<double, std::micro>(end - begin).count());
+
+		const MappedFrameBuffer::Plane &plane = statsMemory_->planes()[0];
+		size_t size = std::min(frame.stats.size(), plane.length);
+		memcpy(plane.data, frame.stats.data(), size);
+		memset(plane.data + size, 0, plane.length - size);
+
+		RkISP1EventSignalStatBuffer stat;
+		stat.frame = frame.sequence;
+		stat.bufferId = StatsBufferId;
+		stat.sensorControls = &frame.sensorControls;
+		op = stat.pack();
+
+		begin = Clock::now();
+		ipa_->processEvent(op);
+		end = Clock::now();
+		processLatencies.push_back(std::chrono::duration<double, std::micro>(end - begin).count());
+
+		if (options_.latency)
+			std::cout << frame.sequence << " LATENCY "
+				  << std::fixed << std::setprecision(1)
+				  << prepareLatencies.back() << "us "
+				  << processLatencies.back() << "us"
+				  << std::defaultfloat << std::endl;
+	}
+
+	if (ret != -ENODATA)
+		return ret;
+
+	double elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+
+	std::cerr << prepareLatencies.size() << " frames replayed in "
+		  << std::fixed << std::setprecision(3) << elapsed << "s"
+		  << std::endl;
+
+	printLatency("prepare", prepareLatencies);
+	printLatency("process", processLatencies);
+
+	return 0;
+}
+
+void Replay::queueFrameAction(unsigned int frame, const IPAOperationData &action)
+{
+	switch (action.operation) {
+	case RKISP1_IPA_ACTION_V4L2_SET: {
+		RkISP1ActionV4L2Set set;
+		if (set.unpack(action))
+			break;
+
+		std::cout << frame << " V4L2_SET" << toString(*set.sensorControls)
+			  << std::endl;
+		break;
+	}
+
+	case RKISP1_IPA_ACTION_PARAM_FILLED: {
+		const MappedFrameBuffer::Plane &plane = paramsMemory_->planes()[0];
+		std::cout << frame << " PARAM_FILLED " << std::hex
+			  << std::setw(8) << std::setfill('0')
+			  << hash(plane.data, plane.length) << std::dec
+			  << std::endl;
+		break;
+	}
+
+	case RKISP1_IPA_ACTION_METADATA: {
+		RkISP1ActionMetadata metadata;
+		if (metadata.unpack(action))
+			break;
+
+		std::cout << frame << " METADATA" << toString(*metadata.metadata)
+			  << std::endl;
+		break;
+	}
+
+	default:
+		std::cout << frame << " UNKNOWN " << action.operation << std::endl;
+		break;
+	}
+}
+
+void Replay::printLatency(const char *name, std::vector<double> &latencies)
+{
+	if (latencies.empty())
+		return;
+
+	std::sort(latencies.begin(), latencies.end());
+
+	double sum = 0.0;
+	for (double latency : latencies)
+		sum += latency;
+
+	std::cerr << std::fixed << std::setprecision(1) << name << ": "
+		  << "min " << latencies.front() << "us, "
+		  << "avg " << sum / latencies.size() << "us, "
+		  << "p99 " << latencies[latencies.size() * 99 / 100] << "us, "
+		  << "max " << latencies.back() << "us" << std::endl;
+}
+
+} /* namespace */
+
+int main(int argc, char *argv[])
+{
+	Options options;
+
+	if (parseOptions(argc, argv, &options))
+		return EXIT_FAILURE;
+
+	Replay replay(options);
+
+	int ret = replay.init();
+	if (ret < 0)
+		return EXIT_FAILURE;
+
+	ret = replay.run();
+	if (ret < 0) {
+		std::cerr << "Replay failed: " << strerror(-ret) << std::endl;
+		return EXIT_FAILURE;
+	}
+
+	return 0;
+}
@@ -0,0 +1,93 @@
+#!/usr/bin/python3
+# SPDX-License-Identifier: GPL-2.0-or-later
+# Copyright (C) 2020, Google Inc.
+#
+# trace-to-json.py - Convert a libcamera trace file to the JSON trace format
+#
+# The output can be loaded in trace viewers that support the JSON trace event
+# format, such as Perfetto (https://ui.perfetto.dev) or chrome://tracing.
+
+import argparse
+import json
+import struct
+import sys
+
+HEADER = struct.Struct('<8sIIIIQ')
+RECORD = struct.Struct('<QIHH4Q')
+MAGIC = b'LCTRACE1'
+
+
+def parse_chunk(data, offset, events):
+    magic, pid, num_tracepoints, descriptions_size, record_size, num_records = \
+        HEADER.unpack_from(data, offset)
+    if magic != MAGIC:
+        raise ValueError('Invalid trace chunk at offset %u' % offset)
+    if record_size != RECORD.size:
+        raise ValueError('Unsupported record size %u' % record_size)
+
+    offset += HEADER.size
+    descriptions = data[offset:offset + descriptions_size].decode('ascii')
+    offset += descriptions_size
+
+    tracepoints = [d.split(' ') for d in descriptions.split('\0')[:num_tracepoints]]
+
+    for i in range(num_records):
+        timestamp, tid, tp_id, _, *args = RECORD.unpack_from(data, offset)
+        offset += RECORD.size
+
+        if tp_id >= len(tracepoints):
+            continue
+
+        name, phase, *arg_names = tracepoints[tp_id]
+        event = {
+            'name': name,
+            'cat': 'libcamera',
+            'ph': phase,
+            'ts': timestamp / 1000,
+            'pid': pid,
+            'tid': tid,
+            'args': dict(zip(arg_names, args)),
+        }
+
+        if phase in ('b', 'e'):
+            # Spans are identified by their first argument, and named after
+            # the tracepoint that begins them.
+            event['id'] = hex(args[0])
+            event['name'] = 'request'
+        elif phase == 'i':
+            event['s'] = 't'
+
+        events.append(event)
+
+    return offset
+
+
+def main(argv):
+    parser = argparse.ArgumentParser()
+    parser.add_argument('-o', dest='output', metavar='file', type=str,
+                        help='Output file name. Defaults to standard output if not specified.')
+    parser.add_argument('input', type=str,
+                        help='Input trace file name.')
+    args = parser.parse_args(argv[1:])
+
+    with open(args.input, 'rb') as f:
+        data = f.read()
+
+    events = []
+    offset = 0
+    while offset < len(data):
+        offset = parse_chunk(data, offset, events)
+
+    trace = json.dumps({'traceEvents': events, 'displayTimeUnit': 'ns'})
+
+    if args.output:
+        with open(args.output, 'w') as f:
+            f.write(trace)
+    else:
+        sys.stdout.write(trace)
+
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main(sys.argv))